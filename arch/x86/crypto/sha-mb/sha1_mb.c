@@ -470,7 +470,8 @@ static void sha1_mb_add_list(struct mcryptd_hash_request_ctx *rctx,
 			     struct mcryptd_alg_cstate *cstate)
 {
 	unsigned long next_flush;
-	unsigned long delay = usecs_to_jiffies(FLUSH_INTERVAL);
+	unsigned long delay = mcryptd_flush_delay(FLUSH_INTERVAL);
+	struct mcryptd_hash_request_ctx *prev;
 
 	/* initialize tag */
 	rctx->tag.arrival = jiffies;    /* tag the arrival time */
@@ -479,6 +480,16 @@ static void sha1_mb_add_list(struct mcryptd_hash_request_ctx *rctx,
 	rctx->tag.expire = next_flush;
 
 	spin_lock(&cstate->work_lock);
+	/*
+	 * The flusher only looks at the head of the list, keep the
+	 * deadlines in order when this one is shorter than the ones
+	 * queued before it.
+	 */
+	list_for_each_entry_reverse(prev, &cstate->work_list, waiter) {
+		if (!time_after(prev->tag.expire, next_flush))
+			break;
+		prev->tag.expire = next_flush;
+	}
 	list_add_tail(&rctx->waiter, &cstate->work_list);
 	spin_unlock(&cstate->work_lock);
 
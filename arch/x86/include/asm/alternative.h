@@ -271,4 +271,16 @@ extern void *text_poke(void *addr, const void *opcode, size_t len);
 extern int poke_int3_handler(struct pt_regs *regs);
 extern void *text_poke_bp(void *addr, const void *opcode, size_t len, void *handler);
 
+#define POKE_MAX_OPCODE_SIZE	5
+
+/* One site patched by text_poke_bp_batch() */
+struct text_poke_loc {
+	void *addr;
+	void *handler;
+	size_t len;
+	u8 opcode[POKE_MAX_OPCODE_SIZE];
+};
+
+extern void text_poke_bp_batch(struct text_poke_loc *tp, unsigned int nr_entries);
+
 #endif /* _ASM_X86_ALTERNATIVE_H */
@@ -11,6 +11,8 @@
 #include <linux/stop_machine.h>
 #include <linux/slab.h>
 #include <linux/kdebug.h>
+#include <linux/bsearch.h>
+#include <linux/sort.h>
 #include <asm/alternative.h>
 #include <asm/sections.h>
 #include <asm/pgtable.h>
@@ -727,54 +729,102 @@ static void do_sync_core(void *info)
 }
 
 static bool bp_patching_in_progress;
-static void *bp_int3_handler, *bp_int3_addr;
+static struct text_poke_loc *bp_vec;
+static unsigned int bp_vec_nr;
+
+static int patch_cmp(const void *key, const void *elt)
+{
+	const struct text_poke_loc *tp = elt;
+
+	if (key < tp->addr)
+		return -1;
+	if (key > tp->addr)
+		return 1;
+	return 0;
+}
+
+static int patch_sort_cmp(const void *a, const void *b)
+{
+	const struct text_poke_loc *tp_a = a, *tp_b = b;
+
+	return patch_cmp(tp_a->addr, tp_b);
+}
 
 int poke_int3_handler(struct pt_regs *regs)
 {
+	struct text_poke_loc *tp;
+	void *ip;
+
 	/* bp_patching_in_progress */
 	smp_rmb();
 
 	if (likely(!bp_patching_in_progress))
 		return 0;
 
-	if (user_mode(regs) || regs->ip != (unsigned long)bp_int3_addr)
+	if (user_mode(regs))
 		return 0;
 
+	/* the trap left ip just past the int3 */
+	ip = (void *)regs->ip - sizeof(unsigned char);
+
+	if (bp_vec_nr == 1) {
+		tp = bp_vec;
+		if (ip != tp->addr)
+			return 0;
+	} else {
+		tp = bsearch(ip, bp_vec, bp_vec_nr, sizeof(*bp_vec),
+			     patch_cmp);
+		if (!tp)
+			return 0;
+	}
+
 	/* set up the specified breakpoint handler */
-	regs->ip = (unsigned long) bp_int3_handler;
+	regs->ip = (unsigned long) tp->handler;
 
 	return 1;
 
 }
 
 /**
- * text_poke_bp() -- update instructions on live kernel on SMP
- * @addr:	address to patch
- * @opcode:	opcode of new instruction
- * @len:	length to copy
- * @handler:	address to jump to when the temporary breakpoint is hit
+ * text_poke_bp_batch() -- update instructions on live kernel on SMP
+ * @tp:		vector of instructions to patch
+ * @nr_entries:	number of entries in the vector
  *
- * Modify multi-byte instruction by using int3 breakpoint on SMP.
+ * Modify multi-byte instructions by using int3 breakpoints on SMP.
  * We completely avoid stop_machine() here, and achieve the
- * synchronization using int3 breakpoint.
+ * synchronization using int3 breakpoints.
  *
  * The way it is done:
- *	- add a int3 trap to the address that will be patched
+ *	- add an int3 trap to each address that will be patched
  *	- sync cores
- *	- update all but the first byte of the patched range
+ *	- update all but the first byte of each patched range
  *	- sync cores
- *	- replace the first byte (int3) by the first byte of
- *	  replacing opcode
+ *	- replace the first byte (int3) of each by the first byte of
+ *	  its replacing opcode
  *	- sync cores
  *
+ * However many sites there are, that's three rounds of IPIs, where
+ * patching them one by one with text_poke_bp() costs three each.
+ * Any int3 hit on one of the sites meanwhile goes to its handler.
+ *
+ * The vector is sorted by address in place.
+ *
  * Note: must be called under text_mutex.
  */
-void *text_poke_bp(void *addr, const void *opcode, size_t len, void *handler)
+void text_poke_bp_batch(struct text_poke_loc *tp, unsigned int nr_entries)
 {
 	unsigned char int3 = 0xcc;
+	bool do_sync = false;
+	unsigned int i;
+
+	if (!nr_entries)
+		return;
+
+	if (nr_entries > 1)
+		sort(tp, nr_entries, sizeof(*tp), patch_sort_cmp, NULL);
 
-	bp_int3_handler = handler;
-	bp_int3_addr = (u8 *)addr + sizeof(int3);
+	bp_vec = tp;
+	bp_vec_nr = nr_entries;
 	bp_patching_in_progress = true;
 	/*
 	 * Corresponding read barrier in int3 notifier for
@@ -783,30 +833,63 @@ void *text_poke_bp(void *addr, const void *opcode, size_t len, void *handler)
 	 */
 	smp_wmb();
 
-	text_poke(addr, &int3, sizeof(int3));
+	for (i = 0; i < nr_entries; i++)
+		text_poke(tp[i].addr, &int3, sizeof(int3));
 
 	on_each_cpu(do_sync_core, NULL, 1);
 
-	if (len - sizeof(int3) > 0) {
-		/* patch all but the first byte */
-		text_poke((char *)addr + sizeof(int3),
-			  (const char *) opcode + sizeof(int3),
-			  len - sizeof(int3));
-		/*
-		 * According to Intel, this core syncing is very likely
-		 * not necessary and we'd be safe even without it. But
-		 * better safe than sorry (plus there's not only Intel).
-		 */
-		on_each_cpu(do_sync_core, NULL, 1);
+	/* patch all but the first byte */
+	for (i = 0; i < nr_entries; i++) {
+		if (tp[i].len - sizeof(int3) > 0) {
+			text_poke((char *)tp[i].addr + sizeof(int3),
+				  (const char *)tp[i].opcode + sizeof(int3),
+				  tp[i].len - sizeof(int3));
+			do_sync = true;
+		}
 	}
 
+	/*
+	 * According to Intel, this core syncing is very likely
+	 * not necessary and we'd be safe even without it. But
+	 * better safe than sorry (plus there's not only Intel).
+	 */
+	if (do_sync)
+		on_each_cpu(do_sync_core, NULL, 1);
+
 	/* patch the first byte */
-	text_poke(addr, opcode, sizeof(int3));
+	for (i = 0; i < nr_entries; i++)
+		text_poke(tp[i].addr, tp[i].opcode, sizeof(int3));
 
 	on_each_cpu(do_sync_core, NULL, 1);
 
 	bp_patching_in_progress = false;
 	smp_wmb();
+}
+
+/**
+ * text_poke_bp() -- update instructions on live kernel on SMP
+ * @addr:	address to patch
+ * @opcode:	opcode of new instruction
+ * @len:	length to copy
+ * @handler:	address to jump to when the temporary breakpoint is hit
+ *
+ * A single site version of text_poke_bp_batch().
+ *
+ * Note: must be called under text_mutex.
+ */
+void *text_poke_bp(void *addr, const void *opcode, size_t len, void *handler)
+{
+	struct text_poke_loc tp = {
+		.addr = addr,
+		.handler = handler,
+		.len = len,
+	};
+
+	if (WARN_ON_ONCE(len > POKE_MAX_OPCODE_SIZE))
+		return NULL;
+
+	memcpy(tp.opcode, opcode, len);
+	text_poke_bp_batch(&tp, 1);
 
 	return addr;
 }
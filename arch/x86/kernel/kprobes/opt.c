@@ -377,6 +377,44 @@ int arch_prepare_optimized_kprobe(struct optimized_kprobe *op,
 	return 0;
 }
 
+/*
+ * Probes are (un)optimized in batches of up to this many, patched with
+ * a single text_poke_bp_batch(), i.e. one round of core syncing for all
+ * of them instead of one per probe.
+ */
+#define MAX_OPTIMIZE_PROBES	256
+
+/* Protected by text_mutex */
+static struct text_poke_loc opt_poke_vec[MAX_OPTIMIZE_PROBES];
+
+static void setup_optimize_kprobe(struct text_poke_loc *tp,
+				  struct optimized_kprobe *op)
+{
+	s32 rel = (s32)((long)op->optinsn.insn -
+			((long)op->kp.addr + RELATIVEJUMP_SIZE));
+
+	/* Backup instructions which will be replaced by jump address */
+	memcpy(op->optinsn.copied_insn, op->kp.addr + INT3_SIZE,
+	       RELATIVE_ADDR_SIZE);
+
+	tp->addr = op->kp.addr;
+	tp->handler = op->optinsn.insn;
+	tp->len = RELATIVEJUMP_SIZE;
+	tp->opcode[0] = RELATIVEJUMP_OPCODE;
+	*(s32 *)(&tp->opcode[1]) = rel;
+}
+
+static void setup_unoptimize_kprobe(struct text_poke_loc *tp,
+				    struct optimized_kprobe *op)
+{
+	tp->addr = op->kp.addr;
+	tp->handler = op->optinsn.insn;
+	tp->len = RELATIVEJUMP_SIZE;
+	/* Set int3 to first byte for kprobes */
+	tp->opcode[0] = BREAKPOINT_INSTRUCTION;
+	memcpy(tp->opcode + 1, op->optinsn.copied_insn, RELATIVE_ADDR_SIZE);
+}
+
 /*
  * Replace breakpoints (int3) with relative jumps.
  * Caller must call with locking kprobe_mutex and text_mutex.
@@ -384,53 +422,53 @@ int arch_prepare_optimized_kprobe(struct optimized_kprobe *op,
 void arch_optimize_kprobes(struct list_head *oplist)
 {
 	struct optimized_kprobe *op, *tmp;
-	u8 insn_buf[RELATIVEJUMP_SIZE];
+	unsigned int c = 0;
 
 	list_for_each_entry_safe(op, tmp, oplist, list) {
-		s32 rel = (s32)((long)op->optinsn.insn -
-			((long)op->kp.addr + RELATIVEJUMP_SIZE));
-
 		WARN_ON(kprobe_disabled(&op->kp));
 
-		/* Backup instructions which will be replaced by jump address */
-		memcpy(op->optinsn.copied_insn, op->kp.addr + INT3_SIZE,
-		       RELATIVE_ADDR_SIZE);
-
-		insn_buf[0] = RELATIVEJUMP_OPCODE;
-		*(s32 *)(&insn_buf[1]) = rel;
-
-		text_poke_bp(op->kp.addr, insn_buf, RELATIVEJUMP_SIZE,
-			     op->optinsn.insn);
-
+		setup_optimize_kprobe(&opt_poke_vec[c], op);
 		list_del_init(&op->list);
+
+		if (++c == MAX_OPTIMIZE_PROBES) {
+			text_poke_bp_batch(opt_poke_vec, c);
+			c = 0;
+		}
 	}
+
+	text_poke_bp_batch(opt_poke_vec, c);
 }
 
 /* Replace a relative jump with a breakpoint (int3).  */
 void arch_unoptimize_kprobe(struct optimized_kprobe *op)
 {
-	u8 insn_buf[RELATIVEJUMP_SIZE];
+	struct text_poke_loc tp;
 
-	/* Set int3 to first byte for kprobes */
-	insn_buf[0] = BREAKPOINT_INSTRUCTION;
-	memcpy(insn_buf + 1, op->optinsn.copied_insn, RELATIVE_ADDR_SIZE);
-	text_poke_bp(op->kp.addr, insn_buf, RELATIVEJUMP_SIZE,
-		     op->optinsn.insn);
+	setup_unoptimize_kprobe(&tp, op);
+	text_poke_bp_batch(&tp, 1);
 }
 
 /*
  * Recover original instructions and breakpoints from relative jumps.
- * Caller must call with locking kprobe_mutex.
+ * Caller must call with locking kprobe_mutex and text_mutex.
  */
 extern void arch_unoptimize_kprobes(struct list_head *oplist,
 				    struct list_head *done_list)
 {
 	struct optimized_kprobe *op, *tmp;
+	unsigned int c = 0;
 
 	list_for_each_entry_safe(op, tmp, oplist, list) {
-		arch_unoptimize_kprobe(op);
+		setup_unoptimize_kprobe(&opt_poke_vec[c], op);
 		list_move(&op->list, done_list);
+
+		if (++c == MAX_OPTIMIZE_PROBES) {
+			text_poke_bp_batch(opt_poke_vec, c);
+			c = 0;
+		}
 	}
+
+	text_poke_bp_batch(opt_poke_vec, c);
 }
 
 int setup_detour_execution(struct kprobe *p, struct pt_regs *regs, int reenter)
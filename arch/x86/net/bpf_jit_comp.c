@@ -182,6 +182,7 @@ static void jit_fill_hole(void *area, unsigned int size)
 struct jit_context {
 	int cleanup_addr; /* epilogue code offset */
 	bool seen_ld_abs;
+	unsigned long *func_starts; /* insns that BPF_CALL_ARGS call */
 };
 
 /* maximum number of bytes emitted while JITing one eBPF insn */
@@ -363,6 +364,12 @@ static int do_jit(struct bpf_prog *bpf_prog, int *addrs, u8 *image,
 		int ilen;
 		u8 *func;
 
+		/* functions called from within the program set up a stack
+		 * frame of their own, and leave through the shared epilogue
+		 */
+		if (ctx->func_starts && test_bit(i, ctx->func_starts))
+			emit_prologue(&prog);
+
 		switch (insn->code) {
 			/* ALU */
 		case BPF_ALU | BPF_ADD | BPF_X:
@@ -845,6 +852,14 @@ xadd:			if (is_imm8(insn->off))
 			emit_bpf_tail_call(&prog);
 			break;
 
+		case BPF_JMP | BPF_CALL_ARGS:
+			/* the callee's code, prologue first, starts where
+			 * the insn before it ends
+			 */
+			jmp_offset = addrs[i + imm32] - addrs[i];
+			EMIT1_off32(0xE8, jmp_offset);
+			break;
+
 			/* cond jump */
 		case BPF_JMP | BPF_JEQ | BPF_X:
 		case BPF_JMP | BPF_JNE | BPF_X:
@@ -1063,6 +1078,19 @@ void bpf_int_jit_compile(struct bpf_prog *prog)
 	if (!addrs)
 		return;
 
+	for (i = 0; i < prog->len; i++) {
+		if (prog->insnsi[i].code != (BPF_JMP | BPF_CALL_ARGS))
+			continue;
+		if (!ctx.func_starts) {
+			ctx.func_starts = kcalloc(BITS_TO_LONGS(prog->len),
+						  sizeof(unsigned long),
+						  GFP_KERNEL);
+			if (!ctx.func_starts)
+				goto out;
+		}
+		__set_bit(i + prog->insnsi[i].imm + 1, ctx.func_starts);
+	}
+
 	/* Before first pass, make a rough estimation of addrs[]
 	 * each bpf instruction is translated to less than 64 bytes
 	 */
@@ -1112,6 +1140,7 @@ void bpf_int_jit_compile(struct bpf_prog *prog)
 		prog->jited = 1;
 	}
 out:
+	kfree(ctx.func_starts);
 	kfree(addrs);
 }
 
@@ -868,6 +868,7 @@ static int blkcg_print_stat(struct seq_file *sf, void *v)
 		const char *dname;
 		struct blkg_rwstat rwstat;
 		u64 rbytes, wbytes, rios, wios;
+		int i;
 
 		dname = blkg_dev_name(blkg);
 		if (!dname)
@@ -885,11 +886,20 @@ static int blkcg_print_stat(struct seq_file *sf, void *v)
 		rios = atomic64_read(&rwstat.aux_cnt[BLKG_RWSTAT_READ]);
 		wios = atomic64_read(&rwstat.aux_cnt[BLKG_RWSTAT_WRITE]);
 
-		spin_unlock_irq(blkg->q->queue_lock);
-
-		if (rbytes || wbytes || rios || wios)
-			seq_printf(sf, "%s rbytes=%llu wbytes=%llu rios=%llu wios=%llu\n",
+		if (rbytes || wbytes || rios || wios) {
+			seq_printf(sf, "%s rbytes=%llu wbytes=%llu rios=%llu wios=%llu",
 				   dname, rbytes, wbytes, rios, wios);
+
+			for (i = 0; i < BLKCG_MAX_POLS; i++) {
+				struct blkcg_policy *pol = blkcg_policy[i];
+
+				if (pol && blkg->pd[i] && pol->pd_stat_fn)
+					pol->pd_stat_fn(blkg->pd[i], sf);
+			}
+			seq_putc(sf, '\n');
+		}
+
+		spin_unlock_irq(blkg->q->queue_lock);
 	}
 
 	rcu_read_unlock();
@@ -1078,6 +1088,11 @@ int blkcg_init_queue(struct request_queue *q)
 	q->root_rl.blkg = blkg;
 
 	ret = blk_throtl_init(q);
+	if (!ret) {
+		ret = blk_iolatency_init(q);
+		if (ret)
+			blk_throtl_exit(q);
+	}
 	if (ret) {
 		spin_lock_irq(q->queue_lock);
 		blkg_destroy_all(q);
@@ -1118,6 +1133,7 @@ void blkcg_exit_queue(struct request_queue *q)
 	blkg_destroy_all(q);
 	spin_unlock_irq(q->queue_lock);
 
+	blk_iolatency_exit(q);
 	blk_throtl_exit(q);
 }
 
@@ -406,7 +406,7 @@ static void __blk_drain_queue(struct request_queue *q, bool drain_all)
 		 * The caller might be trying to drain @q before its
 		 * elevator is initialized.
 		 */
-		if (q->elevator)
+		if (q->elevator && !q->mq_ops)
 			elv_drain_elevator(q);
 
 		blkcg_drain_queue(q);
@@ -703,6 +703,7 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	q->backing_dev_info.capabilities = BDI_CAP_CGROUP_WRITEBACK;
 	q->backing_dev_info.name = "block";
 	q->node = node_id;
+	q->poll_nsec = -1;
 
 	err = bdi_init(&q->backing_dev_info);
 	if (err)
@@ -1469,6 +1470,8 @@ void __blk_put_request(struct request_queue *q, struct request *req)
 	}
 
 	blk_pm_put_request(req);
+	wbt_rq_done(req);
+	blk_iolatency_rq_done(req);
 
 	elv_completed_request(q, req);
 
@@ -1704,6 +1707,8 @@ static blk_qc_t blk_queue_bio(struct request_queue *q, struct bio *bio)
 	int el_ret, rw_flags, where = ELEVATOR_INSERT_SORT;
 	struct request *req;
 	unsigned int request_count = 0;
+	struct blkcg_gq *lat_blkg;
+	bool wb_acct;
 
 	/*
 	 * low level driver can indicate that it wants pages above a
@@ -1720,6 +1725,9 @@ static blk_qc_t blk_queue_bio(struct request_queue *q, struct bio *bio)
 		return BLK_QC_T_NONE;
 	}
 
+	lat_blkg = blk_iolatency_wait(q, bio);
+	wb_acct = wbt_wait(q, bio);
+
 	if (bio->bi_rw & (REQ_FLUSH | REQ_FUA)) {
 		spin_lock_irq(q->queue_lock);
 		where = ELEVATOR_INSERT_FLUSH;
@@ -1731,8 +1739,12 @@ static blk_qc_t blk_queue_bio(struct request_queue *q, struct bio *bio)
 	 * any locks.
 	 */
 	if (!blk_queue_nomerges(q)) {
-		if (blk_attempt_plug_merge(q, bio, &request_count, NULL))
+		if (blk_attempt_plug_merge(q, bio, &request_count, NULL)) {
+			if (wb_acct)
+				wbt_done(q);
+			blk_iolatency_done(lat_blkg);
 			return BLK_QC_T_NONE;
+		}
 	} else
 		request_count = blk_plug_queued_count(q);
 
@@ -1783,6 +1795,10 @@ get_rq:
 	 * often, and the elevators are able to handle it.
 	 */
 	init_request_from_bio(req, bio);
+	wbt_track(req, wb_acct);
+	blk_iolatency_track(req, lat_blkg);
+	wb_acct = false;
+	lat_blkg = NULL;
 
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags))
 		req->cpu = raw_smp_processor_id();
@@ -1811,6 +1827,11 @@ out_unlock:
 		spin_unlock_irq(q->queue_lock);
 	}
 
+	/* Merged, or failed to get a request */
+	if (wb_acct)
+		wbt_done(q);
+	blk_iolatency_done(lat_blkg);
+
 	return BLK_QC_T_NONE;
 }
 
@@ -2062,7 +2083,8 @@ blk_qc_t generic_make_request(struct bio *bio)
 
 		if (likely(blk_queue_enter(q, __GFP_DIRECT_RECLAIM) == 0)) {
 
-			ret = q->make_request_fn(q, bio);
+			if (blk_crypto_submit_bio(&bio))
+				ret = q->make_request_fn(q, bio);
 
 			blk_queue_exit(q);
 
@@ -2512,6 +2534,8 @@ void blk_start_request(struct request *req)
 
 	BUG_ON(test_bit(REQ_ATOM_COMPLETE, &req->atomic_flags));
 	blk_add_timer(req);
+	wbt_issue(req);
+	blk_iolatency_issue(req);
 }
 EXPORT_SYMBOL(blk_start_request);
 
@@ -2735,6 +2759,7 @@ void blk_finish_request(struct request *req, int error)
 		blk_unprep_request(req);
 
 	blk_account_io_done(req);
+	wbt_complete(req);
 
 	if (req->end_io)
 		req->end_io(req, error);
@@ -3338,6 +3363,17 @@ bool blk_poll(struct request_queue *q, blk_qc_t cookie)
 		blk_flush_plug_list(plug, false);
 
 	state = current->state;
+	if (q->poll_nsec >= 0) {
+		struct blk_mq_hw_ctx *hctx;
+		struct request *rq;
+
+		hctx = q->queue_hw_ctx[blk_qc_t_to_queue_num(cookie)];
+		rq = blk_mq_tag_to_rq(hctx->tags, blk_qc_t_to_tag(cookie));
+		/* The caller checks its condition again before spinning */
+		if (rq && blk_mq_poll_hybrid_sleep(q, hctx, rq))
+			return true;
+	}
+
 	while (!need_resched()) {
 		unsigned int queue_num = blk_qc_t_to_queue_num(cookie);
 		struct blk_mq_hw_ctx *hctx = q->queue_hw_ctx[queue_num];
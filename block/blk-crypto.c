@@ -0,0 +1,496 @@
+/*
+ * Block layer encryption contexts and their software fallback
+ *
+ * Copyright (C) 2026
+ *
+ * A bio carrying a struct bio_crypt_ctx is passed through untouched to a
+ * queue whose inline encryption engine supports the key's mode and data
+ * unit size.  For any other queue the data is en/decrypted here using
+ * the kernel crypto API:
+ *
+ *  - writes are encrypted by the submitting task into bounce pages, so
+ *    the page cache keeps the plaintext and concurrent writers encrypt
+ *    in parallel on their own CPUs;
+ *  - reads are decrypted in place once they complete, from an unbound
+ *    workqueue so that completions spread over all CPUs.
+ *
+ * The context is dropped from a read bio before it goes down the stack,
+ * so a lower device never applies it a second time.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-crypto.h>
+#include <linux/mempool.h>
+#include <linux/slab.h>
+#include <linux/scatterlist.h>
+#include <linux/workqueue.h>
+#include <crypto/skcipher.h>
+
+#define BIO_CRYPT_CTX_POOL_SIZE		128
+#define BLK_CRYPTO_BOUNCE_POOL_SIZE	32
+#define BLK_CRYPTO_READ_POOL_SIZE	32
+
+static const struct blk_crypto_mode {
+	const char *cipher_str;
+	unsigned int keysize;
+	unsigned int ivsize;
+} blk_crypto_modes[] = {
+	[BLK_ENCRYPTION_MODE_AES_256_XTS] = {
+		.cipher_str = "xts(aes)",
+		.keysize = 64,
+		.ivsize = 16,
+	},
+};
+
+/* what a read needs to be decrypted and completed */
+struct blk_crypto_read_ctx {
+	struct bio_crypt_ctx	crypt_ctx;
+	struct bvec_iter	crypt_iter;
+	bio_end_io_t		*bi_end_io;
+	void			*bi_private;
+	struct bio		*bio;
+	struct work_struct	work;
+};
+
+struct blk_crypto_result {
+	struct completion	completion;
+	int			err;
+};
+
+static struct kmem_cache *bio_crypt_ctx_cache;
+static mempool_t *bio_crypt_ctx_pool;
+static struct kmem_cache *blk_crypto_read_ctx_cache;
+static mempool_t *blk_crypto_read_ctx_pool;
+static mempool_t *blk_crypto_bounce_page_pool;
+static struct bio_set *blk_crypto_bio_set;
+static struct workqueue_struct *blk_crypto_wq;
+
+/**
+ * blk_crypto_init_key - prepare a key for use with bios
+ * @key: the key to initialize
+ * @raw: the raw key material
+ * @size: size of @raw in bytes, must match the mode
+ * @mode: the encryption mode
+ * @data_unit_size: the data unit size, a power of two between 512 bytes
+ *	and the page size
+ */
+int blk_crypto_init_key(struct blk_crypto_key *key, const u8 *raw,
+			unsigned int size, enum blk_crypto_mode_num mode,
+			unsigned int data_unit_size)
+{
+	if (mode <= BLK_ENCRYPTION_MODE_INVALID ||
+	    mode >= BLK_ENCRYPTION_MODE_MAX)
+		return -EINVAL;
+	if (size != blk_crypto_modes[mode].keysize)
+		return -EINVAL;
+	if (!is_power_of_2(data_unit_size) || data_unit_size < 512 ||
+	    data_unit_size > PAGE_SIZE)
+		return -EINVAL;
+
+	memset(key, 0, sizeof(*key));
+	key->mode = mode;
+	key->data_unit_size = data_unit_size;
+	key->data_unit_shift = ilog2(data_unit_size);
+	key->size = size;
+	memcpy(key->raw, raw, size);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(blk_crypto_init_key);
+
+/**
+ * blk_crypto_start_using_key - get ready to submit bios with @key to @q
+ * @key: an initialized key
+ * @q: the queue the bios will be submitted to
+ *
+ * Sets up the software fallback for @key unless @q does the encryption
+ * itself.  May sleep, and must be called before the first bio using
+ * @key is submitted.
+ */
+int blk_crypto_start_using_key(struct blk_crypto_key *key,
+			       struct request_queue *q)
+{
+	struct crypto_skcipher *tfm;
+	int err;
+
+	if (blk_queue_crypto_supported(q, key->mode, key->data_unit_size))
+		return 0;
+	if (key->fallback_tfm)
+		return 0;
+
+	tfm = crypto_alloc_skcipher(blk_crypto_modes[key->mode].cipher_str,
+				    0, 0);
+	if (IS_ERR(tfm))
+		return PTR_ERR(tfm);
+
+	crypto_skcipher_set_flags(tfm, CRYPTO_TFM_REQ_WEAK_KEY);
+	err = crypto_skcipher_setkey(tfm, key->raw, key->size);
+	if (err) {
+		crypto_free_skcipher(tfm);
+		return err;
+	}
+
+	key->fallback_tfm = tfm;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(blk_crypto_start_using_key);
+
+/**
+ * blk_crypto_free_key - release a key
+ * @key: the key, no bio may refer to it anymore
+ */
+void blk_crypto_free_key(struct blk_crypto_key *key)
+{
+	if (key->fallback_tfm)
+		crypto_free_skcipher(key->fallback_tfm);
+	memzero_explicit(key, sizeof(*key));
+}
+EXPORT_SYMBOL_GPL(blk_crypto_free_key);
+
+/**
+ * blk_queue_crypto_modes - set the inline encryption capabilities of a queue
+ * @q: the request queue of a device with an inline encryption engine
+ * @mode: the encryption mode
+ * @data_unit_sizes: bitmask of the data unit sizes supported for @mode
+ *
+ * The driver then finds the context of each request in its bio's
+ * bi_crypt_context, and has to program the key before issuing it.
+ */
+void blk_queue_crypto_modes(struct request_queue *q,
+			    enum blk_crypto_mode_num mode,
+			    unsigned int data_unit_sizes)
+{
+	q->crypto_modes[mode] = data_unit_sizes;
+}
+EXPORT_SYMBOL_GPL(blk_queue_crypto_modes);
+
+bool blk_queue_crypto_supported(struct request_queue *q,
+				enum blk_crypto_mode_num mode,
+				unsigned int data_unit_size)
+{
+	return q->crypto_modes[mode] & data_unit_size;
+}
+EXPORT_SYMBOL_GPL(blk_queue_crypto_supported);
+
+/**
+ * bio_crypt_set_ctx - attach an encryption context to a bio
+ * @bio: the bio, which must not have a context yet
+ * @key: the key, see blk_crypto_start_using_key()
+ * @dun: data unit number of the first data unit of @bio
+ * @gfp_mask: must allow direct reclaim, the context comes from a mempool
+ */
+void bio_crypt_set_ctx(struct bio *bio, const struct blk_crypto_key *key,
+		       u64 dun, gfp_t gfp_mask)
+{
+	struct bio_crypt_ctx *bc;
+
+	bc = mempool_alloc(bio_crypt_ctx_pool, gfp_mask);
+	bc->bc_key = key;
+	bc->bc_dun = dun;
+	bio->bi_crypt_context = bc;
+}
+EXPORT_SYMBOL_GPL(bio_crypt_set_ctx);
+
+void bio_crypt_free_ctx(struct bio *bio)
+{
+	if (!bio->bi_crypt_context)
+		return;
+	mempool_free(bio->bi_crypt_context, bio_crypt_ctx_pool);
+	bio->bi_crypt_context = NULL;
+}
+
+void bio_crypt_clone(struct bio *dst, struct bio *src, gfp_t gfp_mask)
+{
+	struct bio_crypt_ctx *bc = src->bi_crypt_context;
+
+	if (bc)
+		bio_crypt_set_ctx(dst, bc->bc_key, bc->bc_dun, gfp_mask);
+}
+
+static void blk_crypto_complete(struct crypto_async_request *req, int err)
+{
+	struct blk_crypto_result *res = req->data;
+
+	if (err == -EINPROGRESS)
+		return;
+	res->err = err;
+	complete(&res->completion);
+}
+
+/*
+ * En/decrypt one segment, which has to consist of whole data units, from
+ * @src to @dst.  *@dun is advanced past the units processed.
+ */
+static int blk_crypto_crypt_bvec(struct skcipher_request *req,
+				 struct blk_crypto_result *res,
+				 const struct blk_crypto_key *key, u64 *dun,
+				 struct page *src, struct page *dst,
+				 unsigned int offset, unsigned int len,
+				 bool encrypt)
+{
+	unsigned int unit = key->data_unit_size;
+	struct scatterlist sg_src, sg_dst;
+	union {
+		__le64 dun;
+		u8 bytes[BLK_CRYPTO_MAX_IV_SIZE];
+	} iv;
+	int err;
+
+	if (len & (unit - 1))
+		return -EIO;
+
+	sg_init_table(&sg_src, 1);
+	sg_init_table(&sg_dst, 1);
+	for (; len; len -= unit, offset += unit, (*dun)++) {
+		memset(&iv, 0, sizeof(iv));
+		iv.dun = cpu_to_le64(*dun);
+
+		sg_set_page(&sg_src, src, unit, offset);
+		sg_set_page(&sg_dst, dst, unit, offset);
+		skcipher_request_set_crypt(req, &sg_src, &sg_dst, unit,
+					   iv.bytes);
+
+		reinit_completion(&res->completion);
+		err = encrypt ? crypto_skcipher_encrypt(req) :
+				crypto_skcipher_decrypt(req);
+		if (err == -EINPROGRESS || err == -EBUSY) {
+			wait_for_completion(&res->completion);
+			err = res->err;
+		}
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static struct skcipher_request *
+blk_crypto_alloc_request(const struct blk_crypto_key *key,
+			 struct blk_crypto_result *res)
+{
+	struct skcipher_request *req;
+
+	req = skcipher_request_alloc(key->fallback_tfm, GFP_NOIO);
+	if (!req)
+		return NULL;
+
+	init_completion(&res->completion);
+	skcipher_request_set_callback(req,
+			CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
+			blk_crypto_complete, res);
+	return req;
+}
+
+static void blk_crypto_free_bounce_bio(struct bio *enc_bio)
+{
+	struct bio_vec *bv;
+	int i;
+
+	bio_for_each_segment_all(bv, enc_bio, i)
+		mempool_free(bv->bv_page, blk_crypto_bounce_page_pool);
+	bio_put(enc_bio);
+}
+
+static void blk_crypto_encrypt_endio(struct bio *enc_bio)
+{
+	struct bio *src_bio = enc_bio->bi_private;
+
+	src_bio->bi_error = enc_bio->bi_error;
+	blk_crypto_free_bounce_bio(enc_bio);
+	bio_endio(src_bio);
+}
+
+/*
+ * Replace *@bio_ptr by a bio which writes the encrypted data from bounce
+ * pages.  The original bio completes when that one does.
+ */
+static bool blk_crypto_encrypt_bio(struct bio **bio_ptr)
+{
+	struct bio *src_bio = *bio_ptr, *enc_bio;
+	struct bio_crypt_ctx *bc = src_bio->bi_crypt_context;
+	const struct blk_crypto_key *key = bc->bc_key;
+	struct skcipher_request *req;
+	struct blk_crypto_result res;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	unsigned int nr_segs = 0, bytes = 0;
+	u64 dun = bc->bc_dun;
+	int err = 0;
+
+	/* one bounce page per segment, so split off what fits a bio */
+	bio_for_each_segment(bv, src_bio, iter) {
+		if (nr_segs == BIO_MAX_PAGES) {
+			struct bio *split;
+
+			split = bio_split(src_bio, bytes >> 9, GFP_NOIO,
+					  blk_crypto_bio_set);
+			bio_chain(split, src_bio);
+			generic_make_request(src_bio);
+			src_bio = split;
+			break;
+		}
+		nr_segs++;
+		bytes += bv.bv_len;
+	}
+
+	enc_bio = bio_alloc_bioset(GFP_NOIO, nr_segs, blk_crypto_bio_set);
+	enc_bio->bi_bdev = src_bio->bi_bdev;
+	enc_bio->bi_rw = src_bio->bi_rw;
+	enc_bio->bi_iter.bi_sector = src_bio->bi_iter.bi_sector;
+	enc_bio->bi_end_io = blk_crypto_encrypt_endio;
+	enc_bio->bi_private = src_bio;
+
+	req = blk_crypto_alloc_request(key, &res);
+	if (!req) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	bio_for_each_segment(bv, src_bio, iter) {
+		struct page *page;
+
+		page = mempool_alloc(blk_crypto_bounce_page_pool, GFP_NOIO);
+		enc_bio->bi_io_vec[enc_bio->bi_vcnt].bv_page = page;
+		enc_bio->bi_io_vec[enc_bio->bi_vcnt].bv_len = bv.bv_len;
+		enc_bio->bi_io_vec[enc_bio->bi_vcnt].bv_offset = bv.bv_offset;
+		enc_bio->bi_vcnt++;
+		enc_bio->bi_iter.bi_size += bv.bv_len;
+
+		err = blk_crypto_crypt_bvec(req, &res, key, &dun, bv.bv_page,
+					    page, bv.bv_offset, bv.bv_len,
+					    true);
+		if (err)
+			break;
+	}
+	skcipher_request_free(req);
+	if (err)
+		goto out_free;
+
+	*bio_ptr = enc_bio;
+	return true;
+
+out_free:
+	blk_crypto_free_bounce_bio(enc_bio);
+	src_bio->bi_error = err;
+	bio_endio(src_bio);
+	return false;
+}
+
+static void blk_crypto_decrypt_work(struct work_struct *work)
+{
+	struct blk_crypto_read_ctx *rctx =
+		container_of(work, struct blk_crypto_read_ctx, work);
+	const struct blk_crypto_key *key = rctx->crypt_ctx.bc_key;
+	struct bio *bio = rctx->bio;
+	struct skcipher_request *req;
+	struct blk_crypto_result res;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+	u64 dun = rctx->crypt_ctx.bc_dun;
+	int err = 0;
+
+	req = blk_crypto_alloc_request(key, &res);
+	if (!req) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	__bio_for_each_segment(bv, bio, iter, rctx->crypt_iter) {
+		err = blk_crypto_crypt_bvec(req, &res, key, &dun, bv.bv_page,
+					    bv.bv_page, bv.bv_offset,
+					    bv.bv_len, false);
+		if (err)
+			break;
+	}
+	skcipher_request_free(req);
+out:
+	bio->bi_error = err;
+	bio->bi_end_io = rctx->bi_end_io;
+	bio->bi_private = rctx->bi_private;
+	mempool_free(rctx, blk_crypto_read_ctx_pool);
+	bio_endio(bio);
+}
+
+static void blk_crypto_decrypt_endio(struct bio *bio)
+{
+	struct blk_crypto_read_ctx *rctx = bio->bi_private;
+
+	if (bio->bi_error) {
+		bio->bi_end_io = rctx->bi_end_io;
+		bio->bi_private = rctx->bi_private;
+		mempool_free(rctx, blk_crypto_read_ctx_pool);
+		bio_endio(bio);
+		return;
+	}
+
+	INIT_WORK(&rctx->work, blk_crypto_decrypt_work);
+	queue_work(blk_crypto_wq, &rctx->work);
+}
+
+/*
+ * Take over the completion of a read so that its data gets decrypted
+ * before the submitter sees it.
+ */
+static bool blk_crypto_decrypt_bio(struct bio *bio)
+{
+	struct blk_crypto_read_ctx *rctx;
+
+	rctx = mempool_alloc(blk_crypto_read_ctx_pool, GFP_NOIO);
+	rctx->crypt_ctx = *bio->bi_crypt_context;
+	rctx->crypt_iter = bio->bi_iter;
+	rctx->bi_end_io = bio->bi_end_io;
+	rctx->bi_private = bio->bi_private;
+	rctx->bio = bio;
+
+	bio->bi_end_io = blk_crypto_decrypt_endio;
+	bio->bi_private = rctx;
+	bio_crypt_free_ctx(bio);
+	return true;
+}
+
+bool __blk_crypto_submit_bio(struct bio **bio_ptr)
+{
+	struct bio *bio = *bio_ptr;
+	const struct blk_crypto_key *key = bio->bi_crypt_context->bc_key;
+
+	if (!bio_has_data(bio) ||
+	    blk_queue_crypto_supported(bdev_get_queue(bio->bi_bdev),
+				       key->mode, key->data_unit_size))
+		return true;
+
+	if (WARN_ON_ONCE(!key->fallback_tfm)) {
+		bio->bi_error = -EIO;
+		bio_endio(bio);
+		return false;
+	}
+
+	if (bio_data_dir(bio) == WRITE)
+		return blk_crypto_encrypt_bio(bio_ptr);
+	return blk_crypto_decrypt_bio(bio);
+}
+EXPORT_SYMBOL_GPL(__blk_crypto_submit_bio);
+
+static int __init blk_crypto_init(void)
+{
+	bio_crypt_ctx_cache = KMEM_CACHE(bio_crypt_ctx, SLAB_PANIC);
+	bio_crypt_ctx_pool = mempool_create_slab_pool(BIO_CRYPT_CTX_POOL_SIZE,
+						      bio_crypt_ctx_cache);
+	blk_crypto_read_ctx_cache = KMEM_CACHE(blk_crypto_read_ctx,
+					       SLAB_PANIC);
+	blk_crypto_read_ctx_pool =
+		mempool_create_slab_pool(BLK_CRYPTO_READ_POOL_SIZE,
+					 blk_crypto_read_ctx_cache);
+	blk_crypto_bounce_page_pool =
+		mempool_create_page_pool(BLK_CRYPTO_BOUNCE_POOL_SIZE, 0);
+	blk_crypto_bio_set = bioset_create(BIO_POOL_SIZE, 0);
+	blk_crypto_wq = alloc_workqueue("blk_crypto_wq",
+					WQ_UNBOUND | WQ_HIGHPRI |
+					WQ_MEM_RECLAIM, num_online_cpus());
+
+	if (!bio_crypt_ctx_pool || !blk_crypto_read_ctx_pool ||
+	    !blk_crypto_bounce_page_pool || !blk_crypto_bio_set ||
+	    !blk_crypto_wq)
+		panic("Failed to allocate block layer crypto pools\n");
+	return 0;
+}
+subsys_initcall(blk_crypto_init);
@@ -0,0 +1,428 @@
+/*
+ * Latency target based IO protection of cgroups
+ *
+ * A cgroup sets in io.latency the completion latency it expects of a
+ * device. Every window the mean latency of each group of the queue is
+ * held against its target. If a group missed it, the groups of the queue
+ * with a looser target or none get half the queue depth they had, until
+ * a window passes with no group missing its target, when their depth is
+ * doubled back towards the full queue depth.
+ *
+ * The targets are compared across all the groups of a queue, wherever
+ * they are in the hierarchy.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/blk-cgroup.h>
+#include <linux/timer.h>
+#include <linux/swap.h>
+#include "blk.h"
+
+#define IOLAT_WINDOW		(HZ / 10)
+
+/* Completions needed in a window for its latency to count */
+#define IOLAT_MIN_SAMPLES	3
+
+/* Upper bounds of the latency histogram buckets, in usecs */
+static const unsigned int iolat_buckets[] = {
+	50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+};
+
+#define IOLAT_NR_BUCKETS	(ARRAY_SIZE(iolat_buckets) + 1)
+
+struct iolat_data {
+	struct request_queue *q;
+	atomic_t nr_targets;		/* Groups with a target on the queue */
+	struct timer_list window;
+};
+
+struct iolat_grp {
+	/* must be the first member */
+	struct blkg_policy_data pd;
+
+	u64 min_lat_nsec;		/* Target, 0 is none */
+	unsigned int depth;		/* UINT_MAX while not throttled */
+	atomic_t inflight;
+	wait_queue_head_t wait;
+
+	/* Completions of the current window */
+	atomic_t nr_samples;
+	atomic64_t lat_sum;
+
+	u64 last_avg_lat;		/* Mean of the last window, nsecs */
+	atomic64_t hist[IOLAT_NR_BUCKETS];
+};
+
+static struct blkcg_policy blkcg_policy_iolatency;
+
+static inline struct iolat_grp *pd_to_iolat(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct iolat_grp, pd) : NULL;
+}
+
+static inline struct iolat_grp *blkg_to_iolat(struct blkcg_gq *blkg)
+{
+	return pd_to_iolat(blkg_to_pd(blkg, &blkcg_policy_iolatency));
+}
+
+static void iolat_arm_window(struct iolat_data *id)
+{
+	if (!timer_pending(&id->window))
+		mod_timer(&id->window, jiffies + IOLAT_WINDOW);
+}
+
+/* IO a throttled group must still not wait for */
+static bool iolat_may_wait(struct bio *bio)
+{
+	return !(bio->bi_rw & (REQ_META | REQ_PRIO)) && !current_is_kswapd();
+}
+
+static bool iolat_inc_inflight(struct iolat_grp *iolat)
+{
+	unsigned int depth = READ_ONCE(iolat->depth);
+
+	if (depth == UINT_MAX) {
+		atomic_inc(&iolat->inflight);
+		return true;
+	}
+	return atomic_inc_below(&iolat->inflight, depth);
+}
+
+/**
+ * blk_iolatency_wait - wait for room in the depth of the group of @bio
+ * @q:		the queue @bio goes to
+ * @bio:	the bio about to get a request
+ *
+ * Returns the blkg @bio was counted in, which the request @bio ends up in
+ * must be passed to with blk_iolatency_track(), or NULL.
+ */
+struct blkcg_gq *blk_iolatency_wait(struct request_queue *q, struct bio *bio)
+{
+	struct iolat_data *id = q->iolat;
+	struct iolat_grp *iolat;
+	struct blkcg_gq *blkg;
+	DEFINE_WAIT(wait);
+
+	if (!id || !atomic_read(&id->nr_targets))
+		return NULL;
+
+	rcu_read_lock();
+	blkg = blkg_lookup(bio_blkcg(bio), q);
+	/* The root group is never throttled */
+	if (!blkg || !blkg->parent || !atomic_inc_not_zero(&blkg->refcnt)) {
+		rcu_read_unlock();
+		return NULL;
+	}
+	rcu_read_unlock();
+
+	iolat = blkg_to_iolat(blkg);
+	if (!iolat) {
+		blkg_put(blkg);
+		return NULL;
+	}
+
+	iolat_arm_window(id);
+	if (!iolat_may_wait(bio)) {
+		atomic_inc(&iolat->inflight);
+		return blkg;
+	}
+	if (iolat_inc_inflight(iolat))
+		return blkg;
+
+	for (;;) {
+		prepare_to_wait_exclusive(&iolat->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		if (iolat_inc_inflight(iolat))
+			break;
+		io_schedule();
+	}
+	finish_wait(&iolat->wait, &wait);
+
+	return blkg;
+}
+
+void __blk_iolatency_done(struct blkcg_gq *blkg)
+{
+	struct iolat_grp *iolat = blkg_to_iolat(blkg);
+	int inflight;
+
+	inflight = atomic_dec_return(&iolat->inflight);
+	if (waitqueue_active(&iolat->wait) &&
+	    inflight < READ_ONCE(iolat->depth))
+		wake_up(&iolat->wait);
+	blkg_put(blkg);
+}
+
+static void iolat_add_sample(struct iolat_grp *iolat, u64 lat)
+{
+	unsigned int usecs = min_t(u64, div_u64(lat, NSEC_PER_USEC), UINT_MAX);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(iolat_buckets); i++)
+		if (usecs <= iolat_buckets[i])
+			break;
+	atomic64_inc(&iolat->hist[i]);
+
+	atomic64_add(lat, &iolat->lat_sum);
+	atomic_inc(&iolat->nr_samples);
+}
+
+void __blk_iolatency_rq_done(struct request *rq)
+{
+	struct blkcg_gq *blkg = rq->iolat_blkg;
+
+	rq->iolat_blkg = NULL;
+	if (rq->iolat_issue_ns) {
+		iolat_add_sample(blkg_to_iolat(blkg),
+				 ktime_get_ns() - rq->iolat_issue_ns);
+		rq->iolat_issue_ns = 0;
+	}
+	__blk_iolatency_done(blkg);
+}
+
+static void iolat_set_depth(struct iolat_grp *iolat, unsigned int depth)
+{
+	bool grown = depth > iolat->depth;
+
+	WRITE_ONCE(iolat->depth, depth);
+	if (grown)
+		wake_up_all(&iolat->wait);
+}
+
+static void iolat_window_fn(unsigned long data)
+{
+	struct iolat_data *id = (struct iolat_data *)data;
+	struct request_queue *q = id->q;
+	unsigned int nr_requests = max(q->nr_requests, 2UL);
+	u64 missed = U64_MAX;
+	bool throttled = false;
+	struct blkcg_gq *blkg;
+	unsigned long flags;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+
+	/* The tightest target missed in the window, if any */
+	list_for_each_entry(blkg, &q->blkg_list, q_node) {
+		struct iolat_grp *iolat = blkg_to_iolat(blkg);
+		int nr;
+		u64 sum;
+
+		if (!iolat)
+			continue;
+
+		nr = atomic_xchg(&iolat->nr_samples, 0);
+		sum = atomic64_xchg(&iolat->lat_sum, 0);
+		iolat->last_avg_lat = nr ? div_u64(sum, nr) : 0;
+
+		if (iolat->min_lat_nsec && nr >= IOLAT_MIN_SAMPLES &&
+		    iolat->last_avg_lat > iolat->min_lat_nsec)
+			missed = min(missed, iolat->min_lat_nsec);
+	}
+
+	list_for_each_entry(blkg, &q->blkg_list, q_node) {
+		struct iolat_grp *iolat = blkg_to_iolat(blkg);
+		unsigned int depth;
+
+		if (!iolat || !blkg->parent)
+			continue;
+
+		depth = iolat->depth;
+		if (missed != U64_MAX && (!iolat->min_lat_nsec ||
+					  iolat->min_lat_nsec > missed)) {
+			if (depth == UINT_MAX)
+				depth = nr_requests;
+			depth = max(depth / 2, 1U);
+		} else if (depth != UINT_MAX) {
+			depth *= 2;
+			if (depth >= nr_requests)
+				depth = UINT_MAX;
+		}
+		if (depth != iolat->depth)
+			iolat_set_depth(iolat, depth);
+		if (depth != UINT_MAX)
+			throttled = true;
+	}
+
+	spin_unlock_irqrestore(q->queue_lock, flags);
+
+	/* Keep watching while there is anything to watch */
+	if (throttled)
+		iolat_arm_window(id);
+}
+
+int blk_iolatency_init(struct request_queue *q)
+{
+	struct iolat_data *id;
+	int ret;
+
+	id = kzalloc_node(sizeof(*id), GFP_KERNEL, q->node);
+	if (!id)
+		return -ENOMEM;
+
+	id->q = q;
+	atomic_set(&id->nr_targets, 0);
+	setup_timer(&id->window, iolat_window_fn, (unsigned long)id);
+	q->iolat = id;
+
+	ret = blkcg_activate_policy(q, &blkcg_policy_iolatency);
+	if (ret) {
+		q->iolat = NULL;
+		kfree(id);
+	}
+	return ret;
+}
+
+void blk_iolatency_exit(struct request_queue *q)
+{
+	struct iolat_data *id = q->iolat;
+
+	del_timer_sync(&id->window);
+	blkcg_deactivate_policy(q, &blkcg_policy_iolatency);
+	q->iolat = NULL;
+	kfree(id);
+}
+
+static struct blkg_policy_data *iolat_pd_alloc(gfp_t gfp, int node)
+{
+	struct iolat_grp *iolat;
+
+	iolat = kzalloc_node(sizeof(*iolat), gfp, node);
+	if (!iolat)
+		return NULL;
+
+	iolat->depth = UINT_MAX;
+	atomic_set(&iolat->inflight, 0);
+	init_waitqueue_head(&iolat->wait);
+	return &iolat->pd;
+}
+
+/* Called with the queue lock held */
+static void iolat_set_target(struct iolat_grp *iolat, u64 lat_nsec)
+{
+	struct iolat_data *id = iolat->pd.blkg->q->iolat;
+
+	if (!iolat->min_lat_nsec && lat_nsec)
+		atomic_inc(&id->nr_targets);
+	else if (iolat->min_lat_nsec && !lat_nsec)
+		atomic_dec(&id->nr_targets);
+	iolat->min_lat_nsec = lat_nsec;
+}
+
+static void iolat_pd_offline(struct blkg_policy_data *pd)
+{
+	struct iolat_grp *iolat = pd_to_iolat(pd);
+
+	iolat_set_target(iolat, 0);
+	iolat_set_depth(iolat, UINT_MAX);
+}
+
+static void iolat_pd_free(struct blkg_policy_data *pd)
+{
+	kfree(pd_to_iolat(pd));
+}
+
+static void iolat_pd_stat(struct blkg_policy_data *pd, struct seq_file *sf)
+{
+	struct iolat_grp *iolat = pd_to_iolat(pd);
+	int i;
+
+	if (iolat->depth == UINT_MAX)
+		seq_puts(sf, " depth=max");
+	else
+		seq_printf(sf, " depth=%u", iolat->depth);
+	seq_printf(sf, " avg_lat=%llu",
+		   div_u64(iolat->last_avg_lat, NSEC_PER_USEC));
+
+	for (i = 0; i < ARRAY_SIZE(iolat_buckets); i++)
+		seq_printf(sf, " lat_%uus=%lld", iolat_buckets[i],
+			   (long long)atomic64_read(&iolat->hist[i]));
+	seq_printf(sf, " lat_max=%lld", (long long)atomic64_read(&iolat->hist[i]));
+}
+
+static u64 iolat_prfill_target(struct seq_file *sf,
+			       struct blkg_policy_data *pd, int off)
+{
+	struct iolat_grp *iolat = pd_to_iolat(pd);
+	const char *dname = blkg_dev_name(pd->blkg);
+
+	if (!dname || !iolat->min_lat_nsec)
+		return 0;
+
+	seq_printf(sf, "%s target=%llu\n", dname,
+		   div_u64(iolat->min_lat_nsec, NSEC_PER_USEC));
+	return 0;
+}
+
+static int iolat_print_target(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)), iolat_prfill_target,
+			  &blkcg_policy_iolatency, seq_cft(sf)->private, false);
+	return 0;
+}
+
+static ssize_t iolat_set_limit(struct kernfs_open_file *of,
+			       char *buf, size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blkg_conf_ctx ctx;
+	struct iolat_grp *iolat;
+	char tok[27];		/* target=18446744073709551616 */
+	char *p;
+	u64 val;
+	int len;
+	int ret;
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iolatency, buf, &ctx);
+	if (ret)
+		return ret;
+
+	iolat = blkg_to_iolat(ctx.blkg);
+
+	ret = -EINVAL;
+	if (sscanf(ctx.body, "%26s%n", tok, &len) != 1)
+		goto out_finish;
+	p = tok;
+	strsep(&p, "=");
+	if (!p || strcmp(tok, "target"))
+		goto out_finish;
+
+	if (!strcmp(p, "max"))
+		val = 0;
+	else if (sscanf(p, "%llu", &val) != 1)
+		goto out_finish;
+
+	iolat_set_target(iolat, val * NSEC_PER_USEC);
+	ret = 0;
+out_finish:
+	blkg_conf_finish(&ctx);
+	return ret ?: nbytes;
+}
+
+static struct cftype iolat_files[] = {
+	{
+		.name = "latency",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = iolat_print_target,
+		.write = iolat_set_limit,
+	},
+	{ }	/* terminate */
+};
+
+static struct blkcg_policy blkcg_policy_iolatency = {
+	.dfl_cftypes		= iolat_files,
+
+	.pd_alloc_fn		= iolat_pd_alloc,
+	.pd_offline_fn		= iolat_pd_offline,
+	.pd_free_fn		= iolat_pd_free,
+	.pd_stat_fn		= iolat_pd_stat,
+};
+
+static int __init iolatency_init(void)
+{
+	return blkcg_policy_register(&blkcg_policy_iolatency);
+}
+
+module_init(iolatency_init);
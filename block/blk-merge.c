@@ -500,6 +500,8 @@ int ll_back_merge_fn(struct request_queue *q, struct request *req,
 	if (blk_integrity_rq(req) &&
 	    integrity_req_gap_back_merge(req, bio))
 		return 0;
+	if (!bio_crypt_ctx_back_mergeable(req->biotail, bio))
+		return 0;
 	if (blk_rq_sectors(req) + bio_sectors(bio) >
 	    blk_rq_get_max_sectors(req)) {
 		req->cmd_flags |= REQ_NOMERGE;
@@ -524,6 +526,8 @@ int ll_front_merge_fn(struct request_queue *q, struct request *req,
 	if (blk_integrity_rq(req) &&
 	    integrity_req_gap_front_merge(req, bio))
 		return 0;
+	if (!bio_crypt_ctx_back_mergeable(bio, req->bio))
+		return 0;
 	if (blk_rq_sectors(req) + bio_sectors(bio) >
 	    blk_rq_get_max_sectors(req)) {
 		req->cmd_flags |= REQ_NOMERGE;
@@ -567,6 +571,9 @@ static int ll_merge_requests_fn(struct request_queue *q, struct request *req,
 	if (req_gap_back_merge(req, next->bio))
 		return 0;
 
+	if (!bio_crypt_ctx_back_mergeable(req->biotail, next->bio))
+		return 0;
+
 	/*
 	 * Will it become too large?
 	 */
@@ -704,7 +711,9 @@ static int attempt_merge(struct request_queue *q, struct request *req,
 
 	req->__data_len += blk_rq_bytes(next);
 
-	elv_merge_requests(q, req, next);
+	/* blk-mq merges requests still on their software queue only */
+	if (!q->mq_ops)
+		elv_merge_requests(q, req, next);
 
 	/*
 	 * 'next' is going away, so update stats accordingly
@@ -0,0 +1,150 @@
+/*
+ * I/O scheduler support for blk-mq
+ *
+ * A scheduler is an elevator_type with uses_mq set, attached to the queue
+ * as q->elevator like the legacy ones and switched through the same sysfs
+ * file. It is handed the requests of the software queues when a hardware
+ * queue runs, and __blk_mq_run_hw_queue() then pulls them back out one at
+ * a time with ->dispatch_request() while the driver takes them.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blktrace_api.h>
+
+#include <linux/blk-mq.h>
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-sched.h"
+
+/*
+ * Move the requests of @list that the scheduler orders into it. Flush
+ * sequences and passthrough requests stay on @list to be issued as is.
+ */
+void blk_mq_sched_insert_requests(struct blk_mq_hw_ctx *hctx,
+				  struct list_head *list)
+{
+	struct elevator_queue *e = hctx->queue->elevator;
+	struct request *rq, *next;
+	LIST_HEAD(sched_list);
+
+	list_for_each_entry_safe(rq, next, list, queuelist) {
+		if (rq->cmd_type != REQ_TYPE_FS ||
+		    (rq->cmd_flags & REQ_FLUSH_SEQ))
+			continue;
+		rq->cmd_flags |= REQ_ELVPRIV;
+		list_move_tail(&rq->queuelist, &sched_list);
+	}
+
+	if (!list_empty(&sched_list))
+		e->type->mq_ops.insert_requests(hctx, &sched_list);
+}
+
+static void blk_mq_sched_exit_hctxs(struct request_queue *q, unsigned int nr)
+{
+	struct elevator_type *e = q->elevator->type;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (i == nr)
+			break;
+		if (e->mq_ops.exit_hctx)
+			e->mq_ops.exit_hctx(hctx, i);
+		hctx->sched_data = NULL;
+	}
+}
+
+static int blk_mq_sched_init(struct request_queue *q, struct elevator_type *e)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+	int ret;
+
+	/* Sets q->elevator, whose release drops the module reference */
+	ret = e->mq_ops.init_sched(q, e);
+	if (ret) {
+		module_put(e->elevator_owner);
+		return ret;
+	}
+
+	if (!e->mq_ops.init_hctx)
+		return 0;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		ret = e->mq_ops.init_hctx(hctx, i);
+		if (ret) {
+			blk_mq_sched_exit_hctxs(q, i);
+			elevator_exit(q->elevator);
+			q->elevator = NULL;
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* The queue is frozen or dead, and unregistered from sysfs */
+void blk_mq_sched_teardown(struct request_queue *q)
+{
+	if (!q->elevator)
+		return;
+
+	blk_mq_sched_exit_hctxs(q, q->nr_hw_queues);
+	elevator_exit(q->elevator);
+	q->elevator = NULL;
+}
+
+/* Wait for every run of the hardware queues that may use q->elevator */
+static void blk_mq_sched_quiesce(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	blk_mq_stop_hw_queues(q);
+	/* Runs not from the workqueue have preemption disabled */
+	synchronize_sched();
+	queue_for_each_hw_ctx(q, hctx, i) {
+		cancel_delayed_work_sync(&hctx->run_work);
+		cancel_delayed_work_sync(&hctx->delay_work);
+	}
+}
+
+/**
+ * blk_mq_sched_switch - switch the scheduler of a blk-mq queue
+ * @q:		the queue
+ * @e:		the new scheduler with a module reference held, NULL for none
+ *
+ * Called with q->sysfs_lock held. The queue is frozen, so no request of
+ * the old scheduler is left, while it is switched. If the new one cannot
+ * be set up the queue is left without a scheduler.
+ */
+int blk_mq_sched_switch(struct request_queue *q, struct elevator_type *e)
+{
+	int ret = 0;
+
+	blk_mq_freeze_queue(q);
+	blk_mq_sched_quiesce(q);
+
+	if (q->elevator) {
+		if (q->elevator->registered)
+			elv_unregister_queue(q);
+		blk_mq_sched_teardown(q);
+	}
+
+	if (e) {
+		ret = blk_mq_sched_init(q, e);
+		if (!ret && q->kobj.state_in_sysfs) {
+			ret = elv_register_queue(q);
+			if (ret)
+				blk_mq_sched_teardown(q);
+		}
+	}
+
+	blk_mq_start_hw_queues(q);
+	blk_mq_unfreeze_queue(q);
+
+	if (!ret)
+		blk_add_trace_msg(q, "elv switch: %s",
+				  e ? e->elevator_name : "none");
+	return ret;
+}
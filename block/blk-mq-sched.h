@@ -0,0 +1,48 @@
+#ifndef INT_BLK_MQ_SCHED_H
+#define INT_BLK_MQ_SCHED_H
+
+#include <linux/elevator.h>
+#include "blk-mq.h"
+
+int blk_mq_sched_switch(struct request_queue *q, struct elevator_type *e);
+void blk_mq_sched_teardown(struct request_queue *q);
+void blk_mq_sched_insert_requests(struct blk_mq_hw_ctx *hctx,
+				  struct list_head *list);
+
+static inline bool blk_mq_sched_has_work(struct blk_mq_hw_ctx *hctx)
+{
+	struct elevator_queue *e = hctx->queue->elevator;
+
+	return e && e->type->mq_ops.has_work(hctx);
+}
+
+static inline struct blk_mq_hw_ctx *blk_mq_sched_rq_hctx(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	return q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+}
+
+/* Only the requests the scheduler was given are REQ_ELVPRIV */
+static inline void blk_mq_sched_completed_request(struct request *rq)
+{
+	struct elevator_queue *e = rq->q->elevator;
+
+	if (e && (rq->cmd_flags & REQ_ELVPRIV) &&
+	    e->type->mq_ops.completed_request)
+		e->type->mq_ops.completed_request(blk_mq_sched_rq_hctx(rq), rq);
+}
+
+/* @rq goes back through the scheduler, which forgets it was dispatched */
+static inline void blk_mq_sched_requeue_request(struct request *rq)
+{
+	struct elevator_queue *e = rq->q->elevator;
+
+	if (!e || !(rq->cmd_flags & REQ_ELVPRIV))
+		return;
+	if (e->type->mq_ops.requeue_request)
+		e->type->mq_ops.requeue_request(blk_mq_sched_rq_hctx(rq), rq);
+	rq->cmd_flags &= ~REQ_ELVPRIV;
+}
+
+#endif
@@ -133,6 +133,18 @@ static ssize_t blk_mq_sysfs_merged_show(struct blk_mq_ctx *ctx, char *page)
 	return sprintf(page, "%lu\n", ctx->rq_merged);
 }
 
+static ssize_t blk_mq_sysfs_hash_merged_show(struct blk_mq_ctx *ctx,
+					     char *page)
+{
+	return sprintf(page, "%lu\n", ctx->rq_hash_merged);
+}
+
+static ssize_t blk_mq_sysfs_plug_merged_show(struct blk_mq_ctx *ctx,
+					     char *page)
+{
+	return sprintf(page, "%lu\n", ctx->rq_plug_merged);
+}
+
 static ssize_t blk_mq_sysfs_completed_show(struct blk_mq_ctx *ctx, char *page)
 {
 	return sprintf(page, "%lu %lu\n", ctx->rq_completed[1],
@@ -176,7 +188,27 @@ static ssize_t blk_mq_sysfs_rq_list_show(struct blk_mq_ctx *ctx, char *page)
 
 static ssize_t blk_mq_hw_sysfs_poll_show(struct blk_mq_hw_ctx *hctx, char *page)
 {
-	return sprintf(page, "invoked=%lu, success=%lu\n", hctx->poll_invoked, hctx->poll_success);
+	return sprintf(page, "invoked=%lu, success=%lu, sleeps=%lu\n",
+		       hctx->poll_invoked, hctx->poll_success, hctx->poll_sleeps);
+}
+
+static ssize_t blk_mq_hw_sysfs_poll_stat_show(struct blk_mq_hw_ctx *hctx,
+					      char *page)
+{
+	char *start_page = page;
+	int i;
+
+	for (i = 0; i < BLK_MQ_POLL_STATS_BKTS; i++) {
+		struct blk_mq_poll_stat *stat = &hctx->poll_stat[i];
+
+		/* Buckets of request sizes in bytes, the last one open */
+		page += sprintf(page, "%s %u%s: samples=%lu, mean=%llu\n",
+				i & 1 ? "write" : "read", 512U << (i / 2),
+				i + 2 >= BLK_MQ_POLL_STATS_BKTS ? "+" : "",
+				stat->nr, stat->mean);
+	}
+
+	return page - start_page;
 }
 
 static ssize_t blk_mq_hw_sysfs_queued_show(struct blk_mq_hw_ctx *hctx,
@@ -255,6 +287,14 @@ static struct blk_mq_ctx_sysfs_entry blk_mq_sysfs_merged = {
 	.attr = {.name = "merged", .mode = S_IRUGO },
 	.show = blk_mq_sysfs_merged_show,
 };
+static struct blk_mq_ctx_sysfs_entry blk_mq_sysfs_hash_merged = {
+	.attr = {.name = "hash_merged", .mode = S_IRUGO },
+	.show = blk_mq_sysfs_hash_merged_show,
+};
+static struct blk_mq_ctx_sysfs_entry blk_mq_sysfs_plug_merged = {
+	.attr = {.name = "plug_merged", .mode = S_IRUGO },
+	.show = blk_mq_sysfs_plug_merged_show,
+};
 static struct blk_mq_ctx_sysfs_entry blk_mq_sysfs_completed = {
 	.attr = {.name = "completed", .mode = S_IRUGO },
 	.show = blk_mq_sysfs_completed_show,
@@ -267,6 +307,8 @@ static struct blk_mq_ctx_sysfs_entry blk_mq_sysfs_rq_list = {
 static struct attribute *default_ctx_attrs[] = {
 	&blk_mq_sysfs_dispatched.attr,
 	&blk_mq_sysfs_merged.attr,
+	&blk_mq_sysfs_hash_merged.attr,
+	&blk_mq_sysfs_plug_merged.attr,
 	&blk_mq_sysfs_completed.attr,
 	&blk_mq_sysfs_rq_list.attr,
 	NULL,
@@ -304,6 +346,10 @@ static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_poll = {
 	.attr = {.name = "io_poll", .mode = S_IRUGO },
 	.show = blk_mq_hw_sysfs_poll_show,
 };
+static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_poll_stat = {
+	.attr = {.name = "io_poll_stat", .mode = S_IRUGO },
+	.show = blk_mq_hw_sysfs_poll_stat_show,
+};
 
 static struct attribute *default_hw_ctx_attrs[] = {
 	&blk_mq_hw_sysfs_queued.attr,
@@ -314,6 +360,7 @@ static struct attribute *default_hw_ctx_attrs[] = {
 	&blk_mq_hw_sysfs_cpus.attr,
 	&blk_mq_hw_sysfs_active.attr,
 	&blk_mq_hw_sysfs_poll.attr,
+	&blk_mq_hw_sysfs_poll_stat.attr,
 	NULL,
 };
 
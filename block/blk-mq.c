@@ -29,6 +29,7 @@
 #include "blk.h"
 #include "blk-mq.h"
 #include "blk-mq-tag.h"
+#include "blk-mq-sched.h"
 
 static DEFINE_MUTEX(all_q_mutex);
 static LIST_HEAD(all_q_list);
@@ -276,10 +277,13 @@ static void __blk_mq_free_request(struct blk_mq_hw_ctx *hctx,
 
 	if (rq->cmd_flags & REQ_MQ_INFLIGHT)
 		atomic_dec(&hctx->nr_active);
+	wbt_rq_done(rq);
+	blk_iolatency_rq_done(rq);
 	rq->cmd_flags = 0;
 
 	clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
-	blk_mq_put_tag(hctx, tag, &ctx->last_tag);
+	clear_bit(REQ_ATOM_POLL_SLEPT, &rq->atomic_flags);
+	blk_mq_put_tag(hctx, ctx, tag);
 	blk_queue_exit(q);
 }
 
@@ -306,6 +310,8 @@ EXPORT_SYMBOL_GPL(blk_mq_free_request);
 inline void __blk_mq_end_request(struct request *rq, int error)
 {
 	blk_account_io_done(rq);
+	wbt_complete(rq);
+	blk_mq_sched_completed_request(rq);
 
 	if (rq->end_io) {
 		rq->end_io(rq, error);
@@ -358,10 +364,100 @@ static void blk_mq_ipi_complete_request(struct request *rq)
 	put_cpu();
 }
 
+/* 512 bytes to 64k and up, for each direction */
+static unsigned int blk_mq_poll_stats_bkt(struct request *rq)
+{
+	int bkt = ilog2(max(blk_rq_bytes(rq), 1U)) - 9;
+
+	bkt = clamp(bkt, 0, BLK_MQ_POLL_STATS_BKTS / 2 - 1);
+	return bkt * 2 + rq_data_dir(rq);
+}
+
+static void blk_mq_poll_stat_add(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+	struct blk_mq_poll_stat *stat = &hctx->poll_stat[blk_mq_poll_stats_bkt(rq)];
+	u64 lat = ktime_get_ns() - rq->poll_start_ns;
+
+	/* Racy, but only an estimate for how long to sleep */
+	if (!stat->nr)
+		stat->mean = lat;
+	else
+		stat->mean = stat->mean - (stat->mean >> 3) + (lat >> 3);
+	stat->nr++;
+	rq->poll_start_ns = 0;
+}
+
+/* Polled completions needed in a bucket before its mean is used */
+#define BLK_MQ_POLL_MIN_SAMPLES	8
+
+/**
+ * blk_mq_poll_hybrid_sleep - sleep through part of a polled request
+ * @q:		the queue @rq is on
+ * @hctx:	the hardware queue being polled
+ * @rq:		the request polled for
+ *
+ * Sleeps once per request, for the time set in io_poll_delay or else half
+ * the mean completion time of requests like it, so that polling does not
+ * spin for all of it. Returns true if it slept.
+ */
+bool blk_mq_poll_hybrid_sleep(struct request_queue *q,
+			      struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct hrtimer_sleeper hs;
+	enum hrtimer_mode mode;
+	int poll_nsec = READ_ONCE(q->poll_nsec);
+	u64 nsecs, elapsed;
+
+	if (poll_nsec < 0 || !rq->poll_start_ns ||
+	    test_and_set_bit(REQ_ATOM_POLL_SLEPT, &rq->atomic_flags))
+		return false;
+
+	if (poll_nsec > 0)
+		nsecs = poll_nsec;
+	else {
+		struct blk_mq_poll_stat *stat;
+
+		stat = &hctx->poll_stat[blk_mq_poll_stats_bkt(rq)];
+		if (READ_ONCE(stat->nr) < BLK_MQ_POLL_MIN_SAMPLES)
+			return false;
+		nsecs = READ_ONCE(stat->mean) / 2;
+	}
+
+	elapsed = ktime_get_ns() - rq->poll_start_ns;
+	if (elapsed >= nsecs)
+		return false;
+
+	hctx->poll_sleeps++;
+
+	mode = HRTIMER_MODE_REL;
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, mode);
+	hrtimer_set_expires(&hs.timer, ns_to_ktime(nsecs - elapsed));
+	hrtimer_init_sleeper(&hs, current);
+	do {
+		if (test_bit(REQ_ATOM_COMPLETE, &rq->atomic_flags))
+			break;
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		hrtimer_start_expires(&hs.timer, mode);
+		if (hs.task)
+			io_schedule();
+		hrtimer_cancel(&hs.timer);
+		mode = HRTIMER_MODE_ABS;
+	} while (hs.task && !signal_pending(current));
+
+	__set_current_state(TASK_RUNNING);
+	destroy_hrtimer_on_stack(&hs.timer);
+	return true;
+}
+
 static void __blk_mq_complete_request(struct request *rq)
 {
 	struct request_queue *q = rq->q;
 
+	if (rq->poll_start_ns)
+		blk_mq_poll_stat_add(rq);
+
 	if (!q->softirq_done_fn)
 		blk_mq_end_request(rq, rq->errors);
 	else
@@ -406,6 +502,10 @@ void blk_mq_start_request(struct request *rq)
 		rq->next_rq->resid_len = blk_rq_bytes(rq->next_rq);
 
 	blk_add_timer(rq);
+	wbt_issue(rq);
+	blk_iolatency_issue(rq);
+	if (q->poll_nsec >= 0 && test_bit(QUEUE_FLAG_POLL, &q->queue_flags))
+		rq->poll_start_ns = ktime_get_ns();
 
 	/*
 	 * Ensure that ->deadline is visible before set the started
@@ -450,6 +550,7 @@ static void __blk_mq_requeue_request(struct request *rq)
 void blk_mq_requeue_request(struct request *rq)
 {
 	__blk_mq_requeue_request(rq);
+	blk_mq_sched_requeue_request(rq);
 
 	BUG_ON(blk_queued_rq(rq));
 	blk_mq_add_to_requeue_list(rq, true);
@@ -647,12 +748,80 @@ static void blk_mq_rq_timer(unsigned long priv)
  * merge with. Currently includes a hand-wavy stop count of 8, to not spend
  * too much time checking for merges.
  */
+/*
+ * The requests waiting on a software queue are hashed by their end
+ * sector, like the elevator does, so that a back merge finds its
+ * request however deep the queue is.
+ */
+#define rq_hash_key(rq)		(blk_rq_pos(rq) + blk_rq_sectors(rq))
+
+static inline void blk_mq_rqhash_del(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_HASHED) {
+		hash_del(&rq->hash);
+		rq->cmd_flags &= ~REQ_HASHED;
+	}
+}
+
+static inline void blk_mq_rqhash_add(struct blk_mq_ctx *ctx,
+				     struct request *rq)
+{
+	if (rq_mergeable(rq)) {
+		hash_add(ctx->merge_hash, &rq->hash, rq_hash_key(rq));
+		rq->cmd_flags |= REQ_HASHED;
+	}
+}
+
+static void blk_mq_rqhash_reposition(struct blk_mq_ctx *ctx,
+				     struct request *rq)
+{
+	blk_mq_rqhash_del(rq);
+	blk_mq_rqhash_add(ctx, rq);
+}
+
+static struct request *blk_mq_rqhash_find(struct blk_mq_ctx *ctx,
+					  sector_t offset)
+{
+	struct hlist_node *next;
+	struct request *rq;
+
+	hash_for_each_possible_safe(ctx->merge_hash, rq, next, hash, offset) {
+		if (unlikely(!rq_mergeable(rq))) {
+			blk_mq_rqhash_del(rq);
+			continue;
+		}
+
+		if (rq_hash_key(rq) == offset)
+			return rq;
+	}
+
+	return NULL;
+}
+
+/* The requests of @ctx are all about to leave it */
+static void blk_mq_rqhash_del_all(struct blk_mq_ctx *ctx)
+{
+	struct request *rq;
+
+	list_for_each_entry(rq, &ctx->rq_list, queuelist)
+		blk_mq_rqhash_del(rq);
+}
+
 static bool blk_mq_attempt_merge(struct request_queue *q,
 				 struct blk_mq_ctx *ctx, struct bio *bio)
 {
 	struct request *rq;
 	int checked = 8;
 
+	rq = blk_mq_rqhash_find(ctx, bio->bi_iter.bi_sector);
+	if (rq && blk_rq_merge_ok(rq, bio) &&
+	    bio_attempt_back_merge(q, rq, bio)) {
+		blk_mq_rqhash_reposition(ctx, rq);
+		ctx->rq_merged++;
+		ctx->rq_hash_merged++;
+		return true;
+	}
+
 	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
 		int el_ret;
 
@@ -665,6 +834,7 @@ static bool blk_mq_attempt_merge(struct request_queue *q,
 		el_ret = blk_try_merge(rq, bio);
 		if (el_ret == ELEVATOR_BACK_MERGE) {
 			if (bio_attempt_back_merge(q, rq, bio)) {
+				blk_mq_rqhash_reposition(ctx, rq);
 				ctx->rq_merged++;
 				return true;
 			}
@@ -707,6 +877,7 @@ static void flush_busy_ctxs(struct blk_mq_hw_ctx *hctx, struct list_head *list)
 			ctx = hctx->ctxs[bit + off];
 			clear_bit(bit, &bm->word);
 			spin_lock(&ctx->lock);
+			blk_mq_rqhash_del_all(ctx);
 			list_splice_tail_init(&ctx->rq_list, list);
 			spin_unlock(&ctx->lock);
 
@@ -715,6 +886,52 @@ static void flush_busy_ctxs(struct blk_mq_hw_ctx *hctx, struct list_head *list)
 	}
 }
 
+/*
+ * Issue the requests of the scheduler of @hctx until it has none to give
+ * or the driver is busy, in which case the request goes back on @list.
+ * Returns the number issued.
+ */
+static int blk_mq_sched_dispatch(struct blk_mq_hw_ctx *hctx,
+				 struct list_head *list)
+{
+	struct request_queue *q = hctx->queue;
+	struct elevator_type *e = q->elevator->type;
+	struct blk_mq_queue_data bd;
+	struct request *rq;
+	int queued = 0;
+
+	while ((rq = e->mq_ops.dispatch_request(hctx))) {
+		int ret;
+
+		/*
+		 * The scheduler may hold back what it has, so there is no
+		 * telling whether a next request follows.
+		 */
+		bd.rq = rq;
+		bd.list = NULL;
+		bd.last = true;
+
+		ret = q->mq_ops->queue_rq(hctx, &bd);
+		switch (ret) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			queued++;
+			continue;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			list_add(&rq->queuelist, list);
+			__blk_mq_requeue_request(rq);
+			return queued;
+		default:
+			pr_err("blk-mq: bad return on queue: %d\n", ret);
+		case BLK_MQ_RQ_QUEUE_ERROR:
+			rq->errors = -EIO;
+			blk_mq_end_request(rq, rq->errors);
+			break;
+		}
+	}
+
+	return queued;
+}
+
 /*
  * Run this hardware queue, pulling any software queues mapped to it in.
  * Note that this function currently has various problems around ordering
@@ -741,6 +958,8 @@ static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
 	 * Touch any software queue that has pending entries.
 	 */
 	flush_busy_ctxs(hctx, &rq_list);
+	if (q->elevator)
+		blk_mq_sched_insert_requests(hctx, &rq_list);
 
 	/*
 	 * If we have previous entries on our dispatch list, grab them
@@ -802,6 +1021,10 @@ static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
 			dptr = &driver_list;
 	}
 
+	/* Then whatever the scheduler picks, while the driver keeps up */
+	if (q->elevator && list_empty(&rq_list))
+		queued += blk_mq_sched_dispatch(hctx, &rq_list);
+
 	if (!queued)
 		hctx->dispatched[0]++;
 	else if (queued < (1 << (BLK_MQ_MAX_DISPATCH_ORDER - 1)))
@@ -875,6 +1098,7 @@ void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
 	kblockd_schedule_delayed_work_on(blk_mq_hctx_next_cpu(hctx),
 			&hctx->run_work, 0);
 }
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
 
 void blk_mq_run_hw_queues(struct request_queue *q, bool async)
 {
@@ -883,7 +1107,8 @@ void blk_mq_run_hw_queues(struct request_queue *q, bool async)
 
 	queue_for_each_hw_ctx(q, hctx, i) {
 		if ((!blk_mq_hctx_has_pending(hctx) &&
-		    list_empty_careful(&hctx->dispatch)) ||
+		    list_empty_careful(&hctx->dispatch) &&
+		    !blk_mq_sched_has_work(hctx)) ||
 		    test_bit(BLK_MQ_S_STOPPED, &hctx->state))
 			continue;
 
@@ -983,6 +1208,7 @@ static inline void __blk_mq_insert_req_list(struct blk_mq_hw_ctx *hctx,
 		list_add(&rq->queuelist, &ctx->rq_list);
 	else
 		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	blk_mq_rqhash_add(ctx, rq);
 }
 
 static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
@@ -1017,6 +1243,30 @@ void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
 	blk_mq_put_ctx(current_ctx);
 }
 
+static inline bool hctx_allow_merges(struct blk_mq_hw_ctx *hctx)
+{
+	return (hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
+		!blk_queue_nomerges(hctx->queue);
+}
+
+/*
+ * Merge a request coming off a plug into the request still waiting on
+ * @ctx that it continues, if there is one.
+ */
+static bool blk_mq_attempt_req_merge(struct blk_mq_ctx *ctx,
+				     struct request *rq)
+{
+	struct request *prev;
+
+	prev = blk_mq_rqhash_find(ctx, blk_rq_pos(rq));
+	if (!prev || !blk_attempt_req_merge(rq->q, prev, rq))
+		return false;
+
+	blk_mq_rqhash_reposition(ctx, prev);
+	ctx->rq_plug_merged++;
+	return true;
+}
+
 static void blk_mq_insert_requests(struct request_queue *q,
 				     struct blk_mq_ctx *ctx,
 				     struct list_head *list,
@@ -1046,6 +1296,8 @@ static void blk_mq_insert_requests(struct request_queue *q,
 		rq = list_first_entry(list, struct request, queuelist);
 		list_del_init(&rq->queuelist);
 		rq->mq_ctx = ctx;
+		if (hctx_allow_merges(hctx) && blk_mq_attempt_req_merge(ctx, rq))
+			continue;
 		__blk_mq_insert_req_list(hctx, ctx, rq, false);
 	}
 	blk_mq_hctx_mark_pending(hctx, ctx);
@@ -1120,12 +1372,6 @@ static void blk_mq_bio_to_request(struct request *rq, struct bio *bio)
 		blk_account_io_start(rq, 1);
 }
 
-static inline bool hctx_allow_merges(struct blk_mq_hw_ctx *hctx)
-{
-	return (hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
-		!blk_queue_nomerges(hctx->queue);
-}
-
 static inline bool blk_mq_merge_queue_io(struct blk_mq_hw_ctx *hctx,
 					 struct blk_mq_ctx *ctx,
 					 struct request *rq, struct bio *bio)
@@ -1249,6 +1495,8 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 	struct blk_plug *plug;
 	struct request *same_queue_rq = NULL;
 	blk_qc_t cookie;
+	struct blkcg_gq *lat_blkg;
+	bool wb_acct;
 
 	blk_queue_bounce(q, &bio);
 
@@ -1259,16 +1507,29 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 
 	blk_queue_split(q, &bio, q->bio_split);
 
+	lat_blkg = blk_iolatency_wait(q, bio);
+	wb_acct = wbt_wait(q, bio);
+
 	if (!is_flush_fua && !blk_queue_nomerges(q)) {
 		if (blk_attempt_plug_merge(q, bio, &request_count,
-					   &same_queue_rq))
+					   &same_queue_rq)) {
+			if (wb_acct)
+				wbt_done(q);
+			blk_iolatency_done(lat_blkg);
 			return BLK_QC_T_NONE;
+		}
 	} else
 		request_count = blk_plug_queued_count(q);
 
 	rq = blk_mq_map_request(q, bio, &data);
-	if (unlikely(!rq))
+	if (unlikely(!rq)) {
+		if (wb_acct)
+			wbt_done(q);
+		blk_iolatency_done(lat_blkg);
 		return BLK_QC_T_NONE;
+	}
+	wbt_track(rq, wb_acct);
+	blk_iolatency_track(rq, lat_blkg);
 
 	cookie = blk_tag_to_qc_t(rq->tag, data.hctx->queue_num);
 
@@ -1285,7 +1546,7 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 	 * CPU this way.
 	 */
 	if (((plug && !blk_queue_nomerges(q)) || is_sync) &&
-	    !(data.hctx->flags & BLK_MQ_F_DEFER_ISSUE)) {
+	    !(data.hctx->flags & BLK_MQ_F_DEFER_ISSUE) && !q->elevator) {
 		struct request *old_rq = NULL;
 
 		blk_mq_bio_to_request(rq, bio);
@@ -1317,6 +1578,27 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 		goto done;
 	}
 
+	/*
+	 * The driver notifies the hardware once per batch, so keep the whole
+	 * plugged batch and hand it over at unplug, as blk_sq_make_request()
+	 * does.
+	 */
+	if (plug && (data.hctx->flags & BLK_MQ_F_DEFER_ISSUE)) {
+		blk_mq_bio_to_request(rq, bio);
+		if (!request_count)
+			trace_block_plug(q);
+
+		blk_mq_put_ctx(data.ctx);
+
+		if (request_count >= BLK_MAX_REQUEST_COUNT) {
+			blk_flush_plug_list(plug, false);
+			trace_block_plug(q);
+		}
+
+		list_add_tail(&rq->queuelist, &plug->mq_list);
+		return cookie;
+	}
+
 	if (!blk_mq_merge_queue_io(data.hctx, data.ctx, rq, bio)) {
 		/*
 		 * For a SYNC request, send it to the hardware immediately. For
@@ -1345,6 +1627,8 @@ static blk_qc_t blk_sq_make_request(struct request_queue *q, struct bio *bio)
 	struct blk_map_ctx data;
 	struct request *rq;
 	blk_qc_t cookie;
+	struct blkcg_gq *lat_blkg;
+	bool wb_acct;
 
 	blk_queue_bounce(q, &bio);
 
@@ -1355,13 +1639,26 @@ static blk_qc_t blk_sq_make_request(struct request_queue *q, struct bio *bio)
 
 	blk_queue_split(q, &bio, q->bio_split);
 
+	lat_blkg = blk_iolatency_wait(q, bio);
+	wb_acct = wbt_wait(q, bio);
+
 	if (!is_flush_fua && !blk_queue_nomerges(q) &&
-	    blk_attempt_plug_merge(q, bio, &request_count, NULL))
+	    blk_attempt_plug_merge(q, bio, &request_count, NULL)) {
+		if (wb_acct)
+			wbt_done(q);
+		blk_iolatency_done(lat_blkg);
 		return BLK_QC_T_NONE;
+	}
 
 	rq = blk_mq_map_request(q, bio, &data);
-	if (unlikely(!rq))
+	if (unlikely(!rq)) {
+		if (wb_acct)
+			wbt_done(q);
+		blk_iolatency_done(lat_blkg);
 		return BLK_QC_T_NONE;
+	}
+	wbt_track(rq, wb_acct);
+	blk_iolatency_track(rq, lat_blkg);
 
 	cookie = blk_tag_to_qc_t(rq->tag, data.hctx->queue_num);
 
@@ -1583,6 +1880,7 @@ static int blk_mq_hctx_cpu_offline(struct blk_mq_hw_ctx *hctx, int cpu)
 
 	spin_lock(&ctx->lock);
 	if (!list_empty(&ctx->rq_list)) {
+		blk_mq_rqhash_del_all(ctx);
 		list_splice_init(&ctx->rq_list, &tmp);
 		blk_mq_hctx_clear_pending(hctx, ctx);
 	}
@@ -1600,6 +1898,7 @@ static int blk_mq_hctx_cpu_offline(struct blk_mq_hw_ctx *hctx, int cpu)
 		rq = list_first_entry(&tmp, struct request, queuelist);
 		rq->mq_ctx = ctx;
 		list_move_tail(&rq->queuelist, &ctx->rq_list);
+		blk_mq_rqhash_add(ctx, rq);
 	}
 
 	hctx = q->mq_ops->map_queue(q, ctx->cpu);
@@ -1781,6 +2080,7 @@ static void blk_mq_init_cpu_queues(struct request_queue *q,
 		__ctx->cpu = i;
 		spin_lock_init(&__ctx->lock);
 		INIT_LIST_HEAD(&__ctx->rq_list);
+		hash_init(__ctx->merge_hash);
 		__ctx->queue = q;
 
 		/* If the cpu isn't online, the cpu is mapped to first hctx */
@@ -2095,6 +2395,7 @@ void blk_mq_free_queue(struct request_queue *q)
 	list_del_init(&q->all_q_node);
 	mutex_unlock(&all_q_mutex);
 
+	blk_mq_sched_teardown(q);
 	blk_mq_del_queue_tag_set(q);
 
 	blk_mq_exit_hw_queues(q, set, set->nr_hw_queues);
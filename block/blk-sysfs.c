@@ -320,6 +320,34 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+/* -1 is classic polling, 0 adaptive hybrid polling, else a sleep in usecs */
+static ssize_t queue_poll_delay_show(struct request_queue *q, char *page)
+{
+	int val = q->poll_nsec;
+
+	if (val > 0)
+		val /= 1000;
+	return sprintf(page, "%d\n", val);
+}
+
+static ssize_t queue_poll_delay_store(struct request_queue *q,
+				      const char *page, size_t count)
+{
+	int err, val;
+
+	if (!q->mq_ops || !q->mq_ops->poll)
+		return -EINVAL;
+
+	err = kstrtoint(page, 10, &val);
+	if (err < 0)
+		return err;
+	if (val < -1 || val > INT_MAX / 1000)
+		return -EINVAL;
+
+	WRITE_ONCE(q->poll_nsec, val > 0 ? val * 1000 : val);
+	return count;
+}
+
 static ssize_t queue_poll_show(struct request_queue *q, char *page)
 {
 	return queue_var_show(test_bit(QUEUE_FLAG_POLL, &q->queue_flags), page);
@@ -479,6 +507,66 @@ static struct queue_sysfs_entry queue_poll_entry = {
 	.store = queue_poll_store,
 };
 
+static struct queue_sysfs_entry queue_poll_delay_entry = {
+	.attr = {.name = "io_poll_delay", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_delay_show,
+	.store = queue_poll_delay_store,
+};
+
+#ifdef CONFIG_BLK_WBT
+static ssize_t queue_wb_lat_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%llu\n", div_u64(wbt_get_lat(q), 1000));
+}
+
+static ssize_t queue_wb_lat_store(struct request_queue *q, const char *page,
+				  size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+	int err;
+
+	ret = queue_var_store(&val, page, count);
+	if (ret < 0)
+		return ret;
+
+	err = wbt_set_lat(q, (u64)val * 1000);
+	return err ? err : ret;
+}
+
+static ssize_t queue_wb_window_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%llu\n", div_u64(wbt_get_window(q), 1000));
+}
+
+static ssize_t queue_wb_window_store(struct request_queue *q,
+				     const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+	int err;
+
+	ret = queue_var_store(&val, page, count);
+	if (ret < 0)
+		return ret;
+
+	err = wbt_set_window(q, (u64)val * 1000);
+	return err ? err : ret;
+}
+
+static struct queue_sysfs_entry queue_wb_lat_entry = {
+	.attr = {.name = "wbt_lat_usec", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_wb_lat_show,
+	.store = queue_wb_lat_store,
+};
+
+static struct queue_sysfs_entry queue_wb_window_entry = {
+	.attr = {.name = "wbt_window_usec", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_wb_window_show,
+	.store = queue_wb_window_store,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -504,6 +592,11 @@ static struct attribute *default_attrs[] = {
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
 	&queue_poll_entry.attr,
+	&queue_poll_delay_entry.attr,
+#ifdef CONFIG_BLK_WBT
+	&queue_wb_lat_entry.attr,
+	&queue_wb_window_entry.attr,
+#endif
 	NULL,
 };
 
@@ -580,6 +673,7 @@ static void blk_release_queue(struct kobject *kobj)
 
 	bdi_exit(&q->backing_dev_info);
 	blkcg_exit_queue(q);
+	wbt_exit(q);
 
 	if (q->elevator) {
 		spin_lock_irq(q->queue_lock);
@@ -657,6 +751,10 @@ int blk_register_queue(struct gendisk *disk)
 	if (q->mq_ops)
 		blk_mq_register_disk(disk);
 
+	/* Only request based queues see the requests to throttle */
+	if (q->mq_ops || q->request_fn)
+		wbt_init(q);
+
 	if (!q->request_fn)
 		return 0;
 
@@ -684,6 +782,12 @@ void blk_unregister_queue(struct gendisk *disk)
 
 	if (q->request_fn)
 		elv_unregister_queue(q);
+	else if (q->mq_ops) {
+		mutex_lock(&q->sysfs_lock);
+		if (q->elevator)
+			elv_unregister_queue(q);
+		mutex_unlock(&q->sysfs_lock);
+	}
 
 	kobject_uevent(&q->kobj, KOBJ_REMOVE);
 	kobject_del(&q->kobj);
@@ -0,0 +1,229 @@
+/*
+ * Writeback throttling
+ *
+ * Buffered writeback is submitted as fast as the flushers can build bios
+ * and fills the device queue, which reads then wait behind. Here the
+ * number of such writes in flight to a queue is limited to a depth that
+ * is scaled by the latency of the reads completing on it: every window,
+ * if the fastest read took longer than the target, the depth is halved,
+ * otherwise it is doubled back towards the queue depth.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/swap.h>
+#include <linux/timer.h>
+#include "blk.h"
+
+/* Default read latency targets, in nsecs */
+#define WBT_DEF_LAT_NONROT	(2 * NSEC_PER_MSEC)
+#define WBT_DEF_LAT_ROT		(75 * NSEC_PER_MSEC)
+
+#define WBT_DEF_WINDOW		(100 * NSEC_PER_MSEC)
+
+/* Reads needed in a window for its latency to count */
+#define WBT_MIN_SAMPLES		3
+
+struct rq_wb {
+	struct request_queue *q;
+	u64 min_lat_nsec;		/* Target read latency, 0 is off */
+	u64 window_nsec;
+	unsigned int scale_step;	/* Depth is the queue depth >> this */
+	atomic_t inflight;		/* Throttled writes in flight */
+	wait_queue_head_t wait;
+	struct timer_list window;
+
+	/* Reads completed in the current window */
+	atomic_t nr_reads;
+	atomic64_t fastest_read;
+};
+
+static unsigned int wbt_limit(struct rq_wb *rwb)
+{
+	/* kswapd writing back is as urgent as the reads */
+	if (current_is_kswapd())
+		return max(rwb->q->nr_requests, 1UL);
+	return max(rwb->q->nr_requests >> READ_ONCE(rwb->scale_step), 1UL);
+}
+
+/* Writeback the flushers submit on their own, not what a task waits for */
+static bool wbt_should_throttle(struct bio *bio)
+{
+	return (bio->bi_rw & REQ_WRITE) &&
+		!(bio->bi_rw & (REQ_SYNC | REQ_FLUSH | REQ_FUA | REQ_DISCARD));
+}
+
+static void wbt_arm_window(struct rq_wb *rwb)
+{
+	if (!timer_pending(&rwb->window))
+		mod_timer(&rwb->window,
+			  jiffies + nsecs_to_jiffies(rwb->window_nsec));
+}
+
+/**
+ * wbt_wait - wait for room in the writeback depth of @q
+ * @q:		the queue @bio goes to
+ * @bio:	the bio about to get a request
+ *
+ * Returns true if @bio was counted in the depth, and the request it ends
+ * up in must be passed to wbt_track(), or wbt_done() called if none.
+ */
+bool wbt_wait(struct request_queue *q, struct bio *bio)
+{
+	struct rq_wb *rwb = q->rq_wb;
+	DEFINE_WAIT(wait);
+
+	if (!rwb || !READ_ONCE(rwb->min_lat_nsec) || !wbt_should_throttle(bio))
+		return false;
+
+	wbt_arm_window(rwb);
+	if (atomic_inc_below(&rwb->inflight, wbt_limit(rwb)))
+		return true;
+
+	for (;;) {
+		prepare_to_wait_exclusive(&rwb->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		if (atomic_inc_below(&rwb->inflight, wbt_limit(rwb)))
+			break;
+		/* Flushes the plug, which may hold our own writes */
+		io_schedule();
+	}
+	finish_wait(&rwb->wait, &wait);
+
+	return true;
+}
+
+void wbt_done(struct request_queue *q)
+{
+	struct rq_wb *rwb = q->rq_wb;
+	int inflight;
+
+	inflight = atomic_dec_return(&rwb->inflight);
+	if (waitqueue_active(&rwb->wait) && inflight < wbt_limit(rwb))
+		wake_up(&rwb->wait);
+}
+
+/* Account the latency of a read request completing */
+void wbt_complete(struct request *rq)
+{
+	struct rq_wb *rwb = rq->q->rq_wb;
+	u64 lat, fastest;
+
+	if (!rwb || rq->cmd_type != REQ_TYPE_FS || rq_data_dir(rq) != READ ||
+	    !rq->wbt_issue_ns)
+		return;
+
+	lat = ktime_get_ns() - rq->wbt_issue_ns;
+	rq->wbt_issue_ns = 0;
+	atomic_inc(&rwb->nr_reads);
+
+	fastest = atomic64_read(&rwb->fastest_read);
+	while (lat < fastest) {
+		u64 old = atomic64_cmpxchg(&rwb->fastest_read, fastest, lat);
+
+		if (old == fastest)
+			break;
+		fastest = old;
+	}
+}
+
+static void wbt_window_fn(unsigned long data)
+{
+	struct rq_wb *rwb = (struct rq_wb *)data;
+	unsigned int step = rwb->scale_step;
+	int nr_reads;
+	u64 fastest;
+
+	nr_reads = atomic_xchg(&rwb->nr_reads, 0);
+	fastest = atomic64_xchg(&rwb->fastest_read, U64_MAX);
+
+	if (nr_reads >= WBT_MIN_SAMPLES && fastest > rwb->min_lat_nsec) {
+		/* Even the fastest read was late: writes get half the room */
+		if ((rwb->q->nr_requests >> step) > 1)
+			step++;
+	} else if (step)
+		step--;
+
+	if (step != rwb->scale_step) {
+		WRITE_ONCE(rwb->scale_step, step);
+		wake_up_all(&rwb->wait);
+	}
+
+	/* Keep watching while there is anything to watch */
+	if (step || nr_reads || atomic_read(&rwb->inflight))
+		wbt_arm_window(rwb);
+}
+
+u64 wbt_get_lat(struct request_queue *q)
+{
+	return q->rq_wb ? q->rq_wb->min_lat_nsec : 0;
+}
+
+int wbt_set_lat(struct request_queue *q, u64 lat_nsec)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (!rwb)
+		return -EINVAL;
+
+	WRITE_ONCE(rwb->min_lat_nsec, lat_nsec);
+	if (!lat_nsec)
+		WRITE_ONCE(rwb->scale_step, 0);
+	wake_up_all(&rwb->wait);
+	return 0;
+}
+
+u64 wbt_get_window(struct request_queue *q)
+{
+	return q->rq_wb ? q->rq_wb->window_nsec : 0;
+}
+
+int wbt_set_window(struct request_queue *q, u64 window_nsec)
+{
+	if (!q->rq_wb || !window_nsec)
+		return -EINVAL;
+
+	WRITE_ONCE(q->rq_wb->window_nsec, window_nsec);
+	return 0;
+}
+
+int wbt_init(struct request_queue *q)
+{
+	struct rq_wb *rwb;
+
+	if (q->rq_wb)
+		return 0;
+
+	rwb = kzalloc_node(sizeof(*rwb), GFP_KERNEL, q->node);
+	if (!rwb)
+		return -ENOMEM;
+
+	rwb->q = q;
+	if (blk_queue_nonrot(q))
+		rwb->min_lat_nsec = WBT_DEF_LAT_NONROT;
+	else
+		rwb->min_lat_nsec = WBT_DEF_LAT_ROT;
+	rwb->window_nsec = WBT_DEF_WINDOW;
+	atomic_set(&rwb->inflight, 0);
+	init_waitqueue_head(&rwb->wait);
+	setup_timer(&rwb->window, wbt_window_fn, (unsigned long)rwb);
+	atomic_set(&rwb->nr_reads, 0);
+	atomic64_set(&rwb->fastest_read, U64_MAX);
+
+	q->rq_wb = rwb;
+	return 0;
+}
+
+void wbt_exit(struct request_queue *q)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (rwb) {
+		del_timer_sync(&rwb->window);
+		q->rq_wb = NULL;
+		kfree(rwb);
+	}
+}
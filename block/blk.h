@@ -118,6 +118,7 @@ void blk_account_io_done(struct request *req);
 enum rq_atomic_flags {
 	REQ_ATOM_COMPLETE = 0,
 	REQ_ATOM_STARTED,
+	REQ_ATOM_POLL_SLEPT,
 };
 
 /*
@@ -302,4 +303,120 @@ static inline int blk_throtl_init(struct request_queue *q) { return 0; }
 static inline void blk_throtl_exit(struct request_queue *q) { }
 #endif /* CONFIG_BLK_DEV_THROTTLING */
 
+/* Increment @v unless that takes it to @below or above */
+static inline bool atomic_inc_below(atomic_t *v, int below)
+{
+	int cur = atomic_read(v);
+
+	for (;;) {
+		int old;
+
+		if (cur >= below)
+			return false;
+		old = atomic_cmpxchg(v, cur, cur + 1);
+		if (old == cur)
+			return true;
+		cur = old;
+	}
+}
+
+/*
+ * cgroup latency targets
+ */
+#ifdef CONFIG_BLK_CGROUP_IOLATENCY
+extern int blk_iolatency_init(struct request_queue *q);
+extern void blk_iolatency_exit(struct request_queue *q);
+extern struct blkcg_gq *blk_iolatency_wait(struct request_queue *q,
+					   struct bio *bio);
+extern void __blk_iolatency_done(struct blkcg_gq *blkg);
+extern void __blk_iolatency_rq_done(struct request *rq);
+
+/* Release what blk_iolatency_wait() let in, when no request took it */
+static inline void blk_iolatency_done(struct blkcg_gq *blkg)
+{
+	if (blkg)
+		__blk_iolatency_done(blkg);
+}
+
+/* @rq now holds what blk_iolatency_wait() let in, released when freed */
+static inline void blk_iolatency_track(struct request *rq,
+				       struct blkcg_gq *blkg)
+{
+	rq->iolat_blkg = blkg;
+}
+
+static inline void blk_iolatency_rq_done(struct request *rq)
+{
+	if (rq->iolat_blkg)
+		__blk_iolatency_rq_done(rq);
+}
+
+static inline void blk_iolatency_issue(struct request *rq)
+{
+	if (rq->iolat_blkg)
+		rq->iolat_issue_ns = ktime_get_ns();
+}
+#else /* CONFIG_BLK_CGROUP_IOLATENCY */
+static inline int blk_iolatency_init(struct request_queue *q) { return 0; }
+static inline void blk_iolatency_exit(struct request_queue *q) { }
+static inline struct blkcg_gq *blk_iolatency_wait(struct request_queue *q,
+						  struct bio *bio)
+{
+	return NULL;
+}
+static inline void blk_iolatency_done(struct blkcg_gq *blkg) { }
+static inline void blk_iolatency_track(struct request *rq,
+				       struct blkcg_gq *blkg) { }
+static inline void blk_iolatency_rq_done(struct request *rq) { }
+static inline void blk_iolatency_issue(struct request *rq) { }
+#endif /* CONFIG_BLK_CGROUP_IOLATENCY */
+
+/*
+ * Writeback throttling
+ */
+#ifdef CONFIG_BLK_WBT
+extern bool wbt_wait(struct request_queue *q, struct bio *bio);
+extern void wbt_done(struct request_queue *q);
+extern void wbt_complete(struct request *rq);
+extern int wbt_init(struct request_queue *q);
+extern void wbt_exit(struct request_queue *q);
+extern u64 wbt_get_lat(struct request_queue *q);
+extern int wbt_set_lat(struct request_queue *q, u64 lat_nsec);
+extern u64 wbt_get_window(struct request_queue *q);
+extern int wbt_set_window(struct request_queue *q, u64 window_nsec);
+
+/* @rq now holds what wbt_wait() let in, released when it is freed */
+static inline void wbt_track(struct request *rq, bool tracked)
+{
+	if (tracked)
+		rq->cmd_flags |= REQ_WBT;
+}
+
+static inline void wbt_rq_done(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_WBT) {
+		rq->cmd_flags &= ~REQ_WBT;
+		wbt_done(rq->q);
+	}
+}
+
+static inline void wbt_issue(struct request *rq)
+{
+	if (rq->q->rq_wb)
+		rq->wbt_issue_ns = ktime_get_ns();
+}
+#else /* CONFIG_BLK_WBT */
+static inline bool wbt_wait(struct request_queue *q, struct bio *bio)
+{
+	return false;
+}
+static inline void wbt_done(struct request_queue *q) { }
+static inline void wbt_complete(struct request *rq) { }
+static inline int wbt_init(struct request_queue *q) { return 0; }
+static inline void wbt_exit(struct request_queue *q) { }
+static inline void wbt_track(struct request *rq, bool tracked) { }
+static inline void wbt_rq_done(struct request *rq) { }
+static inline void wbt_issue(struct request *rq) { }
+#endif /* CONFIG_BLK_WBT */
+
 #endif /* BLK_INTERNAL_H */
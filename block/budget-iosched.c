@@ -0,0 +1,340 @@
+/*
+ *  Budget i/o scheduler for blk-mq.
+ *
+ *  Nothing is sorted or merged here: reads and writes each have a fifo
+ *  and a depth, the number of them that may be in the driver at once.
+ *  Reads always get the whole queue depth. Every window the fastest
+ *  read of the window is held against the read latency target, and the
+ *  depth left to the writes is halved while reads are late, and grown
+ *  back otherwise, faster when the writes miss their own target.
+ */
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/elevator.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/timer.h>
+#include <linux/ktime.h>
+
+static const unsigned int read_lat_usec = 2000;
+static const unsigned int write_lat_usec = 10000;
+
+#define BUDGET_WINDOW		(HZ / 10)
+
+/* Completions needed in a window for its latency to count */
+#define BUDGET_MIN_SAMPLES	3
+
+struct budget_data {
+	unsigned int lat_usec[2];
+};
+
+struct budget_domain {
+	struct list_head fifo;
+	atomic_t inflight;
+	unsigned int depth;
+
+	/* Completions of the current window */
+	atomic_t nr_samples;
+	atomic64_t fastest;		/* usecs */
+};
+
+struct budget_hctx {
+	spinlock_t lock;
+	struct blk_mq_hw_ctx *hctx;
+	struct budget_domain dom[2];	/* READ and WRITE */
+	struct timer_list window;
+};
+
+static unsigned int budget_max_depth(struct blk_mq_hw_ctx *hctx)
+{
+	return max(hctx->queue->nr_requests, 1UL);
+}
+
+/* Issue time in usecs, as kept in the request */
+static inline unsigned long budget_now(void)
+{
+	return (unsigned long)(ktime_get_ns() >> 10);
+}
+
+static void budget_arm_window(struct budget_hctx *bh)
+{
+	if (!timer_pending(&bh->window))
+		mod_timer(&bh->window, jiffies + BUDGET_WINDOW);
+}
+
+static void budget_insert_requests(struct blk_mq_hw_ctx *hctx,
+				   struct list_head *list)
+{
+	struct budget_hctx *bh = hctx->sched_data;
+	struct request *rq, *next;
+
+	spin_lock(&bh->lock);
+	list_for_each_entry_safe(rq, next, list, queuelist) {
+		list_move_tail(&rq->queuelist, &bh->dom[rq_data_dir(rq)].fifo);
+	}
+	spin_unlock(&bh->lock);
+
+	budget_arm_window(bh);
+}
+
+/* Take a request of @dir for the driver if its depth has room */
+static struct request *budget_take(struct budget_hctx *bh, int dir)
+{
+	struct budget_domain *dom = &bh->dom[dir];
+	struct request *rq;
+
+	if (list_empty(&dom->fifo) ||
+	    atomic_read(&dom->inflight) >= READ_ONCE(dom->depth))
+		return NULL;
+
+	rq = list_first_entry(&dom->fifo, struct request, queuelist);
+	list_del_init(&rq->queuelist);
+	atomic_inc(&dom->inflight);
+	rq->elv.priv[1] = (void *)budget_now();
+	return rq;
+}
+
+static struct request *budget_dispatch_request(struct blk_mq_hw_ctx *hctx)
+{
+	struct budget_hctx *bh = hctx->sched_data;
+	struct request *rq;
+
+	spin_lock(&bh->lock);
+	rq = budget_take(bh, READ);
+	if (!rq)
+		rq = budget_take(bh, WRITE);
+	spin_unlock(&bh->lock);
+
+	return rq;
+}
+
+static bool budget_has_work(struct blk_mq_hw_ctx *hctx)
+{
+	struct budget_hctx *bh = hctx->sched_data;
+
+	return !list_empty_careful(&bh->dom[READ].fifo) ||
+		!list_empty_careful(&bh->dom[WRITE].fifo);
+}
+
+static void budget_add_sample(struct budget_domain *dom, u64 lat)
+{
+	u64 fastest = atomic64_read(&dom->fastest);
+
+	atomic_inc(&dom->nr_samples);
+	while (lat < fastest) {
+		u64 old = atomic64_cmpxchg(&dom->fastest, fastest, lat);
+
+		if (old == fastest)
+			break;
+		fastest = old;
+	}
+}
+
+static void budget_completed_request(struct blk_mq_hw_ctx *hctx,
+				     struct request *rq)
+{
+	struct budget_hctx *bh = hctx->sched_data;
+	struct budget_domain *dom = &bh->dom[rq_data_dir(rq)];
+
+	atomic_dec(&dom->inflight);
+	budget_add_sample(dom, budget_now() - (unsigned long)rq->elv.priv[1]);
+
+	/* The room just freed may be what the queued requests wait for */
+	if (budget_has_work(hctx))
+		blk_mq_run_hw_queue(hctx, true);
+}
+
+static void budget_requeue_request(struct blk_mq_hw_ctx *hctx,
+				   struct request *rq)
+{
+	struct budget_hctx *bh = hctx->sched_data;
+
+	atomic_dec(&bh->dom[rq_data_dir(rq)].inflight);
+}
+
+/* Whether the fastest completion of the window was late */
+static bool budget_late(struct budget_domain *dom, unsigned int target)
+{
+	int nr = atomic_xchg(&dom->nr_samples, 0);
+	u64 fastest = atomic64_xchg(&dom->fastest, U64_MAX);
+
+	return nr >= BUDGET_MIN_SAMPLES && fastest > target;
+}
+
+static void budget_window_fn(unsigned long data)
+{
+	struct budget_hctx *bh = (struct budget_hctx *)data;
+	struct blk_mq_hw_ctx *hctx = bh->hctx;
+	struct budget_data *bd = hctx->queue->elevator->elevator_data;
+	struct budget_domain *wr = &bh->dom[WRITE];
+	unsigned int max_depth = budget_max_depth(hctx);
+	unsigned int depth = wr->depth;
+	bool reads_late, writes_late;
+
+	reads_late = budget_late(&bh->dom[READ], READ_ONCE(bd->lat_usec[READ]));
+	writes_late = budget_late(wr, READ_ONCE(bd->lat_usec[WRITE]));
+
+	if (reads_late)
+		depth = max(depth / 2, 1U);
+	else if (writes_late)
+		depth = min(depth * 2, max_depth);
+	else
+		depth = min(depth + depth / 4 + 1, max_depth);
+
+	if (depth != wr->depth) {
+		bool grown = depth > wr->depth;
+
+		WRITE_ONCE(wr->depth, depth);
+		if (grown && budget_has_work(hctx))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+
+	/* Keep watching while there is anything to watch */
+	if (depth < max_depth || budget_has_work(hctx) ||
+	    atomic_read(&bh->dom[READ].inflight) || atomic_read(&wr->inflight))
+		budget_arm_window(bh);
+}
+
+static int budget_init_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
+{
+	struct budget_hctx *bh;
+	int dir;
+
+	bh = kzalloc_node(sizeof(*bh), GFP_KERNEL, hctx->numa_node);
+	if (!bh)
+		return -ENOMEM;
+
+	spin_lock_init(&bh->lock);
+	bh->hctx = hctx;
+	for (dir = READ; dir <= WRITE; dir++) {
+		struct budget_domain *dom = &bh->dom[dir];
+
+		INIT_LIST_HEAD(&dom->fifo);
+		atomic_set(&dom->inflight, 0);
+		dom->depth = budget_max_depth(hctx);
+		atomic_set(&dom->nr_samples, 0);
+		atomic64_set(&dom->fastest, U64_MAX);
+	}
+	setup_timer(&bh->window, budget_window_fn, (unsigned long)bh);
+
+	hctx->sched_data = bh;
+	return 0;
+}
+
+static void budget_exit_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
+{
+	struct budget_hctx *bh = hctx->sched_data;
+
+	del_timer_sync(&bh->window);
+	BUG_ON(!list_empty(&bh->dom[READ].fifo));
+	BUG_ON(!list_empty(&bh->dom[WRITE].fifo));
+
+	kfree(bh);
+}
+
+static void budget_exit_sched(struct elevator_queue *e)
+{
+	kfree(e->elevator_data);
+}
+
+static int budget_init_sched(struct request_queue *q, struct elevator_type *e)
+{
+	struct budget_data *bd;
+	struct elevator_queue *eq;
+
+	eq = elevator_alloc(q, e);
+	if (!eq)
+		return -ENOMEM;
+
+	bd = kzalloc_node(sizeof(*bd), GFP_KERNEL, q->node);
+	if (!bd) {
+		kobject_put(&eq->kobj);
+		return -ENOMEM;
+	}
+	eq->elevator_data = bd;
+
+	bd->lat_usec[READ] = read_lat_usec;
+	bd->lat_usec[WRITE] = write_lat_usec;
+
+	q->elevator = eq;
+	return 0;
+}
+
+/*
+ * sysfs parts below
+ */
+
+#define SHOW_FUNCTION(__FUNC, __VAR)					\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct budget_data *bd = e->elevator_data;			\
+	return sprintf(page, "%u\n", __VAR);				\
+}
+SHOW_FUNCTION(budget_read_lat_usec_show, bd->lat_usec[READ]);
+SHOW_FUNCTION(budget_write_lat_usec_show, bd->lat_usec[WRITE]);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR)					\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct budget_data *bd = e->elevator_data;			\
+	unsigned int __data;						\
+	int ret = kstrtouint(page, 10, &__data);			\
+	if (ret)							\
+		return ret;						\
+	if (!__data)							\
+		return -EINVAL;						\
+	WRITE_ONCE(*(__PTR), __data);					\
+	return count;							\
+}
+STORE_FUNCTION(budget_read_lat_usec_store, &bd->lat_usec[READ]);
+STORE_FUNCTION(budget_write_lat_usec_store, &bd->lat_usec[WRITE]);
+#undef STORE_FUNCTION
+
+#define BUDGET_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, budget_##name##_show, \
+				      budget_##name##_store)
+
+static struct elv_fs_entry budget_attrs[] = {
+	BUDGET_ATTR(read_lat_usec),
+	BUDGET_ATTR(write_lat_usec),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_budget = {
+	.mq_ops = {
+		.init_sched =		budget_init_sched,
+		.exit_sched =		budget_exit_sched,
+		.init_hctx =		budget_init_hctx,
+		.exit_hctx =		budget_exit_hctx,
+		.insert_requests =	budget_insert_requests,
+		.dispatch_request =	budget_dispatch_request,
+		.has_work =		budget_has_work,
+		.completed_request =	budget_completed_request,
+		.requeue_request =	budget_requeue_request,
+	},
+	.uses_mq = true,
+
+	.elevator_attrs = budget_attrs,
+	.elevator_name = "budget",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init budget_init(void)
+{
+	return elv_register(&iosched_budget);
+}
+
+static void __exit budget_exit(void)
+{
+	elv_unregister(&iosched_budget);
+}
+
+module_init(budget_init);
+module_exit(budget_exit);
+
+MODULE_ALIAS("budget-iosched");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Latency budget IO scheduler for blk-mq");
@@ -39,6 +39,7 @@ struct mcryptd_flush_list {
 };
 
 static struct mcryptd_flush_list __percpu *mcryptd_flist;
+static struct mcryptd_queue mqueue;
 
 struct hashd_instance_ctx {
 	struct crypto_shash_spawn spawn;
@@ -61,10 +62,38 @@ void mcryptd_arm_flusher(struct mcryptd_alg_cstate *cstate, unsigned long delay)
 		queue_delayed_work_on(smp_processor_id(), kcrypto_wq,
 			&cstate->flush, delay);
 		mutex_unlock(&flist->lock);
+	} else if (time_before(jiffies + delay, cstate->next_flush)) {
+		/* a request with a shorter deadline pulls the flush in */
+		flist = per_cpu_ptr(mcryptd_flist, smp_processor_id());
+		mutex_lock(&flist->lock);
+		cstate->next_flush = jiffies + delay;
+		mod_delayed_work_on(smp_processor_id(), kcrypto_wq,
+			&cstate->flush, delay);
+		mutex_unlock(&flist->lock);
 	}
 }
 EXPORT_SYMBOL(mcryptd_arm_flusher);
 
+/*
+ * Pick the flush delay for a request entering a multibuffer algorithm,
+ * interval being the longest time in usecs it may sit in a partially
+ * filled lane.  Waiting only pays off while more requests are queued
+ * behind it on this cpu to fill the remaining lanes, so the delay is
+ * scaled with the depth of the queue and an idle queue gets flushed
+ * right away.
+ */
+unsigned long mcryptd_flush_delay(unsigned int interval)
+{
+	unsigned int qlen = this_cpu_read(mqueue.cpu_queue->queue.qlen);
+
+	if (!qlen)
+		return 0;
+	if (qlen >= MCRYPTD_BATCH)
+		return usecs_to_jiffies(interval);
+	return usecs_to_jiffies(interval * qlen / MCRYPTD_BATCH);
+}
+EXPORT_SYMBOL(mcryptd_flush_delay);
+
 static int mcryptd_init_queue(struct mcryptd_queue *queue,
 			     unsigned int max_cpu_qlen)
 {
@@ -552,8 +581,6 @@ out_put_alg:
 	return err;
 }
 
-static struct mcryptd_queue mqueue;
-
 static int mcryptd_create(struct crypto_template *tmpl, struct rtattr **tb)
 {
 	struct crypto_attr_type *algt;
@@ -435,6 +435,34 @@ int driver_probe_device(struct device_driver *drv, struct device *dev)
 	return ret;
 }
 
+/*
+ * async_probe_bus=<bus>[,<bus>...] makes drivers of the listed buses probe
+ * asynchronously by default, as if the buses had set ->async_probe.
+ */
+static char async_probe_bus[64];
+
+static int __init save_async_probe_bus(char *str)
+{
+	strlcpy(async_probe_bus, str, sizeof(async_probe_bus));
+	return 1;
+}
+__setup("async_probe_bus=", save_async_probe_bus);
+
+static bool bus_requested_async_probing(struct bus_type *bus)
+{
+	size_t len = strlen(bus->name);
+	const char *p = async_probe_bus;
+
+	while (*p) {
+		if (!strncmp(p, bus->name, len) && (!p[len] || p[len] == ','))
+			return true;
+		p = strchrnul(p, ',');
+		if (*p)
+			p++;
+	}
+	return false;
+}
+
 bool driver_allows_async_probing(struct device_driver *drv)
 {
 	switch (drv->probe_type) {
@@ -448,6 +476,10 @@ bool driver_allows_async_probing(struct device_driver *drv)
 		if (module_requested_async_probing(drv->owner))
 			return true;
 
+		if (drv->bus->async_probe ||
+		    bus_requested_async_probing(drv->bus))
+			return true;
+
 		return false;
 	}
 }
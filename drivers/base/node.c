@@ -18,6 +18,7 @@
 #include <linux/device.h>
 #include <linux/swap.h>
 #include <linux/slab.h>
+#include <linux/migrate.h>
 
 static struct bus_type node_subsys = {
 	.name = "node",
@@ -200,6 +201,30 @@ static ssize_t node_read_distance(struct device *dev,
 }
 static DEVICE_ATTR(distance, S_IRUGO, node_read_distance, NULL);
 
+static ssize_t node_read_demotion_target(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", next_demotion_node(dev->id));
+}
+
+static ssize_t node_write_demotion_target(struct device *dev,
+			struct device_attribute *attr,
+			const char *buf, size_t count)
+{
+	int target, err;
+
+	err = kstrtoint(buf, 10, &target);
+	if (err)
+		return err;
+	if (target < 0)
+		target = NUMA_NO_NODE;
+
+	err = set_demotion_target(dev->id, target);
+	return err ? err : count;
+}
+static DEVICE_ATTR(demotion_target, S_IRUGO | S_IWUSR,
+		   node_read_demotion_target, node_write_demotion_target);
+
 static struct attribute *node_dev_attrs[] = {
 	&dev_attr_cpumap.attr,
 	&dev_attr_cpulist.attr,
@@ -207,6 +232,7 @@ static struct attribute *node_dev_attrs[] = {
 	&dev_attr_numastat.attr,
 	&dev_attr_distance.attr,
 	&dev_attr_vmstat.attr,
+	&dev_attr_demotion_target.attr,
 	NULL
 };
 ATTRIBUTE_GROUPS(node_dev);
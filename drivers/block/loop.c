@@ -85,6 +85,8 @@ static DEFINE_MUTEX(loop_index_mutex);
 
 static int max_part;
 static int part_shift;
+static int nr_queues;
+static bool dio = true;
 
 static int transfer_xor(struct loop_device *lo, int cmd,
 			struct page *raw_page, unsigned raw_off,
@@ -849,20 +851,53 @@ static void loop_config_discard(struct loop_device *lo)
 	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, q);
 }
 
+static void loop_queue_work(struct kthread_work *work);
+
+static void loop_stop_workers(struct loop_device *lo, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		flush_kthread_worker(&lo->workers[i].worker);
+		kthread_stop(lo->workers[i].task);
+	}
+	kfree(lo->workers);
+	lo->workers = NULL;
+}
+
 static void loop_unprepare_queue(struct loop_device *lo)
 {
-	flush_kthread_worker(&lo->worker);
-	kthread_stop(lo->worker_task);
+	loop_stop_workers(lo, lo->tag_set.nr_hw_queues);
 }
 
 static int loop_prepare_queue(struct loop_device *lo)
 {
-	init_kthread_worker(&lo->worker);
-	lo->worker_task = kthread_run(kthread_worker_fn,
-			&lo->worker, "loop%d", lo->lo_number);
-	if (IS_ERR(lo->worker_task))
+	unsigned int nr = lo->tag_set.nr_hw_queues;
+	unsigned int i;
+
+	lo->workers = kcalloc(nr, sizeof(*lo->workers), GFP_KERNEL);
+	if (!lo->workers)
 		return -ENOMEM;
-	set_user_nice(lo->worker_task, MIN_NICE);
+
+	for (i = 0; i < nr; i++) {
+		struct loop_worker *w = &lo->workers[i];
+
+		init_kthread_worker(&w->worker);
+		init_kthread_work(&w->work, loop_queue_work);
+		spin_lock_init(&w->lock);
+		INIT_LIST_HEAD(&w->cmd_list);
+		if (nr == 1)
+			w->task = kthread_run(kthread_worker_fn, &w->worker,
+					      "loop%d", lo->lo_number);
+		else
+			w->task = kthread_run(kthread_worker_fn, &w->worker,
+					      "loop%d/%u", lo->lo_number, i);
+		if (IS_ERR(w->task)) {
+			loop_stop_workers(lo, i);
+			return -ENOMEM;
+		}
+		set_user_nice(w->task, MIN_NICE);
+	}
 	return 0;
 }
 
@@ -945,7 +980,8 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	if (!(lo_flags & LO_FLAGS_READ_ONLY) && file->f_op->fsync)
 		blk_queue_flush(lo->lo_queue, REQ_FLUSH);
 
-	loop_update_dio(lo);
+	/* go direct whenever the backing file allows it, unless told not to */
+	__loop_update_dio(lo, dio || io_is_direct(file));
 	set_capacity(lo->lo_disk, size);
 	bd_set_size(bdev, size << 9);
 	loop_sysfs_init(lo);
@@ -1607,6 +1643,10 @@ module_param(max_loop, int, S_IRUGO);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, S_IRUGO);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+module_param(nr_queues, int, S_IRUGO);
+MODULE_PARM_DESC(nr_queues, "Number of hardware queues per loop device (default: one per online CPU)");
+module_param(dio, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(dio, "Use direct I/O on backing files that support it (default: on)");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1653,6 +1693,8 @@ static int loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 {
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(bd->rq);
 	struct loop_device *lo = cmd->rq->q->queuedata;
+	struct loop_worker *w;
+	unsigned long flags;
 
 	blk_mq_start_request(bd->rq);
 
@@ -1665,7 +1707,17 @@ static int loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 	else
 		cmd->use_aio = false;
 
-	queue_kthread_work(&lo->worker, &cmd->work);
+	/*
+	 * A transfer function may keep state across blocks (cryptoloop's
+	 * cipher does), so while one is set everything goes to one worker.
+	 * The queue is frozen while ->transfer changes.
+	 */
+	w = &lo->workers[lo->transfer ? 0 : hctx->queue_num];
+
+	spin_lock_irqsave(&w->lock, flags);
+	list_add_tail(&cmd->list, &w->cmd_list);
+	spin_unlock_irqrestore(&w->lock, flags);
+	queue_kthread_work(&w->worker, &w->work);
 
 	return BLK_MQ_RQ_QUEUE_OK;
 }
@@ -1688,12 +1740,27 @@ static void loop_handle_cmd(struct loop_cmd *cmd)
 		blk_mq_complete_request(cmd->rq, ret ? -EIO : 0);
 }
 
+/*
+ * Run everything queued since the last pass under one plug, so that the
+ * backing file's direct I/O for a batch is submitted together.
+ */
 static void loop_queue_work(struct kthread_work *work)
 {
-	struct loop_cmd *cmd =
-		container_of(work, struct loop_cmd, work);
+	struct loop_worker *w = container_of(work, struct loop_worker, work);
+	struct loop_cmd *cmd, *next;
+	struct blk_plug plug;
+	LIST_HEAD(cmds);
+
+	spin_lock_irq(&w->lock);
+	list_splice_init(&w->cmd_list, &cmds);
+	spin_unlock_irq(&w->lock);
 
-	loop_handle_cmd(cmd);
+	blk_start_plug(&plug);
+	list_for_each_entry_safe(cmd, next, &cmds, list) {
+		list_del_init(&cmd->list);
+		loop_handle_cmd(cmd);
+	}
+	blk_finish_plug(&plug);
 }
 
 static int loop_init_request(void *data, struct request *rq,
@@ -1703,7 +1770,7 @@ static int loop_init_request(void *data, struct request *rq,
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
 
 	cmd->rq = rq;
-	init_kthread_work(&cmd->work, loop_queue_work);
+	INIT_LIST_HEAD(&cmd->list);
 
 	return 0;
 }
@@ -1741,7 +1808,7 @@ static int loop_add(struct loop_device **l, int i)
 
 	err = -ENOMEM;
 	lo->tag_set.ops = &loop_mq_ops;
-	lo->tag_set.nr_hw_queues = 1;
+	lo->tag_set.nr_hw_queues = nr_queues;
 	lo->tag_set.queue_depth = 128;
 	lo->tag_set.numa_node = NUMA_NO_NODE;
 	lo->tag_set.cmd_size = sizeof(struct loop_cmd);
@@ -1958,6 +2025,9 @@ static int __init loop_init(void)
 	if (err < 0)
 		return err;
 
+	if (nr_queues <= 0 || nr_queues > nr_cpu_ids)
+		nr_queues = num_online_cpus();
+
 	part_shift = 0;
 	if (max_part > 0) {
 		part_shift = fls(max_part);
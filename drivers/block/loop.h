@@ -26,6 +26,15 @@ enum {
 
 struct loop_func_table;
 
+/* one per hardware queue; runs the commands queued on it in batches */
+struct loop_worker {
+	struct kthread_worker	worker;
+	struct task_struct	*task;
+	struct kthread_work	work;
+	spinlock_t		lock;
+	struct list_head	cmd_list;
+};
+
 struct loop_device {
 	int		lo_number;
 	atomic_t	lo_refcnt;
@@ -56,8 +65,7 @@ struct loop_device {
 	spinlock_t		lo_lock;
 	int			lo_state;
 	struct mutex		lo_ctl_mutex;
-	struct kthread_worker	worker;
-	struct task_struct	*worker_task;
+	struct loop_worker	*workers;
 	bool			use_dio;
 
 	struct request_queue	*lo_queue;
@@ -66,7 +74,6 @@ struct loop_device {
 };
 
 struct loop_cmd {
-	struct kthread_work work;
 	struct request *rq;
 	struct list_head list;
 	bool use_aio;           /* use AIO interface to handle I/O */
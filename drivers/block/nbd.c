@@ -15,6 +15,7 @@
 #include <linux/major.h>
 
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/sched.h>
@@ -34,35 +35,79 @@
 #include <linux/kthread.h>
 #include <linux/types.h>
 #include <linux/debugfs.h>
+#include <linux/workqueue.h>
 
 #include <asm/uaccess.h>
 #include <asm/types.h>
 
 #include <linux/nbd.h>
 
+/*
+ * One per socket handed to us with NBD_SET_SOCK.  Hardware queue i sends
+ * on connection i % num_connections, and replies come back on the socket
+ * the request went out on.  A connection that fails is marked dead, its
+ * requests go to the others, and NBD_SET_SOCK on a running device puts a
+ * new socket in its place.
+ */
+struct nbd_sock_stats {
+	u64 requests;		/* sent */
+	u64 replies;
+	u64 bytes_sent;
+	u64 bytes_received;
+	u64 errors;
+	u64 requeued;		/* handed to another connection */
+};
+
+struct nbd_sock {
+	struct socket *sock;
+	struct mutex tx_lock;
+	unsigned long flags;		/* NBD_SOCK_* */
+	struct nbd_device *nbd;
+	int index;
+
+	spinlock_t queue_lock;
+	struct list_head send_queue;	/* commands waiting to be sent */
+	struct work_struct send_work;
+	struct work_struct recv_work;
+
+	unsigned int reconnects;
+	struct nbd_sock_stats stats;
+};
+
+#define NBD_SOCK_DEAD		0
+
+struct nbd_cmd {
+	struct nbd_device *nbd;
+	struct list_head list;
+	unsigned long flags;		/* NBD_CMD_* */
+	int index;			/* the connection it went out on */
+};
+
+/* sent, the reply not yet in; whoever clears it completes the request */
+#define NBD_CMD_INFLIGHT	0
+
 struct nbd_device {
 	u32 flags;
-	struct socket * sock;	/* If == NULL, device is not ready, yet	*/
+	struct nbd_sock **socks;
+	int num_connections;
 	int magic;
 
-	spinlock_t queue_lock;
-	struct list_head queue_head;	/* Requests waiting result */
-	struct request *active_req;
-	wait_queue_head_t active_wq;
-	struct list_head waiting_queue;	/* Requests to be sent */
-	wait_queue_head_t waiting_wq;
+	struct blk_mq_tag_set tag_set;
 
-	struct mutex tx_lock;
+	struct mutex config_lock;
 	struct gendisk *disk;
 	int blksize;
 	loff_t bytesize;
 	int xmit_timeout;
+	bool running;
 	bool disconnect; /* a disconnect has been requested by user */
+	bool timedout;
+	int error;	/* of the last connection to fail */
 
-	struct timer_list timeout_timer;
-	spinlock_t tasks_lock;
-	struct task_struct *task_recv;
-	struct task_struct *task_send;
+	atomic_t recv_threads;
+	wait_queue_head_t recv_wq;
+	struct work_struct timeout_work;
+	struct task_struct *task_setup;
 
 #if IS_ENABLED(CONFIG_DEBUG_FS)
 	struct dentry *dbg_dir;
@@ -81,17 +126,8 @@ static unsigned int nbds_max = 16;
 static struct nbd_device *nbd_dev;
 static int max_part;
 
-/*
- * Use just one lock (or at most 1 per NIC). Two arguments for this:
- * 1. Each NIC is essentially a synchronization point for all servers
- *    accessed through that NIC so there's no need to have more locks
- *    than NICs anyway.
- * 2. More locks lead to more "Dirty cache line bouncing" which will slow
- *    down each lock to the point where they're actually slower than just
- *    a single lock.
- * Thanks go to Jens Axboe and Al Viro for their LKML emails explaining this!
- */
-static DEFINE_SPINLOCK(nbd_lock);
+static struct workqueue_struct *nbd_send_wq;
+static struct workqueue_struct *nbd_recv_wq;
 
 static inline struct device *nbd_to_dev(struct nbd_device *nbd)
 {
@@ -110,77 +146,116 @@ static const char *nbdcmd_to_ascii(int cmd)
 	return "invalid";
 }
 
-static void nbd_end_request(struct nbd_device *nbd, struct request *req)
+static void nbd_end_request(struct nbd_cmd *cmd)
 {
+	struct nbd_device *nbd = cmd->nbd;
+	struct request *req = blk_mq_rq_from_pdu(cmd);
 	int error = req->errors ? -EIO : 0;
-	struct request_queue *q = req->q;
-	unsigned long flags;
 
 	dev_dbg(nbd_to_dev(nbd), "request %p: %s\n", req,
 		error ? "failed" : "done");
 
-	spin_lock_irqsave(q->queue_lock, flags);
-	__blk_end_request_all(req, error);
-	spin_unlock_irqrestore(q->queue_lock, flags);
+	blk_mq_complete_request(req, error);
 }
 
 /*
  * Forcibly shutdown the socket causing all listeners to error
  */
-static void sock_shutdown(struct nbd_device *nbd)
+static void nbd_mark_dead(struct nbd_sock *nsock)
 {
-	if (!nbd->sock)
+	if (test_and_set_bit(NBD_SOCK_DEAD, &nsock->flags))
 		return;
 
-	dev_warn(disk_to_dev(nbd->disk), "shutting down socket\n");
-	kernel_sock_shutdown(nbd->sock, SHUT_RDWR);
-	nbd->sock = NULL;
-	del_timer_sync(&nbd->timeout_timer);
+	dev_warn(disk_to_dev(nsock->nbd->disk),
+		 "shutting down connection %d\n", nsock->index);
+	kernel_sock_shutdown(nsock->sock, SHUT_RDWR);
+}
+
+/* called with the config_lock held */
+static void sock_shutdown(struct nbd_device *nbd)
+{
+	int i;
+
+	for (i = 0; i < nbd->num_connections; i++)
+		nbd_mark_dead(nbd->socks[i]);
 }
 
-static void nbd_xmit_timeout(unsigned long arg)
+static int nbd_live_connections(struct nbd_device *nbd)
 {
-	struct nbd_device *nbd = (struct nbd_device *)arg;
-	unsigned long flags;
+	int i, live = 0;
+
+	for (i = 0; i < nbd->num_connections; i++)
+		if (!test_bit(NBD_SOCK_DEAD, &nbd->socks[i]->flags))
+			live++;
+	return live;
+}
 
-	if (list_empty(&nbd->queue_head))
+/*
+ * Give a request whose connection failed to another one, or fail it if
+ * there's none left or we're going away anyway.
+ */
+static void nbd_requeue_cmd(struct nbd_cmd *cmd)
+{
+	struct nbd_device *nbd = cmd->nbd;
+	struct request *req = blk_mq_rq_from_pdu(cmd);
+
+	if (nbd->disconnect || nbd->timedout || !nbd_live_connections(nbd)) {
+		req->errors++;
+		nbd_end_request(cmd);
 		return;
+	}
 
-	nbd->disconnect = true;
+	nbd->socks[cmd->index]->stats.requeued++;
+	blk_mq_requeue_request(req);
+	blk_mq_kick_requeue_list(req->q);
+}
 
-	spin_lock_irqsave(&nbd->tasks_lock, flags);
+static enum blk_eh_timer_return nbd_xmit_timeout(struct request *req,
+						 bool reserved)
+{
+	struct nbd_cmd *cmd = blk_mq_rq_to_pdu(req);
+	struct nbd_device *nbd = cmd->nbd;
 
-	if (nbd->task_recv)
-		force_sig(SIGKILL, nbd->task_recv);
+	if (!nbd->xmit_timeout)
+		return BLK_EH_RESET_TIMER;
 
-	if (nbd->task_send)
-		force_sig(SIGKILL, nbd->task_send);
+	/*
+	 * We're called from a timer and can't shut sockets down here.  The
+	 * requests are failed once all the connections are gone.
+	 */
+	if (!nbd->timedout) {
+		nbd->timedout = true;
+		schedule_work(&nbd->timeout_work);
+	}
+	return BLK_EH_RESET_TIMER;
+}
 
-	spin_unlock_irqrestore(&nbd->tasks_lock, flags);
+static void nbd_timeout_work(struct work_struct *work)
+{
+	struct nbd_device *nbd = container_of(work, struct nbd_device,
+					      timeout_work);
 
-	dev_err(nbd_to_dev(nbd), "Connection timed out, killed receiver and sender, shutting down connection\n");
+	mutex_lock(&nbd->config_lock);
+	if (nbd->running) {
+		dev_err(nbd_to_dev(nbd), "Connection timed out, shutting down connection\n");
+		sock_shutdown(nbd);
+	}
+	mutex_unlock(&nbd->config_lock);
 }
 
 /*
  *  Send or receive packet.
  */
-static int sock_xmit(struct nbd_device *nbd, int send, void *buf, int size,
+static int sock_xmit(struct nbd_sock *nsock, int send, void *buf, int size,
 		int msg_flags)
 {
-	struct socket *sock = nbd->sock;
+	struct socket *sock = nsock->sock;
 	int result;
 	struct msghdr msg;
 	struct kvec iov;
 	sigset_t blocked, oldset;
 	unsigned long pflags = current->flags;
 
-	if (unlikely(!sock)) {
-		dev_err(disk_to_dev(nbd->disk),
-			"Attempted %s on closed socket in sock_xmit\n",
-			(send ? "send" : "recv"));
-		return -EINVAL;
-	}
-
 	/* Allow interception of SIGKILL only
 	 * Don't allow other signals to interrupt the transmission */
 	siginitsetinv(&blocked, sigmask(SIGKILL));
@@ -208,6 +283,10 @@ static int sock_xmit(struct nbd_device *nbd, int send, void *buf, int size,
 				result = -EPIPE; /* short read */
 			break;
 		}
+		if (send)
+			nsock->stats.bytes_sent += result;
+		else
+			nsock->stats.bytes_received += result;
 		size -= result;
 		buf += result;
 	} while (size > 0);
@@ -215,34 +294,30 @@ static int sock_xmit(struct nbd_device *nbd, int send, void *buf, int size,
 	sigprocmask(SIG_SETMASK, &oldset, NULL);
 	tsk_restore_flags(current, pflags, PF_MEMALLOC);
 
-	if (!send && nbd->xmit_timeout)
-		mod_timer(&nbd->timeout_timer, jiffies + nbd->xmit_timeout);
-
 	return result;
 }
 
-static inline int sock_send_bvec(struct nbd_device *nbd, struct bio_vec *bvec,
+static inline int sock_send_bvec(struct nbd_sock *nsock, struct bio_vec *bvec,
 		int flags)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(nbd, 1, kaddr + bvec->bv_offset,
+	result = sock_xmit(nsock, 1, kaddr + bvec->bv_offset,
 			   bvec->bv_len, flags);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
 /* always call with the tx_lock held */
-static int nbd_send_req(struct nbd_device *nbd, struct request *req)
+static int nbd_send_req(struct nbd_sock *nsock, struct request *req)
 {
+	struct nbd_device *nbd = nsock->nbd;
 	int result, flags;
 	struct nbd_request request;
 	unsigned long size = blk_rq_bytes(req);
-	u32 type;
+	u32 type, tag;
 
-	if (req->cmd_type == REQ_TYPE_DRV_PRIV)
-		type = NBD_CMD_DISC;
-	else if (req->cmd_flags & REQ_DISCARD)
+	if (req->cmd_flags & REQ_DISCARD)
 		type = NBD_CMD_TRIM;
 	else if (req->cmd_flags & REQ_FLUSH)
 		type = NBD_CMD_FLUSH;
@@ -254,16 +329,18 @@ static int nbd_send_req(struct nbd_device *nbd, struct request *req)
 	memset(&request, 0, sizeof(request));
 	request.magic = htonl(NBD_REQUEST_MAGIC);
 	request.type = htonl(type);
-	if (type != NBD_CMD_FLUSH && type != NBD_CMD_DISC) {
+	if (type != NBD_CMD_FLUSH) {
 		request.from = cpu_to_be64((u64)blk_rq_pos(req) << 9);
 		request.len = htonl(size);
 	}
-	memcpy(request.handle, &req, sizeof(req));
+	tag = blk_mq_unique_tag(req);
+	memcpy(request.handle, &tag, sizeof(tag));
 
-	dev_dbg(nbd_to_dev(nbd), "request %p: sending control (%s@%llu,%uB)\n",
+	dev_dbg(nbd_to_dev(nbd), "request %p: sending control (%s@%llu,%uB) on connection %d\n",
 		req, nbdcmd_to_ascii(type),
-		(unsigned long long)blk_rq_pos(req) << 9, blk_rq_bytes(req));
-	result = sock_xmit(nbd, 1, &request, sizeof(request),
+		(unsigned long long)blk_rq_pos(req) << 9, blk_rq_bytes(req),
+		nsock->index);
+	result = sock_xmit(nsock, 1, &request, sizeof(request),
 			(type == NBD_CMD_WRITE) ? MSG_MORE : 0);
 	if (result <= 0) {
 		dev_err(disk_to_dev(nbd->disk),
@@ -284,7 +361,7 @@ static int nbd_send_req(struct nbd_device *nbd, struct request *req)
 				flags = MSG_MORE;
 			dev_dbg(nbd_to_dev(nbd), "request %p: sending %d bytes data\n",
 				req, bvec.bv_len);
-			result = sock_send_bvec(nbd, &bvec, flags);
+			result = sock_send_bvec(nsock, &bvec, flags);
 			if (result <= 0) {
 				dev_err(disk_to_dev(nbd->disk),
 					"Send data failed (result %d)\n",
@@ -293,54 +370,72 @@ static int nbd_send_req(struct nbd_device *nbd, struct request *req)
 			}
 		}
 	}
+	nsock->stats.requests++;
 	return 0;
 }
 
-static struct request *nbd_find_request(struct nbd_device *nbd,
-					struct request *xreq)
+/* always call with the tx_lock held */
+static int nbd_send_disconnect(struct nbd_sock *nsock)
 {
-	struct request *req, *tmp;
-	int err;
+	struct nbd_request request;
 
-	err = wait_event_interruptible(nbd->active_wq, nbd->active_req != xreq);
-	if (unlikely(err))
-		return ERR_PTR(err);
+	memset(&request, 0, sizeof(request));
+	request.magic = htonl(NBD_REQUEST_MAGIC);
+	request.type = htonl(NBD_CMD_DISC);
 
-	spin_lock(&nbd->queue_lock);
-	list_for_each_entry_safe(req, tmp, &nbd->queue_head, queuelist) {
-		if (req != xreq)
-			continue;
-		list_del_init(&req->queuelist);
-		spin_unlock(&nbd->queue_lock);
-		return req;
-	}
-	spin_unlock(&nbd->queue_lock);
+	return sock_xmit(nsock, 1, &request, sizeof(request), 0);
+}
+
+static struct nbd_cmd *nbd_find_cmd(struct nbd_sock *nsock, u32 tag)
+{
+	struct nbd_device *nbd = nsock->nbd;
+	u16 hwq = blk_mq_unique_tag_to_hwq(tag);
+	struct request *req;
+	struct nbd_cmd *cmd;
+
+	if (hwq >= nbd->tag_set.nr_hw_queues)
+		return ERR_PTR(-ENOENT);
+
+	req = blk_mq_tag_to_rq(nbd->tag_set.tags[hwq],
+			       blk_mq_unique_tag_to_tag(tag));
+	if (!req || !blk_mq_request_started(req))
+		return ERR_PTR(-ENOENT);
 
-	return ERR_PTR(-ENOENT);
+	/* a reply comes back on the connection its request went out on */
+	cmd = blk_mq_rq_to_pdu(req);
+	if (cmd->index != nsock->index ||
+	    !test_and_clear_bit(NBD_CMD_INFLIGHT, &cmd->flags))
+		return ERR_PTR(-ENOENT);
+
+	return cmd;
 }
 
-static inline int sock_recv_bvec(struct nbd_device *nbd, struct bio_vec *bvec)
+static inline int sock_recv_bvec(struct nbd_sock *nsock, struct bio_vec *bvec)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(nbd, 0, kaddr + bvec->bv_offset, bvec->bv_len,
+	result = sock_xmit(nsock, 0, kaddr + bvec->bv_offset, bvec->bv_len,
 			MSG_WAITALL);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
 /* NULL returned = something went wrong, inform userspace */
-static struct request *nbd_read_stat(struct nbd_device *nbd)
+static struct nbd_cmd *nbd_read_stat(struct nbd_sock *nsock)
 {
+	struct nbd_device *nbd = nsock->nbd;
 	int result;
 	struct nbd_reply reply;
+	struct nbd_cmd *cmd;
 	struct request *req;
+	u32 tag;
 
 	reply.magic = 0;
-	result = sock_xmit(nbd, 0, &reply, sizeof(reply), MSG_WAITALL);
+	result = sock_xmit(nsock, 0, &reply, sizeof(reply), MSG_WAITALL);
 	if (result <= 0) {
-		dev_err(disk_to_dev(nbd->disk),
-			"Receive control failed (result %d)\n", result);
+		if (!test_bit(NBD_SOCK_DEAD, &nsock->flags))
+			dev_err(disk_to_dev(nbd->disk),
+				"Receive control failed (result %d)\n", result);
 		return ERR_PTR(result);
 	}
 
@@ -350,22 +445,21 @@ static struct request *nbd_read_stat(struct nbd_device *nbd)
 		return ERR_PTR(-EPROTO);
 	}
 
-	req = nbd_find_request(nbd, *(struct request **)reply.handle);
-	if (IS_ERR(req)) {
-		result = PTR_ERR(req);
-		if (result != -ENOENT)
-			return ERR_PTR(result);
-
-		dev_err(disk_to_dev(nbd->disk), "Unexpected reply (%p)\n",
-			reply.handle);
+	memcpy(&tag, reply.handle, sizeof(tag));
+	cmd = nbd_find_cmd(nsock, tag);
+	if (IS_ERR(cmd)) {
+		dev_err(disk_to_dev(nbd->disk), "Unexpected reply (%08x)\n",
+			tag);
 		return ERR_PTR(-EBADR);
 	}
+	req = blk_mq_rq_from_pdu(cmd);
+	nsock->stats.replies++;
 
 	if (ntohl(reply.error)) {
 		dev_err(disk_to_dev(nbd->disk), "Other side returned error (%d)\n",
 			ntohl(reply.error));
 		req->errors++;
-		return req;
+		return cmd;
 	}
 
 	dev_dbg(nbd_to_dev(nbd), "request %p: got reply\n", req);
@@ -374,18 +468,18 @@ static struct request *nbd_read_stat(struct nbd_device *nbd)
 		struct bio_vec bvec;
 
 		rq_for_each_segment(bvec, req, iter) {
-			result = sock_recv_bvec(nbd, &bvec);
+			result = sock_recv_bvec(nsock, &bvec);
 			if (result <= 0) {
 				dev_err(disk_to_dev(nbd->disk), "Receive data failed (result %d)\n",
 					result);
 				req->errors++;
-				return req;
+				return cmd;
 			}
 			dev_dbg(nbd_to_dev(nbd), "request %p: got %d bytes data\n",
 				req, bvec.bv_len);
 		}
 	}
-	return req;
+	return cmd;
 }
 
 static ssize_t pid_show(struct device *dev,
@@ -394,7 +488,7 @@ static ssize_t pid_show(struct device *dev,
 	struct gendisk *disk = dev_to_disk(dev);
 	struct nbd_device *nbd = (struct nbd_device *)disk->private_data;
 
-	return sprintf(buf, "%d\n", task_pid_nr(nbd->task_recv));
+	return sprintf(buf, "%d\n", task_pid_nr(nbd->task_setup));
 }
 
 static struct device_attribute pid_attr = {
@@ -402,98 +496,90 @@ static struct device_attribute pid_attr = {
 	.show = pid_show,
 };
 
-static int nbd_thread_recv(struct nbd_device *nbd)
+static void nbd_requeue_inflight(struct request *req, void *data,
+				 bool reserved)
 {
-	struct request *req;
-	int ret;
-	unsigned long flags;
-
-	BUG_ON(nbd->magic != NBD_MAGIC);
+	struct nbd_sock *nsock = data;
+	struct nbd_cmd *cmd = blk_mq_rq_to_pdu(req);
 
-	sk_set_memalloc(nbd->sock->sk);
-
-	spin_lock_irqsave(&nbd->tasks_lock, flags);
-	nbd->task_recv = current;
-	spin_unlock_irqrestore(&nbd->tasks_lock, flags);
+	if (!blk_mq_request_started(req) || cmd->index != nsock->index)
+		return;
+	if (test_and_clear_bit(NBD_CMD_INFLIGHT, &cmd->flags))
+		nbd_requeue_cmd(cmd);
+}
 
-	ret = device_create_file(disk_to_dev(nbd->disk), &pid_attr);
-	if (ret) {
-		dev_err(disk_to_dev(nbd->disk), "device_create_file failed!\n");
+static void nbd_recv_work(struct work_struct *work)
+{
+	struct nbd_sock *nsock = container_of(work, struct nbd_sock,
+					      recv_work);
+	struct nbd_device *nbd = nsock->nbd;
+	struct nbd_cmd *cmd;
+	int i;
 
-		spin_lock_irqsave(&nbd->tasks_lock, flags);
-		nbd->task_recv = NULL;
-		spin_unlock_irqrestore(&nbd->tasks_lock, flags);
+	BUG_ON(nbd->magic != NBD_MAGIC);
 
-		return ret;
-	}
+	sk_set_memalloc(nsock->sock->sk);
 
 	while (1) {
-		req = nbd_read_stat(nbd);
-		if (IS_ERR(req)) {
-			ret = PTR_ERR(req);
+		cmd = nbd_read_stat(nsock);
+		if (IS_ERR(cmd)) {
+			nbd->error = PTR_ERR(cmd);
 			break;
 		}
 
-		nbd_end_request(nbd, req);
+		nbd_end_request(cmd);
 	}
 
-	device_remove_file(disk_to_dev(nbd->disk), &pid_attr);
+	/*
+	 * Nothing more comes back on this socket, so what went out on it
+	 * has to go again elsewhere.  The tx_lock keeps the sender from
+	 * putting more in flight meanwhile; it sees the connection dead.
+	 */
+	mutex_lock(&nsock->tx_lock);
+	nbd_mark_dead(nsock);
+	for (i = 0; i < nbd->tag_set.nr_hw_queues; i++)
+		blk_mq_all_tag_busy_iter(nbd->tag_set.tags[i],
+					 nbd_requeue_inflight, nsock);
+	mutex_unlock(&nsock->tx_lock);
+
+	atomic_dec(&nbd->recv_threads);
+	wake_up(&nbd->recv_wq);
+}
 
-	spin_lock_irqsave(&nbd->tasks_lock, flags);
-	nbd->task_recv = NULL;
-	spin_unlock_irqrestore(&nbd->tasks_lock, flags);
+/*
+ * Fail whatever is somehow still in flight once no connection is left.
+ * The senders and receivers have all stopped by now.
+ */
+static void nbd_clear_req(struct request *req, void *data, bool reserved)
+{
+	struct nbd_cmd *cmd = blk_mq_rq_to_pdu(req);
 
-	if (signal_pending(current)) {
-		ret = kernel_dequeue_signal(NULL);
-		dev_warn(nbd_to_dev(nbd), "pid %d, %s, got signal %d\n",
-			 task_pid_nr(current), current->comm, ret);
-		mutex_lock(&nbd->tx_lock);
-		sock_shutdown(nbd);
-		mutex_unlock(&nbd->tx_lock);
-		ret = -ETIMEDOUT;
+	if (!blk_mq_request_started(req))
+		return;
+	if (test_and_clear_bit(NBD_CMD_INFLIGHT, &cmd->flags)) {
+		req->errors++;
+		nbd_end_request(cmd);
 	}
-
-	return ret;
 }
 
 static void nbd_clear_que(struct nbd_device *nbd)
 {
-	struct request *req;
+	int i;
 
 	BUG_ON(nbd->magic != NBD_MAGIC);
 
-	/*
-	 * Because we have set nbd->sock to NULL under the tx_lock, all
-	 * modifications to the list must have completed by now.  For
-	 * the same reason, the active_req must be NULL.
-	 *
-	 * As a consequence, we don't need to take the spin lock while
-	 * purging the list here.
-	 */
-	BUG_ON(nbd->sock);
-	BUG_ON(nbd->active_req);
-
-	while (!list_empty(&nbd->queue_head)) {
-		req = list_entry(nbd->queue_head.next, struct request,
-				 queuelist);
-		list_del_init(&req->queuelist);
-		req->errors++;
-		nbd_end_request(nbd, req);
-	}
-
-	while (!list_empty(&nbd->waiting_queue)) {
-		req = list_entry(nbd->waiting_queue.next, struct request,
-				 queuelist);
-		list_del_init(&req->queuelist);
-		req->errors++;
-		nbd_end_request(nbd, req);
-	}
+	for (i = 0; i < nbd->tag_set.nr_hw_queues; i++)
+		blk_mq_all_tag_busy_iter(nbd->tag_set.tags[i],
+					 nbd_clear_req, NULL);
 	dev_dbg(disk_to_dev(nbd->disk), "queue cleared\n");
 }
 
 
-static void nbd_handle_req(struct nbd_device *nbd, struct request *req)
+static void nbd_handle_cmd(struct nbd_sock *nsock, struct nbd_cmd *cmd)
 {
+	struct nbd_device *nbd = nsock->nbd;
+	struct request *req = blk_mq_rq_from_pdu(cmd);
+
 	if (req->cmd_type != REQ_TYPE_FS)
 		goto error_out;
 
@@ -506,194 +592,307 @@ static void nbd_handle_req(struct nbd_device *nbd, struct request *req)
 
 	req->errors = 0;
 
-	mutex_lock(&nbd->tx_lock);
-	if (unlikely(!nbd->sock)) {
-		mutex_unlock(&nbd->tx_lock);
-		dev_err(disk_to_dev(nbd->disk),
-			"Attempted send on closed socket\n");
-		goto error_out;
+	mutex_lock(&nsock->tx_lock);
+	if (unlikely(test_bit(NBD_SOCK_DEAD, &nsock->flags))) {
+		mutex_unlock(&nsock->tx_lock);
+		nbd_requeue_cmd(cmd);
+		return;
 	}
 
-	nbd->active_req = req;
-
-	if (nbd->xmit_timeout && list_empty_careful(&nbd->queue_head))
-		mod_timer(&nbd->timeout_timer, jiffies + nbd->xmit_timeout);
-
-	if (nbd_send_req(nbd, req) != 0) {
+	/* the reply may well beat us out of nbd_send_req() */
+	set_bit(NBD_CMD_INFLIGHT, &cmd->flags);
+	if (nbd_send_req(nsock, req) != 0) {
 		dev_err(disk_to_dev(nbd->disk), "Request send failed\n");
-		req->errors++;
-		nbd_end_request(nbd, req);
-	} else {
-		spin_lock(&nbd->queue_lock);
-		list_add_tail(&req->queuelist, &nbd->queue_head);
-		spin_unlock(&nbd->queue_lock);
+		nsock->stats.errors++;
+		/* the receiver sweeps up the rest once the socket is down */
+		nbd_mark_dead(nsock);
+		if (test_and_clear_bit(NBD_CMD_INFLIGHT, &cmd->flags)) {
+			mutex_unlock(&nsock->tx_lock);
+			nbd_requeue_cmd(cmd);
+			return;
+		}
 	}
-
-	nbd->active_req = NULL;
-	mutex_unlock(&nbd->tx_lock);
-	wake_up_all(&nbd->active_wq);
+	mutex_unlock(&nsock->tx_lock);
 
 	return;
 
 error_out:
 	req->errors++;
-	nbd_end_request(nbd, req);
+	nbd_end_request(cmd);
 }
 
-static int nbd_thread_send(void *data)
+static void nbd_send_work(struct work_struct *work)
 {
-	struct nbd_device *nbd = data;
-	struct request *req;
-	unsigned long flags;
+	struct nbd_sock *nsock = container_of(work, struct nbd_sock,
+					      send_work);
+	struct nbd_cmd *cmd;
+
+	for (;;) {
+		spin_lock_irq(&nsock->queue_lock);
+		cmd = list_first_entry_or_null(&nsock->send_queue,
+					       struct nbd_cmd, list);
+		if (cmd)
+			list_del_init(&cmd->list);
+		spin_unlock_irq(&nsock->queue_lock);
+
+		if (!cmd)
+			break;
+		nbd_handle_cmd(nsock, cmd);
+	}
+}
+
+/* this queue's own connection, or the next live one if that is dead */
+static struct nbd_sock *nbd_pick_sock(struct nbd_device *nbd,
+				      unsigned int queue)
+{
+	int i, index;
 
-	spin_lock_irqsave(&nbd->tasks_lock, flags);
-	nbd->task_send = current;
-	spin_unlock_irqrestore(&nbd->tasks_lock, flags);
+	if (!smp_load_acquire(&nbd->running))
+		return NULL;
 
-	set_user_nice(current, MIN_NICE);
-	while (!kthread_should_stop() || !list_empty(&nbd->waiting_queue)) {
-		/* wait for something to do */
-		wait_event_interruptible(nbd->waiting_wq,
-					 kthread_should_stop() ||
-					 !list_empty(&nbd->waiting_queue));
+	index = queue % nbd->num_connections;
+	for (i = 0; i < nbd->num_connections; i++) {
+		struct nbd_sock *nsock = nbd->socks[index];
 
-		if (signal_pending(current)) {
-			int ret = kernel_dequeue_signal(NULL);
+		if (!test_bit(NBD_SOCK_DEAD, &nsock->flags))
+			return nsock;
+		if (++index == nbd->num_connections)
+			index = 0;
+	}
+	return NULL;
+}
 
-			dev_warn(nbd_to_dev(nbd), "pid %d, %s, got signal %d\n",
-				 task_pid_nr(current), current->comm, ret);
-			mutex_lock(&nbd->tx_lock);
-			sock_shutdown(nbd);
-			mutex_unlock(&nbd->tx_lock);
-			break;
-		}
+/*
+ * We always wait for result of write, for now. It would be nice to make it optional
+ * in future
+ * if ((rq_data_dir(req) == WRITE) && (nbd->flags & NBD_WRITE_NOCHK))
+ *   { printk( "Warning: Ignoring result!\n"); nbd_end_request( req ); }
+ */
 
-		/* extract request */
-		if (list_empty(&nbd->waiting_queue))
-			continue;
+static int nbd_queue_rq(struct blk_mq_hw_ctx *hctx,
+			const struct blk_mq_queue_data *bd)
+{
+	struct nbd_cmd *cmd = blk_mq_rq_to_pdu(bd->rq);
+	struct nbd_device *nbd = cmd->nbd;
+	struct nbd_sock *nsock;
+	unsigned long flags;
+
+	BUG_ON(nbd->magic != NBD_MAGIC);
+
+	dev_dbg(nbd_to_dev(nbd), "request %p: dequeued (flags=%x)\n",
+		bd->rq, bd->rq->cmd_type);
 
-		spin_lock_irq(&nbd->queue_lock);
-		req = list_entry(nbd->waiting_queue.next, struct request,
-				 queuelist);
-		list_del_init(&req->queuelist);
-		spin_unlock_irq(&nbd->queue_lock);
+	blk_mq_start_request(bd->rq);
 
-		/* handle request */
-		nbd_handle_req(nbd, req);
+	nsock = nbd_pick_sock(nbd, hctx->queue_num);
+	if (unlikely(!nsock)) {
+		dev_err_ratelimited(disk_to_dev(nbd->disk),
+				    "Attempted send on closed socket\n");
+		return BLK_MQ_RQ_QUEUE_ERROR;
 	}
+	cmd->index = nsock->index;
+
+	/* the sending sleeps, so it's left to the connection's worker */
+	spin_lock_irqsave(&nsock->queue_lock, flags);
+	list_add_tail(&cmd->list, &nsock->send_queue);
+	spin_unlock_irqrestore(&nsock->queue_lock, flags);
+	queue_work(nbd_send_wq, &nsock->send_work);
+
+	return BLK_MQ_RQ_QUEUE_OK;
+}
 
-	spin_lock_irqsave(&nbd->tasks_lock, flags);
-	nbd->task_send = NULL;
-	spin_unlock_irqrestore(&nbd->tasks_lock, flags);
+static void nbd_complete_rq(struct request *req)
+{
+	blk_mq_end_request(req, req->errors);
+}
 
-	/* Clear maybe pending signals */
-	if (signal_pending(current))
-		kernel_dequeue_signal(NULL);
+static int nbd_init_request(void *data, struct request *rq,
+			    unsigned int hctx_idx, unsigned int request_idx,
+			    unsigned int numa_node)
+{
+	struct nbd_cmd *cmd = blk_mq_rq_to_pdu(rq);
 
+	cmd->nbd = data;
+	INIT_LIST_HEAD(&cmd->list);
 	return 0;
 }
 
-/*
- * We always wait for result of write, for now. It would be nice to make it optional
- * in future
- * if ((rq_data_dir(req) == WRITE) && (nbd->flags & NBD_WRITE_NOCHK))
- *   { printk( "Warning: Ignoring result!\n"); nbd_end_request( req ); }
- */
+static struct blk_mq_ops nbd_mq_ops = {
+	.queue_rq	= nbd_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.complete	= nbd_complete_rq,
+	.init_request	= nbd_init_request,
+	.timeout	= nbd_xmit_timeout,
+};
 
-static void nbd_request_handler(struct request_queue *q)
-		__releases(q->queue_lock) __acquires(q->queue_lock)
+static int nbd_add_socket(struct nbd_device *nbd, struct socket *sock)
 {
-	struct request *req;
-	
-	while ((req = blk_fetch_request(q)) != NULL) {
-		struct nbd_device *nbd;
+	struct nbd_sock **socks;
+	struct nbd_sock *nsock;
+
+	if (nbd->num_connections >= nbd->tag_set.nr_hw_queues)
+		return -EBUSY;
+
+	socks = krealloc(nbd->socks, (nbd->num_connections + 1) *
+			 sizeof(struct nbd_sock *), GFP_KERNEL);
+	if (!socks)
+		return -ENOMEM;
+	nbd->socks = socks;
 
-		spin_unlock_irq(q->queue_lock);
+	nsock = kzalloc(sizeof(*nsock), GFP_KERNEL);
+	if (!nsock)
+		return -ENOMEM;
 
-		nbd = req->rq_disk->private_data;
+	nsock->sock = sock;
+	nsock->nbd = nbd;
+	nsock->index = nbd->num_connections;
+	mutex_init(&nsock->tx_lock);
+	spin_lock_init(&nsock->queue_lock);
+	INIT_LIST_HEAD(&nsock->send_queue);
+	INIT_WORK(&nsock->send_work, nbd_send_work);
+	INIT_WORK(&nsock->recv_work, nbd_recv_work);
 
-		BUG_ON(nbd->magic != NBD_MAGIC);
+	socks[nbd->num_connections++] = nsock;
+	return 0;
+}
 
-		dev_dbg(nbd_to_dev(nbd), "request %p: dequeued (flags=%x)\n",
-			req, req->cmd_type);
+/* put a new socket in the place of a dead connection */
+static int nbd_reconnect_socket(struct nbd_device *nbd, struct socket *sock)
+{
+	int i;
+
+	for (i = 0; i < nbd->num_connections; i++) {
+		struct nbd_sock *nsock = nbd->socks[i];
+		struct socket *old;
 
-		if (unlikely(!nbd->sock)) {
-			dev_err_ratelimited(disk_to_dev(nbd->disk),
-					    "Attempted send on closed socket\n");
-			req->errors++;
-			nbd_end_request(nbd, req);
-			spin_lock_irq(q->queue_lock);
+		if (!test_bit(NBD_SOCK_DEAD, &nsock->flags))
 			continue;
-		}
 
-		spin_lock_irq(&nbd->queue_lock);
-		list_add_tail(&req->queuelist, &nbd->waiting_queue);
-		spin_unlock_irq(&nbd->queue_lock);
+		/* the receiver must be through with the old socket */
+		flush_work(&nsock->recv_work);
+
+		mutex_lock(&nsock->tx_lock);
+		old = nsock->sock;
+		nsock->sock = sock;
+		nsock->reconnects++;
+		clear_bit(NBD_SOCK_DEAD, &nsock->flags);
+		mutex_unlock(&nsock->tx_lock);
+		sockfd_put(old);
+
+		atomic_inc(&nbd->recv_threads);
+		queue_work(nbd_recv_wq, &nsock->recv_work);
+		dev_info(disk_to_dev(nbd->disk), "connection %d reconnected\n",
+			 i);
+		return 0;
+	}
+	return -EBUSY;
+}
 
-		wake_up(&nbd->waiting_wq);
+static void nbd_free_socks(struct nbd_device *nbd)
+{
+	int i;
 
-		spin_lock_irq(q->queue_lock);
+	for (i = 0; i < nbd->num_connections; i++) {
+		sockfd_put(nbd->socks[i]->sock);
+		kfree(nbd->socks[i]);
 	}
+	kfree(nbd->socks);
+	nbd->socks = NULL;
+	nbd->num_connections = 0;
+}
+
+/* called with the config_lock held */
+static void nbd_stop_device(struct nbd_device *nbd)
+{
+	struct request_queue *q = nbd->disk->queue;
+	int i;
+
+	/* new requests fail from now on, queued ones see the sockets dead */
+	WRITE_ONCE(nbd->running, false);
+	sock_shutdown(nbd);
+	wait_event(nbd->recv_wq, atomic_read(&nbd->recv_threads) == 0);
+	for (i = 0; i < nbd->num_connections; i++)
+		flush_work(&nbd->socks[i]->send_work);
+	nbd_clear_que(nbd);
+
+	/* no one may look at the sockets once we free them */
+	blk_mq_freeze_queue(q);
+	for (i = 0; i < nbd->num_connections; i++)
+		flush_work(&nbd->socks[i]->send_work);
+	nbd_free_socks(nbd);
+	blk_mq_unfreeze_queue(q);
 }
 
 static int nbd_dev_dbg_init(struct nbd_device *nbd);
 static void nbd_dev_dbg_close(struct nbd_device *nbd);
 
-/* Must be called with tx_lock held */
+/* Must be called with config_lock held */
 
 static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 		       unsigned int cmd, unsigned long arg)
 {
 	switch (cmd) {
 	case NBD_DISCONNECT: {
-		struct request sreq;
+		int i;
 
 		dev_info(disk_to_dev(nbd->disk), "NBD_DISCONNECT\n");
-		if (!nbd->sock)
+		if (!nbd->num_connections)
 			return -EINVAL;
 
-		mutex_unlock(&nbd->tx_lock);
+		mutex_unlock(&nbd->config_lock);
 		fsync_bdev(bdev);
-		mutex_lock(&nbd->tx_lock);
-		blk_rq_init(NULL, &sreq);
-		sreq.cmd_type = REQ_TYPE_DRV_PRIV;
+		mutex_lock(&nbd->config_lock);
 
 		/* Check again after getting mutex back.  */
-		if (!nbd->sock)
+		if (!nbd->num_connections)
 			return -EINVAL;
 
 		nbd->disconnect = true;
 
-		nbd_send_req(nbd, &sreq);
+		for (i = 0; i < nbd->num_connections; i++) {
+			struct nbd_sock *nsock = nbd->socks[i];
+
+			mutex_lock(&nsock->tx_lock);
+			if (!test_bit(NBD_SOCK_DEAD, &nsock->flags) &&
+			    nbd_send_disconnect(nsock) <= 0)
+				dev_err(disk_to_dev(nbd->disk),
+					"Send disconnect failed on connection %d\n",
+					i);
+			mutex_unlock(&nsock->tx_lock);
+		}
 		return 0;
 	}
- 
-	case NBD_CLEAR_SOCK: {
-		struct socket *sock = nbd->sock;
-		nbd->sock = NULL;
-		nbd_clear_que(nbd);
-		BUG_ON(!list_empty(&nbd->queue_head));
-		BUG_ON(!list_empty(&nbd->waiting_queue));
+
+	case NBD_CLEAR_SOCK:
+		/* a running device gives the sockets up once it stops */
+		if (nbd->running)
+			sock_shutdown(nbd);
+		else
+			nbd_free_socks(nbd);
 		kill_bdev(bdev);
-		if (sock)
-			sockfd_put(sock);
 		return 0;
-	}
 
 	case NBD_SET_SOCK: {
 		struct socket *sock;
 		int err;
-		if (nbd->sock)
-			return -EBUSY;
+
 		sock = sockfd_lookup(arg, &err);
-		if (sock) {
-			nbd->sock = sock;
-			if (max_part > 0)
-				bdev->bd_invalidated = 1;
-			nbd->disconnect = false; /* we're connected now */
-			return 0;
+		if (!sock)
+			return -EINVAL;
+
+		if (nbd->running)
+			err = nbd_reconnect_socket(nbd, sock);
+		else
+			err = nbd_add_socket(nbd, sock);
+		if (err) {
+			sockfd_put(sock);
+			return err;
 		}
-		return -EINVAL;
+
+		if (max_part > 0)
+			bdev->bd_invalidated = 1;
+		nbd->disconnect = false; /* we're connected now */
+		return 0;
 	}
 
 	case NBD_SET_BLKSIZE:
@@ -714,11 +913,8 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 	case NBD_SET_TIMEOUT:
 		nbd->xmit_timeout = arg * HZ;
 		if (arg)
-			mod_timer(&nbd->timeout_timer,
-				  jiffies + nbd->xmit_timeout);
-		else
-			del_timer_sync(&nbd->timeout_timer);
-
+			blk_queue_rq_timeout(nbd->disk->queue,
+					     nbd->xmit_timeout);
 		return 0;
 
 	case NBD_SET_FLAGS:
@@ -733,16 +929,27 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 		return 0;
 
 	case NBD_DO_IT: {
-		struct task_struct *thread;
-		struct socket *sock;
-		int error;
+		int error, i;
 
-		if (nbd->task_recv)
+		if (nbd->task_setup)
 			return -EBUSY;
-		if (!nbd->sock)
+		if (!nbd->num_connections)
 			return -EINVAL;
+		if (nbd->num_connections > 1 &&
+		    !(nbd->flags & NBD_FLAG_CAN_MULTI_CONN)) {
+			dev_err(disk_to_dev(nbd->disk),
+				"server does not support multiple connections per device\n");
+			return -EINVAL;
+		}
 
-		mutex_unlock(&nbd->tx_lock);
+		error = device_create_file(disk_to_dev(nbd->disk), &pid_attr);
+		if (error) {
+			dev_err(disk_to_dev(nbd->disk), "device_create_file failed!\n");
+			return error;
+		}
+		nbd->task_setup = current;
+		nbd->timedout = false;
+		nbd->error = 0;
 
 		if (nbd->flags & NBD_FLAG_READ_ONLY)
 			set_device_ro(bdev, true);
@@ -754,29 +961,28 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 		else
 			blk_queue_flush(nbd->disk->queue, 0);
 
-		thread = kthread_run(nbd_thread_send, nbd, "%s",
-				     nbd_name(nbd));
-		if (IS_ERR(thread)) {
-			mutex_lock(&nbd->tx_lock);
-			return PTR_ERR(thread);
+		nbd_dev_dbg_init(nbd);
+		smp_store_release(&nbd->running, true);
+		for (i = 0; i < nbd->num_connections; i++) {
+			atomic_inc(&nbd->recv_threads);
+			queue_work(nbd_recv_wq, &nbd->socks[i]->recv_work);
 		}
 
-		nbd_dev_dbg_init(nbd);
-		error = nbd_thread_recv(nbd);
-		nbd_dev_dbg_close(nbd);
-		kthread_stop(thread);
+		mutex_unlock(&nbd->config_lock);
+		error = wait_event_interruptible(nbd->recv_wq,
+				atomic_read(&nbd->recv_threads) == 0);
+		mutex_lock(&nbd->config_lock);
 
-		mutex_lock(&nbd->tx_lock);
+		if (!error)
+			error = nbd->error;
+		nbd_stop_device(nbd);
+		nbd_dev_dbg_close(nbd);
+		device_remove_file(disk_to_dev(nbd->disk), &pid_attr);
+		nbd->task_setup = NULL;
 
-		sock_shutdown(nbd);
-		sock = nbd->sock;
-		nbd->sock = NULL;
-		nbd_clear_que(nbd);
 		kill_bdev(bdev);
 		queue_flag_clear_unlocked(QUEUE_FLAG_DISCARD, nbd->disk->queue);
 		set_device_ro(bdev, false);
-		if (sock)
-			sockfd_put(sock);
 		nbd->flags = 0;
 		nbd->bytesize = 0;
 		bdev->bd_inode->i_size = 0;
@@ -785,6 +991,8 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 			blkdev_reread_part(bdev);
 		if (nbd->disconnect) /* user requested, ignore socket errors */
 			return 0;
+		if (nbd->timedout)
+			return -ETIMEDOUT;
 		return error;
 	}
 
@@ -797,9 +1005,9 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 
 	case NBD_PRINT_DEBUG:
 		dev_info(disk_to_dev(nbd->disk),
-			"next = %p, prev = %p, head = %p\n",
-			nbd->queue_head.next, nbd->queue_head.prev,
-			&nbd->queue_head);
+			"%d connections, %d live, %d receiving\n",
+			nbd->num_connections, nbd_live_connections(nbd),
+			atomic_read(&nbd->recv_threads));
 		return 0;
 	}
 	return -ENOTTY;
@@ -816,9 +1024,9 @@ static int nbd_ioctl(struct block_device *bdev, fmode_t mode,
 
 	BUG_ON(nbd->magic != NBD_MAGIC);
 
-	mutex_lock(&nbd->tx_lock);
+	mutex_lock(&nbd->config_lock);
 	error = __nbd_ioctl(bdev, nbd, cmd, arg);
-	mutex_unlock(&nbd->tx_lock);
+	mutex_unlock(&nbd->config_lock);
 
 	return error;
 }
@@ -835,10 +1043,8 @@ static int nbd_dbg_tasks_show(struct seq_file *s, void *unused)
 {
 	struct nbd_device *nbd = s->private;
 
-	if (nbd->task_recv)
-		seq_printf(s, "recv: %d\n", task_pid_nr(nbd->task_recv));
-	if (nbd->task_send)
-		seq_printf(s, "send: %d\n", task_pid_nr(nbd->task_send));
+	if (nbd->task_setup)
+		seq_printf(s, "setup: %d\n", task_pid_nr(nbd->task_setup));
 
 	return 0;
 }
@@ -855,6 +1061,43 @@ static const struct file_operations nbd_dbg_tasks_ops = {
 	.release = single_release,
 };
 
+static int nbd_dbg_connections_show(struct seq_file *s, void *unused)
+{
+	struct nbd_device *nbd = s->private;
+	int i;
+
+	seq_printf(s, "%-4s %-5s %10s %10s %14s %14s %8s %8s %10s\n",
+		   "conn", "state", "requests", "replies", "bytes_sent",
+		   "bytes_recv", "errors", "requeued", "reconnects");
+
+	mutex_lock(&nbd->config_lock);
+	for (i = 0; i < nbd->num_connections; i++) {
+		struct nbd_sock *nsock = nbd->socks[i];
+		struct nbd_sock_stats *st = &nsock->stats;
+
+		seq_printf(s, "%-4d %-5s %10llu %10llu %14llu %14llu %8llu %8llu %10u\n",
+			   i, test_bit(NBD_SOCK_DEAD, &nsock->flags) ?
+			   "dead" : "live", st->requests, st->replies,
+			   st->bytes_sent, st->bytes_received, st->errors,
+			   st->requeued, nsock->reconnects);
+	}
+	mutex_unlock(&nbd->config_lock);
+
+	return 0;
+}
+
+static int nbd_dbg_connections_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nbd_dbg_connections_show, inode->i_private);
+}
+
+static const struct file_operations nbd_dbg_connections_ops = {
+	.open = nbd_dbg_connections_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int nbd_dbg_flags_show(struct seq_file *s, void *unused)
 {
 	struct nbd_device *nbd = s->private;
@@ -872,6 +1115,8 @@ static int nbd_dbg_flags_show(struct seq_file *s, void *unused)
 		seq_puts(s, "NBD_FLAG_SEND_FLUSH\n");
 	if (flags & NBD_FLAG_SEND_TRIM)
 		seq_puts(s, "NBD_FLAG_SEND_TRIM\n");
+	if (flags & NBD_FLAG_CAN_MULTI_CONN)
+		seq_puts(s, "NBD_FLAG_CAN_MULTI_CONN\n");
 
 	return 0;
 }
@@ -908,6 +1153,14 @@ static int nbd_dev_dbg_init(struct nbd_device *nbd)
 		return PTR_ERR(f);
 	}
 
+	f = debugfs_create_file("connections", 0444, dir, nbd,
+				&nbd_dbg_connections_ops);
+	if (IS_ERR_OR_NULL(f)) {
+		dev_err(nbd_to_dev(nbd), "Failed to create debugfs file 'connections', %ld\n",
+			PTR_ERR(f));
+		return PTR_ERR(f);
+	}
+
 	f = debugfs_create_u64("size_bytes", 0444, dir, &nbd->bytesize);
 	if (IS_ERR_OR_NULL(f)) {
 		dev_err(nbd_to_dev(nbd), "Failed to create debugfs file 'size_bytes', %ld\n",
@@ -1027,21 +1280,51 @@ static int __init nbd_init(void)
 	if (!nbd_dev)
 		return -ENOMEM;
 
+	/* the receivers block on their sockets for as long as they're up */
+	nbd_recv_wq = alloc_workqueue("knbd-recv",
+				      WQ_MEM_RECLAIM | WQ_HIGHPRI | WQ_UNBOUND, 0);
+	if (!nbd_recv_wq)
+		goto out_free_dev;
+	nbd_send_wq = alloc_workqueue("knbd-send",
+				      WQ_MEM_RECLAIM | WQ_HIGHPRI | WQ_UNBOUND, 0);
+	if (!nbd_send_wq)
+		goto out_free_recv_wq;
+
 	for (i = 0; i < nbds_max; i++) {
+		struct nbd_device *nbd = &nbd_dev[i];
 		struct gendisk *disk = alloc_disk(1 << part_shift);
 		if (!disk)
 			goto out;
-		nbd_dev[i].disk = disk;
+		nbd->disk = disk;
+
+		/* one hardware queue per CPU, each mapped to a connection */
+		nbd->tag_set.ops = &nbd_mq_ops;
+		nbd->tag_set.nr_hw_queues = num_online_cpus();
+		nbd->tag_set.queue_depth = 128;
+		nbd->tag_set.numa_node = NUMA_NO_NODE;
+		nbd->tag_set.cmd_size = sizeof(struct nbd_cmd);
+		nbd->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_SG_MERGE;
+		nbd->tag_set.driver_data = nbd;
+
+		err = blk_mq_alloc_tag_set(&nbd->tag_set);
+		if (err) {
+			put_disk(disk);
+			goto out;
+		}
+
 		/*
 		 * The new linux 2.5 block layer implementation requires
 		 * every gendisk to have its very own request_queue struct.
 		 * These structs are big so we dynamically allocate them.
 		 */
-		disk->queue = blk_init_queue(nbd_request_handler, &nbd_lock);
-		if (!disk->queue) {
+		disk->queue = blk_mq_init_queue(&nbd->tag_set);
+		if (IS_ERR(disk->queue)) {
+			err = PTR_ERR(disk->queue);
+			blk_mq_free_tag_set(&nbd->tag_set);
 			put_disk(disk);
 			goto out;
 		}
+		disk->queue->queuedata = nbd;
 		/*
 		 * Tell the block layer that we are not a rotational device
 		 */
@@ -1066,16 +1349,10 @@ static int __init nbd_init(void)
 	for (i = 0; i < nbds_max; i++) {
 		struct gendisk *disk = nbd_dev[i].disk;
 		nbd_dev[i].magic = NBD_MAGIC;
-		INIT_LIST_HEAD(&nbd_dev[i].waiting_queue);
-		spin_lock_init(&nbd_dev[i].queue_lock);
-		spin_lock_init(&nbd_dev[i].tasks_lock);
-		INIT_LIST_HEAD(&nbd_dev[i].queue_head);
-		mutex_init(&nbd_dev[i].tx_lock);
-		init_timer(&nbd_dev[i].timeout_timer);
-		nbd_dev[i].timeout_timer.function = nbd_xmit_timeout;
-		nbd_dev[i].timeout_timer.data = (unsigned long)&nbd_dev[i];
-		init_waitqueue_head(&nbd_dev[i].active_wq);
-		init_waitqueue_head(&nbd_dev[i].waiting_wq);
+		mutex_init(&nbd_dev[i].config_lock);
+		atomic_set(&nbd_dev[i].recv_threads, 0);
+		init_waitqueue_head(&nbd_dev[i].recv_wq);
+		INIT_WORK(&nbd_dev[i].timeout_work, nbd_timeout_work);
 		nbd_dev[i].blksize = 1024;
 		nbd_dev[i].bytesize = 0;
 		disk->major = NBD_MAJOR;
@@ -1091,8 +1368,13 @@ static int __init nbd_init(void)
 out:
 	while (i--) {
 		blk_cleanup_queue(nbd_dev[i].disk->queue);
+		blk_mq_free_tag_set(&nbd_dev[i].tag_set);
 		put_disk(nbd_dev[i].disk);
 	}
+	destroy_workqueue(nbd_send_wq);
+out_free_recv_wq:
+	destroy_workqueue(nbd_recv_wq);
+out_free_dev:
 	kfree(nbd_dev);
 	return err;
 }
@@ -1109,9 +1391,13 @@ static void __exit nbd_cleanup(void)
 		if (disk) {
 			del_gendisk(disk);
 			blk_cleanup_queue(disk->queue);
+			blk_mq_free_tag_set(&nbd_dev[i].tag_set);
 			put_disk(disk);
 		}
+		flush_work(&nbd_dev[i].timeout_work);
 	}
+	destroy_workqueue(nbd_send_wq);
+	destroy_workqueue(nbd_recv_wq);
 	unregister_blkdev(NBD_MAJOR, "nbd");
 	kfree(nbd_dev);
 	printk(KERN_INFO "nbd: unregistered device at major %d\n", NBD_MAJOR);
@@ -9,6 +9,20 @@
 #include <linux/blk-mq.h>
 #include <linux/hrtimer.h>
 #include <linux/lightnvm.h>
+#include <linux/configfs.h>
+#include <linux/highmem.h>
+#include <linux/idr.h>
+#include <linux/radix-tree.h>
+#include <linux/random.h>
+
+#define SECTOR_SHIFT		9
+#define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
+
+/* the bandwidth limit is handed out in ticks of this length */
+#define NULL_BW_TICK_NSEC	NSEC_PER_MSEC
+/* how long a blk-mq queue backs off when a data page can't be had */
+#define NULL_ENOMEM_DELAY_MS	10
 
 struct nullb_cmd {
 	struct list_head list;
@@ -17,6 +31,7 @@ struct nullb_cmd {
 	struct request *rq;
 	struct bio *bio;
 	unsigned int tag;
+	int error;
 	struct nullb_queue *nq;
 	struct hrtimer timer;
 };
@@ -25,11 +40,57 @@ struct nullb_queue {
 	unsigned long *tag_map;
 	wait_queue_head_t wait;
 	unsigned int queue_depth;
+	struct nullb_device *dev;
 
 	struct nullb_cmd *cmds;
 };
 
+enum {
+	NULLB_DEV_FL_UP		= 0,	/* the disk is there */
+	NULLB_DEV_FL_THROTTLED	= 1,	/* held to dev->mbps */
+};
+
+struct nullb_badblock {
+	struct list_head list;
+	sector_t start;
+	sector_t end;			/* inclusive */
+};
+
+/*
+ * The configuration of a device, and its data if it is memory backed.
+ * Devices made through configfs keep both while they are powered off.
+ */
+struct nullb_device {
+	struct nullb *nullb;
+	struct config_item item;
+	unsigned long flags;
+
+	spinlock_t lock;		/* protects data and badblocks */
+	struct radix_tree_root data;
+	struct list_head badblocks;
+
+	unsigned long size;		/* in MB */
+	unsigned long completion_nsec;
+	unsigned int completion_jitter_nsec;
+	unsigned long completion_tail_nsec;
+	unsigned int completion_tail_permille;
+	unsigned int submit_queues;
+	int home_node;
+	unsigned int queue_mode;
+	unsigned int blocksize;
+	unsigned int irqmode;
+	unsigned int hw_queue_depth;
+	unsigned int index;
+	unsigned int mbps;
+	bool use_lightnvm;
+	bool use_per_node_hctx;
+	bool memory_backed;
+	bool discard;
+	bool power;
+};
+
 struct nullb {
+	struct nullb_device *dev;
 	struct list_head list;
 	unsigned int index;
 	struct request_queue *q;
@@ -39,6 +100,10 @@ struct nullb {
 	unsigned int queue_depth;
 	spinlock_t lock;
 
+	/* bytes left to this tick of the bandwidth limit */
+	atomic_long_t cur_bytes;
+	struct hrtimer bw_timer;
+
 	struct nullb_queue *queues;
 	unsigned int nr_queues;
 	char disk_name[DISK_NAME_LEN];
@@ -47,7 +112,7 @@ struct nullb {
 static LIST_HEAD(nullb_list);
 static struct mutex lock;
 static int null_major;
-static int nullb_indexes;
+static DEFINE_IDA(nullb_indexes);
 static struct kmem_cache *ppa_cache;
 
 enum {
@@ -144,6 +209,366 @@ static bool use_per_node_hctx = false;
 module_param(use_per_node_hctx, bool, S_IRUGO);
 MODULE_PARM_DESC(use_per_node_hctx, "Use per-node allocation for hardware context queues. Default: false");
 
+static bool memory_backed;
+module_param(memory_backed, bool, S_IRUGO);
+MODULE_PARM_DESC(memory_backed, "Keep the data written, in memory. Default: false");
+
+static bool discard;
+module_param(discard, bool, S_IRUGO);
+MODULE_PARM_DESC(discard, "Support discard. Default: false");
+
+static unsigned int mbps;
+module_param(mbps, uint, S_IRUGO);
+MODULE_PARM_DESC(mbps, "Bandwidth limit in MB/s, blk-mq only. Default: 0 (none)");
+
+static int null_add_dev(struct nullb_device *dev);
+static void null_del_dev(struct nullb *nullb);
+
+/*
+ * Devices beyond the nr_devices ones are made by mkdir in the nullb
+ * configfs directory, set up through its attributes, and brought up
+ * by writing 1 to "power".  Most attributes can only be changed while
+ * the device is powered off.
+ */
+static inline struct nullb_device *to_nullb_device(struct config_item *item)
+{
+	return item ? container_of(item, struct nullb_device, item) : NULL;
+}
+
+static inline ssize_t nullb_device_uint_attr_show(unsigned int val,
+						  char *page)
+{
+	return snprintf(page, PAGE_SIZE, "%u\n", val);
+}
+
+static inline ssize_t nullb_device_int_attr_show(int val, char *page)
+{
+	return snprintf(page, PAGE_SIZE, "%d\n", val);
+}
+
+static inline ssize_t nullb_device_ulong_attr_show(unsigned long val,
+						   char *page)
+{
+	return snprintf(page, PAGE_SIZE, "%lu\n", val);
+}
+
+static inline ssize_t nullb_device_bool_attr_show(bool val, char *page)
+{
+	return snprintf(page, PAGE_SIZE, "%u\n", val);
+}
+
+static ssize_t nullb_device_uint_attr_store(unsigned int *val,
+					    const char *page, size_t count)
+{
+	int ret = kstrtouint(page, 0, val);
+
+	return ret ? ret : count;
+}
+
+static ssize_t nullb_device_int_attr_store(int *val, const char *page,
+					   size_t count)
+{
+	int ret = kstrtoint(page, 0, val);
+
+	return ret ? ret : count;
+}
+
+static ssize_t nullb_device_ulong_attr_store(unsigned long *val,
+					     const char *page, size_t count)
+{
+	int ret = kstrtoul(page, 0, val);
+
+	return ret ? ret : count;
+}
+
+static ssize_t nullb_device_bool_attr_store(bool *val, const char *page,
+					    size_t count)
+{
+	int ret = strtobool(page, val);
+
+	return ret ? ret : count;
+}
+
+#define NULLB_DEVICE_ATTR(NAME, TYPE)					\
+static ssize_t								\
+nullb_device_##NAME##_show(struct config_item *item, char *page)	\
+{									\
+	return nullb_device_##TYPE##_attr_show(				\
+				to_nullb_device(item)->NAME, page);	\
+}									\
+static ssize_t								\
+nullb_device_##NAME##_store(struct config_item *item, const char *page,	\
+			    size_t count)				\
+{									\
+	struct nullb_device *dev = to_nullb_device(item);		\
+									\
+	if (test_bit(NULLB_DEV_FL_UP, &dev->flags))			\
+		return -EBUSY;						\
+	return nullb_device_##TYPE##_attr_store(&dev->NAME, page,	\
+						count);			\
+}									\
+CONFIGFS_ATTR(nullb_device_, NAME);
+
+NULLB_DEVICE_ATTR(size, ulong);
+NULLB_DEVICE_ATTR(completion_nsec, ulong);
+NULLB_DEVICE_ATTR(completion_jitter_nsec, uint);
+NULLB_DEVICE_ATTR(completion_tail_nsec, ulong);
+NULLB_DEVICE_ATTR(completion_tail_permille, uint);
+NULLB_DEVICE_ATTR(submit_queues, uint);
+NULLB_DEVICE_ATTR(home_node, int);
+NULLB_DEVICE_ATTR(queue_mode, uint);
+NULLB_DEVICE_ATTR(blocksize, uint);
+NULLB_DEVICE_ATTR(irqmode, uint);
+NULLB_DEVICE_ATTR(hw_queue_depth, uint);
+NULLB_DEVICE_ATTR(mbps, uint);
+NULLB_DEVICE_ATTR(use_per_node_hctx, bool);
+NULLB_DEVICE_ATTR(memory_backed, bool);
+NULLB_DEVICE_ATTR(discard, bool);
+
+static ssize_t nullb_device_index_show(struct config_item *item, char *page)
+{
+	return nullb_device_uint_attr_show(to_nullb_device(item)->index, page);
+}
+CONFIGFS_ATTR_RO(nullb_device_, index);
+
+static ssize_t nullb_device_power_show(struct config_item *item, char *page)
+{
+	return nullb_device_bool_attr_show(to_nullb_device(item)->power, page);
+}
+
+static ssize_t nullb_device_power_store(struct config_item *item,
+					const char *page, size_t count)
+{
+	struct nullb_device *dev = to_nullb_device(item);
+	bool newp = false;
+	ssize_t ret;
+
+	ret = nullb_device_bool_attr_store(&newp, page, count);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&lock);
+	if (!dev->power && newp) {
+		ret = null_add_dev(dev);
+		if (!ret) {
+			dev->power = true;
+			ret = count;
+		}
+	} else if (dev->power && !newp) {
+		null_del_dev(dev->nullb);
+		dev->power = false;
+	}
+	mutex_unlock(&lock);
+
+	return ret;
+}
+CONFIGFS_ATTR(nullb_device_, power);
+
+/*
+ * Sectors that fail with -EIO: "+start-end" adds the range, "-start-end"
+ * removes the ranges within it.  Both ends are inclusive.  This may be
+ * changed while the device is up.
+ */
+static ssize_t nullb_device_badblocks_show(struct config_item *item,
+					   char *page)
+{
+	struct nullb_device *dev = to_nullb_device(item);
+	struct nullb_badblock *bb;
+	ssize_t len = 0;
+
+	spin_lock_irq(&dev->lock);
+	list_for_each_entry(bb, &dev->badblocks, list) {
+		len += snprintf(page + len, PAGE_SIZE - len, "%llu-%llu\n",
+				(unsigned long long)bb->start,
+				(unsigned long long)bb->end);
+		if (len >= PAGE_SIZE - 1)
+			break;
+	}
+	spin_unlock_irq(&dev->lock);
+
+	return min_t(ssize_t, len, PAGE_SIZE - 1);
+}
+
+static ssize_t nullb_device_badblocks_store(struct config_item *item,
+					    const char *page, size_t count)
+{
+	struct nullb_device *dev = to_nullb_device(item);
+	struct nullb_badblock *bb, *tmp;
+	unsigned long long start, end;
+	char op;
+
+	if (sscanf(page, "%c%llu-%llu", &op, &start, &end) != 3 ||
+	    (op != '+' && op != '-') || start > end)
+		return -EINVAL;
+
+	if (op == '+') {
+		bb = kmalloc(sizeof(*bb), GFP_KERNEL);
+		if (!bb)
+			return -ENOMEM;
+		bb->start = start;
+		bb->end = end;
+
+		spin_lock_irq(&dev->lock);
+		list_add_tail(&bb->list, &dev->badblocks);
+		spin_unlock_irq(&dev->lock);
+		return count;
+	}
+
+	spin_lock_irq(&dev->lock);
+	list_for_each_entry_safe(bb, tmp, &dev->badblocks, list) {
+		if (bb->start >= start && bb->end <= end) {
+			list_del(&bb->list);
+			kfree(bb);
+		}
+	}
+	spin_unlock_irq(&dev->lock);
+
+	return count;
+}
+CONFIGFS_ATTR(nullb_device_, badblocks);
+
+static struct configfs_attribute *nullb_device_attrs[] = {
+	&nullb_device_attr_size,
+	&nullb_device_attr_completion_nsec,
+	&nullb_device_attr_completion_jitter_nsec,
+	&nullb_device_attr_completion_tail_nsec,
+	&nullb_device_attr_completion_tail_permille,
+	&nullb_device_attr_submit_queues,
+	&nullb_device_attr_home_node,
+	&nullb_device_attr_queue_mode,
+	&nullb_device_attr_blocksize,
+	&nullb_device_attr_irqmode,
+	&nullb_device_attr_hw_queue_depth,
+	&nullb_device_attr_mbps,
+	&nullb_device_attr_use_per_node_hctx,
+	&nullb_device_attr_memory_backed,
+	&nullb_device_attr_discard,
+	&nullb_device_attr_index,
+	&nullb_device_attr_power,
+	&nullb_device_attr_badblocks,
+	NULL,
+};
+
+static struct nullb_device *null_alloc_dev(void)
+{
+	struct nullb_device *dev;
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return NULL;
+
+	spin_lock_init(&dev->lock);
+	INIT_RADIX_TREE(&dev->data, GFP_ATOMIC);
+	INIT_LIST_HEAD(&dev->badblocks);
+
+	/* the module parameters are the defaults */
+	dev->size = gb * 1024;
+	dev->completion_nsec = completion_nsec;
+	dev->submit_queues = submit_queues;
+	dev->home_node = home_node;
+	dev->queue_mode = queue_mode;
+	dev->blocksize = bs;
+	dev->irqmode = irqmode;
+	dev->hw_queue_depth = hw_queue_depth;
+	dev->mbps = mbps;
+	dev->use_per_node_hctx = use_per_node_hctx;
+	dev->memory_backed = memory_backed;
+	dev->discard = discard;
+
+	return dev;
+}
+
+static void null_free_data(struct nullb_device *dev)
+{
+	struct page *pages[16];
+	pgoff_t pos = 0;
+	int i, nr;
+
+	do {
+		nr = radix_tree_gang_lookup(&dev->data, (void **)pages, pos,
+					    ARRAY_SIZE(pages));
+		for (i = 0; i < nr; i++) {
+			pos = pages[i]->index;
+			radix_tree_delete(&dev->data, pos);
+			__free_page(pages[i]);
+		}
+		pos++;
+	} while (nr == ARRAY_SIZE(pages));
+}
+
+static void null_free_dev(struct nullb_device *dev)
+{
+	struct nullb_badblock *bb, *tmp;
+
+	null_free_data(dev);
+	list_for_each_entry_safe(bb, tmp, &dev->badblocks, list)
+		kfree(bb);
+	kfree(dev);
+}
+
+static void nullb_device_release(struct config_item *item)
+{
+	null_free_dev(to_nullb_device(item));
+}
+
+static struct configfs_item_operations nullb_device_ops = {
+	.release	= nullb_device_release,
+};
+
+static struct config_item_type nullb_device_type = {
+	.ct_item_ops	= &nullb_device_ops,
+	.ct_attrs	= nullb_device_attrs,
+	.ct_owner	= THIS_MODULE,
+};
+
+static struct config_item *nullb_group_make_item(struct config_group *group,
+						 const char *name)
+{
+	struct nullb_device *dev;
+
+	dev = null_alloc_dev();
+	if (!dev)
+		return ERR_PTR(-ENOMEM);
+
+	config_item_init_type_name(&dev->item, name, &nullb_device_type);
+
+	return &dev->item;
+}
+
+static void nullb_group_drop_item(struct config_group *group,
+				  struct config_item *item)
+{
+	struct nullb_device *dev = to_nullb_device(item);
+
+	mutex_lock(&lock);
+	if (dev->power) {
+		null_del_dev(dev->nullb);
+		dev->power = false;
+	}
+	mutex_unlock(&lock);
+
+	config_item_put(item);
+}
+
+static struct configfs_group_operations nullb_group_ops = {
+	.make_item	= nullb_group_make_item,
+	.drop_item	= nullb_group_drop_item,
+};
+
+static struct config_item_type nullb_group_type = {
+	.ct_group_ops	= &nullb_group_ops,
+	.ct_owner	= THIS_MODULE,
+};
+
+static struct configfs_subsystem nullb_subsys = {
+	.su_group = {
+		.cg_item = {
+			.ci_namebuf = "nullb",
+			.ci_type = &nullb_group_type,
+		},
+	},
+};
+
 static void put_tag(struct nullb_queue *nq, unsigned int tag)
 {
 	clear_bit_unlock(tag, nq->tag_map);
@@ -182,7 +607,7 @@ static struct nullb_cmd *__alloc_cmd(struct nullb_queue *nq)
 		cmd = &nq->cmds[tag];
 		cmd->tag = tag;
 		cmd->nq = nq;
-		if (irqmode == NULL_IRQ_TIMER) {
+		if (nq->dev->irqmode == NULL_IRQ_TIMER) {
 			hrtimer_init(&cmd->timer, CLOCK_MONOTONIC,
 				     HRTIMER_MODE_REL);
 			cmd->timer.function = null_cmd_timer_expired;
@@ -218,19 +643,21 @@ static struct nullb_cmd *alloc_cmd(struct nullb_queue *nq, int can_wait)
 static void end_cmd(struct nullb_cmd *cmd)
 {
 	struct request_queue *q = NULL;
+	int queue_mode = cmd->nq->dev->queue_mode;
 
 	if (cmd->rq)
 		q = cmd->rq->q;
 
 	switch (queue_mode)  {
 	case NULL_Q_MQ:
-		blk_mq_end_request(cmd->rq, 0);
+		blk_mq_end_request(cmd->rq, cmd->error);
 		return;
 	case NULL_Q_RQ:
 		INIT_LIST_HEAD(&cmd->rq->queuelist);
-		blk_end_request_all(cmd->rq, 0);
+		blk_end_request_all(cmd->rq, cmd->error);
 		break;
 	case NULL_Q_BIO:
+		cmd->bio->bi_error = cmd->error;
 		bio_endio(cmd->bio);
 		break;
 	}
@@ -254,27 +681,249 @@ static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
 	return HRTIMER_NORESTART;
 }
 
+/*
+ * completion_nsec, or completion_tail_nsec for completion_tail_permille
+ * of the commands, plus up to completion_jitter_nsec spread uniformly.
+ */
+static u64 null_cmd_latency(struct nullb_device *dev)
+{
+	u64 nsec = dev->completion_nsec;
+
+	if (dev->completion_tail_permille &&
+	    prandom_u32_max(1000) < dev->completion_tail_permille)
+		nsec = dev->completion_tail_nsec;
+	if (dev->completion_jitter_nsec)
+		nsec += prandom_u32_max(dev->completion_jitter_nsec);
+
+	return nsec;
+}
+
 static void null_cmd_end_timer(struct nullb_cmd *cmd)
 {
-	ktime_t kt = ktime_set(0, completion_nsec);
+	ktime_t kt = ns_to_ktime(null_cmd_latency(cmd->nq->dev));
 
 	hrtimer_start(&cmd->timer, kt, HRTIMER_MODE_REL);
 }
 
 static void null_softirq_done_fn(struct request *rq)
 {
-	if (queue_mode == NULL_Q_MQ)
+	struct nullb *nullb = rq->q->queuedata;
+
+	if (nullb->dev->queue_mode == NULL_Q_MQ)
 		end_cmd(blk_mq_rq_to_pdu(rq));
 	else
 		end_cmd(rq->special);
 }
 
-static inline void null_handle_cmd(struct nullb_cmd *cmd)
+/* requires dev->lock */
+static struct page *null_lookup_page(struct nullb_device *dev,
+				     sector_t sector, bool create)
 {
+	pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+	struct page *page;
+
+	page = radix_tree_lookup(&dev->data, idx);
+	if (page || !create)
+		return page;
+
+	/* we may be called with preemption off, from any of the modes */
+	page = alloc_page(GFP_ATOMIC | __GFP_NOWARN | __GFP_ZERO);
+	if (!page)
+		return NULL;
+
+	page->index = idx;
+	if (radix_tree_insert(&dev->data, idx, page)) {
+		__free_page(page);
+		return NULL;
+	}
+
+	return page;
+}
+
+static int null_transfer(struct nullb_device *dev, struct page *page,
+			 unsigned int len, unsigned int off, bool is_write,
+			 sector_t sector)
+{
+	unsigned long flags;
+	void *buf, *mem;
+
+	while (len) {
+		unsigned int offset = (sector & (PAGE_SECTORS - 1)) << SECTOR_SHIFT;
+		unsigned int chunk = min_t(unsigned int, len, PAGE_SIZE - offset);
+		struct page *dpage;
+
+		spin_lock_irqsave(&dev->lock, flags);
+		dpage = null_lookup_page(dev, sector, is_write);
+		if (!dpage && is_write) {
+			spin_unlock_irqrestore(&dev->lock, flags);
+			return -ENOMEM;
+		}
+
+		buf = kmap_atomic(page);
+		if (!dpage) {
+			/* never written, or discarded */
+			memset(buf + off, 0, chunk);
+		} else {
+			mem = kmap_atomic(dpage);
+			if (is_write)
+				memcpy(mem + offset, buf + off, chunk);
+			else
+				memcpy(buf + off, mem + offset, chunk);
+			kunmap_atomic(mem);
+		}
+		kunmap_atomic(buf);
+		spin_unlock_irqrestore(&dev->lock, flags);
+
+		len -= chunk;
+		off += chunk;
+		sector += chunk >> SECTOR_SHIFT;
+	}
+
+	if (!is_write)
+		flush_dcache_page(page);
+	return 0;
+}
+
+static void null_discard(struct nullb_device *dev, sector_t sector,
+			 unsigned int bytes)
+{
+	unsigned long flags;
+	struct page *page;
+	void *mem;
+
+	while (bytes) {
+		unsigned int offset = (sector & (PAGE_SECTORS - 1)) << SECTOR_SHIFT;
+		unsigned int chunk = min_t(unsigned int, bytes, PAGE_SIZE - offset);
+		pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+
+		spin_lock_irqsave(&dev->lock, flags);
+		if (chunk == PAGE_SIZE) {
+			page = radix_tree_delete(&dev->data, idx);
+			if (page)
+				__free_page(page);
+		} else {
+			page = radix_tree_lookup(&dev->data, idx);
+			if (page) {
+				mem = kmap_atomic(page);
+				memset(mem + offset, 0, chunk);
+				kunmap_atomic(mem);
+			}
+		}
+		spin_unlock_irqrestore(&dev->lock, flags);
+
+		bytes -= chunk;
+		sector += chunk >> SECTOR_SHIFT;
+	}
+}
+
+static int null_handle_rq(struct nullb_cmd *cmd)
+{
+	struct request *rq = cmd->rq;
+	struct nullb_device *dev = cmd->nq->dev;
+	sector_t sector = blk_rq_pos(rq);
+	struct req_iterator iter;
+	struct bio_vec bvec;
+	int err;
+
+	if (rq->cmd_flags & REQ_DISCARD) {
+		null_discard(dev, sector, blk_rq_bytes(rq));
+		return 0;
+	}
+
+	rq_for_each_segment(bvec, rq, iter) {
+		err = null_transfer(dev, bvec.bv_page, bvec.bv_len,
+				    bvec.bv_offset, rq_data_dir(rq) == WRITE,
+				    sector);
+		if (err)
+			return err;
+		sector += bvec.bv_len >> SECTOR_SHIFT;
+	}
+
+	return 0;
+}
+
+static int null_handle_bio(struct nullb_cmd *cmd)
+{
+	struct bio *bio = cmd->bio;
+	struct nullb_device *dev = cmd->nq->dev;
+	sector_t sector = bio->bi_iter.bi_sector;
+	struct bvec_iter iter;
+	struct bio_vec bvec;
+	int err;
+
+	if (bio->bi_rw & REQ_DISCARD) {
+		null_discard(dev, sector, bio->bi_iter.bi_size);
+		return 0;
+	}
+
+	bio_for_each_segment(bvec, bio, iter) {
+		err = null_transfer(dev, bvec.bv_page, bvec.bv_len,
+				    bvec.bv_offset, bio_data_dir(bio) == WRITE,
+				    sector);
+		if (err)
+			return err;
+		sector += bvec.bv_len >> SECTOR_SHIFT;
+	}
+
+	return 0;
+}
+
+static bool null_is_badblock(struct nullb_device *dev, sector_t sector,
+			     unsigned int nr_sectors)
+{
+	struct nullb_badblock *bb;
+	unsigned long flags;
+	bool bad = false;
+
+	if (list_empty(&dev->badblocks))
+		return false;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	list_for_each_entry(bb, &dev->badblocks, list) {
+		if (sector <= bb->end && sector + nr_sectors > bb->start) {
+			bad = true;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	return bad;
+}
+
+/*
+ * Returns -ENOMEM, and leaves the command alone, when a blk-mq write on
+ * a memory backed device can't get a page.  Anything else is completed.
+ */
+static int null_handle_cmd(struct nullb_cmd *cmd)
+{
+	struct nullb_device *dev = cmd->nq->dev;
+	bool is_bio = dev->queue_mode == NULL_Q_BIO;
+	sector_t sector;
+	unsigned int nr_sectors;
+	int err;
+
+	if (is_bio) {
+		sector = cmd->bio->bi_iter.bi_sector;
+		nr_sectors = bio_sectors(cmd->bio);
+	} else {
+		sector = blk_rq_pos(cmd->rq);
+		nr_sectors = blk_rq_sectors(cmd->rq);
+	}
+
+	cmd->error = 0;
+	if (null_is_badblock(dev, sector, nr_sectors)) {
+		cmd->error = -EIO;
+	} else if (dev->memory_backed) {
+		err = is_bio ? null_handle_bio(cmd) : null_handle_rq(cmd);
+		if (err == -ENOMEM && dev->queue_mode == NULL_Q_MQ)
+			return err;
+		cmd->error = err;
+	}
+
 	/* Complete IO by inline, softirq or timer */
-	switch (irqmode) {
+	switch (dev->irqmode) {
 	case NULL_IRQ_SOFTIRQ:
-		switch (queue_mode)  {
+		switch (dev->queue_mode)  {
 		case NULL_Q_MQ:
 			blk_mq_complete_request(cmd->rq, cmd->rq->errors);
 			break;
@@ -296,6 +945,8 @@ static inline void null_handle_cmd(struct nullb_cmd *cmd)
 		null_cmd_end_timer(cmd);
 		break;
 	}
+
+	return 0;
 }
 
 static struct nullb_queue *nullb_to_queue(struct nullb *nullb)
@@ -351,21 +1002,68 @@ static void null_request_fn(struct request_queue *q)
 	}
 }
 
+static long null_bytes_per_tick(unsigned int mbps)
+{
+	return (long)mbps * (1 << 20) / (NSEC_PER_SEC / NULL_BW_TICK_NSEC);
+}
+
+/*
+ * Hand out the next tick's bytes and let any queue that ran out go
+ * again.  Stop when a whole tick went by unused; queue_rq starts us.
+ */
+static enum hrtimer_restart null_bw_timer_expired(struct hrtimer *timer)
+{
+	struct nullb *nullb = container_of(timer, struct nullb, bw_timer);
+	long tick_bytes = null_bytes_per_tick(nullb->dev->mbps);
+
+	if (!test_bit(NULLB_DEV_FL_THROTTLED, &nullb->dev->flags) ||
+	    atomic_long_read(&nullb->cur_bytes) == tick_bytes)
+		return HRTIMER_NORESTART;
+
+	atomic_long_set(&nullb->cur_bytes, tick_bytes);
+	blk_mq_start_stopped_hw_queues(nullb->q, true);
+
+	hrtimer_forward_now(timer, ns_to_ktime(NULL_BW_TICK_NSEC));
+	return HRTIMER_RESTART;
+}
+
 static int null_queue_rq(struct blk_mq_hw_ctx *hctx,
 			 const struct blk_mq_queue_data *bd)
 {
 	struct nullb_cmd *cmd = blk_mq_rq_to_pdu(bd->rq);
+	struct nullb_queue *nq = hctx->driver_data;
+	struct nullb *nullb = hctx->queue->queuedata;
+
+	if (test_bit(NULLB_DEV_FL_THROTTLED, &nq->dev->flags)) {
+		if (!hrtimer_active(&nullb->bw_timer))
+			hrtimer_start(&nullb->bw_timer,
+				      ns_to_ktime(NULL_BW_TICK_NSEC),
+				      HRTIMER_MODE_REL);
+
+		if (atomic_long_sub_return(blk_rq_bytes(bd->rq),
+					   &nullb->cur_bytes) < 0) {
+			blk_mq_stop_hw_queues(nullb->q);
+			/* the timer may have come by in the meantime */
+			if (atomic_long_read(&nullb->cur_bytes) > 0)
+				blk_mq_start_stopped_hw_queues(nullb->q, true);
+			return BLK_MQ_RQ_QUEUE_BUSY;
+		}
+	}
 
-	if (irqmode == NULL_IRQ_TIMER) {
+	if (nq->dev->irqmode == NULL_IRQ_TIMER) {
 		hrtimer_init(&cmd->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 		cmd->timer.function = null_cmd_timer_expired;
 	}
 	cmd->rq = bd->rq;
-	cmd->nq = hctx->driver_data;
+	cmd->nq = nq;
 
 	blk_mq_start_request(bd->rq);
 
-	null_handle_cmd(cmd);
+	if (null_handle_cmd(cmd)) {
+		blk_mq_stop_hw_queue(hctx);
+		blk_mq_delay_queue(hctx, NULL_ENOMEM_DELAY_MS);
+		return BLK_MQ_RQ_QUEUE_BUSY;
+	}
 	return BLK_MQ_RQ_QUEUE_OK;
 }
 
@@ -376,6 +1074,7 @@ static void null_init_queue(struct nullb *nullb, struct nullb_queue *nq)
 
 	init_waitqueue_head(&nq->wait);
 	nq->queue_depth = nullb->queue_depth;
+	nq->dev = nullb->dev;
 }
 
 static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
@@ -414,20 +1113,35 @@ static void cleanup_queues(struct nullb *nullb)
 	kfree(nullb->queues);
 }
 
+/* requires lock */
 static void null_del_dev(struct nullb *nullb)
 {
+	struct nullb_device *dev = nullb->dev;
+
 	list_del_init(&nullb->list);
 
-	if (use_lightnvm)
+	if (dev->use_lightnvm)
 		nvm_unregister(nullb->disk_name);
 	else
 		del_gendisk(nullb->disk);
+
+	/* drain without the bandwidth limit */
+	if (test_and_clear_bit(NULLB_DEV_FL_THROTTLED, &dev->flags)) {
+		hrtimer_cancel(&nullb->bw_timer);
+		atomic_long_set(&nullb->cur_bytes, LONG_MAX);
+		blk_mq_start_stopped_hw_queues(nullb->q, true);
+	}
+
 	blk_cleanup_queue(nullb->q);
-	if (queue_mode == NULL_Q_MQ)
+	hrtimer_cancel(&nullb->bw_timer);
+	if (dev->queue_mode == NULL_Q_MQ)
 		blk_mq_free_tag_set(&nullb->tag_set);
-	if (!use_lightnvm)
+	if (!dev->use_lightnvm)
 		put_disk(nullb->disk);
 	cleanup_queues(nullb);
+	ida_simple_remove(&nullb_indexes, nullb->index);
+	clear_bit(NULLB_DEV_FL_UP, &dev->flags);
+	dev->nullb = NULL;
 	kfree(nullb);
 }
 
@@ -472,7 +1186,9 @@ static int null_lnvm_submit_io(struct nvm_dev *dev, struct nvm_rq *rqd)
 
 static int null_lnvm_id(struct nvm_dev *dev, struct nvm_id *id)
 {
-	sector_t size = gb * 1024 * 1024 * 1024ULL;
+	struct nullb *nullb = dev->q->queuedata;
+	sector_t size = (sector_t)nullb->dev->size * 1024 * 1024ULL;
+	unsigned int bs = nullb->dev->blocksize;
 	sector_t blksize;
 	struct nvm_id_group *grp;
 
@@ -518,7 +1234,7 @@ static int null_lnvm_id(struct nvm_dev *dev, struct nvm_id *id)
 	grp->tbet = 1500000;
 	grp->tbem = 1500000;
 	grp->mpos = 0x010101; /* single plane rwe */
-	grp->cpar = hw_queue_depth;
+	grp->cpar = nullb->dev->hw_queue_depth;
 
 	return 0;
 }
@@ -612,13 +1328,13 @@ static int setup_commands(struct nullb_queue *nq)
 
 static int setup_queues(struct nullb *nullb)
 {
-	nullb->queues = kzalloc(submit_queues * sizeof(struct nullb_queue),
-								GFP_KERNEL);
+	nullb->queues = kzalloc(nullb->dev->submit_queues *
+				sizeof(struct nullb_queue), GFP_KERNEL);
 	if (!nullb->queues)
 		return -ENOMEM;
 
 	nullb->nr_queues = 0;
-	nullb->queue_depth = hw_queue_depth;
+	nullb->queue_depth = nullb->dev->hw_queue_depth;
 
 	return 0;
 }
@@ -628,7 +1344,7 @@ static int init_driver_queues(struct nullb *nullb)
 	struct nullb_queue *nq;
 	int i, ret = 0;
 
-	for (i = 0; i < submit_queues; i++) {
+	for (i = 0; i < nullb->dev->submit_queues; i++) {
 		nq = &nullb->queues[i];
 
 		null_init_queue(nullb, nq);
@@ -641,33 +1357,89 @@ static int init_driver_queues(struct nullb *nullb)
 	return 0;
 }
 
-static int null_add_dev(void)
+static void null_validate_conf(struct nullb_device *dev)
+{
+	dev->queue_mode = min_t(unsigned int, dev->queue_mode, NULL_Q_MQ);
+	dev->irqmode = min_t(unsigned int, dev->irqmode, NULL_IRQ_TIMER);
+
+	if (dev->blocksize > PAGE_SIZE) {
+		pr_warn("null_blk: invalid block size\n");
+		pr_warn("null_blk: defaults block size to %lu\n", PAGE_SIZE);
+		dev->blocksize = PAGE_SIZE;
+	}
+	if (dev->blocksize < 512 || !is_power_of_2(dev->blocksize)) {
+		pr_warn("null_blk: invalid block size\n");
+		pr_warn("null_blk: defaults block size to 512\n");
+		dev->blocksize = 512;
+	}
+
+	if (dev->use_lightnvm && dev->blocksize != 4096) {
+		pr_warn("null_blk: LightNVM only supports 4k block size\n");
+		pr_warn("null_blk: defaults block size to 4k\n");
+		dev->blocksize = 4096;
+	}
+
+	if (dev->use_lightnvm && dev->queue_mode != NULL_Q_MQ) {
+		pr_warn("null_blk: LightNVM only supported for blk-mq\n");
+		pr_warn("null_blk: defaults queue mode to blk-mq\n");
+		dev->queue_mode = NULL_Q_MQ;
+	}
+
+	if (dev->use_lightnvm && dev->memory_backed) {
+		pr_warn("null_blk: LightNVM devices are not memory backed\n");
+		dev->memory_backed = false;
+	}
+
+	if (dev->mbps && dev->queue_mode != NULL_Q_MQ) {
+		pr_warn("null_blk: bandwidth limit only supported for blk-mq\n");
+		dev->mbps = 0;
+	}
+
+	if (dev->queue_mode == NULL_Q_MQ && dev->use_per_node_hctx) {
+		if (dev->submit_queues != nr_online_nodes) {
+			pr_warn("null_blk: submit_queues param is set to %u.",
+							nr_online_nodes);
+			dev->submit_queues = nr_online_nodes;
+		}
+	} else if (dev->submit_queues > nr_cpu_ids)
+		dev->submit_queues = nr_cpu_ids;
+	else if (!dev->submit_queues)
+		dev->submit_queues = 1;
+
+	if (!dev->hw_queue_depth)
+		dev->hw_queue_depth = 1;
+}
+
+/* requires lock */
+static int null_add_dev(struct nullb_device *dev)
 {
 	struct gendisk *disk;
 	struct nullb *nullb;
 	sector_t size;
 	int rv;
 
-	nullb = kzalloc_node(sizeof(*nullb), GFP_KERNEL, home_node);
+	null_validate_conf(dev);
+
+	nullb = kzalloc_node(sizeof(*nullb), GFP_KERNEL, dev->home_node);
 	if (!nullb) {
 		rv = -ENOMEM;
 		goto out;
 	}
+	nullb->dev = dev;
 
 	spin_lock_init(&nullb->lock);
-
-	if (queue_mode == NULL_Q_MQ && use_per_node_hctx)
-		submit_queues = nr_online_nodes;
+	hrtimer_init(&nullb->bw_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	nullb->bw_timer.function = null_bw_timer_expired;
 
 	rv = setup_queues(nullb);
 	if (rv)
 		goto out_free_nullb;
 
-	if (queue_mode == NULL_Q_MQ) {
+	if (dev->queue_mode == NULL_Q_MQ) {
 		nullb->tag_set.ops = &null_mq_ops;
-		nullb->tag_set.nr_hw_queues = submit_queues;
-		nullb->tag_set.queue_depth = hw_queue_depth;
-		nullb->tag_set.numa_node = home_node;
+		nullb->tag_set.nr_hw_queues = dev->submit_queues;
+		nullb->tag_set.queue_depth = dev->hw_queue_depth;
+		nullb->tag_set.numa_node = dev->home_node;
 		nullb->tag_set.cmd_size	= sizeof(struct nullb_cmd);
 		nullb->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
 		nullb->tag_set.driver_data = nullb;
@@ -681,8 +1453,8 @@ static int null_add_dev(void)
 			rv = -ENOMEM;
 			goto out_cleanup_tags;
 		}
-	} else if (queue_mode == NULL_Q_BIO) {
-		nullb->q = blk_alloc_queue_node(GFP_KERNEL, home_node);
+	} else if (dev->queue_mode == NULL_Q_BIO) {
+		nullb->q = blk_alloc_queue_node(GFP_KERNEL, dev->home_node);
 		if (!nullb->q) {
 			rv = -ENOMEM;
 			goto out_cleanup_queues;
@@ -692,7 +1464,8 @@ static int null_add_dev(void)
 		if (rv)
 			goto out_cleanup_blk_queue;
 	} else {
-		nullb->q = blk_init_queue_node(null_request_fn, &nullb->lock, home_node);
+		nullb->q = blk_init_queue_node(null_request_fn, &nullb->lock,
+					       dev->home_node);
 		if (!nullb->q) {
 			rv = -ENOMEM;
 			goto out_cleanup_queues;
@@ -708,31 +1481,44 @@ static int null_add_dev(void)
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
 	queue_flag_clear_unlocked(QUEUE_FLAG_ADD_RANDOM, nullb->q);
 
+	if (dev->discard) {
+		nullb->q->limits.discard_granularity = dev->blocksize;
+		nullb->q->limits.discard_alignment = dev->blocksize;
+		blk_queue_max_discard_sectors(nullb->q, UINT_MAX >> 9);
+		queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, nullb->q);
+	}
 
-	mutex_lock(&lock);
+	if (dev->mbps) {
+		atomic_long_set(&nullb->cur_bytes,
+				null_bytes_per_tick(dev->mbps));
+		set_bit(NULLB_DEV_FL_THROTTLED, &dev->flags);
+	}
+
+	rv = ida_simple_get(&nullb_indexes, 0, 0, GFP_KERNEL);
+	if (rv < 0)
+		goto out_cleanup_blk_queue;
+	nullb->index = dev->index = rv;
 	list_add_tail(&nullb->list, &nullb_list);
-	nullb->index = nullb_indexes++;
-	mutex_unlock(&lock);
 
-	blk_queue_logical_block_size(nullb->q, bs);
-	blk_queue_physical_block_size(nullb->q, bs);
+	blk_queue_logical_block_size(nullb->q, dev->blocksize);
+	blk_queue_physical_block_size(nullb->q, dev->blocksize);
 
 	sprintf(nullb->disk_name, "nullb%d", nullb->index);
 
-	if (use_lightnvm) {
+	if (dev->use_lightnvm) {
 		rv = nvm_register(nullb->q, nullb->disk_name,
 							&null_lnvm_dev_ops);
 		if (rv)
-			goto out_cleanup_blk_queue;
+			goto out_cleanup_index;
 		goto done;
 	}
 
-	disk = nullb->disk = alloc_disk_node(1, home_node);
+	disk = nullb->disk = alloc_disk_node(1, dev->home_node);
 	if (!disk) {
 		rv = -ENOMEM;
-		goto out_cleanup_lightnvm;
+		goto out_cleanup_index;
 	}
-	size = gb * 1024 * 1024 * 1024ULL;
+	size = (sector_t)dev->size * 1024 * 1024ULL;
 	set_capacity(disk, size >> 9);
 
 	disk->flags |= GENHD_FL_EXT_DEVT | GENHD_FL_SUPPRESS_PARTITION_INFO;
@@ -745,15 +1531,18 @@ static int null_add_dev(void)
 
 	add_disk(disk);
 done:
+	dev->nullb = nullb;
+	set_bit(NULLB_DEV_FL_UP, &dev->flags);
 	return 0;
 
-out_cleanup_lightnvm:
-	if (use_lightnvm)
-		nvm_unregister(nullb->disk_name);
+out_cleanup_index:
+	list_del_init(&nullb->list);
+	ida_simple_remove(&nullb_indexes, nullb->index);
 out_cleanup_blk_queue:
+	clear_bit(NULLB_DEV_FL_THROTTLED, &dev->flags);
 	blk_cleanup_queue(nullb->q);
 out_cleanup_tags:
-	if (queue_mode == NULL_Q_MQ)
+	if (dev->queue_mode == NULL_Q_MQ)
 		blk_mq_free_tag_set(&nullb->tag_set);
 out_cleanup_queues:
 	cleanup_queues(nullb);
@@ -768,12 +1557,7 @@ static int __init null_init(void)
 	int ret = 0;
 	unsigned int i;
 	struct nullb *nullb;
-
-	if (bs > PAGE_SIZE) {
-		pr_warn("null_blk: invalid block size\n");
-		pr_warn("null_blk: defaults block size to %lu\n", PAGE_SIZE);
-		bs = PAGE_SIZE;
-	}
+	struct nullb_device *dev;
 
 	if (use_lightnvm && bs != 4096) {
 		pr_warn("null_blk: LightNVM only supports 4k block size\n");
@@ -787,22 +1571,20 @@ static int __init null_init(void)
 		queue_mode = NULL_Q_MQ;
 	}
 
-	if (queue_mode == NULL_Q_MQ && use_per_node_hctx) {
-		if (submit_queues < nr_online_nodes) {
-			pr_warn("null_blk: submit_queues param is set to %u.",
-							nr_online_nodes);
-			submit_queues = nr_online_nodes;
-		}
-	} else if (submit_queues > nr_cpu_ids)
-		submit_queues = nr_cpu_ids;
-	else if (!submit_queues)
-		submit_queues = 1;
-
 	mutex_init(&lock);
 
+	config_group_init(&nullb_subsys.su_group);
+	mutex_init(&nullb_subsys.su_mutex);
+
+	ret = configfs_register_subsystem(&nullb_subsys);
+	if (ret)
+		return ret;
+
 	null_major = register_blkdev(0, "nullb");
-	if (null_major < 0)
-		return null_major;
+	if (null_major < 0) {
+		ret = null_major;
+		goto err_conf;
+	}
 
 	if (use_lightnvm) {
 		ppa_cache = kmem_cache_create("ppa_cache", 64 * sizeof(u64),
@@ -814,11 +1596,22 @@ static int __init null_init(void)
 		}
 	}
 
+	mutex_lock(&lock);
 	for (i = 0; i < nr_devices; i++) {
-		ret = null_add_dev();
-		if (ret)
+		dev = null_alloc_dev();
+		if (!dev) {
+			ret = -ENOMEM;
+			goto err_dev;
+		}
+		dev->use_lightnvm = use_lightnvm;
+
+		ret = null_add_dev(dev);
+		if (ret) {
+			null_free_dev(dev);
 			goto err_dev;
+		}
 	}
+	mutex_unlock(&lock);
 
 	pr_info("null: module loaded\n");
 	return 0;
@@ -826,24 +1619,35 @@ static int __init null_init(void)
 err_dev:
 	while (!list_empty(&nullb_list)) {
 		nullb = list_entry(nullb_list.next, struct nullb, list);
+		dev = nullb->dev;
 		null_del_dev(nullb);
+		null_free_dev(dev);
 	}
+	mutex_unlock(&lock);
 	kmem_cache_destroy(ppa_cache);
 err_ppa:
 	unregister_blkdev(null_major, "nullb");
+err_conf:
+	configfs_unregister_subsystem(&nullb_subsys);
 	return ret;
 }
 
 static void __exit null_exit(void)
 {
 	struct nullb *nullb;
+	struct nullb_device *dev;
+
+	/* configfs pins the module, only the nr_devices ones are left */
+	configfs_unregister_subsystem(&nullb_subsys);
 
 	unregister_blkdev(null_major, "nullb");
 
 	mutex_lock(&lock);
 	while (!list_empty(&nullb_list)) {
 		nullb = list_entry(nullb_list.next, struct nullb, list);
+		dev = nullb->dev;
 		null_del_dev(nullb);
+		null_free_dev(dev);
 	}
 	mutex_unlock(&lock);
 
@@ -730,6 +730,7 @@ static struct rbd_client *rbd_client_find(struct ceph_options *ceph_opts)
  */
 enum {
 	Opt_queue_depth,
+	Opt_queues,
 	Opt_last_int,
 	/* int args above */
 	Opt_last_string,
@@ -741,6 +742,7 @@ enum {
 
 static match_table_t rbd_opts_tokens = {
 	{Opt_queue_depth, "queue_depth=%d"},
+	{Opt_queues, "queues=%d"},
 	/* int args above */
 	/* string args above */
 	{Opt_read_only, "read_only"},
@@ -751,11 +753,13 @@ static match_table_t rbd_opts_tokens = {
 };
 
 struct rbd_options {
-	int	queue_depth;
+	int	queue_depth;		/* per hardware queue */
+	int	queues;			/* 0: one per present cpu */
 	bool	read_only;
 };
 
 #define RBD_QUEUE_DEPTH_DEFAULT	BLKDEV_MAX_RQ
+#define RBD_QUEUES_DEFAULT	0
 #define RBD_READ_ONLY_DEFAULT	false
 
 static int parse_rbd_opts_token(char *c, void *private)
@@ -786,6 +790,13 @@ static int parse_rbd_opts_token(char *c, void *private)
 		}
 		rbd_opts->queue_depth = intval;
 		break;
+	case Opt_queues:
+		if (intval < 1) {
+			pr_err("queues out of range\n");
+			return -EINVAL;
+		}
+		rbd_opts->queues = intval;
+		break;
 	case Opt_read_only:
 		rbd_opts->read_only = true;
 		break;
@@ -3475,8 +3486,20 @@ static int rbd_queue_rq(struct blk_mq_hw_ctx *hctx,
 {
 	struct request *rq = bd->rq;
 	struct work_struct *work = blk_mq_rq_to_pdu(rq);
+	int cpu;
 
-	queue_work(rbd_wq, work);
+	/*
+	 * Build the request on the cpu it was issued on, or failing that
+	 * on one the hardware queue is mapped to.  The messenger work it
+	 * kicks off is queued from there, and so stays there too.
+	 */
+	cpu = raw_smp_processor_id();
+	if (!cpumask_test_cpu(cpu, hctx->cpumask))
+		cpu = cpumask_any_and(hctx->cpumask, cpu_online_mask);
+	if (cpu < nr_cpu_ids)
+		queue_work_on(cpu, rbd_wq, work);
+	else
+		queue_work(rbd_wq, work);
 	return BLK_MQ_RQ_QUEUE_OK;
 }
 
@@ -3747,7 +3770,8 @@ static int rbd_init_disk(struct rbd_device *rbd_dev)
 	rbd_dev->tag_set.queue_depth = rbd_dev->opts->queue_depth;
 	rbd_dev->tag_set.numa_node = NUMA_NO_NODE;
 	rbd_dev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_SG_MERGE;
-	rbd_dev->tag_set.nr_hw_queues = 1;
+	rbd_dev->tag_set.nr_hw_queues = rbd_dev->opts->queues ?:
+					num_present_cpus();
 	rbd_dev->tag_set.cmd_size = sizeof(struct work_struct);
 
 	err = blk_mq_alloc_tag_set(&rbd_dev->tag_set);
@@ -4944,6 +4968,7 @@ static int rbd_add_parse_args(const char *buf,
 
 	rbd_opts->read_only = RBD_READ_ONLY_DEFAULT;
 	rbd_opts->queue_depth = RBD_QUEUE_DEPTH_DEFAULT;
+	rbd_opts->queues = RBD_QUEUES_DEFAULT;
 
 	copts = ceph_parse_options(options, mon_addrs,
 					mon_addrs + mon_addrs_size - 1,
@@ -55,6 +55,7 @@ struct virtblk_req {
 	struct request *req;
 	struct virtio_blk_outhdr out_hdr;
 	struct virtio_scsi_inhdr in_hdr;
+	struct virtio_blk_discard_write_zeroes range;
 	u8 status;
 	struct scatterlist sg[];
 };
@@ -114,6 +115,37 @@ static int __virtblk_add_req(struct virtqueue *vq,
 	return virtqueue_add_sgs(vq, sgs, num_out, num_in, vbr, GFP_ATOMIC);
 }
 
+/*
+ * The block layer has no write zeroes operation here, but zeroing is a
+ * WRITE SAME of a zeroed block: blkdev_issue_zeroout() sends those.
+ */
+static bool virtblk_write_same_is_zeroes(struct request *req)
+{
+	struct bio_vec bv = bio_iovec(req->bio);
+	void *p;
+	bool zero;
+
+	p = kmap_atomic(bv.bv_page);
+	zero = !memchr_inv(p + bv.bv_offset, 0, bv.bv_len);
+	kunmap_atomic(p);
+
+	return zero;
+}
+
+/* one range, as the block layer doesn't merge discards into several */
+static unsigned int virtblk_setup_range(struct virtblk_req *vbr, bool unmap)
+{
+	struct request *req = vbr->req;
+
+	vbr->range.sector = cpu_to_le64(blk_rq_pos(req));
+	vbr->range.num_sectors = cpu_to_le32(blk_rq_sectors(req));
+	vbr->range.flags =
+		cpu_to_le32(unmap ? VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP : 0);
+
+	sg_init_one(vbr->sg, &vbr->range, sizeof(vbr->range));
+	return 1;
+}
+
 static inline void virtblk_request_done(struct request *req)
 {
 	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
@@ -168,11 +200,27 @@ static int virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
 	int qid = hctx->queue_num;
 	int err;
 	bool notify = false;
+	bool range = false;
 
 	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
 
 	vbr->req = req;
-	if (req->cmd_flags & REQ_FLUSH) {
+	if (req->cmd_flags & REQ_DISCARD) {
+		vbr->out_hdr.type = cpu_to_virtio32(vblk->vdev, VIRTIO_BLK_T_DISCARD);
+		vbr->out_hdr.sector = 0;
+		vbr->out_hdr.ioprio = cpu_to_virtio32(vblk->vdev, req_get_ioprio(vbr->req));
+		range = true;
+	} else if (req->cmd_flags & REQ_WRITE_SAME) {
+		if (!virtblk_write_same_is_zeroes(req)) {
+			blk_mq_start_request(req);
+			blk_mq_end_request(req, -EOPNOTSUPP);
+			return BLK_MQ_RQ_QUEUE_OK;
+		}
+		vbr->out_hdr.type = cpu_to_virtio32(vblk->vdev, VIRTIO_BLK_T_WRITE_ZEROES);
+		vbr->out_hdr.sector = 0;
+		vbr->out_hdr.ioprio = cpu_to_virtio32(vblk->vdev, req_get_ioprio(vbr->req));
+		range = true;
+	} else if (req->cmd_flags & REQ_FLUSH) {
 		vbr->out_hdr.type = cpu_to_virtio32(vblk->vdev, VIRTIO_BLK_T_FLUSH);
 		vbr->out_hdr.sector = 0;
 		vbr->out_hdr.ioprio = cpu_to_virtio32(vblk->vdev, req_get_ioprio(vbr->req));
@@ -201,8 +249,12 @@ static int virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
 
 	blk_mq_start_request(req);
 
-	num = blk_rq_map_sg(hctx->queue, vbr->req, vbr->sg);
-	if (num) {
+	/* the range goes out as data, the command types carry the OUT bit */
+	if (range)
+		num = virtblk_setup_range(vbr, !(req->cmd_flags & REQ_DISCARD));
+	else
+		num = blk_rq_map_sg(hctx->queue, vbr->req, vbr->sg);
+	if (num && !range) {
 		if (rq_data_dir(vbr->req) == WRITE)
 			vbr->out_hdr.type |= cpu_to_virtio32(vblk->vdev, VIRTIO_BLK_T_OUT);
 		else
@@ -393,6 +445,9 @@ static int init_vq(struct virtio_blk *vblk)
 	if (err)
 		num_vqs = 1;
 
+	/* one per vCPU at most, a queue per CPU is all blk-mq maps */
+	num_vqs = min_t(unsigned int, nr_cpu_ids, num_vqs);
+
 	vblk->vqs = kmalloc(sizeof(*vblk->vqs) * num_vqs, GFP_KERNEL);
 	if (!vblk->vqs) {
 		err = -ENOMEM;
@@ -630,7 +685,8 @@ static int virtblk_probe(struct virtio_device *vdev)
 	vblk->tag_set.ops = &virtio_mq_ops;
 	vblk->tag_set.queue_depth = virtblk_queue_depth;
 	vblk->tag_set.numa_node = NUMA_NO_NODE;
-	vblk->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+	/* we notify the host once for a batch, see virtio_queue_rq() */
+	vblk->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_DEFER_ISSUE;
 	vblk->tag_set.cmd_size =
 		sizeof(struct virtblk_req) +
 		sizeof(struct scatterlist) * sg_elems;
@@ -730,6 +786,23 @@ static int virtblk_probe(struct virtio_device *vdev)
 	if (!err && opt_io_size)
 		blk_queue_io_opt(q, blk_size * opt_io_size);
 
+	if (virtio_has_feature(vdev, VIRTIO_BLK_F_DISCARD)) {
+		virtio_cread(vdev, struct virtio_blk_config,
+			     discard_sector_alignment, &v);
+		q->limits.discard_granularity = v ? v << 9 : blk_size;
+
+		virtio_cread(vdev, struct virtio_blk_config,
+			     max_discard_sectors, &v);
+		blk_queue_max_discard_sectors(q, v ? v : UINT_MAX);
+		queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, q);
+	}
+
+	if (virtio_has_feature(vdev, VIRTIO_BLK_F_WRITE_ZEROES)) {
+		virtio_cread(vdev, struct virtio_blk_config,
+			     max_write_zeroes_sectors, &v);
+		blk_queue_max_write_same_sectors(q, v ? v : UINT_MAX);
+	}
+
 	virtio_device_ready(vdev);
 
 	add_disk(vblk->disk);
@@ -834,14 +907,14 @@ static unsigned int features_legacy[] = {
 	VIRTIO_BLK_F_SEG_MAX, VIRTIO_BLK_F_SIZE_MAX, VIRTIO_BLK_F_GEOMETRY,
 	VIRTIO_BLK_F_RO, VIRTIO_BLK_F_BLK_SIZE, VIRTIO_BLK_F_SCSI,
 	VIRTIO_BLK_F_WCE, VIRTIO_BLK_F_TOPOLOGY, VIRTIO_BLK_F_CONFIG_WCE,
-	VIRTIO_BLK_F_MQ,
+	VIRTIO_BLK_F_MQ, VIRTIO_BLK_F_DISCARD, VIRTIO_BLK_F_WRITE_ZEROES,
 }
 ;
 static unsigned int features[] = {
 	VIRTIO_BLK_F_SEG_MAX, VIRTIO_BLK_F_SIZE_MAX, VIRTIO_BLK_F_GEOMETRY,
 	VIRTIO_BLK_F_RO, VIRTIO_BLK_F_BLK_SIZE,
 	VIRTIO_BLK_F_WCE, VIRTIO_BLK_F_TOPOLOGY, VIRTIO_BLK_F_CONFIG_WCE,
-	VIRTIO_BLK_F_MQ,
+	VIRTIO_BLK_F_MQ, VIRTIO_BLK_F_DISCARD, VIRTIO_BLK_F_WRITE_ZEROES,
 };
 
 static struct virtio_driver virtio_blk = {
@@ -16,6 +16,8 @@
 #define _ZRAM_DRV_H_
 
 #include <linux/spinlock.h>
+#include <linux/bio.h>
+#include <linux/workqueue.h>
 #include <linux/zsmalloc.h>
 
 #include "zcomp.h"
@@ -59,9 +61,12 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /* Flags for zram pages (table[page_no].value) */
 enum zram_pageflags {
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO = ZRAM_FLAG_SHIFT,
+	/* Page consists of the same element repeated, kept in table.element */
+	ZRAM_SAME = ZRAM_FLAG_SHIFT,
 	ZRAM_ACCESS,	/* page is now accessed */
+	ZRAM_WB,	/* page is on the backing device, table.handle is its block */
+	ZRAM_UNDER_WB,	/* page is being written back */
+	ZRAM_IDLE,	/* page was not accessed since the last idle marking */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -70,7 +75,10 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct zram_table_entry {
-	unsigned long handle;
+	union {
+		unsigned long handle;
+		unsigned long element;
+	};
 	unsigned long value;
 };
 
@@ -82,9 +90,14 @@ struct zram_stats {
 	atomic64_t failed_writes;	/* can happen when memory is too low */
 	atomic64_t invalid_io;	/* non-page-aligned I/O requests */
 	atomic64_t notify_free;	/* no. of swap slot free notifications */
-	atomic64_t zero_pages;		/* no. of zero filled pages */
+	atomic64_t zero_pages;		/* no. of same element filled pages */
 	atomic64_t pages_stored;	/* no. of pages currently stored */
 	atomic_long_t max_used_pages;	/* no. of maximum pages stored */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic64_t bd_count;		/* no. of pages in backing device */
+	atomic64_t bd_reads;		/* no. of reads from backing device */
+	atomic64_t bd_writes;		/* no. of writes to backing device */
+#endif
 };
 
 struct zram_meta {
@@ -92,6 +105,18 @@ struct zram_meta {
 	struct zs_pool *mem_pool;
 };
 
+/*
+ * Writes queued for compression in a worker, see zram_queue_async().
+ * There is one queue per online CPU so that a single submitter spreads
+ * its writes over as many compression streams.
+ */
+struct zram_async_queue {
+	spinlock_t lock;
+	struct bio_list bios;
+	struct work_struct work;
+	struct zram *zram;
+};
+
 struct zram {
 	struct zram_meta *meta;
 	struct zcomp *comp;
@@ -118,5 +143,17 @@ struct zram {
 	 * zram is claimed so open request will be failed
 	 */
 	bool claim; /* Protected by bdev->bd_mutex */
+	/* Complete writes from the worker queues instead of inline */
+	bool async_write;
+	struct zram_async_queue *async_queues;
+	unsigned int nr_async_queues;
+	atomic_t async_next;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned int old_block_size;
+	unsigned long *bitmap;	/* Allocated blocks of the backing device */
+	unsigned long nr_pages;	/* Size of the backing device in pages */
+#endif
 };
 #endif
@@ -38,6 +38,7 @@ void dbs_check_cpu(struct dbs_data *dbs_data, int cpu)
 	struct cpufreq_policy *policy = cdbs->shared->policy;
 	unsigned int sampling_rate;
 	unsigned int max_load = 0;
+	unsigned int min_pct, max_pct;
 	unsigned int ignore_nice;
 	unsigned int j;
 
@@ -150,6 +151,10 @@ void dbs_check_cpu(struct dbs_data *dbs_data, int cpu)
 			j_cdbs->prev_load = load;
 		}
 
+		/* as much performance as the tasks there ask for, and no more */
+		sched_cpu_uclamp_pct(j, &min_pct, &max_pct);
+		load = clamp(load, min_pct, max_pct);
+
 		if (load > max_load)
 			max_load = load;
 	}
@@ -973,7 +973,8 @@ static inline void intel_pstate_adjust_busy_pstate(struct cpudata *cpu)
 	int32_t busy_scaled;
 	struct _pid *pid;
 	signed int ctl;
-	int from;
+	int from, target;
+	unsigned int min_pct, max_pct;
 	struct sample *sample;
 
 	from = cpu->pstate.current_pstate;
@@ -984,7 +985,15 @@ static inline void intel_pstate_adjust_busy_pstate(struct cpudata *cpu)
 	ctl = pid_calc(pid, busy_scaled);
 
 	/* Negative values of ctl increase the pstate and vice versa */
-	intel_pstate_set_pstate(cpu, cpu->pstate.current_pstate - ctl, true);
+	target = cpu->pstate.current_pstate - ctl;
+
+	/* Within the utilization clamps of the tasks on the cpu */
+	sched_cpu_uclamp_pct(cpu->cpu, &min_pct, &max_pct);
+	target = clamp_t(int, target,
+			 DIV_ROUND_UP(cpu->pstate.turbo_pstate * min_pct, 100),
+			 cpu->pstate.turbo_pstate * max_pct / 100);
+
+	intel_pstate_set_pstate(cpu, target, true);
 
 	sample = &cpu->sample;
 	trace_pstate_sample(fp_toint(sample->core_pct_busy),
@@ -29,6 +29,12 @@
  * - Pool collects resently freed pages for reuse
  * - Use page->lru to keep a free list
  * - doesn't track currently in use pages
+ * - There is a set of pools for each node, pages go back to the pools of
+ *   the node they are on
+ * - Huge pools keep naturally aligned runs of TTM_HUGE_NR contiguous pages,
+ *   linked through the lru of their first page. The run is allocated as a
+ *   single high order page which is split right away, so callers only ever
+ *   see order 0 pages.
  */
 
 #define pr_fmt(fmt) "[TTM] " fmt
@@ -58,6 +64,13 @@
 /* times are in msecs */
 #define PAGE_FREE_INTERVAL		1000
 
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) && !defined(CONFIG_HIGHMEM)
+#define TTM_HUGE_ORDER			HPAGE_PMD_ORDER
+#else
+#define TTM_HUGE_ORDER			0
+#endif
+#define TTM_HUGE_NR			(1U << TTM_HUGE_ORDER)
+
 /**
  * struct ttm_page_pool - Pool to reuse recently allocated uc/wc pages.
  *
@@ -68,6 +81,8 @@
  * @list: Pool of free uc/wc pages for fast reuse.
  * @gfp_flags: Flags to pass for alloc_page.
  * @npages: Number of pages in pool.
+ * @nid: Node the pages of the pool are on.
+ * @order: Each entry of @list is a run of 1 << @order pages.
  */
 struct ttm_page_pool {
 	spinlock_t		lock;
@@ -75,6 +90,8 @@ struct ttm_page_pool {
 	struct list_head	list;
 	gfp_t			gfp_flags;
 	unsigned		npages;
+	int			nid;
+	unsigned		order;
 	char			*name;
 	unsigned long		nfrees;
 	unsigned long		nrefills;
@@ -92,7 +109,7 @@ struct ttm_pool_opts {
 	unsigned	small;
 };
 
-#define NUM_POOLS 4
+#define NUM_POOLS 6
 
 /**
  * struct ttm_pool_manager - Holds memory pools for fst allocation
@@ -105,22 +122,15 @@ struct ttm_pool_opts {
  * some pages to free.
  * @small_allocation: Limit in number of pages what is small allocation.
  *
- * @pools: All pool objects in use.
+ * @pools: All pool objects in use, NUM_POOLS for each node. Per node these
+ * are wc, uc, wc dma32, uc dma32, wc huge and uc huge, see ttm_get_pool().
  **/
 struct ttm_pool_manager {
 	struct kobject		kobj;
 	struct shrinker		mm_shrink;
 	struct ttm_pool_opts	options;
 
-	union {
-		struct ttm_page_pool	pools[NUM_POOLS];
-		struct {
-			struct ttm_page_pool	wc_pool;
-			struct ttm_page_pool	uc_pool;
-			struct ttm_page_pool	wc_pool_dma32;
-			struct ttm_page_pool	uc_pool_dma32;
-		} ;
-	};
+	struct ttm_page_pool	*pools;
 };
 
 static struct attribute ttm_page_pool_max = {
@@ -147,6 +157,7 @@ static void ttm_pool_kobj_release(struct kobject *kobj)
 {
 	struct ttm_pool_manager *m =
 		container_of(kobj, struct ttm_pool_manager, kobj);
+	kfree(m->pools);
 	kfree(m);
 }
 
@@ -217,6 +228,17 @@ static struct kobj_type ttm_pool_kobj_type = {
 static struct ttm_pool_manager *_manager;
 
 #ifndef CONFIG_X86
+static int set_pages_wb(struct page *page, int numpages)
+{
+#ifdef TTM_HAS_AGP
+	int i;
+
+	for (i = 0; i < numpages; i++)
+		unmap_page_from_agp(page++);
+#endif
+	return 0;
+}
+
 static int set_pages_array_wb(struct page **pages, int addrinarray)
 {
 #ifdef TTM_HAS_AGP
@@ -252,8 +274,9 @@ static int set_pages_array_uc(struct page **pages, int addrinarray)
 #endif
 
 /**
- * Select the right pool or requested caching state and ttm flags. */
-static struct ttm_page_pool *ttm_get_pool(int flags,
+ * Select the right pool of node nid for requested caching state and ttm
+ * flags. */
+static struct ttm_page_pool *ttm_get_pool(int nid, int flags,
 		enum ttm_caching_state cstate)
 {
 	int pool_index;
@@ -269,24 +292,54 @@ static struct ttm_page_pool *ttm_get_pool(int flags,
 	if (flags & TTM_PAGE_FLAG_DMA32)
 		pool_index |= 0x2;
 
-	return &_manager->pools[pool_index];
+	return &_manager->pools[nid * NUM_POOLS + pool_index];
 }
 
-/* set memory back to wb and free the pages. */
-static void ttm_pages_put(struct page *pages[], unsigned npages)
+/* Huge pools only hold pages that need to have their caching changed. */
+static struct ttm_page_pool *ttm_get_huge_pool(int nid, int flags,
+		enum ttm_caching_state cstate)
 {
-	unsigned i;
-	if (set_pages_array_wb(pages, npages))
-		pr_err("Failed to set %d pages to wb!\n", npages);
-	for (i = 0; i < npages; ++i)
-		__free_page(pages[i]);
+	int pool_index;
+
+	if (!TTM_HUGE_ORDER || cstate == tt_cached ||
+	    (flags & TTM_PAGE_FLAG_DMA32))
+		return NULL;
+
+	if (cstate == tt_wc)
+		pool_index = 0x4;
+	else
+		pool_index = 0x5;
+
+	return &_manager->pools[nid * NUM_POOLS + pool_index];
+}
+
+/* set memory back to wb and free the pages, which are runs of 1 << order. */
+static void ttm_pages_put(struct page *pages[], unsigned npages,
+		unsigned order)
+{
+	unsigned i, j;
+
+	if (!order) {
+		if (set_pages_array_wb(pages, npages))
+			pr_err("Failed to set %d pages to wb!\n", npages);
+		for (i = 0; i < npages; ++i)
+			__free_page(pages[i]);
+		return;
+	}
+
+	for (i = 0; i < npages; ++i) {
+		if (set_pages_wb(pages[i], 1 << order))
+			pr_err("Failed to set %d pages to wb!\n", 1 << order);
+		for (j = 0; j < (1 << order); ++j)
+			__free_page(pages[i] + j);
+	}
 }
 
 static void ttm_pool_update_free_locked(struct ttm_page_pool *pool,
 		unsigned freed_pages)
 {
-	pool->npages -= freed_pages;
-	pool->nfrees += freed_pages;
+	pool->npages -= freed_pages << pool->order;
+	pool->nfrees += freed_pages << pool->order;
 }
 
 /**
@@ -296,8 +349,11 @@ static void ttm_pool_update_free_locked(struct ttm_page_pool *pool,
  * number of pages in one go.
  *
  * @pool: to free the pages from
- * @free_all: If set to true will free all pages in pool
+ * @nr_free: number of pages to free, or FREE_ALL_PAGES
  * @use_static: Safe to use static buffer
+ *
+ * Pages are freed a whole pool entry at a time, so more than nr_free pages
+ * may go. Returns the number of pages that are still to be freed.
  **/
 static int ttm_page_pool_free(struct ttm_page_pool *pool, unsigned nr_free,
 			      bool use_static)
@@ -307,7 +363,12 @@ static int ttm_page_pool_free(struct ttm_page_pool *pool, unsigned nr_free,
 	struct page *p;
 	struct page **pages_to_free;
 	unsigned freed_pages = 0,
-		 npages_to_free = nr_free;
+		 npages_to_free;
+
+	/* count in pool entries from here on */
+	if (nr_free != FREE_ALL_PAGES)
+		nr_free = DIV_ROUND_UP(nr_free, 1 << pool->order);
+	npages_to_free = nr_free;
 
 	if (NUM_PAGES_TO_ALLOC < nr_free)
 		npages_to_free = NUM_PAGES_TO_ALLOC;
@@ -342,7 +403,7 @@ restart:
 			 */
 			spin_unlock_irqrestore(&pool->lock, irq_flags);
 
-			ttm_pages_put(pages_to_free, freed_pages);
+			ttm_pages_put(pages_to_free, freed_pages, pool->order);
 			if (likely(nr_free != FREE_ALL_PAGES))
 				nr_free -= freed_pages;
 
@@ -377,11 +438,13 @@ restart:
 	spin_unlock_irqrestore(&pool->lock, irq_flags);
 
 	if (freed_pages)
-		ttm_pages_put(pages_to_free, freed_pages);
+		ttm_pages_put(pages_to_free, freed_pages, pool->order);
 out:
 	if (pages_to_free != static_buf)
 		kfree(pages_to_free);
-	return nr_free;
+	if (nr_free == FREE_ALL_PAGES)
+		return nr_free;
+	return nr_free << pool->order;
 }
 
 /**
@@ -390,6 +453,9 @@ out:
  * XXX: (dchinner) Deadlock warning!
  *
  * This code is crying out for a shrinker per pool....
+ *
+ * The shrinker is NUMA aware and only shrinks the pools of the node under
+ * pressure.
  */
 static unsigned long
 ttm_pool_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
@@ -410,7 +476,8 @@ ttm_pool_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
 		unsigned nr_free = shrink_pages;
 		if (shrink_pages == 0)
 			break;
-		pool = &_manager->pools[(i + pool_offset)%NUM_POOLS];
+		pool = &_manager->pools[sc->nid * NUM_POOLS +
+					(i + pool_offset) % NUM_POOLS];
 		/* OK to use static buffer since global mutex is held. */
 		shrink_pages = ttm_page_pool_free(pool, nr_free, true);
 		freed += nr_free - shrink_pages;
@@ -427,7 +494,7 @@ ttm_pool_shrink_count(struct shrinker *shrink, struct shrink_control *sc)
 	unsigned long count = 0;
 
 	for (i = 0; i < NUM_POOLS; ++i)
-		count += _manager->pools[i].npages;
+		count += _manager->pools[sc->nid * NUM_POOLS + i].npages;
 
 	return count;
 }
@@ -437,6 +504,7 @@ static void ttm_pool_mm_shrink_init(struct ttm_pool_manager *manager)
 	manager->mm_shrink.count_objects = ttm_pool_shrink_count;
 	manager->mm_shrink.scan_objects = ttm_pool_shrink_scan;
 	manager->mm_shrink.seeks = 1;
+	manager->mm_shrink.flags = SHRINKER_NUMA_AWARE;
 	register_shrinker(&manager->mm_shrink);
 }
 
@@ -485,13 +553,14 @@ static void ttm_handle_caching_state_failure(struct list_head *pages,
 }
 
 /**
- * Allocate new pages with correct caching.
+ * Allocate new pages with correct caching, preferably on node nid.
  *
  * This function is reentrant if caller updates count depending on number of
  * pages returned in pages array.
  */
-static int ttm_alloc_new_pages(struct list_head *pages, gfp_t gfp_flags,
-		int ttm_flags, enum ttm_caching_state cstate, unsigned count)
+static int ttm_alloc_new_pages(struct list_head *pages, int nid,
+		gfp_t gfp_flags, int ttm_flags, enum ttm_caching_state cstate,
+		unsigned count)
 {
 	struct page **caching_array;
 	struct page *p;
@@ -509,7 +578,7 @@ static int ttm_alloc_new_pages(struct list_head *pages, gfp_t gfp_flags,
 	}
 
 	for (i = 0, cpages = 0; i < count; ++i) {
-		p = alloc_page(gfp_flags);
+		p = alloc_pages_node(nid, gfp_flags, 0);
 
 		if (!p) {
 			pr_err("Unable to get page %u\n", i);
@@ -601,8 +670,8 @@ static void ttm_page_pool_fill_locked(struct ttm_page_pool *pool,
 		spin_unlock_irqrestore(&pool->lock, *irq_flags);
 
 		INIT_LIST_HEAD(&new_pages);
-		r = ttm_alloc_new_pages(&new_pages, pool->gfp_flags, ttm_flags,
-				cstate,	alloc_size);
+		r = ttm_alloc_new_pages(&new_pages, pool->nid, pool->gfp_flags,
+				ttm_flags, cstate, alloc_size);
 		spin_lock_irqsave(&pool->lock, *irq_flags);
 
 		if (!r) {
@@ -672,15 +741,126 @@ out:
 	return count;
 }
 
+/*
+ * Allocate a new run of TTM_HUGE_NR pages on node nid and put it at pages,
+ * with the right caching. The run is split into order 0 pages.
+ */
+static int ttm_alloc_new_huge(struct page **pages, int nid, gfp_t gfp_flags,
+		enum ttm_caching_state cstate)
+{
+	struct page *p;
+	unsigned i;
+
+	/*
+	 * Don't try hard, and don't fall back to other nodes: local small
+	 * pages are better than remote huge ones.
+	 */
+	gfp_flags |= __GFP_THISNODE | __GFP_NORETRY | __GFP_NOWARN;
+	p = alloc_pages_node(nid, gfp_flags, TTM_HUGE_ORDER);
+	if (!p)
+		return -ENOMEM;
+
+	split_page(p, TTM_HUGE_ORDER);
+	for (i = 0; i < TTM_HUGE_NR; ++i)
+		pages[i] = p + i;
+
+	if (ttm_set_pages_caching(pages, cstate, TTM_HUGE_NR)) {
+		for (i = 0; i < TTM_HUGE_NR; ++i) {
+			__free_page(pages[i]);
+			pages[i] = NULL;
+		}
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Fill pages with as many runs of TTM_HUGE_NR pages as fit into npages,
+ * first from the huge pool, then from fresh allocations.
+ *
+ * @return count of pages put at pages.
+ */
+static unsigned ttm_get_huge_pages(struct ttm_page_pool *pool,
+				   struct page **pages, unsigned npages,
+				   int flags, enum ttm_caching_state cstate)
+{
+	unsigned long irq_flags;
+	unsigned count = 0, i;
+	struct page *p;
+
+	spin_lock_irqsave(&pool->lock, irq_flags);
+	while (npages - count >= TTM_HUGE_NR && !list_empty(&pool->list)) {
+		p = list_first_entry(&pool->list, struct page, lru);
+		list_del(&p->lru);
+		pool->npages -= TTM_HUGE_NR;
+		for (i = 0; i < TTM_HUGE_NR; ++i)
+			pages[count++] = p + i;
+	}
+	spin_unlock_irqrestore(&pool->lock, irq_flags);
+
+	/* clear the pages coming from the pool if requested */
+	if (flags & TTM_PAGE_FLAG_ZERO_ALLOC) {
+		for (i = 0; i < count; ++i)
+			clear_highpage(pages[i]);
+	}
+
+	while (npages - count >= TTM_HUGE_NR) {
+		gfp_t gfp_flags = pool->gfp_flags;
+
+		if (flags & TTM_PAGE_FLAG_ZERO_ALLOC)
+			gfp_flags |= __GFP_ZERO;
+		if (ttm_alloc_new_huge(&pages[count], pool->nid, gfp_flags,
+				       cstate))
+			break;
+		count += TTM_HUGE_NR;
+	}
+
+	return count;
+}
+
+/* Do pages start a naturally aligned run of TTM_HUGE_NR contiguous pages? */
+static bool ttm_pages_huge_run(struct page **pages, unsigned npages)
+{
+	unsigned i;
+
+	if (npages < TTM_HUGE_NR ||
+	    !IS_ALIGNED(page_to_pfn(pages[0]), TTM_HUGE_NR))
+		return false;
+
+	for (i = 1; i < TTM_HUGE_NR; ++i)
+		if (pages[i] != pages[0] + i)
+			return false;
+	return true;
+}
+
+/* Drop the lock of pool, freeing whatever exceeds the pool limit. */
+static void ttm_pool_put_unlock(struct ttm_page_pool *pool,
+				unsigned long irq_flags)
+{
+	unsigned npages = 0;
+
+	/* Check that we don't go over the pool limit */
+	if (pool->npages > _manager->options.max_size) {
+		npages = pool->npages - _manager->options.max_size;
+		/* free at least NUM_PAGES_TO_ALLOC number of pages
+		 * to reduce calls to set_memory_wb */
+		if (npages < NUM_PAGES_TO_ALLOC)
+			npages = NUM_PAGES_TO_ALLOC;
+	}
+	spin_unlock_irqrestore(&pool->lock, irq_flags);
+	if (npages)
+		ttm_page_pool_free(pool, npages, false);
+}
+
 /* Put all pages in pages list to correct pool to wait for reuse */
 static void ttm_put_pages(struct page **pages, unsigned npages, int flags,
 			  enum ttm_caching_state cstate)
 {
 	unsigned long irq_flags;
-	struct ttm_page_pool *pool = ttm_get_pool(flags, cstate);
-	unsigned i;
+	struct ttm_page_pool *pool = NULL, *p;
+	unsigned i = 0, j, nr;
 
-	if (pool == NULL) {
+	if (cstate == tt_cached) {
 		/* No pool for this memory type so free the pages */
 		for (i = 0; i < npages; i++) {
 			if (pages[i]) {
@@ -693,38 +873,55 @@ static void ttm_put_pages(struct page **pages, unsigned npages, int flags,
 		return;
 	}
 
-	spin_lock_irqsave(&pool->lock, irq_flags);
-	for (i = 0; i < npages; i++) {
-		if (pages[i]) {
-			if (page_count(pages[i]) != 1)
+	while (i < npages) {
+		struct page *page = pages[i];
+		int nid;
+
+		if (!page) {
+			i++;
+			continue;
+		}
+
+		nid = page_to_nid(page);
+		p = ttm_get_huge_pool(nid, flags, cstate);
+		if (p && ttm_pages_huge_run(&pages[i], npages - i)) {
+			nr = TTM_HUGE_NR;
+		} else {
+			p = ttm_get_pool(nid, flags, cstate);
+			nr = 1;
+		}
+
+		if (p != pool) {
+			if (pool)
+				ttm_pool_put_unlock(pool, irq_flags);
+			pool = p;
+			spin_lock_irqsave(&pool->lock, irq_flags);
+		}
+
+		for (j = 0; j < nr; j++) {
+			if (page_count(pages[i + j]) != 1)
 				pr_err("Erroneous page count. Leaking pages.\n");
-			list_add_tail(&pages[i]->lru, &pool->list);
-			pages[i] = NULL;
-			pool->npages++;
+			pages[i + j] = NULL;
 		}
+		list_add_tail(&page->lru, &pool->list);
+		pool->npages += nr;
+		i += nr;
 	}
-	/* Check that we don't go over the pool limit */
-	npages = 0;
-	if (pool->npages > _manager->options.max_size) {
-		npages = pool->npages - _manager->options.max_size;
-		/* free at least NUM_PAGES_TO_ALLOC number of pages
-		 * to reduce calls to set_memory_wb */
-		if (npages < NUM_PAGES_TO_ALLOC)
-			npages = NUM_PAGES_TO_ALLOC;
-	}
-	spin_unlock_irqrestore(&pool->lock, irq_flags);
-	if (npages)
-		ttm_page_pool_free(pool, npages, false);
+
+	if (pool)
+		ttm_pool_put_unlock(pool, irq_flags);
 }
 
 /*
  * On success pages list will hold count number of correctly
- * cached pages.
+ * cached pages. Pages come from the node of the calling cpu if possible.
  */
 static int ttm_get_pages(struct page **pages, unsigned npages, int flags,
 			 enum ttm_caching_state cstate)
 {
-	struct ttm_page_pool *pool = ttm_get_pool(flags, cstate);
+	int nid = numa_mem_id();
+	struct ttm_page_pool *pool = ttm_get_pool(nid, flags, cstate);
+	struct ttm_page_pool *huge = ttm_get_huge_pool(nid, flags, cstate);
 	struct list_head plist;
 	struct page *p = NULL;
 	gfp_t gfp_flags = GFP_USER;
@@ -758,10 +955,16 @@ static int ttm_get_pages(struct page **pages, unsigned npages, int flags,
 	/* combine zero flag to pool flags */
 	gfp_flags |= pool->gfp_flags;
 
-	/* First we take pages from the pool */
+	/* Large requests are served by huge pages first */
+	count = 0;
+	if (huge && npages >= TTM_HUGE_NR) {
+		count = ttm_get_huge_pages(huge, pages, npages, flags, cstate);
+		npages -= count;
+	}
+
+	/* Then we take pages from the pool */
 	INIT_LIST_HEAD(&plist);
 	npages = ttm_page_pool_get_pages(pool, &plist, flags, cstate, npages);
-	count = 0;
 	list_for_each_entry(p, &plist, lru) {
 		pages[count++] = p;
 	}
@@ -782,7 +985,8 @@ static int ttm_get_pages(struct page **pages, unsigned npages, int flags,
 		 * multiple requests in parallel.
 		 **/
 		INIT_LIST_HEAD(&plist);
-		r = ttm_alloc_new_pages(&plist, gfp_flags, flags, cstate, npages);
+		r = ttm_alloc_new_pages(&plist, nid, gfp_flags, flags, cstate,
+					npages);
 		list_for_each_entry(p, &plist, lru) {
 			pages[count++] = p;
 		}
@@ -799,7 +1003,7 @@ static int ttm_get_pages(struct page **pages, unsigned npages, int flags,
 }
 
 static void ttm_page_pool_init_locked(struct ttm_page_pool *pool, gfp_t flags,
-		char *name)
+		char *name, int nid, unsigned order)
 {
 	spin_lock_init(&pool->lock);
 	pool->fill_lock = false;
@@ -807,27 +1011,48 @@ static void ttm_page_pool_init_locked(struct ttm_page_pool *pool, gfp_t flags,
 	pool->npages = pool->nfrees = 0;
 	pool->gfp_flags = flags;
 	pool->name = name;
+	pool->nid = nid;
+	pool->order = order;
 }
 
 int ttm_page_alloc_init(struct ttm_mem_global *glob, unsigned max_pages)
 {
-	int ret;
+	struct ttm_page_pool *pools;
+	int ret, nid;
 
 	WARN_ON(_manager);
 
 	pr_info("Initializing pool allocator\n");
 
 	_manager = kzalloc(sizeof(*_manager), GFP_KERNEL);
+	pools = kcalloc(nr_node_ids * NUM_POOLS, sizeof(*pools), GFP_KERNEL);
+	if (!_manager || !pools) {
+		kfree(pools);
+		kfree(_manager);
+		_manager = NULL;
+		return -ENOMEM;
+	}
+	_manager->pools = pools;
 
-	ttm_page_pool_init_locked(&_manager->wc_pool, GFP_HIGHUSER, "wc");
+	for (nid = 0; nid < nr_node_ids; nid++, pools += NUM_POOLS) {
+		ttm_page_pool_init_locked(&pools[0], GFP_HIGHUSER, "wc",
+					  nid, 0);
 
-	ttm_page_pool_init_locked(&_manager->uc_pool, GFP_HIGHUSER, "uc");
+		ttm_page_pool_init_locked(&pools[1], GFP_HIGHUSER, "uc",
+					  nid, 0);
 
-	ttm_page_pool_init_locked(&_manager->wc_pool_dma32,
-				  GFP_USER | GFP_DMA32, "wc dma");
+		ttm_page_pool_init_locked(&pools[2], GFP_USER | GFP_DMA32,
+					  "wc dma", nid, 0);
 
-	ttm_page_pool_init_locked(&_manager->uc_pool_dma32,
-				  GFP_USER | GFP_DMA32, "uc dma");
+		ttm_page_pool_init_locked(&pools[3], GFP_USER | GFP_DMA32,
+					  "uc dma", nid, 0);
+
+		ttm_page_pool_init_locked(&pools[4], GFP_HIGHUSER, "wc huge",
+					  nid, TTM_HUGE_ORDER);
+
+		ttm_page_pool_init_locked(&pools[5], GFP_HIGHUSER, "uc huge",
+					  nid, TTM_HUGE_ORDER);
+	}
 
 	_manager->options.max_size = max_pages;
 	_manager->options.small = SMALL_ALLOCATION;
@@ -854,13 +1079,32 @@ void ttm_page_alloc_fini(void)
 	ttm_pool_mm_shrink_fini(_manager);
 
 	/* OK to use static buffer since global mutex is no longer used. */
-	for (i = 0; i < NUM_POOLS; ++i)
+	for (i = 0; i < nr_node_ids * NUM_POOLS; ++i)
 		ttm_page_pool_free(&_manager->pools[i], FREE_ALL_PAGES, true);
 
 	kobject_put(&_manager->kobj);
 	_manager = NULL;
 }
 
+/*
+ * Give back all pages of ttm, of which only the first mem_count_update
+ * ones have been accounted for.
+ */
+static void ttm_pool_unpopulate_helper(struct ttm_tt *ttm,
+				       unsigned mem_count_update)
+{
+	unsigned i;
+
+	for (i = 0; i < mem_count_update; ++i) {
+		if (ttm->pages[i])
+			ttm_mem_global_free_page(ttm->glob->mem_glob,
+						 ttm->pages[i]);
+	}
+	ttm_put_pages(ttm->pages, ttm->num_pages, ttm->page_flags,
+		      ttm->caching_state);
+	ttm->state = tt_unpopulated;
+}
+
 int ttm_pool_populate(struct ttm_tt *ttm)
 {
 	struct ttm_mem_global *mem_glob = ttm->glob->mem_glob;
@@ -870,19 +1114,19 @@ int ttm_pool_populate(struct ttm_tt *ttm)
 	if (ttm->state != tt_unpopulated)
 		return 0;
 
-	for (i = 0; i < ttm->num_pages; ++i) {
-		ret = ttm_get_pages(&ttm->pages[i], 1,
-				    ttm->page_flags,
-				    ttm->caching_state);
-		if (ret != 0) {
-			ttm_pool_unpopulate(ttm);
-			return -ENOMEM;
-		}
+	/* all at once, so that huge pages can be used */
+	ret = ttm_get_pages(ttm->pages, ttm->num_pages, ttm->page_flags,
+			    ttm->caching_state);
+	if (unlikely(ret != 0)) {
+		ttm_pool_unpopulate_helper(ttm, 0);
+		return -ENOMEM;
+	}
 
+	for (i = 0; i < ttm->num_pages; ++i) {
 		ret = ttm_mem_global_alloc_page(mem_glob, ttm->pages[i],
 						false, false);
 		if (unlikely(ret != 0)) {
-			ttm_pool_unpopulate(ttm);
+			ttm_pool_unpopulate_helper(ttm, i);
 			return -ENOMEM;
 		}
 	}
@@ -902,18 +1146,7 @@ EXPORT_SYMBOL(ttm_pool_populate);
 
 void ttm_pool_unpopulate(struct ttm_tt *ttm)
 {
-	unsigned i;
-
-	for (i = 0; i < ttm->num_pages; ++i) {
-		if (ttm->pages[i]) {
-			ttm_mem_global_free_page(ttm->glob->mem_glob,
-						 ttm->pages[i]);
-			ttm_put_pages(&ttm->pages[i], 1,
-				      ttm->page_flags,
-				      ttm->caching_state);
-		}
-	}
-	ttm->state = tt_unpopulated;
+	ttm_pool_unpopulate_helper(ttm, ttm->num_pages);
 }
 EXPORT_SYMBOL(ttm_pool_unpopulate);
 
@@ -921,18 +1154,22 @@ int ttm_page_alloc_debugfs(struct seq_file *m, void *data)
 {
 	struct ttm_page_pool *p;
 	unsigned i;
-	char *h[] = {"pool", "refills", "pages freed", "size"};
+	char *h[] = {"pool", "node", "refills", "pages freed", "size"};
 	if (!_manager) {
 		seq_printf(m, "No pool allocator running.\n");
 		return 0;
 	}
-	seq_printf(m, "%6s %12s %13s %8s\n",
-			h[0], h[1], h[2], h[3]);
-	for (i = 0; i < NUM_POOLS; ++i) {
+	seq_printf(m, "%7s %4s %12s %13s %8s\n",
+			h[0], h[1], h[2], h[3], h[4]);
+	for (i = 0; i < nr_node_ids * NUM_POOLS; ++i) {
 		p = &_manager->pools[i];
 
-		seq_printf(m, "%6s %12ld %13ld %8d\n",
-				p->name, p->nrefills,
+		/* nothing to show for huge pools without huge pages */
+		if (!TTM_HUGE_ORDER && i % NUM_POOLS >= 4)
+			continue;
+
+		seq_printf(m, "%7s %4d %12ld %13ld %8d\n",
+				p->name, p->nid, p->nrefills,
 				p->nfrees, p->npages);
 	}
 	return 0;
@@ -26,9 +26,80 @@ static int rrpc_submit_io(struct rrpc *rrpc, struct bio *bio,
 		for ((i) = 0, rlun = &(rrpc)->luns[0]; \
 			(i) < (rrpc)->nr_luns; (i)++, rlun = &(rrpc)->luns[(i)])
 
+static void rrpc_prio_swap(struct rrpc_lun *rlun, unsigned int a,
+							unsigned int b)
+{
+	struct rrpc_block *tmp = rlun->prio_heap[a];
+
+	rlun->prio_heap[a] = rlun->prio_heap[b];
+	rlun->prio_heap[b] = tmp;
+	rlun->prio_heap[a]->prio_idx = a;
+	rlun->prio_heap[b]->prio_idx = b;
+}
+
+/* requires rlun->lock, as do all changes to the heap and its keys */
+static void rrpc_prio_up(struct rrpc_lun *rlun, unsigned int i)
+{
+	while (i) {
+		unsigned int parent = (i - 1) / 2;
+
+		if (rlun->prio_heap[parent]->nr_invalid_pages >=
+					rlun->prio_heap[i]->nr_invalid_pages)
+			break;
+		rrpc_prio_swap(rlun, parent, i);
+		i = parent;
+	}
+}
+
+static void rrpc_prio_down(struct rrpc_lun *rlun, unsigned int i)
+{
+	for (;;) {
+		unsigned int max = i, child = 2 * i + 1;
+
+		if (child < rlun->nr_prio &&
+			rlun->prio_heap[child]->nr_invalid_pages >
+				rlun->prio_heap[max]->nr_invalid_pages)
+			max = child;
+		child++;
+		if (child < rlun->nr_prio &&
+			rlun->prio_heap[child]->nr_invalid_pages >
+				rlun->prio_heap[max]->nr_invalid_pages)
+			max = child;
+		if (max == i)
+			break;
+		rrpc_prio_swap(rlun, i, max);
+		i = max;
+	}
+}
+
+static void rrpc_prio_add(struct rrpc_lun *rlun, struct rrpc_block *rblk)
+{
+	BUG_ON(rblk->prio_idx >= 0);
+
+	rblk->prio_idx = rlun->nr_prio;
+	rlun->prio_heap[rlun->nr_prio++] = rblk;
+	rrpc_prio_up(rlun, rblk->prio_idx);
+}
+
+/* take the block with the fewest valid pages out of the heap */
+static struct rrpc_block *rrpc_prio_pop_max(struct rrpc_lun *rlun)
+{
+	struct rrpc_block *rblk = rlun->prio_heap[0];
+
+	rlun->nr_prio--;
+	if (rlun->nr_prio) {
+		rrpc_prio_swap(rlun, 0, rlun->nr_prio);
+		rrpc_prio_down(rlun, 0);
+	}
+	rblk->prio_idx = -1;
+
+	return rblk;
+}
+
 static void rrpc_page_invalidate(struct rrpc *rrpc, struct rrpc_addr *a)
 {
 	struct rrpc_block *rblk = a->rblk;
+	struct rrpc_lun *rlun;
 	unsigned int pg_offset;
 
 	lockdep_assert_held(&rrpc->rev_lock);
@@ -36,6 +107,8 @@ static void rrpc_page_invalidate(struct rrpc *rrpc, struct rrpc_addr *a)
 	if (a->addr == ADDR_EMPTY || !rblk)
 		return;
 
+	rlun = rblk->rlun;
+	spin_lock(&rlun->lock);
 	spin_lock(&rblk->lock);
 
 	div_u64_rem(a->addr, rrpc->dev->pgs_per_blk, &pg_offset);
@@ -44,6 +117,11 @@ static void rrpc_page_invalidate(struct rrpc *rrpc, struct rrpc_addr *a)
 
 	spin_unlock(&rblk->lock);
 
+	/* one valid page less, the block is a better victim now */
+	if (rblk->prio_idx >= 0)
+		rrpc_prio_up(rlun, rblk->prio_idx);
+	spin_unlock(&rlun->lock);
+
 	rrpc->rev_trans_map[a->addr - rrpc->poffset].addr = ADDR_EMPTY;
 }
 
@@ -366,60 +444,30 @@ finished:
 	return 0;
 }
 
-static void rrpc_block_gc(struct work_struct *work)
+static void rrpc_block_gc(struct rrpc *rrpc, struct rrpc_block *rblk)
 {
-	struct rrpc_block_gc *gcb = container_of(work, struct rrpc_block_gc,
-									ws_gc);
-	struct rrpc *rrpc = gcb->rrpc;
-	struct rrpc_block *rblk = gcb->rblk;
 	struct nvm_dev *dev = rrpc->dev;
 
 	pr_debug("nvm: block '%lu' being reclaimed\n", rblk->parent->id);
 
 	if (rrpc_move_valid_pages(rrpc, rblk))
-		goto done;
+		return;
 
 	nvm_erase_blk(dev, rblk->parent);
 	rrpc_put_blk(rrpc, rblk);
-done:
-	mempool_free(gcb, rrpc->gcb_pool);
-}
-
-/* the block with highest number of invalid pages, will be in the beginning
- * of the list
- */
-static struct rrpc_block *rblock_max_invalid(struct rrpc_block *ra,
-							struct rrpc_block *rb)
-{
-	if (ra->nr_invalid_pages == rb->nr_invalid_pages)
-		return ra;
-
-	return (ra->nr_invalid_pages < rb->nr_invalid_pages) ? rb : ra;
 }
 
-/* linearly find the block with highest number of invalid pages
- * requires lun->lock
+/*
+ * Each lun reclaims its own blocks, one at a time, and the luns do so in
+ * parallel on krqd_wq.  The free block count is only an estimate, so it
+ * is read without the media manager's lock.
  */
-static struct rrpc_block *block_prio_find_max(struct rrpc_lun *rlun)
-{
-	struct list_head *prio_list = &rlun->prio_list;
-	struct rrpc_block *rblock, *max;
-
-	BUG_ON(list_empty(prio_list));
-
-	max = list_first_entry(prio_list, struct rrpc_block, prio);
-	list_for_each_entry(rblock, prio_list, prio)
-		max = rblock_max_invalid(max, rblock);
-
-	return max;
-}
-
 static void rrpc_lun_gc(struct work_struct *work)
 {
 	struct rrpc_lun *rlun = container_of(work, struct rrpc_lun, ws_gc);
 	struct rrpc *rrpc = rlun->rrpc;
 	struct nvm_lun *lun = rlun->parent;
-	struct rrpc_block_gc *gcb;
+	struct rrpc_block *rblock;
 	unsigned int nr_blocks_need;
 
 	nr_blocks_need = rrpc->dev->blks_per_lun / GC_LIMIT_INVERSE;
@@ -427,34 +475,24 @@ static void rrpc_lun_gc(struct work_struct *work)
 	if (nr_blocks_need < rrpc->nr_luns)
 		nr_blocks_need = rrpc->nr_luns;
 
-	spin_lock(&lun->lock);
-	while (nr_blocks_need > lun->nr_free_blocks &&
-					!list_empty(&rlun->prio_list)) {
-		struct rrpc_block *rblock = block_prio_find_max(rlun);
-		struct nvm_block *block = rblock->parent;
-
-		if (!rblock->nr_invalid_pages)
+	for (;;) {
+		spin_lock(&rlun->lock);
+		if (nr_blocks_need <= READ_ONCE(lun->nr_free_blocks) ||
+				!rlun->nr_prio ||
+				!rlun->prio_heap[0]->nr_invalid_pages) {
+			spin_unlock(&rlun->lock);
 			break;
-
-		list_del_init(&rblock->prio);
+		}
+		rblock = rrpc_prio_pop_max(rlun);
+		spin_unlock(&rlun->lock);
 
 		BUG_ON(!block_is_full(rrpc, rblock));
 
-		pr_debug("rrpc: selected block '%lu' for GC\n", block->id);
-
-		gcb = mempool_alloc(rrpc->gcb_pool, GFP_ATOMIC);
-		if (!gcb)
-			break;
-
-		gcb->rrpc = rrpc;
-		gcb->rblk = rblock;
-		INIT_WORK(&gcb->ws_gc, rrpc_block_gc);
+		pr_debug("rrpc: selected block '%lu' for GC\n",
+							rblock->parent->id);
 
-		queue_work(rrpc->kgc_wq, &gcb->ws_gc);
-
-		nr_blocks_need--;
+		rrpc_block_gc(rrpc, rblock);
 	}
-	spin_unlock(&lun->lock);
 
 	/* TODO: Hint that request queue can be started again */
 }
@@ -465,11 +503,10 @@ static void rrpc_gc_queue(struct work_struct *work)
 									ws_gc);
 	struct rrpc *rrpc = gcb->rrpc;
 	struct rrpc_block *rblk = gcb->rblk;
-	struct nvm_lun *lun = rblk->parent->lun;
-	struct rrpc_lun *rlun = &rrpc->luns[lun->id - rrpc->lun_offset];
+	struct rrpc_lun *rlun = rblk->rlun;
 
 	spin_lock(&rlun->lock);
-	list_add_tail(&rblk->prio, &rlun->prio_list);
+	rrpc_prio_add(rlun, rblk);
 	spin_unlock(&rlun->lock);
 
 	mempool_free(gcb, rrpc->gcb_pool);
@@ -553,16 +590,13 @@ out:
  * Returns rrpc_addr with the physical address and block. Remember to return to
  * rrpc->addr_cache when request is finished.
  */
-static struct rrpc_addr *rrpc_map_page(struct rrpc *rrpc, sector_t laddr,
-								int is_gc)
+static struct rrpc_addr *rrpc_map_page(struct rrpc *rrpc, struct rrpc_lun *rlun,
+						sector_t laddr, int is_gc)
 {
-	struct rrpc_lun *rlun;
+	struct nvm_lun *lun = rlun->parent;
 	struct rrpc_block *rblk;
-	struct nvm_lun *lun;
 	u64 paddr;
 
-	rlun = rrpc_get_lun_rr(rrpc, is_gc);
-	lun = rlun->parent;
 
 	if (!is_gc && lun->nr_free_blocks < rrpc->nr_luns * 4)
 		return NULL;
@@ -734,6 +768,7 @@ static int rrpc_write_ppalist_rq(struct rrpc *rrpc, struct bio *bio,
 			struct nvm_rq *rqd, unsigned long flags, int npages)
 {
 	struct rrpc_inflight_rq *r = rrpc_get_inflight_rq(rqd);
+	struct rrpc_lun *rlun = NULL;
 	struct rrpc_addr *p;
 	sector_t laddr = rrpc_get_laddr(bio);
 	int is_gc = flags & NVM_IOTYPE_GC;
@@ -745,8 +780,16 @@ static int rrpc_write_ppalist_rq(struct rrpc *rrpc, struct bio *bio,
 	}
 
 	for (i = 0; i < npages; i++) {
+		/*
+		 * Stripe large writes over the luns: each one gets a run of
+		 * pages which fills its flash pages across planes, instead
+		 * of a single page.
+		 */
+		if (i % rrpc->stripe == 0)
+			rlun = rrpc_get_lun_rr(rrpc, is_gc);
+
 		/* We assume that mapping occurs at 4KB granularity */
-		p = rrpc_map_page(rrpc, laddr + i, is_gc);
+		p = rrpc_map_page(rrpc, rlun, laddr + i, is_gc);
 		if (!p) {
 			BUG_ON(is_gc);
 			rrpc_unlock_laddr(rrpc, r);
@@ -776,7 +819,7 @@ static int rrpc_write_rq(struct rrpc *rrpc, struct bio *bio,
 	if (!is_gc && rrpc_lock_rq(rrpc, bio, rqd))
 		return NVM_IO_REQUEUE;
 
-	p = rrpc_map_page(rrpc, laddr, is_gc);
+	p = rrpc_map_page(rrpc, rrpc_get_lun_rr(rrpc, is_gc), laddr, is_gc);
 	if (!p) {
 		BUG_ON(is_gc);
 		rrpc_unlock_rq(rrpc, rqd);
@@ -925,6 +968,7 @@ static void rrpc_gc_free(struct rrpc *rrpc)
 		if (!rlun->blocks)
 			break;
 		vfree(rlun->blocks);
+		vfree(rlun->prio_heap);
 	}
 }
 
@@ -1110,7 +1154,6 @@ static int rrpc_luns_init(struct rrpc *rrpc, int lun_begin, int lun_end)
 		rlun = &rrpc->luns[i];
 		rlun->rrpc = rrpc;
 		rlun->parent = lun;
-		INIT_LIST_HEAD(&rlun->prio_list);
 		INIT_WORK(&rlun->ws_gc, rrpc_lun_gc);
 		spin_lock_init(&rlun->lock);
 
@@ -1122,16 +1165,24 @@ static int rrpc_luns_init(struct rrpc *rrpc, int lun_begin, int lun_end)
 		if (!rlun->blocks)
 			goto err;
 
+		rlun->prio_heap = vmalloc(sizeof(struct rrpc_block *) *
+						rrpc->dev->blks_per_lun);
+		if (!rlun->prio_heap)
+			goto err;
+
 		for (j = 0; j < rrpc->dev->blks_per_lun; j++) {
 			struct rrpc_block *rblk = &rlun->blocks[j];
 			struct nvm_block *blk = &lun->blocks[j];
 
 			rblk->parent = blk;
-			INIT_LIST_HEAD(&rblk->prio);
+			rblk->rlun = rlun;
+			rblk->prio_idx = -1;
 			spin_lock_init(&rblk->lock);
 		}
 	}
 
+	rrpc->stripe = max(dev->sec_per_pl, 1);
+
 	return 0;
 err:
 	return -ENOMEM;
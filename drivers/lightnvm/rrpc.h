@@ -54,7 +54,8 @@ struct rrpc_rq {
 
 struct rrpc_block {
 	struct nvm_block *parent;
-	struct list_head prio;
+	struct rrpc_lun *rlun;
+	int prio_idx;	/* slot in rlun->prio_heap, -1 if not a GC candidate */
 
 #define MAX_INVALID_PAGES_STORAGE 8
 	/* Bitmap for invalid page intries */
@@ -73,8 +74,12 @@ struct rrpc_lun {
 	struct nvm_lun *parent;
 	struct rrpc_block *cur, *gc_cur;
 	struct rrpc_block *blocks;	/* Reference to block allocation */
-	struct list_head prio_list;		/* Blocks that may be GC'ed */
-	struct work_struct ws_gc;
+
+	/* Blocks that may be GC'ed, a max-heap on the invalid page count */
+	struct rrpc_block **prio_heap;
+	unsigned int nr_prio;
+
+	struct work_struct ws_gc;	/* GC of this lun, in parallel to others */
 
 	spinlock_t lock;
 };
@@ -91,6 +96,7 @@ struct rrpc {
 
 	int nr_luns;
 	struct rrpc_lun *luns;
+	int stripe;	/* pages of a request written to one lun in a row */
 
 	/* calculated values */
 	unsigned long long nr_pages;
@@ -1044,6 +1044,8 @@ static struct bkey *__bch_btree_iter_init(struct btree_keys *b,
 					  struct bset_tree *start)
 {
 	struct bkey *ret = NULL;
+	struct bset_tree *t;
+
 	iter->size = ARRAY_SIZE(iter->data);
 	iter->used = 0;
 
@@ -1051,6 +1053,16 @@ static struct bkey *__bch_btree_iter_init(struct btree_keys *b,
 	iter->b = b;
 #endif
 
+	/*
+	 * The sets are searched one after the other: get the top of each
+	 * search tree, and the set header the search starts with, coming in
+	 * all at once rather than missing on each in turn.
+	 */
+	for (t = start; t <= bset_tree_last(b); t++) {
+		prefetch(t->tree);
+		prefetch(t->data);
+	}
+
 	for (; start <= bset_tree_last(b); start++) {
 		ret = bch_bset_search(b, start, search);
 		bch_btree_iter_push(iter, ret, bset_bkey_last(start->data));
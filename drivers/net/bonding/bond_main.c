@@ -219,6 +219,23 @@ static bool bond_time_in_interval(struct bonding *bond, unsigned long last_act,
 
 /*---------------------------- General routines -----------------------------*/
 
+/* Modes where the usable slave array follows slave link state directly,
+ * rather than through the 802.3ad or tlb state machines.
+ */
+static bool bond_slave_arr_follows_link(const struct bonding *bond)
+{
+	return BOND_MODE(bond) == BOND_MODE_XOR ||
+	       BOND_MODE(bond) == BOND_MODE_ROUNDROBIN ||
+	       BOND_MODE(bond) == BOND_MODE_BROADCAST;
+}
+
+/* Modes whose xmit picks from the usable slave array */
+static bool bond_mode_uses_slave_arr(const struct bonding *bond)
+{
+	return bond_mode_uses_xmit_hash(bond) ||
+	       bond_slave_arr_follows_link(bond);
+}
+
 const char *bond_mode_name(int mode)
 {
 	static const char *names[] = {
@@ -1688,7 +1705,7 @@ int bond_enslave(struct net_device *bond_dev, struct net_device *slave_dev)
 		unblock_netpoll_tx();
 	}
 
-	if (bond_mode_uses_xmit_hash(bond))
+	if (bond_mode_uses_slave_arr(bond))
 		bond_update_slave_arr(bond, NULL);
 
 	netdev_info(bond_dev, "Enslaving %s as %s interface with %s link\n",
@@ -1818,7 +1835,7 @@ static int __bond_release_one(struct net_device *bond_dev,
 	if (BOND_MODE(bond) == BOND_MODE_8023AD)
 		bond_3ad_unbind_slave(slave);
 
-	if (bond_mode_uses_xmit_hash(bond))
+	if (bond_mode_uses_slave_arr(bond))
 		bond_update_slave_arr(bond, slave);
 
 	netdev_info(bond_dev, "Releasing %s interface %s\n",
@@ -2118,7 +2135,7 @@ static void bond_miimon_commit(struct bonding *bond)
 				bond_alb_handle_link_change(bond, slave,
 							    BOND_LINK_UP);
 
-			if (BOND_MODE(bond) == BOND_MODE_XOR)
+			if (bond_slave_arr_follows_link(bond))
 				bond_update_slave_arr(bond, NULL);
 
 			if (!bond->curr_active_slave || slave == primary)
@@ -2148,7 +2165,7 @@ static void bond_miimon_commit(struct bonding *bond)
 				bond_alb_handle_link_change(bond, slave,
 							    BOND_LINK_DOWN);
 
-			if (BOND_MODE(bond) == BOND_MODE_XOR)
+			if (bond_slave_arr_follows_link(bond))
 				bond_update_slave_arr(bond, NULL);
 
 			if (slave == rcu_access_pointer(bond->curr_active_slave))
@@ -2618,7 +2635,7 @@ static void bond_loadbalance_arp_mon(struct work_struct *work)
 
 		if (slave_state_changed) {
 			bond_slave_state_change(bond);
-			if (BOND_MODE(bond) == BOND_MODE_XOR)
+			if (bond_slave_arr_follows_link(bond))
 				bond_update_slave_arr(bond, NULL);
 		}
 		if (do_failover) {
@@ -2997,7 +3014,7 @@ static int bond_slave_netdev_event(unsigned long event,
 		 * events. If these (miimon/arpmon) parameters are configured
 		 * then array gets refreshed twice and that should be fine!
 		 */
-		if (bond_mode_uses_xmit_hash(bond))
+		if (bond_mode_uses_slave_arr(bond))
 			bond_update_slave_arr(bond, NULL);
 		break;
 	case NETDEV_CHANGEMTU:
@@ -3241,7 +3258,7 @@ static int bond_open(struct net_device *bond_dev)
 		bond_3ad_initiate_agg_selection(bond, 1);
 	}
 
-	if (bond_mode_uses_xmit_hash(bond))
+	if (bond_mode_uses_slave_arr(bond))
 		bond_update_slave_arr(bond, NULL);
 
 	return 0;
@@ -3707,7 +3724,9 @@ static int bond_xmit_roundrobin(struct sk_buff *skb, struct net_device *bond_dev
 {
 	struct bonding *bond = netdev_priv(bond_dev);
 	struct iphdr *iph = ip_hdr(skb);
+	struct bond_up_slave *slaves;
 	struct slave *slave;
+	unsigned int count;
 	u32 slave_id;
 
 	/* Start with the curr_active_slave that joined the bond as the
@@ -3723,11 +3742,15 @@ static int bond_xmit_roundrobin(struct sk_buff *skb, struct net_device *bond_dev
 		else
 			bond_xmit_slave_id(bond, skb, 0);
 	} else {
-		int slave_cnt = ACCESS_ONCE(bond->slave_cnt);
-
-		if (likely(slave_cnt)) {
+		/* Only slaves that can tx are in the array, so there is no
+		 * walking the slave list for one.
+		 */
+		slaves = rcu_dereference(bond->slave_arr);
+		count = slaves ? ACCESS_ONCE(slaves->count) : 0;
+		if (likely(count)) {
 			slave_id = bond_rr_gen_slave_id(bond);
-			bond_xmit_slave_id(bond, skb, slave_id % slave_cnt);
+			slave = slaves->arr[slave_id % count];
+			bond_dev_queue_xmit(bond, skb, slave->dev);
 		} else {
 			bond_tx_drop(bond_dev, skb);
 		}
@@ -3789,6 +3812,9 @@ err:
  * (a) BOND_MODE_8023AD
  * (b) BOND_MODE_XOR
  * (c) BOND_MODE_TLB && tlb_dynamic_lb == 0
+ * and for the modes that spread over or send to all usable slaves -
+ * (d) BOND_MODE_ROUNDROBIN
+ * (e) BOND_MODE_BROADCAST
  *
  * The caller is expected to hold RTNL only and NO other lock!
  */
@@ -3900,27 +3926,27 @@ static int bond_3ad_xor_xmit(struct sk_buff *skb, struct net_device *dev)
 static int bond_xmit_broadcast(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = netdev_priv(bond_dev);
-	struct slave *slave = NULL;
-	struct list_head *iter;
+	struct bond_up_slave *slaves;
+	unsigned int count, i;
 
-	bond_for_each_slave_rcu(bond, slave, iter) {
-		if (bond_is_last_slave(bond, slave))
-			break;
-		if (bond_slave_is_up(slave) && slave->link == BOND_LINK_UP) {
-			struct sk_buff *skb2 = skb_clone(skb, GFP_ATOMIC);
+	slaves = rcu_dereference(bond->slave_arr);
+	count = slaves ? ACCESS_ONCE(slaves->count) : 0;
+	if (unlikely(!count)) {
+		bond_tx_drop(bond_dev, skb);
+		return NETDEV_TX_OK;
+	}
 
-			if (!skb2) {
-				net_err_ratelimited("%s: Error: %s: skb_clone() failed\n",
-						    bond_dev->name, __func__);
-				continue;
-			}
-			bond_dev_queue_xmit(bond, skb2, slave->dev);
+	for (i = 0; i < count - 1; i++) {
+		struct sk_buff *skb2 = skb_clone(skb, GFP_ATOMIC);
+
+		if (!skb2) {
+			net_err_ratelimited("%s: Error: %s: skb_clone() failed\n",
+					    bond_dev->name, __func__);
+			continue;
 		}
+		bond_dev_queue_xmit(bond, skb2, slaves->arr[i]->dev);
 	}
-	if (slave && bond_slave_is_up(slave) && slave->link == BOND_LINK_UP)
-		bond_dev_queue_xmit(bond, skb, slave->dev);
-	else
-		bond_tx_drop(bond_dev, skb);
+	bond_dev_queue_xmit(bond, skb, slaves->arr[i]->dev);
 
 	return NETDEV_TX_OK;
 }
@@ -33,7 +33,9 @@
 #include <linux/types.h>
 #include <linux/pci.h>
 #include <linux/netdevice.h>
+#include <linux/filter.h>
 #include <linux/cpumask.h>
+#include <linux/dim.h>
 #include <linux/aer.h>
 #include <linux/if_vlan.h>
 #include <linux/jiffies.h>
@@ -222,6 +224,8 @@ struct ixgbe_rx_queue_stats {
 	u64 alloc_rx_page_failed;
 	u64 alloc_rx_buff_failed;
 	u64 csum_err;
+	u64 xdp_drop;
+	u64 xdp_tx;
 };
 
 enum ixgbe_ring_state_t {
@@ -390,6 +394,9 @@ struct ixgbe_q_vector {
 	u16 itr;		/* Interrupt throttle rate written to EITR */
 	struct ixgbe_ring_container rx, tx;
 
+	struct dim rx_dim;	/* picks the ITR of vectors with Rx rings */
+	u16 total_events;	/* polls completed, for rx_dim */
+
 	struct napi_struct napi;
 	cpumask_t affinity_mask;
 	int numa_node;
@@ -684,6 +691,9 @@ struct ixgbe_adapter {
 	u64 non_eop_descs;
 	u32 alloc_rx_page_failed;
 	u32 alloc_rx_buff_failed;
+	u64 xdp_drop;
+	u64 xdp_tx;
+	struct bpf_prog __rcu *xdp_prog;	/* under rtnl */
 
 	struct ixgbe_q_vector *q_vector[MAX_Q_VECTORS];
 
@@ -893,6 +903,7 @@ void ixgbe_unmap_and_free_tx_resource(struct ixgbe_ring *,
 				      struct ixgbe_tx_buffer *);
 void ixgbe_alloc_rx_buffers(struct ixgbe_ring *, u16);
 void ixgbe_write_eitr(struct ixgbe_q_vector *);
+void ixgbe_rx_dim_work(struct work_struct *work);
 int ixgbe_poll(struct napi_struct *napi, int budget);
 int ethtool_ioctl(struct ifreq *ifr);
 s32 ixgbe_reinit_fdir_tables_82599(struct ixgbe_hw *hw);
@@ -859,6 +859,8 @@ static int ixgbe_alloc_q_vector(struct ixgbe_adapter *adapter,
 	/* initialize work limits */
 	q_vector->tx.work_limit = adapter->tx_work_limit;
 
+	dim_init(&q_vector->rx_dim, ixgbe_rx_dim_work);
+
 	/* initialize pointer to rings */
 	ring = q_vector->ring;
 
@@ -980,6 +982,7 @@ static void ixgbe_free_q_vector(struct ixgbe_adapter *adapter, int v_idx)
 	adapter->q_vector[v_idx] = NULL;
 	napi_hash_del(&q_vector->napi);
 	netif_napi_del(&q_vector->napi);
+	cancel_work_sync(&q_vector->rx_dim.work);
 
 	/*
 	 * ixgbe_get_stats64() might access the rings on this vector,
@@ -2029,6 +2029,72 @@ dma_sync:
 	return skb;
 }
 
+/**
+ * ixgbe_run_xdp - run the XDP program on a frame still in its Rx buffer
+ * @rx_ring: rx descriptor ring the frame came in on
+ * @rx_desc: descriptor of the frame
+ * @prog: XDP program of the adapter, or NULL
+ * @cap: capture consumer bound to the ring, or NULL
+ *
+ * Returns true if the program or the consumer took the frame.  Its buffer is then
+ * handed back to the ring as it is, so that a dropped frame never gets
+ * near the page allocator, and no skb is allocated for it.
+ **/
+static bool ixgbe_run_xdp(struct ixgbe_ring *rx_ring,
+			  union ixgbe_adv_rx_desc *rx_desc,
+			  struct bpf_prog *prog, struct xdp_capture *cap)
+{
+	struct ixgbe_rx_buffer *rx_buffer;
+	unsigned int size = le16_to_cpu(rx_desc->wb.upper.length);
+	struct xdp_buff xdp;
+	u32 act, ntc;
+
+	rx_buffer = &rx_ring->rx_buffer_info[rx_ring->next_to_clean];
+
+	/* frames spanning several buffers take the usual way */
+	if (rx_buffer->skb || !ixgbe_test_staterr(rx_desc, IXGBE_RXD_STAT_EOP))
+		return false;
+
+	dma_sync_single_range_for_cpu(rx_ring->dev,
+				      rx_buffer->dma,
+				      rx_buffer->page_offset,
+				      ixgbe_rx_bufsz(rx_ring),
+				      DMA_FROM_DEVICE);
+
+	xdp_init_buff(&xdp, rx_ring->netdev,
+		      page_address(rx_buffer->page) + rx_buffer->page_offset,
+		      size, rx_ring->queue_index);
+	act = xdp_rx(prog, cap, &xdp);
+
+	switch (act) {
+	case XDP_PASS:
+		return false;
+	case XDP_TX:
+	case XDP_REDIRECT:
+		if (likely(!xdp_do_xmit(&xdp, act))) {
+			rx_ring->rx_stats.xdp_tx++;
+			break;
+		}
+		/* fall through */
+	default:
+		/* XDP_ABORTED, XDP_DROP and verdicts we don't know */
+		rx_ring->rx_stats.xdp_drop++;
+		break;
+	}
+
+	/* no skb holds a reference, the same half page can go back */
+	ixgbe_reuse_rx_page(rx_ring, rx_buffer);
+	rx_buffer->page = NULL;
+
+	ntc = rx_ring->next_to_clean + 1;
+	ntc = (ntc < rx_ring->count) ? ntc : 0;
+	rx_ring->next_to_clean = ntc;
+
+	prefetch(IXGBE_RX_DESC(rx_ring, ntc));
+
+	return true;
+}
+
 /**
  * ixgbe_clean_rx_irq - Clean completed descriptors from Rx ring - bounce buf
  * @q_vector: structure containing interrupt and ring information
@@ -2053,6 +2119,12 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	unsigned int mss = 0;
 #endif /* IXGBE_FCOE */
 	u16 cleaned_count = ixgbe_desc_unused(rx_ring);
+	struct bpf_prog *xdp_prog;
+	struct xdp_capture *cap;
+
+	rcu_read_lock();
+	xdp_prog = rcu_dereference(q_vector->adapter->xdp_prog);
+	cap = xdp_capture_lookup(rx_ring->netdev, rx_ring->queue_index);
 
 	while (likely(total_rx_packets < budget)) {
 		union ixgbe_adv_rx_desc *rx_desc;
@@ -2075,6 +2147,14 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		 */
 		dma_rmb();
 
+		if ((xdp_prog || cap) &&
+		    ixgbe_run_xdp(rx_ring, rx_desc, xdp_prog, cap)) {
+			cleaned_count++;
+			total_rx_bytes += le16_to_cpu(rx_desc->wb.upper.length);
+			total_rx_packets++;
+			continue;
+		}
+
 		/* retrieve a buffer from the ring */
 		skb = ixgbe_fetch_rx_buffer(rx_ring, rx_desc);
 
@@ -2130,6 +2210,8 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		total_rx_packets++;
 	}
 
+	rcu_read_unlock();
+
 	u64_stats_update_begin(&rx_ring->syncp);
 	rx_ring->stats.packets += total_rx_packets;
 	rx_ring->stats.bytes += total_rx_bytes;
@@ -2379,6 +2461,43 @@ static void ixgbe_set_itr(struct ixgbe_q_vector *q_vector)
 	}
 }
 
+void ixgbe_rx_dim_work(struct work_struct *work)
+{
+	struct dim *dim = container_of(work, struct dim, work);
+	struct ixgbe_q_vector *q_vector =
+		container_of(dim, struct ixgbe_q_vector, rx_dim);
+	struct dim_cq_moder moder = net_dim_get_rx_moderation(dim->profile_ix);
+
+	/* ethtool may have made the ITR static meanwhile */
+	if (q_vector->adapter->rx_itr_setting & 1) {
+		/* itr counts in 0.25us steps, the HW drops the low bits */
+		q_vector->itr = min_t(u32, moder.usec << 2, IXGBE_MAX_EITR);
+		ixgbe_write_eitr(q_vector);
+	}
+
+	dim->state = DIM_START_MEASURE;
+}
+
+/*
+ * The per interrupt heuristics above flip between their three settings
+ * under mixed traffic; vectors that receive let dim pick the ITR from
+ * the Rx rates over a number of interrupts instead.
+ */
+static void ixgbe_update_dim_sample(struct ixgbe_q_vector *q_vector)
+{
+	struct dim_sample sample;
+	struct ixgbe_ring *ring;
+	u64 packets = 0, bytes = 0;
+
+	ixgbe_for_each_ring(ring, q_vector->rx) {
+		packets += ring->stats.packets;
+		bytes += ring->stats.bytes;
+	}
+
+	dim_update_sample(++q_vector->total_events, packets, bytes, &sample);
+	net_dim(&q_vector->rx_dim, sample);
+}
+
 /**
  * ixgbe_check_overtemp_subtask - check for over temperature
  * @adapter: pointer to adapter
@@ -2811,8 +2930,12 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 
 	/* all work done, exit the polling mode */
 	napi_complete_done(napi, work_done);
-	if (adapter->rx_itr_setting & 1)
-		ixgbe_set_itr(q_vector);
+	if (adapter->rx_itr_setting & 1) {
+		if (q_vector->rx.count)
+			ixgbe_update_dim_sample(q_vector);
+		else
+			ixgbe_set_itr(q_vector);
+	}
 	if (!test_bit(__IXGBE_DOWN, &adapter->state))
 		ixgbe_irq_enable_queues(adapter, ((u64)1 << q_vector->v_idx));
 
@@ -5736,6 +5859,14 @@ static int ixgbe_change_mtu(struct net_device *netdev, int new_mtu)
 	if ((new_mtu < 68) || (max_frame > IXGBE_MAX_JUMBO_FRAME_SIZE))
 		return -EINVAL;
 
+	/* with XDP every frame must fit in a single Rx buffer */
+	if ((rtnl_dereference(adapter->xdp_prog) ||
+	     netdev_has_xdp_capture(netdev)) &&
+	    max_frame + VLAN_HLEN > IXGBE_RXBUFFER_2K) {
+		e_warn(probe, "MTU too large for XDP\n");
+		return -EINVAL;
+	}
+
 	/*
 	 * For 82599EB we cannot allow legacy VFs to enable their receive
 	 * paths when MTU greater than 1500 is configured.  So display a
@@ -6059,6 +6190,7 @@ void ixgbe_update_stats(struct ixgbe_adapter *adapter)
 	u64 non_eop_descs = 0, restart_queue = 0, tx_busy = 0;
 	u64 alloc_rx_page_failed = 0, alloc_rx_buff_failed = 0;
 	u64 bytes = 0, packets = 0, hw_csum_rx_error = 0;
+	u64 xdp_drop = 0, xdp_tx = 0;
 
 	if (test_bit(__IXGBE_DOWN, &adapter->state) ||
 	    test_bit(__IXGBE_RESETTING, &adapter->state))
@@ -6081,6 +6213,8 @@ void ixgbe_update_stats(struct ixgbe_adapter *adapter)
 		alloc_rx_page_failed += rx_ring->rx_stats.alloc_rx_page_failed;
 		alloc_rx_buff_failed += rx_ring->rx_stats.alloc_rx_buff_failed;
 		hw_csum_rx_error += rx_ring->rx_stats.csum_err;
+		xdp_drop += rx_ring->rx_stats.xdp_drop;
+		xdp_tx += rx_ring->rx_stats.xdp_tx;
 		bytes += rx_ring->stats.bytes;
 		packets += rx_ring->stats.packets;
 	}
@@ -6088,6 +6222,8 @@ void ixgbe_update_stats(struct ixgbe_adapter *adapter)
 	adapter->alloc_rx_page_failed = alloc_rx_page_failed;
 	adapter->alloc_rx_buff_failed = alloc_rx_buff_failed;
 	adapter->hw_csum_rx_error = hw_csum_rx_error;
+	adapter->xdp_drop = xdp_drop;
+	adapter->xdp_tx = xdp_tx;
 	netdev->stats.rx_bytes = bytes;
 	netdev->stats.rx_packets = packets;
 
@@ -7993,6 +8129,11 @@ static netdev_features_t ixgbe_fix_features(struct net_device *netdev,
 	if (!(adapter->flags2 & IXGBE_FLAG2_RSC_CAPABLE))
 		features &= ~NETIF_F_LRO;
 
+	/* XDP needs each frame in a buffer of its own */
+	if (rtnl_dereference(adapter->xdp_prog) ||
+	    netdev_has_xdp_capture(netdev))
+		features &= ~NETIF_F_LRO;
+
 	return features;
 }
 
@@ -8392,6 +8533,68 @@ ixgbe_features_check(struct sk_buff *skb, struct net_device *dev,
 	return features;
 }
 
+/* the program and capture consumers only ever see frames held by a
+ * single Rx buffer
+ */
+static int ixgbe_xdp_check(struct net_device *dev)
+{
+	struct ixgbe_adapter *adapter = netdev_priv(dev);
+	int frame_size = dev->mtu + ETH_HLEN + ETH_FCS_LEN + VLAN_HLEN;
+
+	if (adapter->flags2 & IXGBE_FLAG2_RSC_ENABLED) {
+		e_warn(probe, "can't set XDP while LRO is on, disable LRO first\n");
+		return -EINVAL;
+	}
+
+	if (frame_size > IXGBE_RXBUFFER_2K) {
+		e_warn(probe, "MTU too large for XDP\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int ixgbe_xdp_setup(struct net_device *dev, struct bpf_prog *prog)
+{
+	struct ixgbe_adapter *adapter = netdev_priv(dev);
+	struct bpf_prog *old_prog;
+	int err;
+
+	if (prog) {
+		err = ixgbe_xdp_check(dev);
+		if (err)
+			return err;
+	}
+
+	/* the rings pick the new program up on their next poll */
+	old_prog = rtnl_dereference(adapter->xdp_prog);
+	rcu_assign_pointer(adapter->xdp_prog, prog);
+
+	if (old_prog)
+		bpf_prog_put_rcu(old_prog);
+
+	return 0;
+}
+
+static int ixgbe_xdp(struct net_device *dev, struct netdev_xdp *xdp)
+{
+	struct ixgbe_adapter *adapter = netdev_priv(dev);
+
+	switch (xdp->command) {
+	case XDP_SETUP_PROG:
+		return ixgbe_xdp_setup(dev, xdp->prog);
+	case XDP_QUERY_PROG:
+		xdp->prog_attached = !!rtnl_dereference(adapter->xdp_prog);
+		return 0;
+	case XDP_SETUP_CAPTURE:
+		if (xdp->queue >= adapter->num_rx_queues)
+			return -EINVAL;
+		return ixgbe_xdp_check(dev);
+	default:
+		return -EINVAL;
+	}
+}
+
 static const struct net_device_ops ixgbe_netdev_ops = {
 	.ndo_open		= ixgbe_open,
 	.ndo_stop		= ixgbe_close,
@@ -8443,6 +8646,7 @@ static const struct net_device_ops ixgbe_netdev_ops = {
 	.ndo_del_vxlan_port	= ixgbe_del_vxlan_port,
 #endif /* CONFIG_IXGBE_VXLAN */
 	.ndo_features_check	= ixgbe_features_check,
+	.ndo_xdp		= ixgbe_xdp,
 };
 
 /**
@@ -9039,6 +9243,7 @@ static void ixgbe_remove(struct pci_dev *pdev)
 {
 	struct ixgbe_adapter *adapter = pci_get_drvdata(pdev);
 	struct net_device *netdev;
+	struct bpf_prog *xdp_prog;
 	bool disable_dev;
 
 	/* if !adapter then we already cleaned up in probe */
@@ -9074,6 +9279,10 @@ static void ixgbe_remove(struct pci_dev *pdev)
 	if (netdev->reg_state == NETREG_REGISTERED)
 		unregister_netdev(netdev);
 
+	xdp_prog = rcu_dereference_protected(adapter->xdp_prog, 1);
+	if (xdp_prog)
+		bpf_prog_put_rcu(xdp_prog);
+
 	ixgbe_clear_interrupt_scheme(adapter);
 
 	ixgbe_release_hw_control(adapter);
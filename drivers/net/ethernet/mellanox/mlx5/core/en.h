@@ -32,6 +32,8 @@
 
 #include <linux/if_vlan.h>
 #include <linux/etherdevice.h>
+#include <linux/dim.h>
+#include <linux/filter.h>
 #include <linux/mlx5/driver.h>
 #include <linux/mlx5/qp.h>
 #include <linux/mlx5/cq.h>
@@ -50,12 +52,36 @@
 #define MLX5E_PARAMS_DEFAULT_LOG_RQ_SIZE                0xa
 #define MLX5E_PARAMS_MAXIMUM_LOG_RQ_SIZE                0xd
 
+#define MLX5E_PARAMS_MINIMUM_LOG_RQ_SIZE_MPW            0x1
+#define MLX5E_PARAMS_DEFAULT_LOG_RQ_SIZE_MPW            0x3
+#define MLX5E_PARAMS_MAXIMUM_LOG_RQ_SIZE_MPW            0x4
+
 #define MLX5E_PARAMS_DEFAULT_LRO_WQE_SZ                 (64 * 1024)
 #define MLX5E_PARAMS_DEFAULT_RX_CQ_MODERATION_USEC      0x10
 #define MLX5E_PARAMS_DEFAULT_RX_CQ_MODERATION_PKTS      0x20
 #define MLX5E_PARAMS_DEFAULT_TX_CQ_MODERATION_USEC      0x10
 #define MLX5E_PARAMS_DEFAULT_TX_CQ_MODERATION_PKTS      0x20
 #define MLX5E_PARAMS_DEFAULT_MIN_RX_WQES                0x80
+#define MLX5E_PARAMS_DEFAULT_MIN_RX_WQES_MPW            0x2
+
+/*
+ * A striding RQ WQE is one physically contiguous buffer the HW cuts into
+ * strides, packets taking as many consecutive strides as they need.
+ */
+#define MLX5_MPWRQ_LOG_NUM_STRIDES	11 /* >= 9, HW restriction */
+#define MLX5_MPWRQ_LOG_STRIDE_SIZE	6  /* >= 6, HW restriction */
+#define MLX5_MPWRQ_NUM_STRIDES		BIT(MLX5_MPWRQ_LOG_NUM_STRIDES)
+#define MLX5_MPWRQ_STRIDE_SIZE		BIT(MLX5_MPWRQ_LOG_STRIDE_SIZE)
+#define MLX5_MPWRQ_LOG_WQE_SZ		(MLX5_MPWRQ_LOG_NUM_STRIDES + \
+					 MLX5_MPWRQ_LOG_STRIDE_SIZE)
+#define MLX5_MPWRQ_WQE_SZ		BIT(MLX5_MPWRQ_LOG_WQE_SZ)
+#define MLX5_MPWRQ_WQE_PAGE_ORDER	(MLX5_MPWRQ_LOG_WQE_SZ > PAGE_SHIFT ? \
+					 MLX5_MPWRQ_LOG_WQE_SZ - PAGE_SHIFT : 0)
+#define MLX5_MPWRQ_PAGES_PER_WQE	BIT(MLX5_MPWRQ_WQE_PAGE_ORDER)
+#define MLX5_MPWRQ_STRIDES_PER_PAGE	(MLX5_MPWRQ_NUM_STRIDES >> \
+					 MLX5_MPWRQ_WQE_PAGE_ORDER)
+#define MLX5_MPWRQ_SMALL_PACKET_THRESHOLD	128
+#define MLX5E_MPWQE_CACHE_SIZE		8 /* WQE buffers, power of two */
 
 #define MLX5E_LOG_INDIR_RQT_SIZE       0x7
 #define MLX5E_INDIR_RQT_SIZE           BIT(MLX5E_LOG_INDIR_RQT_SIZE)
@@ -100,6 +126,8 @@ static const char vport_strings[][ETH_GSTRING_LEN] = {
 	"tx_queue_wake",
 	"tx_queue_dropped",
 	"rx_wqe_err",
+	"rx_xdp_drop",
+	"rx_xdp_tx",
 };
 
 struct mlx5e_vport_stats {
@@ -138,8 +166,10 @@ struct mlx5e_vport_stats {
 	u64 tx_queue_wake;
 	u64 tx_queue_dropped;
 	u64 rx_wqe_err;
+	u64 rx_xdp_drop;
+	u64 rx_xdp_tx;
 
-#define NUM_VPORT_COUNTERS     32
+#define NUM_VPORT_COUNTERS     34
 };
 
 static const char pport_strings[][ETH_GSTRING_LEN] = {
@@ -218,21 +248,35 @@ struct mlx5e_pport_stats {
 
 static const char rq_stats_strings[][ETH_GSTRING_LEN] = {
 	"packets",
+	"bytes",
 	"csum_none",
 	"csum_sw",
 	"lro_packets",
 	"lro_bytes",
-	"wqe_err"
+	"wqe_err",
+	"xdp_drop",
+	"xdp_tx",
+	"mpwqe_filler",
+	"buff_alloc_err",
+	"cache_reuse",
+	"cache_busy",
 };
 
 struct mlx5e_rq_stats {
 	u64 packets;
+	u64 bytes;
 	u64 csum_none;
 	u64 csum_sw;
 	u64 lro_packets;
 	u64 lro_bytes;
 	u64 wqe_err;
-#define NUM_RQ_STATS 6
+	u64 xdp_drop;
+	u64 xdp_tx;
+	u64 mpwqe_filler;
+	u64 buff_alloc_err;
+	u64 cache_reuse;
+	u64 cache_busy;
+#define NUM_RQ_STATS 13
 };
 
 static const char sq_stats_strings[][ETH_GSTRING_LEN] = {
@@ -266,11 +310,13 @@ struct mlx5e_stats {
 struct mlx5e_params {
 	u8  log_sq_size;
 	u8  log_rq_size;
+	u8  rq_wq_type;
 	u16 num_channels;
 	u8  default_vlan_prio;
 	u8  num_tc;
 	u16 rx_cq_moderation_usec;
 	u16 rx_cq_moderation_pkts;
+	bool rx_am_enabled;
 	u16 tx_cq_moderation_usec;
 	u16 tx_cq_moderation_pkts;
 	u16 min_rx_wqes;
@@ -284,6 +330,7 @@ struct mlx5e_params {
 
 enum {
 	MLX5E_RQ_STATE_POST_WQES_ENABLE,
+	MLX5E_RQ_STATE_AM,
 };
 
 enum cq_flags {
@@ -294,6 +341,7 @@ struct mlx5e_cq {
 	/* data path - accessed per cqe */
 	struct mlx5_cqwq           wq;
 	unsigned long              flags;
+	u16                        event_ctr;
 
 	/* data path - accessed per napi poll */
 	struct napi_struct        *napi;
@@ -305,11 +353,48 @@ struct mlx5e_cq {
 	struct mlx5_wq_ctrl        wq_ctrl;
 } ____cacheline_aligned_in_smp;
 
+struct mlx5e_dma_info {
+	struct page	*page;
+	dma_addr_t	addr;
+};
+
+/*
+ * Every page of a striding RQ WQE holds one reference per stride on top
+ * of ours; a frag handed to an skb takes one of them along, the rest are
+ * dropped once all the strides are consumed.
+ */
+struct mlx5e_mpw_info {
+	struct mlx5e_dma_info dma_info;
+	u16 consumed_strides;
+	u16 skbs_frags[MLX5_MPWRQ_PAGES_PER_WQE];
+};
+
+/* consumed WQE buffers, to be posted again once the stack let go of them */
+struct mlx5e_mpwqe_cache {
+	u32                    head;
+	u32                    tail;
+	struct mlx5e_dma_info  buf[MLX5E_MPWQE_CACHE_SIZE];
+};
+
+struct mlx5e_rq;
+struct mlx5e_rx_wqe;
+typedef void (*mlx5e_fp_handle_rx_cqe)(struct mlx5e_rq *rq,
+				       struct mlx5_cqe64 *cqe,
+				       struct bpf_prog *prog,
+				       struct xdp_capture *cap);
+typedef int (*mlx5e_fp_alloc_wqe)(struct mlx5e_rq *rq,
+				  struct mlx5e_rx_wqe *wqe, u16 ix);
+
 struct mlx5e_rq {
 	/* data path */
 	struct mlx5_wq_ll      wq;
 	u32                    wqe_sz;
 	struct sk_buff       **skb;
+	struct mlx5e_mpw_info *wqe_info;
+	struct mlx5e_mpwqe_cache mpwqe_cache;
+
+	mlx5e_fp_handle_rx_cqe handle_rx_cqe;
+	mlx5e_fp_alloc_wqe     alloc_wqe;
 
 	struct device         *pdev;
 	struct net_device     *netdev;
@@ -319,6 +404,8 @@ struct mlx5e_rq {
 	unsigned long          state;
 	int                    ix;
 
+	struct dim             dim; /* adaptive rx moderation */
+
 	/* control */
 	struct mlx5_wq_ctrl    wq_ctrl;
 	u32                    rqn;
@@ -501,6 +588,7 @@ struct mlx5e_priv {
 	struct mlx5e_vlan_db       vlan;
 
 	struct mlx5e_params        params;
+	struct bpf_prog __rcu     *xdp_prog; /* under state_lock */
 	spinlock_t                 async_events_spinlock; /* sync hw events */
 	struct work_struct         update_carrier_work;
 	struct work_struct         set_rx_mode_work;
@@ -566,6 +654,43 @@ int mlx5e_napi_poll(struct napi_struct *napi, int budget);
 bool mlx5e_poll_tx_cq(struct mlx5e_cq *cq);
 bool mlx5e_poll_rx_cq(struct mlx5e_cq *cq, int budget);
 bool mlx5e_post_rx_wqes(struct mlx5e_rq *rq);
+
+/* the RQ size is counted in WQEs, and a striding RQ WQE is a lot bigger */
+static inline u8 mlx5e_min_log_rq_size(u8 rq_wq_type)
+{
+	return rq_wq_type == MLX5_WQ_TYPE_STRQ ?
+	       MLX5E_PARAMS_MINIMUM_LOG_RQ_SIZE_MPW :
+	       MLX5E_PARAMS_MINIMUM_LOG_RQ_SIZE;
+}
+
+static inline u8 mlx5e_max_log_rq_size(u8 rq_wq_type)
+{
+	return rq_wq_type == MLX5_WQ_TYPE_STRQ ?
+	       MLX5E_PARAMS_MAXIMUM_LOG_RQ_SIZE_MPW :
+	       MLX5E_PARAMS_MAXIMUM_LOG_RQ_SIZE;
+}
+
+static inline u8 mlx5e_default_log_rq_size(u8 rq_wq_type)
+{
+	return rq_wq_type == MLX5_WQ_TYPE_STRQ ?
+	       MLX5E_PARAMS_DEFAULT_LOG_RQ_SIZE_MPW :
+	       MLX5E_PARAMS_DEFAULT_LOG_RQ_SIZE;
+}
+
+static inline u16 mlx5e_default_min_rx_wqes(u8 rq_wq_type)
+{
+	return rq_wq_type == MLX5_WQ_TYPE_STRQ ?
+	       MLX5E_PARAMS_DEFAULT_MIN_RX_WQES_MPW :
+	       MLX5E_PARAMS_DEFAULT_MIN_RX_WQES;
+}
+void mlx5e_handle_rx_cqe(struct mlx5e_rq *rq, struct mlx5_cqe64 *cqe,
+			 struct bpf_prog *prog, struct xdp_capture *cap);
+void mlx5e_handle_rx_cqe_mpwrq(struct mlx5e_rq *rq, struct mlx5_cqe64 *cqe,
+			       struct bpf_prog *prog, struct xdp_capture *cap);
+int mlx5e_alloc_rx_wqe(struct mlx5e_rq *rq, struct mlx5e_rx_wqe *wqe, u16 ix);
+int mlx5e_alloc_rx_mpwqe(struct mlx5e_rq *rq, struct mlx5e_rx_wqe *wqe,
+			 u16 ix);
+void mlx5e_free_rx_mpwqe_cache(struct mlx5e_rq *rq);
 struct mlx5_cqe64 *mlx5e_get_cqe(struct mlx5e_cq *cq);
 
 void mlx5e_update_stats(struct mlx5e_priv *priv);
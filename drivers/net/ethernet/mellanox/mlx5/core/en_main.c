@@ -151,6 +151,8 @@ void mlx5e_update_stats(struct mlx5e_priv *priv)
 	s->rx_csum_none		= 0;
 	s->rx_csum_sw		= 0;
 	s->rx_wqe_err		= 0;
+	s->rx_xdp_drop		= 0;
+	s->rx_xdp_tx		= 0;
 	for (i = 0; i < priv->params.num_channels; i++) {
 		rq_stats = &priv->channel[i]->rq.stats;
 
@@ -159,6 +161,8 @@ void mlx5e_update_stats(struct mlx5e_priv *priv)
 		s->rx_csum_none	+= rq_stats->csum_none;
 		s->rx_csum_sw	+= rq_stats->csum_sw;
 		s->rx_wqe_err   += rq_stats->wqe_err;
+		s->rx_xdp_drop	+= rq_stats->xdp_drop;
+		s->rx_xdp_tx	+= rq_stats->xdp_tx;
 
 		for (j = 0; j < priv->params.num_tc; j++) {
 			sq_stats = &priv->channel[i]->sq[j].stats;
@@ -314,6 +318,7 @@ static int mlx5e_create_rq(struct mlx5e_channel *c,
 	struct mlx5_core_dev *mdev = priv->mdev;
 	void *rqc = param->rqc;
 	void *rqc_wq = MLX5_ADDR_OF(rqc, rqc, wq);
+	u32 byte_count;
 	int wq_sz;
 	int err;
 	int i;
@@ -328,24 +333,44 @@ static int mlx5e_create_rq(struct mlx5e_channel *c,
 	rq->wq.db = &rq->wq.db[MLX5_RCV_DBR];
 
 	wq_sz = mlx5_wq_ll_get_size(&rq->wq);
-	rq->skb = kzalloc_node(wq_sz * sizeof(*rq->skb), GFP_KERNEL,
-			       cpu_to_node(c->cpu));
-	if (!rq->skb) {
-		err = -ENOMEM;
-		goto err_rq_wq_destroy;
-	}
 
-	rq->wqe_sz = (priv->params.lro_en) ? priv->params.lro_wqe_sz :
-					     MLX5E_SW2HW_MTU(priv->netdev->mtu);
-	rq->wqe_sz = SKB_DATA_ALIGN(rq->wqe_sz + MLX5E_NET_IP_ALIGN);
+	switch (priv->params.rq_wq_type) {
+	case MLX5_WQ_TYPE_STRQ:
+		rq->wqe_info = kzalloc_node(wq_sz * sizeof(*rq->wqe_info),
+					    GFP_KERNEL, cpu_to_node(c->cpu));
+		if (!rq->wqe_info) {
+			err = -ENOMEM;
+			goto err_rq_wq_destroy;
+		}
+
+		rq->handle_rx_cqe = mlx5e_handle_rx_cqe_mpwrq;
+		rq->alloc_wqe     = mlx5e_alloc_rx_mpwqe;
+		rq->wqe_sz        = MLX5_MPWRQ_WQE_SZ;
+		byte_count        = rq->wqe_sz;
+		break;
+	default: /* MLX5_WQ_TYPE_LINKED_LIST */
+		rq->skb = kzalloc_node(wq_sz * sizeof(*rq->skb), GFP_KERNEL,
+				       cpu_to_node(c->cpu));
+		if (!rq->skb) {
+			err = -ENOMEM;
+			goto err_rq_wq_destroy;
+		}
+
+		rq->handle_rx_cqe = mlx5e_handle_rx_cqe;
+		rq->alloc_wqe     = mlx5e_alloc_rx_wqe;
+		rq->wqe_sz = (priv->params.lro_en) ?
+			     priv->params.lro_wqe_sz :
+			     MLX5E_SW2HW_MTU(priv->netdev->mtu);
+		rq->wqe_sz = SKB_DATA_ALIGN(rq->wqe_sz + MLX5E_NET_IP_ALIGN);
+		byte_count = rq->wqe_sz - MLX5E_NET_IP_ALIGN;
+		byte_count |= MLX5_HW_START_PADDING;
+	}
 
 	for (i = 0; i < wq_sz; i++) {
 		struct mlx5e_rx_wqe *wqe = mlx5_wq_ll_get_wqe(&rq->wq, i);
-		u32 byte_count = rq->wqe_sz - MLX5E_NET_IP_ALIGN;
 
 		wqe->data.lkey       = c->mkey_be;
-		wqe->data.byte_count =
-			cpu_to_be32(byte_count | MLX5_HW_START_PADDING);
+		wqe->data.byte_count = cpu_to_be32(byte_count);
 	}
 
 	rq->pdev    = c->pdev;
@@ -364,6 +389,7 @@ err_rq_wq_destroy:
 
 static void mlx5e_destroy_rq(struct mlx5e_rq *rq)
 {
+	kfree(rq->wqe_info);
 	kfree(rq->skb);
 	mlx5_wq_destroy(&rq->wq_ctrl);
 }
@@ -457,6 +483,18 @@ static int mlx5e_wait_for_min_rx_wqes(struct mlx5e_rq *rq)
 	return -ETIMEDOUT;
 }
 
+static void mlx5e_rx_am_work(struct work_struct *work)
+{
+	struct dim *dim = container_of(work, struct dim, work);
+	struct mlx5e_rq *rq = container_of(dim, struct mlx5e_rq, dim);
+	struct dim_cq_moder moder = net_dim_get_rx_moderation(dim->profile_ix);
+
+	mlx5_core_modify_cq_moderation(rq->priv->mdev, &rq->cq.mcq,
+				       moder.usec, moder.pkts);
+
+	dim->state = DIM_START_MEASURE;
+}
+
 static int mlx5e_open_rq(struct mlx5e_channel *c,
 			 struct mlx5e_rq_param *param,
 			 struct mlx5e_rq *rq)
@@ -475,6 +513,10 @@ static int mlx5e_open_rq(struct mlx5e_channel *c,
 	if (err)
 		goto err_disable_rq;
 
+	dim_init(&rq->dim, mlx5e_rx_am_work);
+	if (c->priv->params.rx_am_enabled)
+		set_bit(MLX5E_RQ_STATE_AM, &rq->state);
+
 	set_bit(MLX5E_RQ_STATE_POST_WQES_ENABLE, &rq->state);
 	mlx5e_send_nop(&c->sq[0], true); /* trigger mlx5e_post_rx_wqes() */
 
@@ -488,6 +530,25 @@ err_destroy_rq:
 	return err;
 }
 
+/* buffers XDP handed back after mlx5e_post_rx_wqes() was stopped */
+static void mlx5e_free_xdp_rx_skbs(struct mlx5e_rq *rq)
+{
+	int wq_sz = mlx5_wq_ll_get_size(&rq->wq);
+	int i;
+
+	for (i = 0; i < wq_sz; i++) {
+		struct sk_buff *skb = rq->skb[i];
+
+		if (!skb)
+			continue;
+
+		dma_unmap_single(rq->pdev, *((dma_addr_t *)skb->cb),
+				 rq->wqe_sz, DMA_FROM_DEVICE);
+		dev_kfree_skb(skb);
+		rq->skb[i] = NULL;
+	}
+}
+
 static void mlx5e_close_rq(struct mlx5e_rq *rq)
 {
 	clear_bit(MLX5E_RQ_STATE_POST_WQES_ENABLE, &rq->state);
@@ -500,6 +561,13 @@ static void mlx5e_close_rq(struct mlx5e_rq *rq)
 	/* avoid destroying rq before mlx5e_poll_rx_cq() is done with it */
 	napi_synchronize(&rq->channel->napi);
 
+	clear_bit(MLX5E_RQ_STATE_AM, &rq->state);
+	cancel_work_sync(&rq->dim.work);
+
+	if (rq->wqe_info)
+		mlx5e_free_rx_mpwqe_cache(rq);
+	else
+		mlx5e_free_xdp_rx_skbs(rq);
 	mlx5e_disable_rq(rq);
 	mlx5e_destroy_rq(rq);
 }
@@ -964,6 +1032,7 @@ static int mlx5e_open_channel(struct mlx5e_priv *priv, int ix,
 {
 	struct net_device *netdev = priv->netdev;
 	int cpu = mlx5e_get_cpu(priv, ix);
+	struct dim_cq_moder rx_moder;
 	struct mlx5e_channel *c;
 	int err;
 
@@ -987,9 +1056,13 @@ static int mlx5e_open_channel(struct mlx5e_priv *priv, int ix,
 	if (err)
 		goto err_napi_del;
 
+	rx_moder.usec = priv->params.rx_cq_moderation_usec;
+	rx_moder.pkts = priv->params.rx_cq_moderation_pkts;
+	if (priv->params.rx_am_enabled)
+		rx_moder = net_dim_get_def_rx_moderation();
+
 	err = mlx5e_open_cq(c, &cparam->rx_cq, &c->rq.cq,
-			    priv->params.rx_cq_moderation_usec,
-			    priv->params.rx_cq_moderation_pkts);
+			    rx_moder.usec, rx_moder.pkts);
 	if (err)
 		goto err_close_tx_cqs;
 
@@ -1042,7 +1115,14 @@ static void mlx5e_build_rq_param(struct mlx5e_priv *priv,
 	void *rqc = param->rqc;
 	void *wq = MLX5_ADDR_OF(rqc, rqc, wq);
 
-	MLX5_SET(wq, wq, wq_type,          MLX5_WQ_TYPE_LINKED_LIST);
+	if (priv->params.rq_wq_type == MLX5_WQ_TYPE_STRQ) {
+		MLX5_SET(wq, wq, log_wqe_num_of_strides,
+			 MLX5_MPWRQ_LOG_NUM_STRIDES - 9);
+		MLX5_SET(wq, wq, log_wqe_stride_size,
+			 MLX5_MPWRQ_LOG_STRIDE_SIZE - 6);
+	}
+
+	MLX5_SET(wq, wq, wq_type,          priv->params.rq_wq_type);
 	MLX5_SET(wq, wq, end_padding_mode, MLX5_WQ_END_PAD_MODE_ALIGN);
 	MLX5_SET(wq, wq, log_wq_stride,    ilog2(sizeof(struct mlx5e_rx_wqe)));
 	MLX5_SET(wq, wq, log_wq_sz,        priv->params.log_rq_size);
@@ -1078,8 +1158,13 @@ static void mlx5e_build_rx_cq_param(struct mlx5e_priv *priv,
 				    struct mlx5e_cq_param *param)
 {
 	void *cqc = param->cqc;
+	u8 log_cq_size = priv->params.log_rq_size;
 
-	MLX5_SET(cqc, cqc, log_cq_size,  priv->params.log_rq_size);
+	/* a striding RQ WQE completes a packet per stride at worst */
+	if (priv->params.rq_wq_type == MLX5_WQ_TYPE_STRQ)
+		log_cq_size += MLX5_MPWRQ_LOG_NUM_STRIDES;
+
+	MLX5_SET(cqc, cqc, log_cq_size,  log_cq_size);
 
 	mlx5e_build_common_cq_param(priv, param);
 }
@@ -1863,6 +1948,14 @@ static int mlx5e_set_features(struct net_device *netdev,
 	int err = 0;
 	netdev_features_t changes = features ^ netdev->features;
 
+	/* both this and mlx5e_xdp() run under rtnl */
+	if ((changes & NETIF_F_LRO) && (features & NETIF_F_LRO) &&
+	    (rcu_access_pointer(priv->xdp_prog) ||
+	     netdev_has_xdp_capture(netdev))) {
+		netdev_warn(netdev, "LRO can't be used with XDP\n");
+		return -EINVAL;
+	}
+
 	mutex_lock(&priv->state_lock);
 
 	if (changes & NETIF_F_LRO) {
@@ -1931,6 +2024,59 @@ static int mlx5e_change_mtu(struct net_device *netdev, int new_mtu)
 	return err;
 }
 
+/*
+ * Every frame has to fit the buffer of one rx WQE, which only holds with
+ * LRO off.  The rings run on, picking the new program up on their next
+ * poll.
+ */
+static int mlx5e_xdp_set(struct net_device *netdev, struct bpf_prog *prog)
+{
+	struct mlx5e_priv *priv = netdev_priv(netdev);
+	struct bpf_prog *old_prog;
+
+	mutex_lock(&priv->state_lock);
+
+	if (prog && priv->params.lro_en) {
+		mutex_unlock(&priv->state_lock);
+		netdev_warn(netdev, "can't set XDP while LRO is on, disable LRO first\n");
+		return -EINVAL;
+	}
+
+	old_prog = rcu_dereference_protected(priv->xdp_prog,
+					     lockdep_is_held(&priv->state_lock));
+	rcu_assign_pointer(priv->xdp_prog, prog);
+
+	mutex_unlock(&priv->state_lock);
+
+	if (old_prog)
+		bpf_prog_put_rcu(old_prog);
+
+	return 0;
+}
+
+static int mlx5e_xdp(struct net_device *netdev, struct netdev_xdp *xdp)
+{
+	struct mlx5e_priv *priv = netdev_priv(netdev);
+
+	switch (xdp->command) {
+	case XDP_SETUP_PROG:
+		return mlx5e_xdp_set(netdev, xdp->prog);
+	case XDP_QUERY_PROG:
+		xdp->prog_attached = !!rcu_access_pointer(priv->xdp_prog);
+		return 0;
+	case XDP_SETUP_CAPTURE:
+		if (xdp->queue >= priv->params.num_channels)
+			return -EINVAL;
+		if (priv->params.lro_en) {
+			netdev_warn(netdev, "can't capture while LRO is on, disable LRO first\n");
+			return -EINVAL;
+		}
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 static struct net_device_ops mlx5e_netdev_ops = {
 	.ndo_open                = mlx5e_open,
 	.ndo_stop                = mlx5e_close,
@@ -1942,6 +2088,7 @@ static struct net_device_ops mlx5e_netdev_ops = {
 	.ndo_vlan_rx_kill_vid	 = mlx5e_vlan_rx_kill_vid,
 	.ndo_set_features        = mlx5e_set_features,
 	.ndo_change_mtu		 = mlx5e_change_mtu,
+	.ndo_xdp		 = mlx5e_xdp,
 };
 
 static int mlx5e_check_required_hca_cap(struct mlx5_core_dev *mdev)
@@ -1985,19 +2132,22 @@ static void mlx5e_build_netdev_priv(struct mlx5_core_dev *mdev,
 
 	priv->params.log_sq_size           =
 		MLX5E_PARAMS_DEFAULT_LOG_SQ_SIZE;
+	priv->params.rq_wq_type            = MLX5_CAP_GEN(mdev, striding_rq) ?
+		MLX5_WQ_TYPE_STRQ : MLX5_WQ_TYPE_LINKED_LIST;
 	priv->params.log_rq_size           =
-		MLX5E_PARAMS_DEFAULT_LOG_RQ_SIZE;
+		mlx5e_default_log_rq_size(priv->params.rq_wq_type);
 	priv->params.rx_cq_moderation_usec =
 		MLX5E_PARAMS_DEFAULT_RX_CQ_MODERATION_USEC;
 	priv->params.rx_cq_moderation_pkts =
 		MLX5E_PARAMS_DEFAULT_RX_CQ_MODERATION_PKTS;
+	priv->params.rx_am_enabled         = true;
 	priv->params.tx_cq_moderation_usec =
 		MLX5E_PARAMS_DEFAULT_TX_CQ_MODERATION_USEC;
 	priv->params.tx_cq_moderation_pkts =
 		MLX5E_PARAMS_DEFAULT_TX_CQ_MODERATION_PKTS;
 	priv->params.tx_max_inline         = mlx5e_get_max_inline_cap(mdev);
 	priv->params.min_rx_wqes           =
-		MLX5E_PARAMS_DEFAULT_MIN_RX_WQES;
+		mlx5e_default_min_rx_wqes(priv->params.rq_wq_type);
 	priv->params.num_tc                = 1;
 	priv->params.default_vlan_prio     = 0;
 	priv->params.rss_hfunc             = ETH_RSS_HASH_XOR;
@@ -2235,6 +2385,7 @@ static void mlx5e_destroy_netdev(struct mlx5_core_dev *mdev, void *vpriv)
 {
 	struct mlx5e_priv *priv = vpriv;
 	struct net_device *netdev = priv->netdev;
+	struct bpf_prog *xdp_prog;
 
 	set_bit(MLX5E_STATE_DESTROYING, &priv->state);
 
@@ -2242,6 +2393,9 @@ static void mlx5e_destroy_netdev(struct mlx5_core_dev *mdev, void *vpriv)
 	mlx5e_disable_async_events(priv);
 	flush_scheduled_work();
 	unregister_netdev(netdev);
+	xdp_prog = rcu_dereference_protected(priv->xdp_prog, 1);
+	if (xdp_prog)
+		bpf_prog_put_rcu(xdp_prog);
 	mlx5e_destroy_flow_tables(priv);
 	mlx5e_destroy_tirs(priv);
 	mlx5e_destroy_rqt(priv, MLX5E_SINGLE_RQ_RQT);
@@ -35,12 +35,15 @@
 #include <linux/tcp.h>
 #include "en.h"
 
-static inline int mlx5e_alloc_rx_wqe(struct mlx5e_rq *rq,
-				     struct mlx5e_rx_wqe *wqe, u16 ix)
+int mlx5e_alloc_rx_wqe(struct mlx5e_rq *rq, struct mlx5e_rx_wqe *wqe, u16 ix)
 {
 	struct sk_buff *skb;
 	dma_addr_t dma_addr;
 
+	/* a buffer XDP was done with is still mapped, the WQE points at it */
+	if (rq->skb[ix])
+		return 0;
+
 	skb = netdev_alloc_skb(rq->netdev, rq->wqe_sz);
 	if (unlikely(!skb))
 		return -ENOMEM;
@@ -70,6 +73,129 @@ err_free_skb:
 	return -ENOMEM;
 }
 
+static inline bool mlx5e_mpwqe_cache_put(struct mlx5e_rq *rq,
+					 struct mlx5e_dma_info *dma_info)
+{
+	struct mlx5e_mpwqe_cache *cache = &rq->mpwqe_cache;
+	u32 tail_next = (cache->tail + 1) & (MLX5E_MPWQE_CACHE_SIZE - 1);
+
+	if (tail_next == cache->head)
+		return false;
+
+	/* emergency reserves go back where they came from */
+	if (unlikely(page_is_pfmemalloc(dma_info->page)))
+		return false;
+
+	cache->buf[cache->tail] = *dma_info;
+	cache->tail = tail_next;
+	return true;
+}
+
+static inline bool mlx5e_mpwqe_cache_get(struct mlx5e_rq *rq,
+					 struct mlx5e_dma_info *dma_info)
+{
+	struct mlx5e_mpwqe_cache *cache = &rq->mpwqe_cache;
+	struct page *page;
+	int i;
+
+	if (cache->head == cache->tail)
+		return false;
+
+	/* the oldest buffer is the likeliest to be back, don't look further */
+	page = cache->buf[cache->head].page;
+	for (i = 0; i < MLX5_MPWRQ_PAGES_PER_WQE; i++) {
+		if (page_count(&page[i]) != 1) {
+			rq->stats.cache_busy++;
+			return false;
+		}
+	}
+
+	*dma_info = cache->buf[cache->head];
+	cache->head = (cache->head + 1) & (MLX5E_MPWQE_CACHE_SIZE - 1);
+	rq->stats.cache_reuse++;
+
+	dma_sync_single_for_device(rq->pdev, dma_info->addr, MLX5_MPWRQ_WQE_SZ,
+				   DMA_FROM_DEVICE);
+	return true;
+}
+
+static void mlx5e_mpwqe_release(struct mlx5e_rq *rq,
+				struct mlx5e_dma_info *dma_info)
+{
+	int i;
+
+	dma_unmap_page(rq->pdev, dma_info->addr, MLX5_MPWRQ_WQE_SZ,
+		       DMA_FROM_DEVICE);
+	for (i = 0; i < MLX5_MPWRQ_PAGES_PER_WQE; i++)
+		put_page(&dma_info->page[i]);
+}
+
+void mlx5e_free_rx_mpwqe_cache(struct mlx5e_rq *rq)
+{
+	struct mlx5e_mpwqe_cache *cache = &rq->mpwqe_cache;
+
+	while (cache->head != cache->tail) {
+		mlx5e_mpwqe_release(rq, &cache->buf[cache->head]);
+		cache->head = (cache->head + 1) & (MLX5E_MPWQE_CACHE_SIZE - 1);
+	}
+}
+
+int mlx5e_alloc_rx_mpwqe(struct mlx5e_rq *rq, struct mlx5e_rx_wqe *wqe, u16 ix)
+{
+	struct mlx5e_mpw_info *wi = &rq->wqe_info[ix];
+	struct page *page;
+	dma_addr_t addr;
+	int i;
+
+	if (!mlx5e_mpwqe_cache_get(rq, &wi->dma_info)) {
+		page = alloc_pages_node(NUMA_NO_NODE, GFP_ATOMIC | __GFP_COLD |
+					__GFP_NOWARN,
+					MLX5_MPWRQ_WQE_PAGE_ORDER);
+		if (unlikely(!page)) {
+			rq->stats.buff_alloc_err++;
+			return -ENOMEM;
+		}
+
+		addr = dma_map_page(rq->pdev, page, 0, MLX5_MPWRQ_WQE_SZ,
+				    DMA_FROM_DEVICE);
+		if (unlikely(dma_mapping_error(rq->pdev, addr))) {
+			__free_pages(page, MLX5_MPWRQ_WQE_PAGE_ORDER);
+			rq->stats.buff_alloc_err++;
+			return -ENOMEM;
+		}
+
+		/* skbs take and drop the pages one by one */
+		split_page(page, MLX5_MPWRQ_WQE_PAGE_ORDER);
+		wi->dma_info.page = page;
+		wi->dma_info.addr = addr;
+	}
+
+	page = wi->dma_info.page;
+	for (i = 0; i < MLX5_MPWRQ_PAGES_PER_WQE; i++) {
+		atomic_add(MLX5_MPWRQ_STRIDES_PER_PAGE, &page[i]._count);
+		wi->skbs_frags[i] = 0;
+	}
+	wi->consumed_strides = 0;
+
+	wqe->data.addr = cpu_to_be64(wi->dma_info.addr);
+
+	return 0;
+}
+
+static void mlx5e_free_rx_mpwqe(struct mlx5e_rq *rq, struct mlx5e_mpw_info *wi)
+{
+	struct page *page = wi->dma_info.page;
+	int i;
+
+	/* whatever the skbs didn't take, ours is still there after this */
+	for (i = 0; i < MLX5_MPWRQ_PAGES_PER_WQE; i++)
+		atomic_sub(MLX5_MPWRQ_STRIDES_PER_PAGE - wi->skbs_frags[i],
+			   &page[i]._count);
+
+	if (!mlx5e_mpwqe_cache_put(rq, &wi->dma_info))
+		mlx5e_mpwqe_release(rq, &wi->dma_info);
+}
+
 bool mlx5e_post_rx_wqes(struct mlx5e_rq *rq)
 {
 	struct mlx5_wq_ll *wq = &rq->wq;
@@ -80,7 +206,7 @@ bool mlx5e_post_rx_wqes(struct mlx5e_rq *rq)
 	while (!mlx5_wq_ll_is_full(wq)) {
 		struct mlx5e_rx_wqe *wqe = mlx5_wq_ll_get_wqe(wq, wq->head);
 
-		if (unlikely(mlx5e_alloc_rx_wqe(rq, wqe, wq->head)))
+		if (unlikely(rq->alloc_wqe(rq, wqe, wq->head)))
 			break;
 
 		mlx5_wq_ll_push(wq, be16_to_cpu(wqe->next.next_wqe_index));
@@ -94,7 +220,8 @@ bool mlx5e_post_rx_wqes(struct mlx5e_rq *rq)
 	return !mlx5_wq_ll_is_full(wq);
 }
 
-static void mlx5e_lro_update_hdr(struct sk_buff *skb, struct mlx5_cqe64 *cqe)
+static void mlx5e_lro_update_hdr(struct sk_buff *skb, struct mlx5_cqe64 *cqe,
+				 u32 cqe_bcnt)
 {
 	struct ethhdr	*eth	= (struct ethhdr *)(skb->data);
 	struct iphdr	*ipv4	= (struct iphdr *)(skb->data + ETH_HLEN);
@@ -105,7 +232,7 @@ static void mlx5e_lro_update_hdr(struct sk_buff *skb, struct mlx5_cqe64 *cqe)
 	int tcp_ack = ((CQE_L4_HDR_TYPE_TCP_ACK_NO_DATA  == l4_hdr_type) ||
 		       (CQE_L4_HDR_TYPE_TCP_ACK_AND_DATA == l4_hdr_type));
 
-	u16 tot_len = be32_to_cpu(cqe->byte_cnt) - ETH_HLEN;
+	u16 tot_len = cqe_bcnt - ETH_HLEN;
 
 	if (eth->h_proto == htons(ETH_P_IP)) {
 		tcp = (struct tcphdr *)(skb->data + ETH_HLEN +
@@ -184,18 +311,16 @@ csum_none:
 }
 
 static inline void mlx5e_build_rx_skb(struct mlx5_cqe64 *cqe,
+				      u32 cqe_bcnt,
 				      struct mlx5e_rq *rq,
 				      struct sk_buff *skb)
 {
 	struct net_device *netdev = rq->netdev;
-	u32 cqe_bcnt = be32_to_cpu(cqe->byte_cnt);
 	int lro_num_seg;
 
-	skb_put(skb, cqe_bcnt);
-
 	lro_num_seg = be32_to_cpu(cqe->srqn) >> 24;
 	if (lro_num_seg > 1) {
-		mlx5e_lro_update_hdr(skb, cqe);
+		mlx5e_lro_update_hdr(skb, cqe, cqe_bcnt);
 		skb_shinfo(skb)->gso_size = DIV_ROUND_UP(cqe_bcnt, lro_num_seg);
 		rq->stats.lro_packets++;
 		rq->stats.lro_bytes += cqe_bcnt;
@@ -215,21 +340,215 @@ static inline void mlx5e_build_rx_skb(struct mlx5_cqe64 *cqe,
 				       be16_to_cpu(cqe->vlan_info));
 }
 
+/*
+ * Run the XDP program and/or the capture consumer of the queue on a
+ * received frame, before an skb is made of it.  Returns true if either
+ * consumed the frame, the buffer is the driver's again then.
+ */
+static inline bool mlx5e_xdp_run(struct mlx5e_rq *rq,
+				 struct bpf_prog *prog,
+				 struct xdp_capture *cap,
+				 void *data, u32 len)
+{
+	struct xdp_buff xdp;
+	u32 act;
+
+	xdp_init_buff(&xdp, rq->netdev, data, len, rq->ix);
+	act = xdp_rx(prog, cap, &xdp);
+
+	switch (act) {
+	case XDP_PASS:
+		return false;
+	case XDP_TX:
+	case XDP_REDIRECT:
+		if (likely(!xdp_do_xmit(&xdp, act))) {
+			rq->stats.xdp_tx++;
+			break;
+		}
+		/* fall through */
+	default:
+		/* XDP_ABORTED, XDP_DROP and verdicts we don't know */
+		rq->stats.xdp_drop++;
+		break;
+	}
+
+	return true;
+}
+
+/*
+ * A consumed buffer stays in rq->skb[] and mlx5e_alloc_rx_wqe() posts it
+ * again as it is.
+ */
+static inline bool mlx5e_xdp_handle(struct mlx5e_rq *rq,
+				    struct bpf_prog *prog,
+				    struct xdp_capture *cap,
+				    struct mlx5_cqe64 *cqe,
+				    struct sk_buff *skb)
+{
+	dma_addr_t dma_addr = *((dma_addr_t *)skb->cb);
+
+	dma_sync_single_for_cpu(rq->pdev, dma_addr, rq->wqe_sz,
+				DMA_FROM_DEVICE);
+
+	if (!mlx5e_xdp_run(rq, prog, cap, skb->data,
+			   be32_to_cpu(cqe->byte_cnt)))
+		return false;
+
+	dma_sync_single_for_device(rq->pdev, dma_addr, rq->wqe_sz,
+				   DMA_FROM_DEVICE);
+	return true;
+}
+
+void mlx5e_handle_rx_cqe(struct mlx5e_rq *rq, struct mlx5_cqe64 *cqe,
+			 struct bpf_prog *prog, struct xdp_capture *cap)
+{
+	struct mlx5e_rx_wqe *wqe;
+	struct sk_buff *skb;
+	__be16 wqe_counter_be;
+	u16 wqe_counter;
+	u32 cqe_bcnt;
+
+	wqe_counter_be = cqe->wqe_counter;
+	wqe_counter    = be16_to_cpu(wqe_counter_be);
+	wqe            = mlx5_wq_ll_get_wqe(&rq->wq, wqe_counter);
+	skb            = rq->skb[wqe_counter];
+	prefetch(skb->data);
+
+	if ((prog || cap) &&
+	    likely((cqe->op_own >> 4) == MLX5_CQE_RESP_SEND) &&
+	    mlx5e_xdp_handle(rq, prog, cap, cqe, skb))
+		goto wq_ll_pop;
+
+	rq->skb[wqe_counter] = NULL;
+
+	dma_unmap_single(rq->pdev,
+			 *((dma_addr_t *)skb->cb),
+			 rq->wqe_sz,
+			 DMA_FROM_DEVICE);
+
+	if (unlikely((cqe->op_own >> 4) != MLX5_CQE_RESP_SEND)) {
+		rq->stats.wqe_err++;
+		dev_kfree_skb(skb);
+		goto wq_ll_pop;
+	}
+
+	cqe_bcnt = be32_to_cpu(cqe->byte_cnt);
+	skb_put(skb, cqe_bcnt);
+	mlx5e_build_rx_skb(cqe, cqe_bcnt, rq, skb);
+	rq->stats.packets++;
+	rq->stats.bytes += cqe_bcnt;
+	napi_gro_receive(rq->cq.napi, skb);
+
+wq_ll_pop:
+	mlx5_wq_ll_pop(&rq->wq, wqe_counter_be,
+		       &wqe->next.next_wqe_index);
+}
+
+/*
+ * Small packets are copied whole, the headers of bigger ones are copied
+ * and the rest is attached page by page.
+ */
+static inline void mlx5e_add_mpwqe_frags(struct mlx5e_mpw_info *wi,
+					 struct sk_buff *skb,
+					 void *va, u32 offset, u32 len)
+{
+	u32 headlen = min_t(u32, MLX5_MPWRQ_SMALL_PACKET_THRESHOLD, len);
+
+	memcpy(skb_put(skb, headlen), va, headlen);
+	offset += headlen;
+	len    -= headlen;
+
+	while (len) {
+		u32 page_idx = offset >> PAGE_SHIFT;
+		u32 page_off = offset & (PAGE_SIZE - 1);
+		u32 frag_len = min_t(u32, PAGE_SIZE - page_off, len);
+
+		skb_add_rx_frag(skb, skb_shinfo(skb)->nr_frags,
+				&wi->dma_info.page[page_idx], page_off,
+				frag_len, ALIGN(frag_len,
+						MLX5_MPWRQ_STRIDE_SIZE));
+		wi->skbs_frags[page_idx]++;
+		offset += frag_len;
+		len    -= frag_len;
+	}
+}
+
+void mlx5e_handle_rx_cqe_mpwrq(struct mlx5e_rq *rq, struct mlx5_cqe64 *cqe,
+			       struct bpf_prog *prog, struct xdp_capture *cap)
+{
+	u16 wqe_id = be16_to_cpu(cqe->wqe_counter);
+	struct mlx5e_mpw_info *wi = &rq->wqe_info[wqe_id];
+	struct mlx5e_rx_wqe *wqe = mlx5_wq_ll_get_wqe(&rq->wq, wqe_id);
+	struct sk_buff *skb;
+	u32 offset;
+	u32 cqe_bcnt;
+	void *va;
+
+	if (unlikely((cqe->op_own >> 4) != MLX5_CQE_RESP_SEND)) {
+		/* the WQE is flushed, or no good to the HW anymore */
+		rq->stats.wqe_err++;
+		wi->consumed_strides = MLX5_MPWRQ_NUM_STRIDES;
+		goto mpwrq_cqe_out;
+	}
+
+	wi->consumed_strides += mpwrq_get_cqe_consumed_strides(cqe);
+
+	if (unlikely(mpwrq_is_filler_cqe(cqe))) {
+		rq->stats.mpwqe_filler++;
+		goto mpwrq_cqe_out;
+	}
+
+	offset   = mpwrq_get_cqe_stride_index(cqe) << MLX5_MPWRQ_LOG_STRIDE_SIZE;
+	cqe_bcnt = mpwrq_get_cqe_byte_cnt(cqe);
+	va       = page_address(wi->dma_info.page) + offset;
+
+	dma_sync_single_range_for_cpu(rq->pdev, wi->dma_info.addr, offset,
+				      cqe_bcnt, DMA_FROM_DEVICE);
+	prefetch(va);
+
+	/* the strides aren't posted again before the whole WQE is consumed */
+	if ((prog || cap) && mlx5e_xdp_run(rq, prog, cap, va, cqe_bcnt))
+		goto mpwrq_cqe_out;
+
+	skb = napi_alloc_skb(rq->cq.napi,
+			     ALIGN(MLX5_MPWRQ_SMALL_PACKET_THRESHOLD,
+				   sizeof(long)));
+	if (unlikely(!skb)) {
+		rq->stats.buff_alloc_err++;
+		goto mpwrq_cqe_out;
+	}
+
+	mlx5e_add_mpwqe_frags(wi, skb, va, offset, cqe_bcnt);
+	mlx5e_build_rx_skb(cqe, cqe_bcnt, rq, skb);
+	rq->stats.packets++;
+	rq->stats.bytes += cqe_bcnt;
+	napi_gro_receive(rq->cq.napi, skb);
+
+mpwrq_cqe_out:
+	if (likely(wi->consumed_strides < MLX5_MPWRQ_NUM_STRIDES))
+		return;
+
+	mlx5e_free_rx_mpwqe(rq, wi);
+	mlx5_wq_ll_pop(&rq->wq, cqe->wqe_counter, &wqe->next.next_wqe_index);
+}
+
 bool mlx5e_poll_rx_cq(struct mlx5e_cq *cq, int budget)
 {
 	struct mlx5e_rq *rq = container_of(cq, struct mlx5e_rq, cq);
+	struct bpf_prog *xdp_prog;
+	struct xdp_capture *cap;
 	int i;
 
 	/* avoid accessing cq (dma coherent memory) if not needed */
 	if (!test_and_clear_bit(MLX5E_CQ_HAS_CQES, &cq->flags))
 		return false;
 
+	rcu_read_lock();
+	xdp_prog = rcu_dereference(rq->priv->xdp_prog);
+	cap = xdp_capture_lookup(rq->netdev, rq->ix);
+
 	for (i = 0; i < budget; i++) {
-		struct mlx5e_rx_wqe *wqe;
 		struct mlx5_cqe64 *cqe;
-		struct sk_buff *skb;
-		__be16 wqe_counter_be;
-		u16 wqe_counter;
 
 		cqe = mlx5e_get_cqe(cq);
 		if (!cqe)
@@ -237,33 +556,11 @@ bool mlx5e_poll_rx_cq(struct mlx5e_cq *cq, int budget)
 
 		mlx5_cqwq_pop(&cq->wq);
 
-		wqe_counter_be = cqe->wqe_counter;
-		wqe_counter    = be16_to_cpu(wqe_counter_be);
-		wqe            = mlx5_wq_ll_get_wqe(&rq->wq, wqe_counter);
-		skb            = rq->skb[wqe_counter];
-		prefetch(skb->data);
-		rq->skb[wqe_counter] = NULL;
-
-		dma_unmap_single(rq->pdev,
-				 *((dma_addr_t *)skb->cb),
-				 rq->wqe_sz,
-				 DMA_FROM_DEVICE);
-
-		if (unlikely((cqe->op_own >> 4) != MLX5_CQE_RESP_SEND)) {
-			rq->stats.wqe_err++;
-			dev_kfree_skb(skb);
-			goto wq_ll_pop;
-		}
-
-		mlx5e_build_rx_skb(cqe, rq, skb);
-		rq->stats.packets++;
-		napi_gro_receive(cq->napi, skb);
-
-wq_ll_pop:
-		mlx5_wq_ll_pop(&rq->wq, wqe_counter_be,
-			       &wqe->next.next_wqe_index);
+		rq->handle_rx_cqe(rq, cqe, xdp_prog, cap);
 	}
 
+	rcu_read_unlock();
+
 	mlx5_cqwq_update_db_record(&cq->wq);
 
 	/* ensure cq space is freed before enabling more cqes */
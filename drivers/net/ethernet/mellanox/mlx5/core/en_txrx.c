@@ -76,6 +76,14 @@ int mlx5e_napi_poll(struct napi_struct *napi, int budget)
 		return 0;
 	}
 
+	if (test_bit(MLX5E_RQ_STATE_AM, &c->rq.state)) {
+		struct dim_sample sample;
+
+		dim_update_sample(c->rq.cq.event_ctr, c->rq.stats.packets,
+				  c->rq.stats.bytes, &sample);
+		net_dim(&c->rq.dim, sample);
+	}
+
 	for (i = 0; i < c->num_tc; i++)
 		mlx5e_cq_arm(&c->sq[i].cq);
 	mlx5e_cq_arm(&c->rq.cq);
@@ -87,6 +95,7 @@ void mlx5e_completion_event(struct mlx5_core_cq *mcq)
 {
 	struct mlx5e_cq *cq = container_of(mcq, struct mlx5e_cq, mcq);
 
+	cq->event_ctr++;
 	set_bit(MLX5E_CQ_HAS_CQES, &cq->flags);
 	set_bit(MLX5E_CHANNEL_NAPI_SCHED, &cq->channel->flags);
 	barrier();
@@ -26,15 +26,27 @@
 #define MIN_MTU 68		/* Min L3 MTU */
 #define MAX_MTU 65535		/* Max L3 MTU (arbitrary) */
 
+#define VETH_RING_SIZE	256	/* skbs an rx queue holds for its NAPI */
+
 struct pcpu_vstats {
 	u64			packets;
 	u64			bytes;
 	struct u64_stats_sync	syncp;
 };
 
+/* With GRO on, the peer's xmit queues skbs here instead of going
+ * through netif_rx(), and NAPI hands them to GRO in batches.
+ */
+struct veth_rq {
+	struct napi_struct	napi;
+	struct sk_buff_head	queue;
+} ____cacheline_aligned_in_smp;
+
 struct veth_priv {
 	struct net_device __rcu	*peer;
 	atomic64_t		dropped;
+	struct veth_rq		*rq;
+	bool			napi_on;
 };
 
 /*
@@ -105,6 +117,36 @@ static const struct ethtool_ops veth_ethtool_ops = {
 	.get_ethtool_stats	= veth_get_ethtool_stats,
 };
 
+static int veth_forward_skb(struct net_device *rcv, struct sk_buff *skb)
+{
+	struct veth_priv *rcv_priv = netdev_priv(rcv);
+	unsigned int rxq = skb_get_queue_mapping(skb);
+	struct veth_rq *rq;
+
+	if (!READ_ONCE(rcv_priv->napi_on))
+		return dev_forward_skb(rcv, skb);
+
+	if (__dev_forward_skb(rcv, skb) != NET_RX_SUCCESS)
+		return NET_RX_DROP;
+
+	if (unlikely(rxq >= rcv->real_num_rx_queues))
+		rxq %= rcv->real_num_rx_queues;
+	skb_record_rx_queue(skb, rxq);
+	rq = &rcv_priv->rq[rxq];
+
+	spin_lock(&rq->queue.lock);
+	if (unlikely(skb_queue_len(&rq->queue) >= VETH_RING_SIZE)) {
+		spin_unlock(&rq->queue.lock);
+		kfree_skb(skb);
+		return NET_RX_DROP;
+	}
+	__skb_queue_tail(&rq->queue, skb);
+	spin_unlock(&rq->queue.lock);
+
+	napi_schedule(&rq->napi);
+	return NET_RX_SUCCESS;
+}
+
 static netdev_tx_t veth_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct veth_priv *priv = netdev_priv(dev);
@@ -118,7 +160,7 @@ static netdev_tx_t veth_xmit(struct sk_buff *skb, struct net_device *dev)
 		goto drop;
 	}
 
-	if (likely(dev_forward_skb(rcv, skb) == NET_RX_SUCCESS)) {
+	if (likely(veth_forward_skb(rcv, skb) == NET_RX_SUCCESS)) {
 		struct pcpu_vstats *stats = this_cpu_ptr(dev->vstats);
 
 		u64_stats_update_begin(&stats->syncp);
@@ -183,6 +225,66 @@ static struct rtnl_link_stats64 *veth_get_stats64(struct net_device *dev,
 	return tot;
 }
 
+static int veth_poll(struct napi_struct *napi, int budget)
+{
+	struct veth_rq *rq = container_of(napi, struct veth_rq, napi);
+	struct sk_buff_head process_queue;
+	struct sk_buff *skb;
+	int done = 0;
+
+	__skb_queue_head_init(&process_queue);
+
+	spin_lock_bh(&rq->queue.lock);
+	skb_queue_splice_tail_init(&rq->queue, &process_queue);
+	spin_unlock_bh(&rq->queue.lock);
+
+	while (done < budget && (skb = __skb_dequeue(&process_queue))) {
+		napi_gro_receive(napi, skb);
+		done++;
+	}
+
+	if (!skb_queue_empty(&process_queue)) {
+		spin_lock_bh(&rq->queue.lock);
+		skb_queue_splice(&process_queue, &rq->queue);
+		spin_unlock_bh(&rq->queue.lock);
+	}
+
+	if (done < budget) {
+		napi_complete_done(napi, done);
+		/* the peer may have queued more before we completed */
+		if (unlikely(!skb_queue_empty(&rq->queue)) &&
+		    napi_schedule_prep(napi))
+			__napi_schedule(napi);
+	}
+
+	return done;
+}
+
+static void veth_napi_enable(struct net_device *dev)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+	int i;
+
+	for (i = 0; i < dev->real_num_rx_queues; i++)
+		napi_enable(&priv->rq[i].napi);
+	WRITE_ONCE(priv->napi_on, true);
+}
+
+static void veth_napi_disable(struct net_device *dev)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+	int i;
+
+	WRITE_ONCE(priv->napi_on, false);
+	/* the peer's xmit runs under RCU, let it see we're off */
+	synchronize_net();
+
+	for (i = 0; i < dev->real_num_rx_queues; i++) {
+		napi_disable(&priv->rq[i].napi);
+		skb_queue_purge(&priv->rq[i].queue);
+	}
+}
+
 /* fake multicast ability */
 static void veth_set_multicast_list(struct net_device *dev)
 {
@@ -196,6 +298,9 @@ static int veth_open(struct net_device *dev)
 	if (!peer)
 		return -ENOTCONN;
 
+	if (dev->features & NETIF_F_GRO)
+		veth_napi_enable(dev);
+
 	if (peer->flags & IFF_UP) {
 		netif_carrier_on(dev);
 		netif_carrier_on(peer);
@@ -212,6 +317,9 @@ static int veth_close(struct net_device *dev)
 	if (peer)
 		netif_carrier_off(peer);
 
+	if (priv->napi_on)
+		veth_napi_disable(dev);
+
 	return 0;
 }
 
@@ -228,16 +336,57 @@ static int veth_change_mtu(struct net_device *dev, int new_mtu)
 	return 0;
 }
 
+static int veth_set_features(struct net_device *dev,
+			     netdev_features_t features)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+	netdev_features_t changed = features ^ dev->features;
+
+	if (!(changed & NETIF_F_GRO) || !netif_running(dev))
+		return 0;
+
+	if (features & NETIF_F_GRO) {
+		if (!priv->napi_on)
+			veth_napi_enable(dev);
+	} else if (priv->napi_on) {
+		veth_napi_disable(dev);
+	}
+	return 0;
+}
+
 static int veth_dev_init(struct net_device *dev)
 {
+	struct veth_priv *priv = netdev_priv(dev);
+	int i;
+
 	dev->vstats = netdev_alloc_pcpu_stats(struct pcpu_vstats);
 	if (!dev->vstats)
 		return -ENOMEM;
+
+	priv->rq = kcalloc(dev->num_rx_queues, sizeof(*priv->rq), GFP_KERNEL);
+	if (!priv->rq) {
+		free_percpu(dev->vstats);
+		dev->vstats = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < dev->num_rx_queues; i++) {
+		skb_queue_head_init(&priv->rq[i].queue);
+		netif_napi_add(dev, &priv->rq[i].napi, veth_poll,
+			       NAPI_POLL_WEIGHT);
+	}
 	return 0;
 }
 
 static void veth_dev_free(struct net_device *dev)
 {
+	struct veth_priv *priv = netdev_priv(dev);
+	int i;
+
+	if (priv->rq) {
+		for (i = 0; i < dev->num_rx_queues; i++)
+			netif_napi_del(&priv->rq[i].napi);
+		kfree(priv->rq);
+	}
 	free_percpu(dev->vstats);
 	free_netdev(dev);
 }
@@ -280,6 +429,7 @@ static const struct net_device_ops veth_netdev_ops = {
 	.ndo_get_stats64     = veth_get_stats64,
 	.ndo_set_rx_mode     = veth_set_multicast_list,
 	.ndo_set_mac_address = eth_mac_addr,
+	.ndo_set_features    = veth_set_features,
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller	= veth_poll_controller,
 #endif
@@ -338,6 +488,14 @@ static int veth_validate(struct nlattr *tb[], struct nlattr *data[])
 
 static struct rtnl_link_ops veth_link_ops;
 
+/* GRO, and with it NAPI receive, is left for the admin to turn on */
+static void veth_disable_gro(struct net_device *dev)
+{
+	dev->features &= ~NETIF_F_GRO;
+	dev->wanted_features &= ~NETIF_F_GRO;
+	netdev_update_features(dev);
+}
+
 static int veth_newlink(struct net *src_net, struct net_device *dev,
 			 struct nlattr *tb[], struct nlattr *data[])
 {
@@ -406,6 +564,7 @@ static int veth_newlink(struct net *src_net, struct net_device *dev,
 		goto err_register_peer;
 
 	netif_carrier_off(peer);
+	veth_disable_gro(peer);
 
 	err = rtnl_configure_link(peer, ifmp);
 	if (err < 0)
@@ -431,6 +590,7 @@ static int veth_newlink(struct net *src_net, struct net_device *dev,
 		goto err_register_dev;
 
 	netif_carrier_off(dev);
+	veth_disable_gro(dev);
 
 	/*
 	 * tie the deviced together
@@ -27,6 +27,7 @@
 #include <linux/slab.h>
 #include <linux/cpu.h>
 #include <linux/average.h>
+#include <linux/dim.h>
 #include <net/busy_poll.h>
 
 static int napi_weight = NAPI_POLL_WEIGHT;
@@ -50,6 +51,9 @@ DECLARE_EWMA(pkt_len, 1, 64)
 /* Minimum alignment for mergeable packet buffers. */
 #define MERGEABLE_BUFFER_ALIGN max(L1_CACHE_BYTES, 256)
 
+/* Used-up mergeable buffer pages each receive queue keeps for reuse. */
+#define VIRTNET_RX_PAGE_POOL 16
+
 #define VIRTNET_DRIVER_VERSION "1.0.0"
 
 struct virtnet_stats {
@@ -74,6 +78,18 @@ struct send_queue {
 	char name[40];
 };
 
+/*
+ * Pages mergeable buffers were carved from, oldest first, each holding
+ * the reference alloc_frag had on it.  Once the stack has freed every
+ * buffer of the oldest one it is refilled from again instead of a new
+ * page being allocated.
+ */
+struct virtnet_page_pool {
+	unsigned int head;
+	unsigned int count;
+	struct page *pages[VIRTNET_RX_PAGE_POOL];
+};
+
 /* Internal representation of a receive virtqueue */
 struct receive_queue {
 	/* Virtqueue associated with this receive_queue */
@@ -90,9 +106,18 @@ struct receive_queue {
 	/* Page frag for packet buffer allocation. */
 	struct page_frag alloc_frag;
 
+	/* Used-up alloc_frag pages waiting to be recycled. */
+	struct virtnet_page_pool page_pool;
+
 	/* RX: fragments + linear part + virtio header */
 	struct scatterlist sg[MAX_SKB_FRAGS + 2];
 
+	/* Adaptive notification coalescing, and what it samples */
+	struct dim dim;
+	u64 packets;
+	u64 bytes;
+	u16 calls;
+
 	/* Name of this receive queue: input.$index */
 	char name[40];
 };
@@ -141,6 +166,11 @@ struct virtnet_info {
 	/* CPU hot plug notifier */
 	struct notifier_block nb;
 
+	/* The device delays rx notifications for us */
+	bool rx_dim_enabled;
+	u32 rx_usecs;
+	u32 rx_max_packets;
+
 	/* Control VQ buffers: protected by the rtnl lock */
 	struct virtio_net_ctrl_hdr ctrl_hdr;
 	virtio_net_ctrl_ack ctrl_status;
@@ -475,6 +505,9 @@ static void receive_buf(struct virtnet_info *vi, struct receive_queue *rq,
 	stats->rx_packets++;
 	u64_stats_update_end(&stats->rx_syncp);
 
+	rq->bytes += skb->len;
+	rq->packets++;
+
 	if (hdr->hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
 		pr_debug("Needs csum!\n");
 		if (!skb_partial_csum_set(skb,
@@ -616,6 +649,73 @@ static unsigned int get_mergeable_buf_len(struct ewma_pkt_len *avg_pkt_len)
 	return ALIGN(len, MERGEABLE_BUFFER_ALIGN);
 }
 
+static void virtnet_pool_put(struct virtnet_page_pool *pool, struct page *page)
+{
+	if (pool->count == VIRTNET_RX_PAGE_POOL) {
+		put_page(pool->pages[pool->head]);
+		pool->head = (pool->head + 1) % VIRTNET_RX_PAGE_POOL;
+		pool->count--;
+	}
+	pool->pages[(pool->head + pool->count) % VIRTNET_RX_PAGE_POOL] = page;
+	pool->count++;
+}
+
+static struct page *virtnet_pool_get(struct virtnet_page_pool *pool)
+{
+	struct page *page;
+
+	/* The oldest page is the one most likely to be free by now. */
+	if (!pool->count || page_count(pool->pages[pool->head]) != 1)
+		return NULL;
+
+	page = pool->pages[pool->head];
+	pool->head = (pool->head + 1) % VIRTNET_RX_PAGE_POOL;
+	pool->count--;
+	return page;
+}
+
+static void virtnet_pool_free(struct virtnet_page_pool *pool)
+{
+	while (pool->count) {
+		put_page(pool->pages[pool->head]);
+		pool->head = (pool->head + 1) % VIRTNET_RX_PAGE_POOL;
+		pool->count--;
+	}
+}
+
+/*
+ * Like skb_page_frag_refill(), but a page that still has buffers out in
+ * the stack goes to the pool rather than being dropped, and the pool is
+ * tried before the page allocator.
+ */
+static bool virtnet_page_frag_refill(struct receive_queue *rq,
+				     unsigned int len, gfp_t gfp)
+{
+	struct page_frag *pfrag = &rq->alloc_frag;
+	struct page *page;
+
+	if (pfrag->page) {
+		if (page_count(pfrag->page) == 1) {
+			pfrag->offset = 0;
+			return true;
+		}
+		if (pfrag->offset + len <= pfrag->size)
+			return true;
+		virtnet_pool_put(&rq->page_pool, pfrag->page);
+		pfrag->page = NULL;
+	}
+
+	page = virtnet_pool_get(&rq->page_pool);
+	if (page) {
+		pfrag->page = page;
+		pfrag->size = PAGE_SIZE << compound_order(page);
+		pfrag->offset = 0;
+		return true;
+	}
+
+	return skb_page_frag_refill(len, pfrag, gfp);
+}
+
 static int add_recvbuf_mergeable(struct receive_queue *rq, gfp_t gfp)
 {
 	struct page_frag *alloc_frag = &rq->alloc_frag;
@@ -625,7 +725,7 @@ static int add_recvbuf_mergeable(struct receive_queue *rq, gfp_t gfp)
 	unsigned int len, hole;
 
 	len = get_mergeable_buf_len(&rq->mrg_avg_pkt_len);
-	if (unlikely(!skb_page_frag_refill(len, alloc_frag, gfp)))
+	if (unlikely(!virtnet_page_frag_refill(rq, len, gfp)))
 		return -ENOMEM;
 
 	buf = (char *)page_address(alloc_frag->page) + alloc_frag->offset;
@@ -751,16 +851,29 @@ static int virtnet_receive(struct receive_queue *rq, int budget)
 	return received;
 }
 
+static void virtnet_rx_dim_update(struct receive_queue *rq)
+{
+	struct dim_sample sample;
+
+	dim_update_sample(rq->calls, rq->packets, rq->bytes, &sample);
+	net_dim(&rq->dim, sample);
+}
+
 static int virtnet_poll(struct napi_struct *napi, int budget)
 {
 	struct receive_queue *rq =
 		container_of(napi, struct receive_queue, napi);
+	struct virtnet_info *vi = rq->vq->vdev->priv;
 	unsigned int r, received;
 
 	received = virtnet_receive(rq, budget);
+	rq->calls++;
 
 	/* Out of packets? */
 	if (received < budget) {
+		if (vi->rx_dim_enabled)
+			virtnet_rx_dim_update(rq);
+
 		r = virtqueue_enable_cb_prepare(rq->vq);
 		napi_complete_done(napi, received);
 		if (unlikely(virtqueue_poll(rq->vq, r)) &&
@@ -820,6 +933,13 @@ static int virtnet_open(struct net_device *dev)
 			/* Make sure we have some buffers: if oom use wq. */
 			if (!try_fill_recv(vi, &vi->rq[i], GFP_KERNEL))
 				schedule_delayed_work(&vi->refill, 0);
+
+		/* the device starts uncoalesced, get it to dim's profile */
+		if (vi->rx_dim_enabled) {
+			vi->rq[i].dim.state = DIM_APPLY_NEW_PROFILE;
+			schedule_work(&vi->rq[i].dim.work);
+		}
+
 		virtnet_napi_enable(&vi->rq[i]);
 	}
 
@@ -1138,6 +1258,48 @@ static int virtnet_set_queues(struct virtnet_info *vi, u16 queue_pairs)
 	return 0;
 }
 
+static int virtnet_send_rx_coal(struct virtnet_info *vi, int qidx,
+				u32 max_usecs, u32 max_packets)
+{
+	struct scatterlist sg;
+	struct virtio_net_ctrl_coal_vq s;
+
+	s.vqn = cpu_to_le16(rxq2vq(qidx));
+	s.reserved = 0;
+	s.coal.max_usecs = cpu_to_le32(max_usecs);
+	s.coal.max_packets = cpu_to_le32(max_packets);
+	sg_init_one(&sg, &s, sizeof(s));
+
+	if (!virtnet_send_command(vi, VIRTIO_NET_CTRL_NOTF_COAL,
+				  VIRTIO_NET_CTRL_NOTF_COAL_VQ_SET, &sg))
+		return -EINVAL;
+
+	return 0;
+}
+
+static void virtnet_rx_dim_work(struct work_struct *work)
+{
+	struct dim *dim = container_of(work, struct dim, work);
+	struct receive_queue *rq = container_of(dim, struct receive_queue, dim);
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+	struct dim_cq_moder moder;
+
+	/* virtnet_close() cancels us with the rtnl held */
+	if (!rtnl_trylock()) {
+		schedule_work(&dim->work);
+		return;
+	}
+
+	moder = net_dim_get_rx_moderation(dim->profile_ix);
+	if (vi->rx_dim_enabled &&
+	    virtnet_send_rx_coal(vi, rq - vi->rq, moder.usec, moder.pkts))
+		dev_warn(&vi->dev->dev, "Failed to set coalescing of %s\n",
+			 rq->name);
+
+	dim->state = DIM_START_MEASURE;
+	rtnl_unlock();
+}
+
 static int virtnet_close(struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
@@ -1146,8 +1308,10 @@ static int virtnet_close(struct net_device *dev)
 	/* Make sure refill_work doesn't re-enable napi! */
 	cancel_delayed_work_sync(&vi->refill);
 
-	for (i = 0; i < vi->max_queue_pairs; i++)
+	for (i = 0; i < vi->max_queue_pairs; i++) {
 		napi_disable(&vi->rq[i].napi);
+		cancel_work_sync(&vi->rq[i].dim.work);
+	}
 
 	return 0;
 }
@@ -1378,6 +1542,54 @@ static void virtnet_get_channels(struct net_device *dev,
 	channels->other_count = 0;
 }
 
+static int virtnet_get_coalesce(struct net_device *dev,
+				struct ethtool_coalesce *ec)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+
+	if (!virtio_has_feature(vi->vdev, VIRTIO_NET_F_VQ_NOTF_COAL))
+		return -EOPNOTSUPP;
+
+	ec->use_adaptive_rx_coalesce = vi->rx_dim_enabled;
+	ec->rx_coalesce_usecs = vi->rx_usecs;
+	ec->rx_max_coalesced_frames = vi->rx_max_packets;
+
+	return 0;
+}
+
+static int virtnet_set_coalesce(struct net_device *dev,
+				struct ethtool_coalesce *ec)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	struct dim_cq_moder moder;
+	int i, err;
+
+	if (!virtio_has_feature(vi->vdev, VIRTIO_NET_F_VQ_NOTF_COAL))
+		return -EOPNOTSUPP;
+
+	vi->rx_dim_enabled = !!ec->use_adaptive_rx_coalesce;
+	vi->rx_usecs = ec->rx_coalesce_usecs;
+	vi->rx_max_packets = ec->rx_max_coalesced_frames;
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		if (vi->rx_dim_enabled) {
+			/* start over, from the queue's current profile */
+			vi->rq[i].dim.state = DIM_START_MEASURE;
+			moder = net_dim_get_rx_moderation(
+					vi->rq[i].dim.profile_ix);
+			err = virtnet_send_rx_coal(vi, i, moder.usec,
+						   moder.pkts);
+		} else {
+			err = virtnet_send_rx_coal(vi, i, vi->rx_usecs,
+						   vi->rx_max_packets);
+		}
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
 static const struct ethtool_ops virtnet_ethtool_ops = {
 	.get_drvinfo = virtnet_get_drvinfo,
 	.get_link = ethtool_op_get_link,
@@ -1385,6 +1597,8 @@ static const struct ethtool_ops virtnet_ethtool_ops = {
 	.set_channels = virtnet_set_channels,
 	.get_channels = virtnet_get_channels,
 	.get_ts_info = ethtool_op_get_ts_info,
+	.get_coalesce = virtnet_get_coalesce,
+	.set_coalesce = virtnet_set_coalesce,
 };
 
 #define MIN_MTU 68
@@ -1482,9 +1696,11 @@ static void free_receive_bufs(struct virtnet_info *vi)
 static void free_receive_page_frags(struct virtnet_info *vi)
 {
 	int i;
-	for (i = 0; i < vi->max_queue_pairs; i++)
+	for (i = 0; i < vi->max_queue_pairs; i++) {
 		if (vi->rq[i].alloc_frag.page)
 			put_page(vi->rq[i].alloc_frag.page);
+		virtnet_pool_free(&vi->rq[i].page_pool);
+	}
 }
 
 static void free_unused_bufs(struct virtnet_info *vi)
@@ -1620,6 +1836,7 @@ static int virtnet_alloc_queues(struct virtnet_info *vi)
 
 		sg_init_table(vi->rq[i].sg, ARRAY_SIZE(vi->rq[i].sg));
 		ewma_pkt_len_init(&vi->rq[i].mrg_avg_pkt_len);
+		dim_init(&vi->rq[i].dim, virtnet_rx_dim_work);
 		sg_init_table(vi->sq[i].sg, ARRAY_SIZE(vi->sq[i].sg));
 	}
 
@@ -1710,6 +1927,8 @@ static bool virtnet_validate_features(struct virtio_device *vdev)
 			     "VIRTIO_NET_F_CTRL_VQ") ||
 	     VIRTNET_FAIL_ON(vdev, VIRTIO_NET_F_MQ, "VIRTIO_NET_F_CTRL_VQ") ||
 	     VIRTNET_FAIL_ON(vdev, VIRTIO_NET_F_CTRL_MAC_ADDR,
+			     "VIRTIO_NET_F_CTRL_VQ") ||
+	     VIRTNET_FAIL_ON(vdev, VIRTIO_NET_F_VQ_NOTF_COAL,
 			     "VIRTIO_NET_F_CTRL_VQ"))) {
 		return false;
 	}
@@ -1839,6 +2058,9 @@ static int virtnet_probe(struct virtio_device *vdev)
 	if (virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ))
 		vi->has_cvq = true;
 
+	if (virtio_has_feature(vdev, VIRTIO_NET_F_VQ_NOTF_COAL))
+		vi->rx_dim_enabled = true;
+
 	if (vi->any_header_sg)
 		dev->needed_headroom = vi->hdr_len;
 
@@ -1963,8 +2185,10 @@ static int virtnet_freeze(struct virtio_device *vdev)
 	cancel_delayed_work_sync(&vi->refill);
 
 	if (netif_running(vi->dev)) {
-		for (i = 0; i < vi->max_queue_pairs; i++)
+		for (i = 0; i < vi->max_queue_pairs; i++) {
 			napi_disable(&vi->rq[i].napi);
+			cancel_work_sync(&vi->rq[i].dim.work);
+		}
 	}
 
 	remove_vq_common(vi);
@@ -2020,7 +2244,7 @@ static unsigned int features[] = {
 	VIRTIO_NET_F_MRG_RXBUF, VIRTIO_NET_F_STATUS, VIRTIO_NET_F_CTRL_VQ,
 	VIRTIO_NET_F_CTRL_RX, VIRTIO_NET_F_CTRL_VLAN,
 	VIRTIO_NET_F_GUEST_ANNOUNCE, VIRTIO_NET_F_MQ,
-	VIRTIO_NET_F_CTRL_MAC_ADDR,
+	VIRTIO_NET_F_CTRL_MAC_ADDR, VIRTIO_NET_F_VQ_NOTF_COAL,
 	VIRTIO_F_ANY_LAYOUT,
 };
 
@@ -443,7 +443,9 @@ static struct vxlan_fdb *vxlan_find_mac(struct vxlan_dev *vxlan,
 	struct vxlan_fdb *f;
 
 	f = __vxlan_find_mac(vxlan, mac);
-	if (f)
+	/* Every packet gets here; don't dirty the entry more than once per
+	 * jiffy when all CPUs are sending to it. */
+	if (f && f->used != jiffies)
 		f->used = jiffies;
 
 	return f;
@@ -946,6 +948,31 @@ out:
  * and Tunnel endpoint.
  * Return true if packet is bogus and should be dropped.
  */
+/* Point a learned entry at the tunnel endpoint it moved to.  The remote
+ * is swapped rather than written over, so that vxlan_xmit() never sees
+ * half an address.  Caller should hold vxlan->hash_lock.
+ */
+static void vxlan_fdb_migrate(struct vxlan_dev *vxlan, struct vxlan_fdb *f,
+			      union vxlan_addr *src_ip)
+{
+	struct vxlan_rdst *rd, *old;
+
+	old = list_first_entry(&f->remotes, struct vxlan_rdst, list);
+	if (vxlan_addr_equal(&old->remote_ip, src_ip))
+		return;
+
+	rd = kmalloc(sizeof(*rd), GFP_ATOMIC);
+	if (!rd)
+		return;
+	*rd = *old;
+	rd->remote_ip = *src_ip;
+	list_replace_rcu(&old->list, &rd->list);
+	kfree_rcu(old, rcu);
+
+	f->updated = jiffies;
+	vxlan_fdb_notify(vxlan, f, rd, RTM_NEWNEIGH);
+}
+
 static bool vxlan_snoop(struct net_device *dev,
 			union vxlan_addr *src_ip, const u8 *src_mac)
 {
@@ -963,15 +990,25 @@ static bool vxlan_snoop(struct net_device *dev,
 		if (f->state & NUD_NOARP)
 			return true;
 
+		/* A station flapping between endpoints moves at most once
+		 * per jiffy, the packets in between don't take the lock. */
+		if (f->updated == jiffies)
+			return false;
+
 		if (net_ratelimit())
 			netdev_info(dev,
 				    "%pM migrated from %pIS to %pIS\n",
 				    src_mac, &rdst->remote_ip.sa, &src_ip->sa);
 
-		rdst->remote_ip = *src_ip;
-		f->updated = jiffies;
-		vxlan_fdb_notify(vxlan, f, rdst, RTM_NEWNEIGH);
+		spin_lock(&vxlan->hash_lock);
+		vxlan_fdb_migrate(vxlan, f, src_ip);
+		spin_unlock(&vxlan->hash_lock);
 	} else {
+		/* Don't take the lock only to find the table full */
+		if (vxlan->cfg.addrmax &&
+		    READ_ONCE(vxlan->addrcnt) >= vxlan->cfg.addrmax)
+			return false;
+
 		/* learned new entry */
 		spin_lock(&vxlan->hash_lock);
 
@@ -505,12 +505,16 @@ static int btt_maplocks_init(struct arena_info *arena)
 {
 	u32 i;
 
-	arena->map_locks = kcalloc(arena->nfree, sizeof(struct aligned_lock),
+	/*
+	 * Far more locks than lanes, so that writers on different map
+	 * cachelines hardly ever wait on each other.
+	 */
+	arena->map_locks = kcalloc(BTT_MAP_LOCKS, sizeof(struct aligned_lock),
 				GFP_KERNEL);
 	if (!arena->map_locks)
 		return -ENOMEM;
 
-	for (i = 0; i < arena->nfree; i++)
+	for (i = 0; i < BTT_MAP_LOCKS; i++)
 		spin_lock_init(&arena->map_locks[i].lock);
 
 	return 0;
@@ -852,7 +856,8 @@ static int lba_to_arena(struct btt *btt, sector_t sector, __u32 *premap,
 static void lock_map(struct arena_info *arena, u32 premap)
 		__acquires(&arena->map_locks[idx].lock)
 {
-	u32 idx = (premap * MAP_ENT_SIZE / L1_CACHE_BYTES) % arena->nfree;
+	u32 idx = (premap * MAP_ENT_SIZE / L1_CACHE_BYTES) &
+		  (BTT_MAP_LOCKS - 1);
 
 	spin_lock(&arena->map_locks[idx].lock);
 }
@@ -860,7 +865,8 @@ static void lock_map(struct arena_info *arena, u32 premap)
 static void unlock_map(struct arena_info *arena, u32 premap)
 		__releases(&arena->map_locks[idx].lock)
 {
-	u32 idx = (premap * MAP_ENT_SIZE / L1_CACHE_BYTES) % arena->nfree;
+	u32 idx = (premap * MAP_ENT_SIZE / L1_CACHE_BYTES) &
+		  (BTT_MAP_LOCKS - 1);
 
 	spin_unlock(&arena->map_locks[idx].lock);
 }
@@ -33,6 +33,7 @@
 #define RTT_INVALID 0
 #define BTT_PG_SIZE 4096
 #define BTT_DEFAULT_NFREE ND_MAX_LANES
+#define BTT_MAP_LOCKS 1024	/* a power of two */
 #define LOG_SEQ_INIT 1
 
 #define IB_FLAG_ERROR 0x00000001
@@ -112,7 +113,8 @@ struct aligned_lock {
  * @info2off:		Offset in bytes to the backup info block of this arena.
  * @freelist:		Pointer to in-memory list of free blocks
  * @rtt:		Pointer to in-memory "Read Tracking Table"
- * @map_locks:		Spinlocks protecting concurrent map writes
+ * @map_locks:		Spinlocks protecting concurrent map writes, hashed
+ *			by the map cacheline
  * @nd_btt:		Pointer to parent nd_btt structure.
  * @list:		List head for list of arenas
  * @debugfs_dir:	Debugfs dentry
@@ -90,8 +90,12 @@ static inline struct nd_namespace_index *to_next_namespace_index(
 	for (res = (ndd)->dpa.child, next = res ? res->sibling : NULL; \
 			res; res = next, next = next ? next->sibling : NULL)
 
+/* lanes tried, from a cpu's own, before it waits for that one */
+#define ND_LANE_SCAN 4
+
 struct nd_percpu_lane {
 	int count;
+	unsigned int held;	/* the lane this cpu holds while count > 0 */
 	spinlock_t lock;
 };
 
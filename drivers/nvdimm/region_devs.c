@@ -577,10 +577,9 @@ int nd_blk_region_init(struct nd_region *nd_region)
  *
  * A lane correlates to a BLK-data-window and/or a log slot in the BTT.
  * We optimize for the common case where there are 256 lanes, one
- * per-cpu.  For larger systems we need to lock to share lanes.  For now
- * this implementation assumes the cost of maintaining an allocator for
- * free lanes is on the order of the lock hold time, so it implements a
- * static lane = cpu % num_lanes mapping.
+ * per-cpu.  For larger systems we need to lock to share lanes.  Each cpu
+ * starts from its static lane = cpu % num_lanes, and if another cpu holds
+ * it, tries a few of the following lanes before it waits for its own.
  *
  * In the case of a BTT instance on top of a BLK namespace a lane may be
  * acquired recursively.  We lock on the first instance.
@@ -595,12 +594,25 @@ unsigned int nd_region_acquire_lane(struct nd_region *nd_region)
 	cpu = get_cpu();
 	if (nd_region->num_lanes < nr_cpu_ids) {
 		struct nd_percpu_lane *ndl_lock, *ndl_count;
+		unsigned int i, home;
 
-		lane = cpu % nd_region->num_lanes;
 		ndl_count = per_cpu_ptr(nd_region->lane, cpu);
+		if (ndl_count->count++)
+			return ndl_count->held;
+
+		home = cpu % nd_region->num_lanes;
+		for (i = 0; i < ND_LANE_SCAN; i++) {
+			lane = (home + i) % nd_region->num_lanes;
+			ndl_lock = per_cpu_ptr(nd_region->lane, lane);
+			if (spin_trylock(&ndl_lock->lock))
+				goto out;
+		}
+
+		lane = home;
 		ndl_lock = per_cpu_ptr(nd_region->lane, lane);
-		if (ndl_count->count++ == 0)
-			spin_lock(&ndl_lock->lock);
+		spin_lock(&ndl_lock->lock);
+ out:
+		ndl_count->held = lane;
 	} else
 		lane = cpu;
 
@@ -67,6 +67,8 @@ struct nvme_dev {
 	dma_addr_t cmb_dma_addr;
 	u64 cmb_size;
 	u32 cmbsz;
+	u32 sgls;
+	u32 irq_coalesce;	/* as last set through sysfs */
 	u16 oncs;
 	u16 abort_limit;
 	u8 event_limit;
@@ -106,6 +108,7 @@ struct nvme_iod {
 	int offset;		/* Of PRP list */
 	int nents;		/* Used in scatterlist */
 	int length;		/* Of data, in bytes */
+	bool use_sgl;		/* The list holds SGL descriptors, not PRPs */
 	dma_addr_t first_dma;
 	struct scatterlist meta_sg[1]; /* metadata requires single contiguous buffer */
 	struct scatterlist sg[0];
@@ -50,6 +50,7 @@
 #define NVME_MINORS		(1U << MINORBITS)
 #define NVME_Q_DEPTH		1024
 #define NVME_AQ_DEPTH		256
+#define SGES_PER_PAGE		(PAGE_SIZE / sizeof(struct nvme_sgl_desc))
 #define SQ_SIZE(depth)		(depth * sizeof(struct nvme_command))
 #define CQ_SIZE(depth)		(depth * sizeof(struct nvme_completion))
 #define ADMIN_TIMEOUT		(admin_timeout * HZ)
@@ -80,6 +81,11 @@ static bool use_cmb_sqes = true;
 module_param(use_cmb_sqes, bool, 0644);
 MODULE_PARM_DESC(use_cmb_sqes, "use controller's memory buffer for I/O SQes");
 
+static unsigned int sgl_threshold = SZ_32K;
+module_param(sgl_threshold, uint, 0644);
+MODULE_PARM_DESC(sgl_threshold,
+		"use SGLs when the average segment of a request is at least this many bytes, 0 to always use PRPs");
+
 static DEFINE_SPINLOCK(dev_list_lock);
 static LIST_HEAD(dev_list);
 static struct task_struct *nvme_thread;
@@ -134,6 +140,7 @@ struct nvme_queue {
  */
 static inline void _nvme_check_size(void)
 {
+	BUILD_BUG_ON(sizeof(struct nvme_sgl_desc) != 16);
 	BUILD_BUG_ON(sizeof(struct nvme_rw_command) != 64);
 	BUILD_BUG_ON(sizeof(struct nvme_create_cq) != 64);
 	BUILD_BUG_ON(sizeof(struct nvme_create_sq) != 64);
@@ -177,12 +184,25 @@ static int nvme_npages(unsigned size, struct nvme_dev *dev)
 	return DIV_ROUND_UP(8 * nprps, PAGE_SIZE - 8);
 }
 
+/*
+ * The pages the list of an I/O may take up, whether it ends up as PRPs
+ * or as SGL descriptors.
+ */
+static int nvme_iod_npages(unsigned size, unsigned nseg, struct nvme_dev *dev)
+{
+	int nsgl = DIV_ROUND_UP(nseg * sizeof(struct nvme_sgl_desc),
+				PAGE_SIZE - sizeof(struct nvme_sgl_desc));
+
+	return max(nvme_npages(size, dev), nsgl);
+}
+
 static unsigned int nvme_cmd_size(struct nvme_dev *dev)
 {
 	unsigned int ret = sizeof(struct nvme_cmd_info);
 
 	ret += sizeof(struct nvme_iod);
-	ret += sizeof(__le64 *) * nvme_npages(NVME_INT_BYTES(dev), dev);
+	ret += sizeof(__le64 *) *
+		nvme_iod_npages(NVME_INT_BYTES(dev), NVME_INT_PAGES, dev);
 	ret += sizeof(struct scatterlist) * NVME_INT_PAGES;
 
 	return ret;
@@ -426,6 +446,7 @@ static inline void iod_init(struct nvme_iod *iod, unsigned nbytes,
 	iod->npages = -1;
 	iod->length = nbytes;
 	iod->nents = 0;
+	iod->use_sgl = false;
 }
 
 static struct nvme_iod *
@@ -433,7 +454,7 @@ __nvme_alloc_iod(unsigned nseg, unsigned bytes, struct nvme_dev *dev,
 		 unsigned long priv, gfp_t gfp)
 {
 	struct nvme_iod *iod = kmalloc(sizeof(struct nvme_iod) +
-				sizeof(__le64 *) * nvme_npages(bytes, dev) +
+				sizeof(__le64 *) * nvme_iod_npages(bytes, nseg, dev) +
 				sizeof(struct scatterlist) * nseg, gfp);
 
 	if (iod)
@@ -474,7 +495,14 @@ static void nvme_free_iod(struct nvme_dev *dev, struct nvme_iod *iod)
 		dma_pool_free(dev->prp_small_pool, list[0], prp_dma);
 	for (i = 0; i < iod->npages; i++) {
 		__le64 *prp_list = list[i];
-		dma_addr_t next_prp_dma = le64_to_cpu(prp_list[last_prp]);
+		dma_addr_t next_prp_dma;
+
+		if (iod->use_sgl) {
+			struct nvme_sgl_desc *sg_list = (void *)prp_list;
+
+			next_prp_dma = le64_to_cpu(sg_list[SGES_PER_PAGE - 1].addr);
+		} else
+			next_prp_dma = le64_to_cpu(prp_list[last_prp]);
 		dma_pool_free(dev->prp_page_pool, prp_list, prp_dma);
 		prp_dma = next_prp_dma;
 	}
@@ -727,6 +755,100 @@ static int nvme_setup_prps(struct nvme_dev *dev, struct nvme_iod *iod,
 	return total_len;
 }
 
+static void nvme_sgl_set_data(struct nvme_sgl_desc *sge,
+			      struct scatterlist *sg)
+{
+	sge->addr = cpu_to_le64(sg_dma_address(sg));
+	sge->length = cpu_to_le32(sg_dma_len(sg));
+	sge->type = NVME_SGL_FMT_DATA_DESC << 4;
+}
+
+/* Point @sge at a segment of @entries descriptors, chained on if it's full */
+static void nvme_sgl_set_seg(struct nvme_sgl_desc *sge, dma_addr_t dma_addr,
+			     int entries)
+{
+	sge->addr = cpu_to_le64(dma_addr);
+	if (entries <= SGES_PER_PAGE) {
+		sge->length = cpu_to_le32(entries * sizeof(*sge));
+		sge->type = NVME_SGL_FMT_LAST_SEG_DESC << 4;
+	} else {
+		sge->length = cpu_to_le32(PAGE_SIZE);
+		sge->type = NVME_SGL_FMT_SEG_DESC << 4;
+	}
+}
+
+/*
+ * Build the SGL segments for a mapped iod. A single entry needs no list,
+ * its data descriptor goes straight into the command. Otherwise the last
+ * descriptor of each full page links to the next page.
+ */
+static int nvme_setup_sgls(struct nvme_dev *dev, struct nvme_iod *iod,
+		gfp_t gfp)
+{
+	struct dma_pool *pool;
+	struct scatterlist *sg = iod->sg;
+	struct nvme_sgl_desc *sg_list;
+	__le64 **list = iod_list(iod);
+	int entries = iod->nents, i = 0;
+	dma_addr_t sgl_dma;
+
+	iod->use_sgl = true;
+	if (entries == 1)
+		return 0;
+
+	if (entries <= (256 / sizeof(struct nvme_sgl_desc))) {
+		pool = dev->prp_small_pool;
+		iod->npages = 0;
+	} else {
+		pool = dev->prp_page_pool;
+		iod->npages = 1;
+	}
+
+	sg_list = dma_pool_alloc(pool, gfp, &sgl_dma);
+	if (!sg_list) {
+		iod->npages = -1;
+		return -ENOMEM;
+	}
+	list[0] = (__le64 *)sg_list;
+	iod->first_dma = sgl_dma;
+
+	do {
+		if (i == SGES_PER_PAGE) {
+			struct nvme_sgl_desc *link = &sg_list[i - 1];
+
+			sg_list = dma_pool_alloc(pool, gfp, &sgl_dma);
+			if (!sg_list)
+				return -ENOMEM;
+			list[iod->npages++] = (__le64 *)sg_list;
+
+			/* the entry the link takes the place of moves over */
+			i = 0;
+			sg_list[i++] = *link;
+			nvme_sgl_set_seg(link, sgl_dma, entries + 1);
+		}
+
+		nvme_sgl_set_data(&sg_list[i++], sg);
+		sg = sg_next(sg);
+	} while (--entries > 0);
+
+	return 0;
+}
+
+/* Whether the data of @req is better described by SGLs than by PRPs */
+static bool nvme_use_sgls(struct nvme_queue *nvmeq, struct request *req)
+{
+	struct nvme_dev *dev = nvmeq->dev;
+	unsigned int avg_seg_size;
+
+	if (!(dev->sgls & NVME_CTRL_SGLS_SUPPORTED) || !nvmeq->qid)
+		return false;
+	if (!sgl_threshold || req->cmd_type == REQ_TYPE_DRV_PRIV)
+		return false;
+
+	avg_seg_size = DIV_ROUND_UP(blk_rq_bytes(req), req->nr_phys_segments);
+	return avg_seg_size >= sgl_threshold;
+}
+
 static void nvme_submit_priv(struct nvme_queue *nvmeq, struct request *req,
 		struct nvme_iod *iod)
 {
@@ -802,8 +924,17 @@ static int nvme_submit_iod(struct nvme_queue *nvmeq, struct nvme_iod *iod,
 	cmnd.rw.opcode = (rq_data_dir(req) ? nvme_cmd_write : nvme_cmd_read);
 	cmnd.rw.command_id = req->tag;
 	cmnd.rw.nsid = cpu_to_le32(ns->ns_id);
-	cmnd.rw.prp1 = cpu_to_le64(sg_dma_address(iod->sg));
-	cmnd.rw.prp2 = cpu_to_le64(iod->first_dma);
+	if (iod->use_sgl) {
+		cmnd.rw.flags = NVME_CMD_SGL_METABUF;
+		if (iod->nents == 1)
+			nvme_sgl_set_data(&cmnd.rw.sgl, iod->sg);
+		else
+			nvme_sgl_set_seg(&cmnd.rw.sgl, iod->first_dma,
+					 iod->nents);
+	} else {
+		cmnd.rw.prp1 = cpu_to_le64(sg_dma_address(iod->sg));
+		cmnd.rw.prp2 = cpu_to_le64(iod->first_dma);
+	}
 	cmnd.rw.slba = cpu_to_le64(nvme_block_nr(ns, blk_rq_pos(req)));
 	cmnd.rw.length = cpu_to_le16((blk_rq_bytes(req) >> ns->lba_shift) - 1);
 
@@ -890,7 +1021,13 @@ static int nvme_queue_rq(struct blk_mq_hw_ctx *hctx,
 		if (!dma_map_sg(nvmeq->q_dmadev, iod->sg, iod->nents, dma_dir))
 			goto retry_cmd;
 
-		if (blk_rq_bytes(req) !=
+		if (nvme_use_sgls(nvmeq, req)) {
+			if (nvme_setup_sgls(dev, iod, GFP_ATOMIC)) {
+				dma_unmap_sg(dev->dev, iod->sg, iod->nents,
+						dma_dir);
+				goto retry_cmd;
+			}
+		} else if (blk_rq_bytes(req) !=
                     nvme_setup_prps(dev, iod, blk_rq_bytes(req), GFP_ATOMIC)) {
 			dma_unmap_sg(dev->dev, iod->sg, iod->nents, dma_dir);
 			goto retry_cmd;
@@ -2631,6 +2768,7 @@ static int nvme_dev_add(struct nvme_dev *dev)
 	}
 
 	dev->oncs = le16_to_cpup(&ctrl->oncs);
+	dev->sgls = le32_to_cpu(ctrl->sgls);
 	dev->abort_limit = ctrl->acl + 1;
 	dev->vwc = ctrl->vwc;
 	memcpy(dev->serial, ctrl->sn, sizeof(ctrl->sn));
@@ -2654,6 +2792,12 @@ static int nvme_dev_add(struct nvme_dev *dev)
 	}
 	kfree(ctrl);
 
+	/* A reset loses the coalescing set through sysfs, put it back */
+	if (dev->irq_coalesce &&
+	    nvme_set_features(dev, NVME_FEAT_IRQ_COALESCE, dev->irq_coalesce,
+				0, NULL))
+		dev_warn(dev->dev, "failed to restore interrupt coalescing\n");
+
 	if (!dev->tagset.tags) {
 		dev->tagset.ops = &nvme_mq_ops;
 		dev->tagset.nr_hw_queues = dev->online_queues - 1;
@@ -3292,6 +3436,100 @@ static ssize_t nvme_sysfs_reset(struct device *dev,
 }
 static DEVICE_ATTR(reset_controller, S_IWUSR, NULL, nvme_sysfs_reset);
 
+/*
+ * Interrupt coalescing: the controller holds back the interrupt of an I/O
+ * completion queue until irq_coalesce_thr completions have been posted or
+ * irq_coalesce_time microseconds (counted in steps of 100) have passed,
+ * whichever comes first. A time of 0 has every completion interrupt.
+ */
+#define NVME_COALESCE_THR(dw11)		(((dw11) & 0xff) + 1)
+#define NVME_COALESCE_TIME(dw11)	((((dw11) >> 8) & 0xff) * 100)
+
+static int nvme_set_irq_coalesce(struct nvme_dev *dev, u32 thr, u32 time)
+{
+	u32 dw11;
+	int ret;
+
+	if (!thr || thr > 256 || time > 255 * 100)
+		return -EINVAL;
+
+	dw11 = (thr - 1) | (DIV_ROUND_UP(time, 100) << 8);
+	if (!dev->admin_q || blk_queue_dying(dev->admin_q))
+		return -ENODEV;
+
+	ret = nvme_set_features(dev, NVME_FEAT_IRQ_COALESCE, dw11, 0, NULL);
+	if (ret)
+		return ret > 0 ? -EIO : ret;
+
+	dev->irq_coalesce = dw11;
+	return 0;
+}
+
+static ssize_t nvme_sysfs_coalesce_thr_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct nvme_dev *ndev = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", NVME_COALESCE_THR(ndev->irq_coalesce));
+}
+
+static ssize_t nvme_sysfs_coalesce_thr_store(struct device *dev,
+				struct device_attribute *attr, const char *buf,
+				size_t count)
+{
+	struct nvme_dev *ndev = dev_get_drvdata(dev);
+	u32 thr;
+	int ret;
+
+	ret = kstrtou32(buf, 10, &thr);
+	if (ret)
+		return ret;
+
+	ret = nvme_set_irq_coalesce(ndev, thr,
+				    NVME_COALESCE_TIME(ndev->irq_coalesce));
+	return ret ? ret : count;
+}
+static DEVICE_ATTR(irq_coalesce_thr, S_IRUGO | S_IWUSR,
+		   nvme_sysfs_coalesce_thr_show, nvme_sysfs_coalesce_thr_store);
+
+static ssize_t nvme_sysfs_coalesce_time_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct nvme_dev *ndev = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", NVME_COALESCE_TIME(ndev->irq_coalesce));
+}
+
+static ssize_t nvme_sysfs_coalesce_time_store(struct device *dev,
+				struct device_attribute *attr, const char *buf,
+				size_t count)
+{
+	struct nvme_dev *ndev = dev_get_drvdata(dev);
+	u32 time;
+	int ret;
+
+	ret = kstrtou32(buf, 10, &time);
+	if (ret)
+		return ret;
+
+	ret = nvme_set_irq_coalesce(ndev,
+				    NVME_COALESCE_THR(ndev->irq_coalesce), time);
+	return ret ? ret : count;
+}
+static DEVICE_ATTR(irq_coalesce_time, S_IRUGO | S_IWUSR,
+		   nvme_sysfs_coalesce_time_show, nvme_sysfs_coalesce_time_store);
+
+static struct attribute *nvme_dev_attrs[] = {
+	&dev_attr_reset_controller.attr,
+	&dev_attr_irq_coalesce_thr.attr,
+	&dev_attr_irq_coalesce_time.attr,
+	NULL
+};
+
+static struct attribute_group nvme_dev_attrs_group = {
+	.attrs = nvme_dev_attrs,
+};
+
 static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 {
 	int node, result = -ENOMEM;
@@ -3336,7 +3574,7 @@ static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	get_device(dev->device);
 	dev_set_drvdata(dev->device, dev);
 
-	result = device_create_file(dev->device, &dev_attr_reset_controller);
+	result = sysfs_create_group(&dev->device->kobj, &nvme_dev_attrs_group);
 	if (result)
 		goto put_dev;
 
@@ -3390,7 +3628,7 @@ static void nvme_remove(struct pci_dev *pdev)
 	flush_work(&dev->probe_work);
 	flush_work(&dev->reset_work);
 	flush_work(&dev->scan_work);
-	device_remove_file(dev->device, &dev_attr_reset_controller);
+	sysfs_remove_group(&dev->device->kobj, &nvme_dev_attrs_group);
 	nvme_dev_remove(dev);
 	nvme_dev_shutdown(dev);
 	nvme_dev_remove_admin(dev);
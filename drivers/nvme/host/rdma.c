@@ -0,0 +1,2267 @@
+/*
+ * NVMe over Fabrics RDMA host.
+ *
+ * A controller is created by writing its address to /dev/nvme-fabrics:
+ *
+ *	transport=rdma,traddr=<ip>,trsvcid=<port>,nqn=<subsystem nqn>
+ *
+ * optionally followed by hostnqn=, nr_io_queues= and queue_size=.  Every
+ * queue of the controller is an RC queue pair of its own; the data of a
+ * command is described by a single keyed SGL naming a fast registration
+ * of the request's pages, which the target READs or WRITEs directly.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/string.h>
+#include <linux/atomic.h>
+#include <linux/blk-mq.h>
+#include <linux/blkdev.h>
+#include <linux/genhd.h>
+#include <linux/idr.h>
+#include <linux/inet.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/parser.h>
+#include <linux/random.h>
+#include <linux/delay.h>
+#include <linux/uaccess.h>
+#include <linux/scatterlist.h>
+#include <linux/nvme.h>
+#include <linux/nvme-rdma.h>
+#include <asm/unaligned.h>
+
+#include <rdma/ib_verbs.h>
+#include <rdma/rdma_cm.h>
+
+#define NVME_RDMA_CONNECT_TIMEOUT_MS	1000		/* 1 second */
+
+#define NVME_RDMA_MAX_SEGMENTS		256
+
+#define NVME_RDMA_AQ_DEPTH		32
+#define NVME_RDMA_DEF_QUEUE_SIZE	128
+#define NVME_RDMA_MAX_QUEUE_SIZE	1024
+
+/* Only every so many SENDs is signalled, the rest retire with them */
+#define NVME_RDMA_SIG_INTERVAL		16
+
+#define NVME_RDMA_ADMIN_TIMEOUT		(60 * HZ)
+#define NVME_RDMA_IO_TIMEOUT		(30 * HZ)
+
+/*
+ * The work request a completion is for is told apart by the low bits of
+ * its wr_id, as in the target.
+ */
+enum {
+	NVME_RDMA_WR_RECV	= 0,
+	NVME_RDMA_WR_SEND	= 1,
+	NVME_RDMA_WR_REG	= 2,
+	NVME_RDMA_WR_INV	= 3,
+	NVME_RDMA_WR_MASK	= 3,
+};
+
+static inline u64 nvme_rdma_wr_id(void *ctx, int type)
+{
+	return (uintptr_t)ctx | type;
+}
+
+static inline void *nvme_rdma_wr_ctx(u64 wr_id)
+{
+	return (void *)(uintptr_t)(wr_id & ~(u64)NVME_RDMA_WR_MASK);
+}
+
+struct nvme_rdma_device {
+	struct ib_device	*dev;
+	struct ib_pd		*pd;
+	struct ib_device_attr	attr;
+	struct kref		ref;
+	struct list_head	entry;
+};
+
+struct nvme_rdma_qe {
+	void			*data;
+	u64			dma;
+};
+
+struct nvme_rdma_queue;
+
+struct nvme_rdma_request {
+	struct ib_mr		*mr;
+	struct nvme_rdma_qe	sqe;
+	struct ib_sge		sge;
+	struct ib_reg_wr	reg_wr;
+	struct nvme_rdma_queue	*queue;
+	struct sg_table		sg_table;
+	int			nents;
+	bool			need_inval;
+	u16			status;
+	u64			result;
+
+	/* set for the connect command only, which runs outside blk-mq */
+	struct completion	*done;
+	struct request		*rq;
+};
+
+enum nvme_rdma_queue_flags {
+	NVME_RDMA_Q_CONNECTED	= 0,
+	NVME_RDMA_Q_LIVE	= 1,
+};
+
+struct nvme_rdma_queue {
+	struct nvme_rdma_qe	*rsp_ring;
+	int			queue_size;
+	struct nvme_rdma_ctrl	*ctrl;
+	struct nvme_rdma_device	*device;
+	struct ib_cq		*cq;
+	struct ib_qp		*qp;
+	int			qid;
+	unsigned long		flags;
+	atomic_t		sig_count;
+
+	struct rdma_cm_id	*cm_id;
+	int			cm_error;
+	struct completion	cm_done;
+
+	struct nvme_rdma_request *connect_req;
+};
+
+struct nvme_rdma_ctrl {
+	struct list_head	list;
+	struct kref		kref;
+	int			instance;
+	struct device		*device;
+
+	struct nvme_rdma_queue	*queues;
+	unsigned int		queue_count;
+	int			queue_size;
+
+	struct blk_mq_tag_set	admin_tag_set;
+	struct blk_mq_tag_set	tag_set;
+	struct request_queue	*admin_q;
+
+	struct nvme_rdma_device	*rdma_dev;
+	u32			max_fr_pages;
+
+	struct sockaddr_storage	addr;
+	char			traddr[48];
+	char			trsvcid[8];
+	char			subsysnqn[NVMF_NQN_FIELD_LEN];
+	char			hostnqn[NVMF_NQN_FIELD_LEN];
+	u8			hostid[16];
+
+	u16			cntlid;
+	u64			cap;
+	u32			ctrl_config;
+	u32			max_hw_sectors;
+	u8			vwc;
+	char			serial[20];
+	char			model[40];
+	char			firmware_rev[8];
+
+	struct list_head	namespaces;
+	struct work_struct	delete_work;
+	atomic_t		deleting;
+};
+
+struct nvme_rdma_ns {
+	struct list_head	list;
+	struct nvme_rdma_ctrl	*ctrl;
+	struct request_queue	*queue;
+	struct gendisk		*disk;
+	struct kref		kref;
+	unsigned int		ns_id;
+	int			lba_shift;
+};
+
+static LIST_HEAD(device_list);
+static DEFINE_MUTEX(device_list_mutex);
+
+static LIST_HEAD(nvme_rdma_ctrl_list);
+static DEFINE_MUTEX(nvme_rdma_ctrl_mutex);
+
+static DEFINE_IDA(nvme_rdma_instance_ida);
+static int nvme_rdma_major;
+static struct class *nvme_rdma_class;
+static struct workqueue_struct *nvme_rdma_wq;
+
+static int nvme_rdma_cm_handler(struct rdma_cm_id *cm_id,
+		struct rdma_cm_event *event);
+static void nvme_rdma_error_recovery(struct nvme_rdma_ctrl *ctrl);
+
+static inline int nvme_rdma_queue_idx(struct nvme_rdma_queue *queue)
+{
+	return queue - queue->ctrl->queues;
+}
+
+static void nvme_rdma_free_qe(struct ib_device *ibdev, struct nvme_rdma_qe *qe,
+		size_t capsule_size, enum dma_data_direction dir)
+{
+	ib_dma_unmap_single(ibdev, qe->dma, capsule_size, dir);
+	kfree(qe->data);
+}
+
+static int nvme_rdma_alloc_qe(struct ib_device *ibdev, struct nvme_rdma_qe *qe,
+		size_t capsule_size, enum dma_data_direction dir)
+{
+	qe->data = kzalloc(capsule_size, GFP_KERNEL);
+	if (!qe->data)
+		return -ENOMEM;
+
+	qe->dma = ib_dma_map_single(ibdev, qe->data, capsule_size, dir);
+	if (ib_dma_mapping_error(ibdev, qe->dma)) {
+		kfree(qe->data);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void nvme_rdma_free_ring(struct ib_device *ibdev,
+		struct nvme_rdma_qe *ring, size_t ib_queue_size,
+		size_t capsule_size, enum dma_data_direction dir)
+{
+	int i;
+
+	for (i = 0; i < ib_queue_size; i++)
+		nvme_rdma_free_qe(ibdev, &ring[i], capsule_size, dir);
+	kfree(ring);
+}
+
+static struct nvme_rdma_qe *nvme_rdma_alloc_ring(struct ib_device *ibdev,
+		size_t ib_queue_size, size_t capsule_size,
+		enum dma_data_direction dir)
+{
+	struct nvme_rdma_qe *ring;
+	int i;
+
+	ring = kcalloc(ib_queue_size, sizeof(struct nvme_rdma_qe), GFP_KERNEL);
+	if (!ring)
+		return NULL;
+
+	for (i = 0; i < ib_queue_size; i++) {
+		if (nvme_rdma_alloc_qe(ibdev, &ring[i], capsule_size, dir))
+			goto out_free_ring;
+	}
+
+	return ring;
+
+out_free_ring:
+	nvme_rdma_free_ring(ibdev, ring, i, capsule_size, dir);
+	return NULL;
+}
+
+static int nvme_rdma_post_recv(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_qe *qe)
+{
+	struct ib_recv_wr wr, *bad_wr;
+	struct ib_sge list;
+	int ret;
+
+	list.addr = qe->dma;
+	list.length = sizeof(struct nvme_completion);
+	list.lkey = queue->device->pd->local_dma_lkey;
+
+	wr.next = NULL;
+	wr.wr_id = nvme_rdma_wr_id(qe, NVME_RDMA_WR_RECV);
+	wr.sg_list = &list;
+	wr.num_sge = 1;
+
+	ret = ib_post_recv(queue->qp, &wr, &bad_wr);
+	if (unlikely(ret)) {
+		dev_err(queue->ctrl->device,
+			"%s failed with error code %d\n", __func__, ret);
+	}
+	return ret;
+}
+
+static void nvme_rdma_free_dev(struct kref *ref)
+{
+	struct nvme_rdma_device *ndev =
+		container_of(ref, struct nvme_rdma_device, ref);
+
+	mutex_lock(&device_list_mutex);
+	list_del(&ndev->entry);
+	mutex_unlock(&device_list_mutex);
+
+	ib_dealloc_pd(ndev->pd);
+	kfree(ndev);
+}
+
+static void nvme_rdma_dev_put(struct nvme_rdma_device *dev)
+{
+	kref_put(&dev->ref, nvme_rdma_free_dev);
+}
+
+static struct nvme_rdma_device *
+nvme_rdma_find_get_device(struct rdma_cm_id *cm_id)
+{
+	struct nvme_rdma_device *ndev;
+
+	mutex_lock(&device_list_mutex);
+	list_for_each_entry(ndev, &device_list, entry) {
+		if (ndev->dev->node_guid == cm_id->device->node_guid &&
+		    kref_get_unless_zero(&ndev->ref))
+			goto out_unlock;
+	}
+
+	ndev = kzalloc(sizeof(*ndev), GFP_KERNEL);
+	if (!ndev)
+		goto out_err;
+
+	ndev->dev = cm_id->device;
+	kref_init(&ndev->ref);
+
+	if (ib_query_device(ndev->dev, &ndev->attr))
+		goto out_free_dev;
+
+	if (!(ndev->attr.device_cap_flags & IB_DEVICE_MEM_MGT_EXTENSIONS)) {
+		dev_err(&ndev->dev->dev,
+			"Memory registrations not supported.\n");
+		goto out_free_dev;
+	}
+
+	ndev->pd = ib_alloc_pd(ndev->dev);
+	if (IS_ERR(ndev->pd))
+		goto out_free_dev;
+
+	list_add(&ndev->entry, &device_list);
+out_unlock:
+	mutex_unlock(&device_list_mutex);
+	return ndev;
+
+out_free_dev:
+	kfree(ndev);
+out_err:
+	mutex_unlock(&device_list_mutex);
+	return NULL;
+}
+
+static void nvme_rdma_cq_callback(struct ib_cq *cq, void *cq_context);
+
+static void nvme_rdma_destroy_queue_ib(struct nvme_rdma_queue *queue)
+{
+	struct nvme_rdma_device *dev = queue->device;
+	struct ib_device *ibdev = dev->dev;
+
+	rdma_destroy_qp(queue->cm_id);
+	ib_destroy_cq(queue->cq);
+
+	nvme_rdma_free_ring(ibdev, queue->rsp_ring, queue->queue_size,
+			sizeof(struct nvme_completion), DMA_FROM_DEVICE);
+
+	nvme_rdma_dev_put(dev);
+}
+
+static int nvme_rdma_create_queue_ib(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_device *dev)
+{
+	struct ib_device *ibdev = dev->dev;
+	struct ib_cq_init_attr cq_attr = {};
+	struct ib_qp_init_attr init_attr;
+	int send_wr_factor, max_send_wr, i, ret;
+
+	queue->device = dev;
+
+	/* memory registration, SEND and local invalidation per request */
+	send_wr_factor = 3;
+	max_send_wr = send_wr_factor * queue->queue_size +
+			send_wr_factor * NVME_RDMA_SIG_INTERVAL + 1;
+	max_send_wr = min(max_send_wr, dev->attr.max_qp_wr);
+
+	cq_attr.cqe = max_send_wr + queue->queue_size;
+	cq_attr.cqe = min_t(int, cq_attr.cqe, dev->attr.max_cqe);
+	cq_attr.comp_vector = queue->qid % ibdev->num_comp_vectors;
+	queue->cq = ib_create_cq(ibdev, nvme_rdma_cq_callback, NULL, queue,
+			&cq_attr);
+	if (IS_ERR(queue->cq)) {
+		ret = PTR_ERR(queue->cq);
+		goto out;
+	}
+
+	memset(&init_attr, 0, sizeof(init_attr));
+	init_attr.cap.max_send_wr = max_send_wr;
+	init_attr.cap.max_recv_wr = queue->queue_size + 1;
+	init_attr.cap.max_recv_sge = 1;
+	init_attr.cap.max_send_sge = 1;
+	init_attr.sq_sig_type = IB_SIGNAL_REQ_WR;
+	init_attr.qp_type = IB_QPT_RC;
+	init_attr.send_cq = queue->cq;
+	init_attr.recv_cq = queue->cq;
+
+	ret = rdma_create_qp(queue->cm_id, dev->pd, &init_attr);
+	if (ret)
+		goto out_destroy_cq;
+	queue->qp = queue->cm_id->qp;
+
+	queue->rsp_ring = nvme_rdma_alloc_ring(ibdev, queue->queue_size,
+			sizeof(struct nvme_completion), DMA_FROM_DEVICE);
+	if (!queue->rsp_ring) {
+		ret = -ENOMEM;
+		goto out_destroy_qp;
+	}
+
+	for (i = 0; i < queue->queue_size; i++) {
+		ret = nvme_rdma_post_recv(queue, &queue->rsp_ring[i]);
+		if (ret)
+			goto out_destroy_ring;
+	}
+
+	ret = ib_req_notify_cq(queue->cq, IB_CQ_NEXT_COMP);
+	if (ret)
+		goto out_destroy_ring;
+
+	return 0;
+
+out_destroy_ring:
+	nvme_rdma_free_ring(ibdev, queue->rsp_ring, queue->queue_size,
+			sizeof(struct nvme_completion), DMA_FROM_DEVICE);
+out_destroy_qp:
+	rdma_destroy_qp(queue->cm_id);
+	queue->qp = NULL;
+out_destroy_cq:
+	ib_destroy_cq(queue->cq);
+out:
+	return ret;
+}
+
+static int nvme_rdma_init_queue(struct nvme_rdma_ctrl *ctrl,
+		int idx, size_t queue_size)
+{
+	struct nvme_rdma_queue *queue = &ctrl->queues[idx];
+	int ret;
+
+	queue->ctrl = ctrl;
+	queue->qid = idx;
+	queue->queue_size = queue_size;
+	atomic_set(&queue->sig_count, 0);
+	init_completion(&queue->cm_done);
+	queue->cm_error = -ETIMEDOUT;
+
+	queue->cm_id = rdma_create_id(&init_net, nvme_rdma_cm_handler, queue,
+			RDMA_PS_TCP, IB_QPT_RC);
+	if (IS_ERR(queue->cm_id)) {
+		dev_info(ctrl->device,
+			"failed to create CM ID: %ld\n",
+			PTR_ERR(queue->cm_id));
+		return PTR_ERR(queue->cm_id);
+	}
+
+	ret = rdma_resolve_addr(queue->cm_id, NULL,
+			(struct sockaddr *)&ctrl->addr,
+			NVME_RDMA_CONNECT_TIMEOUT_MS);
+	if (ret) {
+		dev_info(ctrl->device,
+			"rdma_resolve_addr failed (%d).\n", ret);
+		goto out_destroy_cm_id;
+	}
+
+	ret = wait_for_completion_interruptible_timeout(&queue->cm_done,
+			msecs_to_jiffies(NVME_RDMA_CONNECT_TIMEOUT_MS) + 1);
+	if (ret <= 0) {
+		ret = ret ? ret : -ETIMEDOUT;
+		goto out_destroy_cm_id;
+	}
+	ret = queue->cm_error;
+	if (ret)
+		goto out_destroy_cm_id;
+
+	set_bit(NVME_RDMA_Q_CONNECTED, &queue->flags);
+	return 0;
+
+out_destroy_cm_id:
+	/* the queue pair may have come up in the address resolution */
+	rdma_disconnect(queue->cm_id);
+	if (queue->qp)
+		nvme_rdma_destroy_queue_ib(queue);
+	rdma_destroy_id(queue->cm_id);
+	queue->qp = NULL;
+	return ret;
+}
+
+static void nvme_rdma_stop_queue(struct nvme_rdma_queue *queue)
+{
+	clear_bit(NVME_RDMA_Q_LIVE, &queue->flags);
+	if (test_bit(NVME_RDMA_Q_CONNECTED, &queue->flags))
+		rdma_disconnect(queue->cm_id);
+}
+
+static void nvme_rdma_free_queue(struct nvme_rdma_queue *queue)
+{
+	if (!test_and_clear_bit(NVME_RDMA_Q_CONNECTED, &queue->flags))
+		return;
+
+	nvme_rdma_destroy_queue_ib(queue);
+	rdma_destroy_id(queue->cm_id);
+}
+
+static void nvme_rdma_unmap_data(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_request *req, enum dma_data_direction dir)
+{
+	if (!req->nents)
+		return;
+
+	ib_dma_unmap_sg(queue->device->dev, req->sg_table.sgl, req->nents,
+			dir);
+	req->nents = 0;
+}
+
+/*
+ * Register the pages of the request with the fast registration MR of
+ * the request, and describe it in the single keyed SGL of the command.
+ */
+static int nvme_rdma_map_data(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_request *req, struct nvme_command *c,
+		int nents, enum dma_data_direction dir)
+{
+	struct nvme_keyed_sgl_desc *sg = &c->common.ksgl;
+	struct ib_device *ibdev = queue->device->dev;
+	int count, nr;
+
+	c->common.flags |= NVME_CMD_SGL_METABUF;
+	memset(sg, 0, sizeof(*sg));
+	sg->type = NVME_KEY_SGL_FMT_DATA_DESC << 4;
+	req->need_inval = false;
+	req->nents = 0;
+
+	if (!nents)
+		return 0;
+
+	count = ib_dma_map_sg(ibdev, req->sg_table.sgl, nents, dir);
+	if (unlikely(count <= 0))
+		return -EIO;
+	req->nents = nents;
+
+	nr = ib_map_mr_sg(req->mr, req->sg_table.sgl, count, PAGE_SIZE);
+	if (nr < count) {
+		nvme_rdma_unmap_data(queue, req, dir);
+		return nr < 0 ? nr : -EINVAL;
+	}
+
+	ib_update_fast_reg_key(req->mr, ib_inc_rkey(req->mr->rkey));
+
+	memset(&req->reg_wr, 0, sizeof(req->reg_wr));
+	req->reg_wr.wr.opcode = IB_WR_REG_MR;
+	req->reg_wr.wr.wr_id = nvme_rdma_wr_id(req, NVME_RDMA_WR_REG);
+	req->reg_wr.mr = req->mr;
+	req->reg_wr.key = req->mr->rkey;
+	req->reg_wr.access = IB_ACCESS_LOCAL_WRITE |
+			     IB_ACCESS_REMOTE_READ |
+			     IB_ACCESS_REMOTE_WRITE;
+
+	sg->addr = cpu_to_le64(req->mr->iova);
+	sg->length[0] = req->mr->length & 0xff;
+	sg->length[1] = (req->mr->length >> 8) & 0xff;
+	sg->length[2] = (req->mr->length >> 16) & 0xff;
+	put_unaligned_le32(req->mr->rkey, sg->key);
+	sg->type = (NVME_KEY_SGL_FMT_DATA_DESC << 4) | NVME_SGL_FMT_INVALIDATE;
+
+	req->need_inval = true;
+	return 0;
+}
+
+static int nvme_rdma_post_send(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_request *req)
+{
+	struct ib_send_wr wr, *first, *bad_wr;
+	int ret;
+
+	req->sge.addr = req->sqe.dma;
+	req->sge.length = sizeof(struct nvme_command);
+	req->sge.lkey = queue->device->pd->local_dma_lkey;
+
+	wr.next = NULL;
+	wr.wr_id = nvme_rdma_wr_id(req, NVME_RDMA_WR_SEND);
+	wr.sg_list = &req->sge;
+	wr.num_sge = 1;
+	wr.opcode = IB_WR_SEND;
+	wr.send_flags = 0;
+
+	/*
+	 * Unsignalled SENDs are only retired from the send queue by a later
+	 * signalled one; the send queue has room for that many extra.
+	 */
+	if (req->done || (atomic_inc_return(&queue->sig_count) %
+			NVME_RDMA_SIG_INTERVAL) == 0)
+		wr.send_flags |= IB_SEND_SIGNALED;
+
+	if (req->need_inval) {
+		req->reg_wr.wr.next = &wr;
+		first = &req->reg_wr.wr;
+	} else {
+		first = &wr;
+	}
+
+	ib_dma_sync_single_for_device(queue->device->dev, req->sqe.dma,
+			sizeof(struct nvme_command), DMA_TO_DEVICE);
+
+	ret = ib_post_send(queue->qp, first, &bad_wr);
+	if (unlikely(ret)) {
+		dev_err(queue->ctrl->device,
+			"%s failed with error code %d\n", __func__, ret);
+	}
+	return ret;
+}
+
+static int nvme_rdma_inv_rkey(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_request *req)
+{
+	struct ib_send_wr *bad_wr;
+	struct ib_send_wr wr = {
+		.opcode		    = IB_WR_LOCAL_INV,
+		.next		    = NULL,
+		.num_sge	    = 0,
+		.send_flags	    = IB_SEND_SIGNALED,
+		.ex.invalidate_rkey = req->mr->rkey,
+	};
+
+	wr.wr_id = nvme_rdma_wr_id(req, NVME_RDMA_WR_INV);
+	return ib_post_send(queue->qp, &wr, &bad_wr);
+}
+
+static void nvme_rdma_end_request(struct nvme_rdma_request *req)
+{
+	struct request *rq = req->rq;
+	int error = 0;
+
+	if (req->done) {
+		complete(req->done);
+		return;
+	}
+
+	if (unlikely(req->status)) {
+		if (rq->cmd_type == REQ_TYPE_DRV_PRIV)
+			error = req->status;
+		else
+			error = -EIO;
+	}
+	blk_mq_complete_request(rq, error);
+}
+
+static struct nvme_rdma_request *
+nvme_rdma_find_request(struct nvme_rdma_queue *queue, u16 command_id)
+{
+	struct nvme_rdma_ctrl *ctrl = queue->ctrl;
+	struct blk_mq_tags *tags;
+	struct request *rq;
+
+	if (command_id == queue->queue_size)
+		return queue->connect_req;
+
+	if (queue->qid == 0)
+		tags = ctrl->admin_tag_set.tags[0];
+	else
+		tags = ctrl->tag_set.tags[queue->qid - 1];
+	if (!tags)
+		return NULL;
+
+	rq = blk_mq_tag_to_rq(tags, command_id);
+	if (!rq)
+		return NULL;
+	return blk_mq_rq_to_pdu(rq);
+}
+
+static void nvme_rdma_recv_done(struct nvme_rdma_queue *queue,
+		struct ib_wc *wc)
+{
+	struct nvme_rdma_qe *qe = nvme_rdma_wr_ctx(wc->wr_id);
+	struct ib_device *ibdev = queue->device->dev;
+	struct nvme_completion *cqe = qe->data;
+	struct nvme_rdma_request *req;
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		if (wc->status != IB_WC_WR_FLUSH_ERR) {
+			dev_err(queue->ctrl->device,
+				"RECV failed with status %s (%d)\n",
+				ib_wc_status_msg(wc->status), wc->status);
+			nvme_rdma_error_recovery(queue->ctrl);
+		}
+		return;
+	}
+
+	if (unlikely(wc->byte_len < sizeof(*cqe))) {
+		dev_err(queue->ctrl->device,
+			"Unexpected nvme completion length(%d)\n",
+			wc->byte_len);
+		nvme_rdma_error_recovery(queue->ctrl);
+		return;
+	}
+
+	ib_dma_sync_single_for_cpu(ibdev, qe->dma, sizeof(*cqe),
+			DMA_FROM_DEVICE);
+
+	req = nvme_rdma_find_request(queue, cqe->command_id);
+	if (unlikely(!req)) {
+		dev_err(queue->ctrl->device,
+			"tag 0x%x on QP %#x not found\n",
+			cqe->command_id, queue->qp->qp_num);
+		nvme_rdma_error_recovery(queue->ctrl);
+		goto repost;
+	}
+
+	req->status = le16_to_cpu(cqe->status) >> 1;
+	req->result = le32_to_cpu(cqe->result) |
+		((u64)le32_to_cpu(cqe->rsvd) << 32);
+
+	ib_dma_sync_single_for_device(ibdev, qe->dma, sizeof(*cqe),
+			DMA_FROM_DEVICE);
+	nvme_rdma_post_recv(queue, qe);
+
+	/*
+	 * The target invalidates the registration in its SEND when it can,
+	 * otherwise the request only completes once we did it ourselves.
+	 */
+	if (req->need_inval) {
+		if ((wc->wc_flags & IB_WC_WITH_INVALIDATE) &&
+		    wc->ex.invalidate_rkey == req->mr->rkey) {
+			req->need_inval = false;
+		} else if (nvme_rdma_inv_rkey(queue, req)) {
+			dev_err(queue->ctrl->device,
+				"Queueing INV WR for rkey %#x failed\n",
+				req->mr->rkey);
+			nvme_rdma_error_recovery(queue->ctrl);
+		} else {
+			return;
+		}
+	}
+
+	nvme_rdma_end_request(req);
+	return;
+
+repost:
+	nvme_rdma_post_recv(queue, qe);
+}
+
+static void nvme_rdma_inv_rkey_done(struct nvme_rdma_queue *queue,
+		struct ib_wc *wc)
+{
+	struct nvme_rdma_request *req = nvme_rdma_wr_ctx(wc->wr_id);
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		if (wc->status != IB_WC_WR_FLUSH_ERR)
+			nvme_rdma_error_recovery(queue->ctrl);
+		req->status = NVME_SC_ABORT_REQ | NVME_SC_DNR;
+	}
+
+	req->need_inval = false;
+	nvme_rdma_end_request(req);
+}
+
+static void nvme_rdma_handle_wc(struct nvme_rdma_queue *queue,
+		struct ib_wc *wc)
+{
+	switch (wc->wr_id & NVME_RDMA_WR_MASK) {
+	case NVME_RDMA_WR_RECV:
+		nvme_rdma_recv_done(queue, wc);
+		break;
+	case NVME_RDMA_WR_INV:
+		nvme_rdma_inv_rkey_done(queue, wc);
+		break;
+	case NVME_RDMA_WR_SEND:
+	case NVME_RDMA_WR_REG:
+		/* nothing to do for these but to notice their failure */
+		if (unlikely(wc->status != IB_WC_SUCCESS &&
+			     wc->status != IB_WC_WR_FLUSH_ERR)) {
+			dev_err(queue->ctrl->device,
+				"%s failed with status %s (%d)\n",
+				(wc->wr_id & NVME_RDMA_WR_MASK) ==
+					NVME_RDMA_WR_SEND ? "SEND" : "MEMREG",
+				ib_wc_status_msg(wc->status), wc->status);
+			nvme_rdma_error_recovery(queue->ctrl);
+		}
+		break;
+	}
+}
+
+static void nvme_rdma_cq_callback(struct ib_cq *cq, void *cq_context)
+{
+	struct nvme_rdma_queue *queue = cq_context;
+	struct ib_wc wc;
+
+	do {
+		while (ib_poll_cq(cq, 1, &wc) > 0)
+			nvme_rdma_handle_wc(queue, &wc);
+	} while (ib_req_notify_cq(cq, IB_CQ_NEXT_COMP |
+				  IB_CQ_REPORT_MISSED_EVENTS) > 0);
+}
+
+static int nvme_rdma_addr_resolved(struct nvme_rdma_queue *queue)
+{
+	struct nvme_rdma_device *dev;
+	int ret;
+
+	dev = nvme_rdma_find_get_device(queue->cm_id);
+	if (!dev) {
+		dev_err(queue->ctrl->device,
+			"no client data found!\n");
+		return -ECONNREFUSED;
+	}
+
+	ret = nvme_rdma_create_queue_ib(queue, dev);
+	if (ret) {
+		nvme_rdma_dev_put(dev);
+		return ret;
+	}
+
+	ret = rdma_resolve_route(queue->cm_id, NVME_RDMA_CONNECT_TIMEOUT_MS);
+	if (ret) {
+		dev_err(queue->ctrl->device,
+			"rdma_resolve_route failed (%d).\n", ret);
+		nvme_rdma_destroy_queue_ib(queue);
+		queue->qp = NULL;
+		return ret;
+	}
+
+	return 0;
+}
+
+static int nvme_rdma_route_resolved(struct nvme_rdma_queue *queue)
+{
+	struct rdma_conn_param param = { };
+	struct nvme_rdma_cm_req priv = { };
+	int ret;
+
+	param.qp_num = queue->qp->qp_num;
+	param.flow_control = 1;
+
+	param.responder_resources = queue->device->attr.max_qp_rd_atom;
+	/* maximum retry count */
+	param.retry_count = 7;
+	param.rnr_retry_count = 7;
+	param.private_data = &priv;
+	param.private_data_len = sizeof(priv);
+
+	priv.recfmt = cpu_to_le16(NVME_RDMA_CM_FMT_1_0);
+	priv.qid = cpu_to_le16(nvme_rdma_queue_idx(queue));
+	priv.hrqsize = cpu_to_le16(queue->queue_size);
+	priv.hsqsize = cpu_to_le16(queue->queue_size);
+
+	ret = rdma_connect(queue->cm_id, &param);
+	if (ret) {
+		dev_err(queue->ctrl->device,
+			"rdma_connect failed (%d).\n", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int nvme_rdma_conn_rejected(struct nvme_rdma_queue *queue,
+		struct rdma_cm_event *ev)
+{
+	const struct nvme_rdma_cm_rej *rej = ev->param.conn.private_data;
+
+	if (rej && ev->param.conn.private_data_len >= sizeof(*rej))
+		dev_err(queue->ctrl->device,
+			"Connect rejected, status %d.\n",
+			le16_to_cpu(rej->sts));
+	else
+		dev_err(queue->ctrl->device,
+			"Connect rejected, no private data.\n");
+
+	return -ECONNRESET;
+}
+
+static int nvme_rdma_cm_handler(struct rdma_cm_id *cm_id,
+		struct rdma_cm_event *ev)
+{
+	struct nvme_rdma_queue *queue = cm_id->context;
+	int cm_error = 0;
+
+	dev_dbg(queue->ctrl->device, "%s (%d): status %d id %p\n",
+		rdma_event_msg(ev->event), ev->event,
+		ev->status, cm_id);
+
+	switch (ev->event) {
+	case RDMA_CM_EVENT_ADDR_RESOLVED:
+		cm_error = nvme_rdma_addr_resolved(queue);
+		break;
+	case RDMA_CM_EVENT_ROUTE_RESOLVED:
+		cm_error = nvme_rdma_route_resolved(queue);
+		break;
+	case RDMA_CM_EVENT_ESTABLISHED:
+		queue->cm_error = 0;
+		complete(&queue->cm_done);
+		return 0;
+	case RDMA_CM_EVENT_REJECTED:
+		cm_error = nvme_rdma_conn_rejected(queue, ev);
+		break;
+	case RDMA_CM_EVENT_ADDR_ERROR:
+	case RDMA_CM_EVENT_ROUTE_ERROR:
+	case RDMA_CM_EVENT_CONNECT_ERROR:
+	case RDMA_CM_EVENT_UNREACHABLE:
+		dev_dbg(queue->ctrl->device,
+			"CM error event %d\n", ev->event);
+		cm_error = -ECONNRESET;
+		break;
+	case RDMA_CM_EVENT_DISCONNECTED:
+	case RDMA_CM_EVENT_ADDR_CHANGE:
+	case RDMA_CM_EVENT_TIMEWAIT_EXIT:
+	case RDMA_CM_EVENT_DEVICE_REMOVAL:
+		dev_dbg(queue->ctrl->device,
+			"disconnect received - connection closed\n");
+		nvme_rdma_error_recovery(queue->ctrl);
+		break;
+	default:
+		dev_err(queue->ctrl->device,
+			"Unexpected RDMA CM event (%d)\n", ev->event);
+		nvme_rdma_error_recovery(queue->ctrl);
+		break;
+	}
+
+	if (cm_error) {
+		queue->cm_error = cm_error;
+		complete(&queue->cm_done);
+	}
+
+	return 0;
+}
+
+/*
+ * The connect command has to go out on the very queue it connects,
+ * which blk-mq can't be asked for: it is sent by hand, its command id
+ * one past the tags of the queue.
+ */
+static int nvme_rdma_connect_queue(struct nvme_rdma_queue *queue)
+{
+	struct nvme_rdma_ctrl *ctrl = queue->ctrl;
+	struct ib_device *ibdev = queue->device->dev;
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct nvme_rdma_request *req;
+	struct nvmf_connect_data *data;
+	struct nvme_command *c;
+	int ret;
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	data = kzalloc(sizeof(*data), GFP_KERNEL);
+	if (!req || !data) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	req->queue = queue;
+	req->done = &done;
+
+	ret = nvme_rdma_alloc_qe(ibdev, &req->sqe, sizeof(struct nvme_command),
+			DMA_TO_DEVICE);
+	if (ret)
+		goto out_free;
+
+	req->mr = ib_alloc_mr(queue->device->pd, IB_MR_TYPE_MEM_REG, 1);
+	if (IS_ERR(req->mr)) {
+		ret = PTR_ERR(req->mr);
+		goto out_free_qe;
+	}
+
+	memcpy(data->hostid, ctrl->hostid, sizeof(data->hostid));
+	data->cntlid = cpu_to_le16(queue->qid ? ctrl->cntlid : 0xffff);
+	strncpy(data->subsysnqn, ctrl->subsysnqn, NVMF_NQN_SIZE);
+	strncpy(data->hostnqn, ctrl->hostnqn, NVMF_NQN_SIZE);
+
+	c = req->sqe.data;
+	c->connect.opcode = nvme_fabrics_command;
+	c->connect.fctype = nvme_fabrics_type_connect;
+	c->connect.command_id = queue->queue_size;
+	c->connect.qid = cpu_to_le16(queue->qid);
+	c->connect.sqsize = cpu_to_le16(queue->queue_size - 1);
+
+	ret = sg_alloc_table(&req->sg_table, 1, GFP_KERNEL);
+	if (ret)
+		goto out_free_mr;
+	sg_set_buf(req->sg_table.sgl, data, sizeof(*data));
+
+	ret = nvme_rdma_map_data(queue, req, c, 1, DMA_TO_DEVICE);
+	if (ret)
+		goto out_free_sg;
+
+	queue->connect_req = req;
+	ret = nvme_rdma_post_send(queue, req);
+	if (ret)
+		goto out_unmap;
+
+	if (!wait_for_completion_timeout(&done, NVME_RDMA_ADMIN_TIMEOUT)) {
+		/* flush the queue pair, the caller then frees the queue */
+		dev_err(ctrl->device, "connect of queue %d timed out\n",
+			queue->qid);
+		queue->connect_req = NULL;
+		nvme_rdma_stop_queue(queue);
+		ret = -ETIMEDOUT;
+		goto out_unmap;
+	}
+
+	if (req->status) {
+		dev_err(ctrl->device,
+			"Connect command failed, error wo/DNR bit: %d\n",
+			req->status & ~NVME_SC_DNR);
+		ret = -EIO;
+	} else if (!queue->qid) {
+		ctrl->cntlid = le16_to_cpu((__le16)req->result);
+	}
+
+out_unmap:
+	queue->connect_req = NULL;
+	nvme_rdma_unmap_data(queue, req, DMA_TO_DEVICE);
+out_free_sg:
+	sg_free_table(&req->sg_table);
+out_free_mr:
+	ib_dereg_mr(req->mr);
+out_free_qe:
+	nvme_rdma_free_qe(ibdev, &req->sqe, sizeof(struct nvme_command),
+			DMA_TO_DEVICE);
+out_free:
+	kfree(data);
+	kfree(req);
+	return ret;
+}
+
+static int nvme_rdma_queue_rq(struct blk_mq_hw_ctx *hctx,
+		const struct blk_mq_queue_data *bd)
+{
+	struct nvme_rdma_queue *queue = hctx->driver_data;
+	struct request *rq = bd->rq;
+	struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+	struct ib_device *dev = queue->device->dev;
+	enum dma_data_direction dir;
+	struct nvme_command *c = req->sqe.data;
+	int nents = 0, ret;
+
+	if (unlikely(!test_bit(NVME_RDMA_Q_LIVE, &queue->flags)))
+		return BLK_MQ_RQ_QUEUE_ERROR;
+
+	dir = rq_data_dir(rq) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	req->status = 0;
+	req->result = 0;
+
+	ib_dma_sync_single_for_cpu(dev, req->sqe.dma,
+			sizeof(struct nvme_command), DMA_TO_DEVICE);
+
+	if (rq->cmd_type == REQ_TYPE_DRV_PRIV) {
+		memcpy(c, rq->cmd, sizeof(*c));
+	} else {
+		struct nvme_rdma_ns *ns = hctx->queue->queuedata;
+
+		memset(c, 0, sizeof(*c));
+		c->common.nsid = cpu_to_le32(ns->ns_id);
+		if (rq->cmd_flags & REQ_FLUSH) {
+			c->common.opcode = nvme_cmd_flush;
+		} else {
+			c->rw.opcode = rq_data_dir(rq) ?
+				nvme_cmd_write : nvme_cmd_read;
+			c->rw.slba = cpu_to_le64(blk_rq_pos(rq) >>
+					(ns->lba_shift - 9));
+			c->rw.length = cpu_to_le16((blk_rq_bytes(rq) >>
+					ns->lba_shift) - 1);
+			if (rq->cmd_flags & REQ_FUA)
+				c->rw.control |= cpu_to_le16(NVME_RW_FUA);
+		}
+	}
+	c->common.command_id = rq->tag;
+
+	blk_mq_start_request(rq);
+
+	if (blk_rq_bytes(rq)) {
+		if (sg_alloc_table(&req->sg_table, rq->nr_phys_segments,
+				GFP_ATOMIC))
+			return BLK_MQ_RQ_QUEUE_BUSY;
+		nents = blk_rq_map_sg(rq->q, rq, req->sg_table.sgl);
+	}
+
+	ret = nvme_rdma_map_data(queue, req, c, nents, dir);
+	if (unlikely(ret < 0)) {
+		dev_err(queue->ctrl->device,
+			"Failed to map data (%d)\n", ret);
+		goto err;
+	}
+
+	ret = nvme_rdma_post_send(queue, req);
+	if (unlikely(ret)) {
+		nvme_rdma_unmap_data(queue, req, dir);
+		goto err;
+	}
+
+	return BLK_MQ_RQ_QUEUE_OK;
+
+err:
+	if (blk_rq_bytes(rq))
+		sg_free_table(&req->sg_table);
+	return BLK_MQ_RQ_QUEUE_ERROR;
+}
+
+static void nvme_rdma_complete_rq(struct request *rq)
+{
+	struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+
+	nvme_rdma_unmap_data(req->queue, req,
+			rq_data_dir(rq) ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	if (blk_rq_bytes(rq))
+		sg_free_table(&req->sg_table);
+
+	blk_mq_end_request(rq, rq->errors);
+}
+
+static enum blk_eh_timer_return
+nvme_rdma_timeout(struct request *rq, bool reserved)
+{
+	struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+
+	dev_warn(req->queue->ctrl->device, "I/O %d QID %d timeout\n",
+		rq->tag, req->queue->qid);
+
+	/* the controller goes away, and the request is cancelled with it */
+	nvme_rdma_error_recovery(req->queue->ctrl);
+	return BLK_EH_RESET_TIMER;
+}
+
+static int __nvme_rdma_init_request(struct nvme_rdma_ctrl *ctrl,
+		struct request *rq, unsigned int queue_idx)
+{
+	struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+	struct nvme_rdma_queue *queue = &ctrl->queues[queue_idx];
+	struct nvme_rdma_device *dev = queue->device;
+	int ret;
+
+	ret = nvme_rdma_alloc_qe(dev->dev, &req->sqe,
+			sizeof(struct nvme_command), DMA_TO_DEVICE);
+	if (ret)
+		return ret;
+
+	req->mr = ib_alloc_mr(dev->pd, IB_MR_TYPE_MEM_REG,
+			ctrl->max_fr_pages);
+	if (IS_ERR(req->mr)) {
+		ret = PTR_ERR(req->mr);
+		nvme_rdma_free_qe(dev->dev, &req->sqe,
+				sizeof(struct nvme_command), DMA_TO_DEVICE);
+		return ret;
+	}
+
+	req->queue = queue;
+	req->rq = rq;
+	return 0;
+}
+
+static void __nvme_rdma_exit_request(struct nvme_rdma_ctrl *ctrl,
+		struct request *rq, unsigned int queue_idx)
+{
+	struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+	struct nvme_rdma_device *dev = ctrl->queues[queue_idx].device;
+
+	ib_dereg_mr(req->mr);
+	nvme_rdma_free_qe(dev->dev, &req->sqe, sizeof(struct nvme_command),
+			DMA_TO_DEVICE);
+}
+
+static int nvme_rdma_init_request(void *data, struct request *rq,
+		unsigned int hctx_idx, unsigned int rq_idx,
+		unsigned int numa_node)
+{
+	return __nvme_rdma_init_request(data, rq, hctx_idx + 1);
+}
+
+static void nvme_rdma_exit_request(void *data, struct request *rq,
+		unsigned int hctx_idx, unsigned int rq_idx)
+{
+	__nvme_rdma_exit_request(data, rq, hctx_idx + 1);
+}
+
+static int nvme_rdma_init_admin_request(void *data, struct request *rq,
+		unsigned int hctx_idx, unsigned int rq_idx,
+		unsigned int numa_node)
+{
+	return __nvme_rdma_init_request(data, rq, 0);
+}
+
+static void nvme_rdma_exit_admin_request(void *data, struct request *rq,
+		unsigned int hctx_idx, unsigned int rq_idx)
+{
+	__nvme_rdma_exit_request(data, rq, 0);
+}
+
+static int nvme_rdma_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+		unsigned int hctx_idx)
+{
+	struct nvme_rdma_ctrl *ctrl = data;
+
+	hctx->driver_data = &ctrl->queues[hctx_idx + 1];
+	return 0;
+}
+
+static int nvme_rdma_init_admin_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+		unsigned int hctx_idx)
+{
+	struct nvme_rdma_ctrl *ctrl = data;
+
+	hctx->driver_data = &ctrl->queues[0];
+	return 0;
+}
+
+static struct blk_mq_ops nvme_rdma_mq_ops = {
+	.queue_rq	= nvme_rdma_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.complete	= nvme_rdma_complete_rq,
+	.init_request	= nvme_rdma_init_request,
+	.exit_request	= nvme_rdma_exit_request,
+	.init_hctx	= nvme_rdma_init_hctx,
+	.timeout	= nvme_rdma_timeout,
+};
+
+static struct blk_mq_ops nvme_rdma_admin_mq_ops = {
+	.queue_rq	= nvme_rdma_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.complete	= nvme_rdma_complete_rq,
+	.init_request	= nvme_rdma_init_admin_request,
+	.exit_request	= nvme_rdma_exit_admin_request,
+	.init_hctx	= nvme_rdma_init_admin_hctx,
+	.timeout	= nvme_rdma_timeout,
+};
+
+/*
+ * Returns 0 on success.  If the result is negative, it's a Linux error code;
+ * if the result is positive, it's an NVM Express status code
+ */
+static int nvme_rdma_submit_sync_cmd(struct request_queue *q,
+		struct nvme_command *cmd, void *buffer, unsigned bufflen,
+		u64 *result)
+{
+	bool write = nvme_is_write(cmd);
+	struct request *rq;
+	int ret;
+
+	rq = blk_mq_alloc_request(q, write, GFP_KERNEL, false);
+	if (IS_ERR(rq))
+		return PTR_ERR(rq);
+
+	rq->cmd_type = REQ_TYPE_DRV_PRIV;
+	rq->cmd_flags |= REQ_FAILFAST_DRIVER;
+	rq->__data_len = 0;
+	rq->__sector = (sector_t) -1;
+	rq->bio = rq->biotail = NULL;
+
+	rq->timeout = NVME_RDMA_ADMIN_TIMEOUT;
+
+	rq->cmd = (unsigned char *)cmd;
+	rq->cmd_len = sizeof(struct nvme_command);
+
+	if (buffer && bufflen) {
+		ret = blk_rq_map_kern(q, rq, buffer, bufflen,
+				      __GFP_DIRECT_RECLAIM);
+		if (ret)
+			goto out;
+	}
+
+	blk_execute_rq(rq->q, NULL, rq, 0);
+	if (result) {
+		struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+
+		*result = req->result;
+	}
+	ret = rq->errors;
+ out:
+	blk_mq_free_request(rq);
+	return ret;
+}
+
+static int nvme_rdma_reg_read64(struct nvme_rdma_ctrl *ctrl, u32 off,
+		u64 *val)
+{
+	struct nvme_command cmd = { };
+
+	cmd.prop_get.opcode = nvme_fabrics_command;
+	cmd.prop_get.fctype = nvme_fabrics_type_property_get;
+	cmd.prop_get.attrib = 1;
+	cmd.prop_get.offset = cpu_to_le32(off);
+
+	return nvme_rdma_submit_sync_cmd(ctrl->admin_q, &cmd, NULL, 0, val);
+}
+
+static int nvme_rdma_reg_read32(struct nvme_rdma_ctrl *ctrl, u32 off,
+		u32 *val)
+{
+	struct nvme_command cmd = { };
+	u64 res;
+	int ret;
+
+	cmd.prop_get.opcode = nvme_fabrics_command;
+	cmd.prop_get.fctype = nvme_fabrics_type_property_get;
+	cmd.prop_get.offset = cpu_to_le32(off);
+
+	ret = nvme_rdma_submit_sync_cmd(ctrl->admin_q, &cmd, NULL, 0, &res);
+	if (!ret)
+		*val = lower_32_bits(res);
+	return ret;
+}
+
+static int nvme_rdma_reg_write32(struct nvme_rdma_ctrl *ctrl, u32 off,
+		u32 val)
+{
+	struct nvme_command cmd = { };
+
+	cmd.prop_set.opcode = nvme_fabrics_command;
+	cmd.prop_set.fctype = nvme_fabrics_type_property_set;
+	cmd.prop_set.offset = cpu_to_le32(off);
+	cmd.prop_set.value = cpu_to_le64(val);
+
+	return nvme_rdma_submit_sync_cmd(ctrl->admin_q, &cmd, NULL, 0, NULL);
+}
+
+static int nvme_rdma_wait_ready(struct nvme_rdma_ctrl *ctrl, bool enabled)
+{
+	unsigned long timeout =
+		((NVME_CAP_TIMEOUT(ctrl->cap) + 1) * HZ / 2) + jiffies;
+	u32 csts, bit = enabled ? NVME_CSTS_RDY : 0;
+	int ret;
+
+	while ((ret = nvme_rdma_reg_read32(ctrl, NVME_REG_CSTS, &csts)) == 0) {
+		if ((csts & NVME_CSTS_RDY) == bit)
+			break;
+
+		msleep(100);
+		if (fatal_signal_pending(current))
+			return -EINTR;
+		if (time_after(jiffies, timeout)) {
+			dev_err(ctrl->device,
+				"Device not ready; aborting %s\n", enabled ?
+						"initialisation" : "reset");
+			return -ENODEV;
+		}
+	}
+
+	return ret;
+}
+
+static int nvme_rdma_enable_ctrl(struct nvme_rdma_ctrl *ctrl)
+{
+	int ret;
+
+	ctrl->ctrl_config = NVME_CC_CSS_NVM;
+	ctrl->ctrl_config |= (PAGE_SHIFT - 12) << NVME_CC_MPS_SHIFT;
+	ctrl->ctrl_config |= NVME_CC_ARB_RR | NVME_CC_SHN_NONE;
+	ctrl->ctrl_config |= NVME_CC_IOSQES | NVME_CC_IOCQES;
+	ctrl->ctrl_config |= NVME_CC_ENABLE;
+
+	ret = nvme_rdma_reg_write32(ctrl, NVME_REG_CC, ctrl->ctrl_config);
+	if (ret)
+		return ret;
+	return nvme_rdma_wait_ready(ctrl, true);
+}
+
+static void nvme_rdma_shutdown_ctrl(struct nvme_rdma_ctrl *ctrl)
+{
+	unsigned long timeout = jiffies + 5 * HZ;
+	u32 csts;
+
+	ctrl->ctrl_config &= ~NVME_CC_SHN_MASK;
+	ctrl->ctrl_config |= NVME_CC_SHN_NORMAL;
+
+	if (nvme_rdma_reg_write32(ctrl, NVME_REG_CC, ctrl->ctrl_config))
+		return;
+
+	while (!nvme_rdma_reg_read32(ctrl, NVME_REG_CSTS, &csts)) {
+		if ((csts & NVME_CSTS_SHST_MASK) == NVME_CSTS_SHST_CMPLT)
+			break;
+
+		msleep(100);
+		if (fatal_signal_pending(current) ||
+		    time_after(jiffies, timeout)) {
+			dev_err(ctrl->device,
+				"Device shutdown incomplete; abort shutdown\n");
+			break;
+		}
+	}
+}
+
+static int nvme_rdma_identify(struct nvme_rdma_ctrl *ctrl, unsigned nsid,
+		unsigned cns, void *buf)
+{
+	struct nvme_command c = { };
+
+	c.identify.opcode = nvme_admin_identify;
+	c.identify.nsid = cpu_to_le32(nsid);
+	c.identify.cns = cpu_to_le32(cns);
+
+	return nvme_rdma_submit_sync_cmd(ctrl->admin_q, &c, buf,
+			sizeof(struct nvme_id_ctrl), NULL);
+}
+
+static int nvme_rdma_set_queue_count(struct nvme_rdma_ctrl *ctrl, int count)
+{
+	struct nvme_command c = { };
+	u32 q_count = (count - 1) | ((count - 1) << 16);
+	u64 result;
+	int status, nr_io_queues;
+
+	c.features.opcode = nvme_admin_set_features;
+	c.features.fid = cpu_to_le32(NVME_FEAT_NUM_QUEUES);
+	c.features.dword11 = cpu_to_le32(q_count);
+
+	status = nvme_rdma_submit_sync_cmd(ctrl->admin_q, &c, NULL, 0, &result);
+	if (status < 0)
+		return status;
+	if (status > 0) {
+		dev_err(ctrl->device, "Could not set queue count (%d)\n",
+			status);
+		return 0;
+	}
+
+	nr_io_queues = min(result & 0xffff, result >> 16) + 1;
+	return min(count, nr_io_queues);
+}
+
+static int nvme_rdma_revalidate_disk(struct gendisk *disk)
+{
+	struct nvme_rdma_ns *ns = disk->private_data;
+	struct nvme_id_ns *id;
+	int lbaf;
+
+	id = kmalloc(sizeof(struct nvme_id_ctrl), GFP_KERNEL);
+	if (!id)
+		return -ENOMEM;
+
+	if (nvme_rdma_identify(ns->ctrl, ns->ns_id, 0, id)) {
+		dev_warn(disk_to_dev(disk),
+			"%s: Identify failure\n", __func__);
+		kfree(id);
+		return -ENODEV;
+	}
+
+	lbaf = id->flbas & NVME_NS_FLBAS_LBA_MASK;
+	ns->lba_shift = id->lbaf[lbaf].ds;
+	if (ns->lba_shift == 0)
+		ns->lba_shift = 9;
+
+	blk_queue_logical_block_size(ns->queue, 1 << ns->lba_shift);
+	set_capacity(disk, le64_to_cpup(&id->nsze) << (ns->lba_shift - 9));
+
+	kfree(id);
+	return 0;
+}
+
+static void nvme_rdma_free_ctrl(struct kref *kref);
+
+static void nvme_rdma_free_ns(struct kref *kref)
+{
+	struct nvme_rdma_ns *ns = container_of(kref, struct nvme_rdma_ns, kref);
+	struct nvme_rdma_ctrl *ctrl = ns->ctrl;
+
+	ns->disk->private_data = NULL;
+	put_disk(ns->disk);
+	kfree(ns);
+	kref_put(&ctrl->kref, nvme_rdma_free_ctrl);
+}
+
+static int nvme_rdma_open(struct block_device *bdev, fmode_t mode)
+{
+	struct nvme_rdma_ns *ns;
+	int ret = 0;
+
+	mutex_lock(&nvme_rdma_ctrl_mutex);
+	ns = bdev->bd_disk->private_data;
+	if (!ns)
+		ret = -ENXIO;
+	else if (!kref_get_unless_zero(&ns->kref))
+		ret = -ENXIO;
+	mutex_unlock(&nvme_rdma_ctrl_mutex);
+
+	return ret;
+}
+
+static void nvme_rdma_release(struct gendisk *disk, fmode_t mode)
+{
+	struct nvme_rdma_ns *ns = disk->private_data;
+
+	kref_put(&ns->kref, nvme_rdma_free_ns);
+}
+
+static const struct block_device_operations nvme_rdma_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nvme_rdma_open,
+	.release	= nvme_rdma_release,
+	.revalidate_disk = nvme_rdma_revalidate_disk,
+};
+
+static void nvme_rdma_alloc_ns(struct nvme_rdma_ctrl *ctrl, unsigned nsid)
+{
+	struct nvme_rdma_ns *ns;
+	struct gendisk *disk;
+
+	ns = kzalloc(sizeof(*ns), GFP_KERNEL);
+	if (!ns)
+		return;
+
+	ns->queue = blk_mq_init_queue(&ctrl->tag_set);
+	if (IS_ERR(ns->queue))
+		goto out_free_ns;
+	queue_flag_set_unlocked(QUEUE_FLAG_NOMERGES, ns->queue);
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, ns->queue);
+	ns->ctrl = ctrl;
+	ns->queue->queuedata = ns;
+
+	disk = alloc_disk(0);
+	if (!disk)
+		goto out_free_queue;
+
+	kref_init(&ns->kref);
+	ns->ns_id = nsid;
+	ns->disk = disk;
+	ns->lba_shift = 9;
+
+	blk_queue_logical_block_size(ns->queue, 1 << ns->lba_shift);
+	blk_queue_max_hw_sectors(ns->queue, ctrl->max_hw_sectors);
+	blk_queue_max_segments(ns->queue, ctrl->max_fr_pages);
+	blk_queue_virt_boundary(ns->queue, PAGE_SIZE - 1);
+	if (ctrl->vwc & NVME_CTRL_VWC_PRESENT)
+		blk_queue_flush(ns->queue, REQ_FLUSH | REQ_FUA);
+
+	disk->major = nvme_rdma_major;
+	disk->first_minor = 0;
+	disk->fops = &nvme_rdma_fops;
+	disk->private_data = ns;
+	disk->queue = ns->queue;
+	disk->driverfs_dev = ctrl->device;
+	disk->flags = GENHD_FL_EXT_DEVT;
+	sprintf(disk->disk_name, "nvmf%dn%d", ctrl->instance, nsid);
+
+	set_capacity(disk, 0);
+	if (nvme_rdma_revalidate_disk(ns->disk))
+		goto out_put_disk;
+
+	kref_get(&ctrl->kref);
+	list_add_tail(&ns->list, &ctrl->namespaces);
+	add_disk(ns->disk);
+	return;
+
+out_put_disk:
+	put_disk(disk);
+out_free_queue:
+	blk_cleanup_queue(ns->queue);
+out_free_ns:
+	kfree(ns);
+}
+
+static void nvme_rdma_ns_remove(struct nvme_rdma_ns *ns)
+{
+	if (ns->disk->flags & GENHD_FL_UP)
+		del_gendisk(ns->disk);
+	blk_cleanup_queue(ns->queue);
+
+	list_del_init(&ns->list);
+	kref_put(&ns->kref, nvme_rdma_free_ns);
+}
+
+static int nvme_rdma_scan_namespaces(struct nvme_rdma_ctrl *ctrl)
+{
+	struct nvme_id_ctrl *id;
+	unsigned nn, i;
+
+	id = kmalloc(sizeof(struct nvme_id_ctrl), GFP_KERNEL);
+	if (!id)
+		return -ENOMEM;
+
+	if (nvme_rdma_identify(ctrl, 0, 1, id)) {
+		dev_err(ctrl->device, "Identify Controller failed\n");
+		kfree(id);
+		return -EIO;
+	}
+
+	nn = le32_to_cpup(&id->nn);
+	ctrl->vwc = id->vwc;
+	memcpy(ctrl->serial, id->sn, sizeof(id->sn));
+	memcpy(ctrl->model, id->mn, sizeof(id->mn));
+	memcpy(ctrl->firmware_rev, id->fr, sizeof(id->fr));
+
+	ctrl->max_hw_sectors =
+		(ctrl->max_fr_pages - 1) << (PAGE_SHIFT - 9);
+	if (id->mdts)
+		ctrl->max_hw_sectors = min_t(u32, ctrl->max_hw_sectors,
+				1 << (id->mdts + 12 - 9));
+	kfree(id);
+
+	for (i = 1; i <= nn; i++)
+		nvme_rdma_alloc_ns(ctrl, i);
+	return 0;
+}
+
+static void nvme_rdma_cancel_request(struct request *rq, void *data,
+		bool reserved)
+{
+	struct nvme_rdma_ctrl *ctrl = data;
+
+	if (!blk_mq_request_started(rq))
+		return;
+
+	dev_warn(ctrl->device, "Cancelling I/O %d\n", rq->tag);
+	blk_mq_complete_request(rq, rq->cmd_type == REQ_TYPE_DRV_PRIV ?
+			NVME_SC_ABORT_REQ | NVME_SC_DNR : -EIO);
+}
+
+static void nvme_rdma_cancel_requests(struct nvme_rdma_ctrl *ctrl)
+{
+	int i;
+
+	if (ctrl->tag_set.tags) {
+		for (i = 0; i < ctrl->tag_set.nr_hw_queues; i++)
+			blk_mq_all_tag_busy_iter(ctrl->tag_set.tags[i],
+				nvme_rdma_cancel_request, ctrl);
+	}
+	blk_mq_all_tag_busy_iter(ctrl->admin_tag_set.tags[0],
+			nvme_rdma_cancel_request, ctrl);
+}
+
+static void nvme_rdma_stop_queues(struct nvme_rdma_ctrl *ctrl)
+{
+	int i;
+
+	for (i = 0; i < ctrl->queue_count; i++)
+		nvme_rdma_stop_queue(&ctrl->queues[i]);
+}
+
+static void nvme_rdma_free_queues(struct nvme_rdma_ctrl *ctrl)
+{
+	int i;
+
+	for (i = ctrl->queue_count - 1; i >= 0; i--)
+		nvme_rdma_free_queue(&ctrl->queues[i]);
+}
+
+/*
+ * Tear the controller down: the queues stop taking requests and their
+ * queue pairs go into the error state first, so that nothing started
+ * waits for a response any more when the request queues are drained.
+ */
+static void nvme_rdma_teardown_ctrl(struct nvme_rdma_ctrl *ctrl,
+		bool shutdown)
+{
+	struct nvme_rdma_ns *ns, *next;
+
+	if (shutdown && test_bit(NVME_RDMA_Q_LIVE, &ctrl->queues[0].flags))
+		nvme_rdma_shutdown_ctrl(ctrl);
+
+	nvme_rdma_stop_queues(ctrl);
+	nvme_rdma_cancel_requests(ctrl);
+
+	list_for_each_entry_safe(ns, next, &ctrl->namespaces, list)
+		nvme_rdma_ns_remove(ns);
+
+	if (ctrl->tag_set.tags)
+		blk_mq_free_tag_set(&ctrl->tag_set);
+	blk_cleanup_queue(ctrl->admin_q);
+	blk_mq_free_tag_set(&ctrl->admin_tag_set);
+
+	nvme_rdma_free_queues(ctrl);
+}
+
+static void nvme_rdma_del_ctrl_work(struct work_struct *work)
+{
+	struct nvme_rdma_ctrl *ctrl =
+		container_of(work, struct nvme_rdma_ctrl, delete_work);
+
+	mutex_lock(&nvme_rdma_ctrl_mutex);
+	list_del(&ctrl->list);
+	mutex_unlock(&nvme_rdma_ctrl_mutex);
+
+	nvme_rdma_teardown_ctrl(ctrl, true);
+	kref_put(&ctrl->kref, nvme_rdma_free_ctrl);
+}
+
+static int __nvme_rdma_del_ctrl(struct nvme_rdma_ctrl *ctrl)
+{
+	if (atomic_xchg(&ctrl->deleting, 1))
+		return -EBUSY;
+
+	if (!queue_work(nvme_rdma_wq, &ctrl->delete_work))
+		return -EBUSY;
+
+	return 0;
+}
+
+/*
+ * There is no reconnecting yet: a controller whose transport failed is
+ * deleted, and the namespaces go away with it.
+ */
+static void nvme_rdma_error_recovery(struct nvme_rdma_ctrl *ctrl)
+{
+	int i;
+
+	for (i = 0; i < ctrl->queue_count; i++)
+		clear_bit(NVME_RDMA_Q_LIVE, &ctrl->queues[i].flags);
+
+	if (!__nvme_rdma_del_ctrl(ctrl))
+		dev_warn(ctrl->device, "transport failure, deleting\n");
+}
+
+static void nvme_rdma_free_ctrl(struct kref *kref)
+{
+	struct nvme_rdma_ctrl *ctrl =
+		container_of(kref, struct nvme_rdma_ctrl, kref);
+
+	device_destroy(nvme_rdma_class, MKDEV(nvme_rdma_major, ctrl->instance));
+	ida_simple_remove(&nvme_rdma_instance_ida, ctrl->instance);
+	kfree(ctrl->queues);
+	kfree(ctrl);
+}
+
+static ssize_t nvme_rdma_sysfs_delete(struct device *dev,
+		struct device_attribute *attr, const char *buf,
+		size_t count)
+{
+	struct nvme_rdma_ctrl *ctrl = dev_get_drvdata(dev);
+	int ret;
+
+	ret = __nvme_rdma_del_ctrl(ctrl);
+	if (ret)
+		return ret;
+	return count;
+}
+static DEVICE_ATTR(delete_controller, S_IWUSR, NULL, nvme_rdma_sysfs_delete);
+
+static ssize_t nvme_rdma_sysfs_subsysnqn(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct nvme_rdma_ctrl *ctrl = dev_get_drvdata(dev);
+
+	return snprintf(buf, PAGE_SIZE, "%s\n", ctrl->subsysnqn);
+}
+static DEVICE_ATTR(subsysnqn, S_IRUGO, nvme_rdma_sysfs_subsysnqn, NULL);
+
+static ssize_t nvme_rdma_sysfs_address(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct nvme_rdma_ctrl *ctrl = dev_get_drvdata(dev);
+
+	return snprintf(buf, PAGE_SIZE, "traddr=%s,trsvcid=%s\n",
+			ctrl->traddr, ctrl->trsvcid);
+}
+static DEVICE_ATTR(address, S_IRUGO, nvme_rdma_sysfs_address, NULL);
+
+static ssize_t nvme_rdma_sysfs_cntlid(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct nvme_rdma_ctrl *ctrl = dev_get_drvdata(dev);
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", ctrl->cntlid);
+}
+static DEVICE_ATTR(cntlid, S_IRUGO, nvme_rdma_sysfs_cntlid, NULL);
+
+#define nvme_rdma_show_str_function(field)				\
+static ssize_t field##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct nvme_rdma_ctrl *ctrl = dev_get_drvdata(dev);		\
+	return sprintf(buf, "%.*s\n", (int)sizeof(ctrl->field),		\
+			ctrl->field);					\
+}									\
+static DEVICE_ATTR(field, S_IRUGO, field##_show, NULL);
+
+nvme_rdma_show_str_function(model);
+nvme_rdma_show_str_function(serial);
+nvme_rdma_show_str_function(firmware_rev);
+
+static struct attribute *nvme_rdma_ctrl_attrs[] = {
+	&dev_attr_delete_controller.attr,
+	&dev_attr_subsysnqn.attr,
+	&dev_attr_address.attr,
+	&dev_attr_cntlid.attr,
+	&dev_attr_model.attr,
+	&dev_attr_serial.attr,
+	&dev_attr_firmware_rev.attr,
+	NULL
+};
+
+static struct attribute_group nvme_rdma_ctrl_attr_group = {
+	.attrs		= nvme_rdma_ctrl_attrs,
+};
+
+static const struct attribute_group *nvme_rdma_ctrl_attr_groups[] = {
+	&nvme_rdma_ctrl_attr_group,
+	NULL,
+};
+
+static int nvme_rdma_configure_admin_queue(struct nvme_rdma_ctrl *ctrl)
+{
+	int ret;
+
+	ret = nvme_rdma_init_queue(ctrl, 0, NVME_RDMA_AQ_DEPTH);
+	if (ret)
+		return ret;
+
+	ctrl->rdma_dev = ctrl->queues[0].device;
+	ctrl->max_fr_pages = min_t(u32, NVME_RDMA_MAX_SEGMENTS,
+		ctrl->rdma_dev->attr.max_fast_reg_page_list_len);
+
+	ret = nvme_rdma_connect_queue(&ctrl->queues[0]);
+	if (ret)
+		goto out_free_queue;
+	set_bit(NVME_RDMA_Q_LIVE, &ctrl->queues[0].flags);
+
+	memset(&ctrl->admin_tag_set, 0, sizeof(ctrl->admin_tag_set));
+	ctrl->admin_tag_set.ops = &nvme_rdma_admin_mq_ops;
+	ctrl->admin_tag_set.queue_depth = NVME_RDMA_AQ_DEPTH;
+	ctrl->admin_tag_set.numa_node = NUMA_NO_NODE;
+	ctrl->admin_tag_set.cmd_size = sizeof(struct nvme_rdma_request);
+	ctrl->admin_tag_set.driver_data = ctrl;
+	ctrl->admin_tag_set.nr_hw_queues = 1;
+	ctrl->admin_tag_set.timeout = NVME_RDMA_ADMIN_TIMEOUT;
+
+	ret = blk_mq_alloc_tag_set(&ctrl->admin_tag_set);
+	if (ret)
+		goto out_free_queue;
+
+	ctrl->admin_q = blk_mq_init_queue(&ctrl->admin_tag_set);
+	if (IS_ERR(ctrl->admin_q)) {
+		ret = PTR_ERR(ctrl->admin_q);
+		goto out_free_tagset;
+	}
+
+	ret = nvme_rdma_reg_read64(ctrl, NVME_REG_CAP, &ctrl->cap);
+	if (ret) {
+		dev_err(ctrl->device, "prop_get NVME_REG_CAP failed\n");
+		goto out_cleanup_queue;
+	}
+
+	ctrl->queue_size = min_t(int, NVME_CAP_MQES(ctrl->cap) + 1,
+			ctrl->queue_size);
+
+	ret = nvme_rdma_enable_ctrl(ctrl);
+	if (ret)
+		goto out_cleanup_queue;
+
+	return 0;
+
+out_cleanup_queue:
+	blk_cleanup_queue(ctrl->admin_q);
+out_free_tagset:
+	blk_mq_free_tag_set(&ctrl->admin_tag_set);
+out_free_queue:
+	nvme_rdma_stop_queue(&ctrl->queues[0]);
+	nvme_rdma_free_queue(&ctrl->queues[0]);
+	return ret;
+}
+
+static int nvme_rdma_create_io_queues(struct nvme_rdma_ctrl *ctrl,
+		int nr_io_queues)
+{
+	int i, ret;
+
+	nr_io_queues = nvme_rdma_set_queue_count(ctrl, nr_io_queues);
+	if (nr_io_queues <= 0)
+		return nr_io_queues;
+
+	for (i = 1; i <= nr_io_queues; i++) {
+		ret = nvme_rdma_init_queue(ctrl, i, ctrl->queue_size);
+		if (ret)
+			break;
+		ctrl->queue_count++;
+
+		ret = nvme_rdma_connect_queue(&ctrl->queues[i]);
+		if (ret)
+			break;
+		set_bit(NVME_RDMA_Q_LIVE, &ctrl->queues[i].flags);
+	}
+
+	/* as many as connected, and fewer are still good to use */
+	nr_io_queues = 0;
+	for (i = 1; i < ctrl->queue_count; i++) {
+		if (!test_bit(NVME_RDMA_Q_LIVE, &ctrl->queues[i].flags))
+			break;
+		nr_io_queues++;
+	}
+	if (!nr_io_queues)
+		return 0;
+
+	memset(&ctrl->tag_set, 0, sizeof(ctrl->tag_set));
+	ctrl->tag_set.ops = &nvme_rdma_mq_ops;
+	ctrl->tag_set.queue_depth = ctrl->queue_size;
+	ctrl->tag_set.numa_node = NUMA_NO_NODE;
+	ctrl->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+	ctrl->tag_set.cmd_size = sizeof(struct nvme_rdma_request);
+	ctrl->tag_set.driver_data = ctrl;
+	ctrl->tag_set.nr_hw_queues = nr_io_queues;
+	ctrl->tag_set.timeout = NVME_RDMA_IO_TIMEOUT;
+
+	ret = blk_mq_alloc_tag_set(&ctrl->tag_set);
+	if (ret)
+		ctrl->tag_set.tags = NULL;
+	return ret;
+}
+
+enum {
+	NVMF_OPT_ERR		= 0,
+	NVMF_OPT_TRANSPORT	= 1 << 0,
+	NVMF_OPT_TRADDR		= 1 << 1,
+	NVMF_OPT_TRSVCID	= 1 << 2,
+	NVMF_OPT_NQN		= 1 << 3,
+	NVMF_OPT_HOSTNQN	= 1 << 4,
+	NVMF_OPT_NR_IO_QUEUES	= 1 << 5,
+	NVMF_OPT_QUEUE_SIZE	= 1 << 6,
+	NVMF_OPT_REQUIRED	= NVMF_OPT_TRANSPORT | NVMF_OPT_TRADDR |
+				  NVMF_OPT_NQN,
+};
+
+static const match_table_t opt_tokens = {
+	{ NVMF_OPT_TRANSPORT,		"transport=%s"		},
+	{ NVMF_OPT_TRADDR,		"traddr=%s"		},
+	{ NVMF_OPT_TRSVCID,		"trsvcid=%s"		},
+	{ NVMF_OPT_NQN,			"nqn=%s"		},
+	{ NVMF_OPT_HOSTNQN,		"hostnqn=%s"		},
+	{ NVMF_OPT_NR_IO_QUEUES,	"nr_io_queues=%d"	},
+	{ NVMF_OPT_QUEUE_SIZE,		"queue_size=%d"		},
+	{ NVMF_OPT_ERR,			NULL			}
+};
+
+static int nvme_rdma_parse_options(struct nvme_rdma_ctrl *ctrl,
+		const char *buf, int *nr_io_queues)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *options, *o, *p;
+	unsigned int mask = 0;
+	int token, ret = -EINVAL;
+
+	options = o = kstrdup(buf, GFP_KERNEL);
+	if (!options)
+		return -ENOMEM;
+
+	while ((p = strsep(&o, ",\n")) != NULL) {
+		if (!*p)
+			continue;
+
+		token = match_token(p, opt_tokens, args);
+		mask |= token;
+		switch (token) {
+		case NVMF_OPT_TRANSPORT:
+			p = match_strdup(args);
+			if (!p) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			if (strcmp(p, "rdma")) {
+				pr_err("unsupported transport %s\n", p);
+				kfree(p);
+				goto out;
+			}
+			kfree(p);
+			break;
+		case NVMF_OPT_TRADDR:
+			if (match_strlcpy(ctrl->traddr, args,
+					sizeof(ctrl->traddr)) >=
+					sizeof(ctrl->traddr))
+				goto out;
+			break;
+		case NVMF_OPT_TRSVCID:
+			if (match_strlcpy(ctrl->trsvcid, args,
+					sizeof(ctrl->trsvcid)) >=
+					sizeof(ctrl->trsvcid))
+				goto out;
+			break;
+		case NVMF_OPT_NQN:
+			if (match_strlcpy(ctrl->subsysnqn, args,
+					NVMF_NQN_SIZE) >= NVMF_NQN_SIZE)
+				goto out;
+			break;
+		case NVMF_OPT_HOSTNQN:
+			if (match_strlcpy(ctrl->hostnqn, args,
+					NVMF_NQN_SIZE) >= NVMF_NQN_SIZE)
+				goto out;
+			break;
+		case NVMF_OPT_NR_IO_QUEUES:
+			if (match_int(args, nr_io_queues) ||
+			    *nr_io_queues <= 0)
+				goto out;
+			break;
+		case NVMF_OPT_QUEUE_SIZE:
+			if (match_int(args, &ctrl->queue_size) ||
+			    ctrl->queue_size < 2 ||
+			    ctrl->queue_size > NVME_RDMA_MAX_QUEUE_SIZE)
+				goto out;
+			break;
+		default:
+			pr_warn("unknown parameter or missing value '%s'\n",
+				p);
+			goto out;
+		}
+	}
+
+	if ((mask & NVMF_OPT_REQUIRED) != NVMF_OPT_REQUIRED) {
+		pr_err("transport, traddr and nqn are required\n");
+		goto out;
+	}
+	ret = 0;
+out:
+	kfree(options);
+	return ret;
+}
+
+static int nvme_rdma_parse_addr(struct nvme_rdma_ctrl *ctrl)
+{
+	struct sockaddr_in *in4 = (struct sockaddr_in *)&ctrl->addr;
+	struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&ctrl->addr;
+	u16 port = NVME_RDMA_IP_PORT;
+
+	if (ctrl->trsvcid[0] && kstrtou16(ctrl->trsvcid, 0, &port))
+		return -EINVAL;
+	if (!ctrl->trsvcid[0])
+		snprintf(ctrl->trsvcid, sizeof(ctrl->trsvcid), "%d", port);
+
+	memset(&ctrl->addr, 0, sizeof(ctrl->addr));
+	if (in4_pton(ctrl->traddr, -1, (u8 *)&in4->sin_addr.s_addr,
+			'\0', NULL)) {
+		in4->sin_family = AF_INET;
+		in4->sin_port = htons(port);
+		return 0;
+	}
+	if (in6_pton(ctrl->traddr, -1, in6->sin6_addr.s6_addr, '\0', NULL)) {
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = htons(port);
+		return 0;
+	}
+
+	pr_err("malformed IP address passed: %s\n", ctrl->traddr);
+	return -EINVAL;
+}
+
+static struct nvme_rdma_ctrl *nvme_rdma_create_ctrl(const char *buf)
+{
+	struct nvme_rdma_ctrl *ctrl;
+	int nr_io_queues = num_online_cpus();
+	int ret;
+
+	ctrl = kzalloc(sizeof(*ctrl), GFP_KERNEL);
+	if (!ctrl)
+		return ERR_PTR(-ENOMEM);
+
+	INIT_LIST_HEAD(&ctrl->list);
+	INIT_LIST_HEAD(&ctrl->namespaces);
+	INIT_WORK(&ctrl->delete_work, nvme_rdma_del_ctrl_work);
+	kref_init(&ctrl->kref);
+	ctrl->queue_size = NVME_RDMA_DEF_QUEUE_SIZE;
+
+	/*
+	 * Transport errors while the controller is still being set up fail
+	 * its commands instead, and the setup then tears it down.
+	 */
+	atomic_set(&ctrl->deleting, 1);
+
+	ret = nvme_rdma_parse_options(ctrl, buf, &nr_io_queues);
+	if (ret)
+		goto out_free_ctrl;
+
+	ret = nvme_rdma_parse_addr(ctrl);
+	if (ret)
+		goto out_free_ctrl;
+
+	generate_random_uuid(ctrl->hostid);
+	if (!ctrl->hostnqn[0])
+		snprintf(ctrl->hostnqn, NVMF_NQN_SIZE,
+			"nqn.2014-08.org.nvmexpress:NVMf:uuid:%pUb",
+			ctrl->hostid);
+
+	nr_io_queues = min_t(int, nr_io_queues, num_online_cpus());
+	ctrl->queues = kcalloc(nr_io_queues + 1, sizeof(*ctrl->queues),
+			GFP_KERNEL);
+	if (!ctrl->queues) {
+		ret = -ENOMEM;
+		goto out_free_ctrl;
+	}
+	ctrl->queue_count = 1;
+
+	ret = ida_simple_get(&nvme_rdma_instance_ida, 0, 0, GFP_KERNEL);
+	if (ret < 0)
+		goto out_free_queues;
+	ctrl->instance = ret;
+
+	ctrl->device = device_create_with_groups(nvme_rdma_class, NULL,
+			MKDEV(nvme_rdma_major, ctrl->instance), ctrl,
+			nvme_rdma_ctrl_attr_groups, "nvmf%d", ctrl->instance);
+	if (IS_ERR(ctrl->device)) {
+		ret = PTR_ERR(ctrl->device);
+		goto out_release_instance;
+	}
+
+	ret = nvme_rdma_configure_admin_queue(ctrl);
+	if (ret)
+		goto out_destroy_device;
+
+	ret = nvme_rdma_create_io_queues(ctrl, nr_io_queues);
+	if (ret)
+		goto out_teardown;
+
+	if (ctrl->tag_set.tags) {
+		ret = nvme_rdma_scan_namespaces(ctrl);
+		if (ret)
+			goto out_teardown;
+	}
+
+	dev_info(ctrl->device,
+		"new ctrl: NQN \"%s\", addr %s:%s, %d I/O queues\n",
+		ctrl->subsysnqn, ctrl->traddr, ctrl->trsvcid,
+		ctrl->tag_set.tags ? ctrl->tag_set.nr_hw_queues : 0);
+
+	mutex_lock(&nvme_rdma_ctrl_mutex);
+	list_add_tail(&ctrl->list, &nvme_rdma_ctrl_list);
+	mutex_unlock(&nvme_rdma_ctrl_mutex);
+	atomic_set(&ctrl->deleting, 0);
+
+	return ctrl;
+
+out_teardown:
+	nvme_rdma_teardown_ctrl(ctrl, false);
+	kref_put(&ctrl->kref, nvme_rdma_free_ctrl);
+	return ERR_PTR(ret);
+out_destroy_device:
+	device_destroy(nvme_rdma_class, MKDEV(nvme_rdma_major, ctrl->instance));
+out_release_instance:
+	ida_simple_remove(&nvme_rdma_instance_ida, ctrl->instance);
+out_free_queues:
+	kfree(ctrl->queues);
+out_free_ctrl:
+	kfree(ctrl);
+	return ERR_PTR(ret);
+}
+
+/*
+ * /dev/nvme-fabrics: a write creates a controller, reading back from the
+ * same file then tells which one.
+ */
+static ssize_t nvme_rdma_dev_write(struct file *file, const char __user *ubuf,
+		size_t count, loff_t *pos)
+{
+	struct nvme_rdma_ctrl *ctrl;
+	char *buf;
+	int ret = 0;
+
+	if (count > PAGE_SIZE)
+		return -ENOMEM;
+	if (file->private_data)
+		return -EINVAL;
+
+	buf = kzalloc(count + 1, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	if (copy_from_user(buf, ubuf, count)) {
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	ctrl = nvme_rdma_create_ctrl(buf);
+	if (IS_ERR(ctrl)) {
+		ret = PTR_ERR(ctrl);
+		goto out_free;
+	}
+
+	kref_get(&ctrl->kref);
+	file->private_data = ctrl;
+out_free:
+	kfree(buf);
+	return ret ? ret : count;
+}
+
+static ssize_t nvme_rdma_dev_read(struct file *file, char __user *ubuf,
+		size_t count, loff_t *pos)
+{
+	struct nvme_rdma_ctrl *ctrl = file->private_data;
+	char buf[32];
+	int len;
+
+	if (!ctrl)
+		return -EINVAL;
+
+	len = snprintf(buf, sizeof(buf), "instance=%d,cntlid=%d\n",
+			ctrl->instance, ctrl->cntlid);
+	return simple_read_from_buffer(ubuf, count, pos, buf, len);
+}
+
+static int nvme_rdma_dev_open(struct inode *inode, struct file *file)
+{
+	file->private_data = NULL;
+	return 0;
+}
+
+static int nvme_rdma_dev_release(struct inode *inode, struct file *file)
+{
+	struct nvme_rdma_ctrl *ctrl = file->private_data;
+
+	if (ctrl)
+		kref_put(&ctrl->kref, nvme_rdma_free_ctrl);
+	return 0;
+}
+
+static const struct file_operations nvme_rdma_dev_fops = {
+	.owner		= THIS_MODULE,
+	.write		= nvme_rdma_dev_write,
+	.read		= nvme_rdma_dev_read,
+	.open		= nvme_rdma_dev_open,
+	.release	= nvme_rdma_dev_release,
+};
+
+static struct miscdevice nvme_rdma_misc = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "nvme-fabrics",
+	.fops		= &nvme_rdma_dev_fops,
+};
+
+static int __init nvme_rdma_init_module(void)
+{
+	int ret;
+
+	nvme_rdma_wq = alloc_workqueue("nvme_rdma_wq", WQ_MEM_RECLAIM, 0);
+	if (!nvme_rdma_wq)
+		return -ENOMEM;
+
+	ret = register_blkdev(0, "nvmf");
+	if (ret < 0)
+		goto out_destroy_wq;
+	nvme_rdma_major = ret;
+
+	nvme_rdma_class = class_create(THIS_MODULE, "nvme-rdma");
+	if (IS_ERR(nvme_rdma_class)) {
+		ret = PTR_ERR(nvme_rdma_class);
+		goto out_unregister_blkdev;
+	}
+
+	ret = misc_register(&nvme_rdma_misc);
+	if (ret)
+		goto out_destroy_class;
+
+	return 0;
+
+out_destroy_class:
+	class_destroy(nvme_rdma_class);
+out_unregister_blkdev:
+	unregister_blkdev(nvme_rdma_major, "nvmf");
+out_destroy_wq:
+	destroy_workqueue(nvme_rdma_wq);
+	return ret;
+}
+
+static void __exit nvme_rdma_cleanup_module(void)
+{
+	struct nvme_rdma_ctrl *ctrl, *next;
+
+	misc_deregister(&nvme_rdma_misc);
+
+	mutex_lock(&nvme_rdma_ctrl_mutex);
+	list_for_each_entry_safe(ctrl, next, &nvme_rdma_ctrl_list, list)
+		__nvme_rdma_del_ctrl(ctrl);
+	mutex_unlock(&nvme_rdma_ctrl_mutex);
+	flush_workqueue(nvme_rdma_wq);
+
+	class_destroy(nvme_rdma_class);
+	unregister_blkdev(nvme_rdma_major, "nvmf");
+	destroy_workqueue(nvme_rdma_wq);
+	ida_destroy(&nvme_rdma_instance_ida);
+}
+
+module_init(nvme_rdma_init_module);
+module_exit(nvme_rdma_cleanup_module);
+
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,1453 @@
+/*
+ * NVMe over Fabrics RDMA target.
+ *
+ * Every queue of a controller is an RC queue pair of its own.  Commands
+ * arrive in receive buffers, the data of a command is moved with RDMA
+ * READs and WRITEs from and to the buffer the host registered, named by
+ * the keyed SGL of the command, and the completion goes back in a SEND.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/atomic.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/nvme.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+#include <linux/inet.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <asm/unaligned.h>
+
+#include <rdma/ib_verbs.h>
+#include <rdma/rdma_cm.h>
+
+#include <linux/nvme-rdma.h>
+#include "nvmet.h"
+
+/* The number of completions one run of the CQ work reaps at a time */
+#define NVMET_RDMA_POLL_BATCH	16
+
+/* Enough work requests to always move the largest command */
+#define NVMET_RDMA_MAX_PAGES	(NVMET_MAX_DATA_LEN / PAGE_SIZE)
+
+/*
+ * The work request a completion is for is told apart by the low bits of
+ * its wr_id: the contexts are at least pointer aligned.
+ */
+enum {
+	NVMET_RDMA_WR_RECV	= 0,
+	NVMET_RDMA_WR_SEND	= 1,
+	NVMET_RDMA_WR_READ	= 2,
+	NVMET_RDMA_WR_MASK	= 3,
+};
+
+static inline u64 nvmet_rdma_wr_id(void *ctx, int type)
+{
+	return (uintptr_t)ctx | type;
+}
+
+static inline void *nvmet_rdma_wr_ctx(u64 wr_id)
+{
+	return (void *)(uintptr_t)(wr_id & ~(u64)NVMET_RDMA_WR_MASK);
+}
+
+struct nvmet_rdma_cmd {
+	struct ib_sge		sge;
+	struct ib_recv_wr	wr;
+	struct nvme_command	*nvme_cmd;
+	struct nvmet_rdma_queue	*queue;
+};
+
+struct nvmet_rdma_rsp {
+	struct ib_sge		send_sge;
+	struct ib_send_wr	send_wr;
+
+	struct nvmet_rdma_cmd	*cmd;
+	struct nvmet_rdma_queue	*queue;
+
+	/* the RDMA READs or WRITEs moving the data of the command */
+	struct ib_rdma_wr	*rdma_wrs;
+	struct ib_sge		*rdma_sges;
+	int			n_rdma;
+	int			dma_nents;
+
+	bool			invalidate;
+	bool			responding;
+	bool			allocated;
+	int			n_wait_wrs;
+
+	struct list_head	free_list;
+	struct list_head	wait_list;
+
+	struct nvme_completion	*nvme_rsp;
+	struct nvmet_req	req;
+};
+
+enum nvmet_rdma_queue_state {
+	NVMET_RDMA_Q_CONNECTING,
+	NVMET_RDMA_Q_LIVE,
+	NVMET_RDMA_Q_DISCONNECTING,
+};
+
+struct nvmet_rdma_queue {
+	struct rdma_cm_id	*cm_id;
+	struct nvmet_port	*port;
+	struct ib_cq		*cq;
+	struct work_struct	cq_work;
+	struct ib_wc		wcs[NVMET_RDMA_POLL_BATCH];
+	atomic_t		sq_wr_avail;
+	struct nvmet_rdma_device *dev;
+	int			max_sge;
+
+	spinlock_t		state_lock;
+	enum nvmet_rdma_queue_state state;
+
+	struct nvmet_sq		nvme_sq;
+
+	struct nvmet_rdma_rsp	*rsps;
+	struct list_head	free_rsps;
+	spinlock_t		rsps_lock;
+	atomic_t		rsps_inflight;
+	wait_queue_head_t	rsps_wait;
+
+	struct nvmet_rdma_cmd	*cmds;
+
+	struct work_struct	release_work;
+	struct list_head	rsp_wr_wait_list;
+	spinlock_t		rsp_wr_wait_lock;
+
+	int			host_qid;
+	int			recv_queue_size;
+	int			send_queue_size;
+
+	struct list_head	queue_list;
+};
+
+struct nvmet_rdma_device {
+	struct ib_device	*device;
+	struct ib_pd		*pd;
+	struct ib_device_attr	attr;
+	struct kref		ref;
+	struct list_head	entry;
+};
+
+static LIST_HEAD(nvmet_rdma_queue_list);
+static DEFINE_MUTEX(nvmet_rdma_queue_mutex);
+
+static LIST_HEAD(device_list);
+static DEFINE_MUTEX(device_list_mutex);
+
+static struct workqueue_struct *nvmet_rdma_wq;
+static struct nvmet_fabrics_ops nvmet_rdma_ops;
+
+static void nvmet_rdma_queue_disconnect(struct nvmet_rdma_queue *queue);
+static void nvmet_rdma_post_stage(struct nvmet_rdma_rsp *rsp);
+
+static inline bool nvmet_rdma_need_data_in(struct nvmet_rdma_rsp *rsp)
+{
+	return nvme_is_write(rsp->req.cmd) && rsp->req.data_len &&
+		!rsp->req.rsp->status;
+}
+
+static inline bool nvmet_rdma_need_data_out(struct nvmet_rdma_rsp *rsp)
+{
+	return !nvme_is_write(rsp->req.cmd) && rsp->req.data_len &&
+		!rsp->req.rsp->status;
+}
+
+static int nvmet_rdma_alloc_sgl(struct scatterlist **sgl, int *nents,
+		u32 length)
+{
+	struct scatterlist *sg;
+	struct page *page;
+	int i, nent;
+
+	nent = DIV_ROUND_UP(length, PAGE_SIZE);
+	sg = kmalloc_array(nent, sizeof(struct scatterlist), GFP_KERNEL);
+	if (!sg)
+		return -ENOMEM;
+
+	sg_init_table(sg, nent);
+
+	for (i = 0; i < nent; i++) {
+		u32 page_len = min_t(u32, length, PAGE_SIZE);
+
+		page = alloc_page(GFP_KERNEL);
+		if (!page)
+			goto out_free_pages;
+
+		sg_set_page(&sg[i], page, page_len, 0);
+		length -= page_len;
+	}
+
+	*sgl = sg;
+	*nents = nent;
+	return 0;
+
+out_free_pages:
+	while (--i >= 0)
+		__free_page(sg_page(&sg[i]));
+	kfree(sg);
+	return -ENOMEM;
+}
+
+static void nvmet_rdma_free_sgl(struct scatterlist *sgl, int nents)
+{
+	struct scatterlist *sg;
+	int count;
+
+	if (!sgl || !nents)
+		return;
+
+	for_each_sg(sgl, sg, nents, count)
+		__free_page(sg_page(sg));
+	kfree(sgl);
+}
+
+static int nvmet_rdma_alloc_cmds(struct nvmet_rdma_queue *queue)
+{
+	struct ib_device *ibdev = queue->dev->device;
+	struct nvmet_rdma_cmd *cmds, *c;
+	int nr_cmds = queue->recv_queue_size, i;
+
+	cmds = kcalloc(nr_cmds, sizeof(struct nvmet_rdma_cmd), GFP_KERNEL);
+	if (!cmds)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_cmds; i++) {
+		c = &cmds[i];
+		c->queue = queue;
+
+		c->nvme_cmd = kmalloc(sizeof(*c->nvme_cmd), GFP_KERNEL);
+		if (!c->nvme_cmd)
+			goto out_free;
+
+		c->sge.addr = ib_dma_map_single(ibdev, c->nvme_cmd,
+				sizeof(*c->nvme_cmd), DMA_FROM_DEVICE);
+		if (ib_dma_mapping_error(ibdev, c->sge.addr)) {
+			kfree(c->nvme_cmd);
+			goto out_free;
+		}
+		c->sge.length = sizeof(*c->nvme_cmd);
+		c->sge.lkey = queue->dev->pd->local_dma_lkey;
+
+		c->wr.wr_id = nvmet_rdma_wr_id(c, NVMET_RDMA_WR_RECV);
+		c->wr.sg_list = &c->sge;
+		c->wr.num_sge = 1;
+	}
+
+	queue->cmds = cmds;
+	return 0;
+
+out_free:
+	while (--i >= 0) {
+		c = &cmds[i];
+		ib_dma_unmap_single(ibdev, c->sge.addr,
+				sizeof(*c->nvme_cmd), DMA_FROM_DEVICE);
+		kfree(c->nvme_cmd);
+	}
+	kfree(cmds);
+	return -ENOMEM;
+}
+
+static void nvmet_rdma_free_cmds(struct nvmet_rdma_queue *queue)
+{
+	struct ib_device *ibdev = queue->dev->device;
+	int i;
+
+	for (i = 0; i < queue->recv_queue_size; i++) {
+		struct nvmet_rdma_cmd *c = &queue->cmds[i];
+
+		ib_dma_unmap_single(ibdev, c->sge.addr,
+				sizeof(*c->nvme_cmd), DMA_FROM_DEVICE);
+		kfree(c->nvme_cmd);
+	}
+	kfree(queue->cmds);
+}
+
+static int nvmet_rdma_alloc_rsp(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *r)
+{
+	struct ib_device *ibdev = queue->dev->device;
+
+	r->queue = queue;
+
+	r->nvme_rsp = kmalloc(sizeof(*r->nvme_rsp), GFP_KERNEL);
+	if (!r->nvme_rsp)
+		return -ENOMEM;
+
+	r->send_sge.addr = ib_dma_map_single(ibdev, r->nvme_rsp,
+			sizeof(*r->nvme_rsp), DMA_TO_DEVICE);
+	if (ib_dma_mapping_error(ibdev, r->send_sge.addr)) {
+		kfree(r->nvme_rsp);
+		return -ENOMEM;
+	}
+	r->send_sge.length = sizeof(*r->nvme_rsp);
+	r->send_sge.lkey = queue->dev->pd->local_dma_lkey;
+
+	r->send_wr.wr_id = nvmet_rdma_wr_id(r, NVMET_RDMA_WR_SEND);
+	r->send_wr.sg_list = &r->send_sge;
+	r->send_wr.num_sge = 1;
+	r->send_wr.send_flags = IB_SEND_SIGNALED;
+
+	r->req.rsp = r->nvme_rsp;
+	return 0;
+}
+
+static void nvmet_rdma_free_rsp(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *r)
+{
+	ib_dma_unmap_single(queue->dev->device, r->send_sge.addr,
+			sizeof(*r->nvme_rsp), DMA_TO_DEVICE);
+	kfree(r->nvme_rsp);
+}
+
+static int nvmet_rdma_alloc_rsps(struct nvmet_rdma_queue *queue)
+{
+	/*
+	 * A response only goes back to the free list once its SEND has
+	 * completed, by which time its receive buffer has long been
+	 * reposted: keep twice as many as there are receives.
+	 */
+	int nr_rsps = queue->recv_queue_size * 2;
+	int ret = -ENOMEM, i;
+
+	queue->rsps = kcalloc(nr_rsps, sizeof(struct nvmet_rdma_rsp),
+			GFP_KERNEL);
+	if (!queue->rsps)
+		goto out;
+
+	for (i = 0; i < nr_rsps; i++) {
+		struct nvmet_rdma_rsp *rsp = &queue->rsps[i];
+
+		ret = nvmet_rdma_alloc_rsp(queue, rsp);
+		if (ret)
+			goto out_free;
+
+		list_add_tail(&rsp->free_list, &queue->free_rsps);
+	}
+
+	return 0;
+
+out_free:
+	while (--i >= 0)
+		nvmet_rdma_free_rsp(queue, &queue->rsps[i]);
+	kfree(queue->rsps);
+out:
+	return ret;
+}
+
+static void nvmet_rdma_free_rsps(struct nvmet_rdma_queue *queue)
+{
+	int i, nr_rsps = queue->recv_queue_size * 2;
+
+	for (i = 0; i < nr_rsps; i++)
+		nvmet_rdma_free_rsp(queue, &queue->rsps[i]);
+	kfree(queue->rsps);
+}
+
+static struct nvmet_rdma_rsp *
+nvmet_rdma_get_rsp(struct nvmet_rdma_queue *queue)
+{
+	struct nvmet_rdma_rsp *rsp = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->rsps_lock, flags);
+	if (!list_empty(&queue->free_rsps)) {
+		rsp = list_first_entry(&queue->free_rsps,
+				struct nvmet_rdma_rsp, free_list);
+		list_del(&rsp->free_list);
+	}
+	spin_unlock_irqrestore(&queue->rsps_lock, flags);
+
+	if (unlikely(!rsp)) {
+		rsp = kzalloc(sizeof(*rsp), GFP_KERNEL);
+		if (!rsp)
+			return NULL;
+		if (nvmet_rdma_alloc_rsp(queue, rsp)) {
+			kfree(rsp);
+			return NULL;
+		}
+		rsp->allocated = true;
+	}
+
+	atomic_inc(&queue->rsps_inflight);
+	return rsp;
+}
+
+static void nvmet_rdma_put_rsp(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvmet_rdma_queue *queue = rsp->queue;
+	unsigned long flags;
+
+	if (unlikely(rsp->allocated)) {
+		nvmet_rdma_free_rsp(queue, rsp);
+		kfree(rsp);
+	} else {
+		spin_lock_irqsave(&queue->rsps_lock, flags);
+		list_add_tail(&rsp->free_list, &queue->free_rsps);
+		spin_unlock_irqrestore(&queue->rsps_lock, flags);
+	}
+
+	if (atomic_dec_and_test(&queue->rsps_inflight))
+		wake_up(&queue->rsps_wait);
+}
+
+static int nvmet_rdma_post_recv(struct nvmet_rdma_cmd *cmd)
+{
+	struct ib_recv_wr *bad_wr;
+
+	ib_dma_sync_single_for_device(cmd->queue->dev->device,
+			cmd->sge.addr, cmd->sge.length, DMA_FROM_DEVICE);
+
+	return ib_post_recv(cmd->queue->cm_id->qp, &cmd->wr, &bad_wr);
+}
+
+static bool nvmet_rdma_get_wrs(struct nvmet_rdma_queue *queue, int n)
+{
+	if (atomic_sub_return(n, &queue->sq_wr_avail) < 0) {
+		atomic_add(n, &queue->sq_wr_avail);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Post the next stage of a response, the RDMA READ of its data or its
+ * completion, once the send queue has room for all its work requests.
+ * Responses that have to wait are posted in order.
+ */
+static void nvmet_rdma_queue_stage(struct nvmet_rdma_rsp *rsp, int n_wrs)
+{
+	struct nvmet_rdma_queue *queue = rsp->queue;
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->rsp_wr_wait_lock, flags);
+	if (list_empty(&queue->rsp_wr_wait_list) &&
+	    nvmet_rdma_get_wrs(queue, n_wrs)) {
+		spin_unlock_irqrestore(&queue->rsp_wr_wait_lock, flags);
+		nvmet_rdma_post_stage(rsp);
+		return;
+	}
+	rsp->n_wait_wrs = n_wrs;
+	list_add_tail(&rsp->wait_list, &queue->rsp_wr_wait_list);
+	spin_unlock_irqrestore(&queue->rsp_wr_wait_lock, flags);
+}
+
+static void nvmet_rdma_process_wr_wait_list(struct nvmet_rdma_queue *queue)
+{
+	struct nvmet_rdma_rsp *rsp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->rsp_wr_wait_lock, flags);
+	while (!list_empty(&queue->rsp_wr_wait_list)) {
+		rsp = list_first_entry(&queue->rsp_wr_wait_list,
+				struct nvmet_rdma_rsp, wait_list);
+		if (!nvmet_rdma_get_wrs(queue, rsp->n_wait_wrs))
+			break;
+		list_del(&rsp->wait_list);
+
+		spin_unlock_irqrestore(&queue->rsp_wr_wait_lock, flags);
+		nvmet_rdma_post_stage(rsp);
+		spin_lock_irqsave(&queue->rsp_wr_wait_lock, flags);
+	}
+	spin_unlock_irqrestore(&queue->rsp_wr_wait_lock, flags);
+}
+
+static void nvmet_rdma_release_rsp(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvmet_rdma_queue *queue = rsp->queue;
+
+	if (rsp->req.sg) {
+		ib_dma_unmap_sg(queue->dev->device, rsp->req.sg,
+				rsp->req.sg_cnt, nvme_is_write(rsp->req.cmd) ?
+				DMA_FROM_DEVICE : DMA_TO_DEVICE);
+		nvmet_rdma_free_sgl(rsp->req.sg, rsp->req.sg_cnt);
+		rsp->req.sg = NULL;
+	}
+
+	kfree(rsp->rdma_wrs);
+	rsp->rdma_wrs = NULL;
+	kfree(rsp->rdma_sges);
+	rsp->rdma_sges = NULL;
+
+	nvmet_rdma_put_rsp(rsp);
+}
+
+/*
+ * Build the chain of RDMA work requests moving the data between our
+ * pages and the buffer of the host, as many SGEs per request as the
+ * device takes.
+ */
+static int nvmet_rdma_map_rdma(struct nvmet_rdma_rsp *rsp, u64 addr, u32 key)
+{
+	struct nvmet_rdma_queue *queue = rsp->queue;
+	bool write = nvme_is_write(rsp->req.cmd);
+	struct scatterlist *sg;
+	struct ib_sge *sge;
+	int i, j, n;
+
+	rsp->dma_nents = ib_dma_map_sg(queue->dev->device, rsp->req.sg,
+			rsp->req.sg_cnt, write ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	if (!rsp->dma_nents) {
+		nvmet_rdma_free_sgl(rsp->req.sg, rsp->req.sg_cnt);
+		rsp->req.sg = NULL;
+		return -ENOMEM;
+	}
+
+	rsp->n_rdma = DIV_ROUND_UP(rsp->dma_nents, queue->max_sge);
+	rsp->rdma_wrs = kcalloc(rsp->n_rdma, sizeof(struct ib_rdma_wr),
+			GFP_KERNEL);
+	rsp->rdma_sges = kcalloc(rsp->dma_nents, sizeof(struct ib_sge),
+			GFP_KERNEL);
+	if (!rsp->rdma_wrs || !rsp->rdma_sges)
+		return -ENOMEM;
+
+	sge = rsp->rdma_sges;
+	sg = rsp->req.sg;
+	for (i = 0; i < rsp->n_rdma; i++) {
+		struct ib_rdma_wr *wr = &rsp->rdma_wrs[i];
+
+		wr->wr.opcode = write ? IB_WR_RDMA_READ : IB_WR_RDMA_WRITE;
+		wr->wr.sg_list = sge;
+		wr->remote_addr = addr;
+		wr->rkey = key;
+
+		n = min(queue->max_sge, rsp->dma_nents - i * queue->max_sge);
+		for (j = 0; j < n; j++, sge++, sg = sg_next(sg)) {
+			sge->addr = ib_sg_dma_address(queue->dev->device, sg);
+			sge->length = ib_sg_dma_len(queue->dev->device, sg);
+			sge->lkey = queue->dev->pd->local_dma_lkey;
+			addr += sge->length;
+		}
+		wr->wr.num_sge = n;
+
+		if (i + 1 < rsp->n_rdma)
+			wr->wr.next = &rsp->rdma_wrs[i + 1].wr;
+	}
+
+	/* only the last READ is signalled, it means all of them are done */
+	if (write) {
+		struct ib_send_wr *last = &rsp->rdma_wrs[rsp->n_rdma - 1].wr;
+
+		last->wr_id = nvmet_rdma_wr_id(rsp, NVMET_RDMA_WR_READ);
+		last->send_flags = IB_SEND_SIGNALED;
+	}
+
+	return 0;
+}
+
+static u16 nvmet_rdma_map_sgl(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvme_keyed_sgl_desc *sgl = &rsp->req.cmd->common.ksgl;
+	u64 addr = le64_to_cpu(sgl->addr);
+	u32 len = sgl->length[0] | (sgl->length[1] << 8) |
+		(sgl->length[2] << 16);
+	u32 key = get_unaligned_le32(sgl->key);
+
+	if (!rsp->req.data_len)
+		return 0;
+
+	if ((sgl->type >> 4) != NVME_KEY_SGL_FMT_DATA_DESC) {
+		pr_err("invalid SGL type: %#x\n", sgl->type);
+		return NVME_SC_SGL_INVALID_TYPE | NVME_SC_DNR;
+	}
+
+	switch (sgl->type & 0xf) {
+	case NVME_SGL_FMT_INVALIDATE:
+		rsp->invalidate = true;
+		/* fall through */
+	case NVME_SGL_FMT_ADDRESS:
+		break;
+	default:
+		pr_err("invalid SGL subtype: %#x\n", sgl->type);
+		return NVME_SC_SGL_INVALID_TYPE | NVME_SC_DNR;
+	}
+
+	if (len < rsp->req.data_len || rsp->req.data_len > NVMET_MAX_DATA_LEN)
+		return NVME_SC_SGL_INVALID_DATA | NVME_SC_DNR;
+
+	if (nvmet_rdma_alloc_sgl(&rsp->req.sg, &rsp->req.sg_cnt,
+			rsp->req.data_len))
+		return NVME_SC_INTERNAL;
+
+	if (nvmet_rdma_map_rdma(rsp, addr, key))
+		return NVME_SC_INTERNAL;
+
+	return 0;
+}
+
+static void nvmet_rdma_post_response(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvmet_rdma_queue *queue = rsp->queue;
+	struct ib_send_wr *first_wr, *bad_wr;
+
+	if (rsp->invalidate) {
+		rsp->send_wr.opcode = IB_WR_SEND_WITH_INV;
+		rsp->send_wr.ex.invalidate_rkey =
+			get_unaligned_le32(rsp->req.cmd->common.ksgl.key);
+	} else {
+		rsp->send_wr.opcode = IB_WR_SEND;
+	}
+
+	if (nvmet_rdma_need_data_out(rsp)) {
+		rsp->rdma_wrs[rsp->n_rdma - 1].wr.next = &rsp->send_wr;
+		first_wr = &rsp->rdma_wrs[0].wr;
+	} else {
+		first_wr = &rsp->send_wr;
+	}
+
+	ib_dma_sync_single_for_device(queue->dev->device,
+			rsp->send_sge.addr, rsp->send_sge.length,
+			DMA_TO_DEVICE);
+
+	if (ib_post_send(queue->cm_id->qp, first_wr, &bad_wr)) {
+		pr_err("sending cmd response failed\n");
+		atomic_add(rsp->n_wait_wrs, &queue->sq_wr_avail);
+		nvmet_rdma_release_rsp(rsp);
+	}
+}
+
+static void nvmet_rdma_post_read(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvmet_rdma_queue *queue = rsp->queue;
+	struct ib_send_wr *bad_wr;
+
+	if (ib_post_send(queue->cm_id->qp, &rsp->rdma_wrs[0].wr, &bad_wr)) {
+		atomic_add(rsp->n_rdma, &queue->sq_wr_avail);
+		nvmet_req_complete(&rsp->req, NVME_SC_DATA_XFER_ERROR);
+	}
+}
+
+static void nvmet_rdma_post_stage(struct nvmet_rdma_rsp *rsp)
+{
+	if (rsp->responding)
+		nvmet_rdma_post_response(rsp);
+	else
+		nvmet_rdma_post_read(rsp);
+}
+
+/*
+ * Called on completion of the request, from whatever context the
+ * backend completes it in.
+ */
+static void nvmet_rdma_queue_response(struct nvmet_req *req)
+{
+	struct nvmet_rdma_rsp *rsp =
+		container_of(req, struct nvmet_rdma_rsp, req);
+	struct nvmet_rdma_queue *queue = rsp->queue;
+	int n_wrs = 1;
+
+	/* the host can send the next command into this buffer right away */
+	if (nvmet_rdma_post_recv(rsp->cmd)) {
+		pr_err("failed to repost receive buffer\n");
+		nvmet_rdma_queue_disconnect(queue);
+	}
+
+	if (nvmet_rdma_need_data_out(rsp))
+		n_wrs += rsp->n_rdma;
+
+	rsp->responding = true;
+	rsp->n_wait_wrs = n_wrs;	/* given back on SEND completion */
+	nvmet_rdma_queue_stage(rsp, n_wrs);
+}
+
+static void nvmet_rdma_handle_command(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *rsp)
+{
+	u16 status;
+
+	ib_dma_sync_single_for_cpu(queue->dev->device,
+		rsp->cmd->sge.addr, rsp->cmd->sge.length,
+		DMA_FROM_DEVICE);
+
+	if (!nvmet_req_init(&rsp->req, &queue->nvme_sq, &nvmet_rdma_ops))
+		return;
+
+	status = nvmet_rdma_map_sgl(rsp);
+	if (status) {
+		nvmet_req_complete(&rsp->req, status);
+		return;
+	}
+
+	if (nvmet_rdma_need_data_in(rsp))
+		nvmet_rdma_queue_stage(rsp, rsp->n_rdma);
+	else
+		rsp->req.execute(&rsp->req);
+}
+
+static void nvmet_rdma_recv_done(struct nvmet_rdma_queue *queue,
+		struct ib_wc *wc)
+{
+	struct nvmet_rdma_cmd *cmd = nvmet_rdma_wr_ctx(wc->wr_id);
+	struct nvmet_rdma_rsp *rsp;
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		if (wc->status != IB_WC_WR_FLUSH_ERR) {
+			pr_err("RECV for CQE 0x%p failed with status %s (%d)\n",
+				cmd, ib_wc_status_msg(wc->status), wc->status);
+			nvmet_rdma_queue_disconnect(queue);
+		}
+		return;
+	}
+
+	if (unlikely(wc->byte_len < sizeof(struct nvme_command))) {
+		pr_err("Ctrl Fatal Error: capsule size less than 64 bytes\n");
+		nvmet_rdma_queue_disconnect(queue);
+		return;
+	}
+
+	rsp = nvmet_rdma_get_rsp(queue);
+	if (unlikely(!rsp)) {
+		/* we can only drop the command, the host will time it out */
+		nvmet_rdma_post_recv(cmd);
+		return;
+	}
+
+	rsp->cmd = cmd;
+	rsp->req.cmd = cmd->nvme_cmd;
+	rsp->req.port = queue->port;
+	rsp->invalidate = false;
+	rsp->responding = false;
+	rsp->n_rdma = 0;
+	rsp->dma_nents = 0;
+
+	nvmet_rdma_handle_command(queue, rsp);
+}
+
+static void nvmet_rdma_send_done(struct nvmet_rdma_queue *queue,
+		struct ib_wc *wc)
+{
+	struct nvmet_rdma_rsp *rsp = nvmet_rdma_wr_ctx(wc->wr_id);
+
+	atomic_add(rsp->n_wait_wrs, &queue->sq_wr_avail);
+	nvmet_rdma_release_rsp(rsp);
+
+	if (unlikely(wc->status != IB_WC_SUCCESS &&
+		     wc->status != IB_WC_WR_FLUSH_ERR)) {
+		pr_err("SEND for CQE 0x%p failed with status %s (%d).\n",
+			rsp, ib_wc_status_msg(wc->status), wc->status);
+		nvmet_rdma_queue_disconnect(queue);
+	}
+}
+
+static void nvmet_rdma_read_data_done(struct nvmet_rdma_queue *queue,
+		struct ib_wc *wc)
+{
+	struct nvmet_rdma_rsp *rsp = nvmet_rdma_wr_ctx(wc->wr_id);
+
+	atomic_add(rsp->n_rdma, &queue->sq_wr_avail);
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		if (wc->status != IB_WC_WR_FLUSH_ERR) {
+			pr_info("RDMA READ for CQE 0x%p failed with status %s (%d).\n",
+				rsp, ib_wc_status_msg(wc->status), wc->status);
+			nvmet_rdma_queue_disconnect(queue);
+		}
+		nvmet_req_complete(&rsp->req, NVME_SC_DATA_XFER_ERROR);
+		return;
+	}
+
+	rsp->req.execute(&rsp->req);
+}
+
+static void nvmet_rdma_handle_wc(struct nvmet_rdma_queue *queue,
+		struct ib_wc *wc)
+{
+	/* an unsignalled RDMA work request that failed */
+	if (!wc->wr_id) {
+		if (wc->status != IB_WC_WR_FLUSH_ERR)
+			nvmet_rdma_queue_disconnect(queue);
+		return;
+	}
+
+	switch (wc->wr_id & NVMET_RDMA_WR_MASK) {
+	case NVMET_RDMA_WR_RECV:
+		nvmet_rdma_recv_done(queue, wc);
+		break;
+	case NVMET_RDMA_WR_SEND:
+		nvmet_rdma_send_done(queue, wc);
+		break;
+	case NVMET_RDMA_WR_READ:
+		nvmet_rdma_read_data_done(queue, wc);
+		break;
+	}
+}
+
+static void nvmet_rdma_cq_work(struct work_struct *work)
+{
+	enum { nvmet_rdma_poll_budget = 65536 };
+	struct nvmet_rdma_queue *queue =
+		container_of(work, struct nvmet_rdma_queue, cq_work);
+	struct ib_wc *const wcs = queue->wcs;
+	int i, n, completed = 0;
+
+	while ((n = ib_poll_cq(queue->cq, ARRAY_SIZE(queue->wcs), wcs)) > 0) {
+		for (i = 0; i < n; i++)
+			nvmet_rdma_handle_wc(queue, &wcs[i]);
+
+		/* the completions just handled gave back send queue room */
+		nvmet_rdma_process_wr_wait_list(queue);
+
+		completed += n;
+		if (completed >= nvmet_rdma_poll_budget)
+			break;
+	}
+
+	ib_req_notify_cq(queue->cq, IB_CQ_NEXT_COMP);
+}
+
+static void nvmet_rdma_cq_callback(struct ib_cq *cq, void *context)
+{
+	struct nvmet_rdma_queue *queue = context;
+
+	queue_work(nvmet_rdma_wq, &queue->cq_work);
+}
+
+static void nvmet_rdma_qp_event(struct ib_event *event, void *priv)
+{
+	struct nvmet_rdma_queue *queue = priv;
+
+	switch (event->event) {
+	case IB_EVENT_COMM_EST:
+		rdma_notify(queue->cm_id, event->event);
+		break;
+	default:
+		pr_err("received unrecognized IB QP event %d\n", event->event);
+		break;
+	}
+}
+
+static void nvmet_rdma_free_dev(struct kref *ref)
+{
+	struct nvmet_rdma_device *ndev =
+		container_of(ref, struct nvmet_rdma_device, ref);
+
+	mutex_lock(&device_list_mutex);
+	list_del(&ndev->entry);
+	mutex_unlock(&device_list_mutex);
+
+	ib_dealloc_pd(ndev->pd);
+	kfree(ndev);
+}
+
+static struct nvmet_rdma_device *
+nvmet_rdma_find_get_device(struct rdma_cm_id *cm_id)
+{
+	struct nvmet_rdma_device *ndev;
+	int ret;
+
+	mutex_lock(&device_list_mutex);
+	list_for_each_entry(ndev, &device_list, entry) {
+		if (ndev->device->node_guid == cm_id->device->node_guid &&
+		    kref_get_unless_zero(&ndev->ref))
+			goto out_unlock;
+	}
+
+	ndev = kzalloc(sizeof(*ndev), GFP_KERNEL);
+	if (!ndev)
+		goto out_err;
+
+	ndev->device = cm_id->device;
+	kref_init(&ndev->ref);
+
+	ret = ib_query_device(ndev->device, &ndev->attr);
+	if (ret)
+		goto out_free_dev;
+
+	ndev->pd = ib_alloc_pd(ndev->device);
+	if (IS_ERR(ndev->pd))
+		goto out_free_dev;
+
+	list_add(&ndev->entry, &device_list);
+out_unlock:
+	mutex_unlock(&device_list_mutex);
+	pr_debug("added %s.\n", ndev->device->name);
+	return ndev;
+
+out_free_dev:
+	kfree(ndev);
+out_err:
+	mutex_unlock(&device_list_mutex);
+	return NULL;
+}
+
+static int nvmet_rdma_create_queue_ib(struct nvmet_rdma_queue *queue)
+{
+	struct nvmet_rdma_device *ndev = queue->dev;
+	struct ib_device_attr *attr = &ndev->attr;
+	struct ib_cq_init_attr cq_attr = {};
+	struct ib_qp_init_attr qp_attr;
+	int max_send_wr, min_send_wr, ret, i;
+
+	queue->max_sge = min(attr->max_sge, attr->max_sge_rd);
+
+	/* one stage of a response may need all its RDMAs plus the SEND */
+	min_send_wr = DIV_ROUND_UP(NVMET_RDMA_MAX_PAGES, queue->max_sge) + 1;
+	max_send_wr = max(queue->send_queue_size * 2, min_send_wr);
+	max_send_wr = min(max_send_wr, attr->max_qp_wr);
+	if (max_send_wr < min_send_wr)
+		return -EINVAL;
+
+	/* the receives, the SENDs and the last READ of each response */
+	cq_attr.cqe = queue->recv_queue_size + 2 * queue->send_queue_size;
+	cq_attr.cqe = min_t(int, cq_attr.cqe, attr->max_cqe);
+	cq_attr.comp_vector = queue->host_qid % ndev->device->num_comp_vectors;
+
+	INIT_WORK(&queue->cq_work, nvmet_rdma_cq_work);
+	queue->cq = ib_create_cq(ndev->device, nvmet_rdma_cq_callback, NULL,
+			queue, &cq_attr);
+	if (IS_ERR(queue->cq)) {
+		ret = PTR_ERR(queue->cq);
+		pr_err("failed to create CQ cqe= %d ret= %d\n",
+			cq_attr.cqe, ret);
+		goto out;
+	}
+
+	memset(&qp_attr, 0, sizeof(qp_attr));
+	qp_attr.qp_context = queue;
+	qp_attr.event_handler = nvmet_rdma_qp_event;
+	qp_attr.send_cq = queue->cq;
+	qp_attr.recv_cq = queue->cq;
+	qp_attr.sq_sig_type = IB_SIGNAL_REQ_WR;
+	qp_attr.qp_type = IB_QPT_RC;
+	qp_attr.cap.max_send_wr = max_send_wr;
+	qp_attr.cap.max_send_sge = queue->max_sge;
+	qp_attr.cap.max_recv_wr = queue->recv_queue_size;
+	qp_attr.cap.max_recv_sge = 1;
+
+	ret = rdma_create_qp(queue->cm_id, ndev->pd, &qp_attr);
+	if (ret) {
+		pr_err("failed to create_qp ret= %d\n", ret);
+		goto err_destroy_cq;
+	}
+
+	atomic_set(&queue->sq_wr_avail, qp_attr.cap.max_send_wr);
+
+	for (i = 0; i < queue->recv_queue_size; i++) {
+		ret = nvmet_rdma_post_recv(&queue->cmds[i]);
+		if (ret)
+			goto err_destroy_qp;
+	}
+
+	ret = ib_req_notify_cq(queue->cq, IB_CQ_NEXT_COMP);
+	if (ret)
+		goto err_destroy_qp;
+
+out:
+	return ret;
+
+err_destroy_qp:
+	rdma_destroy_qp(queue->cm_id);
+err_destroy_cq:
+	ib_destroy_cq(queue->cq);
+	goto out;
+}
+
+static void nvmet_rdma_destroy_queue_ib(struct nvmet_rdma_queue *queue)
+{
+	rdma_destroy_qp(queue->cm_id);
+	flush_work(&queue->cq_work);
+	ib_destroy_cq(queue->cq);
+}
+
+static void nvmet_rdma_free_queue(struct nvmet_rdma_queue *queue)
+{
+	pr_info("freeing queue %d\n", queue->host_qid);
+
+	nvmet_rdma_free_cmds(queue);
+	nvmet_rdma_free_rsps(queue);
+
+	kref_put(&queue->dev->ref, nvmet_rdma_free_dev);
+	kfree(queue);
+}
+
+static void nvmet_rdma_release_queue_work(struct work_struct *w)
+{
+	struct nvmet_rdma_queue *queue =
+		container_of(w, struct nvmet_rdma_queue, release_work);
+	struct rdma_cm_id *cm_id = queue->cm_id;
+	struct nvmet_ctrl *ctrl = queue->nvme_sq.ctrl;
+
+	/*
+	 * The queue pair is in the error state: everything posted comes
+	 * back flushed, and the commands still in the backend complete
+	 * into a send queue that fails them right away.
+	 */
+	wait_event(queue->rsps_wait, !atomic_read(&queue->rsps_inflight));
+
+	if (ctrl && queue->host_qid == 0)
+		ctrl->ops->delete_ctrl(ctrl);
+	nvmet_sq_destroy(&queue->nvme_sq);
+
+	/*
+	 * With the queue pair gone the CM handler no longer finds the
+	 * queue, and once the ID is destroyed it no longer runs at all.
+	 */
+	nvmet_rdma_destroy_queue_ib(queue);
+	rdma_destroy_id(cm_id);
+	nvmet_rdma_free_queue(queue);
+}
+
+static int
+nvmet_rdma_parse_cm_connect_req(struct rdma_conn_param *conn,
+		struct nvmet_rdma_queue *queue)
+{
+	const struct nvme_rdma_cm_req *req = conn->private_data;
+
+	if (!req || conn->private_data_len < sizeof(*req))
+		return NVME_RDMA_CM_INVALID_LEN;
+
+	if (le16_to_cpu(req->recfmt) != NVME_RDMA_CM_FMT_1_0)
+		return NVME_RDMA_CM_INVALID_RECFMT;
+
+	queue->host_qid = le16_to_cpu(req->qid);
+	if (queue->host_qid > NVMET_NR_QUEUES)
+		return NVME_RDMA_CM_INVALID_QID;
+
+	/*
+	 * The host sends as many commands as its send queue holds, and we
+	 * need no more receives than that.
+	 */
+	queue->recv_queue_size = le16_to_cpu(req->hsqsize);
+	if (!queue->recv_queue_size || queue->recv_queue_size > NVMET_QUEUE_SIZE)
+		return NVME_RDMA_CM_INVALID_HSQSIZE;
+
+	queue->send_queue_size = le16_to_cpu(req->hrqsize);
+	if (!queue->send_queue_size || queue->send_queue_size > NVMET_QUEUE_SIZE)
+		return NVME_RDMA_CM_INVALID_HRQSIZE;
+
+	return 0;
+}
+
+static int nvmet_rdma_cm_reject(struct rdma_cm_id *cm_id,
+		enum nvme_rdma_cm_status status)
+{
+	struct nvme_rdma_cm_rej rej;
+
+	rej.recfmt = cpu_to_le16(NVME_RDMA_CM_FMT_1_0);
+	rej.sts = cpu_to_le16(status);
+
+	return rdma_reject(cm_id, (void *)&rej, sizeof(rej));
+}
+
+static struct nvmet_rdma_queue *
+nvmet_rdma_alloc_queue(struct nvmet_rdma_device *ndev,
+		struct rdma_cm_id *cm_id,
+		struct rdma_cm_event *event)
+{
+	struct nvmet_rdma_queue *queue;
+	int ret;
+
+	queue = kzalloc(sizeof(*queue), GFP_KERNEL);
+	if (!queue) {
+		ret = NVME_RDMA_CM_NO_RSC;
+		goto out_reject;
+	}
+
+	INIT_WORK(&queue->release_work, nvmet_rdma_release_queue_work);
+	INIT_LIST_HEAD(&queue->rsp_wr_wait_list);
+	spin_lock_init(&queue->rsp_wr_wait_lock);
+	INIT_LIST_HEAD(&queue->free_rsps);
+	spin_lock_init(&queue->rsps_lock);
+	atomic_set(&queue->rsps_inflight, 0);
+	init_waitqueue_head(&queue->rsps_wait);
+	INIT_LIST_HEAD(&queue->queue_list);
+	spin_lock_init(&queue->state_lock);
+	queue->state = NVMET_RDMA_Q_CONNECTING;
+
+	ret = nvmet_rdma_parse_cm_connect_req(&event->param.conn, queue);
+	if (ret)
+		goto out_free_queue;
+
+	queue->dev = ndev;
+	queue->cm_id = cm_id;
+
+	ret = nvmet_rdma_alloc_rsps(queue);
+	if (ret) {
+		ret = NVME_RDMA_CM_NO_RSC;
+		goto out_free_queue;
+	}
+
+	ret = nvmet_rdma_alloc_cmds(queue);
+	if (ret) {
+		ret = NVME_RDMA_CM_NO_RSC;
+		goto out_free_responses;
+	}
+
+	ret = nvmet_rdma_create_queue_ib(queue);
+	if (ret) {
+		pr_err("%s: creating RDMA queue failed (%d).\n",
+			__func__, ret);
+		ret = NVME_RDMA_CM_NO_RSC;
+		goto out_free_cmds;
+	}
+
+	return queue;
+
+out_free_cmds:
+	nvmet_rdma_free_cmds(queue);
+out_free_responses:
+	nvmet_rdma_free_rsps(queue);
+out_free_queue:
+	kfree(queue);
+out_reject:
+	nvmet_rdma_cm_reject(cm_id, ret);
+	return NULL;
+}
+
+static int nvmet_rdma_cm_accept(struct rdma_cm_id *cm_id,
+		struct nvmet_rdma_queue *queue,
+		struct rdma_conn_param *p)
+{
+	struct rdma_conn_param param = { };
+	struct nvme_rdma_cm_rep priv = { };
+	int ret = -ENOMEM;
+
+	param.rnr_retry_count = 7;
+	param.flow_control = 1;
+	param.initiator_depth = min_t(u8, p->initiator_depth,
+		queue->dev->attr.max_qp_init_rd_atom);
+	param.private_data = &priv;
+	param.private_data_len = sizeof(priv);
+	priv.recfmt = cpu_to_le16(NVME_RDMA_CM_FMT_1_0);
+	priv.crqsize = cpu_to_le16(queue->recv_queue_size);
+
+	ret = rdma_accept(cm_id, &param);
+	if (ret)
+		pr_err("rdma_accept failed (error code = %d)\n", ret);
+
+	return ret;
+}
+
+static int nvmet_rdma_queue_connect(struct rdma_cm_id *cm_id,
+		struct rdma_cm_event *event)
+{
+	struct nvmet_rdma_device *ndev;
+	struct nvmet_rdma_queue *queue;
+	int ret = -EINVAL;
+
+	ndev = nvmet_rdma_find_get_device(cm_id);
+	if (!ndev) {
+		pr_err("no client data!\n");
+		nvmet_rdma_cm_reject(cm_id, NVME_RDMA_CM_NO_RSC);
+		return -ECONNREFUSED;
+	}
+
+	queue = nvmet_rdma_alloc_queue(ndev, cm_id, event);
+	if (!queue) {
+		ret = -ENOMEM;
+		goto put_device;
+	}
+	queue->port = cm_id->context;
+
+	ret = nvmet_rdma_cm_accept(cm_id, queue, &event->param.conn);
+	if (ret)
+		goto release_queue;
+
+	cm_id->context = queue;
+
+	mutex_lock(&nvmet_rdma_queue_mutex);
+	list_add_tail(&queue->queue_list, &nvmet_rdma_queue_list);
+	mutex_unlock(&nvmet_rdma_queue_mutex);
+
+	return 0;
+
+release_queue:
+	/* the cm_id is destroyed by the CM once we return an error */
+	nvmet_rdma_destroy_queue_ib(queue);
+	nvmet_rdma_free_queue(queue);
+	return ret;
+put_device:
+	kref_put(&ndev->ref, nvmet_rdma_free_dev);
+	return ret;
+}
+
+static void nvmet_rdma_queue_established(struct nvmet_rdma_queue *queue)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->state_lock, flags);
+	if (queue->state == NVMET_RDMA_Q_CONNECTING)
+		queue->state = NVMET_RDMA_Q_LIVE;
+	spin_unlock_irqrestore(&queue->state_lock, flags);
+}
+
+static void __nvmet_rdma_queue_disconnect(struct nvmet_rdma_queue *queue)
+{
+	bool disconnect = false;
+	unsigned long flags;
+
+	pr_debug("cm_id= %p queue->state= %d\n", queue->cm_id, queue->state);
+
+	spin_lock_irqsave(&queue->state_lock, flags);
+	switch (queue->state) {
+	case NVMET_RDMA_Q_CONNECTING:
+	case NVMET_RDMA_Q_LIVE:
+		queue->state = NVMET_RDMA_Q_DISCONNECTING;
+		disconnect = true;
+		break;
+	case NVMET_RDMA_Q_DISCONNECTING:
+		break;
+	}
+	spin_unlock_irqrestore(&queue->state_lock, flags);
+
+	if (disconnect) {
+		rdma_disconnect(queue->cm_id);
+		queue_work(nvmet_rdma_wq, &queue->release_work);
+	}
+}
+
+/*
+ * Takes the queue off the list first, so that only one of the paths
+ * racing to disconnect it gets to release it.
+ */
+static void nvmet_rdma_queue_disconnect(struct nvmet_rdma_queue *queue)
+{
+	bool disconnect = false;
+
+	mutex_lock(&nvmet_rdma_queue_mutex);
+	if (!list_empty(&queue->queue_list)) {
+		list_del_init(&queue->queue_list);
+		disconnect = true;
+	}
+	mutex_unlock(&nvmet_rdma_queue_mutex);
+
+	if (disconnect)
+		__nvmet_rdma_queue_disconnect(queue);
+}
+
+static int nvmet_rdma_cm_handler(struct rdma_cm_id *cm_id,
+		struct rdma_cm_event *event)
+{
+	struct nvmet_rdma_queue *queue = NULL;
+	int ret = 0;
+
+	if (cm_id->qp)
+		queue = cm_id->qp->qp_context;
+
+	pr_debug("%s (%d): status %d id %p\n",
+		rdma_event_msg(event->event), event->event,
+		event->status, cm_id);
+
+	switch (event->event) {
+	case RDMA_CM_EVENT_CONNECT_REQUEST:
+		ret = nvmet_rdma_queue_connect(cm_id, event);
+		break;
+	case RDMA_CM_EVENT_ESTABLISHED:
+		nvmet_rdma_queue_established(queue);
+		break;
+	case RDMA_CM_EVENT_ADDR_CHANGE:
+	case RDMA_CM_EVENT_DISCONNECTED:
+	case RDMA_CM_EVENT_DEVICE_REMOVAL:
+	case RDMA_CM_EVENT_TIMEWAIT_EXIT:
+		/*
+		 * We can get the device removal callback even for a
+		 * CM ID that we aren't actually using.  In that case
+		 * the context pointer is NULL, so we shouldn't try
+		 * to disconnect a non-existing queue.
+		 */
+		if (queue)
+			nvmet_rdma_queue_disconnect(queue);
+		break;
+	case RDMA_CM_EVENT_REJECTED:
+	case RDMA_CM_EVENT_UNREACHABLE:
+	case RDMA_CM_EVENT_CONNECT_ERROR:
+		if (queue)
+			nvmet_rdma_queue_disconnect(queue);
+		break;
+	default:
+		pr_err("received unrecognized RDMA CM event %d\n",
+			event->event);
+		break;
+	}
+
+	return ret;
+}
+
+static void nvmet_rdma_delete_ctrl(struct nvmet_ctrl *ctrl)
+{
+	struct nvmet_rdma_queue *queue, *n;
+	LIST_HEAD(del_list);
+
+	mutex_lock(&nvmet_rdma_queue_mutex);
+	list_for_each_entry_safe(queue, n, &nvmet_rdma_queue_list,
+			queue_list) {
+		if (queue->nvme_sq.ctrl == ctrl)
+			list_move_tail(&queue->queue_list, &del_list);
+	}
+	mutex_unlock(&nvmet_rdma_queue_mutex);
+
+	list_for_each_entry_safe(queue, n, &del_list, queue_list) {
+		list_del_init(&queue->queue_list);
+		__nvmet_rdma_queue_disconnect(queue);
+	}
+}
+
+static int nvmet_rdma_parse_addr(struct nvmet_port *port,
+		struct sockaddr_storage *addr)
+{
+	u16 port_num;
+
+	if (kstrtou16(port->trsvcid, 0, &port_num))
+		return -EINVAL;
+
+	memset(addr, 0, sizeof(*addr));
+
+	switch (port->adrfam) {
+	case NVMF_ADDR_FAMILY_IP4: {
+		struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+
+		if (!in4_pton(port->traddr, -1, (u8 *)&sin->sin_addr.s_addr,
+				'\0', NULL))
+			return -EINVAL;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port_num);
+		break;
+	}
+	case NVMF_ADDR_FAMILY_IP6: {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)addr;
+
+		if (!in6_pton(port->traddr, -1, sin6->sin6_addr.s6_addr,
+				'\0', NULL))
+			return -EINVAL;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port_num);
+		break;
+	}
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int nvmet_rdma_add_port(struct nvmet_port *port)
+{
+	struct rdma_cm_id *cm_id;
+	struct sockaddr_storage addr;
+	int ret;
+
+	/* the configfs store leaves the trailing newline in */
+	strim(port->traddr);
+	strim(port->trsvcid);
+
+	ret = nvmet_rdma_parse_addr(port, &addr);
+	if (ret) {
+		pr_err("malformed address %s:%s\n", port->traddr,
+			port->trsvcid);
+		return ret;
+	}
+
+	cm_id = rdma_create_id(&init_net, nvmet_rdma_cm_handler, port,
+			RDMA_PS_TCP, IB_QPT_RC);
+	if (IS_ERR(cm_id)) {
+		pr_err("CM ID creation failed\n");
+		return PTR_ERR(cm_id);
+	}
+
+	ret = rdma_bind_addr(cm_id, (struct sockaddr *)&addr);
+	if (ret) {
+		pr_err("binding CM ID to %s:%s failed (%d)\n",
+			port->traddr, port->trsvcid, ret);
+		goto out_destroy_id;
+	}
+
+	ret = rdma_listen(cm_id, 128);
+	if (ret) {
+		pr_err("listening to %s:%s failed (%d)\n",
+			port->traddr, port->trsvcid, ret);
+		goto out_destroy_id;
+	}
+
+	pr_info("enabling port (%s:%s)\n", port->traddr, port->trsvcid);
+	port->priv = cm_id;
+	return 0;
+
+out_destroy_id:
+	rdma_destroy_id(cm_id);
+	return ret;
+}
+
+static void nvmet_rdma_remove_port(struct nvmet_port *port)
+{
+	struct rdma_cm_id *cm_id = port->priv;
+	struct nvmet_rdma_queue *queue, *n;
+	LIST_HEAD(del_list);
+
+	rdma_destroy_id(cm_id);
+	port->priv = NULL;
+
+	/* the hosts connected through the port lose their queues with it */
+	mutex_lock(&nvmet_rdma_queue_mutex);
+	list_for_each_entry_safe(queue, n, &nvmet_rdma_queue_list,
+			queue_list) {
+		if (queue->port == port)
+			list_move_tail(&queue->queue_list, &del_list);
+	}
+	mutex_unlock(&nvmet_rdma_queue_mutex);
+
+	list_for_each_entry_safe(queue, n, &del_list, queue_list) {
+		list_del_init(&queue->queue_list);
+		__nvmet_rdma_queue_disconnect(queue);
+	}
+}
+
+static struct nvmet_fabrics_ops nvmet_rdma_ops = {
+	.owner			= THIS_MODULE,
+	.add_port		= nvmet_rdma_add_port,
+	.remove_port		= nvmet_rdma_remove_port,
+	.queue_response		= nvmet_rdma_queue_response,
+	.delete_ctrl		= nvmet_rdma_delete_ctrl,
+};
+
+static int __init nvmet_rdma_init(void)
+{
+	int ret;
+
+	nvmet_rdma_wq = alloc_workqueue("nvmet-rdma",
+			WQ_UNBOUND | WQ_MEM_RECLAIM | WQ_HIGHPRI, 0);
+	if (!nvmet_rdma_wq)
+		return -ENOMEM;
+
+	ret = nvmet_register_transport(&nvmet_rdma_ops);
+	if (ret)
+		destroy_workqueue(nvmet_rdma_wq);
+	return ret;
+}
+
+static void __exit nvmet_rdma_exit(void)
+{
+	struct nvmet_rdma_queue *queue;
+
+	nvmet_unregister_transport(&nvmet_rdma_ops);
+
+	mutex_lock(&nvmet_rdma_queue_mutex);
+	while ((queue = list_first_entry_or_null(&nvmet_rdma_queue_list,
+			struct nvmet_rdma_queue, queue_list))) {
+		list_del_init(&queue->queue_list);
+
+		mutex_unlock(&nvmet_rdma_queue_mutex);
+		__nvmet_rdma_queue_disconnect(queue);
+		mutex_lock(&nvmet_rdma_queue_mutex);
+	}
+	mutex_unlock(&nvmet_rdma_queue_mutex);
+
+	destroy_workqueue(nvmet_rdma_wq);
+}
+
+module_init(nvmet_rdma_init);
+module_exit(nvmet_rdma_exit);
+
+MODULE_LICENSE("GPL v2");
@@ -1437,6 +1437,7 @@ struct bus_type pci_bus_type = {
 	.bus_groups	= pci_bus_groups,
 	.drv_groups	= pci_drv_groups,
 	.pm		= PCI_PM_OPS_PTR,
+	.async_probe	= IS_ENABLED(CONFIG_PCI_ASYNC_PROBE),
 };
 EXPORT_SYMBOL(pci_bus_type);
 
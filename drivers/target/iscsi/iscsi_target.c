@@ -4091,6 +4091,7 @@ int iscsi_target_rx_thread(void *arg)
 	u8 buffer[ISCSI_HDR_LEN], opcode;
 	u32 checksum = 0, digest = 0;
 	struct iscsi_conn *conn = arg;
+	struct blk_plug plug;
 	struct kvec iov;
 	/*
 	 * Allow ourselves to be interrupted by SIGINT so that a
@@ -4116,6 +4117,12 @@ int iscsi_target_rx_thread(void *arg)
 		goto transport_err;
 	}
 
+	/*
+	 * SCSI commands are executed right here, so keep the backend I/O of
+	 * all the PDUs we find queued on the socket plugged together.  The
+	 * plug is flushed whenever we sleep waiting for the next one.
+	 */
+	blk_start_plug(&plug);
 	while (!kthread_should_stop()) {
 		/*
 		 * Ensure that both TX and RX per connection kthreads
@@ -4132,7 +4139,7 @@ int iscsi_target_rx_thread(void *arg)
 		ret = rx_data(conn, &iov, 1, ISCSI_HDR_LEN);
 		if (ret != ISCSI_HDR_LEN) {
 			iscsit_rx_thread_wait_for_tcp(conn);
-			goto transport_err;
+			goto transport_err_plug;
 		}
 
 		if (conn->conn_ops->HeaderDigest) {
@@ -4142,7 +4149,7 @@ int iscsi_target_rx_thread(void *arg)
 			ret = rx_data(conn, &iov, 1, ISCSI_CRC_LEN);
 			if (ret != ISCSI_CRC_LEN) {
 				iscsit_rx_thread_wait_for_tcp(conn);
-				goto transport_err;
+				goto transport_err_plug;
 			}
 
 			iscsit_do_crypto_hash_buf(&conn->conn_rx_hash,
@@ -4166,7 +4173,7 @@ int iscsi_target_rx_thread(void *arg)
 		}
 
 		if (conn->conn_state == TARG_CONN_STATE_IN_LOGOUT)
-			goto transport_err;
+			goto transport_err_plug;
 
 		opcode = buffer[0] & ISCSI_OPCODE_MASK;
 
@@ -4177,14 +4184,16 @@ int iscsi_target_rx_thread(void *arg)
 			" while in Discovery Session, rejecting.\n", opcode);
 			iscsit_add_reject(conn, ISCSI_REASON_PROTOCOL_ERROR,
 					  buffer);
-			goto transport_err;
+			goto transport_err_plug;
 		}
 
 		ret = iscsi_target_rx_opcode(conn, buffer);
 		if (ret < 0)
-			goto transport_err;
+			goto transport_err_plug;
 	}
 
+transport_err_plug:
+	blk_finish_plug(&plug);
 transport_err:
 	if (!signal_pending(current))
 		atomic_set(&conn->transport_failed, 1);
@@ -338,6 +338,10 @@ iblock_get_bio(struct se_cmd *cmd, sector_t lba, u32 sg_num)
 	return bio;
 }
 
+/*
+ * When the fabric holds a plug of its own across several commands, ours
+ * nests in it and the bios of all of them go down to blk-mq together.
+ */
 static void iblock_submit_bios(struct bio_list *list, int rw)
 {
 	struct blk_plug plug;
@@ -714,7 +714,7 @@ void target_complete_cmd(struct se_cmd *cmd, u8 scsi_status)
 	cmd->transport_state |= (CMD_T_COMPLETE | CMD_T_ACTIVE);
 	spin_unlock_irqrestore(&cmd->t_state_lock, flags);
 
-	queue_work(target_completion_wq, &cmd->work);
+	queue_work_on(cmd->cpuid, target_completion_wq, &cmd->work);
 }
 EXPORT_SYMBOL(target_complete_cmd);
 
@@ -1204,6 +1204,7 @@ void transport_init_se_cmd(
 	cmd->data_direction = data_direction;
 	cmd->sam_task_attr = task_attr;
 	cmd->sense_buffer = sense_buffer;
+	cmd->cpuid = WORK_CPU_UNBOUND;
 
 	cmd->state_active = false;
 }
@@ -1754,6 +1755,14 @@ void __target_execute_cmd(struct se_cmd *cmd)
 	sense_reason_t ret;
 
 	if (cmd->execute_cmd) {
+		/*
+		 * The backend mostly completes on the CPU it submitted from,
+		 * so queue the completion work there too, unless the fabric
+		 * picked a CPU of its own.
+		 */
+		if (cmd->cpuid == WORK_CPU_UNBOUND)
+			cmd->cpuid = raw_smp_processor_id();
+
 		ret = cmd->execute_cmd(cmd);
 		if (ret) {
 			spin_lock_irq(&cmd->t_state_lock);
@@ -23,6 +23,7 @@
 #include <linux/kernel.h>
 #include <linux/timer.h>
 #include <linux/parser.h>
+#include <linux/radix-tree.h>
 #include <linux/vmalloc.h>
 #include <linux/uio_driver.h>
 #include <linux/stringify.h>
@@ -51,6 +52,13 @@
  * moving buffer allocations, or even page flipping or other
  * allocation techniques, without altering the command ring layout.
  *
+ * The data area is handed out in blocks of DATA_BLOCK_SIZE, and only
+ * backed by pages as far as it has been used: it starts out empty and
+ * grows, up to max_data_area_mb, when the blocks already backed are all
+ * taken.  A command's data is packed into the blocks it is given, which
+ * need not be contiguous; each run of contiguous blocks takes one iov.
+ * Userspace touching a block that isn't backed yet gets SIGBUS.
+ *
  * SECURITY:
  * The user process must be assumed to be malicious. There's no way to
  * prevent it breaking the command ring protocol if it wants, but in
@@ -63,10 +71,12 @@
 
 #define TCMU_TIME_OUT (30 * MSEC_PER_SEC)
 
-#define CMDR_SIZE (16 * 4096)
-#define DATA_SIZE (257 * 4096)
+#define CMDR_SIZE (8 * 1024 * 1024)
 
-#define TCMU_RING_SIZE (CMDR_SIZE + DATA_SIZE)
+#define DATA_BLOCK_SIZE PAGE_SIZE
+#define DATA_BLOCK_SHIFT PAGE_SHIFT
+#define DATA_AREA_MB_DEF 1024
+#define DATA_AREA_MB_MAX (BITS_PER_LONG == 64 ? 16 * 1024 : 1024)
 
 static struct device *tcmu_root_device;
 
@@ -92,13 +102,17 @@ struct tcmu_dev {
 	size_t dev_size;
 	u32 cmdr_size;
 	u32 cmdr_last_cleaned;
-	/* Offset of data ring from start of mb */
+	/* Offset of data area from start of mb */
 	size_t data_off;
 	size_t data_size;
-	/* Ring head + tail values. */
-	/* Must add data_off and mb_addr to get the address */
-	size_t data_head;
-	size_t data_tail;
+	size_t ring_size;
+
+	/* Blocks of the data area, the first data_pages of them backed */
+	u32 max_blocks;
+	u32 data_pages;
+	u32 used_blocks;
+	unsigned long *data_bitmap;
+	struct radix_tree_root data_blocks;
 
 	wait_queue_head_t wait_cmdr;
 	/* TODO should this be a mutex? */
@@ -126,6 +140,11 @@ struct tcmu_cmd {
 	   cmd has been completed then accessing se_cmd is off limits */
 	size_t data_length;
 
+	/* The data area blocks the command's data went to, in order */
+	u32 *dbi;
+	u32 dbi_cnt;
+	u32 dbi_cur;
+
 	unsigned long deadline;
 
 #define TCMU_CMD_BIT_EXPIRED 0
@@ -154,11 +173,34 @@ static struct genl_family tcmu_genl_family = {
 	.n_mcgrps = ARRAY_SIZE(tcmu_mcgrps),
 };
 
+static size_t tcmu_sgl_length(struct scatterlist *sgl, unsigned int nents)
+{
+	struct scatterlist *sg;
+	size_t len = 0;
+	int i;
+
+	for_each_sg(sgl, sg, nents, i)
+		len += sg->length;
+	return len;
+}
+
+static inline u32 tcmu_blocks(size_t len)
+{
+	return DIV_ROUND_UP(len, DATA_BLOCK_SIZE);
+}
+
+static void tcmu_free_cmd(struct tcmu_cmd *tcmu_cmd)
+{
+	kfree(tcmu_cmd->dbi);
+	kmem_cache_free(tcmu_cmd_cache, tcmu_cmd);
+}
+
 static struct tcmu_cmd *tcmu_alloc_cmd(struct se_cmd *se_cmd)
 {
 	struct se_device *se_dev = se_cmd->se_dev;
 	struct tcmu_dev *udev = TCMU_DEV(se_dev);
 	struct tcmu_cmd *tcmu_cmd;
+	size_t bidi_length = 0;
 	int cmd_id;
 
 	tcmu_cmd = kmem_cache_zalloc(tcmu_cmd_cache, GFP_KERNEL);
@@ -171,7 +213,22 @@ static struct tcmu_cmd *tcmu_alloc_cmd(struct se_cmd *se_cmd)
 
 	if (se_cmd->se_cmd_flags & SCF_BIDI) {
 		BUG_ON(!(se_cmd->t_bidi_data_sg && se_cmd->t_bidi_data_nents));
-		tcmu_cmd->data_length += se_cmd->t_bidi_data_sg->length;
+		bidi_length = tcmu_sgl_length(se_cmd->t_bidi_data_sg,
+					      se_cmd->t_bidi_data_nents);
+		tcmu_cmd->data_length += bidi_length;
+	}
+
+	/* data out and data in each start on a block of their own */
+	tcmu_cmd->dbi_cnt = tcmu_blocks(tcmu_sgl_length(se_cmd->t_data_sg,
+							se_cmd->t_data_nents)) +
+			    tcmu_blocks(bidi_length);
+	if (tcmu_cmd->dbi_cnt) {
+		tcmu_cmd->dbi = kcalloc(tcmu_cmd->dbi_cnt, sizeof(u32),
+					GFP_KERNEL);
+		if (!tcmu_cmd->dbi) {
+			kmem_cache_free(tcmu_cmd_cache, tcmu_cmd);
+			return NULL;
+		}
 	}
 
 	tcmu_cmd->deadline = jiffies + msecs_to_jiffies(TCMU_TIME_OUT);
@@ -184,7 +241,7 @@ static struct tcmu_cmd *tcmu_alloc_cmd(struct se_cmd *se_cmd)
 	idr_preload_end();
 
 	if (cmd_id < 0) {
-		kmem_cache_free(tcmu_cmd_cache, tcmu_cmd);
+		tcmu_free_cmd(tcmu_cmd);
 		return NULL;
 	}
 	tcmu_cmd->cmd_id = cmd_id;
@@ -232,110 +289,196 @@ static inline size_t head_to_end(size_t head, size_t size)
 
 #define UPDATE_HEAD(head, used, size) smp_store_release(&head, ((head % size) + used) % size)
 
+/* called with cmdr_lock held; the caller made sure a backed block is free */
+static u32 tcmu_get_empty_block(struct tcmu_dev *udev,
+				struct tcmu_cmd *tcmu_cmd)
+{
+	u32 dbi;
+
+	dbi = find_first_zero_bit(udev->data_bitmap, udev->data_pages);
+	BUG_ON(dbi >= udev->data_pages);
+	set_bit(dbi, udev->data_bitmap);
+	udev->used_blocks++;
+
+	tcmu_cmd->dbi[tcmu_cmd->dbi_cur++] = dbi;
+	return dbi;
+}
+
+static inline void *tcmu_block_addr(struct tcmu_dev *udev, u32 dbi)
+{
+	return page_address(radix_tree_lookup(&udev->data_blocks, dbi));
+}
+
+static void tcmu_put_blocks(struct tcmu_dev *udev, struct tcmu_cmd *tcmu_cmd)
+{
+	u32 i;
+
+	for (i = 0; i < tcmu_cmd->dbi_cur; i++)
+		clear_bit(tcmu_cmd->dbi[i], udev->data_bitmap);
+	udev->used_blocks -= tcmu_cmd->dbi_cur;
+	tcmu_cmd->dbi_cur = 0;
+}
+
 static void alloc_and_scatter_data_area(struct tcmu_dev *udev,
-	struct scatterlist *data_sg, unsigned int data_nents,
-	struct iovec **iov, int *iov_cnt, bool copy_data)
+	struct tcmu_cmd *tcmu_cmd, struct scatterlist *data_sg,
+	unsigned int data_nents, struct iovec **iov, int *iov_cnt,
+	bool copy_data)
 {
 	int i;
 	void *from, *to;
-	size_t copy_bytes;
+	size_t copy_bytes, block_remaining = 0;
+	size_t sg_remaining, offset;
 	struct scatterlist *sg;
+	u32 dbi = 0, prev_dbi = 0;
 
 	for_each_sg(data_sg, sg, data_nents, i) {
-		copy_bytes = min_t(size_t, sg->length,
-				 head_to_end(udev->data_head, udev->data_size));
+		sg_remaining = sg->length;
 		from = kmap_atomic(sg_page(sg)) + sg->offset;
-		to = (void *) udev->mb_addr + udev->data_off + udev->data_head;
-
-		if (copy_data) {
-			memcpy(to, from, copy_bytes);
-			tcmu_flush_dcache_range(to, copy_bytes);
-		}
-
-		/* Even iov_base is relative to mb_addr */
-		(*iov)->iov_len = copy_bytes;
-		(*iov)->iov_base = (void __user *) udev->data_off +
-						udev->data_head;
-		(*iov_cnt)++;
-		(*iov)++;
 
-		UPDATE_HEAD(udev->data_head, copy_bytes, udev->data_size);
-
-		/* Uh oh, we wrapped the buffer. Must split sg across 2 iovs. */
-		if (sg->length != copy_bytes) {
-			void *from_skip = from + copy_bytes;
-
-			copy_bytes = sg->length - copy_bytes;
+		while (sg_remaining) {
+			if (!block_remaining) {
+				prev_dbi = dbi;
+				dbi = tcmu_get_empty_block(udev, tcmu_cmd);
+				block_remaining = DATA_BLOCK_SIZE;
+			}
 
-			(*iov)->iov_len = copy_bytes;
-			(*iov)->iov_base = (void __user *) udev->data_off +
-							udev->data_head;
+			copy_bytes = min_t(size_t, sg_remaining,
+					   block_remaining);
+			offset = DATA_BLOCK_SIZE - block_remaining;
+			to = tcmu_block_addr(udev, dbi) + offset;
 
 			if (copy_data) {
-				to = (void *) udev->mb_addr +
-					udev->data_off + udev->data_head;
-				memcpy(to, from_skip, copy_bytes);
+				memcpy(to, from + sg->length - sg_remaining,
+				       copy_bytes);
 				tcmu_flush_dcache_range(to, copy_bytes);
 			}
 
-			(*iov_cnt)++;
-			(*iov)++;
+			/*
+			 * Extend the last iov if we carry on where it ended,
+			 * in the same block or at the start of the next one.
+			 * Even iov_base is relative to mb_addr.
+			 */
+			if (*iov_cnt &&
+			    (offset || (tcmu_cmd->dbi_cur > 1 &&
+					dbi == prev_dbi + 1))) {
+				(*iov - 1)->iov_len += copy_bytes;
+			} else {
+				(*iov)->iov_len = copy_bytes;
+				(*iov)->iov_base = (void __user *)
+					(udev->data_off +
+					 ((size_t)dbi << DATA_BLOCK_SHIFT) +
+					 offset);
+				(*iov_cnt)++;
+				(*iov)++;
+			}
 
-			UPDATE_HEAD(udev->data_head,
-				copy_bytes, udev->data_size);
+			sg_remaining -= copy_bytes;
+			block_remaining -= copy_bytes;
 		}
 
 		kunmap_atomic(from - sg->offset);
 	}
 }
 
-static void gather_and_free_data_area(struct tcmu_dev *udev,
-	struct scatterlist *data_sg, unsigned int data_nents)
+/*
+ * Copy the data in from the blocks that follow the first *dbi_idx of the
+ * command's, in the order they were handed out.
+ */
+static void gather_data_area(struct tcmu_dev *udev, struct tcmu_cmd *tcmu_cmd,
+	struct scatterlist *data_sg, unsigned int data_nents, u32 dbi_idx)
 {
 	int i;
 	void *from, *to;
-	size_t copy_bytes;
+	size_t copy_bytes, block_remaining = 0;
+	size_t sg_remaining;
 	struct scatterlist *sg;
+	u32 dbi = 0;
 
 	/* It'd be easier to look at entry's iovec again, but UAM */
 	for_each_sg(data_sg, sg, data_nents, i) {
-		copy_bytes = min_t(size_t, sg->length,
-				 head_to_end(udev->data_tail, udev->data_size));
-
+		sg_remaining = sg->length;
 		to = kmap_atomic(sg_page(sg)) + sg->offset;
 		WARN_ON(sg->length + sg->offset > PAGE_SIZE);
-		from = (void *) udev->mb_addr +
-			udev->data_off + udev->data_tail;
-		tcmu_flush_dcache_range(from, copy_bytes);
-		memcpy(to, from, copy_bytes);
 
-		UPDATE_HEAD(udev->data_tail, copy_bytes, udev->data_size);
-
-		/* Uh oh, wrapped the data buffer for this sg's data */
-		if (sg->length != copy_bytes) {
-			void *to_skip = to + copy_bytes;
+		while (sg_remaining) {
+			if (!block_remaining) {
+				if (WARN_ON(dbi_idx >= tcmu_cmd->dbi_cur))
+					break;
+				dbi = tcmu_cmd->dbi[dbi_idx++];
+				block_remaining = DATA_BLOCK_SIZE;
+			}
 
-			from = (void *) udev->mb_addr +
-				udev->data_off + udev->data_tail;
-			WARN_ON(udev->data_tail);
-			copy_bytes = sg->length - copy_bytes;
+			copy_bytes = min_t(size_t, sg_remaining,
+					   block_remaining);
+			from = tcmu_block_addr(udev, dbi) +
+				DATA_BLOCK_SIZE - block_remaining;
 			tcmu_flush_dcache_range(from, copy_bytes);
-			memcpy(to_skip, from, copy_bytes);
+			memcpy(to + sg->length - sg_remaining, from,
+			       copy_bytes);
 
-			UPDATE_HEAD(udev->data_tail,
-				copy_bytes, udev->data_size);
+			sg_remaining -= copy_bytes;
+			block_remaining -= copy_bytes;
 		}
 		kunmap_atomic(to - sg->offset);
 	}
 }
 
+/*
+ * Back more of the data area with pages, so that at least @blocks of the
+ * backed blocks are free.  Called without cmdr_lock, as it allocates.
+ */
+static int tcmu_grow_data_area(struct tcmu_dev *udev, u32 blocks)
+{
+	struct page *page;
+	int ret;
+
+	for (;;) {
+		spin_lock_irq(&udev->cmdr_lock);
+		if (udev->data_pages - udev->used_blocks >= blocks ||
+		    udev->data_pages >= udev->max_blocks) {
+			spin_unlock_irq(&udev->cmdr_lock);
+			return 0;
+		}
+		spin_unlock_irq(&udev->cmdr_lock);
+
+		/* userspace gets to see all of it */
+		page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (!page)
+			return -ENOMEM;
+
+		ret = radix_tree_preload(GFP_KERNEL);
+		if (ret) {
+			__free_page(page);
+			return ret;
+		}
+
+		spin_lock_irq(&udev->cmdr_lock);
+		if (udev->data_pages < udev->max_blocks) {
+			ret = radix_tree_insert(&udev->data_blocks,
+						udev->data_pages, page);
+			if (!ret) {
+				udev->data_pages++;
+				page = NULL;
+			}
+		}
+		spin_unlock_irq(&udev->cmdr_lock);
+		radix_tree_preload_end();
+
+		if (page) {
+			__free_page(page);
+			if (ret)
+				return ret;
+		}
+	}
+}
+
 /*
  * We can't queue a command until we have space available on the cmd ring *and*
- * space available on the data ring.
+ * enough blocks free in the data area.
  *
  * Called with ring lock held.
  */
-static bool is_ring_space_avail(struct tcmu_dev *udev, size_t cmd_size, size_t data_needed)
+static bool is_ring_space_avail(struct tcmu_dev *udev, size_t cmd_size, u32 blocks)
 {
 	struct tcmu_mailbox *mb = udev->mb_addr;
 	size_t space;
@@ -362,10 +505,9 @@ static bool is_ring_space_avail(struct tcmu_dev *udev, size_t cmd_size, size_t d
 		return false;
 	}
 
-	space = spc_free(udev->data_head, udev->data_tail, udev->data_size);
-	if (space < data_needed) {
-		pr_debug("no data space: %zu %zu %zu\n", udev->data_head,
-		       udev->data_tail, udev->data_size);
+	if (udev->data_pages - udev->used_blocks < blocks) {
+		pr_debug("no data space: %u %u %u\n", udev->used_blocks,
+		       udev->data_pages, udev->max_blocks);
 		return false;
 	}
 
@@ -392,32 +534,45 @@ static int tcmu_queue_cmd_ring(struct tcmu_cmd *tcmu_cmd)
 	 * Must be a certain minimum size for response sense info, but
 	 * also may be larger if the iov array is large.
 	 *
-	 * iovs = sgl_nents+1, for end-of-ring case, plus another 1
-	 * b/c size == offsetof one-past-element.
+	 * At worst every data block takes an iov of its own.
 	*/
 	base_command_size = max(offsetof(struct tcmu_cmd_entry,
-					 req.iov[se_cmd->t_bidi_data_nents +
-						 se_cmd->t_data_nents + 2]),
+					 req.iov[tcmu_cmd->dbi_cnt]),
 				sizeof(struct tcmu_cmd_entry));
 	command_size = base_command_size
 		+ round_up(scsi_command_size(se_cmd->t_task_cdb), TCMU_OP_ALIGN_SIZE);
 
 	WARN_ON(command_size & (TCMU_OP_ALIGN_SIZE-1));
 
-	spin_lock_irq(&udev->cmdr_lock);
-
-	mb = udev->mb_addr;
-	cmd_head = mb->cmd_head % udev->cmdr_size; /* UAM */
 	if ((command_size > (udev->cmdr_size / 2))
-	    || tcmu_cmd->data_length > (udev->data_size - 1))
+	    || tcmu_cmd->dbi_cnt > udev->max_blocks)
 		pr_warn("TCMU: Request of size %zu/%zu may be too big for %u/%zu "
 			"cmd/data ring buffers\n", command_size, tcmu_cmd->data_length,
 			udev->cmdr_size, udev->data_size);
 
-	while (!is_ring_space_avail(udev, command_size, tcmu_cmd->data_length)) {
+	if (tcmu_grow_data_area(udev, tcmu_cmd->dbi_cnt))
+		return -ENOMEM;
+
+	spin_lock_irq(&udev->cmdr_lock);
+
+	mb = udev->mb_addr;
+	cmd_head = mb->cmd_head % udev->cmdr_size; /* UAM */
+
+	while (!is_ring_space_avail(udev, command_size, tcmu_cmd->dbi_cnt)) {
 		int ret;
 		DEFINE_WAIT(__wait);
 
+		/* the data area may still have room to grow */
+		if (udev->data_pages < udev->max_blocks &&
+		    udev->data_pages - udev->used_blocks < tcmu_cmd->dbi_cnt) {
+			spin_unlock_irq(&udev->cmdr_lock);
+			if (tcmu_grow_data_area(udev, tcmu_cmd->dbi_cnt))
+				return -ENOMEM;
+			spin_lock_irq(&udev->cmdr_lock);
+			cmd_head = mb->cmd_head % udev->cmdr_size; /* UAM */
+			continue;
+		}
+
 		prepare_to_wait(&udev->wait_cmdr, &__wait, TASK_INTERRUPTIBLE);
 
 		pr_debug("sleeping for ring space\n");
@@ -468,14 +623,14 @@ static int tcmu_queue_cmd_ring(struct tcmu_cmd *tcmu_cmd)
 	iov_cnt = 0;
 	copy_to_data_area = (se_cmd->data_direction == DMA_TO_DEVICE
 		|| se_cmd->se_cmd_flags & SCF_BIDI);
-	alloc_and_scatter_data_area(udev, se_cmd->t_data_sg,
+	alloc_and_scatter_data_area(udev, tcmu_cmd, se_cmd->t_data_sg,
 		se_cmd->t_data_nents, &iov, &iov_cnt, copy_to_data_area);
 	entry->req.iov_cnt = iov_cnt;
 	entry->req.iov_dif_cnt = 0;
 
 	/* Handle BIDI commands */
 	iov_cnt = 0;
-	alloc_and_scatter_data_area(udev, se_cmd->t_bidi_data_sg,
+	alloc_and_scatter_data_area(udev, tcmu_cmd, se_cmd->t_bidi_data_sg,
 		se_cmd->t_bidi_data_nents, &iov, &iov_cnt, false);
 	entry->req.iov_bidi_cnt = iov_cnt;
 
@@ -517,7 +672,7 @@ static int tcmu_queue_cmd(struct se_cmd *se_cmd)
 		idr_remove(&udev->commands, tcmu_cmd->cmd_id);
 		spin_unlock_irq(&udev->commands_lock);
 
-		kmem_cache_free(tcmu_cmd_cache, tcmu_cmd);
+		tcmu_free_cmd(tcmu_cmd);
 	}
 
 	return ret;
@@ -530,43 +685,39 @@ static void tcmu_handle_completion(struct tcmu_cmd *cmd, struct tcmu_cmd_entry *
 
 	if (test_bit(TCMU_CMD_BIT_EXPIRED, &cmd->flags)) {
 		/* cmd has been completed already from timeout, just reclaim data
-		   ring space */
-		UPDATE_HEAD(udev->data_tail, cmd->data_length, udev->data_size);
+		   area space */
+		tcmu_put_blocks(udev, cmd);
+		tcmu_free_cmd(cmd);
 		return;
 	}
 
 	if (entry->hdr.uflags & TCMU_UFLAG_UNKNOWN_OP) {
-		UPDATE_HEAD(udev->data_tail, cmd->data_length, udev->data_size);
 		pr_warn("TCMU: Userspace set UNKNOWN_OP flag on se_cmd %p\n",
 			cmd->se_cmd);
 		entry->rsp.scsi_status = SAM_STAT_CHECK_CONDITION;
 	} else if (entry->rsp.scsi_status == SAM_STAT_CHECK_CONDITION) {
 		memcpy(se_cmd->sense_buffer, entry->rsp.sense_buffer,
 			       se_cmd->scsi_sense_length);
-
-		UPDATE_HEAD(udev->data_tail, cmd->data_length, udev->data_size);
 	} else if (se_cmd->se_cmd_flags & SCF_BIDI) {
-		/* Discard data_out buffer */
-		UPDATE_HEAD(udev->data_tail,
-			(size_t)se_cmd->t_data_sg->length, udev->data_size);
-
-		/* Get Data-In buffer */
-		gather_and_free_data_area(udev,
-			se_cmd->t_bidi_data_sg, se_cmd->t_bidi_data_nents);
+		/* Get Data-In buffer, past the data_out blocks */
+		gather_data_area(udev, cmd, se_cmd->t_bidi_data_sg,
+			se_cmd->t_bidi_data_nents,
+			tcmu_blocks(tcmu_sgl_length(se_cmd->t_data_sg,
+						    se_cmd->t_data_nents)));
 	} else if (se_cmd->data_direction == DMA_FROM_DEVICE) {
-		gather_and_free_data_area(udev,
-			se_cmd->t_data_sg, se_cmd->t_data_nents);
-	} else if (se_cmd->data_direction == DMA_TO_DEVICE) {
-		UPDATE_HEAD(udev->data_tail, cmd->data_length, udev->data_size);
-	} else if (se_cmd->data_direction != DMA_NONE) {
+		gather_data_area(udev, cmd, se_cmd->t_data_sg,
+			se_cmd->t_data_nents, 0);
+	} else if (se_cmd->data_direction != DMA_TO_DEVICE &&
+		   se_cmd->data_direction != DMA_NONE) {
 		pr_warn("TCMU: data direction was %d!\n",
 			se_cmd->data_direction);
 	}
+	tcmu_put_blocks(udev, cmd);
 
 	target_complete_cmd(cmd->se_cmd, entry->rsp.scsi_status);
 	cmd->se_cmd = NULL;
 
-	kmem_cache_free(tcmu_cmd_cache, cmd);
+	tcmu_free_cmd(cmd);
 }
 
 static unsigned int tcmu_handle_completions(struct tcmu_dev *udev)
@@ -645,8 +796,10 @@ static int tcmu_check_expired_cmd(int id, void *p, void *data)
 	target_complete_cmd(cmd->se_cmd, SAM_STAT_CHECK_CONDITION);
 	cmd->se_cmd = NULL;
 
-	kmem_cache_free(tcmu_cmd_cache, cmd);
-
+	/*
+	 * Userspace still owns its blocks; they and the cmd are given back
+	 * when it completes the entry.
+	 */
 	return 0;
 }
 
@@ -712,6 +865,10 @@ static struct se_device *tcmu_alloc_device(struct se_hba *hba, const char *name)
 	idr_init(&udev->commands);
 	spin_lock_init(&udev->commands_lock);
 
+	/* lookups happen under the lock or RCU, inserts are preloaded */
+	INIT_RADIX_TREE(&udev->data_blocks, GFP_NOWAIT);
+	udev->max_blocks = (DATA_AREA_MB_DEF << 20) >> DATA_BLOCK_SHIFT;
+
 	setup_timer(&udev->timeout, tcmu_device_timedout,
 		(unsigned long)udev);
 
@@ -762,11 +919,19 @@ static int tcmu_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	 */
 	offset = (vmf->pgoff - mi) << PAGE_SHIFT;
 
-	addr = (void *)(unsigned long)info->mem[mi].addr + offset;
-	if (info->mem[mi].memtype == UIO_MEM_LOGICAL)
-		page = virt_to_page(addr);
-	else
+	if (offset < udev->data_off) {
+		/* the mailbox and the command ring */
+		addr = (void *)(unsigned long)info->mem[mi].addr + offset;
 		page = vmalloc_to_page(addr);
+	} else {
+		/* blocks are backed once, and stay until the device goes */
+		rcu_read_lock();
+		page = radix_tree_lookup(&udev->data_blocks,
+				(offset - udev->data_off) >> DATA_BLOCK_SHIFT);
+		rcu_read_unlock();
+		if (!page)
+			return VM_FAULT_SIGBUS;
+	}
 	get_page(page);
 	vmf->page = page;
 	return 0;
@@ -786,7 +951,7 @@ static int tcmu_mmap(struct uio_info *info, struct vm_area_struct *vma)
 	vma->vm_private_data = udev;
 
 	/* Ensure the mmap is exactly the right size */
-	if (vma_pages(vma) != (TCMU_RING_SIZE >> PAGE_SHIFT))
+	if (vma_pages(vma) != (udev->ring_size >> PAGE_SHIFT))
 		return -EINVAL;
 
 	return 0;
@@ -880,16 +1045,25 @@ static int tcmu_configure_device(struct se_device *dev)
 
 	info->name = str;
 
-	udev->mb_addr = vzalloc(TCMU_RING_SIZE);
+	/* only the mailbox and command ring are allocated up front */
+	udev->mb_addr = vzalloc(CMDR_SIZE);
 	if (!udev->mb_addr) {
 		ret = -ENOMEM;
 		goto err_vzalloc;
 	}
 
+	udev->data_bitmap = vzalloc(BITS_TO_LONGS(udev->max_blocks) *
+				    sizeof(unsigned long));
+	if (!udev->data_bitmap) {
+		ret = -ENOMEM;
+		goto err_bitmap;
+	}
+
 	/* mailbox fits in first part of CMDR space */
 	udev->cmdr_size = CMDR_SIZE - CMDR_OFF;
 	udev->data_off = CMDR_SIZE;
-	udev->data_size = TCMU_RING_SIZE - CMDR_SIZE;
+	udev->data_size = (size_t)udev->max_blocks << DATA_BLOCK_SHIFT;
+	udev->ring_size = CMDR_SIZE + udev->data_size;
 
 	mb = udev->mb_addr;
 	mb->version = TCMU_MAILBOX_VERSION;
@@ -903,7 +1077,7 @@ static int tcmu_configure_device(struct se_device *dev)
 
 	info->mem[0].name = "tcm-user command & data buffer";
 	info->mem[0].addr = (phys_addr_t) udev->mb_addr;
-	info->mem[0].size = TCMU_RING_SIZE;
+	info->mem[0].size = udev->ring_size;
 	info->mem[0].memtype = UIO_MEM_VIRTUAL;
 
 	info->irqcontrol = tcmu_irqcontrol;
@@ -932,7 +1106,11 @@ static int tcmu_configure_device(struct se_device *dev)
 err_netlink:
 	uio_unregister_device(&udev->uio_info);
 err_register:
+	vfree(udev->data_bitmap);
+	udev->data_bitmap = NULL;
+err_bitmap:
 	vfree(udev->mb_addr);
+	udev->mb_addr = NULL;
 err_vzalloc:
 	kfree(info->name);
 
@@ -943,11 +1121,27 @@ static int tcmu_check_pending_cmd(int id, void *p, void *data)
 {
 	struct tcmu_cmd *cmd = p;
 
-	if (test_bit(TCMU_CMD_BIT_EXPIRED, &cmd->flags))
+	if (test_bit(TCMU_CMD_BIT_EXPIRED, &cmd->flags)) {
+		tcmu_free_cmd(cmd);
 		return 0;
+	}
 	return -EINVAL;
 }
 
+static void tcmu_free_data_area(struct tcmu_dev *udev)
+{
+	struct page *page;
+	u32 i;
+
+	for (i = 0; i < udev->data_pages; i++) {
+		page = radix_tree_delete(&udev->data_blocks, i);
+		if (page)
+			__free_page(page);
+	}
+	udev->data_pages = 0;
+	vfree(udev->data_bitmap);
+}
+
 static void tcmu_dev_call_rcu(struct rcu_head *p)
 {
 	struct se_device *dev = container_of(p, struct se_device, rcu_head);
@@ -964,6 +1158,7 @@ static void tcmu_free_device(struct se_device *dev)
 	del_timer_sync(&udev->timeout);
 
 	vfree(udev->mb_addr);
+	tcmu_free_data_area(udev);
 
 	/* Upper layer should drain all requests before calling this */
 	spin_lock_irq(&udev->commands_lock);
@@ -985,13 +1180,15 @@ static void tcmu_free_device(struct se_device *dev)
 }
 
 enum {
-	Opt_dev_config, Opt_dev_size, Opt_hw_block_size, Opt_err,
+	Opt_dev_config, Opt_dev_size, Opt_hw_block_size, Opt_max_data_area_mb,
+	Opt_err,
 };
 
 static match_table_t tokens = {
 	{Opt_dev_config, "dev_config=%s"},
 	{Opt_dev_size, "dev_size=%u"},
 	{Opt_hw_block_size, "hw_block_size=%u"},
+	{Opt_max_data_area_mb, "max_data_area_mb=%u"},
 	{Opt_err, NULL}
 };
 
@@ -1053,6 +1250,31 @@ static ssize_t tcmu_set_configfs_dev_params(struct se_device *dev,
 			}
 			dev->dev_attrib.hw_block_size = tmp_ul;
 			break;
+		case Opt_max_data_area_mb:
+			if (udev->mb_addr) {
+				pr_err("max_data_area_mb can't be changed once the device is configured\n");
+				ret = -EBUSY;
+				break;
+			}
+			arg_p = match_strdup(&args[0]);
+			if (!arg_p) {
+				ret = -ENOMEM;
+				break;
+			}
+			ret = kstrtoul(arg_p, 0, &tmp_ul);
+			kfree(arg_p);
+			if (ret < 0) {
+				pr_err("kstrtoul() failed for max_data_area_mb=\n");
+				break;
+			}
+			if (!tmp_ul || tmp_ul > DATA_AREA_MB_MAX) {
+				pr_err("max_data_area_mb must be 1 to %u\n",
+				       DATA_AREA_MB_MAX);
+				ret = -EINVAL;
+				break;
+			}
+			udev->max_blocks = (tmp_ul << 20) >> DATA_BLOCK_SHIFT;
+			break;
 		default:
 			break;
 		}
@@ -1069,7 +1291,9 @@ static ssize_t tcmu_show_configfs_dev_params(struct se_device *dev, char *b)
 
 	bl = sprintf(b + bl, "Config: %s ",
 		     udev->dev_config[0] ? udev->dev_config : "NULL");
-	bl += sprintf(b + bl, "Size: %zu\n", udev->dev_size);
+	bl += sprintf(b + bl, "Size: %zu ", udev->dev_size);
+	bl += sprintf(b + bl, "MaxDataAreaMB: %u\n",
+		      (u32)(((u64)udev->max_blocks << DATA_BLOCK_SHIFT) >> 20));
 
 	return bl;
 }
@@ -147,12 +147,14 @@ EXPORT_SYMBOL_GPL(vhost_work_init);
 
 /* Init poll structure */
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     unsigned long mask, struct vhost_dev *dev)
+		     unsigned long mask, struct vhost_dev *dev,
+		     struct vhost_virtqueue *vq)
 {
 	init_waitqueue_func_entry(&poll->wait, vhost_poll_wakeup);
 	init_poll_funcptr(&poll->table, vhost_poll_func);
 	poll->mask = mask;
 	poll->dev = dev;
+	poll->vq = vq;
 	poll->wqh = NULL;
 
 	vhost_work_init(&poll->work, fn);
@@ -229,32 +231,71 @@ void vhost_poll_flush(struct vhost_poll *poll)
 }
 EXPORT_SYMBOL_GPL(vhost_poll_flush);
 
-void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work)
+static void vhost_worker_queue(struct vhost_worker *worker,
+			       struct vhost_work *work)
 {
+	struct vhost_dev *dev = worker->dev;
 	unsigned long flags;
 
 	spin_lock_irqsave(&dev->work_lock, flags);
 	if (list_empty(&work->node)) {
-		list_add_tail(&work->node, &dev->work_list);
+		list_add_tail(&work->node, &worker->work_list);
 		work->queue_seq++;
 		spin_unlock_irqrestore(&dev->work_lock, flags);
-		wake_up_process(dev->worker);
+		wake_up_process(worker->task);
 	} else {
 		spin_unlock_irqrestore(&dev->work_lock, flags);
 	}
 }
+
+void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work)
+{
+	vhost_worker_queue(dev->worker, work);
+}
 EXPORT_SYMBOL_GPL(vhost_work_queue);
 
+/*
+ * Work already queued when the virtqueue moves to another worker still
+ * runs on the old one; handlers serialize on the virtqueue mutex anyway.
+ */
+void vhost_vq_work_queue(struct vhost_virtqueue *vq, struct vhost_work *work)
+{
+	struct vhost_worker *worker;
+
+	rcu_read_lock();
+	worker = rcu_dereference(vq->worker);
+	vhost_worker_queue(worker, work);
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL_GPL(vhost_vq_work_queue);
+
 /* A lockless hint for busy polling code to exit the loop */
 bool vhost_has_work(struct vhost_dev *dev)
 {
-	return !list_empty(&dev->work_list);
+	return !list_empty(&dev->worker->work_list);
 }
 EXPORT_SYMBOL_GPL(vhost_has_work);
 
+/* The same, for code running on @vq's worker */
+bool vhost_vq_has_work(struct vhost_virtqueue *vq)
+{
+	struct vhost_worker *worker;
+	bool ret;
+
+	rcu_read_lock();
+	worker = rcu_dereference(vq->worker);
+	ret = !list_empty(&worker->work_list);
+	rcu_read_unlock();
+	return ret;
+}
+EXPORT_SYMBOL_GPL(vhost_vq_has_work);
+
 void vhost_poll_queue(struct vhost_poll *poll)
 {
-	vhost_work_queue(poll->dev, &poll->work);
+	if (poll->vq)
+		vhost_vq_work_queue(poll->vq, &poll->work);
+	else
+		vhost_work_queue(poll->dev, &poll->work);
 }
 EXPORT_SYMBOL_GPL(vhost_poll_queue);
 
@@ -286,11 +327,13 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->is_le = virtio_legacy_is_little_endian();
 	vhost_vq_reset_user_be(vq);
 	vq->busyloop_timeout = 0;
+	RCU_INIT_POINTER(vq->worker, NULL);
 }
 
 static int vhost_worker(void *data)
 {
-	struct vhost_dev *dev = data;
+	struct vhost_worker *worker = data;
+	struct vhost_dev *dev = worker->dev;
 	struct vhost_work *work = NULL;
 	unsigned uninitialized_var(seq);
 	mm_segment_t oldfs = get_fs();
@@ -314,8 +357,8 @@ static int vhost_worker(void *data)
 			__set_current_state(TASK_RUNNING);
 			break;
 		}
-		if (!list_empty(&dev->work_list)) {
-			work = list_first_entry(&dev->work_list,
+		if (!list_empty(&worker->work_list)) {
+			work = list_first_entry(&worker->work_list,
 						struct vhost_work, node);
 			list_del_init(&work->node);
 			seq = work->queue_seq;
@@ -392,8 +435,9 @@ void vhost_dev_init(struct vhost_dev *dev,
 	dev->memory = NULL;
 	dev->mm = NULL;
 	spin_lock_init(&dev->work_lock);
-	INIT_LIST_HEAD(&dev->work_list);
 	dev->worker = NULL;
+	idr_init(&dev->worker_idr);
+	dev->nworkers = 0;
 
 	for (i = 0; i < dev->nvqs; ++i) {
 		vq = dev->vqs[i];
@@ -405,7 +449,7 @@ void vhost_dev_init(struct vhost_dev *dev,
 		vhost_vq_reset(dev, vq);
 		if (vq->handle_kick)
 			vhost_poll_init(&vq->poll, vq->handle_kick,
-					POLLIN, dev);
+					POLLIN, dev, vq);
 	}
 }
 EXPORT_SYMBOL_GPL(vhost_dev_init);
@@ -432,17 +476,156 @@ static void vhost_attach_cgroups_work(struct vhost_work *work)
 	s->ret = cgroup_attach_task_all(s->owner, current);
 }
 
-static int vhost_attach_cgroups(struct vhost_dev *dev)
+static int vhost_attach_cgroups(struct vhost_worker *worker)
 {
 	struct vhost_attach_cgroups_struct attach;
 
 	attach.owner = current;
 	vhost_work_init(&attach.work, vhost_attach_cgroups_work);
-	vhost_work_queue(dev, &attach.work);
-	vhost_work_flush(dev, &attach.work);
+	vhost_worker_queue(worker, &attach.work);
+	vhost_work_flush(worker->dev, &attach.work);
 	return attach.ret;
 }
 
+static void vhost_flush_work(struct vhost_work *work)
+{
+}
+
+/* Wait for everything queued on @worker so far to have run. */
+static void vhost_worker_flush(struct vhost_worker *worker)
+{
+	struct vhost_work flush;
+
+	vhost_work_init(&flush, vhost_flush_work);
+	vhost_worker_queue(worker, &flush);
+	vhost_work_flush(worker->dev, &flush);
+}
+
+static void vhost_worker_destroy(struct vhost_worker *worker)
+{
+	WARN_ON(!list_empty(&worker->work_list));
+	kthread_stop(worker->task);
+	kfree_rcu(worker, rcu);
+}
+
+/* Caller should have device mutex; the worker runs in our cgroups. */
+static struct vhost_worker *vhost_worker_create(struct vhost_dev *dev)
+{
+	struct vhost_worker *worker;
+	struct task_struct *task;
+	int id, err;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return ERR_PTR(-ENOMEM);
+	INIT_LIST_HEAD(&worker->work_list);
+	worker->dev = dev;
+
+	id = idr_alloc(&dev->worker_idr, worker, 0, 0, GFP_KERNEL);
+	if (id < 0) {
+		err = id;
+		goto err_idr;
+	}
+	worker->id = id;
+
+	task = kthread_create(vhost_worker, worker, "vhost-%d", current->pid);
+	if (IS_ERR(task)) {
+		err = PTR_ERR(task);
+		goto err_task;
+	}
+
+	worker->task = task;
+	wake_up_process(task);	/* avoid contributing to loadavg */
+
+	err = vhost_attach_cgroups(worker);
+	if (err)
+		goto err_cgroup;
+
+	dev->nworkers++;
+	return worker;
+
+err_cgroup:
+	kthread_stop(task);
+err_task:
+	idr_remove(&dev->worker_idr, id);
+err_idr:
+	kfree(worker);
+	return ERR_PTR(err);
+}
+
+/* Caller should have device mutex */
+static long vhost_new_worker(struct vhost_dev *dev,
+			     struct vhost_worker_state __user *argp)
+{
+	struct vhost_worker_state state;
+	struct vhost_worker *worker;
+
+	/* More workers than virtqueues wouldn't buy anything */
+	if (dev->nworkers >= dev->nvqs)
+		return -ENOSPC;
+
+	worker = vhost_worker_create(dev);
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+
+	state.worker_id = worker->id;
+	if (copy_to_user(argp, &state, sizeof(state))) {
+		idr_remove(&dev->worker_idr, worker->id);
+		dev->nworkers--;
+		vhost_worker_destroy(worker);
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/* Caller should have device mutex */
+static long vhost_free_worker(struct vhost_dev *dev,
+			      struct vhost_worker_state __user *argp)
+{
+	struct vhost_worker_state state;
+	struct vhost_worker *worker;
+
+	if (copy_from_user(&state, argp, sizeof(state)))
+		return -EFAULT;
+
+	worker = idr_find(&dev->worker_idr, state.worker_id);
+	if (!worker)
+		return -ENODEV;
+	if (worker == dev->worker || worker->attachment_cnt)
+		return -EBUSY;
+
+	idr_remove(&dev->worker_idr, worker->id);
+	dev->nworkers--;
+	/* Let anyone who looked it up before it was detached queue their
+	 * work, and then let that run. */
+	synchronize_rcu();
+	vhost_worker_flush(worker);
+	vhost_worker_destroy(worker);
+	return 0;
+}
+
+/* Caller should have device and vq mutex */
+static long vhost_vq_attach_worker(struct vhost_virtqueue *vq,
+				   struct vhost_vring_worker *w)
+{
+	struct vhost_dev *dev = vq->dev;
+	struct vhost_worker *worker, *old;
+
+	worker = idr_find(&dev->worker_idr, w->worker_id);
+	if (!worker)
+		return -ENODEV;
+
+	old = rcu_dereference_protected(vq->worker,
+					lockdep_is_held(&dev->mutex));
+	if (old == worker)
+		return 0;
+
+	worker->attachment_cnt++;
+	rcu_assign_pointer(vq->worker, worker);
+	old->attachment_cnt--;
+	return 0;
+}
+
 /* Caller should have device mutex */
 bool vhost_dev_has_owner(struct vhost_dev *dev)
 {
@@ -453,8 +636,8 @@ EXPORT_SYMBOL_GPL(vhost_dev_has_owner);
 /* Caller should have device mutex */
 long vhost_dev_set_owner(struct vhost_dev *dev)
 {
-	struct task_struct *worker;
-	int err;
+	struct vhost_worker *worker;
+	int err, i;
 
 	/* Is there an owner already? */
 	if (vhost_dev_has_owner(dev)) {
@@ -464,26 +647,27 @@ long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	/* No owner, become one */
 	dev->mm = get_task_mm(current);
-	worker = kthread_create(vhost_worker, dev, "vhost-%d", current->pid);
+	worker = vhost_worker_create(dev);
 	if (IS_ERR(worker)) {
 		err = PTR_ERR(worker);
 		goto err_worker;
 	}
 
 	dev->worker = worker;
-	wake_up_process(worker);	/* avoid contributing to loadavg */
-
-	err = vhost_attach_cgroups(dev);
-	if (err)
-		goto err_cgroup;
 
 	err = vhost_dev_alloc_iovecs(dev);
 	if (err)
-		goto err_cgroup;
+		goto err_iovecs;
+
+	for (i = 0; i < dev->nvqs; ++i)
+		rcu_assign_pointer(dev->vqs[i]->worker, worker);
+	worker->attachment_cnt = dev->nvqs;
 
 	return 0;
-err_cgroup:
-	kthread_stop(worker);
+err_iovecs:
+	idr_remove(&dev->worker_idr, worker->id);
+	dev->nworkers--;
+	vhost_worker_destroy(worker);
 	dev->worker = NULL;
 err_worker:
 	if (dev->mm)
@@ -534,6 +718,7 @@ EXPORT_SYMBOL_GPL(vhost_dev_stop);
 /* Caller should have device mutex if and only if locked is set */
 void vhost_dev_cleanup(struct vhost_dev *dev, bool locked)
 {
+	struct vhost_worker *worker;
 	int i;
 
 	for (i = 0; i < dev->nvqs; ++i) {
@@ -559,11 +744,12 @@ void vhost_dev_cleanup(struct vhost_dev *dev, bool locked)
 	/* No one will access memory at this point */
 	kvfree(dev->memory);
 	dev->memory = NULL;
-	WARN_ON(!list_empty(&dev->work_list));
-	if (dev->worker) {
-		kthread_stop(dev->worker);
-		dev->worker = NULL;
-	}
+	idr_for_each_entry(&dev->worker_idr, worker, i)
+		vhost_worker_destroy(worker);
+	idr_destroy(&dev->worker_idr);
+	idr_init(&dev->worker_idr);
+	dev->nworkers = 0;
+	dev->worker = NULL;
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -748,6 +934,8 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 	struct vhost_vring_state s;
 	struct vhost_vring_file f;
 	struct vhost_vring_addr a;
+	struct vhost_vring_worker w;
+	struct vhost_worker *worker;
 	u32 idx;
 	long r;
 
@@ -933,6 +1121,21 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 		if (copy_to_user(argp, &s, sizeof(s)))
 			r = -EFAULT;
 		break;
+	case VHOST_ATTACH_VRING_WORKER:
+		if (copy_from_user(&w, argp, sizeof(w))) {
+			r = -EFAULT;
+			break;
+		}
+		r = vhost_vq_attach_worker(vq, &w);
+		break;
+	case VHOST_GET_VRING_WORKER:
+		worker = rcu_dereference_protected(vq->worker,
+						   lockdep_is_held(&d->mutex));
+		w.index = idx;
+		w.worker_id = worker->id;
+		if (copy_to_user(argp, &w, sizeof(w)))
+			r = -EFAULT;
+		break;
 	default:
 		r = -ENOIOCTLCMD;
 	}
@@ -980,6 +1183,12 @@ long vhost_dev_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *argp)
 	case VHOST_SET_MEM_TABLE:
 		r = vhost_set_memory(d, argp);
 		break;
+	case VHOST_NEW_WORKER:
+		r = vhost_new_worker(d, argp);
+		break;
+	case VHOST_FREE_WORKER:
+		r = vhost_free_worker(d, argp);
+		break;
 	case VHOST_SET_LOG_BASE:
 		if (copy_from_user(&p, argp, sizeof p)) {
 			r = -EFAULT;
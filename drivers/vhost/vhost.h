@@ -11,6 +11,8 @@
 #include <linux/virtio_config.h>
 #include <linux/virtio_ring.h>
 #include <linux/atomic.h>
+#include <linux/idr.h>
+#include <linux/rcupdate.h>
 
 struct vhost_work;
 typedef void (*vhost_work_fn_t)(struct vhost_work *work);
@@ -24,6 +26,18 @@ struct vhost_work {
 	unsigned		  done_seq;
 };
 
+/* A kthread running the work of the virtqueues attached to it. */
+struct vhost_worker {
+	struct task_struct	  *task;
+	/* Protected by the device's work_lock. */
+	struct list_head	  work_list;
+	struct vhost_dev	  *dev;
+	int			  id;
+	/* Virtqueues using this worker, protected by the device mutex. */
+	int			  attachment_cnt;
+	struct rcu_head		  rcu;
+};
+
 /* Poll a file (eventfd or socket) */
 /* Note: there's nothing vhost specific about this structure. */
 struct vhost_poll {
@@ -33,14 +47,19 @@ struct vhost_poll {
 	struct vhost_work	  work;
 	unsigned long		  mask;
 	struct vhost_dev	 *dev;
+	/* Queue work on this virtqueue's worker, if set. */
+	struct vhost_virtqueue	 *vq;
 };
 
 void vhost_work_init(struct vhost_work *work, vhost_work_fn_t fn);
 void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work);
+void vhost_vq_work_queue(struct vhost_virtqueue *vq, struct vhost_work *work);
 bool vhost_has_work(struct vhost_dev *dev);
+bool vhost_vq_has_work(struct vhost_virtqueue *vq);
 
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     unsigned long mask, struct vhost_dev *dev);
+		     unsigned long mask, struct vhost_dev *dev,
+		     struct vhost_virtqueue *vq);
 int vhost_poll_start(struct vhost_poll *poll, struct file *file);
 void vhost_poll_stop(struct vhost_poll *poll);
 void vhost_poll_flush(struct vhost_poll *poll);
@@ -56,6 +75,8 @@ struct vhost_log {
 /* The virtqueue structure describes a queue attached to a device. */
 struct vhost_virtqueue {
 	struct vhost_dev *dev;
+	/* Where the work of this virtqueue runs. */
+	struct vhost_worker __rcu *worker;
 
 	/* The actual ring of buffers. */
 	struct mutex mutex;
@@ -126,9 +147,13 @@ struct vhost_dev {
 	int nvqs;
 	struct file *log_file;
 	struct eventfd_ctx *log_ctx;
+	/* Protects the work lists of all the device's workers. */
 	spinlock_t work_lock;
-	struct list_head work_list;
-	struct task_struct *worker;
+	/* Created with the owner; the one virtqueues start out on. */
+	struct vhost_worker *worker;
+	/* All workers, by id, protected by the device mutex. */
+	struct idr worker_idr;
+	int nworkers;
 };
 
 void vhost_dev_init(struct vhost_dev *, struct vhost_virtqueue **vqs, int nvqs);
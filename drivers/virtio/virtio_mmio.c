@@ -135,6 +135,10 @@ static int vm_finalize_features(struct virtio_device *vdev)
 	/* Give virtio_ring a chance to accept features. */
 	vring_transport_features(vdev);
 
+	/* A legacy device only takes the page frame of a split ring. */
+	if (vm_dev->version == 1)
+		__virtio_clear_bit(vdev, VIRTIO_F_RING_PACKED);
+
 	/* Make sure there is are no mixed devices */
 	if (vm_dev->version == 2 &&
 			!__virtio_test_bit(vdev, VIRTIO_F_VERSION_1)) {
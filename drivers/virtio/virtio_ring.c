@@ -43,6 +43,26 @@
 	} while (0)
 #define END_USE(_vq) \
 	do { BUG_ON(!(_vq)->in_use); (_vq)->in_use = 0; } while(0)
+#define LAST_ADD_TIME_UPDATE(_vq)				\
+	do {							\
+		ktime_t now = ktime_get();			\
+								\
+		/* No kick or get, with .1 second between?  Warn. */ \
+		if ((_vq)->last_add_time_valid)			\
+			WARN_ON(ktime_to_ms(ktime_sub(now,	\
+				(_vq)->last_add_time)) > 100);	\
+		(_vq)->last_add_time = now;			\
+		(_vq)->last_add_time_valid = true;		\
+	} while (0)
+#define LAST_ADD_TIME_CHECK(_vq)				\
+	do {							\
+		if ((_vq)->last_add_time_valid) {		\
+			WARN_ON(ktime_to_ms(ktime_sub(ktime_get(), \
+				      (_vq)->last_add_time)) > 100); \
+		}						\
+	} while (0)
+#define LAST_ADD_TIME_INVALID(_vq)				\
+	((_vq)->last_add_time_valid = false)
 #else
 #define BAD_RING(_vq, fmt, args...)				\
 	do {							\
@@ -52,14 +72,26 @@
 	} while (0)
 #define START_USE(vq)
 #define END_USE(vq)
+#define LAST_ADD_TIME_UPDATE(vq)
+#define LAST_ADD_TIME_CHECK(vq)
+#define LAST_ADD_TIME_INVALID(vq)
 #endif
 
+struct vring_desc_state_packed {
+	u16 num;			/* Descriptor list length. */
+	u16 next;			/* The next buffer id on the free list. */
+	struct vring_packed_desc *indir_desc; /* Indirect descriptor, if any. */
+};
+
 struct vring_virtqueue {
 	struct virtqueue vq;
 
-	/* Actual memory layout for this queue */
+	/* Actual memory layout for this queue, if split */
 	struct vring vring;
 
+	/* Is this a packed ring? */
+	bool packed_ring;
+
 	/* Can we use weak barriers? */
 	bool weak_barriers;
 
@@ -72,7 +104,7 @@ struct vring_virtqueue {
 	/* Host publishes avail event idx */
 	bool event;
 
-	/* Head of free buffer list. */
+	/* Head of free buffer list (of buffer ids, if packed). */
 	unsigned int free_head;
 	/* Number we've added since last sync. */
 	unsigned int num_added;
@@ -86,6 +118,31 @@ struct vring_virtqueue {
 	/* Last written value to avail->idx in guest byte order */
 	u16 avail_idx_shadow;
 
+	/* The packed ring, which shares free_head, num_added and
+	 * last_used_idx with the split one. */
+	struct {
+		unsigned int num;
+		struct vring_packed_desc *desc;
+		struct vring_packed_desc_event *driver;
+		struct vring_packed_desc_event *device;
+
+		/* Index of the next descriptor we make available. */
+		u16 next_avail_idx;
+
+		/* Wrap counters of the driver and of the device. */
+		bool avail_wrap_counter;
+		bool used_wrap_counter;
+
+		/* AVAIL/USED flags a descriptor gets when made available. */
+		u16 avail_used_flags;
+
+		/* Last written value to driver->flags */
+		u16 event_flags_shadow;
+
+		/* Per buffer id state. */
+		struct vring_desc_state_packed *desc_state;
+	} packed;
+
 	/* How to notify other side. FIXME: commonalize hcalls! */
 	bool (*notify)(struct virtqueue *vq);
 
@@ -126,13 +183,13 @@ static struct vring_desc *alloc_indirect(struct virtqueue *_vq,
 	return desc;
 }
 
-static inline int virtqueue_add(struct virtqueue *_vq,
-				struct scatterlist *sgs[],
-				unsigned int total_sg,
-				unsigned int out_sgs,
-				unsigned int in_sgs,
-				void *data,
-				gfp_t gfp)
+static inline int virtqueue_add_split(struct virtqueue *_vq,
+				      struct scatterlist *sgs[],
+				      unsigned int total_sg,
+				      unsigned int out_sgs,
+				      unsigned int in_sgs,
+				      void *data,
+				      gfp_t gfp)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 	struct scatterlist *sg;
@@ -141,30 +198,7 @@ static inline int virtqueue_add(struct virtqueue *_vq,
 	int head;
 	bool indirect;
 
-	START_USE(vq);
-
-	BUG_ON(data == NULL);
-
-	if (unlikely(vq->broken)) {
-		END_USE(vq);
-		return -EIO;
-	}
-
-#ifdef DEBUG
-	{
-		ktime_t now = ktime_get();
-
-		/* No kick or get, with .1 second between?  Warn. */
-		if (vq->last_add_time_valid)
-			WARN_ON(ktime_to_ms(ktime_sub(now, vq->last_add_time))
-					    > 100);
-		vq->last_add_time = now;
-		vq->last_add_time_valid = true;
-	}
-#endif
-
 	BUG_ON(total_sg > vq->vring.num);
-	BUG_ON(total_sg == 0);
 
 	head = vq->free_head;
 
@@ -202,7 +236,6 @@ static inline int virtqueue_add(struct virtqueue *_vq,
 		 * host should service the ring ASAP. */
 		if (out_sgs)
 			vq->notify(&vq->vq);
-		END_USE(vq);
 		return -ENOSPC;
 	}
 
@@ -252,7 +285,167 @@ static inline int virtqueue_add(struct virtqueue *_vq,
 	vq->num_added++;
 
 	pr_debug("Added buffer head %i to %p\n", head, vq);
+	return 0;
+}
+
+static struct vring_packed_desc *alloc_indirect_packed(unsigned int total_sg,
+						       gfp_t gfp)
+{
+	/* Same as alloc_indirect(): virt_to_phys needs a lowmem table. */
+	gfp &= ~__GFP_HIGHMEM;
+
+	return kmalloc(total_sg * sizeof(struct vring_packed_desc), gfp);
+}
+
+/* Move next_avail_idx on by one, flipping the wrap counter at the end. */
+static inline void packed_next_avail(struct vring_virtqueue *vq, u16 *i)
+{
+	if (++*i >= vq->packed.num) {
+		*i = 0;
+		vq->packed.avail_wrap_counter ^= 1;
+		vq->packed.avail_used_flags ^=
+			1 << VRING_PACKED_DESC_F_AVAIL |
+			1 << VRING_PACKED_DESC_F_USED;
+	}
+}
+
+/*
+ * A buffer takes a single id however many descriptors it spans; the id
+ * is what the device writes back into the used descriptor.
+ */
+static inline int virtqueue_add_packed(struct virtqueue *_vq,
+				       struct scatterlist *sgs[],
+				       unsigned int total_sg,
+				       unsigned int out_sgs,
+				       unsigned int in_sgs,
+				       void *data,
+				       gfp_t gfp)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	struct vring_packed_desc *desc, *indir = NULL;
+	struct scatterlist *sg;
+	unsigned int n, c, descs_used;
+	u16 i, head, id, flags, uninitialized_var(head_flags);
+
+	BUG_ON(total_sg > vq->packed.num);
+
+	head = vq->packed.next_avail_idx;
+
+	/* Go indirect on the same terms as the split ring. */
+	if (vq->indirect && total_sg > 1 && vq->vq.num_free)
+		indir = alloc_indirect_packed(total_sg, gfp);
+
+	descs_used = indir ? 1 : total_sg;
+	if (vq->vq.num_free < descs_used) {
+		pr_debug("Can't add buf len %i - avail = %i\n",
+			 descs_used, vq->vq.num_free);
+		kfree(indir);
+		if (out_sgs)
+			vq->notify(&vq->vq);
+		return -ENOSPC;
+	}
+
+	id = vq->free_head;
+	BUG_ON(id == vq->packed.num);
+
+	if (indir) {
+		desc = indir;
+		i = 0;
+	} else {
+		desc = vq->packed.desc;
+		i = head;
+	}
+
+	c = 0;
+	for (n = 0; n < out_sgs + in_sgs; n++) {
+		for (sg = sgs[n]; sg; sg = sg_next(sg)) {
+			flags = n < out_sgs ? 0 : VRING_DESC_F_WRITE;
+			desc[i].addr = cpu_to_le64(sg_phys(sg));
+			desc[i].len = cpu_to_le32(sg->length);
+			desc[i].id = cpu_to_le16(id);
+
+			if (indir) {
+				desc[i].flags = cpu_to_le16(flags);
+				i++;
+				continue;
+			}
+
+			flags |= vq->packed.avail_used_flags;
+			if (++c != total_sg)
+				flags |= VRING_DESC_F_NEXT;
+			/* The head goes to the device last, see below. */
+			if (i == head)
+				head_flags = flags;
+			else
+				desc[i].flags = cpu_to_le16(flags);
+			packed_next_avail(vq, &i);
+		}
+	}
+
+	if (indir) {
+		vq->packed.desc[head].addr = cpu_to_le64(virt_to_phys(indir));
+		/* avoid kmemleak false positive (hidden by virt_to_phys) */
+		kmemleak_ignore(indir);
+		vq->packed.desc[head].len = cpu_to_le32(total_sg *
+					sizeof(struct vring_packed_desc));
+		vq->packed.desc[head].id = cpu_to_le16(id);
+		head_flags = VRING_DESC_F_INDIRECT |
+			     vq->packed.avail_used_flags;
+		i = head;
+		packed_next_avail(vq, &i);
+	}
+
+	vq->vq.num_free -= descs_used;
+	vq->packed.next_avail_idx = i;
+	vq->free_head = vq->packed.desc_state[id].next;
+
+	/* Set token. */
+	vq->packed.desc_state[id].num = descs_used;
+	vq->packed.desc_state[id].indir_desc = indir;
+	vq->data[id] = data;
+
+	/* The rest of the chain must be visible before its head flips
+	 * over to available, the device can start on it right then. */
+	virtio_wmb(vq->weak_barriers);
+	vq->packed.desc[head].flags = cpu_to_le16(head_flags);
+	vq->num_added += descs_used;
+
+	pr_debug("Added buffer id %i at %i to %p\n", id, head, vq);
+	return 0;
+}
+
+static inline int virtqueue_add(struct virtqueue *_vq,
+				struct scatterlist *sgs[],
+				unsigned int total_sg,
+				unsigned int out_sgs,
+				unsigned int in_sgs,
+				void *data,
+				gfp_t gfp)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	int err;
+
+	START_USE(vq);
+
+	BUG_ON(data == NULL);
+	BUG_ON(total_sg == 0);
+
+	if (unlikely(vq->broken)) {
+		END_USE(vq);
+		return -EIO;
+	}
+
+	LAST_ADD_TIME_UPDATE(vq);
+
+	if (vq->packed_ring)
+		err = virtqueue_add_packed(_vq, sgs, total_sg, out_sgs, in_sgs,
+					   data, gfp);
+	else
+		err = virtqueue_add_split(_vq, sgs, total_sg, out_sgs, in_sgs,
+					  data, gfp);
 	END_USE(vq);
+	if (err)
+		return err;
 
 	/* This is very unlikely, but theoretically possible.  Kick
 	 * just in case. */
@@ -350,10 +543,54 @@ EXPORT_SYMBOL_GPL(virtqueue_add_inbuf);
  * This is sometimes useful because the virtqueue_kick_prepare() needs
  * to be serialized, but the actual virtqueue_notify() call does not.
  */
+static bool virtqueue_kick_prepare_split(struct vring_virtqueue *vq)
+{
+	u16 new, old;
+
+	old = vq->avail_idx_shadow - vq->num_added;
+	new = vq->avail_idx_shadow;
+	vq->num_added = 0;
+
+	if (vq->event)
+		return vring_need_event(virtio16_to_cpu(vq->vq.vdev, vring_avail_event(&vq->vring)),
+					new, old);
+
+	return !(vq->vring.used->flags & cpu_to_virtio16(vq->vq.vdev, VRING_USED_F_NO_NOTIFY));
+}
+
+static bool virtqueue_kick_prepare_packed(struct vring_virtqueue *vq)
+{
+	u16 new, old, off_wrap, flags, event_idx;
+	bool wrap_counter;
+	union {
+		struct vring_packed_desc_event event;
+		u32 u32;
+	} snapshot;
+
+	old = vq->packed.next_avail_idx - vq->num_added;
+	new = vq->packed.next_avail_idx;
+	vq->num_added = 0;
+
+	/* Offset and flags have to be read together. */
+	snapshot.u32 = READ_ONCE(*(u32 *)vq->packed.device);
+	flags = le16_to_cpu(snapshot.event.flags);
+
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC)
+		return flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+
+	off_wrap = le16_to_cpu(snapshot.event.off_wrap);
+	wrap_counter = off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR;
+	event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	/* An event from the previous lap of the ring comes before us. */
+	if (wrap_counter != vq->packed.avail_wrap_counter)
+		event_idx -= vq->packed.num;
+
+	return vring_need_event(event_idx, new, old);
+}
+
 bool virtqueue_kick_prepare(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
-	u16 new, old;
 	bool needs_kick;
 
 	START_USE(vq);
@@ -361,24 +598,13 @@ bool virtqueue_kick_prepare(struct virtqueue *_vq)
 	 * event. */
 	virtio_mb(vq->weak_barriers);
 
-	old = vq->avail_idx_shadow - vq->num_added;
-	new = vq->avail_idx_shadow;
-	vq->num_added = 0;
-
-#ifdef DEBUG
-	if (vq->last_add_time_valid) {
-		WARN_ON(ktime_to_ms(ktime_sub(ktime_get(),
-					      vq->last_add_time)) > 100);
-	}
-	vq->last_add_time_valid = false;
-#endif
+	LAST_ADD_TIME_CHECK(vq);
+	LAST_ADD_TIME_INVALID(vq);
 
-	if (vq->event) {
-		needs_kick = vring_need_event(virtio16_to_cpu(_vq->vdev, vring_avail_event(&vq->vring)),
-					      new, old);
-	} else {
-		needs_kick = !(vq->vring.used->flags & cpu_to_virtio16(_vq->vdev, VRING_USED_F_NO_NOTIFY));
-	}
+	if (vq->packed_ring)
+		needs_kick = virtqueue_kick_prepare_packed(vq);
+	else
+		needs_kick = virtqueue_kick_prepare_split(vq);
 	END_USE(vq);
 	return needs_kick;
 }
@@ -428,7 +654,7 @@ bool virtqueue_kick(struct virtqueue *vq)
 }
 EXPORT_SYMBOL_GPL(virtqueue_kick);
 
-static void detach_buf(struct vring_virtqueue *vq, unsigned int head)
+static void detach_buf_split(struct vring_virtqueue *vq, unsigned int head)
 {
 	unsigned int i;
 
@@ -453,11 +679,49 @@ static void detach_buf(struct vring_virtqueue *vq, unsigned int head)
 	vq->vq.num_free++;
 }
 
-static inline bool more_used(const struct vring_virtqueue *vq)
+static void detach_buf_packed(struct vring_virtqueue *vq, unsigned int id)
+{
+	struct vring_desc_state_packed *state = &vq->packed.desc_state[id];
+
+	/* Clear data ptr. */
+	vq->data[id] = NULL;
+
+	kfree(state->indir_desc);
+	state->indir_desc = NULL;
+
+	vq->vq.num_free += state->num;
+	state->next = vq->free_head;
+	vq->free_head = id;
+}
+
+static inline bool more_used_split(const struct vring_virtqueue *vq)
 {
 	return vq->last_used_idx != virtio16_to_cpu(vq->vq.vdev, vq->vring.used->idx);
 }
 
+/* The device marks a descriptor used by setting AVAIL and USED both to
+ * its wrap counter. */
+static inline bool is_used_desc_packed(const struct vring_virtqueue *vq,
+				       u16 idx, bool used_wrap_counter)
+{
+	u16 flags = le16_to_cpu(READ_ONCE(vq->packed.desc[idx].flags));
+	bool avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+	bool used = flags & (1 << VRING_PACKED_DESC_F_USED);
+
+	return avail == used && used == used_wrap_counter;
+}
+
+static inline bool more_used_packed(const struct vring_virtqueue *vq)
+{
+	return is_used_desc_packed(vq, vq->last_used_idx,
+				   vq->packed.used_wrap_counter);
+}
+
+static inline bool more_used(const struct vring_virtqueue *vq)
+{
+	return vq->packed_ring ? more_used_packed(vq) : more_used_split(vq);
+}
+
 /**
  * virtqueue_get_buf - get the next used buffer
  * @vq: the struct virtqueue we're talking about.
@@ -474,23 +738,16 @@ static inline bool more_used(const struct vring_virtqueue *vq)
  * Returns NULL if there are no used buffers, or the "data" token
  * handed to virtqueue_add_*().
  */
-void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
+static void *virtqueue_get_buf_split(struct vring_virtqueue *vq,
+				     unsigned int *len)
 {
-	struct vring_virtqueue *vq = to_vvq(_vq);
+	struct virtqueue *_vq = &vq->vq;
 	void *ret;
 	unsigned int i;
 	u16 last_used;
 
-	START_USE(vq);
-
-	if (unlikely(vq->broken)) {
-		END_USE(vq);
-		return NULL;
-	}
-
-	if (!more_used(vq)) {
+	if (!more_used_split(vq)) {
 		pr_debug("No more buffers in queue\n");
-		END_USE(vq);
 		return NULL;
 	}
 
@@ -512,7 +769,7 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 
 	/* detach_buf clears data, so grab it now. */
 	ret = vq->data[i];
-	detach_buf(vq, i);
+	detach_buf_split(vq, i);
 	vq->last_used_idx++;
 	/* If we expect an interrupt for the next entry, tell host
 	 * by writing event index and flush out the write before
@@ -521,10 +778,78 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 		vring_used_event(&vq->vring) = cpu_to_virtio16(_vq->vdev, vq->last_used_idx);
 		virtio_mb(vq->weak_barriers);
 	}
+	return ret;
+}
 
-#ifdef DEBUG
-	vq->last_add_time_valid = false;
-#endif
+static void *virtqueue_get_buf_packed(struct vring_virtqueue *vq,
+				      unsigned int *len)
+{
+	u16 last_used, id;
+	void *ret;
+
+	if (!more_used_packed(vq)) {
+		pr_debug("No more buffers in queue\n");
+		return NULL;
+	}
+
+	/* Only get used elements after they have been exposed by host. */
+	virtio_rmb(vq->weak_barriers);
+
+	last_used = vq->last_used_idx;
+	id = le16_to_cpu(vq->packed.desc[last_used].id);
+	*len = le32_to_cpu(vq->packed.desc[last_used].len);
+
+	if (unlikely(id >= vq->packed.num)) {
+		BAD_RING(vq, "id %u out of range\n", id);
+		return NULL;
+	}
+	if (unlikely(!vq->data[id])) {
+		BAD_RING(vq, "id %u is not a head!\n", id);
+		return NULL;
+	}
+
+	/* The device skips the rest of the buffer's descriptors. */
+	last_used += vq->packed.desc_state[id].num;
+	if (last_used >= vq->packed.num) {
+		last_used -= vq->packed.num;
+		vq->packed.used_wrap_counter ^= 1;
+	}
+	vq->last_used_idx = last_used;
+
+	/* detach_buf clears data, so grab it now. */
+	ret = vq->data[id];
+	detach_buf_packed(vq, id);
+
+	/* As for the split ring: move the event along if we asked for
+	 * one at a specific descriptor. */
+	if (vq->packed.event_flags_shadow == VRING_PACKED_EVENT_FLAG_DESC) {
+		vq->packed.driver->off_wrap = cpu_to_le16(vq->last_used_idx |
+			(vq->packed.used_wrap_counter <<
+			 VRING_PACKED_EVENT_F_WRAP_CTR));
+		virtio_mb(vq->weak_barriers);
+	}
+	return ret;
+}
+
+void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	void *ret;
+
+	START_USE(vq);
+
+	if (unlikely(vq->broken)) {
+		END_USE(vq);
+		return NULL;
+	}
+
+	if (vq->packed_ring)
+		ret = virtqueue_get_buf_packed(vq, len);
+	else
+		ret = virtqueue_get_buf_split(vq, len);
+
+	if (ret)
+		LAST_ADD_TIME_INVALID(vq);
 
 	END_USE(vq);
 	return ret;
@@ -544,6 +869,14 @@ void virtqueue_disable_cb(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	if (vq->packed_ring) {
+		if (vq->packed.event_flags_shadow != VRING_PACKED_EVENT_FLAG_DISABLE) {
+			vq->packed.event_flags_shadow = VRING_PACKED_EVENT_FLAG_DISABLE;
+			vq->packed.driver->flags = cpu_to_le16(vq->packed.event_flags_shadow);
+		}
+		return;
+	}
+
 	if (!(vq->avail_flags_shadow & VRING_AVAIL_F_NO_INTERRUPT)) {
 		vq->avail_flags_shadow |= VRING_AVAIL_F_NO_INTERRUPT;
 		vq->vring.avail->flags = cpu_to_virtio16(_vq->vdev, vq->avail_flags_shadow);
@@ -564,6 +897,29 @@ EXPORT_SYMBOL_GPL(virtqueue_disable_cb);
  * Caller must ensure we don't call this with other virtqueue
  * operations at the same time (except where noted).
  */
+/*
+ * Point the device's event at descriptor @idx of lap @wrap_counter, if
+ * events can be asked for at a descriptor, and turn events back on.
+ */
+static void virtqueue_enable_event_packed(struct vring_virtqueue *vq,
+					  u16 idx, bool wrap_counter)
+{
+	if (vq->event) {
+		vq->packed.driver->off_wrap = cpu_to_le16(idx |
+			(wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR));
+		/* The offset has to be in place before the flags say to
+		 * look at it. */
+		virtio_wmb(vq->weak_barriers);
+	}
+
+	if (vq->packed.event_flags_shadow == VRING_PACKED_EVENT_FLAG_DISABLE) {
+		vq->packed.event_flags_shadow = vq->event ?
+			VRING_PACKED_EVENT_FLAG_DESC :
+			VRING_PACKED_EVENT_FLAG_ENABLE;
+		vq->packed.driver->flags = cpu_to_le16(vq->packed.event_flags_shadow);
+	}
+}
+
 unsigned virtqueue_enable_cb_prepare(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
@@ -571,6 +927,18 @@ unsigned virtqueue_enable_cb_prepare(struct virtqueue *_vq)
 
 	START_USE(vq);
 
+	/* For the packed ring the state is the index and the wrap counter,
+	 * packed the way the device's event offset is. */
+	if (vq->packed_ring) {
+		virtqueue_enable_event_packed(vq, vq->last_used_idx,
+					      vq->packed.used_wrap_counter);
+		last_used_idx = vq->last_used_idx |
+			(vq->packed.used_wrap_counter <<
+			 VRING_PACKED_EVENT_F_WRAP_CTR);
+		END_USE(vq);
+		return last_used_idx;
+	}
+
 	/* We optimistically turn back on interrupts, then check if there was
 	 * more to do. */
 	/* Depending on the VIRTIO_RING_F_EVENT_IDX feature, we need to
@@ -600,6 +968,10 @@ bool virtqueue_poll(struct virtqueue *_vq, unsigned last_used_idx)
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
 	virtio_mb(vq->weak_barriers);
+	if (vq->packed_ring)
+		return is_used_desc_packed(vq,
+			last_used_idx & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR),
+			last_used_idx >> VRING_PACKED_EVENT_F_WRAP_CTR & 1);
 	return (u16)last_used_idx != virtio16_to_cpu(_vq->vdev, vq->vring.used->idx);
 }
 EXPORT_SYMBOL_GPL(virtqueue_poll);
@@ -635,6 +1007,24 @@ EXPORT_SYMBOL_GPL(virtqueue_enable_cb);
  * Caller must ensure we don't call this with other virtqueue
  * operations at the same time (except where noted).
  */
+static bool virtqueue_enable_cb_delayed_packed(struct vring_virtqueue *vq)
+{
+	bool wrap_counter = vq->packed.used_wrap_counter;
+	u16 used_idx, bufs;
+
+	/* TODO: tune this threshold */
+	bufs = (vq->packed.num - vq->vq.num_free) * 3 / 4;
+	used_idx = vq->last_used_idx + bufs;
+	if (used_idx >= vq->packed.num) {
+		used_idx -= vq->packed.num;
+		wrap_counter ^= 1;
+	}
+
+	virtqueue_enable_event_packed(vq, used_idx, wrap_counter);
+	virtio_mb(vq->weak_barriers);
+	return !is_used_desc_packed(vq, used_idx, wrap_counter);
+}
+
 bool virtqueue_enable_cb_delayed(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
@@ -642,6 +1032,13 @@ bool virtqueue_enable_cb_delayed(struct virtqueue *_vq)
 
 	START_USE(vq);
 
+	if (vq->packed_ring) {
+		bool ret = virtqueue_enable_cb_delayed_packed(vq);
+
+		END_USE(vq);
+		return ret;
+	}
+
 	/* We optimistically turn back on interrupts, then check if there was
 	 * more to do. */
 	/* Depending on the VIRTIO_RING_F_USED_EVENT_IDX feature, we need to
@@ -681,12 +1078,29 @@ void *virtqueue_detach_unused_buf(struct virtqueue *_vq)
 
 	START_USE(vq);
 
+	if (vq->packed_ring) {
+		for (i = 0; i < vq->packed.num; i++) {
+			if (!vq->data[i])
+				continue;
+			/* detach_buf clears data, so grab it now. */
+			buf = vq->data[i];
+			detach_buf_packed(vq, i);
+			END_USE(vq);
+			return buf;
+		}
+		/* That should have freed everything. */
+		BUG_ON(vq->vq.num_free != vq->packed.num);
+
+		END_USE(vq);
+		return NULL;
+	}
+
 	for (i = 0; i < vq->vring.num; i++) {
 		if (!vq->data[i])
 			continue;
 		/* detach_buf clears data, so grab it now. */
 		buf = vq->data[i];
-		detach_buf(vq, i);
+		detach_buf_split(vq, i);
 		vq->avail_idx_shadow--;
 		vq->vring.avail->idx = cpu_to_virtio16(_vq->vdev, vq->avail_idx_shadow);
 		END_USE(vq);
@@ -743,7 +1157,28 @@ struct virtqueue *vring_new_virtqueue(unsigned int index,
 	if (!vq)
 		return NULL;
 
-	vring_init(&vq->vring, num, pages, vring_align);
+	vq->packed_ring = virtio_has_feature(vdev, VIRTIO_F_RING_PACKED);
+	if (vq->packed_ring) {
+		/* The packed ring fits in what vring_size() asked for. */
+		vq->packed.desc_state = kmalloc_array(num,
+				sizeof(struct vring_desc_state_packed),
+				GFP_KERNEL);
+		if (!vq->packed.desc_state) {
+			kfree(vq);
+			return NULL;
+		}
+		vq->packed.num = num;
+		vq->packed.desc = pages;
+		vq->packed.driver = pages + num * sizeof(struct vring_packed_desc);
+		vq->packed.device = vq->packed.driver + 1;
+		vq->packed.next_avail_idx = 0;
+		vq->packed.avail_wrap_counter = 1;
+		vq->packed.used_wrap_counter = 1;
+		vq->packed.avail_used_flags = 1 << VRING_PACKED_DESC_F_AVAIL;
+		vq->packed.event_flags_shadow = VRING_PACKED_EVENT_FLAG_ENABLE;
+	} else {
+		vring_init(&vq->vring, num, pages, vring_align);
+	}
 	vq->vq.callback = callback;
 	vq->vq.vdev = vdev;
 	vq->vq.name = name;
@@ -767,12 +1202,25 @@ struct virtqueue *vring_new_virtqueue(unsigned int index,
 
 	/* No callback?  Tell other side not to bother us. */
 	if (!callback) {
-		vq->avail_flags_shadow |= VRING_AVAIL_F_NO_INTERRUPT;
-		vq->vring.avail->flags = cpu_to_virtio16(vdev, vq->avail_flags_shadow);
+		if (vq->packed_ring) {
+			vq->packed.event_flags_shadow = VRING_PACKED_EVENT_FLAG_DISABLE;
+			vq->packed.driver->flags = cpu_to_le16(vq->packed.event_flags_shadow);
+		} else {
+			vq->avail_flags_shadow |= VRING_AVAIL_F_NO_INTERRUPT;
+			vq->vring.avail->flags = cpu_to_virtio16(vdev, vq->avail_flags_shadow);
+		}
 	}
 
 	/* Put everything in free lists. */
 	vq->free_head = 0;
+	if (vq->packed_ring) {
+		for (i = 0; i < num; i++) {
+			vq->packed.desc_state[i].next = i + 1;
+			vq->packed.desc_state[i].indir_desc = NULL;
+			vq->data[i] = NULL;
+		}
+		return &vq->vq;
+	}
 	for (i = 0; i < num-1; i++) {
 		vq->vring.desc[i].next = cpu_to_virtio16(vdev, i + 1);
 		vq->data[i] = NULL;
@@ -783,10 +1231,14 @@ struct virtqueue *vring_new_virtqueue(unsigned int index,
 }
 EXPORT_SYMBOL_GPL(vring_new_virtqueue);
 
-void vring_del_virtqueue(struct virtqueue *vq)
+void vring_del_virtqueue(struct virtqueue *_vq)
 {
-	list_del(&vq->list);
-	kfree(to_vvq(vq));
+	struct vring_virtqueue *vq = to_vvq(_vq);
+
+	list_del(&_vq->list);
+	if (vq->packed_ring)
+		kfree(vq->packed.desc_state);
+	kfree(vq);
 }
 EXPORT_SYMBOL_GPL(vring_del_virtqueue);
 
@@ -803,11 +1255,17 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_F_VERSION_1:
 			break;
+		case VIRTIO_F_RING_PACKED:
+			break;
 		default:
 			/* We don't understand this bit. */
 			__virtio_clear_bit(vdev, i);
 		}
 	}
+
+	/* The packed ring is little-endian, legacy devices can't have it. */
+	if (!__virtio_test_bit(vdev, VIRTIO_F_VERSION_1))
+		__virtio_clear_bit(vdev, VIRTIO_F_RING_PACKED);
 }
 EXPORT_SYMBOL_GPL(vring_transport_features);
 
@@ -823,7 +1281,7 @@ unsigned int virtqueue_get_vring_size(struct virtqueue *_vq)
 
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
-	return vq->vring.num;
+	return vq->packed_ring ? vq->packed.num : vq->vring.num;
 }
 EXPORT_SYMBOL_GPL(virtqueue_get_vring_size);
 
@@ -854,6 +1312,9 @@ void *virtqueue_get_avail(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	/* For the packed ring, the driver event suppression area */
+	if (vq->packed_ring)
+		return vq->packed.driver;
 	return vq->vring.avail;
 }
 EXPORT_SYMBOL_GPL(virtqueue_get_avail);
@@ -862,6 +1323,9 @@ void *virtqueue_get_used(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	/* For the packed ring, the device event suppression area */
+	if (vq->packed_ring)
+		return vq->packed.device;
 	return vq->vring.used;
 }
 EXPORT_SYMBOL_GPL(virtqueue_get_used);
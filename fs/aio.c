@@ -40,6 +40,8 @@
 #include <linux/ramfs.h>
 #include <linux/percpu-refcount.h>
 #include <linux/mount.h>
+#include <linux/kthread.h>
+#include <linux/cred.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -137,6 +139,7 @@ struct kioctx {
 	struct {
 		spinlock_t	ctx_lock;
 		struct list_head active_reqs;	/* used for cancellation */
+		struct list_head poll_reqs;	/* IOCB_HIPRI, for polling */
 	} ____cacheline_aligned_in_smp;
 
 	struct {
@@ -154,6 +157,20 @@ struct kioctx {
 	struct file		*aio_ring_file;
 
 	unsigned		id;
+
+	/* Set up once by IOCB_CMD_SQ_SETUP, see aio_sq_setup() */
+	struct mutex		sq_lock;
+	struct file		**files;
+	unsigned		nr_files;
+
+	struct task_struct	*sq_thread;
+	struct aio_sq_ring __user *sq_ring;
+	unsigned		sq_head;
+	unsigned		sq_mask;
+	unsigned long		sq_idle;	/* In jiffies */
+	bool			sq_compat;
+	struct mm_struct	*sq_mm;
+	const struct cred	*sq_cred;
 };
 
 /*
@@ -180,6 +197,7 @@ struct aio_kiocb {
 
 	struct list_head	ki_list;	/* the aio core uses this
 						 * for cancellation */
+	struct list_head	ki_poll_list;	/* on ctx->poll_reqs */
 
 	/*
 	 * If the aio_resfd field of the userspace iocb is not zero,
@@ -197,6 +215,9 @@ unsigned long aio_max_nr = 0x10000; /* system wide maximum number of aio request
 static struct kmem_cache	*kiocb_cachep;
 static struct kmem_cache	*kioctx_cachep;
 
+/* Runs the buffered reads that could not be served from the page cache */
+static struct workqueue_struct	*aio_read_wq;
+
 static struct vfsmount *aio_mnt;
 
 static const struct file_operations aio_ring_fops;
@@ -260,6 +281,10 @@ static int __init aio_setup(void)
 	kiocb_cachep = KMEM_CACHE(aio_kiocb, SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 	kioctx_cachep = KMEM_CACHE(kioctx,SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 
+	aio_read_wq = alloc_workqueue("aio_read", WQ_UNBOUND, 0);
+	if (!aio_read_wq)
+		panic("Failed to create aio read workqueue.");
+
 	pr_debug("sizeof(struct page) = %zu\n", sizeof(struct page));
 
 	return 0;
@@ -574,6 +599,9 @@ static void free_ioctx(struct work_struct *work)
 
 	pr_debug("freeing %p\n", ctx);
 
+	while (ctx->nr_files)
+		fput(ctx->files[--ctx->nr_files]);
+	kfree(ctx->files);
 	aio_free_ring(ctx);
 	free_percpu(ctx->cpu);
 	percpu_ref_exit(&ctx->reqs);
@@ -723,12 +751,14 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	spin_lock_init(&ctx->ctx_lock);
 	spin_lock_init(&ctx->completion_lock);
 	mutex_init(&ctx->ring_lock);
+	mutex_init(&ctx->sq_lock);
 	/* Protect against page migration throughout kiotx setup by keeping
 	 * the ring_lock mutex held until setup is complete. */
 	mutex_lock(&ctx->ring_lock);
 	init_waitqueue_head(&ctx->wait);
 
 	INIT_LIST_HEAD(&ctx->active_reqs);
+	INIT_LIST_HEAD(&ctx->poll_reqs);
 
 	if (percpu_ref_init(&ctx->users, free_ioctx_users, 0, GFP_KERNEL))
 		goto err;
@@ -812,6 +842,16 @@ static int kill_ioctx(struct mm_struct *mm, struct kioctx *ctx,
 	table->table[ctx->id] = NULL;
 	spin_unlock(&mm->ioctx_lock);
 
+	/*
+	 * The submission thread holds the mm, so the last mmput() may be its
+	 * own, as it exits on seeing the rest of the mm users gone.
+	 */
+	if (ctx->sq_thread) {
+		if (ctx->sq_thread != current)
+			kthread_stop(ctx->sq_thread);
+		put_task_struct(ctx->sq_thread);
+	}
+
 	/* percpu_ref_kill() will do the necessary call_rcu() */
 	wake_up_all(&ctx->wait);
 
@@ -1074,11 +1114,14 @@ static void aio_complete(struct kiocb *kiocb, long res, long res2)
 	 */
 	BUG_ON(is_sync_kiocb(kiocb));
 
-	if (iocb->ki_list.next) {
+	if (iocb->ki_list.next || iocb->ki_poll_list.next) {
 		unsigned long flags;
 
 		spin_lock_irqsave(&ctx->ctx_lock, flags);
-		list_del(&iocb->ki_list);
+		if (iocb->ki_list.next)
+			list_del(&iocb->ki_list);
+		if (iocb->ki_poll_list.next)
+			list_del(&iocb->ki_poll_list);
 		spin_unlock_irqrestore(&ctx->ctx_lock, flags);
 	}
 
@@ -1257,6 +1300,69 @@ static bool aio_read_events(struct kioctx *ctx, long min_nr, long nr,
 	return ret < 0 || *i >= min_nr;
 }
 
+static struct request_queue *aio_file_queue(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct block_device *bdev;
+
+	if (S_ISBLK(inode->i_mode))
+		bdev = I_BDEV(inode);
+	else
+		bdev = inode->i_sb->s_bdev;
+	return bdev ? bdev_get_queue(bdev) : NULL;
+}
+
+/*
+ * Poll the queue of the oldest IOCB_HIPRI request once. Returns false if
+ * there is nothing to poll for.
+ */
+static bool aio_poll_one(struct kioctx *ctx)
+{
+	struct aio_kiocb *req;
+	struct request_queue *q;
+	struct file *file = NULL;
+	blk_qc_t cookie = BLK_QC_T_NONE;
+
+	spin_lock_irq(&ctx->ctx_lock);
+	if (!list_empty(&ctx->poll_reqs)) {
+		req = list_first_entry(&ctx->poll_reqs, struct aio_kiocb,
+				       ki_poll_list);
+		cookie = READ_ONCE(req->common.ki_cookie);
+		/* The request may complete once we unlock, its file stays */
+		file = get_file(req->common.ki_filp);
+	}
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	if (!file)
+		return false;
+
+	q = aio_file_queue(file);
+	if (!q || !blk_poll(q, cookie))
+		cpu_relax();
+	fput(file);
+	return true;
+}
+
+/*
+ * Reap the events of IOCB_HIPRI requests by spinning on their queues
+ * rather than sleeping for the interrupt. Returns true if done.
+ */
+static bool aio_poll_events(struct kioctx *ctx, long min_nr, long nr,
+			    struct io_event __user *event, long *i,
+			    ktime_t until)
+{
+	ktime_t end = ktime_add_safe(ktime_get(), until);
+
+	while (!aio_read_events(ctx, min_nr, nr, event, i)) {
+		if (!aio_poll_one(ctx))
+			return false;
+		if (signal_pending(current) || !ktime_before(ktime_get(), end))
+			return true;
+		cond_resched();
+	}
+	return true;
+}
+
 static long read_events(struct kioctx *ctx, long min_nr, long nr,
 			struct io_event __user *event,
 			struct timespec __user *timeout)
@@ -1289,7 +1395,7 @@ static long read_events(struct kioctx *ctx, long min_nr, long nr,
 	 */
 	if (until.tv64 == 0)
 		aio_read_events(ctx, min_nr, nr, event, &ret);
-	else
+	else if (!aio_poll_events(ctx, min_nr, nr, event, &ret, until))
 		wait_event_interruptible_hrtimeout(ctx->wait,
 				aio_read_events(ctx, min_nr, nr, event, &ret),
 				until);
@@ -1400,6 +1506,93 @@ static int aio_setup_vectored_rw(int rw, char __user *buf, size_t len,
  * aio_run_iocb:
  *	Performs the initial checks and io submission.
  */
+static void aio_finish_iocb(struct kiocb *req, ssize_t ret)
+{
+	if (ret != -EIOCBQUEUED) {
+		/*
+		 * There's no easy way to restart the syscall since other AIO's
+		 * may be already running. Just fail this IO with EINTR.
+		 */
+		if (unlikely(ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
+			     ret == -ERESTARTNOHAND ||
+			     ret == -ERESTART_RESTARTBLOCK))
+			ret = -EINTR;
+		aio_complete(req, ret, 0);
+	}
+}
+
+/*
+ * Buffered reads of regular files are first tried with IOCB_NOWAIT, from
+ * the page cache only. What they could not read without waiting for I/O
+ * is left to a worker, which completes the iocb once it has read the rest.
+ */
+struct aio_read_work {
+	struct work_struct	work;
+	struct kiocb		*req;
+	struct mm_struct	*mm;
+	struct iov_iter		iter;
+	struct iovec		*iovec;
+	ssize_t			done;	/* read before punting */
+};
+
+static bool aio_read_can_punt(struct kiocb *req, int rw)
+{
+	return rw == READ && !(req->ki_flags & IOCB_DIRECT) &&
+		S_ISREG(file_inode(req->ki_filp)->i_mode) && current->mm;
+}
+
+static void aio_read_workfn(struct work_struct *work)
+{
+	struct aio_read_work *aw = container_of(work, struct aio_read_work,
+						work);
+	struct kiocb *req = aw->req;
+	ssize_t ret;
+
+	use_mm(aw->mm);
+	ret = req->ki_filp->f_op->read_iter(req, &aw->iter);
+	unuse_mm(aw->mm);
+	mmput(aw->mm);
+
+	if (ret >= 0)
+		ret += aw->done;
+	else if (aw->done)
+		ret = aw->done;
+	kfree(aw->iovec);
+	kfree(aw);
+
+	aio_finish_iocb(req, ret);
+}
+
+/*
+ * Hand the rest of the read described by @iter to a worker. The iovecs
+ * may live on the submitter's stack, so the ones left are copied.
+ */
+static int aio_read_punt(struct kiocb *req, struct iov_iter *iter,
+			 ssize_t done)
+{
+	struct aio_read_work *aw;
+
+	aw = kmalloc(sizeof(*aw), GFP_KERNEL);
+	if (!aw)
+		return -ENOMEM;
+	aw->iovec = kmemdup(iter->iov, iter->nr_segs * sizeof(struct iovec),
+			    GFP_KERNEL);
+	if (!aw->iovec) {
+		kfree(aw);
+		return -ENOMEM;
+	}
+
+	INIT_WORK(&aw->work, aio_read_workfn);
+	aw->req = req;
+	aw->mm = current->mm;
+	atomic_inc(&aw->mm->mm_users);
+	aw->iter = *iter;
+	aw->iter.iov = aw->iovec;
+	aw->done = done;
+	queue_work(aio_read_wq, &aw->work);
+	return 0;
+}
+
 static ssize_t aio_run_iocb(struct kiocb *req, unsigned opcode,
 			    char __user *buf, size_t len, bool compat)
 {
@@ -1452,7 +1645,19 @@ rw_common:
 		if (rw == WRITE)
 			file_start_write(file);
 
-		ret = iter_op(req, &iter);
+		if (aio_read_can_punt(req, rw)) {
+			req->ki_flags |= IOCB_NOWAIT;
+			ret = iter_op(req, &iter);
+			req->ki_flags &= ~IOCB_NOWAIT;
+
+			/* Short of data, and not because of the end of file? */
+			if ((ret == -EAGAIN ||
+			     (ret >= 0 && iov_iter_count(&iter) &&
+			      req->ki_pos < i_size_read(file_inode(file)))) &&
+			    !aio_read_punt(req, &iter, max_t(ssize_t, ret, 0)))
+				ret = -EIOCBQUEUED;
+		} else
+			ret = iter_op(req, &iter);
 
 		if (rw == WRITE)
 			file_end_write(file);
@@ -1478,21 +1683,18 @@ rw_common:
 		return -EINVAL;
 	}
 
-	if (ret != -EIOCBQUEUED) {
-		/*
-		 * There's no easy way to restart the syscall since other AIO's
-		 * may be already running. Just fail this IO with EINTR.
-		 */
-		if (unlikely(ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
-			     ret == -ERESTARTNOHAND ||
-			     ret == -ERESTART_RESTARTBLOCK))
-			ret = -EINTR;
-		aio_complete(req, ret, 0);
-	}
-
+	aio_finish_iocb(req, ret);
 	return 0;
 }
 
+static struct file *aio_fixed_file(struct kioctx *ctx, unsigned idx)
+{
+	/* Pairs with the release in aio_sq_setup() */
+	if (idx >= smp_load_acquire(&ctx->nr_files))
+		return NULL;
+	return get_file(ctx->files[idx]);
+}
+
 static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 			 struct iocb *iocb, bool compat)
 {
@@ -1519,7 +1721,10 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	if (unlikely(!req))
 		return -EAGAIN;
 
-	req->common.ki_filp = fget(iocb->aio_fildes);
+	if (iocb->aio_flags & IOCB_FLAG_FIXED_FILE)
+		req->common.ki_filp = aio_fixed_file(ctx, iocb->aio_fildes);
+	else
+		req->common.ki_filp = fget(iocb->aio_fildes);
 	if (unlikely(!req->common.ki_filp)) {
 		ret = -EBADF;
 		goto out_put_req;
@@ -1554,6 +1759,16 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	req->ki_user_iocb = user_iocb;
 	req->ki_user_data = iocb->aio_data;
 
+	/* On the list before it can complete, aio_complete() takes it off */
+	if ((iocb->aio_flags & IOCB_FLAG_HIPRI) &&
+	    (req->common.ki_flags & IOCB_DIRECT)) {
+		req->common.ki_flags |= IOCB_HIPRI;
+		req->common.ki_cookie = BLK_QC_T_NONE;
+		spin_lock_irq(&ctx->ctx_lock);
+		list_add_tail(&req->ki_poll_list, &ctx->poll_reqs);
+		spin_unlock_irq(&ctx->ctx_lock);
+	}
+
 	ret = aio_run_iocb(&req->common, iocb->aio_lio_opcode,
 			   (char __user *)(unsigned long)iocb->aio_buf,
 			   iocb->aio_nbytes,
@@ -1563,12 +1778,250 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 
 	return 0;
 out_put_req:
+	if (req->ki_poll_list.next) {
+		spin_lock_irq(&ctx->ctx_lock);
+		list_del(&req->ki_poll_list);
+		spin_unlock_irq(&ctx->ctx_lock);
+	}
 	put_reqs_available(ctx, 1);
 	percpu_ref_put(&ctx->reqs);
 	kiocb_free(req);
 	return ret;
 }
 
+/* Limits for IOCB_CMD_SQ_SETUP */
+#define AIO_MAX_FIXED_FILES	1024
+#define AIO_MAX_SQ_ENTRIES	4096
+
+/* An iocb the submission thread could not submit completes with @res */
+static int aio_sq_fail(struct kioctx *ctx, struct iocb __user *user_iocb,
+		       u64 data, long res)
+{
+	struct aio_kiocb *req = aio_get_req(ctx);
+
+	if (unlikely(!req))
+		return -EAGAIN;
+
+	req->common.ki_complete = aio_complete;
+	req->ki_user_iocb = user_iocb;
+	req->ki_user_data = data;
+	aio_complete(&req->common, res, 0);
+	return 0;
+}
+
+static int aio_sq_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb)
+{
+	struct iocb tmp;
+	int ret;
+
+	if (unlikely(copy_from_user(&tmp, user_iocb, sizeof(tmp))))
+		return aio_sq_fail(ctx, user_iocb, 0, -EFAULT);
+
+	/* There is no file table here to look up descriptors in */
+	if (!(tmp.aio_flags & IOCB_FLAG_FIXED_FILE) ||
+	    (tmp.aio_flags & IOCB_FLAG_RESFD))
+		ret = -EBADF;
+	else
+		ret = io_submit_one(ctx, user_iocb, &tmp, ctx->sq_compat);
+
+	/* Out of events: leave it queued until some are reaped */
+	if (ret && ret != -EAGAIN)
+		ret = aio_sq_fail(ctx, user_iocb, tmp.aio_data, ret);
+	return ret;
+}
+
+/* Submit what is queued on the ring, returns the number of iocbs taken */
+static unsigned aio_sq_submit(struct kioctx *ctx)
+{
+	struct aio_sq_ring __user *ring = ctx->sq_ring;
+	unsigned head = ctx->sq_head, tail, nr;
+	struct blk_plug plug;
+
+	if (get_user(tail, &ring->tail) || tail == head)
+		return 0;
+	/* Read the entries after the tail that covers them */
+	smp_rmb();
+
+	blk_start_plug(&plug);
+	while (head != tail) {
+		u64 ptr;
+
+		if (get_user(ptr, &ring->iocbs[head & ctx->sq_mask]))
+			break;
+		if (aio_sq_submit_one(ctx,
+				(struct iocb __user *)(unsigned long)ptr))
+			break;
+		head++;
+	}
+	blk_finish_plug(&plug);
+
+	if (head == ctx->sq_head)
+		return 0;
+	/* The user may reuse the entries once it sees the head move */
+	smp_mb();
+	if (put_user(head, &ring->head))
+		return 0;
+	nr = head - ctx->sq_head;
+	ctx->sq_head = head;
+	return nr;
+}
+
+static bool aio_sq_pending(struct kioctx *ctx)
+{
+	unsigned tail;
+
+	return !get_user(tail, &ctx->sq_ring->tail) && tail != ctx->sq_head;
+}
+
+/*
+ * Runs with the mm and credentials of the task that set it up, until the
+ * context is destroyed or no other user of the mm is left.
+ */
+static int aio_sq_thread(void *data)
+{
+	struct kioctx *ctx = data;
+	struct mm_struct *mm = ctx->sq_mm;
+	const struct cred *cred = ctx->sq_cred, *old_cred;
+	unsigned long idle_end = jiffies + ctx->sq_idle;
+
+	use_mm(mm);
+	old_cred = override_creds(cred);
+
+	while (!kthread_should_stop() && atomic_read(&mm->mm_users) > 1) {
+		if (aio_sq_submit(ctx)) {
+			idle_end = jiffies + ctx->sq_idle;
+			cond_resched();
+			continue;
+		}
+		if (time_before(jiffies, idle_end)) {
+			cond_resched();
+			continue;
+		}
+
+		/* From here the user has to io_submit() for more to be done */
+		if (put_user(AIO_SQ_NEED_WAKEUP, &ctx->sq_ring->flags))
+			goto sleep;
+		smp_mb();
+		if (aio_sq_pending(ctx))
+			goto awake;
+sleep:
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			/* Wakes up to see whether the process is gone */
+			schedule_timeout(HZ);
+		__set_current_state(TASK_RUNNING);
+awake:
+		put_user(0, &ctx->sq_ring->flags);
+		idle_end = jiffies + ctx->sq_idle;
+	}
+
+	revert_creds(old_cred);
+	put_cred(cred);
+	unuse_mm(mm);
+	/* Not touching ctx from here, this may end up in exit_aio() */
+	mmput(mm);
+	return 0;
+}
+
+static int aio_sq_start(struct kioctx *ctx, struct aio_sq_setup *p,
+			bool compat)
+{
+	struct aio_sq_ring __user *ring = (void __user *)(unsigned long)p->ring;
+	struct task_struct *tsk;
+	unsigned nr;
+
+	if (get_user(nr, &ring->nr) || get_user(ctx->sq_head, &ring->head))
+		return -EFAULT;
+	if (!nr || nr > AIO_MAX_SQ_ENTRIES || !is_power_of_2(nr))
+		return -EINVAL;
+	if (!access_ok(VERIFY_WRITE, ring,
+		       sizeof(*ring) + nr * sizeof(ring->iocbs[0])))
+		return -EFAULT;
+
+	tsk = kthread_create(aio_sq_thread, ctx, "aio_sq/%d",
+			     task_pid_nr(current));
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+
+	ctx->sq_ring = ring;
+	ctx->sq_mask = nr - 1;
+	ctx->sq_idle = msecs_to_jiffies(p->idle_ms);
+	ctx->sq_compat = compat;
+	ctx->sq_mm = current->mm;
+	atomic_inc(&current->mm->mm_users);
+	ctx->sq_cred = get_current_cred();
+	get_task_struct(tsk);
+	ctx->sq_thread = tsk;
+	return 0;
+}
+
+/*
+ * IOCB_CMD_SQ_SETUP: register files with the context and start the
+ * submission thread, see include/uapi/linux/aio_abi.h.
+ */
+static int aio_sq_setup(struct kioctx *ctx, struct iocb *iocb, bool compat)
+{
+	struct aio_sq_setup p;
+	struct file **files = NULL;
+	s32 __user *fds;
+	unsigned i = 0;
+	int ret;
+
+	if (iocb->aio_nbytes != sizeof(p))
+		return -EINVAL;
+	if (copy_from_user(&p, (void __user *)(unsigned long)iocb->aio_buf,
+			   sizeof(p)))
+		return -EFAULT;
+	if (p.nr_files > AIO_MAX_FIXED_FILES)
+		return -EINVAL;
+
+	mutex_lock(&ctx->sq_lock);
+	ret = -EBUSY;
+	if (ctx->files || ctx->sq_thread)
+		goto out;
+
+	ret = -ENOMEM;
+	if (p.nr_files) {
+		files = kcalloc(p.nr_files, sizeof(*files), GFP_KERNEL);
+		if (!files)
+			goto out;
+	}
+
+	fds = (s32 __user *)(unsigned long)p.files;
+	for (i = 0; i < p.nr_files; i++) {
+		s32 fd;
+
+		ret = -EFAULT;
+		if (get_user(fd, fds + i))
+			goto out_files;
+		ret = -EBADF;
+		files[i] = fget(fd);
+		if (!files[i])
+			goto out_files;
+	}
+
+	if (p.ring) {
+		ret = aio_sq_start(ctx, &p, compat);
+		if (ret)
+			goto out_files;
+	}
+
+	ctx->files = files;
+	smp_store_release(&ctx->nr_files, p.nr_files);
+	if (ctx->sq_thread)
+		wake_up_process(ctx->sq_thread);
+	mutex_unlock(&ctx->sq_lock);
+	return 0;
+
+out_files:
+	while (i)
+		fput(files[--i]);
+	kfree(files);
+out:
+	mutex_unlock(&ctx->sq_lock);
+	return ret;
+}
+
 long do_io_submit(aio_context_t ctx_id, long nr,
 		  struct iocb __user *__user *iocbpp, bool compat)
 {
@@ -1612,12 +2065,19 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 			break;
 		}
 
-		ret = io_submit_one(ctx, user_iocb, &tmp, compat);
+		if (tmp.aio_lio_opcode == IOCB_CMD_SQ_SETUP)
+			ret = aio_sq_setup(ctx, &tmp, compat);
+		else
+			ret = io_submit_one(ctx, user_iocb, &tmp, compat);
 		if (ret)
 			break;
 	}
 	blk_finish_plug(&plug);
 
+	/* Kick a submission thread that went to sleep */
+	if (ctx->sq_thread)
+		wake_up_process(ctx->sq_thread);
+
 	percpu_ref_put(&ctx->users);
 	return i ? i : ret;
 }
@@ -268,6 +268,9 @@ int notify_change(struct dentry * dentry, struct iattr * attr, struct inode **de
 		error = simple_setattr(dentry, attr);
 
 	if (!error) {
+		if (S_ISDIR(inode->i_mode) &&
+		    (ia_valid & (ATTR_MODE | ATTR_UID | ATTR_GID)))
+			path_cache_invalidate(inode->i_sb);
 		fsnotify_change(dentry, ia_valid);
 		ima_inode_post_setattr(dentry);
 		evm_inode_post_setattr(dentry, ia_valid);
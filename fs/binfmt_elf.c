@@ -442,6 +442,64 @@ out:
 	return elf_phdata;
 }
 
+/*
+ * What load_elf_binary() reads of a binary beyond bprm->buf: its exec
+ * header, its program headers and the path of its interpreter, if any,
+ * which follows them.  Kept in the exec cache, see fs/exec.c.
+ */
+struct elf_layout {
+	struct elfhdr ehdr;
+	unsigned int interp_size;	/* p_filesz of PT_INTERP, or 0 */
+	struct elf_phdr phdrs[];
+};
+
+static inline char *elf_layout_interp(struct elf_layout *layout)
+{
+	return (char *)&layout->phdrs[layout->ehdr.e_phnum];
+}
+
+/* Returns the cached layout of @file for the caller to kfree(), or NULL */
+static struct elf_layout *elf_layout_get(struct file *file)
+{
+	size_t len;
+
+	return exec_cache_get(file, ELF_CLASS, &len);
+}
+
+static void elf_layout_set(struct file *file, struct elfhdr *elf_ex,
+			   struct elf_phdr *phdrs, char *interp,
+			   unsigned int interp_size)
+{
+	size_t phsize = elf_ex->e_phnum * sizeof(struct elf_phdr);
+	size_t len = sizeof(struct elf_layout) + phsize + interp_size;
+	struct elf_layout *layout;
+
+	if (!IS_ENABLED(CONFIG_EXEC_CACHE))
+		return;
+
+	layout = kmalloc(len, GFP_KERNEL);
+	if (!layout)
+		return;
+	layout->ehdr = *elf_ex;
+	layout->interp_size = interp_size;
+	memcpy(layout->phdrs, phdrs, phsize);
+	memcpy(elf_layout_interp(layout), interp, interp_size);
+	exec_cache_set(file, ELF_CLASS, layout, len);
+	kfree(layout);
+}
+
+/* The program headers of @layout if there is one, else read them in */
+static struct elf_phdr *elf_layout_phdrs(struct elf_layout *layout,
+					 struct elfhdr *elf_ex,
+					 struct file *elf_file)
+{
+	if (layout)
+		return kmemdup(layout->phdrs,
+			       elf_ex->e_phnum * sizeof(struct elf_phdr),
+			       GFP_KERNEL);
+	return load_elf_phdrs(elf_ex, elf_file);
+}
+
 #ifndef CONFIG_ARCH_BINFMT_ELF_STATE
 
 /**
@@ -670,6 +728,8 @@ static int load_elf_binary(struct linux_binprm *bprm)
 	char * elf_interpreter = NULL;
 	unsigned long error;
 	struct elf_phdr *elf_ppnt, *elf_phdata, *interp_elf_phdata = NULL;
+	struct elf_layout *layout, *interp_layout = NULL;
+	unsigned int interp_size = 0;
 	unsigned long elf_bss, elf_brk;
 	int retval, i;
 	unsigned long elf_entry;
@@ -705,9 +765,16 @@ static int load_elf_binary(struct linux_binprm *bprm)
 	if (!bprm->file->f_op->mmap)
 		goto out;
 
-	elf_phdata = load_elf_phdrs(&loc->elf_ex, bprm->file);
+	/* A layout cached for an older version of the file is of no use */
+	layout = elf_layout_get(bprm->file);
+	if (layout && memcmp(&layout->ehdr, &loc->elf_ex, sizeof(loc->elf_ex))) {
+		kfree(layout);
+		layout = NULL;
+	}
+
+	elf_phdata = elf_layout_phdrs(layout, &loc->elf_ex, bprm->file);
 	if (!elf_phdata)
-		goto out;
+		goto out_free_ph;
 
 	elf_ppnt = elf_phdata;
 	elf_bss = 0;
@@ -735,6 +802,12 @@ static int load_elf_binary(struct linux_binprm *bprm)
 			if (!elf_interpreter)
 				goto out_free_ph;
 
+			interp_size = elf_ppnt->p_filesz;
+			if (layout) {
+				memcpy(elf_interpreter,
+				       elf_layout_interp(layout), interp_size);
+				goto interp_read;
+			}
 			retval = kernel_read(bprm->file, elf_ppnt->p_offset,
 					     elf_interpreter,
 					     elf_ppnt->p_filesz);
@@ -743,6 +816,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 					retval = -EIO;
 				goto out_free_interp;
 			}
+interp_read:
 			/* make sure path is NULL terminated */
 			retval = -ENOEXEC;
 			if (elf_interpreter[elf_ppnt->p_filesz - 1] != '\0')
@@ -761,6 +835,11 @@ static int load_elf_binary(struct linux_binprm *bprm)
 			would_dump(bprm, interpreter);
 
 			/* Get the exec headers */
+			interp_layout = elf_layout_get(interpreter);
+			if (interp_layout) {
+				loc->interp_elf_ex = interp_layout->ehdr;
+				break;
+			}
 			retval = kernel_read(interpreter, 0,
 					     (void *)&loc->interp_elf_ex,
 					     sizeof(loc->interp_elf_ex));
@@ -775,6 +854,10 @@ static int load_elf_binary(struct linux_binprm *bprm)
 		elf_ppnt++;
 	}
 
+	if (!layout)
+		elf_layout_set(bprm->file, &loc->elf_ex, elf_phdata,
+			       elf_interpreter, interp_size);
+
 	elf_ppnt = elf_phdata;
 	for (i = 0; i < loc->elf_ex.e_phnum; i++, elf_ppnt++)
 		switch (elf_ppnt->p_type) {
@@ -805,10 +888,14 @@ static int load_elf_binary(struct linux_binprm *bprm)
 			goto out_free_dentry;
 
 		/* Load the interpreter program headers */
-		interp_elf_phdata = load_elf_phdrs(&loc->interp_elf_ex,
-						   interpreter);
+		interp_elf_phdata = elf_layout_phdrs(interp_layout,
+						     &loc->interp_elf_ex,
+						     interpreter);
 		if (!interp_elf_phdata)
 			goto out_free_dentry;
+		if (!interp_layout)
+			elf_layout_set(interpreter, &loc->interp_elf_ex,
+				       interp_elf_phdata, NULL, 0);
 
 		/* Pass PT_LOPROC..PT_HIPROC headers to arch code */
 		elf_ppnt = interp_elf_phdata;
@@ -1030,6 +1117,8 @@ static int load_elf_binary(struct linux_binprm *bprm)
 
 	kfree(interp_elf_phdata);
 	kfree(elf_phdata);
+	kfree(interp_layout);
+	kfree(layout);
 
 	set_binfmt(&elf_format);
 
@@ -1082,6 +1171,8 @@ static int load_elf_binary(struct linux_binprm *bprm)
 	ELF_PLAT_INIT(regs, reloc_func_desc);
 #endif
 
+	exec_cache_prefault(bprm->file);
+
 	start_thread(regs, elf_entry, bprm->p);
 	retval = 0;
 out:
@@ -1092,6 +1183,7 @@ out_ret:
 	/* error cleanup */
 out_free_dentry:
 	kfree(interp_elf_phdata);
+	kfree(interp_layout);
 	allow_write_access(interpreter);
 	if (interpreter)
 		fput(interpreter);
@@ -1099,6 +1191,7 @@ out_free_interp:
 	kfree(elf_interpreter);
 out_free_ph:
 	kfree(elf_phdata);
+	kfree(layout);
 	goto out;
 }
 
@@ -2654,6 +2654,118 @@ int btrfs_find_item(struct btrfs_root *fs_root, struct btrfs_path *path,
 	return 0;
 }
 
+/* how often the lockless descent starts over before taking the locks */
+#define BTRFS_SEARCH_OPTIMISTIC_TRIES	3
+
+/*
+ * lockless descent for the plain lookups of btrfs_search_slot.  The nodes
+ * above the leaf are read without their locks: a node's lock_seq is
+ * sampled before reading it and checked after, and again after sampling
+ * the child's, so a node that changed under us, or a child the node
+ * stopped pointing to, sends us back to the root.  The counts we read
+ * may be torn until they're checked, so they're bounded before use.
+ *
+ * Only the leaf gets read locked, and its lock_seq checked once more,
+ * leaving the path as the locked descent would: the nodes referenced,
+ * the leaf locked.  -EAGAIN means the locked descent has to do it,
+ * because a node was write locked, wasn't cached or kept changing.
+ */
+static int btrfs_search_slot_optimistic(struct btrfs_root *root,
+					struct btrfs_key *key,
+					struct btrfs_path *p)
+{
+	struct extent_buffer *b;
+	struct extent_buffer *tmp;
+	unsigned int seq;
+	unsigned int tmp_seq;
+	int tries = 0;
+	int level;
+	int slot;
+	int ret;
+	u32 nritems;
+	u64 blocknr;
+	u64 gen;
+
+again:
+	if (tries++ >= BTRFS_SEARCH_OPTIMISTIC_TRIES)
+		return -EAGAIN;
+
+	b = btrfs_root_node(root);
+	if (!btrfs_tree_read_seq_begin(b, &seq)) {
+		free_extent_buffer(b);
+		return -EAGAIN;
+	}
+	/* a cow of the root write locks it, so this stays true until then */
+	if (b != READ_ONCE(root->node)) {
+		free_extent_buffer(b);
+		goto again;
+	}
+	level = btrfs_header_level(b);
+	if (level >= BTRFS_MAX_LEVEL) {
+		free_extent_buffer(b);
+		goto again;
+	}
+
+	while (1) {
+		p->nodes[level] = b;
+		if (level == 0)
+			break;
+
+		nritems = btrfs_header_nritems(b);
+		if (nritems == 0 || nritems > BTRFS_NODEPTRS_PER_BLOCK(root))
+			goto retry;
+
+		ret = generic_bin_search(b, offsetof(struct btrfs_node, ptrs),
+					 sizeof(struct btrfs_key_ptr), key,
+					 nritems, &slot);
+		if (ret && slot > 0)
+			slot -= 1;
+		p->slots[level] = slot;
+		blocknr = btrfs_node_blockptr(b, slot);
+		gen = btrfs_node_ptr_generation(b, slot);
+		if (btrfs_tree_read_seq_retry(b, seq))
+			goto retry;
+
+		tmp = btrfs_find_tree_block(root->fs_info, blocknr);
+		if (!tmp)
+			goto fallback;
+		if (btrfs_buffer_uptodate(tmp, gen, 1) <= 0 ||
+		    !btrfs_tree_read_seq_begin(tmp, &tmp_seq)) {
+			free_extent_buffer(tmp);
+			goto fallback;
+		}
+		/* b still points to tmp, as of tmp's lock_seq */
+		if (btrfs_tree_read_seq_retry(b, seq) ||
+		    btrfs_header_level(tmp) != level - 1) {
+			free_extent_buffer(tmp);
+			goto retry;
+		}
+
+		b = tmp;
+		seq = tmp_seq;
+		level--;
+	}
+
+	if (!btrfs_tree_read_lock_atomic(b))
+		goto fallback;
+	if (btrfs_tree_read_seq_retry(b, seq)) {
+		btrfs_tree_read_unlock(b);
+		goto retry;
+	}
+	p->locks[0] = BTRFS_READ_LOCK;
+
+	ret = bin_search(b, key, 0, &slot);
+	p->slots[0] = slot;
+	return ret;
+
+retry:
+	btrfs_release_path(p);
+	goto again;
+fallback:
+	btrfs_release_path(p);
+	return -EAGAIN;
+}
+
 /*
  * look for key in the tree.  path is filled in with nodes along the way
  * if key is found, we return zero and you can find the item in the leaf
@@ -2713,6 +2825,14 @@ int btrfs_search_slot(struct btrfs_trans_handle *trans, struct btrfs_root
 
 	min_write_lock_level = write_lock_level;
 
+	/* plain lookups first try without locking the nodes */
+	if (!cow && !p->keep_locks && !lowest_level && !p->skip_locking &&
+	    !p->search_commit_root && !p->search_for_split) {
+		ret = btrfs_search_slot_optimistic(root, key, p);
+		if (ret != -EAGAIN)
+			goto done;
+	}
+
 again:
 	prev_cmp = -1;
 	/*
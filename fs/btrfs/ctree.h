@@ -96,6 +96,9 @@ struct btrfs_ordered_sum;
 /* for storing items that use the BTRFS_UUID_KEY* types */
 #define BTRFS_UUID_TREE_OBJECTID 9ULL
 
+/* holds the block group items, instead of the extent tree */
+#define BTRFS_BLOCK_GROUP_TREE_OBJECTID 11ULL
+
 /* for storing balance parameters in the root tree */
 #define BTRFS_BALANCE_OBJECTID -4ULL
 
@@ -523,6 +526,12 @@ struct btrfs_super_block {
 #define BTRFS_FEATURE_INCOMPAT_SKINNY_METADATA	(1ULL << 8)
 #define BTRFS_FEATURE_INCOMPAT_NO_HOLES		(1ULL << 9)
 
+/*
+ * the block group items live in a tree of their own, so that mount
+ * doesn't have to look for them all over the extent tree
+ */
+#define BTRFS_FEATURE_INCOMPAT_BLOCK_GROUP_TREE	(1ULL << 10)
+
 #define BTRFS_FEATURE_COMPAT_SUPP		0ULL
 #define BTRFS_FEATURE_COMPAT_SAFE_SET		0ULL
 #define BTRFS_FEATURE_COMPAT_SAFE_CLEAR		0ULL
@@ -539,7 +548,8 @@ struct btrfs_super_block {
 	 BTRFS_FEATURE_INCOMPAT_RAID56 |		\
 	 BTRFS_FEATURE_INCOMPAT_EXTENDED_IREF |		\
 	 BTRFS_FEATURE_INCOMPAT_SKINNY_METADATA |	\
-	 BTRFS_FEATURE_INCOMPAT_NO_HOLES)
+	 BTRFS_FEATURE_INCOMPAT_NO_HOLES |		\
+	 BTRFS_FEATURE_INCOMPAT_BLOCK_GROUP_TREE)
 
 #define BTRFS_FEATURE_INCOMPAT_SAFE_SET			\
 	(BTRFS_FEATURE_INCOMPAT_EXTENDED_IREF)
@@ -1405,6 +1415,15 @@ struct btrfs_stripe_hash_table {
 	struct list_head stripe_cache;
 	spinlock_t cache_lock;
 	int cache_size;
+
+	/* how long a partial stripe waits for more writes */
+	unsigned int hold_msecs;
+
+	/* how the stripes got written */
+	atomic_long_t full_stripe_writes;
+	atomic_long_t rmw_writes;
+	atomic_long_t rmw_cache_hits;
+
 	struct btrfs_stripe_hash table[];
 };
 
@@ -1412,6 +1431,23 @@ struct btrfs_stripe_hash_table {
 
 void btrfs_init_async_reclaim_work(struct work_struct *work);
 
+/*
+ * discard=async: freed ranges wait in @queue, where adjacent ones merge,
+ * and a worker trims them one block group range at a time, no more than
+ * @iops_limit runs and @kbps_limit KiB a second (0 is no limit).
+ */
+struct btrfs_discard_ctl {
+	struct delayed_work work;
+	struct extent_io_tree queue;
+	u64 cursor;			/* where the next run starts looking */
+	unsigned long next_run;		/* jiffies, as the limits allow */
+	u32 iops_limit;
+	u32 kbps_limit;
+
+	spinlock_t lock;		/* protects the counter below */
+	u64 discarded_bytes;
+};
+
 /* fs_info */
 struct reloc_control;
 struct btrfs_device;
@@ -1429,6 +1465,7 @@ struct btrfs_fs_info {
 	struct btrfs_root *csum_root;
 	struct btrfs_root *quota_root;
 	struct btrfs_root *uuid_root;
+	struct btrfs_root *block_group_root;
 
 	/* the log root tree is a directory of all the other log roots */
 	struct btrfs_root *log_root_tree;
@@ -1448,6 +1485,8 @@ struct btrfs_fs_info {
 	struct extent_io_tree freed_extents[2];
 	struct extent_io_tree *pinned_extents;
 
+	struct btrfs_discard_ctl discard_ctl;
+
 	/* logical->physical extent mapping */
 	struct btrfs_mapping_tree mapping_tree;
 
@@ -1648,6 +1687,8 @@ struct btrfs_fs_info {
 	int thread_pool_size;
 
 	struct kobject *space_info_kobj;
+	struct kobject *discard_kobj;
+	struct kobject *raid56_kobj;
 	int do_barriers;
 	int closing;
 	int log_root_recovering;
@@ -2184,6 +2225,7 @@ struct btrfs_ioctl_defrag_range_args {
 #define BTRFS_MOUNT_RESCAN_UUID_TREE	(1 << 23)
 #define BTRFS_MOUNT_FRAGMENT_DATA	(1 << 24)
 #define BTRFS_MOUNT_FRAGMENT_METADATA	(1 << 25)
+#define BTRFS_MOUNT_DISCARD_ASYNC	(1 << 26)
 
 #define BTRFS_DEFAULT_COMMIT_INTERVAL	(30)
 #define BTRFS_DEFAULT_MAX_INLINE	(8192)
@@ -3563,6 +3605,7 @@ int btrfs_discard_extent(struct btrfs_root *root, u64 bytenr,
 int btrfs_force_chunk_alloc(struct btrfs_trans_handle *trans,
 			    struct btrfs_root *root, u64 type);
 int btrfs_trim_fs(struct btrfs_root *root, struct fstrim_range *range);
+int block_group_cache_done(struct btrfs_block_group_cache *cache);
 
 int btrfs_init_space_info(struct btrfs_fs_info *fs_info);
 int btrfs_delayed_refs_qgroup_accounting(struct btrfs_trans_handle *trans,
@@ -3737,6 +3780,7 @@ static inline void free_fs_info(struct btrfs_fs_info *fs_info)
 	kfree(fs_info->csum_root);
 	kfree(fs_info->quota_root);
 	kfree(fs_info->uuid_root);
+	kfree(fs_info->block_group_root);
 	kfree(fs_info->super_copy);
 	kfree(fs_info->super_for_commit);
 	security_free_mnt_opts(&fs_info->security_opts);
@@ -4257,6 +4301,15 @@ static inline int __btrfs_fs_incompat(struct btrfs_fs_info *fs_info, u64 flag)
 	return !!(btrfs_super_incompat_flags(disk_super) & flag);
 }
 
+/* where the block group items are */
+static inline struct btrfs_root *
+btrfs_block_group_root(struct btrfs_fs_info *fs_info)
+{
+	if (fs_info->block_group_root)
+		return fs_info->block_group_root;
+	return fs_info->extent_root;
+}
+
 /*
  * Call btrfs_abort_transaction as early as possible when an error condition is
  * detected, that way the exact line number is reported.
@@ -0,0 +1,165 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/workqueue.h>
+#include "ctree.h"
+#include "free-space-cache.h"
+#include "discard.h"
+
+/*
+ * With discard=async nothing is discarded at commit time.  The ranges the
+ * commit unpins are queued instead, and a worker trims them later in
+ * logical order, a block group range per run, through the free space
+ * cache like FITRIM does: only what is still free when the worker gets to
+ * it is discarded, and it is kept from the allocator meanwhile.  So a
+ * range that got reused in between costs nothing, and one that is lost
+ * on unmount is only a discard that didn't happen.
+ */
+
+/* how much of the free space a run may take away from the allocator */
+#define BTRFS_DISCARD_MAX_BYTES		(64 * 1024 * 1024)
+
+#define BTRFS_DISCARD_DEFAULT_IOPS	10
+
+static bool btrfs_discard_enabled(struct btrfs_fs_info *fs_info)
+{
+	return btrfs_raw_test_opt(fs_info->mount_opt, DISCARD_ASYNC) &&
+	       !btrfs_fs_closing(fs_info) &&
+	       !(fs_info->sb->s_flags & MS_RDONLY);
+}
+
+static void btrfs_discard_schedule(struct btrfs_discard_ctl *ctl)
+{
+	unsigned long next_run = READ_ONCE(ctl->next_run);
+	unsigned long now = jiffies;
+
+	queue_delayed_work(system_unbound_wq, &ctl->work,
+			   time_before(now, next_run) ? next_run - now : 0);
+}
+
+static void btrfs_discard_workfn(struct work_struct *work)
+{
+	struct btrfs_discard_ctl *ctl;
+	struct btrfs_fs_info *fs_info;
+	struct btrfs_block_group_cache *cache;
+	unsigned long delay;
+	u64 trimmed = 0;
+	u64 start;
+	u64 end;
+	u32 iops;
+	u32 kbps;
+
+	ctl = container_of(to_delayed_work(work), struct btrfs_discard_ctl,
+			   work);
+	fs_info = container_of(ctl, struct btrfs_fs_info, discard_ctl);
+
+	if (!btrfs_discard_enabled(fs_info))
+		return;
+
+	if (find_first_extent_bit(&ctl->queue, ctl->cursor, &start, &end,
+				  EXTENT_DIRTY, NULL)) {
+		if (!ctl->cursor)
+			return;
+		/* wrap around */
+		ctl->cursor = 0;
+		if (find_first_extent_bit(&ctl->queue, 0, &start, &end,
+					  EXTENT_DIRTY, NULL))
+			return;
+	}
+	end++;
+
+	cache = btrfs_lookup_block_group(fs_info, start);
+	if (cache)
+		end = min(end, cache->key.objectid + cache->key.offset);
+	end = min_t(u64, end, start + BTRFS_DISCARD_MAX_BYTES);
+
+	clear_extent_dirty(&ctl->queue, start, end - 1, GFP_NOFS);
+	ctl->cursor = end;
+
+	/* a block group being cached has no free space to trim yet */
+	if (cache) {
+		if (block_group_cache_done(cache))
+			btrfs_trim_block_group(cache, &trimmed, start, end,
+					       fs_info->tree_root->sectorsize);
+		btrfs_put_block_group(cache);
+	}
+
+	spin_lock(&ctl->lock);
+	ctl->discarded_bytes += trimmed;
+	spin_unlock(&ctl->lock);
+
+	iops = READ_ONCE(ctl->iops_limit);
+	kbps = READ_ONCE(ctl->kbps_limit);
+	delay = iops ? HZ / iops : 0;
+	if (kbps)
+		delay = max_t(unsigned long, delay,
+			      div64_u64(trimmed * HZ, (u64)kbps * 1024));
+	WRITE_ONCE(ctl->next_run, jiffies + delay);
+
+	btrfs_discard_schedule(ctl);
+}
+
+void btrfs_discard_init(struct btrfs_fs_info *fs_info)
+{
+	struct btrfs_discard_ctl *ctl = &fs_info->discard_ctl;
+
+	INIT_DELAYED_WORK(&ctl->work, btrfs_discard_workfn);
+	extent_io_tree_init(&ctl->queue, fs_info->btree_inode->i_mapping);
+	ctl->cursor = 0;
+	ctl->next_run = jiffies;
+	ctl->iops_limit = BTRFS_DISCARD_DEFAULT_IOPS;
+	ctl->kbps_limit = 0;
+	spin_lock_init(&ctl->lock);
+	ctl->discarded_bytes = 0;
+}
+
+/*
+ * Queue a range which just went back to the free space cache.  Failing
+ * to queue it only loses the discard.
+ */
+void btrfs_discard_queue(struct btrfs_fs_info *fs_info, u64 start, u64 len)
+{
+	struct btrfs_discard_ctl *ctl = &fs_info->discard_ctl;
+
+	if (!btrfs_discard_enabled(fs_info))
+		return;
+
+	/* adjacent and overlapping ranges merge in the tree */
+	if (set_extent_dirty(&ctl->queue, start, start + len - 1, GFP_NOFS))
+		return;
+
+	btrfs_discard_schedule(ctl);
+}
+
+/* forget what is queued, on unmount and when leaving discard=async */
+void btrfs_discard_stop(struct btrfs_fs_info *fs_info)
+{
+	struct btrfs_discard_ctl *ctl = &fs_info->discard_ctl;
+
+	cancel_delayed_work_sync(&ctl->work);
+	clear_extent_dirty(&ctl->queue, 0, (u64)-1, GFP_NOFS);
+	ctl->cursor = 0;
+}
+
+u64 btrfs_discard_queued_bytes(struct btrfs_fs_info *fs_info)
+{
+	u64 start = 0;
+
+	return count_range_bits(&fs_info->discard_ctl.queue, &start, (u64)-1,
+				(u64)-1, EXTENT_DIRTY, 0);
+}
@@ -0,0 +1,27 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#ifndef __BTRFS_DISCARD_H
+#define __BTRFS_DISCARD_H
+
+#include "ctree.h"
+
+void btrfs_discard_init(struct btrfs_fs_info *fs_info);
+void btrfs_discard_queue(struct btrfs_fs_info *fs_info, u64 start, u64 len);
+void btrfs_discard_stop(struct btrfs_fs_info *fs_info);
+u64 btrfs_discard_queued_bytes(struct btrfs_fs_info *fs_info);
+
+#endif
@@ -36,6 +36,7 @@
 #include "math.h"
 #include "sysfs.h"
 #include "qgroup.h"
+#include "discard.h"
 
 #undef SCRAMBLE_DELAYED_REFS
 
@@ -111,7 +112,7 @@ static int block_rsv_use_bytes(struct btrfs_block_rsv *block_rsv,
 int btrfs_pin_extent(struct btrfs_root *root,
 		     u64 bytenr, u64 num_bytes, int reserved);
 
-static noinline int
+noinline int
 block_group_cache_done(struct btrfs_block_group_cache *cache)
 {
 	smp_mb();
@@ -3261,11 +3262,11 @@ static int write_one_cache_group(struct btrfs_trans_handle *trans,
 				 struct btrfs_block_group_cache *cache)
 {
 	int ret;
-	struct btrfs_root *extent_root = root->fs_info->extent_root;
+	struct btrfs_root *bg_root = btrfs_block_group_root(root->fs_info);
 	unsigned long bi;
 	struct extent_buffer *leaf;
 
-	ret = btrfs_search_slot(trans, extent_root, &cache->key, path, 0, 1);
+	ret = btrfs_search_slot(trans, bg_root, &cache->key, path, 0, 1);
 	if (ret) {
 		if (ret > 0)
 			ret = -ENOENT;
@@ -5368,6 +5369,9 @@ static void init_global_block_rsv(struct btrfs_fs_info *fs_info)
 	fs_info->tree_root->block_rsv = &fs_info->global_block_rsv;
 	if (fs_info->quota_root)
 		fs_info->quota_root->block_rsv = &fs_info->global_block_rsv;
+	if (fs_info->block_group_root)
+		fs_info->block_group_root->block_rsv =
+			&fs_info->global_block_rsv;
 	fs_info->chunk_root->block_rsv = &fs_info->chunk_block_rsv;
 
 	update_global_block_rsv(fs_info);
@@ -6354,6 +6358,8 @@ int btrfs_finish_extent_commit(struct btrfs_trans_handle *trans,
 
 		clear_extent_dirty(unpin, start, end, GFP_NOFS);
 		unpin_extent_range(root, start, end, true);
+		if (btrfs_test_opt(root, DISCARD_ASYNC))
+			btrfs_discard_queue(fs_info, start, end + 1 - start);
 		mutex_unlock(&fs_info->unused_bg_unpin_mutex);
 		cond_resched();
 	}
@@ -7593,6 +7599,8 @@ static int __btrfs_free_reserved_extent(struct btrfs_root *root,
 			ret = btrfs_discard_extent(root, start, len, NULL);
 		btrfs_add_free_space(cache, start, len);
 		btrfs_update_reserved_bytes(cache, len, RESERVE_FREE, delalloc);
+		if (btrfs_test_opt(root, DISCARD_ASYNC))
+			btrfs_discard_queue(root->fs_info, start, len);
 	}
 
 	btrfs_put_block_group(cache);
@@ -9704,7 +9712,8 @@ int btrfs_read_block_groups(struct btrfs_root *root)
 		need_clear = 1;
 
 	while (1) {
-		ret = find_first_block_group(root, path, &key);
+		ret = find_first_block_group(btrfs_block_group_root(info),
+					     path, &key);
 		if (ret > 0)
 			break;
 		if (ret != 0)
@@ -9857,6 +9866,7 @@ void btrfs_create_pending_block_groups(struct btrfs_trans_handle *trans,
 {
 	struct btrfs_block_group_cache *block_group, *tmp;
 	struct btrfs_root *extent_root = root->fs_info->extent_root;
+	struct btrfs_root *bg_root = btrfs_block_group_root(root->fs_info);
 	struct btrfs_block_group_item item;
 	struct btrfs_key key;
 	int ret = 0;
@@ -9872,7 +9882,7 @@ void btrfs_create_pending_block_groups(struct btrfs_trans_handle *trans,
 		memcpy(&key, &block_group->key, sizeof(key));
 		spin_unlock(&block_group->lock);
 
-		ret = btrfs_insert_item(trans, extent_root, &key, &item,
+		ret = btrfs_insert_item(trans, bg_root, &key, &item,
 					sizeof(item));
 		if (ret)
 			btrfs_abort_transaction(trans, extent_root, ret);
@@ -10283,6 +10293,7 @@ int btrfs_remove_block_group(struct btrfs_trans_handle *trans,
 	btrfs_put_block_group(block_group);
 	btrfs_put_block_group(block_group);
 
+	root = btrfs_block_group_root(root->fs_info);
 	ret = btrfs_search_slot(trans, root, &key, path, -1, 1);
 	if (ret > 0)
 		ret = -EIO;
@@ -10457,8 +10468,13 @@ void btrfs_delete_unused_bgs(struct btrfs_fs_info *fs_info)
 		spin_unlock(&block_group->lock);
 		spin_unlock(&space_info->lock);
 
-		/* DISCARD can flip during remount */
-		trimming = btrfs_test_opt(root, DISCARD);
+		/*
+		 * DISCARD can flip during remount.  The chunk may be handed
+		 * out again right after the commit, so it can't wait for the
+		 * async discard worker either.
+		 */
+		trimming = btrfs_test_opt(root, DISCARD) ||
+			   btrfs_test_opt(root, DISCARD_ASYNC);
 
 		/* Implicit trim during transaction commit. */
 		if (trimming)
@@ -148,6 +148,9 @@ struct extent_buffer {
 	/* protects write locks */
 	rwlock_t lock;
 
+	/* odd while write locked, for the lockless readers of the tree */
+	seqcount_t lock_seq;
+
 	/* readers use lock_wq while they wait for the write
 	 * lock holders to unlock
 	 */
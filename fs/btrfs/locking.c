@@ -193,6 +193,7 @@ int btrfs_try_tree_write_lock(struct extent_buffer *eb)
 	atomic_inc(&eb->write_locks);
 	atomic_inc(&eb->spinning_writers);
 	eb->lock_owner = current->pid;
+	raw_write_seqcount_begin(&eb->lock_seq);
 	return 1;
 }
 
@@ -271,6 +272,7 @@ again:
 	atomic_inc(&eb->spinning_writers);
 	atomic_inc(&eb->write_locks);
 	eb->lock_owner = current->pid;
+	raw_write_seqcount_begin(&eb->lock_seq);
 }
 
 /*
@@ -283,6 +285,7 @@ void btrfs_tree_unlock(struct extent_buffer *eb)
 	BUG_ON(blockers > 1);
 
 	btrfs_assert_tree_locked(eb);
+	raw_write_seqcount_end(&eb->lock_seq);
 	eb->lock_owner = 0;
 	atomic_dec(&eb->write_locks);
 
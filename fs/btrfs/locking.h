@@ -50,6 +50,24 @@ static inline void btrfs_tree_unlock_rw(struct extent_buffer *eb, int rw)
 		BUG();
 }
 
+/*
+ * Lockless readers: sample the buffer's lock_seq, read what they need,
+ * then check that it didn't change.  A write lock holder may be changing
+ * the buffer as long as the count is odd, so begin fails then.
+ */
+static inline bool btrfs_tree_read_seq_begin(struct extent_buffer *eb,
+					     unsigned int *seq)
+{
+	*seq = raw_read_seqcount(&eb->lock_seq);
+	return !(*seq & 1);
+}
+
+static inline bool btrfs_tree_read_seq_retry(struct extent_buffer *eb,
+					     unsigned int seq)
+{
+	return read_seqcount_retry(&eb->lock_seq, seq);
+}
+
 static inline void btrfs_set_lock_blocking(struct extent_buffer *eb)
 {
 	btrfs_set_lock_blocking_rw(eb, BTRFS_WRITE_LOCK);
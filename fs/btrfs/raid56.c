@@ -32,6 +32,7 @@
 #include <linux/list_sort.h>
 #include <linux/raid/xor.h>
 #include <linux/vmalloc.h>
+#include <linux/timer.h>
 #include <asm/div64.h>
 #include "ctree.h"
 #include "extent_map.h"
@@ -58,8 +59,16 @@
  */
 #define RBIO_CACHE_READY_BIT	3
 
+/*
+ * set while a partial stripe write is held back, waiting for more
+ * bios to fill it in
+ */
+#define RBIO_HOLD_BIT		4
+
 #define RBIO_CACHE_SIZE 1024
 
+#define RBIO_HOLD_MSECS_DEFAULT	5
+
 enum btrfs_rbio_ops {
 	BTRFS_RBIO_WRITE,
 	BTRFS_RBIO_READ_REBUILD,
@@ -88,6 +97,9 @@ struct btrfs_raid_bio {
 	 */
 	struct btrfs_work work;
 
+	/* ends the hold of a partial stripe write */
+	struct timer_list hold_timer;
+
 	/*
 	 * bio list and bio_list_lock are used
 	 * to add more bios into the stripe
@@ -182,6 +194,8 @@ static noinline void finish_rmw(struct btrfs_raid_bio *rbio);
 static void rmw_work(struct btrfs_work *work);
 static void read_rebuild_work(struct btrfs_work *work);
 static void async_rmw_stripe(struct btrfs_raid_bio *rbio);
+static void async_finish_rmw(struct btrfs_raid_bio *rbio);
+static void rbio_hold_timeout(unsigned long data);
 static void async_read_rebuild(struct btrfs_raid_bio *rbio);
 static int fail_bio_stripe(struct btrfs_raid_bio *rbio, struct bio *bio);
 static int fail_rbio_index(struct btrfs_raid_bio *rbio, int failed);
@@ -227,6 +241,7 @@ int btrfs_alloc_stripe_hash_table(struct btrfs_fs_info *info)
 
 	spin_lock_init(&table->cache_lock);
 	INIT_LIST_HEAD(&table->stripe_cache);
+	table->hold_msecs = RBIO_HOLD_MSECS_DEFAULT;
 
 	h = table->table;
 
@@ -545,6 +560,22 @@ static int __rbio_is_full(struct btrfs_raid_bio *rbio)
 	return ret;
 }
 
+/*
+ * a held rbio that others have filled in doesn't need to wait any more.
+ * Must be called with the bio list lock held
+ */
+static void rbio_end_hold_if_full(struct btrfs_raid_bio *rbio)
+{
+	if (!test_bit(RBIO_HOLD_BIT, &rbio->flags) || !__rbio_is_full(rbio))
+		return;
+
+	clear_bit(RBIO_HOLD_BIT, &rbio->flags);
+	/* the timer's ref, the stripe lock still holds one */
+	if (del_timer(&rbio->hold_timer))
+		atomic_dec(&rbio->refs);
+	async_rmw_stripe(rbio);
+}
+
 static int rbio_is_full(struct btrfs_raid_bio *rbio)
 {
 	unsigned long flags;
@@ -692,6 +723,7 @@ static noinline int lock_stripe_add(struct btrfs_raid_bio *rbio)
 			/* can we merge into the lock owner? */
 			if (rbio_can_merge(cur, rbio)) {
 				merge_rbio(cur, rbio);
+				rbio_end_hold_if_full(cur);
 				spin_unlock(&cur->bio_list_lock);
 				freeit = rbio;
 				ret = 1;
@@ -978,6 +1010,7 @@ static struct btrfs_raid_bio *alloc_rbio(struct btrfs_root *root,
 	spin_lock_init(&rbio->bio_list_lock);
 	INIT_LIST_HEAD(&rbio->stripe_cache);
 	INIT_LIST_HEAD(&rbio->hash_list);
+	setup_timer(&rbio->hold_timer, rbio_hold_timeout, (unsigned long)rbio);
 	rbio->bbio = bbio;
 	rbio->fs_info = root->fs_info;
 	rbio->stripe_len = stripe_len;
@@ -1490,6 +1523,23 @@ static void async_rmw_stripe(struct btrfs_raid_bio *rbio)
 			 &rbio->work);
 }
 
+static void finish_rmw_work(struct btrfs_work *work)
+{
+	struct btrfs_raid_bio *rbio;
+
+	rbio = container_of(work, struct btrfs_raid_bio, work);
+	finish_rmw(rbio);
+}
+
+static void async_finish_rmw(struct btrfs_raid_bio *rbio)
+{
+	btrfs_init_work(&rbio->work, btrfs_rmw_helper,
+			finish_rmw_work, NULL, NULL);
+
+	btrfs_queue_work(rbio->fs_info->rmw_workers,
+			 &rbio->work);
+}
+
 static void async_read_rebuild(struct btrfs_raid_bio *rbio)
 {
 	btrfs_init_work(&rbio->work, btrfs_rmw_helper,
@@ -1505,6 +1555,7 @@ static void async_read_rebuild(struct btrfs_raid_bio *rbio)
  */
 static int raid56_rmw_stripe(struct btrfs_raid_bio *rbio)
 {
+	struct btrfs_stripe_hash_table *table = rbio->fs_info->stripe_hash_table;
 	int bios_to_read = 0;
 	struct bio_list bio_list;
 	int ret;
@@ -1562,8 +1613,13 @@ static int raid56_rmw_stripe(struct btrfs_raid_bio *rbio)
 		 * But if there are missing devices it may not be
 		 * safe to do the full stripe write yet.
 		 */
+		if (rbio_is_full(rbio))
+			atomic_long_inc(&table->full_stripe_writes);
+		else
+			atomic_long_inc(&table->rmw_cache_hits);
 		goto finish;
 	}
+	atomic_long_inc(&table->rmw_writes);
 
 	/*
 	 * the bbio may be freed once we submit the last bio.  Make sure
@@ -1610,23 +1666,62 @@ static int full_stripe_write(struct btrfs_raid_bio *rbio)
 	}
 
 	ret = lock_stripe_add(rbio);
-	if (ret == 0)
-		finish_rmw(rbio);
+	if (ret == 0) {
+		atomic_long_inc(&rbio->fs_info->stripe_hash_table->full_stripe_writes);
+		/* the parity of many stripes gets computed in parallel */
+		async_finish_rmw(rbio);
+	}
 	return 0;
 }
 
+static void rbio_hold_timeout(unsigned long data)
+{
+	struct btrfs_raid_bio *rbio = (struct btrfs_raid_bio *)data;
+	unsigned long flags;
+	int held;
+
+	spin_lock_irqsave(&rbio->bio_list_lock, flags);
+	held = test_and_clear_bit(RBIO_HOLD_BIT, &rbio->flags);
+	spin_unlock_irqrestore(&rbio->bio_list_lock, flags);
+
+	if (held)
+		async_rmw_stripe(rbio);
+	__free_raid_bio(rbio);
+}
+
 /*
  * partial stripe writes get handed over to async helpers.
  * We're really hoping to merge a few more writes into this
- * rbio before calculating new parity
+ * rbio before calculating new parity, so we hold it back for
+ * hold_msecs first: the writes of other tasks and other plugs
+ * merge into the lock owner until the rmw starts.
  */
 static int partial_stripe_write(struct btrfs_raid_bio *rbio)
 {
+	unsigned int msecs;
+	unsigned long flags;
 	int ret;
 
 	ret = lock_stripe_add(rbio);
-	if (ret == 0)
+	if (ret)
+		return 0;
+
+	msecs = READ_ONCE(rbio->fs_info->stripe_hash_table->hold_msecs);
+	if (!msecs) {
 		async_rmw_stripe(rbio);
+		return 0;
+	}
+
+	spin_lock_irqsave(&rbio->bio_list_lock, flags);
+	if (__rbio_is_full(rbio)) {
+		spin_unlock_irqrestore(&rbio->bio_list_lock, flags);
+		async_rmw_stripe(rbio);
+		return 0;
+	}
+	set_bit(RBIO_HOLD_BIT, &rbio->flags);
+	atomic_inc(&rbio->refs);
+	mod_timer(&rbio->hold_timer, jiffies + msecs_to_jiffies(msecs));
+	spin_unlock_irqrestore(&rbio->bio_list_lock, flags);
 	return 0;
 }
 
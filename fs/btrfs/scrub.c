@@ -52,9 +52,9 @@ struct scrub_ctx;
  * operations. The first two values configure an upper limit for the number
  * of (dynamically allocated) pages that are added to a bio.
  */
-#define SCRUB_PAGES_PER_RD_BIO	32	/* 128k per bio */
+#define SCRUB_PAGES_PER_RD_BIO	64	/* 256k per bio */
 #define SCRUB_PAGES_PER_WR_BIO	32	/* 128k per bio */
-#define SCRUB_BIOS_PER_SCTX	64	/* 8MB per device in flight */
+#define SCRUB_BIOS_PER_SCTX	64	/* 16MB per device in flight */
 
 /*
  * the following value times PAGE_SIZE needs to be large enough to match the
@@ -195,6 +195,10 @@ struct scrub_ctx {
 	struct btrfs_scrub_progress stat;
 	spinlock_t		stat_lock;
 
+	/* for the device's scrub_speed_max */
+	ktime_t			throttle_deadline;
+	u64			throttle_sent;
+
 	/*
 	 * Use a ref counter to avoid use-after-free issues. Scrub workers
 	 * decrement bios_in_flight and workers_pending and then do a wakeup
@@ -2032,6 +2036,46 @@ static void scrub_page_put(struct scrub_page *spage)
 	}
 }
 
+/*
+ * Keep the reads of the device below its scrub_speed_max.  The second is
+ * cut into up to 64 slices, one per 16MiB/s of the limit, so that a low
+ * limit doesn't mean bursts of a second; once a slice's share has been
+ * sent, we sleep until the slice is over.
+ */
+static void scrub_throttle(struct scrub_ctx *sctx, struct scrub_bio *sbio)
+{
+	const int time_slice = 1000;
+	u64 bwlimit = READ_ONCE(sbio->dev->scrub_speed_max);
+	ktime_t now;
+	s64 delta;
+	u32 div;
+
+	if (bwlimit == 0)
+		return;
+
+	div = max_t(u32, 1, (u32)div_u64(bwlimit, 16 * 1024 * 1024));
+	div = min_t(u32, 64, div);
+
+	now = ktime_get();
+	if (ktime_to_ns(sctx->throttle_deadline) == 0) {
+		sctx->throttle_deadline = ktime_add_ms(now, time_slice / div);
+		sctx->throttle_sent = 0;
+	}
+
+	if (ktime_before(now, sctx->throttle_deadline)) {
+		sctx->throttle_sent += sbio->bio->bi_iter.bi_size;
+		if (sctx->throttle_sent <= div_u64(bwlimit, div))
+			return;
+
+		delta = ktime_ms_delta(sctx->throttle_deadline, now);
+		if (delta > 0)
+			schedule_timeout_interruptible(msecs_to_jiffies(delta));
+	}
+
+	/* the next bio starts a new slice */
+	sctx->throttle_deadline = ktime_set(0, 0);
+}
+
 static void scrub_submit(struct scrub_ctx *sctx)
 {
 	struct scrub_bio *sbio;
@@ -2041,6 +2085,7 @@ static void scrub_submit(struct scrub_ctx *sctx)
 
 	sbio = sctx->bios[sctx->curr];
 	sctx->curr = -1;
+	scrub_throttle(sctx, sbio);
 	scrub_pending_bio_inc(sctx);
 	btrfsic_submit_bio(READ, sbio->bio);
 }
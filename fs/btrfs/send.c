@@ -124,6 +124,11 @@ struct send_ctx {
 	struct list_head name_cache_list;
 	int name_cache_size;
 
+	/*
+	 * the inode whose data we're reading, kept open with its readahead
+	 * state, so the readahead window grows over the writes of a file
+	 */
+	struct inode *cur_inode;
 	struct file_ra_state ra;
 
 	char *read_buf;
@@ -4440,24 +4445,49 @@ out:
 	return ret;
 }
 
-static ssize_t fill_read_buf(struct send_ctx *sctx, u64 offset, u32 len)
+static void close_cur_inode(struct send_ctx *sctx)
+{
+	if (sctx->cur_inode) {
+		iput(sctx->cur_inode);
+		sctx->cur_inode = NULL;
+	}
+}
+
+static struct inode *get_cur_inode(struct send_ctx *sctx)
 {
 	struct btrfs_root *root = sctx->send_root;
-	struct btrfs_fs_info *fs_info = root->fs_info;
+	struct inode *inode;
+	struct btrfs_key key;
+
+	if (sctx->cur_inode && btrfs_ino(sctx->cur_inode) == sctx->cur_ino)
+		return sctx->cur_inode;
+	close_cur_inode(sctx);
+
+	key.objectid = sctx->cur_ino;
+	key.type = BTRFS_INODE_ITEM_KEY;
+	key.offset = 0;
+
+	inode = btrfs_iget(root->fs_info->sb, &key, root, NULL);
+	if (IS_ERR(inode))
+		return inode;
+
+	memset(&sctx->ra, 0, sizeof(struct file_ra_state));
+	file_ra_state_init(&sctx->ra, inode->i_mapping);
+	sctx->cur_inode = inode;
+	return inode;
+}
+
+static ssize_t fill_read_buf(struct send_ctx *sctx, u64 offset, u32 len)
+{
 	struct inode *inode;
 	struct page *page;
 	char *addr;
-	struct btrfs_key key;
 	pgoff_t index = offset >> PAGE_CACHE_SHIFT;
 	pgoff_t last_index;
 	unsigned pg_offset = offset & ~PAGE_CACHE_MASK;
 	ssize_t ret = 0;
 
-	key.objectid = sctx->cur_ino;
-	key.type = BTRFS_INODE_ITEM_KEY;
-	key.offset = 0;
-
-	inode = btrfs_iget(fs_info->sb, &key, root, NULL);
+	inode = get_cur_inode(sctx);
 	if (IS_ERR(inode))
 		return PTR_ERR(inode);
 
@@ -4468,25 +4498,36 @@ static ssize_t fill_read_buf(struct send_ctx *sctx, u64 offset, u32 len)
 			len = offset - i_size_read(inode);
 	}
 	if (len == 0)
-		goto out;
+		return 0;
 
 	last_index = (offset + len - 1) >> PAGE_CACHE_SHIFT;
 
-	/* initial readahead */
-	memset(&sctx->ra, 0, sizeof(struct file_ra_state));
-	file_ra_state_init(&sctx->ra, inode->i_mapping);
-	btrfs_force_ra(inode->i_mapping, &sctx->ra, NULL, index,
-		       last_index - index + 1);
-
 	while (index <= last_index) {
 		unsigned cur_len = min_t(unsigned, len,
 					 PAGE_CACHE_SIZE - pg_offset);
-		page = find_or_create_page(inode->i_mapping, index, GFP_NOFS);
+
+		/*
+		 * like a sequential read(2): the reads of the next extents of
+		 * the file are in flight while we copy and send this one
+		 */
+		page = find_lock_page(inode->i_mapping, index);
 		if (!page) {
-			ret = -ENOMEM;
-			break;
+			page_cache_sync_readahead(inode->i_mapping, &sctx->ra,
+						  NULL, index,
+						  last_index + 1 - index);
+			page = find_or_create_page(inode->i_mapping, index,
+						   GFP_NOFS);
+			if (!page) {
+				ret = -ENOMEM;
+				break;
+			}
 		}
 
+		if (PageReadahead(page))
+			page_cache_async_readahead(inode->i_mapping, &sctx->ra,
+						   NULL, page, index,
+						   last_index + 1 - index);
+
 		if (!PageUptodate(page)) {
 			btrfs_readpage(NULL, page);
 			lock_page(page);
@@ -4508,8 +4549,6 @@ static ssize_t fill_read_buf(struct send_ctx *sctx, u64 offset, u32 len)
 		len -= cur_len;
 		ret += cur_len;
 	}
-out:
-	iput(inode);
 	return ret;
 }
 
@@ -5791,6 +5830,8 @@ static int full_send_tree(struct send_ctx *sctx)
 	path = alloc_path_for_send();
 	if (!path)
 		return -ENOMEM;
+	/* every leaf of the tree gets sent, read them ahead */
+	path->reada = 1;
 
 	key.objectid = BTRFS_FIRST_FREE_OBJECTID;
 	key.type = BTRFS_INODE_ITEM_KEY;
@@ -6140,6 +6181,7 @@ long btrfs_ioctl_send(struct file *mnt_file, void __user *arg_)
 	current->journal_info = BTRFS_SEND_TRANS_STUB;
 	ret = send_subvol(sctx);
 	current->journal_info = NULL;
+	close_cur_inode(sctx);
 	if (ret < 0)
 		goto out;
 
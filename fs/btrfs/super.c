@@ -61,6 +61,7 @@
 #include "tests/btrfs-tests.h"
 
 #include "qgroup.h"
+#include "discard.h"
 #define CREATE_TRACE_POINTS
 #include <trace/events/btrfs.h>
 
@@ -301,6 +302,7 @@ enum {
 	Opt_check_integrity, Opt_check_integrity_including_extent_data,
 	Opt_check_integrity_print_mask, Opt_fatal_errors, Opt_rescan_uuid_tree,
 	Opt_commit_interval, Opt_barrier, Opt_nodefrag, Opt_nodiscard,
+	Opt_discard_mode,
 	Opt_noenospc_debug, Opt_noflushoncommit, Opt_acl, Opt_datacow,
 	Opt_datasum, Opt_treelog, Opt_noinode_cache,
 #ifdef CONFIG_BTRFS_DEBUG
@@ -338,6 +340,7 @@ static match_table_t tokens = {
 	{Opt_noflushoncommit, "noflushoncommit"},
 	{Opt_ratio, "metadata_ratio=%d"},
 	{Opt_discard, "discard"},
+	{Opt_discard_mode, "discard=%s"},
 	{Opt_nodiscard, "nodiscard"},
 	{Opt_space_cache, "space_cache"},
 	{Opt_clear_cache, "clear_cache"},
@@ -609,12 +612,29 @@ int btrfs_parse_options(struct btrfs_root *root, char *options)
 			}
 			break;
 		case Opt_discard:
+			btrfs_clear_opt(info->mount_opt, DISCARD_ASYNC);
 			btrfs_set_and_info(root, DISCARD,
 					   "turning on discard");
 			break;
+		case Opt_discard_mode:
+			if (strcmp(args[0].from, "sync") == 0) {
+				btrfs_clear_opt(info->mount_opt, DISCARD_ASYNC);
+				btrfs_set_and_info(root, DISCARD,
+						   "turning on sync discard");
+			} else if (strcmp(args[0].from, "async") == 0) {
+				btrfs_clear_opt(info->mount_opt, DISCARD);
+				btrfs_set_and_info(root, DISCARD_ASYNC,
+						   "turning on async discard");
+			} else {
+				ret = -EINVAL;
+				goto out;
+			}
+			break;
 		case Opt_nodiscard:
 			btrfs_clear_and_info(root, DISCARD,
 					     "turning off discard");
+			btrfs_clear_and_info(root, DISCARD_ASYNC,
+					     "turning off async discard");
 			break;
 		case Opt_space_cache:
 			btrfs_set_and_info(root, SPACE_CACHE,
@@ -1158,6 +1178,8 @@ static int btrfs_show_options(struct seq_file *seq, struct dentry *dentry)
 		seq_puts(seq, ",flushoncommit");
 	if (btrfs_test_opt(root, DISCARD))
 		seq_puts(seq, ",discard");
+	else if (btrfs_test_opt(root, DISCARD_ASYNC))
+		seq_puts(seq, ",discard=async");
 	if (!(root->fs_info->sb->s_flags & MS_POSIXACL))
 		seq_puts(seq, ",noacl");
 	if (btrfs_test_opt(root, SPACE_CACHE))
@@ -1603,6 +1625,12 @@ static inline void btrfs_remount_cleanup(struct btrfs_fs_info *fs_info,
 		btrfs_cleanup_defrag_inodes(fs_info);
 	}
 
+	/* the queued discards are dropped, like at unmount */
+	if (btrfs_raw_test_opt(old_opts, DISCARD_ASYNC) &&
+	    (!btrfs_raw_test_opt(fs_info->mount_opt, DISCARD_ASYNC) ||
+	     (fs_info->sb->s_flags & MS_RDONLY)))
+		btrfs_discard_stop(fs_info);
+
 	clear_bit(BTRFS_FS_STATE_REMOUNTING, &fs_info->fs_state);
 }
 
@@ -31,6 +31,7 @@
 #include "transaction.h"
 #include "sysfs.h"
 #include "volumes.h"
+#include "discard.h"
 
 static inline struct btrfs_fs_info *to_fs_info(struct kobject *kobj);
 static inline struct btrfs_fs_devices *to_fs_devs(struct kobject *kobj);
@@ -202,6 +203,7 @@ BTRFS_FEAT_ATTR_INCOMPAT(extended_iref, EXTENDED_IREF);
 BTRFS_FEAT_ATTR_INCOMPAT(raid56, RAID56);
 BTRFS_FEAT_ATTR_INCOMPAT(skinny_metadata, SKINNY_METADATA);
 BTRFS_FEAT_ATTR_INCOMPAT(no_holes, NO_HOLES);
+BTRFS_FEAT_ATTR_INCOMPAT(block_group_tree, BLOCK_GROUP_TREE);
 
 static struct attribute *btrfs_supported_feature_attrs[] = {
 	BTRFS_FEAT_ATTR_PTR(mixed_backref),
@@ -213,6 +215,7 @@ static struct attribute *btrfs_supported_feature_attrs[] = {
 	BTRFS_FEAT_ATTR_PTR(raid56),
 	BTRFS_FEAT_ATTR_PTR(skinny_metadata),
 	BTRFS_FEAT_ATTR_PTR(no_holes),
+	BTRFS_FEAT_ATTR_PTR(block_group_tree),
 	NULL
 };
 
@@ -357,6 +360,140 @@ static const struct attribute *allocation_attrs[] = {
 	NULL,
 };
 
+static ssize_t discard_iops_limit_show(struct kobject *kobj,
+				       struct kobj_attribute *a, char *buf)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj->parent);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			READ_ONCE(fs_info->discard_ctl.iops_limit));
+}
+
+static ssize_t discard_iops_limit_store(struct kobject *kobj,
+					struct kobj_attribute *a,
+					const char *buf, size_t len)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj->parent);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(fs_info->discard_ctl.iops_limit, val);
+	return len;
+}
+BTRFS_ATTR_RW(iops_limit, discard_iops_limit_show, discard_iops_limit_store);
+
+static ssize_t discard_kbps_limit_show(struct kobject *kobj,
+				       struct kobj_attribute *a, char *buf)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj->parent);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			READ_ONCE(fs_info->discard_ctl.kbps_limit));
+}
+
+static ssize_t discard_kbps_limit_store(struct kobject *kobj,
+					struct kobj_attribute *a,
+					const char *buf, size_t len)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj->parent);
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(fs_info->discard_ctl.kbps_limit, val);
+	return len;
+}
+BTRFS_ATTR_RW(kbps_limit, discard_kbps_limit_show, discard_kbps_limit_store);
+
+static ssize_t discard_discardable_bytes_show(struct kobject *kobj,
+					      struct kobj_attribute *a,
+					      char *buf)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj->parent);
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n",
+			btrfs_discard_queued_bytes(fs_info));
+}
+BTRFS_ATTR(discardable_bytes, discard_discardable_bytes_show);
+
+static ssize_t discard_discarded_bytes_show(struct kobject *kobj,
+					    struct kobj_attribute *a,
+					    char *buf)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj->parent);
+	struct btrfs_discard_ctl *ctl = &fs_info->discard_ctl;
+
+	return btrfs_show_u64(&ctl->discarded_bytes, &ctl->lock, buf);
+}
+BTRFS_ATTR(discarded_bytes, discard_discarded_bytes_show);
+
+static const struct attribute *discard_attrs[] = {
+	BTRFS_ATTR_PTR(iops_limit),
+	BTRFS_ATTR_PTR(kbps_limit),
+	BTRFS_ATTR_PTR(discardable_bytes),
+	BTRFS_ATTR_PTR(discarded_bytes),
+	NULL,
+};
+
+static ssize_t raid56_stripe_hold_ms_show(struct kobject *kobj,
+					  struct kobj_attribute *a, char *buf)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj->parent);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			READ_ONCE(fs_info->stripe_hash_table->hold_msecs));
+}
+
+static ssize_t raid56_stripe_hold_ms_store(struct kobject *kobj,
+					   struct kobj_attribute *a,
+					   const char *buf, size_t len)
+{
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj->parent);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val > MSEC_PER_SEC)
+		return -EINVAL;
+
+	WRITE_ONCE(fs_info->stripe_hash_table->hold_msecs, val);
+	return len;
+}
+BTRFS_ATTR_RW(stripe_hold_ms, raid56_stripe_hold_ms_show,
+	      raid56_stripe_hold_ms_store);
+
+#define RAID56_COUNTER_ATTR(field)					\
+static ssize_t raid56_show_##field(struct kobject *kobj,		\
+				   struct kobj_attribute *a, char *buf)	\
+{									\
+	struct btrfs_fs_info *fs_info = to_fs_info(kobj->parent);	\
+									\
+	return snprintf(buf, PAGE_SIZE, "%ld\n",			\
+			atomic_long_read(&fs_info->stripe_hash_table->field)); \
+}									\
+BTRFS_ATTR(field, raid56_show_##field)
+
+RAID56_COUNTER_ATTR(full_stripe_writes);
+RAID56_COUNTER_ATTR(rmw_writes);
+RAID56_COUNTER_ATTR(rmw_cache_hits);
+
+static const struct attribute *raid56_attrs[] = {
+	BTRFS_ATTR_PTR(stripe_hold_ms),
+	BTRFS_ATTR_PTR(full_stripe_writes),
+	BTRFS_ATTR_PTR(rmw_writes),
+	BTRFS_ATTR_PTR(rmw_cache_hits),
+	NULL,
+};
+
 static ssize_t btrfs_label_show(struct kobject *kobj,
 				struct kobj_attribute *a, char *buf)
 {
@@ -523,6 +660,12 @@ static void __btrfs_sysfs_remove_fsid(struct btrfs_fs_devices *fs_devs)
 		fs_devs->device_dir_kobj = NULL;
 	}
 
+	if (fs_devs->devinfo_kobj) {
+		kobject_del(fs_devs->devinfo_kobj);
+		kobject_put(fs_devs->devinfo_kobj);
+		fs_devs->devinfo_kobj = NULL;
+	}
+
 	if (fs_devs->fsid_kobj.state_initialized) {
 		kobject_del(&fs_devs->fsid_kobj);
 		kobject_put(&fs_devs->fsid_kobj);
@@ -549,6 +692,16 @@ void btrfs_sysfs_remove_mounted(struct btrfs_fs_info *fs_info)
 {
 	btrfs_reset_fs_info_ptr(fs_info);
 
+	if (fs_info->raid56_kobj) {
+		sysfs_remove_files(fs_info->raid56_kobj, raid56_attrs);
+		kobject_del(fs_info->raid56_kobj);
+		kobject_put(fs_info->raid56_kobj);
+	}
+	if (fs_info->discard_kobj) {
+		sysfs_remove_files(fs_info->discard_kobj, discard_attrs);
+		kobject_del(fs_info->discard_kobj);
+		kobject_put(fs_info->discard_kobj);
+	}
 	if (fs_info->space_info_kobj) {
 		sysfs_remove_files(fs_info->space_info_kobj, allocation_attrs);
 		kobject_del(fs_info->space_info_kobj);
@@ -637,6 +790,66 @@ static void init_feature_attrs(void)
 
 /* when one_device is NULL, it removes all device links */
 
+static ssize_t btrfs_devinfo_scrub_speed_max_show(struct kobject *kobj,
+						  struct kobj_attribute *a,
+						  char *buf)
+{
+	struct btrfs_device *device = container_of(kobj, struct btrfs_device,
+						   devid_kobj);
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n",
+			READ_ONCE(device->scrub_speed_max));
+}
+
+static ssize_t btrfs_devinfo_scrub_speed_max_store(struct kobject *kobj,
+						   struct kobj_attribute *a,
+						   const char *buf, size_t len)
+{
+	struct btrfs_device *device = container_of(kobj, struct btrfs_device,
+						   devid_kobj);
+	char *endptr;
+	u64 limit;
+
+	/* bytes per second, with the usual K, M and G suffixes */
+	limit = memparse(buf, &endptr);
+	if (endptr == buf || (*endptr && *endptr != '\n'))
+		return -EINVAL;
+
+	WRITE_ONCE(device->scrub_speed_max, limit);
+	return len;
+}
+BTRFS_ATTR_RW(scrub_speed_max, btrfs_devinfo_scrub_speed_max_show,
+	      btrfs_devinfo_scrub_speed_max_store);
+
+static struct attribute *devid_attrs[] = {
+	BTRFS_ATTR_PTR(scrub_speed_max),
+	NULL,
+};
+
+static void btrfs_release_devid_kobj(struct kobject *kobj)
+{
+	struct btrfs_device *device = container_of(kobj, struct btrfs_device,
+						   devid_kobj);
+
+	memset(&device->devid_kobj, 0, sizeof(struct kobject));
+	complete(&device->kobj_unregister);
+}
+
+static struct kobj_type devid_ktype = {
+	.sysfs_ops	= &kobj_sysfs_ops,
+	.default_attrs	= devid_attrs,
+	.release	= btrfs_release_devid_kobj,
+};
+
+static void btrfs_sysfs_rm_devinfo(struct btrfs_device *device)
+{
+	if (device->devid_kobj.state_initialized) {
+		kobject_del(&device->devid_kobj);
+		kobject_put(&device->devid_kobj);
+		wait_for_completion(&device->kobj_unregister);
+	}
+}
+
 int btrfs_sysfs_rm_device_link(struct btrfs_fs_devices *fs_devices,
 		struct btrfs_device *one_device)
 {
@@ -654,11 +867,14 @@ int btrfs_sysfs_rm_device_link(struct btrfs_fs_devices *fs_devices,
 						disk_kobj->name);
 	}
 
-	if (one_device)
+	if (one_device) {
+		btrfs_sysfs_rm_devinfo(one_device);
 		return 0;
+	}
 
 	list_for_each_entry(one_device,
 			&fs_devices->devices, dev_list) {
+		btrfs_sysfs_rm_devinfo(one_device);
 		if (!one_device->bdev)
 			continue;
 		disk = one_device->bdev->bd_part;
@@ -680,6 +896,13 @@ int btrfs_sysfs_add_device(struct btrfs_fs_devices *fs_devs)
 	if (!fs_devs->device_dir_kobj)
 		return -ENOMEM;
 
+	if (!fs_devs->devinfo_kobj)
+		fs_devs->devinfo_kobj = kobject_create_and_add("devinfo",
+						&fs_devs->fsid_kobj);
+
+	if (!fs_devs->devinfo_kobj)
+		return -ENOMEM;
+
 	return 0;
 }
 
@@ -706,6 +929,20 @@ int btrfs_sysfs_add_device_link(struct btrfs_fs_devices *fs_devices,
 					  disk_kobj, disk_kobj->name);
 		if (error)
 			break;
+
+		if (!fs_devices->devinfo_kobj ||
+		    dev->devid_kobj.state_initialized)
+			continue;
+
+		init_completion(&dev->kobj_unregister);
+		error = kobject_init_and_add(&dev->devid_kobj, &devid_ktype,
+					     fs_devices->devinfo_kobj, "%llu",
+					     dev->devid);
+		if (error) {
+			kobject_put(&dev->devid_kobj);
+			wait_for_completion(&dev->kobj_unregister);
+			break;
+		}
 	}
 
 	return error;
@@ -774,6 +1011,26 @@ int btrfs_sysfs_add_mounted(struct btrfs_fs_info *fs_info)
 	if (error)
 		goto failure;
 
+	fs_info->discard_kobj = kobject_create_and_add("discard", fsid_kobj);
+	if (!fs_info->discard_kobj) {
+		error = -ENOMEM;
+		goto failure;
+	}
+
+	error = sysfs_create_files(fs_info->discard_kobj, discard_attrs);
+	if (error)
+		goto failure;
+
+	fs_info->raid56_kobj = kobject_create_and_add("raid56", fsid_kobj);
+	if (!fs_info->raid56_kobj) {
+		error = -ENOMEM;
+		goto failure;
+	}
+
+	error = sysfs_create_files(fs_info->raid56_kobj, raid56_attrs);
+	if (error)
+		goto failure;
+
 	return 0;
 failure:
 	btrfs_sysfs_remove_mounted(fs_info);
@@ -130,6 +130,8 @@ struct btrfs_device {
 
 	/* per-device scrub information */
 	struct scrub_ctx *scrub_device;
+	/* bytes per second, 0 is no limit */
+	u64 scrub_speed_max;
 
 	struct btrfs_work work;
 	struct rcu_head rcu;
@@ -150,6 +152,10 @@ struct btrfs_device {
 	/* Counter to record the change of device stats */
 	atomic_t dev_stats_ccnt;
 	atomic_t dev_stat_values[BTRFS_DEV_STAT_VALUES_MAX];
+
+	/* /sys/fs/btrfs/<fsid>/devinfo/<devid> */
+	struct kobject devid_kobj;
+	struct completion kobj_unregister;
 };
 
 /*
@@ -258,6 +264,7 @@ struct btrfs_fs_devices {
 	/* sysfs kobjects */
 	struct kobject fsid_kobj;
 	struct kobject *device_dir_kobj;
+	struct kobject *devinfo_kobj;
 	struct completion kobj_unregister;
 };
 
@@ -118,6 +118,47 @@ struct dentry_stat_t dentry_stat = {
 
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
+static DEFINE_PER_CPU(long, nr_dentry_negative);
+
+/*
+ * Unused negative dentries beyond this share of memory, in percent, are
+ * not kept around, and go first at reclaim time.  0 means no limit.
+ */
+int sysctl_negative_dentry_limit __read_mostly = 5;
+static bool negative_dentries_over __read_mostly;
+static unsigned long negative_dentries_checked;
+
+static long get_nr_dentry_negative(void)
+{
+	int i;
+	long sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
+
+/*
+ * Are there more negative dentries than the limit lets us keep?  Summing
+ * up the counters costs, so it's done at most once a jiffy.
+ */
+static bool negative_dentries_over_limit(void)
+{
+	int limit = READ_ONCE(sysctl_negative_dentry_limit);
+	unsigned long now = jiffies;
+
+	if (!limit)
+		return false;
+
+	if (READ_ONCE(negative_dentries_checked) != now) {
+		unsigned long max = totalram_pages / 100 * limit *
+				    (PAGE_SIZE / sizeof(struct dentry));
+
+		WRITE_ONCE(negative_dentries_checked, now);
+		WRITE_ONCE(negative_dentries_over,
+			   get_nr_dentry_negative() > max);
+	}
+	return READ_ONCE(negative_dentries_over);
+}
 
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 
@@ -156,6 +197,7 @@ int proc_nr_dentry(struct ctl_table *table, int write, void __user *buffer,
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
 	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = get_nr_dentry_negative();
 	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
 }
 #endif
@@ -275,6 +317,8 @@ static inline void __d_set_inode_and_type(struct dentry *dentry,
 {
 	unsigned flags;
 
+	if (d_is_negative(dentry) && type_flags != DCACHE_MISS_TYPE)
+		this_cpu_dec(nr_dentry_negative);
 	dentry->d_inode = inode;
 	flags = READ_ONCE(dentry->d_flags);
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
@@ -286,6 +330,8 @@ static inline void __d_clear_type_and_inode(struct dentry *dentry)
 {
 	unsigned flags = READ_ONCE(dentry->d_flags);
 
+	if (!d_is_negative(dentry))
+		this_cpu_inc(nr_dentry_negative);
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	WRITE_ONCE(dentry->d_flags, flags);
 	dentry->d_inode = NULL;
@@ -484,6 +530,8 @@ void __d_drop(struct dentry *dentry)
 		dentry->d_hash.pprev = NULL;
 		hlist_bl_unlock(b);
 		dentry_rcuwalk_invalidate(dentry);
+		if (d_is_dir(dentry))
+			path_cache_invalidate(dentry->d_sb);
 	}
 }
 EXPORT_SYMBOL(__d_drop);
@@ -536,6 +584,8 @@ static void __dentry_kill(struct dentry *dentry)
 	 */
 	BUG_ON(dentry->d_lockref.count > 0);
 	this_cpu_dec(nr_dentry);
+	if (d_is_negative(dentry))
+		this_cpu_dec(nr_dentry_negative);
 	if (dentry->d_op && dentry->d_op->d_release)
 		dentry->d_op->d_release(dentry);
 
@@ -773,6 +823,10 @@ repeat:
 			goto kill_it;
 	}
 
+	/* Too many negative dentries about, don't keep this one */
+	if (unlikely(d_is_negative(dentry)) && negative_dentries_over_limit())
+		goto kill_it;
+
 	if (!(dentry->d_flags & DCACHE_REFERENCED))
 		dentry->d_flags |= DCACHE_REFERENCED;
 	dentry_lru_add(dentry);
@@ -1034,7 +1088,9 @@ static enum lru_status dentry_lru_isolate(struct list_head *item,
 		return LRU_REMOVED;
 	}
 
-	if (dentry->d_flags & DCACHE_REFERENCED) {
+	/* Negative dentries get no second pass while they're too many */
+	if ((dentry->d_flags & DCACHE_REFERENCED) &&
+	    !(d_is_negative(dentry) && negative_dentries_over_limit())) {
 		dentry->d_flags &= ~DCACHE_REFERENCED;
 		spin_unlock(&dentry->d_lock);
 
@@ -1600,6 +1656,7 @@ struct dentry *__d_alloc(struct super_block *sb, const struct qstr *name)
 	d_set_d_op(dentry, dentry->d_sb->s_d_op);
 
 	this_cpu_inc(nr_dentry);
+	this_cpu_inc(nr_dentry_negative);
 
 	return dentry;
 }
@@ -2058,21 +2115,31 @@ struct dentry *d_add_ci(struct dentry *dentry, struct inode *inode,
 	 * if not go ahead and create it now.
 	 */
 	found = d_hash_and_lookup(dentry->d_parent, name);
-	if (!found) {
+	if (found) {
+		iput(inode);
+		return found;
+	}
+	if (d_in_lookup(dentry)) {
+		/* the exact name has to go through the in-lookup hash too */
+		new = d_alloc_parallel(dentry->d_parent, name, dentry->d_wait);
+		if (IS_ERR(new) || !d_in_lookup(new)) {
+			iput(inode);
+			return new;
+		}
+	} else {
 		new = d_alloc(dentry->d_parent, name);
 		if (!new) {
-			found = ERR_PTR(-ENOMEM);
-		} else {
-			found = d_splice_alias(inode, new);
-			if (found) {
-				dput(new);
-				return found;
-			}
-			return new;
+			iput(inode);
+			return ERR_PTR(-ENOMEM);
 		}
 	}
-	iput(inode);
-	return found;
+	found = d_splice_alias(inode, new);
+	if (found) {
+		d_lookup_done(new);
+		dput(new);
+		return found;
+	}
+	return new;
 }
 EXPORT_SYMBOL(d_add_ci);
 
@@ -2438,6 +2505,232 @@ void d_rehash(struct dentry * entry)
 }
 EXPORT_SYMBOL(d_rehash);
 
+/*
+ * Parallel lookups.  On a filesystem with FS_PARALLEL_LOOKUP, lookup_slow()
+ * calls ->lookup() without the parent's i_mutex.  What that lock used to
+ * guarantee - that there is only one dentry for a name - is kept with a
+ * small hash of the dentries being looked up: d_alloc_parallel() either
+ * finds the name hashed, or waits for the lookup of it already going on,
+ * or puts the new dentry there and leaves the lookup to the caller.  The
+ * holders of i_mutex take their dentries from there as well, so they
+ * can't race with the lookups either.
+ *
+ * An in-lookup dentry is neither hashed nor an alias, so it is kept on
+ * in_lookup_hashtable through ->d_u, and ->d_lru points to the waitqueue
+ * of its lookup instead.  Whenever one leaves the table for the dcache,
+ * the parent's ->i_dir_seq is bumped, which tells d_alloc_parallel() to
+ * look again.
+ */
+#define IN_LOOKUP_SHIFT 10
+static struct hlist_bl_head in_lookup_hashtable[1 << IN_LOOKUP_SHIFT];
+
+static inline struct hlist_bl_head *in_lookup_hash(const struct dentry *dir,
+						    unsigned int hash)
+{
+	hash += (unsigned long) dir / L1_CACHE_BYTES;
+	return in_lookup_hashtable + hash_32(hash, IN_LOOKUP_SHIFT);
+}
+
+static inline unsigned start_dir_add(struct inode *dir)
+{
+	for (;;) {
+		unsigned n = dir->i_dir_seq;
+		if (!(n & 1) && cmpxchg(&dir->i_dir_seq, n, n + 1) == n)
+			return n;
+		cpu_relax();
+	}
+}
+
+static inline void end_dir_add(struct inode *dir, unsigned n)
+{
+	smp_store_release(&dir->i_dir_seq, n + 2);
+}
+
+/*
+ * The waitqueue lives on the stack of whoever does the lookup and is
+ * gone once the lookup is done, so our entry is never taken off it.
+ */
+static void d_wait_lookup(struct dentry *dentry)
+{
+	if (d_in_lookup(dentry)) {
+		DECLARE_WAITQUEUE(wait, current);
+		add_wait_queue(dentry->d_wait, &wait);
+		do {
+			set_current_state(TASK_UNINTERRUPTIBLE);
+			spin_unlock(&dentry->d_lock);
+			schedule();
+			spin_lock(&dentry->d_lock);
+		} while (d_in_lookup(dentry));
+	}
+}
+
+static bool d_in_lookup_match(struct dentry *dentry, struct dentry *parent,
+			      const struct qstr *name)
+{
+	if (dentry->d_name.hash != name->hash)
+		return false;
+	if (dentry->d_parent != parent)
+		return false;
+	if (parent->d_flags & DCACHE_OP_COMPARE)
+		return !parent->d_op->d_compare(parent, dentry,
+						dentry->d_name.len,
+						dentry->d_name.name, name);
+	return dentry->d_name.len == name->len &&
+	       !dentry_cmp(dentry, name->name, name->len);
+}
+
+/**
+ * d_alloc_parallel - allocate a dentry for a lookup, or find it
+ * @parent: directory the lookup is in
+ * @name: name to look up, hashed
+ * @wq: waitqueue for the ones waiting for our lookup
+ *
+ * Returns the dentry of @name if it is in the dcache, possibly after
+ * waiting for somebody else's lookup of it.  Otherwise, returns a new
+ * in-lookup dentry; the caller then calls ->lookup() on it and ends the
+ * lookup with d_lookup_done(), unless ->lookup() did it, and @wq must
+ * stay around until it has.
+ */
+struct dentry *d_alloc_parallel(struct dentry *parent,
+				const struct qstr *name,
+				wait_queue_head_t *wq)
+{
+	struct hlist_bl_head *b = in_lookup_hash(parent, name->hash);
+	struct hlist_bl_node *node;
+	struct dentry *new = d_alloc(parent, name);
+	struct dentry *dentry;
+	unsigned seq, r_seq, d_seq;
+
+	if (unlikely(!new))
+		return ERR_PTR(-ENOMEM);
+
+retry:
+	rcu_read_lock();
+	seq = smp_load_acquire(&parent->d_inode->i_dir_seq) & ~1;
+	r_seq = read_seqbegin(&rename_lock);
+	dentry = __d_lookup_rcu(parent, name, &d_seq);
+	if (unlikely(dentry)) {
+		if (!lockref_get_not_dead(&dentry->d_lockref)) {
+			rcu_read_unlock();
+			goto retry;
+		}
+		if (read_seqcount_retry(&dentry->d_seq, d_seq)) {
+			rcu_read_unlock();
+			dput(dentry);
+			goto retry;
+		}
+		rcu_read_unlock();
+		dput(new);
+		return dentry;
+	}
+	if (unlikely(read_seqretry(&rename_lock, r_seq))) {
+		rcu_read_unlock();
+		goto retry;
+	}
+
+	hlist_bl_lock(b);
+	if (unlikely(parent->d_inode->i_dir_seq != seq)) {
+		hlist_bl_unlock(b);
+		rcu_read_unlock();
+		goto retry;
+	}
+	hlist_bl_for_each_entry(dentry, node, b, d_u.d_in_lookup_hash) {
+		if (!d_in_lookup_match(dentry, parent, name))
+			continue;
+		/* somebody is looking it up, wait for them */
+		hlist_bl_unlock(b);
+		if (!lockref_get_not_dead(&dentry->d_lockref)) {
+			rcu_read_unlock();
+			goto retry;
+		}
+		rcu_read_unlock();
+		spin_lock(&dentry->d_lock);
+		d_wait_lookup(dentry);
+		/*
+		 * If it didn't end up hashed under the name we want, a
+		 * rename or a failed lookup got in the way; start over.
+		 */
+		if (unlikely(d_unhashed(dentry) ||
+			     !d_in_lookup_match(dentry, parent, name))) {
+			spin_unlock(&dentry->d_lock);
+			dput(dentry);
+			goto retry;
+		}
+		spin_unlock(&dentry->d_lock);
+		dput(new);
+		return dentry;
+	}
+	rcu_read_unlock();
+	/* nobody else can see it yet, so no ->d_lock */
+	new->d_flags |= DCACHE_PAR_LOOKUP;
+	new->d_wait = wq;
+	hlist_bl_add_head_rcu(&new->d_u.d_in_lookup_hash, b);
+	hlist_bl_unlock(b);
+	return new;
+}
+EXPORT_SYMBOL(d_alloc_parallel);
+
+/* called with ->d_lock held */
+void __d_lookup_done(struct dentry *dentry)
+{
+	struct hlist_bl_head *b = in_lookup_hash(dentry->d_parent,
+						 dentry->d_name.hash);
+	hlist_bl_lock(b);
+	dentry->d_flags &= ~DCACHE_PAR_LOOKUP;
+	__hlist_bl_del(&dentry->d_u.d_in_lookup_hash);
+	wake_up_all(dentry->d_wait);
+	dentry->d_wait = NULL;
+	hlist_bl_unlock(b);
+	INIT_HLIST_NODE(&dentry->d_u.d_alias);
+	INIT_LIST_HEAD(&dentry->d_lru);
+}
+EXPORT_SYMBOL(__d_lookup_done);
+
+/* d_instantiate() and d_rehash() in one go; inode->i_lock held */
+static inline void __d_add(struct dentry *dentry, struct inode *inode)
+{
+	unsigned add_flags = d_flags_for_inode(inode);
+	struct inode *dir = NULL;
+	unsigned n;
+
+	spin_lock(&dentry->d_lock);
+	if (unlikely(d_in_lookup(dentry))) {
+		dir = dentry->d_parent->d_inode;
+		n = start_dir_add(dir);
+		__d_lookup_done(dentry);
+	}
+	if (inode)
+		hlist_add_head(&dentry->d_u.d_alias, &inode->i_dentry);
+	raw_write_seqcount_begin(&dentry->d_seq);
+	__d_set_inode_and_type(dentry, inode, add_flags);
+	raw_write_seqcount_end(&dentry->d_seq);
+	_d_rehash(dentry);
+	if (dir)
+		end_dir_add(dir, n);
+	spin_unlock(&dentry->d_lock);
+	fsnotify_d_instantiate(dentry, inode);
+}
+
+/**
+ * d_add - add dentry to hash queues
+ * @entry: dentry to add
+ * @inode: The inode to attach to this dentry
+ *
+ * This adds the entry to the hash queues and initializes @inode.
+ * The entry was actually filled in earlier during d_alloc().
+ */
+void d_add(struct dentry *entry, struct inode *inode)
+{
+	if (inode) {
+		security_d_instantiate(entry, inode);
+		spin_lock(&inode->i_lock);
+	}
+	__d_add(entry, inode);
+	if (inode)
+		spin_unlock(&inode->i_lock);
+}
+EXPORT_SYMBOL(d_add);
+
 /**
  * dentry_update_name_case - update case insensitive dentry with a new name
  * @dentry: dentry to be updated
@@ -2593,6 +2886,9 @@ static void dentry_unlock_for_move(struct dentry *dentry, struct dentry *target)
 static void __d_move(struct dentry *dentry, struct dentry *target,
 		     bool exchange)
 {
+	struct inode *dir = NULL;
+	unsigned n;
+
 	if (!dentry->d_inode)
 		printk(KERN_WARNING "VFS: moving negative dcache entry\n");
 
@@ -2604,6 +2900,13 @@ static void __d_move(struct dentry *dentry, struct dentry *target,
 	write_seqcount_begin(&dentry->d_seq);
 	write_seqcount_begin_nested(&target->d_seq, DENTRY_D_LOCK_NESTED);
 
+	/* d_splice_alias() moving a directory in place of an in-lookup one */
+	if (unlikely(d_in_lookup(target))) {
+		dir = target->d_parent->d_inode;
+		n = start_dir_add(dir);
+		__d_lookup_done(target);
+	}
+
 	/* __d_drop does write_seqcount_barrier, but they're OK to nest. */
 
 	/*
@@ -2649,6 +2952,9 @@ static void __d_move(struct dentry *dentry, struct dentry *target,
 	write_seqcount_end(&target->d_seq);
 	write_seqcount_end(&dentry->d_seq);
 
+	if (dir)
+		end_dir_add(dir, n);
+
 	dentry_unlock_for_move(dentry, target);
 }
 
@@ -2774,10 +3080,9 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
 
 	BUG_ON(!d_unhashed(dentry));
 
-	if (!inode) {
-		__d_instantiate(dentry, NULL);
+	if (!inode)
 		goto out;
-	}
+	security_d_instantiate(dentry, inode);
 	spin_lock(&inode->i_lock);
 	if (S_ISDIR(inode->i_mode)) {
 		struct dentry *new = __d_find_any_alias(inode);
@@ -2812,11 +3117,10 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
 		}
 	}
 	/* already taking inode->i_lock, so d_add() by hand */
-	__d_instantiate(dentry, inode);
-	spin_unlock(&inode->i_lock);
 out:
-	security_d_instantiate(dentry, inode);
-	d_rehash(dentry);
+	__d_add(dentry, inode);
+	if (inode)
+		spin_unlock(&inode->i_lock);
 	return NULL;
 }
 EXPORT_SYMBOL(d_splice_alias);
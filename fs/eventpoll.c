@@ -42,6 +42,8 @@
 #include <linux/seq_file.h>
 #include <linux/compat.h>
 #include <linux/rculist.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
 
 /*
  * LOCKING:
@@ -49,14 +51,18 @@
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (spinlock)
+ * 3) ep->lock (rwlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
+ * We need a spinning lock (ep->lock) because we manipulate objects
  * from inside the poll callback, that might be triggered from
  * a wake_up() that in turn might be called from IRQ context.
  * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * a spinning lock. The poll callback only takes it for read and
+ * queues the item locklessly, on the ready list of the CPU it runs
+ * on or on ep->ovflist, so wakeups from many CPUs don't serialize on
+ * it; everything else that touches the lists takes it for write.
+ * ep->wq is protected by its own lock. During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -92,13 +98,21 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+#define EPOLLINOUT_BITS (POLLIN | POLLOUT)
+
+#define EPOLLEXCLUSIVE_OK_BITS (EPOLLINOUT_BITS | POLLERR | POLLHUP | \
+				EPOLLWAKEUP | EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
 
 #define EP_MAX_EVENTS (INT_MAX / sizeof(struct epoll_event))
 
+/* Maximum number of commands in one epoll_ctl_batch() */
+#define EP_MAX_BATCH 1024
+
 #define EP_UNACTIVE_PTR ((void *) -1L)
 
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
@@ -179,7 +193,7 @@ struct epitem {
  */
 struct eventpoll {
 	/* Protect the access to this structure */
-	spinlock_t lock;
+	rwlock_t lock;
 
 	/*
 	 * This mutex is used to ensure that files are not removed
@@ -198,6 +212,13 @@ struct eventpoll {
 	/* List of ready file descriptors */
 	struct list_head rdllist;
 
+	/*
+	 * Ready lists the poll callback queues on, one per CPU, and the
+	 * CPUs whose list may not be empty.
+	 */
+	struct list_head __percpu *pcp_rdllist;
+	cpumask_var_t pcp_ready;
+
 	/* RB tree root used to store monitored fd structs */
 	struct rb_root rbr;
 
@@ -257,6 +278,9 @@ struct ep_send_events_data {
 /* Maximum number of epoll watched descriptors, per user */
 static long max_user_watches __read_mostly;
 
+/* Longest busy-poll epoll_pwait1() may ask for, in microseconds */
+static int max_busy_poll_usecs __read_mostly = 1000;
+
 /*
  * This mutex is used to serialize ep_free() and eventpoll_release_file().
  */
@@ -292,6 +316,7 @@ static LIST_HEAD(tfile_check_list);
 
 static long zero;
 static long long_max = LONG_MAX;
+static int int_zero;
 
 struct ctl_table epoll_table[] = {
 	{
@@ -303,6 +328,14 @@ struct ctl_table epoll_table[] = {
 		.extra1		= &zero,
 		.extra2		= &long_max,
 	},
+	{
+		.procname	= "max_busy_poll_usecs",
+		.data		= &max_busy_poll_usecs,
+		.maxlen		= sizeof(max_busy_poll_usecs),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &int_zero,
+	},
 	{ }
 };
 #endif /* CONFIG_SYSCTL */
@@ -376,7 +409,80 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	return !list_empty_careful(&ep->rdllist) ||
+		!cpumask_empty(ep->pcp_ready) ||
+		READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR;
+}
+
+/*
+ * list_add_tail_lockless - add @new to the tail of @head, with no lock
+ *                          against other adders
+ *
+ * Used by the poll callback under the read side of ep->lock; the ones
+ * iterating or removing from the list take the write side.  Returns
+ * false if another CPU got @new queued first, @new must be unlinked
+ * (initialized to point to itself) otherwise.
+ */
+static inline bool list_add_tail_lockless(struct list_head *new,
+					  struct list_head *head)
+{
+	struct list_head *prev;
+
+	/* whoever swaps new->next from new owns the insertion */
+	if (cmpxchg(&new->next, new, head) != new)
+		return false;
+
+	/*
+	 * The xchg() is a full barrier: ->next is set before the tail
+	 * moves to us, and the tail has moved before prev->next points
+	 * to us.  Only the tail is ever added to, so these two can't be
+	 * touched by anybody else meanwhile.
+	 */
+	prev = xchg(&head->prev, new);
+	prev->next = new;
+	new->prev = prev;
+
+	return true;
+}
+
+/*
+ * chain_epi_lockless - chain @epi on ep->ovflist, with no lock against
+ *                      other adders
+ *
+ * Same as list_add_tail_lockless() for the single linked ->ovflist.
+ */
+static inline bool chain_epi_lockless(struct epitem *epi)
+{
+	struct eventpoll *ep = epi->ep;
+
+	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) != EP_UNACTIVE_PTR)
+		return false;
+
+	epi->next = xchg(&ep->ovflist, epi);
+
+	return true;
+}
+
+/*
+ * Moves all the ready items to @txlist, the ones queued on this CPU
+ * first: they were most likely made ready here and are cache hot.
+ * Must be called with ep->lock held for write.
+ */
+static void ep_collect_ready(struct eventpoll *ep, struct list_head *txlist)
+{
+	int this_cpu = smp_processor_id();
+	int cpu;
+
+	if (cpumask_test_cpu(this_cpu, ep->pcp_ready))
+		list_splice_tail_init(per_cpu_ptr(ep->pcp_rdllist, this_cpu),
+				      txlist);
+	list_splice_tail_init(&ep->rdllist, txlist);
+	for_each_cpu(cpu, ep->pcp_ready) {
+		if (cpu != this_cpu)
+			list_splice_tail_init(per_cpu_ptr(ep->pcp_rdllist, cpu),
+					      txlist);
+	}
+	cpumask_clear(ep->pcp_ready);
 }
 
 /**
@@ -595,7 +701,6 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 			      void *priv, int depth, bool ep_locked)
 {
 	int error, pwake = 0;
-	unsigned long flags;
 	struct epitem *epi, *nepi;
 	LIST_HEAD(txlist);
 
@@ -615,17 +720,17 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	 * because we want the "sproc" callback to be able to do it
 	 * in a lockless way.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
-	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_lock_irq(&ep->lock);
+	ep_collect_ready(ep, &txlist);
+	WRITE_ONCE(ep->ovflist, NULL);
+	write_unlock_irq(&ep->lock);
 
 	/*
 	 * Now call the callback function.
 	 */
 	error = (*sproc)(ep, &txlist, priv);
 
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irq(&ep->lock);
 	/*
 	 * During the time we spent inside the "sproc" callback, some
 	 * other events might have been queued by the poll callback.
@@ -647,9 +752,9 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	/*
 	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
 	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
+	 * the ready lists.
 	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	WRITE_ONCE(ep->ovflist, EP_UNACTIVE_PTR);
 
 	/*
 	 * Quickly re-inject items left on "txlist".
@@ -663,11 +768,11 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 		 * the ->poll() wait list (delayed after we release the lock).
 		 */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irq(&ep->lock);
 
 	if (!ep_locked)
 		mutex_unlock(&ep->mtx);
@@ -691,7 +796,6 @@ static void epi_rcu_free(struct rcu_head *head)
  */
 static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 {
-	unsigned long flags;
 	struct file *file = epi->ffd.file;
 
 	/*
@@ -711,10 +815,10 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irq(&ep->lock);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irq(&ep->lock);
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 	/*
@@ -780,6 +884,8 @@ static void ep_free(struct eventpoll *ep)
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
 	wakeup_source_unregister(ep->ws);
+	free_cpumask_var(ep->pcp_ready);
+	free_percpu(ep->pcp_rdllist);
 	kfree(ep);
 }
 
@@ -934,7 +1040,7 @@ void eventpoll_release_file(struct file *file)
 
 static int ep_alloc(struct eventpoll **pep)
 {
-	int error;
+	int error, cpu;
 	struct user_struct *user;
 	struct eventpoll *ep;
 
@@ -944,7 +1050,15 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
-	spin_lock_init(&ep->lock);
+	ep->pcp_rdllist = alloc_percpu(struct list_head);
+	if (unlikely(!ep->pcp_rdllist))
+		goto free_ep;
+	if (unlikely(!zalloc_cpumask_var(&ep->pcp_ready, GFP_KERNEL)))
+		goto free_pcp;
+	for_each_possible_cpu(cpu)
+		INIT_LIST_HEAD(per_cpu_ptr(ep->pcp_rdllist, cpu));
+
+	rwlock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
@@ -957,6 +1071,10 @@ static int ep_alloc(struct eventpoll **pep)
 
 	return 0;
 
+free_pcp:
+	free_percpu(ep->pcp_rdllist);
+free_ep:
+	kfree(ep);
 free_uid:
 	free_uid(user);
 	return error;
@@ -1002,6 +1120,9 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
+	struct list_head *rdllist;
+	int ewake = 0;
+	int cpu;
 
 	if ((unsigned long)key & POLLFREE) {
 		ep_pwq_from_wait(wait)->whead = NULL;
@@ -1014,7 +1135,7 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 		list_del_init(&wait->task_list);
 	}
 
-	spin_lock_irqsave(&ep->lock, flags);
+	read_lock_irqsave(&ep->lock, flags);
 
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
@@ -1040,10 +1161,8 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * semantics). All the events that happen during that period of time are
 	 * chained in ep->ovflist and requeued later on.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
+	if (unlikely(READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR)) {
+		if (epi->next == EP_UNACTIVE_PTR && chain_epi_lockless(epi)) {
 			if (epi->ws) {
 				/*
 				 * Activate ep->ws since epi->ws may get
@@ -1051,34 +1170,66 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 				 */
 				__pm_stay_awake(ep->ws);
 			}
-
 		}
 		goto out_unlock;
 	}
 
-	/* If this file is already in the ready list we exit soon */
+	/*
+	 * If this file is already in a ready list we exit soon.  Otherwise
+	 * queue it on the one of this CPU; the mask bit goes first, so that
+	 * it is set by the time the item can be seen.
+	 */
 	if (!ep_is_linked(&epi->rdllink)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-		ep_pm_stay_awake_rcu(epi);
+		cpu = smp_processor_id();
+		rdllist = per_cpu_ptr(ep->pcp_rdllist, cpu);
+		if (!cpumask_test_cpu(cpu, ep->pcp_ready))
+			cpumask_set_cpu(cpu, ep->pcp_ready);
+		if (list_add_tail_lockless(&epi->rdllink, rdllist))
+			ep_pm_stay_awake_rcu(epi);
 	}
 
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
-	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
+	if (waitqueue_active(&ep->wq)) {
+		/*
+		 * An exclusive wakeup is only consumed if it brings an
+		 * event the item is interested in, so that the source
+		 * goes on to the next exclusive waiter otherwise.
+		 */
+		if ((epi->event.events & EPOLLEXCLUSIVE) &&
+		    !((unsigned long)key & POLLFREE)) {
+			switch ((unsigned long)key & EPOLLINOUT_BITS) {
+			case POLLIN:
+				if (epi->event.events & POLLIN)
+					ewake = 1;
+				break;
+			case POLLOUT:
+				if (epi->event.events & POLLOUT)
+					ewake = 1;
+				break;
+			case 0:
+				ewake = 1;
+				break;
+			}
+		}
+		wake_up(&ep->wq);
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
 out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
+	read_unlock_irqrestore(&ep->lock, flags);
 
 	/* We have to call this outside the lock */
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
-	return 1;
+	if (!(epi->event.events & EPOLLEXCLUSIVE))
+		ewake = 1;
+
+	return ewake;
 }
 
 /*
@@ -1095,7 +1246,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -1265,7 +1419,6 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		     struct file *tfile, int fd, int full_check)
 {
 	int error, revents, pwake = 0;
-	unsigned long flags;
 	long user_watches;
 	struct epitem *epi;
 	struct ep_pqueue epq;
@@ -1332,7 +1485,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		goto error_remove_epi;
 
 	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irq(&ep->lock);
 
 	/* If the file is already "ready" we drop it inside the ready list */
 	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
@@ -1341,12 +1494,12 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
 
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irq(&ep->lock);
 
 	atomic_long_inc(&ep->user->epoll_watches);
 
@@ -1372,10 +1525,10 @@ error_unregister:
 	 * list, since that is used/cleaned only inside a section bound by "mtx".
 	 * And ep_insert() is called with "mtx" held.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irq(&ep->lock);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irq(&ep->lock);
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 
@@ -1419,7 +1572,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 *    event occurs immediately after we call f_op->poll().
 	 *    We need this because we did not take ep->lock while
 	 *    changing epi above (but ep_poll_callback does take
-	 *    ep->lock).
+	 *    ep->lock for read).
 	 *
 	 * 2) We also need to ensure we do not miss _past_ events
 	 *    when calling f_op->poll().  This barrier also
@@ -1442,18 +1595,18 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * list, push it inside.
 	 */
 	if (revents & event->events) {
-		spin_lock_irq(&ep->lock);
+		write_lock_irq(&ep->lock);
 		if (!ep_is_linked(&epi->rdllink)) {
 			list_add_tail(&epi->rdllink, &ep->rdllist);
 			ep_pm_stay_awake(epi);
 
 			/* Notify waiting tasks that events are available */
 			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
+				wake_up(&ep->wq);
 			if (waitqueue_active(&ep->poll_wait))
 				pwake++;
 		}
-		spin_unlock_irq(&ep->lock);
+		write_unlock_irq(&ep->lock);
 	}
 
 	/* We have to call this outside the lock */
@@ -1529,7 +1682,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * the ready list, so that the next call to
 				 * epoll_wait() will check again the events
 				 * availability. At this point, no one can insert
-				 * into ep->rdllist besides us. The epoll_ctl()
+				 * into the ready lists besides us. The epoll_ctl()
 				 * callers are locked out by
 				 * ep_scan_ready_list() holding "mtx" and the
 				 * poll callback will queue them in ep->ovflist.
@@ -1565,6 +1718,42 @@ static inline struct timespec ep_set_mstimeout(long ms)
 	return timespec_add_safe(now, ts);
 }
 
+/*
+ * Turns an epoll_wait() timeout in milliseconds into the end time ep_poll()
+ * takes: NULL for no timeout, zero for not blocking at all.
+ */
+static struct timespec *ep_timeout_to_timespec(struct timespec *to, long ms)
+{
+	if (ms < 0)
+		return NULL;
+
+	if (!ms) {
+		to->tv_sec = 0;
+		to->tv_nsec = 0;
+	} else {
+		*to = ep_set_mstimeout(ms);
+	}
+	return to;
+}
+
+/*
+ * Spins for up to @usecs for events to come in, so that a caller with
+ * latency sensitive sources doesn't pay for a sleep and a wakeup.  Gives
+ * up early if something else wants the CPU or a signal is pending.
+ */
+static bool ep_busy_loop(struct eventpoll *ep, unsigned int usecs)
+{
+	u64 end = local_clock() + (u64)usecs * NSEC_PER_USEC;
+
+	while (!ep_events_available(ep)) {
+		if (need_resched() || signal_pending(current) ||
+		    local_clock() >= end)
+			return false;
+		cpu_relax();
+	}
+	return true;
+}
+
 /**
  * ep_poll - Retrieves ready events, and delivers them to the caller supplied
  *           event buffer.
@@ -1573,42 +1762,40 @@ static inline struct timespec ep_set_mstimeout(long ms)
  * @events: Pointer to the userspace buffer where the ready events should be
  *          stored.
  * @maxevents: Size (in terms of number of events) of the caller event buffer.
- * @timeout: Maximum timeout for the ready events fetch operation, in
- *           milliseconds. If the @timeout is zero, the function will not block,
- *           while if the @timeout is less than zero, the function will block
- *           until at least one event has been retrieved (or an error
- *           occurred).
+ * @end_time: Absolute time the ready events fetch operation gives up at.
+ *            If @end_time is zero, the function will not block, while if
+ *            it is NULL, the function will block until at least one event
+ *            has been retrieved (or an error occurred).
+ * @busy_poll_usecs: How long to spin for events before going to sleep.
  *
  * Returns: Returns the number of ready events which have been fetched, or an
  *          error code, in case of error.
  */
 static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
-		   int maxevents, long timeout)
+		   int maxevents, struct timespec *end_time,
+		   unsigned int busy_poll_usecs)
 {
 	int res = 0, eavail, timed_out = 0;
-	unsigned long flags;
 	long slack = 0;
 	wait_queue_t wait;
 	ktime_t expires, *to = NULL;
 
-	if (timeout > 0) {
-		struct timespec end_time = ep_set_mstimeout(timeout);
-
-		slack = select_estimate_accuracy(&end_time);
+	if (end_time && (end_time->tv_sec || end_time->tv_nsec)) {
+		slack = select_estimate_accuracy(end_time);
 		to = &expires;
-		*to = timespec_to_ktime(end_time);
-	} else if (timeout == 0) {
+		*to = timespec_to_ktime(*end_time);
+	} else if (end_time) {
 		/*
 		 * Avoid the unnecessary trip to the wait queue loop, if the
 		 * caller specified a non blocking operation.
 		 */
 		timed_out = 1;
-		spin_lock_irqsave(&ep->lock, flags);
 		goto check_events;
 	}
 
 fetch_events:
-	spin_lock_irqsave(&ep->lock, flags);
+	if (busy_poll_usecs)
+		ep_busy_loop(ep, busy_poll_usecs);
 
 	if (!ep_events_available(ep)) {
 		/*
@@ -1617,7 +1804,9 @@ fetch_events:
 		 * ep_poll_callback() when events will become available.
 		 */
 		init_waitqueue_entry(&wait, current);
+		spin_lock_irq(&ep->wq.lock);
 		__add_wait_queue_exclusive(&ep->wq, &wait);
+		spin_unlock_irq(&ep->wq.lock);
 
 		for (;;) {
 			/*
@@ -1633,22 +1822,19 @@ fetch_events:
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
 			if (!schedule_hrtimeout_range(to, slack, HRTIMER_MODE_ABS))
 				timed_out = 1;
-
-			spin_lock_irqsave(&ep->lock, flags);
 		}
 
+		spin_lock_irq(&ep->wq.lock);
 		__remove_wait_queue(&ep->wq, &wait);
+		spin_unlock_irq(&ep->wq.lock);
 		__set_current_state(TASK_RUNNING);
 	}
 check_events:
 	/* Is it worth to try to dig for events ? */
 	eavail = ep_events_available(ep);
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
 	 * there's still timeout left over, we go trying again in search of
@@ -1813,116 +1999,90 @@ SYSCALL_DEFINE1(epoll_create, int, size)
 }
 
 /*
- * The following function implements the controller interface for
- * the eventpoll file that enables the insertion/removal/change of
- * file descriptors inside the interest set.
+ * Checks that @file can have @op done on @tfile, before any lock is taken.
  */
-SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
-		struct epoll_event __user *, event)
+static int ep_ctl_check(struct file *file, struct file *tfile, int op,
+			struct epoll_event *epds)
 {
-	int error;
-	int full_check = 0;
-	struct fd f, tf;
-	struct eventpoll *ep;
-	struct epitem *epi;
-	struct epoll_event epds;
-	struct eventpoll *tep = NULL;
-
-	error = -EFAULT;
-	if (ep_op_has_event(op) &&
-	    copy_from_user(&epds, event, sizeof(struct epoll_event)))
-		goto error_return;
-
-	error = -EBADF;
-	f = fdget(epfd);
-	if (!f.file)
-		goto error_return;
-
-	/* Get the "struct file *" for the target file */
-	tf = fdget(fd);
-	if (!tf.file)
-		goto error_fput;
-
 	/* The target file descriptor must support poll */
-	error = -EPERM;
-	if (!tf.file->f_op->poll)
-		goto error_tgt_fput;
+	if (!tfile->f_op->poll)
+		return -EPERM;
 
 	/* Check if EPOLLWAKEUP is allowed */
 	if (ep_op_has_event(op))
-		ep_take_care_of_epollwakeup(&epds);
+		ep_take_care_of_epollwakeup(epds);
 
 	/*
 	 * We have to check that the file structure underneath the file descriptor
 	 * the user passed to us _is_ an eventpoll file. And also we do not permit
 	 * adding an epoll file descriptor inside itself.
 	 */
-	error = -EINVAL;
-	if (f.file == tf.file || !is_file_epoll(f.file))
-		goto error_tgt_fput;
-
-	/*
-	 * At this point it is safe to assume that the "private_data" contains
-	 * our own data structure.
-	 */
-	ep = f.file->private_data;
+	if (file == tfile || !is_file_epoll(file))
+		return -EINVAL;
 
 	/*
-	 * When we insert an epoll file descriptor, inside another epoll file
-	 * descriptor, there is the change of creating closed loops, which are
-	 * better be handled here, than in more critical paths. While we are
-	 * checking for loops we also determine the list of files reachable
-	 * and hang them on the tfile_check_list, so we can check that we
-	 * haven't created too many possible wakeup paths.
-	 *
-	 * We do not need to take the global 'epumutex' on EPOLL_CTL_ADD when
-	 * the epoll file descriptor is attaching directly to a wakeup source,
-	 * unless the epoll file descriptor is nested. The purpose of taking the
-	 * 'epmutex' on add is to prevent complex toplogies such as loops and
-	 * deep wakeup paths from forming in parallel through multiple
-	 * EPOLL_CTL_ADD operations.
+	 * epoll adds to the wakeup queue at EPOLL_CTL_ADD time only,
+	 * so EPOLLEXCLUSIVE is not allowed for a EPOLL_CTL_MOD operation.
+	 * Also, we do not currently supported nested exclusive wakeups.
 	 */
-	mutex_lock_nested(&ep->mtx, 0);
-	if (op == EPOLL_CTL_ADD) {
-		if (!list_empty(&f.file->f_ep_links) ||
-						is_file_epoll(tf.file)) {
-			full_check = 1;
-			mutex_unlock(&ep->mtx);
-			mutex_lock(&epmutex);
-			if (is_file_epoll(tf.file)) {
-				error = -ELOOP;
-				if (ep_loop_check(ep, tf.file) != 0) {
-					clear_tfile_check_list();
-					goto error_tgt_fput;
-				}
-			} else
-				list_add(&tf.file->f_tfile_llink,
-							&tfile_check_list);
-			mutex_lock_nested(&ep->mtx, 0);
-			if (is_file_epoll(tf.file)) {
-				tep = tf.file->private_data;
-				mutex_lock_nested(&tep->mtx, 1);
-			}
-		}
+	if (ep_op_has_event(op) && (epds->events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD)
+			return -EINVAL;
+		if (is_file_epoll(tfile) ||
+		    (epds->events & ~EPOLLEXCLUSIVE_OK_BITS))
+			return -EINVAL;
 	}
 
+	return 0;
+}
+
+/*
+ * When we insert an epoll file descriptor, inside another epoll file
+ * descriptor, there is the change of creating closed loops, which are
+ * better be handled here, than in more critical paths. While we are
+ * checking for loops we also determine the list of files reachable
+ * and hang them on the tfile_check_list, so we can check that we
+ * haven't created too many possible wakeup paths.
+ *
+ * We do not need to take the global 'epumutex' on EPOLL_CTL_ADD when
+ * the epoll file descriptor is attaching directly to a wakeup source,
+ * unless the epoll file descriptor is nested. The purpose of taking the
+ * 'epmutex' on add is to prevent complex toplogies such as loops and
+ * deep wakeup paths from forming in parallel through multiple
+ * EPOLL_CTL_ADD operations.
+ */
+static inline bool ep_ctl_full_check(struct file *file, struct file *tfile,
+				     int op)
+{
+	return op == EPOLL_CTL_ADD &&
+		(!list_empty(&file->f_ep_links) || is_file_epoll(tfile));
+}
+
+/*
+ * Does @op on @tfile, once the checks are done.  Must be called with
+ * "mtx" held, and "epmutex" if @full_check.
+ */
+static int ep_ctl_locked(struct eventpoll *ep, int op, struct file *tfile,
+			 int fd, struct epoll_event *epds, int full_check)
+{
+	struct epitem *epi;
+	int error;
+
 	/*
 	 * Try to lookup the file inside our RB tree, Since we grabbed "mtx"
 	 * above, we can be sure to be able to use the item looked up by
 	 * ep_find() till we release the mutex.
 	 */
-	epi = ep_find(ep, tf.file, fd);
+	epi = ep_find(ep, tfile, fd);
 
 	error = -EINVAL;
 	switch (op) {
 	case EPOLL_CTL_ADD:
 		if (!epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_insert(ep, &epds, tf.file, fd, full_check);
+			epds->events |= POLLERR | POLLHUP;
+			error = ep_insert(ep, epds, tfile, fd, full_check);
 		} else
 			error = -EEXIST;
-		if (full_check)
-			clear_tfile_check_list();
 		break;
 	case EPOLL_CTL_DEL:
 		if (epi)
@@ -1932,20 +2092,101 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_modify(ep, epi, &epds);
+			if (!(epi->event.events & EPOLLEXCLUSIVE)) {
+				epds->events |= POLLERR | POLLHUP;
+				error = ep_modify(ep, epi, epds);
+			}
 		} else
 			error = -ENOENT;
 		break;
 	}
+
+	return error;
+}
+
+/* One EPOLL_CTL_* operation of the epoll @file on @tfile */
+static int do_epoll_ctl(struct file *file, int op, struct file *tfile, int fd,
+			struct epoll_event *epds)
+{
+	int error;
+	int full_check = 0;
+	struct eventpoll *ep;
+	struct eventpoll *tep = NULL;
+
+	error = ep_ctl_check(file, tfile, op, epds);
+	if (error)
+		return error;
+
+	/*
+	 * At this point it is safe to assume that the "private_data" contains
+	 * our own data structure.
+	 */
+	ep = file->private_data;
+
+	mutex_lock_nested(&ep->mtx, 0);
+	if (ep_ctl_full_check(file, tfile, op)) {
+		full_check = 1;
+		mutex_unlock(&ep->mtx);
+		mutex_lock(&epmutex);
+		if (is_file_epoll(tfile)) {
+			error = -ELOOP;
+			if (ep_loop_check(ep, tfile) != 0) {
+				clear_tfile_check_list();
+				goto error_unlock;
+			}
+		} else
+			list_add(&tfile->f_tfile_llink, &tfile_check_list);
+		mutex_lock_nested(&ep->mtx, 0);
+		if (is_file_epoll(tfile)) {
+			tep = tfile->private_data;
+			mutex_lock_nested(&tep->mtx, 1);
+		}
+	}
+
+	error = ep_ctl_locked(ep, op, tfile, fd, epds, full_check);
+	if (full_check)
+		clear_tfile_check_list();
+
 	if (tep != NULL)
 		mutex_unlock(&tep->mtx);
 	mutex_unlock(&ep->mtx);
 
-error_tgt_fput:
+error_unlock:
 	if (full_check)
 		mutex_unlock(&epmutex);
 
+	return error;
+}
+
+/*
+ * The following function implements the controller interface for
+ * the eventpoll file that enables the insertion/removal/change of
+ * file descriptors inside the interest set.
+ */
+SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
+		struct epoll_event __user *, event)
+{
+	int error;
+	struct fd f, tf;
+	struct epoll_event epds;
+
+	error = -EFAULT;
+	if (ep_op_has_event(op) &&
+	    copy_from_user(&epds, event, sizeof(struct epoll_event)))
+		goto error_return;
+
+	error = -EBADF;
+	f = fdget(epfd);
+	if (!f.file)
+		goto error_return;
+
+	/* Get the "struct file *" for the target file */
+	tf = fdget(fd);
+	if (!tf.file)
+		goto error_fput;
+
+	error = do_epoll_ctl(f.file, op, tf.file, fd, &epds);
+
 	fdput(tf);
 error_fput:
 	fdput(f);
@@ -1954,12 +2195,87 @@ error_return:
 	return error;
 }
 
+/*
+ * A vector of epoll_ctl() operations, done under one hold of "mtx" as
+ * long as none of them needs the loop and path checks.  Each command
+ * gets its own result; returns the number of commands done, which is
+ * short of @ncmds only if the vector couldn't be read or written.
+ */
+SYSCALL_DEFINE4(epoll_ctl_batch, int, epfd, int, flags, int, ncmds,
+		struct epoll_ctl_cmd __user *, cmds)
+{
+	struct epoll_ctl_cmd cmd;
+	struct epoll_event epds;
+	struct eventpoll *ep;
+	struct fd f, tf;
+	int i, error;
+
+	if (flags || ncmds <= 0 || ncmds > EP_MAX_BATCH)
+		return -EINVAL;
+
+	f = fdget(epfd);
+	if (!f.file)
+		return -EBADF;
+
+	error = -EINVAL;
+	if (!is_file_epoll(f.file))
+		goto error_fput;
+	ep = f.file->private_data;
+
+	mutex_lock_nested(&ep->mtx, 0);
+	for (i = 0; i < ncmds; i++) {
+		error = -EFAULT;
+		if (copy_from_user(&cmd, &cmds[i], sizeof(cmd)))
+			break;
+
+		epds.events = cmd.events;
+		epds.data = cmd.data;
+
+		error = -EINVAL;
+		if (cmd.flags)
+			goto result;
+
+		error = -EBADF;
+		tf = fdget(cmd.fd);
+		if (!tf.file)
+			goto result;
+
+		if (ep_ctl_full_check(f.file, tf.file, cmd.op)) {
+			/* "epmutex" comes before "mtx" */
+			mutex_unlock(&ep->mtx);
+			error = do_epoll_ctl(f.file, cmd.op, tf.file, cmd.fd,
+					     &epds);
+			mutex_lock_nested(&ep->mtx, 0);
+		} else {
+			error = ep_ctl_check(f.file, tf.file, cmd.op, &epds);
+			if (!error)
+				error = ep_ctl_locked(ep, cmd.op, tf.file,
+						      cmd.fd, &epds, 0);
+		}
+		fdput(tf);
+result:
+		if (put_user(error, &cmds[i].result)) {
+			error = -EFAULT;
+			break;
+		}
+		cond_resched();
+	}
+	mutex_unlock(&ep->mtx);
+
+	if (i)
+		error = i;
+error_fput:
+	fdput(f);
+	return error;
+}
+
 /*
  * Implement the event wait interface for the eventpoll file. It is the kernel
  * part of the user space epoll_wait(2).
  */
-SYSCALL_DEFINE4(epoll_wait, int, epfd, struct epoll_event __user *, events,
-		int, maxevents, int, timeout)
+static int do_epoll_wait(int epfd, struct epoll_event __user *events,
+			 int maxevents, struct timespec *end_time,
+			 unsigned int busy_poll_usecs)
 {
 	int error;
 	struct fd f;
@@ -1993,13 +2309,22 @@ SYSCALL_DEFINE4(epoll_wait, int, epfd, struct epoll_event __user *, events,
 	ep = f.file->private_data;
 
 	/* Time to fish for events ... */
-	error = ep_poll(ep, events, maxevents, timeout);
+	error = ep_poll(ep, events, maxevents, end_time, busy_poll_usecs);
 
 error_fput:
 	fdput(f);
 	return error;
 }
 
+SYSCALL_DEFINE4(epoll_wait, int, epfd, struct epoll_event __user *, events,
+		int, maxevents, int, timeout)
+{
+	struct timespec end_time;
+
+	return do_epoll_wait(epfd, events, maxevents,
+			     ep_timeout_to_timespec(&end_time, timeout), 0);
+}
+
 /*
  * Implement the event wait interface for the eventpoll file. It is the kernel
  * part of the user space epoll_pwait(2).
@@ -2044,6 +2369,68 @@ SYSCALL_DEFINE6(epoll_pwait, int, epfd, struct epoll_event __user *, events,
 	return error;
 }
 
+/*
+ * epoll_pwait() with a nanosecond timeout and busy polling: the wait
+ * parameters come in a struct epoll_wait_params.
+ */
+SYSCALL_DEFINE4(epoll_pwait1, int, epfd, struct epoll_event __user *, events,
+		int, maxevents, struct epoll_wait_params __user *, uparams)
+{
+	struct epoll_wait_params params;
+	struct timespec end_time, *to = NULL;
+	const sigset_t __user *sigmask;
+	sigset_t ksigmask, sigsaved;
+	unsigned int busy_poll_usecs;
+	int error;
+
+	if (copy_from_user(&params, uparams, sizeof(params)))
+		return -EFAULT;
+	if (params.__reserved)
+		return -EINVAL;
+
+	if (params.tv_sec >= 0) {
+		to = &end_time;
+		if (poll_select_set_timeout(to, params.tv_sec, params.tv_nsec))
+			return -EINVAL;
+	}
+
+	busy_poll_usecs = min_t(unsigned int, params.busy_poll_usecs,
+				READ_ONCE(max_busy_poll_usecs));
+
+	/*
+	 * If the caller wants a certain signal mask to be set during the wait,
+	 * we apply it here.
+	 */
+	sigmask = (const sigset_t __user *)(uintptr_t)params.sigmask;
+	if (sigmask) {
+		if (params.sigsetsize != sizeof(sigset_t))
+			return -EINVAL;
+		if (copy_from_user(&ksigmask, sigmask, sizeof(ksigmask)))
+			return -EFAULT;
+		sigsaved = current->blocked;
+		set_current_blocked(&ksigmask);
+	}
+
+	error = do_epoll_wait(epfd, events, maxevents, to, busy_poll_usecs);
+
+	/*
+	 * If we changed the signal mask, we need to restore the original one.
+	 * In case we've got a signal while waiting, we do not restore the
+	 * signal mask yet, and we allow do_signal() to deliver the signal on
+	 * the way back to userspace, before the signal mask is restored.
+	 */
+	if (sigmask) {
+		if (error == -EINTR) {
+			memcpy(&current->saved_sigmask, &sigsaved,
+			       sizeof(sigsaved));
+			set_restore_sigmask();
+		} else
+			set_current_blocked(&sigsaved);
+	}
+
+	return error;
+}
+
 #ifdef CONFIG_COMPAT
 COMPAT_SYSCALL_DEFINE6(epoll_pwait, int, epfd,
 			struct epoll_event __user *, events,
@@ -1128,6 +1128,265 @@ void would_dump(struct linux_binprm *bprm, struct file *file)
 }
 EXPORT_SYMBOL(would_dump);
 
+#ifdef CONFIG_EXEC_CACHE
+/*
+ * Exec cache
+ *
+ * A binary format can keep what it reads of an executable beyond
+ * bprm->buf with its inode, so that the next exec of the same file does
+ * not read and check it all over again.  Only exec, which denies writes
+ * to the file while it runs, looks at the cache, and the cache is dropped
+ * as soon as anyone gets write access to the file, so it cannot go stale
+ * under an exec.  Changes the kernel is not told about, on network
+ * filesystems, still show in the size or mtime the cache is checked
+ * against.
+ *
+ * With fs.exec_prefault set, the file pages the text mappings of the
+ * first process to go away after the cache was filled had mapped are
+ * recorded too, and later execs map them before the new program runs
+ * rather than letting it take a fault for each of them.
+ */
+struct exec_hot {
+	unsigned long nr;		/* file pages covered by bits */
+	unsigned long bits[];
+};
+
+struct exec_cache {
+	struct rcu_head rcu;
+	struct timespec mtime;
+	loff_t size;
+	int format;
+	struct exec_hot *hot;
+	size_t len;
+	char data[];
+};
+
+/* Text beyond this is not recorded, 128MB with 4K pages */
+#define EXEC_HOT_MAX_PAGES	(1UL << 15)
+
+int sysctl_exec_prefault __read_mostly;
+
+static void exec_cache_free(struct rcu_head *head)
+{
+	struct exec_cache *c = container_of(head, struct exec_cache, rcu);
+
+	kfree(c->hot);
+	kfree(c);
+}
+
+void __exec_cache_drop(struct inode *inode)
+{
+	struct exec_cache *c = xchg(&inode->i_exec_cache, NULL);
+
+	if (c)
+		call_rcu(&c->rcu, exec_cache_free);
+}
+EXPORT_SYMBOL(__exec_cache_drop);
+
+static bool exec_cache_fresh(struct exec_cache *c, struct inode *inode)
+{
+	return c->size == i_size_read(inode) &&
+	       timespec_equal(&c->mtime, &inode->i_mtime);
+}
+
+/**
+ * exec_cache_get - copy out what a binary format cached of an executable
+ * @file: the executable, with writes to it denied
+ * @format: tag the binary format stored the data under
+ * @len: returns the length of the data
+ *
+ * Returns a copy of the data for the caller to kfree(), or NULL if there
+ * is none, it is stale or no memory was to be had without waiting.
+ */
+void *exec_cache_get(struct file *file, int format, size_t *len)
+{
+	struct inode *inode = file_inode(file);
+	struct exec_cache *c;
+	void *data = NULL;
+
+	rcu_read_lock();
+	c = rcu_dereference(inode->i_exec_cache);
+	if (c && c->format == format && exec_cache_fresh(c, inode)) {
+		data = kmemdup(c->data, c->len, GFP_NOWAIT | __GFP_NOWARN);
+		*len = c->len;
+	}
+	rcu_read_unlock();
+	return data;
+}
+EXPORT_SYMBOL(exec_cache_get);
+
+/**
+ * exec_cache_set - cache what a binary format read of an executable
+ * @file: the executable, with writes to it denied
+ * @format: tag to store the data under
+ * @data: what to cache
+ * @len: length of @data
+ *
+ * Replaces a stale entry; an exec of the same file racing with this one
+ * may have filled the cache already, that entry is kept then.
+ */
+void exec_cache_set(struct file *file, int format, const void *data,
+		    size_t len)
+{
+	struct inode *inode = file_inode(file);
+	struct exec_cache *c, *old;
+
+	c = kmalloc(sizeof(*c) + len, GFP_KERNEL);
+	if (!c)
+		return;
+	c->mtime = inode->i_mtime;
+	c->size = i_size_read(inode);
+	c->format = format;
+	c->hot = NULL;
+	c->len = len;
+	memcpy(c->data, data, len);
+
+	rcu_read_lock();
+	old = rcu_dereference(inode->i_exec_cache);
+	if (old && old->format == format && exec_cache_fresh(old, inode))
+		goto keep;
+	if (cmpxchg(&inode->i_exec_cache, old, c) != old)
+		goto keep;
+	if (old)
+		call_rcu(&old->rcu, exec_cache_free);
+	rcu_read_unlock();
+	return;
+keep:
+	rcu_read_unlock();
+	kfree(c);
+}
+EXPORT_SYMBOL(exec_cache_set);
+
+static bool exec_text_vma(struct vm_area_struct *vma, struct inode *inode)
+{
+	return vma->vm_file && file_inode(vma->vm_file) == inode &&
+	       (vma->vm_flags & VM_EXEC);
+}
+
+/*
+ * Map the pages of @file recorded as hot into the text mappings of it that
+ * the current exec set up.  Faulting them in here takes a single pass
+ * under mmap_sem, and lets fault-around map their neighbours in batches.
+ */
+void exec_cache_prefault(struct file *file)
+{
+	struct inode *inode = file_inode(file);
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	struct exec_cache *c;
+	struct exec_hot *hot = NULL;
+
+	if (!sysctl_exec_prefault)
+		return;
+
+	rcu_read_lock();
+	c = rcu_dereference(inode->i_exec_cache);
+	if (c && c->hot && exec_cache_fresh(c, inode))
+		hot = kmemdup(c->hot, sizeof(*hot) +
+			      BITS_TO_LONGS(c->hot->nr) * sizeof(long),
+			      GFP_NOWAIT | __GFP_NOWARN);
+	rcu_read_unlock();
+	if (!hot)
+		return;
+
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		unsigned long pgoff, next, end;
+
+		if (!exec_text_vma(vma, inode) || vma->vm_pgoff >= hot->nr)
+			continue;
+		end = min(vma->vm_pgoff + vma_pages(vma), hot->nr);
+		pgoff = find_next_bit(hot->bits, end, vma->vm_pgoff);
+		while (pgoff < end) {
+			next = find_next_zero_bit(hot->bits, end, pgoff);
+			get_user_pages(current, mm, vma->vm_start +
+				       ((pgoff - vma->vm_pgoff) << PAGE_SHIFT),
+				       next - pgoff, 0, 0, NULL, NULL);
+			pgoff = find_next_bit(hot->bits, end, next);
+		}
+	}
+	up_read(&mm->mmap_sem);
+	kfree(hot);
+}
+EXPORT_SYMBOL(exec_cache_prefault);
+
+static int exec_hot_pte(pte_t *pte, unsigned long addr, unsigned long next,
+			struct mm_walk *walk)
+{
+	struct exec_hot *hot = walk->private;
+	struct page *page;
+	pgoff_t pgoff;
+
+	if (!pte_present(*pte))
+		return 0;
+	/* text a debugger or relocations wrote to is not the file's */
+	page = vm_normal_page(walk->vma, addr, *pte);
+	if (!page || PageAnon(page))
+		return 0;
+	pgoff = linear_page_index(walk->vma, addr);
+	if (pgoff < hot->nr)
+		__set_bit(pgoff, hot->bits);
+	return 0;
+}
+
+/*
+ * Record which pages of its executable the text mappings of @mm have
+ * mapped, unless the cache of the executable has that already.  Called
+ * from the last mmput(), before the mappings go away.
+ */
+void exec_cache_record(struct mm_struct *mm)
+{
+	struct mm_walk walk = {
+		.pte_entry	= exec_hot_pte,
+		.mm		= mm,
+	};
+	struct vm_area_struct *vma;
+	struct exec_cache *c;
+	struct exec_hot *hot;
+	struct file *exe_file;
+	struct inode *inode;
+	unsigned long nr;
+
+	if (!sysctl_exec_prefault)
+		return;
+	exe_file = get_mm_exe_file(mm);
+	if (!exe_file)
+		return;
+	inode = file_inode(exe_file);
+
+	rcu_read_lock();
+	c = rcu_dereference(inode->i_exec_cache);
+	nr = c && !c->hot ? DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE) : 0;
+	rcu_read_unlock();
+	if (!nr)
+		goto out;
+
+	nr = min(nr, EXEC_HOT_MAX_PAGES);
+	hot = kzalloc(sizeof(*hot) + BITS_TO_LONGS(nr) * sizeof(long),
+		      GFP_KERNEL | __GFP_NOWARN);
+	if (!hot)
+		goto out;
+	hot->nr = nr;
+	walk.private = hot;
+
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next)
+		if (exec_text_vma(vma, inode))
+			walk_page_vma(vma, &walk);
+	up_read(&mm->mmap_sem);
+
+	rcu_read_lock();
+	c = rcu_dereference(inode->i_exec_cache);
+	if (c && !bitmap_empty(hot->bits, nr) &&
+	    cmpxchg(&c->hot, NULL, hot) == NULL)
+		hot = NULL;
+	rcu_read_unlock();
+	kfree(hot);
+out:
+	fput(exe_file);
+}
+#endif /* CONFIG_EXEC_CACHE */
+
 void setup_new_exec(struct linux_binprm * bprm)
 {
 	arch_pick_mmap_layout(current->mm);
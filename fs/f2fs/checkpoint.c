@@ -14,6 +14,7 @@
 #include <linux/writeback.h>
 #include <linux/blkdev.h>
 #include <linux/f2fs_fs.h>
+#include <linux/kthread.h>
 #include <linux/pagevec.h>
 #include <linux/swap.h>
 
@@ -1149,6 +1150,104 @@ out:
 	trace_f2fs_write_checkpoint(sbi->sb, cpc->reason, "finish checkpoint");
 }
 
+static void __issue_checkpoint(struct f2fs_sb_info *sbi)
+{
+	struct cp_control cpc;
+
+	cpc.reason = __get_cp_reason(sbi);
+
+	mutex_lock(&sbi->gc_mutex);
+	write_checkpoint(sbi, &cpc);
+	mutex_unlock(&sbi->gc_mutex);
+}
+
+/*
+ * One checkpoint covers everybody who asked for one before it started, so
+ * the requests queued while the previous checkpoint was being written all
+ * get done by the next one.
+ */
+static int issue_checkpoint_thread(void *data)
+{
+	struct f2fs_sb_info *sbi = data;
+	struct ckpt_cmd_control *ccc = sbi->ckpt_control_info;
+	wait_queue_head_t *q = &ccc->ckpt_wait_queue;
+repeat:
+	if (!llist_empty(&ccc->issue_list)) {
+		struct ckpt_cmd *cmd, *next;
+
+		ccc->dispatch_list = llist_del_all(&ccc->issue_list);
+
+		__issue_checkpoint(sbi);
+
+		llist_for_each_entry_safe(cmd, next,
+					  ccc->dispatch_list, llnode)
+			complete(&cmd->wait);
+		ccc->dispatch_list = NULL;
+	}
+
+	/* don't leave anybody waiting behind */
+	if (kthread_should_stop() && llist_empty(&ccc->issue_list))
+		return 0;
+
+	wait_event_interruptible(*q,
+		kthread_should_stop() || !llist_empty(&ccc->issue_list));
+	goto repeat;
+}
+
+void f2fs_issue_checkpoint(struct f2fs_sb_info *sbi)
+{
+	struct ckpt_cmd_control *ccc = sbi->ckpt_control_info;
+	struct ckpt_cmd cmd;
+
+	if (!test_opt(sbi, CHECKPOINT_MERGE) || !ccc) {
+		__issue_checkpoint(sbi);
+		return;
+	}
+
+	init_completion(&cmd.wait);
+
+	llist_add(&cmd.llnode, &ccc->issue_list);
+
+	if (!ccc->dispatch_list)
+		wake_up(&ccc->ckpt_wait_queue);
+
+	wait_for_completion(&cmd.wait);
+}
+
+int create_ckpt_cmd_control(struct f2fs_sb_info *sbi)
+{
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
+	struct ckpt_cmd_control *ccc;
+	int err;
+
+	ccc = kzalloc(sizeof(struct ckpt_cmd_control), GFP_KERNEL);
+	if (!ccc)
+		return -ENOMEM;
+	init_waitqueue_head(&ccc->ckpt_wait_queue);
+	init_llist_head(&ccc->issue_list);
+	sbi->ckpt_control_info = ccc;
+	ccc->f2fs_issue_ckpt = kthread_run(issue_checkpoint_thread, sbi,
+				"f2fs_ckpt-%u:%u", MAJOR(dev), MINOR(dev));
+	if (IS_ERR(ccc->f2fs_issue_ckpt)) {
+		err = PTR_ERR(ccc->f2fs_issue_ckpt);
+		kfree(ccc);
+		sbi->ckpt_control_info = NULL;
+		return err;
+	}
+
+	return 0;
+}
+
+void destroy_ckpt_cmd_control(struct f2fs_sb_info *sbi)
+{
+	struct ckpt_cmd_control *ccc = sbi->ckpt_control_info;
+
+	if (ccc && ccc->f2fs_issue_ckpt)
+		kthread_stop(ccc->f2fs_issue_ckpt);
+	kfree(ccc);
+	sbi->ckpt_control_info = NULL;
+}
+
 void init_ino_entry_info(struct f2fs_sb_info *sbi)
 {
 	int i;
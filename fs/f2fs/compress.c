@@ -0,0 +1,781 @@
+/*
+ * fs/f2fs/compress.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/fs.h>
+#include <linux/f2fs_fs.h>
+#include <linux/bio.h>
+#include <linux/crypto.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/vmalloc.h>
+#include <linux/writeback.h>
+
+#include "f2fs.h"
+#include "node.h"
+#include "segment.h"
+
+/*
+ * The pages of a cluster are compressed together when the cluster is
+ * written back, and it is stored compressed if that saves a block at
+ * least; otherwise it goes out block by block as usual.  The compressed
+ * blocks are written synchronously before they get their address slots,
+ * so that a compressed cluster is never seen half written.
+ *
+ * Reading any page of a compressed cluster reads and decompresses all of
+ * it, and fills in the sibling pages which aren't cached yet.
+ */
+
+#define CLUSTER_BYTES		(F2FS_CLUSTER_SIZE << PAGE_CACHE_SHIFT)
+
+/* room for the header and the worst case of both algorithms */
+#define NR_CPAGES		(F2FS_CLUSTER_SIZE + 1)
+
+static const char * const f2fs_compress_names[F2FS_COMPRESS_MAX] = {
+	[F2FS_COMPRESS_LZO]	= "lzo",
+	[F2FS_COMPRESS_LZ4]	= "lz4",
+};
+
+static inline pgoff_t cluster_start(pgoff_t index)
+{
+	return index & ~((pgoff_t)F2FS_CLUSTER_SIZE - 1);
+}
+
+static inline bool is_real_blkaddr(block_t blkaddr)
+{
+	return blkaddr != NULL_ADDR && blkaddr != NEW_ADDR &&
+						blkaddr != COMPRESS_ADDR;
+}
+
+/* is the slot accounted in valid_block_count? */
+static inline bool is_counted_blkaddr(block_t blkaddr)
+{
+	return blkaddr != NULL_ADDR && blkaddr != COMPRESS_ADDR;
+}
+
+static struct crypto_comp *f2fs_compress_tfm(struct f2fs_sb_info *sbi,
+						unsigned int algorithm)
+{
+	struct crypto_comp *tfm, *old;
+
+	if (algorithm >= F2FS_COMPRESS_MAX)
+		return ERR_PTR(-EIO);
+
+	tfm = READ_ONCE(sbi->compress_tfm[algorithm]);
+	if (tfm)
+		return tfm;
+
+	tfm = crypto_alloc_comp(f2fs_compress_names[algorithm], 0, 0);
+	if (IS_ERR(tfm))
+		return tfm;
+
+	old = cmpxchg(&sbi->compress_tfm[algorithm], NULL, tfm);
+	if (old) {
+		crypto_free_comp(tfm);
+		tfm = old;
+	}
+	return tfm;
+}
+
+void f2fs_destroy_compress(struct f2fs_sb_info *sbi)
+{
+	int i;
+
+	for (i = 0; i < F2FS_COMPRESS_MAX; i++)
+		if (sbi->compress_tfm[i])
+			crypto_free_comp(sbi->compress_tfm[i]);
+}
+
+int f2fs_parse_compress_algorithm(struct f2fs_sb_info *sbi, const char *name)
+{
+	int i;
+
+	for (i = 0; i < F2FS_COMPRESS_MAX; i++) {
+		if (!strcmp(name, f2fs_compress_names[i])) {
+			sbi->mount_opt.compress_algorithm = i;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+const char *f2fs_compress_algorithm_name(struct f2fs_sb_info *sbi)
+{
+	return f2fs_compress_names[sbi->mount_opt.compress_algorithm];
+}
+
+static void f2fs_free_pages(struct page **pages, int nr)
+{
+	while (nr--)
+		__free_page(pages[nr]);
+}
+
+static int f2fs_alloc_pages(struct page **pages, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		pages[i] = alloc_page(GFP_NOFS | __GFP_ZERO);
+		if (!pages[i]) {
+			f2fs_free_pages(pages, i);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/* synchronous IO of @nr blocks at @blkaddr[] from or into @pages[] */
+static int f2fs_cluster_io(struct f2fs_sb_info *sbi, int rw,
+			block_t *blkaddr, struct page **pages, int nr)
+{
+	struct bio *bio = NULL;
+	int i, err = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (bio && blkaddr[i] != blkaddr[i - 1] + 1) {
+			err = submit_bio_wait(rw, bio);
+			bio_put(bio);
+			bio = NULL;
+			if (err)
+				return err;
+		}
+		if (!bio) {
+			bio = f2fs_bio_alloc(nr - i);
+			bio->bi_bdev = sbi->sb->s_bdev;
+			bio->bi_iter.bi_sector = SECTOR_FROM_BLOCK(blkaddr[i]);
+		}
+		bio_add_page(bio, pages[i], PAGE_CACHE_SIZE, 0);
+	}
+	if (bio) {
+		err = submit_bio_wait(rw, bio);
+		bio_put(bio);
+	}
+	return err;
+}
+
+/*
+ * Decompress the cluster whose address slots are @blkaddr[] into @pages[],
+ * F2FS_CLUSTER_SIZE of them.
+ */
+static int f2fs_decompress_cluster(struct f2fs_sb_info *sbi,
+				block_t *blkaddr, struct page **pages)
+{
+	struct page *cpages[F2FS_CLUSTER_SIZE - 1];
+	struct f2fs_compress_header *hdr;
+	struct crypto_comp *tfm;
+	void *src = NULL, *dst = NULL;
+	unsigned int dlen = CLUSTER_BYTES, clen;
+	int nr, i, err;
+
+	for (nr = 0; nr < F2FS_CLUSTER_SIZE - 1; nr++)
+		if (!is_real_blkaddr(blkaddr[nr + 1]))
+			break;
+	if (!nr)
+		return -EIO;
+
+	err = f2fs_alloc_pages(cpages, nr);
+	if (err)
+		return err;
+
+	/* wait for GCed blocks to be written */
+	for (i = 0; i < nr; i++)
+		f2fs_wait_on_encrypted_page_writeback(sbi, blkaddr[i + 1]);
+
+	err = f2fs_cluster_io(sbi, READ_SYNC, blkaddr + 1, cpages, nr);
+	if (err)
+		goto out;
+
+	err = -ENOMEM;
+	src = vmap(cpages, nr, VM_MAP, PAGE_KERNEL);
+	dst = vmap(pages, F2FS_CLUSTER_SIZE, VM_MAP, PAGE_KERNEL);
+	if (!src || !dst)
+		goto out;
+
+	err = -EIO;
+	hdr = src;
+	clen = le32_to_cpu(hdr->clen);
+	if (hdr->log_cluster_size != F2FS_LOG_CLUSTER_SIZE ||
+			clen > (nr << PAGE_CACHE_SHIFT) - sizeof(*hdr)) {
+		f2fs_msg(sbi->sb, KERN_ERR,
+			"corrupted compressed cluster at block %u", blkaddr[1]);
+		goto out;
+	}
+
+	tfm = f2fs_compress_tfm(sbi, hdr->algorithm);
+	if (IS_ERR(tfm)) {
+		err = PTR_ERR(tfm);
+		goto out;
+	}
+
+	/* decompression keeps no state in the tfm, it needs no lock */
+	if (crypto_comp_decompress(tfm, src + sizeof(*hdr), clen, dst, &dlen))
+		goto out;
+
+	memset(dst + dlen, 0, CLUSTER_BYTES - dlen);
+	flush_kernel_vmap_range(dst, CLUSTER_BYTES);
+	err = 0;
+out:
+	if (dst)
+		vunmap(dst);
+	if (src)
+		vunmap(src);
+	f2fs_free_pages(cpages, nr);
+	return err;
+}
+
+/*
+ * Compress the first @nr_pages of a cluster into @cpages[].  Returns how
+ * many blocks that takes, or 0 if the cluster is better stored as is.
+ */
+static int f2fs_compress_cluster(struct f2fs_sb_info *sbi,
+				struct page **pages, unsigned int nr_pages,
+				struct page **cpages)
+{
+	unsigned int algorithm = sbi->mount_opt.compress_algorithm;
+	struct f2fs_compress_header *hdr;
+	unsigned int clen;
+	struct crypto_comp *tfm;
+	void *src = NULL, *dst = NULL;
+	int nc = 0, err;
+
+	tfm = f2fs_compress_tfm(sbi, algorithm);
+	if (IS_ERR(tfm))
+		return 0;
+
+	if (f2fs_alloc_pages(cpages, NR_CPAGES))
+		return 0;
+
+	src = vmap(pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	dst = vmap(cpages, NR_CPAGES, VM_MAP, PAGE_KERNEL);
+	if (!src || !dst)
+		goto out;
+
+	clen = (NR_CPAGES << PAGE_CACHE_SHIFT) - sizeof(*hdr);
+	mutex_lock(&sbi->compress_mutex);
+	err = crypto_comp_compress(tfm, src, nr_pages << PAGE_CACHE_SHIFT,
+					dst + sizeof(*hdr), &clen);
+	mutex_unlock(&sbi->compress_mutex);
+	if (err)
+		goto out;
+
+	nc = DIV_ROUND_UP(sizeof(*hdr) + clen, PAGE_CACHE_SIZE);
+	if (nc >= nr_pages) {
+		nc = 0;
+		goto out;
+	}
+
+	hdr = dst;
+	hdr->clen = cpu_to_le32(clen);
+	hdr->algorithm = algorithm;
+	hdr->log_cluster_size = F2FS_LOG_CLUSTER_SIZE;
+	memset(hdr->reserved, 0, sizeof(hdr->reserved));
+	memset(dst + sizeof(*hdr) + clen, 0,
+			(nc << PAGE_CACHE_SHIFT) - sizeof(*hdr) - clen);
+	flush_kernel_vmap_range(dst, nc << PAGE_CACHE_SHIFT);
+out:
+	if (dst)
+		vunmap(dst);
+	if (src)
+		vunmap(src);
+	f2fs_free_pages(cpages + nc, NR_CPAGES - nc);
+	return nc;
+}
+
+/*
+ * Read the cluster of the locked @page, along with the siblings we can
+ * lock without waiting.  If the cluster isn't compressed, -EAGAIN is
+ * returned with @page still locked, to be read block by block; otherwise
+ * @page is unlocked.
+ */
+int f2fs_read_compressed_page(struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+	struct inode *inode = mapping->host;
+	pgoff_t start = cluster_start(page->index);
+	pgoff_t end_index = DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE);
+	struct page *pages[F2FS_CLUSTER_SIZE] = { NULL, };
+	bool scratch[F2FS_CLUSTER_SIZE] = { false, };
+	block_t blkaddr[F2FS_CLUSTER_SIZE];
+	struct dnode_of_data dn;
+	int i, err;
+
+	set_new_dnode(&dn, inode, NULL, NULL, 0);
+	err = get_dnode_of_data(&dn, page->index, LOOKUP_NODE);
+	if (err) {
+		if (err == -ENOENT)
+			return -EAGAIN;
+		SetPageError(page);
+		unlock_page(page);
+		return err;
+	}
+
+	if (!f2fs_cluster_is_compressed(&dn, page->index)) {
+		f2fs_put_dnode(&dn);
+		return -EAGAIN;
+	}
+
+	dn.ofs_in_node -= page->index - start;
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++)
+		blkaddr[i] = datablock_addr(dn.node_page, dn.ofs_in_node + i);
+	f2fs_put_dnode(&dn);
+
+	pages[page->index - start] = page;
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++) {
+		struct page *p = NULL;
+
+		if (pages[i])
+			continue;
+
+		if (start + i < end_index) {
+			p = grab_cache_page_nowait(mapping, start + i);
+			if (p && PageUptodate(p)) {
+				f2fs_put_page(p, 1);
+				p = NULL;
+			}
+		}
+		if (!p) {
+			p = alloc_page(GFP_NOFS);
+			if (!p) {
+				err = -ENOMEM;
+				break;
+			}
+			scratch[i] = true;
+		}
+		pages[i] = p;
+	}
+
+	if (!err)
+		err = f2fs_decompress_cluster(F2FS_I_SB(inode), blkaddr, pages);
+
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++) {
+		if (!pages[i])
+			continue;
+		if (scratch[i]) {
+			__free_page(pages[i]);
+			continue;
+		}
+		if (err)
+			SetPageError(pages[i]);
+		else
+			SetPageUptodate(pages[i]);
+		unlock_page(pages[i]);
+		if (pages[i] != page)
+			page_cache_release(pages[i]);
+	}
+	return err;
+}
+
+/* read those of the locked pages of a cluster which aren't uptodate */
+static int f2fs_read_locked_cluster(struct inode *inode, pgoff_t start,
+				struct page **pages, unsigned int nr_pages)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	struct page *dst[F2FS_CLUSTER_SIZE] = { NULL, };
+	bool scratch[F2FS_CLUSTER_SIZE] = { false, };
+	block_t blkaddr[F2FS_CLUSTER_SIZE];
+	struct dnode_of_data dn;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < nr_pages; i++)
+		if (!PageUptodate(pages[i]))
+			break;
+	if (i == nr_pages)
+		return 0;
+
+	set_new_dnode(&dn, inode, NULL, NULL, 0);
+	err = get_dnode_of_data(&dn, start, LOOKUP_NODE);
+	if (err && err != -ENOENT)
+		return err;
+
+	if (err || !f2fs_cluster_is_compressed(&dn, start)) {
+		if (!err)
+			f2fs_put_dnode(&dn);
+		goto raw;
+	}
+
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++)
+		blkaddr[i] = datablock_addr(dn.node_page, dn.ofs_in_node + i);
+	f2fs_put_dnode(&dn);
+
+	/* the pages we have are newer than what's on disk */
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++) {
+		if (i < nr_pages && !PageUptodate(pages[i])) {
+			dst[i] = pages[i];
+			continue;
+		}
+		dst[i] = alloc_page(GFP_NOFS);
+		if (!dst[i]) {
+			err = -ENOMEM;
+			break;
+		}
+		scratch[i] = true;
+	}
+
+	if (!err)
+		err = f2fs_decompress_cluster(sbi, blkaddr, dst);
+
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++) {
+		if (!dst[i])
+			break;
+		if (scratch[i])
+			__free_page(dst[i]);
+		else if (!err)
+			SetPageUptodate(dst[i]);
+	}
+	return err;
+
+raw:
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page = pages[i];
+
+		if (PageUptodate(page))
+			continue;
+
+		set_new_dnode(&dn, inode, NULL, NULL, 0);
+		err = get_dnode_of_data(&dn, start + i, LOOKUP_NODE);
+		if (err && err != -ENOENT)
+			return err;
+		blkaddr[i] = err ? NULL_ADDR : dn.data_blkaddr;
+		if (!err)
+			f2fs_put_dnode(&dn);
+
+		if (is_real_blkaddr(blkaddr[i])) {
+			err = f2fs_cluster_io(sbi, READ_SYNC, &blkaddr[i],
+								&page, 1);
+			if (err)
+				return err;
+		} else {
+			zero_user_segment(page, 0, PAGE_CACHE_SIZE);
+		}
+		SetPageUptodate(page);
+	}
+	return 0;
+}
+
+/*
+ * Give the cluster at @dn the compressed blocks in @cpages[], and free up
+ * what it had.
+ */
+static int f2fs_store_compressed(struct dnode_of_data *dn, struct page *page,
+					struct page **cpages, int nc)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(dn->inode);
+	unsigned int base = dn->ofs_in_node;
+	block_t old[F2FS_CLUSTER_SIZE], new[F2FS_CLUSTER_SIZE];
+	struct f2fs_summary sum;
+	struct node_info ni;
+	int i, type, nr_inc = 0, nr_dec = 0, err;
+
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++) {
+		old[i] = datablock_addr(dn->node_page, base + i);
+		if (i == 0)
+			new[i] = COMPRESS_ADDR;
+		else if (i <= nc)
+			new[i] = NEW_ADDR;
+		else
+			new[i] = NULL_ADDR;
+
+		if (is_counted_blkaddr(new[i]) && !is_counted_blkaddr(old[i]))
+			nr_inc++;
+		else if (!is_counted_blkaddr(new[i]) &&
+					is_counted_blkaddr(old[i]))
+			nr_dec++;
+	}
+
+	if (nr_inc && !inc_valid_block_count(sbi, dn->inode, nr_inc))
+		return -ENOSPC;
+
+	type = get_data_segment_type(page);
+	get_node_info(sbi, dn->nid, &ni);
+	for (i = 1; i <= nc; i++) {
+		set_summary(&sum, dn->nid, base + i, ni.version);
+		allocate_data_block(sbi, NULL,
+				is_real_blkaddr(old[i]) ? old[i] : NEW_ADDR,
+				&new[i], &sum, type);
+	}
+
+	err = f2fs_cluster_io(sbi, WRITE_SYNC, new + 1, cpages, nc);
+	if (err) {
+		set_bit(AS_EIO, &dn->inode->i_mapping->flags);
+		f2fs_stop_checkpoint(sbi);
+	}
+
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++) {
+		if ((i == 0 || i > nc) && is_real_blkaddr(old[i]))
+			invalidate_blocks(sbi, old[i]);
+		if (new[i] == old[i])
+			continue;
+		dn->ofs_in_node = base + i;
+		dn->data_blkaddr = new[i];
+		set_data_blkaddr(dn);
+	}
+	dn->ofs_in_node = base;
+
+	if (nr_dec)
+		dec_valid_block_count(sbi, dn->inode, nr_dec);
+	if (nr_inc || nr_dec) {
+		mark_inode_dirty(dn->inode);
+		sync_inode_page(dn);
+	}
+	return err;
+}
+
+/*
+ * The cluster at @dn is to be written block by block.  If it was stored
+ * compressed, turn its slots back into reserved ones first; returns 1 if
+ * so, as then all of its pages have to be written.
+ */
+static int f2fs_store_raw(struct dnode_of_data *dn, unsigned int nr_pages)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(dn->inode);
+	unsigned int base = dn->ofs_in_node;
+	block_t old, new;
+	int i, nr_inc = 0, nr_dec = 0;
+
+	if (datablock_addr(dn->node_page, base) != COMPRESS_ADDR)
+		return 0;
+
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++) {
+		old = datablock_addr(dn->node_page, base + i);
+		new = i < nr_pages ? NEW_ADDR : NULL_ADDR;
+
+		if (is_counted_blkaddr(new) && !is_counted_blkaddr(old))
+			nr_inc++;
+		else if (!is_counted_blkaddr(new) && is_counted_blkaddr(old))
+			nr_dec++;
+	}
+
+	if (nr_inc && !inc_valid_block_count(sbi, dn->inode, nr_inc))
+		return -ENOSPC;
+
+	for (i = 0; i < F2FS_CLUSTER_SIZE; i++) {
+		old = datablock_addr(dn->node_page, base + i);
+		new = i < nr_pages ? NEW_ADDR : NULL_ADDR;
+
+		if (is_real_blkaddr(old))
+			invalidate_blocks(sbi, old);
+		if (new == old)
+			continue;
+		dn->ofs_in_node = base + i;
+		dn->data_blkaddr = new;
+		set_data_blkaddr(dn);
+	}
+	dn->ofs_in_node = base;
+
+	if (nr_dec)
+		dec_valid_block_count(sbi, dn->inode, nr_dec);
+	mark_inode_dirty(dn->inode);
+	sync_inode_page(dn);
+	return 1;
+}
+
+/* write @page and the @dirty siblings, or @all of them, block by block */
+static int f2fs_write_raw_pages(struct page *page, struct page **pages,
+				unsigned int nr_pages, bool *dirty, bool all,
+				struct writeback_control *wbc)
+{
+	struct f2fs_io_info fio = {
+		.sbi = F2FS_P_SB(page),
+		.type = DATA,
+		.rw = (wbc->sync_mode == WB_SYNC_ALL) ? WRITE_SYNC : WRITE,
+	};
+	unsigned int i;
+	int err, ret = 0;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (pages[i] != page && !dirty[i] && !all)
+			continue;
+
+		fio.page = pages[i];
+		fio.encrypted_page = NULL;
+		err = do_write_data_page(&fio);
+		if (err && err != -ENOENT) {
+			if (pages[i] == page)
+				ret = err;
+			else
+				dirty[i] = true;
+			continue;
+		}
+		dirty[i] = false;
+		clear_cold_data(pages[i]);
+	}
+	return ret;
+}
+
+/*
+ * Write the cluster of @page out, compressed if that saves a block.  This
+ * is called by ->writepage with @page locked and cleaned, and @page is
+ * locked again on return; in between, it is unlocked so that the pages
+ * of the cluster can be locked in ascending order.
+ */
+int f2fs_write_compressed_page(struct page *page,
+				struct writeback_control *wbc)
+{
+	struct address_space *mapping = page->mapping;
+	struct inode *inode = mapping->host;
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	loff_t i_size = i_size_read(inode);
+	pgoff_t start = cluster_start(page->index);
+	pgoff_t end_index = DIV_ROUND_UP(i_size, PAGE_CACHE_SIZE);
+	unsigned int ofs = page->index - start, offset, nr_pages, i;
+	struct page *pages[F2FS_CLUSTER_SIZE] = { NULL, };
+	bool dirty[F2FS_CLUSTER_SIZE] = { false, };
+	struct page *cpages[NR_CPAGES];
+	struct dnode_of_data dn;
+	int nc = 0, err = 0;
+
+	if (page->index >= end_index)
+		return 0;
+	nr_pages = min_t(pgoff_t, F2FS_CLUSTER_SIZE, end_index - start);
+
+	unlock_page(page);
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = f2fs_grab_cache_page(mapping, start + i, true);
+		if (!pages[i]) {
+			err = -ENOMEM;
+			goto out;
+		}
+		f2fs_wait_on_page_writeback(pages[i], DATA);
+	}
+
+	/* truncated while it was unlocked */
+	if (pages[ofs] != page)
+		goto out;
+
+	err = f2fs_read_locked_cluster(inode, start, pages, nr_pages);
+	if (err)
+		goto out;
+
+	/* this write-protects what's mapped, so no one dirties it behind us */
+	for (i = 0; i < nr_pages; i++) {
+		if (pages[i] != page && clear_page_dirty_for_io(pages[i])) {
+			dirty[i] = true;
+			inode_dec_dirty_pages(inode);
+		}
+	}
+
+	/* what's past EOF is stored, and read back, as zeroes */
+	offset = i_size & (PAGE_CACHE_SIZE - 1);
+	if (offset && start + nr_pages == end_index)
+		zero_user_segment(pages[nr_pages - 1], offset, PAGE_CACHE_SIZE);
+
+	if (nr_pages > 1)
+		nc = f2fs_compress_cluster(sbi, pages, nr_pages, cpages);
+
+	f2fs_lock_op(sbi);
+	set_new_dnode(&dn, inode, NULL, NULL, 0);
+	err = get_dnode_of_data(&dn, start, ALLOC_NODE);
+	if (err)
+		goto unlock;
+
+	/* a cluster running into the next dnode is never compressed */
+	if (dn.ofs_in_node + F2FS_CLUSTER_SIZE >
+			ADDRS_PER_PAGE(dn.node_page, F2FS_I(inode))) {
+		f2fs_put_dnode(&dn);
+		err = f2fs_write_raw_pages(page, pages, nr_pages, dirty,
+								false, wbc);
+		goto unlock;
+	}
+
+	if (nc) {
+		err = f2fs_store_compressed(&dn, page, cpages, nc);
+		f2fs_put_dnode(&dn);
+		if (err)
+			goto unlock;
+
+		for (i = 0; i < nr_pages; i++) {
+			dirty[i] = false;
+			clear_cold_data(pages[i]);
+		}
+		set_inode_flag(F2FS_I(inode), FI_APPEND_WRITE);
+		if (start == 0)
+			set_inode_flag(F2FS_I(inode), FI_FIRST_BLOCK_WRITTEN);
+		goto unlock;
+	}
+
+	err = f2fs_store_raw(&dn, nr_pages);
+	f2fs_put_dnode(&dn);
+	if (err >= 0)
+		err = f2fs_write_raw_pages(page, pages, nr_pages, dirty,
+								err > 0, wbc);
+unlock:
+	f2fs_unlock_op(sbi);
+	f2fs_free_pages(cpages, nc);
+out:
+	for (i = 0; i < nr_pages && pages[i]; i++) {
+		if (pages[i] == page) {
+			page_cache_release(page);
+			continue;
+		}
+		if (dirty[i])
+			set_page_dirty(pages[i]);
+		f2fs_put_page(pages[i], 1);
+	}
+	if (pages[ofs] != page)
+		lock_page(page);
+	return err;
+}
+
+/*
+ * Truncating into a compressed cluster keeps its blocks, so it is written
+ * again first with what is left of it, and zeroes after @from.
+ */
+int f2fs_truncate_compressed_cluster(struct inode *inode, u64 from)
+{
+	pgoff_t index = from >> PAGE_CACHE_SHIFT;
+	pgoff_t start = cluster_start(index), i;
+	unsigned int offset = from & (PAGE_CACHE_SIZE - 1);
+	struct dnode_of_data dn;
+	struct page *page;
+	bool compressed;
+	int err;
+
+	if (index == start && !offset)
+		return 0;
+
+	set_new_dnode(&dn, inode, NULL, NULL, 0);
+	err = get_dnode_of_data(&dn, start, LOOKUP_NODE);
+	if (err)
+		return err == -ENOENT ? 0 : err;
+	compressed = f2fs_cluster_is_compressed(&dn, start);
+	f2fs_put_dnode(&dn);
+	if (!compressed)
+		return 0;
+
+	for (i = start; i < index || (i == index && offset); i++) {
+		page = get_lock_data_page(inode, i, true);
+		if (IS_ERR(page))
+			return PTR_ERR(page);
+		f2fs_wait_on_page_writeback(page, DATA);
+		if (i == index)
+			zero_user_segment(page, offset, PAGE_CACHE_SIZE);
+		set_page_dirty(page);
+		f2fs_put_page(page, 1);
+	}
+
+	return filemap_write_and_wait_range(inode->i_mapping,
+				(loff_t)start << PAGE_CACHE_SHIFT, from - 1);
+}
+
+/* truncate_blocks() must not free the blocks of a compressed cluster */
+pgoff_t f2fs_compressed_free_from(struct inode *inode, pgoff_t free_from)
+{
+	pgoff_t start = cluster_start(free_from);
+	struct dnode_of_data dn;
+	bool compressed;
+
+	if (free_from == start)
+		return free_from;
+
+	set_new_dnode(&dn, inode, NULL, NULL, 0);
+	if (get_dnode_of_data(&dn, start, LOOKUP_NODE))
+		return free_from;
+	compressed = f2fs_cluster_is_compressed(&dn, start);
+	f2fs_put_dnode(&dn);
+
+	return compressed ? start + F2FS_CLUSTER_SIZE : free_from;
+}
@@ -12,6 +12,7 @@
 #include <keys/encrypted-type.h>
 #include <keys/user-type.h>
 #include <linux/random.h>
+#include <linux/blkdev.h>
 #include <linux/scatterlist.h>
 #include <uapi/linux/keyctl.h>
 #include <crypto/hash.h>
@@ -94,6 +95,12 @@ static void f2fs_free_crypt_info(struct f2fs_crypt_info *ci)
 
 	key_put(ci->ci_keyring_key);
 	crypto_free_ablkcipher(ci->ci_ctfm);
+#ifdef CONFIG_BLK_INLINE_ENCRYPTION
+	if (ci->ci_bc_key) {
+		blk_crypto_free_key(ci->ci_bc_key);
+		kfree(ci->ci_bc_key);
+	}
+#endif
 	kmem_cache_free(f2fs_crypt_info_cachep, ci);
 }
 
@@ -113,6 +120,54 @@ void f2fs_free_encryption_info(struct inode *inode, struct f2fs_crypt_info *ci)
 	f2fs_free_crypt_info(ci);
 }
 
+#ifdef CONFIG_BLK_INLINE_ENCRYPTION
+/*
+ * With "inlinecrypt" the contents of regular files are handed to the block
+ * layer in plaintext together with the key, which en/decrypts them on the
+ * way to and from the device, either in the device's inline encryption
+ * engine or in software.  The tweak is the page index just as with
+ * f2fs_page_crypto(), so both produce the same on-disk format.
+ */
+static int f2fs_setup_inline_crypt(struct inode *inode,
+				   struct f2fs_crypt_info *ci, char mode,
+				   const char *raw_key)
+{
+	struct super_block *sb = inode->i_sb;
+	struct blk_crypto_key *key;
+	int res;
+
+	if (!test_opt(F2FS_SB(sb), INLINECRYPT) || !S_ISREG(inode->i_mode) ||
+	    mode != F2FS_ENCRYPTION_MODE_AES_256_XTS)
+		return 0;
+
+	key = kmalloc(sizeof(*key), GFP_NOFS);
+	if (!key)
+		return -ENOMEM;
+
+	res = blk_crypto_init_key(key, raw_key, F2FS_AES_256_XTS_KEY_SIZE,
+				  BLK_ENCRYPTION_MODE_AES_256_XTS,
+				  PAGE_CACHE_SIZE);
+	if (!res)
+		res = blk_crypto_start_using_key(key,
+						 bdev_get_queue(sb->s_bdev));
+	if (res) {
+		blk_crypto_free_key(key);
+		kfree(key);
+		return res;
+	}
+
+	ci->ci_bc_key = key;
+	return 0;
+}
+#else
+static inline int f2fs_setup_inline_crypt(struct inode *inode,
+					  struct f2fs_crypt_info *ci, char mode,
+					  const char *raw_key)
+{
+	return 0;
+}
+#endif
+
 int _f2fs_get_encryption_info(struct inode *inode)
 {
 	struct f2fs_inode_info *fi = F2FS_I(inode);
@@ -160,6 +215,9 @@ retry:
 	crypt_info->ci_filename_mode = ctx.filenames_encryption_mode;
 	crypt_info->ci_ctfm = NULL;
 	crypt_info->ci_keyring_key = NULL;
+#ifdef CONFIG_BLK_INLINE_ENCRYPTION
+	crypt_info->ci_bc_key = NULL;
+#endif
 	memcpy(crypt_info->ci_master_key, ctx.master_key_descriptor,
 				sizeof(crypt_info->ci_master_key));
 	if (S_ISREG(inode->i_mode))
@@ -230,6 +288,10 @@ retry:
 	if (res)
 		goto out;
 
+	res = f2fs_setup_inline_crypt(inode, crypt_info, mode, raw_key);
+	if (res)
+		goto out;
+
 	memzero_explicit(raw_key, sizeof(raw_key));
 	if (cmpxchg(&fi->i_crypt_info, NULL, crypt_info) != NULL) {
 		f2fs_free_crypt_info(crypt_info);
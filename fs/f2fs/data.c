@@ -138,6 +138,19 @@ void f2fs_submit_merged_bio(struct f2fs_sb_info *sbi,
 	up_write(&io->io_rwsem);
 }
 
+/*
+ * The block layer key to en/decrypt a data page of an "inlinecrypt" file
+ * with.  Pages that are moved as ciphertext by GC come with their
+ * encrypted_page and get none.
+ */
+static const struct blk_crypto_key *fio_inline_crypt_key(
+						struct f2fs_io_info *fio)
+{
+	if (fio->type != DATA || fio->encrypted_page || !fio->page->mapping)
+		return NULL;
+	return f2fs_inline_crypt_key(fio->page->mapping->host);
+}
+
 /*
  * Fill the locked page with data located in the block address.
  * Return unlocked page.
@@ -146,6 +159,7 @@ int f2fs_submit_page_bio(struct f2fs_io_info *fio)
 {
 	struct bio *bio;
 	struct page *page = fio->encrypted_page ? fio->encrypted_page : fio->page;
+	const struct blk_crypto_key *key = fio_inline_crypt_key(fio);
 
 	trace_f2fs_submit_page_bio(page, fio);
 	f2fs_trace_ios(fio, 0);
@@ -157,6 +171,8 @@ int f2fs_submit_page_bio(struct f2fs_io_info *fio)
 		bio_put(bio);
 		return -EFAULT;
 	}
+	if (key)
+		bio_crypt_set_ctx(bio, key, fio->page->index, GFP_NOIO);
 
 	submit_bio(fio->rw, bio);
 	return 0;
@@ -168,6 +184,7 @@ void f2fs_submit_page_mbio(struct f2fs_io_info *fio)
 	enum page_type btype = PAGE_TYPE_OF_BIO(fio->type);
 	struct f2fs_bio_info *io;
 	bool is_read = is_read_io(fio->rw);
+	const struct blk_crypto_key *key = fio_inline_crypt_key(fio);
 	struct page *bio_page;
 
 	io = is_read ? &sbi->read_io : &sbi->write_io[btype];
@@ -180,7 +197,8 @@ void f2fs_submit_page_mbio(struct f2fs_io_info *fio)
 		inc_page_count(sbi, F2FS_WRITEBACK);
 
 	if (io->bio && (io->last_block_in_bio != fio->blk_addr - 1 ||
-						io->fio.rw != fio->rw))
+			io->fio.rw != fio->rw ||
+			!bio_crypt_can_append(io->bio, key, fio->page->index)))
 		__submit_merged_bio(io);
 alloc_new:
 	if (io->bio == NULL) {
@@ -188,6 +206,9 @@ alloc_new:
 
 		io->bio = __bio_alloc(sbi, fio->blk_addr, bio_blocks, is_read);
 		io->fio = *fio;
+		if (key)
+			bio_crypt_set_ctx(io->bio, key, fio->page->index,
+					  GFP_NOIO);
 	}
 
 	bio_page = fio->encrypted_page ? fio->encrypted_page : fio->page;
@@ -255,7 +276,9 @@ int f2fs_reserve_block(struct dnode_of_data *dn, pgoff_t index)
 	if (err)
 		return err;
 
-	if (dn->data_blkaddr == NULL_ADDR)
+	/* the blocks of a compressed cluster are found at writeback */
+	if (dn->data_blkaddr == NULL_ADDR &&
+			!f2fs_cluster_is_compressed(dn, index))
 		err = reserve_new_block(dn);
 	if (err || need_put)
 		f2fs_put_dnode(dn);
@@ -293,6 +316,9 @@ struct page *get_read_data_page(struct inode *inode, pgoff_t index,
 	if (f2fs_encrypted_inode(inode) && S_ISREG(inode->i_mode))
 		return read_mapping_page(mapping, index, NULL);
 
+	if (f2fs_compressed_inode(inode))
+		return read_mapping_page(mapping, index, NULL);
+
 	page = f2fs_grab_cache_page(mapping, index, for_write);
 	if (!page)
 		return ERR_PTR(-ENOMEM);
@@ -767,6 +793,9 @@ int f2fs_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 	bool past_eof = false, whole_file = false;
 	int ret = 0;
 
+	if (f2fs_compressed_inode(inode))
+		return -EOPNOTSUPP;
+
 	ret = fiemap_check_flags(fieinfo, FIEMAP_FLAG_SYNC);
 	if (ret)
 		return ret;
@@ -885,6 +914,7 @@ static int f2fs_mpage_readpages(struct address_space *mapping,
 	sector_t last_block_in_file;
 	sector_t block_nr;
 	struct block_device *bdev = inode->i_sb->s_bdev;
+	const struct blk_crypto_key *bc_key = f2fs_inline_crypt_key(inode);
 	struct f2fs_map_blocks map;
 
 	map.m_pblk = 0;
@@ -952,7 +982,8 @@ got_it:
 		 * This page will go to BIO.  Do we need to send this
 		 * BIO off first?
 		 */
-		if (bio && (last_block_in_bio != block_nr - 1)) {
+		if (bio && (last_block_in_bio != block_nr - 1 ||
+			    !bio_crypt_can_append(bio, bc_key, page->index))) {
 submit_and_realloc:
 			submit_bio(READ, bio);
 			bio = NULL;
@@ -963,9 +994,11 @@ submit_and_realloc:
 			if (f2fs_encrypted_inode(inode) &&
 					S_ISREG(inode->i_mode)) {
 
-				ctx = f2fs_get_crypto_ctx(inode);
-				if (IS_ERR(ctx))
-					goto set_error_page;
+				if (!bc_key) {
+					ctx = f2fs_get_crypto_ctx(inode);
+					if (IS_ERR(ctx))
+						goto set_error_page;
+				}
 
 				/* wait the page to be moved by cleaning */
 				f2fs_wait_on_encrypted_page_writeback(
@@ -983,6 +1016,9 @@ submit_and_realloc:
 			bio->bi_iter.bi_sector = SECTOR_FROM_BLOCK(block_nr);
 			bio->bi_end_io = f2fs_read_end_io;
 			bio->bi_private = ctx;
+			if (bc_key)
+				bio_crypt_set_ctx(bio, bc_key, page->index,
+						  GFP_KERNEL);
 		}
 
 		if (bio_add_page(bio, page, blocksize, 0) < blocksize)
@@ -1021,11 +1057,31 @@ static int f2fs_read_data_page(struct file *file, struct page *page)
 	/* If the file has inline data, try to read it directly */
 	if (f2fs_has_inline_data(inode))
 		ret = f2fs_read_inline_data(inode, page);
+	else if (f2fs_compressed_inode(inode))
+		ret = f2fs_read_compressed_page(page);
 	if (ret == -EAGAIN)
 		ret = f2fs_mpage_readpages(page->mapping, NULL, page, 1);
 	return ret;
 }
 
+/* readahead of a compressed file goes a cluster at a time */
+static int f2fs_read_compressed_pages(struct address_space *mapping,
+			struct list_head *pages, unsigned nr_pages)
+{
+	for (; nr_pages; nr_pages--) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+
+		list_del(&page->lru);
+		if (!add_to_page_cache_lru(page, mapping,
+					page->index, GFP_KERNEL)) {
+			if (f2fs_read_compressed_page(page) == -EAGAIN)
+				f2fs_mpage_readpages(mapping, NULL, page, 1);
+		}
+		page_cache_release(page);
+	}
+	return 0;
+}
+
 static int f2fs_read_data_pages(struct file *file,
 			struct address_space *mapping,
 			struct list_head *pages, unsigned nr_pages)
@@ -1039,6 +1095,9 @@ static int f2fs_read_data_pages(struct file *file,
 	if (f2fs_has_inline_data(inode))
 		return 0;
 
+	if (f2fs_compressed_inode(inode))
+		return f2fs_read_compressed_pages(mapping, pages, nr_pages);
+
 	return f2fs_mpage_readpages(mapping, pages, NULL, nr_pages);
 }
 
@@ -1068,10 +1127,12 @@ int do_write_data_page(struct f2fs_io_info *fio)
 		f2fs_wait_on_encrypted_page_writeback(F2FS_I_SB(inode),
 							fio->blk_addr);
 
-		fio->encrypted_page = f2fs_encrypt(inode, fio->page);
-		if (IS_ERR(fio->encrypted_page)) {
-			err = PTR_ERR(fio->encrypted_page);
-			goto out_writepage;
+		if (!f2fs_inline_crypt_key(inode)) {
+			fio->encrypted_page = f2fs_encrypt(inode, fio->page);
+			if (IS_ERR(fio->encrypted_page)) {
+				err = PTR_ERR(fio->encrypted_page);
+				goto out_writepage;
+			}
 		}
 	}
 
@@ -1162,6 +1223,14 @@ write:
 	else if (has_not_enough_free_secs(sbi, 0))
 		goto redirty_out;
 
+	/* a cluster is written as a whole, and not for reclaim */
+	if (f2fs_compressed_inode(inode)) {
+		if (wbc->for_reclaim)
+			goto redirty_out;
+		err = f2fs_write_compressed_page(page, wbc);
+		goto done;
+	}
+
 	err = -EAGAIN;
 	f2fs_lock_op(sbi);
 	if (f2fs_has_inline_data(inode))
@@ -1474,7 +1543,20 @@ put_next:
 		goto out_update;
 	}
 
-	if (dn.data_blkaddr == NEW_ADDR) {
+	if (f2fs_compressed_inode(inode)) {
+		err = f2fs_read_data_page(file, page);
+		lock_page(page);
+		if (err)
+			goto fail;
+		if (unlikely(!PageUptodate(page))) {
+			err = -EIO;
+			goto fail;
+		}
+		if (unlikely(page->mapping != mapping)) {
+			f2fs_put_page(page, 1);
+			goto repeat;
+		}
+	} else if (dn.data_blkaddr == NEW_ADDR) {
 		zero_user_segment(page, 0, PAGE_CACHE_SIZE);
 	} else {
 		struct f2fs_io_info fio = {
@@ -1500,7 +1582,8 @@ put_next:
 		}
 
 		/* avoid symlink page */
-		if (f2fs_encrypted_inode(inode) && S_ISREG(inode->i_mode)) {
+		if (f2fs_encrypted_inode(inode) && S_ISREG(inode->i_mode) &&
+		    !f2fs_inline_crypt_key(inode)) {
 			err = f2fs_decrypt_one(inode, page);
 			if (err)
 				goto fail;
@@ -1576,6 +1659,9 @@ static ssize_t f2fs_direct_IO(struct kiocb *iocb, struct iov_iter *iter,
 	if (f2fs_encrypted_inode(inode) && S_ISREG(inode->i_mode))
 		return 0;
 
+	if (f2fs_compressed_inode(inode))
+		return 0;
+
 	err = check_direct_IO(inode, iter, offset);
 	if (err)
 		return err;
@@ -1676,6 +1762,10 @@ static sector_t f2fs_bmap(struct address_space *mapping, sector_t block)
 	if (f2fs_has_inline_data(inode))
 		return 0;
 
+	/* no block of a compressed cluster is that of one page */
+	if (f2fs_compressed_inode(inode))
+		return 0;
+
 	/* make sure allocating whole blocks */
 	if (mapping_tagged(mapping, PAGECACHE_TAG_DIRTY))
 		filemap_write_and_wait(mapping);
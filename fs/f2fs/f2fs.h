@@ -21,6 +21,7 @@
 #include <linux/sched.h>
 #include <linux/vmalloc.h>
 #include <linux/bio.h>
+#include <linux/blk-crypto.h>
 
 #ifdef CONFIG_F2FS_CHECK_FS
 #define f2fs_bug_on(sbi, condition)	BUG_ON(condition)
@@ -54,6 +55,8 @@
 #define F2FS_MOUNT_FASTBOOT		0x00001000
 #define F2FS_MOUNT_EXTENT_CACHE		0x00002000
 #define F2FS_MOUNT_FORCE_FG_GC		0x00004000
+#define F2FS_MOUNT_CHECKPOINT_MERGE	0x00008000
+#define F2FS_MOUNT_INLINECRYPT		0x00010000
 
 #define clear_opt(sbi, option)	(sbi->mount_opt.opt &= ~F2FS_MOUNT_##option)
 #define set_opt(sbi, option)	(sbi->mount_opt.opt |= F2FS_MOUNT_##option)
@@ -71,6 +74,9 @@ typedef u32 nid_t;
 
 struct f2fs_mount_info {
 	unsigned int	opt;
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	unsigned int	compress_algorithm;	/* for the clusters written */
+#endif
 };
 
 #define F2FS_FEATURE_ENCRYPT	0x0001
@@ -598,6 +604,18 @@ struct flush_cmd_control {
 	struct llist_node *dispatch_list;	/* list for command dispatch */
 };
 
+struct ckpt_cmd {
+	struct completion wait;
+	struct llist_node llnode;
+};
+
+struct ckpt_cmd_control {
+	struct task_struct *f2fs_issue_ckpt;	/* checkpoint thread */
+	wait_queue_head_t ckpt_wait_queue;	/* waiting queue for wake-up */
+	struct llist_head issue_list;		/* list for command issue */
+	struct llist_node *dispatch_list;	/* list for command dispatch */
+};
+
 struct f2fs_sm_info {
 	struct sit_info *sit_info;		/* whole segment information */
 	struct free_segmap_info *free_info;	/* free segment information */
@@ -736,6 +754,10 @@ struct f2fs_sb_info {
 	struct rw_semaphore cp_rwsem;		/* blocking FS operations */
 	struct rw_semaphore node_write;		/* locking node writes */
 	struct mutex writepages;		/* mutex for writepages() */
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	struct crypto_comp *compress_tfm[F2FS_COMPRESS_MAX];
+	struct mutex compress_mutex;		/* the tfms don't share */
+#endif
 	wait_queue_head_t cp_wait;
 	long cp_expires, cp_interval;		/* next expected periodic cp */
 
@@ -787,6 +809,7 @@ struct f2fs_sb_info {
 	/* for cleaning operations */
 	struct mutex gc_mutex;			/* mutex for GC */
 	struct f2fs_gc_kthread	*gc_thread;	/* GC thread */
+	struct ckpt_cmd_control *ckpt_control_info;	/* checkpoint merging */
 	unsigned int cur_victim_sec;		/* current victim section num */
 
 	/* maximum # of trials to find a victim segment for SSR and GC */
@@ -1526,6 +1549,28 @@ static inline bool f2fs_is_atomic_file(struct inode *inode)
 	return is_inode_flag_set(F2FS_I(inode), FI_ATOMIC_FILE);
 }
 
+static inline bool f2fs_compressed_inode(struct inode *inode)
+{
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	return S_ISREG(inode->i_mode) &&
+			(F2FS_I(inode)->i_flags & FS_COMPR_FL);
+#else
+	return false;
+#endif
+}
+
+/* is the cluster of @index, whose dnode @dn is at, stored compressed? */
+static inline bool f2fs_cluster_is_compressed(struct dnode_of_data *dn,
+							pgoff_t index)
+{
+	unsigned int ofs = index & (F2FS_CLUSTER_SIZE - 1);
+
+	if (!f2fs_compressed_inode(dn->inode) || dn->ofs_in_node < ofs)
+		return false;
+	return datablock_addr(dn->node_page, dn->ofs_in_node - ofs) ==
+								COMPRESS_ADDR;
+}
+
 static inline bool f2fs_is_volatile_file(struct inode *inode)
 {
 	return is_inode_flag_set(F2FS_I(inode), FI_VOLATILE_FILE);
@@ -1608,6 +1653,10 @@ static inline bool f2fs_may_extent_tree(struct inode *inode)
 			is_inode_flag_set(F2FS_I(inode), FI_NO_EXTENT))
 		return false;
 
+	/* extents don't map compressed clusters */
+	if (f2fs_compressed_inode(inode))
+		return false;
+
 	return S_ISREG(mode);
 }
 
@@ -1789,6 +1838,7 @@ void write_data_page(struct dnode_of_data *, struct f2fs_io_info *);
 void rewrite_data_page(struct f2fs_io_info *);
 void f2fs_replace_block(struct f2fs_sb_info *, struct dnode_of_data *,
 				block_t, block_t, unsigned char, bool);
+int get_data_segment_type(struct page *);
 void allocate_data_block(struct f2fs_sb_info *, struct page *,
 		block_t, block_t *, struct f2fs_summary *, int);
 void f2fs_wait_on_page_writeback(struct page *, enum page_type);
@@ -1828,6 +1878,9 @@ void add_dirty_dir_inode(struct inode *);
 void remove_dirty_dir_inode(struct inode *);
 void sync_dirty_dir_inodes(struct f2fs_sb_info *);
 void write_checkpoint(struct f2fs_sb_info *, struct cp_control *);
+void f2fs_issue_checkpoint(struct f2fs_sb_info *);
+int create_ckpt_cmd_control(struct f2fs_sb_info *);
+void destroy_ckpt_cmd_control(struct f2fs_sb_info *);
 void init_ino_entry_info(struct f2fs_sb_info *);
 int __init create_checkpoint_caches(void);
 void destroy_checkpoint_caches(void);
@@ -2081,6 +2134,46 @@ void init_extent_cache_info(struct f2fs_sb_info *);
 int __init create_extent_cache(void);
 void destroy_extent_cache(void);
 
+/*
+ * compress.c
+ */
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+int f2fs_read_compressed_page(struct page *);
+int f2fs_write_compressed_page(struct page *, struct writeback_control *);
+int f2fs_truncate_compressed_cluster(struct inode *, u64);
+pgoff_t f2fs_compressed_free_from(struct inode *, pgoff_t);
+int f2fs_parse_compress_algorithm(struct f2fs_sb_info *, const char *);
+const char *f2fs_compress_algorithm_name(struct f2fs_sb_info *);
+void f2fs_destroy_compress(struct f2fs_sb_info *);
+
+static inline void f2fs_init_compress(struct f2fs_sb_info *sbi)
+{
+	mutex_init(&sbi->compress_mutex);
+}
+#else
+static inline int f2fs_read_compressed_page(struct page *page)
+{
+	return -EAGAIN;
+}
+static inline int f2fs_write_compressed_page(struct page *page,
+					struct writeback_control *wbc)
+{
+	return -EOPNOTSUPP;
+}
+static inline int f2fs_truncate_compressed_cluster(struct inode *inode,
+							u64 from)
+{
+	return 0;
+}
+static inline pgoff_t f2fs_compressed_free_from(struct inode *inode,
+							pgoff_t free_from)
+{
+	return free_from;
+}
+static inline void f2fs_init_compress(struct f2fs_sb_info *sbi) { }
+static inline void f2fs_destroy_compress(struct f2fs_sb_info *sbi) { }
+#endif
+
 /*
  * crypto support
  */
@@ -2129,6 +2222,22 @@ static inline bool f2fs_may_encrypt(struct inode *inode)
 #endif
 }
 
+/*
+ * The block layer key of a regular file whose contents are encrypted by
+ * the block layer ("inlinecrypt"), NULL if f2fs has to do it itself.
+ */
+static inline const struct blk_crypto_key *
+f2fs_inline_crypt_key(struct inode *inode)
+{
+#if defined(CONFIG_F2FS_FS_ENCRYPTION) && defined(CONFIG_BLK_INLINE_ENCRYPTION)
+	struct f2fs_crypt_info *ci = F2FS_I(inode)->i_crypt_info;
+
+	if (S_ISREG(inode->i_mode) && ci)
+		return ci->ci_bc_key;
+#endif
+	return NULL;
+}
+
 /* crypto_policy.c */
 int f2fs_is_child_context_consistent_with_parent(struct inode *,
 							struct inode *);
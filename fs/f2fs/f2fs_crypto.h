@@ -81,6 +81,10 @@ struct f2fs_crypt_info {
 	struct crypto_ablkcipher *ci_ctfm;
 	struct key	*ci_keyring_key;
 	char		ci_master_key[F2FS_KEY_DESCRIPTOR_SIZE];
+#ifdef CONFIG_BLK_INLINE_ENCRYPTION
+	/* set when the contents are en/decrypted by the block layer */
+	struct blk_crypto_key *ci_bc_key;
+#endif
 };
 
 #define F2FS_CTX_REQUIRES_FREE_ENCRYPT_FL             0x00000001
@@ -146,6 +146,8 @@ static inline bool need_do_checkpoint(struct inode *inode)
 		need_cp = true;
 	else if (sbi->active_logs == 2)
 		need_cp = true;
+	else if (f2fs_compressed_inode(inode))
+		need_cp = true;
 
 	return need_cp;
 }
@@ -409,6 +411,10 @@ static loff_t f2fs_llseek(struct file *file, loff_t offset, int whence)
 	case SEEK_HOLE:
 		if (offset < 0)
 			return -ENXIO;
+		/* the slots of a compressed cluster don't tell holes */
+		if (f2fs_compressed_inode(inode))
+			return generic_file_llseek_size(file, offset, whence,
+						maxbytes, i_size_read(inode));
 		return f2fs_seek_block(file, offset, whence);
 	}
 
@@ -441,6 +447,12 @@ static int f2fs_file_open(struct inode *inode, struct file *filp)
 {
 	int ret = generic_file_open(inode, filp);
 
+#ifndef CONFIG_F2FS_FS_COMPRESSION
+	/* we couldn't tell compressed clusters from the others */
+	if (!ret && S_ISREG(inode->i_mode) &&
+			(F2FS_I(inode)->i_flags & FS_COMPR_FL))
+		return -EOPNOTSUPP;
+#endif
 	if (!ret && f2fs_encrypted_inode(inode)) {
 		ret = f2fs_get_encryption_info(inode);
 		if (ret)
@@ -466,10 +478,13 @@ int truncate_data_blocks_range(struct dnode_of_data *dn, int count)
 
 		dn->data_blkaddr = NULL_ADDR;
 		set_data_blkaddr(dn);
-		invalidate_blocks(sbi, blkaddr);
 		if (dn->ofs_in_node == 0 && IS_INODE(dn->node_page))
 			clear_inode_flag(F2FS_I(dn->inode),
 						FI_FIRST_BLOCK_WRITTEN);
+		/* the head of a compressed cluster has no block of its own */
+		if (blkaddr == COMPRESS_ADDR)
+			continue;
+		invalidate_blocks(sbi, blkaddr);
 		nr_free++;
 	}
 
@@ -542,6 +557,8 @@ int truncate_blocks(struct inode *inode, u64 from, bool lock)
 	trace_f2fs_truncate_blocks_enter(inode, from);
 
 	free_from = (pgoff_t)F2FS_BYTES_TO_BLK(from + blocksize - 1);
+	if (f2fs_compressed_inode(inode))
+		free_from = f2fs_compressed_free_from(inode, free_from);
 
 	if (lock)
 		f2fs_lock_op(sbi);
@@ -610,6 +627,14 @@ int f2fs_truncate(struct inode *inode, bool lock)
 			return err;
 	}
 
+	/* callers under f2fs_lock_op() only truncate whole clusters */
+	if (f2fs_compressed_inode(inode) && lock) {
+		err = f2fs_truncate_compressed_cluster(inode,
+							i_size_read(inode));
+		if (err)
+			return err;
+	}
+
 	err = truncate_blocks(inode, i_size_read(inode), lock);
 	if (err)
 		return err;
@@ -1217,6 +1242,9 @@ static long f2fs_fallocate(struct file *file, int mode,
 	if (!S_ISREG(inode->i_mode))
 		return -EINVAL;
 
+	if (f2fs_compressed_inode(inode))
+		return -EOPNOTSUPP;
+
 	if (f2fs_encrypted_inode(inode) &&
 		(mode & (FALLOC_FL_COLLAPSE_RANGE | FALLOC_FL_INSERT_RANGE)))
 		return -EOPNOTSUPP;
@@ -1289,6 +1317,21 @@ static int f2fs_ioc_getflags(struct file *filp, unsigned long arg)
 	return put_user(flags, (int __user *)arg);
 }
 
+static int f2fs_may_change_compression(struct inode *inode)
+{
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	if (!S_ISREG(inode->i_mode))
+		return 0;
+	if (f2fs_encrypted_inode(inode) || f2fs_is_atomic_file(inode))
+		return -EINVAL;
+	if (i_size_read(inode) || F2FS_HAS_BLOCKS(inode))
+		return -EINVAL;
+	return f2fs_convert_inline_inode(inode);
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
 static int f2fs_ioc_setflags(struct file *filp, unsigned long arg)
 {
 	struct inode *inode = file_inode(filp);
@@ -1325,6 +1368,15 @@ static int f2fs_ioc_setflags(struct file *filp, unsigned long arg)
 		}
 	}
 
+	/* the blocks of a file are laid out one way or the other */
+	if ((flags ^ oldflags) & FS_COMPR_FL) {
+		ret = f2fs_may_change_compression(inode);
+		if (ret) {
+			mutex_unlock(&inode->i_mutex);
+			goto out;
+		}
+	}
+
 	flags = flags & FS_FL_USER_MODIFIABLE;
 	flags |= oldflags & ~FS_FL_USER_MODIFIABLE;
 	fi->i_flags = flags;
@@ -1353,6 +1405,10 @@ static int f2fs_ioc_start_atomic_write(struct file *filp)
 	if (!inode_owner_or_capable(inode))
 		return -EACCES;
 
+	/* commit_inmem_pages() writes block by block */
+	if (f2fs_compressed_inode(inode))
+		return -EINVAL;
+
 	f2fs_balance_fs(F2FS_I_SB(inode));
 
 	if (f2fs_is_atomic_file(inode))
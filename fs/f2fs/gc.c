@@ -713,9 +713,13 @@ next_step:
 			if (IS_ERR(inode) || is_bad_inode(inode))
 				continue;
 
-			/* if encrypted inode, let's go phase 3 */
-			if (f2fs_encrypted_inode(inode) &&
-						S_ISREG(inode->i_mode)) {
+			/*
+			 * if encrypted inode, let's go phase 3; the blocks of
+			 * a compressed cluster are no page's either
+			 */
+			if ((f2fs_encrypted_inode(inode) &&
+						S_ISREG(inode->i_mode)) ||
+					f2fs_compressed_inode(inode)) {
 				add_gc_inode(gc_list, inode);
 				continue;
 			}
@@ -738,7 +742,9 @@ next_step:
 		if (inode) {
 			start_bidx = start_bidx_of_node(nofs, F2FS_I(inode))
 								+ ofs_in_node;
-			if (f2fs_encrypted_inode(inode) && S_ISREG(inode->i_mode))
+			if ((f2fs_encrypted_inode(inode) &&
+						S_ISREG(inode->i_mode)) ||
+					f2fs_compressed_inode(inode))
 				move_encrypted_block(inode, start_bidx);
 			else
 				move_data_page(inode, start_bidx, gc_type);
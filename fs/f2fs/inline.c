@@ -31,6 +31,9 @@ bool f2fs_may_inline_data(struct inode *inode)
 	if (f2fs_encrypted_inode(inode) && S_ISREG(inode->i_mode))
 		return false;
 
+	if (f2fs_compressed_inode(inode))
+		return false;
+
 	return true;
 }
 
@@ -60,6 +60,13 @@ static struct inode *f2fs_new_inode(struct inode *dir, umode_t mode)
 	if (f2fs_encrypted_inode(dir) && f2fs_may_encrypt(inode))
 		f2fs_set_encrypted_inode(inode);
 
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	/* Likewise, files made in a compressed directory are compressed. */
+	if (S_ISREG(mode) && (F2FS_I(dir)->i_flags & FS_COMPR_FL) &&
+			!f2fs_encrypted_inode(inode))
+		F2FS_I(inode)->i_flags |= FS_COMPR_FL;
+#endif
+
 	if (f2fs_may_inline_data(inode))
 		set_inode_flag(F2FS_I(inode), FI_INLINE_DATA);
 	if (f2fs_may_inline_dentry(inode))
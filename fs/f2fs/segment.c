@@ -289,7 +289,14 @@ void f2fs_balance_fs(struct f2fs_sb_info *sbi)
 	 */
 	if (has_not_enough_free_secs(sbi, 0)) {
 		mutex_lock(&sbi->gc_mutex);
-		f2fs_gc(sbi, false);
+		/*
+		 * Writers pile up here when space runs out; the GC of the
+		 * one ahead of us may well have made room for us too.
+		 */
+		if (has_not_enough_free_secs(sbi, 0))
+			f2fs_gc(sbi, false);
+		else
+			mutex_unlock(&sbi->gc_mutex);
 	}
 }
 
@@ -1239,6 +1246,11 @@ static int __get_segment_type(struct page *page, enum page_type p_type)
 	return __get_segment_type_6(page, p_type);
 }
 
+int get_data_segment_type(struct page *page)
+{
+	return __get_segment_type(page, DATA);
+}
+
 void allocate_data_block(struct f2fs_sb_info *sbi, struct page *page,
 		block_t old_blkaddr, block_t *new_blkaddr,
 		struct f2fs_summary *sum, int type)
@@ -62,11 +62,14 @@ enum {
 	Opt_inline_data,
 	Opt_inline_dentry,
 	Opt_flush_merge,
+	Opt_checkpoint_merge,
 	Opt_nobarrier,
 	Opt_fastboot,
 	Opt_extent_cache,
 	Opt_noextent_cache,
 	Opt_noinline_data,
+	Opt_compress_algorithm,
+	Opt_inlinecrypt,
 	Opt_err,
 };
 
@@ -86,11 +89,14 @@ static match_table_t f2fs_tokens = {
 	{Opt_inline_data, "inline_data"},
 	{Opt_inline_dentry, "inline_dentry"},
 	{Opt_flush_merge, "flush_merge"},
+	{Opt_checkpoint_merge, "checkpoint_merge"},
 	{Opt_nobarrier, "nobarrier"},
 	{Opt_fastboot, "fastboot"},
 	{Opt_extent_cache, "extent_cache"},
 	{Opt_noextent_cache, "noextent_cache"},
 	{Opt_noinline_data, "noinline_data"},
+	{Opt_compress_algorithm, "compress_algorithm=%s"},
+	{Opt_inlinecrypt, "inlinecrypt"},
 	{Opt_err, NULL},
 };
 
@@ -391,6 +397,9 @@ static int parse_options(struct super_block *sb, char *options)
 		case Opt_flush_merge:
 			set_opt(sbi, FLUSH_MERGE);
 			break;
+		case Opt_checkpoint_merge:
+			set_opt(sbi, CHECKPOINT_MERGE);
+			break;
 		case Opt_nobarrier:
 			set_opt(sbi, NOBARRIER);
 			break;
@@ -406,6 +415,36 @@ static int parse_options(struct super_block *sb, char *options)
 		case Opt_noinline_data:
 			clear_opt(sbi, INLINE_DATA);
 			break;
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+		case Opt_compress_algorithm:
+			name = match_strdup(&args[0]);
+
+			if (!name)
+				return -ENOMEM;
+			if (f2fs_parse_compress_algorithm(sbi, name)) {
+				f2fs_msg(sb, KERN_ERR,
+					"Unknown compress_algorithm %s", name);
+				kfree(name);
+				return -EINVAL;
+			}
+			kfree(name);
+			break;
+#else
+		case Opt_compress_algorithm:
+			f2fs_msg(sb, KERN_INFO,
+				"compress_algorithm options not supported");
+			break;
+#endif
+#ifdef CONFIG_BLK_INLINE_ENCRYPTION
+		case Opt_inlinecrypt:
+			set_opt(sbi, INLINECRYPT);
+			break;
+#else
+		case Opt_inlinecrypt:
+			f2fs_msg(sb, KERN_INFO,
+				"inlinecrypt options not supported");
+			break;
+#endif
 		default:
 			f2fs_msg(sb, KERN_ERR,
 				"Unrecognized mount option \"%s\" or missing value",
@@ -524,6 +563,7 @@ static void f2fs_put_super(struct super_block *sb)
 	kobject_del(&sbi->s_kobj);
 
 	stop_gc_thread(sbi);
+	destroy_ckpt_cmd_control(sbi);
 
 	/* prevent remaining shrinker jobs */
 	mutex_lock(&sbi->umount_mutex);
@@ -567,6 +607,7 @@ static void f2fs_put_super(struct super_block *sb)
 
 	sb->s_fs_info = NULL;
 	brelse(sbi->raw_super_buf);
+	f2fs_destroy_compress(sbi);
 	kfree(sbi);
 }
 
@@ -577,13 +618,7 @@ int f2fs_sync_fs(struct super_block *sb, int sync)
 	trace_f2fs_sync_fs(sb, sync);
 
 	if (sync) {
-		struct cp_control cpc;
-
-		cpc.reason = __get_cp_reason(sbi);
-
-		mutex_lock(&sbi->gc_mutex);
-		write_checkpoint(sbi, &cpc);
-		mutex_unlock(&sbi->gc_mutex);
+		f2fs_issue_checkpoint(sbi);
 	} else {
 		f2fs_balance_fs(sbi);
 	}
@@ -678,6 +713,8 @@ static int f2fs_show_options(struct seq_file *seq, struct dentry *root)
 		seq_puts(seq, ",inline_dentry");
 	if (!f2fs_readonly(sbi->sb) && test_opt(sbi, FLUSH_MERGE))
 		seq_puts(seq, ",flush_merge");
+	if (!f2fs_readonly(sbi->sb) && test_opt(sbi, CHECKPOINT_MERGE))
+		seq_puts(seq, ",checkpoint_merge");
 	if (test_opt(sbi, NOBARRIER))
 		seq_puts(seq, ",nobarrier");
 	if (test_opt(sbi, FASTBOOT))
@@ -686,7 +723,13 @@ static int f2fs_show_options(struct seq_file *seq, struct dentry *root)
 		seq_puts(seq, ",extent_cache");
 	else
 		seq_puts(seq, ",noextent_cache");
+	if (test_opt(sbi, INLINECRYPT))
+		seq_puts(seq, ",inlinecrypt");
 	seq_printf(seq, ",active_logs=%u", sbi->active_logs);
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	seq_printf(seq, ",compress_algorithm=%s",
+				f2fs_compress_algorithm_name(sbi));
+#endif
 
 	return 0;
 }
@@ -740,6 +783,9 @@ static void default_options(struct f2fs_sb_info *sbi)
 	set_opt(sbi, INLINE_DATA);
 	set_opt(sbi, EXTENT_CACHE);
 
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	sbi->mount_opt.compress_algorithm = F2FS_COMPRESS_LZ4;
+#endif
 #ifdef CONFIG_F2FS_FS_XATTR
 	set_opt(sbi, XATTR_USER);
 #endif
@@ -818,6 +864,15 @@ static int f2fs_remount(struct super_block *sb, int *flags, char *data)
 		if (err)
 			goto restore_gc;
 	}
+
+	/* the same goes for the checkpoint merging thread */
+	if ((*flags & MS_RDONLY) || !test_opt(sbi, CHECKPOINT_MERGE)) {
+		destroy_ckpt_cmd_control(sbi);
+	} else if (!sbi->ckpt_control_info) {
+		err = create_ckpt_cmd_control(sbi);
+		if (err)
+			goto restore_gc;
+	}
 skip:
 	/* Update the POSIXACL Flag */
 	 sb->s_flags = (sb->s_flags & ~MS_POSIXACL) |
@@ -1186,6 +1241,7 @@ try_onemore:
 	sbi->raw_super_buf = raw_super_buf;
 	mutex_init(&sbi->gc_mutex);
 	mutex_init(&sbi->writepages);
+	f2fs_init_compress(sbi);
 	mutex_init(&sbi->cp_mutex);
 	init_rwsem(&sbi->node_write);
 
@@ -1341,11 +1397,17 @@ try_onemore:
 	 * If filesystem is not mounted as read-only then
 	 * do start the gc_thread.
 	 */
+	if (test_opt(sbi, CHECKPOINT_MERGE) && !f2fs_readonly(sb)) {
+		err = create_ckpt_cmd_control(sbi);
+		if (err)
+			goto free_kobj;
+	}
+
 	if (test_opt(sbi, BG_GC) && !f2fs_readonly(sb)) {
 		/* After POR, we can run background GC thread.*/
 		err = start_gc_thread(sbi);
 		if (err)
-			goto free_kobj;
+			goto free_ckpt;
 	}
 	kfree(options);
 
@@ -1359,6 +1421,8 @@ try_onemore:
 
 	return 0;
 
+free_ckpt:
+	destroy_ckpt_cmd_control(sbi);
 free_kobj:
 	kobject_del(&sbi->s_kobj);
 free_proc:
@@ -1388,6 +1452,7 @@ free_options:
 	kfree(options);
 free_sb_buf:
 	brelse(raw_super_buf);
+	f2fs_destroy_compress(sbi);
 free_sbi:
 	kfree(sbi);
 
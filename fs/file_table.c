@@ -312,7 +312,7 @@ void put_filp(struct file *file)
 void __init files_init(void)
 { 
 	filp_cachep = kmem_cache_create("filp", sizeof(struct file), 0,
-			SLAB_HWCACHE_ALIGN | SLAB_PANIC, NULL);
+			SLAB_HWCACHE_ALIGN | SLAB_PANIC | SLAB_MAGAZINE, NULL);
 	percpu_counter_init(&nr_files, 0, GFP_KERNEL);
 }
 
@@ -1636,6 +1636,111 @@ static long writeback_inodes_wb(struct bdi_writeback *wb, long nr_pages,
 	return nr_pages - work.nr_pages;
 }
 
+/*
+ * Extra flushers of a wb_writeback() run. They write back the inodes
+ * queued on b_io alongside the flusher that queued them, each taking the
+ * next inode off the list, so a fast device is not limited to what one
+ * thread can submit. The queueing and all the stop conditions stay with
+ * the owner of the work.
+ */
+struct wb_helper {
+	struct work_struct work;
+	struct wb_helpers *helpers;
+};
+
+struct wb_helpers {
+	struct bdi_writeback *wb;
+	struct wb_writeback_work *work;
+	atomic_long_t nr_written;	/* pages written by the helpers */
+	bool stop;
+	int nr;
+	struct wb_helper helper[WB_MAX_WORKERS - 1];
+};
+
+static void wb_helper_workfn(struct work_struct *w)
+{
+	struct wb_helpers *helpers = container_of(w, struct wb_helper,
+						  work)->helpers;
+	struct bdi_writeback *wb = helpers->wb;
+	struct wb_writeback_work work = *helpers->work;
+	struct blk_plug plug;
+
+	work.nr_pages = LONG_MAX;
+	work.done = NULL;
+
+	blk_start_plug(&plug);
+	spin_lock(&wb->list_lock);
+	while (!READ_ONCE(helpers->stop) && !list_empty(&wb->b_io)) {
+		long nr_pages = work.nr_pages;
+		long progress;
+
+		if (work.sb)
+			progress = writeback_sb_inodes(work.sb, wb, &work);
+		else
+			progress = __writeback_inodes_wb(wb, &work);
+		atomic_long_add(nr_pages - work.nr_pages, &helpers->nr_written);
+		if (!progress)
+			break;
+	}
+	spin_unlock(&wb->list_lock);
+	blk_finish_plug(&plug);
+}
+
+static void wb_helpers_init(struct wb_helpers *helpers,
+			    struct bdi_writeback *wb,
+			    struct wb_writeback_work *work)
+{
+	int i;
+
+	helpers->nr = 0;
+	/* Data integrity writeback keeps to one flusher */
+	if (work->sync_mode != WB_SYNC_NONE)
+		return;
+
+	helpers->wb = wb;
+	helpers->work = work;
+	atomic_long_set(&helpers->nr_written, 0);
+	helpers->stop = false;
+	helpers->nr = READ_ONCE(wb->bdi->wb_workers) - 1;
+	for (i = 0; i < helpers->nr; i++) {
+		helpers->helper[i].helpers = helpers;
+		INIT_WORK_ONSTACK(&helpers->helper[i].work, wb_helper_workfn);
+	}
+}
+
+/* Have the helpers that are not busy already work on b_io */
+static void wb_helpers_kick(struct wb_helpers *helpers)
+{
+	int i;
+
+	for (i = 0; i < helpers->nr; i++)
+		queue_work(bdi_wq, &helpers->helper[i].work);
+}
+
+/*
+ * Helpers still queued are cancelled rather than waited for: the owner
+ * may be running in the rescuer, which would be the only one to run them.
+ */
+static long wb_helpers_stop(struct wb_helpers *helpers)
+{
+	int i;
+
+	if (!helpers->nr)
+		return 0;
+
+	WRITE_ONCE(helpers->stop, true);
+	for (i = 0; i < helpers->nr; i++) {
+		cancel_work_sync(&helpers->helper[i].work);
+		destroy_work_on_stack(&helpers->helper[i].work);
+	}
+	return atomic_long_read(&helpers->nr_written);
+}
+
+static long wb_helpers_written(struct wb_helpers *helpers)
+{
+	return helpers->nr ? atomic_long_read(&helpers->nr_written) : 0;
+}
+
 /*
  * Explicit flushing or periodic writeback of "old" data.
  *
@@ -1660,9 +1765,11 @@ static long wb_writeback(struct bdi_writeback *wb,
 	struct inode *inode;
 	long progress;
 	struct blk_plug plug;
+	struct wb_helpers helpers;
 
 	oldest_jif = jiffies;
 	work->older_than_this = &oldest_jif;
+	wb_helpers_init(&helpers, wb, work);
 
 	blk_start_plug(&plug);
 	spin_lock(&wb->list_lock);
@@ -1670,7 +1777,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		/*
 		 * Stop writeback when nr_pages has been consumed
 		 */
-		if (work->nr_pages <= 0)
+		if (work->nr_pages - wb_helpers_written(&helpers) <= 0)
 			break;
 
 		/*
@@ -1705,6 +1812,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		trace_writeback_start(wb, work);
 		if (list_empty(&wb->b_io))
 			queue_io(wb, work);
+		wb_helpers_kick(&helpers);
 		if (work->sb)
 			progress = writeback_sb_inodes(work->sb, wb, work);
 		else
@@ -1746,6 +1854,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 	spin_unlock(&wb->list_lock);
 	blk_finish_plug(&plug);
 
+	work->nr_pages -= wb_helpers_stop(&helpers);
 	return nr_pages - work->nr_pages;
 }
 
@@ -320,7 +320,7 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 
 static u64 fuse_get_unique(struct fuse_iqueue *fiq)
 {
-	return ++fiq->reqctr;
+	return atomic64_inc_return(&fiq->reqctr);
 }
 
 static void queue_request(struct fuse_iqueue *fiq, struct fuse_req *req)
@@ -332,6 +332,61 @@ static void queue_request(struct fuse_iqueue *fiq, struct fuse_req *req)
 	kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 }
 
+/*
+ * Queue the request on the queue of the current CPU, if a device is
+ * bound to it.  Returns false if not, the request is to be queued on
+ * the connection wide queue then.
+ */
+static bool queue_request_cpu(struct fuse_iqueue *fiq, struct fuse_req *req)
+{
+	struct fuse_cpu_queue __percpu *queues;
+	struct fuse_cpu_queue *cq;
+
+	queues = smp_load_acquire(&fiq->cpu_queues);
+	if (!queues)
+		return false;
+
+	/* just a hint, we may be migrated right away */
+	cq = raw_cpu_ptr(queues);
+	if (!READ_ONCE(cq->nr_devs))
+		return false;
+
+	spin_lock(&cq->waitq.lock);
+	/* fuse_abort_conn() clears ->connected before draining the queues */
+	if (!cq->nr_devs || !READ_ONCE(fiq->connected)) {
+		spin_unlock(&cq->waitq.lock);
+		return false;
+	}
+	req->in.h.unique = fuse_get_unique(fiq);
+	req->in.h.len = sizeof(struct fuse_in_header) +
+		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
+	req->cq = cq;
+	list_add_tail(&req->list, &cq->pending);
+	wake_up_locked(&cq->waitq);
+	spin_unlock(&cq->waitq.lock);
+	return true;
+}
+
+/*
+ * Lock the queue a pending request is on.  A request only ever moves
+ * from a per-CPU queue to fiq, with both locks held.
+ */
+static spinlock_t *lock_pending_queue(struct fuse_iqueue *fiq,
+				      struct fuse_req *req)
+{
+	struct fuse_cpu_queue *cq;
+	spinlock_t *lock;
+
+	for (;;) {
+		cq = READ_ONCE(req->cq);
+		lock = cq ? &cq->waitq.lock : &fiq->waitq.lock;
+		spin_lock(lock);
+		if (READ_ONCE(req->cq) == cq)
+			return lock;
+		spin_unlock(lock);
+	}
+}
+
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 		       u64 nodeid, u64 nlookup)
 {
@@ -446,6 +501,7 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 	}
 
 	if (!test_bit(FR_FORCE, &req->flags)) {
+		spinlock_t *lock;
 		sigset_t oldset;
 
 		/* Only fatal signals may interrupt this */
@@ -457,16 +513,16 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 		if (!err)
 			return;
 
-		spin_lock(&fiq->waitq.lock);
+		lock = lock_pending_queue(fiq, req);
 		/* Request is not yet in userspace, bail out */
 		if (test_bit(FR_PENDING, &req->flags)) {
 			list_del(&req->list);
-			spin_unlock(&fiq->waitq.lock);
+			spin_unlock(lock);
 			__fuse_put_request(req);
 			req->out.h.error = -EINTR;
 			return;
 		}
-		spin_unlock(&fiq->waitq.lock);
+		spin_unlock(lock);
 	}
 
 	/*
@@ -481,22 +537,25 @@ static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 	struct fuse_iqueue *fiq = &fc->iq;
 
 	BUG_ON(test_bit(FR_BACKGROUND, &req->flags));
-	spin_lock(&fiq->waitq.lock);
-	if (!fiq->connected) {
-		spin_unlock(&fiq->waitq.lock);
-		req->out.h.error = -ENOTCONN;
-	} else {
+	/* acquire extra reference, since request is still needed
+	   after request_end() */
+	__fuse_get_request(req);
+	if (!queue_request_cpu(fiq, req)) {
+		spin_lock(&fiq->waitq.lock);
+		if (!fiq->connected) {
+			spin_unlock(&fiq->waitq.lock);
+			__fuse_put_request(req);
+			req->out.h.error = -ENOTCONN;
+			return;
+		}
 		req->in.h.unique = fuse_get_unique(fiq);
 		queue_request(fiq, req);
-		/* acquire extra reference, since request is still needed
-		   after request_end() */
-		__fuse_get_request(req);
 		spin_unlock(&fiq->waitq.lock);
-
-		request_wait_answer(fc, req);
-		/* Pairs with smp_wmb() in request_end() */
-		smp_rmb();
 	}
+
+	request_wait_answer(fc, req);
+	/* Pairs with smp_wmb() in request_end() */
+	smp_rmb();
 }
 
 void fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
@@ -1069,6 +1128,81 @@ static int request_pending(struct fuse_iqueue *fiq)
 		forget_pending(fiq);
 }
 
+/* Are there interrupts or forgets, which go before any request?  Unlocked. */
+static bool urgent_pending(struct fuse_iqueue *fiq)
+{
+	return !list_empty_careful(&fiq->interrupts) ||
+		READ_ONCE(fiq->forget_list_head.next) != NULL;
+}
+
+static struct fuse_cpu_queue *fuse_dev_cpu_queue(struct fuse_dev *fud)
+{
+	/* pairs with smp_store_release() in fuse_dev_bind_cpu() */
+	int cpu = smp_load_acquire(&fud->cpu);
+
+	if (cpu < 0)
+		return NULL;
+	return per_cpu_ptr(fud->fc->iq.cpu_queues, cpu);
+}
+
+/*
+ * A bound reader waits on both the per-CPU queue and fiq, as it serves
+ * the requests of fiq as well.
+ */
+static int fuse_wait_cpu_queue(struct fuse_iqueue *fiq,
+			       struct fuse_cpu_queue *cq, bool nonblock)
+{
+	DEFINE_WAIT(cq_wait);
+	DEFINE_WAIT(iq_wait);
+	int err = 0;
+
+	for (;;) {
+		prepare_to_wait_exclusive(&cq->waitq, &cq_wait,
+					  TASK_INTERRUPTIBLE);
+		prepare_to_wait_exclusive(&fiq->waitq, &iq_wait,
+					  TASK_INTERRUPTIBLE);
+		if (!READ_ONCE(fiq->connected) ||
+		    !list_empty_careful(&cq->pending) ||
+		    !list_empty_careful(&fiq->pending) || urgent_pending(fiq))
+			break;
+		if (nonblock) {
+			err = -EAGAIN;
+			break;
+		}
+		if (signal_pending(current)) {
+			err = -ERESTARTSYS;
+			break;
+		}
+		schedule();
+	}
+	finish_wait(&fiq->waitq, &iq_wait);
+	finish_wait(&cq->waitq, &cq_wait);
+	return err;
+}
+
+/*
+ * Take the first request off a per-CPU queue.  With @limit, leave it
+ * there if it is larger than that.
+ */
+static struct fuse_req *fuse_cpu_dequeue(struct fuse_cpu_queue *cq,
+					 size_t limit)
+{
+	struct fuse_req *req = NULL;
+
+	spin_lock(&cq->waitq.lock);
+	if (!list_empty(&cq->pending)) {
+		req = list_first_entry(&cq->pending, struct fuse_req, list);
+		if (limit && req->in.h.len > limit) {
+			req = NULL;
+		} else {
+			clear_bit(FR_PENDING, &req->flags);
+			list_del_init(&req->list);
+		}
+	}
+	spin_unlock(&cq->waitq.lock);
+	return req;
+}
+
 /*
  * Transfer an interrupt request to userspace
  *
@@ -1231,29 +1365,69 @@ __releases(fiq->waitq.lock)
  * was an error during the copying then it's finished by calling
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
+ *
+ * A device bound to a CPU reads interrupts and forgets first, then the
+ * requests of its CPU, then those of fiq.
+ *
+ * With @more, another request is being added to a batch: nothing is
+ * waited for, and 0 is returned unless an ordinary request fitting in
+ * @nbytes is pending.
  */
 static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
-				struct fuse_copy_state *cs, size_t nbytes)
+				struct fuse_copy_state *cs, size_t nbytes,
+				bool more)
 {
 	ssize_t err;
 	struct fuse_conn *fc = fud->fc;
 	struct fuse_iqueue *fiq = &fc->iq;
 	struct fuse_pqueue *fpq = &fud->pq;
+	struct fuse_cpu_queue *cq;
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
 
  restart:
+	cq = fuse_dev_cpu_queue(fud);
+	if (cq) {
+		if (!more) {
+			err = fuse_wait_cpu_queue(fiq, cq,
+						  file->f_flags & O_NONBLOCK);
+			if (err)
+				return err;
+		}
+		if (!urgent_pending(fiq)) {
+			req = fuse_cpu_dequeue(cq, more ? nbytes : 0);
+			if (req)
+				goto got_req;
+		}
+	}
+
 	spin_lock(&fiq->waitq.lock);
-	err = -EAGAIN;
-	if ((file->f_flags & O_NONBLOCK) && fiq->connected &&
-	    !request_pending(fiq))
-		goto err_unlock;
+	if (more) {
+		if (!fiq->connected || !list_empty(&fiq->interrupts) ||
+		    forget_pending(fiq) || list_empty(&fiq->pending) ||
+		    list_first_entry(&fiq->pending, struct fuse_req,
+				     list)->in.h.len > nbytes) {
+			spin_unlock(&fiq->waitq.lock);
+			return 0;
+		}
+	} else if (cq) {
+		/* a bound reader only sleeps in fuse_wait_cpu_queue() */
+		if (fiq->connected && !request_pending(fiq)) {
+			spin_unlock(&fiq->waitq.lock);
+			goto restart;
+		}
+	} else {
+		err = -EAGAIN;
+		if ((file->f_flags & O_NONBLOCK) && fiq->connected &&
+		    !request_pending(fiq))
+			goto err_unlock;
 
-	err = wait_event_interruptible_exclusive_locked(fiq->waitq,
-				!fiq->connected || request_pending(fiq));
-	if (err)
-		goto err_unlock;
+		err = wait_event_interruptible_exclusive_locked(fiq->waitq,
+					!fiq->connected || request_pending(fiq));
+		if (err)
+			goto err_unlock;
+	}
 
 	err = -ENODEV;
 	if (!fiq->connected)
@@ -1278,6 +1452,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	list_del_init(&req->list);
 	spin_unlock(&fiq->waitq.lock);
 
+ got_req:
 	in = &req->in;
 	reqsize = in->h.len;
 	/* If request is too large, reply with an error and restart the read */
@@ -1351,15 +1526,38 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, struct iov_iter *to)
 	struct file *file = iocb->ki_filp;
 	struct fuse_dev *fud = fuse_get_dev(file);
 
+	size_t nbytes, done, pos;
+	struct iov_iter iter;
+	ssize_t ret;
+
 	if (!fud)
 		return -EPERM;
 
 	if (!iter_is_iovec(to))
 		return -EINVAL;
 
-	fuse_copy_init(&cs, 1, to);
+	nbytes = iov_iter_count(to);
+	iter = *to;
+	fuse_copy_init(&cs, 1, &iter);
+	ret = fuse_dev_do_read(fud, file, &cs, nbytes, false);
+	if (ret <= 0 || !fud->fc->batch_read)
+		return ret;
 
-	return fuse_dev_do_read(fud, file, &cs, iov_iter_count(to));
+	/*
+	 * Add what else is pending.  The copy state maps the buffer a page
+	 * at a time, so each request gets one of its own.
+	 */
+	done = ret;
+	while ((pos = FUSE_BATCH_ALIGN(done)) < nbytes) {
+		iter = *to;
+		iov_iter_advance(&iter, pos);
+		fuse_copy_init(&cs, 1, &iter);
+		ret = fuse_dev_do_read(fud, file, &cs, nbytes - pos, true);
+		if (ret <= 0)
+			break;
+		done = pos + ret;
+	}
+	return done;
 }
 
 static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
@@ -1376,6 +1574,14 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	if (!fud)
 		return -EPERM;
 
+	/*
+	 * Make room for the pages of the largest WRITE, so they can be
+	 * handed over without the daemon having to size the pipe for it.
+	 */
+	pipe_lock(pipe);
+	pipe_auto_grow_to(pipe, DIV_ROUND_UP(fud->fc->max_write, PAGE_SIZE) + 2);
+	pipe_unlock(pipe);
+
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
@@ -1383,7 +1589,7 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	fuse_copy_init(&cs, 1, NULL);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fud, in, &cs, len);
+	ret = fuse_dev_do_read(fud, in, &cs, len, false);
 	if (ret < 0)
 		goto out;
 
@@ -2054,6 +2260,7 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
 	struct fuse_iqueue *fiq;
+	struct fuse_cpu_queue *cq;
 	struct fuse_dev *fud = fuse_get_dev(file);
 
 	if (!fud)
@@ -2061,11 +2268,15 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 
 	fiq = &fud->fc->iq;
 	poll_wait(file, &fiq->waitq, wait);
+	cq = fuse_dev_cpu_queue(fud);
+	if (cq)
+		poll_wait(file, &cq->waitq, wait);
 
 	spin_lock(&fiq->waitq.lock);
 	if (!fiq->connected)
 		mask = POLLERR;
-	else if (request_pending(fiq))
+	else if (request_pending(fiq) ||
+		 (cq && !list_empty_careful(&cq->pending)))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fiq->waitq.lock);
 
@@ -2165,6 +2376,19 @@ void fuse_abort_conn(struct fuse_conn *fc)
 			kfree(dequeue_forget(fiq, 1, NULL));
 		wake_up_all_locked(&fiq->waitq);
 		spin_unlock(&fiq->waitq.lock);
+		if (fiq->cpu_queues) {
+			int cpu;
+
+			for_each_possible_cpu(cpu) {
+				struct fuse_cpu_queue *cq;
+
+				cq = per_cpu_ptr(fiq->cpu_queues, cpu);
+				spin_lock(&cq->waitq.lock);
+				list_splice_init(&cq->pending, &to_end2);
+				wake_up_all_locked(&cq->waitq);
+				spin_unlock(&cq->waitq.lock);
+			}
+		}
 		kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 		end_polls(fc);
 		wake_up_all(&fc->blocked_waitq);
@@ -2183,6 +2407,75 @@ void fuse_abort_conn(struct fuse_conn *fc)
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+static int fuse_alloc_cpu_queues(struct fuse_iqueue *fiq)
+{
+	struct fuse_cpu_queue __percpu *queues;
+	int cpu;
+
+	queues = alloc_percpu(struct fuse_cpu_queue);
+	if (!queues)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct fuse_cpu_queue *cq = per_cpu_ptr(queues, cpu);
+
+		init_waitqueue_head(&cq->waitq);
+		INIT_LIST_HEAD(&cq->pending);
+		cq->nr_devs = 0;
+	}
+	/* pairs with smp_load_acquire() in queue_request_cpu() */
+	smp_store_release(&fiq->cpu_queues, queues);
+	return 0;
+}
+
+/*
+ * Bind the device to @cpu, or unbind it with -1.  The requests left on
+ * a queue nobody reads anymore go over to fiq.  Called with fuse_mutex
+ * held, or at release.
+ */
+static int fuse_dev_bind_cpu(struct fuse_dev *fud, int cpu)
+{
+	struct fuse_iqueue *fiq = &fud->fc->iq;
+	struct fuse_cpu_queue *cq;
+	struct fuse_req *req;
+	int err;
+
+	if (cpu == fud->cpu)
+		return 0;
+
+	if (cpu >= 0 && !fiq->cpu_queues) {
+		err = fuse_alloc_cpu_queues(fiq);
+		if (err)
+			return err;
+	}
+
+	if (fud->cpu >= 0) {
+		cq = per_cpu_ptr(fiq->cpu_queues, fud->cpu);
+		spin_lock(&cq->waitq.lock);
+		if (!--cq->nr_devs && !list_empty(&cq->pending)) {
+			spin_lock(&fiq->waitq.lock);
+			list_for_each_entry(req, &cq->pending, list)
+				WRITE_ONCE(req->cq, NULL);
+			list_splice_tail_init(&cq->pending, &fiq->pending);
+			wake_up_all_locked(&fiq->waitq);
+			spin_unlock(&fiq->waitq.lock);
+			kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
+		}
+		/* readers waiting on it check fud->cpu again */
+		wake_up_all_locked(&cq->waitq);
+		spin_unlock(&cq->waitq.lock);
+	}
+
+	if (cpu >= 0) {
+		cq = per_cpu_ptr(fiq->cpu_queues, cpu);
+		spin_lock(&cq->waitq.lock);
+		cq->nr_devs++;
+		spin_unlock(&cq->waitq.lock);
+	}
+	smp_store_release(&fud->cpu, cpu);
+	return 0;
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
 	struct fuse_dev *fud = fuse_get_dev(file);
@@ -2192,6 +2485,8 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 		struct fuse_pqueue *fpq = &fud->pq;
 
 		WARN_ON(!list_empty(&fpq->io));
+		if (fud->cpu >= 0)
+			fuse_dev_bind_cpu(fud, -1);
 		end_requests(fc, &fpq->processing);
 		/* Are we the last open device? */
 		if (atomic_dec_and_test(&fc->dev_count)) {
@@ -2264,6 +2559,42 @@ static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 				fput(old);
 			}
 		}
+	} else if (cmd == FUSE_DEV_IOC_BIND_CPU) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+		__u32 cpu;
+
+		err = -EPERM;
+		if (!fud)
+			return err;
+
+		err = -EFAULT;
+		if (!get_user(cpu, (__u32 __user *) arg)) {
+			err = -EINVAL;
+			if (cpu == (__u32)-1 ||
+			    (cpu < nr_cpu_ids && cpu_possible(cpu))) {
+				mutex_lock(&fuse_mutex);
+				err = fuse_dev_bind_cpu(fud, (int)cpu);
+				mutex_unlock(&fuse_mutex);
+			}
+		}
+	} else if (cmd == FUSE_DEV_IOC_BACKING_OPEN) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+		struct fuse_backing_map map;
+
+		if (!fud)
+			return -EPERM;
+		if (copy_from_user(&map, (void __user *) arg, sizeof(map)))
+			return -EFAULT;
+		err = fuse_backing_open(fud->fc, &map);
+	} else if (cmd == FUSE_DEV_IOC_BACKING_CLOSE) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+		__u32 backing_id;
+
+		if (!fud)
+			return -EPERM;
+		if (get_user(backing_id, (__u32 __user *) arg))
+			return -EFAULT;
+		err = fuse_backing_close(fud->fc, backing_id);
 	}
 	return err;
 }
@@ -23,6 +23,7 @@
 #include <linux/poll.h>
 #include <linux/workqueue.h>
 #include <linux/kref.h>
+#include <linux/idr.h>
 
 /** Max number of pages that can be used in a single read request */
 #define FUSE_MAX_PAGES_PER_REQ 32
@@ -158,6 +159,9 @@ struct fuse_file {
 
 	/** Has flock been performed on this file? */
 	bool flock:1;
+
+	/** Backing file I/O is passed through to, with FOPEN_PASSTHROUGH */
+	struct file *passthrough;
 };
 
 /** One input argument of a request */
@@ -383,6 +387,27 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** The per-CPU queue the request is pending on, NULL for fiq */
+	struct fuse_cpu_queue *cq;
+};
+
+/**
+ * Per-CPU input queue
+ *
+ * Requests sent from a CPU that a device is bound to are queued here,
+ * and read by the devices bound to the CPU, without touching the
+ * lock of the connection wide input queue.
+ */
+struct fuse_cpu_queue {
+	/** Bound readers wait on this, its lock protects the members */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** Number of devices bound to the CPU */
+	unsigned nr_devs;
 };
 
 struct fuse_iqueue {
@@ -393,7 +418,7 @@ struct fuse_iqueue {
 	wait_queue_head_t waitq;
 
 	/** The next unique request id */
-	u64 reqctr;
+	atomic64_t reqctr;
 
 	/** The list of pending requests */
 	struct list_head pending;
@@ -410,6 +435,9 @@ struct fuse_iqueue {
 
 	/** O_ASYNC requests */
 	struct fasync_struct *fasync;
+
+	/** Per-CPU queues, allocated when a device is first bound */
+	struct fuse_cpu_queue __percpu *cpu_queues;
 };
 
 struct fuse_pqueue {
@@ -438,6 +466,9 @@ struct fuse_dev {
 
 	/** list entry on fc->devices */
 	struct list_head entry;
+
+	/** CPU the device reads the requests of, or -1 */
+	int cpu;
 };
 
 /**
@@ -480,6 +511,9 @@ struct fuse_conn {
 	/** The next unique kernel file handle */
 	u64 khctr;
 
+	/** Backing files registered with FUSE_DEV_IOC_BACKING_OPEN */
+	struct idr backing_files;
+
 	/** rbtree of fuse_files waiting for poll events indexed by ph */
 	struct rb_root polled_files;
 
@@ -540,6 +574,12 @@ struct fuse_conn {
 	/** write-back cache policy (default is write-through) */
 	unsigned writeback_cache:1;
 
+	/** Return as many requests as fit in one read() */
+	unsigned batch_read:1;
+
+	/** Files may be opened with FOPEN_PASSTHROUGH */
+	unsigned passthrough:1;
+
 	/*
 	 * The following bitfields are only for optimization purposes
 	 * and hence races in setting them will not cause malfunction
@@ -953,4 +993,16 @@ int fuse_do_setattr(struct inode *inode, struct iattr *attr,
 
 void fuse_set_initialized(struct fuse_conn *fc);
 
+/* passthrough.c */
+int fuse_backing_open(struct fuse_conn *fc, struct fuse_backing_map *map);
+int fuse_backing_close(struct fuse_conn *fc, int backing_id);
+void fuse_backing_files_free(struct fuse_conn *fc);
+int fuse_passthrough_open(struct file *file, struct fuse_file *ff,
+			  int backing_id);
+void fuse_passthrough_release(struct fuse_file *ff);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb,
+				    struct iov_iter *from);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
@@ -0,0 +1,196 @@
+/*
+  FUSE: Filesystem in Userspace
+
+  Passing file I/O through to backing files.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/uio.h>
+
+/*
+ * The daemon registers a file it opened with FUSE_DEV_IOC_BACKING_OPEN
+ * and names it in the reply to OPEN or CREATE.  The file opened on fuse
+ * then gets a backing file of its own, opened on the same path with the
+ * daemon's credentials, and read, write and mmap go there without a
+ * round trip.  Everything else, metadata included, still goes through
+ * the daemon.
+ */
+
+int fuse_backing_open(struct fuse_conn *fc, struct fuse_backing_map *map)
+{
+	struct file *file;
+	int res;
+
+	if (!fc->passthrough || !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (map->flags || map->padding)
+		return -EINVAL;
+
+	file = fget(map->fd);
+	if (!file)
+		return -EBADF;
+
+	res = -EOPNOTSUPP;
+	if (!S_ISREG(file_inode(file)->i_mode) ||
+	    !file->f_op->read_iter || !file->f_op->write_iter)
+		goto out_fput;
+
+	/* no passthrough to another passthrough, or to an overlay of one */
+	res = -ELOOP;
+	if (file_inode(file)->i_sb->s_stack_depth >= FILESYSTEM_MAX_STACK_DEPTH)
+		goto out_fput;
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&fc->lock);
+	res = idr_alloc_cyclic(&fc->backing_files, file, 1, 0, GFP_ATOMIC);
+	spin_unlock(&fc->lock);
+	idr_preload_end();
+	if (res > 0)
+		return res;
+
+out_fput:
+	fput(file);
+	return res;
+}
+
+int fuse_backing_close(struct fuse_conn *fc, int backing_id)
+{
+	struct file *file;
+
+	if (!fc->passthrough || !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (backing_id <= 0)
+		return -EINVAL;
+
+	spin_lock(&fc->lock);
+	file = idr_find(&fc->backing_files, backing_id);
+	if (file)
+		idr_remove(&fc->backing_files, backing_id);
+	spin_unlock(&fc->lock);
+	if (!file)
+		return -ENOENT;
+
+	/* open files have their own backing file, they don't care */
+	fput(file);
+	return 0;
+}
+
+void fuse_backing_files_free(struct fuse_conn *fc)
+{
+	struct file *file;
+	int id;
+
+	idr_for_each_entry(&fc->backing_files, file, id)
+		fput(file);
+	idr_destroy(&fc->backing_files);
+}
+
+int fuse_passthrough_open(struct file *file, struct fuse_file *ff,
+			  int backing_id)
+{
+	struct fuse_conn *fc = ff->fc;
+	struct file *backing, *pt;
+
+	if (!fc->passthrough)
+		return -EIO;
+
+	spin_lock(&fc->lock);
+	backing = idr_find(&fc->backing_files, backing_id);
+	if (backing)
+		get_file(backing);
+	spin_unlock(&fc->lock);
+	if (!backing)
+		return -EIO;
+
+	pt = dentry_open(&backing->f_path,
+			 file->f_flags & ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC),
+			 backing->f_cred);
+	fput(backing);
+	if (IS_ERR(pt))
+		return PTR_ERR(pt);
+
+	ff->passthrough = pt;
+	return 0;
+}
+
+void fuse_passthrough_release(struct fuse_file *ff)
+{
+	if (ff->passthrough) {
+		fput(ff->passthrough);
+		ff->passthrough = NULL;
+	}
+}
+
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	ssize_t ret;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	ret = vfs_iter_read(ff->passthrough, to, &iocb->ki_pos);
+	file_accessed(file);
+	return ret;
+}
+
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb,
+				    struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct inode *inode = file_inode(file);
+	struct file *backing = ff->passthrough;
+	ssize_t ret;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	/* O_APPEND is left to the backing file, which has it too */
+	mutex_lock(&inode->i_mutex);
+	file_start_write(backing);
+	ret = vfs_iter_write(backing, from, &iocb->ki_pos);
+	file_end_write(backing);
+	if (ret > 0) {
+		fuse_write_update_size(inode, iocb->ki_pos);
+		/* mtime and friends changed behind the daemon's back */
+		fuse_invalidate_attr(inode);
+	}
+	mutex_unlock(&inode->i_mutex);
+
+	return ret;
+}
+
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+	int ret;
+
+	if (!backing->f_op->mmap)
+		return -ENODEV;
+
+	if (WARN_ON(vma->vm_file != file))
+		return -EIO;
+
+	/* the mapping is the backing file's, and so is the vma */
+	vma->vm_file = get_file(backing);
+	ret = backing->f_op->mmap(backing, vma);
+	if (ret) {
+		vma->vm_file = file;
+		fput(backing);
+	} else {
+		fput(file);
+		file_accessed(file);
+	}
+	return ret;
+}
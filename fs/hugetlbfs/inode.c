@@ -13,6 +13,7 @@
 #include <asm/current.h>
 #include <linux/sched.h>		/* remove ASAP */
 #include <linux/falloc.h>
+#include <linux/fcntl.h>
 #include <linux/fs.h>
 #include <linux/mount.h>
 #include <linux/file.h>
@@ -55,16 +56,6 @@ struct hugetlbfs_config {
 	long    min_hpages;
 };
 
-struct hugetlbfs_inode_info {
-	struct shared_policy policy;
-	struct inode vfs_inode;
-};
-
-static inline struct hugetlbfs_inode_info *HUGETLBFS_I(struct inode *inode)
-{
-	return container_of(inode, struct hugetlbfs_inode_info, vfs_inode);
-}
-
 int sysctl_hugetlb_shm_group;
 
 enum {
@@ -154,7 +145,9 @@ static int hugetlbfs_file_mmap(struct file *file, struct vm_area_struct *vma)
 		goto out;
 
 	ret = 0;
-	if (vma->vm_flags & VM_WRITE && inode->i_size < len)
+	/* a grow sealed memfd faults beyond its size, as on tmpfs */
+	if (vma->vm_flags & VM_WRITE && inode->i_size < len &&
+	    !(HUGETLBFS_I(inode)->seals & F_SEAL_GROW))
 		inode->i_size = len;
 out:
 	mutex_unlock(&inode->i_mutex);
@@ -525,6 +518,13 @@ static long hugetlbfs_punch_hole(struct inode *inode, loff_t offset, loff_t len)
 		struct address_space *mapping = inode->i_mapping;
 
 		mutex_lock(&inode->i_mutex);
+
+		/* protected by i_mutex */
+		if (HUGETLBFS_I(inode)->seals & F_SEAL_WRITE) {
+			mutex_unlock(&inode->i_mutex);
+			return -EPERM;
+		}
+
 		i_mmap_lock_write(mapping);
 		if (!RB_EMPTY_ROOT(&mapping->i_mmap))
 			hugetlb_vmdelete_list(&mapping->i_mmap,
@@ -573,6 +573,12 @@ static long hugetlbfs_fallocate(struct file *file, int mode, loff_t offset,
 	if (error)
 		goto out;
 
+	if ((HUGETLBFS_I(inode)->seals & F_SEAL_GROW) &&
+	    offset + len > inode->i_size) {
+		error = -EPERM;
+		goto out;
+	}
+
 	/*
 	 * Initialize a pseudo vma as this is required by the huge page
 	 * allocation routines.  If NUMA is configured, use page index
@@ -671,10 +677,17 @@ static int hugetlbfs_setattr(struct dentry *dentry, struct iattr *attr)
 		return error;
 
 	if (ia_valid & ATTR_SIZE) {
-		error = -EINVAL;
-		if (attr->ia_size & ~huge_page_mask(h))
+		unsigned int seals = HUGETLBFS_I(inode)->seals;
+		loff_t oldsize = inode->i_size;
+		loff_t newsize = attr->ia_size;
+
+		if (newsize & ~huge_page_mask(h))
 			return -EINVAL;
-		error = hugetlb_vmtruncate(inode, attr->ia_size);
+		/* protected by i_mutex */
+		if ((newsize < oldsize && (seals & F_SEAL_SHRINK)) ||
+		    (newsize > oldsize && (seals & F_SEAL_GROW)))
+			return -EPERM;
+		error = hugetlb_vmtruncate(inode, newsize);
 		if (error)
 			return error;
 	}
@@ -746,6 +759,8 @@ static struct inode *hugetlbfs_get_inode(struct super_block *sb,
 		 * the rb tree will still be empty.
 		 */
 		mpol_shared_policy_init(&info->policy, NULL);
+		/* only memfd_create(MFD_ALLOW_SEALING) lifts this */
+		info->seals = F_SEAL_SEAL;
 		switch (mode & S_IFMT) {
 		default:
 			init_special_inode(inode, mode, dev);
@@ -18,6 +18,10 @@
 #include <linux/buffer_head.h> /* for inode_has_buffers */
 #include <linux/ratelimit.h>
 #include <linux/list_lru.h>
+#include <linux/list_bl.h>
+#include <linux/percpu_counter.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <trace/events/writeback.h>
 #include "internal.h"
 
@@ -32,8 +36,8 @@
  *   inode->i_sb->s_inodes, inode->i_sb_list
  * bdi->wb.list_lock protects:
  *   bdi->wb.b_{dirty,io,more_io,dirty_time}, inode->i_io_list
- * inode_hash_lock protects:
- *   inode_hashtable, inode->i_hash
+ * the inode hash bucket bit locks protect:
+ *   inode->i_hash, inode->i_hashval
  *
  * Lock ordering:
  *
@@ -44,18 +48,49 @@
  * bdi->wb.list_lock
  *   inode->i_lock
  *
- * inode_hash_lock
- *   inode->i_sb->s_inode_list_lock
- *   inode->i_lock
+ * inode hash bucket, in the table being emptied
+ *   inode hash bucket, in the current table
+ *     inode->i_sb->s_inode_list_lock
+ *     inode->i_lock
  *
  * iunique_lock
- *   inode_hash_lock
+ *   inode hash bucket
  */
 
-static unsigned int i_hash_mask __read_mostly;
-static unsigned int i_hash_shift __read_mostly;
-static struct hlist_head *inode_hashtable __read_mostly;
-static __cacheline_aligned_in_smp DEFINE_SPINLOCK(inode_hash_lock);
+/*
+ * The inode hash.  Every bucket is locked on its own, by a bit lock in
+ * the bucket head.  The table grows online: once the hashed inodes
+ * outnumber the buckets twice over, a table twice the size is put in
+ * place and a work item moves the inodes over from the old one, a bucket
+ * at a time.  Meanwhile new inodes go to the new table, and a lookup
+ * locks and searches the bucket of its hash value in both tables, the
+ * old one first.  inode_hash_seq lets a lookup see both table pointers
+ * change at once, and RCU keeps an old table around for lookups that
+ * still have a bucket of it.
+ */
+struct inode_hash_table {
+	struct hlist_bl_head	*buckets;
+	unsigned int		shift;
+	unsigned int		mask;
+};
+
+/* the buckets an inode with a given hash value can be on, locked */
+struct inode_hash_bucket {
+	struct hlist_bl_head	*old;	/* NULL unless the table grows */
+	struct hlist_bl_head	*new;
+	unsigned int		shift;	/* of the current table */
+};
+
+static struct inode_hash_table inode_hash_boot;	/* never freed */
+static struct inode_hash_table *inode_hash __read_mostly = &inode_hash_boot;
+static struct inode_hash_table *inode_hash_old __read_mostly;
+static seqcount_t inode_hash_seq = SEQCNT_ZERO(inode_hash_seq);
+
+static struct percpu_counter nr_inodes_hashed;
+static unsigned int inode_hash_max_shift __read_mostly;	/* 0: can't grow */
+static void inode_hash_grow(struct work_struct *work);
+static DECLARE_WORK(inode_hash_grow_work, inode_hash_grow);
+static DEFINE_MUTEX(inode_hash_grow_mutex);
 
 /*
  * Empty aops. Can be used for the cases where the user does not
@@ -180,6 +215,9 @@ int inode_init_always(struct super_block *sb, struct inode *inode)
 
 #ifdef CONFIG_FSNOTIFY
 	inode->i_fsnotify_mask = 0;
+#endif
+#ifdef CONFIG_EXEC_CACHE
+	inode->i_exec_cache = NULL;
 #endif
 	inode->i_flctx = NULL;
 	this_cpu_inc(nr_inodes);
@@ -225,6 +263,7 @@ void __destroy_inode(struct inode *inode)
 	inode_detach_wb(inode);
 	security_inode_free(inode);
 	fsnotify_inode_delete(inode);
+	exec_cache_drop(inode);
 	locks_free_lock_context(inode->i_flctx);
 	if (!inode->i_nlink) {
 		WARN_ON(atomic_long_read(&inode->i_sb->s_remove_count) == 0);
@@ -355,7 +394,7 @@ EXPORT_SYMBOL(address_space_init_once);
 void inode_init_once(struct inode *inode)
 {
 	memset(inode, 0, sizeof(*inode));
-	INIT_HLIST_NODE(&inode->i_hash);
+	INIT_HLIST_BL_NODE(&inode->i_hash);
 	INIT_LIST_HEAD(&inode->i_devices);
 	INIT_LIST_HEAD(&inode->i_io_list);
 	INIT_LIST_HEAD(&inode->i_lru);
@@ -439,33 +478,94 @@ static inline void inode_sb_list_del(struct inode *inode)
 	}
 }
 
-static unsigned long hash(struct super_block *sb, unsigned long hashval)
+static unsigned long hash(struct super_block *sb, unsigned long hashval,
+			  struct inode_hash_table *tbl)
 {
 	unsigned long tmp;
 
 	tmp = (hashval * (unsigned long)sb) ^ (GOLDEN_RATIO_PRIME + hashval) /
 			L1_CACHE_BYTES;
-	tmp = tmp ^ ((tmp ^ GOLDEN_RATIO_PRIME) >> i_hash_shift);
-	return tmp & i_hash_mask;
+	tmp = tmp ^ ((tmp ^ GOLDEN_RATIO_PRIME) >> tbl->shift);
+	return tmp & tbl->mask;
+}
+
+/*
+ * Lock the buckets that an inode of @sb with @hashval can be on.  The
+ * RCU read lock is held until inode_hash_unlock(), as is whatever
+ * buckets lock there is to have - nothing in between may sleep.
+ */
+static void inode_hash_lock(struct super_block *sb, unsigned long hashval,
+			    struct inode_hash_bucket *b)
+{
+	struct inode_hash_table *tbl, *old;
+	unsigned int seq;
+
+	rcu_read_lock();
+	for (;;) {
+		seq = read_seqcount_begin(&inode_hash_seq);
+		tbl = READ_ONCE(inode_hash);
+		old = READ_ONCE(inode_hash_old);
+
+		b->new = tbl->buckets + hash(sb, hashval, tbl);
+		b->old = old ? old->buckets + hash(sb, hashval, old) : NULL;
+		b->shift = tbl->shift;
+		if (b->old)
+			hlist_bl_lock(b->old);
+		hlist_bl_lock(b->new);
+
+		/* the tables changed before we got the locks, try again */
+		if (likely(!read_seqcount_retry(&inode_hash_seq, seq)))
+			return;
+		hlist_bl_unlock(b->new);
+		if (b->old)
+			hlist_bl_unlock(b->old);
+	}
+}
+
+static void inode_hash_unlock(struct inode_hash_bucket *b)
+{
+	hlist_bl_unlock(b->new);
+	if (b->old)
+		hlist_bl_unlock(b->old);
+	rcu_read_unlock();
+}
+
+/* walk the old chain, if any, then the new one */
+#define for_each_inode_hash_chain(head, b, i)				\
+	for (i = 0; i < 2; i++)						\
+		if ((head = (i ? (b)->new : (b)->old)) != NULL)
+
+/* hash @inode in the buckets locked by inode_hash_lock() */
+static void inode_hash_add(struct inode *inode, unsigned long hashval,
+			   struct inode_hash_bucket *b)
+{
+	inode->i_hashval = hashval;
+	hlist_bl_add_head(&inode->i_hash, b->new);
+	percpu_counter_inc(&nr_inodes_hashed);
+
+	if (unlikely(b->shift < READ_ONCE(inode_hash_max_shift) &&
+		     percpu_counter_read_positive(&nr_inodes_hashed) >
+		     (2LL << b->shift)))
+		schedule_work(&inode_hash_grow_work);
 }
 
 /**
  *	__insert_inode_hash - hash an inode
  *	@inode: unhashed inode
  *	@hashval: unsigned long value used to locate this object in the
- *		inode_hashtable.
+ *		inode hash.
  *
  *	Add an inode to the inode hash for this superblock.
  */
 void __insert_inode_hash(struct inode *inode, unsigned long hashval)
 {
-	struct hlist_head *b = inode_hashtable + hash(inode->i_sb, hashval);
+	struct inode_hash_bucket b;
 
-	spin_lock(&inode_hash_lock);
+	inode_hash_lock(inode->i_sb, hashval, &b);
 	spin_lock(&inode->i_lock);
-	hlist_add_head(&inode->i_hash, b);
+	inode_hash_add(inode, hashval, &b);
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&inode_hash_lock);
+	inode_hash_unlock(&b);
 }
 EXPORT_SYMBOL(__insert_inode_hash);
 
@@ -477,11 +577,16 @@ EXPORT_SYMBOL(__insert_inode_hash);
  */
 void __remove_inode_hash(struct inode *inode)
 {
-	spin_lock(&inode_hash_lock);
+	struct inode_hash_bucket b;
+
+	inode_hash_lock(inode->i_sb, inode->i_hashval, &b);
 	spin_lock(&inode->i_lock);
-	hlist_del_init(&inode->i_hash);
+	if (!hlist_bl_unhashed(&inode->i_hash)) {
+		hlist_bl_del_init(&inode->i_hash);
+		percpu_counter_dec(&nr_inodes_hashed);
+	}
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&inode_hash_lock);
+	inode_hash_unlock(&b);
 }
 EXPORT_SYMBOL(__remove_inode_hash);
 
@@ -765,31 +870,40 @@ long prune_icache_sb(struct super_block *sb, struct shrink_control *sc)
 	return freed;
 }
 
-static void __wait_on_freeing_inode(struct inode *inode);
+static void __wait_on_freeing_inode(struct inode *inode,
+				    struct super_block *sb,
+				    unsigned long hashval,
+				    struct inode_hash_bucket *b);
 /*
- * Called with the inode lock held.
+ * Called with the hash buckets for @hashval locked.
  */
 static struct inode *find_inode(struct super_block *sb,
-				struct hlist_head *head,
+				unsigned long hashval,
+				struct inode_hash_bucket *b,
 				int (*test)(struct inode *, void *),
 				void *data)
 {
-	struct inode *inode = NULL;
+	struct hlist_bl_head *head;
+	struct hlist_bl_node *node;
+	struct inode *inode;
+	int i;
 
 repeat:
-	hlist_for_each_entry(inode, head, i_hash) {
-		if (inode->i_sb != sb)
-			continue;
-		if (!test(inode, data))
-			continue;
-		spin_lock(&inode->i_lock);
-		if (inode->i_state & (I_FREEING|I_WILL_FREE)) {
-			__wait_on_freeing_inode(inode);
-			goto repeat;
+	for_each_inode_hash_chain(head, b, i) {
+		hlist_bl_for_each_entry(inode, node, head, i_hash) {
+			if (inode->i_sb != sb)
+				continue;
+			if (!test(inode, data))
+				continue;
+			spin_lock(&inode->i_lock);
+			if (inode->i_state & (I_FREEING|I_WILL_FREE)) {
+				__wait_on_freeing_inode(inode, sb, hashval, b);
+				goto repeat;
+			}
+			__iget(inode);
+			spin_unlock(&inode->i_lock);
+			return inode;
 		}
-		__iget(inode);
-		spin_unlock(&inode->i_lock);
-		return inode;
 	}
 	return NULL;
 }
@@ -799,24 +913,61 @@ repeat:
  * iget_locked for details.
  */
 static struct inode *find_inode_fast(struct super_block *sb,
-				struct hlist_head *head, unsigned long ino)
+				struct inode_hash_bucket *b, unsigned long ino)
 {
-	struct inode *inode = NULL;
+	struct hlist_bl_head *head;
+	struct hlist_bl_node *node;
+	struct inode *inode;
+	int i;
 
 repeat:
-	hlist_for_each_entry(inode, head, i_hash) {
-		if (inode->i_ino != ino)
-			continue;
-		if (inode->i_sb != sb)
-			continue;
-		spin_lock(&inode->i_lock);
-		if (inode->i_state & (I_FREEING|I_WILL_FREE)) {
-			__wait_on_freeing_inode(inode);
-			goto repeat;
+	for_each_inode_hash_chain(head, b, i) {
+		hlist_bl_for_each_entry(inode, node, head, i_hash) {
+			if (inode->i_ino != ino)
+				continue;
+			if (inode->i_sb != sb)
+				continue;
+			spin_lock(&inode->i_lock);
+			if (inode->i_state & (I_FREEING|I_WILL_FREE)) {
+				__wait_on_freeing_inode(inode, sb, ino, b);
+				goto repeat;
+			}
+			__iget(inode);
+			spin_unlock(&inode->i_lock);
+			return inode;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find an inode that isn't being freed for insert_inode_locked*(), by
+ * @test or, without one, by inode number.  Returns it with ->i_lock held.
+ */
+static struct inode *find_inode_live(struct super_block *sb,
+				     struct inode_hash_bucket *b,
+				     unsigned long ino,
+				     int (*test)(struct inode *, void *),
+				     void *data)
+{
+	struct hlist_bl_head *head;
+	struct hlist_bl_node *node;
+	struct inode *old;
+	int i;
+
+	for_each_inode_hash_chain(head, b, i) {
+		hlist_bl_for_each_entry(old, node, head, i_hash) {
+			if (old->i_sb != sb)
+				continue;
+			if (test ? !test(old, data) : old->i_ino != ino)
+				continue;
+			spin_lock(&old->i_lock);
+			if (old->i_state & (I_FREEING|I_WILL_FREE)) {
+				spin_unlock(&old->i_lock);
+				continue;
+			}
+			return old;
 		}
-		__iget(inode);
-		spin_unlock(&inode->i_lock);
-		return inode;
 	}
 	return NULL;
 }
@@ -1003,19 +1154,19 @@ EXPORT_SYMBOL(unlock_two_nondirectories);
  * hashed, and with the I_NEW flag set. The file system gets to fill it in
  * before unlocking it via unlock_new_inode().
  *
- * Note both @test and @set are called with the inode_hash_lock held, so can't
- * sleep.
+ * Note both @test and @set are called with the inode hash bucket locked, so
+ * can't sleep.
  */
 struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *),
 		int (*set)(struct inode *, void *), void *data)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct inode_hash_bucket b;
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	inode = find_inode(sb, head, test, data);
-	spin_unlock(&inode_hash_lock);
+	inode_hash_lock(sb, hashval, &b);
+	inode = find_inode(sb, hashval, &b, test, data);
+	inode_hash_unlock(&b);
 
 	if (inode) {
 		wait_on_inode(inode);
@@ -1026,19 +1177,19 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 	if (inode) {
 		struct inode *old;
 
-		spin_lock(&inode_hash_lock);
+		inode_hash_lock(sb, hashval, &b);
 		/* We released the lock, so.. */
-		old = find_inode(sb, head, test, data);
+		old = find_inode(sb, hashval, &b, test, data);
 		if (!old) {
 			if (set(inode, data))
 				goto set_failed;
 
 			spin_lock(&inode->i_lock);
 			inode->i_state = I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			inode_hash_add(inode, hashval, &b);
 			spin_unlock(&inode->i_lock);
 			inode_sb_list_add(inode);
-			spin_unlock(&inode_hash_lock);
+			inode_hash_unlock(&b);
 
 			/* Return the locked inode with I_NEW set, the
 			 * caller is responsible for filling in the contents
@@ -1051,7 +1202,7 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 		 * us. Use the old inode instead of the one we just
 		 * allocated.
 		 */
-		spin_unlock(&inode_hash_lock);
+		inode_hash_unlock(&b);
 		destroy_inode(inode);
 		inode = old;
 		wait_on_inode(inode);
@@ -1059,7 +1210,7 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 	return inode;
 
 set_failed:
-	spin_unlock(&inode_hash_lock);
+	inode_hash_unlock(&b);
 	destroy_inode(inode);
 	return NULL;
 }
@@ -1080,12 +1231,12 @@ EXPORT_SYMBOL(iget5_locked);
  */
 struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct inode_hash_bucket b;
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	inode = find_inode_fast(sb, head, ino);
-	spin_unlock(&inode_hash_lock);
+	inode_hash_lock(sb, ino, &b);
+	inode = find_inode_fast(sb, &b, ino);
+	inode_hash_unlock(&b);
 	if (inode) {
 		wait_on_inode(inode);
 		return inode;
@@ -1095,17 +1246,17 @@ struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 	if (inode) {
 		struct inode *old;
 
-		spin_lock(&inode_hash_lock);
+		inode_hash_lock(sb, ino, &b);
 		/* We released the lock, so.. */
-		old = find_inode_fast(sb, head, ino);
+		old = find_inode_fast(sb, &b, ino);
 		if (!old) {
 			inode->i_ino = ino;
 			spin_lock(&inode->i_lock);
 			inode->i_state = I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			inode_hash_add(inode, ino, &b);
 			spin_unlock(&inode->i_lock);
 			inode_sb_list_add(inode);
-			spin_unlock(&inode_hash_lock);
+			inode_hash_unlock(&b);
 
 			/* Return the locked inode with I_NEW set, the
 			 * caller is responsible for filling in the contents
@@ -1118,7 +1269,7 @@ struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 		 * us. Use the old inode instead of the one we just
 		 * allocated.
 		 */
-		spin_unlock(&inode_hash_lock);
+		inode_hash_unlock(&b);
 		destroy_inode(inode);
 		inode = old;
 		wait_on_inode(inode);
@@ -1136,17 +1287,22 @@ EXPORT_SYMBOL(iget_locked);
  */
 static int test_inode_iunique(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *b = inode_hashtable + hash(sb, ino);
+	struct inode_hash_bucket b;
+	struct hlist_bl_head *head;
+	struct hlist_bl_node *node;
 	struct inode *inode;
+	int i;
 
-	spin_lock(&inode_hash_lock);
-	hlist_for_each_entry(inode, b, i_hash) {
-		if (inode->i_ino == ino && inode->i_sb == sb) {
-			spin_unlock(&inode_hash_lock);
-			return 0;
+	inode_hash_lock(sb, ino, &b);
+	for_each_inode_hash_chain(head, &b, i) {
+		hlist_bl_for_each_entry(inode, node, head, i_hash) {
+			if (inode->i_ino == ino && inode->i_sb == sb) {
+				inode_hash_unlock(&b);
+				return 0;
+			}
 		}
 	}
-	spin_unlock(&inode_hash_lock);
+	inode_hash_unlock(&b);
 
 	return 1;
 }
@@ -1221,17 +1377,17 @@ EXPORT_SYMBOL(igrab);
  * Note: I_NEW is not waited upon so you have to be very careful what you do
  * with the returned inode.  You probably should be using ilookup5() instead.
  *
- * Note2: @test is called with the inode_hash_lock held, so can't sleep.
+ * Note2: @test is called with the inode hash bucket locked, so can't sleep.
  */
 struct inode *ilookup5_nowait(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct inode_hash_bucket b;
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	inode = find_inode(sb, head, test, data);
-	spin_unlock(&inode_hash_lock);
+	inode_hash_lock(sb, hashval, &b);
+	inode = find_inode(sb, hashval, &b, test, data);
+	inode_hash_unlock(&b);
 
 	return inode;
 }
@@ -1252,7 +1408,7 @@ EXPORT_SYMBOL(ilookup5_nowait);
  * This is a generalized version of ilookup() for file systems where the
  * inode number is not sufficient for unique identification of an inode.
  *
- * Note: @test is called with the inode_hash_lock held, so can't sleep.
+ * Note: @test is called with the inode hash bucket locked, so can't sleep.
  */
 struct inode *ilookup5(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
@@ -1275,12 +1431,12 @@ EXPORT_SYMBOL(ilookup5);
  */
 struct inode *ilookup(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct inode_hash_bucket b;
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	inode = find_inode_fast(sb, head, ino);
-	spin_unlock(&inode_hash_lock);
+	inode_hash_lock(sb, ino, &b);
+	inode = find_inode_fast(sb, &b, ino);
+	inode_hash_unlock(&b);
 
 	if (inode)
 		wait_on_inode(inode);
@@ -1302,7 +1458,7 @@ EXPORT_SYMBOL(ilookup);
  * taking the i_lock spin_lock and checking i_state for an inode being
  * freed or being initialized, and incrementing the reference count
  * before returning 1.  It also must not sleep, since it is called with
- * the inode_hash_lock spinlock held.
+ * the inode hash bucket locked.
  *
  * This is a even more generalized version of ilookup5() when the
  * function must never block --- find_inode() can block in
@@ -1317,23 +1473,27 @@ struct inode *find_inode_nowait(struct super_block *sb,
 					     void *),
 				void *data)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct inode_hash_bucket b;
+	struct hlist_bl_head *head;
+	struct hlist_bl_node *node;
 	struct inode *inode, *ret_inode = NULL;
-	int mval;
+	int mval, i;
 
-	spin_lock(&inode_hash_lock);
-	hlist_for_each_entry(inode, head, i_hash) {
-		if (inode->i_sb != sb)
-			continue;
-		mval = match(inode, hashval, data);
-		if (mval == 0)
-			continue;
-		if (mval == 1)
-			ret_inode = inode;
-		goto out;
+	inode_hash_lock(sb, hashval, &b);
+	for_each_inode_hash_chain(head, &b, i) {
+		hlist_bl_for_each_entry(inode, node, head, i_hash) {
+			if (inode->i_sb != sb)
+				continue;
+			mval = match(inode, hashval, data);
+			if (mval == 0)
+				continue;
+			if (mval == 1)
+				ret_inode = inode;
+			goto out;
+		}
 	}
 out:
-	spin_unlock(&inode_hash_lock);
+	inode_hash_unlock(&b);
 	return ret_inode;
 }
 EXPORT_SYMBOL(find_inode_nowait);
@@ -1342,34 +1502,24 @@ int insert_inode_locked(struct inode *inode)
 {
 	struct super_block *sb = inode->i_sb;
 	ino_t ino = inode->i_ino;
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct inode_hash_bucket b;
 
 	while (1) {
-		struct inode *old = NULL;
-		spin_lock(&inode_hash_lock);
-		hlist_for_each_entry(old, head, i_hash) {
-			if (old->i_ino != ino)
-				continue;
-			if (old->i_sb != sb)
-				continue;
-			spin_lock(&old->i_lock);
-			if (old->i_state & (I_FREEING|I_WILL_FREE)) {
-				spin_unlock(&old->i_lock);
-				continue;
-			}
-			break;
-		}
+		struct inode *old;
+
+		inode_hash_lock(sb, ino, &b);
+		old = find_inode_live(sb, &b, ino, NULL, NULL);
 		if (likely(!old)) {
 			spin_lock(&inode->i_lock);
 			inode->i_state |= I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			inode_hash_add(inode, ino, &b);
 			spin_unlock(&inode->i_lock);
-			spin_unlock(&inode_hash_lock);
+			inode_hash_unlock(&b);
 			return 0;
 		}
 		__iget(old);
 		spin_unlock(&old->i_lock);
-		spin_unlock(&inode_hash_lock);
+		inode_hash_unlock(&b);
 		wait_on_inode(old);
 		if (unlikely(!inode_unhashed(old))) {
 			iput(old);
@@ -1384,35 +1534,24 @@ int insert_inode_locked4(struct inode *inode, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
 {
 	struct super_block *sb = inode->i_sb;
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct inode_hash_bucket b;
 
 	while (1) {
-		struct inode *old = NULL;
+		struct inode *old;
 
-		spin_lock(&inode_hash_lock);
-		hlist_for_each_entry(old, head, i_hash) {
-			if (old->i_sb != sb)
-				continue;
-			if (!test(old, data))
-				continue;
-			spin_lock(&old->i_lock);
-			if (old->i_state & (I_FREEING|I_WILL_FREE)) {
-				spin_unlock(&old->i_lock);
-				continue;
-			}
-			break;
-		}
+		inode_hash_lock(sb, hashval, &b);
+		old = find_inode_live(sb, &b, hashval, test, data);
 		if (likely(!old)) {
 			spin_lock(&inode->i_lock);
 			inode->i_state |= I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			inode_hash_add(inode, hashval, &b);
 			spin_unlock(&inode->i_lock);
-			spin_unlock(&inode_hash_lock);
+			inode_hash_unlock(&b);
 			return 0;
 		}
 		__iget(old);
 		spin_unlock(&old->i_lock);
-		spin_unlock(&inode_hash_lock);
+		inode_hash_unlock(&b);
 		wait_on_inode(old);
 		if (unlikely(!inode_unhashed(old))) {
 			iput(old);
@@ -1823,19 +1962,131 @@ EXPORT_SYMBOL(inode_needs_sync);
  * wake_up_bit(&inode->i_state, __I_NEW) after removing from the hash list
  * will DTRT.
  */
-static void __wait_on_freeing_inode(struct inode *inode)
+static void __wait_on_freeing_inode(struct inode *inode,
+				    struct super_block *sb,
+				    unsigned long hashval,
+				    struct inode_hash_bucket *b)
 {
 	wait_queue_head_t *wq;
 	DEFINE_WAIT_BIT(wait, &inode->i_state, __I_NEW);
 	wq = bit_waitqueue(&inode->i_state, __I_NEW);
 	prepare_to_wait(wq, &wait.wait, TASK_UNINTERRUPTIBLE);
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&inode_hash_lock);
+	inode_hash_unlock(b);
 	schedule();
 	finish_wait(wq, &wait.wait);
-	spin_lock(&inode_hash_lock);
+	inode_hash_lock(sb, hashval, b);
+}
+
+static struct inode_hash_table *inode_hash_alloc(unsigned int shift)
+{
+	struct inode_hash_table *tbl;
+
+	tbl = kmalloc(sizeof(*tbl), GFP_KERNEL);
+	if (!tbl)
+		return NULL;
+	/* zeroed heads are empty and unlocked */
+	tbl->buckets = vzalloc(sizeof(struct hlist_bl_head) << shift);
+	if (!tbl->buckets) {
+		kfree(tbl);
+		return NULL;
+	}
+	tbl->shift = shift;
+	tbl->mask = (1U << shift) - 1;
+	return tbl;
+}
+
+static void inode_hash_free(struct inode_hash_table *tbl)
+{
+	if (tbl == &inode_hash_boot)
+		return;
+	vfree(tbl->buckets);
+	kfree(tbl);
+}
+
+/* move the inodes of one bucket of the old table over to the new one */
+static void inode_hash_move_bucket(struct hlist_bl_head *ob,
+				   struct inode_hash_table *tbl)
+{
+	struct hlist_bl_node *node;
+
+	hlist_bl_lock(ob);
+	while ((node = hlist_bl_first(ob)) != NULL) {
+		struct inode *inode = hlist_bl_entry(node, struct inode, i_hash);
+		struct hlist_bl_head *nb;
+
+		nb = tbl->buckets + hash(inode->i_sb, inode->i_hashval, tbl);
+		hlist_bl_lock(nb);
+		/* not hlist_bl_del(), the inode must not look unhashed */
+		__hlist_bl_del(&inode->i_hash);
+		hlist_bl_add_head(&inode->i_hash, nb);
+		hlist_bl_unlock(nb);
+	}
+	hlist_bl_unlock(ob);
+}
+
+static void inode_hash_set(struct inode_hash_table *tbl,
+			   struct inode_hash_table *old)
+{
+	preempt_disable();
+	write_seqcount_begin(&inode_hash_seq);
+	WRITE_ONCE(inode_hash, tbl);
+	WRITE_ONCE(inode_hash_old, old);
+	write_seqcount_end(&inode_hash_seq);
+	preempt_enable();
+}
+
+/*
+ * Double the inode hash, if it is still loaded past two inodes a bucket
+ * once we get here.  Lookups and inserts go on all along.
+ */
+static void inode_hash_grow(struct work_struct *work)
+{
+	struct inode_hash_table *tbl, *old;
+	unsigned int i;
+
+	mutex_lock(&inode_hash_grow_mutex);
+	old = inode_hash;
+	if (old->shift >= inode_hash_max_shift ||
+	    percpu_counter_sum(&nr_inodes_hashed) <= (2LL << old->shift))
+		goto out;
+
+	tbl = inode_hash_alloc(old->shift + 1);
+	if (!tbl)
+		goto out;
+
+	inode_hash_set(tbl, old);
+
+	for (i = 0; i <= old->mask; i++) {
+		inode_hash_move_bucket(&old->buckets[i], tbl);
+		cond_resched();
+	}
+
+	inode_hash_set(tbl, NULL);
+	synchronize_rcu();
+	inode_hash_free(old);
+
+	pr_debug("Inode-cache hash table grown to %u entries\n",
+		 1U << tbl->shift);
+out:
+	mutex_unlock(&inode_hash_grow_mutex);
 }
 
+/*
+ * Let the hash grow until the buckets would take about 1/256th of the
+ * memory; no more inodes than that can be cached at two a bucket anyway.
+ */
+static int __init inode_hash_grow_init(void)
+{
+	unsigned long pages = totalram_pages >> 8;
+
+	WRITE_ONCE(inode_hash_max_shift,
+		   max_t(unsigned int, inode_hash->shift,
+			 ilog2(pages * PAGE_SIZE / sizeof(struct hlist_bl_head))));
+	return 0;
+}
+core_initcall(inode_hash_grow_init);
+
 static __initdata unsigned long ihash_entries;
 static int __init set_ihash_entries(char *str)
 {
@@ -1859,19 +2110,19 @@ void __init inode_init_early(void)
 	if (hashdist)
 		return;
 
-	inode_hashtable =
+	inode_hash_boot.buckets =
 		alloc_large_system_hash("Inode-cache",
-					sizeof(struct hlist_head),
+					sizeof(struct hlist_bl_head),
 					ihash_entries,
 					14,
 					HASH_EARLY,
-					&i_hash_shift,
-					&i_hash_mask,
+					&inode_hash_boot.shift,
+					&inode_hash_boot.mask,
 					0,
 					0);
 
-	for (loop = 0; loop < (1U << i_hash_shift); loop++)
-		INIT_HLIST_HEAD(&inode_hashtable[loop]);
+	for (loop = 0; loop < (1U << inode_hash_boot.shift); loop++)
+		INIT_HLIST_BL_HEAD(&inode_hash_boot.buckets[loop]);
 }
 
 void __init inode_init(void)
@@ -1886,23 +2137,26 @@ void __init inode_init(void)
 					 SLAB_MEM_SPREAD),
 					 init_once);
 
+	if (percpu_counter_init(&nr_inodes_hashed, 0, GFP_KERNEL))
+		panic("inode_init: can't count hashed inodes");
+
 	/* Hash may have been set up in inode_init_early */
 	if (!hashdist)
 		return;
 
-	inode_hashtable =
+	inode_hash_boot.buckets =
 		alloc_large_system_hash("Inode-cache",
-					sizeof(struct hlist_head),
+					sizeof(struct hlist_bl_head),
 					ihash_entries,
 					14,
 					0,
-					&i_hash_shift,
-					&i_hash_mask,
+					&inode_hash_boot.shift,
+					&inode_hash_boot.mask,
 					0,
 					0);
 
-	for (loop = 0; loop < (1U << i_hash_shift); loop++)
-		INIT_HLIST_HEAD(&inode_hashtable[loop]);
+	for (loop = 0; loop < (1U << inode_hash_boot.shift); loop++)
+		INIT_HLIST_BL_HEAD(&inode_hash_boot.buckets[loop]);
 }
 
 void init_special_inode(struct inode *inode, umode_t mode, dev_t rdev)
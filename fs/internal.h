@@ -131,6 +131,40 @@ extern struct dentry *__d_alloc(struct super_block *, const struct qstr *);
 extern int d_set_mounted(struct dentry *dentry);
 extern long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc);
 
+/*
+ * path_cache.c
+ */
+#ifdef CONFIG_FS_PATH_CACHE
+struct path_cache_key {
+	const char	*name;		/* the directory part of the path */
+	const char	*last;		/* and the last component after it */
+	unsigned int	len;
+	unsigned int	hash;
+	unsigned int	gen;		/* ->s_path_cache_gen at the start */
+	unsigned int	rename_seq;	/* rename_lock at the start */
+	struct dentry	*start;
+	struct vfsmount	*mnt;
+	bool		store;		/* walk qualifies for storing so far */
+};
+
+extern bool path_cache_lookup(struct path_cache_key *key, const char *name,
+			      const struct path *start, unsigned int m_seq,
+			      struct dentry **dentry, struct inode **inode,
+			      unsigned int *seq);
+extern void path_cache_store(struct path_cache_key *key, unsigned int m_seq,
+			     struct dentry *dentry, struct inode *inode,
+			     unsigned int seq);
+extern void path_cache_free(struct super_block *sb);
+#else
+struct path_cache_key {
+	bool		store;
+};
+
+static inline void path_cache_free(struct super_block *sb)
+{
+}
+#endif
+
 /*
  * read_write.c
  */
@@ -765,6 +765,181 @@ int jbd2_journal_next_log_block(journal_t *journal, unsigned long long *retp)
 	return jbd2_journal_bmap(journal, blocknr, retp);
 }
 
+/*
+ * Fast commits.  Instead of writing out every metadata block the running
+ * transaction touched, the filesystem writes its own compact records of
+ * the changes into the fast commit area, and jbd2 hands them back to it
+ * through ->j_fc_replay_callback during recovery.  The transaction still
+ * gets its full commit later on, which obsoletes the fast commits.
+ *
+ * The filesystem brackets a fast commit with jbd2_fc_begin_commit() and
+ * jbd2_fc_end_commit(), and in between gets the blocks to write with
+ * jbd2_fc_get_buf(), submits them itself and waits on them with
+ * jbd2_fc_wait_bufs().  If it can't express a change compactly, or the
+ * area is full, it ends with jbd2_fc_end_commit_fallback() instead,
+ * which does a full commit.
+ */
+
+/*
+ * Start a fast commit of transaction @tid, holding off any new updates.
+ * Returns 0 if the fast commit may go ahead, -EALREADY if @tid was
+ * committed meanwhile, or another commit finished while we waited for
+ * it, -EINVAL if there is no full commit for the fast commits to follow
+ * yet or the journal has no fast commit area, and -EIO if it aborted.
+ * Every error but -EALREADY means a full commit is needed.
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	if (unlikely(is_journal_aborted(journal)))
+		return -EIO;
+
+	if (!jbd2_has_feature_fast_commit(journal) || !journal->j_fc_wbuf)
+		return -EINVAL;
+
+	write_lock(&journal->j_state_lock);
+	/*
+	 * Recovery skips a log marked empty, fast commits and all; the next
+	 * full commit writes the tail to the superblock again.
+	 */
+	if (journal->j_flags & JBD2_FLUSHED) {
+		write_unlock(&journal->j_state_lock);
+		return -EINVAL;
+	}
+
+	if (tid_geq(journal->j_commit_sequence, tid)) {
+		write_unlock(&journal->j_state_lock);
+		return -EALREADY;
+	}
+
+	if (journal->j_flags &
+	    (JBD2_FULL_COMMIT_ONGOING | JBD2_FAST_COMMIT_ONGOING)) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		finish_wait(&journal->j_fc_wait, &wait);
+		return -EALREADY;
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+
+	jbd2_journal_lock_updates(journal);
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+
+static int __jbd2_fc_end_commit(journal_t *journal, bool fallback)
+{
+	tid_t tid = 0;
+
+	read_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction)
+		tid = journal->j_running_transaction->t_tid;
+	read_unlock(&journal->j_state_lock);
+
+	jbd2_journal_unlock_updates(journal);
+	if (journal->j_fc_cleanup_callback)
+		journal->j_fc_cleanup_callback(journal, 0, tid);
+
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+
+	if (fallback && tid)
+		return jbd2_complete_transaction(journal, tid);
+	return 0;
+}
+
+int jbd2_fc_end_commit(journal_t *journal)
+{
+	return __jbd2_fc_end_commit(journal, false);
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+
+int jbd2_fc_end_commit_fallback(journal_t *journal)
+{
+	return __jbd2_fc_end_commit(journal, true);
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit_fallback);
+
+/*
+ * Get the next block of the fast commit area, to be filled in and
+ * submitted by the caller.  Returns -ENOSPC when the area is full.
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out)
+{
+	unsigned long long pblock;
+	unsigned long blocknr;
+	struct buffer_head *bh;
+	int fc_off, err;
+
+	*bh_out = NULL;
+
+	if (journal->j_fc_first + journal->j_fc_off >= journal->j_fc_last)
+		return -ENOSPC;
+
+	fc_off = journal->j_fc_off;
+	blocknr = journal->j_fc_first + fc_off;
+	err = jbd2_journal_bmap(journal, blocknr, &pblock);
+	if (err)
+		return err;
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+
+	journal->j_fc_off++;
+	journal->j_fc_wbuf[fc_off] = bh;
+	*bh_out = bh;
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_get_buf);
+
+/*
+ * Wait for the last @num_blks fast commit buffers handed out, and drop
+ * them.  Waits in reverse order, so that we are less likely to be woken
+ * up before all of them are done.
+ */
+int jbd2_fc_wait_bufs(journal_t *journal, int num_blks)
+{
+	struct buffer_head *bh;
+	int i, err = 0;
+
+	for (i = journal->j_fc_off - 1;
+	     i >= 0 && i >= (int)journal->j_fc_off - num_blks; i--) {
+		bh = journal->j_fc_wbuf[i];
+		if (!bh)
+			continue;
+		wait_on_buffer(bh);
+		if (unlikely(!buffer_uptodate(bh)))
+			err = -EIO;
+		put_bh(bh);
+		journal->j_fc_wbuf[i] = NULL;
+	}
+	return err;
+}
+EXPORT_SYMBOL(jbd2_fc_wait_bufs);
+
+/* Drop the fast commit buffers not waited on, when giving up on them */
+int jbd2_fc_release_bufs(journal_t *journal)
+{
+	struct buffer_head *bh;
+	int i;
+
+	for (i = journal->j_fc_off - 1; i >= 0; i--) {
+		bh = journal->j_fc_wbuf[i];
+		if (!bh)
+			break;
+		put_bh(bh);
+		journal->j_fc_wbuf[i] = NULL;
+	}
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_release_bufs);
+
 /*
  * Conversion of logical to physical block numbers for the journal
  *
@@ -1080,6 +1255,7 @@ static journal_t * journal_init_common (void)
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
 	init_waitqueue_head(&journal->j_wait_reserved);
+	init_waitqueue_head(&journal->j_fc_wait);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
 	spin_lock_init(&journal->j_revoke_lock);
@@ -1266,6 +1442,47 @@ static void journal_fail_superblock (journal_t *journal)
  * subsequent use.
  */
 
+/*
+ * Carve the fast commit area off the end of the log.  Called with j_first
+ * and j_last spanning the whole journal.
+ */
+static int journal_fc_geometry(journal_t *journal)
+{
+	unsigned long num_fc_blks;
+
+	if (!jbd2_has_feature_fast_commit(journal))
+		return 0;
+
+	num_fc_blks = jbd2_journal_get_num_fc_blks(journal->j_superblock);
+	if (journal->j_first + JBD2_MIN_JOURNAL_BLOCKS + num_fc_blks >
+	    journal->j_last + 1) {
+		printk(KERN_ERR "JBD2: Journal too short for %lu fast commit "
+		       "blocks.\n", num_fc_blks);
+		return -EINVAL;
+	}
+
+	journal->j_fc_last = journal->j_last;
+	journal->j_last -= num_fc_blks;
+	journal->j_fc_first = journal->j_last;
+	journal->j_fc_off = 0;
+	return 0;
+}
+
+static int journal_fc_alloc_wbuf(journal_t *journal)
+{
+	int n = jbd2_journal_get_num_fc_blks(journal->j_superblock);
+
+	if (journal->j_fc_wbuf)
+		return 0;
+
+	journal->j_fc_wbuf = kcalloc(n, sizeof(struct buffer_head *),
+				     GFP_KERNEL);
+	if (!journal->j_fc_wbuf)
+		return -ENOMEM;
+	journal->j_fc_wbufsize = n;
+	return 0;
+}
+
 static int journal_reset(journal_t *journal)
 {
 	journal_superblock_t *sb = journal->j_superblock;
@@ -1282,10 +1499,14 @@ static int journal_reset(journal_t *journal)
 
 	journal->j_first = first;
 	journal->j_last = last;
+	if (journal_fc_geometry(journal)) {
+		journal_fail_superblock(journal);
+		return -EINVAL;
+	}
 
 	journal->j_head = first;
 	journal->j_tail = first;
-	journal->j_free = last - first;
+	journal->j_free = journal->j_last - first;
 
 	journal->j_tail_sequence = journal->j_transaction_sequence;
 	journal->j_commit_sequence = journal->j_transaction_sequence - 1;
@@ -1599,7 +1820,8 @@ static int load_superblock(journal_t *journal)
 	journal->j_last = be32_to_cpu(sb->s_maxlen);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
-	return 0;
+	/* recovery must not mistake the fast commit area for log */
+	return journal_fc_geometry(journal);
 }
 
 
@@ -1660,6 +1882,10 @@ int jbd2_journal_load(journal_t *journal)
 	if (journal_reset(journal))
 		goto recovery_error;
 
+	if (jbd2_has_feature_fast_commit(journal) &&
+	    journal_fc_alloc_wbuf(journal))
+		return -ENOMEM;
+
 	journal->j_flags &= ~JBD2_ABORT;
 	journal->j_flags |= JBD2_LOADED;
 	return 0;
@@ -1738,6 +1964,7 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_chksum_driver)
 		crypto_free_shash(journal->j_chksum_driver);
 	kfree(journal->j_wbuf);
+	kfree(journal->j_fc_wbuf);
 	kfree(journal);
 
 	return err;
@@ -1823,6 +2050,42 @@ int jbd2_journal_check_available_features (journal_t *journal, unsigned long com
  *
  */
 
+/*
+ * Turn fast commits on for a loaded journal.  The log isn't moved, so this
+ * only works while it is empty and clear of the area to be carved off,
+ * which is the case right after jbd2_journal_load().
+ */
+static int journal_enable_fast_commit(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long num_fc_blks = jbd2_journal_get_num_fc_blks(sb);
+	int err;
+
+	err = journal_fc_alloc_wbuf(journal);
+	if (err)
+		return err;
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction ||
+	    journal->j_committing_transaction ||
+	    journal->j_head != journal->j_tail ||
+	    journal->j_head + num_fc_blks >= journal->j_last) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	jbd2_set_feature_fast_commit(journal);
+	err = journal_fc_geometry(journal);
+	if (err) {
+		jbd2_clear_feature_fast_commit(journal);
+		goto out;
+	}
+	journal->j_free = journal->j_last - journal->j_first;
+out:
+	write_unlock(&journal->j_state_lock);
+	return err;
+}
+
 int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 			  unsigned long ro, unsigned long incompat)
 {
@@ -1878,6 +2141,11 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 		}
 	}
 
+	/* If enabling fast commits, carve the fast commit area off the log */
+	if (INCOMPAT_FEATURE_ON(JBD2_FEATURE_INCOMPAT_FAST_COMMIT) &&
+	    journal_enable_fast_commit(journal))
+		return 0;
+
 	/* If enabling v1 checksums, downgrade superblock */
 	if (COMPAT_FEATURE_ON(JBD2_FEATURE_COMPAT_CHECKSUM))
 		sb->s_feature_incompat &=
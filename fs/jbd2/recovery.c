@@ -417,6 +417,44 @@ static int jbd2_block_tag_csum_verify(journal_t *j, journal_block_tag_t *tag,
 		return tag->t_checksum == cpu_to_be16(csum32);
 }
 
+/*
+ * Hand the fast commit area to the filesystem, block by block, until it
+ * says the valid records end.  The fast commits that count are those of
+ * the transaction after the last one found in the log.
+ */
+static int fc_do_one_pass(journal_t *journal,
+			  struct recovery_info *info, enum passtype pass)
+{
+	unsigned int expected_commit_id = info->end_transaction;
+	unsigned long next_fc_block;
+	struct buffer_head *bh;
+	int err = 0;
+
+	next_fc_block = journal->j_fc_first;
+	if (!journal->j_fc_replay_callback)
+		return 0;
+
+	while (next_fc_block < journal->j_fc_last) {
+		err = jread(&bh, journal, next_fc_block);
+		if (err)
+			break;
+
+		err = journal->j_fc_replay_callback(journal, bh, pass,
+					next_fc_block - journal->j_fc_first,
+					expected_commit_id);
+		brelse(bh);
+		next_fc_block++;
+		if (err < 0 || err == JBD2_FC_REPLAY_STOP)
+			break;
+		err = 0;
+	}
+
+	if (err < 0)
+		printk(KERN_ERR "JBD2: fast commit replay failed, error %d\n",
+		       err);
+	return err < 0 ? err : 0;
+}
+
 static int do_one_pass(journal_t *journal,
 			struct recovery_info *info, enum passtype pass)
 {
@@ -803,6 +841,12 @@ static int do_one_pass(journal_t *journal,
 				success = -EIO;
 		}
 	}
+	if (jbd2_has_feature_fast_commit(journal) && pass != PASS_REVOKE) {
+		err = fc_do_one_pass(journal, info, pass);
+		if (err && !success)
+			success = err;
+	}
+
 	if (block_error && success == 0)
 		success = -EIO;
 	return success;
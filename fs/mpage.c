@@ -365,21 +365,35 @@ mpage_readpages(struct address_space *mapping, struct list_head *pages,
 
 	map_bh.b_state = 0;
 	map_bh.b_size = 0;
-	for (page_idx = 0; page_idx < nr_pages; page_idx++) {
-		struct page *page = list_entry(pages->prev, struct page, lru);
-
-		prefetchw(&page->flags);
-		list_del(&page->lru);
-		if (!add_to_page_cache_lru(page, mapping,
-					page->index,
-					gfp)) {
-			bio = do_mpage_readpage(bio, page,
-					nr_pages - page_idx,
-					&last_block_in_bio, &map_bh,
-					&first_logical_block,
-					get_block, gfp);
+	for (page_idx = 0; page_idx < nr_pages; ) {
+		struct page *batch[PAGEVEC_SIZE];
+		int nr = min_t(unsigned, nr_pages - page_idx, PAGEVEC_SIZE);
+		int i, added;
+
+		for (i = 0; i < nr; i++) {
+			batch[i] = list_entry(pages->prev, struct page, lru);
+			prefetchw(&batch[i]->flags);
+			list_del(&batch[i]->lru);
+		}
+
+		for (i = 0; i < nr; ) {
+			added = add_to_page_cache_lru_batch(batch + i, nr - i,
+							    mapping, gfp);
+			if (added <= 0) {
+				page_cache_release(batch[i++]);
+				page_idx++;
+				continue;
+			}
+			while (added--) {
+				bio = do_mpage_readpage(bio, batch[i],
+						nr_pages - page_idx,
+						&last_block_in_bio, &map_bh,
+						&first_logical_block,
+						get_block, gfp);
+				page_cache_release(batch[i++]);
+				page_idx++;
+			}
 		}
-		page_cache_release(page);
 	}
 	BUG_ON(!list_empty(pages));
 	if (bio)
@@ -1441,15 +1441,45 @@ static int follow_dotdot(struct nameidata *nd)
 	return 0;
 }
 
+static inline bool lookup_parallel(const struct dentry *dir)
+{
+	return dir->d_sb->s_type->fs_flags & FS_PARALLEL_LOOKUP;
+}
+
+/*
+ * Allocate a dentry to look the name up with.  Where lookups run in
+ * parallel, it comes from the in-lookup hash even with i_mutex held, so
+ * it may turn out to be looked up already; need_lookup tells.
+ */
+static struct dentry *lookup_alloc(struct qstr *name, struct dentry *dir,
+				   wait_queue_head_t *wq, bool *need_lookup)
+{
+	struct dentry *dentry;
+
+	if (lookup_parallel(dir)) {
+		dentry = d_alloc_parallel(dir, name, wq);
+		if (!IS_ERR(dentry))
+			*need_lookup = d_in_lookup(dentry);
+		return dentry;
+	}
+
+	dentry = d_alloc(dir, name);
+	if (unlikely(!dentry))
+		return ERR_PTR(-ENOMEM);
+	*need_lookup = true;
+	return dentry;
+}
+
 /*
  * This looks up the name in dcache, possibly revalidates the old dentry and
  * allocates a new one if not found or not valid.  In the need_lookup argument
- * returns whether i_op->lookup is necessary.
+ * returns whether i_op->lookup is necessary.  @wq must outlive the lookup.
  *
- * dir->d_inode->i_mutex must be held
+ * dir->d_inode->i_mutex must be held, unless lookup_parallel(dir)
  */
 static struct dentry *lookup_dcache(struct qstr *name, struct dentry *dir,
-				    unsigned int flags, bool *need_lookup)
+				    unsigned int flags, wait_queue_head_t *wq,
+				    bool *need_lookup)
 {
 	struct dentry *dentry;
 	int error;
@@ -1472,13 +1502,8 @@ static struct dentry *lookup_dcache(struct qstr *name, struct dentry *dir,
 		}
 	}
 
-	if (!dentry) {
-		dentry = d_alloc(dir, name);
-		if (unlikely(!dentry))
-			return ERR_PTR(-ENOMEM);
-
-		*need_lookup = true;
-	}
+	if (!dentry)
+		dentry = lookup_alloc(name, dir, wq, need_lookup);
 	return dentry;
 }
 
@@ -1486,7 +1511,7 @@ static struct dentry *lookup_dcache(struct qstr *name, struct dentry *dir,
  * Call i_op->lookup on the dentry.  The dentry must be negative and
  * unhashed.
  *
- * dir->d_inode->i_mutex must be held
+ * dir->d_inode->i_mutex must be held, unless it does parallel lookups
  */
 static struct dentry *lookup_real(struct inode *dir, struct dentry *dentry,
 				  unsigned int flags)
@@ -1495,11 +1520,13 @@ static struct dentry *lookup_real(struct inode *dir, struct dentry *dentry,
 
 	/* Don't create child dentry for a dead directory. */
 	if (unlikely(IS_DEADDIR(dir))) {
+		d_lookup_done(dentry);
 		dput(dentry);
 		return ERR_PTR(-ENOENT);
 	}
 
 	old = dir->i_op->lookup(dir, dentry, flags);
+	d_lookup_done(dentry);
 	if (unlikely(old)) {
 		dput(dentry);
 		dentry = old;
@@ -1510,10 +1537,11 @@ static struct dentry *lookup_real(struct inode *dir, struct dentry *dentry,
 static struct dentry *__lookup_hash(struct qstr *name,
 		struct dentry *base, unsigned int flags)
 {
+	DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
 	bool need_lookup;
 	struct dentry *dentry;
 
-	dentry = lookup_dcache(name, base, flags, &need_lookup);
+	dentry = lookup_dcache(name, base, flags, &wq, &need_lookup);
 	if (!need_lookup)
 		return dentry;
 
@@ -1630,9 +1658,14 @@ static int lookup_slow(struct nameidata *nd, struct path *path)
 	parent = nd->path.dentry;
 	BUG_ON(nd->inode != parent->d_inode);
 
-	mutex_lock(&parent->d_inode->i_mutex);
-	dentry = __lookup_hash(&nd->last, parent, nd->flags);
-	mutex_unlock(&parent->d_inode->i_mutex);
+	if (lookup_parallel(parent)) {
+		/* d_alloc_parallel() keeps the lookups of one name apart */
+		dentry = __lookup_hash(&nd->last, parent, nd->flags);
+	} else {
+		mutex_lock(&parent->d_inode->i_mutex);
+		dentry = __lookup_hash(&nd->last, parent, nd->flags);
+		mutex_unlock(&parent->d_inode->i_mutex);
+	}
 	if (IS_ERR(dentry))
 		return PTR_ERR(dentry);
 	path->mnt = nd->path.mnt;
@@ -1885,6 +1918,89 @@ static inline u64 hash_name(const char *name)
 
 #endif
 
+#ifdef CONFIG_FS_PATH_CACHE
+/* dentries whose lookups a cached walk would skip something for */
+#define PATH_CACHE_BAD_DENTRY	(DCACHE_OP_HASH | DCACHE_OP_REVALIDATE | \
+				 DCACHE_OP_WEAK_REVALIDATE | \
+				 DCACHE_MANAGED_DENTRY | \
+				 DCACHE_OP_SELECT_INODE | DCACHE_OP_REAL)
+
+/*
+ * Can a cached walk skip the MAY_EXEC check on this directory?  Only if
+ * it would pass for anyone: no ->permission(), exec for all and no ACL.
+ */
+static inline bool path_cache_dir_ok(struct inode *inode)
+{
+	if (!(inode->i_opflags & IOP_FASTPERM) ||
+	    (inode->i_mode & S_IXUGO) != S_IXUGO)
+		return false;
+#ifdef CONFIG_FS_POSIX_ACL
+	if (IS_POSIXACL(inode) && READ_ONCE(inode->i_acl))
+		return false;
+#endif
+	return true;
+}
+
+/*
+ * Look the directory part of @name up in the path cache.  On a hit, move
+ * @nd there and return the last component; otherwise return @name, with
+ * @key set up for path_cache_note() to store the walk.
+ */
+static const char *path_cache_walk(struct nameidata *nd, const char *name,
+				   struct path_cache_key *key)
+{
+	struct dentry *dentry;
+	struct inode *inode;
+	unsigned seq;
+
+	key->store = false;
+	if (!(nd->flags & LOOKUP_RCU) || nd->depth)
+		return name;
+	if (!path_cache_lookup(key, name, &nd->path, nd->m_seq,
+			       &dentry, &inode, &seq))
+		return name;
+
+	nd->path.dentry = dentry;
+	nd->inode = inode;
+	nd->seq = seq;
+	nd->flags &= ~LOOKUP_JUMPED;
+	return key->last;
+}
+
+/*
+ * Called on each directory the walk gets to while it still qualifies:
+ * stop if it no longer does, store it when the last component is next.
+ */
+static void path_cache_note(struct nameidata *nd, const char *name,
+			    struct path_cache_key *key)
+{
+	if (!(nd->flags & LOOKUP_RCU) || nd->path.mnt != key->mnt ||
+	    (READ_ONCE(nd->path.dentry->d_flags) & PATH_CACHE_BAD_DENTRY) ||
+	    !path_cache_dir_ok(nd->inode)) {
+		key->store = false;
+		return;
+	}
+	if (name == key->last) {
+		path_cache_store(key, nd->m_seq, nd->path.dentry, nd->inode,
+				 nd->seq);
+		key->store = false;
+	}
+}
+#else
+static inline const char *path_cache_walk(struct nameidata *nd,
+					  const char *name,
+					  struct path_cache_key *key)
+{
+	key->store = false;
+	return name;
+}
+
+static inline void path_cache_note(struct nameidata *nd, const char *name,
+				   struct path_cache_key *key)
+{
+}
+#endif
+
 /*
  * Name resolution.
  * This is the basic name resolution function, turning a pathname into
@@ -1895,6 +2011,7 @@ static inline u64 hash_name(const char *name)
  */
 static int link_path_walk(const char *name, struct nameidata *nd)
 {
+	struct path_cache_key pck;
 	int err;
 
 	while (*name=='/')
@@ -1902,11 +2019,16 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 	if (!*name)
 		return 0;
 
+	name = path_cache_walk(nd, name, &pck);
+
 	/* At this point we know we have a real path component. */
 	for(;;) {
 		u64 hash_len;
 		int type;
 
+		if (unlikely(pck.store))
+			path_cache_note(nd, name, &pck);
+
 		err = may_lookup(nd);
  		if (err)
 			return err;
@@ -1924,6 +2046,8 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 			case 1:
 				type = LAST_DOT;
 		}
+		if (unlikely(type != LAST_NORM))
+			pck.store = false;
 		if (likely(type == LAST_NORM)) {
 			struct dentry *parent = nd->path.dentry;
 			nd->flags &= ~LOOKUP_JUMPED;
@@ -1971,6 +2095,7 @@ OK:
 		if (err) {
 			const char *s = get_link(nd);
 
+			pck.store = false;
 			if (IS_ERR(s))
 				return PTR_ERR(s);
 			err = 0;
@@ -2405,17 +2530,17 @@ mountpoint_last(struct nameidata *nd, struct path *path)
 	mutex_lock(&dir->d_inode->i_mutex);
 	dentry = d_lookup(dir, &nd->last);
 	if (!dentry) {
+		DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
+		bool need_lookup;
+
 		/*
 		 * No cached dentry. Mounted dentries are pinned in the cache,
 		 * so that means that this dentry is probably a symlink or the
 		 * path doesn't actually point to a mounted dentry.
 		 */
-		dentry = d_alloc(dir, &nd->last);
-		if (!dentry) {
-			mutex_unlock(&dir->d_inode->i_mutex);
-			return -ENOMEM;
-		}
-		dentry = lookup_real(dir->d_inode, dentry, nd->flags);
+		dentry = lookup_alloc(&nd->last, dir, &wq, &need_lookup);
+		if (!IS_ERR(dentry) && need_lookup)
+			dentry = lookup_real(dir->d_inode, dentry, nd->flags);
 		if (IS_ERR(dentry)) {
 			mutex_unlock(&dir->d_inode->i_mutex);
 			return PTR_ERR(dentry);
@@ -2794,6 +2919,7 @@ static int atomic_open(struct nameidata *nd, struct dentry *dentry,
 
 	/* Don't create child dentry for a dead directory. */
 	if (unlikely(IS_DEADDIR(dir))) {
+		d_lookup_done(dentry);
 		error = -ENOENT;
 		goto out;
 	}
@@ -2851,6 +2977,7 @@ static int atomic_open(struct nameidata *nd, struct dentry *dentry,
 	file->f_path.mnt = nd->path.mnt;
 	error = dir->i_op->atomic_open(dir, dentry, file, open_flag, mode,
 				      opened);
+	d_lookup_done(dentry);
 	if (error < 0) {
 		if (create_error && error == -ENOENT)
 			error = create_error;
@@ -2942,12 +3069,13 @@ static int lookup_open(struct nameidata *nd, struct path *path,
 {
 	struct dentry *dir = nd->path.dentry;
 	struct inode *dir_inode = dir->d_inode;
+	DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
 	struct dentry *dentry;
 	int error;
 	bool need_lookup;
 
 	*opened &= ~FILE_CREATED;
-	dentry = lookup_dcache(&nd->last, dir, nd->flags, &need_lookup);
+	dentry = lookup_dcache(&nd->last, dir, nd->flags, &wq, &need_lookup);
 	if (IS_ERR(dentry))
 		return PTR_ERR(dentry);
 
@@ -13,6 +13,9 @@
 #include <linux/highmem.h>
 #include <linux/log2.h>
 #include <linux/hash.h>
+#include <linux/percpu.h>
+#include <linux/rculist.h>
+#include <linux/seqlock.h>
 #include <net/checksum.h>
 
 #include "nfsd.h"
@@ -27,14 +30,37 @@
  */
 #define TARGET_BUCKET_SIZE	64
 
+/*
+ * Lookups walk the hash chain of a bucket under RCU, without its lock.
+ * What they find is only good if ->hash_seq didn't move until the lock
+ * was taken, otherwise the chain is searched again with the lock held.
+ * Entries are SLAB_DESTROY_BY_RCU, so whatever a lockless walk runs into
+ * is still a struct svc_cacherep.
+ */
 struct nfsd_drc_bucket {
+	struct hlist_head hash_head;
 	struct list_head lru_head;
+	seqcount_t hash_seq;
 	spinlock_t cache_lock;
 };
 
 static struct nfsd_drc_bucket	*drc_hashtbl;
 static struct kmem_cache	*drc_slab;
 
+/*
+ * Entries freed from the cache are kept on the CPU they were freed on for
+ * the next miss, which usually comes soon as every non-idempotent call
+ * needs one.
+ */
+#define DRC_PCP_ENTRIES		16
+
+struct nfsd_drc_pcp {
+	unsigned int		count;
+	struct svc_cacherep	*ent[DRC_PCP_ENTRIES];
+};
+
+static DEFINE_PER_CPU(struct nfsd_drc_pcp, drc_pcp);
+
 /* max number of entries allowed in the cache */
 static unsigned int		max_drc_entries;
 
@@ -121,35 +147,59 @@ nfsd_cache_hash(__be32 xid)
 static struct svc_cacherep *
 nfsd_reply_cache_alloc(void)
 {
-	struct svc_cacherep	*rp;
+	struct nfsd_drc_pcp	*pcp = get_cpu_ptr(&drc_pcp);
+	struct svc_cacherep	*rp = NULL;
+
+	if (pcp->count)
+		rp = pcp->ent[--pcp->count];
+	put_cpu_ptr(&drc_pcp);
 
-	rp = kmem_cache_alloc(drc_slab, GFP_KERNEL);
+	if (!rp)
+		rp = kmem_cache_alloc(drc_slab, GFP_KERNEL);
 	if (rp) {
 		rp->c_state = RC_UNUSED;
 		rp->c_type = RC_NOCACHE;
 		INIT_LIST_HEAD(&rp->c_lru);
+		INIT_HLIST_NODE(&rp->c_hash);
 	}
 	return rp;
 }
 
+/* hand an entry which isn't in the cache back, with preemption disabled */
 static void
-nfsd_reply_cache_free_locked(struct svc_cacherep *rp)
+nfsd_reply_cache_put(struct svc_cacherep *rp)
+{
+	struct nfsd_drc_pcp	*pcp = this_cpu_ptr(&drc_pcp);
+
+	if (pcp->count < DRC_PCP_ENTRIES)
+		pcp->ent[pcp->count++] = rp;
+	else
+		kmem_cache_free(drc_slab, rp);
+}
+
+static void
+nfsd_reply_cache_free_locked(struct nfsd_drc_bucket *b, struct svc_cacherep *rp)
 {
 	if (rp->c_type == RC_REPLBUFF && rp->c_replvec.iov_base) {
 		drc_mem_usage -= rp->c_replvec.iov_len;
 		kfree(rp->c_replvec.iov_base);
 	}
+	if (!hlist_unhashed(&rp->c_hash)) {
+		write_seqcount_begin(&b->hash_seq);
+		hlist_del_init_rcu(&rp->c_hash);
+		write_seqcount_end(&b->hash_seq);
+	}
 	list_del(&rp->c_lru);
 	atomic_dec(&num_drc_entries);
 	drc_mem_usage -= sizeof(*rp);
-	kmem_cache_free(drc_slab, rp);
+	nfsd_reply_cache_put(rp);
 }
 
 static void
 nfsd_reply_cache_free(struct nfsd_drc_bucket *b, struct svc_cacherep *rp)
 {
 	spin_lock(&b->cache_lock);
-	nfsd_reply_cache_free_locked(rp);
+	nfsd_reply_cache_free_locked(b, rp);
 	spin_unlock(&b->cache_lock);
 }
 
@@ -169,7 +219,7 @@ int nfsd_reply_cache_init(void)
 		return status;
 
 	drc_slab = kmem_cache_create("nfsd_drc", sizeof(struct svc_cacherep),
-					0, 0, NULL);
+					0, SLAB_DESTROY_BY_RCU, NULL);
 	if (!drc_slab)
 		goto out_nomem;
 
@@ -177,7 +227,9 @@ int nfsd_reply_cache_init(void)
 	if (!drc_hashtbl)
 		goto out_nomem;
 	for (i = 0; i < hashsize; i++) {
+		INIT_HLIST_HEAD(&drc_hashtbl[i].hash_head);
 		INIT_LIST_HEAD(&drc_hashtbl[i].lru_head);
+		seqcount_init(&drc_hashtbl[i].hash_seq);
 		spin_lock_init(&drc_hashtbl[i].cache_lock);
 	}
 	drc_hashsize = hashsize;
@@ -193,15 +245,27 @@ void nfsd_reply_cache_shutdown(void)
 {
 	struct svc_cacherep	*rp;
 	unsigned int i;
+	int cpu;
 
 	unregister_shrinker(&nfsd_reply_cache_shrinker);
 
 	for (i = 0; i < drc_hashsize; i++) {
-		struct list_head *head = &drc_hashtbl[i].lru_head;
-		while (!list_empty(head)) {
-			rp = list_first_entry(head, struct svc_cacherep, c_lru);
-			nfsd_reply_cache_free_locked(rp);
+		struct nfsd_drc_bucket *b = &drc_hashtbl[i];
+
+		spin_lock(&b->cache_lock);
+		while (!list_empty(&b->lru_head)) {
+			rp = list_first_entry(&b->lru_head,
+					      struct svc_cacherep, c_lru);
+			nfsd_reply_cache_free_locked(b, rp);
 		}
+		spin_unlock(&b->cache_lock);
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct nfsd_drc_pcp *pcp = per_cpu_ptr(&drc_pcp, cpu);
+
+		while (pcp->count)
+			kmem_cache_free(drc_slab, pcp->ent[--pcp->count]);
 	}
 
 	kfree (drc_hashtbl);
@@ -239,7 +303,7 @@ prune_bucket(struct nfsd_drc_bucket *b)
 		if (atomic_read(&num_drc_entries) <= max_drc_entries &&
 		    time_before(jiffies, rp->c_timestamp + RC_EXPIRE))
 			break;
-		nfsd_reply_cache_free_locked(rp);
+		nfsd_reply_cache_free_locked(b, rp);
 		freed++;
 	}
 	return freed;
@@ -337,18 +401,18 @@ nfsd_cache_match(struct svc_rqst *rqstp, __wsum csum, struct svc_cacherep *rp)
 
 /*
  * Search the request hash for an entry that matches the given rqstp.
- * Must be called with cache_lock held. Returns the found entry or
- * NULL on failure.
+ * Called either with cache_lock held, or under RCU, in which case the
+ * result only stands if hash_seq didn't change meanwhile. Returns the
+ * found entry or NULL on failure.
  */
 static struct svc_cacherep *
 nfsd_cache_search(struct nfsd_drc_bucket *b, struct svc_rqst *rqstp,
 		__wsum csum)
 {
 	struct svc_cacherep	*rp, *ret = NULL;
-	struct list_head 	*rh = &b->lru_head;
 	unsigned int		entries = 0;
 
-	list_for_each_entry(rp, rh, c_lru) {
+	hlist_for_each_entry_rcu(rp, &b->hash_head, c_hash) {
 		++entries;
 		if (nfsd_cache_match(rqstp, csum, rp)) {
 			ret = rp;
@@ -371,11 +435,10 @@ nfsd_cache_search(struct nfsd_drc_bucket *b, struct svc_rqst *rqstp,
 }
 
 /*
- * Try to find an entry matching the current call in the cache. When none
- * is found, we try to grab the oldest expired entry off the LRU list. If
- * a suitable one isn't there, then drop the cache_lock and allocate a
- * new one, then search again in case one got inserted while this thread
- * didn't hold the lock.
+ * Try to find an entry matching the current call in the cache, first
+ * without the cache_lock. When none is found, get a new entry, then take
+ * the lock and search again if the hash chain changed meanwhile, in case
+ * an entry for a retransmission of this call got inserted.
  */
 int
 nfsd_cache_lookup(struct svc_rqst *rqstp)
@@ -389,6 +452,7 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 	u32 hash = nfsd_cache_hash(xid);
 	struct nfsd_drc_bucket *b = &drc_hashtbl[hash];
 	unsigned long		age;
+	unsigned int		seq;
 	int type = rqstp->rq_cachetype;
 	int rtn = RC_DOIT;
 
@@ -400,24 +464,29 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 
 	csum = nfsd_cache_csum(rqstp);
 
+	rcu_read_lock();
+	seq = read_seqcount_begin(&b->hash_seq);
+	found = nfsd_cache_search(b, rqstp, csum);
+	rcu_read_unlock();
+
 	/*
-	 * Since the common case is a cache miss followed by an insert,
-	 * preallocate an entry.
+	 * The common case is a cache miss followed by an insert, get the
+	 * entry before taking the lock.
 	 */
-	rp = nfsd_reply_cache_alloc();
+	rp = NULL;
+	if (!found)
+		rp = nfsd_reply_cache_alloc();
+
 	spin_lock(&b->cache_lock);
-	if (likely(rp)) {
-		atomic_inc(&num_drc_entries);
-		drc_mem_usage += sizeof(*rp);
-	}
 
 	/* go ahead and prune the cache */
 	prune_bucket(b);
 
-	found = nfsd_cache_search(b, rqstp, csum);
+	if (read_seqcount_retry(&b->hash_seq, seq))
+		found = nfsd_cache_search(b, rqstp, csum);
 	if (found) {
-		if (likely(rp))
-			nfsd_reply_cache_free_locked(rp);
+		if (rp)
+			nfsd_reply_cache_put(rp);
 		rp = found;
 		goto found_entry;
 	}
@@ -426,6 +495,8 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 		dprintk("nfsd: unable to allocate DRC entry!\n");
 		goto out;
 	}
+	atomic_inc(&num_drc_entries);
+	drc_mem_usage += sizeof(*rp);
 
 	nfsdstats.rcmisses++;
 	rqstp->rq_cacherep = rp;
@@ -439,6 +510,9 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 	rp->c_len = rqstp->rq_arg.len;
 	rp->c_csum = csum;
 
+	write_seqcount_begin(&b->hash_seq);
+	hlist_add_head_rcu(&rp->c_hash, &b->hash_head);
+	write_seqcount_end(&b->hash_seq);
 	lru_put_end(b, rp);
 
 	/* release any buffer */
@@ -484,7 +558,7 @@ found_entry:
 		break;
 	default:
 		printk(KERN_WARNING "nfsd: bad repcache type %d\n", rp->c_type);
-		nfsd_reply_cache_free_locked(rp);
+		nfsd_reply_cache_free_locked(b, rp);
 	}
 
 	goto out;
@@ -204,9 +204,21 @@ int ovl_set_attr(struct dentry *upperdentry, struct kstat *stat)
 	return err;
 }
 
+/* a metacopy upper has the size of the data it doesn't have */
+static int ovl_set_size(struct dentry *upperdentry, struct kstat *stat)
+{
+	struct iattr attr = {
+		.ia_valid = ATTR_SIZE,
+		.ia_size = stat->size,
+	};
+
+	return notify_change(upperdentry, &attr, NULL);
+}
+
 static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 			      struct dentry *dentry, struct path *lowerpath,
-			      struct kstat *stat, const char *link)
+			      struct kstat *stat, const char *link,
+			      bool metacopy)
 {
 	struct inode *wdir = workdir->d_inode;
 	struct inode *udir = upperdir->d_inode;
@@ -233,7 +245,7 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 	if (err)
 		goto out2;
 
-	if (S_ISREG(stat->mode)) {
+	if (S_ISREG(stat->mode) && !metacopy) {
 		struct path upperpath;
 		ovl_path_upper(dentry, &upperpath);
 		BUG_ON(upperpath.dentry != NULL);
@@ -248,8 +260,17 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 	if (err)
 		goto out_cleanup;
 
+	if (metacopy) {
+		err = ovl_do_setxattr(newdentry, OVL_XATTR_METACOPY, NULL, 0, 0);
+		if (err)
+			goto out_cleanup;
+	}
+
 	mutex_lock(&newdentry->d_inode->i_mutex);
-	err = ovl_set_attr(newdentry, stat);
+	if (metacopy)
+		err = ovl_set_size(newdentry, stat);
+	if (!err)
+		err = ovl_set_attr(newdentry, stat);
 	mutex_unlock(&newdentry->d_inode->i_mutex);
 	if (err)
 		goto out_cleanup;
@@ -258,6 +279,8 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 	if (err)
 		goto out_cleanup;
 
+	/* ovl_dentry_update() orders this before the upper is visible */
+	ovl_dentry_set_metacopy(dentry, metacopy);
 	ovl_dentry_update(dentry, newdentry);
 	newdentry = NULL;
 
@@ -292,9 +315,14 @@ out_cleanup:
  * up uses upper parent i_mutex for exclusion.  Since rename can change
  * d_parent it is possible that the copy up will lock the old parent.  At
  * that point the file will have already been copied up anyway.
+ *
+ * With @metacopy, a regular file gets everything but its data copied up.
+ * The upper is marked with OVL_XATTR_METACOPY, and reads go to the lower
+ * file until ovl_copy_up_meta_data() copies the data up too.
  */
 int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
-		    struct path *lowerpath, struct kstat *stat)
+		    struct path *lowerpath, struct kstat *stat,
+		    bool metacopy)
 {
 	struct dentry *workdir = ovl_workdir(dentry);
 	int err;
@@ -358,7 +386,7 @@ int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 	}
 
 	err = ovl_copy_up_locked(workdir, upperdir, dentry, lowerpath,
-				 stat, link);
+				 stat, link, metacopy && S_ISREG(stat->mode));
 	if (!err) {
 		/* Restore timestamps on parent (best effort) */
 		ovl_set_timestamps(upperdir, &pstat);
@@ -375,7 +403,72 @@ out_free_link:
 	return err;
 }
 
-int ovl_copy_up(struct dentry *dentry)
+/*
+ * Copy the data of a metacopy upper up.  Until the xattr is gone, a
+ * partial copy is ignored, so a crash in the middle is harmless.  The
+ * workdir lock keeps two of these from copying at once.
+ */
+static int ovl_copy_up_meta_data(struct dentry *dentry)
+{
+	struct dentry *workdir = ovl_workdir(dentry);
+	struct path upperpath, lowerpath;
+	const struct cred *old_cred;
+	struct cred *override_cred;
+	struct kstat stat;
+	int err;
+
+	if (WARN_ON(!workdir))
+		return -EROFS;
+
+	ovl_path_upper(dentry, &upperpath);
+	ovl_path_lower(dentry, &lowerpath);
+
+	override_cred = prepare_creds();
+	if (!override_cred)
+		return -ENOMEM;
+
+	/*
+	 * CAP_DAC_OVERRIDE for opening the upper for writing
+	 * CAP_SYS_ADMIN for removing the private xattr
+	 * CAP_FOWNER for the timestamp update
+	 */
+	cap_raise(override_cred->cap_effective, CAP_DAC_OVERRIDE);
+	cap_raise(override_cred->cap_effective, CAP_SYS_ADMIN);
+	cap_raise(override_cred->cap_effective, CAP_FOWNER);
+	old_cred = override_creds(override_cred);
+
+	mutex_lock_nested(&workdir->d_inode->i_mutex, I_MUTEX_PARENT);
+	if (!ovl_dentry_is_metacopy(dentry)) {
+		/* raced with another one */
+		err = 0;
+		goto out_unlock;
+	}
+
+	err = vfs_getattr(&upperpath, &stat);
+	if (err)
+		goto out_unlock;
+
+	err = ovl_copy_up_data(&lowerpath, &upperpath, stat.size);
+	if (err)
+		goto out_unlock;
+
+	err = ovl_do_removexattr(upperpath.dentry, OVL_XATTR_METACOPY);
+	if (err)
+		goto out_unlock;
+
+	mutex_lock(&upperpath.dentry->d_inode->i_mutex);
+	ovl_set_timestamps(upperpath.dentry, &stat);
+	mutex_unlock(&upperpath.dentry->d_inode->i_mutex);
+	ovl_dentry_set_metacopy(dentry, false);
+
+out_unlock:
+	mutex_unlock(&workdir->d_inode->i_mutex);
+	revert_creds(old_cred);
+	put_cred(override_cred);
+	return err;
+}
+
+static int ovl_copy_up_tree(struct dentry *dentry, bool metacopy)
 {
 	int err;
 
@@ -406,7 +499,8 @@ int ovl_copy_up(struct dentry *dentry)
 		ovl_path_lower(next, &lowerpath);
 		err = vfs_getattr(&lowerpath, &stat);
 		if (!err)
-			err = ovl_copy_up_one(parent, next, &lowerpath, &stat);
+			err = ovl_copy_up_one(parent, next, &lowerpath, &stat,
+					      metacopy && next == dentry);
 
 		dput(parent);
 		dput(next);
@@ -414,3 +508,21 @@ int ovl_copy_up(struct dentry *dentry)
 
 	return err;
 }
+
+/* copy up the dentry and its ancestors, data and all */
+int ovl_copy_up(struct dentry *dentry)
+{
+	int err;
+
+	err = ovl_copy_up_tree(dentry, false);
+	if (!err && ovl_dentry_is_metacopy(dentry))
+		err = ovl_copy_up_meta_data(dentry);
+
+	return err;
+}
+
+/* the same, but leave the data of a regular file in the lower layer */
+int ovl_copy_up_meta(struct dentry *dentry)
+{
+	return ovl_copy_up_tree(dentry, ovl_metacopy_enabled(dentry));
+}
@@ -30,7 +30,7 @@ static int ovl_copy_up_truncate(struct dentry *dentry)
 		goto out_dput_parent;
 
 	stat.size = 0;
-	err = ovl_copy_up_one(parent, dentry, &lowerpath, &stat);
+	err = ovl_copy_up_one(parent, dentry, &lowerpath, &stat, false);
 
 out_dput_parent:
 	dput(parent);
@@ -59,7 +59,11 @@ int ovl_setattr(struct dentry *dentry, struct iattr *attr)
 	if (err)
 		goto out;
 
-	err = ovl_copy_up(dentry);
+	/* only a size change needs the data */
+	if (attr->ia_valid & ATTR_SIZE)
+		err = ovl_copy_up(dentry);
+	else
+		err = ovl_copy_up_meta(dentry);
 	if (!err) {
 		upperdentry = ovl_dentry_upper(dentry);
 
@@ -78,9 +82,21 @@ static int ovl_getattr(struct vfsmount *mnt, struct dentry *dentry,
 			 struct kstat *stat)
 {
 	struct path realpath;
+	enum ovl_path_type type;
+	int err;
 
-	ovl_path_real(dentry, &realpath);
-	return vfs_getattr(&realpath, stat);
+	type = ovl_path_real(dentry, &realpath);
+	err = vfs_getattr(&realpath, stat);
+	if (!err && OVL_TYPE_UPPER(type) && ovl_dentry_is_metacopy(dentry)) {
+		struct kstat lowerstat;
+
+		/* the upper is all holes, the blocks are down there */
+		ovl_path_lower(dentry, &realpath);
+		err = vfs_getattr(&realpath, &lowerstat);
+		if (!err)
+			stat->blocks = lowerstat.blocks;
+	}
+	return err;
 }
 
 int ovl_permission(struct inode *inode, int mask)
@@ -235,7 +251,7 @@ int ovl_setxattr(struct dentry *dentry, const char *name,
 	if (ovl_is_private_xattr(name))
 		goto out_drop_write;
 
-	err = ovl_copy_up(dentry);
+	err = ovl_copy_up_meta(dentry);
 	if (err)
 		goto out_drop_write;
 
@@ -252,7 +268,8 @@ static bool ovl_need_xattr_filter(struct dentry *dentry,
 				  enum ovl_path_type type)
 {
 	if ((type & (__OVL_PATH_PURE | __OVL_PATH_UPPER)) == __OVL_PATH_UPPER)
-		return S_ISDIR(dentry->d_inode->i_mode);
+		return S_ISDIR(dentry->d_inode->i_mode) ||
+			ovl_dentry_is_metacopy(dentry);
 	else
 		return false;
 }
@@ -320,7 +337,7 @@ int ovl_removexattr(struct dentry *dentry, const char *name)
 		if (err < 0)
 			goto out_drop_write;
 
-		err = ovl_copy_up(dentry);
+		err = ovl_copy_up_meta(dentry);
 		if (err)
 			goto out_drop_write;
 
@@ -373,6 +390,21 @@ struct inode *ovl_d_select_inode(struct dentry *dentry, unsigned file_flags)
 			return ERR_PTR(err);
 
 		ovl_path_upper(dentry, &realpath);
+	} else if (OVL_TYPE_UPPER(type) && ovl_dentry_is_metacopy(dentry)) {
+		if ((OPEN_FMODE(file_flags) & FMODE_WRITE) ||
+		    (file_flags & O_TRUNC)) {
+			err = ovl_want_write(dentry);
+			if (err)
+				return ERR_PTR(err);
+
+			err = ovl_copy_up(dentry);
+			ovl_drop_write(dentry);
+			if (err)
+				return ERR_PTR(err);
+		} else {
+			/* read the data where it is */
+			ovl_path_lower(dentry, &realpath);
+		}
 	}
 
 	if (realpath.dentry->d_flags & DCACHE_OP_SELECT_INODE)
@@ -28,6 +28,12 @@ struct ovl_cache_entry {
 	char name[];
 };
 
+/*
+ * The merged entries of a directory.  The dentry holds a reference to the
+ * last one read, so listing the directory again doesn't merge the layers
+ * all over again, until the directory changes or the dentry goes.
+ * The refcount is protected by the directory's i_mutex.
+ */
 struct ovl_dir_cache {
 	long refcount;
 	u64 version;
@@ -328,6 +334,14 @@ static void ovl_seek_cursor(struct ovl_dir_file *od, loff_t pos)
 	od->cursor = p;
 }
 
+void ovl_dir_cache_release(struct ovl_dir_cache *cache)
+{
+	/* open files hold the dentry, so only our reference can be left */
+	WARN_ON(cache->refcount != 1);
+	ovl_cache_free(&cache->entries);
+	kfree(cache);
+}
+
 static struct ovl_dir_cache *ovl_cache_get(struct dentry *dentry)
 {
 	int res;
@@ -338,13 +352,21 @@ static struct ovl_dir_cache *ovl_cache_get(struct dentry *dentry)
 		cache->refcount++;
 		return cache;
 	}
-	ovl_set_dir_cache(dentry, NULL);
+	if (cache) {
+		/* stale: drop the dentry's reference */
+		ovl_set_dir_cache(dentry, NULL);
+		if (!--cache->refcount) {
+			ovl_cache_free(&cache->entries);
+			kfree(cache);
+		}
+	}
 
 	cache = kzalloc(sizeof(struct ovl_dir_cache), GFP_KERNEL);
 	if (!cache)
 		return ERR_PTR(-ENOMEM);
 
-	cache->refcount = 1;
+	/* one for the file, one for the dentry */
+	cache->refcount = 2;
 	INIT_LIST_HEAD(&cache->entries);
 
 	res = ovl_dir_read_merged(dentry, &cache->entries);
@@ -0,0 +1,307 @@
+/*
+ * fs/path_cache.c - per-superblock cache of directory lookups
+ *
+ * link_path_walk() resolves every component of a path with a hash and a
+ * dcache probe of its own.  For the deep, stable trees that build farms
+ * and image scanners stat over and over, this caches the result of
+ * walking the directory part of a path - everything but the last
+ * component - so that the next RCU-walk of the same string from the
+ * same starting point resolves it with a single probe.
+ *
+ * An entry is only stored for a walk that could be replayed without
+ * losing anything: it stayed in RCU mode on one mount, followed no
+ * symlinks and no "." or "..", met no dentry the filesystem wants to
+ * hash, revalidate or manage itself, and every directory it went
+ * through was searchable by anyone without ->permission(), ACLs or an
+ * LSM having a say.  The entry then stays valid as long as no rename
+ * (rename_lock), no mount change (mount_lock) and no invalidation of
+ * the superblock (->s_path_cache_gen) happened since the walk began;
+ * the latter is bumped whenever a directory dentry is dropped or a
+ * directory's mode, owner or ACL changes.  The cached dentry is then
+ * checked against its ->d_seq like any other step of an RCU-walk.
+ */
+
+#include <linux/fs.h>
+#include <linux/dcache.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/lsm_hooks.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include "internal.h"
+
+#define PATH_CACHE_BITS		6
+#define PATH_CACHE_SIZE		(1 << PATH_CACHE_BITS)
+#define PATH_CACHE_NAME_MAX	192
+
+struct path_cache_entry {
+	seqcount_t		seq;
+	unsigned int		hash;
+	unsigned int		len;
+	unsigned int		gen;
+	unsigned int		rename_seq;
+	unsigned int		m_seq;
+	unsigned int		d_seq;
+	struct dentry		*start;
+	struct vfsmount		*mnt;
+	struct dentry		*dentry;
+	struct inode		*inode;
+	char			name[PATH_CACHE_NAME_MAX];
+};
+
+struct path_cache_stats {
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		stores;
+};
+
+struct path_cache {
+	spinlock_t		lock;		/* serializes the writers */
+	struct path_cache_stats __percpu *stats;
+	struct path_cache_entry	ent[PATH_CACHE_SIZE];
+};
+
+int sysctl_path_cache __read_mostly = 1;
+
+/* cleared if an LSM checks inode permissions, we couldn't skip those */
+static bool path_cache_usable __read_mostly;
+
+static inline struct path_cache_entry *
+path_cache_slot(struct path_cache *pc, unsigned int hash)
+{
+	return &pc->ent[hash_32(hash, PATH_CACHE_BITS)];
+}
+
+/*
+ * Stores happen in the middle of an RCU-walk, so the table can only be
+ * had without sleeping.  If that fails, we'll try again next time.
+ */
+static struct path_cache *path_cache_alloc(struct super_block *sb)
+{
+	struct path_cache *pc, *old;
+	int i;
+
+	pc = kzalloc(sizeof(*pc), GFP_NOWAIT | __GFP_NOWARN);
+	if (!pc)
+		return NULL;
+	pc->stats = alloc_percpu_gfp(struct path_cache_stats, GFP_NOWAIT);
+	if (!pc->stats) {
+		kfree(pc);
+		return NULL;
+	}
+	spin_lock_init(&pc->lock);
+	for (i = 0; i < PATH_CACHE_SIZE; i++)
+		seqcount_init(&pc->ent[i].seq);
+
+	old = cmpxchg(&sb->s_path_cache, NULL, pc);
+	if (old) {
+		free_percpu(pc->stats);
+		kfree(pc);
+		pc = old;
+	}
+	return pc;
+}
+
+void path_cache_free(struct super_block *sb)
+{
+	struct path_cache *pc = sb->s_path_cache;
+
+	if (pc) {
+		free_percpu(pc->stats);
+		kfree(pc);
+	}
+}
+
+/**
+ * path_cache_lookup - look the directory part of a path up
+ * @key:	set up here, for path_cache_store() on a miss
+ * @name:	the path, past any leading slashes
+ * @start:	where the walk of @name starts
+ * @m_seq:	the walk's mount_lock sequence
+ * @dentry:	the directory found on a hit, with its @inode and @seq
+ *
+ * Must be called in RCU-walk mode.  Returns true on a hit; otherwise
+ * @key->store tells whether the walk should store what it finds.
+ */
+bool path_cache_lookup(struct path_cache_key *key, const char *name,
+		       const struct path *start, unsigned int m_seq,
+		       struct dentry **dentry, struct inode **inode,
+		       unsigned int *seq)
+{
+	struct super_block *sb = start->dentry->d_sb;
+	struct path_cache_entry *e;
+	struct path_cache *pc;
+	const char *last;
+	unsigned int s;
+	bool hit;
+
+	key->store = false;
+	if (!path_cache_usable || !READ_ONCE(sysctl_path_cache))
+		return false;
+
+	/* the last component is left to the usual walk */
+	last = name + strlen(name);
+	while (last > name && last[-1] == '/')
+		last--;
+	while (last > name && last[-1] != '/')
+		last--;
+	if (last == name || last - name > PATH_CACHE_NAME_MAX)
+		return false;
+
+	key->name = name;
+	key->last = last;
+	key->len = last - name;
+	key->hash = full_name_hash(name, key->len);
+	key->start = start->dentry;
+	key->mnt = start->mnt;
+	key->gen = atomic_read(&sb->s_path_cache_gen);
+	key->rename_seq = raw_seqcount_begin(&rename_lock.seqcount);
+	key->store = true;
+
+	pc = READ_ONCE(sb->s_path_cache);
+	if (!pc)
+		return false;
+
+	e = path_cache_slot(pc, key->hash);
+	do {
+		s = read_seqcount_begin(&e->seq);
+		hit = e->hash == key->hash && e->len == key->len &&
+		      e->start == key->start && e->mnt == key->mnt &&
+		      e->gen == key->gen && e->m_seq == m_seq &&
+		      e->rename_seq == key->rename_seq &&
+		      !memcmp(e->name, name, key->len);
+		*dentry = e->dentry;
+		*inode = e->inode;
+		*seq = e->d_seq;
+	} while (read_seqcount_retry(&e->seq, s));
+
+	/*
+	 * The matching generation means the dentry wasn't dropped before we
+	 * sampled it in the key, so RCU keeps it around for us to check.
+	 */
+	if (hit && (READ_ONCE((*dentry)->d_inode) != *inode ||
+		    read_seqcount_retry(&(*dentry)->d_seq, *seq)))
+		hit = false;
+
+	if (hit) {
+		this_cpu_inc(pc->stats->hits);
+		key->store = false;
+	} else {
+		this_cpu_inc(pc->stats->misses);
+	}
+	return hit;
+}
+
+/**
+ * path_cache_store - remember where the directory part of a path led
+ * @key:	from the path_cache_lookup() that missed
+ * @m_seq:	the walk's mount_lock sequence
+ * @dentry:	the directory the walk got to, with its @inode and @seq
+ */
+void path_cache_store(struct path_cache_key *key, unsigned int m_seq,
+		      struct dentry *dentry, struct inode *inode,
+		      unsigned int seq)
+{
+	struct super_block *sb = key->start->d_sb;
+	struct path_cache_entry *e;
+	struct path_cache *pc;
+
+	pc = READ_ONCE(sb->s_path_cache);
+	if (!pc) {
+		pc = path_cache_alloc(sb);
+		if (!pc)
+			return;
+	}
+
+	/*
+	 * Holding ->d_lock keeps the dentry from being dropped until the
+	 * entry is in; a drop after that bumps the generation past ours.
+	 */
+	spin_lock(&dentry->d_lock);
+	if (d_unhashed(dentry) || read_seqcount_retry(&dentry->d_seq, seq)) {
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+
+	e = path_cache_slot(pc, key->hash);
+	spin_lock(&pc->lock);
+	write_seqcount_begin(&e->seq);
+	e->hash = key->hash;
+	e->len = key->len;
+	e->gen = key->gen;
+	e->rename_seq = key->rename_seq;
+	e->m_seq = m_seq;
+	e->d_seq = seq;
+	e->start = key->start;
+	e->mnt = key->mnt;
+	e->dentry = dentry;
+	e->inode = inode;
+	memcpy(e->name, key->name, key->len);
+	write_seqcount_end(&e->seq);
+	spin_unlock(&pc->lock);
+	spin_unlock(&dentry->d_lock);
+
+	this_cpu_inc(pc->stats->stores);
+}
+
+#ifdef CONFIG_PROC_FS
+static void path_cache_show_sb(struct super_block *sb, void *arg)
+{
+	struct path_cache *pc = READ_ONCE(sb->s_path_cache);
+	struct seq_file *m = arg;
+	unsigned long hits = 0, misses = 0, stores = 0;
+	int cpu;
+
+	if (!pc)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct path_cache_stats *st = per_cpu_ptr(pc->stats, cpu);
+
+		hits += st->hits;
+		misses += st->misses;
+		stores += st->stores;
+	}
+	seq_printf(m, "%-12s %-16s %12lu %12lu %12lu\n", sb->s_type->name,
+		   sb->s_id, hits, misses, stores);
+}
+
+static int path_cache_proc_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "%-12s %-16s %12s %12s %12s\n",
+		   "fstype", "device", "hits", "misses", "stores");
+	iterate_supers(path_cache_show_sb, m);
+	return 0;
+}
+
+static int path_cache_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, path_cache_proc_show, NULL);
+}
+
+static const struct file_operations path_cache_proc_fops = {
+	.open		= path_cache_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
+static int __init path_cache_init(void)
+{
+#ifdef CONFIG_SECURITY
+	if (!list_empty(&security_hook_heads.inode_permission)) {
+		pr_info("path cache: disabled, an LSM checks inode permissions\n");
+		return 0;
+	}
+#endif
+	path_cache_usable = true;
+#ifdef CONFIG_PROC_FS
+	proc_create("fs/path_cache", 0, NULL, &path_cache_proc_fops);
+#endif
+	return 0;
+}
+fs_initcall(path_cache_init);
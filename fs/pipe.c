@@ -38,6 +38,14 @@ unsigned int pipe_max_size = 1048576;
  */
 unsigned int pipe_min_size = PAGE_SIZE;
 
+/*
+ * A writer finding the pipe full grows it up to this size rather than
+ * sleeping, and up to this many pages for all the pipes of a user. Can
+ * be set in /proc/sys/fs/pipe-auto-max-size and pipe-user-auto-pages.
+ */
+unsigned int pipe_auto_max_size = 262144;
+unsigned long pipe_user_auto_pages = 16384;
+
 /*
  * We use a start+len construction, which provides full use of the 
  * allocated memory.
@@ -278,12 +286,15 @@ pipe_read(struct kiocb *iocb, struct iov_iter *to)
 			}
 
 			if (!buf->len) {
+				/* writers only sleep on a full pipe */
+				if (bufs == pipe->buffers ||
+				    READ_ONCE(pipe->poll_usage))
+					do_wakeup = 1;
 				buf->ops = NULL;
 				ops->release(pipe, buf);
 				curbuf = (curbuf + 1) & (pipe->buffers - 1);
 				pipe->curbuf = curbuf;
 				pipe->nrbufs = --bufs;
-				do_wakeup = 1;
 			}
 			total_len -= chars;
 			if (!total_len)
@@ -334,6 +345,68 @@ static inline int is_packetized(struct file *file)
 	return (file->f_flags & O_DIRECT) != 0;
 }
 
+static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long nr_pages);
+
+/*
+ * A writer found the pipe full: double it instead of going to sleep, as
+ * long as it stays within pipe_auto_max_size and its user within
+ * pipe_user_auto_pages.  Returns true if there is room now.
+ */
+static bool pipe_auto_grow(struct pipe_inode_info *pipe)
+{
+	unsigned long max = READ_ONCE(pipe_auto_max_size) >> PAGE_SHIFT;
+	unsigned int more = pipe->buffers;
+	struct user_struct *user;
+
+	if (pipe->sized || pipe->buffers * 2 > max)
+		return false;
+
+	user = pipe->user ? pipe->user : current_user();
+	if (atomic_long_add_return(more, &user->pipe_auto_pages) >
+	    READ_ONCE(pipe_user_auto_pages))
+		goto uncharge;
+	if (pipe_set_size(pipe, pipe->buffers * 2) < 0)
+		goto uncharge;
+
+	if (!pipe->user)
+		pipe->user = get_uid(user);
+	pipe->auto_pages += more;
+	return true;
+
+uncharge:
+	atomic_long_sub(more, &user->pipe_auto_pages);
+	return false;
+}
+
+/**
+ * pipe_auto_grow_to - grow a pipe until it has @nr_bufs free buffers
+ * @pipe:	the pipe, locked
+ * @nr_bufs:	the number of buffers about to be added in one go
+ *
+ * For splice_read() implementations that hand over more pages than a
+ * default sized pipe has buffers.  The same limits apply as for a writer
+ * that found the pipe full.
+ */
+bool pipe_auto_grow_to(struct pipe_inode_info *pipe, unsigned int nr_bufs)
+{
+	while (pipe->buffers - pipe->nrbufs < nr_bufs)
+		if (!pipe_auto_grow(pipe))
+			return false;
+	return true;
+}
+EXPORT_SYMBOL_GPL(pipe_auto_grow_to);
+
+static void pipe_auto_uncharge(struct pipe_inode_info *pipe)
+{
+	if (!pipe->user)
+		return;
+
+	atomic_long_sub(pipe->auto_pages, &pipe->user->pipe_auto_pages);
+	free_uid(pipe->user);
+	pipe->user = NULL;
+	pipe->auto_pages = 0;
+}
+
 static ssize_t
 pipe_write(struct kiocb *iocb, struct iov_iter *from)
 {
@@ -365,7 +438,16 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		const struct pipe_buf_operations *ops = buf->ops;
 		int offset = buf->offset + buf->len;
 
-		if (ops->can_merge && offset + chars <= PAGE_SIZE) {
+		/*
+		 * A small write that doesn't fit fills the room left, and
+		 * the rest goes in a new buffer - if there is a free one,
+		 * since it mustn't be interleaved with another writer.
+		 */
+		if (total_len < PAGE_SIZE && offset + chars > PAGE_SIZE &&
+		    pipe->nrbufs < pipe->buffers)
+			chars = PAGE_SIZE - offset;
+
+		if (ops->can_merge && chars && offset + chars <= PAGE_SIZE) {
 			ret = ops->confirm(pipe, buf);
 			if (ret)
 				goto out;
@@ -375,7 +457,9 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 				ret = -EFAULT;
 				goto out;
 			}
-			do_wakeup = 1;
+			/* readers only sleep on an empty pipe */
+			if (READ_ONCE(pipe->poll_usage))
+				do_wakeup = 1;
 			buf->len += ret;
 			if (!iov_iter_count(from))
 				goto out;
@@ -410,8 +494,10 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
 			 * syscall merging.
 			 * FIXME! Is this really true?
+			 * Readers only sleep on an empty pipe, though.
 			 */
-			do_wakeup = 1;
+			if (!bufs || READ_ONCE(pipe->poll_usage))
+				do_wakeup = 1;
 			copied = copy_page_from_iter(page, 0, PAGE_SIZE, from);
 			if (unlikely(copied < PAGE_SIZE && iov_iter_count(from))) {
 				if (!ret)
@@ -438,6 +524,8 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		}
 		if (bufs < pipe->buffers)
 			continue;
+		if (pipe_auto_grow(pipe))
+			continue;
 		if (filp->f_flags & O_NONBLOCK) {
 			if (!ret)
 				ret = -EAGAIN;
@@ -505,6 +593,10 @@ pipe_poll(struct file *filp, poll_table *wait)
 
 	poll_wait(filp, &pipe->wait, wait);
 
+	/* edge-triggered pollers want a wakeup per event, not per state change */
+	if (!pipe->poll_usage)
+		WRITE_ONCE(pipe->poll_usage, true);
+
 	/* Reading only -- no need for acquiring the semaphore.  */
 	nrbufs = pipe->nrbufs;
 	mask = 0;
@@ -614,6 +706,8 @@ void free_pipe_info(struct pipe_inode_info *pipe)
 	}
 	if (pipe->tmp_page)
 		__free_page(pipe->tmp_page);
+	pipe_gifts_free(pipe);
+	pipe_auto_uncharge(pipe);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -1002,6 +1096,9 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long nr_pages)
 	kfree(pipe->bufs);
 	pipe->bufs = bufs;
 	pipe->buffers = nr_pages;
+
+	/* readers only wake up writers on a full pipe, it may not be anymore */
+	wake_up_interruptible_poll(&pipe->wait, POLLOUT | POLLWRNORM);
 	return nr_pages * PAGE_SIZE;
 }
 
@@ -1071,11 +1168,18 @@ long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
 			goto out;
 		}
 		ret = pipe_set_size(pipe, nr_pages);
+		if (ret >= 0) {
+			pipe->sized = true;
+			pipe_auto_uncharge(pipe);
+		}
 		break;
 		}
 	case F_GETPIPE_SZ:
 		ret = pipe->buffers * PAGE_SIZE;
 		break;
+	case F_GETPIPE_GIFTED:
+		ret = pipe_gifts_done(pipe);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -63,6 +63,8 @@ void set_cached_acl(struct inode *inode, int type, struct posix_acl *acl)
 	old = *p;
 	rcu_assign_pointer(*p, posix_acl_dup(acl));
 	spin_unlock(&inode->i_lock);
+	if (S_ISDIR(inode->i_mode))
+		path_cache_invalidate(inode->i_sb);
 	if (old != ACL_NOT_CACHED)
 		posix_acl_release(old);
 }
@@ -76,6 +78,8 @@ void forget_cached_acl(struct inode *inode, int type)
 	old = *p;
 	*p = ACL_NOT_CACHED;
 	spin_unlock(&inode->i_lock);
+	if (S_ISDIR(inode->i_mode))
+		path_cache_invalidate(inode->i_sb);
 	if (old != ACL_NOT_CACHED)
 		posix_acl_release(old);
 }
@@ -89,6 +93,8 @@ void forget_all_cached_acls(struct inode *inode)
 	old_default = inode->i_default_acl;
 	inode->i_acl = inode->i_default_acl = ACL_NOT_CACHED;
 	spin_unlock(&inode->i_lock);
+	if (S_ISDIR(inode->i_mode))
+		path_cache_invalidate(inode->i_sb);
 	if (old_access != ACL_NOT_CACHED)
 		posix_acl_release(old_access);
 	if (old_default != ACL_NOT_CACHED)
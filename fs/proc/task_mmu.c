@@ -13,6 +13,7 @@
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/mmu_notifier.h>
+#include <linux/lazyfork.h>
 #include <linux/page_idle.h>
 
 #include <asm/elf.h>
@@ -615,6 +616,9 @@ static void show_smap_vma_flags(struct seq_file *m, struct vm_area_struct *vma)
 		[ilog2(VM_MERGEABLE)]	= "mg",
 		[ilog2(VM_UFFD_MISSING)]= "um",
 		[ilog2(VM_UFFD_WP)]	= "uw",
+#ifdef CONFIG_64BIT
+		[ilog2(VM_SYNC)]	= "sf",
+#endif
 	};
 	size_t i;
 
@@ -766,6 +770,209 @@ const struct file_operations proc_tid_smaps_operations = {
 	.release	= proc_map_release,
 };
 
+/*
+ * smaps_rollup: the counters of smaps summed over all the vmas, for the
+ * readers who only want the totals and not one text record per vma.
+ */
+static int show_smaps_rollup(struct seq_file *m, void *v)
+{
+	struct proc_maps_private *priv = m->private;
+	struct mm_struct *mm = priv->mm;
+	struct vm_area_struct *vma;
+	struct mem_size_stats mss;
+	struct mm_walk smaps_walk = {
+		.pmd_entry = smaps_pte_range,
+#ifdef CONFIG_HUGETLB_PAGE
+		.hugetlb_entry = smaps_hugetlb_range,
+#endif
+		.mm = mm,
+		.private = &mss,
+	};
+	unsigned long start = 0, end = 0;
+	u64 locked = 0;
+
+	if (!mm || !atomic_inc_not_zero(&mm->mm_users))
+		return 0;
+
+	memset(&mss, 0, sizeof mss);
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		u64 pss = mss.pss;
+
+		walk_page_vma(vma, &smaps_walk);
+		if (vma->vm_flags & VM_LOCKED)
+			locked += mss.pss - pss;
+		if (!start)
+			start = vma->vm_start;
+		end = vma->vm_end;
+	}
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+
+	seq_setwidth(m, 25 + sizeof(void *) * 6 - 1);
+	seq_printf(m, "%08lx-%08lx ---p 00000000 00:00 0", start, end);
+	seq_pad(m, ' ');
+	seq_puts(m, "[rollup]\n");
+
+	seq_printf(m,
+		   "Rss:            %8lu kB\n"
+		   "Pss:            %8lu kB\n"
+		   "Shared_Clean:   %8lu kB\n"
+		   "Shared_Dirty:   %8lu kB\n"
+		   "Private_Clean:  %8lu kB\n"
+		   "Private_Dirty:  %8lu kB\n"
+		   "Referenced:     %8lu kB\n"
+		   "Anonymous:      %8lu kB\n"
+		   "AnonHugePages:  %8lu kB\n"
+		   "Shared_Hugetlb: %8lu kB\n"
+		   "Private_Hugetlb: %7lu kB\n"
+		   "Swap:           %8lu kB\n"
+		   "SwapPss:        %8lu kB\n"
+		   "Locked:         %8lu kB\n",
+		   mss.resident >> 10,
+		   (unsigned long)(mss.pss >> (10 + PSS_SHIFT)),
+		   mss.shared_clean  >> 10,
+		   mss.shared_dirty  >> 10,
+		   mss.private_clean >> 10,
+		   mss.private_dirty >> 10,
+		   mss.referenced >> 10,
+		   mss.anonymous >> 10,
+		   mss.anonymous_thp >> 10,
+		   mss.shared_hugetlb >> 10,
+		   mss.private_hugetlb >> 10,
+		   mss.swap >> 10,
+		   (unsigned long)(mss.swap_pss >> (10 + PSS_SHIFT)),
+		   (unsigned long)(locked >> (10 + PSS_SHIFT)));
+	return 0;
+}
+
+static void *smaps_rollup_start(struct seq_file *m, loff_t *pos)
+{
+	return *pos ? NULL : SEQ_START_TOKEN;
+}
+
+static void *smaps_rollup_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return NULL;
+}
+
+static void smaps_rollup_stop(struct seq_file *m, void *v)
+{
+}
+
+static const struct seq_operations proc_smaps_rollup_op = {
+	.start	= smaps_rollup_start,
+	.next	= smaps_rollup_next,
+	.stop	= smaps_rollup_stop,
+	.show	= show_smaps_rollup
+};
+
+static int smaps_rollup_open(struct inode *inode, struct file *file)
+{
+	return do_maps_open(inode, file, &proc_smaps_rollup_op);
+}
+
+const struct file_operations proc_smaps_rollup_operations = {
+	.open		= smaps_rollup_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= proc_map_release,
+};
+
+#ifdef CONFIG_IDLE_PAGE_TRACKING
+/*
+ * idle_pages: the idle and active memory of each vma, and of the whole
+ * mm, then the counts of kidled's last pass if it scans this mm.  Writing
+ * 1 has kidled scan the mm, writing 0 stops it.
+ */
+static int show_idle_pages(struct seq_file *m, void *v)
+{
+	struct proc_maps_private *priv = m->private;
+	struct mm_struct *mm = priv->mm;
+	struct page_idle_stats total = { 0 }, last;
+	struct vm_area_struct *vma;
+	unsigned long passes;
+
+	if (!mm || !atomic_inc_not_zero(&mm->mm_users))
+		return 0;
+
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		struct page_idle_stats st = { 0 };
+
+		page_idle_count_range(vma, vma->vm_start, vma->vm_end, &st);
+		seq_printf(m, "%08lx-%08lx %8lu %8lu\n",
+			   vma->vm_start, vma->vm_end,
+			   st.idle << (PAGE_SHIFT - 10),
+			   st.active << (PAGE_SHIFT - 10));
+		total.idle += st.idle;
+		total.active += st.active;
+	}
+	up_read(&mm->mmap_sem);
+
+	seq_printf(m, "Idle:           %8lu kB\n"
+		      "Active:         %8lu kB\n",
+		   total.idle << (PAGE_SHIFT - 10),
+		   total.active << (PAGE_SHIFT - 10));
+
+	if (page_idle_scan_result(mm, &last, &passes))
+		seq_printf(m, "ScanPasses:     %8lu\n"
+			      "ScanIdle:       %8lu kB\n"
+			      "ScanActive:     %8lu kB\n",
+			   passes, last.idle << (PAGE_SHIFT - 10),
+			   last.active << (PAGE_SHIFT - 10));
+	mmput(mm);
+	return 0;
+}
+
+static const struct seq_operations proc_idle_pages_op = {
+	.start	= smaps_rollup_start,
+	.next	= smaps_rollup_next,
+	.stop	= smaps_rollup_stop,
+	.show	= show_idle_pages
+};
+
+static int idle_pages_open(struct inode *inode, struct file *file)
+{
+	return do_maps_open(inode, file, &proc_idle_pages_op);
+}
+
+static ssize_t idle_pages_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct task_struct *task;
+	struct mm_struct *mm;
+	int on, rv;
+
+	rv = kstrtoint_from_user(buf, count, 10, &on);
+	if (rv < 0)
+		return rv;
+	if (on != 0 && on != 1)
+		return -EINVAL;
+
+	task = get_proc_task(file_inode(file));
+	if (!task)
+		return -ESRCH;
+	mm = get_task_mm(task);
+	put_task_struct(task);
+	if (!mm)
+		return -ESRCH;
+
+	rv = page_idle_scan_mm(mm, on);
+	mmput(mm);
+	return rv ? rv : count;
+}
+
+const struct file_operations proc_idle_pages_operations = {
+	.open		= idle_pages_open,
+	.read		= seq_read,
+	.write		= idle_pages_write,
+	.llseek		= seq_lseek,
+	.release	= proc_map_release,
+};
+#endif /* CONFIG_IDLE_PAGE_TRACKING */
+
 enum clear_refs_types {
 	CLEAR_REFS_ALL = 1,
 	CLEAR_REFS_ANON,
@@ -857,6 +1064,9 @@ out:
 
 	if (pmd_trans_unstable(pmd))
 		return 0;
+	/* The ptes of a table shared by fork are not this mm's to clear */
+	if (lazyfork_pmd(*pmd))
+		return 0;
 
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE) {
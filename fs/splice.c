@@ -20,6 +20,7 @@
 #include <linux/fs.h>
 #include <linux/file.h>
 #include <linux/pagemap.h>
+#include <linux/pagevec.h>
 #include <linux/splice.h>
 #include <linux/memcontrol.h>
 #include <linux/mm_inline.h>
@@ -152,10 +153,183 @@ static int user_page_pipe_buf_steal(struct pipe_inode_info *pipe,
 	return generic_pipe_buf_steal(pipe, buf);
 }
 
+/*
+ * Pages vmsplice()d with SPLICE_F_GIFT are tracked until the kernel is
+ * done with them, so that the gifting process knows when it can reuse its
+ * memory.  Putting the pipe buffer isn't enough for that: a consumer like
+ * ->sendpage() keeps a reference of its own, for as long as the data is in
+ * flight.  So the gift keeps the pipe's reference, and it's done with when
+ * the page's references are down to those of its mappings, its cache and
+ * ours.  Consumers don't tell when they let go, so that is checked as the
+ * gifts are released and when F_GETPIPE_GIFTED asks.
+ *
+ * The gifts are kept in the order they were made, and ->done only covers
+ * the leading ones that are done with, so that it tells userspace how
+ * far it can reuse its buffers.  The tracking outlives the pipe if a gift
+ * got moved to another pipe, until that one lets go of it too.
+ */
+struct pipe_gifts {
+	spinlock_t		lock;
+	bool			dead;		/* the pipe is gone */
+	struct list_head	list;		/* oldest first */
+	u64			done;		/* bytes */
+};
+
+struct pipe_gift {
+	struct list_head	list;
+	struct pipe_gifts	*gifts;
+	struct page		*page;		/* set when the pipe lets go */
+	unsigned int		len;
+};
+
+static bool pipe_gift_page_idle(struct page *page)
+{
+	int refs;
+
+	/* no telling the compound page's users apart, take the pipe's word */
+	if (PageCompound(page))
+		return true;
+
+	refs = page_mapcount(page) + 1;
+	if (page_mapping(page))
+		refs++;
+	if (page_has_private(page))
+		refs++;
+	smp_rmb();
+	return page_count(page) <= refs;
+}
+
+static void pipe_gift_free(struct pipe_gift *gift)
+{
+	list_del(&gift->list);
+	if (gift->page)
+		page_cache_release(gift->page);
+	kfree(gift);
+}
+
+/*
+ * Drops the gifts that are done with, from the oldest on; all the released
+ * ones once nobody asks anymore.  Returns true if @gifts is to be freed.
+ * Called with ->lock held.
+ */
+static bool pipe_gifts_reap(struct pipe_gifts *gifts)
+{
+	struct pipe_gift *gift, *next;
+
+	list_for_each_entry_safe(gift, next, &gifts->list, list) {
+		if (!gift->page) {
+			if (gifts->dead)
+				continue;
+			break;
+		}
+		if (!gifts->dead && !pipe_gift_page_idle(gift->page))
+			break;
+		gifts->done += gift->len;
+		pipe_gift_free(gift);
+	}
+
+	return gifts->dead && list_empty(&gifts->list);
+}
+
+static struct pipe_gifts *pipe_gifts_get(struct pipe_inode_info *pipe)
+{
+	struct pipe_gifts *gifts = READ_ONCE(pipe->gifts), *old;
+
+	if (gifts)
+		return gifts;
+
+	gifts = kzalloc(sizeof(*gifts), GFP_KERNEL);
+	if (!gifts)
+		return NULL;
+	spin_lock_init(&gifts->lock);
+	INIT_LIST_HEAD(&gifts->list);
+
+	old = cmpxchg(&pipe->gifts, NULL, gifts);
+	if (old) {
+		kfree(gifts);
+		gifts = old;
+	}
+	return gifts;
+}
+
+/* the pipe lets go of the page of @gift, with its reference */
+static void pipe_gift_released(struct pipe_gift *gift, struct page *page)
+{
+	struct pipe_gifts *gifts = gift->gifts;
+	bool free;
+
+	spin_lock(&gifts->lock);
+	gift->page = page;
+	free = pipe_gifts_reap(gifts);
+	spin_unlock(&gifts->lock);
+
+	if (free)
+		kfree(gifts);
+}
+
+/* the page of @gift never made it into the pipe */
+static void pipe_gift_cancel(struct pipe_gift *gift)
+{
+	struct pipe_gifts *gifts = gift->gifts;
+
+	spin_lock(&gifts->lock);
+	pipe_gift_free(gift);
+	spin_unlock(&gifts->lock);
+}
+
+long pipe_gifts_done(struct pipe_inode_info *pipe)
+{
+	struct pipe_gifts *gifts = READ_ONCE(pipe->gifts);
+	u64 done;
+
+	if (!gifts)
+		return 0;
+
+	spin_lock(&gifts->lock);
+	pipe_gifts_reap(gifts);
+	done = gifts->done;
+	spin_unlock(&gifts->lock);
+
+	return done & LONG_MAX;
+}
+
+void pipe_gifts_free(struct pipe_inode_info *pipe)
+{
+	struct pipe_gifts *gifts = pipe->gifts;
+	bool free;
+
+	if (!gifts)
+		return;
+
+	spin_lock(&gifts->lock);
+	gifts->dead = true;
+	free = pipe_gifts_reap(gifts);
+	spin_unlock(&gifts->lock);
+
+	if (free)
+		kfree(gifts);
+}
+
+static void user_page_pipe_buf_release(struct pipe_inode_info *pipe,
+				       struct pipe_buffer *buf)
+{
+	struct pipe_gift *gift = (struct pipe_gift *)buf->private;
+
+	/* a tee()d duplicate has the flag cleared, it isn't the gift */
+	if (!(buf->flags & PIPE_BUF_FLAG_GIFT) || !gift) {
+		page_cache_pipe_buf_release(pipe, buf);
+		return;
+	}
+
+	buf->flags &= ~(PIPE_BUF_FLAG_GIFT | PIPE_BUF_FLAG_LRU);
+	buf->private = 0;
+	pipe_gift_released(gift, buf->page);
+}
+
 static const struct pipe_buf_operations user_page_pipe_buf_ops = {
 	.can_merge = 0,
 	.confirm = generic_pipe_buf_confirm,
-	.release = page_cache_pipe_buf_release,
+	.release = user_page_pipe_buf_release,
 	.steal = user_page_pipe_buf_steal,
 	.get = generic_pipe_buf_get,
 };
@@ -355,17 +529,32 @@ __generic_file_splice_read(struct file *in, loff_t *ppos,
 		 */
 		page = find_get_page(mapping, index);
 		if (!page) {
+			struct page *new[PAGEVEC_SIZE];
+			int nr_new, added, i;
+
 			/*
-			 * page didn't exist, allocate one.
+			 * page didn't exist, allocate one for it and for
+			 * the holes likely to follow, they are added up to
+			 * the next page that exists.
 			 */
-			page = page_cache_alloc_cold(mapping);
-			if (!page)
+			nr_new = min_t(int, nr_pages - spd.nr_pages,
+				       PAGEVEC_SIZE);
+			for (i = 0; i < nr_new; i++) {
+				new[i] = page_cache_alloc_cold(mapping);
+				if (!new[i])
+					break;
+				new[i]->index = index + i;
+			}
+			nr_new = i;
+			if (!nr_new)
 				break;
 
-			error = add_to_page_cache_lru(page, mapping, index,
+			added = add_to_page_cache_lru_batch(new, nr_new, mapping,
 				   mapping_gfp_constraint(mapping, GFP_KERNEL));
-			if (unlikely(error)) {
-				page_cache_release(page);
+			for (i = max(added, 0); i < nr_new; i++)
+				page_cache_release(new[i]);
+			if (unlikely(added < 0)) {
+				error = added;
 				if (error == -EEXIST)
 					continue;
 				break;
@@ -374,7 +563,12 @@ __generic_file_splice_read(struct file *in, loff_t *ppos,
 			 * add_to_page_cache() locks the page, unlock it
 			 * to avoid convoluting the logic below even more.
 			 */
-			unlock_page(page);
+			for (i = 0; i < added; i++) {
+				unlock_page(new[i]);
+				spd.pages[spd.nr_pages++] = new[i];
+			}
+			index += added;
+			continue;
 		}
 
 		spd.pages[spd.nr_pages++] = page;
@@ -1506,6 +1700,7 @@ static int get_iovec_page_array(const struct iovec __user *iov,
 
 			partial[buffers].offset = off;
 			partial[buffers].len = plen;
+			partial[buffers].private = 0;
 
 			off = 0;
 			len -= plen;
@@ -1589,6 +1784,59 @@ static long vmsplice_to_user(struct file *file, const struct iovec __user *uiov,
  * as splice-from-memory, where the regular splice is splice-from-file (or
  * to file). In both cases the output is a pipe, naturally.
  */
+static void vmsplice_release_page(struct splice_pipe_desc *spd, unsigned int i)
+{
+	struct pipe_gift *gift = (struct pipe_gift *)spd->partial[i].private;
+
+	if (gift)
+		pipe_gift_cancel(gift);
+	page_cache_release(spd->pages[i]);
+}
+
+/*
+ * Sets up the tracking of the @spd pages as gifts, in order.  On failure,
+ * releases the pages.
+ */
+static int vmsplice_gift_pages(struct pipe_inode_info *pipe,
+			       struct splice_pipe_desc *spd)
+{
+	struct pipe_gifts *gifts;
+	struct pipe_gift *gift;
+	LIST_HEAD(list);
+	int i;
+
+	gifts = pipe_gifts_get(pipe);
+	if (!gifts)
+		goto fail;
+
+	for (i = 0; i < spd->nr_pages; i++) {
+		gift = kmalloc(sizeof(*gift), GFP_KERNEL);
+		if (!gift)
+			goto fail_free;
+		gift->gifts = gifts;
+		gift->page = NULL;
+		gift->len = spd->partial[i].len;
+		list_add_tail(&gift->list, &list);
+		spd->partial[i].private = (unsigned long)gift;
+	}
+
+	spin_lock(&gifts->lock);
+	list_splice_tail(&list, &gifts->list);
+	spin_unlock(&gifts->lock);
+	return 0;
+
+fail_free:
+	while (!list_empty(&list)) {
+		gift = list_first_entry(&list, struct pipe_gift, list);
+		list_del(&gift->list);
+		kfree(gift);
+	}
+fail:
+	for (i = 0; i < spd->nr_pages; i++)
+		page_cache_release(spd->pages[i]);
+	return -ENOMEM;
+}
+
 static long vmsplice_to_pipe(struct file *file, const struct iovec __user *iov,
 			     unsigned long nr_segs, unsigned int flags)
 {
@@ -1601,7 +1849,7 @@ static long vmsplice_to_pipe(struct file *file, const struct iovec __user *iov,
 		.nr_pages_max = PIPE_DEF_BUFFERS,
 		.flags = flags,
 		.ops = &user_page_pipe_buf_ops,
-		.spd_release = spd_release_page,
+		.spd_release = vmsplice_release_page,
 	};
 	long ret;
 
@@ -1617,6 +1865,8 @@ static long vmsplice_to_pipe(struct file *file, const struct iovec __user *iov,
 					    spd.nr_pages_max);
 	if (spd.nr_pages <= 0)
 		ret = spd.nr_pages;
+	else if ((flags & SPLICE_F_GIFT) && vmsplice_gift_pages(pipe, &spd))
+		ret = -ENOMEM;
 	else
 		ret = splice_to_pipe(pipe, &spd);
 
@@ -47,6 +47,7 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -498,6 +499,151 @@ out:
 }
 
 
+/*
+ * Readahead.  The pages are put in the page cache a datablock at a time,
+ * and all but the first datablock are decompressed by a workqueue, so
+ * that consecutive blocks are decompressed in parallel as far as the
+ * decompressor allows.  The pages stay locked until their block is read,
+ * which is what the reader waits on.
+ */
+static struct workqueue_struct *squashfs_read_wq;
+
+struct squashfs_ra_block {
+	struct work_struct	work;
+	struct list_head	list;
+	struct inode		*inode;
+	u64			block;
+	int			bsize;
+	int			start_index;
+	int			pages;
+	struct page		*page[0];
+};
+
+static void squashfs_ra_read(struct squashfs_ra_block *ra)
+{
+	squashfs_readahead_block(ra->inode, ra->block, ra->bsize,
+				ra->start_index, ra->page, ra->pages);
+	kfree(ra);
+}
+
+static void squashfs_ra_work(struct work_struct *work)
+{
+	squashfs_ra_read(container_of(work, struct squashfs_ra_block, work));
+}
+
+/*
+ * Set up the read of the datablock @index, if it is a separately
+ * compressed one; sparse blocks and the fragment go through readpage.
+ */
+static struct squashfs_ra_block *squashfs_ra_alloc(struct inode *inode,
+	int index)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int start_index = index << shift;
+	int pages = min(1 << shift, file_end - start_index + 1);
+	struct squashfs_ra_block *ra;
+	u64 block = 0;
+	int bsize;
+
+	if (index >= i_size_read(inode) >> msblk->block_log &&
+	    squashfs_i(inode)->fragment_block != SQUASHFS_INVALID_BLK)
+		return NULL;
+
+	bsize = read_blocklist(inode, index, &block);
+	if (bsize <= 0)
+		return NULL;
+
+	ra = kzalloc(sizeof(*ra) + pages * sizeof(struct page *), GFP_KERNEL);
+	if (ra == NULL)
+		return NULL;
+
+	INIT_WORK(&ra->work, squashfs_ra_work);
+	ra->inode = inode;
+	ra->block = block;
+	ra->bsize = bsize;
+	ra->start_index = start_index;
+	ra->pages = pages;
+	return ra;
+}
+
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	pgoff_t end_index = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+					PAGE_CACHE_SHIFT;
+	struct squashfs_ra_block *ra = NULL, *first, *next;
+	int index = -1;
+	LIST_HEAD(blocks);
+
+	while (!list_empty(pages)) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+
+		list_del(&page->lru);
+		if (page->index >= end_index || add_to_page_cache_lru(page,
+					mapping, page->index, GFP_KERNEL)) {
+			page_cache_release(page);
+			continue;
+		}
+
+		if (page->index >> shift != index) {
+			index = page->index >> shift;
+			ra = squashfs_ra_alloc(inode, index);
+			if (ra)
+				list_add_tail(&ra->list, &blocks);
+		}
+
+		if (ra == NULL) {
+			squashfs_readpage(file, page);
+			page_cache_release(page);
+			continue;
+		}
+
+		/* the reference from the readahead is handed over to @ra */
+		ra->page[page->index - ra->start_index] = page;
+	}
+
+	if (list_empty(&blocks))
+		return 0;
+
+	/*
+	 * The first block is likely the one the reader is waiting for, it
+	 * is read here.  With a single decompressor the others would only
+	 * compete with it, so they're queued once it is done.
+	 */
+	first = list_first_entry(&blocks, struct squashfs_ra_block, list);
+	list_del(&first->list);
+	if (squashfs_max_decompressors() == 1)
+		squashfs_ra_read(first);
+
+	list_for_each_entry_safe(ra, next, &blocks, list)
+		queue_work(squashfs_read_wq, &ra->work);
+
+	if (squashfs_max_decompressors() > 1)
+		squashfs_ra_read(first);
+
+	return 0;
+}
+
+int __init squashfs_init_readahead(void)
+{
+	squashfs_read_wq = alloc_workqueue("squashfs_read", WQ_UNBOUND, 0);
+	if (squashfs_read_wq == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void squashfs_destroy_readahead(void)
+{
+	destroy_workqueue(squashfs_read_wq);
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
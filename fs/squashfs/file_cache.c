@@ -36,3 +36,53 @@ int squashfs_readpage_block(struct page *page, u64 block, int bsize)
 	squashfs_cache_put(buffer);
 	return res;
 }
+
+/*
+ * Read a datablock for readahead.  @page holds the pages of the block
+ * which squashfs_readpages() put in the page cache, locked, the rest are
+ * grabbed here if they're not there.  All of them are unlocked and
+ * released before returning.
+ */
+void squashfs_readahead_block(struct inode *inode, u64 block, int bsize,
+	int start_index, struct page **page, int pages)
+{
+	struct squashfs_cache_entry *buffer = squashfs_get_datablock(inode->i_sb,
+		block, bsize);
+	int bytes = buffer->length, offset = 0, i;
+	void *pageaddr;
+
+	if (buffer->error)
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+
+	for (i = 0; i < pages; i++, bytes -= PAGE_CACHE_SIZE,
+					offset += PAGE_CACHE_SIZE) {
+		int avail = clamp_t(int, bytes, 0, PAGE_CACHE_SIZE);
+
+		if (page[i] == NULL) {
+			page[i] = grab_cache_page_nowait(inode->i_mapping,
+							start_index + i);
+			if (page[i] == NULL)
+				continue;
+			if (PageUptodate(page[i]))
+				goto skip_page;
+		}
+
+		if (buffer->error) {
+			SetPageError(page[i]);
+			goto skip_page;
+		}
+
+		pageaddr = kmap_atomic(page[i]);
+		squashfs_copy_data(pageaddr, buffer, offset, avail);
+		memset(pageaddr + avail, 0, PAGE_CACHE_SIZE - avail);
+		kunmap_atomic(pageaddr);
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+skip_page:
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+
+	squashfs_cache_put(buffer);
+}
@@ -20,47 +20,24 @@
 #include "squashfs.h"
 #include "page_actor.h"
 
-static int squashfs_read_cache(struct page *target_page, u64 block, int bsize,
-	int pages, struct page **page);
-
-/* Read separately compressed datablock directly into page cache */
-int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
+static int squashfs_read_cache(struct inode *inode, struct page *target_page,
+	u64 block, int bsize, int pages, struct page **page);
 
+/*
+ * Try to grab the pages covered by the Squashfs block which starts at
+ * @start_index, leaving alone those the caller has put in @page already.
+ * Returns the number of pages we couldn't get.
+ */
+static int squashfs_grab_pages(struct address_space *mapping, int start_index,
+	struct page **page, int pages)
 {
-	struct inode *inode = target_page->mapping->host;
-	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
-
-	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
-	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
-	int start_index = target_page->index & ~mask;
-	int end_index = start_index | mask;
-	int i, n, pages, missing_pages, bytes, res = -ENOMEM;
-	struct page **page;
-	struct squashfs_page_actor *actor;
-	void *pageaddr;
-
-	if (end_index > file_end)
-		end_index = file_end;
-
-	pages = end_index - start_index + 1;
+	int i, missing_pages = 0;
 
-	page = kmalloc_array(pages, sizeof(void *), GFP_KERNEL);
-	if (page == NULL)
-		return res;
-
-	/*
-	 * Create a "page actor" which will kmap and kunmap the
-	 * page cache pages appropriately within the decompressor
-	 */
-	actor = squashfs_page_actor_init_special(page, pages, 0);
-	if (actor == NULL)
-		goto out;
-
-	/* Try to grab all the pages covered by the Squashfs block */
-	for (missing_pages = 0, i = 0, n = start_index; i < pages; i++, n++) {
-		page[i] = (n == target_page->index) ? target_page :
-			grab_cache_page_nowait(target_page->mapping, n);
+	for (i = 0; i < pages; i++) {
+		if (page[i])
+			continue;
 
+		page[i] = grab_cache_page_nowait(mapping, start_index + i);
 		if (page[i] == NULL) {
 			missing_pages++;
 			continue;
@@ -74,6 +51,29 @@ int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
 		}
 	}
 
+	return missing_pages;
+}
+
+/*
+ * Read the datablock into the locked pages in @page, which come with a
+ * reference each.  All of them but target_page are unlocked and released
+ * here, target_page is dealt with by the caller on error.
+ */
+static int squashfs_read_pages(struct inode *inode, struct page *target_page,
+	u64 block, int bsize, struct page **page, int pages, int missing_pages)
+{
+	struct squashfs_page_actor *actor;
+	int i, bytes, res = -ENOMEM;
+	void *pageaddr;
+
+	/*
+	 * Create a "page actor" which will kmap and kunmap the
+	 * page cache pages appropriately within the decompressor
+	 */
+	actor = squashfs_page_actor_init_special(page, pages, 0);
+	if (actor == NULL)
+		goto mark_errored;
+
 	if (missing_pages) {
 		/*
 		 * Couldn't get one or more pages, this page has either
@@ -82,8 +82,8 @@ int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
 		 * squashfs_readpage also trying to grab them.  Fall back to
 		 * using an intermediate buffer.
 		 */
-		res = squashfs_read_cache(target_page, block, bsize, pages,
-								page);
+		res = squashfs_read_cache(inode, target_page, block, bsize,
+								pages, page);
 		if (res < 0)
 			goto mark_errored;
 
@@ -113,7 +113,6 @@ int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
 	}
 
 	kfree(actor);
-	kfree(page);
 
 	return 0;
 
@@ -132,16 +131,61 @@ mark_errored:
 
 out:
 	kfree(actor);
+	return res;
+}
+
+/* Read separately compressed datablock directly into page cache */
+int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
+
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int end_index = start_index | mask;
+	int pages, missing_pages, res;
+	struct page **page;
+
+	if (end_index > file_end)
+		end_index = file_end;
+
+	pages = end_index - start_index + 1;
+
+	page = kcalloc(pages, sizeof(void *), GFP_KERNEL);
+	if (page == NULL)
+		return -ENOMEM;
+
+	page[target_page->index - start_index] = target_page;
+	missing_pages = squashfs_grab_pages(target_page->mapping, start_index,
+								page, pages);
+	res = squashfs_read_pages(inode, target_page, block, bsize, page,
+							pages, missing_pages);
 	kfree(page);
 	return res;
 }
 
+/*
+ * Read a datablock for readahead.  @page holds the pages of the block
+ * which squashfs_readpages() put in the page cache, locked, the rest are
+ * grabbed here.  All of them are unlocked and released before returning.
+ */
+void squashfs_readahead_block(struct inode *inode, u64 block, int bsize,
+	int start_index, struct page **page, int pages)
+{
+	int missing_pages = squashfs_grab_pages(inode->i_mapping, start_index,
+								page, pages);
+
+	squashfs_read_pages(inode, NULL, block, bsize, page, pages,
+							missing_pages);
+}
+
 
-static int squashfs_read_cache(struct page *target_page, u64 block, int bsize,
-	int pages, struct page **page)
+static int squashfs_read_cache(struct inode *inode, struct page *target_page,
+	u64 block, int bsize, int pages, struct page **page)
 {
-	struct inode *i = target_page->mapping->host;
-	struct squashfs_cache_entry *buffer = squashfs_get_datablock(i->i_sb,
+	struct squashfs_cache_entry *buffer = squashfs_get_datablock(inode->i_sb,
 						 block, bsize);
 	int bytes = buffer->length, res = buffer->error, n, offset = 0;
 	void *pageaddr;
@@ -69,9 +69,13 @@ extern __le64 *squashfs_read_fragment_index_table(struct super_block *,
 /* file.c */
 void squashfs_copy_cache(struct page *, struct squashfs_cache_entry *, int,
 				int);
+extern int squashfs_init_readahead(void);
+extern void squashfs_destroy_readahead(void);
 
 /* file_xxx.c */
 extern int squashfs_readpage_block(struct page *, u64, int);
+extern void squashfs_readahead_block(struct inode *, u64, int, int,
+				struct page **, int);
 
 /* id.c */
 extern int squashfs_get_id(struct super_block *, unsigned int, unsigned int *);
@@ -312,6 +312,117 @@ SYSCALL_DEFINE2(newfstat, unsigned int, fd, struct stat __user *, statbuf)
 	return error;
 }
 
+static void cp_stat_batch_time(struct stat_batch_time *t,
+			       const struct timespec *ts)
+{
+	t->tv_sec = ts->tv_sec;
+	t->tv_nsec = ts->tv_nsec;
+}
+
+/* fill what was asked for into @ent, and say what that was in ->mask */
+static void cp_stat_batch(struct kstat *stat, unsigned int mask,
+			  struct stat_batch_entry *ent)
+{
+	if (mask & STAT_BATCH_MODE)
+		ent->mode = stat->mode;
+	if (mask & STAT_BATCH_NLINK)
+		ent->nlink = stat->nlink;
+	if (mask & STAT_BATCH_UID)
+		ent->uid = from_kuid_munged(current_user_ns(), stat->uid);
+	if (mask & STAT_BATCH_GID)
+		ent->gid = from_kgid_munged(current_user_ns(), stat->gid);
+	if (mask & STAT_BATCH_RDEV) {
+		ent->rdev_major = MAJOR(stat->rdev);
+		ent->rdev_minor = MINOR(stat->rdev);
+	}
+	if (mask & STAT_BATCH_DEV) {
+		ent->dev_major = MAJOR(stat->dev);
+		ent->dev_minor = MINOR(stat->dev);
+	}
+	if (mask & STAT_BATCH_INO)
+		ent->ino = stat->ino;
+	if (mask & STAT_BATCH_SIZE)
+		ent->size = stat->size;
+	if (mask & STAT_BATCH_BLOCKS)
+		ent->blocks = stat->blocks;
+	if (mask & STAT_BATCH_BLKSIZE)
+		ent->blksize = stat->blksize;
+	if (mask & STAT_BATCH_ATIME)
+		cp_stat_batch_time(&ent->atime, &stat->atime);
+	if (mask & STAT_BATCH_MTIME)
+		cp_stat_batch_time(&ent->mtime, &stat->mtime);
+	if (mask & STAT_BATCH_CTIME)
+		cp_stat_batch_time(&ent->ctime, &stat->ctime);
+	ent->mask = mask;
+}
+
+/*
+ * stat_batch - the attributes of a list of names, relative to @dfd
+ *
+ * Each name is looked up on its own, through the dcache like any
+ * fstatat(), and gets ->error set; a failed lookup doesn't end the batch.
+ * Only the output part of an entry is written back, and only the fields
+ * in @mask are filled in.  Returns the number of entries done, which is
+ * short of @count only if a fatal signal came in.
+ */
+SYSCALL_DEFINE5(stat_batch, int, dfd, struct stat_batch_entry __user *, entries,
+		unsigned int, count, unsigned int, mask, unsigned int, flags)
+{
+	const size_t out = offsetof(struct stat_batch_entry, error);
+	unsigned int lookup_flags = 0;
+	unsigned int i;
+
+	if (flags & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT))
+		return -EINVAL;
+	if (mask & ~STAT_BATCH_ALL)
+		return -EINVAL;
+	if (count > STAT_BATCH_MAX)
+		return -E2BIG;
+
+	if (!(flags & AT_SYMLINK_NOFOLLOW))
+		lookup_flags |= LOOKUP_FOLLOW;
+
+	for (i = 0; i < count; i++) {
+		struct stat_batch_entry ent;
+		unsigned int lflags = lookup_flags;
+		const char __user *name;
+		struct kstat stat;
+		struct path path;
+		u64 uname;
+		int error;
+
+		if (fatal_signal_pending(current))
+			break;
+
+		if (get_user(uname, &entries[i].name))
+			return i ? i : -EFAULT;
+		name = (const char __user *)(uintptr_t)uname;
+
+		memset(&ent, 0, sizeof(ent));
+retry:
+		error = user_path_at(dfd, name, lflags, &path);
+		if (!error) {
+			error = vfs_getattr(&path, &stat);
+			path_put(&path);
+			if (retry_estale(error, lflags)) {
+				lflags |= LOOKUP_REVAL;
+				goto retry;
+			}
+		}
+		ent.error = error;
+		if (!error)
+			cp_stat_batch(&stat, mask, &ent);
+
+		if (copy_to_user((char __user *)&entries[i] + out,
+				 (char *)&ent + out, sizeof(ent) - out))
+			return i ? i : -EFAULT;
+
+		cond_resched();
+	}
+
+	return i;
+}
+
 SYSCALL_DEFINE4(readlinkat, int, dfd, const char __user *, pathname,
 		char __user *, buf, int, bufsiz)
 {
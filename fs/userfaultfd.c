@@ -26,9 +26,18 @@
 #include <linux/mempolicy.h>
 #include <linux/ioctl.h>
 #include <linux/security.h>
+#include <linux/uio.h>
 
 static struct kmem_cache *userfaultfd_ctx_cachep __read_mostly;
 
+/* the write protect faults need the architecture's help */
+#ifdef CONFIG_HAVE_ARCH_USERFAULTFD_WP
+#define UFFD_SUPPORTED_FEATURES UFFD_API_FEATURES
+#else
+#define UFFD_SUPPORTED_FEATURES \
+	(UFFD_API_FEATURES & ~UFFD_FEATURE_PAGEFAULT_FLAG_WP)
+#endif
+
 enum userfaultfd_state {
 	UFFD_STATE_WAIT_API,
 	UFFD_STATE_RUNNING,
@@ -236,6 +245,8 @@ static inline bool userfaultfd_must_wait(struct userfaultfd_ctx *ctx,
 	 */
 	if (pte_none(*pte))
 		ret = true;
+	if ((reason & VM_UFFD_WP) && pte_uffd_wp(*pte))
+		ret = true;
 	pte_unmap(pte);
 
 out:
@@ -452,6 +463,10 @@ static int userfaultfd_release(struct inode *inode, struct file *file)
 			prev = vma;
 			continue;
 		}
+		/* nobody is left to resolve the write protect faults */
+		if (userfaultfd_wp(vma))
+			uffd_wp_range(vma, vma->vm_start,
+				      vma->vm_end - vma->vm_start, false);
 		new_flags = vma->vm_flags & ~(VM_UFFD_MISSING | VM_UFFD_WP);
 		prev = vma_merge(mm, prev, vma->vm_start, vma->vm_end,
 				 new_flags, vma->anon_vma,
@@ -462,8 +477,10 @@ static int userfaultfd_release(struct inode *inode, struct file *file)
 			vma = prev;
 		else
 			prev = vma;
+		vm_write_begin(vma);
 		vma->vm_flags = new_flags;
 		vma->vm_userfaultfd_ctx = NULL_VM_UFFD_CTX;
+		vm_write_end(vma);
 	}
 	up_write(&mm->mmap_sem);
 
@@ -743,13 +760,10 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 	if (uffdio_register.mode & UFFDIO_REGISTER_MODE_MISSING)
 		vm_flags |= VM_UFFD_MISSING;
 	if (uffdio_register.mode & UFFDIO_REGISTER_MODE_WP) {
-		vm_flags |= VM_UFFD_WP;
-		/*
-		 * FIXME: remove the below error constraint by
-		 * implementing the wprotect tracking mode.
-		 */
-		ret = -EINVAL;
+#ifndef CONFIG_HAVE_ARCH_USERFAULTFD_WP
 		goto out;
+#endif
+		vm_flags |= VM_UFFD_WP;
 	}
 
 	ret = validate_range(mm, uffdio_register.range.start,
@@ -854,8 +868,10 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 		 * the next vma was merged into the current one and
 		 * the current one has not been updated yet.
 		 */
+		vm_write_begin(vma);
 		vma->vm_flags = new_flags;
 		vma->vm_userfaultfd_ctx.ctx = ctx;
+		vm_write_end(vma);
 
 	skip:
 		prev = vma;
@@ -870,8 +886,11 @@ out_unlock:
 		 * userland which ioctls methods are guaranteed to
 		 * succeed on this range.
 		 */
-		if (put_user(UFFD_API_RANGE_IOCTLS,
-			     &user_uffdio_register->ioctls))
+		__u64 ioctls_out = UFFD_API_RANGE_IOCTLS;
+
+		if (vm_flags & VM_UFFD_WP)
+			ioctls_out |= UFFD_API_RANGE_IOCTLS_WP;
+		if (put_user(ioctls_out, &user_uffdio_register->ioctls))
 			ret = -EFAULT;
 	}
 out:
@@ -963,6 +982,14 @@ static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
 			start = vma->vm_start;
 		vma_end = min(end, vma->vm_end);
 
+		/* don't leave write protected ptes behind */
+		if (userfaultfd_wp(vma)) {
+			ret = uffd_wp_range(vma, start, vma_end - start,
+					    false);
+			if (ret)
+				break;
+		}
+
 		new_flags = vma->vm_flags & ~(VM_UFFD_MISSING | VM_UFFD_WP);
 		prev = vma_merge(mm, prev, start, vma_end, new_flags,
 				 vma->anon_vma, vma->vm_file, vma->vm_pgoff,
@@ -988,8 +1015,10 @@ static int userfaultfd_unregister(struct userfaultfd_ctx *ctx,
 		 * the next vma was merged into the current one and
 		 * the current one has not been updated yet.
 		 */
+		vm_write_begin(vma);
 		vma->vm_flags = new_flags;
 		vma->vm_userfaultfd_ctx = NULL_VM_UFFD_CTX;
+		vm_write_end(vma);
 
 	skip:
 		prev = vma;
@@ -1065,11 +1094,12 @@ static int userfaultfd_copy(struct userfaultfd_ctx *ctx,
 	ret = -EINVAL;
 	if (uffdio_copy.src + uffdio_copy.len <= uffdio_copy.src)
 		goto out;
-	if (uffdio_copy.mode & ~UFFDIO_COPY_MODE_DONTWAKE)
+	if (uffdio_copy.mode & ~(UFFDIO_COPY_MODE_DONTWAKE|UFFDIO_COPY_MODE_WP))
 		goto out;
 
 	ret = mcopy_atomic(ctx->mm, uffdio_copy.dst, uffdio_copy.src,
-			   uffdio_copy.len);
+			   uffdio_copy.len,
+			   uffdio_copy.mode & UFFDIO_COPY_MODE_WP);
 	if (unlikely(put_user(ret, &user_uffdio_copy->copy)))
 		return -EFAULT;
 	if (ret < 0)
@@ -1128,6 +1158,129 @@ out:
 	return ret;
 }
 
+/*
+ * Resolve a batch of faults with a single ioctl, each entry of the
+ * vector is an UFFDIO_COPY or, with UFFDIO_VEC_ZEROPAGE, an
+ * UFFDIO_ZEROPAGE of its own.  The entries are processed in order up
+ * to the first one that fails or is only partially resolved, "copy"
+ * returns the bytes resolved over all the entries before it and -EAGAIN
+ * is returned if there was some progress, the error of the first entry
+ * otherwise.
+ */
+static int userfaultfd_copyv(struct userfaultfd_ctx *ctx,
+			     unsigned long arg)
+{
+	__s64 ret, copied;
+	struct uffdio_copyv uffdio_copyv;
+	struct uffdio_copyv __user *user_uffdio_copyv;
+	struct uffdio_vec __user *user_vec;
+	struct uffdio_vec vec;
+	struct userfaultfd_wake_range range;
+	__u64 i;
+
+	user_uffdio_copyv = (struct uffdio_copyv __user *) arg;
+
+	ret = -EFAULT;
+	if (copy_from_user(&uffdio_copyv, user_uffdio_copyv,
+			   /* don't copy "copy" last field */
+			   sizeof(uffdio_copyv)-sizeof(__s64)))
+		goto out;
+
+	ret = -EINVAL;
+	if (!uffdio_copyv.nr_vec || uffdio_copyv.nr_vec > UIO_MAXIOV)
+		goto out;
+	if (uffdio_copyv.mode & ~UFFDIO_COPYV_MODE_DONTWAKE)
+		goto out;
+
+	user_vec = (struct uffdio_vec __user *)(unsigned long) uffdio_copyv.vec;
+	copied = 0;
+	for (i = 0; i < uffdio_copyv.nr_vec; i++) {
+		ret = -EFAULT;
+		if (copy_from_user(&vec, &user_vec[i], sizeof(vec)))
+			break;
+
+		ret = validate_range(ctx->mm, vec.dst, vec.len);
+		if (ret)
+			break;
+		ret = -EINVAL;
+		if (vec.flags & ~UFFDIO_VEC_ZEROPAGE)
+			break;
+
+		if (vec.flags & UFFDIO_VEC_ZEROPAGE) {
+			ret = mfill_zeropage(ctx->mm, vec.dst, vec.len);
+		} else {
+			/* see userfaultfd_copy() */
+			if (vec.src + vec.len <= vec.src)
+				break;
+			ret = mcopy_atomic(ctx->mm, vec.dst, vec.src, vec.len,
+					   false);
+		}
+		if (ret < 0)
+			break;
+		/* len == 0 would wake all */
+		BUG_ON(!ret);
+		copied += ret;
+		range.len = ret;
+		if (!(uffdio_copyv.mode & UFFDIO_COPYV_MODE_DONTWAKE)) {
+			range.start = vec.dst;
+			wake_userfault(ctx, &range);
+		}
+		ret = range.len == vec.len ? 0 : -EAGAIN;
+		if (ret)
+			break;
+	}
+
+	if (unlikely(put_user(copied ? copied : ret,
+			      &user_uffdio_copyv->copy)))
+		return -EFAULT;
+	if (ret && copied)
+		ret = -EAGAIN;
+out:
+	return ret;
+}
+
+static int userfaultfd_writeprotect(struct userfaultfd_ctx *ctx,
+				    unsigned long arg)
+{
+	int ret;
+	struct uffdio_writeprotect uffdio_wp;
+	struct userfaultfd_wake_range range;
+	const void __user *buf = (void __user *)arg;
+	bool enable_wp;
+
+	ret = -EFAULT;
+	if (copy_from_user(&uffdio_wp, buf, sizeof(uffdio_wp)))
+		goto out;
+
+	ret = validate_range(ctx->mm, uffdio_wp.range.start,
+			     uffdio_wp.range.len);
+	if (ret)
+		goto out;
+
+	ret = -EINVAL;
+	if (uffdio_wp.mode & ~(UFFDIO_WRITEPROTECT_MODE_DONTWAKE |
+			       UFFDIO_WRITEPROTECT_MODE_WP))
+		goto out;
+	enable_wp = uffdio_wp.mode & UFFDIO_WRITEPROTECT_MODE_WP;
+	/* there is nothing to wake up when protecting */
+	if (enable_wp && (uffdio_wp.mode & UFFDIO_WRITEPROTECT_MODE_DONTWAKE))
+		goto out;
+
+	ret = mwriteprotect_range(ctx->mm, uffdio_wp.range.start,
+				  uffdio_wp.range.len, enable_wp);
+	if (ret)
+		goto out;
+
+	if (!enable_wp &&
+	    !(uffdio_wp.mode & UFFDIO_WRITEPROTECT_MODE_DONTWAKE)) {
+		range.start = uffdio_wp.range.start;
+		range.len = uffdio_wp.range.len;
+		wake_userfault(ctx, &range);
+	}
+out:
+	return ret;
+}
+
 /*
  * userland asks for a certain API version and we return which bits
  * and ioctl commands are implemented in this kernel for such API
@@ -1146,14 +1299,15 @@ static int userfaultfd_api(struct userfaultfd_ctx *ctx,
 	ret = -EFAULT;
 	if (copy_from_user(&uffdio_api, buf, sizeof(uffdio_api)))
 		goto out;
-	if (uffdio_api.api != UFFD_API || uffdio_api.features) {
+	if (uffdio_api.api != UFFD_API ||
+	    (uffdio_api.features & ~UFFD_SUPPORTED_FEATURES)) {
 		memset(&uffdio_api, 0, sizeof(uffdio_api));
 		if (copy_to_user(buf, &uffdio_api, sizeof(uffdio_api)))
 			goto out;
 		ret = -EINVAL;
 		goto out;
 	}
-	uffdio_api.features = UFFD_API_FEATURES;
+	uffdio_api.features = UFFD_SUPPORTED_FEATURES;
 	uffdio_api.ioctls = UFFD_API_IOCTLS;
 	ret = -EFAULT;
 	if (copy_to_user(buf, &uffdio_api, sizeof(uffdio_api)))
@@ -1192,6 +1346,12 @@ static long userfaultfd_ioctl(struct file *file, unsigned cmd,
 	case UFFDIO_ZEROPAGE:
 		ret = userfaultfd_zeropage(ctx, arg);
 		break;
+	case UFFDIO_COPYV:
+		ret = userfaultfd_copyv(ctx, arg);
+		break;
+	case UFFDIO_WRITEPROTECT:
+		ret = userfaultfd_writeprotect(ctx, arg);
+		break;
 	}
 	return ret;
 }
@@ -1222,7 +1382,7 @@ static void userfaultfd_show_fdinfo(struct seq_file *m, struct file *f)
 	 *	protocols: aa:... bb:...
 	 */
 	seq_printf(m, "pending:\t%lu\ntotal:\t%lu\nAPI:\t%Lx:%x:%Lx\n",
-		   pending, total, UFFD_API, UFFD_API_FEATURES,
+		   pending, total, UFFD_API, UFFD_SUPPORTED_FEATURES,
 		   UFFD_API_IOCTLS|UFFD_API_RANGE_IOCTLS);
 }
 #endif
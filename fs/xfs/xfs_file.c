@@ -42,6 +42,7 @@
 #include <linux/falloc.h>
 #include <linux/pagevec.h>
 #include <linux/backing-dev.h>
+#include <linux/mman.h>
 
 static const struct vm_operations_struct xfs_file_vm_ops;
 
@@ -859,6 +860,7 @@ write_retry:
 
 		enospc = 1;
 		xfs_flush_inodes(ip->i_mount);
+		xfs_inactive_flush(ip->i_mount);
 		eofb.eof_scan_owner = ip->i_ino; /* for locking */
 		eofb.eof_flags = XFS_EOF_FLAGS_SYNC;
 		xfs_icache_free_eofblocks(ip->i_mount, &eofb);
@@ -1498,6 +1500,51 @@ xfs_file_llseek(
  *         i_lock (XFS - extent map serialisation)
  */
 
+/*
+ * A write fault on a MAP_SYNC mapping may only map blocks whose mapping is
+ * already stable, so that userspace can make its stores durable with cache
+ * flushes alone.  So allocate (or convert) the blocks first, and if that
+ * or an earlier fault left metadata changes in the log that fsync would
+ * have to force, force them now.  The DAX fault then finds the blocks
+ * mapped and written.  Timestamp updates are left alone, as fdatasync
+ * does.  Called with the MMAPLOCK held shared.
+ */
+STATIC int
+xfs_filemap_sync_fault(
+	struct vm_area_struct	*vma,
+	pgoff_t			pgoff,
+	size_t			size)
+{
+	struct inode		*inode = file_inode(vma->vm_file);
+	struct xfs_inode	*ip = XFS_I(inode);
+	struct buffer_head	bh;
+	xfs_lsn_t		lsn = 0;
+	int			error;
+
+	/* the fault itself sorts out, or falls back from, ranges past EOF */
+	if (pgoff + (size >> PAGE_SHIFT) >
+	    DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE))
+		return 0;
+
+	memset(&bh, 0, sizeof(bh));
+	bh.b_size = size;
+	error = xfs_get_blocks_dax_fault(inode,
+			(sector_t)pgoff << (PAGE_SHIFT - inode->i_blkbits),
+			&bh, 1);
+	if (error)
+		return error == -ENOMEM ? VM_FAULT_OOM : VM_FAULT_SIGBUS;
+
+	xfs_ilock(ip, XFS_ILOCK_SHARED);
+	if (xfs_ipincount(ip) &&
+	    (ip->i_itemp->ili_fsync_fields & ~XFS_ILOG_TIMESTAMP))
+		lsn = ip->i_itemp->ili_last_lsn;
+	xfs_iunlock(ip, XFS_ILOCK_SHARED);
+
+	if (lsn && _xfs_log_force_lsn(ip->i_mount, lsn, XFS_LOG_SYNC, NULL))
+		return VM_FAULT_SIGBUS;
+	return 0;
+}
+
 /*
  * mmap()d file has taken write protection fault and is being made writable. We
  * can set the page state up correctly for a writable page, which means we can
@@ -1519,7 +1566,12 @@ xfs_filemap_page_mkwrite(
 	xfs_ilock(XFS_I(inode), XFS_MMAPLOCK_SHARED);
 
 	if (IS_DAX(inode)) {
-		ret = __dax_mkwrite(vma, vmf, xfs_get_blocks_dax_fault, NULL);
+		ret = 0;
+		if (vma->vm_flags & VM_SYNC)
+			ret = xfs_filemap_sync_fault(vma, vmf->pgoff, PAGE_SIZE);
+		if (!ret)
+			ret = __dax_mkwrite(vma, vmf, xfs_get_blocks_dax_fault,
+					    NULL);
 	} else {
 		ret = block_page_mkwrite(vma, vmf, xfs_get_blocks);
 		ret = block_page_mkwrite_return(ret);
@@ -1590,8 +1642,16 @@ xfs_filemap_pmd_fault(
 	}
 
 	xfs_ilock(XFS_I(inode), XFS_MMAPLOCK_SHARED);
-	ret = __dax_pmd_fault(vma, addr, pmd, flags, xfs_get_blocks_dax_fault,
-			      NULL);
+	ret = 0;
+	if ((flags & FAULT_FLAG_WRITE) && (vma->vm_flags & VM_SYNC) &&
+	    (addr & PMD_MASK) >= vma->vm_start &&
+	    (addr & PMD_MASK) + PMD_SIZE <= vma->vm_end)
+		ret = xfs_filemap_sync_fault(vma,
+					     linear_page_index(vma, addr & PMD_MASK),
+					     PMD_SIZE);
+	if (!ret)
+		ret = __dax_pmd_fault(vma, addr, pmd, flags,
+				      xfs_get_blocks_dax_fault, NULL);
 	xfs_iunlock(XFS_I(inode), XFS_MMAPLOCK_SHARED);
 
 	if (flags & FAULT_FLAG_WRITE)
@@ -1628,6 +1688,10 @@ xfs_filemap_pfn_mkwrite(
 	size = (i_size_read(inode) + PAGE_SIZE - 1) >> PAGE_SHIFT;
 	if (vmf->pgoff >= size)
 		ret = VM_FAULT_SIGBUS;
+	else if (vma->vm_flags & VM_SYNC)
+		/* the block may still be waiting on the log from write(2) */
+		ret = xfs_filemap_sync_fault(vma, vmf->pgoff, PAGE_SIZE) ?:
+		      VM_FAULT_NOPAGE;
 	xfs_iunlock(ip, XFS_MMAPLOCK_SHARED);
 	sb_end_pagefault(inode->i_sb);
 	return ret;
@@ -1647,6 +1711,10 @@ xfs_file_mmap(
 	struct file	*filp,
 	struct vm_area_struct *vma)
 {
+	/* MAP_SYNC only means something when the mapping is the storage */
+	if ((vma->vm_flags & VM_SYNC) && !IS_DAX(file_inode(filp)))
+		return -EOPNOTSUPP;
+
 	file_accessed(filp);
 	vma->vm_ops = &xfs_file_vm_ops;
 	if (IS_DAX(file_inode(filp)))
@@ -1665,6 +1733,7 @@ const struct file_operations xfs_file_operations = {
 	.compat_ioctl	= xfs_file_compat_ioctl,
 #endif
 	.mmap		= xfs_file_mmap,
+	.mmap_supported_flags = MAP_SYNC,
 	.open		= xfs_file_open,
 	.release	= xfs_file_release,
 	.fsync		= xfs_file_fsync,
@@ -182,6 +182,22 @@ xfs_iget_cache_hit(
 		goto out_error;
 	}
 
+	/*
+	 * An inode waiting for background inactivation is unlinked and going
+	 * away. Only the allocation of its number, once it has been freed, can
+	 * want it back, and that has to wait for the inactivation to finish.
+	 */
+	if (ip->i_flags & (XFS_NEED_INACTIVE|XFS_INACTIVATING)) {
+		if (!(flags & XFS_IGET_CREATE)) {
+			error = -ENOENT;
+			goto out_error;
+		}
+		trace_xfs_iget_skip(ip);
+		XFS_STATS_INC(mp, xs_ig_frecycle);
+		error = -EAGAIN;
+		goto out_error;
+	}
+
 	/*
 	 * If lookup is racing with unlink return an error immediately.
 	 */
@@ -487,7 +503,8 @@ xfs_inode_ag_walk_grab(
 		goto out_unlock_noent;
 
 	/* avoid new or reclaimable inodes. Leave for reclaim code to flush */
-	if (__xfs_iflags_test(ip, XFS_INEW | XFS_IRECLAIMABLE | XFS_IRECLAIM))
+	if (__xfs_iflags_test(ip, XFS_INEW | XFS_IRECLAIMABLE | XFS_IRECLAIM |
+				  XFS_NEED_INACTIVE | XFS_INACTIVATING))
 		goto out_unlock_noent;
 	spin_unlock(&ip->i_flags_lock);
 
@@ -759,6 +776,9 @@ __xfs_inode_set_reclaim_tag(
  * We set the inode flag atomically with the radix tree tag.
  * Once we get tag lookups on the radix tree, this inode flag
  * can go away.
+ *
+ * An inode coming out of background inactivation drops its inactivation
+ * flags in the same go, so lookups never find it in between.
  */
 void
 xfs_inode_set_reclaim_tag(
@@ -771,12 +791,100 @@ xfs_inode_set_reclaim_tag(
 	spin_lock(&pag->pag_ici_lock);
 	spin_lock(&ip->i_flags_lock);
 	__xfs_inode_set_reclaim_tag(pag, ip);
+	ip->i_flags &= ~(XFS_NEED_INACTIVE | XFS_INACTIVATING);
 	__xfs_iflags_set(ip, XFS_IRECLAIMABLE);
 	spin_unlock(&ip->i_flags_lock);
 	spin_unlock(&pag->pag_ici_lock);
 	xfs_perag_put(pag);
 }
 
+/*
+ * Background inactivation of unlinked inodes.
+ *
+ * Freeing the blocks of a large, fragmented file takes many transactions, and
+ * doing that in the final iput leaves an unlinker waiting for all of them. So
+ * an unlinked inode is only marked for inactivation when it is evicted, and
+ * destroying it tags it in its AG's inode cache instead of queueing it for
+ * reclaim. The AG's worker then frees it and passes it on to reclaim. Until it
+ * is freed, the inode stays on the AGI unlinked list, so recovery still takes
+ * care of it after a crash.
+ *
+ * Unlinkers are throttled once an AG has XFS_INACTIVE_BACKLOG inodes queued:
+ * they wait for the worker of the AG to catch up.
+ */
+#define XFS_INACTIVE_BACKLOG	256
+
+void
+xfs_inode_set_inactive_tag(
+	struct xfs_inode	*ip)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_perag	*pag;
+	bool			throttle;
+
+	pag = xfs_perag_get(mp, XFS_INO_TO_AGNO(mp, ip->i_ino));
+	spin_lock(&pag->pag_ici_lock);
+	radix_tree_tag_set(&pag->pag_ici_root,
+			   XFS_INO_TO_AGINO(mp, ip->i_ino),
+			   XFS_ICI_INACTIVE_TAG);
+	throttle = ++pag->pag_ici_inactive > XFS_INACTIVE_BACKLOG;
+	spin_unlock(&pag->pag_ici_lock);
+
+	queue_work(mp->m_inactive_workqueue, &pag->pag_inactive_work);
+
+	/* the worker may need what a transaction or memory reclaim holds */
+	if (throttle && !(current->flags & (PF_FSTRANS | PF_MEMALLOC)))
+		flush_work(&pag->pag_inactive_work);
+	xfs_perag_put(pag);
+}
+
+/*
+ * Inactivate the tagged inodes of an AG, a batch at a time. Nothing but us
+ * takes an inode out of the tree while it is tagged to be inactivated.
+ */
+void
+xfs_inactive_worker(
+	struct work_struct	*work)
+{
+	struct xfs_perag	*pag = container_of(work, struct xfs_perag,
+						    pag_inactive_work);
+	struct xfs_mount	*mp = pag->pag_mount;
+	struct xfs_inode	*batch[XFS_LOOKUP_BATCH];
+	int			nr_found;
+	int			i;
+
+	do {
+		spin_lock(&pag->pag_ici_lock);
+		nr_found = radix_tree_gang_lookup_tag(&pag->pag_ici_root,
+				(void **)batch, 0, XFS_LOOKUP_BATCH,
+				XFS_ICI_INACTIVE_TAG);
+		for (i = 0; i < nr_found; i++) {
+			struct xfs_inode *ip = batch[i];
+
+			radix_tree_tag_clear(&pag->pag_ici_root,
+					     XFS_INO_TO_AGINO(mp, ip->i_ino),
+					     XFS_ICI_INACTIVE_TAG);
+			pag->pag_ici_inactive--;
+			xfs_iflags_set(ip, XFS_INACTIVATING);
+		}
+		spin_unlock(&pag->pag_ici_lock);
+
+		for (i = 0; i < nr_found; i++) {
+			xfs_inactive(batch[i]);
+			xfs_inode_set_reclaim_tag(batch[i]);
+			cond_resched();
+		}
+	} while (nr_found);
+}
+
+/* Wait for the inodes queued for inactivation so far to be done with. */
+void
+xfs_inactive_flush(
+	struct xfs_mount	*mp)
+{
+	flush_workqueue(mp->m_inactive_workqueue);
+}
+
 STATIC void
 __xfs_inode_clear_reclaim(
 	xfs_perag_t	*pag,
@@ -1944,6 +1944,27 @@ xfs_inactive(
 	xfs_qm_dqdetach(ip);
 }
 
+/*
+ * An unlinked inode has its blocks and itself freed by its AG's background
+ * worker rather than in the final iput, see xfs_inode_set_inactive_tag().
+ * Decide whether that is the case for an inode being evicted.
+ */
+bool
+xfs_inode_defer_inactive(
+	struct xfs_inode	*ip)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+
+	if (ip->i_d.di_mode == 0 || ip->i_d.di_nlink != 0)
+		return false;
+
+	/* nothing to do, or nothing we could do */
+	if ((mp->m_flags & XFS_MOUNT_RDONLY) || XFS_FORCED_SHUTDOWN(mp))
+		return false;
+
+	return true;
+}
+
 /*
  * This is called when the inode's link count goes to 0.
  * We place the on-disk inode on a list in the AGI.  It
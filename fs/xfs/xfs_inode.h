@@ -216,6 +216,8 @@ xfs_get_initial_prid(struct xfs_inode *dp)
 #define __XFS_IPINNED_BIT	8	 /* wakeup key for zero pin count */
 #define XFS_IPINNED		(1 << __XFS_IPINNED_BIT)
 #define XFS_IDONTCACHE		(1 << 9) /* don't cache the inode long term */
+#define XFS_NEED_INACTIVE	(1 << 10) /* unlinked, to be freed in bg */
+#define XFS_INACTIVATING	(1 << 11) /* being freed in the background */
 
 /*
  * Per-lifetime flags need to be reset when re-using a reclaimable inode during
@@ -373,6 +375,7 @@ static inline int xfs_isiflocked(struct xfs_inode *ip)
 
 int		xfs_release(struct xfs_inode *ip);
 void		xfs_inactive(struct xfs_inode *ip);
+bool		xfs_inode_defer_inactive(struct xfs_inode *ip);
 int		xfs_lookup(struct xfs_inode *dp, struct xfs_name *name,
 			   struct xfs_inode **ipp, struct xfs_name *ci_name);
 int		xfs_create(struct xfs_inode *dp, struct xfs_name *name,
@@ -335,12 +335,14 @@ xfs_bulkstat_ag_ichunk(
 }
 
 /*
- * Return stat information in bulk (by-inode) for the filesystem.
+ * Return stat information in bulk (by-inode) for the filesystem, stopping
+ * short of the AG @end_agno.
  */
 int					/* error status */
-xfs_bulkstat(
+xfs_bulkstat_range(
 	xfs_mount_t		*mp,	/* mount point for filesystem */
 	xfs_ino_t		*lastinop, /* last inode returned */
+	xfs_agnumber_t		end_agno, /* AG to stop at */
 	int			*ubcountp, /* size of buffer/count returned */
 	bulkstat_one_pf		formatter, /* func that'd fill a single buf */
 	size_t			statstruct_size, /* sizeof struct filling */
@@ -363,7 +365,7 @@ xfs_bulkstat(
 	 */
 	agno = XFS_INO_TO_AGNO(mp, *lastinop);
 	agino = XFS_INO_TO_AGINO(mp, *lastinop);
-	if (agno >= mp->m_sb.sb_agcount ||
+	if (agno >= end_agno ||
 	    *lastinop != XFS_AGINO_TO_INO(mp, agno, agino)) {
 		*done = 1;
 		*ubcountp = 0;
@@ -388,7 +390,7 @@ xfs_bulkstat(
 	 * Loop over the allocation groups, starting from the last
 	 * inode returned; 0 means start of the allocation group.
 	 */
-	while (agno < mp->m_sb.sb_agcount) {
+	while (agno < end_agno) {
 		struct xfs_inobt_rec_incore	*irbp = irbuf;
 		struct xfs_inobt_rec_incore	*irbufend = irbuf + nirbuf;
 		bool				end_of_ag = false;
@@ -529,12 +531,29 @@ del_cursor:
 	 * the filesystem so the next call will return immediately.
 	 */
 	*lastinop = XFS_AGINO_TO_INO(mp, agno, agino);
-	if (agno >= mp->m_sb.sb_agcount)
+	if (agno >= end_agno)
 		*done = 1;
 
 	return error;
 }
 
+/*
+ * Return stat information in bulk (by-inode) for the filesystem.
+ */
+int					/* error status */
+xfs_bulkstat(
+	xfs_mount_t		*mp,	/* mount point for filesystem */
+	xfs_ino_t		*lastinop, /* last inode returned */
+	int			*ubcountp, /* size of buffer/count returned */
+	bulkstat_one_pf		formatter, /* func that'd fill a single buf */
+	size_t			statstruct_size, /* sizeof struct filling */
+	char			__user *ubuffer, /* buffer with inode stats */
+	int			*done)	/* 1 if there are more stats to get */
+{
+	return xfs_bulkstat_range(mp, lastinop, mp->m_sb.sb_agcount, ubcountp,
+				  formatter, statstruct_size, ubuffer, done);
+}
+
 int
 xfs_inumbers_fmt(
 	void			__user *ubuffer, /* buffer to write to */
@@ -252,7 +252,8 @@ struct xfs_cil_ctx {
 	xfs_lsn_t		commit_lsn;	/* chkpt commit record lsn */
 	struct xlog_ticket	*ticket;	/* chkpt ticket */
 	int			nvecs;		/* number of regions */
-	int			space_used;	/* aggregate size of regions */
+	atomic_t		space_used;	/* aggregate size of regions */
+	atomic_t		order_id;	/* commit order of the items */
 	struct list_head	busy_extents;	/* busy extents in chkpt */
 	struct xfs_log_vec	*lv_chain;	/* logvecs being pushed */
 	struct xfs_log_callback	log_cb;		/* completion callback hook. */
@@ -275,10 +276,30 @@ struct xfs_cil_ctx {
  * the commit LSN to be determined as well. This should make synchronous
  * operations almost as efficient as the old logging methods.
  */
+/*
+ * Transaction commits don't share a list or a counter: each CPU gathers the
+ * items, busy extents and space accounting of the commits it runs in its own
+ * structure, and the push, which holds out all commits with the context lock,
+ * pulls them together into the checkpoint.  Only the space used is folded
+ * into the context as it goes, in chunks, so that the background push can
+ * still see the checkpoint growing.
+ */
+struct xlog_cil_pcp {
+	int			space_used;	/* this CPU's part of the chkpt */
+	int			space_pending;	/* not yet in ctx->space_used */
+	int			space_reserved;	/* stolen for the chkpt ticket */
+	int			nvecs;
+	struct list_head	log_items;
+	struct list_head	busy_extents;
+};
+
+/* the CIL has nothing in it for the current context */
+#define XLOG_CIL_EMPTY		0
+
 struct xfs_cil {
 	struct xlog		*xc_log;
-	struct list_head	xc_cil;
-	spinlock_t		xc_cil_lock;
+	unsigned long		xc_flags;
+	struct xlog_cil_pcp __percpu *xc_pcp;
 
 	struct rw_semaphore	xc_ctx_lock ____cacheline_aligned_in_smp;
 	struct xfs_cil_ctx	*xc_ctx;
@@ -340,6 +361,14 @@ struct xfs_cil {
  */
 #define XLOG_CIL_SPACE_LIMIT(log)	(log->l_logsize >> 3)
 
+/*
+ * How much space a CPU gathers before adding it to the context.  At most every
+ * CPU holds just below this back, so the checkpoint can overshoot the limit
+ * above by half of it before the background push notices.
+ */
+#define XLOG_CIL_PCP_SPACE(log)	\
+	(XLOG_CIL_SPACE_LIMIT(log) / (2 * num_online_cpus()))
+
 /*
  * ticket grant locks, queues and accounting have their own cachlines
  * as these are quite hot and can be operated on concurrently.
@@ -368,6 +397,7 @@ struct xlog {
 	uint			l_flags;
 	uint			l_quotaoffs_flag; /* XFS_DQ_*, for QUOTAOFFs */
 	struct list_head	*l_buf_cancel_table;
+	spinlock_t		l_buf_cancel_lock; /* pass 2 runs in parallel */
 	int			l_iclog_hsize;  /* size of iclog header */
 	int			l_iclog_heads;  /* # of iclog header sectors */
 	uint			l_sectBBsize;   /* sector size in BBs (2^n) */
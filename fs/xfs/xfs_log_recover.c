@@ -1986,9 +1986,12 @@ xlog_check_buffer_cancelled(
 {
 	struct xfs_buf_cancel	*bcp;
 
+	spin_lock(&log->l_buf_cancel_lock);
 	bcp = xlog_peek_buffer_cancelled(log, blkno, len, flags);
-	if (!bcp)
+	if (!bcp) {
+		spin_unlock(&log->l_buf_cancel_lock);
 		return 0;
+	}
 
 	/*
 	 * We've go a match, so return 1 so that the recovery of this buffer
@@ -2002,6 +2005,7 @@ xlog_check_buffer_cancelled(
 			kmem_free(bcp);
 		}
 	}
+	spin_unlock(&log->l_buf_cancel_lock);
 	return 1;
 }
 
@@ -3652,6 +3656,127 @@ xlog_recover_items_pass2(
 	return error;
 }
 
+/*
+ * Pass 2 of a batch of items is spread over several workers by the AG each
+ * item changes, so that the changes to any one buffer are still replayed in
+ * the order they were logged in. The items that don't change a buffer (the
+ * extent free intents and done items, which go into the AIL) all go to the
+ * first worker, in order as well. The workers are only used within a batch,
+ * which is replayed completely before the next one is looked at.
+ */
+#define XLOG_RECOVER_MAX_WORKERS	16
+
+struct xlog_recover_worker {
+	struct work_struct		work;
+	struct xlog			*log;
+	struct xlog_recover		*trans;
+	struct list_head		items;
+	struct list_head		buffer_list;
+	int				error;
+};
+
+/* the AG of the disk space the item modifies */
+STATIC xfs_agnumber_t
+xlog_recover_item_agno(
+	struct xlog			*log,
+	struct xlog_recover_item	*item)
+{
+	struct xfs_mount		*mp = log->l_mp;
+	struct xfs_buf_log_format	*buf_f;
+	struct xfs_inode_log_format	ilf_buf;
+	struct xfs_inode_log_format	*ilfp;
+	struct xfs_dq_logformat		*dq_f;
+	struct xfs_icreate_log		*icl;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_BUF:
+		buf_f = item->ri_buf[0].i_addr;
+		return xfs_daddr_to_agno(mp, buf_f->blf_blkno);
+	case XFS_LI_INODE:
+		if (item->ri_buf[0].i_len == sizeof(struct xfs_inode_log_format)) {
+			ilfp = item->ri_buf[0].i_addr;
+		} else {
+			ilfp = &ilf_buf;
+			memset(ilfp, 0, sizeof(*ilfp));
+			if (xfs_inode_item_format_convert(&item->ri_buf[0],
+							  ilfp))
+				return 0;
+		}
+		return xfs_daddr_to_agno(mp, ilfp->ilf_blkno);
+	case XFS_LI_DQUOT:
+		dq_f = item->ri_buf[0].i_addr;
+		return xfs_daddr_to_agno(mp, dq_f->qlf_blkno);
+	case XFS_LI_ICREATE:
+		icl = item->ri_buf[0].i_addr;
+		return be32_to_cpu(icl->icl_ag);
+	default:
+		return 0;
+	}
+}
+
+static void
+xlog_recover_pass2_worker(
+	struct work_struct		*work)
+{
+	struct xlog_recover_worker	*rw = container_of(work,
+					struct xlog_recover_worker, work);
+
+	rw->error = xlog_recover_items_pass2(rw->log, rw->trans,
+					     &rw->buffer_list, &rw->items);
+}
+
+STATIC int
+xlog_recover_items_pass2_parallel(
+	struct xlog			*log,
+	struct xlog_recover		*trans,
+	struct list_head		*buffer_list,
+	struct list_head		*item_list)
+{
+	struct xlog_recover_worker	*workers;
+	struct xlog_recover_item	*item;
+	struct xlog_recover_item	*next;
+	int				nr_workers;
+	int				error = 0;
+	int				i;
+
+	nr_workers = min_t(int, num_online_cpus(), XLOG_RECOVER_MAX_WORKERS);
+	nr_workers = min_t(xfs_agnumber_t, nr_workers,
+			   log->l_mp->m_sb.sb_agcount);
+	if (nr_workers <= 1)
+		return xlog_recover_items_pass2(log, trans, buffer_list,
+						item_list);
+
+	workers = kmem_zalloc(nr_workers * sizeof(*workers), KM_SLEEP);
+	for (i = 0; i < nr_workers; i++) {
+		INIT_WORK(&workers[i].work, xlog_recover_pass2_worker);
+		workers[i].log = log;
+		workers[i].trans = trans;
+		INIT_LIST_HEAD(&workers[i].items);
+		INIT_LIST_HEAD(&workers[i].buffer_list);
+	}
+
+	list_for_each_entry_safe(item, next, item_list, ri_list) {
+		i = xlog_recover_item_agno(log, item) % nr_workers;
+		list_move_tail(&item->ri_list, &workers[i].items);
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		if (!list_empty(&workers[i].items))
+			queue_work(system_unbound_wq, &workers[i].work);
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		flush_work(&workers[i].work);
+		if (!error)
+			error = workers[i].error;
+		list_splice_tail_init(&workers[i].items, item_list);
+		list_splice_tail_init(&workers[i].buffer_list, buffer_list);
+	}
+
+	kmem_free(workers);
+	return error;
+}
+
 /*
  * Perform the transaction.
  *
@@ -3691,8 +3816,8 @@ xlog_recover_commit_trans(
 			list_move_tail(&item->ri_list, &ra_list);
 			items_queued++;
 			if (items_queued >= XLOG_RECOVER_COMMIT_QUEUE_MAX) {
-				error = xlog_recover_items_pass2(log, trans,
-						&buffer_list, &ra_list);
+				error = xlog_recover_items_pass2_parallel(log,
+						trans, &buffer_list, &ra_list);
 				list_splice_tail_init(&ra_list, &done_list);
 				items_queued = 0;
 			}
@@ -3709,7 +3834,7 @@ xlog_recover_commit_trans(
 out:
 	if (!list_empty(&ra_list)) {
 		if (!error)
-			error = xlog_recover_items_pass2(log, trans,
+			error = xlog_recover_items_pass2_parallel(log, trans,
 					&buffer_list, &ra_list);
 		list_splice_tail_init(&ra_list, &done_list);
 	}
@@ -4849,6 +4974,7 @@ xlog_do_log_recovery(
 						 KM_SLEEP);
 	for (i = 0; i < XLOG_BC_TABLE_SIZE; i++)
 		INIT_LIST_HEAD(&log->l_buf_cancel_table[i]);
+	spin_lock_init(&log->l_buf_cancel_lock);
 
 	error = xlog_do_recovery_pass(log, head_blk, tail_blk,
 				      XLOG_RECOVER_PASS1, NULL);
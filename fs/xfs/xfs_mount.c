@@ -212,6 +212,7 @@ xfs_initialize_perag(
 		spin_lock_init(&pag->pag_ici_lock);
 		mutex_init(&pag->pag_ici_reclaim_lock);
 		INIT_RADIX_TREE(&pag->pag_ici_root, GFP_ATOMIC);
+		INIT_WORK(&pag->pag_inactive_work, xfs_inactive_worker);
 		spin_lock_init(&pag->pag_buf_lock);
 		pag->pag_buf_tree = RB_ROOT;
 
@@ -937,6 +938,12 @@ xfs_mountfs(
 		goto out_rtunmount;
 	}
 
+	/*
+	 * Recovery dropped the inodes left on the unlinked lists, and their
+	 * freeing has to be done before quotacheck counts what's there.
+	 */
+	xfs_inactive_flush(mp);
+
 	/*
 	 * Complete the quota initialisation, post-log-replay component.
 	 */
@@ -972,6 +979,7 @@ xfs_mountfs(
 	xfs_rtunmount_inodes(mp);
  out_rele_rip:
 	IRELE(rip);
+	xfs_inactive_flush(mp);
 	cancel_delayed_work_sync(&mp->m_reclaim_work);
 	xfs_reclaim_inodes(mp, SYNC_WAIT);
  out_log_dealloc:
@@ -1007,6 +1015,9 @@ xfs_unmountfs(
 
 	cancel_delayed_work_sync(&mp->m_eofblocks_work);
 
+	/* the inodes unlinked before the unmount still need freeing */
+	xfs_inactive_flush(mp);
+
 	xfs_qm_unmount_quotas(mp);
 	xfs_rtunmount_inodes(mp);
 	IRELE(mp->m_rootip);
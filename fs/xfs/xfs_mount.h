@@ -136,6 +136,7 @@ typedef struct xfs_mount {
 	struct workqueue_struct	*m_reclaim_workqueue;
 	struct workqueue_struct	*m_log_workqueue;
 	struct workqueue_struct *m_eofblocks_workqueue;
+	struct workqueue_struct *m_inactive_workqueue;
 
 	/*
 	 * Generation of the filesysyem layout.  This is incremented by each
@@ -303,6 +304,8 @@ typedef struct xfs_perag {
 	int		pag_ici_reclaimable;	/* reclaimable inodes */
 	struct mutex	pag_ici_reclaim_lock;	/* serialisation point */
 	unsigned long	pag_ici_reclaim_cursor;	/* reclaim restart point */
+	int		pag_ici_inactive;	/* inodes to inactivate */
+	struct work_struct pag_inactive_work;	/* background inactivation */
 
 	/* buffer cache index */
 	spinlock_t	pag_buf_lock;	/* lock for pag_buf_tree */
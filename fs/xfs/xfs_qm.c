@@ -1240,6 +1240,78 @@ out_unlock:
 	return error;
 }
 
+/*
+ * The inodes of each AG are walked by a worker of their own, at most one
+ * per CPU at a time. The dquots they adjust are locked on the way, so the
+ * workers only contend where they meet on the same dquots.
+ */
+struct xfs_qm_quotacheck_ag {
+	struct work_struct	work;
+	struct xfs_mount	*mp;
+	xfs_agnumber_t		agno;
+	int			error;
+};
+
+STATIC void
+xfs_qm_quotacheck_ag_worker(
+	struct work_struct	*work)
+{
+	struct xfs_qm_quotacheck_ag *qa = container_of(work,
+					struct xfs_qm_quotacheck_ag, work);
+	struct xfs_mount	*mp = qa->mp;
+	xfs_ino_t		lastino;
+	int			done, count, error;
+
+	lastino = XFS_AGINO_TO_INO(mp, qa->agno, 0);
+	do {
+		count = INT_MAX;
+		error = xfs_bulkstat_range(mp, &lastino, qa->agno + 1, &count,
+					   xfs_qm_dqusage_adjust, 1, NULL,
+					   &done);
+	} while (!error && !done);
+
+	qa->error = error;
+}
+
+STATIC int
+xfs_qm_quotacheck_inodes(
+	struct xfs_mount	*mp)
+{
+	struct workqueue_struct	*wq;
+	struct xfs_qm_quotacheck_ag *qas;
+	xfs_agnumber_t		agcount = mp->m_sb.sb_agcount;
+	xfs_agnumber_t		agno;
+	int			error = 0;
+
+	wq = alloc_workqueue("xfs-quotacheck/%s", WQ_UNBOUND,
+			     num_online_cpus(), mp->m_fsname);
+	if (!wq)
+		return -ENOMEM;
+
+	qas = kmem_zalloc_large(agcount * sizeof(*qas), KM_SLEEP);
+	if (!qas) {
+		destroy_workqueue(wq);
+		return -ENOMEM;
+	}
+
+	for (agno = 0; agno < agcount; agno++) {
+		INIT_WORK(&qas[agno].work, xfs_qm_quotacheck_ag_worker);
+		qas[agno].mp = mp;
+		qas[agno].agno = agno;
+		queue_work(wq, &qas[agno].work);
+	}
+	destroy_workqueue(wq);
+
+	for (agno = 0; agno < agcount; agno++) {
+		if (qas[agno].error) {
+			error = qas[agno].error;
+			break;
+		}
+	}
+	kmem_free(qas);
+	return error;
+}
+
 /*
  * Walk thru all the filesystem inodes and construct a consistent view
  * of the disk quota world. If the quotacheck fails, disable quotas.
@@ -1248,18 +1320,13 @@ STATIC int
 xfs_qm_quotacheck(
 	xfs_mount_t	*mp)
 {
-	int			done, count, error, error2;
-	xfs_ino_t		lastino;
-	size_t			structsz;
+	int			error, error2;
 	uint			flags;
 	LIST_HEAD		(buffer_list);
 	struct xfs_inode	*uip = mp->m_quotainfo->qi_uquotaip;
 	struct xfs_inode	*gip = mp->m_quotainfo->qi_gquotaip;
 	struct xfs_inode	*pip = mp->m_quotainfo->qi_pquotaip;
 
-	count = INT_MAX;
-	structsz = 1;
-	lastino = 0;
 	flags = 0;
 
 	ASSERT(uip || gip || pip);
@@ -1296,18 +1363,11 @@ xfs_qm_quotacheck(
 		flags |= XFS_PQUOTA_CHKD;
 	}
 
-	do {
-		/*
-		 * Iterate thru all the inodes in the file system,
-		 * adjusting the corresponding dquot counters in core.
-		 */
-		error = xfs_bulkstat(mp, &lastino, &count,
-				     xfs_qm_dqusage_adjust,
-				     structsz, NULL, &done);
-		if (error)
-			break;
-
-	} while (!done);
+	/*
+	 * Iterate thru all the inodes in the file system,
+	 * adjusting the corresponding dquot counters in core.
+	 */
+	error = xfs_qm_quotacheck_inodes(mp);
 
 	/*
 	 * We've made all the changes that we need to make incore.  Flush them
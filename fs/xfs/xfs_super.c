@@ -853,8 +853,15 @@ xfs_init_mount_workqueues(
 	if (!mp->m_eofblocks_workqueue)
 		goto out_destroy_log;
 
+	mp->m_inactive_workqueue = alloc_workqueue("xfs-inactive/%s",
+			WQ_UNBOUND|WQ_MEM_RECLAIM|WQ_FREEZABLE, 0, mp->m_fsname);
+	if (!mp->m_inactive_workqueue)
+		goto out_destroy_eofb;
+
 	return 0;
 
+out_destroy_eofb:
+	destroy_workqueue(mp->m_eofblocks_workqueue);
 out_destroy_log:
 	destroy_workqueue(mp->m_log_workqueue);
 out_destroy_reclaim:
@@ -875,6 +882,7 @@ STATIC void
 xfs_destroy_mount_workqueues(
 	struct xfs_mount	*mp)
 {
+	destroy_workqueue(mp->m_inactive_workqueue);
 	destroy_workqueue(mp->m_eofblocks_workqueue);
 	destroy_workqueue(mp->m_log_workqueue);
 	destroy_workqueue(mp->m_reclaim_workqueue);
@@ -938,9 +946,13 @@ xfs_fs_destroy_inode(
 	 * inode is clean, it still may be under IO and hence we have
 	 * to take the flush lock. The background reclaim path handles
 	 * this more efficiently than we can here, so simply let background
-	 * reclaim tear down all inodes.
+	 * reclaim tear down all inodes. Unlinked inodes go through background
+	 * inactivation first.
 	 */
-	xfs_inode_set_reclaim_tag(ip);
+	if (xfs_iflags_test(ip, XFS_NEED_INACTIVE))
+		xfs_inode_set_inactive_tag(ip);
+	else
+		xfs_inode_set_reclaim_tag(ip);
 }
 
 /*
@@ -987,6 +999,10 @@ xfs_fs_evict_inode(
 	XFS_STATS_INC(ip->i_mount, vn_rele);
 	XFS_STATS_INC(ip->i_mount, vn_remove);
 
+	if (xfs_inode_defer_inactive(ip)) {
+		xfs_iflags_set(ip, XFS_NEED_INACTIVE);
+		return;
+	}
 	xfs_inactive(ip);
 }
 
@@ -1028,6 +1044,13 @@ xfs_fs_sync_fs(
 	if (!wait)
 		return 0;
 
+	/*
+	 * A freeze has to find the unlinked inodes freed, and this is the last
+	 * point where the workers can still run transactions.
+	 */
+	if (sb->s_writers.frozen == SB_FREEZE_PAGEFAULT)
+		xfs_inactive_flush(mp);
+
 	xfs_log_force(mp, XFS_LOG_SYNC);
 	if (laptop_mode) {
 		/*
@@ -1265,6 +1288,7 @@ xfs_fs_remount(
 		 * reserve pool size so that if we get remounted rw, we can
 		 * return it to the same size.
 		 */
+		xfs_inactive_flush(mp);
 		xfs_save_resvblks(mp);
 		xfs_quiesce_attr(mp);
 		mp->m_flags |= XFS_MOUNT_RDONLY;
@@ -1639,7 +1663,7 @@ static struct file_system_type xfs_fs_type = {
 	.name			= "xfs",
 	.mount			= xfs_fs_mount,
 	.kill_sb		= kill_block_super,
-	.fs_flags		= FS_REQUIRES_DEV,
+	.fs_flags		= FS_REQUIRES_DEV | FS_PARALLEL_LOOKUP,
 };
 MODULE_ALIAS_FS("xfs");
 
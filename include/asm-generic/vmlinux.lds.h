@@ -654,6 +654,9 @@
 #define INIT_CALLS_LEVEL(level)						\
 		VMLINUX_SYMBOL(__initcall##level##_start) = .;		\
 		*(.initcall##level##.init)				\
+		VMLINUX_SYMBOL(__initcall##level##p_start) = .;		\
+		*(.initcall##level##p.init)				\
+		VMLINUX_SYMBOL(__initcall##level##p_end) = .;		\
 		*(.initcall##level##s.init)				\
 
 #define INIT_CALLS							\
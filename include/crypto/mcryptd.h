@@ -108,5 +108,6 @@ static inline unsigned long get_delay(unsigned long t)
 }
 
 void mcryptd_arm_flusher(struct mcryptd_alg_cstate *cstate, unsigned long delay);
+unsigned long mcryptd_flush_delay(unsigned int interval);
 
 #endif
@@ -36,11 +36,17 @@ enum wb_stat_item {
 	WB_WRITEBACK,
 	WB_DIRTIED,
 	WB_WRITTEN,
+	WB_READAHEAD,		/* pages read ahead */
+	WB_RA_SYNC,		/* readaheads on a cache miss */
+	WB_RA_ASYNC,		/* readaheads on a marker hit */
 	NR_WB_STAT_ITEMS
 };
 
 #define WB_STAT_BATCH (8*(1+ilog2(nr_cpu_ids)))
 
+/* Most flushers writing back the inodes of one wb at once */
+#define WB_MAX_WORKERS	8
+
 /*
  * For cgroup writeback, multiple wb's may map to the same blkcg.  Those
  * wb's can operate mostly independently but should share the congested
@@ -144,6 +150,7 @@ struct backing_dev_info {
 
 	unsigned int min_ratio;
 	unsigned int max_ratio, max_prop_frac;
+	unsigned int wb_workers;	/* flushers per wb, <= WB_MAX_WORKERS */
 
 	/*
 	 * Sum of avg_write_bw of wbs with dirty inodes.  > 0 if there are
@@ -0,0 +1,44 @@
+#ifndef _LINUX_BIASED_RWSEM_H
+#define _LINUX_BIASED_RWSEM_H
+
+#include <linux/rwsem.h>
+#include <linux/types.h>
+
+/*
+ * A reader-biased rw_semaphore.  While the lock is read-biased, readers
+ * don't touch it at all: they publish themselves in a slot of a per-node
+ * table of visible readers instead, so read-mostly locks don't bounce
+ * their cacheline across sockets.  A writer revokes the bias and waits
+ * for the published readers of the lock to go away, then keeps the bias
+ * off for a while, in proportion to what the revocation cost.
+ *
+ * It costs two words on top of the rw_semaphore and needs no allocation,
+ * so it can replace a DECLARE_RWSEM()/init_rwsem() lock as is.
+ */
+struct bias_rw_semaphore {
+	struct rw_semaphore	rw_sem;
+	int			rbias;		/* readers take the fast path */
+	u64			inhibit_until;	/* no rbias before this time */
+};
+
+#define __BIAS_RWSEM_INITIALIZER(name)				\
+	{ .rw_sem = __RWSEM_INITIALIZER(name.rw_sem) }
+
+#define DECLARE_BIAS_RWSEM(name)				\
+	struct bias_rw_semaphore name = __BIAS_RWSEM_INITIALIZER(name)
+
+#define init_bias_rwsem(sem)					\
+do {								\
+	init_rwsem(&(sem)->rw_sem);				\
+	(sem)->rbias = 0;					\
+	(sem)->inhibit_until = 0;				\
+} while (0)
+
+extern void bias_down_read(struct bias_rw_semaphore *sem);
+extern int bias_down_read_trylock(struct bias_rw_semaphore *sem);
+extern void bias_up_read(struct bias_rw_semaphore *sem);
+
+extern void bias_down_write(struct bias_rw_semaphore *sem);
+extern void bias_up_write(struct bias_rw_semaphore *sem);
+
+#endif
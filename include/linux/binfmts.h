@@ -120,4 +120,29 @@ extern void install_exec_creds(struct linux_binprm *bprm);
 extern void set_binfmt(struct linux_binfmt *new);
 extern ssize_t read_code(struct file *, unsigned long, loff_t, size_t);
 
+#ifdef CONFIG_EXEC_CACHE
+extern int sysctl_exec_prefault;
+
+extern void *exec_cache_get(struct file *file, int format, size_t *len);
+extern void exec_cache_set(struct file *file, int format,
+			   const void *data, size_t len);
+extern void exec_cache_prefault(struct file *file);
+extern void exec_cache_record(struct mm_struct *mm);
+#else
+static inline void *exec_cache_get(struct file *file, int format, size_t *len)
+{
+	return NULL;
+}
+static inline void exec_cache_set(struct file *file, int format,
+				  const void *data, size_t len)
+{
+}
+static inline void exec_cache_prefault(struct file *file)
+{
+}
+static inline void exec_cache_record(struct mm_struct *mm)
+{
+}
+#endif
+
 #endif /* _LINUX_BINFMTS_H */
@@ -0,0 +1,167 @@
+/*
+ * Block layer encryption contexts
+ *
+ * A bio can carry an encryption context: the key to use and the data unit
+ * number (DUN) of its first data unit, which serves as the IV.  Devices
+ * with an inline encryption engine advertise the modes they support on
+ * their queue and apply the context while transferring the data, for all
+ * other devices the block layer en/decrypts the bio in software.
+ *
+ * Bios with a context must only be split at data unit boundaries.
+ */
+#ifndef __LINUX_BLK_CRYPTO_H
+#define __LINUX_BLK_CRYPTO_H
+
+#include <linux/blk_types.h>
+
+struct request_queue;
+struct crypto_skcipher;
+
+enum blk_crypto_mode_num {
+	BLK_ENCRYPTION_MODE_INVALID,
+	BLK_ENCRYPTION_MODE_AES_256_XTS,
+	BLK_ENCRYPTION_MODE_MAX,
+};
+
+#define BLK_CRYPTO_MAX_KEY_SIZE		64
+#define BLK_CRYPTO_MAX_IV_SIZE		16
+
+/**
+ * struct blk_crypto_key - a key for block layer encryption
+ * @mode: the encryption mode the key is used with
+ * @data_unit_size: size in bytes of each independently en/decrypted unit
+ * @data_unit_shift: log2 of @data_unit_size
+ * @size: size of @raw in bytes
+ * @fallback_tfm: cipher for software en/decryption, if it is needed
+ * @raw: the raw key
+ *
+ * The key is owned by its user, which has to keep it around for as long
+ * as bios referring to it are in flight.
+ */
+struct blk_crypto_key {
+	enum blk_crypto_mode_num mode;
+	unsigned int data_unit_size;
+	unsigned int data_unit_shift;
+	unsigned int size;
+	struct crypto_skcipher *fallback_tfm;
+	u8 raw[BLK_CRYPTO_MAX_KEY_SIZE];
+};
+
+/**
+ * struct bio_crypt_ctx - the encryption context of a bio
+ * @bc_key: the key to en/decrypt the data with
+ * @bc_dun: the data unit number of the first data unit of the bio
+ */
+struct bio_crypt_ctx {
+	const struct blk_crypto_key *bc_key;
+	u64 bc_dun;
+};
+
+#ifdef CONFIG_BLK_INLINE_ENCRYPTION
+
+int blk_crypto_init_key(struct blk_crypto_key *key, const u8 *raw,
+			unsigned int size, enum blk_crypto_mode_num mode,
+			unsigned int data_unit_size);
+int blk_crypto_start_using_key(struct blk_crypto_key *key,
+			       struct request_queue *q);
+void blk_crypto_free_key(struct blk_crypto_key *key);
+
+void blk_queue_crypto_modes(struct request_queue *q,
+			    enum blk_crypto_mode_num mode,
+			    unsigned int data_unit_sizes);
+bool blk_queue_crypto_supported(struct request_queue *q,
+				enum blk_crypto_mode_num mode,
+				unsigned int data_unit_size);
+
+void bio_crypt_set_ctx(struct bio *bio, const struct blk_crypto_key *key,
+		       u64 dun, gfp_t gfp_mask);
+void bio_crypt_free_ctx(struct bio *bio);
+void bio_crypt_clone(struct bio *dst, struct bio *src, gfp_t gfp_mask);
+bool __blk_crypto_submit_bio(struct bio **bio_ptr);
+
+static inline bool bio_has_crypt_ctx(struct bio *bio)
+{
+	return bio->bi_crypt_context;
+}
+
+static inline void bio_crypt_advance(struct bio *bio, unsigned int bytes)
+{
+	struct bio_crypt_ctx *bc = bio->bi_crypt_context;
+
+	if (bc)
+		bc->bc_dun += bytes >> bc->bc_key->data_unit_shift;
+}
+
+/*
+ * Can @key and @dun continue @bio?  Filesystems use this to decide
+ * whether a page may be added to a bio they are building.
+ */
+static inline bool bio_crypt_can_append(struct bio *bio,
+					const struct blk_crypto_key *key,
+					u64 dun)
+{
+	struct bio_crypt_ctx *bc = bio->bi_crypt_context;
+
+	if (!bc)
+		return !key;
+	return bc->bc_key == key &&
+	       bc->bc_dun + (bio->bi_iter.bi_size >> key->data_unit_shift) == dun;
+}
+
+/* may @next follow @bio in the same request? */
+static inline bool bio_crypt_ctx_back_mergeable(struct bio *bio,
+						struct bio *next)
+{
+	struct bio_crypt_ctx *bc = next->bi_crypt_context;
+
+	return bio_crypt_can_append(bio, bc ? bc->bc_key : NULL,
+				    bc ? bc->bc_dun : 0);
+}
+
+/*
+ * Called for every bio before it is handed to its queue.  Returns false
+ * if the bio has been completed instead, and may replace *bio_ptr.
+ */
+static inline bool blk_crypto_submit_bio(struct bio **bio_ptr)
+{
+	if (!bio_has_crypt_ctx(*bio_ptr))
+		return true;
+	return __blk_crypto_submit_bio(bio_ptr);
+}
+
+#else /* CONFIG_BLK_INLINE_ENCRYPTION */
+
+static inline bool bio_has_crypt_ctx(struct bio *bio)
+{
+	return false;
+}
+
+static inline void bio_crypt_set_ctx(struct bio *bio,
+				     const struct blk_crypto_key *key,
+				     u64 dun, gfp_t gfp_mask) { }
+static inline void bio_crypt_free_ctx(struct bio *bio) { }
+static inline void bio_crypt_clone(struct bio *dst, struct bio *src,
+				   gfp_t gfp_mask) { }
+static inline void bio_crypt_advance(struct bio *bio, unsigned int bytes) { }
+
+static inline bool bio_crypt_can_append(struct bio *bio,
+					const struct blk_crypto_key *key,
+					u64 dun)
+{
+	return true;
+}
+
+static inline bool bio_crypt_ctx_back_mergeable(struct bio *bio,
+						struct bio *next)
+{
+	return true;
+}
+
+static inline bool blk_crypto_submit_bio(struct bio **bio_ptr)
+{
+	return true;
+}
+
+#endif /* CONFIG_BLK_INLINE_ENCRYPTION */
+
+#endif /* __LINUX_BLK_CRYPTO_H */
@@ -18,6 +18,17 @@ struct blk_mq_ctxmap {
 	struct blk_align_bitmap *map;
 };
 
+/*
+ * Completion times of polled requests, by direction and size, which
+ * hybrid polling sleeps through part of
+ */
+struct blk_mq_poll_stat {
+	u64			mean;		/* nsecs */
+	unsigned long		nr;
+};
+
+#define BLK_MQ_POLL_STATS_BKTS	16
+
 struct blk_mq_hw_ctx {
 	struct {
 		spinlock_t		lock;
@@ -47,6 +58,8 @@ struct blk_mq_hw_ctx {
 
 	struct blk_mq_tags	*tags;
 
+	void			*sched_data;	/* of q->elevator */
+
 	unsigned long		queued;
 	unsigned long		run;
 #define BLK_MQ_MAX_DISPATCH_ORDER	10
@@ -62,6 +75,8 @@ struct blk_mq_hw_ctx {
 
 	unsigned long		poll_invoked;
 	unsigned long		poll_success;
+	unsigned long		poll_sleeps;
+	struct blk_mq_poll_stat	poll_stat[BLK_MQ_POLL_STATS_BKTS];
 };
 
 struct blk_mq_tag_set {
@@ -230,6 +245,7 @@ void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx);
 void blk_mq_stop_hw_queues(struct request_queue *q);
 void blk_mq_start_hw_queues(struct request_queue *q);
 void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async);
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
 void blk_mq_run_hw_queues(struct request_queue *q, bool async);
 void blk_mq_delay_queue(struct blk_mq_hw_ctx *hctx, unsigned long msecs);
 void blk_mq_all_tag_busy_iter(struct blk_mq_tags *tags, busy_tag_iter_fn *fn,
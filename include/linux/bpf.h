@@ -28,6 +28,9 @@ struct bpf_map_ops {
 	/* funcs called by prog_array and perf_event_array map */
 	void *(*map_fd_get_ptr) (struct bpf_map *map, int fd);
 	void (*map_fd_put_ptr) (void *ptr);
+
+	/* funcs called by the verifier */
+	u32 (*map_gen_lookup)(struct bpf_map *map, struct bpf_insn *insn_buf);
 };
 
 struct bpf_map {
@@ -36,6 +39,7 @@ struct bpf_map {
 	u32 key_size;
 	u32 value_size;
 	u32 max_entries;
+	u32 map_flags;
 	u32 pages;
 	struct user_struct *user;
 	const struct bpf_map_ops *ops;
@@ -151,6 +155,7 @@ struct bpf_array {
 	union {
 		char value[0] __aligned(8);
 		void *ptrs[0] __aligned(8);
+		void __percpu *pptrs[0] __aligned(8);
 	};
 };
 #define MAX_TAIL_CALL_CNT 32
@@ -185,6 +190,14 @@ int bpf_obj_get_user(const char __user *pathname);
 
 /* verify correctness of eBPF program */
 int bpf_check(struct bpf_prog **fp, union bpf_attr *attr);
+
+/* syscall access to per-cpu maps, a value for each possible cpu */
+int bpf_percpu_hash_copy(struct bpf_map *map, void *key, void *value);
+int bpf_percpu_array_copy(struct bpf_map *map, void *key, void *value);
+int bpf_percpu_hash_update(struct bpf_map *map, void *key, void *value,
+			   u64 flags);
+int bpf_percpu_array_update(struct bpf_map *map, void *key, void *value,
+			    u64 flags);
 #else
 static inline void bpf_register_prog_type(struct bpf_prog_type_list *tl)
 {
@@ -198,12 +211,47 @@ static inline struct bpf_prog *bpf_prog_get(u32 ufd)
 static inline void bpf_prog_put(struct bpf_prog *prog)
 {
 }
+
+static inline void bpf_prog_put_rcu(struct bpf_prog *prog)
+{
+}
 #endif /* CONFIG_BPF_SYSCALL */
 
+#ifdef CONFIG_SCHED_BPF
+int sched_bpf_attach(struct bpf_prog *prog);
+int sched_bpf_detach(void);
+#else
+static inline int sched_bpf_attach(struct bpf_prog *prog)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline int sched_bpf_detach(void)
+{
+	return -EOPNOTSUPP;
+}
+#endif /* CONFIG_SCHED_BPF */
+
+#ifdef CONFIG_NET
+int xdp_attach(int ifindex, struct bpf_prog *prog);
+int xdp_detach(int ifindex);
+#else
+static inline int xdp_attach(int ifindex, struct bpf_prog *prog)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline int xdp_detach(int ifindex)
+{
+	return -EOPNOTSUPP;
+}
+#endif /* CONFIG_NET */
+
 /* verifier prototypes for helper functions called from eBPF programs */
 extern const struct bpf_func_proto bpf_map_lookup_elem_proto;
 extern const struct bpf_func_proto bpf_map_update_elem_proto;
 extern const struct bpf_func_proto bpf_map_delete_elem_proto;
+extern const struct bpf_func_proto bpf_get_stackid_proto;
 
 extern const struct bpf_func_proto bpf_get_prandom_u32_proto;
 extern const struct bpf_func_proto bpf_get_smp_processor_id_proto;
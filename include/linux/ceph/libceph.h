@@ -48,6 +48,7 @@ struct ceph_options {
 	unsigned long osd_idle_ttl;		/* jiffies */
 	unsigned long osd_keepalive_timeout;	/* jiffies */
 	unsigned long monc_ping_timeout;	/* jiffies */
+	int osd_conns;				/* connections per osd */
 
 	/*
 	 * any type that can't be simply compared or doesn't need need
@@ -69,6 +70,8 @@ struct ceph_options {
 #define CEPH_OSD_KEEPALIVE_DEFAULT	msecs_to_jiffies(5 * 1000)
 #define CEPH_OSD_IDLE_TTL_DEFAULT	msecs_to_jiffies(60 * 1000)
 #define CEPH_MONC_PING_TIMEOUT_DEFAULT	msecs_to_jiffies(30 * 1000)
+#define CEPH_OSD_CONNS_DEFAULT		1
+#define CEPH_OSD_MAX_CONNS		8
 
 #define CEPH_MSG_MAX_FRONT_LEN	(16*1024*1024)
 #define CEPH_MSG_MAX_MIDDLE_LEN	(16*1024*1024)
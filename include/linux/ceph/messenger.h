@@ -188,6 +188,10 @@ struct ceph_connection {
 	struct socket *sock;
 	struct ceph_entity_addr peer_addr; /* peer address */
 	struct ceph_entity_addr peer_addr_for_me;
+	struct ceph_entity_addr my_addr;   /* what we present to the peer */
+	u32 nonce_offset;     /* added to the messenger's nonce, so that
+				 more connections to one peer are told
+				 apart */
 
 	unsigned long flags;
 	unsigned long state;
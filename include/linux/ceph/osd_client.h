@@ -26,6 +26,12 @@ typedef void (*ceph_osdc_callback_t)(struct ceph_osd_request *,
 typedef void (*ceph_osdc_unsafe_callback_t)(struct ceph_osd_request *, bool);
 
 /* a given osd we're communicating with */
+/* one more connection to an osd, with osd_conns > 1 */
+struct ceph_osd_con {
+	struct ceph_connection oc_con;
+	struct ceph_auth_handshake oc_auth;
+};
+
 struct ceph_osd {
 	atomic_t o_ref;
 	struct ceph_osd_client *o_osdc;
@@ -33,6 +39,8 @@ struct ceph_osd {
 	int o_incarnation;
 	struct rb_node o_node;
 	struct ceph_connection o_con;
+	struct ceph_osd_con *o_extra_cons;	/* o_nr_cons - 1 of them */
+	int o_nr_cons;
 	struct list_head o_requests;
 	struct list_head o_linger_requests;
 	struct list_head o_osd_lru;
@@ -111,6 +111,9 @@ struct ceph_osdmap {
 
 	struct mutex crush_scratch_mutex;
 	int crush_scratch_ary[CEPH_PG_MAX_SIZE * 3];
+
+	/* recently calculated acting sets, for this epoch only */
+	struct ceph_pg_acting_cache *pg_cache;
 };
 
 static inline void ceph_oid_set_name(struct ceph_object_id *oid,
@@ -139,11 +139,36 @@ struct cgroup_subsys_state {
 	 */
 	atomic_t online_cnt;
 
+	/*
+	 * Entry on the cgroup's ->rstat_css_list if ->ss implements
+	 * css_rstat_flush().  Protected by cgroup_rstat_lock.
+	 */
+	struct list_head rstat_css_node;
+
 	/* percpu_ref killing and RCU release */
 	struct rcu_head rcu_head;
 	struct work_struct destroy_work;
 };
 
+/*
+ * Per-cpu recursive statistics tracking.  Whenever a controller updates
+ * its per-cpu stats of a cgroup on a cpu, cgroup_rstat_updated() links
+ * the cgroup and its ancestors into a tree of cgroups with pending
+ * updates on that cpu.  A flush then only has to visit the cgroups on
+ * those trees, children before their parents, instead of every cgroup
+ * and cpu of the subtree being read.  See kernel/cgroup_rstat.c.
+ */
+struct cgroup_rstat_cpu {
+	/*
+	 * ->updated_children is this cgroup's list of children with
+	 * pending updates, chained through their ->updated_next and
+	 * terminated by this cgroup itself.  ->updated_next is NULL while
+	 * the cgroup isn't on its parent's list.
+	 */
+	struct cgroup *updated_children;
+	struct cgroup *updated_next;
+};
+
 /*
  * A css_set is a structure holding pointers to a set of
  * cgroup_subsys_state objects. This saves space in the task struct
@@ -294,6 +319,12 @@ struct cgroup {
 
 	/* used to schedule release agent */
 	struct work_struct release_agent_work;
+
+	/* recursive per-cpu stats, see struct cgroup_rstat_cpu */
+	struct cgroup_rstat_cpu __percpu *rstat_cpu;
+
+	/* csses whose ->ss implements css_rstat_flush() */
+	struct list_head rstat_css_list;
 };
 
 /*
@@ -430,6 +461,7 @@ struct cgroup_subsys {
 	void (*css_free)(struct cgroup_subsys_state *css);
 	void (*css_reset)(struct cgroup_subsys_state *css);
 	void (*css_e_css_changed)(struct cgroup_subsys_state *css);
+	void (*css_rstat_flush)(struct cgroup_subsys_state *css, int cpu);
 
 	int (*can_attach)(struct cgroup_taskset *tset);
 	void (*cancel_attach)(struct cgroup_taskset *tset);
@@ -0,0 +1,52 @@
+#ifndef _LINUX_COPY_OFFLOAD_H
+#define _LINUX_COPY_OFFLOAD_H
+
+#include <linux/dmaengine.h>
+
+struct page;
+struct ctl_table;
+
+/*
+ * A batch of page copies handed to a DMA engine, see mm/copy_offload.c.
+ * Lives on the stack of the copying task between copy_offload_begin()
+ * and copy_offload_end().
+ */
+struct copy_offload {
+	struct dma_chan *chan;
+	dma_cookie_t cookie;		/* of the last copy submitted */
+	unsigned long nr_pages;		/* submitted so far */
+};
+
+#ifdef CONFIG_PAGE_COPY_OFFLOAD
+extern int sysctl_copy_offload;
+
+extern bool copy_offload_begin(struct copy_offload *co);
+extern bool copy_offload_pages(struct copy_offload *co, struct page *dst,
+			       struct page *src, unsigned int nr_pages);
+extern bool copy_offload_end(struct copy_offload *co);
+extern int copy_offload_sysctl_handler(struct ctl_table *table, int write,
+				       void __user *buffer, size_t *length,
+				       loff_t *ppos);
+
+#else /* CONFIG_PAGE_COPY_OFFLOAD */
+
+static inline bool copy_offload_begin(struct copy_offload *co)
+{
+	return false;
+}
+
+static inline bool copy_offload_pages(struct copy_offload *co,
+				      struct page *dst, struct page *src,
+				      unsigned int nr_pages)
+{
+	return false;
+}
+
+static inline bool copy_offload_end(struct copy_offload *co)
+{
+	return false;
+}
+
+#endif /* CONFIG_PAGE_COPY_OFFLOAD */
+
+#endif /* _LINUX_COPY_OFFLOAD_H */
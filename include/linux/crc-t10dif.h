@@ -11,4 +11,10 @@ extern __u16 crc_t10dif_generic(__u16 crc, const unsigned char *buffer,
 extern __u16 crc_t10dif(unsigned char const *, size_t);
 extern __u16 crc_t10dif_update(__u16 crc, unsigned char const *, size_t);
 
+struct iov_iter;
+extern size_t crc_t10dif_and_copy_to_iter(void *addr, size_t bytes, __u16 *crc,
+					  struct iov_iter *i);
+extern size_t crc_t10dif_and_copy_from_iter(void *addr, size_t bytes,
+					    __u16 *crc, struct iov_iter *i);
+
 #endif
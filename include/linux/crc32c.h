@@ -3,7 +3,13 @@
 
 #include <linux/types.h>
 
+struct iov_iter;
+
 extern u32 crc32c(u32 crc, const void *address, unsigned int length);
+extern size_t crc32c_and_copy_to_iter(void *addr, size_t bytes, u32 *crc,
+				      struct iov_iter *i);
+extern size_t crc32c_and_copy_from_iter(void *addr, size_t bytes, u32 *crc,
+					struct iov_iter *i);
 
 /* This macro exists for backwards-compatibility. */
 #define crc32c_le crc32c
@@ -92,6 +92,9 @@ extern void bus_remove_file(struct bus_type *, struct bus_attribute *);
  * @p:		The private data of the driver core, only the driver core can
  *		touch this.
  * @lock_key:	Lock class key for use by the lock validator
+ * @async_probe: Probe the drivers of this bus asynchronously, unless they
+ *		ask for PROBE_FORCE_SYNCHRONOUS.  Also set for the buses named
+ *		in the async_probe_bus= kernel parameter.
  *
  * A bus is a channel between the processor and one or more devices. For the
  * purposes of the device model, all devices are connected via a bus, even if
@@ -129,6 +132,8 @@ struct bus_type {
 
 	struct subsys_private *p;
 	struct lock_class_key lock_key;
+
+	bool async_probe;
 };
 
 extern int __must_check bus_register(struct bus_type *bus);
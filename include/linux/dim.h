@@ -0,0 +1,100 @@
+/*
+ * Dynamic interrupt moderation (dim) - Definitions
+ *
+ * A network driver feeds dim a sample of its cumulative packet, byte and
+ * interrupt event counters at the end of every NAPI cycle.  Every
+ * DIM_NEVENTS events dim turns the samples into rates and compares them
+ * with the previous measurement; it then walks a small table of
+ * moderation profiles, from the lowest latency to the highest
+ * throughput one, in whichever direction makes the rates better, and
+ * parks on the profile where neither neighbour does.  Comparing whole
+ * measurement windows, and getting "tired" after a number of steps,
+ * keeps it from oscillating the way per-interrupt heuristics do.
+ *
+ * When dim picks another profile, it schedules dim->work and stops
+ * measuring.  The driver's work function applies the profile returned
+ * by net_dim_get_rx_moderation() and sets dim->state back to
+ * DIM_START_MEASURE.
+ *
+ * net_dim() must be serialized by the caller, which the NAPI context
+ * it runs in does.
+ */
+
+#ifndef _LINUX_DIM_H
+#define _LINUX_DIM_H
+
+#include <linux/ktime.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#define NET_DIM_PARAMS_NUM_PROFILES	5
+#define NET_DIM_DEF_PROFILE		1
+
+/* a moderation profile: the interrupt delay, and a packet count bound */
+struct dim_cq_moder {
+	u16	usec;
+	u16	pkts;
+};
+
+struct dim_sample {
+	ktime_t	time;
+	u32	pkt_ctr;
+	u32	byte_ctr;
+	u16	event_ctr;
+};
+
+/* rates over a measurement window, per millisecond */
+struct dim_stats {
+	int	ppms;	/* packets */
+	int	bpms;	/* bytes */
+	int	epms;	/* events */
+};
+
+enum dim_state {
+	DIM_START_MEASURE,
+	DIM_MEASURE_IN_PROGRESS,
+	DIM_APPLY_NEW_PROFILE,
+};
+
+enum dim_tune_state {
+	DIM_PARKING_ON_TOP,
+	DIM_PARKING_TIRED,
+	DIM_GOING_RIGHT,
+	DIM_GOING_LEFT,
+};
+
+struct dim {
+	u8			state;
+	struct dim_stats	prev_stats;
+	struct dim_sample	start_sample;
+	struct work_struct	work;
+	u8			profile_ix;
+	u8			tune_state;
+	u8			steps_right;
+	u8			steps_left;
+	u8			tired;
+};
+
+static inline void dim_update_sample(u16 event_ctr, u64 packets, u64 bytes,
+				     struct dim_sample *s)
+{
+	s->time	     = ktime_get();
+	s->pkt_ctr   = packets;
+	s->byte_ctr  = bytes;
+	s->event_ctr = event_ctr;
+}
+
+/* a dim starting on the default profile, with @func to apply profiles */
+static inline void dim_init(struct dim *dim, work_func_t func)
+{
+	memset(dim, 0, sizeof(*dim));
+	dim->profile_ix = NET_DIM_DEF_PROFILE;
+	INIT_WORK(&dim->work, func);
+}
+
+void net_dim(struct dim *dim, struct dim_sample end_sample);
+struct dim_cq_moder net_dim_get_rx_moderation(int ix);
+struct dim_cq_moder net_dim_get_def_rx_moderation(void);
+
+#endif /* _LINUX_DIM_H */
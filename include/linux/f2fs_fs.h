@@ -25,6 +25,7 @@
 
 #define NULL_ADDR		((block_t)0)	/* used as block_t addresses */
 #define NEW_ADDR		((block_t)-1)	/* used as block_t addresses */
+#define COMPRESS_ADDR		((block_t)-2)	/* head of a compressed cluster */
 
 #define F2FS_BYTES_TO_BLK(bytes)	((bytes) >> F2FS_BLKSIZE_BITS)
 #define F2FS_BLK_TO_BYTES(blk)		((blk) << F2FS_BLKSIZE_BITS)
@@ -176,6 +177,30 @@ struct f2fs_extent {
 #define ADDRS_PER_PAGE(page, fi)	\
 	(IS_INODE(page) ? ADDRS_PER_INODE(fi) : ADDRS_PER_BLOCK)
 
+/*
+ * A regular file with FS_COMPR_FL set is stored in clusters of
+ * F2FS_CLUSTER_SIZE blocks, aligned on the file offset.  A compressed
+ * cluster has COMPRESS_ADDR in its first address slot and the compressed
+ * blocks in the slots that follow, starting with an f2fs_compress_header;
+ * the remaining slots are NULL_ADDR.  A cluster that crosses a direct
+ * node boundary is never compressed.
+ */
+#define F2FS_LOG_CLUSTER_SIZE	2
+#define F2FS_CLUSTER_SIZE	(1 << F2FS_LOG_CLUSTER_SIZE)
+
+enum {
+	F2FS_COMPRESS_LZO,
+	F2FS_COMPRESS_LZ4,
+	F2FS_COMPRESS_MAX,
+};
+
+struct f2fs_compress_header {
+	__le32 clen;			/* compressed length in bytes */
+	__u8 algorithm;			/* F2FS_COMPRESS_* */
+	__u8 log_cluster_size;		/* F2FS_LOG_CLUSTER_SIZE */
+	__u8 reserved[10];
+} __packed;
+
 #define	NODE_DIR1_BLOCK		(DEF_ADDRS_PER_INODE + 1)
 #define	NODE_DIR2_BLOCK		(DEF_ADDRS_PER_INODE + 2)
 #define	NODE_IND1_BLOCK		(DEF_ADDRS_PER_INODE + 3)
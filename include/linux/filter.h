@@ -45,6 +45,11 @@ struct bpf_prog_aux;
 /* BPF program can access up to 512 bytes of stack space. */
 #define MAX_BPF_STACK	512
 
+/* unused opcode to mark calls to other bpf functions of the program,
+ * which the verifier gets as BPF_CALL with src_reg BPF_PSEUDO_CALL
+ */
+#define BPF_CALL_ARGS	0xe0
+
 /* Helper macros for filter block array initializers. */
 
 /* ALU ops on registers, bpf_add|sub|...: dst_reg += src_reg */
@@ -383,6 +388,74 @@ static inline u32 bpf_prog_run_clear_cb(const struct bpf_prog *prog,
 	return BPF_PROG_RUN(prog, skb);
 }
 
+/* what a BPF_PROG_TYPE_XDP program runs on: a frame still in the ring */
+struct xdp_buff {
+	struct xdp_md md;	/* the program's context */
+	void *data;
+	void *data_end;
+	struct net_device *dev;
+};
+
+static inline void xdp_init_buff(struct xdp_buff *xdp, struct net_device *dev,
+				 void *data, unsigned int len, u16 queue)
+{
+	xdp->md.len = len;
+	xdp->md.ingress_ifindex = dev->ifindex;
+	xdp->md.rx_queue_index = queue;
+	xdp->data = data;
+	xdp->data_end = data + len;
+	xdp->dev = dev;
+}
+
+/* called with rcu_read_lock() held, which also keeps @prog around */
+static inline u32 bpf_prog_run_xdp(const struct bpf_prog *prog,
+				   struct xdp_buff *xdp)
+{
+	return BPF_PROG_RUN(prog, (void *)&xdp->md);
+}
+
+int xdp_do_xmit(struct xdp_buff *xdp, u32 act);
+
+/* a consumer of the raw frames of one rx queue, see xdp_capture_attach() */
+struct xdp_capture {
+	/* true if it took the frame, which then goes no further */
+	bool (*rcv)(struct xdp_capture *cap, struct xdp_buff *xdp);
+};
+
+struct xdp_capture_table {
+	struct rcu_head rcu;
+	unsigned int nr;
+	struct xdp_capture __rcu *queue[0];
+};
+
+int xdp_capture_attach(struct net_device *dev, unsigned int queue,
+		       struct xdp_capture *cap);
+void xdp_capture_detach(struct net_device *dev, unsigned int queue);
+
+/* called with rcu_read_lock() held, once per poll of the queue */
+static inline struct xdp_capture *xdp_capture_lookup(struct net_device *dev,
+						     unsigned int queue)
+{
+	struct xdp_capture_table *t = rcu_dereference(dev->xdp_capture);
+
+	if (likely(!t) || queue >= t->nr)
+		return NULL;
+	return rcu_dereference(t->queue[queue]);
+}
+
+/*
+ * The verdict on a frame of a queue with a capture consumer and/or an
+ * XDP program, either of which may be NULL.  The consumer sees the frame
+ * first; one it keeps is done with, as if the program had dropped it.
+ */
+static inline u32 xdp_rx(const struct bpf_prog *prog, struct xdp_capture *cap,
+			 struct xdp_buff *xdp)
+{
+	if (cap && cap->rcv(cap, xdp))
+		return XDP_DROP;
+	return prog ? bpf_prog_run_xdp(prog, xdp) : XDP_PASS;
+}
+
 static inline unsigned int bpf_prog_size(unsigned int proglen)
 {
 	return max(sizeof(struct bpf_prog),
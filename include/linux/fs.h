@@ -64,6 +64,10 @@ extern int sysctl_nr_open;
 extern struct inodes_stat_t inodes_stat;
 extern int leases_enable, lease_break_time;
 extern int sysctl_protected_symlinks;
+extern int sysctl_negative_dentry_limit;
+#ifdef CONFIG_FS_PATH_CACHE
+extern int sysctl_path_cache;
+#endif
 extern int sysctl_protected_hardlinks;
 
 struct buffer_head;
@@ -137,6 +141,8 @@ typedef void (dax_iodone_t)(struct buffer_head *bh_map, int uptodate);
 #define FMODE_CAN_READ          ((__force fmode_t)0x20000)
 /* Has write method(s) */
 #define FMODE_CAN_WRITE         ((__force fmode_t)0x40000)
+/* Data is not reused: drop its pages from the cache after I/O */
+#define FMODE_NOREUSE		((__force fmode_t)0x80000)
 
 /* File was opened by fanotify and shouldn't generate fanotify events */
 #define FMODE_NONOTIFY		((__force fmode_t)0x4000000)
@@ -319,6 +325,9 @@ struct writeback_control;
 #define IOCB_EVENTFD		(1 << 0)
 #define IOCB_APPEND		(1 << 1)
 #define IOCB_DIRECT		(1 << 2)
+#define IOCB_UNCACHED		(1 << 3)
+#define IOCB_NOWAIT		(1 << 4)	/* -EAGAIN rather than wait for I/O */
+#define IOCB_HIPRI		(1 << 5)	/* Completion is polled for */
 
 struct kiocb {
 	struct file		*ki_filp;
@@ -326,6 +335,7 @@ struct kiocb {
 	void (*ki_complete)(struct kiocb *iocb, long ret, long ret2);
 	void			*private;
 	int			ki_flags;
+	blk_qc_t		ki_cookie;	/* For polling, with IOCB_HIPRI */
 };
 
 static inline bool is_sync_kiocb(struct kiocb *kiocb)
@@ -635,7 +645,8 @@ struct inode {
 	unsigned long		dirtied_when;	/* jiffies of first dirtying */
 	unsigned long		dirtied_time_when;
 
-	struct hlist_node	i_hash;
+	struct hlist_bl_node	i_hash;
+	unsigned long		i_hashval;	/* what i_hash was hashed by */
 	struct list_head	i_io_list;	/* backing dev IO list */
 #ifdef CONFIG_CGROUP_WRITEBACK
 	struct bdi_writeback	*i_wb;		/* the associated cgroup wb */
@@ -667,6 +678,7 @@ struct inode {
 		struct block_device	*i_bdev;
 		struct cdev		*i_cdev;
 		char			*i_link;
+		unsigned		i_dir_seq;	/* in-lookup ends, see d_alloc_parallel() */
 	};
 
 	__u32			i_generation;
@@ -676,12 +688,25 @@ struct inode {
 	struct hlist_head	i_fsnotify_marks;
 #endif
 
+#ifdef CONFIG_EXEC_CACHE
+	struct exec_cache	*i_exec_cache;	/* see fs/exec.c */
+#endif
+
 	void			*i_private; /* fs or device private pointer */
 };
 
 static inline int inode_unhashed(struct inode *inode)
 {
-	return hlist_unhashed(&inode->i_hash);
+	return hlist_bl_unhashed(&inode->i_hash);
+}
+
+/*
+ * For filesystems that don't use the inode hash but still want their
+ * inodes to look hashed, so that iput() doesn't evict them right away.
+ */
+static inline void inode_fake_hash(struct inode *inode)
+{
+	hlist_bl_add_fake(&inode->i_hash);
 }
 
 /*
@@ -816,6 +841,18 @@ struct fown_struct {
 /*
  * Track a single file's readahead state
  */
+/*
+ * The windows of other sequential streams seen on the same file, which
+ * take over from the current one when a read continues one of them.
+ */
+#define RA_SAVED_STREAMS	3
+
+struct ra_stream {
+	pgoff_t start;
+	unsigned int size;
+	unsigned int async_size;
+};
+
 struct file_ra_state {
 	pgoff_t start;			/* where readahead started */
 	unsigned int size;		/* # of readahead pages */
@@ -825,6 +862,9 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	unsigned int next_saved;	/* Slot for the next saved stream */
+	struct ra_stream saved[RA_SAVED_STREAMS];
 };
 
 /*
@@ -1383,8 +1423,25 @@ struct super_block {
 	/* s_inode_list_lock protects s_inodes */
 	spinlock_t		s_inode_list_lock ____cacheline_aligned_in_smp;
 	struct list_head	s_inodes;	/* all inodes */
+
+#ifdef CONFIG_FS_PATH_CACHE
+	/* Cached directory lookups, see fs/path_cache.c */
+	struct path_cache	*s_path_cache;
+	atomic_t		s_path_cache_gen;
+#endif
 };
 
+/*
+ * Throw away whatever the path cache of @sb knows.  Needed whenever a
+ * directory dentry goes away or a directory's permissions change.
+ */
+static inline void path_cache_invalidate(struct super_block *sb)
+{
+#ifdef CONFIG_FS_PATH_CACHE
+	atomic_inc(&sb->s_path_cache_gen);
+#endif
+}
+
 extern struct timespec current_fs_time(struct super_block *sb);
 
 /*
@@ -1619,6 +1676,7 @@ struct file_operations {
 	long (*unlocked_ioctl) (struct file *, unsigned int, unsigned long);
 	long (*compat_ioctl) (struct file *, unsigned int, unsigned long);
 	int (*mmap) (struct file *, struct vm_area_struct *);
+	unsigned long mmap_supported_flags;
 	int (*open) (struct inode *, struct file *);
 	int (*flush) (struct file *, fl_owner_t id);
 	int (*release) (struct inode *, struct file *);
@@ -1938,6 +1996,7 @@ struct file_system_type {
 #define FS_USERNS_MOUNT		8	/* Can be mounted by userns root */
 #define FS_USERNS_DEV_MOUNT	16 /* A userns mount does not imply MNT_NODEV */
 #define FS_USERNS_VISIBLE	32	/* FS must already be visible */
+#define FS_PARALLEL_LOOKUP	64	/* ->lookup() doesn't need the parent's i_mutex */
 #define FS_RENAME_DOES_D_MOVE	32768	/* FS will handle d_move() during rename() internally. */
 	struct dentry *(*mount) (struct file_system_type *, int,
 		       const char *, void *);
@@ -2490,10 +2549,29 @@ static inline void file_end_write(struct file *file)
  * except for the cases where we don't hold i_writecount yet. Then we need to
  * use {get,deny}_write_access() - these functions check the sign and refuse
  * to do the change if sign is wrong.
+ *
+ * Getting write access also drops what exec cached of the file.
  */
+#ifdef CONFIG_EXEC_CACHE
+extern void __exec_cache_drop(struct inode *inode);
+
+static inline void exec_cache_drop(struct inode *inode)
+{
+	if (unlikely(READ_ONCE(inode->i_exec_cache)))
+		__exec_cache_drop(inode);
+}
+#else
+static inline void exec_cache_drop(struct inode *inode)
+{
+}
+#endif
+
 static inline int get_write_access(struct inode *inode)
 {
-	return atomic_inc_unless_negative(&inode->i_writecount) ? 0 : -ETXTBSY;
+	if (!atomic_inc_unless_negative(&inode->i_writecount))
+		return -ETXTBSY;
+	exec_cache_drop(inode);
+	return 0;
 }
 static inline int deny_write_access(struct file *file)
 {
@@ -2614,7 +2692,7 @@ static inline void insert_inode_hash(struct inode *inode)
 extern void __remove_inode_hash(struct inode *);
 static inline void remove_inode_hash(struct inode *inode)
 {
-	if (!inode_unhashed(inode) && !hlist_fake(&inode->i_hash))
+	if (!inode_unhashed(inode) && !hlist_bl_fake(&inode->i_hash))
 		__remove_inode_hash(inode);
 }
 
@@ -2873,6 +2951,8 @@ static inline int iocb_flags(struct file *file)
 		res |= IOCB_APPEND;
 	if (io_is_direct(file))
 		res |= IOCB_DIRECT;
+	if (file->f_mode & FMODE_NOREUSE)
+		res |= IOCB_UNCACHED;
 	return res;
 }
 
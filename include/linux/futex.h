@@ -27,6 +27,9 @@ handle_futex_death(u32 __user *uaddr, struct task_struct *curr, int pi);
  *	mapped on a file (reference on the underlying inode)
  *  10 : Shared futex (PTHREAD_PROCESS_SHARED)
  *       (but private mapping on an mm, and reference taken on it)
+ *
+ * node is the hash table the key goes to, FUTEX_NO_NODE to have the
+ * hash pick one.  It takes no part in matching the keys.
 */
 
 #define FUT_OFF_INODE    1 /* We set bit 0 if key has a reference on inode */
@@ -37,20 +40,32 @@ union futex_key {
 		unsigned long pgoff;
 		struct inode *inode;
 		int offset;
+		int node;
 	} shared;
 	struct {
 		unsigned long address;
 		struct mm_struct *mm;
 		int offset;
+		int node;
 	} private;
 	struct {
 		unsigned long word;
 		void *ptr;
 		int offset;
+		int node;
 	} both;
 };
 
-#define FUTEX_KEY_INIT (union futex_key) { .both = { .ptr = NULL } }
+#define FUTEX_KEY_INIT (union futex_key) \
+	{ .both = { .ptr = NULL, .node = FUTEX_NO_NODE } }
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+extern void futex_private_hash_free(struct mm_struct *mm);
+#else
+static inline void futex_private_hash_free(struct mm_struct *mm)
+{
+}
+#endif
 
 #ifdef CONFIG_FUTEX
 extern void exit_robust_list(struct task_struct *curr);
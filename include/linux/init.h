@@ -216,6 +216,22 @@ extern bool initcall_debug;
 #define late_initcall(fn)		__define_initcall(fn, 7)
 #define late_initcall_sync(fn)		__define_initcall(fn, 7s)
 
+/*
+ * Parallel initcalls of a level are started once all ordinary initcalls of
+ * that level have returned, and run concurrently with each other from async
+ * threads.  The _sync initcalls of the level, and all later levels, only run
+ * after every parallel initcall of the level has finished.
+ *
+ * So a parallel initcall may depend on everything set up by the ordinary
+ * initcalls of its own and all earlier levels, but not on the other parallel
+ * initcalls of its level.  It must not wait for async work itself, nor
+ * request modules synchronously.
+ */
+#define subsys_initcall_parallel(fn)	__define_initcall(fn, 4p)
+#define fs_initcall_parallel(fn)	__define_initcall(fn, 5p)
+#define device_initcall_parallel(fn)	__define_initcall(fn, 6p)
+#define late_initcall_parallel(fn)	__define_initcall(fn, 7p)
+
 #define __initcall(fn) device_initcall(fn)
 
 #define __exitcall(fn) \
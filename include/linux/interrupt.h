@@ -464,6 +464,14 @@ static inline struct task_struct *this_cpu_ksoftirqd(void)
 	return this_cpu_read(ksoftirqd);
 }
 
+DECLARE_PER_CPU(struct task_struct *, ksoftirqt);
+
+/* does @p run softirqs as a task, with the time accounted to it? */
+static inline bool this_cpu_softirq_thread(struct task_struct *p)
+{
+	return p == this_cpu_ksoftirqd() || p == this_cpu_read(ksoftirqt);
+}
+
 /* Tasklets --- multithreaded analogue of BHs.
 
    Main feature differing them of generic softirqs: tasklet
@@ -71,6 +71,12 @@ extern void jbd2_free(void *ptr, size_t size);
 
 #define JBD2_MIN_JOURNAL_BLOCKS 1024
 
+/*
+ * Size of the fast commit area at the end of the journal, when the
+ * superblock doesn't give one.
+ */
+#define JBD2_DEFAULT_FAST_COMMIT_BLOCKS 256
+
 #ifdef __KERNEL__
 
 /**
@@ -270,7 +276,9 @@ typedef struct journal_superblock_s
 /* 0x0050 */
 	__u8	s_checksum_type;	/* checksum type */
 	__u8	s_padding2[3];
-	__u32	s_padding[42];
+/* 0x0054 */
+	__be32	s_num_fc_blks;		/* Number of fast commit blocks */
+	__u32	s_padding[41];
 	__be32	s_checksum;		/* crc32c(superblock) */
 
 /* 0x0100 */
@@ -296,6 +304,7 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 #define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
 #define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x00000010
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x00000020
 
 /* See "journal feature predicate functions" below */
 
@@ -306,7 +315,8 @@ typedef struct journal_superblock_s
 					JBD2_FEATURE_INCOMPAT_64BIT | \
 					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
 					JBD2_FEATURE_INCOMPAT_CSUM_V2 | \
-					JBD2_FEATURE_INCOMPAT_CSUM_V3)
+					JBD2_FEATURE_INCOMPAT_CSUM_V3 | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -990,6 +1000,25 @@ struct journal_s
 	struct buffer_head	**j_wbuf;
 	int			j_wbufsize;
 
+	/*
+	 * The fast commit area: the blocks from j_fc_first up to, but not
+	 * including, j_fc_last, carved off the end of the journal.  A fast
+	 * commit writes the filesystem's own compact records of what the
+	 * running transaction changed there, from block j_fc_first + j_fc_off
+	 * on; the next full commit makes them stale and rewinds j_fc_off.
+	 * [j_state_lock]
+	 */
+	unsigned long		j_fc_first;
+	unsigned long		j_fc_last;
+	unsigned long		j_fc_off;
+
+	/* the buffers of the fast commit being written, j_fc_off of them */
+	struct buffer_head	**j_fc_wbuf;
+	int			j_fc_wbufsize;
+
+	/* Wait queue for a fast commit or a full commit to finish */
+	wait_queue_head_t	j_fc_wait;
+
 	/*
 	 * this is the pid of hte last person to run a synchronous operation
 	 * through the journal
@@ -1014,6 +1043,26 @@ struct journal_s
 	void			(*j_commit_callback)(journal_t *,
 						     transaction_t *);
 
+	/*
+	 * Called during recovery for every block of the fast commit area, in
+	 * order, after each pass over the log but the revoke pass.  @tid is
+	 * the transaction the fast commits must belong to, as those of older
+	 * transactions are stale.  Returns JBD2_FC_REPLAY_CONTINUE for more,
+	 * JBD2_FC_REPLAY_STOP at the end of the valid records, or an error.
+	 */
+	int			(*j_fc_replay_callback)(journal_t *,
+							struct buffer_head *,
+							int pass, int off,
+							tid_t tid);
+
+	/*
+	 * Called after a fast commit (@full == 0) or a full commit of
+	 * transaction @tid, so the filesystem can drop what it tracked for
+	 * it.
+	 */
+	void			(*j_fc_cleanup_callback)(journal_t *,
+							 int full, tid_t tid);
+
 	/*
 	 * Journal statistics
 	 */
@@ -1099,6 +1148,7 @@ JBD2_FEATURE_INCOMPAT_FUNCS(64bit,		64BIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(async_commit,	ASYNC_COMMIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum2,		CSUM_V2)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
+JBD2_FEATURE_INCOMPAT_FUNCS(fast_commit,	FAST_COMMIT)
 
 /*
  * Journal flag definitions
@@ -1113,6 +1163,14 @@ JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
 						 * data write error in ordered
 						 * mode */
 #define JBD2_REC_ERR	0x080	/* The errno in the sb has been recorded */
+#define JBD2_FAST_COMMIT_ONGOING	0x100	/* A fast commit is being
+						 * written */
+#define JBD2_FULL_COMMIT_ONGOING	0x200	/* A full commit is being
+						 * written */
+
+/* Fast commit replay callback return values */
+#define JBD2_FC_REPLAY_STOP	0
+#define JBD2_FC_REPLAY_CONTINUE	1
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1280,6 +1338,14 @@ extern int	   jbd2_journal_begin_ordered_truncate(journal_t *journal,
 extern void	   jbd2_journal_init_jbd_inode(struct jbd2_inode *jinode, struct inode *inode);
 extern void	   jbd2_journal_release_jbd_inode(journal_t *journal, struct jbd2_inode *jinode);
 
+/* Fast commits */
+extern int	   jbd2_fc_begin_commit(journal_t *journal, tid_t tid);
+extern int	   jbd2_fc_end_commit(journal_t *journal);
+extern int	   jbd2_fc_end_commit_fallback(journal_t *journal);
+extern int	   jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out);
+extern int	   jbd2_fc_wait_bufs(journal_t *journal, int num_blks);
+extern int	   jbd2_fc_release_bufs(journal_t *journal);
+
 /*
  * journal_head management
  */
@@ -1418,6 +1484,13 @@ static inline int jbd2_journal_has_csum_v2or3(journal_t *journal)
 	return journal->j_chksum_driver != NULL;
 }
 
+static inline int jbd2_journal_get_num_fc_blks(journal_superblock_t *jsb)
+{
+	int num_fc_blocks = be32_to_cpu(jsb->s_num_fc_blks);
+
+	return num_fc_blocks ? num_fc_blocks : JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+}
+
 /*
  * We reserve t_outstanding_credits >> JBD2_CONTROL_BLOCKS_SHIFT for
  * transaction control blocks.
@@ -32,6 +32,7 @@
 #include <linux/compiler.h>	/* for __kprobes */
 #include <linux/linkage.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/notifier.h>
 #include <linux/smp.h>
 #include <linux/bug.h>
@@ -180,7 +181,16 @@ struct jprobe {
  * nmissed - tracks the number of times the probed function's return was
  * ignored, due to maxactive being too low.
  *
+ * Instances in use sit on their task's kretprobe_instances stack, and
+ * may still be there after the kretprobe is unregistered; they point at
+ * its kretprobe_holder instead, which lives until the last of them has
+ * returned.
  */
+struct kretprobe_holder {
+	struct kretprobe	*rp;	/* NULL once unregistered */
+	atomic_t		ref;
+};
+
 struct kretprobe {
 	struct kprobe kp;
 	kretprobe_handler_t handler;
@@ -190,10 +200,13 @@ struct kretprobe {
 	size_t data_size;
 	struct hlist_head free_instances;
 	raw_spinlock_t lock;
+	struct kretprobe_holder *rph;
 };
 
 struct kretprobe_instance {
-	struct hlist_node hlist;
+	struct hlist_node hlist;	/* on rp->free_instances */
+	struct llist_node llist;	/* on task->kretprobe_instances */
+	struct kretprobe_holder *rph;
 	struct kretprobe *rp;
 	kprobe_opcode_t *ret_addr;
 	struct task_struct *task;
@@ -227,6 +240,8 @@ static inline int kprobes_built_in(void)
 extern void arch_prepare_kretprobe(struct kretprobe_instance *ri,
 				   struct pt_regs *regs);
 extern int arch_trampoline_kprobe(struct kprobe *p);
+extern unsigned long kretprobe_trampoline_handler(struct pt_regs *regs,
+					unsigned long trampoline_address);
 #else /* CONFIG_KRETPROBES */
 static inline void arch_prepare_kretprobe(struct kretprobe *rp,
 					struct pt_regs *regs)
@@ -342,10 +357,6 @@ int arch_check_ftrace_location(struct kprobe *p);
 
 /* Get the kprobe at this addr (if any) - called with preemption disabled */
 struct kprobe *get_kprobe(void *addr);
-void kretprobe_hash_lock(struct task_struct *tsk,
-			 struct hlist_head **head, unsigned long *flags);
-void kretprobe_hash_unlock(struct task_struct *tsk, unsigned long *flags);
-struct hlist_head * kretprobe_inst_table_head(struct task_struct *tsk);
 
 /* kprobe_running() will just return the current_kprobe on this CPU */
 static inline struct kprobe *kprobe_running(void)
@@ -382,7 +393,7 @@ int register_kretprobes(struct kretprobe **rps, int num);
 void unregister_kretprobes(struct kretprobe **rps, int num);
 
 void kprobe_flush_task(struct task_struct *tk);
-void recycle_rp_inst(struct kretprobe_instance *ri, struct hlist_head *head);
+void recycle_rp_inst(struct kretprobe_instance *ri);
 
 int disable_kprobe(struct kprobe *kp);
 int enable_kprobe(struct kprobe *kp);
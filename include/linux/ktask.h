@@ -0,0 +1,80 @@
+/*
+ * ktask.h - framework to parallelize CPU-intensive kernel work
+ *
+ * A ktask splits a large job, such as initializing the struct pages of a
+ * node, into chunks and runs them from several threads at once.  The job is
+ * described as a range of unsigned longs (pfns, page counts, ...), optionally
+ * split into one part per NUMA node, and a function which is called for
+ * every chunk of the range.
+ *
+ * The caller takes part in the work and ktask_run() returns once all of the
+ * job has been done, so the caller may pass data on its stack.
+ */
+#ifndef _LINUX_KTASK_H
+#define _LINUX_KTASK_H
+
+#include <linux/numa.h>
+#include <linux/types.h>
+
+#define KTASK_RETURN_SUCCESS	0
+
+/**
+ * struct ktask_node - the part of a job to be done on one NUMA node
+ * @kn_start: start of the range
+ * @kn_task_size: size of the range
+ * @kn_nid: node the chunks are preferably run on, or NUMA_NO_NODE
+ */
+struct ktask_node {
+	unsigned long		kn_start;
+	unsigned long		kn_task_size;
+	int			kn_nid;
+};
+
+/*
+ * Called for each chunk [start, end) of the job, with the node of the
+ * ktask_node it belongs to.  Returns KTASK_RETURN_SUCCESS or an error, in
+ * which case the remaining chunks are not started and ktask_run() returns
+ * the error.  Chunks are done in no particular order.
+ */
+typedef int (*ktask_thread_func)(unsigned long start, unsigned long end,
+				 int nid, void *arg);
+
+/**
+ * struct ktask_ctl - how to run a job
+ * @kc_thread_func: called for every chunk
+ * @kc_func_arg: passed to @kc_thread_func
+ * @kc_min_chunk_size: smallest piece of work worth a thread, chunks are
+ *	always a multiple of it
+ * @kc_max_threads: upper bound of threads, 0 for no job specific bound
+ */
+struct ktask_ctl {
+	ktask_thread_func	kc_thread_func;
+	void			*kc_func_arg;
+	unsigned long		kc_min_chunk_size;
+	unsigned int		kc_max_threads;
+};
+
+#define DEFINE_KTASK_CTL(ctl_name, thread_func, func_arg, min_chunk_size) \
+	struct ktask_ctl ctl_name = {					\
+		.kc_thread_func		= (thread_func),		\
+		.kc_func_arg		= (func_arg),			\
+		.kc_min_chunk_size	= (min_chunk_size),		\
+		.kc_max_threads		= 0,				\
+	}
+
+int ktask_run_numa(struct ktask_node *nodes, size_t nr_nodes,
+		   struct ktask_ctl *ctl);
+
+static inline int ktask_run(unsigned long start, unsigned long task_size,
+			    struct ktask_ctl *ctl)
+{
+	struct ktask_node node = {
+		.kn_start	= start,
+		.kn_task_size	= task_size,
+		.kn_nid		= NUMA_NO_NODE,
+	};
+
+	return ktask_run_numa(&node, 1, ctl);
+}
+
+#endif /* _LINUX_KTASK_H */
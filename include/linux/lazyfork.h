@@ -0,0 +1,46 @@
+#ifndef _LINUX_LAZYFORK_H
+#define _LINUX_LAZYFORK_H
+
+#include <linux/mm.h>
+
+#ifdef CONFIG_LAZY_FORK
+/*
+ * A pte table that fork shared between mms is mapped by each of them
+ * through a write protected pmd, and counts the mms beyond the first in
+ * its _mapcount. See mm/memory.c.
+ */
+static inline bool lazyfork_pmd(pmd_t pmd)
+{
+	return !pmd_write(pmd);
+}
+
+/* Is @pte, of an anonymous vma, in a table other mms use too? */
+static inline bool lazyfork_pte_shared(pte_t *pte)
+{
+	return page_mapcount(virt_to_page(pte)) > 0;
+}
+
+extern int lazyfork_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+			    unsigned long addr, gfp_t gfp);
+
+#else /* CONFIG_LAZY_FORK */
+
+static inline bool lazyfork_pmd(pmd_t pmd)
+{
+	return false;
+}
+
+static inline bool lazyfork_pte_shared(pte_t *pte)
+{
+	return false;
+}
+
+static inline int lazyfork_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+				   unsigned long addr, gfp_t gfp)
+{
+	return 0;
+}
+
+#endif /* CONFIG_LAZY_FORK */
+
+#endif /* _LINUX_LAZYFORK_H */
@@ -180,6 +180,23 @@ static inline bool llist_add(struct llist_node *new, struct llist_head *head)
 	return llist_add_batch(new, new, head);
 }
 
+/**
+ * __llist_add - add a new entry, non-atomically
+ * @new:	new entry to be added
+ * @head:	the head for your lock-less list
+ *
+ * For a list only ever touched by one context at a time, such as one
+ * that belongs to the current task.
+ *
+ * Returns true if the list was empty prior to adding this entry.
+ */
+static inline bool __llist_add(struct llist_node *new, struct llist_head *head)
+{
+	new->next = head->first;
+	head->first = new;
+	return new->next == NULL;
+}
+
 /**
  * llist_del_all - delete all entries from lock-less list
  * @head:	the head of lock-less list to delete all entries
@@ -193,6 +210,20 @@ static inline struct llist_node *llist_del_all(struct llist_head *head)
 	return xchg(&head->first, NULL);
 }
 
+/**
+ * __llist_del_all - delete all entries, non-atomically
+ * @head:	the head of lock-less list to delete all entries
+ *
+ * The counterpart of __llist_add(), see llist_del_all().
+ */
+static inline struct llist_node *__llist_del_all(struct llist_head *head)
+{
+	struct llist_node *first = head->first;
+
+	head->first = NULL;
+	return first;
+}
+
 extern struct llist_node *llist_del_first(struct llist_head *head);
 
 struct llist_node *llist_reverse_order(struct llist_node *head);
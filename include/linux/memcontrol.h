@@ -63,6 +63,8 @@ enum mem_cgroup_events_index {
 	MEM_CGROUP_EVENTS_PGPGOUT,	/* # of pages paged out */
 	MEM_CGROUP_EVENTS_PGFAULT,	/* # of page-faults */
 	MEM_CGROUP_EVENTS_PGMAJFAULT,	/* # of major page-faults */
+	MEM_CGROUP_EVENTS_BG_RECLAIM,	/* # of background reclaim runs */
+	MEM_CGROUP_EVENTS_BG_RECLAIMED,	/* # of pages reclaimed by them */
 	MEM_CGROUP_EVENTS_NSTATS,
 	/* default hierarchy events */
 	MEMCG_LOW = MEM_CGROUP_EVENTS_NSTATS,
@@ -119,6 +121,19 @@ struct mem_cgroup_stat_cpu {
 	unsigned long events[MEMCG_NR_EVENTS];
 	unsigned long nr_page_events;
 	unsigned long targets[MEM_CGROUP_NTARGETS];
+
+	/* values of the above at the last flush, see memcg_rstat_flush() */
+	long count_prev[MEM_CGROUP_STAT_NSTATS];
+	unsigned long events_prev[MEM_CGROUP_EVENTS_NSTATS];
+};
+
+/*
+ * Totals of the per-cpu counters, brought up to date by flushing the
+ * memcg's cgroup.  Protected by the cgroup rstat lock.
+ */
+struct mem_cgroup_stat {
+	long count[MEM_CGROUP_STAT_NSTATS];
+	unsigned long events[MEM_CGROUP_EVENTS_NSTATS];
 };
 
 struct mem_cgroup_reclaim_iter {
@@ -192,6 +207,10 @@ struct mem_cgroup {
 	unsigned long low;
 	unsigned long high;
 
+	/* Reclaim in the background within this many pages of min(high, max) */
+	unsigned long bg_reclaim_margin;
+	struct work_struct bg_reclaim_work;
+
 	unsigned long soft_limit;
 
 	/* vmpressure notifications */
@@ -213,6 +232,13 @@ struct mem_cgroup {
 	/* OOM-Killer disable */
 	int		oom_kill_disable;
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/* khugepaged pages scanned per second in our mms, 0 for no limit */
+	unsigned long khugepaged_scan_budget;
+	atomic_long_t khugepaged_scanned;
+	unsigned long khugepaged_period;	/* jiffies */
+#endif
+
 	/* handle for "memory.events" */
 	struct cgroup_file events_file;
 
@@ -246,6 +272,14 @@ struct mem_cgroup {
 	 */
 	struct mem_cgroup_stat_cpu __percpu *stat;
 
+	/*
+	 * Flushed totals of this memcg alone and of its subtree, and the
+	 * flushed deltas of children yet to be added to the latter.
+	 */
+	struct mem_cgroup_stat	stat_local;
+	struct mem_cgroup_stat	stat_total;
+	struct mem_cgroup_stat	stat_pending;
+
 #if defined(CONFIG_MEMCG_KMEM) && defined(CONFIG_INET)
 	struct cg_proto tcp_mem;
 #endif
@@ -277,6 +311,16 @@ struct mem_cgroup {
 };
 extern struct cgroup_subsys_state *mem_cgroup_root_css;
 
+/*
+ * Tell the next flush of the memcg's subtree to look at the per-cpu
+ * stats which were just updated on this cpu.  Called with preemption
+ * disabled, right after the update.
+ */
+static inline void mem_cgroup_stat_updated(struct mem_cgroup *memcg)
+{
+	cgroup_rstat_updated(memcg->css.cgroup, smp_processor_id());
+}
+
 /**
  * mem_cgroup_events - count memory events against a cgroup
  * @memcg: the memory cgroup
@@ -287,7 +331,10 @@ static inline void mem_cgroup_events(struct mem_cgroup *memcg,
 		       enum mem_cgroup_events_index idx,
 		       unsigned int nr)
 {
+	preempt_disable();
 	this_cpu_add(memcg->stat->events[idx], nr);
+	mem_cgroup_stat_updated(memcg);
+	preempt_enable();
 	cgroup_file_notify(&memcg->events_file);
 }
 
@@ -344,6 +391,9 @@ static inline bool mm_match_cgroup(struct mm_struct *mm,
 	return match;
 }
 
+bool mem_cgroup_khugepaged_may_scan(struct mm_struct *mm);
+void mem_cgroup_khugepaged_scanned(struct mm_struct *mm, unsigned int pages);
+
 struct cgroup_subsys_state *mem_cgroup_css_from_page(struct page *page);
 ino_t page_cgroup_ino(struct page *page);
 
@@ -360,6 +410,17 @@ int mem_cgroup_select_victim_node(struct mem_cgroup *memcg);
 void mem_cgroup_update_lru_size(struct lruvec *lruvec, enum lru_list lru,
 		int nr_pages);
 
+static inline struct mem_cgroup *lruvec_memcg(struct lruvec *lruvec)
+{
+	struct mem_cgroup_per_zone *mz;
+
+	if (mem_cgroup_disabled())
+		return NULL;
+
+	mz = container_of(lruvec, struct mem_cgroup_per_zone, lruvec);
+	return mz->memcg;
+}
+
 static inline bool mem_cgroup_lruvec_online(struct lruvec *lruvec)
 {
 	struct mem_cgroup_per_zone *mz;
@@ -446,8 +507,12 @@ static inline void mem_cgroup_update_page_stat(struct mem_cgroup *memcg,
 {
 	VM_BUG_ON(!rcu_read_lock_held());
 
-	if (memcg)
+	if (memcg) {
+		preempt_disable();
 		this_cpu_add(memcg->stat->count[idx], val);
+		mem_cgroup_stat_updated(memcg);
+		preempt_enable();
+	}
 }
 
 static inline void mem_cgroup_inc_page_stat(struct mem_cgroup *memcg,
@@ -479,6 +544,7 @@ static inline void mem_cgroup_count_vm_event(struct mm_struct *mm,
 	if (unlikely(!memcg))
 		goto out;
 
+	preempt_disable();
 	switch (idx) {
 	case PGFAULT:
 		this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_PGFAULT]);
@@ -489,6 +555,8 @@ static inline void mem_cgroup_count_vm_event(struct mm_struct *mm,
 	default:
 		BUG();
 	}
+	mem_cgroup_stat_updated(memcg);
+	preempt_enable();
 out:
 	rcu_read_unlock();
 }
@@ -554,12 +622,27 @@ static inline struct lruvec *mem_cgroup_page_lruvec(struct page *page,
 	return &zone->lruvec;
 }
 
+static inline struct mem_cgroup *lruvec_memcg(struct lruvec *lruvec)
+{
+	return NULL;
+}
+
 static inline bool mm_match_cgroup(struct mm_struct *mm,
 		struct mem_cgroup *memcg)
 {
 	return true;
 }
 
+static inline bool mem_cgroup_khugepaged_may_scan(struct mm_struct *mm)
+{
+	return true;
+}
+
+static inline void mem_cgroup_khugepaged_scanned(struct mm_struct *mm,
+						 unsigned int pages)
+{
+}
+
 static inline bool task_in_mem_cgroup(struct task_struct *task,
 				      const struct mem_cgroup *memcg)
 {
@@ -590,6 +673,17 @@ mem_cgroup_inactive_anon_is_low(struct lruvec *lruvec)
 	return true;
 }
 
+static inline struct mem_cgroup *lruvec_memcg(struct lruvec *lruvec)
+{
+	struct mem_cgroup_per_zone *mz;
+
+	if (mem_cgroup_disabled())
+		return NULL;
+
+	mz = container_of(lruvec, struct mem_cgroup_per_zone, lruvec);
+	return mz->memcg;
+}
+
 static inline bool mem_cgroup_lruvec_online(struct lruvec *lruvec)
 {
 	return true;
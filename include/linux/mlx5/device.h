@@ -585,7 +585,8 @@ struct mlx5_err_cqe {
 };
 
 struct mlx5_cqe64 {
-	u8		rsvd0[4];
+	u8		rsvd0[2];
+	__be16		wqe_id;
 	u8		lro_tcppsh_abort_dupack;
 	u8		lro_min_ttl;
 	__be16		lro_tcp_win;
@@ -626,6 +627,35 @@ static inline int cqe_has_vlan(struct mlx5_cqe64 *cqe)
 	return !!(cqe->l4_hdr_type_etc & 0x1);
 }
 
+/* striding RQ: byte_cnt is [31]: filler, [30:16]: strides, [15:0]: bytes */
+#define MPWRQ_CQE_BYTE_CNT_MASK			0xffff
+#define MPWRQ_CQE_BC_CONSUMED_STRIDES_SHIFT	16
+#define MPWRQ_CQE_BC_CONSUMED_STRIDES_MASK	0x7fff0000
+#define MPWRQ_CQE_IS_FILLER			0x80000000
+
+static inline u16 mpwrq_get_cqe_byte_cnt(struct mlx5_cqe64 *cqe)
+{
+	return be32_to_cpu(cqe->byte_cnt) & MPWRQ_CQE_BYTE_CNT_MASK;
+}
+
+static inline u16 mpwrq_get_cqe_consumed_strides(struct mlx5_cqe64 *cqe)
+{
+	u32 bcnt = be32_to_cpu(cqe->byte_cnt);
+
+	return (bcnt & MPWRQ_CQE_BC_CONSUMED_STRIDES_MASK) >>
+	       MPWRQ_CQE_BC_CONSUMED_STRIDES_SHIFT;
+}
+
+static inline bool mpwrq_is_filler_cqe(struct mlx5_cqe64 *cqe)
+{
+	return !!(be32_to_cpu(cqe->byte_cnt) & MPWRQ_CQE_IS_FILLER);
+}
+
+static inline u16 mpwrq_get_cqe_stride_index(struct mlx5_cqe64 *cqe)
+{
+	return be16_to_cpu(cqe->wqe_id);
+}
+
 enum {
 	CQE_L4_HDR_TYPE_NONE			= 0x0,
 	CQE_L4_HDR_TYPE_TCP_NO_ACK		= 0x1,
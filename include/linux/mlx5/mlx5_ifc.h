@@ -680,7 +680,8 @@ struct mlx5_ifc_cmd_hca_cap_bits {
 	u8         cqe_version[0x4];
 
 	u8         compact_address_vector[0x1];
-	u8         reserved_23[0xe];
+	u8         striding_rq[0x1];
+	u8         reserved_23[0xd];
 	u8         drain_sigerr[0x1];
 	u8         cmdif_checksum[0x2];
 	u8         sigerr_cqe[0x1];
@@ -883,7 +884,13 @@ struct mlx5_ifc_wq_bits {
 	u8         reserved_6[0x3];
 	u8         log_wq_sz[0x5];
 
-	u8         reserved_7[0x4e0];
+	u8         reserved_7[0x14];
+	u8         log_wqe_num_of_strides[0x4];
+	u8         two_byte_shift_en[0x1];
+	u8         reserved_8[0x4];
+	u8         log_wqe_stride_size[0x3];
+
+	u8         reserved_9[0x4c0];
 
 	struct mlx5_ifc_cmd_pas_bits pas[0];
 };
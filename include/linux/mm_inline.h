@@ -3,6 +3,7 @@
 
 #include <linux/huge_mm.h>
 #include <linux/swap.h>
+#include <linux/jump_label.h>
 
 /**
  * page_is_file_cache - should the page be on a file LRU or anon LRU?
@@ -22,10 +23,173 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+#ifdef CONFIG_LRU_GEN
+
+extern struct static_key_false lru_gen_key;
+
+static inline bool lru_gen_enabled(void)
+{
+	return static_branch_unlikely(&lru_gen_key);
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/*
+ * page_lru_gen - which generation is the page on?
+ * @page: the page to test
+ *
+ * Returns the generation @page is on, or -1 if it is not on a multi-gen
+ * LRU list.
+ */
+static inline int page_lru_gen(struct page *page)
+{
+	unsigned long flags = READ_ONCE(page->flags);
+
+	return (int)((flags & LRU_GEN_MASK) >> LRU_GEN_PGOFF) - 1;
+}
+
+/* The oldest generation of a type is accounted as its inactive list */
+static inline enum lru_list lru_gen_lru(struct lruvec *lruvec, int gen,
+					int type)
+{
+	enum lru_list lru = type * LRU_FILE;
+
+	if (gen != lru_gen_from_seq(lruvec->lrugen.min_seq[type]))
+		lru += LRU_ACTIVE;
+	return lru;
+}
+
+/*
+ * lru_gen_page_active - is the page in one of the younger generations?
+ * @page: the page to test
+ * @lruvec: the lruvec @page is on
+ *
+ * Returns true if @page would be on an active list with the two-list LRU.
+ */
+static inline bool lru_gen_page_active(struct page *page,
+				       struct lruvec *lruvec)
+{
+	int gen = page_lru_gen(page);
+
+	return gen >= 0 &&
+	       gen != lru_gen_from_seq(lruvec->lrugen.min_seq[page_is_file_cache(page)]);
+}
+
+static __always_inline void lru_gen_update_size(struct lruvec *lruvec,
+				int gen, int type, int nr_pages)
+{
+	enum lru_list lru = lru_gen_lru(lruvec, gen, type);
+
+	lruvec->lrugen.nr_pages[gen][type] += nr_pages;
+	mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
+	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, nr_pages);
+}
+
+/*
+ * Activated pages join the youngest generation. Fresh anon pages and pages
+ * still waiting for writeback get one more generation before they become
+ * eligible, everything else starts out in the oldest generation, like on
+ * the inactive list. @reclaiming puts the page next in line for eviction.
+ */
+static __always_inline bool lru_gen_add_page(struct page *page,
+				struct lruvec *lruvec, bool reclaiming)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int type = page_is_file_cache(page);
+	unsigned long seq;
+	int gen;
+
+	if (!lru_gen_enabled() || PageUnevictable(page))
+		return false;
+
+	if (PageActive(page))
+		seq = lrugen->max_seq;
+	else if ((!type && !PageSwapCache(page)) ||
+		 (PageReclaim(page) &&
+		  (PageDirty(page) || PageWriteback(page))))
+		seq = lrugen->min_seq[type] + 1;
+	else
+		seq = lrugen->min_seq[type];
+
+	gen = lru_gen_from_seq(seq);
+	set_mask_bits(&page->flags, LRU_GEN_MASK | BIT(PG_active),
+		      (gen + 1UL) << LRU_GEN_PGOFF);
+	lru_gen_update_size(lruvec, gen, type, hpage_nr_pages(page));
+	if (reclaiming)
+		list_add_tail(&page->lru, &lrugen->lists[gen][type]);
+	else
+		list_add(&page->lru, &lrugen->lists[gen][type]);
+	return true;
+}
+
+static __always_inline bool lru_gen_del_page(struct page *page,
+				struct lruvec *lruvec)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	VM_BUG_ON_PAGE(PageActive(page), page);
+	VM_BUG_ON_PAGE(PageUnevictable(page), page);
+
+	lru_gen_update_size(lruvec, gen, page_is_file_cache(page),
+			    -hpage_nr_pages(page));
+	set_mask_bits(&page->flags, LRU_GEN_MASK, 0);
+	list_del(&page->lru);
+	return true;
+}
+
+/* A tail page inherits the generation of the huge page it is split from */
+static inline void lru_gen_split_page(struct page *page,
+				      struct page *page_tail)
+{
+	set_mask_bits(&page_tail->flags, LRU_GEN_MASK,
+		      READ_ONCE(page->flags) & LRU_GEN_MASK);
+}
+
+#else /* !CONFIG_LRU_GEN */
+
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline bool lru_gen_page_active(struct page *page,
+				       struct lruvec *lruvec)
+{
+	return false;
+}
+
+static inline bool lru_gen_add_page(struct page *page, struct lruvec *lruvec,
+				    bool reclaiming)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct page *page, struct lruvec *lruvec)
+{
+	return false;
+}
+
+static inline void lru_gen_split_page(struct page *page,
+				      struct page *page_tail)
+{
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
+
+	if (lru_gen_add_page(page, lruvec, false))
+		return;
+
 	mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
 	list_add(&page->lru, &lruvec->lists[lru]);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, nr_pages);
@@ -35,6 +199,10 @@ static __always_inline void del_page_from_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
+
+	if (lru_gen_del_page(page, lruvec))
+		return;
+
 	mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
 	list_del(&page->lru);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, -nr_pages);
@@ -100,4 +268,29 @@ static __always_inline enum lru_list page_lru(struct page *page)
 	return lru;
 }
 
+/**
+ * lru_gen_rotate_page - queue a page for immediate reclaim
+ * @page: the page to rotate
+ * @lruvec: the lruvec @page is on
+ *
+ * Moves @page to the tail of the oldest generation of its type. Returns
+ * false if @page is not on a multi-gen LRU list.
+ */
+static inline bool lru_gen_rotate_page(struct page *page,
+				       struct lruvec *lruvec)
+{
+	enum lru_list lru;
+
+	if (!lru_gen_del_page(page, lruvec))
+		return false;
+
+	/* The multi-gen LRU may have been turned off in the meantime */
+	if (!lru_gen_add_page(page, lruvec, true)) {
+		lru = page_lru(page);
+		add_page_to_lru_list(page, lruvec, lru);
+		list_move_tail(&page->lru, &lruvec->lists[lru]);
+	}
+	return true;
+}
+
 #endif
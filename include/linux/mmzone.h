@@ -213,12 +213,50 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-gen LRU sorts evictable pages into generations instead of the
+ * active/inactive pair. A page's generation is the sequence number modulo
+ * MAX_NR_GENS, stored in its LRU_GEN field in page->flags.
+ *
+ * The aging opens a new youngest generation (max_seq) and promotes pages
+ * found accessed while walking page tables. The eviction reclaims from the
+ * oldest generation (min_seq) of each type and retires it once it is
+ * empty. For the vmstat and memcg counters, the oldest generation of a type
+ * is accounted as its inactive list and the younger ones as its active list.
+ */
+#define MIN_NR_GENS		2U
+#define MAX_NR_GENS		4U
+
+enum {
+	LRU_GEN_ANON,
+	LRU_GEN_FILE,
+	ANON_AND_FILE
+};
+
+struct lru_gen {
+	/* the youngest generation number */
+	unsigned long max_seq;
+	/* the oldest generation numbers, anon in [0] and file in [1] */
+	unsigned long min_seq[ANON_AND_FILE];
+	/* the birth time of each generation in jiffies */
+	unsigned long timestamps[MAX_NR_GENS];
+	/* the multi-gen LRU lists, new pages are added at the head */
+	struct list_head lists[MAX_NR_GENS][ANON_AND_FILE];
+	/* the number of pages on each of the above lists */
+	unsigned long nr_pages[MAX_NR_GENS][ANON_AND_FILE];
+};
+#endif
+
 struct lruvec {
 	struct list_head lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat reclaim_stat;
 #ifdef CONFIG_MEMCG
 	struct zone *zone;
 #endif
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen lrugen;
+#endif
 };
 
 /* Mask used at gathering information at once (see memcontrol.c) */
@@ -249,13 +287,21 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * The pcp lists cache order-0 pages as well as the small high orders up to
+ * PAGE_ALLOC_COSTLY_ORDER, one list per (order, migratetype) pair, so that
+ * kernel stacks, slab pages and similar allocations can avoid zone->lock.
+ */
+#define PCP_MAX_ORDER		PAGE_ALLOC_COSTLY_ORDER
+#define NR_PCP_LISTS		(MIGRATE_PCPTYPES * (PCP_MAX_ORDER + 1))
+
 struct per_cpu_pages {
 	int count;		/* number of pages in the list */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per order and migrate type on the pcp-lists */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
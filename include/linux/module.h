@@ -120,6 +120,11 @@ extern void cleanup_module(void);
 #define late_initcall(fn)		module_init(fn)
 #define late_initcall_sync(fn)		module_init(fn)
 
+#define subsys_initcall_parallel(fn)	module_init(fn)
+#define fs_initcall_parallel(fn)	module_init(fn)
+#define device_initcall_parallel(fn)	module_init(fn)
+#define late_initcall_parallel(fn)	module_init(fn)
+
 #define console_initcall(fn)		module_init(fn)
 #define security_initcall(fn)		module_init(fn)
 
@@ -296,6 +301,7 @@ enum module_state {
 };
 
 struct module;
+struct mod_export;
 
 struct mod_tree_node {
 	struct module *mod;
@@ -328,6 +334,7 @@ struct module {
 	const struct kernel_symbol *syms;
 	const unsigned long *crcs;
 	unsigned int num_syms;
+	struct mod_export *exports;	/* index of all of them by name */
 
 	/* Kernel parameters. */
 #ifdef CONFIG_SYSFS
@@ -226,6 +226,9 @@ struct xt_table_info {
 	unsigned int stacksize;
 	void ***jumpstack;
 
+	/* family private lookup acceleration, freed by the family */
+	void *index;
+
 	unsigned char entries[0] __aligned(8);
 };
 
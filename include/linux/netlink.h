@@ -139,6 +139,7 @@ struct netlink_callback {
 	struct module		*module;
 	u16			family;
 	u16			min_dump_alloc;
+	bool			strict_check;
 	unsigned int		prev_seq, seq;
 	long			args[6];
 };
@@ -136,7 +136,15 @@ struct nvme_id_ctrl {
 	__le16			acwu;
 	__u8			rsvd534[2];
 	__le32			sgls;
-	__u8			rsvd540[1508];
+	__u8			rsvd540[228];
+	char			subnqn[256];
+	__u8			rsvd1024[768];
+	__le32			ioccsz;
+	__le32			iorcsz;
+	__le16			icdoff;
+	__u8			ctrattr;
+	__u8			msdbd;
+	__u8			rsvd1804[244];
 	struct nvme_id_power_state	psd[32];
 	__u8			vs[1024];
 };
@@ -146,6 +154,7 @@ enum {
 	NVME_CTRL_ONCS_WRITE_UNCORRECTABLE	= 1 << 1,
 	NVME_CTRL_ONCS_DSM			= 1 << 2,
 	NVME_CTRL_VWC_PRESENT			= 1 << 0,
+	NVME_CTRL_SGLS_SUPPORTED		= 1 << 0,
 };
 
 struct nvme_lbaf {
@@ -291,6 +300,43 @@ enum nvme_opcode {
 	nvme_cmd_resv_release	= 0x15,
 };
 
+/*
+ * Scatter gather list descriptor, which may take the place of the two PRP
+ * entries of an I/O command when the controller supports SGLs.
+ */
+struct nvme_sgl_desc {
+	__le64			addr;
+	__le32			length;
+	__u8			rsvd[3];
+	__u8			type;
+};
+
+enum {
+	NVME_SGL_FMT_DATA_DESC		= 0x00,
+	NVME_SGL_FMT_SEG_DESC		= 0x02,
+	NVME_SGL_FMT_LAST_SEG_DESC	= 0x03,
+};
+
+/*
+ * Keyed SGL data descriptor of the fabrics transports: the host memory
+ * region the controller reads or writes directly, named by its key.
+ */
+struct nvme_keyed_sgl_desc {
+	__le64			addr;
+	__u8			length[3];
+	__u8			key[4];
+	__u8			type;
+};
+
+enum {
+	NVME_KEY_SGL_FMT_DATA_DESC	= 0x04,
+	NVME_SGL_FMT_ADDRESS		= 0x00,
+	NVME_SGL_FMT_INVALIDATE		= 0x0f,
+};
+
+/* PSDT, in the command flags: SGL for the data, metadata in one buffer */
+#define NVME_CMD_SGL_METABUF	(1 << 6)
+
 struct nvme_common_command {
 	__u8			opcode;
 	__u8			flags;
@@ -298,8 +344,14 @@ struct nvme_common_command {
 	__le32			nsid;
 	__le32			cdw2[2];
 	__le64			metadata;
-	__le64			prp1;
-	__le64			prp2;
+	union {
+		struct {
+			__le64	prp1;
+			__le64	prp2;
+		};
+		struct nvme_sgl_desc sgl;
+		struct nvme_keyed_sgl_desc ksgl;
+	};
 	__le32			cdw10[6];
 };
 
@@ -310,8 +362,14 @@ struct nvme_rw_command {
 	__le32			nsid;
 	__u64			rsvd2;
 	__le64			metadata;
-	__le64			prp1;
-	__le64			prp2;
+	union {
+		struct {
+			__le64	prp1;
+			__le64	prp2;
+		};
+		struct nvme_sgl_desc sgl;
+		struct nvme_keyed_sgl_desc ksgl;
+	};
 	__le64			slba;
 	__le16			length;
 	__le16			control;
@@ -517,6 +575,90 @@ struct nvme_format_cmd {
 	__u32			rsvd11[5];
 };
 
+/*
+ * NVMe over Fabrics
+ */
+
+#define NVMF_NQN_SIZE		223
+#define NVMF_NQN_FIELD_LEN	256
+
+enum nvme_fabrics_type {
+	nvme_fabrics_type_property_set	= 0x00,
+	nvme_fabrics_type_connect	= 0x01,
+	nvme_fabrics_type_property_get	= 0x04,
+};
+
+/* All fabrics commands share this opcode and carry their own fctype */
+#define nvme_fabrics_command	0x7f
+
+struct nvmf_common_command {
+	__u8			opcode;
+	__u8			resv1;
+	__u16			command_id;
+	__u8			fctype;
+	__u8			resv2[35];
+	__u8			ts[24];
+};
+
+struct nvmf_connect_command {
+	__u8			opcode;
+	__u8			resv1;
+	__u16			command_id;
+	__u8			fctype;
+	__u8			resv2[19];
+	struct nvme_keyed_sgl_desc ksgl;
+	__le16			recfmt;
+	__le16			qid;
+	__le16			sqsize;
+	__u8			cattr;
+	__u8			resv3;
+	__le32			kato;
+	__u8			resv4[12];
+};
+
+/* The data of a connect command */
+struct nvmf_connect_data {
+	__u8			hostid[16];
+	__le16			cntlid;
+	char			resv4[238];
+	char			subsysnqn[NVMF_NQN_FIELD_LEN];
+	char			hostnqn[NVMF_NQN_FIELD_LEN];
+	char			resv5[256];
+};
+
+struct nvmf_property_set_command {
+	__u8			opcode;
+	__u8			resv1;
+	__u16			command_id;
+	__u8			fctype;
+	__u8			resv2[35];
+	__u8			attrib;		/* 0: 4 bytes, 1: 8 bytes */
+	__u8			resv3[3];
+	__le32			offset;
+	__le64			value;
+	__u8			resv4[8];
+};
+
+struct nvmf_property_get_command {
+	__u8			opcode;
+	__u8			resv1;
+	__u16			command_id;
+	__u8			fctype;
+	__u8			resv2[35];
+	__u8			attrib;
+	__u8			resv3[3];
+	__le32			offset;
+	__u8			resv4[16];
+};
+
+/* The property offsets are those of the registers in struct nvme_bar */
+enum {
+	NVME_REG_CAP	= 0x0000,
+	NVME_REG_VS	= 0x0008,
+	NVME_REG_CC	= 0x0014,
+	NVME_REG_CSTS	= 0x001c,
+};
+
 struct nvme_command {
 	union {
 		struct nvme_common_command common;
@@ -530,9 +672,24 @@ struct nvme_command {
 		struct nvme_format_cmd format;
 		struct nvme_dsm_cmd dsm;
 		struct nvme_abort_cmd abort;
+		struct nvmf_common_command fabrics;
+		struct nvmf_connect_command connect;
+		struct nvmf_property_set_command prop_set;
+		struct nvmf_property_get_command prop_get;
 	};
 };
 
+/* Whether the data of the command flows from the host to the controller */
+static inline bool nvme_is_write(struct nvme_command *cmd)
+{
+	/*
+	 * Bit 0 of the opcode gives the direction of the data for every
+	 * command, the fabrics ones included: a connect is sent with its
+	 * data like a write.
+	 */
+	return cmd->common.opcode & 1;
+}
+
 enum {
 	NVME_SC_SUCCESS			= 0x0,
 	NVME_SC_INVALID_OPCODE		= 0x1,
@@ -576,6 +733,13 @@ enum {
 	NVME_SC_BAD_ATTRIBUTES		= 0x180,
 	NVME_SC_INVALID_PI		= 0x181,
 	NVME_SC_READ_ONLY		= 0x182,
+
+	NVME_SC_CONNECT_FORMAT		= 0x180,
+	NVME_SC_CONNECT_CTRL_BUSY	= 0x181,
+	NVME_SC_CONNECT_INVALID_PARAM	= 0x182,
+	NVME_SC_CONNECT_RESTART_DISC	= 0x183,
+	NVME_SC_CONNECT_INVALID_HOST	= 0x184,
+
 	NVME_SC_WRITE_FAULT		= 0x280,
 	NVME_SC_READ_ERROR		= 0x281,
 	NVME_SC_GUARD_CHECK		= 0x282,
@@ -7,6 +7,22 @@
 
 #ifdef CONFIG_IDLE_PAGE_TRACKING
 
+struct mm_struct;
+struct vm_area_struct;
+
+struct page_idle_stats {
+	unsigned long	idle;		/* pages, not touched since marked */
+	unsigned long	active;
+};
+
+extern void page_idle_count_range(struct vm_area_struct *vma,
+				  unsigned long start, unsigned long end,
+				  struct page_idle_stats *stats);
+extern int page_idle_scan_mm(struct mm_struct *mm, bool on);
+extern bool page_idle_scan_result(struct mm_struct *mm,
+				  struct page_idle_stats *stats,
+				  unsigned long *passes);
+
 #ifdef CONFIG_64BIT
 static inline bool page_is_young(struct page *page)
 {
@@ -580,6 +580,7 @@ struct perf_event {
 #ifdef CONFIG_CGROUP_PERF
 	struct perf_cgroup		*cgrp; /* cgroup event is attach to */
 	int				cgrp_defer_enabled;
+	struct list_head		cgrp_group_entry;
 #endif
 
 #endif /* CONFIG_PERF_EVENTS */
@@ -661,6 +662,11 @@ struct perf_cpu_context {
 
 	struct pmu			*unique_pmu;
 	struct perf_cgroup		*cgrp;
+#ifdef CONFIG_CGROUP_PERF
+	/* group leaders of ctx not attached to a cgroup */
+	struct list_head		pinned_groups;
+	struct list_head		flexible_groups;
+#endif
 };
 
 struct perf_output_handle {
@@ -680,10 +686,15 @@ struct perf_output_handle {
 /*
  * perf_cgroup_info keeps track of time_enabled for a cgroup.
  * This is a per-cpu dynamically allocated data structure.
+ *
+ * It also indexes the group leaders attached to the cgroup on
+ * that cpu, so switching to a cgroup only visits its own events.
  */
 struct perf_cgroup_info {
 	u64				time;
 	u64				timestamp;
+	struct list_head		pinned_groups;
+	struct list_head		flexible_groups;
 };
 
 struct perf_cgroup {
@@ -967,6 +978,11 @@ DECLARE_PER_CPU(struct perf_callchain_entry, perf_callchain_entry);
 
 extern void perf_callchain_user(struct perf_callchain_entry *entry, struct pt_regs *regs);
 extern void perf_callchain_kernel(struct perf_callchain_entry *entry, struct pt_regs *regs);
+extern struct perf_callchain_entry *
+get_perf_callchain(struct pt_regs *regs, u32 init_nr, bool kernel, bool user,
+		   bool crosstask, bool add_mark);
+extern int get_callchain_buffers(void);
+extern void put_callchain_buffers(void);
 
 static inline void perf_callchain_store(struct perf_callchain_entry *entry, u64 ip)
 {
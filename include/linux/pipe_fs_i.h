@@ -41,7 +41,12 @@ struct pipe_buffer {
  *	@w_counter: writer counter
  *	@fasync_readers: reader side fasync
  *	@fasync_writers: writer side fasync
+ *	@user: the user @auto_pages are charged to
+ *	@auto_pages: the pipe buffers grown on a full pipe, past PIPE_DEF_BUFFERS
+ *	@sized: set by F_SETPIPE_SZ, which ends the growth on a full pipe
+ *	@poll_usage: polled, so every write and read has to wake up
  *	@bufs: the circular array of pipe buffers
+ *	@gifts: tracks when the pages vmsplice()d with SPLICE_F_GIFT are done with
  **/
 struct pipe_inode_info {
 	struct mutex mutex;
@@ -56,7 +61,12 @@ struct pipe_inode_info {
 	struct page *tmp_page;
 	struct fasync_struct *fasync_readers;
 	struct fasync_struct *fasync_writers;
+	struct user_struct *user;
+	unsigned int auto_pages;
+	bool sized;
+	bool poll_usage;
 	struct pipe_buffer *bufs;
+	struct pipe_gifts *gifts;
 };
 
 /*
@@ -123,7 +133,10 @@ void pipe_unlock(struct pipe_inode_info *);
 void pipe_double_lock(struct pipe_inode_info *, struct pipe_inode_info *);
 
 extern unsigned int pipe_max_size, pipe_min_size;
+extern unsigned int pipe_auto_max_size;
+extern unsigned long pipe_user_auto_pages;
 int pipe_proc_fn(struct ctl_table *, int, void __user *, size_t *, loff_t *);
+bool pipe_auto_grow_to(struct pipe_inode_info *, unsigned int);
 
 
 /* Drop the inode semaphore and wait for a pipe event, atomically */
@@ -140,6 +153,10 @@ void generic_pipe_buf_release(struct pipe_inode_info *, struct pipe_buffer *);
 
 extern const struct pipe_buf_operations nosteal_pipe_buf_ops;
 
+/* for F_GETPIPE_GIFTED */
+long pipe_gifts_done(struct pipe_inode_info *pipe);
+void pipe_gifts_free(struct pipe_inode_info *pipe);
+
 /* for F_SETPIPE_SZ and F_GETPIPE_SZ */
 long pipe_fcntl(struct file *, unsigned int, unsigned long arg);
 struct pipe_inode_info *get_pipe_info(struct file *file);
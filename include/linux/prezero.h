@@ -0,0 +1,35 @@
+#ifndef _LINUX_PREZERO_H
+#define _LINUX_PREZERO_H
+
+struct page;
+struct vm_area_struct;
+struct ctl_table;
+
+#ifdef CONFIG_HUGEPAGE_PREZERO
+extern int sysctl_prezero_thp_pages;
+extern int sysctl_prezero_hugetlb;
+
+extern struct page *prezero_alloc_thp(struct vm_area_struct *vma);
+extern void prezero_kick_node(int nid);
+extern int prezero_sysctl_handler(struct ctl_table *table, int write,
+				  void __user *buffer, size_t *length,
+				  loff_t *ppos);
+
+#ifdef CONFIG_HUGETLB_PAGE
+extern bool hugetlb_prezero_page(int nid);
+#endif
+
+#else /* CONFIG_HUGEPAGE_PREZERO */
+
+static inline struct page *prezero_alloc_thp(struct vm_area_struct *vma)
+{
+	return NULL;
+}
+
+static inline void prezero_kick_node(int nid)
+{
+}
+
+#endif /* CONFIG_HUGEPAGE_PREZERO */
+
+#endif /* _LINUX_PREZERO_H */
@@ -0,0 +1,79 @@
+#ifndef _LINUX_PTSHARE_H
+#define _LINUX_PTSHARE_H
+
+#include <linux/mm.h>
+
+#ifdef CONFIG_PTSHARE
+/*
+ * A pte table referenced by more than one mm counts the extra mms in its
+ * _mapcount, and has PG_private_2 set from the first time it was shared:
+ * its entries are not accounted in any mm's rss counters from then on.
+ */
+static inline bool ptshare_table_shared(struct page *table)
+{
+	return page_mapcount(table) > 0;
+}
+
+static inline bool ptshare_pte_unaccounted(pte_t *pte)
+{
+	return PagePrivate2(virt_to_page(pte));
+}
+
+static inline void ptshare_free_table(struct page *table)
+{
+	ClearPagePrivate2(table);
+}
+
+extern bool ptshare_attach(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd);
+extern void ptshare_unshare(struct vm_area_struct *vma);
+extern void __ptshare_flush_tlb_page(struct vm_area_struct *vma,
+				     unsigned long address);
+extern int ptshare_madvise(struct vm_area_struct *vma,
+			   unsigned long *vm_flags, int advice);
+
+/*
+ * Flush a pte changed through the rmap for all mms sharing its table.
+ * The caller holds i_mmap_rwsem, as rmap_walk() does.
+ */
+static inline void ptshare_flush_tlb_page(struct vm_area_struct *vma,
+					  unsigned long address, pte_t *pte)
+{
+	if (ptshare_table_shared(virt_to_page(pte)))
+		__ptshare_flush_tlb_page(vma, address);
+}
+
+#else /* CONFIG_PTSHARE */
+
+static inline bool ptshare_table_shared(struct page *table)
+{
+	return false;
+}
+
+static inline bool ptshare_pte_unaccounted(pte_t *pte)
+{
+	return false;
+}
+
+static inline void ptshare_free_table(struct page *table)
+{
+}
+
+static inline bool ptshare_attach(struct vm_area_struct *vma,
+				  unsigned long address, pmd_t *pmd)
+{
+	return false;
+}
+
+static inline void ptshare_unshare(struct vm_area_struct *vma)
+{
+}
+
+static inline void ptshare_flush_tlb_page(struct vm_area_struct *vma,
+					  unsigned long address, pte_t *pte)
+{
+}
+
+#endif /* CONFIG_PTSHARE */
+
+#endif /* _LINUX_PTSHARE_H */
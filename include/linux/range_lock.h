@@ -0,0 +1,61 @@
+/*
+ * Range locks
+ *
+ * A range lock excludes other holders of overlapping ranges of the same
+ * tree only. Readers share with readers, writers exclude everyone, and a
+ * range waits for the overlapping ranges queued before it, so neither
+ * side starves.
+ */
+#ifndef _LINUX_RANGE_LOCK_H
+#define _LINUX_RANGE_LOCK_H
+
+#include <linux/interval_tree.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+struct task_struct;
+
+struct range_lock_tree {
+	struct rb_root root;
+	spinlock_t lock;
+	u64 seqnum;		/* Queueing order of the ranges */
+};
+
+struct range_lock {
+	struct interval_tree_node node;
+	struct task_struct *task;
+	unsigned int blocking_ranges;	/* Earlier ranges still held */
+	bool reader;
+	u64 seqnum;
+};
+
+#define __RANGE_LOCK_TREE_INITIALIZER(name)			\
+	{ .root = RB_ROOT,					\
+	  .lock = __SPIN_LOCK_UNLOCKED(name.lock) }
+
+static inline void range_lock_tree_init(struct range_lock_tree *tree)
+{
+	tree->root = RB_ROOT;
+	spin_lock_init(&tree->lock);
+	tree->seqnum = 0;
+}
+
+/* Lock [@start, @last] */
+static inline void range_lock_init(struct range_lock *lock,
+				   unsigned long start, unsigned long last)
+{
+	lock->node.start = start;
+	lock->node.last = last;
+	lock->blocking_ranges = 0;
+}
+
+extern void range_read_lock(struct range_lock_tree *tree,
+			    struct range_lock *lock);
+extern void range_read_unlock(struct range_lock_tree *tree,
+			      struct range_lock *lock);
+extern void range_write_lock(struct range_lock_tree *tree,
+			     struct range_lock *lock);
+extern void range_write_unlock(struct range_lock_tree *tree,
+			       struct range_lock *lock);
+
+#endif /* _LINUX_RANGE_LOCK_H */
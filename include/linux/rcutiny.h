@@ -37,6 +37,17 @@ static inline void cond_synchronize_rcu(unsigned long oldstate)
 	might_sleep();
 }
 
+static inline unsigned long start_poll_synchronize_rcu(void)
+{
+	return 0;
+}
+
+/* As for cond_synchronize_rcu(), any point that may block is a GP on UP. */
+static inline bool poll_state_synchronize_rcu(unsigned long oldstate)
+{
+	return true;
+}
+
 static inline unsigned long get_state_synchronize_sched(void)
 {
 	return 0;
@@ -47,6 +58,16 @@ static inline void cond_synchronize_sched(unsigned long oldstate)
 	might_sleep();
 }
 
+static inline unsigned long start_poll_synchronize_sched(void)
+{
+	return 0;
+}
+
+static inline bool poll_state_synchronize_sched(unsigned long oldstate)
+{
+	return true;
+}
+
 static inline void rcu_barrier_bh(void)
 {
 	wait_rcu_gp(call_rcu_bh);
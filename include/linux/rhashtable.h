@@ -56,6 +56,7 @@ struct rhash_head {
 /**
  * struct bucket_table - Table of hash buckets
  * @size: Number of hash buckets
+ * @nest: Number of bits of first-level nested table, 0 for a flat table
  * @rehash: Current bucket being rehashed
  * @hash_rnd: Random seed to fold into hash
  * @locks_mask: Mask to apply before accessing locks[]
@@ -63,10 +64,17 @@ struct rhash_head {
  * @walkers: List of active walkers
  * @rcu: RCU structure for freeing the table
  * @future_tbl: Table under construction during rehashing
- * @buckets: size * hash buckets
+ * @buckets: size * hash buckets, or the nested table if @nest is set
+ *
+ * Tables too large for a single allocation are nested: buckets[0] then
+ * points to a page of @nest bits worth of pointers to further pages, each
+ * of which resolves another PAGE_SHIFT - ilog2(sizeof(void *)) bits of the
+ * bucket index down to pages of actual buckets.  Use rht_bucket() rather
+ * than accessing @buckets directly.
  */
 struct bucket_table {
 	unsigned int		size;
+	unsigned int		nest;
 	unsigned int		rehash;
 	u32			hash_rnd;
 	unsigned int		locks_mask;
@@ -340,6 +348,23 @@ static inline int lockdep_rht_bucket_is_held(const struct bucket_table *tbl,
 int rhashtable_init(struct rhashtable *ht,
 		    const struct rhashtable_params *params);
 
+struct rhash_head __rcu **rht_bucket_nested(const struct bucket_table *tbl,
+					    unsigned int hash);
+
+static inline struct rhash_head __rcu *const *rht_bucket(
+	const struct bucket_table *tbl, unsigned int hash)
+{
+	return unlikely(tbl->nest) ? rht_bucket_nested(tbl, hash) :
+				     &tbl->buckets[hash];
+}
+
+static inline struct rhash_head __rcu **rht_bucket_var(
+	struct bucket_table *tbl, unsigned int hash)
+{
+	return unlikely(tbl->nest) ? rht_bucket_nested(tbl, hash) :
+				     &tbl->buckets[hash];
+}
+
 struct bucket_table *rhashtable_insert_slow(struct rhashtable *ht,
 					    const void *key,
 					    struct rhash_head *obj,
@@ -391,7 +416,7 @@ void rhashtable_destroy(struct rhashtable *ht);
  * @hash:	the hash value / bucket index
  */
 #define rht_for_each(pos, tbl, hash) \
-	rht_for_each_continue(pos, (tbl)->buckets[hash], tbl, hash)
+	rht_for_each_continue(pos, *rht_bucket(tbl, hash), tbl, hash)
 
 /**
  * rht_for_each_entry_continue - continue iterating over hash chain
@@ -416,7 +441,7 @@ void rhashtable_destroy(struct rhashtable *ht);
  * @member:	name of the &struct rhash_head within the hashable struct.
  */
 #define rht_for_each_entry(tpos, pos, tbl, hash, member)		\
-	rht_for_each_entry_continue(tpos, pos, (tbl)->buckets[hash],	\
+	rht_for_each_entry_continue(tpos, pos, *rht_bucket(tbl, hash),	\
 				    tbl, hash, member)
 
 /**
@@ -432,7 +457,7 @@ void rhashtable_destroy(struct rhashtable *ht);
  * remove the loop cursor from the list.
  */
 #define rht_for_each_entry_safe(tpos, pos, next, tbl, hash, member)	    \
-	for (pos = rht_dereference_bucket((tbl)->buckets[hash], tbl, hash), \
+	for (pos = rht_dereference_bucket(*rht_bucket(tbl, hash), tbl, hash), \
 	     next = !rht_is_a_nulls(pos) ?				    \
 		       rht_dereference_bucket(pos->next, tbl, hash) : NULL; \
 	     (!rht_is_a_nulls(pos)) && rht_entry(tpos, pos, member);	    \
@@ -468,7 +493,7 @@ void rhashtable_destroy(struct rhashtable *ht);
  * traversal is guarded by rcu_read_lock().
  */
 #define rht_for_each_rcu(pos, tbl, hash)				\
-	rht_for_each_rcu_continue(pos, (tbl)->buckets[hash], tbl, hash)
+	rht_for_each_rcu_continue(pos, *rht_bucket(tbl, hash), tbl, hash)
 
 /**
  * rht_for_each_entry_rcu_continue - continue iterating over rcu hash chain
@@ -502,7 +527,7 @@ void rhashtable_destroy(struct rhashtable *ht);
  * traversal is guarded by rcu_read_lock().
  */
 #define rht_for_each_entry_rcu(tpos, pos, tbl, hash, member)		\
-	rht_for_each_entry_rcu_continue(tpos, pos, (tbl)->buckets[hash],\
+	rht_for_each_entry_rcu_continue(tpos, pos, *rht_bucket(tbl, hash),\
 					tbl, hash, member)
 
 static inline int rhashtable_compare(struct rhashtable_compare_arg *arg,
@@ -565,13 +590,14 @@ restart:
 /* Internal function, please use rhashtable_insert_fast() instead */
 static inline int __rhashtable_insert_fast(
 	struct rhashtable *ht, const void *key, struct rhash_head *obj,
-	const struct rhashtable_params params)
+	const struct rhashtable_params params, bool defer_grow)
 {
 	struct rhashtable_compare_arg arg = {
 		.ht = ht,
 		.key = key,
 	};
 	struct bucket_table *tbl, *new_tbl;
+	struct rhash_head __rcu **bkt;
 	struct rhash_head *head;
 	spinlock_t *lock;
 	unsigned int elasticity;
@@ -637,14 +663,15 @@ slow_path:
 
 	err = 0;
 
-	head = rht_dereference_bucket(tbl->buckets[hash], tbl, hash);
+	bkt = rht_bucket_var(tbl, hash);
+	head = rht_dereference_bucket(*bkt, tbl, hash);
 
 	RCU_INIT_POINTER(obj->next, head);
 
-	rcu_assign_pointer(tbl->buckets[hash], obj);
+	rcu_assign_pointer(*bkt, obj);
 
 	atomic_inc(&ht->nelems);
-	if (rht_grow_above_75(ht, tbl))
+	if (!defer_grow && rht_grow_above_75(ht, tbl))
 		schedule_work(&ht->run_work);
 
 out:
@@ -674,7 +701,44 @@ static inline int rhashtable_insert_fast(
 	struct rhashtable *ht, struct rhash_head *obj,
 	const struct rhashtable_params params)
 {
-	return __rhashtable_insert_fast(ht, NULL, obj, params);
+	return __rhashtable_insert_fast(ht, NULL, obj, params, false);
+}
+
+/**
+ * rhashtable_insert_bulk - insert a batch of objects into hash table
+ * @ht:		hash table
+ * @objs:	pointers to the hash heads inside the objects
+ * @n:		number of objects
+ * @params:	hash table parameters
+ *
+ * Like calling rhashtable_insert_fast() for each object, except that the
+ * check whether the table should grow and the scheduling of the deferred
+ * resize are done once for the whole batch.  This keeps the cache line
+ * of the element count from bouncing around in the growth check when
+ * many CPUs insert concurrently, e.g. when a table is populated.
+ *
+ * Stops at the first object that cannot be inserted.
+ *
+ * Returns the number of objects inserted.
+ */
+static inline unsigned int rhashtable_insert_bulk(
+	struct rhashtable *ht, struct rhash_head **objs, unsigned int n,
+	const struct rhashtable_params params)
+{
+	const struct bucket_table *tbl;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (__rhashtable_insert_fast(ht, NULL, objs[i], params, true))
+			break;
+
+	rcu_read_lock();
+	tbl = rht_dereference_rcu(ht->tbl, ht);
+	if (i && rht_grow_above_75(ht, tbl))
+		schedule_work(&ht->run_work);
+	rcu_read_unlock();
+
+	return i;
 }
 
 /**
@@ -707,7 +771,7 @@ static inline int rhashtable_lookup_insert_fast(
 	BUG_ON(ht->p.obj_hashfn);
 
 	return __rhashtable_insert_fast(ht, key + ht->p.key_offset, obj,
-					params);
+					params, false);
 }
 
 /**
@@ -738,7 +802,7 @@ static inline int rhashtable_lookup_insert_key(
 {
 	BUG_ON(!ht->p.obj_hashfn || !key);
 
-	return __rhashtable_insert_fast(ht, key, obj, params);
+	return __rhashtable_insert_fast(ht, key, obj, params, false);
 }
 
 /* Internal function, please use rhashtable_remove_fast() instead */
@@ -757,7 +821,7 @@ static inline int __rhashtable_remove_fast(
 
 	spin_lock_bh(lock);
 
-	pprev = &tbl->buckets[hash];
+	pprev = rht_bucket_var(tbl, hash);
 	rht_for_each(he, tbl, hash) {
 		if (he != obj) {
 			pprev = &he->next;
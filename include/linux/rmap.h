@@ -155,6 +155,9 @@ void page_add_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
 void do_page_add_anon_rmap(struct page *, struct vm_area_struct *,
 			   unsigned long, int);
 void page_add_new_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+void page_add_new_anon_rmap_index(struct page *, struct anon_vma *, pgoff_t);
+#endif
 void page_add_file_rmap(struct page *);
 void page_remove_rmap(struct page *);
 
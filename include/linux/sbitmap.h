@@ -0,0 +1,195 @@
+/*
+ * Scalable bitmaps
+ *
+ * A bitmap for allocating bits, ids or tags, from many CPUs at once. The
+ * words of the map are each in a cacheline of their own and every CPU
+ * starts its search at its own hint, so allocators mostly stay off each
+ * other's cachelines until the map runs full. sbitmap_queue adds waiting
+ * for a free bit, woken in batches over several wait queues.
+ */
+#ifndef _LINUX_SBITMAP_H
+#define _LINUX_SBITMAP_H
+
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/cache.h>
+#include <linux/wait.h>
+#include <linux/gfp.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+struct sbitmap_word {
+	unsigned long word;
+	unsigned long depth;		/* Bits in use in this word */
+} ____cacheline_aligned_in_smp;
+
+struct sbitmap {
+	unsigned int depth;
+	unsigned int shift;		/* log2 of the bits per word */
+	unsigned int map_nr;
+	struct sbitmap_word *map;
+};
+
+#define SBQ_WAIT_QUEUES	8
+#define SBQ_WAKE_BATCH	8
+
+struct sbq_wait_state {
+	atomic_t wait_cnt;		/* Frees left before the next wakeup */
+	wait_queue_head_t wait;
+} ____cacheline_aligned_in_smp;
+
+struct sbitmap_queue {
+	struct sbitmap sb;
+
+	unsigned int __percpu *alloc_hint;
+	unsigned int wake_batch;
+	atomic_t wake_index;
+	struct sbq_wait_state *ws;
+
+	/* Allocate in strict order rather than from the freed bits */
+	bool round_robin;
+};
+
+#define SB_NR_TO_INDEX(sb, bitnr) ((bitnr) >> (sb)->shift)
+#define SB_NR_TO_BIT(sb, bitnr) ((bitnr) & ((1U << (sb)->shift) - 1U))
+
+/*
+ * @shift is log2 of the bits per word, or -1 to have it picked for
+ * @depth.
+ */
+extern int sbitmap_init_node(struct sbitmap *sb, unsigned int depth, int shift,
+			     gfp_t flags, int node);
+
+static inline void sbitmap_free(struct sbitmap *sb)
+{
+	kfree(sb->map);
+	sb->map = NULL;
+}
+
+extern void sbitmap_resize(struct sbitmap *sb, unsigned int depth);
+extern int sbitmap_get(struct sbitmap *sb, unsigned int alloc_hint,
+		       bool round_robin);
+extern bool sbitmap_any_bit_set(const struct sbitmap *sb);
+extern bool sbitmap_any_bit_clear(const struct sbitmap *sb);
+extern unsigned int sbitmap_weight(const struct sbitmap *sb);
+
+typedef bool (*sb_for_each_fn)(struct sbitmap *, unsigned int, void *);
+
+/*
+ * Call @fn for each set bit, for as long as it returns true.
+ */
+static inline void sbitmap_for_each_set(struct sbitmap *sb, sb_for_each_fn fn,
+					void *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < sb->map_nr; i++) {
+		struct sbitmap_word *word = &sb->map[i];
+		unsigned int off, nr;
+
+		if (!word->word)
+			continue;
+
+		nr = 0;
+		off = i << sb->shift;
+		while (1) {
+			nr = find_next_bit(&word->word, word->depth, nr);
+			if (nr >= word->depth)
+				break;
+
+			if (!fn(sb, off + nr, data))
+				return;
+
+			nr++;
+		}
+	}
+}
+
+static inline unsigned long *__sbitmap_word(struct sbitmap *sb,
+					    unsigned int bitnr)
+{
+	return &sb->map[SB_NR_TO_INDEX(sb, bitnr)].word;
+}
+
+static inline void sbitmap_set_bit(struct sbitmap *sb, unsigned int bitnr)
+{
+	set_bit(SB_NR_TO_BIT(sb, bitnr), __sbitmap_word(sb, bitnr));
+}
+
+static inline void sbitmap_clear_bit(struct sbitmap *sb, unsigned int bitnr)
+{
+	clear_bit(SB_NR_TO_BIT(sb, bitnr), __sbitmap_word(sb, bitnr));
+}
+
+static inline int sbitmap_test_bit(struct sbitmap *sb, unsigned int bitnr)
+{
+	return test_bit(SB_NR_TO_BIT(sb, bitnr), __sbitmap_word(sb, bitnr));
+}
+
+extern int sbitmap_queue_init_node(struct sbitmap_queue *sbq,
+				   unsigned int depth, int shift,
+				   bool round_robin, gfp_t flags, int node);
+
+static inline void sbitmap_queue_free(struct sbitmap_queue *sbq)
+{
+	kfree(sbq->ws);
+	sbq->ws = NULL;
+	free_percpu(sbq->alloc_hint);
+	sbq->alloc_hint = NULL;
+	sbitmap_free(&sbq->sb);
+}
+
+extern void sbitmap_queue_resize(struct sbitmap_queue *sbq, unsigned int depth);
+
+/*
+ * Allocate a bit starting at the hint of this CPU; preemption must be
+ * disabled. Returns the bit, or -1 if none is free.
+ */
+extern int __sbitmap_queue_get(struct sbitmap_queue *sbq);
+
+static inline int sbitmap_queue_get(struct sbitmap_queue *sbq,
+				    unsigned int *cpu)
+{
+	int nr;
+
+	*cpu = get_cpu();
+	nr = __sbitmap_queue_get(sbq);
+	put_cpu();
+	return nr;
+}
+
+/*
+ * Free @nr, allocated on @cpu, and wake up waiters once a batch of bits
+ * has been freed.
+ */
+extern void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
+				unsigned int cpu);
+extern void sbitmap_queue_wake_all(struct sbitmap_queue *sbq);
+
+static inline int sbq_index_inc(int index)
+{
+	return (index + 1) & (SBQ_WAIT_QUEUES - 1);
+}
+
+static inline void sbq_index_atomic_inc(atomic_t *index)
+{
+	int old = atomic_read(index);
+	int new = sbq_index_inc(old);
+	atomic_cmpxchg(index, old, new);
+}
+
+/*
+ * The wait queue to sleep on for a free bit. Waiters rotate over the
+ * queues through @wait_index, which each user keeps for itself.
+ */
+static inline struct sbq_wait_state *sbq_wait_ptr(struct sbitmap_queue *sbq,
+						  atomic_t *wait_index)
+{
+	struct sbq_wait_state *ws;
+
+	ws = &sbq->ws[atomic_read(wait_index)];
+	sbq_index_atomic_inc(wait_index);
+	return ws;
+}
+
+#endif /* _LINUX_SBITMAP_H */
@@ -63,6 +63,8 @@ struct sched_param {
 #include <asm/processor.h>
 
 #define SCHED_ATTR_SIZE_VER0	48	/* sizeof first published struct */
+#define SCHED_ATTR_SIZE_VER1	56	/* add: latency_nice */
+#define SCHED_ATTR_SIZE_VER2	64	/* add: util_{min,max} */
 
 /*
  * Extended scheduling parameters data structure.
@@ -99,6 +101,12 @@ struct sched_param {
  *  @sched_deadline	representative of the task's deadline
  *  @sched_runtime	representative of the task's runtime
  *  @sched_period	representative of the task's period
+ *  @sched_latency_nice	task's latency nice value (SCHED_FLAG_LATENCY_NICE)
+ *  @sched_util_min	least utilization the task is treated as having
+ *  @sched_util_max	most utilization the task is treated as having
+ *
+ * The utilization clamps are in the [0..SCHED_CAPACITY_SCALE] range and
+ * are set with SCHED_FLAG_UTIL_CLAMP_{MIN,MAX}; -1 restores the default.
  *
  * Given this task model, there are a multiplicity of scheduling algorithms
  * and policies, that can be used to ensure all the tasks will make their
@@ -124,6 +132,13 @@ struct sched_attr {
 	u64 sched_runtime;
 	u64 sched_deadline;
 	u64 sched_period;
+
+	/* SCHED_NORMAL, SCHED_BATCH */
+	s32 sched_latency_nice;
+
+	/* utilization clamps */
+	u32 sched_util_min;
+	u32 sched_util_max;
 };
 
 struct futex_pi_state;
@@ -507,6 +522,8 @@ static inline int get_dumpable(struct mm_struct *mm)
 
 #define MMF_HAS_UPROBES		19	/* has uprobes */
 #define MMF_RECALC_UPROBES	20	/* MMF_HAS_UPROBES can be wrong */
+#define MMF_RANGE_LOCK		21	/* faults lock their page in mmap_range */
+#define MMF_LAZY_FORK		22	/* fork shares pte tables, see lazyfork.h */
 
 #define MMF_INIT_MASK		(MMF_DUMPABLE_MASK | MMF_DUMP_FILTER_MASK)
 
@@ -830,6 +847,7 @@ struct user_struct {
 	unsigned long mq_bytes;	/* How many bytes can be allocated to mqueue? */
 #endif
 	unsigned long locked_shm; /* How many pages of mlocked shm ? */
+	atomic_long_t pipe_auto_pages; /* Pipe slots grown on their own */
 	unsigned long unix_inflight;	/* How many files in flight in unix sockets */
 
 #ifdef CONFIG_KEYS
@@ -1024,11 +1042,25 @@ extern int sched_domain_level_max;
 
 struct sched_group;
 
+/*
+ * State shared by all the cpus of a domain, one instance per span; only
+ * domains sharing package resources have one.
+ */
+struct sched_domain_shared {
+	atomic_t	ref;
+	/*
+	 * The cpus of the domain running their idle task, as kept up to
+	 * date by the idle class.  Only a hint for select_idle_sibling().
+	 */
+	unsigned long	idle_cpus[0];
+};
+
 struct sched_domain {
 	/* These fields must be setup */
 	struct sched_domain *parent;	/* top domain must be null terminated */
 	struct sched_domain *child;	/* bottom domain must be null terminated */
 	struct sched_group *groups;	/* the balancing groups of the domain */
+	struct sched_domain_shared *shared;
 	unsigned long min_interval;	/* Minimum balance interval ms */
 	unsigned long max_interval;	/* Maximum balance interval ms */
 	unsigned int busy_factor;	/* less balancing by factor if busy */
@@ -1054,6 +1086,9 @@ struct sched_domain {
 	u64 max_newidle_lb_cost;
 	unsigned long next_decay_max_lb_cost;
 
+	/* select_idle_sibling() stats */
+	u64 avg_scan_cost;		/* running average, in ns */
+
 #ifdef CONFIG_SCHEDSTATS
 	/* load_balance() stats */
 	unsigned int lb_count[CPU_MAX_IDLE_TYPES];
@@ -1109,6 +1144,11 @@ static inline struct cpumask *sched_domain_span(struct sched_domain *sd)
 	return to_cpumask(sd->span);
 }
 
+static inline struct cpumask *sds_idle_cpus(struct sched_domain_shared *sds)
+{
+	return to_cpumask(sds->idle_cpus);
+}
+
 extern void partition_sched_domains(int ndoms_new, cpumask_var_t doms_new[],
 				    struct sched_domain_attr *dattr_new);
 
@@ -1127,6 +1167,7 @@ struct sd_data {
 	struct sched_domain **__percpu sd;
 	struct sched_group **__percpu sg;
 	struct sched_group_capacity **__percpu sgc;
+	struct sched_domain_shared **__percpu sds;
 };
 
 struct sched_domain_topology_level {
@@ -1290,6 +1331,43 @@ struct sched_rt_entity {
 #endif
 };
 
+#ifdef CONFIG_SCHED_BPF
+struct sched_bpf_entity {
+	struct rb_node		node;
+	/* queued tasks of the rq in enqueue order, for the watchdog */
+	struct list_head	fifo_node;
+	u32			key;
+	u64			seq;
+	unsigned long		queued_ticks;
+	unsigned int		slice;
+	unsigned int		time_slice;
+	/* queued in the class: the running task is, but not in the rbtree */
+	int			on_rq;
+};
+#endif
+
+#ifdef CONFIG_UCLAMP_TASK
+enum uclamp_id {
+	UCLAMP_MIN = 0,
+	UCLAMP_MAX,
+	UCLAMP_CNT
+};
+
+/* the clamp values are accounted on each rq in this many buckets */
+#define UCLAMP_BUCKETS	5
+
+/*
+ * A utilization clamp: value is in [0..SCHED_CAPACITY_SCALE].  While the
+ * task is runnable, active is set and bucket_id is the rq bucket it is
+ * accounted in.
+ */
+struct uclamp_se {
+	unsigned int value		: SCHED_CAPACITY_SHIFT + 1;
+	unsigned int bucket_id		: 3;
+	unsigned int active		: 1;
+};
+#endif
+
 struct sched_dl_entity {
 	struct rb_node	rb_node;
 
@@ -1374,6 +1452,12 @@ struct tlbflush_unmap_batch {
 	 * allows an update without redirtying the page.
 	 */
 	bool writable;
+
+	/*
+	 * IPIs the deferred flushes would have sent on their own, counted
+	 * while the tlb_flush_batched tracepoint is enabled.
+	 */
+	unsigned int nr_ipis;
 };
 
 struct task_struct {
@@ -1396,11 +1480,24 @@ struct task_struct {
 
 	int prio, static_prio, normal_prio;
 	unsigned int rt_priority;
+	int latency_nice;
 	const struct sched_class *sched_class;
 	struct sched_entity se;
 	struct sched_rt_entity rt;
+#ifdef CONFIG_SCHED_BPF
+	struct sched_bpf_entity bpf;
+#endif
+#ifdef CONFIG_UCLAMP_TASK
+	/* clamps asked for, and those in effect while runnable */
+	struct uclamp_se uclamp_req[UCLAMP_CNT];
+	struct uclamp_se uclamp[UCLAMP_CNT];
+#endif
 #ifdef CONFIG_CGROUP_SCHED
 	struct task_group *sched_task_group;
+#endif
+#ifdef CONFIG_SCHED_CORE
+	/* only tasks of the same cookie share a core, see core.c */
+	unsigned long core_cookie;
 #endif
 	struct sched_dl_entity dl;
 
@@ -1806,6 +1903,9 @@ struct task_struct {
 #ifdef CONFIG_UPROBES
 	struct uprobe_task *utask;
 #endif
+#ifdef CONFIG_KRETPROBES
+	struct llist_head kretprobe_instances;
+#endif
 #if defined(CONFIG_BCACHE) || defined(CONFIG_BCACHE_MODULE)
 	unsigned int	sequential_io;
 	unsigned int	sequential_io_avg;
@@ -2384,6 +2484,17 @@ extern int sched_setscheduler_nocheck(struct task_struct *, int,
 				      const struct sched_param *);
 extern int sched_setattr(struct task_struct *,
 			 const struct sched_attr *);
+#ifdef CONFIG_UCLAMP_TASK
+extern void sched_cpu_uclamp_pct(int cpu, unsigned int *min_pct,
+				 unsigned int *max_pct);
+#else
+static inline void sched_cpu_uclamp_pct(int cpu, unsigned int *min_pct,
+					unsigned int *max_pct)
+{
+	*min_pct = 0;
+	*max_pct = 100;
+}
+#endif
 extern struct task_struct *idle_task(int cpu);
 /**
  * is_idle_task - is the specified task an idle task?
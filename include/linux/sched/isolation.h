@@ -0,0 +1,53 @@
+#ifndef _LINUX_SCHED_ISOLATION_H
+#define _LINUX_SCHED_ISOLATION_H
+
+#include <linux/cpumask.h>
+#include <linux/init.h>
+#include <linux/smp.h>
+
+struct task_struct;
+
+/*
+ * The kinds of kernel work the cpus isolated by nohz_full= or isolcpus=
+ * are spared, and left to the housekeeping cpus.
+ */
+enum hk_flags {
+	HK_FLAG_TIMER		= 1,		/* unpinned timers */
+	HK_FLAG_RCU		= (1 << 1),	/* RCU callbacks and kthreads */
+	HK_FLAG_MISC		= (1 << 2),	/* vmstat, lockup detector */
+	HK_FLAG_TICK		= (1 << 3),	/* the tick itself */
+	HK_FLAG_DOMAIN		= (1 << 4),	/* load balancing */
+	HK_FLAG_WQ		= (1 << 5),	/* unbound work */
+	HK_FLAG_MANAGED_IRQ	= (1 << 6),	/* kernel chosen irq affinity */
+	HK_FLAG_KTHREAD		= (1 << 7),	/* unbound kthreads */
+};
+
+#ifdef CONFIG_CPU_ISOLATION
+extern int housekeeping_any_cpu(enum hk_flags flags);
+extern const struct cpumask *housekeeping_cpumask(enum hk_flags flags);
+extern void housekeeping_affine(struct task_struct *t, enum hk_flags flags);
+extern bool housekeeping_test_cpu(int cpu, enum hk_flags flags);
+extern void __init housekeeping_init(void);
+#else
+static inline int housekeeping_any_cpu(enum hk_flags flags)
+{
+	return smp_processor_id();
+}
+
+static inline const struct cpumask *housekeeping_cpumask(enum hk_flags flags)
+{
+	return cpu_possible_mask;
+}
+
+static inline void housekeeping_affine(struct task_struct *t,
+				       enum hk_flags flags) { }
+
+static inline bool housekeeping_test_cpu(int cpu, enum hk_flags flags)
+{
+	return true;
+}
+
+static inline void housekeeping_init(void) { }
+#endif /* CONFIG_CPU_ISOLATION */
+
+#endif /* _LINUX_SCHED_ISOLATION_H */
@@ -35,13 +35,39 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	MAGAZINE_ALLOC_HIT,	/* Allocation from cpu magazine */
+	MAGAZINE_ALLOC_MISS,	/* Magazines and depot empty on allocation */
+	MAGAZINE_FREE,		/* Free to cpu magazine */
+	MAGAZINE_FLUSH,		/* Magazine returned to the slabs in bulk */
+	MAGAZINE_DEPOT_GET,	/* Full magazine taken from the depot */
+	MAGAZINE_DEPOT_PUT,	/* Full magazine handed to the depot */
 	NR_SLUB_STAT_ITEMS };
 
+/*
+ * Caches created with SLAB_MAGAZINE keep recently freed objects in per cpu
+ * magazines. Full magazines are passed between cpus through the depot.
+ */
+#define SLUB_MAGAZINE_SIZE	32
+
+struct slub_magazine {
+	struct list_head list;	/* On the depot full or empty list */
+	unsigned int rounds;	/* Number of objects in the magazine */
+	void *objects[SLUB_MAGAZINE_SIZE];
+};
+
+struct slub_depot {
+	spinlock_t lock;
+	struct list_head full;
+	struct list_head empty;
+};
+
 struct kmem_cache_cpu {
 	void **freelist;	/* Pointer to next available object */
 	unsigned long tid;	/* Globally unique transaction id */
 	struct page *page;	/* The slab from which we are allocating */
 	struct page *partial;	/* Partially allocated frozen slabs */
+	struct slub_magazine *mag;	/* Loaded magazine */
+	struct slub_magazine *mag_prev;	/* Previously loaded magazine */
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
@@ -98,6 +124,7 @@ struct kmem_cache {
 	 */
 	int remote_node_defrag_ratio;
 #endif
+	struct slub_depot depot;	/* Magazines not loaded on any cpu */
 	struct kmem_cache_node *node[MAX_NUMNODES];
 };
 
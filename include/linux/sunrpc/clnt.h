@@ -27,6 +27,7 @@
 #include <net/ipv6.h>
 
 struct rpc_inode;
+struct rpc_xprt_switch;
 
 /*
  * The high-level client handle
@@ -38,6 +39,7 @@ struct rpc_clnt {
 	struct list_head	cl_tasks;	/* List of tasks */
 	spinlock_t		cl_lock;	/* spinlock */
 	struct rpc_xprt __rcu *	cl_xprt;	/* transport */
+	struct rpc_xprt_switch *cl_xpswitch;	/* nconnect transports */
 	struct rpc_procinfo *	cl_procinfo;	/* procedure info */
 	u32			cl_prog,	/* RPC program number */
 				cl_vers,	/* RPC version number */
@@ -121,6 +123,7 @@ struct rpc_create_args {
 	unsigned long		flags;
 	char			*client_name;
 	struct svc_xprt		*bc_xprt;	/* NFSv4.1 backchannel */
+	unsigned int		nconnect;	/* transports to spread over */
 };
 
 /* Values for "flags" field */
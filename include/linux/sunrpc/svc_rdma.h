@@ -41,6 +41,7 @@
 
 #ifndef SVC_RDMA_H
 #define SVC_RDMA_H
+#include <linux/interrupt.h>
 #include <linux/sunrpc/xdr.h>
 #include <linux/sunrpc/svcsock.h>
 #include <linux/sunrpc/rpc_rdma.h>
@@ -162,7 +163,7 @@ struct svcxprt_rdma {
 
 	wait_queue_head_t    sc_send_wait;	/* SQ exhaustion waitlist */
 	unsigned long	     sc_flags;
-	struct list_head     sc_dto_q;		/* DTO tasklet I/O pending Q */
+	struct tasklet_struct sc_dto_tasklet;	/* reaps the SQ and RQ CQs */
 	struct list_head     sc_read_complete_q;
 	struct work_struct   sc_work;
 };
@@ -170,6 +171,7 @@ struct svcxprt_rdma {
 #define RDMAXPRT_RQ_PENDING	1
 #define RDMAXPRT_SQ_PENDING	2
 #define RDMAXPRT_CONN_PENDING	3
+#define RDMAXPRT_DTO_QUEUED	4
 
 #define RPCRDMA_LISTEN_BACKLOG  10
 /* The default ORD value is based on two outstanding full-size writes with a
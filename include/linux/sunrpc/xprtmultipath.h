@@ -0,0 +1,36 @@
+/*
+ * linux/include/linux/sunrpc/xprtmultipath.h
+ *
+ * A set of transports to one server, which an RPC client spreads its
+ * requests over.
+ */
+#ifndef _LINUX_SUNRPC_XPRTMULTIPATH_H
+#define _LINUX_SUNRPC_XPRTMULTIPATH_H
+
+#include <linux/kref.h>
+#include <linux/sunrpc/xprt.h>
+
+#define RPC_MAX_NCONNECT	16
+
+struct rpc_xprt_switch {
+	struct kref		xps_kref;
+	atomic_t		xps_next;	/* round-robin cursor */
+	unsigned int		xps_nxprts;
+	struct rpc_xprt		*xps_xprt[];
+};
+
+struct rpc_xprt_switch *xprt_switch_alloc(unsigned int nxprts, gfp_t gfp);
+void			xprt_switch_add_xprt(struct rpc_xprt_switch *xps,
+				struct rpc_xprt *xprt);
+struct rpc_xprt *	xprt_switch_get_next(struct rpc_xprt_switch *xps);
+void			xprt_switch_put(struct rpc_xprt_switch *xps);
+
+static inline struct rpc_xprt_switch *
+xprt_switch_get(struct rpc_xprt_switch *xps)
+{
+	if (xps)
+		kref_get(&xps->xps_kref);
+	return xps;
+}
+
+#endif /* _LINUX_SUNRPC_XPRTMULTIPATH_H */
@@ -12,6 +12,9 @@
 #define _LINUX_SYSCALLS_H
 
 struct epoll_event;
+struct epoll_ctl_cmd;
+struct futex_waitv;
+struct epoll_wait_params;
 struct iattr;
 struct inode;
 struct iocb;
@@ -46,6 +49,7 @@ struct shmid_ds;
 struct sockaddr;
 struct stat;
 struct stat64;
+struct stat_batch_entry;
 struct statfs;
 struct statfs64;
 struct __sysctl_args;
@@ -335,6 +339,10 @@ asmlinkage long sys_set_tid_address(int __user *tidptr);
 asmlinkage long sys_futex(u32 __user *uaddr, int op, u32 val,
 			struct timespec __user *utime, u32 __user *uaddr2,
 			u32 val3);
+asmlinkage long sys_futex_waitv(struct futex_waitv __user *waiters,
+				unsigned int nr_futexes, unsigned int flags,
+				struct timespec __user *timeout,
+				clockid_t clockid);
 
 asmlinkage long sys_init_module(void __user *umod, unsigned long len,
 				const char __user *uargs);
@@ -634,6 +642,11 @@ asmlinkage long sys_epoll_pwait(int epfd, struct epoll_event __user *events,
 				int maxevents, int timeout,
 				const sigset_t __user *sigmask,
 				size_t sigsetsize);
+asmlinkage long sys_epoll_ctl_batch(int epfd, int flags, int ncmds,
+				struct epoll_ctl_cmd __user *cmds);
+asmlinkage long sys_epoll_pwait1(int epfd, struct epoll_event __user *events,
+				int maxevents,
+				struct epoll_wait_params __user *params);
 asmlinkage long sys_gethostname(char __user *name, int len);
 asmlinkage long sys_sethostname(char __user *name, int len);
 asmlinkage long sys_setdomainname(char __user *name, int len);
@@ -888,5 +901,8 @@ asmlinkage long sys_execveat(int dfd, const char __user *filename,
 asmlinkage long sys_membarrier(int cmd, int flags);
 
 asmlinkage long sys_mlock2(unsigned long start, size_t len, int flags);
+asmlinkage long sys_stat_batch(int dfd, struct stat_batch_entry __user *entries,
+			       unsigned int count, unsigned int mask,
+			       unsigned int flags);
 
 #endif
@@ -148,6 +148,12 @@ static inline void iov_iter_reexpand(struct iov_iter *i, size_t count)
 size_t csum_and_copy_to_iter(void *addr, size_t bytes, __wsum *csum, struct iov_iter *i);
 size_t csum_and_copy_from_iter(void *addr, size_t bytes, __wsum *csum, struct iov_iter *i);
 
+typedef u32 (*crc_update_fn)(u32 crc, const void *p, size_t len);
+size_t crc_and_copy_to_iter(void *addr, size_t bytes, u32 *crc,
+			    crc_update_fn update, struct iov_iter *i);
+size_t crc_and_copy_from_iter(void *addr, size_t bytes, u32 *crc,
+			      crc_update_fn update, struct iov_iter *i);
+
 int import_iovec(int type, const struct iovec __user * uvector,
 		 unsigned nr_segs, unsigned fast_segs,
 		 struct iovec **iov, struct iov_iter *i);
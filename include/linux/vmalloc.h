@@ -6,6 +6,7 @@
 #include <linux/list.h>
 #include <asm/page.h>		/* pgprot_t */
 #include <linux/rbtree.h>
+#include <linux/llist.h>
 
 struct vm_area_struct;		/* vma defining user mapping in mm_types.h */
 
@@ -45,7 +46,8 @@ struct vmap_area {
 	unsigned long flags;
 	struct rb_node rb_node;         /* address sorted rbtree */
 	struct list_head list;          /* address sorted list */
-	struct list_head purge_list;    /* "lazy purge" list */
+	struct llist_node purge_list;   /* "lazy purge" list */
+	unsigned long rb_subtree_gap;   /* largest free gap in the subtree */
 	struct vm_struct *vm;
 	struct rcu_head rcu_head;
 };
@@ -119,18 +119,42 @@ struct delayed_work {
 	int cpu;
 };
 
+/*
+ * Affinity scopes of unbound workqueues.  The CPUs of an unbound
+ * workqueue are split into pods at the granularity of its scope and each
+ * pod is served by its own worker_pool, so that work items are executed
+ * close to where they were issued.
+ */
+enum wq_affn_scope {
+	WQ_AFFN_DFL,			/* use system default */
+	WQ_AFFN_CPU,			/* one pod per CPU */
+	WQ_AFFN_SMT,			/* one pod per SMT sibling group */
+	WQ_AFFN_CACHE,			/* one pod per last level cache */
+	WQ_AFFN_NUMA,			/* one pod per NUMA node */
+	WQ_AFFN_SYSTEM,			/* one pod across the whole system */
+
+	WQ_AFFN_NR_TYPES,
+};
+
 /*
  * A struct for workqueue attributes.  This can be used to change
  * attributes of an unbound workqueue.
  *
- * Unlike other fields, ->no_numa isn't a property of a worker_pool.  It
- * only modifies how apply_workqueue_attrs() select pools and thus doesn't
- * participate in pool hash calculations or equality comparisons.
+ * ->pod_cpumask is the part of ->cpumask a pool's workers are started
+ * on.  Normally both are the same.  If ->steal is set, the workers may
+ * run anywhere in ->cpumask and CPUs idling outside the pod pick up
+ * the pool's backlog.
+ *
+ * Unlike other fields, ->affn_scope isn't a property of a worker_pool.
+ * It only modifies how apply_workqueue_attrs() select pools and thus
+ * doesn't participate in pool hash calculations or equality comparisons.
  */
 struct workqueue_attrs {
 	int			nice;		/* nice level */
 	cpumask_var_t		cpumask;	/* allowed CPUs */
-	bool			no_numa;	/* disable NUMA affinity */
+	cpumask_var_t		pod_cpumask;	/* CPUs of the pod */
+	bool			steal;		/* allow work-stealing */
+	enum wq_affn_scope	affn_scope;	/* pod granularity */
 };
 
 static inline struct delayed_work *to_delayed_work(struct work_struct *work)
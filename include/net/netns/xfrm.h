@@ -74,6 +74,8 @@ struct netns_xfrm {
 #endif
 	spinlock_t xfrm_state_lock;
 	rwlock_t xfrm_policy_lock;
+	/* bumped around moves of policies between bydst chains */
+	seqcount_t xfrm_policy_hash_generation;
 	struct mutex xfrm_cfg_mutex;
 
 	/* flow cache part */
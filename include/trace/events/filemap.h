@@ -52,6 +52,46 @@ DEFINE_EVENT(mm_filemap_op_page_cache, mm_filemap_add_to_page_cache,
 	TP_ARGS(page)
 	);
 
+TRACE_EVENT(mm_filemap_readahead,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 unsigned long req_size, struct file_ra_state *ra, bool async),
+
+	TP_ARGS(mapping, offset, req_size, ra, async),
+
+	TP_STRUCT__entry(
+		__field(unsigned long, i_ino)
+		__field(dev_t, s_dev)
+		__field(pgoff_t, offset)
+		__field(unsigned long, req_size)
+		__field(pgoff_t, start)
+		__field(unsigned int, size)
+		__field(unsigned int, async_size)
+		__field(bool, async)
+	),
+
+	TP_fast_assign(
+		__entry->i_ino = mapping->host->i_ino;
+		if (mapping->host->i_sb)
+			__entry->s_dev = mapping->host->i_sb->s_dev;
+		else
+			__entry->s_dev = mapping->host->i_rdev;
+		__entry->offset = offset;
+		__entry->req_size = req_size;
+		__entry->start = ra->start;
+		__entry->size = ra->size;
+		__entry->async_size = ra->async_size;
+		__entry->async = async;
+	),
+
+	TP_printk("dev %d:%d ino %lx ofs=%lu req=%lu start=%lu size=%u async_size=%u %s",
+		MAJOR(__entry->s_dev), MINOR(__entry->s_dev),
+		__entry->i_ino,
+		__entry->offset, __entry->req_size,
+		__entry->start, __entry->size, __entry->async_size,
+		__entry->async ? "async" : "sync")
+);
+
 #endif /* _TRACE_FILEMAP_H */
 
 /* This part must be outside protection */
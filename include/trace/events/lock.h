@@ -80,6 +80,66 @@ DEFINE_EVENT(lock, lock_acquired,
 #endif
 #endif
 
+/* flags of contention_begin */
+#define LCB_F_SPIN	(1U << 0)	/* spinning, not sleeping */
+#define LCB_F_READ	(1U << 1)
+#define LCB_F_WRITE	(1U << 2)
+#define LCB_F_MUTEX	(1U << 3)
+
+/*
+ * Lock contention, without lockdep: contention_begin when a locker
+ * can't get the lock on the fast path, contention_end once it has it,
+ * or has given up (ret != 0).  @ip is the locking call site, as far as
+ * the slowpath knows it.
+ */
+TRACE_EVENT(contention_begin,
+
+	TP_PROTO(void *lock, unsigned int flags, unsigned long ip),
+
+	TP_ARGS(lock, flags, ip),
+
+	TP_STRUCT__entry(
+		__field(void *, lock_addr)
+		__field(unsigned long, ip)
+		__field(unsigned int, flags)
+	),
+
+	TP_fast_assign(
+		__entry->lock_addr = lock;
+		__entry->ip = ip;
+		__entry->flags = flags;
+	),
+
+	TP_printk("%p %s%s%s%s caller=%pS", __entry->lock_addr,
+		  (__entry->flags & LCB_F_SPIN) ? "spin " : "",
+		  (__entry->flags & LCB_F_MUTEX) ? "mutex" : "",
+		  (__entry->flags & LCB_F_READ) ? "read" : "",
+		  (__entry->flags & LCB_F_WRITE) ? "write" : "",
+		  (void *)__entry->ip)
+);
+
+TRACE_EVENT(contention_end,
+
+	TP_PROTO(void *lock, u64 wait_ns, int ret),
+
+	TP_ARGS(lock, wait_ns, ret),
+
+	TP_STRUCT__entry(
+		__field(void *, lock_addr)
+		__field(u64, wait_ns)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->lock_addr = lock;
+		__entry->wait_ns = wait_ns;
+		__entry->ret = ret;
+	),
+
+	TP_printk("%p wait_ns=%llu ret=%d", __entry->lock_addr,
+		  (unsigned long long)__entry->wait_ns, __entry->ret)
+);
+
 #endif /* _TRACE_LOCK_H */
 
 /* This part must be outside protection */
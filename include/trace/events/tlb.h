@@ -57,6 +57,29 @@ TRACE_EVENT_CONDITION(tlb_flush,
 		__entry->reason)
 );
 
+/*
+ * A batched shootdown: how many IPIs it sent, and how many fewer than
+ * flushing each deferred change on its own would have.
+ */
+TRACE_EVENT(tlb_flush_batched,
+
+	TP_PROTO(unsigned int nr_ipis, unsigned int nr_sent),
+	TP_ARGS(nr_ipis, nr_sent),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, sent)
+		__field(unsigned int, avoided)
+	),
+
+	TP_fast_assign(
+		__entry->sent    = nr_sent;
+		__entry->avoided = nr_ipis > nr_sent ? nr_ipis - nr_sent : 0;
+	),
+
+	TP_printk("ipis_sent:%u ipis_avoided:%u",
+		__entry->sent, __entry->avoided)
+);
+
 #endif /* _TRACE_TLB_H */
 
 /* This part must be outside protection */
@@ -562,7 +562,7 @@ static inline notrace int trace_event_get_offsets_##call(		\
  *		trace_buffer_unlock_commit(buffer, event, irq_flags, pc);
  *
  *	if (__tt)
- *		event_triggers_post_call(trace_file, __tt);
+ *		event_triggers_post_call(trace_file, __tt, entry);
  * }
  *
  * static struct trace_event ftrace_event_type_<call> = {
@@ -715,9 +715,18 @@ __SYSCALL(__NR_userfaultfd, sys_userfaultfd)
 __SYSCALL(__NR_membarrier, sys_membarrier)
 #define __NR_mlock2 284
 __SYSCALL(__NR_mlock2, sys_mlock2)
+#define __NR_stat_batch 285
+__SYSCALL(__NR_stat_batch, sys_stat_batch)
+#define __NR_epoll_ctl_batch 286
+__SYSCALL(__NR_epoll_ctl_batch, sys_epoll_ctl_batch)
+#define __NR_epoll_pwait1 287
+__SYSCALL(__NR_epoll_pwait1, sys_epoll_pwait1)
+
+#define __NR_futex_waitv 288
+__SYSCALL(__NR_futex_waitv, sys_futex_waitv)
 
 #undef __NR_syscalls
-#define __NR_syscalls 285
+#define __NR_syscalls 289
 
 /*
  * All syscalls below here should go away really,
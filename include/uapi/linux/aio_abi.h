@@ -44,6 +44,7 @@ enum {
 	IOCB_CMD_NOOP = 6,
 	IOCB_CMD_PREADV = 7,
 	IOCB_CMD_PWRITEV = 8,
+	IOCB_CMD_SQ_SETUP = 9,
 };
 
 /*
@@ -53,6 +54,43 @@ enum {
  *                   is valid.
  */
 #define IOCB_FLAG_RESFD		(1 << 0)
+/*
+ * IOCB_FLAG_FIXED_FILE - "aio_fildes" is an index into the files
+ *                        registered with IOCB_CMD_SQ_SETUP.
+ * IOCB_FLAG_HIPRI - For O_DIRECT: io_getevents() spins on the device for
+ *                   the completion, if its queue supports polling.
+ */
+#define IOCB_FLAG_FIXED_FILE	(1 << 1)
+#define IOCB_FLAG_HIPRI		(1 << 2)
+
+/*
+ * IOCB_CMD_SQ_SETUP: "aio_buf" points to a struct aio_sq_setup and
+ * "aio_nbytes" is its size. It is done once per context, at once, and
+ * posts no event.
+ *
+ * The files listed are registered with the context. If a ring is given,
+ * a kernel thread submits the iocbs whose addresses are queued on it,
+ * which must name their file with IOCB_FLAG_FIXED_FILE and cannot use
+ * IOCB_FLAG_RESFD. An iocb it cannot submit completes with the error.
+ * After "idle_ms" without work the thread sets AIO_SQ_NEED_WAKEUP in the
+ * ring flags and sleeps until io_submit() is called on the context.
+ */
+struct aio_sq_setup {
+	__u64	files;		/* __s32 array of file descriptors */
+	__u32	nr_files;
+	__u32	idle_ms;
+	__u64	ring;		/* struct aio_sq_ring, or 0 for none */
+};
+
+#define AIO_SQ_NEED_WAKEUP	(1 << 0)
+
+struct aio_sq_ring {
+	__u32	head;		/* next entry the kernel takes */
+	__u32	tail;		/* next entry the user fills */
+	__u32	nr;		/* number of entries, a power of 2 */
+	__u32	flags;		/* AIO_SQ_* */
+	__u64	iocbs[0];	/* struct iocb __user * */
+};
 
 /* read() from /dev/aio returns these structures. */
 struct io_event {
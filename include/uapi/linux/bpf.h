@@ -73,6 +73,8 @@ enum bpf_cmd {
 	BPF_PROG_LOAD,
 	BPF_OBJ_PIN,
 	BPF_OBJ_GET,
+	BPF_PROG_ATTACH,
+	BPF_PROG_DETACH,
 };
 
 enum bpf_map_type {
@@ -81,6 +83,10 @@ enum bpf_map_type {
 	BPF_MAP_TYPE_ARRAY,
 	BPF_MAP_TYPE_PROG_ARRAY,
 	BPF_MAP_TYPE_PERF_EVENT_ARRAY,
+	BPF_MAP_TYPE_PERCPU_HASH,
+	BPF_MAP_TYPE_PERCPU_ARRAY,
+	BPF_MAP_TYPE_LRU_HASH,
+	BPF_MAP_TYPE_STACK_TRACE,
 };
 
 enum bpf_prog_type {
@@ -89,21 +95,46 @@ enum bpf_prog_type {
 	BPF_PROG_TYPE_KPROBE,
 	BPF_PROG_TYPE_SCHED_CLS,
 	BPF_PROG_TYPE_SCHED_ACT,
+	BPF_PROG_TYPE_SCHED,
+	BPF_PROG_TYPE_XDP,
 };
 
+enum bpf_attach_type {
+	BPF_SCHED_POLICY,	/* decisions of the SCHED_BPF class */
+	BPF_XDP,		/* frames received by a net device */
+	__MAX_BPF_ATTACH_TYPE
+};
+
+#define MAX_BPF_ATTACH_TYPE __MAX_BPF_ATTACH_TYPE
+
 #define BPF_PSEUDO_MAP_FD	1
 
+/* when bpf_call->src_reg == BPF_PSEUDO_CALL, bpf_call->imm == pc-relative
+ * offset to another bpf function
+ */
+#define BPF_PSEUDO_CALL		1
+
 /* flags for BPF_MAP_UPDATE_ELEM command */
 #define BPF_ANY		0 /* create new element or update existing */
 #define BPF_NOEXIST	1 /* create new element if it didn't exist */
 #define BPF_EXIST	2 /* update existing element */
 
+/* BPF_FUNC_get_stackid flags */
+#define BPF_F_SKIP_FIELD_MASK		0xffULL
+#define BPF_F_USER_STACK		(1ULL << 8)
+#define BPF_F_FAST_STACK_CMP		(1ULL << 9)
+#define BPF_F_REUSE_STACKID		(1ULL << 10)
+
+/* flags for BPF_MAP_CREATE command */
+#define BPF_F_NO_PREALLOC	(1U << 0) /* hash: allocate elements on update */
+
 union bpf_attr {
 	struct { /* anonymous struct used by BPF_MAP_CREATE command */
 		__u32	map_type;	/* one of enum bpf_map_type */
 		__u32	key_size;	/* size of key in bytes */
 		__u32	value_size;	/* size of value in bytes */
 		__u32	max_entries;	/* max number of entries in a map */
+		__u32	map_flags;	/* BPF_F_* flags */
 	};
 
 	struct { /* anonymous struct used by BPF_MAP_*_ELEM commands */
@@ -131,6 +162,14 @@ union bpf_attr {
 		__aligned_u64	pathname;
 		__u32		bpf_fd;
 	};
+
+	struct { /* anonymous struct used by BPF_PROG_ATTACH/DETACH commands */
+		__u32		target_fd;	/* 0 for BPF_SCHED_POLICY,
+						 * ifindex for BPF_XDP
+						 */
+		__u32		attach_bpf_fd;	/* eBPF program to attach */
+		__u32		attach_type;	/* one of enum bpf_attach_type */
+	};
 } __attribute__((aligned(8)));
 
 /* integer value in 'imm' field of BPF_CALL instruction selects which helper
@@ -269,6 +308,41 @@ enum bpf_func_id {
 	 * Return: 0 on success
 	 */
 	BPF_FUNC_perf_event_output,
+
+	/**
+	 * bpf_xdp_load_bytes(ctx, offset, to, len) - load bytes from frame
+	 * @ctx: pointer to 'struct xdp_md'
+	 * @offset: offset within the frame
+	 * @to: pointer where to copy bytes to
+	 * @len: number of bytes to copy
+	 * Return: 0 on success
+	 */
+	BPF_FUNC_xdp_load_bytes,
+
+	/**
+	 * bpf_xdp_store_bytes(ctx, offset, from, len) - store bytes into frame
+	 * @ctx: pointer to 'struct xdp_md'
+	 * @offset: offset within the frame
+	 * @from: pointer where to copy bytes from
+	 * @len: number of bytes to store into the frame
+	 * Return: 0 on success
+	 */
+	BPF_FUNC_xdp_store_bytes,
+
+	/**
+	 * bpf_get_stackid(ctx, map, flags) - walk user or kernel stack and
+	 * return id
+	 * @ctx: struct pt_regs*
+	 * @map: pointer to stack_trace map
+	 * @flags: bits 0-7 - number of stack frames to skip
+	 *         bit 8 - collect user stack instead of kernel
+	 *         bit 9 - compare stacks by hash only
+	 *         bit 10 - if two different stacks hash into the same stackid
+	 *                  discard old
+	 *         other bits - reserved
+	 * Return: >= 0 stackid on success or negative error
+	 */
+	BPF_FUNC_get_stackid,
 	__BPF_FUNC_MAX_ID,
 };
 
@@ -298,4 +372,53 @@ struct bpf_tunnel_key {
 	__u32 remote_ipv4;
 };
 
+/* operations a BPF_PROG_TYPE_SCHED program is run for */
+enum bpf_sched_op {
+	/* pick the cpu a waking task runs on, return value is the cpu */
+	BPF_SCHED_SELECT_CPU,
+	/* task is queued, return value is its dispatch key: lowest runs first */
+	BPF_SCHED_ENQUEUE,
+	/* task left the runqueue, return value is ignored */
+	BPF_SCHED_DEQUEUE,
+};
+
+/* BPF_SCHED_ENQUEUE flags */
+#define BPF_SCHED_ENQ_WAKEUP	(1U << 0) /* task just woke up */
+#define BPF_SCHED_ENQ_REQUEUE	(1U << 1) /* task was preempted or yielded */
+
+/* user accessible context of BPF_PROG_TYPE_SCHED programs.
+ * everything is read only except slice_us, which BPF_SCHED_ENQUEUE may set
+ * to the time slice of the task in microseconds (0 keeps the default).
+ */
+struct bpf_sched_ctx {
+	__u32 op;		/* enum bpf_sched_op */
+	__u32 pid;
+	__u32 tgid;
+	__s32 nice;
+	__s32 prev_cpu;		/* cpu the task last ran on */
+	__s32 this_cpu;		/* cpu the program runs on */
+	__u32 flags;		/* wake flags or BPF_SCHED_ENQ_* */
+	__u32 slice_us;
+};
+
+/* verdicts of BPF_PROG_TYPE_XDP programs.  XDP_REDIRECT sends the frame
+ * to the device picked with bpf_redirect(ifindex, 0) by the program.
+ */
+enum xdp_action {
+	XDP_ABORTED = 0,
+	XDP_DROP,
+	XDP_PASS,
+	XDP_TX,
+	XDP_REDIRECT,
+};
+
+/* user accessible context of BPF_PROG_TYPE_XDP programs, read only.
+ * the frame itself is read and written with bpf_xdp_{load,store}_bytes().
+ */
+struct xdp_md {
+	__u32 len;
+	__u32 ingress_ifindex;
+	__u32 rx_queue_index;
+};
+
 #endif /* _UAPI__LINUX_BPF_H__ */
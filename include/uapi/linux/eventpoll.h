@@ -26,6 +26,9 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/* Set exclusive wakeup mode for the target file descriptor */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /*
  * Request the handling of system wakeup events so as to prevent system suspends
  * from happening while those events are being processed.
@@ -61,6 +64,36 @@ struct epoll_event {
 	__u64 data;
 } EPOLL_PACKED;
 
+/* One operation of epoll_ctl_batch() */
+struct epoll_ctl_cmd {
+	/* Reserved, must be 0 */
+	__s32 flags;
+	/* EPOLL_CTL_ADD, EPOLL_CTL_DEL or EPOLL_CTL_MOD */
+	__s32 op;
+	/* The target file descriptor */
+	__s32 fd;
+	/* epoll_event.events, for EPOLL_CTL_ADD and EPOLL_CTL_MOD */
+	__u32 events;
+	/* epoll_event.data, for EPOLL_CTL_ADD and EPOLL_CTL_MOD */
+	__u64 data;
+	/* Output: what epoll_ctl() would have returned for it */
+	__s32 result;
+	__u32 __pad;
+};
+
+/* The wait parameters of epoll_pwait1() */
+struct epoll_wait_params {
+	/* Relative timeout; a negative tv_sec waits without a timeout */
+	__s64 tv_sec;
+	__s64 tv_nsec;
+	/* const sigset_t *, the signal mask during the wait, or 0 */
+	__u64 sigmask;
+	__u64 sigsetsize;
+	/* Spin for events this long before sleeping, capped by a sysctl */
+	__u32 busy_poll_usecs;
+	__u32 __reserved;
+};
+
 #ifdef CONFIG_PM_SLEEP
 static inline void ep_take_care_of_epollwakeup(struct epoll_event *epev)
 {
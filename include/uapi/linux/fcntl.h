@@ -27,6 +27,13 @@
 #define F_SETPIPE_SZ	(F_LINUX_SPECIFIC_BASE + 7)
 #define F_GETPIPE_SZ	(F_LINUX_SPECIFIC_BASE + 8)
 
+/*
+ * Bytes vmsplice()d into the pipe with SPLICE_F_GIFT that the kernel is
+ * done with, in the order they were gifted: up to there, the memory can
+ * be reused.
+ */
+#define F_GETPIPE_GIFTED	(F_LINUX_SPECIFIC_BASE + 11)
+
 /*
  * Set/Get seals
  */
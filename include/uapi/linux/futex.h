@@ -23,7 +23,9 @@
 
 #define FUTEX_PRIVATE_FLAG	128
 #define FUTEX_CLOCK_REALTIME	256
-#define FUTEX_CMD_MASK		~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME)
+#define FUTEX_NUMA_FLAG		512
+#define FUTEX_CMD_MASK		~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME | \
+				  FUTEX_NUMA_FLAG)
 
 #define FUTEX_WAIT_PRIVATE	(FUTEX_WAIT | FUTEX_PRIVATE_FLAG)
 #define FUTEX_WAKE_PRIVATE	(FUTEX_WAKE | FUTEX_PRIVATE_FLAG)
@@ -40,6 +42,29 @@
 #define FUTEX_CMP_REQUEUE_PI_PRIVATE	(FUTEX_CMP_REQUEUE_PI | \
 					 FUTEX_PRIVATE_FLAG)
 
+/*
+ * With FUTEX_NUMA_FLAG, the futex is a pair of u32s, aligned to 8 bytes:
+ * the futex word and the node its waiters are hashed on.  A node of
+ * FUTEX_NO_NODE is replaced with the node of the first task to use the
+ * futex.  Not for the PI operations, nor for robust futexes.
+ */
+#define FUTEX_NO_NODE		((__u32)-1)
+
+/*
+ * futex_waitv() waits on up to FUTEX_WAITV_MAX of these at once.
+ * @flags is FUTEX_32, optionally with FUTEX_PRIVATE_FLAG and
+ * FUTEX_NUMA_FLAG.
+ */
+#define FUTEX_32		2
+#define FUTEX_WAITV_MAX		128
+
+struct futex_waitv {
+	__u64 val;
+	__u64 uaddr;
+	__u32 flags;
+	__u32 __reserved;
+};
+
 /*
  * Support for robust futexes: the kernel cleans up held futexes at
  * thread exit time.
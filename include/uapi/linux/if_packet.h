@@ -56,6 +56,9 @@ struct sockaddr_ll {
 #define PACKET_QDISC_BYPASS		20
 #define PACKET_ROLLOVER_STATS		21
 #define PACKET_FANOUT_DATA		22
+#define PACKET_RX_QUEUE			23
+#define PACKET_WAKEUP			24
+#define PACKET_ZEROCOPY			25
 
 #define PACKET_FANOUT_HASH		0
 #define PACKET_FANOUT_LB		1
@@ -286,6 +289,21 @@ union tpacket_req_u {
 	struct tpacket_req3	req3;
 };
 
+/* PACKET_RX_QUEUE: feed a TPACKET_V3 rx ring from one rx queue */
+struct tpacket_rxq_req {
+	unsigned int	tp_queue;	/* rx queue, or -1 to unbind */
+	unsigned int	tp_flags;
+};
+
+#define TP_RXQ_CONSUME		0x1	/* frames taken go no further */
+#define TP_RXQ_DIRECT		0x80000000 /* getsockopt: fed by the driver */
+
+/* PACKET_WAKEUP: wake the reader once per tp_frames, or after tp_usecs */
+struct tpacket_wakeup_req {
+	unsigned int	tp_frames;	/* 0 or 1: on every frame */
+	unsigned int	tp_usecs;	/* at most this long after the first */
+};
+
 struct packet_mreq {
 	int		mr_ifindex;
 	unsigned short	mr_type;
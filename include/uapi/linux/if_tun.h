@@ -56,10 +56,13 @@
  */
 #define TUNSETVNETBE _IOW('T', 222, int)
 #define TUNGETVNETBE _IOR('T', 223, int)
+#define TUNWRITEFRAMES _IOW('T', 224, struct tun_frames)
+#define TUNREADFRAMES  _IOW('T', 225, struct tun_frames)
 
 /* TUNSETIFF ifr flags */
 #define IFF_TUN		0x0001
 #define IFF_TAP		0x0002
+#define IFF_NAPI	0x0010
 #define IFF_NO_PI	0x1000
 /* This flag has no real effect */
 #define IFF_ONE_QUEUE	0x2000
@@ -89,6 +92,23 @@ struct tun_pi {
 	__be16 proto;
 };
 
+/*
+ * Batched I/O (TUNWRITEFRAMES, TUNREADFRAMES): each frame is a buffer
+ * holding one packet, laid out as for write() and read().  On return
+ * from TUNREADFRAMES, len holds the size of the packet read into it.
+ */
+struct tun_frame {
+	__u64	addr;
+	__u32	len;
+	__u32	pad;
+};
+
+struct tun_frames {
+	__u32	count;
+	__u32	pad;
+	__u64	frames;		/* array of count struct tun_frame */
+};
+
 /*
  * Filter spec (used for SETXXFILTER ioctls)
  * This stuff is applicable only to the TAP (Ethernet) devices.
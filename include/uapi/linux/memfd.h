@@ -4,5 +4,14 @@
 /* flags for memfd_create(2) (unsigned int) */
 #define MFD_CLOEXEC		0x0001U
 #define MFD_ALLOW_SEALING	0x0002U
+#define MFD_HUGETLB		0x0004U
+
+/*
+ * With MFD_HUGETLB, the huge page size can be selected like with
+ * MAP_HUGETLB: the log2 of the size in bits [26:31], 0 for the default
+ * huge page size.
+ */
+#define MFD_HUGE_SHIFT		26
+#define MFD_HUGE_MASK		0x3f
 
 #endif /* _UAPI_LINUX_MEMFD_H */
@@ -41,5 +41,57 @@
 
 #endif
 
+#include <linux/types.h>
+
+/*
+ * stat_batch(2): the attributes of many names in one directory at once.
+ * The caller asks for a mask of STAT_BATCH_* fields; each entry comes
+ * back with the error of its lookup and the mask of the fields filled.
+ */
+#define STAT_BATCH_MODE		0x00000001U
+#define STAT_BATCH_NLINK	0x00000002U
+#define STAT_BATCH_UID		0x00000004U
+#define STAT_BATCH_GID		0x00000008U
+#define STAT_BATCH_RDEV		0x00000010U
+#define STAT_BATCH_SIZE		0x00000020U
+#define STAT_BATCH_BLOCKS	0x00000040U
+#define STAT_BATCH_ATIME	0x00000080U
+#define STAT_BATCH_MTIME	0x00000100U
+#define STAT_BATCH_CTIME	0x00000200U
+#define STAT_BATCH_INO		0x00000400U
+#define STAT_BATCH_DEV		0x00000800U
+#define STAT_BATCH_BLKSIZE	0x00001000U
+#define STAT_BATCH_ALL		0x00001fffU
+
+/* largest number of entries in one call */
+#define STAT_BATCH_MAX		1024
+
+struct stat_batch_time {
+	__s64	tv_sec;
+	__u32	tv_nsec;
+	__s32	__reserved;
+};
+
+struct stat_batch_entry {
+	__u64	name;		/* in: const char *, relative to dfd */
+	__s32	error;		/* out: 0 or -errno of the lookup */
+	__u32	mask;		/* out: STAT_BATCH_* fields filled in */
+	__u32	mode;
+	__u32	nlink;
+	__u32	uid;
+	__u32	gid;
+	__u32	rdev_major;
+	__u32	rdev_minor;
+	__u32	dev_major;
+	__u32	dev_minor;
+	__u64	ino;
+	__u64	size;
+	__u64	blocks;
+	__u32	blksize;
+	__u32	__spare;
+	struct stat_batch_time atime;
+	struct stat_batch_time mtime;
+	struct stat_batch_time ctime;
+};
 
 #endif /* _UAPI_LINUX_STAT_H */
@@ -33,7 +33,7 @@
  */
 
 
-#define TASKSTATS_VERSION	8
+#define TASKSTATS_VERSION	9
 #define TS_COMM_LEN		32	/* should be >= TASK_COMM_LEN
 					 * in linux/sched.h */
 
@@ -163,6 +163,11 @@ struct taskstats {
 	/* Delay waiting for memory reclaim */
 	__u64	freepages_count;
 	__u64	freepages_delay_total;
+	/* version 8 ends here */
+
+	/* Current memory usage, as in /proc/<pid>/statm */
+	__u64	rss;			/* resident set size, in KB */
+	__u64	vm;			/* address space size, in KB */
 };
 
 
@@ -170,6 +175,10 @@ struct taskstats {
  * Commands sent from userspace
  * Not versioned. New commands should only be inserted at the enum's end
  * prior to __TASKSTATS_CMD_MAX
+ *
+ * A TASKSTATS_CMD_GET with NLM_F_DUMP and no attributes answers with one
+ * TASKSTATS_CMD_NEW message per task of the caller's pid namespace, each
+ * with a TASKSTATS_TYPE_AGGR_PID of its pid and stats.
  */
 
 enum {
@@ -16,8 +16,10 @@
  * After implementing the respective features it will become:
  * #define UFFD_API_FEATURES (UFFD_FEATURE_PAGEFAULT_FLAG_WP | \
  *			      UFFD_FEATURE_EVENT_FORK)
+ * UFFD_FEATURE_PAGEFAULT_FLAG_WP is only reported by kernels whose
+ * architecture supports it.
  */
-#define UFFD_API_FEATURES (0)
+#define UFFD_API_FEATURES (UFFD_FEATURE_PAGEFAULT_FLAG_WP)
 #define UFFD_API_IOCTLS				\
 	((__u64)1 << _UFFDIO_REGISTER |		\
 	 (__u64)1 << _UFFDIO_UNREGISTER |	\
@@ -25,7 +27,11 @@
 #define UFFD_API_RANGE_IOCTLS			\
 	((__u64)1 << _UFFDIO_WAKE |		\
 	 (__u64)1 << _UFFDIO_COPY |		\
-	 (__u64)1 << _UFFDIO_ZEROPAGE)
+	 (__u64)1 << _UFFDIO_ZEROPAGE |		\
+	 (__u64)1 << _UFFDIO_COPYV)
+/* on top of UFFD_API_RANGE_IOCTLS for UFFDIO_REGISTER_MODE_WP ranges */
+#define UFFD_API_RANGE_IOCTLS_WP		\
+	((__u64)1 << _UFFDIO_WRITEPROTECT)
 
 /*
  * Valid ioctl command number range with this API is from 0x00 to
@@ -40,6 +46,8 @@
 #define _UFFDIO_WAKE			(0x02)
 #define _UFFDIO_COPY			(0x03)
 #define _UFFDIO_ZEROPAGE		(0x04)
+#define _UFFDIO_COPYV			(0x05)
+#define _UFFDIO_WRITEPROTECT		(0x06)
 #define _UFFDIO_API			(0x3F)
 
 /* userfaultfd ioctl ids */
@@ -56,6 +64,10 @@
 				      struct uffdio_copy)
 #define UFFDIO_ZEROPAGE		_IOWR(UFFDIO, _UFFDIO_ZEROPAGE,	\
 				      struct uffdio_zeropage)
+#define UFFDIO_COPYV		_IOWR(UFFDIO, _UFFDIO_COPYV,	\
+				      struct uffdio_copyv)
+#define UFFDIO_WRITEPROTECT	_IOWR(UFFDIO, _UFFDIO_WRITEPROTECT, \
+				      struct uffdio_writeprotect)
 
 /* read() structure */
 struct uffd_msg {
@@ -105,8 +117,8 @@ struct uffdio_api {
 	 * are to be considered implicitly always enabled in all kernels as
 	 * long as the uffdio_api.api requested matches UFFD_API.
 	 */
-#if 0 /* not available yet */
 #define UFFD_FEATURE_PAGEFAULT_FLAG_WP		(1<<0)
+#if 0 /* not available yet */
 #define UFFD_FEATURE_EVENT_FORK			(1<<1)
 #endif
 	__u64 features;
@@ -137,12 +149,12 @@ struct uffdio_copy {
 	__u64 src;
 	__u64 len;
 	/*
-	 * There will be a wrprotection flag later that allows to map
-	 * pages wrprotected on the fly. And such a flag will be
-	 * available if the wrprotection ioctl are implemented for the
-	 * range according to the uffdio_register.ioctls.
+	 * UFFDIO_COPY_MODE_WP maps the pages wrprotected on the fly,
+	 * it is available if UFFDIO_WRITEPROTECT is implemented for
+	 * the range according to the uffdio_register.ioctls.
 	 */
 #define UFFDIO_COPY_MODE_DONTWAKE		((__u64)1<<0)
+#define UFFDIO_COPY_MODE_WP			((__u64)1<<1)
 	__u64 mode;
 
 	/*
@@ -164,4 +176,41 @@ struct uffdio_zeropage {
 	__s64 zeropage;
 };
 
+/* one fault to resolve with UFFDIO_COPYV */
+struct uffdio_vec {
+	__u64 dst;
+	/* ignored for UFFDIO_VEC_ZEROPAGE */
+	__u64 src;
+	__u64 len;
+#define UFFDIO_VEC_ZEROPAGE			((__u64)1<<0)
+	__u64 flags;
+};
+
+struct uffdio_copyv {
+	/* user pointer to an array of nr_vec struct uffdio_vec */
+	__u64 vec;
+	__u64 nr_vec;
+#define UFFDIO_COPYV_MODE_DONTWAKE		((__u64)1<<0)
+	__u64 mode;
+
+	/*
+	 * "copy" is written by the ioctl and must be at the end: the
+	 * copy_from_user will not read the last 8 bytes.  It is the
+	 * number of bytes resolved over all the entries.
+	 */
+	__s64 copy;
+};
+
+struct uffdio_writeprotect {
+	struct uffdio_range range;
+	/*
+	 * UFFDIO_WRITEPROTECT_MODE_WP protects the range, without it
+	 * the range is unprotected and the faults waiting on it are
+	 * woken up unless UFFDIO_WRITEPROTECT_MODE_DONTWAKE is set.
+	 */
+#define UFFDIO_WRITEPROTECT_MODE_WP		((__u64)1<<0)
+#define UFFDIO_WRITEPROTECT_MODE_DONTWAKE	((__u64)1<<1)
+	__u64 mode;
+};
+
 #endif /* _LINUX_USERFAULTFD_H */
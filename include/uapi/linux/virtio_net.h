@@ -55,6 +55,8 @@
 #define VIRTIO_NET_F_MQ	22	/* Device supports Receive Flow
 					 * Steering */
 #define VIRTIO_NET_F_CTRL_MAC_ADDR 23	/* Set MAC address */
+#define VIRTIO_NET_F_VQ_NOTF_COAL 52	/* Device supports virtqueue
+					 * notification coalescing */
 
 #ifndef VIRTIO_NET_NO_LEGACY
 #define VIRTIO_NET_F_GSO	6	/* Host handles pkts w/ any GSO type */
@@ -242,4 +244,25 @@ struct virtio_net_ctrl_mq {
 #define VIRTIO_NET_CTRL_GUEST_OFFLOADS   5
 #define VIRTIO_NET_CTRL_GUEST_OFFLOADS_SET        0
 
+/*
+ * Control notification coalescing.
+ *
+ * With VIRTIO_NET_F_VQ_NOTF_COAL, the notifications of each virtqueue can
+ * be delayed by up to max_usecs, or until max_packets were used.  A zero
+ * in both turns coalescing off for the queue.
+ */
+struct virtio_net_ctrl_coal {
+	__le32 max_packets;
+	__le32 max_usecs;
+};
+
+struct virtio_net_ctrl_coal_vq {
+	__le16 vqn;
+	__le16 reserved;
+	struct virtio_net_ctrl_coal coal;
+};
+
+#define VIRTIO_NET_CTRL_NOTF_COAL		6
+ #define VIRTIO_NET_CTRL_NOTF_COAL_VQ_SET	2
+
 #endif /* _LINUX_VIRTIO_NET_H */
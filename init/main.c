@@ -43,6 +43,7 @@
 #include <linux/cgroup.h>
 #include <linux/efi.h>
 #include <linux/tick.h>
+#include <linux/sched/isolation.h>
 #include <linux/interrupt.h>
 #include <linux/taskstats_kern.h>
 #include <linux/delayacct.h>
@@ -584,6 +585,7 @@ asmlinkage __visible void __init start_kernel(void)
 	early_irq_init();
 	init_IRQ();
 	tick_init();
+	housekeeping_init();
 	rcu_init_nohz();
 	init_timers();
 	hrtimers_init();
@@ -820,6 +822,15 @@ extern initcall_t __initcall6_start[];
 extern initcall_t __initcall7_start[];
 extern initcall_t __initcall_end[];
 
+extern initcall_t __initcall0p_start[], __initcall0p_end[];
+extern initcall_t __initcall1p_start[], __initcall1p_end[];
+extern initcall_t __initcall2p_start[], __initcall2p_end[];
+extern initcall_t __initcall3p_start[], __initcall3p_end[];
+extern initcall_t __initcall4p_start[], __initcall4p_end[];
+extern initcall_t __initcall5p_start[], __initcall5p_end[];
+extern initcall_t __initcall6p_start[], __initcall6p_end[];
+extern initcall_t __initcall7p_start[], __initcall7p_end[];
+
 static initcall_t *initcall_levels[] __initdata = {
 	__initcall0_start,
 	__initcall1_start,
@@ -844,9 +855,183 @@ static char *initcall_level_names[] __initdata = {
 	"late",
 };
 
+/* The parallel initcalls of each level, see include/linux/init.h */
+static initcall_t *initcall_parallel_levels[][2] __initdata = {
+	{ __initcall0p_start, __initcall0p_end },
+	{ __initcall1p_start, __initcall1p_end },
+	{ __initcall2p_start, __initcall2p_end },
+	{ __initcall3p_start, __initcall3p_end },
+	{ __initcall4p_start, __initcall4p_end },
+	{ __initcall5p_start, __initcall5p_end },
+	{ __initcall6p_start, __initcall6p_end },
+	{ __initcall7p_start, __initcall7p_end },
+};
+
+static bool initcall_parallel __initdata = true;
+
+static int __init set_initcall_parallel(char *str)
+{
+	if (strtobool(str, &initcall_parallel))
+		return 0;
+	return 1;
+}
+__setup("initcall_parallel=", set_initcall_parallel);
+
+/*
+ * initcall_summary=<n> reports how long each initcall level took and the
+ * <n> slowest initcalls once all of them have run.  For a level with
+ * parallel initcalls the longest of them is on the critical path of the
+ * boot, the others only add to the work done.
+ */
+#define INITCALL_SUMMARY_MAX	32
+
+struct initcall_record {
+	initcall_t		fn;
+	s64			usecs;
+	int			level;
+	bool			parallel;
+};
+
+struct initcall_level_stats {
+	s64			usecs;
+	s64			parallel_usecs;
+	s64			parallel_work;
+	unsigned int		nr_parallel;
+	struct initcall_record	longest;
+};
+
+static unsigned int initcall_summary __initdata;
+static struct initcall_record slowest_initcalls[INITCALL_SUMMARY_MAX] __initdata;
+static unsigned int nr_slowest_initcalls __initdata;
+static struct initcall_level_stats initcall_level_stats[ARRAY_SIZE(initcall_parallel_levels)] __initdata;
+static DEFINE_SPINLOCK(initcall_summary_lock);
+
+static int __init set_initcall_summary(char *str)
+{
+	get_option(&str, &initcall_summary);
+	initcall_summary = min(initcall_summary, INITCALL_SUMMARY_MAX);
+	return 1;
+}
+__setup("initcall_summary=", set_initcall_summary);
+
+static void __init record_initcall(struct initcall_record *rec)
+{
+	struct initcall_level_stats *stats = &initcall_level_stats[rec->level];
+	unsigned int i;
+
+	spin_lock(&initcall_summary_lock);
+	if (rec->parallel) {
+		stats->nr_parallel++;
+		stats->parallel_work += rec->usecs;
+		if (rec->usecs >= stats->longest.usecs)
+			stats->longest = *rec;
+	}
+
+	/* keep the slowest initcalls sorted, slowest first */
+	for (i = nr_slowest_initcalls; i > 0; i--) {
+		if (slowest_initcalls[i - 1].usecs >= rec->usecs)
+			break;
+		if (i < initcall_summary)
+			slowest_initcalls[i] = slowest_initcalls[i - 1];
+	}
+	if (i < initcall_summary) {
+		slowest_initcalls[i] = *rec;
+		if (nr_slowest_initcalls < initcall_summary)
+			nr_slowest_initcalls++;
+	}
+	spin_unlock(&initcall_summary_lock);
+}
+
+static void __init do_timed_initcall(initcall_t fn, int level, bool parallel)
+{
+	struct initcall_record rec;
+	ktime_t calltime;
+
+	if (!initcall_summary) {
+		do_one_initcall(fn);
+		return;
+	}
+
+	calltime = ktime_get();
+	do_one_initcall(fn);
+
+	rec.fn = fn;
+	rec.usecs = ktime_us_delta(ktime_get(), calltime);
+	rec.level = level;
+	rec.parallel = parallel;
+	record_initcall(&rec);
+}
+
+static void __init print_initcall_summary(void)
+{
+	struct initcall_level_stats *stats;
+	unsigned int i;
+
+	if (!initcall_summary)
+		return;
+
+	pr_info("initcall summary:\n");
+	for (i = 0; i < ARRAY_SIZE(initcall_level_stats); i++) {
+		stats = &initcall_level_stats[i];
+		if (!stats->nr_parallel) {
+			pr_info("  %-8s %10lld usecs\n",
+				initcall_level_names[i], stats->usecs);
+			continue;
+		}
+		pr_info("  %-8s %10lld usecs, %u parallel initcalls took %lld usecs for %lld usecs of work, critical path %pF (%lld usecs)\n",
+			initcall_level_names[i], stats->usecs,
+			stats->nr_parallel, stats->parallel_usecs,
+			stats->parallel_work, stats->longest.fn,
+			stats->longest.usecs);
+	}
+
+	pr_info("slowest initcalls:\n");
+	for (i = 0; i < nr_slowest_initcalls; i++)
+		pr_info("  %10lld usecs %pF (%s%s)\n",
+			slowest_initcalls[i].usecs, slowest_initcalls[i].fn,
+			initcall_level_names[slowest_initcalls[i].level],
+			slowest_initcalls[i].parallel ? ", parallel" : "");
+}
+
+static ASYNC_DOMAIN_EXCLUSIVE(initcall_domain);
+static int parallel_initcall_level __initdata;
+
+static void __init do_parallel_initcall(void *data, async_cookie_t cookie)
+{
+	initcall_t *fn = data;
+
+	do_timed_initcall(*fn, parallel_initcall_level, true);
+}
+
+static void __init do_parallel_initcalls(int level)
+{
+	initcall_t *start = initcall_parallel_levels[level][0];
+	initcall_t *end = initcall_parallel_levels[level][1];
+	ktime_t calltime;
+	initcall_t *fn;
+
+	if (start == end)
+		return;
+
+	calltime = ktime_get();
+	if (initcall_parallel) {
+		parallel_initcall_level = level;
+		for (fn = start; fn < end; fn++)
+			async_schedule_domain(do_parallel_initcall, fn,
+					      &initcall_domain);
+		async_synchronize_full_domain(&initcall_domain);
+	} else {
+		for (fn = start; fn < end; fn++)
+			do_timed_initcall(*fn, level, true);
+	}
+	initcall_level_stats[level].parallel_usecs =
+		ktime_us_delta(ktime_get(), calltime);
+}
+
 static void __init do_initcall_level(int level)
 {
 	initcall_t *fn;
+	ktime_t calltime = ktime_get();
 
 	strcpy(initcall_command_line, saved_command_line);
 	parse_args(initcall_level_names[level],
@@ -855,8 +1040,18 @@ static void __init do_initcall_level(int level)
 		   level, level,
 		   NULL, &repair_env_string);
 
-	for (fn = initcall_levels[level]; fn < initcall_levels[level+1]; fn++)
-		do_one_initcall(*fn);
+	for (fn = initcall_levels[level];
+	     fn < initcall_parallel_levels[level][0]; fn++)
+		do_timed_initcall(*fn, level, false);
+
+	do_parallel_initcalls(level);
+
+	for (fn = initcall_parallel_levels[level][1];
+	     fn < initcall_levels[level+1]; fn++)
+		do_timed_initcall(*fn, level, false);
+
+	initcall_level_stats[level].usecs =
+		ktime_us_delta(ktime_get(), calltime);
 }
 
 static void __init do_initcalls(void)
@@ -865,6 +1060,8 @@ static void __init do_initcalls(void)
 
 	for (level = 0; level < ARRAY_SIZE(initcall_levels) - 1; level++)
 		do_initcall_level(level);
+
+	print_initcall_summary();
 }
 
 /*
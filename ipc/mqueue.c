@@ -68,6 +68,7 @@ struct mqueue_inode_info {
 	wait_queue_head_t wait_q;
 
 	struct rb_root msg_tree;
+	struct posix_msg_tree_node *msg_tree_rightmost;	/* highest priority */
 	struct posix_msg_tree_node *node_cache;
 	struct mq_attr attr;
 
@@ -121,6 +122,12 @@ static int msg_insert(struct msg_msg *msg, struct mqueue_inode_info *info)
 {
 	struct rb_node **p, *parent = NULL;
 	struct posix_msg_tree_node *leaf;
+	bool rightmost = true;
+
+	/* Most queues only ever see one priority: skip the walk for it */
+	leaf = info->msg_tree_rightmost;
+	if (leaf && likely(leaf->priority == msg->m_type))
+		goto insert_msg;
 
 	p = &info->msg_tree.rb_node;
 	while (*p) {
@@ -129,9 +136,10 @@ static int msg_insert(struct msg_msg *msg, struct mqueue_inode_info *info)
 
 		if (likely(leaf->priority == msg->m_type))
 			goto insert_msg;
-		else if (msg->m_type < leaf->priority)
+		else if (msg->m_type < leaf->priority) {
 			p = &(*p)->rb_left;
-		else
+			rightmost = false;
+		} else
 			p = &(*p)->rb_right;
 	}
 	if (info->node_cache) {
@@ -144,6 +152,8 @@ static int msg_insert(struct msg_msg *msg, struct mqueue_inode_info *info)
 		INIT_LIST_HEAD(&leaf->msg_list);
 	}
 	leaf->priority = msg->m_type;
+	if (rightmost)
+		info->msg_tree_rightmost = leaf;
 	rb_link_node(&leaf->rb_node, parent, p);
 	rb_insert_color(&leaf->rb_node, &info->msg_tree);
 insert_msg:
@@ -153,24 +163,39 @@ insert_msg:
 	return 0;
 }
 
+static void msg_tree_erase(struct posix_msg_tree_node *leaf,
+			   struct mqueue_inode_info *info)
+{
+	struct rb_node *node = &leaf->rb_node;
+
+	if (info->msg_tree_rightmost == leaf) {
+		node = rb_prev(node);
+		info->msg_tree_rightmost = node ?
+			rb_entry(node, struct posix_msg_tree_node, rb_node) :
+			NULL;
+	}
+	rb_erase(&leaf->rb_node, &info->msg_tree);
+	if (info->node_cache) {
+		kfree(leaf);
+	} else {
+		info->node_cache = leaf;
+	}
+}
+
 static inline struct msg_msg *msg_get(struct mqueue_inode_info *info)
 {
-	struct rb_node **p, *parent = NULL;
 	struct posix_msg_tree_node *leaf;
 	struct msg_msg *msg;
 
 try_again:
-	p = &info->msg_tree.rb_node;
-	while (*p) {
-		parent = *p;
-		/*
-		 * During insert, low priorities go to the left and high to the
-		 * right.  On receive, we want the highest priorities first, so
-		 * walk all the way to the right.
-		 */
-		p = &(*p)->rb_right;
-	}
-	if (!parent) {
+	/*
+	 * During insert, low priorities go to the left and high to the
+	 * right.  On receive, we want the highest priorities first, which
+	 * is the rightmost node msg_insert() and msg_tree_erase() keep track
+	 * of.
+	 */
+	leaf = info->msg_tree_rightmost;
+	if (!leaf) {
 		if (info->attr.mq_curmsgs) {
 			pr_warn_once("Inconsistency in POSIX message queue, "
 				     "no tree element, but supposedly messages "
@@ -179,30 +204,18 @@ try_again:
 		}
 		return NULL;
 	}
-	leaf = rb_entry(parent, struct posix_msg_tree_node, rb_node);
 	if (unlikely(list_empty(&leaf->msg_list))) {
 		pr_warn_once("Inconsistency in POSIX message queue, "
 			     "empty leaf node but we haven't implemented "
 			     "lazy leaf delete!\n");
-		rb_erase(&leaf->rb_node, &info->msg_tree);
-		if (info->node_cache) {
-			kfree(leaf);
-		} else {
-			info->node_cache = leaf;
-		}
+		msg_tree_erase(leaf, info);
 		goto try_again;
 	} else {
 		msg = list_first_entry(&leaf->msg_list,
 				       struct msg_msg, m_list);
 		list_del(&msg->m_list);
-		if (list_empty(&leaf->msg_list)) {
-			rb_erase(&leaf->rb_node, &info->msg_tree);
-			if (info->node_cache) {
-				kfree(leaf);
-			} else {
-				info->node_cache = leaf;
-			}
-		}
+		if (list_empty(&leaf->msg_list))
+			msg_tree_erase(leaf, info);
 	}
 	info->attr.mq_curmsgs--;
 	info->qsize -= msg->m_ts;
@@ -244,6 +257,7 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 		info->qsize = 0;
 		info->user = NULL;	/* set when all is ok */
 		info->msg_tree = RB_ROOT;
+		info->msg_tree_rightmost = NULL;
 		info->node_cache = NULL;
 		memset(&info->attr, 0, sizeof(info->attr));
 		info->attr.mq_maxmsg = min(ipc_ns->mq_msg_max,
@@ -1007,6 +1021,17 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 		goto out_fput;
 	}
 
+	/*
+	 * Don't copy in the message just to find the queue full: without the
+	 * lock this may miss a receiver making room, but then the send just
+	 * happened before it.
+	 */
+	if ((f.file->f_flags & O_NONBLOCK) &&
+	    READ_ONCE(info->attr.mq_curmsgs) == info->attr.mq_maxmsg) {
+		ret = -EAGAIN;
+		goto out_fput;
+	}
+
 	/* First try to allocate memory, before doing anything with
 	 * existing queues. */
 	msg_ptr = load_msg(u_msg_ptr, msg_len);
@@ -1124,6 +1149,13 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 		goto out_fput;
 	}
 
+	/* Polling an empty queue needs no lock, see mq_timedsend() */
+	if ((f.file->f_flags & O_NONBLOCK) &&
+	    !READ_ONCE(info->attr.mq_curmsgs)) {
+		ret = -EAGAIN;
+		goto out_fput;
+	}
+
 	/*
 	 * msg_insert really wants us to have a valid, spare node struct so
 	 * it doesn't have to kmalloc a GFP_ATOMIC allocation, but it will
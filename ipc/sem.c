@@ -291,6 +291,8 @@ static void sem_wait_array(struct sem_array *sma)
 /*
  * If the request contains only one semaphore operation, and there are
  * no complex transactions pending, lock only the semaphore involved.
+ * semtimedop() also passes nsops == 1 for several operations on the
+ * same semaphore, until it finds they have to sleep.
  * Otherwise, lock the entire semaphore array, since we either have
  * multiple semaphores in our own semops, or we need to look at
  * semaphores from other pending complex operations.
@@ -1797,7 +1799,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	struct sembuf fast_sops[SEMOPM_FAST];
 	struct sembuf *sops = fast_sops, *sop;
 	struct sem_undo *un;
-	int undos = 0, alter = 0, max, locknum;
+	int undos = 0, alter = 0, single = 1, max, locknum;
 	struct sem_queue queue;
 	unsigned long jiffies_left = 0;
 	struct ipc_namespace *ns;
@@ -1839,6 +1841,8 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 			undos = 1;
 		if (sop->sem_op != 0)
 			alter = 1;
+		if (sop->sem_num != sops->sem_num)
+			single = 0;
 	}
 
 	INIT_LIST_HEAD(&tasks);
@@ -1874,8 +1878,13 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	if (error)
 		goto out_rcu_wakeup;
 
+	/*
+	 * Operations that all address the same semaphore can get away with
+	 * just its lock as long as they don't have to sleep, see below.
+	 */
+	locknum = sem_lock(sma, sops, single ? 1 : nsops);
+relock:
 	error = -EIDRM;
-	locknum = sem_lock(sma, sops, nsops);
 	/*
 	 * We eventually might perform the following check in a lockless
 	 * fashion, considering ipc_valid_object() locking constraints.
@@ -1915,6 +1924,16 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	if (error <= 0)
 		goto out_unlock_free;
 
+	/*
+	 * Sleeping multi-sop operations are queued on the global queues,
+	 * which need the full lock: retry with it.
+	 */
+	if (nsops > 1 && locknum != -1) {
+		sem_unlock(sma, locknum);
+		locknum = sem_lock(sma, sops, nsops);
+		goto relock;
+	}
+
 	/* We need to sleep on this operation, so we put the current
 	 * task into the pending queue and go to sleep.
 	 */
@@ -13,38 +13,149 @@
 #include <linux/jhash.h>
 #include <linux/filter.h>
 #include <linux/vmalloc.h>
+#include <linux/percpu.h>
 
 struct bpf_htab {
 	struct bpf_map map;
 	struct hlist_head *buckets;
 	raw_spinlock_t lock;
+	void *elems;			/* preallocated elements, if any */
+	struct list_head free_list;	/* unused preallocated elements */
+	struct list_head lru_list;	/* LRU maps: most recently added first */
 	u32 count;	/* number of elements in this hashtable */
 	u32 n_buckets;	/* number of hash buckets */
 	u32 elem_size;	/* size of each element in bytes */
 };
 
-/* each htab element is struct htab_elem + key + value */
+/* each htab element is struct htab_elem + key + value, where for per-cpu
+ * maps the value is the pointer to the per-cpu copies of it
+ */
 struct htab_elem {
 	struct hlist_node hash_node;
-	struct rcu_head rcu;
+	union {
+		struct {	/* BPF_F_NO_PREALLOC: being freed */
+			struct rcu_head rcu;
+			struct bpf_htab *htab;
+		};
+		/* preallocated: on free_list, or in use on lru_list */
+		struct list_head list_node;
+	};
 	u32 hash;
+	u32 lru_ref;	/* LRU maps: looked up since the last eviction scan */
 	char key[0] __aligned(8);
 };
 
+/* an eviction looks at no more than this many elements before it settles */
+#define HTAB_LRU_SCAN_MAX	64
+
+static bool htab_is_percpu(const struct bpf_htab *htab)
+{
+	return htab->map.map_type == BPF_MAP_TYPE_PERCPU_HASH;
+}
+
+static bool htab_is_lru(const struct bpf_htab *htab)
+{
+	return htab->map.map_type == BPF_MAP_TYPE_LRU_HASH;
+}
+
+static bool htab_is_prealloc(const struct bpf_htab *htab)
+{
+	return !(htab->map.map_flags & BPF_F_NO_PREALLOC);
+}
+
+static inline void htab_elem_set_ptr(struct htab_elem *l, u32 key_size,
+				     void __percpu *pptr)
+{
+	*(void __percpu **)(l->key + key_size) = pptr;
+}
+
+static inline void __percpu *htab_elem_get_ptr(struct htab_elem *l, u32 key_size)
+{
+	return *(void __percpu **)(l->key + key_size);
+}
+
+static struct htab_elem *get_htab_elem(struct bpf_htab *htab, int i)
+{
+	return (struct htab_elem *) (htab->elems + i * htab->elem_size);
+}
+
+/* one element more than max_entries, so that an update of an existing
+ * element of a full map has a new one to put in place of the old
+ */
+static u32 htab_prealloc_cnt(const struct bpf_htab *htab)
+{
+	return htab->map.max_entries + 1;
+}
+
+static void htab_free_elems(struct bpf_htab *htab)
+{
+	int i;
+
+	if (htab_is_percpu(htab)) {
+		for (i = 0; i < htab_prealloc_cnt(htab); i++)
+			free_percpu(htab_elem_get_ptr(get_htab_elem(htab, i),
+						      round_up(htab->map.key_size, 8)));
+	}
+	vfree(htab->elems);
+}
+
+static int prealloc_elems(struct bpf_htab *htab)
+{
+	u32 num_entries = htab_prealloc_cnt(htab);
+	int i;
+
+	htab->elems = vzalloc(htab->elem_size * num_entries);
+	if (!htab->elems)
+		return -ENOMEM;
+
+	for (i = 0; i < num_entries; i++) {
+		struct htab_elem *l = get_htab_elem(htab, i);
+		void __percpu *pptr;
+
+		if (htab_is_percpu(htab)) {
+			pptr = __alloc_percpu_gfp(round_up(htab->map.value_size, 8),
+						  8, GFP_USER | __GFP_NOWARN);
+			if (!pptr)
+				goto free_elems;
+			htab_elem_set_ptr(l, round_up(htab->map.key_size, 8),
+					  pptr);
+		}
+		list_add_tail(&l->list_node, &htab->free_list);
+	}
+	return 0;
+
+free_elems:
+	htab_free_elems(htab);
+	return -ENOMEM;
+}
+
 /* Called from syscall */
 static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 {
+	bool percpu = attr->map_type == BPF_MAP_TYPE_PERCPU_HASH;
+	bool lru = attr->map_type == BPF_MAP_TYPE_LRU_HASH;
 	struct bpf_htab *htab;
+	u64 cost;
 	int err, i;
 
+	if (attr->map_flags & ~BPF_F_NO_PREALLOC)
+		/* reserved bits should not be used */
+		return ERR_PTR(-EINVAL);
+
+	if (lru && (attr->map_flags & BPF_F_NO_PREALLOC))
+		/* evicting on the way in needs every element to exist already */
+		return ERR_PTR(-EINVAL);
+
 	htab = kzalloc(sizeof(*htab), GFP_USER);
 	if (!htab)
 		return ERR_PTR(-ENOMEM);
 
 	/* mandatory map attributes */
+	htab->map.map_type = attr->map_type;
 	htab->map.key_size = attr->key_size;
 	htab->map.value_size = attr->value_size;
 	htab->map.max_entries = attr->max_entries;
+	htab->map.map_flags = attr->map_flags;
 
 	/* check sanity of attributes.
 	 * value_size == 0 may be allowed in the future to use map as a set
@@ -73,24 +184,33 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 		 */
 		goto free_htab;
 
+	if (percpu && round_up(htab->map.value_size, 8) > PCPU_MIN_UNIT_SIZE)
+		/* make sure the size for pcpu_alloc() is reasonable */
+		goto free_htab;
+
 	htab->elem_size = sizeof(struct htab_elem) +
-			  round_up(htab->map.key_size, 8) +
-			  htab->map.value_size;
+			  round_up(htab->map.key_size, 8);
+	if (percpu)
+		htab->elem_size += sizeof(void *);
+	else
+		htab->elem_size += round_up(htab->map.value_size, 8);
 
 	/* prevent zero size kmalloc and check for u32 overflow */
 	if (htab->n_buckets == 0 ||
 	    htab->n_buckets > U32_MAX / sizeof(struct hlist_head))
 		goto free_htab;
 
-	if ((u64) htab->n_buckets * sizeof(struct hlist_head) +
-	    (u64) htab->elem_size * htab->map.max_entries >=
-	    U32_MAX - PAGE_SIZE)
+	cost = (u64) htab->n_buckets * sizeof(struct hlist_head) +
+	       (u64) htab->elem_size * htab_prealloc_cnt(htab);
+	if (percpu)
+		cost += (u64) round_up(htab->map.value_size, 8) *
+			num_possible_cpus() * htab_prealloc_cnt(htab);
+
+	if (cost >= U32_MAX - PAGE_SIZE)
 		/* make sure page count doesn't overflow */
 		goto free_htab;
 
-	htab->map.pages = round_up(htab->n_buckets * sizeof(struct hlist_head) +
-				   htab->elem_size * htab->map.max_entries,
-				   PAGE_SIZE) >> PAGE_SHIFT;
+	htab->map.pages = round_up(cost, PAGE_SIZE) >> PAGE_SHIFT;
 
 	err = -ENOMEM;
 	htab->buckets = kmalloc_array(htab->n_buckets, sizeof(struct hlist_head),
@@ -107,9 +227,19 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 
 	raw_spin_lock_init(&htab->lock);
 	htab->count = 0;
+	INIT_LIST_HEAD(&htab->free_list);
+	INIT_LIST_HEAD(&htab->lru_list);
+
+	if (htab_is_prealloc(htab)) {
+		err = prealloc_elems(htab);
+		if (err)
+			goto free_buckets;
+	}
 
 	return &htab->map;
 
+free_buckets:
+	kvfree(htab->buckets);
 free_htab:
 	kfree(htab);
 	return ERR_PTR(err);
@@ -138,11 +268,10 @@ static struct htab_elem *lookup_elem_raw(struct hlist_head *head, u32 hash,
 }
 
 /* Called from syscall or from eBPF program */
-static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
+static struct htab_elem *__htab_map_lookup_elem(struct bpf_map *map, void *key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct hlist_head *head;
-	struct htab_elem *l;
 	u32 hash, key_size;
 
 	/* Must be called with rcu_read_lock. */
@@ -154,7 +283,12 @@ static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
 
 	head = select_bucket(htab, hash);
 
-	l = lookup_elem_raw(head, hash, key, key_size);
+	return lookup_elem_raw(head, hash, key, key_size);
+}
+
+static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct htab_elem *l = __htab_map_lookup_elem(map, key);
 
 	if (l)
 		return l->key + round_up(map->key_size, 8);
@@ -162,6 +296,30 @@ static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
 	return NULL;
 }
 
+static void *htab_percpu_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct htab_elem *l = __htab_map_lookup_elem(map, key);
+
+	if (l)
+		return this_cpu_ptr(htab_elem_get_ptr(l, round_up(map->key_size, 8)));
+
+	return NULL;
+}
+
+static void *htab_lru_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct htab_elem *l = __htab_map_lookup_elem(map, key);
+
+	if (l) {
+		/* don't dirty the cache line of an element already marked */
+		if (!READ_ONCE(l->lru_ref))
+			WRITE_ONCE(l->lru_ref, 1);
+		return l->key + round_up(map->key_size, 8);
+	}
+
+	return NULL;
+}
+
 /* Called from syscall */
 static int htab_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
 {
@@ -220,15 +378,153 @@ find_first_elem:
 	return -ENOENT;
 }
 
-/* Called from syscall or from eBPF program */
-static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
-				u64 map_flags)
+static void htab_elem_free_rcu(struct rcu_head *head)
+{
+	struct htab_elem *l = container_of(head, struct htab_elem, rcu);
+	struct bpf_htab *htab = l->htab;
+
+	if (htab_is_percpu(htab))
+		free_percpu(htab_elem_get_ptr(l, round_up(htab->map.key_size, 8)));
+	kfree(l);
+}
+
+/* Called with htab->lock held, once @l is off its hash list.
+ * A preallocated element may be reused right away, so a program that
+ * looked it up just before can see it change under it, as it could
+ * with an update of the element in place.
+ */
+static void free_htab_elem(struct bpf_htab *htab, struct htab_elem *l)
+{
+	if (htab_is_prealloc(htab)) {
+		if (htab_is_lru(htab))
+			list_move(&l->list_node, &htab->free_list);
+		else
+			list_add(&l->list_node, &htab->free_list);
+	} else {
+		l->htab = htab;
+		call_rcu(&l->rcu, htab_elem_free_rcu);
+	}
+}
+
+/*
+ * Called with htab->lock held, for a new element of a full LRU map.
+ * The elements are on lru_list in the order they were added, and a
+ * lookup marks one referenced: the scan from the oldest end gives
+ * referenced elements a second chance at the head, and evicts the
+ * first one not looked up since it was last passed.
+ */
+static void htab_lru_evict(struct bpf_htab *htab)
+{
+	struct htab_elem *l;
+	int i;
+
+	for (i = 0; i < HTAB_LRU_SCAN_MAX; i++) {
+		l = list_last_entry(&htab->lru_list, struct htab_elem, list_node);
+		if (!l->lru_ref)
+			break;
+		l->lru_ref = 0;
+		list_move(&l->list_node, &htab->lru_list);
+	}
+
+	/* everything recently used: the oldest one goes */
+	l = list_last_entry(&htab->lru_list, struct htab_elem, list_node);
+	hlist_del_rcu(&l->hash_node);
+	htab->count--;
+	free_htab_elem(htab, l);
+}
+
+static void pcpu_copy_value(struct bpf_htab *htab, void __percpu *pptr,
+			    void *value, bool onallcpus)
+{
+	u32 size = round_up(htab->map.value_size, 8);
+	int off = 0, cpu;
+
+	if (!onallcpus) {
+		/* a program only ever writes the copy of the cpu it runs on */
+		memcpy(this_cpu_ptr(pptr), value, htab->map.value_size);
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		memcpy(per_cpu_ptr(pptr, cpu), value + off, size);
+		off += size;
+	}
+}
+
+/* a new element from a program starts out zero on the other cpus */
+static void pcpu_init_value(struct bpf_htab *htab, void __percpu *pptr,
+			    void *value, bool onallcpus)
+{
+	u32 size = round_up(htab->map.value_size, 8);
+	int cpu;
+
+	if (onallcpus) {
+		pcpu_copy_value(htab, pptr, value, true);
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		if (cpu == smp_processor_id())
+			memcpy(per_cpu_ptr(pptr, cpu), value,
+			       htab->map.value_size);
+		else
+			memset(per_cpu_ptr(pptr, cpu), 0, size);
+	}
+}
+
+/* Called with htab->lock held */
+static struct htab_elem *alloc_htab_elem(struct bpf_htab *htab, void *key,
+					 void *value, u32 hash, bool onallcpus)
+{
+	u32 key_size = htab->map.key_size;
+	void __percpu *pptr;
+	struct htab_elem *l;
+
+	if (htab_is_prealloc(htab)) {
+		if (list_empty(&htab->free_list))
+			return ERR_PTR(-E2BIG);
+		l = list_first_entry(&htab->free_list, struct htab_elem,
+				     list_node);
+		list_del(&l->list_node);
+		if (htab_is_lru(htab)) {
+			l->lru_ref = 0;
+			list_add(&l->list_node, &htab->lru_list);
+		}
+	} else {
+		l = kmalloc(htab->elem_size, GFP_ATOMIC | __GFP_NOWARN);
+		if (!l)
+			return ERR_PTR(-ENOMEM);
+		if (htab_is_percpu(htab)) {
+			pptr = __alloc_percpu_gfp(round_up(htab->map.value_size, 8),
+						  8, GFP_ATOMIC | __GFP_NOWARN);
+			if (!pptr) {
+				kfree(l);
+				return ERR_PTR(-ENOMEM);
+			}
+			htab_elem_set_ptr(l, round_up(key_size, 8), pptr);
+		}
+	}
+
+	memcpy(l->key, key, key_size);
+	if (htab_is_percpu(htab))
+		pcpu_init_value(htab, htab_elem_get_ptr(l, round_up(key_size, 8)),
+				value, onallcpus);
+	else
+		memcpy(l->key + round_up(key_size, 8), value,
+		       htab->map.value_size);
+
+	l->hash = hash;
+	return l;
+}
+
+static int __htab_map_update_elem(struct bpf_map *map, void *key, void *value,
+				  u64 map_flags, bool onallcpus)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct htab_elem *l_new, *l_old;
 	struct hlist_head *head;
 	unsigned long flags;
-	u32 key_size;
+	u32 hash, key_size;
 	int ret;
 
 	if (map_flags > BPF_EXIST)
@@ -237,26 +533,19 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 
 	WARN_ON_ONCE(!rcu_read_lock_held());
 
-	/* allocate new element outside of lock */
-	l_new = kmalloc(htab->elem_size, GFP_ATOMIC | __GFP_NOWARN);
-	if (!l_new)
-		return -ENOMEM;
-
 	key_size = map->key_size;
 
-	memcpy(l_new->key, key, key_size);
-	memcpy(l_new->key + round_up(key_size, 8), value, map->value_size);
-
-	l_new->hash = htab_map_hash(l_new->key, key_size);
+	hash = htab_map_hash(key, key_size);
 
 	/* bpf_map_update_elem() can be called in_irq() */
 	raw_spin_lock_irqsave(&htab->lock, flags);
 
-	head = select_bucket(htab, l_new->hash);
+	head = select_bucket(htab, hash);
 
-	l_old = lookup_elem_raw(head, l_new->hash, key, key_size);
+	l_old = lookup_elem_raw(head, hash, key, key_size);
 
-	if (!l_old && unlikely(htab->count >= map->max_entries)) {
+	if (!l_old && unlikely(htab->count >= map->max_entries) &&
+	    !htab_is_lru(htab)) {
 		/* if elem with this 'key' doesn't exist and we've reached
 		 * max_entries limit, fail insertion of new elem
 		 */
@@ -276,25 +565,47 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 		goto err;
 	}
 
+	if (l_old && htab_is_percpu(htab)) {
+		/* per-cpu values are updated in place */
+		pcpu_copy_value(htab, htab_elem_get_ptr(l_old, round_up(key_size, 8)),
+				value, onallcpus);
+		ret = 0;
+		goto err;
+	}
+
+	if (!l_old && unlikely(htab->count >= map->max_entries))
+		/* a full LRU map makes room for the new elem instead */
+		htab_lru_evict(htab);
+
+	l_new = alloc_htab_elem(htab, key, value, hash, onallcpus);
+	if (IS_ERR(l_new)) {
+		ret = PTR_ERR(l_new);
+		goto err;
+	}
+
 	/* add new element to the head of the list, so that concurrent
 	 * search will find it before old elem
 	 */
 	hlist_add_head_rcu(&l_new->hash_node, head);
 	if (l_old) {
 		hlist_del_rcu(&l_old->hash_node);
-		kfree_rcu(l_old, rcu);
+		free_htab_elem(htab, l_old);
 	} else {
 		htab->count++;
 	}
-	raw_spin_unlock_irqrestore(&htab->lock, flags);
-
-	return 0;
+	ret = 0;
 err:
 	raw_spin_unlock_irqrestore(&htab->lock, flags);
-	kfree(l_new);
 	return ret;
 }
 
+/* Called from syscall or from eBPF program */
+static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
+				u64 map_flags)
+{
+	return __htab_map_update_elem(map, key, value, map_flags, false);
+}
+
 /* Called from syscall or from eBPF program */
 static int htab_map_delete_elem(struct bpf_map *map, void *key)
 {
@@ -320,7 +631,7 @@ static int htab_map_delete_elem(struct bpf_map *map, void *key)
 	if (l) {
 		hlist_del_rcu(&l->hash_node);
 		htab->count--;
-		kfree_rcu(l, rcu);
+		free_htab_elem(htab, l);
 		ret = 0;
 	}
 
@@ -340,6 +651,9 @@ static void delete_all_elements(struct bpf_htab *htab)
 		hlist_for_each_entry_safe(l, n, head, hash_node) {
 			hlist_del_rcu(&l->hash_node);
 			htab->count--;
+			if (htab_is_percpu(htab))
+				free_percpu(htab_elem_get_ptr(l,
+						round_up(htab->map.key_size, 8)));
 			kfree(l);
 		}
 	}
@@ -357,10 +671,17 @@ static void htab_map_free(struct bpf_map *map)
 	 */
 	synchronize_rcu();
 
-	/* some of kfree_rcu() callbacks for elements of this map may not have
-	 * executed. It's ok. Proceed to free residual elements and map itself
-	 */
-	delete_all_elements(htab);
+	if (htab_is_prealloc(htab)) {
+		/* all elements live in htab->elems, in use or not */
+		htab_free_elems(htab);
+	} else {
+		/* some of the free_htab_elem() callbacks for elements of
+		 * this map may not have executed yet, and they need htab.
+		 * Wait for them, then free the residual elements
+		 */
+		rcu_barrier();
+		delete_all_elements(htab);
+	}
 	kvfree(htab->buckets);
 	kfree(htab);
 }
@@ -379,9 +700,81 @@ static struct bpf_map_type_list htab_type __read_mostly = {
 	.type = BPF_MAP_TYPE_HASH,
 };
 
+/* Called from syscall, @value holds round_up(value_size, 8) per possible cpu */
+int bpf_percpu_hash_copy(struct bpf_map *map, void *key, void *value)
+{
+	struct htab_elem *l;
+	void __percpu *pptr;
+	int ret = -ENOENT;
+	int cpu, off = 0;
+	u32 size;
+
+	/* per-cpu areas are zero-filled and programs can only write
+	 * value_size of them, so copying the rounded up size doesn't
+	 * leak any kernel data
+	 */
+	size = round_up(map->value_size, 8);
+	rcu_read_lock();
+	l = __htab_map_lookup_elem(map, key);
+	if (!l)
+		goto out;
+	pptr = htab_elem_get_ptr(l, round_up(map->key_size, 8));
+	for_each_possible_cpu(cpu) {
+		memcpy(value + off, per_cpu_ptr(pptr, cpu), size);
+		off += size;
+	}
+	ret = 0;
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+/* Called from syscall, @value as for bpf_percpu_hash_copy() */
+int bpf_percpu_hash_update(struct bpf_map *map, void *key, void *value,
+			   u64 map_flags)
+{
+	int ret;
+
+	rcu_read_lock();
+	ret = __htab_map_update_elem(map, key, value, map_flags, true);
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static const struct bpf_map_ops htab_percpu_ops = {
+	.map_alloc = htab_map_alloc,
+	.map_free = htab_map_free,
+	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_elem = htab_percpu_map_lookup_elem,
+	.map_update_elem = htab_map_update_elem,
+	.map_delete_elem = htab_map_delete_elem,
+};
+
+static struct bpf_map_type_list htab_percpu_type __read_mostly = {
+	.ops = &htab_percpu_ops,
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+};
+
+static const struct bpf_map_ops htab_lru_ops = {
+	.map_alloc = htab_map_alloc,
+	.map_free = htab_map_free,
+	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_elem = htab_lru_map_lookup_elem,
+	.map_update_elem = htab_map_update_elem,
+	.map_delete_elem = htab_map_delete_elem,
+};
+
+static struct bpf_map_type_list htab_lru_type __read_mostly = {
+	.ops = &htab_lru_ops,
+	.type = BPF_MAP_TYPE_LRU_HASH,
+};
+
 static int __init register_htab_map(void)
 {
 	bpf_register_map_type(&htab_type);
+	bpf_register_map_type(&htab_percpu_type);
+	bpf_register_map_type(&htab_lru_type);
 	return 0;
 }
 late_initcall(register_htab_map);
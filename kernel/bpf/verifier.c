@@ -30,10 +30,17 @@
  * - out of bounds or malformed jumps
  * The second pass is all possible path descent from the 1st insn.
  * Since it's analyzing all pathes through the program, the length of the
- * analysis is limited to 32k insn, which may be hit even if total number of
+ * analysis is limited to 128k insn, which may be hit even if total number of
  * insn is less then 4K, but there are too many branches that change stack/regs.
  * Number of 'branches to be analyzed' is limited to 1k
  *
+ * To keep that number down, the verifier remembers the state it had at
+ * branch targets and prunes a path when it reaches a target in a state
+ * that is no less strict than one already proven safe there. Registers
+ * and spilled stack slots that the continuation from the old state never
+ * read before writing them don't take part in that comparison, see
+ * mark_reg_read() and states_equal().
+ *
  * On entry to each instruction, each register has a type, and the instruction
  * changes the types of the registers depending on instruction semantics.
  * If instruction is BPF_MOV64_REG(BPF_REG_1, BPF_REG_5), then type of R5 is
@@ -123,6 +130,14 @@
  *
  * After the call R0 is set to return type of the function and registers R1-R5
  * are set to NOT_INIT to indicate that they are no longer readable.
+ *
+ * A program can also call functions of its own: BPF_CALL with src_reg
+ * BPF_PSEUDO_CALL calls the function starting at insn + imm + 1. The callee
+ * gets R1-R5 of the caller, a frame pointer and a stack of its own, and
+ * returns R0 to the caller on bpf_exit, like a helper would. The verifier
+ * walks the callee at every call, with the state of the caller kept aside,
+ * see check_func_call(). A callee may use pointers into the stack of its
+ * callers, but never hand pointers into its own stack back.
  */
 
 /* types of values stored in eBPF registers */
@@ -138,6 +153,12 @@ enum bpf_reg_type {
 	CONST_IMM,		 /* constant integer value */
 };
 
+enum reg_liveness {
+	REG_LIVE_NONE = 0,	/* reg wasn't read or written since last state */
+	REG_LIVE_READ,		/* reg was read, its value at this state matters */
+	REG_LIVE_WRITTEN,	/* reg was written first, screening off later reads */
+};
+
 struct reg_state {
 	enum bpf_reg_type type;
 	union {
@@ -149,6 +170,12 @@ struct reg_state {
 		 */
 		struct bpf_map *map_ptr;
 	};
+	/* valid when type == FRAME_PTR | PTR_TO_STACK: whose stack */
+	u32 frameno;
+	/* liveness, not part of the value: must stay last, see regsafe() */
+	enum reg_liveness live;
+	/* the same register in the explored state this one continues from */
+	struct reg_state *parent;
 };
 
 enum bpf_stack_slot_type {
@@ -166,6 +193,10 @@ struct verifier_state {
 	struct reg_state regs[MAX_BPF_REG];
 	u8 stack_slot_type[MAX_BPF_STACK];
 	struct reg_state spilled_regs[MAX_BPF_STACK / BPF_REG_SIZE];
+	/* state of the calling function, NULL in the main program */
+	struct verifier_state *caller;
+	int callsite;	/* the call insn that made this frame */
+	u32 frameno;	/* number of callers */
 };
 
 /* linked list of verifier states used to prune search */
@@ -188,6 +219,21 @@ struct verifier_stack_elem {
 
 #define MAX_USED_MAPS 64 /* max number of maps accessed by one eBPF program */
 
+#define BPF_COMPLEXITY_LIMIT_INSNS	131072 /* insns analyzed, all paths */
+#define BPF_COMPLEXITY_LIMIT_STACK	1024   /* branches pending analysis */
+
+/* every frame takes MAX_BPF_STACK of kernel stack when the program runs */
+#define MAX_CALL_FRAMES		4
+#define BPF_MAX_SUBPROGS	256
+
+/* what the verifier learns about an insn for the rewrites after it */
+struct bpf_insn_aux_data {
+	struct bpf_map *map_ptr;	/* map of a bpf_map_lookup_elem() call */
+};
+
+/* the call sees different maps on different paths */
+#define BPF_MAP_PTR_POISON ((void *)0xeB9F + POISON_POINTER_DELTA)
+
 /* single container for all structs
  * one verifier_env per bpf_check() call
  */
@@ -197,9 +243,17 @@ struct verifier_env {
 	int stack_size;			/* number of states to be processed */
 	struct verifier_state cur_state; /* current verifier state */
 	struct verifier_state_list **explored_states; /* search pruning optimization */
+	struct bpf_insn_aux_data *insn_aux_data; /* array of per-insn state */
+	u32 subprog_starts[BPF_MAX_SUBPROGS]; /* first insns of functions */
+	u32 subprog_cnt;		/* number of functions, main included */
 	struct bpf_map *used_maps[MAX_USED_MAPS]; /* array of map's used by eBPF program */
 	u32 used_map_cnt;		/* number of used maps */
 	bool allow_ptr_leaks;
+	/* statistics, reported at the end of the verifier log */
+	u32 insn_processed;		/* insns analyzed, all paths */
+	u32 total_states;		/* states remembered for pruning */
+	u32 pruned_states;		/* paths cut short by an equivalent state */
+	int peak_stack_size;		/* max number of branches pending */
 };
 
 /* verbose verifier prints what it's seeing
@@ -244,6 +298,8 @@ static void print_verifier_state(struct verifier_env *env)
 	enum bpf_reg_type t;
 	int i;
 
+	if (env->cur_state.frameno)
+		verbose(" frame%d", env->cur_state.frameno);
 	for (i = 0; i < MAX_BPF_REG; i++) {
 		t = env->cur_state.regs[i].type;
 		if (t == NOT_INIT)
@@ -410,6 +466,45 @@ static void print_bpf_insn(struct bpf_insn *insn)
 	}
 }
 
+static void free_caller_frames(struct verifier_state *state)
+{
+	struct verifier_state *frame = state->caller, *next;
+
+	while (frame) {
+		next = frame->caller;
+		kfree(frame);
+		frame = next;
+	}
+	state->caller = NULL;
+}
+
+/* copy 'src' into 'dst', along with the frames of its callers */
+static int copy_verifier_state(struct verifier_state *dst,
+			       const struct verifier_state *src)
+{
+	free_caller_frames(dst);
+	memcpy(dst, src, sizeof(*src));
+	dst->caller = NULL;
+
+	for (src = src->caller; src; src = src->caller, dst = dst->caller) {
+		dst->caller = kmemdup(src, sizeof(*src), GFP_KERNEL);
+		if (!dst->caller)
+			return -ENOMEM;
+		dst->caller->caller = NULL;
+	}
+	return 0;
+}
+
+/* the frame of the current call stack 'frameno' refers to */
+static struct verifier_state *func_state(struct verifier_env *env, u32 frameno)
+{
+	struct verifier_state *state = &env->cur_state;
+
+	while (state->frameno != frameno)
+		state = state->caller;
+	return state;
+}
+
 static int pop_stack(struct verifier_env *env, int *prev_insn_idx)
 {
 	struct verifier_stack_elem *elem;
@@ -418,6 +513,8 @@ static int pop_stack(struct verifier_env *env, int *prev_insn_idx)
 	if (env->head == NULL)
 		return -1;
 
+	/* the current state takes over the caller frames of the popped one */
+	free_caller_frames(&env->cur_state);
 	memcpy(&env->cur_state, &env->head->st, sizeof(env->cur_state));
 	insn_idx = env->head->insn_idx;
 	if (prev_insn_idx)
@@ -434,17 +531,20 @@ static struct verifier_state *push_stack(struct verifier_env *env, int insn_idx,
 {
 	struct verifier_stack_elem *elem;
 
-	elem = kmalloc(sizeof(struct verifier_stack_elem), GFP_KERNEL);
+	elem = kzalloc(sizeof(struct verifier_stack_elem), GFP_KERNEL);
 	if (!elem)
 		goto err;
 
-	memcpy(&elem->st, &env->cur_state, sizeof(env->cur_state));
 	elem->insn_idx = insn_idx;
 	elem->prev_insn_idx = prev_insn_idx;
 	elem->next = env->head;
 	env->head = elem;
 	env->stack_size++;
-	if (env->stack_size > 1024) {
+	if (copy_verifier_state(&elem->st, &env->cur_state))
+		goto err;
+	if (env->stack_size > env->peak_stack_size)
+		env->peak_stack_size = env->stack_size;
+	if (env->stack_size > BPF_COMPLEXITY_LIMIT_STACK) {
 		verbose("BPF program is too complex\n");
 		goto err;
 	}
@@ -468,6 +568,9 @@ static void init_reg_state(struct reg_state *regs)
 		regs[i].type = NOT_INIT;
 		regs[i].imm = 0;
 		regs[i].map_ptr = NULL;
+		regs[i].frameno = 0;
+		regs[i].live = REG_LIVE_NONE;
+		regs[i].parent = NULL;
 	}
 
 	/* frame pointer */
@@ -483,6 +586,28 @@ static void mark_reg_unknown_value(struct reg_state *regs, u32 regno)
 	regs[regno].type = UNKNOWN_VALUE;
 	regs[regno].imm = 0;
 	regs[regno].map_ptr = NULL;
+	regs[regno].frameno = 0;
+	regs[regno].live |= REG_LIVE_WRITTEN;
+}
+
+/* the current state read register (or spilled register) 'reg': unless
+ * it wrote it itself first, the value it had in the explored state this
+ * one continues from matters, and so on up the chain
+ */
+static void mark_reg_read(struct reg_state *reg)
+{
+	struct reg_state *parent = reg->parent;
+
+	while (parent) {
+		if (reg->live & REG_LIVE_WRITTEN)
+			break;
+		if (parent->live & REG_LIVE_READ)
+			/* and so are the ones further up */
+			break;
+		parent->live |= REG_LIVE_READ;
+		reg = parent;
+		parent = reg->parent;
+	}
 }
 
 enum reg_arg_type {
@@ -491,9 +616,11 @@ enum reg_arg_type {
 	DST_OP_NO_MARK	/* same as above, check only, don't mark */
 };
 
-static int check_reg_arg(struct reg_state *regs, u32 regno,
+static int check_reg_arg(struct verifier_env *env, u32 regno,
 			 enum reg_arg_type t)
 {
+	struct reg_state *regs = env->cur_state.regs;
+
 	if (regno >= MAX_BPF_REG) {
 		verbose("R%d is invalid\n", regno);
 		return -EINVAL;
@@ -505,6 +632,7 @@ static int check_reg_arg(struct reg_state *regs, u32 regno,
 			verbose("R%d !read_ok\n", regno);
 			return -EACCES;
 		}
+		mark_reg_read(&regs[regno]);
 	} else {
 		/* check whether register used as dest operand can be written to */
 		if (regno == BPF_REG_FP) {
@@ -548,17 +676,22 @@ static bool is_spillable_regtype(enum bpf_reg_type type)
 
 /* check_stack_read/write functions track spill/fill of registers,
  * stack boundary and alignment are checked in check_mem_access()
+ *
+ * 'state' is the frame owning the stack, the registers are the ones of
+ * the current frame
  */
-static int check_stack_write(struct verifier_state *state, int off, int size,
+static int check_stack_write(struct verifier_env *env,
+			     struct verifier_state *state, int off, int size,
 			     int value_regno)
 {
+	struct reg_state *regs = env->cur_state.regs;
 	int i;
 	/* caller checked that off % size == 0 and -MAX_BPF_STACK <= off < 0,
 	 * so it's aligned access and [off, off + size) are within stack limits
 	 */
 
 	if (value_regno >= 0 &&
-	    is_spillable_regtype(state->regs[value_regno].type)) {
+	    is_spillable_regtype(regs[value_regno].type)) {
 
 		/* register containing pointer is being spilled into stack */
 		if (size != BPF_REG_SIZE) {
@@ -566,9 +699,19 @@ static int check_stack_write(struct verifier_state *state, int off, int size,
 			return -EACCES;
 		}
 
+		if ((regs[value_regno].type == FRAME_PTR ||
+		     regs[value_regno].type == PTR_TO_STACK) &&
+		    regs[value_regno].frameno > state->frameno) {
+			/* that stack is gone once the callee returns */
+			verbose("cannot spill pointers to stack into stack frame of the caller\n");
+			return -EACCES;
+		}
+
 		/* save register state */
 		state->spilled_regs[(MAX_BPF_STACK + off) / BPF_REG_SIZE] =
-			state->regs[value_regno];
+			regs[value_regno];
+		state->spilled_regs[(MAX_BPF_STACK + off) / BPF_REG_SIZE].live |=
+			REG_LIVE_WRITTEN;
 
 		for (i = 0; i < BPF_REG_SIZE; i++)
 			state->stack_slot_type[MAX_BPF_STACK + off + i] = STACK_SPILL;
@@ -583,9 +726,11 @@ static int check_stack_write(struct verifier_state *state, int off, int size,
 	return 0;
 }
 
-static int check_stack_read(struct verifier_state *state, int off, int size,
+static int check_stack_read(struct verifier_env *env,
+			    struct verifier_state *state, int off, int size,
 			    int value_regno)
 {
+	struct reg_state *regs = env->cur_state.regs;
 	u8 *slot_type;
 	int i;
 
@@ -603,10 +748,14 @@ static int check_stack_read(struct verifier_state *state, int off, int size,
 			}
 		}
 
-		if (value_regno >= 0)
+		mark_reg_read(&state->spilled_regs[(MAX_BPF_STACK + off) / BPF_REG_SIZE]);
+
+		if (value_regno >= 0) {
 			/* restore register state from stack */
-			state->regs[value_regno] =
+			regs[value_regno] =
 				state->spilled_regs[(MAX_BPF_STACK + off) / BPF_REG_SIZE];
+			regs[value_regno].live |= REG_LIVE_WRITTEN;
+		}
 		return 0;
 	} else {
 		for (i = 0; i < size; i++) {
@@ -618,7 +767,7 @@ static int check_stack_read(struct verifier_state *state, int off, int size,
 		}
 		if (value_regno >= 0)
 			/* have read misc data from the stack */
-			mark_reg_unknown_value(state->regs, value_regno);
+			mark_reg_unknown_value(regs, value_regno);
 		return 0;
 	}
 }
@@ -710,20 +859,25 @@ static int check_mem_access(struct verifier_env *env, u32 regno, int off,
 
 	} else if (state->regs[regno].type == FRAME_PTR ||
 		   state->regs[regno].type == PTR_TO_STACK) {
+		struct verifier_state *frame;
+
 		if (off >= 0 || off < -MAX_BPF_STACK) {
 			verbose("invalid stack off=%d size=%d\n", off, size);
 			return -EACCES;
 		}
+		frame = func_state(env, state->regs[regno].frameno);
 		if (t == BPF_WRITE) {
 			if (!env->allow_ptr_leaks &&
-			    state->stack_slot_type[MAX_BPF_STACK + off] == STACK_SPILL &&
+			    frame->stack_slot_type[MAX_BPF_STACK + off] == STACK_SPILL &&
 			    size != BPF_REG_SIZE) {
 				verbose("attempt to corrupt spilled pointer on stack\n");
 				return -EACCES;
 			}
-			err = check_stack_write(state, off, size, value_regno);
+			err = check_stack_write(env, frame, off, size,
+						value_regno);
 		} else {
-			err = check_stack_read(state, off, size, value_regno);
+			err = check_stack_read(env, frame, off, size,
+					       value_regno);
 		}
 	} else {
 		verbose("R%d invalid mem access '%s'\n",
@@ -735,7 +889,6 @@ static int check_mem_access(struct verifier_env *env, u32 regno, int off,
 
 static int check_xadd(struct verifier_env *env, struct bpf_insn *insn)
 {
-	struct reg_state *regs = env->cur_state.regs;
 	int err;
 
 	if ((BPF_SIZE(insn->code) != BPF_W && BPF_SIZE(insn->code) != BPF_DW) ||
@@ -745,12 +898,12 @@ static int check_xadd(struct verifier_env *env, struct bpf_insn *insn)
 	}
 
 	/* check src1 operand */
-	err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+	err = check_reg_arg(env, insn->src_reg, SRC_OP);
 	if (err)
 		return err;
 
 	/* check src2 operand */
-	err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+	err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 	if (err)
 		return err;
 
@@ -772,12 +925,13 @@ static int check_xadd(struct verifier_env *env, struct bpf_insn *insn)
 static int check_stack_boundary(struct verifier_env *env,
 				int regno, int access_size)
 {
-	struct verifier_state *state = &env->cur_state;
-	struct reg_state *regs = state->regs;
+	struct reg_state *regs = env->cur_state.regs;
+	struct verifier_state *state;
 	int off, i;
 
 	if (regs[regno].type != PTR_TO_STACK)
 		return -EACCES;
+	state = func_state(env, regs[regno].frameno);
 
 	off = regs[regno].imm;
 	if (off >= 0 || off < -MAX_BPF_STACK || off + access_size > 0 ||
@@ -811,6 +965,7 @@ static int check_func_arg(struct verifier_env *env, u32 regno,
 		verbose("R%d !read_ok\n", regno);
 		return -EACCES;
 	}
+	mark_reg_read(reg);
 
 	if (arg_type == ARG_ANYTHING) {
 		if (is_pointer_value(env, regno)) {
@@ -903,6 +1058,10 @@ static int check_map_func_compatibility(struct bpf_map *map, int func_id)
 		    func_id != BPF_FUNC_perf_event_output)
 			goto error;
 		break;
+	case BPF_MAP_TYPE_STACK_TRACE:
+		if (func_id != BPF_FUNC_get_stackid)
+			goto error;
+		break;
 	default:
 		break;
 	}
@@ -918,6 +1077,10 @@ static int check_map_func_compatibility(struct bpf_map *map, int func_id)
 		if (map->map_type != BPF_MAP_TYPE_PERF_EVENT_ARRAY)
 			goto error;
 		break;
+	case BPF_FUNC_get_stackid:
+		if (map->map_type != BPF_MAP_TYPE_STACK_TRACE)
+			goto error;
+		break;
 	default:
 		break;
 	}
@@ -929,7 +1092,7 @@ error:
 	return -EINVAL;
 }
 
-static int check_call(struct verifier_env *env, int func_id)
+static int check_call(struct verifier_env *env, int func_id, int insn_idx)
 {
 	struct verifier_state *state = &env->cur_state;
 	const struct bpf_func_proto *fn = NULL;
@@ -975,11 +1138,22 @@ static int check_call(struct verifier_env *env, int func_id)
 	if (err)
 		return err;
 
+	if (func_id == BPF_FUNC_map_lookup_elem) {
+		/* remember the map for inline_map_lookups() */
+		struct bpf_insn_aux_data *aux = &env->insn_aux_data[insn_idx];
+
+		if (!aux->map_ptr)
+			aux->map_ptr = map;
+		else if (aux->map_ptr != map)
+			aux->map_ptr = BPF_MAP_PTR_POISON;
+	}
+
 	/* reset caller saved regs */
 	for (i = 0; i < CALLER_SAVED_REGS; i++) {
 		reg = regs + caller_saved[i];
 		reg->type = NOT_INIT;
 		reg->imm = 0;
+		reg->live |= REG_LIVE_WRITTEN;
 	}
 
 	/* update return register */
@@ -1011,6 +1185,79 @@ static int check_call(struct verifier_env *env, int func_id)
 	return 0;
 }
 
+/* call of the function at insn + imm + 1: set the caller's state aside
+ * and continue walking the callee, *insn_idx is updated to its first insn
+ */
+static int check_func_call(struct verifier_env *env, struct bpf_insn *insn,
+			   int *insn_idx)
+{
+	struct verifier_state *state = &env->cur_state;
+	struct verifier_state *caller;
+	int i;
+
+	if (state->frameno + 1 >= MAX_CALL_FRAMES) {
+		verbose("the call stack of %d frames is too deep\n",
+			state->frameno + 2);
+		return -E2BIG;
+	}
+
+	caller = kmemdup(state, sizeof(*state), GFP_KERNEL);
+	if (!caller)
+		return -ENOMEM;
+
+	state->caller = caller;
+	state->callsite = *insn_idx;
+	state->frameno++;
+
+	/* the callee starts with the arguments, a frame pointer of its own
+	 * and an empty stack
+	 */
+	memset(state->regs, 0, sizeof(state->regs));
+	for (i = 0; i < MAX_BPF_REG; i++)
+		state->regs[i].type = NOT_INIT;
+	for (i = BPF_REG_1; i <= BPF_REG_5; i++)
+		state->regs[i] = caller->regs[i];
+	state->regs[BPF_REG_FP].type = FRAME_PTR;
+	state->regs[BPF_REG_FP].frameno = state->frameno;
+
+	memset(state->stack_slot_type, STACK_INVALID,
+	       sizeof(state->stack_slot_type));
+	memset(state->spilled_regs, 0, sizeof(state->spilled_regs));
+
+	*insn_idx += insn->imm + 1;
+	return 0;
+}
+
+/* bpf_exit of a callee: back to the caller's state, with the return value
+ * in R0, *insn_idx is updated to the insn after the call
+ */
+static int prepare_func_exit(struct verifier_env *env, int *insn_idx)
+{
+	struct verifier_state *state = &env->cur_state;
+	struct verifier_state *caller = state->caller;
+	struct reg_state r0 = state->regs[BPF_REG_0];
+	int i;
+
+	if ((r0.type == FRAME_PTR || r0.type == PTR_TO_STACK) &&
+	    r0.frameno == state->frameno) {
+		verbose("cannot return stack pointer to the caller\n");
+		return -EINVAL;
+	}
+
+	*insn_idx = state->callsite + 1;
+	memcpy(state, caller, sizeof(*state));
+	kfree(caller);
+
+	state->regs[BPF_REG_0] = r0;
+	state->regs[BPF_REG_0].live |= REG_LIVE_WRITTEN;
+	for (i = BPF_REG_1; i <= BPF_REG_5; i++) {
+		state->regs[i].type = NOT_INIT;
+		state->regs[i].imm = 0;
+		state->regs[i].live |= REG_LIVE_WRITTEN;
+	}
+	return 0;
+}
+
 /* check validity of 32-bit and 64-bit arithmetic operations */
 static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 {
@@ -1035,7 +1282,7 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check src operand */
-		err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+		err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 		if (err)
 			return err;
 
@@ -1046,7 +1293,7 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check dest operand */
-		err = check_reg_arg(regs, insn->dst_reg, DST_OP);
+		err = check_reg_arg(env, insn->dst_reg, DST_OP);
 		if (err)
 			return err;
 
@@ -1059,7 +1306,7 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 			}
 
 			/* check src operand */
-			err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
 			if (err)
 				return err;
 		} else {
@@ -1070,7 +1317,7 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check dest operand */
-		err = check_reg_arg(regs, insn->dst_reg, DST_OP);
+		err = check_reg_arg(env, insn->dst_reg, DST_OP);
 		if (err)
 			return err;
 
@@ -1080,6 +1327,7 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 				 * copy register state to dest reg
 				 */
 				regs[insn->dst_reg] = regs[insn->src_reg];
+				regs[insn->dst_reg].live |= REG_LIVE_WRITTEN;
 			} else {
 				if (is_pointer_value(env, insn->src_reg)) {
 					verbose("R%d partial copy of pointer\n",
@@ -1104,6 +1352,7 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 	} else {	/* all other ALU ops: and, sub, xor, add, ... */
 
 		bool stack_relative = false;
+		u32 frameno = 0;
 
 		if (BPF_SRC(insn->code) == BPF_X) {
 			if (insn->imm != 0 || insn->off != 0) {
@@ -1111,7 +1360,7 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 				return -EINVAL;
 			}
 			/* check src1 operand */
-			err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
 			if (err)
 				return err;
 		} else {
@@ -1122,7 +1371,7 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check src2 operand */
-		err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+		err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 		if (err)
 			return err;
 
@@ -1147,6 +1396,7 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 		    regs[insn->dst_reg].type == FRAME_PTR &&
 		    BPF_SRC(insn->code) == BPF_K) {
 			stack_relative = true;
+			frameno = regs[insn->dst_reg].frameno;
 		} else if (is_pointer_value(env, insn->dst_reg)) {
 			verbose("R%d pointer arithmetic prohibited\n",
 				insn->dst_reg);
@@ -1159,13 +1409,14 @@ static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
 		}
 
 		/* check dest operand */
-		err = check_reg_arg(regs, insn->dst_reg, DST_OP);
+		err = check_reg_arg(env, insn->dst_reg, DST_OP);
 		if (err)
 			return err;
 
 		if (stack_relative) {
 			regs[insn->dst_reg].type = PTR_TO_STACK;
 			regs[insn->dst_reg].imm = insn->imm;
+			regs[insn->dst_reg].frameno = frameno;
 		}
 	}
 
@@ -1192,7 +1443,7 @@ static int check_cond_jmp_op(struct verifier_env *env,
 		}
 
 		/* check src1 operand */
-		err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+		err = check_reg_arg(env, insn->src_reg, SRC_OP);
 		if (err)
 			return err;
 
@@ -1209,7 +1460,7 @@ static int check_cond_jmp_op(struct verifier_env *env,
 	}
 
 	/* check src2 operand */
-	err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+	err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 	if (err)
 		return err;
 
@@ -1303,7 +1554,7 @@ static int check_ld_imm(struct verifier_env *env, struct bpf_insn *insn)
 		return -EINVAL;
 	}
 
-	err = check_reg_arg(regs, insn->dst_reg, DST_OP);
+	err = check_reg_arg(env, insn->dst_reg, DST_OP);
 	if (err)
 		return err;
 
@@ -1366,7 +1617,7 @@ static int check_ld_abs(struct verifier_env *env, struct bpf_insn *insn)
 	}
 
 	/* check whether implicit source operand (register R6) is readable */
-	err = check_reg_arg(regs, BPF_REG_6, SRC_OP);
+	err = check_reg_arg(env, BPF_REG_6, SRC_OP);
 	if (err)
 		return err;
 
@@ -1377,7 +1628,7 @@ static int check_ld_abs(struct verifier_env *env, struct bpf_insn *insn)
 
 	if (mode == BPF_IND) {
 		/* check explicit source operand */
-		err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+		err = check_reg_arg(env, insn->src_reg, SRC_OP);
 		if (err)
 			return err;
 	}
@@ -1387,6 +1638,7 @@ static int check_ld_abs(struct verifier_env *env, struct bpf_insn *insn)
 		reg = regs + caller_saved[i];
 		reg->type = NOT_INIT;
 		reg->imm = 0;
+		reg->live |= REG_LIVE_WRITTEN;
 	}
 
 	/* mark destination R0 register as readable, since it contains
@@ -1396,6 +1648,108 @@ static int check_ld_abs(struct verifier_env *env, struct bpf_insn *insn)
 	return 0;
 }
 
+static int add_subprog(struct verifier_env *env, int off)
+{
+	int i, j;
+
+	if (off < 0 || off >= env->prog->len) {
+		verbose("call to invalid destination\n");
+		return -EINVAL;
+	}
+
+	/* keep subprog_starts sorted */
+	for (i = 0; i < env->subprog_cnt; i++) {
+		if (env->subprog_starts[i] == off)
+			return 0;
+		if (env->subprog_starts[i] > off)
+			break;
+	}
+	if (env->subprog_cnt >= BPF_MAX_SUBPROGS) {
+		verbose("too many subprograms\n");
+		return -E2BIG;
+	}
+	for (j = env->subprog_cnt; j > i; j--)
+		env->subprog_starts[j] = env->subprog_starts[j - 1];
+	env->subprog_starts[i] = off;
+	env->subprog_cnt++;
+	return 0;
+}
+
+/* find the functions of the program, the targets of its BPF_PSEUDO_CALLs,
+ * and check that none jumps or falls into another
+ */
+static int check_subprogs(struct verifier_env *env)
+{
+	struct bpf_insn *insn = env->prog->insnsi;
+	int insn_cnt = env->prog->len;
+	int i, j, start, end, err;
+	u8 code;
+
+	env->subprog_starts[0] = 0;
+	env->subprog_cnt = 1;
+
+	for (i = 0; i < insn_cnt; i++) {
+		if (insn[i].code != (BPF_JMP | BPF_CALL) ||
+		    insn[i].src_reg != BPF_PSEUDO_CALL)
+			continue;
+		if (!env->allow_ptr_leaks) {
+			verbose("function calls to other bpf functions are allowed for root only\n");
+			return -EPERM;
+		}
+		err = add_subprog(env, i + insn[i].imm + 1);
+		if (err)
+			return err;
+	}
+
+	if (env->subprog_cnt == 1)
+		return 0;
+
+	for (j = 0; j < env->subprog_cnt; j++) {
+		start = env->subprog_starts[j];
+		end = j + 1 < env->subprog_cnt ? env->subprog_starts[j + 1] :
+						  insn_cnt;
+
+		for (i = start; i < end; i++) {
+			code = insn[i].code;
+
+			/* the skb cached by LD_ABS and the tail call counter
+			 * live in the frame of the main program
+			 */
+			if (BPF_CLASS(code) == BPF_LD &&
+			    (BPF_MODE(code) == BPF_ABS ||
+			     BPF_MODE(code) == BPF_IND)) {
+				verbose("BPF_LD_[ABS|IND] instructions cannot be mixed with bpf-to-bpf calls\n");
+				return -EINVAL;
+			}
+			if (code == (BPF_JMP | BPF_CALL) &&
+			    insn[i].src_reg == BPF_REG_0 &&
+			    insn[i].imm == BPF_FUNC_tail_call) {
+				verbose("tail_calls are not allowed in programs with bpf-to-bpf calls\n");
+				return -EINVAL;
+			}
+
+			if (BPF_CLASS(code) != BPF_JMP ||
+			    BPF_OP(code) == BPF_CALL ||
+			    BPF_OP(code) == BPF_EXIT)
+				continue;
+			if (i + insn[i].off + 1 < start ||
+			    i + insn[i].off + 1 >= end) {
+				verbose("jump out of range from insn %d to %d\n",
+					i, i + insn[i].off + 1);
+				return -EINVAL;
+			}
+		}
+
+		/* no falling through into the next function either */
+		code = insn[end - 1].code;
+		if (code != (BPF_JMP | BPF_EXIT) && code != (BPF_JMP | BPF_JA)) {
+			verbose("last insn of a function is not an exit or jmp\n");
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
 /* non-recursive DFS pseudo code
  * 1  procedure DFS-iterative(G,v):
  * 2      label v as discovered
@@ -1525,6 +1879,16 @@ peek_stack:
 				goto peek_stack;
 			else if (ret < 0)
 				goto err_free;
+			if (insns[t].src_reg == BPF_PSEUDO_CALL) {
+				/* the callee returns to t + 1 */
+				env->explored_states[t + 1] = STATE_LIST_MARK;
+				ret = push_insn(t, t + insns[t].imm + 1,
+						BRANCH, env);
+				if (ret == 1)
+					goto peek_stack;
+				else if (ret < 0)
+					goto err_free;
+			}
 		} else if (opcode == BPF_JA) {
 			if (BPF_SRC(insns[t].code) != BPF_K) {
 				ret = -EINVAL;
@@ -1592,6 +1956,25 @@ err_free:
 	return ret;
 }
 
+/* returns true if the explored state 'rold' of a register is at least as
+ * strict as its current state 'rcur'
+ */
+static bool regsafe(struct reg_state *rold, struct reg_state *rcur)
+{
+	if (!(rold->live & REG_LIVE_READ))
+		/* the path from the explored state didn't need this value */
+		return true;
+
+	if (memcmp(rold, rcur, offsetof(struct reg_state, live)) == 0)
+		return true;
+
+	if (rold->type == NOT_INIT ||
+	    (rold->type == UNKNOWN_VALUE && rcur->type != NOT_INIT))
+		return true;
+
+	return false;
+}
+
 /* compare two verifier states
  *
  * all states stored in state_list are known to be valid, since
@@ -1617,21 +2000,25 @@ err_free:
  * Similarly with registers. If explored state has register type as invalid
  * whereas register type in current state is meaningful, it means that
  * the current state will reach 'bpf_exit' instruction safely
+ *
+ * Registers and spilled registers that no path from the explored state
+ * read before overwriting them can hold anything, they aren't marked
+ * REG_LIVE_READ. That holds once all those paths have been explored,
+ * which they have: the graph is a DAG and pending branches are handled
+ * last in, first out, so nothing can get back to a remembered state
+ * before everything below it is done.
+ *
+ * Inside of a function call, the call stacks must be the same, and so must
+ * be all frames on them.
  */
-static bool states_equal(struct verifier_state *old, struct verifier_state *cur)
+static bool func_states_equal(struct verifier_state *old,
+			      struct verifier_state *cur)
 {
 	int i;
 
-	for (i = 0; i < MAX_BPF_REG; i++) {
-		if (memcmp(&old->regs[i], &cur->regs[i],
-			   sizeof(old->regs[0])) != 0) {
-			if (old->regs[i].type == NOT_INIT ||
-			    (old->regs[i].type == UNKNOWN_VALUE &&
-			     cur->regs[i].type != NOT_INIT))
-				continue;
+	for (i = 0; i < MAX_BPF_REG; i++)
+		if (!regsafe(&old->regs[i], &cur->regs[i]))
 			return false;
-		}
-	}
 
 	for (i = 0; i < MAX_BPF_STACK; i++) {
 		if (old->stack_slot_type[i] == STACK_INVALID)
@@ -1645,9 +2032,10 @@ static bool states_equal(struct verifier_state *old, struct verifier_state *cur)
 			return false;
 		if (i % BPF_REG_SIZE)
 			continue;
-		if (memcmp(&old->spilled_regs[i / BPF_REG_SIZE],
-			   &cur->spilled_regs[i / BPF_REG_SIZE],
-			   sizeof(old->spilled_regs[0])))
+		if (old->stack_slot_type[i] != STACK_SPILL)
+			continue;
+		if (!regsafe(&old->spilled_regs[i / BPF_REG_SIZE],
+			     &cur->spilled_regs[i / BPF_REG_SIZE]))
 			/* when explored and current stack slot types are
 			 * the same, check that stored pointers types
 			 * are the same as well.
@@ -1659,16 +2047,51 @@ static bool states_equal(struct verifier_state *old, struct verifier_state *cur)
 			 * return false to continue verification of this path
 			 */
 			return false;
-		else
-			continue;
 	}
 	return true;
 }
 
+static bool states_equal(struct verifier_state *old, struct verifier_state *cur)
+{
+	if (old->frameno != cur->frameno)
+		return false;
+
+	for (; old; old = old->caller, cur = cur->caller)
+		if (old->callsite != cur->callsite ||
+		    !func_states_equal(old, cur))
+			return false;
+	return true;
+}
+
+/* the current state was found equivalent to the explored one, so what the
+ * paths from the explored state read, the current state reads as well.
+ * Pass that on to the states the current one continues from.
+ */
+static void propagate_liveness(struct verifier_state *explored,
+			       struct verifier_state *cur)
+{
+	int i;
+
+	/* states_equal() made sure both have the same frames */
+	for (; explored; explored = explored->caller, cur = cur->caller) {
+		for (i = 0; i < BPF_REG_FP; i++)
+			if (explored->regs[i].live & REG_LIVE_READ)
+				mark_reg_read(&cur->regs[i]);
+
+		for (i = 0; i < MAX_BPF_STACK / BPF_REG_SIZE; i++)
+			if (explored->stack_slot_type[i * BPF_REG_SIZE] == STACK_SPILL &&
+			    (explored->spilled_regs[i].live & REG_LIVE_READ))
+				mark_reg_read(&cur->spilled_regs[i]);
+	}
+}
+
 static int is_state_visited(struct verifier_env *env, int insn_idx)
 {
+	struct verifier_state *cur = &env->cur_state;
 	struct verifier_state_list *new_sl;
 	struct verifier_state_list *sl;
+	struct verifier_state *frame, *new_frame;
+	int i;
 
 	sl = env->explored_states[insn_idx];
 	if (!sl)
@@ -1678,11 +2101,14 @@ static int is_state_visited(struct verifier_env *env, int insn_idx)
 		return 0;
 
 	while (sl != STATE_LIST_MARK) {
-		if (states_equal(&sl->state, &env->cur_state))
+		if (states_equal(&sl->state, cur)) {
 			/* reached equivalent register/stack state,
 			 * prune the search
 			 */
+			propagate_liveness(&sl->state, cur);
+			env->pruned_states++;
 			return 1;
+		}
 		sl = sl->next;
 	}
 
@@ -1692,14 +2118,35 @@ static int is_state_visited(struct verifier_env *env, int insn_idx)
 	 * it will be rejected. Since there are no loops, we won't be
 	 * seeing this 'insn_idx' instruction again on the way to bpf_exit
 	 */
-	new_sl = kmalloc(sizeof(struct verifier_state_list), GFP_USER);
+	new_sl = kzalloc(sizeof(struct verifier_state_list), GFP_USER);
 	if (!new_sl)
 		return -ENOMEM;
 
+	if (copy_verifier_state(&new_sl->state, cur)) {
+		free_caller_frames(&new_sl->state);
+		kfree(new_sl);
+		return -ENOMEM;
+	}
+
 	/* add new state to the head of linked list */
-	memcpy(&new_sl->state, &env->cur_state, sizeof(env->cur_state));
 	new_sl->next = env->explored_states[insn_idx];
 	env->explored_states[insn_idx] = new_sl;
+	env->total_states++;
+
+	/* from here on the current state continues from the new one, and
+	 * what it writes are no writes of the new state's children
+	 */
+	for (frame = cur, new_frame = &new_sl->state; frame;
+	     frame = frame->caller, new_frame = new_frame->caller) {
+		for (i = 0; i < MAX_BPF_REG; i++) {
+			frame->regs[i].parent = &new_frame->regs[i];
+			frame->regs[i].live = REG_LIVE_NONE;
+		}
+		for (i = 0; i < MAX_BPF_STACK / BPF_REG_SIZE; i++) {
+			frame->spilled_regs[i].parent = &new_frame->spilled_regs[i];
+			frame->spilled_regs[i].live = REG_LIVE_NONE;
+		}
+	}
 	return 0;
 }
 
@@ -1710,7 +2157,6 @@ static int do_check(struct verifier_env *env)
 	struct reg_state *regs = state->regs;
 	int insn_cnt = env->prog->len;
 	int insn_idx, prev_insn_idx = 0;
-	int insn_processed = 0;
 	bool do_print_state = false;
 
 	init_reg_state(regs);
@@ -1729,9 +2175,9 @@ static int do_check(struct verifier_env *env)
 		insn = &insns[insn_idx];
 		class = BPF_CLASS(insn->code);
 
-		if (++insn_processed > 32768) {
+		if (++env->insn_processed > BPF_COMPLEXITY_LIMIT_INSNS) {
 			verbose("BPF program is too large. Proccessed %d insn\n",
-				insn_processed);
+				env->insn_processed);
 			return -E2BIG;
 		}
 
@@ -1772,11 +2218,11 @@ static int do_check(struct verifier_env *env)
 			/* check for reserved fields is already done */
 
 			/* check src operand */
-			err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
 			if (err)
 				return err;
 
-			err = check_reg_arg(regs, insn->dst_reg, DST_OP_NO_MARK);
+			err = check_reg_arg(env, insn->dst_reg, DST_OP_NO_MARK);
 			if (err)
 				return err;
 
@@ -1829,11 +2275,11 @@ static int do_check(struct verifier_env *env)
 			}
 
 			/* check src1 operand */
-			err = check_reg_arg(regs, insn->src_reg, SRC_OP);
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
 			if (err)
 				return err;
 			/* check src2 operand */
-			err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+			err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 			if (err)
 				return err;
 
@@ -1862,7 +2308,7 @@ static int do_check(struct verifier_env *env)
 				return -EINVAL;
 			}
 			/* check src operand */
-			err = check_reg_arg(regs, insn->dst_reg, SRC_OP);
+			err = check_reg_arg(env, insn->dst_reg, SRC_OP);
 			if (err)
 				return err;
 
@@ -1879,13 +2325,23 @@ static int do_check(struct verifier_env *env)
 			if (opcode == BPF_CALL) {
 				if (BPF_SRC(insn->code) != BPF_K ||
 				    insn->off != 0 ||
-				    insn->src_reg != BPF_REG_0 ||
+				    (insn->src_reg != BPF_REG_0 &&
+				     insn->src_reg != BPF_PSEUDO_CALL) ||
 				    insn->dst_reg != BPF_REG_0) {
 					verbose("BPF_CALL uses reserved fields\n");
 					return -EINVAL;
 				}
 
-				err = check_call(env, insn->imm);
+				if (insn->src_reg == BPF_PSEUDO_CALL) {
+					prev_insn_idx = insn_idx;
+					err = check_func_call(env, insn, &insn_idx);
+					if (err)
+						return err;
+					do_print_state = true;
+					continue;
+				}
+
+				err = check_call(env, insn->imm, insn_idx);
 				if (err)
 					return err;
 
@@ -1916,10 +2372,20 @@ static int do_check(struct verifier_env *env)
 				 * of bpf_exit, which means that program wrote
 				 * something into it earlier
 				 */
-				err = check_reg_arg(regs, BPF_REG_0, SRC_OP);
+				err = check_reg_arg(env, BPF_REG_0, SRC_OP);
 				if (err)
 					return err;
 
+				if (state->caller) {
+					/* return from a callee */
+					prev_insn_idx = insn_idx;
+					err = prepare_func_exit(env, &insn_idx);
+					if (err)
+						return err;
+					do_print_state = true;
+					continue;
+				}
+
 				if (is_pointer_value(env, BPF_REG_0)) {
 					verbose("R0 leaks addr as return value\n");
 					return -EACCES;
@@ -2088,6 +2554,17 @@ static void adjust_branches(struct bpf_prog *prog, int pos, int delta)
 	int i;
 
 	for (i = 0; i < insn_cnt; i++, insn++) {
+		if (insn->code == (BPF_JMP | BPF_CALL) &&
+		    insn->src_reg == BPF_PSEUDO_CALL) {
+			/* calls within the program are relative in imm */
+			if (i < pos && i + insn->imm + 1 > pos)
+				insn->imm += delta;
+			else if (i > pos + delta &&
+				 i + insn->imm + 1 <= pos + delta)
+				insn->imm -= delta;
+			continue;
+		}
+
 		if (BPF_CLASS(insn->code) != BPF_JMP ||
 		    BPF_OP(insn->code) == BPF_CALL ||
 		    BPF_OP(insn->code) == BPF_EXIT)
@@ -2101,6 +2578,84 @@ static void adjust_branches(struct bpf_prog *prog, int pos, int delta)
 	}
 }
 
+/* replace the insn at @off with the @len insns of @patch */
+static struct bpf_prog *patch_insn(struct verifier_env *env, u32 off,
+				   const struct bpf_insn *patch, u32 len)
+{
+	struct bpf_prog *new_prog;
+	u32 insn_cnt = env->prog->len + len - 1;
+
+	if (len == 1) {
+		memcpy(env->prog->insnsi + off, patch, sizeof(*patch));
+		return env->prog;
+	}
+
+	/* several new insns need to be inserted. Make room for them */
+	new_prog = bpf_prog_realloc(env->prog, bpf_prog_size(insn_cnt),
+				    GFP_USER);
+	if (!new_prog)
+		return NULL;
+
+	new_prog->len = insn_cnt;
+
+	memmove(new_prog->insnsi + off + len, new_prog->insnsi + off + 1,
+		sizeof(*patch) * (insn_cnt - off - len));
+
+	/* copy substitute insns in place of the old one */
+	memcpy(new_prog->insnsi + off, patch, sizeof(*patch) * len);
+
+	/* adjust branches in the whole program */
+	adjust_branches(new_prog, off, len - 1);
+
+	env->prog = new_prog;
+	return new_prog;
+}
+
+/* replace bpf_map_lookup_elem() calls, whose map is known at every one of
+ * them, with the map's own lookup code, so the JIT sees plain loads
+ */
+static int inline_map_lookups(struct verifier_env *env)
+{
+	struct bpf_insn *insn = env->prog->insnsi;
+	int insn_cnt = env->prog->len;
+	struct bpf_insn insn_buf[16];
+	struct bpf_prog *new_prog;
+	struct bpf_map *map_ptr;
+	int i, delta = 0;
+	u32 cnt;
+
+	for (i = 0; i < insn_cnt; i++, insn++) {
+		if (insn->code != (BPF_JMP | BPF_CALL) ||
+		    insn->src_reg != BPF_REG_0 ||
+		    insn->imm != BPF_FUNC_map_lookup_elem)
+			continue;
+
+		/* aux data is indexed the way the program was verified */
+		map_ptr = env->insn_aux_data[i - delta].map_ptr;
+		if (!map_ptr || map_ptr == BPF_MAP_PTR_POISON ||
+		    !map_ptr->ops->map_gen_lookup)
+			continue;
+
+		cnt = map_ptr->ops->map_gen_lookup(map_ptr, insn_buf);
+		if (cnt == 0 || cnt >= ARRAY_SIZE(insn_buf)) {
+			verbose("bpf verifier is misconfigured\n");
+			return -EINVAL;
+		}
+
+		new_prog = patch_insn(env, i, insn_buf, cnt);
+		if (!new_prog)
+			return -ENOMEM;
+
+		/* keep walking new program and skip insns we just inserted */
+		delta += cnt - 1;
+		insn_cnt += cnt - 1;
+		insn = new_prog->insnsi + i + cnt - 1;
+		i += cnt - 1;
+	}
+
+	return 0;
+}
+
 /* convert load instructions that access fields of 'struct __sk_buff'
  * into sequence of instructions that access fields of 'struct sk_buff'
  */
@@ -2139,32 +2694,12 @@ static int convert_ctx_accesses(struct verifier_env *env)
 			return -EINVAL;
 		}
 
-		if (cnt == 1) {
-			memcpy(insn, insn_buf, sizeof(*insn));
-			continue;
-		}
-
-		/* several new insns need to be inserted. Make room for them */
-		insn_cnt += cnt - 1;
-		new_prog = bpf_prog_realloc(env->prog,
-					    bpf_prog_size(insn_cnt),
-					    GFP_USER);
+		new_prog = patch_insn(env, i, insn_buf, cnt);
 		if (!new_prog)
 			return -ENOMEM;
 
-		new_prog->len = insn_cnt;
-
-		memmove(new_prog->insnsi + i + cnt, new_prog->insns + i + 1,
-			sizeof(*insn) * (insn_cnt - i - cnt));
-
-		/* copy substitute insns in place of load instruction */
-		memcpy(new_prog->insnsi + i, insn_buf, sizeof(*insn) * cnt);
-
-		/* adjust branches in the whole program */
-		adjust_branches(new_prog, i, cnt - 1);
-
 		/* keep walking new program and skip insns we just inserted */
-		env->prog = new_prog;
+		insn_cnt += cnt - 1;
 		insn = new_prog->insnsi + i + cnt - 1;
 		i += cnt - 1;
 	}
@@ -2186,6 +2721,7 @@ static void free_states(struct verifier_env *env)
 		if (sl)
 			while (sl != STATE_LIST_MARK) {
 				sln = sl->next;
+				free_caller_frames(&sl->state);
 				kfree(sl);
 				sl = sln;
 			}
@@ -2198,6 +2734,7 @@ int bpf_check(struct bpf_prog **prog, union bpf_attr *attr)
 {
 	char __user *log_ubuf = NULL;
 	struct verifier_env *env;
+	u64 start_time;
 	int ret = -EINVAL;
 
 	if ((*prog)->len <= 0 || (*prog)->len > BPF_MAXINSNS)
@@ -2245,22 +2782,38 @@ int bpf_check(struct bpf_prog **prog, union bpf_attr *attr)
 	env->explored_states = kcalloc(env->prog->len,
 				       sizeof(struct verifier_state_list *),
 				       GFP_USER);
+	env->insn_aux_data = kcalloc(env->prog->len,
+				     sizeof(struct bpf_insn_aux_data),
+				     GFP_USER);
 	ret = -ENOMEM;
-	if (!env->explored_states)
+	if (!env->explored_states || !env->insn_aux_data)
 		goto skip_full_check;
 
-	ret = check_cfg(env);
+	env->allow_ptr_leaks = capable(CAP_SYS_ADMIN);
+
+	ret = check_subprogs(env);
 	if (ret < 0)
 		goto skip_full_check;
 
-	env->allow_ptr_leaks = capable(CAP_SYS_ADMIN);
+	ret = check_cfg(env);
+	if (ret < 0)
+		goto skip_full_check;
 
+	start_time = ktime_get_ns();
 	ret = do_check(env);
+	verbose("processed %u insns (limit %d), stored %u states, pruned %u, peak %d branches, %llu usec\n",
+		env->insn_processed, BPF_COMPLEXITY_LIMIT_INSNS,
+		env->total_states, env->pruned_states, env->peak_stack_size,
+		div_u64(ktime_get_ns() - start_time, NSEC_PER_USEC));
 
 skip_full_check:
 	while (pop_stack(env, NULL) >= 0);
+	free_caller_frames(&env->cur_state);
 	free_states(env);
 
+	if (ret == 0)
+		ret = inline_map_lookups(env);
+
 	if (ret == 0)
 		/* program is valid, convert *(u32*)(ctx + off) accesses */
 		ret = convert_ctx_accesses(env);
@@ -2309,6 +2862,7 @@ free_env:
 		 */
 		release_maps(env);
 	*prog = env->prog;
+	kfree(env->insn_aux_data);
 	kfree(env);
 	mutex_unlock(&bpf_verifier_lock);
 	return ret;
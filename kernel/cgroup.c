@@ -1114,6 +1114,7 @@ static void cgroup_free_root(struct cgroup_root *root)
 		/* hierarchy ID should already have been released */
 		WARN_ON_ONCE(root->hierarchy_id);
 
+		cgroup_rstat_exit(&root->cgrp);
 		idr_destroy(&root->cgroup_idr);
 		kfree(root);
 	}
@@ -1542,11 +1543,14 @@ static int rebind_subsystems(struct cgroup_root *dst_root,
 		WARN_ON(!css || cgroup_css(dcgrp, ss));
 
 		css_clear_dir(css, NULL);
+		cgroup_rstat_css_unlink(css);
 
 		RCU_INIT_POINTER(scgrp->subsys[ssid], NULL);
 		rcu_assign_pointer(dcgrp->subsys[ssid], css);
 		ss->root = dst_root;
 		css->cgroup = dcgrp;
+		if (ss->css_rstat_flush)
+			cgroup_rstat_css_link(css);
 
 		spin_lock_bh(&css_set_lock);
 		hash_for_each(css_set_table, i, cset, hlist)
@@ -1880,6 +1884,7 @@ static void init_cgroup_housekeeping(struct cgroup *cgrp)
 	INIT_LIST_HEAD(&cgrp->self.children);
 	INIT_LIST_HEAD(&cgrp->cset_links);
 	INIT_LIST_HEAD(&cgrp->pidlists);
+	INIT_LIST_HEAD(&cgrp->rstat_css_list);
 	mutex_init(&cgrp->pidlist_mutex);
 	cgrp->self.cgroup = cgrp;
 	cgrp->self.flags |= CSS_ONLINE;
@@ -1920,6 +1925,11 @@ static int cgroup_setup_root(struct cgroup_root *root, unsigned long ss_mask)
 
 	lockdep_assert_held(&cgroup_mutex);
 
+	/* freed along with @root by cgroup_free_root() */
+	ret = cgroup_rstat_init(root_cgrp);
+	if (ret)
+		goto out;
+
 	ret = cgroup_idr_alloc(&root->cgroup_idr, root_cgrp, 1, 2, GFP_KERNEL);
 	if (ret < 0)
 		goto out;
@@ -4714,6 +4724,7 @@ static void css_free_work_fn(struct work_struct *work)
 			 * that the parent won't be destroyed before its
 			 * children.
 			 */
+			cgroup_rstat_exit(cgrp);
 			cgroup_put(cgroup_parent(cgrp));
 			kernfs_put(cgrp->kn);
 			kfree(cgrp);
@@ -4751,6 +4762,7 @@ static void css_release_work_fn(struct work_struct *work)
 
 	if (ss) {
 		/* css release path */
+		cgroup_rstat_css_unlink(css);
 		cgroup_idr_replace(&ss->css_idr, NULL, css->id);
 		if (ss->css_released)
 			ss->css_released(css);
@@ -4795,6 +4807,7 @@ static void init_and_link_css(struct cgroup_subsys_state *css,
 	css->ss = ss;
 	INIT_LIST_HEAD(&css->sibling);
 	INIT_LIST_HEAD(&css->children);
+	INIT_LIST_HEAD(&css->rstat_css_node);
 	css->serial_nr = css_serial_nr_next++;
 	atomic_set(&css->online_cnt, 0);
 
@@ -4819,6 +4832,8 @@ static int online_css(struct cgroup_subsys_state *css)
 	if (!ret) {
 		css->flags |= CSS_ONLINE;
 		rcu_assign_pointer(css->cgroup->subsys[ss->id], css);
+		if (ss->css_rstat_flush)
+			cgroup_rstat_css_link(css);
 
 		atomic_inc(&css->online_cnt);
 		if (css->parent)
@@ -4944,10 +4959,14 @@ static int cgroup_mkdir(struct kernfs_node *parent_kn, const char *name,
 		goto out_unlock;
 	}
 
-	ret = percpu_ref_init(&cgrp->self.refcnt, css_release, 0, GFP_KERNEL);
+	ret = cgroup_rstat_init(cgrp);
 	if (ret)
 		goto out_free_cgrp;
 
+	ret = percpu_ref_init(&cgrp->self.refcnt, css_release, 0, GFP_KERNEL);
+	if (ret)
+		goto out_stat_exit;
+
 	/*
 	 * Temporarily set the pointer to NULL, so idr_find() won't return
 	 * a half-baked cgroup.
@@ -5032,6 +5051,8 @@ out_free_id:
 	cgroup_idr_remove(&root->cgroup_idr, cgrp->id);
 out_cancel_ref:
 	percpu_ref_exit(&cgrp->self.refcnt);
+out_stat_exit:
+	cgroup_rstat_exit(cgrp);
 out_free_cgrp:
 	kfree(cgrp);
 out_unlock:
@@ -5330,6 +5351,7 @@ int __init cgroup_init(void)
 	key = css_set_hash(init_css_set.subsys);
 	hash_add(css_set_table, &init_css_set.hlist, key);
 
+	cgroup_rstat_boot();
 	BUG_ON(cgroup_setup_root(&cgrp_dfl_root, 0));
 
 	mutex_unlock(&cgroup_mutex);
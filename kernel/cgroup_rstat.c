@@ -0,0 +1,322 @@
+/*
+ * Recursive per-cpu statistics for cgroups
+ *
+ * Controllers keep their hot statistics in per-cpu counters which are
+ * cheap to update but expensive to read: a hierarchical read used to
+ * walk every descendant cgroup on every possible cpu.  With the number
+ * of cgroups and cpus both in the thousands that makes reading
+ * memory.stat of a high level cgroup take a visible amount of time.
+ *
+ * Instead, an update marks the cgroup on the updating cpu by linking it
+ * and its ancestors into a per-cpu tree of cgroups with pending updates,
+ * which is a no-op if it is already linked.  A read flushes the subtree
+ * of interest: for every cpu, each cgroup with pending updates below the
+ * one being read is visited, children before their parents, and its
+ * controllers' css_rstat_flush() callbacks fold the per-cpu deltas into
+ * their totals and pass them on to the parent.  Cgroups without updates
+ * since the last flush are not visited at all.
+ */
+
+#include <linux/cgroup.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+/* serializes flushes and protects the ->rstat_css_list of all cgroups */
+static DEFINE_SPINLOCK(cgroup_rstat_lock);
+
+/* protects the updated trees of a cpu */
+static DEFINE_PER_CPU(raw_spinlock_t, cgroup_rstat_cpu_lock);
+
+static struct cgroup *rstat_parent(struct cgroup *cgrp)
+{
+	struct cgroup_subsys_state *parent_css = cgrp->self.parent;
+
+	if (parent_css)
+		return container_of(parent_css, struct cgroup, self);
+	return NULL;
+}
+
+static struct cgroup_rstat_cpu *cgroup_rstat_cpu(struct cgroup *cgrp, int cpu)
+{
+	return per_cpu_ptr(cgrp->rstat_cpu, cpu);
+}
+
+/**
+ * cgroup_rstat_updated - note that the per-cpu stats of a cgroup changed
+ * @cgrp: the cgroup whose stats were updated
+ * @cpu: the cpu the stats were updated on
+ *
+ * Called by controllers after updating their per-cpu statistics of
+ * @cgrp on @cpu, so that the next flush of @cgrp or one of its ancestors
+ * picks them up.  Checking whether @cgrp is already linked is lockless,
+ * so this is cheap enough to be called on every update.  May be called
+ * from any context.
+ */
+void cgroup_rstat_updated(struct cgroup *cgrp, int cpu)
+{
+	raw_spinlock_t *cpu_lock = per_cpu_ptr(&cgroup_rstat_cpu_lock, cpu);
+	struct cgroup *parent;
+	unsigned long flags;
+
+	/* roots are flushed on every read anyway */
+	if (!rstat_parent(cgrp))
+		return;
+
+	/*
+	 * As the updated_children lists are terminated by their owner and
+	 * not NULL, a NULL ->updated_next means @cgrp is not linked.  This
+	 * speculative test can race with a flush unlinking @cgrp, in which
+	 * case the update is only picked up after the next one on @cpu.
+	 * That's fine for stats and keeps barriers out of the hot paths.
+	 */
+	if (READ_ONCE(cgroup_rstat_cpu(cgrp, cpu)->updated_next))
+		return;
+
+	raw_spin_lock_irqsave(cpu_lock, flags);
+
+	/* link @cgrp and all its ancestors which aren't linked yet */
+	for (parent = rstat_parent(cgrp); parent;
+	     cgrp = parent, parent = rstat_parent(cgrp)) {
+		struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(cgrp, cpu);
+		struct cgroup_rstat_cpu *prstatc = cgroup_rstat_cpu(parent, cpu);
+
+		/*
+		 * Cgroups are linked and unlinked bottom up, so if @cgrp
+		 * is linked, all its ancestors are too.
+		 */
+		if (rstatc->updated_next)
+			break;
+
+		rstatc->updated_next = prstatc->updated_children;
+		prstatc->updated_children = cgrp;
+	}
+
+	raw_spin_unlock_irqrestore(cpu_lock, flags);
+}
+
+/**
+ * cgroup_rstat_cpu_pop_updated - iterate and unlink the updated tree
+ * @pos: the cgroup returned by the previous call, NULL to start
+ * @root: the cgroup whose updated subtree is walked
+ * @cpu: the cpu whose updated tree is walked
+ *
+ * Returns the next cgroup of the subtree in post order, that is with
+ * all its updated children returned already, after unlinking it.  @root
+ * itself is returned last if it is linked.  Returns NULL when done.
+ * Called with the cpu's cgroup_rstat_cpu_lock held.
+ */
+static struct cgroup *cgroup_rstat_cpu_pop_updated(struct cgroup *pos,
+						   struct cgroup *root, int cpu)
+{
+	struct cgroup_rstat_cpu *rstatc;
+	struct cgroup *parent;
+
+	if (pos == root)
+		return NULL;
+
+	/* any unvisited cgroup will do as the starting point */
+	if (!pos)
+		pos = root;
+	else
+		pos = rstat_parent(pos);
+
+	/* walk down to the first leaf */
+	while (true) {
+		rstatc = cgroup_rstat_cpu(pos, cpu);
+		if (rstatc->updated_children == pos)
+			break;
+		pos = rstatc->updated_children;
+	}
+
+	/*
+	 * Unlink @pos.  The list is singly linked, but as we always walk
+	 * down the first child, @pos is the first child of its parent
+	 * unless it is @root.
+	 */
+	parent = rstat_parent(pos);
+	if (parent && rstatc->updated_next) {
+		struct cgroup_rstat_cpu *prstatc = cgroup_rstat_cpu(parent, cpu);
+		struct cgroup **nextp = &prstatc->updated_children;
+
+		while (*nextp != pos) {
+			WARN_ON_ONCE(*nextp == parent);
+			nextp = &cgroup_rstat_cpu(*nextp, cpu)->updated_next;
+		}
+
+		*nextp = rstatc->updated_next;
+		WRITE_ONCE(rstatc->updated_next, NULL);
+		return pos;
+	}
+
+	/* only @root which wasn't linked ends up here */
+	return NULL;
+}
+
+static void cgroup_rstat_flush_csses(struct cgroup *cgrp, int cpu)
+{
+	struct cgroup_subsys_state *css;
+
+	list_for_each_entry(css, &cgrp->rstat_css_list, rstat_css_node)
+		css->ss->css_rstat_flush(css, cpu);
+}
+
+/* see cgroup_rstat_flush() */
+static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
+{
+	int cpu;
+
+	lockdep_assert_held(&cgroup_rstat_lock);
+
+	for_each_possible_cpu(cpu) {
+		raw_spinlock_t *cpu_lock = per_cpu_ptr(&cgroup_rstat_cpu_lock,
+						       cpu);
+		struct cgroup *pos = NULL;
+
+		raw_spin_lock(cpu_lock);
+		while ((pos = cgroup_rstat_cpu_pop_updated(pos, cgrp, cpu)))
+			cgroup_rstat_flush_csses(pos, cpu);
+
+		/*
+		 * Hierarchy roots are never linked, updates to their own
+		 * stats are picked up on every flush instead.
+		 */
+		if (!rstat_parent(cgrp))
+			cgroup_rstat_flush_csses(cgrp, cpu);
+		raw_spin_unlock(cpu_lock);
+
+		if (may_sleep && (need_resched() ||
+				  spin_needbreak(&cgroup_rstat_lock))) {
+			spin_unlock_irq(&cgroup_rstat_lock);
+			if (!cond_resched())
+				cpu_relax();
+			spin_lock_irq(&cgroup_rstat_lock);
+		}
+	}
+}
+
+/**
+ * cgroup_rstat_flush - flush the stats of a cgroup subtree
+ * @cgrp: the cgroup to flush
+ *
+ * Fold all pending per-cpu updates of @cgrp and its descendants into
+ * the totals the controllers keep for them.  Once this returns, the
+ * totals of @cgrp reflect every update made before the call.  Might
+ * sleep.
+ */
+void cgroup_rstat_flush(struct cgroup *cgrp)
+{
+	might_sleep();
+
+	spin_lock_irq(&cgroup_rstat_lock);
+	cgroup_rstat_flush_locked(cgrp, true);
+	spin_unlock_irq(&cgroup_rstat_lock);
+}
+
+/**
+ * cgroup_rstat_flush_hold - flush the stats of a cgroup subtree and hold
+ * @cgrp: the cgroup to flush
+ *
+ * Like cgroup_rstat_flush() but keeps further flushes from changing the
+ * totals until cgroup_rstat_flush_release() is called, so the caller
+ * can take a consistent snapshot.  Returns with irqs disabled, which
+ * the caller must keep short.
+ */
+void cgroup_rstat_flush_hold(struct cgroup *cgrp)
+	__acquires(&cgroup_rstat_lock)
+{
+	might_sleep();
+
+	spin_lock_irq(&cgroup_rstat_lock);
+	cgroup_rstat_flush_locked(cgrp, true);
+}
+
+/**
+ * cgroup_rstat_flush_release - release cgroup_rstat_flush_hold()
+ */
+void cgroup_rstat_flush_release(void)
+	__releases(&cgroup_rstat_lock)
+{
+	spin_unlock_irq(&cgroup_rstat_lock);
+}
+
+/**
+ * cgroup_rstat_css_link - start flushing a css
+ * @css: the css which came online
+ *
+ * Called by cgroup core when @css comes online, if its subsystem
+ * implements css_rstat_flush().
+ */
+void cgroup_rstat_css_link(struct cgroup_subsys_state *css)
+{
+	unsigned long flags;
+
+	/* early subsystems come online before irqs are enabled */
+	spin_lock_irqsave(&cgroup_rstat_lock, flags);
+	list_add_tail(&css->rstat_css_node, &css->cgroup->rstat_css_list);
+	spin_unlock_irqrestore(&cgroup_rstat_lock, flags);
+}
+
+/**
+ * cgroup_rstat_css_unlink - stop flushing a css
+ * @css: the css being released or moved to another cgroup
+ *
+ * Flushes the pending updates of @css's cgroup, so that they end up in
+ * the totals of @css and of its ancestors, before unlinking @css.
+ */
+void cgroup_rstat_css_unlink(struct cgroup_subsys_state *css)
+{
+	if (list_empty(&css->rstat_css_node))
+		return;
+
+	spin_lock_irq(&cgroup_rstat_lock);
+	cgroup_rstat_flush_locked(css->cgroup, false);
+	list_del_init(&css->rstat_css_node);
+	spin_unlock_irq(&cgroup_rstat_lock);
+}
+
+int cgroup_rstat_init(struct cgroup *cgrp)
+{
+	int cpu;
+
+	cgrp->rstat_cpu = alloc_percpu(struct cgroup_rstat_cpu);
+	if (!cgrp->rstat_cpu)
+		return -ENOMEM;
+
+	/* an empty updated_children list is terminated by its owner */
+	for_each_possible_cpu(cpu)
+		cgroup_rstat_cpu(cgrp, cpu)->updated_children = cgrp;
+
+	return 0;
+}
+
+void cgroup_rstat_exit(struct cgroup *cgrp)
+{
+	int cpu;
+
+	if (!cgrp->rstat_cpu)
+		return;
+
+	/* unlink @cgrp, its parent must still be around */
+	cgroup_rstat_flush(cgrp);
+
+	for_each_possible_cpu(cpu) {
+		struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(cgrp, cpu);
+
+		if (WARN_ON_ONCE(rstatc->updated_children != cgrp) ||
+		    WARN_ON_ONCE(rstatc->updated_next))
+			return;
+	}
+
+	free_percpu(cgrp->rstat_cpu);
+	cgrp->rstat_cpu = NULL;
+}
+
+void __init cgroup_rstat_boot(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		raw_spin_lock_init(per_cpu_ptr(&cgroup_rstat_cpu_lock, cpu));
+}
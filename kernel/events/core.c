@@ -672,6 +672,70 @@ perf_cgroup_mark_enabled(struct perf_event *event,
 		}
 	}
 }
+
+/*
+ * cpu contexts keep a second index of their group leaders: those
+ * attached to a cgroup on the cgroup's perf_cgroup_info for the cpu,
+ * all others on the perf_cpu_context itself. A cgroup switch then
+ * only has to look at the groups which can match the new cgroup.
+ *
+ * The cgroup lists are shared by the cpu contexts of all pmus. Like
+ * the context lists they are only modified and walked on their own
+ * cpu with interrupts disabled, which serializes them too.
+ */
+static struct list_head *
+perf_cgroup_group_list(struct perf_event *event, struct perf_event_context *ctx)
+{
+	struct perf_cpu_context *cpuctx;
+	struct perf_cgroup_info *info;
+
+	if (is_cgroup_event(event)) {
+		info = per_cpu_ptr(event->cgrp->info, event->cpu);
+		if (event->attr.pinned)
+			return &info->pinned_groups;
+		return &info->flexible_groups;
+	}
+
+	cpuctx = container_of(ctx, struct perf_cpu_context, ctx);
+	if (event->attr.pinned)
+		return &cpuctx->pinned_groups;
+	return &cpuctx->flexible_groups;
+}
+
+static inline void
+perf_cgroup_group_add(struct perf_event *event, struct perf_event_context *ctx)
+{
+	if (ctx->task)
+		return;
+
+	list_add_tail(&event->cgrp_group_entry,
+		      perf_cgroup_group_list(event, ctx));
+}
+
+static inline void perf_cgroup_group_del(struct perf_event *event)
+{
+	list_del_init(&event->cgrp_group_entry);
+}
+
+/*
+ * Whether @ctx should be scheduled in through the cgroup index
+ * rather than by walking all of its groups.
+ */
+static inline bool perf_cgroup_indexed(struct perf_event_context *ctx)
+{
+	return !ctx->task && ctx->nr_cgroups;
+}
+
+static inline void perf_cgroup_event_init(struct perf_event *event)
+{
+	INIT_LIST_HEAD(&event->cgrp_group_entry);
+}
+
+static inline void perf_cgroup_cpuctx_init(struct perf_cpu_context *cpuctx)
+{
+	INIT_LIST_HEAD(&cpuctx->pinned_groups);
+	INIT_LIST_HEAD(&cpuctx->flexible_groups);
+}
 #else /* !CONFIG_CGROUP_PERF */
 
 static inline bool
@@ -749,6 +813,28 @@ perf_cgroup_mark_enabled(struct perf_event *event,
 			 struct perf_event_context *ctx)
 {
 }
+
+static inline void
+perf_cgroup_group_add(struct perf_event *event, struct perf_event_context *ctx)
+{
+}
+
+static inline void perf_cgroup_group_del(struct perf_event *event)
+{
+}
+
+static inline bool perf_cgroup_indexed(struct perf_event_context *ctx)
+{
+	return false;
+}
+
+static inline void perf_cgroup_event_init(struct perf_event *event)
+{
+}
+
+static inline void perf_cgroup_cpuctx_init(struct perf_cpu_context *cpuctx)
+{
+}
 #endif
 
 /*
@@ -1231,6 +1317,7 @@ list_add_event(struct perf_event *event, struct perf_event_context *ctx)
 
 		list = ctx_group_list(event, ctx);
 		list_add_tail(&event->group_entry, list);
+		perf_cgroup_group_add(event, ctx);
 	}
 
 	if (is_cgroup_event(event))
@@ -1433,8 +1520,10 @@ list_del_event(struct perf_event *event, struct perf_event_context *ctx)
 
 	list_del_rcu(&event->event_entry);
 
-	if (event->group_leader == event)
+	if (event->group_leader == event) {
 		list_del_init(&event->group_entry);
+		perf_cgroup_group_del(event);
+	}
 
 	update_group_times(event);
 
@@ -1482,8 +1571,10 @@ static void perf_group_detach(struct perf_event *event)
 	 * to whatever list we are on.
 	 */
 	list_for_each_entry_safe(sibling, tmp, &event->sibling_list, group_entry) {
-		if (list)
+		if (list) {
 			list_move_tail(&sibling->group_entry, list);
+			perf_cgroup_group_add(sibling, sibling->ctx);
+		}
 		sibling->group_leader = sibling;
 
 		/* Inherit group flags from the previous leader */
@@ -2719,35 +2810,165 @@ static void cpu_ctx_sched_out(struct perf_cpu_context *cpuctx,
 }
 
 static void
-ctx_pinned_sched_in(struct perf_event_context *ctx,
-		    struct perf_cpu_context *cpuctx)
+pinned_group_sched_in(struct perf_event *event,
+		      struct perf_event_context *ctx,
+		      struct perf_cpu_context *cpuctx)
 {
+	if (event->state <= PERF_EVENT_STATE_OFF)
+		return;
+	if (!event_filter_match(event))
+		return;
+
+	/* may need to reset tstamp_enabled */
+	if (is_cgroup_event(event))
+		perf_cgroup_mark_enabled(event, ctx);
+
+	if (group_can_go_on(event, cpuctx, 1))
+		group_sched_in(event, cpuctx, ctx);
+
+	/*
+	 * If this pinned group hasn't been scheduled,
+	 * put it in error state.
+	 */
+	if (event->state == PERF_EVENT_STATE_INACTIVE) {
+		update_group_times(event);
+		event->state = PERF_EVENT_STATE_ERROR;
+	}
+}
+
+static void
+flexible_group_sched_in(struct perf_event *event,
+			struct perf_event_context *ctx,
+			struct perf_cpu_context *cpuctx,
+			int *can_add_hw)
+{
+	/* Ignore events in OFF or ERROR state */
+	if (event->state <= PERF_EVENT_STATE_OFF)
+		return;
+	/*
+	 * Listen to the 'cpu' scheduling filter constraint
+	 * of events:
+	 */
+	if (!event_filter_match(event))
+		return;
+
+	/* may need to reset tstamp_enabled */
+	if (is_cgroup_event(event))
+		perf_cgroup_mark_enabled(event, ctx);
+
+	if (group_can_go_on(event, cpuctx, *can_add_hw)) {
+		if (group_sched_in(event, cpuctx, ctx))
+			*can_add_hw = 0;
+	}
+}
+
+#ifdef CONFIG_CGROUP_PERF
+/*
+ * A cgroup event also counts for the descendants of its cgroup, so
+ * the groups which can match are those not attached to any cgroup
+ * plus those of cpuctx->cgrp and of each of its ancestors.
+ */
+static inline struct perf_cgroup_info *
+perf_cgroup_css_info(struct cgroup_subsys_state *css)
+{
+	return this_cpu_ptr(container_of(css, struct perf_cgroup, css)->info);
+}
+
+static inline struct cgroup_subsys_state *
+perf_cgroup_css(struct perf_cpu_context *cpuctx)
+{
+	return cpuctx->cgrp ? &cpuctx->cgrp->css : NULL;
+}
+
+static void
+cgrp_pinned_sched_in(struct perf_event_context *ctx,
+		     struct perf_cpu_context *cpuctx)
+{
+	struct cgroup_subsys_state *css;
+	struct perf_cgroup_info *info;
 	struct perf_event *event;
 
-	list_for_each_entry(event, &ctx->pinned_groups, group_entry) {
-		if (event->state <= PERF_EVENT_STATE_OFF)
-			continue;
-		if (!event_filter_match(event))
-			continue;
+	list_for_each_entry(event, &cpuctx->pinned_groups, cgrp_group_entry)
+		pinned_group_sched_in(event, ctx, cpuctx);
 
-		/* may need to reset tstamp_enabled */
-		if (is_cgroup_event(event))
-			perf_cgroup_mark_enabled(event, ctx);
+	for (css = perf_cgroup_css(cpuctx); css; css = css->parent) {
+		info = perf_cgroup_css_info(css);
+		list_for_each_entry(event, &info->pinned_groups, cgrp_group_entry) {
+			if (event->ctx == ctx)
+				pinned_group_sched_in(event, ctx, cpuctx);
+		}
+	}
+}
 
-		if (group_can_go_on(event, cpuctx, 1))
-			group_sched_in(event, cpuctx, ctx);
+static void
+cgrp_flexible_sched_in(struct perf_event_context *ctx,
+		       struct perf_cpu_context *cpuctx)
+{
+	struct cgroup_subsys_state *css;
+	struct perf_cgroup_info *info;
+	struct perf_event *event;
+	int can_add_hw = 1;
 
-		/*
-		 * If this pinned group hasn't been scheduled,
-		 * put it in error state.
-		 */
-		if (event->state == PERF_EVENT_STATE_INACTIVE) {
-			update_group_times(event);
-			event->state = PERF_EVENT_STATE_ERROR;
+	list_for_each_entry(event, &cpuctx->flexible_groups, cgrp_group_entry)
+		flexible_group_sched_in(event, ctx, cpuctx, &can_add_hw);
+
+	for (css = perf_cgroup_css(cpuctx); css; css = css->parent) {
+		info = perf_cgroup_css_info(css);
+		list_for_each_entry(event, &info->flexible_groups, cgrp_group_entry) {
+			if (event->ctx == ctx)
+				flexible_group_sched_in(event, ctx, cpuctx,
+							&can_add_hw);
 		}
 	}
 }
 
+static void cgrp_rotate_ctx(struct perf_event_context *ctx)
+{
+	struct perf_cpu_context *cpuctx;
+	struct cgroup_subsys_state *css;
+
+	if (!perf_cgroup_indexed(ctx))
+		return;
+
+	cpuctx = container_of(ctx, struct perf_cpu_context, ctx);
+	list_rotate_left(&cpuctx->flexible_groups);
+
+	for (css = perf_cgroup_css(cpuctx); css; css = css->parent)
+		list_rotate_left(&perf_cgroup_css_info(css)->flexible_groups);
+}
+#else /* !CONFIG_CGROUP_PERF */
+static inline void
+cgrp_pinned_sched_in(struct perf_event_context *ctx,
+		     struct perf_cpu_context *cpuctx)
+{
+}
+
+static inline void
+cgrp_flexible_sched_in(struct perf_event_context *ctx,
+		       struct perf_cpu_context *cpuctx)
+{
+}
+
+static inline void cgrp_rotate_ctx(struct perf_event_context *ctx)
+{
+}
+#endif
+
+static void
+ctx_pinned_sched_in(struct perf_event_context *ctx,
+		    struct perf_cpu_context *cpuctx)
+{
+	struct perf_event *event;
+
+	if (perf_cgroup_indexed(ctx)) {
+		cgrp_pinned_sched_in(ctx, cpuctx);
+		return;
+	}
+
+	list_for_each_entry(event, &ctx->pinned_groups, group_entry)
+		pinned_group_sched_in(event, ctx, cpuctx);
+}
+
 static void
 ctx_flexible_sched_in(struct perf_event_context *ctx,
 		      struct perf_cpu_context *cpuctx)
@@ -2755,26 +2976,13 @@ ctx_flexible_sched_in(struct perf_event_context *ctx,
 	struct perf_event *event;
 	int can_add_hw = 1;
 
-	list_for_each_entry(event, &ctx->flexible_groups, group_entry) {
-		/* Ignore events in OFF or ERROR state */
-		if (event->state <= PERF_EVENT_STATE_OFF)
-			continue;
-		/*
-		 * Listen to the 'cpu' scheduling filter constraint
-		 * of events:
-		 */
-		if (!event_filter_match(event))
-			continue;
-
-		/* may need to reset tstamp_enabled */
-		if (is_cgroup_event(event))
-			perf_cgroup_mark_enabled(event, ctx);
-
-		if (group_can_go_on(event, cpuctx, can_add_hw)) {
-			if (group_sched_in(event, cpuctx, ctx))
-				can_add_hw = 0;
-		}
+	if (perf_cgroup_indexed(ctx)) {
+		cgrp_flexible_sched_in(ctx, cpuctx);
+		return;
 	}
+
+	list_for_each_entry(event, &ctx->flexible_groups, group_entry)
+		flexible_group_sched_in(event, ctx, cpuctx, &can_add_hw);
 }
 
 static void
@@ -3066,8 +3274,10 @@ static void rotate_ctx(struct perf_event_context *ctx)
 	 * Rotate the first entry last of non-pinned groups. Rotation might be
 	 * disabled by the inheritance code.
 	 */
-	if (!ctx->rotate_disable)
+	if (!ctx->rotate_disable) {
 		list_rotate_left(&ctx->flexible_groups);
+		cgrp_rotate_ctx(ctx);
+	}
 }
 
 static int perf_rotate_context(struct perf_cpu_context *cpuctx)
@@ -7669,6 +7879,7 @@ skip_type:
 		lockdep_set_class(&cpuctx->ctx.mutex, &cpuctx_mutex);
 		lockdep_set_class(&cpuctx->ctx.lock, &cpuctx_lock);
 		cpuctx->ctx.pmu = pmu;
+		perf_cgroup_cpuctx_init(cpuctx);
 
 		__perf_mux_hrtimer_init(cpuctx, cpu);
 
@@ -7886,6 +8097,7 @@ perf_event_alloc(struct perf_event_attr *attr, int cpu,
 	INIT_LIST_HEAD(&event->group_entry);
 	INIT_LIST_HEAD(&event->event_entry);
 	INIT_LIST_HEAD(&event->sibling_list);
+	perf_cgroup_event_init(event);
 	INIT_LIST_HEAD(&event->rb_entry);
 	INIT_LIST_HEAD(&event->active_entry);
 	INIT_HLIST_NODE(&event->hlist_entry);
@@ -9443,7 +9655,9 @@ device_initcall(perf_event_sysfs_init);
 static struct cgroup_subsys_state *
 perf_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 {
+	struct perf_cgroup_info *info;
 	struct perf_cgroup *jc;
+	int cpu;
 
 	jc = kzalloc(sizeof(*jc), GFP_KERNEL);
 	if (!jc)
@@ -9455,6 +9669,12 @@ perf_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 		return ERR_PTR(-ENOMEM);
 	}
 
+	for_each_possible_cpu(cpu) {
+		info = per_cpu_ptr(jc->info, cpu);
+		INIT_LIST_HEAD(&info->pinned_groups);
+		INIT_LIST_HEAD(&info->flexible_groups);
+	}
+
 	return &jc->css;
 }
 
@@ -12,6 +12,7 @@ struct ring_buffer {
 	atomic_t			refcount;
 	struct rcu_head			rcu_head;
 	struct irq_work			irq_work;
+	struct irq_work			wakeup_work;
 #ifdef CONFIG_PERF_USE_VMALLOC
 	struct work_struct		work;
 	int				page_order;	/* allocation order  */
@@ -62,6 +63,7 @@ static inline void rb_free_rcu(struct rcu_head *rcu_head)
 	struct ring_buffer *rb;
 
 	rb = container_of(rcu_head, struct ring_buffer, rcu_head);
+	irq_work_sync(&rb->wakeup_work);
 	rb_free(rb);
 }
 
@@ -182,8 +184,6 @@ DEFINE_OUTPUT_COPY(__output_copy_user, arch_perf_out_copy_user)
 /* Callchain handling */
 extern struct perf_callchain_entry *
 perf_callchain(struct perf_event *event, struct pt_regs *regs);
-extern int get_callchain_buffers(void);
-extern void put_callchain_buffers(void);
 
 static inline int get_recursion_context(int *recursion)
 {
@@ -21,8 +21,12 @@ static void perf_output_wakeup(struct perf_output_handle *handle)
 {
 	atomic_set(&handle->rb->poll, POLLIN);
 
-	handle->event->pending_wakeup = 1;
-	irq_work_queue(&handle->event->pending);
+	/*
+	 * The wakeup is per buffer rather than per event: however many
+	 * of the events redirected into it write before the irq_work
+	 * runs, their waiters are woken by a single walk of event_list.
+	 */
+	irq_work_queue(&handle->rb->wakeup_work);
 }
 
 /*
@@ -223,6 +227,17 @@ void perf_output_end(struct perf_output_handle *handle)
 
 static void rb_irq_work(struct irq_work *work);
 
+static void rb_wakeup_work(struct irq_work *work)
+{
+	struct ring_buffer *rb = container_of(work, struct ring_buffer, wakeup_work);
+	struct perf_event *event;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(event, &rb->event_list, rb_entry)
+		wake_up_all(&event->waitq);
+	rcu_read_unlock();
+}
+
 static void
 ring_buffer_init(struct ring_buffer *rb, long watermark, int flags)
 {
@@ -244,6 +259,7 @@ ring_buffer_init(struct ring_buffer *rb, long watermark, int flags)
 	INIT_LIST_HEAD(&rb->event_list);
 	spin_lock_init(&rb->event_lock);
 	init_irq_work(&rb->irq_work, rb_irq_work);
+	init_irq_work(&rb->wakeup_work, rb_wakeup_work);
 }
 
 static void ring_buffer_put_async(struct ring_buffer *rb)
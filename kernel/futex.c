@@ -63,7 +63,7 @@
 #include <linux/sched/rt.h>
 #include <linux/hugetlb.h>
 #include <linux/freezer.h>
-#include <linux/bootmem.h>
+#include <linux/vmalloc.h>
 #include <linux/fault-inject.h>
 
 #include <asm/futex.h>
@@ -182,6 +182,7 @@ int __read_mostly futex_cmpxchg_enabled;
 #define FLAGS_SHARED		0x01
 #define FLAGS_CLOCKRT		0x02
 #define FLAGS_HAS_TIMEOUT	0x04
+#define FLAGS_NUMA		0x08
 
 /*
  * Priority Inheritance state:
@@ -256,16 +257,33 @@ struct futex_hash_bucket {
 } ____cacheline_aligned_in_smp;
 
 /*
- * The base of the bucket array and its size are always used together
- * (after initialization only in hash_futex()), so ensure that they
- * reside in the same cacheline.
+ * There is a bucket array per node, all of the same size.  The arrays,
+ * their size and its log are always used together (after initialization
+ * only in hash_futex()), so ensure that they reside in the same cacheline.
  */
 static struct {
-	struct futex_hash_bucket *queues;
+	struct futex_hash_bucket **queues;
 	unsigned long            hashsize;
-} __futex_data __read_mostly __aligned(2*sizeof(long));
-#define futex_queues   (__futex_data.queues)
-#define futex_hashsize (__futex_data.hashsize)
+	unsigned int             hashshift;
+} __futex_data __read_mostly __aligned(4*sizeof(long));
+#define futex_queues    (__futex_data.queues)
+#define futex_hashsize  (__futex_data.hashsize)
+#define futex_hashshift (__futex_data.hashshift)
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+/*
+ * The hash of an mm's private futexes.  Whether an mm has one is settled
+ * for good by its first private futex operation: a waiter hashed one way
+ * would never be found by a waker hashed the other.  If it can't have
+ * one, mm->futex_hash is FUTEX_HASH_GLOBAL.
+ */
+struct futex_private_hash {
+	unsigned long			hashmask;
+	struct futex_hash_bucket	queues[0];
+};
+
+#define FUTEX_HASH_GLOBAL	((struct futex_private_hash *)1UL)
+#endif
 
 
 /*
@@ -374,14 +392,33 @@ static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
 }
 
 /*
- * We hash on the keys returned from get_futex_key (see below).
+ * We hash on the keys returned from get_futex_key (see below).  A key
+ * without a node hint goes to the node picked by the hash bits left
+ * over from the bucket index, which spreads such futexes over all the
+ * nodes as a single interleaved table would.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & (futex_hashsize - 1)];
+	int node = key->both.node;
+
+	if (node == FUTEX_NO_NODE) {
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+		if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+			struct futex_private_hash *fph;
+
+			fph = READ_ONCE(key->private.mm->futex_hash);
+			if (fph != FUTEX_HASH_GLOBAL)
+				return &fph->queues[hash & fph->hashmask];
+		}
+#endif
+		node = nr_node_ids > 1 ?
+		       (hash >> futex_hashshift) % nr_node_ids : 0;
+	}
+
+	return &futex_queues[node][hash & (futex_hashsize - 1)];
 }
 
 /*
@@ -446,10 +483,108 @@ static void drop_futex_key_refs(union futex_key *key)
 	}
 }
 
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+/*
+ * Sized for the threads the mm has by now, or for the CPUs they could
+ * run on if there are more of those, but never bigger than a node's
+ * part of the global hash.
+ */
+static void futex_private_hash_init(struct mm_struct *mm)
+{
+	struct futex_private_hash *fph;
+	unsigned long size, i;
+
+	if (likely(READ_ONCE(mm->futex_hash)))
+		return;
+
+	size = roundup_pow_of_two(4 * max_t(int, get_nr_threads(current),
+					    num_online_cpus()));
+	size = clamp(size, 16UL, futex_hashsize);
+
+	fph = kmalloc(sizeof(*fph) + size * sizeof(struct futex_hash_bucket),
+		      GFP_KERNEL | __GFP_NOWARN);
+	if (!fph)
+		fph = vmalloc(sizeof(*fph) +
+			      size * sizeof(struct futex_hash_bucket));
+
+	if (fph) {
+		fph->hashmask = size - 1;
+		for (i = 0; i < size; i++) {
+			atomic_set(&fph->queues[i].waiters, 0);
+			plist_head_init(&fph->queues[i].chain);
+			spin_lock_init(&fph->queues[i].lock);
+		}
+	} else {
+		fph = FUTEX_HASH_GLOBAL;
+	}
+
+	if (cmpxchg(&mm->futex_hash, NULL, fph) && fph != FUTEX_HASH_GLOBAL)
+		kvfree(fph);
+}
+
+/* called once the last user of @mm is gone, with nobody left to wait */
+void futex_private_hash_free(struct mm_struct *mm)
+{
+	struct futex_private_hash *fph = mm->futex_hash;
+
+	if (fph && fph != FUTEX_HASH_GLOBAL)
+		kvfree(fph);
+	mm->futex_hash = NULL;
+}
+#else
+static inline void futex_private_hash_init(struct mm_struct *mm)
+{
+}
+#endif
+
+static int fault_in_user_writeable(u32 __user *uaddr);
+
+/*
+ * Read the node hint of a FUTEX_NUMA_FLAG futex, which follows the futex
+ * word.  An unset hint is claimed for the node we run on, so that all
+ * the users of the futex agree on it from then on.
+ */
+static int futex_get_node(u32 __user *uaddr, union futex_key *key)
+{
+	u32 __user *naddr = uaddr + 1;
+	u32 node, cur;
+	int ret;
+
+retry:
+	if (get_user(node, naddr))
+		return -EFAULT;
+
+	if (node == FUTEX_NO_NODE) {
+		node = numa_node_id();
+
+		pagefault_disable();
+		ret = futex_atomic_cmpxchg_inatomic(&cur, naddr,
+						    FUTEX_NO_NODE, node);
+		pagefault_enable();
+
+		if (ret == -EFAULT) {
+			if (fault_in_user_writeable(naddr))
+				return -EFAULT;
+			goto retry;
+		}
+		if (ret)
+			return ret;
+		if (cur != FUTEX_NO_NODE)
+			node = cur;
+	}
+
+	if (node >= nr_node_ids || !node_possible(node))
+		return -EINVAL;
+
+	key->both.node = node;
+	return 0;
+}
+
 /**
  * get_futex_key() - Get parameters which are the keys for a futex
  * @uaddr:	virtual address of the futex
- * @fshared:	0 for a PROCESS_PRIVATE futex, 1 for PROCESS_SHARED
+ * @flags:	FLAGS_SHARED for a PROCESS_SHARED futex, FLAGS_NUMA if it
+ *		carries a node hint
  * @key:	address where result is stored.
  * @rw:		mapping needs to be read/write (values: VERIFY_READ,
  *              VERIFY_WRITE)
@@ -465,24 +600,36 @@ static void drop_futex_key_refs(union futex_key *key)
  * lock_page() might sleep, the caller should not hold a spinlock.
  */
 static int
-get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key, int rw)
+get_futex_key(u32 __user *uaddr, unsigned int flags, union futex_key *key,
+	      int rw)
 {
 	unsigned long address = (unsigned long)uaddr;
 	struct mm_struct *mm = current->mm;
 	struct page *page, *page_head;
+	int fshared = flags & FLAGS_SHARED;
 	int err, ro = 0;
 
 	/*
-	 * The futex address must be "naturally" aligned.
+	 * The futex address must be "naturally" aligned, along with the
+	 * node hint if there is one.
 	 */
 	key->both.offset = address % PAGE_SIZE;
+	key->both.node = FUTEX_NO_NODE;
 	if (unlikely((address % sizeof(u32)) != 0))
 		return -EINVAL;
+	if ((flags & FLAGS_NUMA) && unlikely(address % (2 * sizeof(u32))))
+		return -EINVAL;
 	address -= key->both.offset;
 
 	if (unlikely(!access_ok(rw, uaddr, sizeof(u32))))
 		return -EFAULT;
 
+	if (flags & FLAGS_NUMA) {
+		err = futex_get_node(uaddr, key);
+		if (err)
+			return err;
+	}
+
 	if (unlikely(should_fail_futex(fshared)))
 		return -EFAULT;
 
@@ -496,6 +643,8 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key, int rw)
 	if (!fshared) {
 		key->private.mm = mm;
 		key->private.address = address;
+		if (key->both.node == FUTEX_NO_NODE)
+			futex_private_hash_init(mm);
 		get_futex_key_refs(key);  /* implies MB (B) */
 		return 0;
 	}
@@ -1331,7 +1480,7 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 	if (!bitset)
 		return -EINVAL;
 
-	ret = get_futex_key(uaddr, flags & FLAGS_SHARED, &key, VERIFY_READ);
+	ret = get_futex_key(uaddr, flags, &key, VERIFY_READ);
 	if (unlikely(ret != 0))
 		goto out;
 
@@ -1383,10 +1532,10 @@ futex_wake_op(u32 __user *uaddr1, unsigned int flags, u32 __user *uaddr2,
 	WAKE_Q(wake_q);
 
 retry:
-	ret = get_futex_key(uaddr1, flags & FLAGS_SHARED, &key1, VERIFY_READ);
+	ret = get_futex_key(uaddr1, flags, &key1, VERIFY_READ);
 	if (unlikely(ret != 0))
 		goto out;
-	ret = get_futex_key(uaddr2, flags & FLAGS_SHARED, &key2, VERIFY_WRITE);
+	ret = get_futex_key(uaddr2, flags, &key2, VERIFY_WRITE);
 	if (unlikely(ret != 0))
 		goto out_put_key1;
 
@@ -1650,10 +1799,10 @@ static int futex_requeue(u32 __user *uaddr1, unsigned int flags,
 	}
 
 retry:
-	ret = get_futex_key(uaddr1, flags & FLAGS_SHARED, &key1, VERIFY_READ);
+	ret = get_futex_key(uaddr1, flags, &key1, VERIFY_READ);
 	if (unlikely(ret != 0))
 		goto out;
-	ret = get_futex_key(uaddr2, flags & FLAGS_SHARED, &key2,
+	ret = get_futex_key(uaddr2, flags, &key2,
 			    requeue_pi ? VERIFY_WRITE : VERIFY_READ);
 	if (unlikely(ret != 0))
 		goto out_put_key1;
@@ -2242,7 +2391,7 @@ static int futex_wait_setup(u32 __user *uaddr, u32 val, unsigned int flags,
 	 * while the syscall executes.
 	 */
 retry:
-	ret = get_futex_key(uaddr, flags & FLAGS_SHARED, &q->key, VERIFY_READ);
+	ret = get_futex_key(uaddr, flags, &q->key, VERIFY_READ);
 	if (unlikely(ret != 0))
 		return ret;
 
@@ -2396,7 +2545,7 @@ static int futex_lock_pi(u32 __user *uaddr, unsigned int flags,
 	}
 
 retry:
-	ret = get_futex_key(uaddr, flags & FLAGS_SHARED, &q.key, VERIFY_WRITE);
+	ret = get_futex_key(uaddr, flags, &q.key, VERIFY_WRITE);
 	if (unlikely(ret != 0))
 		goto out;
 
@@ -2520,7 +2669,7 @@ retry:
 	if ((uval & FUTEX_TID_MASK) != vpid)
 		return -EPERM;
 
-	ret = get_futex_key(uaddr, flags & FLAGS_SHARED, &key, VERIFY_WRITE);
+	ret = get_futex_key(uaddr, flags, &key, VERIFY_WRITE);
 	if (ret)
 		return ret;
 
@@ -2721,7 +2870,7 @@ static int futex_wait_requeue_pi(u32 __user *uaddr, unsigned int flags,
 	RB_CLEAR_NODE(&rt_waiter.tree_entry);
 	rt_waiter.task = NULL;
 
-	ret = get_futex_key(uaddr2, flags & FLAGS_SHARED, &key2, VERIFY_WRITE);
+	ret = get_futex_key(uaddr2, flags, &key2, VERIFY_WRITE);
 	if (unlikely(ret != 0))
 		goto out;
 
@@ -3074,13 +3223,16 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 			return -ENOSYS;
 	}
 
+	if (op & FUTEX_NUMA_FLAG)
+		flags |= FLAGS_NUMA;
+
 	switch (cmd) {
 	case FUTEX_LOCK_PI:
 	case FUTEX_UNLOCK_PI:
 	case FUTEX_TRYLOCK_PI:
 	case FUTEX_WAIT_REQUEUE_PI:
 	case FUTEX_CMP_REQUEUE_PI:
-		if (!futex_cmpxchg_enabled)
+		if (!futex_cmpxchg_enabled || (flags & FLAGS_NUMA))
 			return -ENOSYS;
 	}
 
@@ -3151,6 +3303,229 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 	return do_futex(uaddr, op, val, tp, uaddr2, val2, val3);
 }
 
+/**
+ * struct futex_vector - a futex of futex_waitv(), and its queue entry
+ * @w:	the futex_waitv as userspace passed it
+ * @q:	the futex_q queued on the futex
+ */
+struct futex_vector {
+	struct futex_waitv w;
+	struct futex_q q;
+};
+
+#define FUTEX_WAITV_FLAGS	(FUTEX_32 | FUTEX_PRIVATE_FLAG | FUTEX_NUMA_FLAG)
+
+static inline u32 __user *futex_waitv_uaddr(struct futex_vector *v)
+{
+	return (u32 __user *)(unsigned long)v->w.uaddr;
+}
+
+static inline unsigned int futex_waitv_flags(struct futex_vector *v)
+{
+	unsigned int flags = 0;
+
+	if (!(v->w.flags & FUTEX_PRIVATE_FLAG))
+		flags |= FLAGS_SHARED;
+	if (v->w.flags & FUTEX_NUMA_FLAG)
+		flags |= FLAGS_NUMA;
+	return flags;
+}
+
+static int futex_parse_waitv(struct futex_vector *vs,
+			     struct futex_waitv __user *uwaitv,
+			     unsigned int nr_futexes)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_futexes; i++) {
+		struct futex_waitv *w = &vs[i].w;
+
+		if (copy_from_user(w, &uwaitv[i], sizeof(*w)))
+			return -EFAULT;
+
+		if ((w->flags & ~FUTEX_WAITV_FLAGS) || w->__reserved ||
+		    !(w->flags & FUTEX_32))
+			return -EINVAL;
+		if (w->val > U32_MAX || (unsigned long)w->uaddr != w->uaddr)
+			return -EINVAL;
+
+		vs[i].q = futex_q_init;
+	}
+
+	return 0;
+}
+
+/*
+ * Unqueue the first @count futexes, dropping their key references.
+ * Returns the index of the first one of them we were woken on, or -1.
+ */
+static int futex_unqueue_waitv(struct futex_vector *vs, int count)
+{
+	int i, ret = -1;
+
+	for (i = 0; i < count; i++) {
+		if (!unqueue_me(&vs[i].q) && ret < 0)
+			ret = i;
+	}
+	return ret;
+}
+
+/*
+ * futex_wait_setup() for a vector of futexes: queue on each of them in
+ * turn, with the value checked under the bucket lock as usual.  The
+ * task is put to sleep before the first one is queued, so a wakeup on
+ * any of them from then on is not lost.
+ *
+ * Return:
+ *  0 - queued on all the futexes, with the task state set;
+ *  1 - woken on one of them already, its index is in @woken;
+ * <0 - -EFAULT or -EWOULDBLOCK, the task is running again
+ */
+static int futex_waitv_setup(struct futex_vector *vs, int count, int *woken)
+{
+	struct futex_hash_bucket *hb;
+	int i, j, ret;
+	u32 uval;
+
+retry:
+	for (i = 0; i < count; i++) {
+		ret = get_futex_key(futex_waitv_uaddr(&vs[i]),
+				    futex_waitv_flags(&vs[i]), &vs[i].q.key,
+				    VERIFY_READ);
+		if (unlikely(ret)) {
+			while (i--)
+				put_futex_key(&vs[i].q.key);
+			return ret;
+		}
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	for (i = 0; i < count; i++) {
+		u32 __user *uaddr = futex_waitv_uaddr(&vs[i]);
+
+		hb = queue_lock(&vs[i].q);
+		ret = get_futex_value_locked(&uval, uaddr);
+		if (!ret && uval == vs[i].w.val) {
+			queue_me(&vs[i].q, hb);
+			continue;
+		}
+
+		queue_unlock(hb);
+		__set_current_state(TASK_RUNNING);
+
+		*woken = futex_unqueue_waitv(vs, i);
+		for (j = i; j < count; j++)
+			put_futex_key(&vs[j].q.key);
+		if (*woken >= 0)
+			return 1;
+
+		if (ret) {
+			if (get_user(uval, uaddr))
+				return -EFAULT;
+			goto retry;
+		}
+		return -EWOULDBLOCK;
+	}
+
+	return 0;
+}
+
+static int futex_wait_multiple(struct futex_vector *vs, int count,
+			       struct hrtimer_sleeper *to)
+{
+	int i, ret, woken = -1;
+
+	for (;;) {
+		ret = futex_waitv_setup(vs, count, &woken);
+		if (ret)
+			return ret > 0 ? woken : ret;
+
+		/*
+		 * If any of the futex_qs was taken off its hash list,
+		 * another task has tried to wake us already.
+		 */
+		for (i = 0; i < count; i++) {
+			if (plist_node_empty(&vs[i].q.list))
+				break;
+		}
+		if (i == count && (!to || to->task))
+			freezable_schedule();
+		__set_current_state(TASK_RUNNING);
+
+		ret = futex_unqueue_waitv(vs, count);
+		if (ret >= 0)
+			return ret;
+		if (to && !to->task)
+			return -ETIMEDOUT;
+		if (signal_pending(current))
+			return -ERESTARTSYS;
+
+		/* a spurious wakeup, queue up again */
+	}
+}
+
+/**
+ * sys_futex_waitv - wait on any of a vector of futexes
+ * @waiters:	the futexes, each with the value it is expected to hold
+ * @nr_futexes:	at most FUTEX_WAITV_MAX
+ * @flags:	must be 0
+ * @timeout:	optional absolute timeout
+ * @clockid:	CLOCK_MONOTONIC or CLOCK_REALTIME, the clock of @timeout
+ *
+ * FUTEX_WAIT on all the futexes at once: fails with -EWOULDBLOCK if one
+ * of them doesn't hold its value, returns the index of one of them that
+ * got woken otherwise.
+ */
+SYSCALL_DEFINE5(futex_waitv, struct futex_waitv __user *, waiters,
+		unsigned int, nr_futexes, unsigned int, flags,
+		struct timespec __user *, timeout, clockid_t, clockid)
+{
+	struct hrtimer_sleeper to, *tp = NULL;
+	struct futex_vector *vs;
+	struct timespec ts;
+	int ret;
+
+	if (flags || !waiters || !nr_futexes || nr_futexes > FUTEX_WAITV_MAX)
+		return -EINVAL;
+
+	if (timeout) {
+		if (clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC)
+			return -EINVAL;
+		if (copy_from_user(&ts, timeout, sizeof(ts)))
+			return -EFAULT;
+		if (!timespec_valid(&ts))
+			return -EINVAL;
+	}
+
+	vs = kcalloc(nr_futexes, sizeof(*vs), GFP_KERNEL);
+	if (!vs)
+		return -ENOMEM;
+
+	ret = futex_parse_waitv(vs, waiters, nr_futexes);
+	if (ret)
+		goto out;
+
+	if (timeout) {
+		tp = &to;
+		hrtimer_init_on_stack(&to.timer, clockid, HRTIMER_MODE_ABS);
+		hrtimer_init_sleeper(&to, current);
+		hrtimer_set_expires_range_ns(&to.timer, timespec_to_ktime(ts),
+					     current->timer_slack_ns);
+		hrtimer_start_expires(&to.timer, HRTIMER_MODE_ABS);
+	}
+
+	ret = futex_wait_multiple(vs, nr_futexes, tp);
+
+	if (tp) {
+		hrtimer_cancel(&to.timer);
+		destroy_hrtimer_on_stack(&to.timer);
+	}
+out:
+	kfree(vs);
+	return ret;
+}
+
 static void __init futex_detect_cmpxchg(void)
 {
 #ifndef CONFIG_HAVE_FUTEX_CMPXCHG
@@ -3171,31 +3546,49 @@ static void __init futex_detect_cmpxchg(void)
 #endif
 }
 
-static int __init futex_init(void)
+static struct futex_hash_bucket * __init futex_alloc_queues(int node)
 {
-	unsigned int futex_shift;
+	size_t size = futex_hashsize * sizeof(struct futex_hash_bucket);
+	int nid = node_state(node, N_MEMORY) ? node : NUMA_NO_NODE;
+	struct futex_hash_bucket *queues;
 	unsigned long i;
 
+	queues = kmalloc_node(size, GFP_KERNEL | __GFP_NOWARN, nid);
+	if (!queues)
+		queues = vmalloc_node(size, nid);
+	if (!queues)
+		panic("futex: failed to allocate the hash table of node %d\n",
+		      node);
+
+	for (i = 0; i < futex_hashsize; i++) {
+		atomic_set(&queues[i].waiters, 0);
+		plist_head_init(&queues[i].chain);
+		spin_lock_init(&queues[i].lock);
+	}
+
+	return queues;
+}
+
+static int __init futex_init(void)
+{
+	int node;
+
 #if CONFIG_BASE_SMALL
 	futex_hashsize = 16;
 #else
-	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+	futex_hashsize = roundup_pow_of_two(256 *
+			DIV_ROUND_UP(num_possible_cpus(), num_possible_nodes()));
 #endif
+	futex_hashshift = ilog2(futex_hashsize);
 
-	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
-					       futex_hashsize, 0,
-					       futex_hashsize < 256 ? HASH_SMALL : 0,
-					       &futex_shift, NULL,
-					       futex_hashsize, futex_hashsize);
-	futex_hashsize = 1UL << futex_shift;
+	futex_queues = kcalloc(nr_node_ids, sizeof(*futex_queues), GFP_KERNEL);
+	if (!futex_queues)
+		panic("futex: failed to allocate the hash tables\n");
 
-	futex_detect_cmpxchg();
+	for (node = 0; node < nr_node_ids; node++)
+		futex_queues[node] = futex_alloc_queues(node);
 
-	for (i = 0; i < futex_hashsize; i++) {
-		atomic_set(&futex_queues[i].waiters, 0);
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	futex_detect_cmpxchg();
 
 	return 0;
 }
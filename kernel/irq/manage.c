@@ -17,6 +17,7 @@
 #include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/sched/rt.h>
+#include <linux/sched/isolation.h>
 #include <linux/task_work.h>
 
 #include "internals.h"
@@ -352,6 +353,19 @@ static int setup_affinity(struct irq_desc *desc, struct cpumask *mask)
 	}
 
 	cpumask_and(mask, cpu_online_mask, set);
+
+	/*
+	 * Unless userspace chose them, keep the interrupt off the isolated
+	 * cpus while a housekeeping one can take it.
+	 */
+	if (set == irq_default_affinity) {
+		const struct cpumask *hk_mask =
+			housekeeping_cpumask(HK_FLAG_MANAGED_IRQ);
+
+		if (cpumask_intersects(mask, hk_mask))
+			cpumask_and(mask, mask, hk_mask);
+	}
+
 	if (node != NUMA_NO_NODE) {
 		const struct cpumask *nodemask = cpumask_of_node(node);
 
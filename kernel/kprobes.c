@@ -69,7 +69,6 @@
 
 static int kprobes_initialized;
 static struct hlist_head kprobe_table[KPROBE_TABLE_SIZE];
-static struct hlist_head kretprobe_inst_table[KPROBE_TABLE_SIZE];
 
 /* NOTE: change this value only with kprobe_mutex held */
 static bool kprobes_all_disarmed;
@@ -77,14 +76,6 @@ static bool kprobes_all_disarmed;
 /* This protects kprobe_table and optimizing_list */
 static DEFINE_MUTEX(kprobe_mutex);
 static DEFINE_PER_CPU(struct kprobe *, kprobe_instance) = NULL;
-static struct {
-	raw_spinlock_t lock ____cacheline_aligned_in_smp;
-} kretprobe_table_locks[KPROBE_TABLE_SIZE];
-
-static raw_spinlock_t *kretprobe_table_lock_ptr(unsigned long hash)
-{
-	return &(kretprobe_table_locks[hash].lock);
-}
 
 /* Blacklist -- list of struct kprobe_blacklist_entry */
 static LIST_HEAD(kprobe_blacklist);
@@ -1074,66 +1065,111 @@ void kprobes_inc_nmissed_count(struct kprobe *p)
 }
 NOKPROBE_SYMBOL(kprobes_inc_nmissed_count);
 
-void recycle_rp_inst(struct kretprobe_instance *ri,
-		     struct hlist_head *head)
+#ifdef CONFIG_KRETPROBES
+static void kretprobe_holder_put(struct kretprobe_holder *rph)
+{
+	if (atomic_dec_and_test(&rph->ref))
+		kfree(rph);
+}
+NOKPROBE_SYMBOL(kretprobe_holder_put);
+
+/*
+ * Give an instance back to its kretprobe, or, if the kretprobe has
+ * been unregistered meanwhile, free it.
+ */
+void recycle_rp_inst(struct kretprobe_instance *ri)
 {
-	struct kretprobe *rp = ri->rp;
+	struct kretprobe_holder *rph = ri->rph;
+	struct kretprobe *rp = READ_ONCE(rph->rp);
+	unsigned long flags;
 
-	/* remove rp inst off the rprobe_inst_table */
-	hlist_del(&ri->hlist);
-	INIT_HLIST_NODE(&ri->hlist);
 	if (likely(rp)) {
-		raw_spin_lock(&rp->lock);
+		INIT_HLIST_NODE(&ri->hlist);
+		raw_spin_lock_irqsave(&rp->lock, flags);
 		hlist_add_head(&ri->hlist, &rp->free_instances);
-		raw_spin_unlock(&rp->lock);
-	} else
+		raw_spin_unlock_irqrestore(&rp->lock, flags);
+	} else {
 		/* Unregistering */
-		hlist_add_head(&ri->hlist, head);
+		kfree(ri);
+		kretprobe_holder_put(rph);
+	}
 }
 NOKPROBE_SYMBOL(recycle_rp_inst);
 
-void kretprobe_hash_lock(struct task_struct *tsk,
-			 struct hlist_head **head, unsigned long *flags)
-__acquires(hlist_lock)
+/**
+ * kretprobe_trampoline_handler - run the return probes of a returning function
+ * @regs: the registers at the return
+ * @trampoline_address: the address of the arch's kretprobe_trampoline
+ *
+ * Every task keeps its kretprobe instances on a stack of its own,
+ * innermost function first, which only the task itself ever pushes or
+ * pops: no lock is needed, and tasks don't contend with each other the
+ * way they did on a shared hash table.  When more than one return probe
+ * is set on the same call, all but the first (chronologically) saved
+ * the trampoline as their return address; the handlers of all of them
+ * run, and the stack is popped down to the one with the real address.
+ *
+ * Called by the arch's trampoline handler, with @regs set up as the
+ * return probe handlers expect them.
+ *
+ * Return: the address the function really returns to.
+ */
+unsigned long kretprobe_trampoline_handler(struct pt_regs *regs,
+					   unsigned long trampoline_address)
 {
-	unsigned long hash = hash_ptr(tsk, KPROBE_HASH_BITS);
-	raw_spinlock_t *hlist_lock;
+	struct llist_head *head = &current->kretprobe_instances;
+	struct kretprobe_instance *ri = NULL;
+	kprobe_opcode_t *correct_ret_addr = NULL;
+	struct llist_node *first, *last, *node;
+	struct kprobe *prev;
+	struct kretprobe *rp;
 
-	*head = &kretprobe_inst_table[hash];
-	hlist_lock = kretprobe_table_lock_ptr(hash);
-	raw_spin_lock_irqsave(hlist_lock, *flags);
-}
-NOKPROBE_SYMBOL(kretprobe_hash_lock);
+	preempt_disable();
 
-static void kretprobe_table_lock(unsigned long hash,
-				 unsigned long *flags)
-__acquires(hlist_lock)
-{
-	raw_spinlock_t *hlist_lock = kretprobe_table_lock_ptr(hash);
-	raw_spin_lock_irqsave(hlist_lock, *flags);
-}
-NOKPROBE_SYMBOL(kretprobe_table_lock);
+	first = head->first;
+	for (node = first; node; node = node->next) {
+		ri = container_of(node, struct kretprobe_instance, llist);
+		if ((unsigned long)ri->ret_addr != trampoline_address) {
+			correct_ret_addr = ri->ret_addr;
+			break;
+		}
+	}
+	kretprobe_assert(ri, (unsigned long)correct_ret_addr,
+			 trampoline_address);
 
-void kretprobe_hash_unlock(struct task_struct *tsk,
-			   unsigned long *flags)
-__releases(hlist_lock)
-{
-	unsigned long hash = hash_ptr(tsk, KPROBE_HASH_BITS);
-	raw_spinlock_t *hlist_lock;
+	/* Pop it all before running anything; nested probes push above */
+	last = node;
+	head->first = last->next;
 
-	hlist_lock = kretprobe_table_lock_ptr(hash);
-	raw_spin_unlock_irqrestore(hlist_lock, *flags);
-}
-NOKPROBE_SYMBOL(kretprobe_hash_unlock);
+	prev = kprobe_running();
+	if (!prev)
+		get_kprobe_ctlblk()->kprobe_status = KPROBE_HIT_ACTIVE;
 
-static void kretprobe_table_unlock(unsigned long hash,
-				   unsigned long *flags)
-__releases(hlist_lock)
-{
-	raw_spinlock_t *hlist_lock = kretprobe_table_lock_ptr(hash);
-	raw_spin_unlock_irqrestore(hlist_lock, *flags);
+	node = first;
+	while (node) {
+		struct llist_node *next = node->next;
+
+		ri = container_of(node, struct kretprobe_instance, llist);
+		rp = READ_ONCE(ri->rph->rp);
+		if (rp && rp->handler) {
+			__this_cpu_write(current_kprobe, &rp->kp);
+			ri->ret_addr = correct_ret_addr;
+			rp->handler(ri, regs);
+			__this_cpu_write(current_kprobe, prev);
+		}
+
+		recycle_rp_inst(ri);
+
+		if (node == last)
+			break;
+		node = next;
+	}
+
+	preempt_enable_no_resched();
+
+	return (unsigned long)correct_ret_addr;
 }
-NOKPROBE_SYMBOL(kretprobe_table_unlock);
+NOKPROBE_SYMBOL(kretprobe_trampoline_handler);
 
 /*
  * This function is called from finish_task_switch when task tk becomes dead,
@@ -1144,61 +1180,50 @@ NOKPROBE_SYMBOL(kretprobe_table_unlock);
 void kprobe_flush_task(struct task_struct *tk)
 {
 	struct kretprobe_instance *ri;
-	struct hlist_head *head, empty_rp;
-	struct hlist_node *tmp;
-	unsigned long hash, flags = 0;
+	struct llist_node *node;
 
+	/* Early boot, not yet initialized. */
 	if (unlikely(!kprobes_initialized))
-		/* Early boot.  kretprobe_table_locks not yet initialized. */
 		return;
 
-	INIT_HLIST_HEAD(&empty_rp);
-	hash = hash_ptr(tk, KPROBE_HASH_BITS);
-	head = &kretprobe_inst_table[hash];
-	kretprobe_table_lock(hash, &flags);
-	hlist_for_each_entry_safe(ri, tmp, head, hlist) {
-		if (ri->task == tk)
-			recycle_rp_inst(ri, &empty_rp);
-	}
-	kretprobe_table_unlock(hash, &flags);
-	hlist_for_each_entry_safe(ri, tmp, &empty_rp, hlist) {
-		hlist_del(&ri->hlist);
-		kfree(ri);
+	node = __llist_del_all(&tk->kretprobe_instances);
+	while (node) {
+		ri = container_of(node, struct kretprobe_instance, llist);
+		node = node->next;
+
+		recycle_rp_inst(ri);
 	}
 }
 NOKPROBE_SYMBOL(kprobe_flush_task);
 
-static inline void free_rp_inst(struct kretprobe *rp)
+/*
+ * Free the instances not in use, and drop the kretprobe's own reference
+ * to its holder; the ones in use are freed as their functions return.
+ */
+static void free_rp_inst(struct kretprobe *rp)
 {
 	struct kretprobe_instance *ri;
 	struct hlist_node *next;
 
+	if (!rp->rph)
+		return;
+
 	hlist_for_each_entry_safe(ri, next, &rp->free_instances, hlist) {
 		hlist_del(&ri->hlist);
 		kfree(ri);
+		kretprobe_holder_put(rp->rph);
 	}
-}
 
-static void cleanup_rp_inst(struct kretprobe *rp)
+	kretprobe_holder_put(rp->rph);
+	rp->rph = NULL;
+}
+NOKPROBE_SYMBOL(free_rp_inst);
+#else /* CONFIG_KRETPROBES */
+void kprobe_flush_task(struct task_struct *tk)
 {
-	unsigned long flags, hash;
-	struct kretprobe_instance *ri;
-	struct hlist_node *next;
-	struct hlist_head *head;
-
-	/* No race here */
-	for (hash = 0; hash < KPROBE_TABLE_SIZE; hash++) {
-		kretprobe_table_lock(hash, &flags);
-		head = &kretprobe_inst_table[hash];
-		hlist_for_each_entry_safe(ri, next, head, hlist) {
-			if (ri->rp == rp)
-				ri->rp = NULL;
-		}
-		kretprobe_table_unlock(hash, &flags);
-	}
-	free_rp_inst(rp);
 }
-NOKPROBE_SYMBOL(cleanup_rp_inst);
+NOKPROBE_SYMBOL(kprobe_flush_task);
+#endif /* CONFIG_KRETPROBES */
 
 /*
 * Add the new probe to ap->list. Fail if this is the
@@ -1786,8 +1811,8 @@ EXPORT_SYMBOL_GPL(unregister_jprobes);
 static int pre_handler_kretprobe(struct kprobe *p, struct pt_regs *regs)
 {
 	struct kretprobe *rp = container_of(p, struct kretprobe, kp);
-	unsigned long hash, flags = 0;
 	struct kretprobe_instance *ri;
+	unsigned long flags = 0;
 
 	/*
 	 * To avoid deadlocks, prohibit return probing in NMI contexts,
@@ -1801,7 +1826,6 @@ static int pre_handler_kretprobe(struct kprobe *p, struct pt_regs *regs)
 	}
 
 	/* TODO: consider to only swap the RA after the last pre_handler fired */
-	hash = hash_ptr(current, KPROBE_HASH_BITS);
 	raw_spin_lock_irqsave(&rp->lock, flags);
 	if (!hlist_empty(&rp->free_instances)) {
 		ri = hlist_entry(rp->free_instances.first,
@@ -1821,11 +1845,8 @@ static int pre_handler_kretprobe(struct kprobe *p, struct pt_regs *regs)
 
 		arch_prepare_kretprobe(ri, regs);
 
-		/* XXX(hch): why is there no hlist_move_head? */
-		INIT_HLIST_NODE(&ri->hlist);
-		kretprobe_table_lock(hash, &flags);
-		hlist_add_head(&ri->hlist, &kretprobe_inst_table[hash]);
-		kretprobe_table_unlock(hash, &flags);
+		/* Only current ever touches its own stack, see above */
+		__llist_add(&ri->llist, &current->kretprobe_instances);
 	} else {
 		rp->nmissed++;
 		raw_spin_unlock_irqrestore(&rp->lock, flags);
@@ -1867,6 +1888,14 @@ int register_kretprobe(struct kretprobe *rp)
 	}
 	raw_spin_lock_init(&rp->lock);
 	INIT_HLIST_HEAD(&rp->free_instances);
+
+	/* Instances may outlive rp, but not its holder */
+	rp->rph = kmalloc(sizeof(*rp->rph), GFP_KERNEL);
+	if (!rp->rph)
+		return -ENOMEM;
+	rp->rph->rp = rp;
+	atomic_set(&rp->rph->ref, 1);
+
 	for (i = 0; i < rp->maxactive; i++) {
 		inst = kmalloc(sizeof(struct kretprobe_instance) +
 			       rp->data_size, GFP_KERNEL);
@@ -1874,6 +1903,8 @@ int register_kretprobe(struct kretprobe *rp)
 			free_rp_inst(rp);
 			return -ENOMEM;
 		}
+		inst->rph = rp->rph;
+		atomic_inc(&rp->rph->ref);
 		INIT_HLIST_NODE(&inst->hlist);
 		hlist_add_head(&inst->hlist, &rp->free_instances);
 	}
@@ -1918,17 +1949,20 @@ void unregister_kretprobes(struct kretprobe **rps, int num)
 	if (num <= 0)
 		return;
 	mutex_lock(&kprobe_mutex);
-	for (i = 0; i < num; i++)
+	for (i = 0; i < num; i++) {
 		if (__unregister_kprobe_top(&rps[i]->kp) < 0)
 			rps[i]->kp.addr = NULL;
+		/* From now on, returning instances free themselves */
+		if (rps[i]->rph)
+			WRITE_ONCE(rps[i]->rph->rp, NULL);
+	}
 	mutex_unlock(&kprobe_mutex);
 
 	synchronize_sched();
 	for (i = 0; i < num; i++) {
-		if (rps[i]->kp.addr) {
+		if (rps[i]->kp.addr)
 			__unregister_kprobe_bottom(&rps[i]->kp);
-			cleanup_rp_inst(rps[i]);
-		}
+		free_rp_inst(rps[i]);
 	}
 }
 EXPORT_SYMBOL_GPL(unregister_kretprobes);
@@ -2137,8 +2171,6 @@ static int __init init_kprobes(void)
 	/* initialize all list heads */
 	for (i = 0; i < KPROBE_TABLE_SIZE; i++) {
 		INIT_HLIST_HEAD(&kprobe_table[i]);
-		INIT_HLIST_HEAD(&kretprobe_inst_table[i]);
-		raw_spin_lock_init(&(kretprobe_table_locks[i].lock));
 	}
 
 	err = populate_kprobe_blacklist(__start_kprobe_blacklist,
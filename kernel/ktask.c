@@ -0,0 +1,217 @@
+/*
+ * ktask.c - framework to parallelize CPU-intensive kernel work
+ *
+ * The job is cut into chunks which are handed out to the threads on demand,
+ * so threads which finish early, or got a cheaper part of the job, simply
+ * take on more chunks.  Every thread prefers the chunks of the node it runs
+ * on and only helps out on other nodes once its own is done.
+ *
+ * Helper threads are unbound workqueue workers placed on the right node,
+ * the caller of ktask_run() is always one of the threads.
+ */
+
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktask.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/topology.h>
+#include <linux/workqueue.h>
+
+/*
+ * Cut the job in about this many chunks per thread, so that threads which
+ * are slowed down by others do not hold up the whole job.
+ */
+#define KTASK_LOAD_BAL_FACTOR	4
+
+/* ktask_max_threads= bounds the threads of any job, 0 is all online CPUs */
+static unsigned int ktask_max_threads __read_mostly;
+
+static int __init ktask_max_threads_setup(char *str)
+{
+	if (kstrtouint(str, 0, &ktask_max_threads))
+		return 0;
+	return 1;
+}
+__setup("ktask_max_threads=", ktask_max_threads_setup);
+
+struct ktask_task {
+	struct ktask_ctl	*kt_ctl;
+	struct ktask_node	*kt_nodes;
+	size_t			kt_nr_nodes;
+	unsigned long		kt_chunk_size;
+	/* protects the ktask_nodes and everything below */
+	struct mutex		kt_mutex;
+	int			kt_error;
+	unsigned int		kt_nworks;
+	unsigned int		kt_nworks_fini;
+	struct completion	kt_done;
+};
+
+struct ktask_work {
+	struct work_struct	kw_work;
+	struct ktask_task	*kw_task;
+	size_t			kw_node;
+};
+
+/* Find a node which still has work left.  Called with kt_mutex held. */
+static struct ktask_node *ktask_find_node(struct ktask_task *kt)
+{
+	size_t i;
+
+	for (i = 0; i < kt->kt_nr_nodes; i++)
+		if (kt->kt_nodes[i].kn_task_size)
+			return &kt->kt_nodes[i];
+	return NULL;
+}
+
+static void ktask_thread(struct work_struct *work)
+{
+	struct ktask_work *kw = container_of(work, struct ktask_work, kw_work);
+	struct ktask_task *kt = kw->kw_task;
+	struct ktask_ctl *ctl = kt->kt_ctl;
+	struct ktask_node *kn = &kt->kt_nodes[kw->kw_node];
+	bool done;
+
+	mutex_lock(&kt->kt_mutex);
+	while (!kt->kt_error) {
+		unsigned long start, size;
+		int nid, ret;
+
+		if (!kn->kn_task_size) {
+			kn = ktask_find_node(kt);
+			if (!kn)
+				break;
+		}
+
+		start = kn->kn_start;
+		size = min(kt->kt_chunk_size, kn->kn_task_size);
+		nid = kn->kn_nid;
+		kn->kn_start += size;
+		kn->kn_task_size -= size;
+		mutex_unlock(&kt->kt_mutex);
+
+		ret = ctl->kc_thread_func(start, start + size, nid,
+					  ctl->kc_func_arg);
+
+		mutex_lock(&kt->kt_mutex);
+		if (ret != KTASK_RETURN_SUCCESS && !kt->kt_error)
+			kt->kt_error = ret;
+	}
+	done = ++kt->kt_nworks_fini == kt->kt_nworks;
+	mutex_unlock(&kt->kt_mutex);
+
+	if (done)
+		complete(&kt->kt_done);
+}
+
+/* Without helpers the caller does the whole job, still chunk by chunk. */
+static int ktask_run_single(struct ktask_node *nodes, size_t nr_nodes,
+			    struct ktask_ctl *ctl, unsigned long chunk_size)
+{
+	size_t i;
+	int ret;
+
+	for (i = 0; i < nr_nodes; i++) {
+		unsigned long start = nodes[i].kn_start;
+		unsigned long end = start + nodes[i].kn_task_size;
+
+		while (start < end) {
+			unsigned long size = min(chunk_size, end - start);
+
+			ret = ctl->kc_thread_func(start, start + size,
+						  nodes[i].kn_nid,
+						  ctl->kc_func_arg);
+			if (ret != KTASK_RETURN_SUCCESS)
+				return ret;
+			start += size;
+		}
+	}
+	return KTASK_RETURN_SUCCESS;
+}
+
+static void ktask_queue_work(struct ktask_work *kw, int nid)
+{
+	int cpu = nr_cpu_ids;
+
+	/* an unbound workqueue runs the work on the node of @cpu */
+	if (nid != NUMA_NO_NODE)
+		cpu = cpumask_any_and(cpumask_of_node(nid), cpu_online_mask);
+
+	if (cpu < nr_cpu_ids)
+		queue_work_on(cpu, system_unbound_wq, &kw->kw_work);
+	else
+		queue_work(system_unbound_wq, &kw->kw_work);
+}
+
+/**
+ * ktask_run_numa - run a job split into NUMA node local parts
+ * @nodes: the parts of the job, modified while the job runs
+ * @nr_nodes: number of parts
+ * @ctl: how to run the job
+ *
+ * Must be called from a context that can sleep.  Returns
+ * KTASK_RETURN_SUCCESS or the first error returned for a chunk.
+ */
+int ktask_run_numa(struct ktask_node *nodes, size_t nr_nodes,
+		   struct ktask_ctl *ctl)
+{
+	unsigned long min_chunk = max(ctl->kc_min_chunk_size, 1UL);
+	unsigned long total = 0, chunk;
+	unsigned int nworks, max_threads, i;
+	struct ktask_work *works;
+	struct ktask_task kt;
+	size_t n;
+
+	for (n = 0; n < nr_nodes; n++)
+		total += nodes[n].kn_task_size;
+	if (!total)
+		return KTASK_RETURN_SUCCESS;
+
+	max_threads = ktask_max_threads ?: num_online_cpus();
+	if (ctl->kc_max_threads)
+		max_threads = min(max_threads, ctl->kc_max_threads);
+	nworks = clamp_t(unsigned long, DIV_ROUND_UP(total, min_chunk),
+			 1, max(max_threads, 1U));
+
+	chunk = max(min_chunk, total / (nworks * KTASK_LOAD_BAL_FACTOR));
+	chunk = roundup(chunk, min_chunk);
+
+	if (nworks == 1)
+		return ktask_run_single(nodes, nr_nodes, ctl, chunk);
+
+	works = kmalloc_array(nworks, sizeof(*works), GFP_KERNEL);
+	if (!works)
+		return ktask_run_single(nodes, nr_nodes, ctl, chunk);
+
+	kt.kt_ctl = ctl;
+	kt.kt_nodes = nodes;
+	kt.kt_nr_nodes = nr_nodes;
+	kt.kt_chunk_size = chunk;
+	mutex_init(&kt.kt_mutex);
+	kt.kt_error = KTASK_RETURN_SUCCESS;
+	kt.kt_nworks = nworks;
+	kt.kt_nworks_fini = 0;
+	init_completion(&kt.kt_done);
+
+	/* spread the threads over the nodes, the caller takes the first */
+	for (i = 0; i < nworks; i++) {
+		struct ktask_work *kw = &works[i];
+
+		INIT_WORK(&kw->kw_work, ktask_thread);
+		kw->kw_task = &kt;
+		kw->kw_node = i % nr_nodes;
+		if (i)
+			ktask_queue_work(kw, nodes[kw->kw_node].kn_nid);
+	}
+
+	ktask_thread(&works[0].kw_work);
+	wait_for_completion(&kt.kt_done);
+
+	mutex_destroy(&kt.kt_mutex);
+	kfree(works);
+	return kt.kt_error;
+}
+EXPORT_SYMBOL_GPL(ktask_run_numa);
@@ -0,0 +1,201 @@
+#include <linux/biased-rwsem.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/lockdep.h>
+#include <linux/nodemask.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+
+/*
+ * The visible readers table.  A fast-path reader claims the slot
+ * hash(sem, current) in the table of the node it runs on by installing
+ * @sem there.  As the reader may migrate before unlocking, the unlock and
+ * the writer look at that slot in the tables of all nodes.
+ */
+#define BIAS_RW_SLOT_BITS	10
+#define BIAS_RW_SLOTS		(1U << BIAS_RW_SLOT_BITS)
+
+/*
+ * After a revocation, readers stay on the rw_semaphore for this many
+ * times the cost of the revocation, which bounds the writer slowdown.
+ */
+#define BIAS_RW_INHIBIT_MULT	9
+
+struct bias_rw_slot {
+	struct bias_rw_semaphore	*sem;
+	struct task_struct		*owner;
+};
+
+static struct bias_rw_slot *bias_rw_table[MAX_NUMNODES] __read_mostly;
+static bool bias_rw_ready __read_mostly;
+
+/* writers waiting for fast-path readers to leave */
+static DECLARE_WAIT_QUEUE_HEAD(bias_rw_waitq);
+
+static inline unsigned int bias_rw_hash(struct bias_rw_semaphore *sem)
+{
+	return hash_long((unsigned long)sem ^
+			 ((unsigned long)current >> L1_CACHE_SHIFT),
+			 BIAS_RW_SLOT_BITS);
+}
+
+static bool bias_read_fast(struct bias_rw_semaphore *sem, int trylock,
+			   unsigned long ip)
+{
+	struct bias_rw_slot *slot;
+
+	if (!READ_ONCE(sem->rbias))
+		return false;
+
+	slot = &bias_rw_table[numa_node_id()][bias_rw_hash(sem)];
+	if (cmpxchg(&slot->sem, NULL, sem) != NULL)
+		return false;
+
+	/*
+	 * The cmpxchg() orders the slot against the recheck; it pairs with
+	 * the smp_mb() in bias_revoke().  Either the writer sees us in the
+	 * slot, or we see the bias gone.
+	 */
+	if (unlikely(!READ_ONCE(sem->rbias))) {
+		smp_store_release(&slot->sem, NULL);
+		wake_up_all(&bias_rw_waitq);
+		return false;
+	}
+
+	slot->owner = current;
+	rwsem_acquire_read(&sem->rw_sem.dep_map, 0, trylock, ip);
+	return true;
+}
+
+/* called with ->rw_sem read-held, so no writer can be revoking */
+static void bias_read_slow_done(struct bias_rw_semaphore *sem)
+{
+	if (unlikely(!READ_ONCE(sem->rbias)) && bias_rw_ready &&
+	    local_clock() >= READ_ONCE(sem->inhibit_until))
+		/* publish the last writer's updates to the fast readers */
+		smp_store_release(&sem->rbias, 1);
+}
+
+void bias_down_read(struct bias_rw_semaphore *sem)
+{
+	might_sleep();
+
+	if (bias_read_fast(sem, 0, _RET_IP_))
+		return;
+
+	down_read(&sem->rw_sem);
+	bias_read_slow_done(sem);
+}
+EXPORT_SYMBOL_GPL(bias_down_read);
+
+int bias_down_read_trylock(struct bias_rw_semaphore *sem)
+{
+	if (bias_read_fast(sem, 1, _RET_IP_))
+		return 1;
+
+	if (!down_read_trylock(&sem->rw_sem))
+		return 0;
+
+	bias_read_slow_done(sem);
+	return 1;
+}
+EXPORT_SYMBOL_GPL(bias_down_read_trylock);
+
+void bias_up_read(struct bias_rw_semaphore *sem)
+{
+	unsigned int hash = bias_rw_hash(sem);
+	int node;
+
+	/* ->rbias may be gone already, the slot tells how we got in */
+	for (node = 0; node < nr_node_ids; node++) {
+		struct bias_rw_slot *slot;
+
+		if (!bias_rw_table[node])
+			continue;
+		slot = &bias_rw_table[node][hash];
+		if (READ_ONCE(slot->sem) != sem || slot->owner != current)
+			continue;
+
+		rwsem_release(&sem->rw_sem.dep_map, 1, _RET_IP_);
+		slot->owner = NULL;
+		smp_store_release(&slot->sem, NULL);
+
+		/* pairs with the barrier in bias_revoke() */
+		smp_mb();
+		if (!READ_ONCE(sem->rbias))
+			wake_up_all(&bias_rw_waitq);
+		return;
+	}
+
+	up_read(&sem->rw_sem);
+}
+EXPORT_SYMBOL_GPL(bias_up_read);
+
+static bool bias_rw_published(struct bias_rw_semaphore *sem,
+			      struct bias_rw_slot *slot)
+{
+	return READ_ONCE(slot->sem) == sem;
+}
+
+/* called with ->rw_sem write-held */
+static void bias_revoke(struct bias_rw_semaphore *sem)
+{
+	u64 start = local_clock();
+	unsigned int i;
+	int node;
+
+	WRITE_ONCE(sem->rbias, 0);
+	smp_mb();
+
+	for (node = 0; node < nr_node_ids; node++) {
+		struct bias_rw_slot *table = bias_rw_table[node];
+
+		if (!table)
+			continue;
+		for (i = 0; i < BIAS_RW_SLOTS; i++)
+			wait_event(bias_rw_waitq,
+				   !bias_rw_published(sem, &table[i]));
+	}
+
+	/* order the readers' critical sections before ours */
+	smp_mb();
+
+	sem->inhibit_until = local_clock() +
+		(local_clock() - start) * BIAS_RW_INHIBIT_MULT;
+}
+
+void bias_down_write(struct bias_rw_semaphore *sem)
+{
+	down_write(&sem->rw_sem);
+
+	/* ->rbias is only set with ->rw_sem held, it can't come back */
+	if (READ_ONCE(sem->rbias))
+		bias_revoke(sem);
+}
+EXPORT_SYMBOL_GPL(bias_down_write);
+
+void bias_up_write(struct bias_rw_semaphore *sem)
+{
+	up_write(&sem->rw_sem);
+}
+EXPORT_SYMBOL_GPL(bias_up_write);
+
+static int __init bias_rw_init(void)
+{
+	int node;
+
+	for_each_node(node) {
+		bias_rw_table[node] = kzalloc_node(BIAS_RW_SLOTS *
+						   sizeof(struct bias_rw_slot),
+						   GFP_KERNEL, node);
+		if (!bias_rw_table[node])
+			return -ENOMEM;
+	}
+
+	/* the tables must be visible before any lock gets biased */
+	smp_wmb();
+	bias_rw_ready = true;
+	return 0;
+}
+core_initcall(bias_rw_init);
@@ -0,0 +1,29 @@
+#ifndef __LOCKING_CONTENTION_H
+#define __LOCKING_CONTENTION_H
+
+#include <linux/sched.h>
+#include <trace/events/lock.h>
+
+/*
+ * The contention tracepoints of the lock slowpaths.  The wait is only
+ * timed while they are enabled, otherwise they cost a static branch.
+ * An end without a begin, when tracing got enabled in between, is not
+ * reported.
+ */
+static __always_inline u64
+lock_contention_begin(void *lock, unsigned int flags, unsigned long ip)
+{
+	if (!trace_contention_begin_enabled())
+		return 0;
+
+	trace_contention_begin(lock, flags, ip);
+	return local_clock() ? : 1;
+}
+
+static __always_inline void lock_contention_end(void *lock, u64 start, int ret)
+{
+	if (start)
+		trace_contention_end(lock, local_clock() - start, ret);
+}
+
+#endif /* __LOCKING_CONTENTION_H */
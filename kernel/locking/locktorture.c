@@ -68,11 +68,13 @@ static struct task_struct **writer_tasks;
 static struct task_struct **reader_tasks;
 
 static bool lock_is_write_held;
+static int lock_last_writer_node = NUMA_NO_NODE;
 static bool lock_is_read_held;
 
 struct lock_stress_stats {
 	long n_lock_fail;
 	long n_lock_acquired;
+	long n_lock_remote;	/* acquired after a writer on another node */
 };
 
 #if defined(MODULE)
@@ -577,6 +579,7 @@ static int lock_torture_writer(void *arg)
 {
 	struct lock_stress_stats *lwsp = arg;
 	static DEFINE_TORTURE_RANDOM(rand);
+	int node;
 
 	VERBOSE_TOROUT_STRING("lock_torture_writer task started");
 	set_user_nice(current, MAX_NICE);
@@ -594,6 +597,12 @@ static int lock_torture_writer(void *arg)
 			lwsp->n_lock_fail++; /* rare, but... */
 
 		lwsp->n_lock_acquired++;
+		node = numa_node_id();
+		if (lock_last_writer_node != node) {
+			if (lock_last_writer_node != NUMA_NO_NODE)
+				lwsp->n_lock_remote++;
+			lock_last_writer_node = node;
+		}
 		cxt.cur_ops->write_delay(&rand);
 		lock_is_write_held = 0;
 		cxt.cur_ops->writeunlock();
@@ -649,12 +658,14 @@ static void __torture_print_stats(char *page,
 	long max = 0;
 	long min = statp[0].n_lock_acquired;
 	long long sum = 0;
+	long long remote = 0;
 
 	n_stress = write ? cxt.nrealwriters_stress : cxt.nrealreaders_stress;
 	for (i = 0; i < n_stress; i++) {
 		if (statp[i].n_lock_fail)
 			fail = true;
 		sum += statp[i].n_lock_acquired;
+		remote += statp[i].n_lock_remote;
 		if (max < statp[i].n_lock_fail)
 			max = statp[i].n_lock_fail;
 		if (min > statp[i].n_lock_fail)
@@ -665,6 +676,8 @@ static void __torture_print_stats(char *page,
 			write ? "Writes" : "Reads ",
 			sum, max, min, max / 2 > min ? "???" : "",
 			fail, fail ? "!!!" : "");
+	if (write && num_online_nodes() > 1)
+		page += sprintf(page, "Writes:  Cross-node: %lld\n", remote);
 	if (fail)
 		atomic_inc(&cxt.n_lock_torture_errors);
 }
@@ -848,6 +861,7 @@ static int __init lock_torture_init(void)
 	for (i = 0; i < cxt.nrealwriters_stress; i++) {
 		cxt.lwsa[i].n_lock_fail = 0;
 		cxt.lwsa[i].n_lock_acquired = 0;
+		cxt.lwsa[i].n_lock_remote = 0;
 	}
 
 	if (cxt.cur_ops->readlock) {
@@ -876,6 +890,7 @@ static int __init lock_torture_init(void)
 		for (i = 0; i < cxt.nrealreaders_stress; i++) {
 			cxt.lrsa[i].n_lock_fail = 0;
 			cxt.lrsa[i].n_lock_acquired = 0;
+			cxt.lrsa[i].n_lock_remote = 0;
 		}
 	}
 	lock_torture_print_module_parms(cxt.cur_ops, "Start of test");
@@ -67,6 +67,7 @@
  */
 
 #include "mcs_spinlock.h"
+#include "contention.h"
 
 #ifdef CONFIG_PARAVIRT_SPINLOCKS
 #define MAX_NODES	8
@@ -231,6 +232,12 @@ static __always_inline void set_locked(struct qspinlock *lock)
 	WRITE_ONCE(l->locked, _Q_LOCKED_VAL);
 }
 
+#ifdef CONFIG_NUMA
+#include "qspinlock_cna.h"
+#else
+static inline bool cna_enabled(void) { return false; }
+static inline void cna_queue(struct qspinlock *lock) { }
+#endif
 
 /*
  * Generate the native code for queued_spin_unlock_slowpath(); provide NOPs for
@@ -282,6 +289,7 @@ void queued_spin_lock_slowpath(struct qspinlock *lock, u32 val)
 {
 	struct mcs_spinlock *prev, *next, *node;
 	u32 new, old, tail;
+	u64 start;
 	int idx;
 
 	BUILD_BUG_ON(CONFIG_NR_CPUS >= (1U << _Q_TAIL_CPU_BITS));
@@ -358,6 +366,14 @@ void queued_spin_lock_slowpath(struct qspinlock *lock, u32 val)
 	 * queuing.
 	 */
 queue:
+	start = lock_contention_begin(lock, LCB_F_SPIN, _RET_IP_);
+
+	if (!pv_enabled() && cna_enabled()) {
+		cna_queue(lock);
+		lock_contention_end(lock, start, 0);
+		return;
+	}
+
 	node = this_cpu_ptr(&mcs_nodes[0]);
 	idx = node->count++;
 	tail = encode_tail(smp_processor_id(), idx);
@@ -447,6 +463,7 @@ release:
 	 * release the node
 	 */
 	this_cpu_dec(mcs_nodes[0].count);
+	lock_contention_end(lock, start, 0);
 }
 EXPORT_SYMBOL(queued_spin_lock_slowpath);
 
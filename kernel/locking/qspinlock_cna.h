@@ -0,0 +1,243 @@
+#ifndef _GEN_PV_LOCK_SLOWPATH_CNA_H
+#define _GEN_PV_LOCK_SLOWPATH_CNA_H
+
+#include <linux/jump_label.h>
+#include <linux/moduleparam.h>
+#include <linux/topology.h>
+
+/*
+ * Compact NUMA-aware queueing (CNA), after Dice and Kogan, "Compact
+ * NUMA-aware Locks", EuroSys 2019.
+ *
+ * The MCS queue of the slowpath is split in two.  When the queue head
+ * takes the lock and passes the head position on, it prefers the first
+ * waiter running on its own node; the waiters it skips are moved to a
+ * secondary queue, which travels with the head position.  So the lock,
+ * and the data it protects, mostly stays on one node.
+ *
+ * The secondary queue is put back in front of the main queue when no
+ * local waiter is left, or after numa_spinlock_threshold local handoffs
+ * in a row, which bounds how long the remote waiters can be passed over.
+ * When the head is alone in the main queue, the secondary queue becomes
+ * the main queue.
+ *
+ * It is selected at boot with numa_spinlock=on, and stays set from then.
+ * It uses its own queue nodes, so it can't be switched while any lock
+ * is queued on.
+ */
+
+struct cna_node {
+	struct mcs_spinlock	mcs;
+	int			numa_node;
+	u32			encoded_tail;
+	unsigned int		intra_count;	/* local handoffs in a row */
+
+	/* the secondary queue, handed over with the head position */
+	struct cna_node		*sec_head;
+	struct cna_node		*sec_tail;
+
+	/* the first local waiter in the main queue, and its predecessor */
+	struct cna_node		*scan_hit;
+	struct cna_node		*scan_prev;
+};
+
+static DEFINE_PER_CPU_ALIGNED(struct cna_node, cna_nodes[4]);
+
+static DEFINE_STATIC_KEY_FALSE(numa_spinlock_key);
+static bool numa_spinlock __initdata;
+
+static unsigned int numa_spinlock_threshold __read_mostly = 1 << 8;
+module_param(numa_spinlock_threshold, uint, 0644);
+
+static int __init numa_spinlock_setup(char *str)
+{
+	if (!strcmp(str, "on"))
+		numa_spinlock = true;
+	else if (strcmp(str, "off"))
+		pr_warn("qspinlock: unknown numa_spinlock=%s\n", str);
+	return 1;
+}
+__setup("numa_spinlock=", numa_spinlock_setup);
+
+/*
+ * The secondary CPUs are not up yet, so no lock can have a queue built
+ * with the other kind of nodes.
+ */
+static int __init cna_init(void)
+{
+	int cpu, idx;
+
+	if (!numa_spinlock || num_possible_nodes() <= 1)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		for (idx = 0; idx < 4; idx++) {
+			struct cna_node *cn = per_cpu_ptr(&cna_nodes[idx], cpu);
+
+			cn->numa_node = cpu_to_node(cpu);
+			cn->encoded_tail = encode_tail(cpu, idx);
+		}
+	}
+
+	static_branch_enable(&numa_spinlock_key);
+	pr_info("qspinlock: NUMA-aware queueing enabled\n");
+	return 0;
+}
+early_initcall(cna_init);
+
+static inline bool cna_enabled(void)
+{
+	return static_branch_unlikely(&numa_spinlock_key);
+}
+
+static inline struct cna_node *cna_decode_tail(u32 tail)
+{
+	int cpu = (tail >> _Q_TAIL_CPU_OFFSET) - 1;
+	int idx = (tail &  _Q_TAIL_IDX_MASK) >> _Q_TAIL_IDX_OFFSET;
+
+	return per_cpu_ptr(&cna_nodes[idx], cpu);
+}
+
+static inline struct cna_node *cna_next(struct cna_node *cn)
+{
+	return (struct cna_node *)READ_ONCE(cn->mcs.next);
+}
+
+/*
+ * Look for the first waiter on our node, while we wait for the lock.
+ * The part of the queue up to it can't change: waiters only leave the
+ * queue through the head, which is us.
+ */
+static void cna_scan(struct cna_node *cn, struct cna_node *next)
+{
+	struct cna_node *cur = next, *prev = NULL;
+
+	while (cur) {
+		if (cur->numa_node == cn->numa_node) {
+			cn->scan_hit = cur;
+			cn->scan_prev = prev;
+			return;
+		}
+		prev = cur;
+		cur = cna_next(cur);
+	}
+}
+
+/* pick the next queue head and pass the head position and the lock on */
+static void cna_hand_off(struct cna_node *cn, struct cna_node *next)
+{
+	struct cna_node *succ;
+	unsigned int intra = 0;
+
+	if (!cn->scan_hit || cn->intra_count >= numa_spinlock_threshold) {
+		/* the remote waiters' turn, oldest first */
+		if (cn->sec_head) {
+			cn->sec_tail->mcs.next = &next->mcs;
+			succ = cn->sec_head;
+			cn->sec_head = cn->sec_tail = NULL;
+		} else {
+			succ = next;
+		}
+	} else {
+		if (cn->scan_hit != next) {
+			/* move the remote waiters in between aside */
+			if (cn->sec_head)
+				cn->sec_tail->mcs.next = &next->mcs;
+			else
+				cn->sec_head = next;
+			cn->sec_tail = cn->scan_prev;
+			cn->scan_prev->mcs.next = NULL;
+		}
+		succ = cn->scan_hit;
+		intra = cn->intra_count + 1;
+	}
+
+	succ->sec_head = cn->sec_head;
+	succ->sec_tail = cn->sec_tail;
+	succ->intra_count = intra;
+	arch_mcs_spin_unlock_contended(&succ->mcs.locked);
+}
+
+/* the MCS queueing part of queued_spin_lock_slowpath(), NUMA-aware */
+static void cna_queue(struct qspinlock *lock)
+{
+	struct cna_node *cn, *prev, *next;
+	u32 new, old, val, tail;
+	int idx;
+
+	cn = this_cpu_ptr(&cna_nodes[0]);
+	idx = cn->mcs.count++;
+	cn += idx;
+	tail = cn->encoded_tail;
+
+	cn->mcs.locked = 0;
+	cn->mcs.next = NULL;
+	cn->sec_head = cn->sec_tail = NULL;
+	cn->scan_hit = cn->scan_prev = NULL;
+	cn->intra_count = 0;
+
+	if (queued_spin_trylock(lock))
+		goto release;
+
+	old = xchg_tail(lock, tail);
+
+	if (old & _Q_TAIL_MASK) {
+		prev = cna_decode_tail(old);
+		WRITE_ONCE(prev->mcs.next, &cn->mcs);
+
+		/* our predecessor fills in the sec_* and intra_count fields */
+		arch_mcs_spin_lock_contended(&cn->mcs.locked);
+	}
+
+	/*
+	 * We're the queue head: wait for the owner & pending to go away,
+	 * and look for a local successor meanwhile.
+	 */
+	while ((val = smp_load_acquire(&lock->val.counter)) & _Q_LOCKED_PENDING_MASK) {
+		if (!cn->scan_hit && (next = cna_next(cn)))
+			cna_scan(cn, next);
+		cpu_relax();
+	}
+
+	/*
+	 * claim the lock.  When we're alone in the main queue, the
+	 * secondary queue, if any, becomes the main queue.
+	 */
+	for (;;) {
+		if (val != tail) {
+			set_locked(lock);
+			break;
+		}
+
+		new = _Q_LOCKED_VAL;
+		if (cn->sec_head)
+			new |= cn->sec_tail->encoded_tail;
+
+		old = atomic_cmpxchg(&lock->val, val, new);
+		if (old == val) {
+			if (cn->sec_head) {
+				next = cn->sec_head;
+				next->sec_head = next->sec_tail = NULL;
+				next->intra_count = 0;
+				arch_mcs_spin_unlock_contended(&next->mcs.locked);
+			}
+			goto release;
+		}
+
+		val = old;
+	}
+
+	while (!(next = cna_next(cn)))
+		cpu_relax();
+
+	/* the scan may have missed a waiter which was still linking in */
+	if (!cn->scan_hit)
+		cna_scan(cn, next);
+
+	cna_hand_off(cn, next);
+
+release:
+	this_cpu_dec(cna_nodes[0].mcs.count);
+}
+
+#endif /* _GEN_PV_LOCK_SLOWPATH_CNA_H */
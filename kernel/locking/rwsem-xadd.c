@@ -17,6 +17,7 @@
 #include <linux/osq_lock.h>
 
 #include "rwsem.h"
+#include "contention.h"
 
 /*
  * Guide to the rw_semaphore's count field for common values.
@@ -65,8 +66,13 @@
  *	 are only waiters but none active (5th case above), and attempt to
  *	 steal the lock.
  *
+ * A writer that has been first in the queue for more than
+ * RWSEM_WAIT_TIMEOUT sets sem->handoff, which stops the others from
+ * stealing the lock until it has got it.
  */
 
+#define RWSEM_WAIT_TIMEOUT	DIV_ROUND_UP(HZ, 250)
+
 /*
  * Initialize an rwsem:
  */
@@ -83,6 +89,7 @@ void __init_rwsem(struct rw_semaphore *sem, const char *name,
 	sem->count = RWSEM_UNLOCKED_VALUE;
 	raw_spin_lock_init(&sem->wait_lock);
 	INIT_LIST_HEAD(&sem->wait_list);
+	sem->handoff = 0;
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
 	sem->owner = NULL;
 	osq_lock_init(&sem->osq);
@@ -100,6 +107,7 @@ struct rwsem_waiter {
 	struct list_head list;
 	struct task_struct *task;
 	enum rwsem_waiter_type type;
+	unsigned long timeout;
 };
 
 enum rwsem_wake_type {
@@ -207,6 +215,9 @@ __rwsem_do_wake(struct rw_semaphore *sem, enum rwsem_wake_type wake_type)
 	return sem;
 }
 
+static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem);
+static bool rwsem_optimistic_spin(struct rw_semaphore *sem, bool wlock);
+
 /*
  * Wait for the read lock to be granted
  */
@@ -216,6 +227,26 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	long count, adjustment = -RWSEM_ACTIVE_READ_BIAS;
 	struct rwsem_waiter waiter;
 	struct task_struct *tsk = current;
+	bool first = false;
+	u64 start;
+
+	start = lock_contention_begin(sem, LCB_F_READ, _RET_IP_);
+
+	/*
+	 * If a running writer holds the lock, take our bias back and spin
+	 * until it leaves, rather than going to sleep.  Not when we were the
+	 * last active locker in front of waiters though: those have to be
+	 * woken, and come first.
+	 */
+	if (rwsem_can_spin_on_owner(sem)) {
+		count = rwsem_atomic_update(-RWSEM_ACTIVE_READ_BIAS, sem);
+		adjustment = 0;
+		if (count != RWSEM_WAITING_BIAS &&
+		    rwsem_optimistic_spin(sem, false)) {
+			lock_contention_end(sem, start, 0);
+			return sem;
+		}
+	}
 
 	/* set up my own style of waitqueue */
 	waiter.task = tsk;
@@ -223,8 +254,10 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	get_task_struct(tsk);
 
 	raw_spin_lock_irq(&sem->wait_lock);
-	if (list_empty(&sem->wait_list))
+	if (list_empty(&sem->wait_list)) {
 		adjustment += RWSEM_WAITING_BIAS;
+		first = true;
+	}
 	list_add_tail(&waiter.list, &sem->wait_list);
 
 	/* we're now waiting on the lock, but no longer actively locking */
@@ -236,8 +269,7 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	 * wake our own waiter to join the existing active readers !
 	 */
 	if (count == RWSEM_WAITING_BIAS ||
-	    (count > RWSEM_WAITING_BIAS &&
-	     adjustment != -RWSEM_ACTIVE_READ_BIAS))
+	    (count > RWSEM_WAITING_BIAS && first))
 		sem = __rwsem_do_wake(sem, RWSEM_WAKE_ANY);
 
 	raw_spin_unlock_irq(&sem->wait_lock);
@@ -251,12 +283,30 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	}
 
 	__set_task_state(tsk, TASK_RUNNING);
+	lock_contention_end(sem, start, 0);
 	return sem;
 }
 EXPORT_SYMBOL(rwsem_down_read_failed);
 
-static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
+static inline bool rwsem_first_waiter(struct rw_semaphore *sem,
+				      struct rwsem_waiter *waiter)
 {
+	return list_first_entry(&sem->wait_list, struct rwsem_waiter,
+				list) == waiter;
+}
+
+/*
+ * Called with wait_lock held.
+ */
+static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem,
+					struct rwsem_waiter *waiter)
+{
+	bool first = rwsem_first_waiter(sem, waiter);
+
+	/* the first waiter has waited long enough, it's its turn now */
+	if (sem->handoff && !first)
+		return false;
+
 	/*
 	 * Try acquiring the write lock. Check count first in order
 	 * to reduce unnecessary expensive cmpxchg() operations.
@@ -267,9 +317,14 @@ static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
 		if (!list_is_singular(&sem->wait_list))
 			rwsem_atomic_update(RWSEM_WAITING_BIAS, sem);
 		rwsem_set_owner(sem);
+		if (first)
+			WRITE_ONCE(sem->handoff, 0);
 		return true;
 	}
 
+	if (first && !sem->handoff && time_after(jiffies, waiter->timeout))
+		WRITE_ONCE(sem->handoff, 1);
+
 	return false;
 }
 
@@ -281,7 +336,7 @@ static inline bool rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
 {
 	long old, count = READ_ONCE(sem->count);
 
-	while (true) {
+	while (!READ_ONCE(sem->handoff)) {
 		if (!(count == 0 || count == RWSEM_WAITING_BIAS))
 			return false;
 
@@ -294,6 +349,27 @@ static inline bool rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
 
 		count = old;
 	}
+	return false;
+}
+
+/*
+ * Try to acquire read lock before the reader has been put on wait queue.
+ * Only while there are neither writers nor waiters, so spinning readers
+ * don't get ahead of anyone queued.
+ */
+static inline bool rwsem_try_read_lock_unqueued(struct rw_semaphore *sem)
+{
+	long old, count = READ_ONCE(sem->count);
+
+	while (count >= 0) {
+		old = cmpxchg_acquire(&sem->count, count,
+				      count + RWSEM_ACTIVE_READ_BIAS);
+		if (old == count)
+			return true;
+
+		count = old;
+	}
+	return false;
 }
 
 static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
@@ -301,7 +377,7 @@ static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
 	struct task_struct *owner;
 	bool ret = true;
 
-	if (need_resched())
+	if (need_resched() || READ_ONCE(sem->handoff))
 		return false;
 
 	rcu_read_lock();
@@ -362,7 +438,7 @@ bool rwsem_spin_on_owner(struct rw_semaphore *sem, struct task_struct *owner)
 	return (count == 0 || count == RWSEM_WAITING_BIAS);
 }
 
-static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
+static bool rwsem_optimistic_spin(struct rw_semaphore *sem, bool wlock)
 {
 	struct task_struct *owner;
 	bool taken = false;
@@ -381,10 +457,25 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 		if (owner && !rwsem_spin_on_owner(sem, owner))
 			break;
 
-		/* wait_lock will be acquired if write_lock is obtained */
-		if (rwsem_try_write_lock_unqueued(sem)) {
-			taken = true;
-			break;
+		if (wlock) {
+			/* wait_lock will be acquired if write_lock is obtained */
+			if (rwsem_try_write_lock_unqueued(sem)) {
+				taken = true;
+				break;
+			}
+
+			/* leave the lock to the first waiter */
+			if (READ_ONCE(sem->handoff))
+				break;
+		} else {
+			if (rwsem_try_read_lock_unqueued(sem)) {
+				taken = true;
+				break;
+			}
+
+			/* get in line behind the waiters */
+			if (!list_empty(&sem->wait_list))
+				break;
 		}
 
 		/*
@@ -419,7 +510,12 @@ static inline bool rwsem_has_spinner(struct rw_semaphore *sem)
 }
 
 #else
-static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
+static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
+{
+	return false;
+}
+
+static bool rwsem_optimistic_spin(struct rw_semaphore *sem, bool wlock)
 {
 	return false;
 }
@@ -439,13 +535,18 @@ struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 	long count;
 	bool waiting = true; /* any queued threads before us */
 	struct rwsem_waiter waiter;
+	u64 start;
+
+	start = lock_contention_begin(sem, LCB_F_WRITE, _RET_IP_);
 
 	/* undo write bias from down_write operation, stop active locking */
 	count = rwsem_atomic_update(-RWSEM_ACTIVE_WRITE_BIAS, sem);
 
 	/* do optimistic spinning and steal lock if possible */
-	if (rwsem_optimistic_spin(sem))
+	if (rwsem_optimistic_spin(sem, true)) {
+		lock_contention_end(sem, start, 0);
 		return sem;
+	}
 
 	/*
 	 * Optimistic spinning failed, proceed to the slowpath
@@ -453,6 +554,7 @@ struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 	 */
 	waiter.task = current;
 	waiter.type = RWSEM_WAITING_FOR_WRITE;
+	waiter.timeout = jiffies + RWSEM_WAIT_TIMEOUT;
 
 	raw_spin_lock_irq(&sem->wait_lock);
 
@@ -474,13 +576,21 @@ struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 		if (count > RWSEM_WAITING_BIAS)
 			sem = __rwsem_do_wake(sem, RWSEM_WAKE_READERS);
 
+		/*
+		 * The lock is free, but reserved for the first waiter: a
+		 * spinner bailing out on the handoff may have been relied
+		 * on for the wakeup in rwsem_wake(), do it for it.
+		 */
+		else if (count == RWSEM_WAITING_BIAS && sem->handoff)
+			sem = __rwsem_do_wake(sem, RWSEM_WAKE_ANY);
+
 	} else
 		count = rwsem_atomic_update(RWSEM_WAITING_BIAS, sem);
 
 	/* wait until we successfully acquire the lock */
 	set_current_state(TASK_UNINTERRUPTIBLE);
 	while (true) {
-		if (rwsem_try_write_lock(count, sem))
+		if (rwsem_try_write_lock(count, sem, &waiter))
 			break;
 		raw_spin_unlock_irq(&sem->wait_lock);
 
@@ -496,6 +606,7 @@ struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 
 	list_del(&waiter.list);
 	raw_spin_unlock_irq(&sem->wait_lock);
+	lock_contention_end(sem, start, 0);
 
 	return sem;
 }
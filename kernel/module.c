@@ -59,6 +59,8 @@
 #include <linux/jump_label.h>
 #include <linux/pfn.h>
 #include <linux/bsearch.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
 #include <uapi/linux/module.h>
 #include "module-internal.h"
 
@@ -444,70 +446,169 @@ static bool each_symbol_in_section(const struct symsearch *arr,
 	return false;
 }
 
-/* Returns true as soon as fn returns true, otherwise false. */
-bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
-				    struct module *owner,
-				    void *data),
-			 void *data)
+static const struct symsearch vmlinux_syms[] = {
+	{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
+	  NOT_GPL_ONLY, false },
+	{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
+	  __start___kcrctab_gpl,
+	  GPL_ONLY, false },
+	{ __start___ksymtab_gpl_future, __stop___ksymtab_gpl_future,
+	  __start___kcrctab_gpl_future,
+	  WILL_BE_GPL_ONLY, false },
+#ifdef CONFIG_UNUSED_SYMBOLS
+	{ __start___ksymtab_unused, __stop___ksymtab_unused,
+	  __start___kcrctab_unused,
+	  NOT_GPL_ONLY, true },
+	{ __start___ksymtab_unused_gpl, __stop___ksymtab_unused_gpl,
+	  __start___kcrctab_unused_gpl,
+	  GPL_ONLY, true },
+#endif
+};
+
+static bool each_module_symbol_section(struct module *mod,
+				       bool (*fn)(const struct symsearch *syms,
+						  struct module *owner,
+						  void *data),
+				       void *data)
 {
-	struct module *mod;
-	static const struct symsearch arr[] = {
-		{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
+	struct symsearch arr[] = {
+		{ mod->syms, mod->syms + mod->num_syms, mod->crcs,
 		  NOT_GPL_ONLY, false },
-		{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
-		  __start___kcrctab_gpl,
+		{ mod->gpl_syms, mod->gpl_syms + mod->num_gpl_syms,
+		  mod->gpl_crcs,
 		  GPL_ONLY, false },
-		{ __start___ksymtab_gpl_future, __stop___ksymtab_gpl_future,
-		  __start___kcrctab_gpl_future,
+		{ mod->gpl_future_syms,
+		  mod->gpl_future_syms + mod->num_gpl_future_syms,
+		  mod->gpl_future_crcs,
 		  WILL_BE_GPL_ONLY, false },
 #ifdef CONFIG_UNUSED_SYMBOLS
-		{ __start___ksymtab_unused, __stop___ksymtab_unused,
-		  __start___kcrctab_unused,
+		{ mod->unused_syms,
+		  mod->unused_syms + mod->num_unused_syms,
+		  mod->unused_crcs,
 		  NOT_GPL_ONLY, true },
-		{ __start___ksymtab_unused_gpl, __stop___ksymtab_unused_gpl,
-		  __start___kcrctab_unused_gpl,
+		{ mod->unused_gpl_syms,
+		  mod->unused_gpl_syms + mod->num_unused_gpl_syms,
+		  mod->unused_gpl_crcs,
 		  GPL_ONLY, true },
 #endif
 	};
 
+	return each_symbol_in_section(arr, ARRAY_SIZE(arr), mod, fn, data);
+}
+
+/* Returns true as soon as fn returns true, otherwise false. */
+bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
+				    struct module *owner,
+				    void *data),
+			 void *data)
+{
+	struct module *mod;
+
 	module_assert_mutex_or_preempt();
 
-	if (each_symbol_in_section(arr, ARRAY_SIZE(arr), NULL, fn, data))
+	if (each_symbol_in_section(vmlinux_syms, ARRAY_SIZE(vmlinux_syms),
+				   NULL, fn, data))
 		return true;
 
 	list_for_each_entry_rcu(mod, &modules, list) {
-		struct symsearch arr[] = {
-			{ mod->syms, mod->syms + mod->num_syms, mod->crcs,
-			  NOT_GPL_ONLY, false },
-			{ mod->gpl_syms, mod->gpl_syms + mod->num_gpl_syms,
-			  mod->gpl_crcs,
-			  GPL_ONLY, false },
-			{ mod->gpl_future_syms,
-			  mod->gpl_future_syms + mod->num_gpl_future_syms,
-			  mod->gpl_future_crcs,
-			  WILL_BE_GPL_ONLY, false },
-#ifdef CONFIG_UNUSED_SYMBOLS
-			{ mod->unused_syms,
-			  mod->unused_syms + mod->num_unused_syms,
-			  mod->unused_crcs,
-			  NOT_GPL_ONLY, true },
-			{ mod->unused_gpl_syms,
-			  mod->unused_gpl_syms + mod->num_unused_gpl_syms,
-			  mod->unused_gpl_crcs,
-			  GPL_ONLY, true },
-#endif
-		};
-
 		if (mod->state == MODULE_STATE_UNFORMED)
 			continue;
 
-		if (each_symbol_in_section(arr, ARRAY_SIZE(arr), mod, fn, data))
+		if (each_module_symbol_section(mod, fn, data))
 			return true;
 	}
 	return false;
 }
 EXPORT_SYMBOL_GPL(each_symbol_section);
 
+/*
+ * The exports of all formed modules, hashed by name, so that find_symbol()
+ * goes straight to the one module that can export a name (see
+ * verify_export_symbols()) instead of searching each of them in turn.
+ * Changed under module_mutex, read under RCU-sched like the module list.
+ */
+struct mod_export {
+	struct hlist_node node;
+	const char *name;
+	struct module *owner;
+};
+
+#define MOD_EXPORT_HASH_BITS	12
+static DEFINE_HASHTABLE(mod_export_hash, MOD_EXPORT_HASH_BITS);
+
+static u32 mod_export_hashfn(const char *name)
+{
+	return jhash(name, strlen(name), 0);
+}
+
+static unsigned int mod_num_exports(struct module *mod)
+{
+	return mod->num_syms + mod->num_gpl_syms + mod->num_gpl_future_syms
+#ifdef CONFIG_UNUSED_SYMBOLS
+		+ mod->num_unused_syms + mod->num_unused_gpl_syms
+#endif
+		;
+}
+
+static bool mod_export_add_section(const struct symsearch *syms,
+				   struct module *owner, void *data)
+{
+	struct mod_export **next = data;
+	const struct kernel_symbol *s;
+
+	for (s = syms->start; s < syms->stop; s++, (*next)++) {
+		(*next)->name = s->name;
+		(*next)->owner = owner;
+		hash_add_rcu(mod_export_hash, &(*next)->node,
+			     mod_export_hashfn(s->name));
+	}
+	return false;
+}
+
+/* Called under module_mutex, once the exports have been verified */
+static int mod_export_add(struct module *mod)
+{
+	unsigned int num = mod_num_exports(mod);
+	struct mod_export *next;
+
+	if (!num)
+		return 0;
+	mod->exports = kmalloc_array(num, sizeof(*mod->exports), GFP_KERNEL);
+	if (!mod->exports)
+		return -ENOMEM;
+	next = mod->exports;
+	each_module_symbol_section(mod, mod_export_add_section, &next);
+	return 0;
+}
+
+/*
+ * Called under module_mutex when unlinking @mod, the caller frees
+ * mod->exports after synchronize_sched().
+ */
+static void mod_export_del(struct module *mod)
+{
+	unsigned int i, num;
+
+	if (!mod->exports)
+		return;
+	num = mod_num_exports(mod);
+	for (i = 0; i < num; i++)
+		hash_del_rcu(&mod->exports[i].node);
+}
+
+static struct module *mod_export_owner(const char *name)
+{
+	struct mod_export *e;
+
+	hash_for_each_possible_rcu(mod_export_hash, e, node,
+				   mod_export_hashfn(name)) {
+		if (e->owner->state != MODULE_STATE_UNFORMED &&
+		    !strcmp(e->name, name))
+			return e->owner;
+	}
+	return NULL;
+}
+
 struct find_symbol_arg {
 	/* Input */
 	const char *name;
@@ -587,12 +688,18 @@ const struct kernel_symbol *find_symbol(const char *name,
 					bool warn)
 {
 	struct find_symbol_arg fsa;
+	struct module *mod;
 
 	fsa.name = name;
 	fsa.gplok = gplok;
 	fsa.warn = warn;
 
-	if (each_symbol_section(find_symbol_in_section, &fsa)) {
+	module_assert_mutex_or_preempt();
+
+	if (each_symbol_in_section(vmlinux_syms, ARRAY_SIZE(vmlinux_syms),
+				   NULL, find_symbol_in_section, &fsa) ||
+	    ((mod = mod_export_owner(name)) &&
+	     each_module_symbol_section(mod, find_symbol_in_section, &fsa))) {
 		if (owner)
 			*owner = fsa.owner;
 		if (crc)
@@ -1393,8 +1500,25 @@ static const struct kernel_symbol *resolve_symbol(struct module *mod,
 	struct module *owner;
 	const struct kernel_symbol *sym;
 	const unsigned long *crc;
+	bool gplok = !(mod->taints & (1 << TAINT_PROPRIETARY_MODULE));
 	int err;
 
+	/*
+	 * Symbols of the kernel proper need no reference on their owner,
+	 * so most of them are resolved without module_mutex, which modules
+	 * loading in parallel would otherwise keep bouncing around.
+	 */
+	preempt_disable();
+	sym = find_symbol(name, &owner, &crc, gplok, true);
+	preempt_enable();
+	if (sym && !owner) {
+		if (!check_version(info->sechdrs, info->index.vers, name, mod,
+				   crc, NULL))
+			sym = ERR_PTR(-EINVAL);
+		strncpy(ownername, module_name(NULL), MODULE_NAME_LEN);
+		return sym;
+	}
+
 	/*
 	 * The module_mutex should not be a heavily contended lock;
 	 * if we get the occasional sleep here, we'll go an extra iteration
@@ -1402,8 +1526,8 @@ static const struct kernel_symbol *resolve_symbol(struct module *mod,
 	 */
 	sched_annotate_sleep();
 	mutex_lock(&module_mutex);
-	sym = find_symbol(name, &owner, &crc,
-			  !(mod->taints & (1 << TAINT_PROPRIETARY_MODULE)), true);
+	/* Whatever there was to warn about has been warned about above */
+	sym = find_symbol(name, &owner, &crc, gplok, !sym);
 	if (!sym)
 		goto unlock;
 
@@ -2030,11 +2154,13 @@ static void free_module(struct module *mod)
 	/* Unlink carefully: kallsyms could be walking list. */
 	list_del_rcu(&mod->list);
 	mod_tree_remove(mod);
+	mod_export_del(mod);
 	/* Remove this module from bug list, this uses list_del_rcu */
 	module_bug_cleanup(mod);
 	/* Wait for RCU-sched synchronizing before releasing mod->list and buglist. */
 	synchronize_sched();
 	mutex_unlock(&module_mutex);
+	kfree(mod->exports);
 
 	/* This may be NULL, but that's OK */
 	unset_module_init_ro_nx(mod);
@@ -3388,6 +3514,10 @@ static int complete_formation(struct module *mod, struct load_info *info)
 	if (err < 0)
 		goto out;
 
+	err = mod_export_add(mod);
+	if (err < 0)
+		goto out;
+
 	/* This relies on module_mutex for list integrity. */
 	module_bug_finalize(info->hdr, info->sechdrs, mod);
 
@@ -3584,10 +3714,12 @@ static int load_module(struct load_info *info, const char __user *uargs,
 	/* Unlink carefully: kallsyms could be walking list. */
 	list_del_rcu(&mod->list);
 	mod_tree_remove(mod);
+	mod_export_del(mod);
 	wake_up_all(&module_wq);
 	/* Wait for RCU-sched synchronizing before releasing mod->list. */
 	synchronize_sched();
 	mutex_unlock(&module_mutex);
+	kfree(mod->exports);
  free_module:
 	/*
 	 * Ftrace needs to clean up what it initialized.
@@ -121,6 +121,55 @@ static inline bool __rcu_reclaim(const char *rn, struct rcu_head *head)
 	}
 }
 
+/*
+ * The objects of kfree_rcu() callbacks, gathered up for kfree_bulk() by
+ * the tree-RCU callback invokers.
+ */
+#define RCU_KFREE_BULK	16
+
+struct kmem_cache;
+void kmem_cache_free_bulk(struct kmem_cache *, size_t, void **);
+
+struct rcu_kfree_batch {
+	unsigned long nr_bulk;		/* kfree_bulk() calls */
+	unsigned long nr_objs;		/* objects freed by them */
+	int nr;
+	void *objs[RCU_KFREE_BULK];
+};
+
+static inline void rcu_kfree_batch_flush(struct rcu_kfree_batch *kb)
+{
+	if (!kb->nr)
+		return;
+
+	/* a NULL cache is kfree_bulk(), the objects may be of any size */
+	kmem_cache_free_bulk(NULL, kb->nr, kb->objs);
+	kb->nr_bulk++;
+	kb->nr_objs += kb->nr;
+	kb->nr = 0;
+}
+
+/*
+ * Like __rcu_reclaim(), but the lazy case leaves the object to @kb.
+ * Must be called with interrupts enabled, as is kmem_cache_free_bulk().
+ */
+static inline bool __rcu_reclaim_batch(const char *rn, struct rcu_head *head,
+				       struct rcu_kfree_batch *kb)
+{
+	unsigned long offset = (unsigned long)head->func;
+
+	if (!__is_kfree_rcu_offset(offset))
+		return __rcu_reclaim(rn, head);
+
+	rcu_lock_acquire(&rcu_callback_map);
+	RCU_TRACE(trace_rcu_invoke_kfree_callback(rn, head, offset));
+	kb->objs[kb->nr++] = (void *)head - offset;
+	if (kb->nr == RCU_KFREE_BULK)
+		rcu_kfree_batch_flush(kb);
+	rcu_lock_release(&rcu_callback_map);
+	return true;
+}
+
 #ifdef CONFIG_RCU_STALL_COMMON
 
 extern int rcu_cpu_stall_suppress;
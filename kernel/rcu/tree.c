@@ -50,12 +50,14 @@
 #include <linux/kernel_stat.h>
 #include <linux/wait.h>
 #include <linux/kthread.h>
+#include <linux/sched/isolation.h>
 #include <linux/prefetch.h>
 #include <linux/delay.h>
 #include <linux/stop_machine.h>
 #include <linux/random.h>
 #include <linux/trace_events.h>
 #include <linux/suspend.h>
+#include <linux/workqueue.h>
 
 #include "tree.h"
 #include "rcu.h"
@@ -155,6 +157,9 @@ EXPORT_SYMBOL_GPL(rcu_scheduler_active);
  */
 static int rcu_scheduler_fully_active __read_mostly;
 
+/* Runs the per-leaf parts of the expedited grace-period initialization. */
+static struct workqueue_struct *rcu_par_gp_wq __read_mostly;
+
 static void rcu_init_new_rnp(struct rcu_node *rnp_leaf);
 static void rcu_cleanup_dead_rnp(struct rcu_node *rnp_leaf);
 static void rcu_boost_kthread_setaffinity(struct rcu_node *rnp, int outgoingcpu);
@@ -2655,6 +2660,7 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 {
 	unsigned long flags;
 	struct rcu_head *next, *list, **tail;
+	struct rcu_kfree_batch kb = { 0 };
 	long bl, count, count_lazy;
 	int i;
 
@@ -2690,7 +2696,7 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 		next = list->next;
 		prefetch(next);
 		debug_rcu_head_unqueue(list);
-		if (__rcu_reclaim(rsp->name, list))
+		if (__rcu_reclaim_batch(rsp->name, list, &kb))
 			count_lazy++;
 		list = next;
 		/* Stop only if limit reached and CPU has something to do. */
@@ -2699,6 +2705,7 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 		     (!is_idle_task(current) && !rcu_is_callbacks_kthread())))
 			break;
 	}
+	rcu_kfree_batch_flush(&kb);
 
 	local_irq_save(flags);
 	trace_rcu_batch_end(rsp->name, count, !!list, need_resched(),
@@ -2719,6 +2726,8 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 	rdp->qlen_lazy -= count_lazy;
 	WRITE_ONCE(rdp->qlen, rdp->qlen - count);
 	rdp->n_cbs_invoked += count;
+	rdp->n_kfree_bulk += kb.nr_bulk;
+	rdp->n_kfree_bulk_objs += kb.nr_objs;
 
 	/* Reinstate batch limit if we have worked down the excess. */
 	if (rdp->blimit == LONG_MAX && rdp->qlen <= qlowmark)
@@ -3292,6 +3301,72 @@ void cond_synchronize_rcu(unsigned long oldstate)
 }
 EXPORT_SYMBOL_GPL(cond_synchronize_rcu);
 
+/*
+ * Make sure that a grace period is started for the specified RCU
+ * flavor, even if no CPU has callbacks asking for one, so that a
+ * caller polling for the end of the current grace period needn't
+ * wait for some unrelated call_rcu() to come along.
+ */
+static void rcu_poll_gp_request(struct rcu_state *rsp)
+{
+	unsigned long c;
+	unsigned long flags;
+	bool needwake;
+	struct rcu_data *rdp;
+	struct rcu_node *rnp;
+
+	local_irq_save(flags);
+	rdp = this_cpu_ptr(rsp->rda);
+	rnp = rdp->mynode;
+	raw_spin_lock(&rnp->lock);
+	smp_mb__after_unlock_lock();
+	needwake = rcu_start_future_gp(rnp, rdp, &c);
+	raw_spin_unlock_irqrestore(&rnp->lock, flags);
+	if (needwake)
+		rcu_gp_kthread_wake(rsp);
+}
+
+/**
+ * start_poll_synchronize_rcu - Snapshot RCU state and start a grace period
+ *
+ * Returns a cookie for poll_state_synchronize_rcu(), just as
+ * get_state_synchronize_rcu() does, but also makes sure that the
+ * grace period that the cookie waits for gets started.
+ */
+unsigned long start_poll_synchronize_rcu(void)
+{
+	unsigned long gp = get_state_synchronize_rcu();
+
+	rcu_poll_gp_request(rcu_state_p);
+	return gp;
+}
+EXPORT_SYMBOL_GPL(start_poll_synchronize_rcu);
+
+/**
+ * poll_state_synchronize_rcu - Has an RCU grace period elapsed?
+ *
+ * @oldstate: return value from get_state_synchronize_rcu() or
+ *	      start_poll_synchronize_rcu()
+ *
+ * Returns true if a full RCU grace period has elapsed since the call
+ * that returned @oldstate, and false otherwise.  Unlike
+ * cond_synchronize_rcu(), this never blocks, so it may be used by
+ * callers that would rather come back later than wait.  The same
+ * counter-wrap argument applies.
+ */
+bool poll_state_synchronize_rcu(unsigned long oldstate)
+{
+	/*
+	 * Ensure that this load happens before any RCU-destructive
+	 * actions the caller might carry out after we return true.
+	 */
+	if (ULONG_CMP_GE(oldstate, smp_load_acquire(&rcu_state_p->completed)))
+		return false;
+	smp_mb(); /* Order against the end of the grace period. */
+	return true;
+}
+EXPORT_SYMBOL_GPL(poll_state_synchronize_rcu);
+
 /**
  * get_state_synchronize_sched - Snapshot current RCU-sched state
  *
@@ -3344,6 +3419,40 @@ void cond_synchronize_sched(unsigned long oldstate)
 }
 EXPORT_SYMBOL_GPL(cond_synchronize_sched);
 
+/**
+ * start_poll_synchronize_sched - Snapshot RCU-sched state, start a GP
+ *
+ * Returns a cookie for poll_state_synchronize_sched(), and makes sure
+ * that the grace period that the cookie waits for gets started.
+ */
+unsigned long start_poll_synchronize_sched(void)
+{
+	unsigned long gp = get_state_synchronize_sched();
+
+	rcu_poll_gp_request(&rcu_sched_state);
+	return gp;
+}
+EXPORT_SYMBOL_GPL(start_poll_synchronize_sched);
+
+/**
+ * poll_state_synchronize_sched - Has an RCU-sched grace period elapsed?
+ *
+ * @oldstate: return value from get_state_synchronize_sched() or
+ *	      start_poll_synchronize_sched()
+ *
+ * Returns true if a full RCU-sched grace period has elapsed since the
+ * call that returned @oldstate, and false otherwise, without blocking.
+ */
+bool poll_state_synchronize_sched(unsigned long oldstate)
+{
+	if (ULONG_CMP_GE(oldstate,
+			 smp_load_acquire(&rcu_sched_state.completed)))
+		return false;
+	smp_mb(); /* Order against the end of the grace period. */
+	return true;
+}
+EXPORT_SYMBOL_GPL(poll_state_synchronize_sched);
+
 /* Adjust sequence number for start of update-side operation. */
 static void rcu_seq_start(unsigned long *sp)
 {
@@ -3692,11 +3801,10 @@ static void sync_sched_exp_online_cleanup(int cpu)
 }
 
 /*
- * Select the nodes that the upcoming expedited grace period needs
- * to wait for.
+ * Select the CPUs within the specified rcu_node that the upcoming
+ * expedited grace period needs to wait for.
  */
-static void sync_rcu_exp_select_cpus(struct rcu_state *rsp,
-				     smp_call_func_t func)
+static void sync_rcu_exp_select_node_cpus(struct work_struct *wp)
 {
 	int cpu;
 	unsigned long flags;
@@ -3704,67 +3812,107 @@ static void sync_rcu_exp_select_cpus(struct rcu_state *rsp,
 	unsigned long mask_ofl_test;
 	unsigned long mask_ofl_ipi;
 	int ret;
-	struct rcu_node *rnp;
+	struct rcu_exp_work *rewp =
+		container_of(wp, struct rcu_exp_work, rew_work);
+	struct rcu_node *rnp = container_of(rewp, struct rcu_node, rew);
+	struct rcu_state *rsp = rewp->rew_rsp;
+	smp_call_func_t func = rewp->rew_func;
 
-	sync_exp_reset_tree(rsp);
-	rcu_for_each_leaf_node(rsp, rnp) {
-		raw_spin_lock_irqsave(&rnp->lock, flags);
-		smp_mb__after_unlock_lock();
+	raw_spin_lock_irqsave(&rnp->lock, flags);
+	smp_mb__after_unlock_lock();
 
-		/* Each pass checks a CPU for identity, offline, and idle. */
-		mask_ofl_test = 0;
-		for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++) {
-			struct rcu_data *rdp = per_cpu_ptr(rsp->rda, cpu);
-			struct rcu_dynticks *rdtp = &per_cpu(rcu_dynticks, cpu);
+	/* Each pass checks a CPU for identity, offline, and idle. */
+	mask_ofl_test = 0;
+	for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++) {
+		struct rcu_data *rdp = per_cpu_ptr(rsp->rda, cpu);
+		struct rcu_dynticks *rdtp = &per_cpu(rcu_dynticks, cpu);
 
-			if (raw_smp_processor_id() == cpu ||
-			    !(atomic_add_return(0, &rdtp->dynticks) & 0x1))
-				mask_ofl_test |= rdp->grpmask;
-		}
-		mask_ofl_ipi = rnp->expmask & ~mask_ofl_test;
+		if (raw_smp_processor_id() == cpu ||
+		    !(atomic_add_return(0, &rdtp->dynticks) & 0x1))
+			mask_ofl_test |= rdp->grpmask;
+	}
+	mask_ofl_ipi = rnp->expmask & ~mask_ofl_test;
 
-		/*
-		 * Need to wait for any blocked tasks as well.  Note that
-		 * additional blocking tasks will also block the expedited
-		 * GP until such time as the ->expmask bits are cleared.
-		 */
-		if (rcu_preempt_has_tasks(rnp))
-			rnp->exp_tasks = rnp->blkd_tasks.next;
-		raw_spin_unlock_irqrestore(&rnp->lock, flags);
+	/*
+	 * Need to wait for any blocked tasks as well.  Note that
+	 * additional blocking tasks will also block the expedited
+	 * GP until such time as the ->expmask bits are cleared.
+	 */
+	if (rcu_preempt_has_tasks(rnp))
+		rnp->exp_tasks = rnp->blkd_tasks.next;
+	raw_spin_unlock_irqrestore(&rnp->lock, flags);
 
-		/* IPI the remaining CPUs for expedited quiescent state. */
-		mask = 1;
-		for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++, mask <<= 1) {
-			if (!(mask_ofl_ipi & mask))
-				continue;
+	/* IPI the remaining CPUs for expedited quiescent state. */
+	mask = 1;
+	for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++, mask <<= 1) {
+		if (!(mask_ofl_ipi & mask))
+			continue;
 retry_ipi:
-			ret = smp_call_function_single(cpu, func, rsp, 0);
-			if (!ret) {
-				mask_ofl_ipi &= ~mask;
-			} else {
-				/* Failed, raced with offline. */
-				raw_spin_lock_irqsave(&rnp->lock, flags);
+		ret = smp_call_function_single(cpu, func, rsp, 0);
+		if (!ret) {
+			mask_ofl_ipi &= ~mask;
+		} else {
+			/* Failed, raced with offline. */
+			raw_spin_lock_irqsave(&rnp->lock, flags);
+			if (cpu_online(cpu) &&
+			    (rnp->expmask & mask)) {
+				raw_spin_unlock_irqrestore(&rnp->lock,
+							   flags);
+				schedule_timeout_uninterruptible(1);
 				if (cpu_online(cpu) &&
-				    (rnp->expmask & mask)) {
-					raw_spin_unlock_irqrestore(&rnp->lock,
-								   flags);
-					schedule_timeout_uninterruptible(1);
-					if (cpu_online(cpu) &&
-					    (rnp->expmask & mask))
-						goto retry_ipi;
-					raw_spin_lock_irqsave(&rnp->lock,
-							      flags);
-				}
-				if (!(rnp->expmask & mask))
-					mask_ofl_ipi &= ~mask;
-				raw_spin_unlock_irqrestore(&rnp->lock, flags);
+				    (rnp->expmask & mask))
+					goto retry_ipi;
+				raw_spin_lock_irqsave(&rnp->lock,
+						      flags);
 			}
+			if (!(rnp->expmask & mask))
+				mask_ofl_ipi &= ~mask;
+			raw_spin_unlock_irqrestore(&rnp->lock, flags);
+		}
+	}
+	/* Report quiescent states for those that went offline. */
+	mask_ofl_test |= mask_ofl_ipi;
+	if (mask_ofl_test)
+		rcu_report_exp_cpu_mult(rsp, rnp, mask_ofl_test, false);
+}
+
+/*
+ * Select the nodes that the upcoming expedited grace period needs
+ * to wait for.  On large systems, the leaves are handled in parallel,
+ * each by a workqueue handler running on one of its own CPUs, so that
+ * the IPIs go out from many CPUs at once.  The last leaf, and all of
+ * them early during boot or when the workqueue isn't there, is handled
+ * here directly.
+ */
+static void sync_rcu_exp_select_cpus(struct rcu_state *rsp,
+				     smp_call_func_t func)
+{
+	int cpu;
+	struct rcu_node *rnp;
+
+	sync_exp_reset_tree(rsp);
+	rcu_for_each_leaf_node(rsp, rnp) {
+		rnp->exp_need_flush = false;
+		rnp->rew.rew_func = func;
+		rnp->rew.rew_rsp = rsp;
+		if (!READ_ONCE(rcu_par_gp_wq) || !rcu_scheduler_fully_active ||
+		    rnp == &rsp->node[rcu_num_nodes - 1]) {
+			sync_rcu_exp_select_node_cpus(&rnp->rew.rew_work);
+			continue;
 		}
-		/* Report quiescent states for those that went offline. */
-		mask_ofl_test |= mask_ofl_ipi;
-		if (mask_ofl_test)
-			rcu_report_exp_cpu_mult(rsp, rnp, mask_ofl_test, false);
+		INIT_WORK(&rnp->rew.rew_work, sync_rcu_exp_select_node_cpus);
+		cpu = cpumask_next(rnp->grplo - 1, cpu_online_mask);
+		/* If all its CPUs are offline, any CPU will do. */
+		if (unlikely(cpu > rnp->grphi))
+			cpu = WORK_CPU_UNBOUND;
+		queue_work_on(cpu, rcu_par_gp_wq, &rnp->rew.rew_work);
+		rnp->exp_need_flush = true;
 	}
+
+	/* Wait for the handlers to finish selecting and IPIing. */
+	rcu_for_each_leaf_node(rsp, rnp)
+		if (rnp->exp_need_flush)
+			flush_work(&rnp->rew.rew_work);
 }
 
 static void synchronize_sched_expedited_wait(struct rcu_state *rsp)
@@ -4342,6 +4490,24 @@ static int __init rcu_spawn_gp_kthread(void)
 }
 early_initcall(rcu_spawn_gp_kthread);
 
+/*
+ * Create the workqueue that lets expedited grace periods select and IPI
+ * the CPUs of each leaf rcu_node structure in parallel.  Until then, and
+ * if it can't be had, the leaves are handled one after the other.
+ */
+static int __init rcu_par_gp_wq_init(void)
+{
+	struct workqueue_struct *wq;
+
+	if (rcu_num_nodes <= 1)
+		return 0;
+	wq = alloc_workqueue("rcu_par_gp", WQ_MEM_RECLAIM, 0);
+	WARN_ON_ONCE(!wq);
+	WRITE_ONCE(rcu_par_gp_wq, wq);
+	return 0;
+}
+core_initcall(rcu_par_gp_wq_init);
+
 /*
  * This function is invoked towards the end of the scheduler's initialization
  * process.  Before this is called, the idle task might contain
@@ -28,6 +28,7 @@
 #include <linux/cpumask.h>
 #include <linux/seqlock.h>
 #include <linux/stop_machine.h>
+#include <linux/workqueue.h>
 
 /*
  * Define shape of hierarchy based on NR_CPUS, CONFIG_RCU_FANOUT, and
@@ -249,6 +250,16 @@ struct rcu_node {
 	raw_spinlock_t fqslock ____cacheline_internodealigned_in_smp;
 
 	struct mutex exp_funnel_mutex ____cacheline_internodealigned_in_smp;
+
+	struct rcu_exp_work {
+		smp_call_func_t rew_func;
+		struct rcu_state *rew_rsp;
+		struct work_struct rew_work;
+	} rew;
+				/* Selects this leaf's CPUs for an */
+				/*  expedited GP, in parallel with the */
+				/*  other leaves. */
+	bool exp_need_flush;	/* Need to flush rew_work? */
 } ____cacheline_internodealigned_in_smp;
 
 /*
@@ -350,6 +361,8 @@ struct rcu_data {
 					/* qlen at last check for QS forcing */
 	unsigned long	n_cbs_invoked;	/* count of RCU cbs invoked. */
 	unsigned long	n_nocbs_invoked; /* count of no-CBs RCU cbs invoked. */
+	unsigned long	n_kfree_bulk;	/* kfree_bulk() calls for kfree_rcu() */
+	unsigned long	n_kfree_bulk_objs; /*  and objects freed by them. */
 	unsigned long   n_cbs_orphaned; /* RCU cbs orphaned by dying CPU */
 	unsigned long   n_cbs_adopted;  /* RCU cbs adopted from dying CPU */
 	unsigned long	n_force_qs_snap;
@@ -396,6 +409,11 @@ struct rcu_data {
 	wait_queue_head_t nocb_wq;	/* For nocb kthreads to sleep on. */
 	struct task_struct *nocb_kthread;
 	int nocb_defer_wakeup;		/* Defer wakeup of nocb_kthread. */
+	bool nocb_lazy;			/* Only lazy CBs queued, not woken. */
+	struct timer_list nocb_lazy_timer; /* Wakes for the lazy CBs. */
+	unsigned long n_nocb_wake;	/* Wakeups for new CBs. */
+	unsigned long n_nocb_lazy_timer; /* Lazy CBs woken for by timer, */
+	unsigned long n_nocb_lazy_flush; /*  and early. */
 
 	/* The following fields are used by the leader, hence own cacheline. */
 	struct rcu_head *nocb_gp_head ____cacheline_internodealigned_in_smp;
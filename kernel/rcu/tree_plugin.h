@@ -1856,6 +1856,18 @@ bool rcu_is_nocb_cpu(int cpu)
 }
 #endif /* #ifndef CONFIG_RCU_NOCB_CPU_ALL */
 
+/*
+ * Lazy callbacks, that is kfree_rcu(), don't wake up the rcuo kthreads
+ * right away: they wait up to rcu_nocb_lazy_delay milliseconds for more
+ * callbacks to batch them with, unless more than rcu_nocb_lazy_qhimark
+ * of them pile up, a non-lazy callback needs the kthread anyway, or
+ * memory gets short.  Zero rcu_nocb_lazy_delay disables this.
+ */
+static int rcu_nocb_lazy_delay = 100;
+module_param(rcu_nocb_lazy_delay, int, 0644);
+static long rcu_nocb_lazy_qhimark = 1000;
+module_param(rcu_nocb_lazy_qhimark, long, 0644);
+
 /*
  * Kick the leader kthread for this NOCB group.
  */
@@ -1872,6 +1884,88 @@ static void wake_nocb_leader(struct rcu_data *rdp, bool force)
 	}
 }
 
+/*
+ * Wake up the leader kthread for new callbacks on this CPU, or leave it
+ * to do_nocb_deferred_wakeup() if that can't be done from here.  Return
+ * false in the latter case.
+ */
+static bool wake_nocb_leader_or_defer(struct rcu_data *rdp,
+				      unsigned long flags, int waketype)
+{
+	if (irqs_disabled_flags(flags)) {
+		rdp->nocb_defer_wakeup = waketype;
+		return false;
+	}
+
+	wake_nocb_leader(rdp, waketype == RCU_NOGP_WAKE_FORCE);
+	rdp->n_nocb_wake++;
+	return true;
+}
+
+/* The lazy callbacks have waited long enough. */
+static void do_nocb_lazy_wakeup(unsigned long data)
+{
+	struct rcu_data *rdp = (struct rcu_data *)data;
+
+	if (!READ_ONCE(rdp->nocb_lazy))
+		return;
+
+	WRITE_ONCE(rdp->nocb_lazy, false);
+	rdp->n_nocb_lazy_timer++;
+	wake_nocb_leader(rdp, false);
+	trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu, TPS("WakeLazyTimer"));
+}
+
+/* Memory is short: don't let the lazy callbacks sit on freeable memory. */
+static unsigned long rcu_nocb_lazy_count(struct shrinker *shrink,
+					 struct shrink_control *sc)
+{
+	struct rcu_state *rsp;
+	unsigned long count = 0;
+	int cpu;
+
+	for_each_rcu_flavor(rsp) {
+		for_each_cpu(cpu, rcu_nocb_mask) {
+			struct rcu_data *rdp = per_cpu_ptr(rsp->rda, cpu);
+
+			if (READ_ONCE(rdp->nocb_lazy))
+				count += atomic_long_read(&rdp->nocb_q_count_lazy);
+		}
+	}
+	return count;
+}
+
+static unsigned long rcu_nocb_lazy_scan(struct shrinker *shrink,
+					struct shrink_control *sc)
+{
+	struct rcu_state *rsp;
+	unsigned long count = 0;
+	int cpu;
+
+	for_each_rcu_flavor(rsp) {
+		for_each_cpu(cpu, rcu_nocb_mask) {
+			struct rcu_data *rdp = per_cpu_ptr(rsp->rda, cpu);
+
+			if (!READ_ONCE(rdp->nocb_lazy))
+				continue;
+			WRITE_ONCE(rdp->nocb_lazy, false);
+			rdp->n_nocb_lazy_flush++;
+			count += atomic_long_read(&rdp->nocb_q_count_lazy);
+			wake_nocb_leader(rdp, false);
+			trace_rcu_nocb_wake(rsp->name, cpu, TPS("WakeLazyShrink"));
+		}
+	}
+
+	/* the memory comes back only after a grace period */
+	return count ? : SHRINK_STOP;
+}
+
+static struct shrinker rcu_nocb_lazy_shrinker = {
+	.count_objects = rcu_nocb_lazy_count,
+	.scan_objects = rcu_nocb_lazy_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+
 /*
  * Does the specified CPU need an RCU callback for the specified flavor
  * of rcu_barrier()?
@@ -1935,6 +2029,7 @@ static void __call_rcu_nocb_enqueue(struct rcu_data *rdp,
 	int len;
 	struct rcu_head **old_rhpp;
 	struct task_struct *t;
+	bool lazy;
 
 	/* Enqueue the callback on the nocb list and update counts. */
 	atomic_long_add(rhcount, &rdp->nocb_q_count);
@@ -1952,29 +2047,45 @@ static void __call_rcu_nocb_enqueue(struct rcu_data *rdp,
 		return;
 	}
 	len = atomic_long_read(&rdp->nocb_q_count);
-	if (old_rhpp == &rdp->nocb_head) {
-		if (!irqs_disabled_flags(flags)) {
-			/* ... if queue was empty ... */
-			wake_nocb_leader(rdp, false);
+	lazy = rhcount == rhcount_lazy && READ_ONCE(rcu_nocb_lazy_delay) > 0;
+	if (old_rhpp == &rdp->nocb_head && lazy) {
+		/* ... not yet if the queue was empty and is lazy, ... */
+		WRITE_ONCE(rdp->nocb_lazy, true);
+		if (!timer_pending(&rdp->nocb_lazy_timer))
+			mod_timer(&rdp->nocb_lazy_timer, jiffies +
+				  msecs_to_jiffies(rcu_nocb_lazy_delay));
+		trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu,
+				    TPS("WakeLazy"));
+		rdp->qlen_last_fqs_check = 0;
+	} else if (old_rhpp == &rdp->nocb_head) {
+		/* ... if queue was empty ... */
+		WRITE_ONCE(rdp->nocb_lazy, false);
+		if (wake_nocb_leader_or_defer(rdp, flags, RCU_NOGP_WAKE))
 			trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu,
 					    TPS("WakeEmpty"));
-		} else {
-			rdp->nocb_defer_wakeup = RCU_NOGP_WAKE;
+		else
 			trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu,
 					    TPS("WakeEmptyIsDeferred"));
-		}
 		rdp->qlen_last_fqs_check = 0;
+	} else if (READ_ONCE(rdp->nocb_lazy) &&
+		   (!lazy || len > rcu_nocb_lazy_qhimark)) {
+		/* ... or if it was lazy, and can't or needn't wait, ... */
+		WRITE_ONCE(rdp->nocb_lazy, false);
+		rdp->n_nocb_lazy_flush++;
+		if (wake_nocb_leader_or_defer(rdp, flags, RCU_NOGP_WAKE))
+			trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu,
+					    TPS("WakeLazyFlush"));
+		else
+			trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu,
+					    TPS("WakeLazyFlushIsDeferred"));
 	} else if (len > rdp->qlen_last_fqs_check + qhimark) {
 		/* ... or if many callbacks queued. */
-		if (!irqs_disabled_flags(flags)) {
-			wake_nocb_leader(rdp, true);
+		if (wake_nocb_leader_or_defer(rdp, flags, RCU_NOGP_WAKE_FORCE))
 			trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu,
 					    TPS("WakeOvf"));
-		} else {
-			rdp->nocb_defer_wakeup = RCU_NOGP_WAKE_FORCE;
+		else
 			trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu,
 					    TPS("WakeOvfIsDeferred"));
-		}
 		rdp->qlen_last_fqs_check = LONG_MAX / 2;
 	} else {
 		trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu, TPS("WakeNot"));
@@ -2237,6 +2348,7 @@ static int rcu_nocb_kthread(void *arg)
 	struct rcu_head *next;
 	struct rcu_head **tail;
 	struct rcu_data *rdp = arg;
+	struct rcu_kfree_batch kb = { 0 };
 
 	/* Each pass through this loop invokes one batch of callbacks */
 	for (;;) {
@@ -2271,12 +2383,15 @@ static int rcu_nocb_kthread(void *arg)
 			}
 			debug_rcu_head_unqueue(list);
 			local_bh_disable();
-			if (__rcu_reclaim(rdp->rsp->name, list))
+			if (__rcu_reclaim_batch(rdp->rsp->name, list, &kb))
 				cl++;
 			c++;
 			local_bh_enable();
 			list = next;
 		}
+		rcu_kfree_batch_flush(&kb);
+		rdp->n_kfree_bulk = kb.nr_bulk;
+		rdp->n_kfree_bulk_objs = kb.nr_objs;
 		trace_rcu_batch_end(rdp->rsp->name, c, !!list, 0, 0, 1);
 		smp_mb__before_atomic();  /* _add after CB invocation. */
 		atomic_long_add(-c, &rdp->nocb_q_count);
@@ -2319,6 +2434,8 @@ void __init rcu_init_nohz(void)
 	if (tick_nohz_full_running && cpumask_weight(tick_nohz_full_mask))
 		need_rcu_nocb_mask = true;
 #endif /* #if defined(CONFIG_NO_HZ_FULL) */
+	if (!cpumask_equal(housekeeping_cpumask(HK_FLAG_RCU), cpu_possible_mask))
+		need_rcu_nocb_mask = true;
 
 	if (!have_rcu_nocb_mask && need_rcu_nocb_mask) {
 		if (!zalloc_cpumask_var(&rcu_nocb_mask, GFP_KERNEL)) {
@@ -2342,6 +2459,10 @@ void __init rcu_init_nohz(void)
 	if (tick_nohz_full_running)
 		cpumask_or(rcu_nocb_mask, rcu_nocb_mask, tick_nohz_full_mask);
 #endif /* #if defined(CONFIG_NO_HZ_FULL) */
+	/* isolcpus=rcu: callbacks are invoked by the rcuo kthreads */
+	for_each_possible_cpu(cpu)
+		if (!housekeeping_test_cpu(cpu, HK_FLAG_RCU))
+			cpumask_set_cpu(cpu, rcu_nocb_mask);
 
 	if (!cpumask_subset(rcu_nocb_mask, cpu_possible_mask)) {
 		pr_info("\tNote: kernel parameter 'rcu_nocbs=' contains nonexistent CPUs.\n");
@@ -2366,6 +2487,8 @@ static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
 	rdp->nocb_tail = &rdp->nocb_head;
 	init_waitqueue_head(&rdp->nocb_wq);
 	rdp->nocb_follower_tail = &rdp->nocb_follower_head;
+	__setup_timer(&rdp->nocb_lazy_timer, do_nocb_lazy_wakeup,
+		      (unsigned long)rdp, TIMER_DEFERRABLE);
 }
 
 /*
@@ -2441,6 +2564,8 @@ static void __init rcu_spawn_nocb_kthreads(void)
 
 	for_each_online_cpu(cpu)
 		rcu_spawn_all_nocb_kthreads(cpu);
+	if (have_rcu_nocb_mask && register_shrinker(&rcu_nocb_lazy_shrinker))
+		pr_err("RCU: lazy callbacks shrinker registration failed\n");
 }
 
 /* How many follower CPU IDs per leader?  Default of -1 for sqrt(nr_cpu_ids). */
@@ -3034,7 +3159,7 @@ static void rcu_bind_gp_kthread(void)
 	if (cpu >= 0 && cpu < nr_cpu_ids)
 		set_cpus_allowed_ptr(current, cpumask_of(cpu));
 #else /* #ifdef CONFIG_NO_HZ_FULL_SYSIDLE */
-	housekeeping_affine(current);
+	housekeeping_affine(current, HK_FLAG_RCU);
 #endif /* #else #ifdef CONFIG_NO_HZ_FULL_SYSIDLE */
 }
 
@@ -352,6 +352,55 @@ static const struct file_operations rcugp_fops = {
 	.release = single_release,
 };
 
+/*
+ * Callback batching: kfree_bulk() of kfree_rcu() objects, and the
+ * wakeups of the rcuo kthreads, lazy (lz) or not.
+ */
+static void print_one_rcu_batch(struct seq_file *m, struct rcu_data *rdp)
+{
+	if (!rdp->beenonline)
+		return;
+	seq_printf(m, "%3d%ckb=%lu/%lu",
+		   rdp->cpu,
+		   cpu_is_offline(rdp->cpu) ? '!' : ' ',
+		   rdp->n_kfree_bulk, rdp->n_kfree_bulk_objs);
+#ifdef CONFIG_RCU_NOCB_CPU
+	if (rcu_is_nocb_cpu(rdp->cpu))
+		seq_printf(m, " nw=%lu lz=%c lzt=%lu lzf=%lu",
+			   rdp->n_nocb_wake,
+			   ".L"[READ_ONCE(rdp->nocb_lazy)],
+			   rdp->n_nocb_lazy_timer,
+			   rdp->n_nocb_lazy_flush);
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+	seq_puts(m, "\n");
+}
+
+static int show_rcu_batch(struct seq_file *m, void *v)
+{
+	print_one_rcu_batch(m, (struct rcu_data *)v);
+	return 0;
+}
+
+static const struct seq_operations rcu_batch_op = {
+	.start = r_start,
+	.next  = r_next,
+	.stop  = r_stop,
+	.show  = show_rcu_batch,
+};
+
+static int rcu_batch_open(struct inode *inode, struct file *file)
+{
+	return r_open(inode, file, &rcu_batch_op);
+}
+
+static const struct file_operations rcu_batch_fops = {
+	.owner = THIS_MODULE,
+	.open = rcu_batch_open,
+	.read = seq_read,
+	.llseek = no_llseek,
+	.release = seq_release,
+};
+
 static void print_one_rcu_pending(struct seq_file *m, struct rcu_data *rdp)
 {
 	if (!rdp->beenonline)
@@ -458,6 +507,11 @@ static int __init rcutree_trace_init(void)
 		if (!retval)
 			goto free_out;
 
+		retval = debugfs_create_file("rcubatch", 0444,
+				rspdir, rsp, &rcu_batch_fops);
+		if (!retval)
+			goto free_out;
+
 #ifdef CONFIG_RCU_BOOST
 		if (rsp == &rcu_preempt_state) {
 			retval = debugfs_create_file("rcuboost", 0444,
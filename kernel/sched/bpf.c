@@ -0,0 +1,508 @@
+/*
+ * BPF-programmable Scheduling Class (mapped to the SCHED_BPF policy)
+ *
+ * SCHED_BPF tasks run when there is nothing to run in the fair class.
+ * Which cpu a task wakes up on and the order the tasks of a cpu run in
+ * are decided by one BPF_PROG_TYPE_SCHED program, attached with the
+ * BPF_PROG_ATTACH command of bpf(2):
+ *
+ *  - BPF_SCHED_SELECT_CPU returns the cpu a waking task is queued on;
+ *  - BPF_SCHED_ENQUEUE returns the dispatch key of a task being queued,
+ *    the per cpu queue runs the lowest key first, FIFO among equal ones,
+ *    and may set the time slice of the task;
+ *  - BPF_SCHED_DEQUEUE tells the program a task left the queue.
+ *
+ * A program returning garbage, being detached or starving a queued task
+ * for SCHED_BPF_WATCHDOG_TICKS moves every SCHED_BPF task back to
+ * SCHED_NORMAL. Until that is done the class runs the tasks as plain FIFO.
+ */
+
+#include "sched.h"
+
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/irq_work.h>
+
+/* default time slice, the program can hand out another one per enqueue */
+#define BPF_TIMESLICE			(20 * HZ / 1000)
+
+/* ticks of SCHED_BPF execution a queued task may be passed over for */
+#define SCHED_BPF_WATCHDOG_TICKS	(30 * HZ)
+
+static struct bpf_prog __rcu *sched_bpf_prog;
+static DEFINE_MUTEX(sched_bpf_mutex);
+
+/* set from the first error until the tasks are back on CFS */
+static atomic_t sched_bpf_failing = ATOMIC_INIT(0);
+
+static struct irq_work sched_bpf_irq_work;
+static void sched_bpf_disable_workfn(struct work_struct *work);
+static DECLARE_WORK(sched_bpf_disable_work, sched_bpf_disable_workfn);
+
+bool sched_bpf_enabled(void)
+{
+	return rcu_access_pointer(sched_bpf_prog) &&
+		!atomic_read(&sched_bpf_failing);
+}
+
+/*
+ * Called with rq->lock or p->pi_lock held: neither printk() nor
+ * schedule_work() are safe here, hence the detour through irq_work.
+ */
+static void sched_bpf_error(const char *reason)
+{
+	if (atomic_xchg(&sched_bpf_failing, 1))
+		return;
+
+	printk_deferred(KERN_WARNING
+		"sched_bpf: %s, moving SCHED_BPF tasks to SCHED_NORMAL\n",
+		reason);
+	irq_work_queue(&sched_bpf_irq_work);
+}
+
+static void sched_bpf_irq_workfn(struct irq_work *work)
+{
+	schedule_work(&sched_bpf_disable_work);
+}
+
+/*
+ * Run the program for @op on @p. Returns false when there is no program to
+ * run, which the callers take as a request for FIFO.
+ */
+static bool sched_bpf_run(u32 op, struct task_struct *p, u32 flags,
+			  struct bpf_sched_ctx *ctx, int *ret)
+{
+	struct bpf_prog *prog;
+	bool ran = false;
+
+	ctx->op = op;
+	ctx->pid = task_pid_nr(p);
+	ctx->tgid = task_tgid_nr(p);
+	ctx->nice = task_nice(p);
+	ctx->prev_cpu = task_cpu(p);
+	ctx->this_cpu = smp_processor_id();
+	ctx->flags = flags;
+	ctx->slice_us = 0;
+
+	rcu_read_lock();
+	prog = rcu_dereference(sched_bpf_prog);
+	if (prog && !atomic_read(&sched_bpf_failing)) {
+		*ret = BPF_PROG_RUN(prog, (void *)ctx);
+		ran = true;
+	}
+	rcu_read_unlock();
+
+	return ran;
+}
+
+void init_bpf_rq(struct bpf_rq *bpf_rq)
+{
+	bpf_rq->queue = RB_ROOT;
+	bpf_rq->leftmost = NULL;
+	INIT_LIST_HEAD(&bpf_rq->fifo);
+	bpf_rq->nr_running = 0;
+	bpf_rq->seq = 0;
+	bpf_rq->ticks = 0;
+}
+
+static inline struct task_struct *bpf_task_of(struct sched_bpf_entity *bse)
+{
+	return container_of(bse, struct task_struct, bpf);
+}
+
+static inline bool bpf_entity_before(struct sched_bpf_entity *a,
+				     struct sched_bpf_entity *b)
+{
+	if (a->key != b->key)
+		return a->key < b->key;
+	return a->seq < b->seq;
+}
+
+static void __enqueue_bpf_entity(struct bpf_rq *bpf_rq,
+				 struct sched_bpf_entity *bse)
+{
+	struct rb_node **link = &bpf_rq->queue.rb_node;
+	struct rb_node *parent = NULL;
+	struct sched_bpf_entity *entry;
+	int leftmost = 1;
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct sched_bpf_entity, node);
+		if (bpf_entity_before(bse, entry)) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = 0;
+		}
+	}
+
+	if (leftmost)
+		bpf_rq->leftmost = &bse->node;
+
+	rb_link_node(&bse->node, parent, link);
+	rb_insert_color(&bse->node, &bpf_rq->queue);
+	list_add_tail(&bse->fifo_node, &bpf_rq->fifo);
+}
+
+static void __dequeue_bpf_entity(struct bpf_rq *bpf_rq,
+				 struct sched_bpf_entity *bse)
+{
+	if (bpf_rq->leftmost == &bse->node)
+		bpf_rq->leftmost = rb_next(&bse->node);
+
+	rb_erase(&bse->node, &bpf_rq->queue);
+	RB_CLEAR_NODE(&bse->node);
+	list_del_init(&bse->fifo_node);
+}
+
+/* ask the program where @p goes in the queue and put it there */
+static void queue_task_bpf(struct rq *rq, struct task_struct *p, u32 flags)
+{
+	struct bpf_rq *bpf_rq = &rq->bpf;
+	struct sched_bpf_entity *bse = &p->bpf;
+	struct bpf_sched_ctx ctx;
+	int ret;
+
+	bse->key = 0;
+	bse->slice = BPF_TIMESLICE;
+
+	if (sched_bpf_run(BPF_SCHED_ENQUEUE, p, flags, &ctx, &ret)) {
+		if (ret < 0) {
+			sched_bpf_error("enqueue failed");
+		} else {
+			bse->key = ret;
+			if (ctx.slice_us)
+				bse->slice = max(usecs_to_jiffies(ctx.slice_us),
+						 1UL);
+		}
+	}
+
+	bse->time_slice = bse->slice;
+	bse->seq = bpf_rq->seq++;
+	bse->queued_ticks = bpf_rq->ticks;
+	__enqueue_bpf_entity(bpf_rq, bse);
+}
+
+static void update_curr_bpf(struct rq *rq)
+{
+	struct task_struct *curr = rq->curr;
+	u64 delta_exec;
+
+	if (curr->sched_class != &bpf_sched_class)
+		return;
+
+	delta_exec = rq_clock_task(rq) - curr->se.exec_start;
+	if (unlikely((s64)delta_exec <= 0))
+		return;
+
+	schedstat_set(curr->se.statistics.exec_max,
+		      max(curr->se.statistics.exec_max, delta_exec));
+
+	curr->se.sum_exec_runtime += delta_exec;
+	account_group_exec_runtime(curr, delta_exec);
+
+	curr->se.exec_start = rq_clock_task(rq);
+	cpuacct_charge(curr, delta_exec);
+}
+
+static void enqueue_task_bpf(struct rq *rq, struct task_struct *p, int flags)
+{
+	p->bpf.on_rq = 1;
+	queue_task_bpf(rq, p, flags & ENQUEUE_WAKEUP ? BPF_SCHED_ENQ_WAKEUP : 0);
+
+	rq->bpf.nr_running++;
+	add_nr_running(rq, 1);
+}
+
+static void dequeue_task_bpf(struct rq *rq, struct task_struct *p, int flags)
+{
+	struct sched_bpf_entity *bse = &p->bpf;
+	struct bpf_sched_ctx ctx;
+	int ret;
+
+	update_curr_bpf(rq);
+
+	/* the running task is not in the queue, see set_curr_task_bpf() */
+	if (!RB_EMPTY_NODE(&bse->node))
+		__dequeue_bpf_entity(&rq->bpf, bse);
+	bse->on_rq = 0;
+
+	rq->bpf.nr_running--;
+	sub_nr_running(rq, 1);
+
+	sched_bpf_run(BPF_SCHED_DEQUEUE, p, 0, &ctx, &ret);
+}
+
+/*
+ * put_prev_task_bpf() queues the task again, behind the tasks of the same
+ * key: there is nothing to do here.
+ */
+static void yield_task_bpf(struct rq *rq)
+{
+}
+
+static void check_preempt_curr_bpf(struct rq *rq, struct task_struct *p,
+				   int flags)
+{
+	if (p->bpf.key < rq->curr->bpf.key)
+		resched_curr(rq);
+}
+
+static struct task_struct *
+pick_next_task_bpf(struct rq *rq, struct task_struct *prev)
+{
+	struct bpf_rq *bpf_rq = &rq->bpf;
+	struct sched_bpf_entity *bse;
+	struct task_struct *p;
+
+	if (!bpf_rq->nr_running)
+		return NULL;
+
+	/* a runnable SCHED_BPF prev goes back to the queue like the others */
+	put_prev_task(rq, prev);
+
+	bse = rb_entry(bpf_rq->leftmost, struct sched_bpf_entity, node);
+	__dequeue_bpf_entity(bpf_rq, bse);
+
+	p = bpf_task_of(bse);
+	p->se.exec_start = rq_clock_task(rq);
+
+	return p;
+}
+
+static void put_prev_task_bpf(struct rq *rq, struct task_struct *p)
+{
+	update_curr_bpf(rq);
+
+	if (p->bpf.on_rq)
+		queue_task_bpf(rq, p, BPF_SCHED_ENQ_REQUEUE);
+}
+
+#ifdef CONFIG_SMP
+static int
+select_task_rq_bpf(struct task_struct *p, int cpu, int sd_flag, int flags)
+{
+	struct bpf_sched_ctx ctx;
+	int ret;
+
+	if (!sched_bpf_run(BPF_SCHED_SELECT_CPU, p, flags, &ctx, &ret))
+		return cpu;
+
+	if (ret < 0 || ret >= nr_cpu_ids ||
+	    !cpumask_test_cpu(ret, tsk_cpus_allowed(p))) {
+		sched_bpf_error("select_cpu returned an invalid cpu");
+		return cpu;
+	}
+
+	return ret;
+}
+#endif
+
+static void set_curr_task_bpf(struct rq *rq)
+{
+	struct task_struct *p = rq->curr;
+
+	p->se.exec_start = rq_clock_task(rq);
+
+	if (!RB_EMPTY_NODE(&p->bpf.node))
+		__dequeue_bpf_entity(&rq->bpf, &p->bpf);
+}
+
+static void task_tick_bpf(struct rq *rq, struct task_struct *p, int queued)
+{
+	struct bpf_rq *bpf_rq = &rq->bpf;
+	struct sched_bpf_entity *oldest;
+
+	update_curr_bpf(rq);
+
+	/*
+	 * Only count the ticks SCHED_BPF actually ran for: being starved by
+	 * the classes above is what a SCHED_BPF task signed up for, being
+	 * starved by the program is not.
+	 */
+	bpf_rq->ticks++;
+	oldest = list_first_entry_or_null(&bpf_rq->fifo,
+					  struct sched_bpf_entity, fifo_node);
+	if (oldest && bpf_rq->ticks - oldest->queued_ticks >
+		      SCHED_BPF_WATCHDOG_TICKS)
+		sched_bpf_error("a queued task starved");
+
+	if (--p->bpf.time_slice)
+		return;
+
+	p->bpf.time_slice = p->bpf.slice;
+
+	/* let the program pick again, unless there is nothing to pick from */
+	if (bpf_rq->leftmost)
+		resched_curr(rq);
+}
+
+static void switched_to_bpf(struct rq *rq, struct task_struct *p)
+{
+	if (task_on_rq_queued(p) && rq->curr != p)
+		check_preempt_curr(rq, p, 0);
+}
+
+/* the program sees the new nice level on the next enqueue */
+static void
+prio_changed_bpf(struct rq *rq, struct task_struct *p, int oldprio)
+{
+}
+
+static unsigned int get_rr_interval_bpf(struct rq *rq, struct task_struct *p)
+{
+	return p->bpf.slice ? : BPF_TIMESLICE;
+}
+
+const struct sched_class bpf_sched_class = {
+	.next			= &idle_sched_class,
+	.enqueue_task		= enqueue_task_bpf,
+	.dequeue_task		= dequeue_task_bpf,
+	.yield_task		= yield_task_bpf,
+
+	.check_preempt_curr	= check_preempt_curr_bpf,
+
+	.pick_next_task		= pick_next_task_bpf,
+	.put_prev_task		= put_prev_task_bpf,
+
+#ifdef CONFIG_SMP
+	.select_task_rq		= select_task_rq_bpf,
+	.set_cpus_allowed	= set_cpus_allowed_common,
+#endif
+
+	.set_curr_task		= set_curr_task_bpf,
+	.task_tick		= task_tick_bpf,
+
+	.get_rr_interval	= get_rr_interval_bpf,
+
+	.prio_changed		= prio_changed_bpf,
+	.switched_to		= switched_to_bpf,
+
+	.update_curr		= update_curr_bpf,
+};
+
+/*
+ * Drop the program and move the SCHED_BPF tasks to SCHED_NORMAL, the way
+ * normalize_rt_tasks() does for sysrq-n.
+ */
+static void __sched_bpf_detach(void)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	struct task_struct *g, *p;
+	struct bpf_prog *prog;
+
+	lockdep_assert_held(&sched_bpf_mutex);
+
+	atomic_set(&sched_bpf_failing, 1);
+	prog = rcu_dereference_protected(sched_bpf_prog,
+					 lockdep_is_held(&sched_bpf_mutex));
+	RCU_INIT_POINTER(sched_bpf_prog, NULL);
+
+	read_lock(&tasklist_lock);
+	for_each_process_thread(g, p) {
+		if (p->policy == SCHED_BPF)
+			sched_setscheduler_nocheck(p, SCHED_NORMAL, &param);
+	}
+	read_unlock(&tasklist_lock);
+
+	if (prog)
+		bpf_prog_put_rcu(prog);
+	atomic_set(&sched_bpf_failing, 0);
+}
+
+static void sched_bpf_disable_workfn(struct work_struct *work)
+{
+	mutex_lock(&sched_bpf_mutex);
+	__sched_bpf_detach();
+	mutex_unlock(&sched_bpf_mutex);
+}
+
+int sched_bpf_attach(struct bpf_prog *prog)
+{
+	int ret = 0;
+
+	/* a fallback in flight must not take the new program down with it */
+	irq_work_sync(&sched_bpf_irq_work);
+	flush_work(&sched_bpf_disable_work);
+
+	mutex_lock(&sched_bpf_mutex);
+	if (rcu_access_pointer(sched_bpf_prog) ||
+	    atomic_read(&sched_bpf_failing))
+		ret = -EBUSY;
+	else
+		rcu_assign_pointer(sched_bpf_prog, prog);
+	mutex_unlock(&sched_bpf_mutex);
+
+	return ret;
+}
+
+int sched_bpf_detach(void)
+{
+	int ret = 0;
+
+	mutex_lock(&sched_bpf_mutex);
+	if (rcu_access_pointer(sched_bpf_prog))
+		__sched_bpf_detach();
+	else
+		ret = -ENOENT;
+	mutex_unlock(&sched_bpf_mutex);
+
+	return ret;
+}
+
+static const struct bpf_func_proto *sched_bpf_func_proto(enum bpf_func_id func_id)
+{
+	switch (func_id) {
+	case BPF_FUNC_map_lookup_elem:
+		return &bpf_map_lookup_elem_proto;
+	case BPF_FUNC_map_update_elem:
+		return &bpf_map_update_elem_proto;
+	case BPF_FUNC_map_delete_elem:
+		return &bpf_map_delete_elem_proto;
+	case BPF_FUNC_ktime_get_ns:
+		return &bpf_ktime_get_ns_proto;
+	case BPF_FUNC_get_prandom_u32:
+		return &bpf_get_prandom_u32_proto;
+	case BPF_FUNC_get_smp_processor_id:
+		return &bpf_get_smp_processor_id_proto;
+	case BPF_FUNC_tail_call:
+		return &bpf_tail_call_proto;
+	default:
+		return NULL;
+	}
+}
+
+/* bpf+sched programs read 'struct bpf_sched_ctx' and may set slice_us */
+static bool sched_bpf_is_valid_access(int off, int size,
+				      enum bpf_access_type type)
+{
+	if (off < 0 || off >= sizeof(struct bpf_sched_ctx))
+		return false;
+
+	if (size != sizeof(__u32) || off % size != 0)
+		return false;
+
+	if (type == BPF_WRITE)
+		return off == offsetof(struct bpf_sched_ctx, slice_us);
+
+	return true;
+}
+
+static const struct bpf_verifier_ops sched_bpf_ops = {
+	.get_func_proto  = sched_bpf_func_proto,
+	.is_valid_access = sched_bpf_is_valid_access,
+};
+
+static struct bpf_prog_type_list sched_bpf_tl = {
+	.ops	= &sched_bpf_ops,
+	.type	= BPF_PROG_TYPE_SCHED,
+};
+
+static int __init register_sched_bpf_prog_ops(void)
+{
+	init_irq_work(&sched_bpf_irq_work, sched_bpf_irq_workfn);
+	bpf_register_prog_type(&sched_bpf_tl);
+	return 0;
+}
+late_initcall(register_sched_bpf_prog_ops);
@@ -621,21 +621,21 @@ int get_nohz_timer_target(void)
 	int i, cpu = smp_processor_id();
 	struct sched_domain *sd;
 
-	if (!idle_cpu(cpu) && is_housekeeping_cpu(cpu))
+	if (!idle_cpu(cpu) && housekeeping_test_cpu(cpu, HK_FLAG_TIMER))
 		return cpu;
 
 	rcu_read_lock();
 	for_each_domain(cpu, sd) {
 		for_each_cpu(i, sched_domain_span(sd)) {
-			if (!idle_cpu(i) && is_housekeeping_cpu(cpu)) {
+			if (!idle_cpu(i) && housekeeping_test_cpu(i, HK_FLAG_TIMER)) {
 				cpu = i;
 				goto unlock;
 			}
 		}
 	}
 
-	if (!is_housekeeping_cpu(cpu))
-		cpu = housekeeping_any_cpu();
+	if (!housekeeping_test_cpu(cpu, HK_FLAG_TIMER))
+		cpu = housekeeping_any_cpu(HK_FLAG_TIMER);
 unlock:
 	rcu_read_unlock();
 	return cpu;
@@ -827,11 +827,304 @@ static void set_load_weight(struct task_struct *p)
 	load->inv_weight = prio_to_wmult[prio];
 }
 
+#ifdef CONFIG_UCLAMP_TASK
+/*
+ * Utilization clamping.
+ *
+ * Each rq counts, per clamp, its runnable FAIR and RT tasks whose clamp
+ * falls in each of UCLAMP_BUCKETS ranges of values, along with the
+ * largest clamp seen in the bucket since it was last empty.  The clamp of
+ * the rq then follows enqueues and dequeues in constant time: only taking
+ * the last task out of the top bucket needs a scan of the buckets.
+ */
+#define UCLAMP_BUCKET_DELTA	\
+	DIV_ROUND_CLOSEST(SCHED_CAPACITY_SCALE, UCLAMP_BUCKETS)
+
+static inline unsigned int uclamp_bucket_id(unsigned int clamp_value)
+{
+	return min_t(unsigned int, clamp_value / UCLAMP_BUCKET_DELTA,
+		     UCLAMP_BUCKETS - 1);
+}
+
+static inline unsigned int uclamp_none(enum uclamp_id clamp_id)
+{
+	return clamp_id == UCLAMP_MIN ? 0 : SCHED_CAPACITY_SCALE;
+}
+
+static inline void uclamp_se_set(struct uclamp_se *uc_se, unsigned int value)
+{
+	uc_se->value = value;
+	uc_se->bucket_id = uclamp_bucket_id(value);
+}
+
+/* the clamp @p asks for, held within those of its group */
+static struct uclamp_se
+uclamp_eff_get(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct uclamp_se uc_req = p->uclamp_req[clamp_id];
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	struct task_group *tg = task_group(p);
+
+	uclamp_se_set(&uc_req, clamp_t(unsigned int, uc_req.value,
+				       tg->uclamp[UCLAMP_MIN].value,
+				       tg->uclamp[UCLAMP_MAX].value));
+#endif
+	uc_req.active = 0;
+
+	return uc_req;
+}
+
+unsigned int uclamp_eff_value(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct uclamp_se uc_eff;
+
+	/* a runnable task keeps the clamp it was enqueued with */
+	if (p->uclamp[clamp_id].active)
+		return p->uclamp[clamp_id].value;
+
+	uc_eff = uclamp_eff_get(p, clamp_id);
+
+	return uc_eff.value;
+}
+
+static unsigned int uclamp_rq_max_value(struct rq *rq, enum uclamp_id clamp_id)
+{
+	struct uclamp_bucket *bucket = rq->uclamp[clamp_id].bucket;
+	int bucket_id;
+
+	for (bucket_id = UCLAMP_BUCKETS - 1; bucket_id >= 0; bucket_id--) {
+		if (bucket[bucket_id].tasks)
+			return bucket[bucket_id].value;
+	}
+
+	/* nothing runnable asks for anything */
+	return uclamp_none(clamp_id);
+}
+
+static inline void uclamp_rq_inc_id(struct rq *rq, struct task_struct *p,
+				    enum uclamp_id clamp_id)
+{
+	struct uclamp_rq *uc_rq = &rq->uclamp[clamp_id];
+	struct uclamp_se *uc_se = &p->uclamp[clamp_id];
+	struct uclamp_bucket *bucket;
+
+	*uc_se = uclamp_eff_get(p, clamp_id);
+	uc_se->active = 1;
+
+	bucket = &uc_rq->bucket[uc_se->bucket_id];
+	if (++bucket->tasks == 1 || uc_se->value > bucket->value)
+		bucket->value = uc_se->value;
+
+	if (++uc_rq->tasks == 1 || uc_se->value > uc_rq->value)
+		WRITE_ONCE(uc_rq->value, uc_se->value);
+}
+
+static inline void uclamp_rq_dec_id(struct rq *rq, struct task_struct *p,
+				    enum uclamp_id clamp_id)
+{
+	struct uclamp_rq *uc_rq = &rq->uclamp[clamp_id];
+	struct uclamp_se *uc_se = &p->uclamp[clamp_id];
+	struct uclamp_bucket *bucket;
+
+	if (!uc_se->active)
+		return;
+	uc_se->active = 0;
+
+	bucket = &uc_rq->bucket[uc_se->bucket_id];
+	uc_rq->tasks--;
+	if (--bucket->tasks)
+		return;
+
+	if (bucket->value >= uc_rq->value)
+		WRITE_ONCE(uc_rq->value, uclamp_rq_max_value(rq, clamp_id));
+}
+
+static inline void uclamp_rq_inc(struct rq *rq, struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	if (p->sched_class != &fair_sched_class &&
+	    p->sched_class != &rt_sched_class)
+		return;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+		uclamp_rq_inc_id(rq, p, clamp_id);
+}
+
+static inline void uclamp_rq_dec(struct rq *rq, struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+		uclamp_rq_dec_id(rq, p, clamp_id);
+}
+
+/**
+ * sched_cpu_uclamp_pct - the utilization clamps of a cpu
+ * @cpu: the cpu in question
+ * @min_pct: where to store the least performance asked for, in percent
+ * @max_pct: where to store the most performance asked for, in percent
+ *
+ * For cpufreq governors: the load they measure on @cpu, in percent of
+ * its capacity, is to be held within [*min_pct..*max_pct] according to
+ * the tasks currently runnable there.
+ */
+void sched_cpu_uclamp_pct(int cpu, unsigned int *min_pct,
+			  unsigned int *max_pct)
+{
+	struct rq *rq = cpu_rq(cpu);
+
+	*min_pct = DIV_ROUND_UP(READ_ONCE(rq->uclamp[UCLAMP_MIN].value) * 100,
+				SCHED_CAPACITY_SCALE);
+	*max_pct = DIV_ROUND_UP(READ_ONCE(rq->uclamp[UCLAMP_MAX].value) * 100,
+				SCHED_CAPACITY_SCALE);
+}
+EXPORT_SYMBOL_GPL(sched_cpu_uclamp_pct);
+
+static void uclamp_fork(struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+		p->uclamp[clamp_id].active = 0;
+
+	if (likely(!p->sched_reset_on_fork))
+		return;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+		uclamp_se_set(&p->uclamp_req[clamp_id], uclamp_none(clamp_id));
+}
+
+static int uclamp_validate(struct task_struct *p,
+			   const struct sched_attr *attr, bool user)
+{
+	unsigned int lower = p->uclamp_req[UCLAMP_MIN].value;
+	unsigned int upper = p->uclamp_req[UCLAMP_MAX].value;
+
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MIN)
+		lower = attr->sched_util_min == (u32)-1 ?
+			uclamp_none(UCLAMP_MIN) : attr->sched_util_min;
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MAX)
+		upper = attr->sched_util_max == (u32)-1 ?
+			uclamp_none(UCLAMP_MAX) : attr->sched_util_max;
+
+	if (lower > upper || upper > SCHED_CAPACITY_SCALE)
+		return -EINVAL;
+
+	/* a higher floor is paid for by everything else on the cpu */
+	if (user && lower > p->uclamp_req[UCLAMP_MIN].value &&
+	    !capable(CAP_SYS_NICE))
+		return -EPERM;
+
+	return 0;
+}
+
+static void __setscheduler_uclamp(struct task_struct *p,
+				  const struct sched_attr *attr)
+{
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MIN)
+		uclamp_se_set(&p->uclamp_req[UCLAMP_MIN],
+			      attr->sched_util_min == (u32)-1 ?
+			      uclamp_none(UCLAMP_MIN) : attr->sched_util_min);
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MAX)
+		uclamp_se_set(&p->uclamp_req[UCLAMP_MAX],
+			      attr->sched_util_max == (u32)-1 ?
+			      uclamp_none(UCLAMP_MAX) : attr->sched_util_max);
+}
+
+static void __getparam_uclamp(struct task_struct *p, struct sched_attr *attr)
+{
+	attr->sched_util_min = p->uclamp_req[UCLAMP_MIN].value;
+	attr->sched_util_max = p->uclamp_req[UCLAMP_MAX].value;
+}
+
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+static DEFINE_MUTEX(uclamp_mutex);
+
+/*
+ * A group's clamps are those it asks for, but no higher than its
+ * parent's, and its floor no higher than its ceiling.
+ */
+static void uclamp_tg_update_eff(struct task_group *tg,
+				 struct task_group *parent)
+{
+	unsigned int eff[UCLAMP_CNT];
+	enum uclamp_id clamp_id;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++) {
+		eff[clamp_id] = tg->uclamp_req[clamp_id].value;
+		if (parent)
+			eff[clamp_id] = min_t(unsigned int, eff[clamp_id],
+					      parent->uclamp[clamp_id].value);
+	}
+	eff[UCLAMP_MIN] = min(eff[UCLAMP_MIN], eff[UCLAMP_MAX]);
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+		uclamp_se_set(&tg->uclamp[clamp_id], eff[clamp_id]);
+}
+
+static void uclamp_tg_init(struct task_group *tg, struct task_group *parent)
+{
+	enum uclamp_id clamp_id;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+		uclamp_se_set(&tg->uclamp_req[clamp_id], uclamp_none(clamp_id));
+	uclamp_tg_update_eff(tg, parent);
+}
+#else
+static inline void uclamp_tg_init(struct task_group *tg,
+				  struct task_group *parent) { }
+#endif
+
+static void __init init_uclamp(void)
+{
+	enum uclamp_id clamp_id;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		memset(cpu_rq(cpu)->uclamp, 0, sizeof(cpu_rq(cpu)->uclamp));
+		for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+			cpu_rq(cpu)->uclamp[clamp_id].value =
+				uclamp_none(clamp_id);
+	}
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++) {
+		uclamp_se_set(&init_task.uclamp_req[clamp_id],
+			      uclamp_none(clamp_id));
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+		uclamp_se_set(&root_task_group.uclamp_req[clamp_id],
+			      uclamp_none(clamp_id));
+		uclamp_se_set(&root_task_group.uclamp[clamp_id],
+			      uclamp_none(clamp_id));
+#endif
+	}
+}
+#else
+static inline void uclamp_rq_inc(struct rq *rq, struct task_struct *p) { }
+static inline void uclamp_rq_dec(struct rq *rq, struct task_struct *p) { }
+static inline void uclamp_fork(struct task_struct *p) { }
+
+static inline int uclamp_validate(struct task_struct *p,
+				  const struct sched_attr *attr, bool user)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void __setscheduler_uclamp(struct task_struct *p,
+					 const struct sched_attr *attr) { }
+static inline void __getparam_uclamp(struct task_struct *p,
+				     struct sched_attr *attr) { }
+static inline void init_uclamp(void) { }
+static inline void uclamp_tg_init(struct task_group *tg,
+				  struct task_group *parent) { }
+#endif /* CONFIG_UCLAMP_TASK */
+
 static inline void enqueue_task(struct rq *rq, struct task_struct *p, int flags)
 {
 	update_rq_clock(rq);
 	if (!(flags & ENQUEUE_RESTORE))
 		sched_info_queued(rq, p);
+	uclamp_rq_inc(rq, p);
 	p->sched_class->enqueue_task(rq, p, flags);
 }
 
@@ -840,6 +1133,7 @@ static inline void dequeue_task(struct rq *rq, struct task_struct *p, int flags)
 	update_rq_clock(rq);
 	if (!(flags & DEQUEUE_SAVE))
 		sched_info_dequeued(rq, p);
+	uclamp_rq_dec(rq, p);
 	p->sched_class->dequeue_task(rq, p, flags);
 }
 
@@ -2119,6 +2413,11 @@ static void __sched_fork(unsigned long clone_flags, struct task_struct *p)
 
 	INIT_LIST_HEAD(&p->rt.run_list);
 
+#ifdef CONFIG_SCHED_BPF
+	RB_CLEAR_NODE(&p->bpf.node);
+	INIT_LIST_HEAD(&p->bpf.fifo_node);
+#endif
+
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
@@ -2202,6 +2501,8 @@ int sched_fork(unsigned long clone_flags, struct task_struct *p)
 	 */
 	p->prio = current->normal_prio;
 
+	uclamp_fork(p);
+
 	/*
 	 * Revert to default priority/policy on fork if requested.
 	 */
@@ -2213,6 +2514,9 @@ int sched_fork(unsigned long clone_flags, struct task_struct *p)
 		} else if (PRIO_TO_NICE(p->static_prio) < 0)
 			p->static_prio = NICE_TO_PRIO(0);
 
+		if (p->latency_nice < 0)
+			p->latency_nice = 0;
+
 		p->prio = p->normal_prio = __normal_prio(p);
 		set_load_weight(p);
 
@@ -2223,11 +2527,22 @@ int sched_fork(unsigned long clone_flags, struct task_struct *p)
 		p->sched_reset_on_fork = 0;
 	}
 
+	/*
+	 * Once the program is gone SCHED_BPF is on its way out: don't let
+	 * children escape the move of their parents back to CFS.
+	 */
+	if (bpf_policy(p->policy) && !sched_bpf_enabled())
+		p->policy = SCHED_NORMAL;
+
 	if (dl_prio(p->prio)) {
 		put_cpu();
 		return -EAGAIN;
 	} else if (rt_prio(p->prio)) {
 		p->sched_class = &rt_sched_class;
+#ifdef CONFIG_SCHED_BPF
+	} else if (bpf_policy(p->policy)) {
+		p->sched_class = &bpf_sched_class;
+#endif
 	} else {
 		p->sched_class = &fair_sched_class;
 	}
@@ -2854,6 +3169,167 @@ unsigned long long task_sched_runtime(struct task_struct *p)
 	return ns;
 }
 
+#ifdef CONFIG_SCHED_CORE
+/*
+ * Core scheduling.
+ *
+ * The tasks of a cgroup with cpu.tag set, and of the groups below it,
+ * carry the tagged group as their cookie; all other tasks carry 0.  The
+ * SMT siblings of a core only run tasks of the same cookie at any one
+ * time: a cpu that picked a task whose cookie differs from the one a
+ * sibling runs goes idle instead, and waits to be kicked when that
+ * sibling changes what it runs.  The idle and stop tasks go with every
+ * cookie.
+ *
+ * The decision is serialized across the core by taking the core_lock
+ * of every sibling, in cpu order, with the rq lock held.
+ *
+ * So that a waiting sibling is not starved, a cpu that has been running
+ * the same cookie for sysctl_sched_core_slice while a sibling waits for
+ * another one is rescheduled from the tick, and goes idle itself at its
+ * next pick so the waiter gets the core.
+ */
+DEFINE_STATIC_KEY_FALSE(sched_core_key);
+static DEFINE_MUTEX(sched_core_mutex);
+
+unsigned int sysctl_sched_core_slice = 4000000ULL;
+
+static void sched_core_lock(int cpu)
+{
+	int i, nest = 0;
+
+	for_each_cpu(i, cpu_smt_mask(cpu))
+		raw_spin_lock_nested(&cpu_rq(i)->core_lock, nest++);
+}
+
+static void sched_core_unlock(int cpu)
+{
+	int i;
+
+	for_each_cpu(i, cpu_smt_mask(cpu))
+		raw_spin_unlock(&cpu_rq(i)->core_lock);
+}
+
+/* Have the siblings waiting on us look again at what they may run. */
+static void sched_core_kick_waiters(struct rq *rq)
+{
+	int i;
+
+	for_each_cpu(i, cpu_smt_mask(cpu_of(rq))) {
+		struct rq *srq = cpu_rq(i);
+
+		if (srq == rq || !srq->core_waiting)
+			continue;
+		if (set_nr_and_not_polling(srq->idle))
+			smp_send_reschedule(i);
+	}
+}
+
+/*
+ * @next was picked to run on @rq: commit to it if it goes with what the
+ * siblings run, else put it back and run the idle task instead.
+ */
+static struct task_struct *
+sched_core_pick(struct rq *rq, struct task_struct *next)
+{
+	int i, cpu = cpu_of(rq);
+	bool was_running = rq->core_running;
+	unsigned long was_cookie = rq->core_cookie;
+	unsigned long cookie;
+	u64 now = rq_clock(rq);
+
+	sched_core_lock(cpu);
+
+	if (next == rq->idle || next == rq->stop) {
+		rq->core_running = false;
+		rq->core_waiting = false;
+		goto done;
+	}
+
+	cookie = READ_ONCE(next->core_cookie);
+	for_each_cpu(i, cpu_smt_mask(cpu)) {
+		struct rq *srq = cpu_rq(i);
+
+		if (srq == rq)
+			continue;
+		if (srq->core_running && srq->core_cookie != cookie)
+			goto force_idle;
+		/* give way to a sibling waiting for long enough */
+		if (srq->core_waiting && srq->core_wait_cookie != cookie &&
+		    was_running && was_cookie == cookie &&
+		    now - rq->core_since >= sysctl_sched_core_slice)
+			goto force_idle;
+	}
+
+	if (!was_running || was_cookie != cookie) {
+		rq->core_cookie = cookie;
+		rq->core_since = now;
+	}
+	rq->core_running = true;
+	rq->core_waiting = false;
+	goto done;
+
+force_idle:
+	rq->core_running = false;
+	rq->core_waiting = true;
+	rq->core_wait_cookie = cookie;
+	next = idle_sched_class.pick_next_task(rq, next);
+
+done:
+	if (was_running != rq->core_running ||
+	    (was_running && was_cookie != rq->core_cookie))
+		sched_core_kick_waiters(rq);
+	sched_core_unlock(cpu);
+
+	return next;
+}
+
+/* Called from the tick, with the rq lock held. */
+static void sched_core_tick(struct rq *rq)
+{
+	int i;
+
+	if (!sched_core_enabled() || !rq->core_running)
+		return;
+	if (rq_clock(rq) - rq->core_since < sysctl_sched_core_slice)
+		return;
+
+	for_each_cpu(i, cpu_smt_mask(cpu_of(rq))) {
+		struct rq *srq = cpu_rq(i);
+
+		if (srq != rq && READ_ONCE(srq->core_waiting) &&
+		    READ_ONCE(srq->core_wait_cookie) != rq->core_cookie) {
+			resched_curr(rq);
+			return;
+		}
+	}
+}
+
+/* The cookie of @p is that of the closest tagged group it is in. */
+static void sched_core_update_cookie(struct task_struct *p)
+{
+	struct task_group *tg;
+	unsigned long cookie = 0;
+
+	for (tg = p->sched_task_group; tg; tg = tg->parent) {
+		if (tg->core_tagged) {
+			cookie = (unsigned long)tg;
+			break;
+		}
+	}
+	WRITE_ONCE(p->core_cookie, cookie);
+}
+#else
+static inline struct task_struct *
+sched_core_pick(struct rq *rq, struct task_struct *next)
+{
+	return next;
+}
+
+static inline void sched_core_tick(struct rq *rq) { }
+static inline void sched_core_update_cookie(struct task_struct *p) { }
+#endif /* CONFIG_SCHED_CORE */
+
 /*
  * This function gets called by the timer code, with HZ frequency.
  * We call it with interrupts disabled.
@@ -2869,6 +3345,7 @@ void scheduler_tick(void)
 	raw_spin_lock(&rq->lock);
 	update_rq_clock(rq);
 	curr->sched_class->task_tick(rq, curr, 0);
+	sched_core_tick(rq);
 	update_cpu_load_active(rq);
 	calc_global_load_tick(rq);
 	raw_spin_unlock(&rq->lock);
@@ -3041,7 +3518,10 @@ pick_next_task(struct rq *rq, struct task_struct *prev)
 		if (unlikely(p == RETRY_TASK))
 			goto again;
 
-		/* assumes fair_sched_class->next == idle_sched_class */
+		/*
+		 * assumes fair_sched_class->next == idle_sched_class, or
+		 * as good as: nr_running says SCHED_BPF has nothing queued
+		 */
 		if (unlikely(!p))
 			p = idle_sched_class.pick_next_task(rq, prev);
 
@@ -3167,6 +3647,8 @@ static void __sched notrace __schedule(bool preempt)
 		update_rq_clock(rq);
 
 	next = pick_next_task(rq, prev);
+	if (sched_core_enabled())
+		next = sched_core_pick(rq, next);
 	clear_tsk_need_resched(prev);
 	clear_preempt_need_resched();
 	rq->clock_skip_update = 0;
@@ -3429,6 +3911,11 @@ void rt_mutex_setprio(struct task_struct *p, int prio)
 			p->dl.dl_boosted = 0;
 		if (rt_prio(oldprio))
 			p->rt.timeout = 0;
+#ifdef CONFIG_SCHED_BPF
+		if (bpf_policy(p->policy))
+			p->sched_class = &bpf_sched_class;
+		else
+#endif
 		p->sched_class = &fair_sched_class;
 	}
 
@@ -3665,6 +4152,11 @@ static void __setscheduler_params(struct task_struct *p,
 	else if (fair_policy(policy))
 		p->static_prio = NICE_TO_PRIO(attr->sched_nice);
 
+	if (attr->sched_flags & SCHED_FLAG_LATENCY_NICE)
+		p->latency_nice = attr->sched_latency_nice;
+
+	__setscheduler_uclamp(p, attr);
+
 	/*
 	 * __sched_setscheduler() ensures attr->sched_priority == 0 when
 	 * !rt_policy. Always setting this ensures that things like
@@ -3694,6 +4186,10 @@ static void __setscheduler(struct rq *rq, struct task_struct *p,
 		p->sched_class = &dl_sched_class;
 	else if (rt_prio(p->prio))
 		p->sched_class = &rt_sched_class;
+#ifdef CONFIG_SCHED_BPF
+	else if (bpf_policy(p->policy))
+		p->sched_class = &bpf_sched_class;
+#endif
 	else
 		p->sched_class = &fair_sched_class;
 }
@@ -3808,9 +4304,26 @@ recheck:
 			return -EINVAL;
 	}
 
-	if (attr->sched_flags & ~(SCHED_FLAG_RESET_ON_FORK))
+	if (attr->sched_flags &
+	    ~(SCHED_FLAG_RESET_ON_FORK | SCHED_FLAG_LATENCY_NICE |
+	      SCHED_FLAG_UTIL_CLAMP))
+		return -EINVAL;
+
+	if (attr->sched_flags & SCHED_FLAG_LATENCY_NICE &&
+	    (attr->sched_latency_nice < MIN_LATENCY_NICE ||
+	     attr->sched_latency_nice > MAX_LATENCY_NICE))
 		return -EINVAL;
 
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP) {
+		retval = uclamp_validate(p, attr, user);
+		if (retval)
+			return retval;
+	}
+
+	/* SCHED_BPF needs a program to make its decisions */
+	if (bpf_policy(policy) && policy != p->policy && !sched_bpf_enabled())
+		return -ENODEV;
+
 	/*
 	 * Valid priorities for SCHED_FIFO and SCHED_RR are
 	 * 1..MAX_USER_RT_PRIO-1, valid priority for SCHED_NORMAL,
@@ -3833,6 +4346,11 @@ recheck:
 				return -EPERM;
 		}
 
+		/* asking for lower latency than the default is privileged */
+		if (attr->sched_flags & SCHED_FLAG_LATENCY_NICE &&
+		    attr->sched_latency_nice < min(p->latency_nice, 0))
+			return -EPERM;
+
 		if (rt_policy(policy)) {
 			unsigned long rlim_rtprio =
 					task_rlimit(p, RLIMIT_RTPRIO);
@@ -3856,6 +4374,13 @@ recheck:
 		if (dl_policy(policy))
 			return -EPERM;
 
+		/*
+		 * Placement and order of SCHED_BPF tasks are up to the
+		 * program loaded by the administrator: opting in is too.
+		 */
+		if (bpf_policy(policy) && policy != p->policy)
+			return -EPERM;
+
 		/*
 		 * Treat SCHED_IDLE as nice 20. Only allow a switch to
 		 * SCHED_NORMAL if the RLIMIT_NICE would normally permit it.
@@ -3908,6 +4433,11 @@ recheck:
 			goto change;
 		if (dl_policy(policy) && dl_param_changed(p, attr))
 			goto change;
+		if (attr->sched_flags & SCHED_FLAG_LATENCY_NICE &&
+		    attr->sched_latency_nice != p->latency_nice)
+			goto change;
+		if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP)
+			goto change;
 
 		p->sched_reset_on_fork = reset_on_fork;
 		task_rq_unlock(rq, p, &flags);
@@ -4385,6 +4915,10 @@ SYSCALL_DEFINE4(sched_getattr, pid_t, pid, struct sched_attr __user *, uattr,
 		attr.sched_priority = p->rt_priority;
 	else
 		attr.sched_nice = task_nice(p);
+	attr.sched_latency_nice = p->latency_nice;
+	/* the default clamps are not 0: only tell those asking for them */
+	if (size >= SCHED_ATTR_SIZE_VER2)
+		__getparam_uclamp(p, &attr);
 
 	rcu_read_unlock();
 
@@ -4813,6 +5347,9 @@ SYSCALL_DEFINE1(sched_get_priority_max, int, policy)
 	case SCHED_NORMAL:
 	case SCHED_BATCH:
 	case SCHED_IDLE:
+#ifdef CONFIG_SCHED_BPF
+	case SCHED_BPF:
+#endif
 		ret = 0;
 		break;
 	}
@@ -4840,6 +5377,9 @@ SYSCALL_DEFINE1(sched_get_priority_min, int, policy)
 	case SCHED_NORMAL:
 	case SCHED_BATCH:
 	case SCHED_IDLE:
+#ifdef CONFIG_SCHED_BPF
+	case SCHED_BPF:
+#endif
 		ret = 0;
 	}
 	return ret;
@@ -5963,6 +6503,8 @@ static void free_sched_domain(struct rcu_head *rcu)
 		kfree(sd->groups->sgc);
 		kfree(sd->groups);
 	}
+	if (sd->shared && atomic_dec_and_test(&sd->shared->ref))
+		kfree(sd->shared);
 	kfree(sd);
 }
 
@@ -5989,12 +6531,14 @@ static void destroy_sched_domains(struct sched_domain *sd, int cpu)
 DEFINE_PER_CPU(struct sched_domain *, sd_llc);
 DEFINE_PER_CPU(int, sd_llc_size);
 DEFINE_PER_CPU(int, sd_llc_id);
+DEFINE_PER_CPU(struct sched_domain_shared *, sd_llc_shared);
 DEFINE_PER_CPU(struct sched_domain *, sd_numa);
 DEFINE_PER_CPU(struct sched_domain *, sd_busy);
 DEFINE_PER_CPU(struct sched_domain *, sd_asym);
 
 static void update_top_cache_domain(int cpu)
 {
+	struct sched_domain_shared *sds = NULL;
 	struct sched_domain *sd;
 	struct sched_domain *busy_sd = NULL;
 	int id = cpu;
@@ -6005,9 +6549,15 @@ static void update_top_cache_domain(int cpu)
 		id = cpumask_first(sched_domain_span(sd));
 		size = cpumask_weight(sched_domain_span(sd));
 		busy_sd = sd->parent; /* sd_busy */
+		sds = sd->shared;
 	}
 	rcu_assign_pointer(per_cpu(sd_busy, cpu), busy_sd);
 
+	/* a new mask doesn't know about this cpu until it next goes idle */
+	if (sds && idle_cpu(cpu))
+		cpumask_set_cpu(cpu, sds_idle_cpus(sds));
+	rcu_assign_pointer(per_cpu(sd_llc_shared, cpu), sds);
+
 	rcu_assign_pointer(per_cpu(sd_llc, cpu), sd);
 	per_cpu(sd_llc_size, cpu) = size;
 	per_cpu(sd_llc_id, cpu) = id;
@@ -6069,16 +6619,6 @@ cpu_attach_domain(struct sched_domain *sd, struct root_domain *rd, int cpu)
 	update_top_cache_domain(cpu);
 }
 
-/* Setup the mask of cpus configured for isolated domains */
-static int __init isolated_cpu_setup(char *str)
-{
-	alloc_bootmem_cpumask_var(&cpu_isolated_map);
-	cpulist_parse(str, cpu_isolated_map);
-	return 1;
-}
-
-__setup("isolcpus=", isolated_cpu_setup);
-
 struct s_data {
 	struct sched_domain ** __percpu sd;
 	struct root_domain	*rd;
@@ -6395,6 +6935,9 @@ static void claim_allocations(int cpu, struct sched_domain *sd)
 
 	if (atomic_read(&(*per_cpu_ptr(sdd->sgc, cpu))->ref))
 		*per_cpu_ptr(sdd->sgc, cpu) = NULL;
+
+	if (atomic_read(&(*per_cpu_ptr(sdd->sds, cpu))->ref))
+		*per_cpu_ptr(sdd->sds, cpu) = NULL;
 }
 
 #ifdef CONFIG_NUMA
@@ -6863,10 +7406,15 @@ static int __sdt_alloc(const struct cpumask *cpu_map)
 		if (!sdd->sgc)
 			return -ENOMEM;
 
+		sdd->sds = alloc_percpu(struct sched_domain_shared *);
+		if (!sdd->sds)
+			return -ENOMEM;
+
 		for_each_cpu(j, cpu_map) {
 			struct sched_domain *sd;
 			struct sched_group *sg;
 			struct sched_group_capacity *sgc;
+			struct sched_domain_shared *sds;
 
 			sd = kzalloc_node(sizeof(struct sched_domain) + cpumask_size(),
 					GFP_KERNEL, cpu_to_node(j));
@@ -6890,6 +7438,13 @@ static int __sdt_alloc(const struct cpumask *cpu_map)
 				return -ENOMEM;
 
 			*per_cpu_ptr(sdd->sgc, j) = sgc;
+
+			sds = kzalloc_node(sizeof(struct sched_domain_shared) + cpumask_size(),
+					GFP_KERNEL, cpu_to_node(j));
+			if (!sds)
+				return -ENOMEM;
+
+			*per_cpu_ptr(sdd->sds, j) = sds;
 		}
 	}
 
@@ -6918,6 +7473,8 @@ static void __sdt_free(const struct cpumask *cpu_map)
 				kfree(*per_cpu_ptr(sdd->sg, j));
 			if (sdd->sgc)
 				kfree(*per_cpu_ptr(sdd->sgc, j));
+			if (sdd->sds)
+				kfree(*per_cpu_ptr(sdd->sds, j));
 		}
 		free_percpu(sdd->sd);
 		sdd->sd = NULL;
@@ -6925,6 +7482,8 @@ static void __sdt_free(const struct cpumask *cpu_map)
 		sdd->sg = NULL;
 		free_percpu(sdd->sgc);
 		sdd->sgc = NULL;
+		free_percpu(sdd->sds);
+		sdd->sds = NULL;
 	}
 }
 
@@ -6957,6 +7516,18 @@ struct sched_domain *build_sched_domain(struct sched_domain_topology_level *tl,
 		}
 
 	}
+
+	/*
+	 * All the cpus of a cache domain use the shared state of the first
+	 * one of its span, claim_allocations() keeps the one in use.
+	 */
+	if (sd->flags & SD_SHARE_PKG_RESOURCES) {
+		struct sd_data *sdd = sd->private;
+
+		sd->shared = *per_cpu_ptr(sdd->sds,
+				cpumask_first(sched_domain_span(sd)));
+		atomic_inc(&sd->shared->ref);
+	}
 	set_domain_attribute(sd, attr);
 
 	return sd;
@@ -7425,12 +7996,18 @@ void __init sched_init(void)
 
 		rq = cpu_rq(i);
 		raw_spin_lock_init(&rq->lock);
+#ifdef CONFIG_SCHED_CORE
+		raw_spin_lock_init(&rq->core_lock);
+#endif
 		rq->nr_running = 0;
 		rq->calc_load_active = 0;
 		rq->calc_load_update = jiffies + LOAD_FREQ;
 		init_cfs_rq(&rq->cfs);
 		init_rt_rq(&rq->rt);
 		init_dl_rq(&rq->dl);
+#ifdef CONFIG_SCHED_BPF
+		init_bpf_rq(&rq->bpf);
+#endif
 #ifdef CONFIG_FAIR_GROUP_SCHED
 		root_task_group.shares = ROOT_TASK_GROUP_LOAD;
 		INIT_LIST_HEAD(&rq->leaf_cfs_rq_list);
@@ -7496,6 +8073,7 @@ void __init sched_init(void)
 	}
 
 	set_load_weight(&init_task);
+	init_uclamp();
 
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&init_task.preempt_notifiers);
@@ -7716,6 +8294,8 @@ struct task_group *sched_create_group(struct task_group *parent)
 	if (!alloc_rt_sched_group(tg, parent))
 		goto err;
 
+	uclamp_tg_init(tg, parent);
+
 	return tg;
 
 err:
@@ -7797,6 +8377,7 @@ void sched_move_task(struct task_struct *tsk)
 			  struct task_group, css);
 	tg = autogroup_task_group(tsk, tg);
 	tsk->sched_task_group = tg;
+	sched_core_update_cookie(tsk);
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	if (tsk->sched_class->task_move_group)
@@ -8214,6 +8795,20 @@ cpu_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 	return &tg->css;
 }
 
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+static int cpu_cgroup_css_online(struct cgroup_subsys_state *css)
+{
+	struct task_group *tg = css_tg(css);
+
+	/* the parent's clamps may have changed since we were allocated */
+	mutex_lock(&uclamp_mutex);
+	uclamp_tg_update_eff(tg, tg->parent);
+	mutex_unlock(&uclamp_mutex);
+
+	return 0;
+}
+#endif
+
 static void cpu_cgroup_css_released(struct cgroup_subsys_state *css)
 {
 	struct task_group *tg = css_tg(css);
@@ -8225,6 +8820,11 @@ static void cpu_cgroup_css_free(struct cgroup_subsys_state *css)
 {
 	struct task_group *tg = css_tg(css);
 
+#ifdef CONFIG_SCHED_CORE
+	if (tg->core_tagged)
+		static_branch_dec(&sched_core_key);
+#endif
+
 	/*
 	 * Relies on the RCU grace period between css_released() and this.
 	 */
@@ -8286,7 +8886,8 @@ const u64 min_cfs_quota_period = 1 * NSEC_PER_MSEC; /* 1ms */
 
 static int __cfs_schedulable(struct task_group *tg, u64 period, u64 runtime);
 
-static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
+static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota,
+				u64 burst)
 {
 	int i, ret = 0, runtime_enabled, runtime_was_enabled;
 	struct cfs_bandwidth *cfs_b = &tg->cfs_bandwidth;
@@ -8310,6 +8911,13 @@ static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
 	if (period > max_cfs_quota_period)
 		return -EINVAL;
 
+	/*
+	 * A burst carries over at most a period worth of quota, it is not
+	 * a way around the quota.
+	 */
+	if (quota != RUNTIME_INF && burst > quota)
+		return -EINVAL;
+
 	/*
 	 * Prevent race between setting of cfs_rq->runtime_enabled and
 	 * unthrottle_offline_cfs_rqs().
@@ -8331,6 +8939,7 @@ static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
 	raw_spin_lock_irq(&cfs_b->lock);
 	cfs_b->period = ns_to_ktime(period);
 	cfs_b->quota = quota;
+	cfs_b->burst = burst;
 
 	__refill_cfs_bandwidth_runtime(cfs_b);
 	/* restart the period timer (if active) to handle new period expiry */
@@ -8369,7 +8978,7 @@ int tg_set_cfs_quota(struct task_group *tg, long cfs_quota_us)
 	else
 		quota = (u64)cfs_quota_us * NSEC_PER_USEC;
 
-	return tg_set_cfs_bandwidth(tg, period, quota);
+	return tg_set_cfs_bandwidth(tg, period, quota, tg->cfs_bandwidth.burst);
 }
 
 long tg_get_cfs_quota(struct task_group *tg)
@@ -8392,7 +9001,7 @@ int tg_set_cfs_period(struct task_group *tg, long cfs_period_us)
 	period = (u64)cfs_period_us * NSEC_PER_USEC;
 	quota = tg->cfs_bandwidth.quota;
 
-	return tg_set_cfs_bandwidth(tg, period, quota);
+	return tg_set_cfs_bandwidth(tg, period, quota, tg->cfs_bandwidth.burst);
 }
 
 long tg_get_cfs_period(struct task_group *tg)
@@ -8405,6 +9014,30 @@ long tg_get_cfs_period(struct task_group *tg)
 	return cfs_period_us;
 }
 
+static int tg_set_cfs_burst(struct task_group *tg, u64 cfs_burst_us)
+{
+	u64 quota, period, burst;
+
+	if (cfs_burst_us > U64_MAX / NSEC_PER_USEC)
+		return -EINVAL;
+
+	burst = (u64)cfs_burst_us * NSEC_PER_USEC;
+	period = ktime_to_ns(tg->cfs_bandwidth.period);
+	quota = tg->cfs_bandwidth.quota;
+
+	return tg_set_cfs_bandwidth(tg, period, quota, burst);
+}
+
+static u64 tg_get_cfs_burst(struct task_group *tg)
+{
+	u64 burst_us;
+
+	burst_us = tg->cfs_bandwidth.burst;
+	do_div(burst_us, NSEC_PER_USEC);
+
+	return burst_us;
+}
+
 static s64 cpu_cfs_quota_read_s64(struct cgroup_subsys_state *css,
 				  struct cftype *cft)
 {
@@ -8429,6 +9062,18 @@ static int cpu_cfs_period_write_u64(struct cgroup_subsys_state *css,
 	return tg_set_cfs_period(css_tg(css), cfs_period_us);
 }
 
+static u64 cpu_cfs_burst_read_u64(struct cgroup_subsys_state *css,
+				  struct cftype *cft)
+{
+	return tg_get_cfs_burst(css_tg(css));
+}
+
+static int cpu_cfs_burst_write_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cftype, u64 cfs_burst_us)
+{
+	return tg_set_cfs_burst(css_tg(css), cfs_burst_us);
+}
+
 struct cfs_schedulable_data {
 	struct task_group *tg;
 	u64 period, quota;
@@ -8515,6 +9160,8 @@ static int cpu_stats_show(struct seq_file *sf, void *v)
 	seq_printf(sf, "nr_periods %d\n", cfs_b->nr_periods);
 	seq_printf(sf, "nr_throttled %d\n", cfs_b->nr_throttled);
 	seq_printf(sf, "throttled_time %llu\n", cfs_b->throttled_time);
+	seq_printf(sf, "nr_bursts %d\n", cfs_b->nr_bursts);
+	seq_printf(sf, "burst_time %llu\n", cfs_b->burst_time);
 
 	return 0;
 }
@@ -8547,7 +9194,149 @@ static u64 cpu_rt_period_read_uint(struct cgroup_subsys_state *css,
 }
 #endif /* CONFIG_RT_GROUP_SCHED */
 
+#ifdef CONFIG_SCHED_CORE
+static u64 cpu_core_tag_read_u64(struct cgroup_subsys_state *css,
+				 struct cftype *cft)
+{
+	return css_tg(css)->core_tagged;
+}
+
+static int cpu_core_tag_write_u64(struct cgroup_subsys_state *css,
+				  struct cftype *cft, u64 val)
+{
+	struct task_group *tg = css_tg(css);
+	struct task_struct *g, *p;
+
+	if (tg == &root_task_group)
+		return -EINVAL;
+	if (val > 1)
+		return -ERANGE;
+
+	mutex_lock(&sched_core_mutex);
+	if (tg->core_tagged == val)
+		goto out_unlock;
+
+	tg->core_tagged = val;
+	if (val)
+		static_branch_inc(&sched_core_key);
+	else
+		static_branch_dec(&sched_core_key);
+
+	/*
+	 * Tasks below the group may change cookie too.  A running task
+	 * keeps sharing its core under the old one until it is next
+	 * scheduled.
+	 */
+	rcu_read_lock();
+	for_each_process_thread(g, p)
+		sched_core_update_cookie(p);
+	rcu_read_unlock();
+out_unlock:
+	mutex_unlock(&sched_core_mutex);
+
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+/* apply the new effective clamps of the groups to their runnable tasks */
+static void uclamp_update_active(struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+	unsigned long flags;
+	struct rq *rq;
+
+	rq = task_rq_lock(p, &flags);
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++) {
+		if (!p->uclamp[clamp_id].active)
+			continue;
+		uclamp_rq_dec_id(rq, p, clamp_id);
+		uclamp_rq_inc_id(rq, p, clamp_id);
+	}
+	task_rq_unlock(rq, p, &flags);
+}
+
+static int cpu_uclamp_write(struct cgroup_subsys_state *css, u64 pct,
+			    enum uclamp_id clamp_id)
+{
+	struct cgroup_subsys_state *top_css = css;
+	struct task_struct *g, *p;
+
+	if (pct > 100)
+		return -ERANGE;
+
+	mutex_lock(&uclamp_mutex);
+	uclamp_se_set(&css_tg(css)->uclamp_req[clamp_id],
+		      DIV_ROUND_CLOSEST((unsigned int)pct * SCHED_CAPACITY_SCALE,
+					100));
+
+	rcu_read_lock();
+	css_for_each_descendant_pre(css, top_css)
+		uclamp_tg_update_eff(css_tg(css), css_tg(css)->parent);
+
+	for_each_process_thread(g, p)
+		uclamp_update_active(p);
+	rcu_read_unlock();
+	mutex_unlock(&uclamp_mutex);
+
+	return 0;
+}
+
+static u64 cpu_uclamp_read(struct cgroup_subsys_state *css,
+			   enum uclamp_id clamp_id)
+{
+	return DIV_ROUND_CLOSEST(css_tg(css)->uclamp_req[clamp_id].value * 100,
+				 SCHED_CAPACITY_SCALE);
+}
+
+static int cpu_uclamp_min_write_u64(struct cgroup_subsys_state *css,
+				    struct cftype *cft, u64 pct)
+{
+	return cpu_uclamp_write(css, pct, UCLAMP_MIN);
+}
+
+static u64 cpu_uclamp_min_read_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cft)
+{
+	return cpu_uclamp_read(css, UCLAMP_MIN);
+}
+
+static int cpu_uclamp_max_write_u64(struct cgroup_subsys_state *css,
+				    struct cftype *cft, u64 pct)
+{
+	return cpu_uclamp_write(css, pct, UCLAMP_MAX);
+}
+
+static u64 cpu_uclamp_max_read_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cft)
+{
+	return cpu_uclamp_read(css, UCLAMP_MAX);
+}
+#endif
+
 static struct cftype cpu_files[] = {
+#ifdef CONFIG_SCHED_CORE
+	{
+		.name = "tag",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_core_tag_read_u64,
+		.write_u64 = cpu_core_tag_write_u64,
+	},
+#endif
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	{
+		.name = "uclamp.min",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_uclamp_min_read_u64,
+		.write_u64 = cpu_uclamp_min_write_u64,
+	},
+	{
+		.name = "uclamp.max",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_uclamp_max_read_u64,
+		.write_u64 = cpu_uclamp_max_write_u64,
+	},
+#endif
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	{
 		.name = "shares",
@@ -8566,6 +9355,11 @@ static struct cftype cpu_files[] = {
 		.read_u64 = cpu_cfs_period_read_u64,
 		.write_u64 = cpu_cfs_period_write_u64,
 	},
+	{
+		.name = "cfs_burst_us",
+		.read_u64 = cpu_cfs_burst_read_u64,
+		.write_u64 = cpu_cfs_burst_write_u64,
+	},
 	{
 		.name = "stat",
 		.seq_show = cpu_stats_show,
@@ -8588,6 +9382,9 @@ static struct cftype cpu_files[] = {
 
 struct cgroup_subsys cpu_cgrp_subsys = {
 	.css_alloc	= cpu_cgroup_css_alloc,
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	.css_online	= cpu_cgroup_css_online,
+#endif
 	.css_released	= cpu_cgroup_css_released,
 	.css_free	= cpu_cgroup_css_free,
 	.fork		= cpu_cgroup_fork,
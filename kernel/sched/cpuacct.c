@@ -6,6 +6,7 @@
 #include <linux/seq_file.h>
 #include <linux/rcupdate.h>
 #include <linux/kernel_stat.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/err.h>
 
 #include "sched.h"
@@ -25,12 +26,37 @@ enum cpuacct_stat_index {
 	CPUACCT_STAT_NSTATS,
 };
 
+/*
+ * What the tasks of a group, and of that group only, were charged on a
+ * cpu.  The charging paths only touch the group a task is in and tell
+ * the cgroup core about it, flushing the group's cgroup then propagates
+ * the charges up to the hierarchical totals in struct cpuacct.
+ */
+struct cpuacct_cpu {
+	/* written by cpuacct_charge() under the rq lock */
+	u64 usage;
+	struct u64_stats_sync syncp;
+	/* written by cpuacct_account_field() on the local cpu */
+	u64 cpustat[NR_STATS];
+
+	/* owned by cpuacct_css_rstat_flush() */
+	u64 usage_prev;
+	u64 usage_pending;
+	u64 cpustat_prev[NR_STATS];
+	u64 cpustat_pending[NR_STATS];
+};
+
 /* track cpu usage of a group of tasks and its child groups */
 struct cpuacct {
 	struct cgroup_subsys_state css;
-	/* cpuusage holds pointer to a u64-type object on every cpu */
+	/*
+	 * Hierarchical totals: cpuusage holds pointer to a u64-type object
+	 * on every cpu.  Only up to date after flushing the group, and
+	 * protected by the cgroup rstat lock.
+	 */
 	u64 __percpu *cpuusage;
 	struct kernel_cpustat __percpu *cpustat;
+	struct cpuacct_cpu __percpu *pcpu;
 };
 
 static inline struct cpuacct *css_ca(struct cgroup_subsys_state *css)
@@ -50,9 +76,11 @@ static inline struct cpuacct *parent_ca(struct cpuacct *ca)
 }
 
 static DEFINE_PER_CPU(u64, root_cpuacct_cpuusage);
+static DEFINE_PER_CPU(struct cpuacct_cpu, root_cpuacct_pcpu);
 static struct cpuacct root_cpuacct = {
 	.cpustat	= &kernel_cpustat,
 	.cpuusage	= &root_cpuacct_cpuusage,
+	.pcpu		= &root_cpuacct_pcpu,
 };
 
 /* create a new cpu accounting group */
@@ -60,6 +88,7 @@ static struct cgroup_subsys_state *
 cpuacct_css_alloc(struct cgroup_subsys_state *parent_css)
 {
 	struct cpuacct *ca;
+	int cpu;
 
 	if (!parent_css)
 		return &root_cpuacct.css;
@@ -76,8 +105,17 @@ cpuacct_css_alloc(struct cgroup_subsys_state *parent_css)
 	if (!ca->cpustat)
 		goto out_free_cpuusage;
 
+	ca->pcpu = alloc_percpu(struct cpuacct_cpu);
+	if (!ca->pcpu)
+		goto out_free_cpustat;
+
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(ca->pcpu, cpu)->syncp);
+
 	return &ca->css;
 
+out_free_cpustat:
+	free_percpu(ca->cpustat);
 out_free_cpuusage:
 	free_percpu(ca->cpuusage);
 out_free_ca:
@@ -91,44 +129,60 @@ static void cpuacct_css_free(struct cgroup_subsys_state *css)
 {
 	struct cpuacct *ca = css_ca(css);
 
+	free_percpu(ca->pcpu);
 	free_percpu(ca->cpustat);
 	free_percpu(ca->cpuusage);
 	kfree(ca);
 }
 
-static u64 cpuacct_cpuusage_read(struct cpuacct *ca, int cpu)
-{
-	u64 *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
-	u64 data;
-
-#ifndef CONFIG_64BIT
-	/*
-	 * Take rq->lock to make 64-bit read safe on 32-bit platforms.
-	 */
-	raw_spin_lock_irq(&cpu_rq(cpu)->lock);
-	data = *cpuusage;
-	raw_spin_unlock_irq(&cpu_rq(cpu)->lock);
-#else
-	data = *cpuusage;
-#endif
-
-	return data;
-}
-
-static void cpuacct_cpuusage_write(struct cpuacct *ca, int cpu, u64 val)
+/*
+ * Fold the charges of @css on @cpu since the last flush, and those
+ * its children passed on, into its totals and pass them on to the
+ * parent.  Runs for children before their parents, under the rstat
+ * lock, which is what now makes the 64-bit totals safe to access on
+ * 32-bit platforms instead of the rq lock.
+ */
+static void cpuacct_css_rstat_flush(struct cgroup_subsys_state *css, int cpu)
 {
-	u64 *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
+	struct cpuacct *ca = css_ca(css);
+	struct cpuacct *parent = parent_ca(ca);
+	struct cpuacct_cpu *cac = per_cpu_ptr(ca->pcpu, cpu);
+	struct cpuacct_cpu *pcac = NULL;
+	struct kernel_cpustat *kcpustat;
+	unsigned int seq;
+	u64 usage, delta;
+	int i;
 
-#ifndef CONFIG_64BIT
-	/*
-	 * Take rq->lock to make 64-bit write safe on 32-bit platforms.
-	 */
-	raw_spin_lock_irq(&cpu_rq(cpu)->lock);
-	*cpuusage = val;
-	raw_spin_unlock_irq(&cpu_rq(cpu)->lock);
-#else
-	*cpuusage = val;
-#endif
+	if (parent)
+		pcac = per_cpu_ptr(parent->pcpu, cpu);
+
+	do {
+		seq = u64_stats_fetch_begin(&cac->syncp);
+		usage = cac->usage;
+	} while (u64_stats_fetch_retry(&cac->syncp, seq));
+
+	delta = usage - cac->usage_prev + cac->usage_pending;
+	cac->usage_prev = usage;
+	cac->usage_pending = 0;
+	*per_cpu_ptr(ca->cpuusage, cpu) += delta;
+	if (pcac)
+		pcac->usage_pending += delta;
+
+	/* the root's cpustat is kernel_cpustat, which the caller updates */
+	if (ca == &root_cpuacct)
+		return;
+
+	kcpustat = per_cpu_ptr(ca->cpustat, cpu);
+	for (i = 0; i < NR_STATS; i++) {
+		u64 v = READ_ONCE(cac->cpustat[i]);
+
+		delta = v - cac->cpustat_prev[i] + cac->cpustat_pending[i];
+		cac->cpustat_prev[i] = v;
+		cac->cpustat_pending[i] = 0;
+		kcpustat->cpustat[i] += delta;
+		if (parent != &root_cpuacct)
+			pcac->cpustat_pending[i] += delta;
+	}
 }
 
 /* return total cpu usage (in nanoseconds) of a group */
@@ -138,8 +192,10 @@ static u64 cpuusage_read(struct cgroup_subsys_state *css, struct cftype *cft)
 	u64 totalcpuusage = 0;
 	int i;
 
+	cgroup_rstat_flush_hold(css->cgroup);
 	for_each_present_cpu(i)
-		totalcpuusage += cpuacct_cpuusage_read(ca, i);
+		totalcpuusage += *per_cpu_ptr(ca->cpuusage, i);
+	cgroup_rstat_flush_release();
 
 	return totalcpuusage;
 }
@@ -156,8 +212,11 @@ static int cpuusage_write(struct cgroup_subsys_state *css, struct cftype *cft,
 		goto out;
 	}
 
+	/* flush first, so that charges made before the reset go away too */
+	cgroup_rstat_flush_hold(css->cgroup);
 	for_each_present_cpu(i)
-		cpuacct_cpuusage_write(ca, i, 0);
+		*per_cpu_ptr(ca->cpuusage, i) = 0;
+	cgroup_rstat_flush_release();
 
 out:
 	return err;
@@ -169,10 +228,12 @@ static int cpuacct_percpu_seq_show(struct seq_file *m, void *V)
 	u64 percpu;
 	int i;
 
+	cgroup_rstat_flush_hold(ca->css.cgroup);
 	for_each_present_cpu(i) {
-		percpu = cpuacct_cpuusage_read(ca, i);
+		percpu = *per_cpu_ptr(ca->cpuusage, i);
 		seq_printf(m, "%llu ", (unsigned long long) percpu);
 	}
+	cgroup_rstat_flush_release();
 	seq_printf(m, "\n");
 	return 0;
 }
@@ -186,26 +247,25 @@ static int cpuacct_stats_show(struct seq_file *sf, void *v)
 {
 	struct cpuacct *ca = css_ca(seq_css(sf));
 	int cpu;
-	s64 val = 0;
+	s64 user = 0, system = 0;
 
+	cgroup_rstat_flush_hold(ca->css.cgroup);
 	for_each_online_cpu(cpu) {
 		struct kernel_cpustat *kcpustat = per_cpu_ptr(ca->cpustat, cpu);
-		val += kcpustat->cpustat[CPUTIME_USER];
-		val += kcpustat->cpustat[CPUTIME_NICE];
+		user += kcpustat->cpustat[CPUTIME_USER];
+		user += kcpustat->cpustat[CPUTIME_NICE];
+		system += kcpustat->cpustat[CPUTIME_SYSTEM];
+		system += kcpustat->cpustat[CPUTIME_IRQ];
+		system += kcpustat->cpustat[CPUTIME_SOFTIRQ];
 	}
-	val = cputime64_to_clock_t(val);
-	seq_printf(sf, "%s %lld\n", cpuacct_stat_desc[CPUACCT_STAT_USER], val);
+	cgroup_rstat_flush_release();
 
-	val = 0;
-	for_each_online_cpu(cpu) {
-		struct kernel_cpustat *kcpustat = per_cpu_ptr(ca->cpustat, cpu);
-		val += kcpustat->cpustat[CPUTIME_SYSTEM];
-		val += kcpustat->cpustat[CPUTIME_IRQ];
-		val += kcpustat->cpustat[CPUTIME_SOFTIRQ];
-	}
+	user = cputime64_to_clock_t(user);
+	seq_printf(sf, "%s %lld\n", cpuacct_stat_desc[CPUACCT_STAT_USER], user);
 
-	val = cputime64_to_clock_t(val);
-	seq_printf(sf, "%s %lld\n", cpuacct_stat_desc[CPUACCT_STAT_SYSTEM], val);
+	system = cputime64_to_clock_t(system);
+	seq_printf(sf, "%s %lld\n", cpuacct_stat_desc[CPUACCT_STAT_SYSTEM],
+		   system);
 
 	return 0;
 }
@@ -234,6 +294,7 @@ static struct cftype files[] = {
  */
 void cpuacct_charge(struct task_struct *tsk, u64 cputime)
 {
+	struct cpuacct_cpu *cac;
 	struct cpuacct *ca;
 	int cpu;
 
@@ -242,15 +303,12 @@ void cpuacct_charge(struct task_struct *tsk, u64 cputime)
 	rcu_read_lock();
 
 	ca = task_ca(tsk);
+	cac = per_cpu_ptr(ca->pcpu, cpu);
 
-	while (true) {
-		u64 *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
-		*cpuusage += cputime;
-
-		ca = parent_ca(ca);
-		if (!ca)
-			break;
-	}
+	u64_stats_update_begin(&cac->syncp);
+	cac->usage += cputime;
+	u64_stats_update_end(&cac->syncp);
+	cgroup_rstat_updated(ca->css.cgroup, cpu);
 
 	rcu_read_unlock();
 }
@@ -262,15 +320,13 @@ void cpuacct_charge(struct task_struct *tsk, u64 cputime)
  */
 void cpuacct_account_field(struct task_struct *p, int index, u64 val)
 {
-	struct kernel_cpustat *kcpustat;
 	struct cpuacct *ca;
 
 	rcu_read_lock();
 	ca = task_ca(p);
-	while (ca != &root_cpuacct) {
-		kcpustat = this_cpu_ptr(ca->cpustat);
-		kcpustat->cpustat[index] += val;
-		ca = parent_ca(ca);
+	if (ca != &root_cpuacct) {
+		this_cpu_ptr(ca->pcpu)->cpustat[index] += val;
+		cgroup_rstat_updated(ca->css.cgroup, smp_processor_id());
 	}
 	rcu_read_unlock();
 }
@@ -278,6 +334,7 @@ void cpuacct_account_field(struct task_struct *p, int index, u64 val)
 struct cgroup_subsys cpuacct_cgrp_subsys = {
 	.css_alloc	= cpuacct_css_alloc,
 	.css_free	= cpuacct_css_free,
+	.css_rstat_flush = cpuacct_css_rstat_flush,
 	.legacy_cftypes	= files,
 	.early_init	= 1,
 };
@@ -617,6 +617,31 @@ static u64 __sched_period(unsigned long nr_running)
 		return sysctl_sched_latency;
 }
 
+/*
+ * Latency nice scales the slice of a task and the wakeup granularity it
+ * is preempted with: x2 every 5 levels, 1/16 at -20 and x14 at 19, with
+ * 1024 for the default 0.
+ */
+static const int latency_to_scale[LATENCY_NICE_WIDTH] = {
+ /* -20 */        64,        74,        84,        97,       111,
+ /* -15 */       128,       147,       169,       194,       223,
+ /* -10 */       256,       294,       338,       388,       446,
+ /*  -5 */       512,       588,       676,       776,       891,
+ /*   0 */      1024,      1176,      1351,      1552,      1783,
+ /*   5 */      2048,      2353,      2702,      3104,      3566,
+ /*  10 */      4096,      4705,      5405,      6208,      7132,
+ /*  15 */      8192,      9410,     10809,     12417,     14263,
+};
+
+static inline u64 latency_scale(u64 delta, int latency_nice)
+{
+	if (likely(!latency_nice))
+		return delta;
+
+	latency_nice = clamp(latency_nice, MIN_LATENCY_NICE, MAX_LATENCY_NICE);
+	return (delta * latency_to_scale[latency_nice - MIN_LATENCY_NICE]) >> 10;
+}
+
 /*
  * We calculate the wall-time slice from the period by taking a part
  * proportional to the weight.
@@ -627,6 +652,9 @@ static u64 sched_slice(struct cfs_rq *cfs_rq, struct sched_entity *se)
 {
 	u64 slice = __sched_period(cfs_rq->nr_running + !se->on_rq);
 
+	if (entity_is_task(se))
+		slice = latency_scale(slice, task_of(se)->latency_nice);
+
 	for_each_sched_entity(se) {
 		struct load_weight *load;
 		struct load_weight lw;
@@ -1086,6 +1114,10 @@ bool should_numa_migrate_memory(struct task_struct *p, struct page * page,
 	if (cpupid_match_pid(p, last_cpupid))
 		return true;
 
+	/* Get shared pages off a slow memory tier as well */
+	if (!node_is_toptier(src_nid))
+		return true;
+
 	/* A shared fault, but p->numa_group has not been set up yet. */
 	if (!ng)
 		return true;
@@ -1380,8 +1412,15 @@ balance:
 	 * One idle CPU per node is evaluated for a task numa move.
 	 * Call select_idle_sibling to maybe find a better one.
 	 */
-	if (!cur)
+	if (!cur) {
+		/*
+		 * select_idle_sibling() accounts its scan to this cpu, as
+		 * it does from the wakeup path, where irqs are disabled.
+		 */
+		local_irq_disable();
 		env->dst_cpu = select_idle_sibling(env->p, env->dst_cpu);
+		local_irq_enable();
+	}
 
 assign:
 	task_numa_assign(env, cur, imp);
@@ -2210,6 +2249,7 @@ void task_numa_work(struct callback_head *work)
 
 
 	down_read(&mm->mmap_sem);
+	prot_numa_batch_begin(mm);
 	vma = find_vma(mm, start);
 	if (!vma) {
 		reset_ptenuma_scan(p);
@@ -2243,7 +2283,7 @@ void task_numa_work(struct callback_head *work)
 			start = max(start, vma->vm_start);
 			end = ALIGN(start + (pages << PAGE_SHIFT), HPAGE_SIZE);
 			end = min(end, vma->vm_end);
-			nr_pte_updates = change_prot_numa(vma, start, end);
+			nr_pte_updates = change_prot_numa_batch(vma, start, end);
 
 			/*
 			 * Try to scan sysctl_numa_balancing_size worth of
@@ -2276,6 +2316,7 @@ out:
 		mm->numa_scan_offset = start;
 	else
 		reset_ptenuma_scan(p);
+	prot_numa_batch_end(mm);
 	up_read(&mm->mmap_sem);
 }
 
@@ -3194,7 +3235,8 @@ set_next_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
 }
 
 static int
-wakeup_preempt_entity(struct sched_entity *curr, struct sched_entity *se);
+wakeup_preempt_entity(struct sched_entity *curr, struct sched_entity *se,
+		      int latency_nice);
 
 /*
  * Pick the next process, keeping these things in mind, in this order:
@@ -3233,20 +3275,20 @@ pick_next_entity(struct cfs_rq *cfs_rq, struct sched_entity *curr)
 				second = curr;
 		}
 
-		if (second && wakeup_preempt_entity(second, left) < 1)
+		if (second && wakeup_preempt_entity(second, left, 0) < 1)
 			se = second;
 	}
 
 	/*
 	 * Prefer last buddy, try to return the CPU to a preempted task.
 	 */
-	if (cfs_rq->last && wakeup_preempt_entity(cfs_rq->last, left) < 1)
+	if (cfs_rq->last && wakeup_preempt_entity(cfs_rq->last, left, 0) < 1)
 		se = cfs_rq->last;
 
 	/*
 	 * Someone really wants this to run. If it's not unfair, run it.
 	 */
-	if (cfs_rq->next && wakeup_preempt_entity(cfs_rq->next, left) < 1)
+	if (cfs_rq->next && wakeup_preempt_entity(cfs_rq->next, left, 0) < 1)
 		se = cfs_rq->next;
 
 	clear_buddies(cfs_rq, se);
@@ -3367,17 +3409,31 @@ static inline u64 sched_cfs_bandwidth_slice(void)
  * We use sched_clock_cpu directly instead of rq->clock to avoid adding
  * additional synchronization around rq->lock.
  *
+ * What the group did not use of the previous periods is kept, up to
+ * cfs_b->burst: a bursty group under its average quota is not throttled.
+ *
  * requires cfs_b->lock
  */
 void __refill_cfs_bandwidth_runtime(struct cfs_bandwidth *cfs_b)
 {
+	s64 burst_used;
 	u64 now;
 
 	if (cfs_b->quota == RUNTIME_INF)
 		return;
 
 	now = sched_clock_cpu(smp_processor_id());
-	cfs_b->runtime = cfs_b->quota;
+	cfs_b->runtime += cfs_b->quota;
+
+	/* more than the quota was used last period: a burst */
+	burst_used = cfs_b->runtime_snap - cfs_b->runtime;
+	if (burst_used > 0) {
+		cfs_b->burst_time += burst_used;
+		cfs_b->nr_bursts++;
+	}
+
+	cfs_b->runtime = min(cfs_b->runtime, cfs_b->quota + cfs_b->burst);
+	cfs_b->runtime_snap = cfs_b->runtime;
 	cfs_b->runtime_expires = now + ktime_to_ns(cfs_b->period);
 }
 
@@ -3405,6 +3461,15 @@ static int assign_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 	/* note: this is a positive sum as runtime_remaining <= 0 */
 	min_amount = sched_cfs_bandwidth_slice() - cfs_rq->runtime_remaining;
 
+	/*
+	 * Once the pool of a throttled group is drained, its cpus come here
+	 * on every tick: don't have them all bounce cfs_b->lock only to find
+	 * nothing. The armed period timer refills the pool and unthrottles.
+	 */
+	if (READ_ONCE(cfs_b->period_active) && !READ_ONCE(cfs_b->runtime) &&
+	    READ_ONCE(cfs_b->quota) != RUNTIME_INF)
+		return 0;
+
 	raw_spin_lock(&cfs_b->lock);
 	if (cfs_b->quota == RUNTIME_INF)
 		amount = min_amount;
@@ -3803,6 +3868,11 @@ static void start_cfs_slack_bandwidth(struct cfs_bandwidth *cfs_b)
 	if (runtime_refresh_within(cfs_b, min_left))
 		return;
 
+	/* don't push forwards an existing deferred unthrottle */
+	if (cfs_b->slack_started)
+		return;
+	cfs_b->slack_started = true;
+
 	hrtimer_start(&cfs_b->slack_timer,
 			ns_to_ktime(cfs_bandwidth_slack_period),
 			HRTIMER_MODE_REL);
@@ -3817,6 +3887,10 @@ static void __return_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 	if (slack_runtime <= 0)
 		return;
 
+	/* runtime of a past period can't be returned: skip cfs_b->lock */
+	if (cfs_rq->runtime_expires != READ_ONCE(cfs_b->runtime_expires))
+		goto out;
+
 	raw_spin_lock(&cfs_b->lock);
 	if (cfs_b->quota != RUNTIME_INF &&
 	    cfs_rq->runtime_expires == cfs_b->runtime_expires) {
@@ -3829,6 +3903,7 @@ static void __return_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 	}
 	raw_spin_unlock(&cfs_b->lock);
 
+out:
 	/* even if it's not valid for return we don't want to try again */
 	cfs_rq->runtime_remaining -= slack_runtime;
 }
@@ -3855,6 +3930,8 @@ static void do_sched_cfs_slack_timer(struct cfs_bandwidth *cfs_b)
 
 	/* confirm we're still not at a refresh boundary */
 	raw_spin_lock(&cfs_b->lock);
+	cfs_b->slack_started = false;
+
 	if (runtime_refresh_within(cfs_b, min_bandwidth_expiration)) {
 		raw_spin_unlock(&cfs_b->lock);
 		return;
@@ -3959,6 +4036,7 @@ void init_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
 	cfs_b->runtime = 0;
 	cfs_b->quota = RUNTIME_INF;
 	cfs_b->period = ns_to_ktime(default_cfs_period());
+	cfs_b->burst = 0;
 
 	INIT_LIST_HEAD(&cfs_b->throttled_cfs_rq);
 	hrtimer_init(&cfs_b->period_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_PINNED);
@@ -4466,6 +4544,43 @@ static unsigned long capacity_orig_of(int cpu)
 	return cpu_rq(cpu)->cpu_capacity_orig;
 }
 
+/*
+ * The margin, ~20%, by which the capacity of a cpu is to exceed the
+ * utilization of a task for the task to fit it.
+ */
+static const unsigned long capacity_margin = 1280;
+
+static int task_fits_capacity(struct task_struct *p, int cpu)
+{
+	unsigned long capacity = capacity_orig_of(cpu);
+
+	/* the biggest cpus fit anything */
+	if (capacity >= READ_ONCE(cpu_rq(cpu)->rd->max_cpu_capacity))
+		return 1;
+
+	return uclamp_task_util(p, p->se.avg.util_avg) * capacity_margin <
+	       capacity * SCHED_CAPACITY_SCALE;
+}
+
+/*
+ * On systems with cpus of different capacity, a task too big for the
+ * cpu it wakes on, or for the one it last ran on, looks further than
+ * their caches for a cpu it fits.
+ */
+static int wake_cap(struct task_struct *p, int cpu, int prev_cpu)
+{
+	unsigned long max_cap = READ_ONCE(cpu_rq(cpu)->rd->max_cpu_capacity);
+	unsigned long min_cap;
+
+	min_cap = min(capacity_orig_of(prev_cpu), capacity_orig_of(cpu));
+
+	/* all about the same size, none fits it much better */
+	if (max_cap - min_cap < max_cap >> 3)
+		return 0;
+
+	return !task_fits_capacity(p, cpu) || !task_fits_capacity(p, prev_cpu);
+}
+
 static unsigned long cpu_avg_load_per_task(int cpu)
 {
 	struct rq *rq = cpu_rq(cpu);
@@ -4736,6 +4851,7 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 	unsigned long min_load = ULONG_MAX, this_load = 0;
 	int load_idx = sd->forkexec_idx;
 	int imbalance = 100 + (sd->imbalance_pct-100)/2;
+	int this_fits = 0, idlest_fits = 0;
 
 	if (sd_flag & SD_BALANCE_WAKE)
 		load_idx = sd->wake_idx;
@@ -4743,6 +4859,7 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 	do {
 		unsigned long load, avg_load;
 		int local_group;
+		int fits = 0;
 		int i;
 
 		/* Skip over this group if it has no CPUs allowed */
@@ -4764,6 +4881,9 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 				load = target_load(i, load_idx);
 
 			avg_load += load;
+
+			if (!fits && cpumask_test_cpu(i, tsk_cpus_allowed(p)))
+				fits = task_fits_capacity(p, i);
 		}
 
 		/* Adjust by relative CPU capacity of the group */
@@ -4771,13 +4891,23 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 
 		if (local_group) {
 			this_load = avg_load;
-		} else if (avg_load < min_load) {
+			this_fits = fits;
+		} else if (fits > idlest_fits ||
+			   (fits == idlest_fits && avg_load < min_load)) {
 			min_load = avg_load;
 			idlest = group;
+			idlest_fits = fits;
 		}
 	} while (group = group->next, group != sd->groups);
 
-	if (!idlest || 100*this_load < imbalance*min_load)
+	if (!idlest)
+		return NULL;
+
+	/* fitting the task comes before spreading the load */
+	if (idlest_fits != this_fits)
+		return idlest_fits ? idlest : NULL;
+
+	if (100*this_load < imbalance*min_load)
 		return NULL;
 	return idlest;
 }
@@ -4831,13 +4961,137 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 	return shallowest_idle_cpu != -1 ? shallowest_idle_cpu : least_loaded_cpu;
 }
 
+/*
+ * Keep the shared idle mask of @rq's cache domain up to date, from the
+ * idle class as the cpu starts and stops running its idle task.
+ */
+void update_idle_cpumask(struct rq *rq, bool idle)
+{
+	struct sched_domain_shared *sds;
+	int cpu = cpu_of(rq);
+
+	rcu_read_lock();
+	sds = rcu_dereference(per_cpu(sd_llc_shared, cpu));
+	/* test first, every cpu of the domain writes to the mask */
+	if (sds && cpumask_test_cpu(cpu, sds_idle_cpus(sds)) != idle) {
+		if (idle)
+			cpumask_set_cpu(cpu, sds_idle_cpus(sds));
+		else
+			cpumask_clear_cpu(cpu, sds_idle_cpus(sds));
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * The next cpu after @cpu set in both @idle and @allowed, wrapping around
+ * once so that the walk ends just before @start.
+ */
+static inline int sis_next_cpu(int cpu, const struct cpumask *idle,
+			       const struct cpumask *allowed, int start,
+			       bool *wrapped)
+{
+	int next = cpumask_next_and(cpu, idle, allowed);
+
+	if (!*wrapped && next >= nr_cpu_ids) {
+		*wrapped = true;
+		next = cpumask_next_and(-1, idle, allowed);
+	}
+	if (*wrapped && next >= start)
+		return nr_cpu_ids;
+	return next;
+}
+
+#ifdef CONFIG_SCHED_SMT
+static inline bool sis_core_idle(int cpu, const struct cpumask *idle)
+{
+	return cpumask_subset(cpu_smt_mask(cpu), idle);
+}
+#else
+static inline bool sis_core_idle(int cpu, const struct cpumask *idle)
+{
+	return true;
+}
+#endif
+
+/*
+ * Look for an idle cpu in the cache domain @sd of @target among the
+ * cpus its idle mask names, each one still checked with idle_cpu().
+ * A cpu whose SMT siblings are all idle too is taken at once, otherwise
+ * the first idle one found.  How many are looked at depends on how long
+ * this cpu is expected to stay idle, against what a scan costs.
+ */
+static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd,
+			   int target)
+{
+	struct sched_domain_shared *sds = sd->shared;
+	struct sched_domain *this_sd;
+	u64 avg_cost, avg_idle, span_avg;
+	u64 time;
+	struct cpumask *idle;
+	int cpu, found = -1, nr = INT_MAX, scanned = 0;
+	bool wrapped = false;
+
+	this_sd = rcu_dereference(*this_cpu_ptr(&sd_llc));
+	if (!sds || !this_sd)
+		return -1;
+
+	/*
+	 * Due to large variance we need a large fuzz factor; hackbench in
+	 * particularly is sensitive here.
+	 */
+	avg_idle = this_rq()->avg_idle / 512;
+	avg_cost = this_sd->avg_scan_cost + 1;
+
+	if (sched_feat(SIS_AVG_CPU) && avg_idle < avg_cost)
+		return -1;
+
+	if (sched_feat(SIS_PROP)) {
+		span_avg = sd->span_weight * avg_idle;
+		if (span_avg > 4 * avg_cost)
+			nr = div_u64(span_avg, avg_cost);
+		else
+			nr = 4;
+	}
+
+	idle = sds_idle_cpus(sds);
+	time = local_clock();
+
+	for (cpu = sis_next_cpu(target, idle, tsk_cpus_allowed(p), target,
+				&wrapped);
+	     cpu < nr_cpu_ids;
+	     cpu = sis_next_cpu(cpu, idle, tsk_cpus_allowed(p), target,
+				&wrapped)) {
+		if (scanned >= nr)
+			break;
+		scanned++;
+		if (!idle_cpu(cpu))
+			continue;
+		if (sis_core_idle(cpu, idle)) {
+			found = cpu;
+			break;
+		}
+		if (found < 0)
+			found = cpu;
+	}
+
+	time = local_clock() - time;
+	avg_cost = this_sd->avg_scan_cost;
+	this_sd->avg_scan_cost += (s64)(time - avg_cost) / 8;
+
+	schedstat_inc(this_rq(), sis_search);
+	schedstat_add(this_rq(), sis_scanned, scanned);
+	if (found < 0)
+		schedstat_inc(this_rq(), sis_failed);
+
+	return found;
+}
+
 /*
  * Try and locate an idle CPU in the sched_domain.
  */
 static int select_idle_sibling(struct task_struct *p, int target)
 {
 	struct sched_domain *sd;
-	struct sched_group *sg;
 	int i = task_cpu(p);
 
 	if (idle_cpu(target))
@@ -4849,30 +5103,14 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	if (i != target && cpus_share_cache(i, target) && idle_cpu(i))
 		return i;
 
-	/*
-	 * Otherwise, iterate the domains and find an elegible idle cpu.
-	 */
 	sd = rcu_dereference(per_cpu(sd_llc, target));
-	for_each_lower_domain(sd) {
-		sg = sd->groups;
-		do {
-			if (!cpumask_intersects(sched_group_cpus(sg),
-						tsk_cpus_allowed(p)))
-				goto next;
+	if (!sd)
+		return target;
 
-			for_each_cpu(i, sched_group_cpus(sg)) {
-				if (i == target || !idle_cpu(i))
-					goto next;
-			}
+	i = select_idle_cpu(p, sd, target);
+	if (i >= 0)
+		return i;
 
-			target = cpumask_first_and(sched_group_cpus(sg),
-					tsk_cpus_allowed(p));
-			goto done;
-next:
-			sg = sg->next;
-		} while (sg != sd->groups);
-	}
-done:
 	return target;
 }
 
@@ -4928,11 +5166,14 @@ select_task_rq_fair(struct task_struct *p, int prev_cpu, int sd_flag, int wake_f
 	struct sched_domain *tmp, *affine_sd = NULL, *sd = NULL;
 	int cpu = smp_processor_id();
 	int new_cpu = prev_cpu;
-	int want_affine = 0;
+	int want_affine = 0, want_cap = 0;
 	int sync = wake_flags & WF_SYNC;
 
-	if (sd_flag & SD_BALANCE_WAKE)
-		want_affine = !wake_wide(p) && cpumask_test_cpu(cpu, tsk_cpus_allowed(p));
+	if (sd_flag & SD_BALANCE_WAKE) {
+		want_cap = wake_cap(p, cpu, prev_cpu);
+		want_affine = !wake_wide(p) && !want_cap &&
+			      cpumask_test_cpu(cpu, tsk_cpus_allowed(p));
+	}
 
 	rcu_read_lock();
 	for_each_domain(cpu, tmp) {
@@ -4949,7 +5190,8 @@ select_task_rq_fair(struct task_struct *p, int prev_cpu, int sd_flag, int wake_f
 			break;
 		}
 
-		if (tmp->flags & sd_flag)
+		/* a task in want of a bigger cpu balances at any level */
+		if (tmp->flags & sd_flag || want_cap)
 			sd = tmp;
 		else if (!want_affine)
 			break;
@@ -4969,7 +5211,7 @@ select_task_rq_fair(struct task_struct *p, int prev_cpu, int sd_flag, int wake_f
 		struct sched_group *group;
 		int weight;
 
-		if (!(sd->flags & sd_flag)) {
+		if (!(sd->flags & sd_flag) && !want_cap) {
 			sd = sd->child;
 			continue;
 		}
@@ -4994,7 +5236,7 @@ select_task_rq_fair(struct task_struct *p, int prev_cpu, int sd_flag, int wake_f
 		for_each_domain(cpu, tmp) {
 			if (weight <= tmp->span_weight)
 				break;
-			if (tmp->flags & sd_flag)
+			if (tmp->flags & sd_flag || want_cap)
 				sd = tmp;
 		}
 		/* while loop will break here if sd == NULL */
@@ -5035,9 +5277,11 @@ static void task_dead_fair(struct task_struct *p)
 #endif /* CONFIG_SMP */
 
 static unsigned long
-wakeup_gran(struct sched_entity *curr, struct sched_entity *se)
+wakeup_gran(struct sched_entity *curr, struct sched_entity *se,
+	    int latency_nice)
 {
-	unsigned long gran = sysctl_sched_wakeup_granularity;
+	unsigned long gran = latency_scale(sysctl_sched_wakeup_granularity,
+					   latency_nice);
 
 	/*
 	 * Since its curr running now, convert the gran from real-time
@@ -5068,16 +5312,19 @@ wakeup_gran(struct sched_entity *curr, struct sched_entity *se)
  *  w(c, s2) =  0
  *  w(c, s3) =  1
  *
+ * @latency_nice scales g: how much lower the latency nice of 'se' is than
+ * that of 'curr'.
  */
 static int
-wakeup_preempt_entity(struct sched_entity *curr, struct sched_entity *se)
+wakeup_preempt_entity(struct sched_entity *curr, struct sched_entity *se,
+		      int latency_nice)
 {
 	s64 gran, vdiff = curr->vruntime - se->vruntime;
 
 	if (vdiff <= 0)
 		return -1;
 
-	gran = wakeup_gran(curr, se);
+	gran = wakeup_gran(curr, se, latency_nice);
 	if (vdiff > gran)
 		return 1;
 
@@ -5164,7 +5411,12 @@ static void check_preempt_wakeup(struct rq *rq, struct task_struct *p, int wake_
 	find_matching_se(&se, &pse);
 	update_curr(cfs_rq_of(se));
 	BUG_ON(!pse);
-	if (wakeup_preempt_entity(se, pse) == 1) {
+	/*
+	 * The latency nice of the tasks, not of the entities that compete:
+	 * groups don't have one.
+	 */
+	if (wakeup_preempt_entity(se, pse,
+				  p->latency_nice - curr->latency_nice) == 1) {
 		/*
 		 * Bias pick_next to pick the sched entity that is
 		 * triggering this preemption.
@@ -6108,6 +6360,8 @@ static void update_cpu_capacity(struct sched_domain *sd, int cpu)
 	struct sched_group *sdg = sd->groups;
 
 	cpu_rq(cpu)->cpu_capacity_orig = capacity;
+	if (capacity > READ_ONCE(cpu_rq(cpu)->rd->max_cpu_capacity))
+		WRITE_ONCE(cpu_rq(cpu)->rd->max_cpu_capacity, capacity);
 
 	capacity *= scale_rt_capacity(cpu);
 	capacity >>= SCHED_CAPACITY_SHIFT;
@@ -7327,7 +7581,8 @@ out:
 		this_rq->next_balance = next_balance;
 
 	/* Is there a task of a high priority class? */
-	if (this_rq->nr_running != this_rq->cfs.h_nr_running)
+	if (this_rq->nr_running !=
+	    this_rq->cfs.h_nr_running + bpf_nr_running(this_rq))
 		pulled_task = -1;
 
 	if (pulled_task) {
@@ -8270,7 +8525,11 @@ static unsigned int get_rr_interval_fair(struct rq *rq, struct task_struct *task
  * All the scheduling class methods:
  */
 const struct sched_class fair_sched_class = {
+#ifdef CONFIG_SCHED_BPF
+	.next			= &bpf_sched_class,
+#else
 	.next			= &idle_sched_class,
+#endif
 	.enqueue_task		= enqueue_task_fair,
 	.dequeue_task		= dequeue_task_fair,
 	.yield_task		= yield_task_fair,
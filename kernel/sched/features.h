@@ -64,6 +64,14 @@ SCHED_FEAT(TTWU_QUEUE, true)
 SCHED_FEAT(RT_PUSH_IPI, true)
 #endif
 
+/*
+ * Bound the idle cpu search of select_idle_sibling(): give up when this
+ * cpu's average idle time is shorter than an average scan (SIS_AVG_CPU),
+ * or scan a number of cpus in proportion to it (SIS_PROP).
+ */
+SCHED_FEAT(SIS_AVG_CPU, false)
+SCHED_FEAT(SIS_PROP, true)
+
 SCHED_FEAT(FORCE_SD_OVERLAP, false)
 SCHED_FEAT(RT_RUNTIME_SHARE, true)
 SCHED_FEAT(LB_MIN, false)
@@ -0,0 +1,386 @@
+/*
+ *  Housekeeping management: which cpus the routine kernel work that can
+ *  run anywhere goes to (unbound timers, workqueues and kthreads, RCU
+ *  callbacks, vmstat, kernel chosen irq affinity...), so that the cpus
+ *  isolated with nohz_full= or isolcpus= are left to their tasks.
+ *
+ *  The interruptions file in debugfs counts, per cpu, what still gets in
+ *  the way of those tasks, to verify the isolation holds.
+ */
+#include "sched.h"
+
+#include <linux/bootmem.h>
+#include <linux/ctype.h>
+#include <linux/debugfs.h>
+#include <linux/kernel_stat.h>
+#include <linux/sched/isolation.h>
+#include <linux/seq_file.h>
+#include <linux/tick.h>
+#include <linux/uaccess.h>
+
+#include <trace/events/irq.h>
+#include <trace/events/timer.h>
+#include <trace/events/workqueue.h>
+
+/* what nohz_full= (and isolcpus=nohz) takes off the cpus */
+#define HK_FLAG_NOHZ_FULL	(HK_FLAG_TICK | HK_FLAG_TIMER | HK_FLAG_RCU | \
+				 HK_FLAG_MISC | HK_FLAG_WQ | HK_FLAG_KTHREAD)
+
+static DEFINE_STATIC_KEY_FALSE(housekeeping_overridden);
+static cpumask_var_t housekeeping_mask;
+static unsigned int housekeeping_flags;
+
+int housekeeping_any_cpu(enum hk_flags flags)
+{
+	int cpu;
+
+	if (static_branch_unlikely(&housekeeping_overridden) &&
+	    (housekeeping_flags & flags)) {
+		cpu = cpumask_any_and(housekeeping_mask, cpu_online_mask);
+		if (cpu < nr_cpu_ids)
+			return cpu;
+	}
+	return smp_processor_id();
+}
+EXPORT_SYMBOL_GPL(housekeeping_any_cpu);
+
+const struct cpumask *housekeeping_cpumask(enum hk_flags flags)
+{
+	if (static_branch_unlikely(&housekeeping_overridden) &&
+	    (housekeeping_flags & flags))
+		return housekeeping_mask;
+	return cpu_possible_mask;
+}
+EXPORT_SYMBOL_GPL(housekeeping_cpumask);
+
+void housekeeping_affine(struct task_struct *t, enum hk_flags flags)
+{
+	if (static_branch_unlikely(&housekeeping_overridden) &&
+	    (housekeeping_flags & flags))
+		set_cpus_allowed_ptr(t, housekeeping_mask);
+}
+EXPORT_SYMBOL_GPL(housekeeping_affine);
+
+bool housekeeping_test_cpu(int cpu, enum hk_flags flags)
+{
+	if (static_branch_unlikely(&housekeeping_overridden) &&
+	    (housekeeping_flags & flags))
+		return cpumask_test_cpu(cpu, housekeeping_mask);
+	return true;
+}
+EXPORT_SYMBOL_GPL(housekeeping_test_cpu);
+
+void __init housekeeping_init(void)
+{
+#ifdef CONFIG_NO_HZ_FULL_ALL
+	/* no nohz_full=: the tick code made all cpus but the boot one nohz */
+	if (!housekeeping_flags && tick_nohz_full_running) {
+		if (!alloc_cpumask_var(&housekeeping_mask, GFP_KERNEL)) {
+			WARN(1, "Housekeeping: can't allocate cpumask\n");
+			return;
+		}
+		cpumask_andnot(housekeeping_mask, cpu_possible_mask,
+			       tick_nohz_full_mask);
+		housekeeping_flags = HK_FLAG_NOHZ_FULL;
+	}
+#endif
+	if (!housekeeping_flags)
+		return;
+
+	static_branch_enable(&housekeeping_overridden);
+
+	pr_info("Housekeeping: CPUs: %*pbl.\n",
+		cpumask_pr_args(housekeeping_mask));
+
+	/* We need at least one CPU to handle housekeeping work */
+	WARN_ON_ONCE(cpumask_empty(housekeeping_mask));
+}
+
+static int __init housekeeping_setup(char *str, unsigned int flags)
+{
+	cpumask_var_t non_housekeeping_mask;
+
+	alloc_bootmem_cpumask_var(&non_housekeeping_mask);
+	if (cpulist_parse(str, non_housekeeping_mask) < 0) {
+		pr_warn("Housekeeping: nohz_full= or isolcpus= incorrect CPU range\n");
+		free_bootmem_cpumask_var(non_housekeeping_mask);
+		return 0;
+	}
+
+	if (!housekeeping_flags) {
+		alloc_bootmem_cpumask_var(&housekeeping_mask);
+		cpumask_andnot(housekeeping_mask,
+			       cpu_possible_mask, non_housekeeping_mask);
+		if (cpumask_empty(housekeeping_mask))
+			cpumask_set_cpu(smp_processor_id(), housekeeping_mask);
+	} else {
+		cpumask_var_t tmp;
+
+		alloc_bootmem_cpumask_var(&tmp);
+		cpumask_andnot(tmp, cpu_possible_mask, non_housekeeping_mask);
+		if (!cpumask_equal(tmp, housekeeping_mask)) {
+			pr_warn("Housekeeping: nohz_full= must match isolcpus=\n");
+			free_bootmem_cpumask_var(tmp);
+			free_bootmem_cpumask_var(non_housekeeping_mask);
+			return 0;
+		}
+		free_bootmem_cpumask_var(tmp);
+	}
+
+	if ((flags & HK_FLAG_TICK) && !(housekeeping_flags & HK_FLAG_TICK)) {
+#ifdef CONFIG_NO_HZ_FULL
+		tick_nohz_full_setup(non_housekeeping_mask);
+#else
+		pr_warn("Housekeeping: nohz unsupported. Build with CONFIG_NO_HZ_FULL\n");
+		free_bootmem_cpumask_var(non_housekeeping_mask);
+		return 0;
+#endif
+	}
+
+	/* the scheduler domains code keeps its own mask */
+	if ((flags & HK_FLAG_DOMAIN) && !(housekeeping_flags & HK_FLAG_DOMAIN)) {
+		alloc_bootmem_cpumask_var(&cpu_isolated_map);
+		cpumask_copy(cpu_isolated_map, non_housekeeping_mask);
+	}
+
+	housekeeping_flags |= flags;
+
+	free_bootmem_cpumask_var(non_housekeeping_mask);
+
+	return 1;
+}
+
+static int __init housekeeping_nohz_full_setup(char *str)
+{
+	return housekeeping_setup(str, HK_FLAG_NOHZ_FULL);
+}
+__setup("nohz_full=", housekeeping_nohz_full_setup);
+
+static const struct {
+	const char	*name;
+	unsigned int	flags;
+} isolcpus_flags[] __initconst = {
+	{ "nohz",		HK_FLAG_NOHZ_FULL },
+	{ "domain",		HK_FLAG_DOMAIN },
+	{ "managed_irq",	HK_FLAG_MANAGED_IRQ },
+	{ "timer",		HK_FLAG_TIMER },
+	{ "rcu",		HK_FLAG_RCU },
+	{ "misc",		HK_FLAG_MISC },
+	{ "wq",			HK_FLAG_WQ },
+	{ "kthread",		HK_FLAG_KTHREAD },
+};
+
+/*
+ * isolcpus=[flag,...,]<cpu list>: which of the flags above to apply to
+ * the cpus of the list, domain (no load balancing) if none is given.
+ */
+static int __init housekeeping_isolcpus_setup(char *str)
+{
+	unsigned int flags = 0;
+	size_t len;
+	int i;
+
+	while (isalpha(*str)) {
+		len = strcspn(str, ",");
+		for (i = 0; i < ARRAY_SIZE(isolcpus_flags); i++) {
+			if (strlen(isolcpus_flags[i].name) == len &&
+			    !strncmp(str, isolcpus_flags[i].name, len))
+				break;
+		}
+		if (i == ARRAY_SIZE(isolcpus_flags) || str[len] != ',') {
+			pr_warn("isolcpus: Error, unknown flag %.*s\n",
+				(int)len, str);
+			return 0;
+		}
+		flags |= isolcpus_flags[i].flags;
+		str += len + 1;
+	}
+
+	if (!flags)
+		flags = HK_FLAG_DOMAIN;
+
+	return housekeeping_setup(str, flags);
+}
+__setup("isolcpus=", housekeeping_isolcpus_setup);
+
+#ifdef CONFIG_DEBUG_FS
+
+#ifndef arch_irq_stat_cpu
+#define arch_irq_stat_cpu(cpu) 0
+#endif
+
+/*
+ * The interruptions of each cpu since counting was started, by writing
+ * 1 to the interruptions file; writing 0 stops it.  Hard interrupts
+ * come from the irq statistics, IPIs included where the arch counts
+ * them, the rest from probes on the irq, timer and workqueue
+ * tracepoints.
+ */
+struct isolation_stats {
+	u64		irqs_start;
+	u64		irqs_stop;
+	unsigned long	softirqs;
+	unsigned long	timers;
+	unsigned long	hrtimers;
+	unsigned long	works;
+};
+
+static DEFINE_PER_CPU(struct isolation_stats, isolation_stats);
+static DEFINE_MUTEX(isolation_stats_mutex);
+static bool isolation_stats_on;
+
+static u64 isolation_irqs(int cpu)
+{
+	return kstat_cpu_irqs_sum(cpu) + arch_irq_stat_cpu(cpu);
+}
+
+static void isolation_probe_softirq(void *data, unsigned int vec_nr)
+{
+	this_cpu_inc(isolation_stats.softirqs);
+}
+
+static void isolation_probe_timer(void *data, struct timer_list *timer)
+{
+	this_cpu_inc(isolation_stats.timers);
+}
+
+static void isolation_probe_hrtimer(void *data, struct hrtimer *hrtimer,
+				    ktime_t *now)
+{
+	this_cpu_inc(isolation_stats.hrtimers);
+}
+
+static void isolation_probe_work(void *data, struct work_struct *work)
+{
+	this_cpu_inc(isolation_stats.works);
+}
+
+static void isolation_stats_unregister(void)
+{
+	unregister_trace_workqueue_execute_start(isolation_probe_work, NULL);
+	unregister_trace_hrtimer_expire_entry(isolation_probe_hrtimer, NULL);
+	unregister_trace_timer_expire_entry(isolation_probe_timer, NULL);
+	unregister_trace_softirq_entry(isolation_probe_softirq, NULL);
+	tracepoint_synchronize_unregister();
+}
+
+static int isolation_stats_start(void)
+{
+	int cpu, ret;
+
+	for_each_possible_cpu(cpu) {
+		struct isolation_stats *stats = &per_cpu(isolation_stats, cpu);
+
+		memset(stats, 0, sizeof(*stats));
+		stats->irqs_start = isolation_irqs(cpu);
+	}
+
+	ret = register_trace_softirq_entry(isolation_probe_softirq, NULL);
+	if (!ret)
+		ret = register_trace_timer_expire_entry(isolation_probe_timer,
+							NULL);
+	if (!ret)
+		ret = register_trace_hrtimer_expire_entry(isolation_probe_hrtimer,
+							  NULL);
+	if (!ret)
+		ret = register_trace_workqueue_execute_start(isolation_probe_work,
+							     NULL);
+	if (ret) {
+		/* unregistering what was not registered is harmless */
+		isolation_stats_unregister();
+		return ret;
+	}
+
+	isolation_stats_on = true;
+	return 0;
+}
+
+static void isolation_stats_stop(void)
+{
+	int cpu;
+
+	isolation_stats_unregister();
+
+	for_each_possible_cpu(cpu)
+		per_cpu(isolation_stats, cpu).irqs_stop = isolation_irqs(cpu);
+
+	isolation_stats_on = false;
+}
+
+static int isolation_stats_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	mutex_lock(&isolation_stats_mutex);
+	seq_printf(m, "%-5s %-8s %12s %12s %12s %12s %12s\n", "cpu",
+		   "isolated", "irqs", "softirqs", "timers", "hrtimers",
+		   "works");
+	for_each_online_cpu(cpu) {
+		struct isolation_stats *stats = &per_cpu(isolation_stats, cpu);
+		u64 irqs = isolation_stats_on ? isolation_irqs(cpu) :
+						stats->irqs_stop;
+
+		seq_printf(m, "%-5d %-8d %12llu %12lu %12lu %12lu %12lu\n", cpu,
+			   !housekeeping_test_cpu(cpu, HK_FLAG_NOHZ_FULL |
+						  HK_FLAG_DOMAIN |
+						  HK_FLAG_MANAGED_IRQ),
+			   irqs - stats->irqs_start,
+			   READ_ONCE(stats->softirqs),
+			   READ_ONCE(stats->timers),
+			   READ_ONCE(stats->hrtimers),
+			   READ_ONCE(stats->works));
+	}
+	mutex_unlock(&isolation_stats_mutex);
+
+	return 0;
+}
+
+static int isolation_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, isolation_stats_show, NULL);
+}
+
+static ssize_t isolation_stats_write(struct file *file,
+				     const char __user *ubuf,
+				     size_t cnt, loff_t *ppos)
+{
+	unsigned int on;
+	int ret;
+
+	ret = kstrtouint_from_user(ubuf, cnt, 10, &on);
+	if (ret)
+		return ret;
+
+	mutex_lock(&isolation_stats_mutex);
+	if (on && !isolation_stats_on)
+		ret = isolation_stats_start();
+	else if (!on && isolation_stats_on)
+		isolation_stats_stop();
+	mutex_unlock(&isolation_stats_mutex);
+
+	return ret ? ret : cnt;
+}
+
+static const struct file_operations isolation_stats_fops = {
+	.open		= isolation_stats_open,
+	.read		= seq_read,
+	.write		= isolation_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static __init int isolation_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("isolation", NULL);
+	if (!dir)
+		return -ENOMEM;
+
+	debugfs_create_file("interruptions", 0644, dir, NULL,
+			    &isolation_stats_fops);
+	return 0;
+}
+late_initcall(isolation_debugfs_init);
+
+#endif /* CONFIG_DEBUG_FS */
@@ -3,6 +3,7 @@
 #include <linux/sched/sysctl.h>
 #include <linux/sched/rt.h>
 #include <linux/sched/deadline.h>
+#include <linux/sched/isolation.h>
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/stop_machine.h>
@@ -102,10 +103,16 @@ static inline int dl_policy(int policy)
 {
 	return policy == SCHED_DEADLINE;
 }
+
+static inline int bpf_policy(int policy)
+{
+	return IS_ENABLED(CONFIG_SCHED_BPF) && policy == SCHED_BPF;
+}
+
 static inline bool valid_policy(int policy)
 {
 	return idle_policy(policy) || fair_policy(policy) ||
-		rt_policy(policy) || dl_policy(policy);
+		rt_policy(policy) || dl_policy(policy) || bpf_policy(policy);
 }
 
 static inline int task_has_rt_policy(struct task_struct *p)
@@ -223,16 +230,19 @@ struct cfs_bandwidth {
 	raw_spinlock_t lock;
 	ktime_t period;
 	u64 quota, runtime;
+	/* unused quota carried over periods, runtime is at most quota + burst */
+	u64 burst, runtime_snap;
 	s64 hierarchical_quota;
 	u64 runtime_expires;
 
 	int idle, period_active;
+	bool slack_started;
 	struct hrtimer period_timer, slack_timer;
 	struct list_head throttled_cfs_rq;
 
 	/* statistics */
-	int nr_periods, nr_throttled;
-	u64 throttled_time;
+	int nr_periods, nr_throttled, nr_bursts;
+	u64 throttled_time, burst_time;
 #endif
 };
 
@@ -269,6 +279,15 @@ struct task_group {
 #ifdef CONFIG_SCHED_AUTOGROUP
 	struct autogroup *autogroup;
 #endif
+#ifdef CONFIG_SCHED_CORE
+	/* cpu.tag: the tasks of the group, and below, share a cookie */
+	int core_tagged;
+#endif
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	/* cpu.uclamp.{min,max}, and those restricted by the parent's */
+	struct uclamp_se uclamp_req[UCLAMP_CNT];
+	struct uclamp_se uclamp[UCLAMP_CNT];
+#endif
 
 	struct cfs_bandwidth cfs_bandwidth;
 };
@@ -508,6 +527,42 @@ struct dl_rq {
 #endif
 };
 
+#ifdef CONFIG_SCHED_BPF
+/* BPF-programmable class' related fields in a runqueue */
+struct bpf_rq {
+	/* queued tasks ordered by the key their program handed out */
+	struct rb_root		queue;
+	struct rb_node		*leftmost;
+	struct list_head	fifo;
+	unsigned int		nr_running;
+	u64			seq;
+	/* ticks of SCHED_BPF execution, the watchdog's clock */
+	unsigned long		ticks;
+};
+#endif
+
+#ifdef CONFIG_UCLAMP_TASK
+/*
+ * The runnable tasks of a rq whose clamp falls in a bucket, and the
+ * largest of their clamps since the bucket was last empty.
+ */
+struct uclamp_bucket {
+	unsigned long value : SCHED_CAPACITY_SHIFT + 1;
+	unsigned long tasks : BITS_PER_LONG - SCHED_CAPACITY_SHIFT - 1;
+};
+
+/*
+ * The clamp of a rq is the max of the clamps of its runnable tasks: a
+ * task asking for more performance gets it, one asking for less only
+ * does if the others on the cpu ask for no more.
+ */
+struct uclamp_rq {
+	unsigned int value;
+	unsigned int tasks;
+	struct uclamp_bucket bucket[UCLAMP_BUCKETS];
+};
+#endif
+
 #ifdef CONFIG_SMP
 
 /*
@@ -543,6 +598,9 @@ struct root_domain {
 	 */
 	cpumask_var_t rto_mask;
 	struct cpupri cpupri;
+
+	/* the capacity_orig of the biggest cpu of the domain */
+	unsigned long max_cpu_capacity;
 };
 
 extern struct root_domain def_root_domain;
@@ -587,6 +645,12 @@ struct rq {
 	struct cfs_rq cfs;
 	struct rt_rq rt;
 	struct dl_rq dl;
+#ifdef CONFIG_SCHED_BPF
+	struct bpf_rq bpf;
+#endif
+#ifdef CONFIG_UCLAMP_TASK
+	struct uclamp_rq uclamp[UCLAMP_CNT];
+#endif
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	/* list of leaf cfs_rq on this cpu: */
@@ -605,6 +669,19 @@ struct rq {
 	unsigned long next_balance;
 	struct mm_struct *prev_mm;
 
+#ifdef CONFIG_SCHED_CORE
+	/*
+	 * What this cpu committed to run, as seen by its SMT siblings;
+	 * all of it is protected by the core_lock of every sibling.
+	 */
+	raw_spinlock_t core_lock;
+	unsigned long core_cookie;
+	u64 core_since;			/* rq_clock() core_cookie started */
+	unsigned long core_wait_cookie;	/* the cookie forced idle for */
+	bool core_running;
+	bool core_waiting;
+#endif
+
 	unsigned int clock_skip_update;
 	u64 clock;
 	u64 clock_task;
@@ -678,6 +755,11 @@ struct rq {
 	/* try_to_wake_up() stats */
 	unsigned int ttwu_count;
 	unsigned int ttwu_local;
+
+	/* select_idle_sibling() stats */
+	unsigned int sis_search;
+	unsigned int sis_scanned;
+	unsigned int sis_failed;
 #endif
 
 #ifdef CONFIG_SMP
@@ -833,6 +915,7 @@ static inline struct sched_domain *lowest_flag_domain(int cpu, int flag)
 DECLARE_PER_CPU(struct sched_domain *, sd_llc);
 DECLARE_PER_CPU(int, sd_llc_size);
 DECLARE_PER_CPU(int, sd_llc_id);
+DECLARE_PER_CPU(struct sched_domain_shared *, sd_llc_shared);
 DECLARE_PER_CPU(struct sched_domain *, sd_numa);
 DECLARE_PER_CPU(struct sched_domain *, sd_busy);
 DECLARE_PER_CPU(struct sched_domain *, sd_asym);
@@ -1009,6 +1092,20 @@ extern struct static_key sched_feat_keys[__SCHED_FEAT_NR];
 
 extern struct static_key_false sched_numa_balancing;
 
+#ifdef CONFIG_SCHED_CORE
+extern struct static_key_false sched_core_key;
+
+static inline bool sched_core_enabled(void)
+{
+	return static_branch_unlikely(&sched_core_key);
+}
+#else
+static inline bool sched_core_enabled(void)
+{
+	return false;
+}
+#endif
+
 static inline u64 global_rt_period(void)
 {
 	return (u64)sysctl_sched_rt_period * NSEC_PER_USEC;
@@ -1243,6 +1340,7 @@ extern const struct sched_class stop_sched_class;
 extern const struct sched_class dl_sched_class;
 extern const struct sched_class rt_sched_class;
 extern const struct sched_class fair_sched_class;
+extern const struct sched_class bpf_sched_class;
 extern const struct sched_class idle_sched_class;
 
 
@@ -1254,6 +1352,7 @@ extern void trigger_load_balance(struct rq *rq);
 
 extern void idle_enter_fair(struct rq *this_rq);
 extern void idle_exit_fair(struct rq *this_rq);
+extern void update_idle_cpumask(struct rq *rq, bool idle);
 
 extern void set_cpus_allowed_common(struct task_struct *p, const struct cpumask *new_mask);
 
@@ -1261,6 +1360,7 @@ extern void set_cpus_allowed_common(struct task_struct *p, const struct cpumask
 
 static inline void idle_enter_fair(struct rq *rq) { }
 static inline void idle_exit_fair(struct rq *rq) { }
+static inline void update_idle_cpumask(struct rq *rq, bool idle) { }
 
 #endif
 
@@ -1709,6 +1809,44 @@ print_numa_stats(struct seq_file *m, int node, unsigned long tsf,
 extern void init_cfs_rq(struct cfs_rq *cfs_rq);
 extern void init_rt_rq(struct rt_rq *rt_rq);
 extern void init_dl_rq(struct dl_rq *dl_rq);
+#ifdef CONFIG_SCHED_BPF
+extern void init_bpf_rq(struct bpf_rq *bpf_rq);
+extern bool sched_bpf_enabled(void);
+
+static inline unsigned int bpf_nr_running(struct rq *rq)
+{
+	return rq->bpf.nr_running;
+}
+#else
+static inline bool sched_bpf_enabled(void)
+{
+	return false;
+}
+
+static inline unsigned int bpf_nr_running(struct rq *rq)
+{
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_UCLAMP_TASK
+extern unsigned int uclamp_eff_value(struct task_struct *p,
+				     enum uclamp_id clamp_id);
+
+/* the utilization of @p, within its clamps */
+static inline unsigned long uclamp_task_util(struct task_struct *p,
+					     unsigned long util)
+{
+	return clamp(util, (unsigned long)uclamp_eff_value(p, UCLAMP_MIN),
+		     (unsigned long)uclamp_eff_value(p, UCLAMP_MAX));
+}
+#else
+static inline unsigned long uclamp_task_util(struct task_struct *p,
+					     unsigned long util)
+{
+	return util;
+}
+#endif
 
 extern void cfs_bandwidth_usage_inc(void);
 extern void cfs_bandwidth_usage_dec(void);
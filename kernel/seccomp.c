@@ -41,8 +41,10 @@
  *         outside of a lifetime-guarded section.  In general, this
  *         is only needed for handling filters shared across tasks.
  * @prev: points to a previously installed, or inherited, filter
- * @len: the number of instructions in the program
- * @insnsi: the BPF program instructions to evaluate
+ * @prog: the BPF program to evaluate
+ * @cache_arch: the audit arch @cache_allow is good for
+ * @cache_allow: syscalls this filter and all before it allow whatever
+ *               their arguments, so that they need not be run for them
  *
  * seccomp_filter objects are organized in a tree linked via the @prev
  * pointer.  For any task, it appears to be a singly-linked list starting
@@ -54,10 +56,14 @@
  * seccomp_filter objects should never be modified after being attached
  * to a task_struct (other than @usage).
  */
+#define SECCOMP_CACHE_NR	512
+
 struct seccomp_filter {
 	atomic_t usage;
 	struct seccomp_filter *prev;
 	struct bpf_prog *prog;
+	u32 cache_arch;
+	DECLARE_BITMAP(cache_allow, SECCOMP_CACHE_NR);
 };
 
 /* Limit any path through the tree to 256KB worth of instructions. */
@@ -167,6 +173,102 @@ static int seccomp_check_filter(struct sock_filter *filter, unsigned int flen)
 	return 0;
 }
 
+/**
+ * seccomp_is_const_allow - does a filter allow a syscall whatever its args?
+ * @fprog: the filter as userspace passed it in
+ * @sd: seccomp data with only nr and arch filled in
+ *
+ * Emulates the filter as long as it only looks at the syscall number and
+ * the arch: true means it got to SECCOMP_RET_ALLOW that way.  Anything
+ * else, including loads of the arguments, gives up.  The program has
+ * been checked, so jumps stay within it.
+ */
+static bool seccomp_is_const_allow(struct sock_fprog_kern *fprog,
+				   struct seccomp_data *sd)
+{
+	unsigned int pc;
+	u32 a = 0;
+	bool taken;
+
+	for (pc = 0; pc < fprog->len; pc++) {
+		struct sock_filter *insn = &fprog->filter[pc];
+		u32 k = insn->k;
+
+		switch (insn->code) {
+		case BPF_LD | BPF_W | BPF_ABS:
+			if (k == offsetof(struct seccomp_data, nr))
+				a = sd->nr;
+			else if (k == offsetof(struct seccomp_data, arch))
+				a = sd->arch;
+			else
+				return false;
+			break;
+		case BPF_ALU | BPF_AND | BPF_K:
+			a &= k;
+			break;
+		case BPF_RET | BPF_K:
+			return (k & SECCOMP_RET_ACTION) == SECCOMP_RET_ALLOW;
+		case BPF_JMP | BPF_JA:
+			pc += k;
+			break;
+		case BPF_JMP | BPF_JEQ | BPF_K:
+		case BPF_JMP | BPF_JGE | BPF_K:
+		case BPF_JMP | BPF_JGT | BPF_K:
+		case BPF_JMP | BPF_JSET | BPF_K:
+			switch (BPF_OP(insn->code)) {
+			case BPF_JEQ:
+				taken = a == k;
+				break;
+			case BPF_JGE:
+				taken = a >= k;
+				break;
+			case BPF_JGT:
+				taken = a > k;
+				break;
+			default:
+				taken = a & k;
+				break;
+			}
+			pc += taken ? insn->jt : insn->jf;
+			break;
+		default:
+			return false;
+		}
+	}
+	return false;
+}
+
+/**
+ * seccomp_cache_prepare - find the syscalls a new filter always allows
+ * @sfilter: filter not attached yet, with its original program saved
+ *
+ * Only done for the arch of the current task. The result is merged with
+ * the previous filter's in seccomp_attach_filter().
+ */
+static void seccomp_cache_prepare(struct seccomp_filter *sfilter)
+{
+	struct sock_fprog_kern *fprog = sfilter->prog->orig_prog;
+	struct seccomp_data sd = { .arch = syscall_get_arch() };
+	int nr;
+
+	sfilter->cache_arch = sd.arch;
+	for (nr = 0; nr < SECCOMP_CACHE_NR; nr++) {
+		sd.nr = nr;
+		if (seccomp_is_const_allow(fprog, &sd))
+			__set_bit(nr, sfilter->cache_allow);
+	}
+}
+
+static inline bool seccomp_cache_allow(const struct seccomp_filter *f,
+				       const struct seccomp_data *sd)
+{
+	if (unlikely(sd->arch != f->cache_arch))
+		return false;
+	if (unlikely(sd->nr < 0 || sd->nr >= SECCOMP_CACHE_NR))
+		return false;
+	return test_bit(sd->nr, f->cache_allow);
+}
+
 /**
  * seccomp_run_filters - evaluates all seccomp filters against @syscall
  * @syscall: number of the current system call
@@ -190,6 +292,10 @@ static u32 seccomp_run_filters(struct seccomp_data *sd)
 		sd = &sd_local;
 	}
 
+	/* The newest filter knows the syscalls none of them looks into */
+	if (seccomp_cache_allow(f, sd))
+		return SECCOMP_RET_ALLOW;
+
 	/*
 	 * All filters in the list are evaluated and the lowest BPF return
 	 * value always takes priority (ignoring the DATA).
@@ -347,7 +453,6 @@ static struct seccomp_filter *seccomp_prepare_filter(struct sock_fprog *fprog)
 {
 	struct seccomp_filter *sfilter;
 	int ret;
-	const bool save_orig = config_enabled(CONFIG_CHECKPOINT_RESTORE);
 
 	if (fprog->len == 0 || fprog->len > BPF_MAXINSNS)
 		return ERR_PTR(-EINVAL);
@@ -370,13 +475,24 @@ static struct seccomp_filter *seccomp_prepare_filter(struct sock_fprog *fprog)
 	if (!sfilter)
 		return ERR_PTR(-ENOMEM);
 
+	/*
+	 * The original program is needed to build the cache, and has to be
+	 * the copy that was checked and translated.
+	 */
 	ret = bpf_prog_create_from_user(&sfilter->prog, fprog,
-					seccomp_check_filter, save_orig);
+					seccomp_check_filter, true);
 	if (ret < 0) {
 		kfree(sfilter);
 		return ERR_PTR(ret);
 	}
 
+	seccomp_cache_prepare(sfilter);
+	if (!config_enabled(CONFIG_CHECKPOINT_RESTORE)) {
+		kfree(sfilter->prog->orig_prog->filter);
+		kfree(sfilter->prog->orig_prog);
+		sfilter->prog->orig_prog = NULL;
+	}
+
 	atomic_set(&sfilter->usage, 1);
 
 	return sfilter;
@@ -448,6 +564,14 @@ static long seccomp_attach_filter(unsigned int flags,
 	 * task reference.
 	 */
 	filter->prev = current->seccomp.filter;
+	if (filter->prev) {
+		/* A syscall is only cached as allowed if all filters allow it */
+		if (filter->prev->cache_arch == filter->cache_arch)
+			bitmap_and(filter->cache_allow, filter->cache_allow,
+				   filter->prev->cache_allow, SECCOMP_CACHE_NR);
+		else
+			bitmap_zero(filter->cache_allow, SECCOMP_CACHE_NR);
+	}
 	current->seccomp.filter = filter;
 
 	/* Now that the new filter is in place, synchronize to all threads. */
@@ -56,12 +56,55 @@ EXPORT_SYMBOL(irq_stat);
 static struct softirq_action softirq_vec[NR_SOFTIRQS] __cacheline_aligned_in_smp;
 
 DEFINE_PER_CPU(struct task_struct *, ksoftirqd);
+DEFINE_PER_CPU(struct task_struct *, ksoftirqt);
 
 const char * const softirq_to_name[NR_SOFTIRQS] = {
 	"HI", "TIMER", "NET_TX", "NET_RX", "BLOCK", "BLOCK_IOPOLL",
 	"TASKLET", "SCHED", "HRTIMER", "RCU"
 };
 
+/*
+ * The vectors listed in softirq_threaded= never run in the context they
+ * happen to interrupt.  They are always handed to the per-cpu ksoftirqt
+ * thread, which is their only executor and so can be given its own
+ * priority and cgroup, and is charged for the time they take.
+ */
+static __u32 softirq_threaded_mask __read_mostly;
+
+static int __init softirq_threaded_setup(char *str)
+{
+	char *name;
+	int nr;
+
+	while ((name = strsep(&str, ",")) != NULL) {
+		for (nr = 0; nr < NR_SOFTIRQS; nr++)
+			if (!strcasecmp(name, softirq_to_name[nr]))
+				break;
+		if (nr == NR_SOFTIRQS) {
+			pr_warn("unknown softirq \"%s\" in softirq_threaded=\n",
+				name);
+			continue;
+		}
+		softirq_threaded_mask |= 1U << nr;
+	}
+	return 1;
+}
+__setup("softirq_threaded=", softirq_threaded_setup);
+
+/* the vectors this cpu hands to ksoftirqt, none until it is up */
+static inline __u32 softirq_threaded(void)
+{
+	return __this_cpu_read(ksoftirqt) ? softirq_threaded_mask : 0;
+}
+
+/* the vectors the current context may run */
+static inline __u32 softirq_run_mask(void)
+{
+	if (current == __this_cpu_read(ksoftirqt))
+		return softirq_threaded_mask;
+	return ~softirq_threaded();
+}
+
 /*
  * we cannot loop indefinitely here to avoid userspace starvation,
  * but we also don't want to introduce a worst case 1/HZ latency
@@ -77,6 +120,25 @@ static void wakeup_softirqd(void)
 		wake_up_process(tsk);
 }
 
+static void wakeup_softirqt(void)
+{
+	struct task_struct *tsk = __this_cpu_read(ksoftirqt);
+
+	if (tsk && tsk->state != TASK_RUNNING)
+		wake_up_process(tsk);
+}
+
+/* hand the vectors in @pending to the threads running them */
+static void wakeup_softirq_threads(__u32 pending)
+{
+	__u32 threaded = softirq_threaded();
+
+	if (pending & ~threaded)
+		wakeup_softirqd();
+	if (pending & threaded)
+		wakeup_softirqt();
+}
+
 /*
  * preempt_count and SOFTIRQ_OFFSET usage:
  * - preempt_count is changed by SOFTIRQ_OFFSET on entering or leaving
@@ -234,6 +296,7 @@ asmlinkage __visible void __do_softirq(void)
 	int max_restart = MAX_SOFTIRQ_RESTART;
 	struct softirq_action *h;
 	bool in_hardirq;
+	__u32 mask = softirq_run_mask();
 	__u32 pending;
 	int softirq_bit;
 
@@ -244,7 +307,7 @@ asmlinkage __visible void __do_softirq(void)
 	 */
 	current->flags &= ~PF_MEMALLOC;
 
-	pending = local_softirq_pending();
+	pending = local_softirq_pending() & mask;
 	account_irq_enter_time(current);
 
 	__local_bh_disable_ip(_RET_IP_, SOFTIRQ_OFFSET);
@@ -252,7 +315,7 @@ asmlinkage __visible void __do_softirq(void)
 
 restart:
 	/* Reset the pending bitmask before enabling irqs */
-	set_softirq_pending(0);
+	set_softirq_pending(local_softirq_pending() & ~mask);
 
 	local_irq_enable();
 
@@ -287,11 +350,13 @@ restart:
 
 	pending = local_softirq_pending();
 	if (pending) {
-		if (time_before(jiffies, end) && !need_resched() &&
-		    --max_restart)
+		if ((pending & mask) && time_before(jiffies, end) &&
+		    !need_resched() && --max_restart) {
+			pending &= mask;
 			goto restart;
+		}
 
-		wakeup_softirqd();
+		wakeup_softirq_threads(pending);
 	}
 
 	lockdep_softirq_end(in_hardirq);
@@ -313,8 +378,10 @@ asmlinkage __visible void do_softirq(void)
 
 	pending = local_softirq_pending();
 
-	if (pending)
+	if (pending & softirq_run_mask())
 		do_softirq_own_stack();
+	else if (pending)
+		wakeup_softirq_threads(pending);
 
 	local_irq_restore(flags);
 }
@@ -340,7 +407,9 @@ void irq_enter(void)
 
 static inline void invoke_softirq(void)
 {
-	if (!force_irqthreads) {
+	__u32 pending = local_softirq_pending();
+
+	if (!force_irqthreads && (pending & softirq_run_mask())) {
 #ifdef CONFIG_HAVE_IRQ_EXIT_ON_IRQ_STACK
 		/*
 		 * We can safely execute softirq on the current stack if
@@ -357,7 +426,7 @@ static inline void invoke_softirq(void)
 		do_softirq_own_stack();
 #endif
 	} else {
-		wakeup_softirqd();
+		wakeup_softirq_threads(pending);
 	}
 }
 
@@ -408,11 +477,11 @@ inline void raise_softirq_irqoff(unsigned int nr)
 	 * actually run the softirq once we return from
 	 * the irq or softirq.
 	 *
-	 * Otherwise we wake up ksoftirqd to make sure we
-	 * schedule the softirq soon.
+	 * Otherwise we wake up ksoftirqd or ksoftirqt to make sure
+	 * we schedule the softirq soon.
 	 */
 	if (!in_interrupt())
-		wakeup_softirqd();
+		wakeup_softirq_threads(1U << nr);
 }
 
 void raise_softirq(unsigned int nr)
@@ -648,7 +717,12 @@ void __init softirq_init(void)
 
 static int ksoftirqd_should_run(unsigned int cpu)
 {
-	return local_softirq_pending();
+	return local_softirq_pending() & ~softirq_threaded();
+}
+
+static int ksoftirqt_should_run(unsigned int cpu)
+{
+	return local_softirq_pending() & softirq_threaded_mask;
 }
 
 static void run_ksoftirqd(unsigned int cpu)
@@ -751,11 +825,20 @@ static struct smp_hotplug_thread softirq_threads = {
 	.thread_comm		= "ksoftirqd/%u",
 };
 
+static struct smp_hotplug_thread softirq_threaded_threads = {
+	.store			= &ksoftirqt,
+	.thread_should_run	= ksoftirqt_should_run,
+	.thread_fn		= run_ksoftirqd,
+	.thread_comm		= "ksoftirqt/%u",
+};
+
 static __init int spawn_ksoftirqd(void)
 {
 	register_cpu_notifier(&cpu_nfb);
 
 	BUG_ON(smpboot_register_percpu_thread(&softirq_threads));
+	if (softirq_threaded_mask)
+		BUG_ON(smpboot_register_percpu_thread(&softirq_threaded_threads));
 
 	return 0;
 }
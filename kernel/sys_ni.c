@@ -60,6 +60,7 @@ cond_syscall(compat_sys_recvmmsg);
 cond_syscall(sys_socketcall);
 cond_syscall(sys_futex);
 cond_syscall(compat_sys_futex);
+cond_syscall(sys_futex_waitv);
 cond_syscall(sys_set_robust_list);
 cond_syscall(compat_sys_set_robust_list);
 cond_syscall(sys_get_robust_list);
@@ -69,6 +70,8 @@ cond_syscall(sys_epoll_create1);
 cond_syscall(sys_epoll_ctl);
 cond_syscall(sys_epoll_wait);
 cond_syscall(sys_epoll_pwait);
+cond_syscall(sys_epoll_ctl_batch);
+cond_syscall(sys_epoll_pwait1);
 cond_syscall(compat_sys_epoll_pwait);
 cond_syscall(sys_semget);
 cond_syscall(sys_semop);
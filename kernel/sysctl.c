@@ -65,6 +65,8 @@
 #include <linux/sched/sysctl.h>
 #include <linux/kexec.h>
 #include <linux/bpf.h>
+#include <linux/prezero.h>
+#include <linux/copy_offload.h>
 
 #include <asm/uaccess.h>
 #include <asm/processor.h>
@@ -284,6 +286,15 @@ static struct ctl_table kern_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	},
+#ifdef CONFIG_SCHED_CORE
+	{
+		.procname	= "sched_core_slice_ns",
+		.data		= &sysctl_sched_core_slice,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec,
+	},
+#endif
 #ifdef CONFIG_SCHED_DEBUG
 	{
 		.procname	= "sched_min_granularity_ns",
@@ -1301,6 +1312,51 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &zero,
 		.extra2		= &one_hundred,
 	},
+#ifdef CONFIG_LRU_GEN
+	{
+		.procname	= "lru_gen_enabled",
+		.data		= NULL,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= lru_gen_sysctl_handler,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
+#ifdef CONFIG_HUGEPAGE_PREZERO
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	{
+		.procname	= "prezero_thp_pages",
+		.data		= &sysctl_prezero_thp_pages,
+		.maxlen		= sizeof(sysctl_prezero_thp_pages),
+		.mode		= 0644,
+		.proc_handler	= prezero_sysctl_handler,
+		.extra1		= &zero,
+	},
+#endif
+#ifdef CONFIG_HUGETLB_PAGE
+	{
+		.procname	= "prezero_hugetlb",
+		.data		= &sysctl_prezero_hugetlb,
+		.maxlen		= sizeof(sysctl_prezero_hugetlb),
+		.mode		= 0644,
+		.proc_handler	= prezero_sysctl_handler,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
+#endif
+#ifdef CONFIG_PAGE_COPY_OFFLOAD
+	{
+		.procname	= "copy_offload",
+		.data		= &sysctl_copy_offload,
+		.maxlen		= sizeof(sysctl_copy_offload),
+		.mode		= 0644,
+		.proc_handler	= copy_offload_sysctl_handler,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
 #ifdef CONFIG_HUGETLB_PAGE
 	{
 		.procname	= "nr_hugepages",
@@ -1692,6 +1748,26 @@ static struct ctl_table fs_table[] = {
 		.child		= epoll_table,
 	},
 #endif
+#endif
+	{
+		.procname	= "negative-dentry-limit",
+		.data		= &sysctl_negative_dentry_limit,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
+#ifdef CONFIG_FS_PATH_CACHE
+	{
+		.procname	= "path-cache",
+		.data		= &sysctl_path_cache,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
 #endif
 	{
 		.procname	= "protected_symlinks",
@@ -1720,6 +1796,17 @@ static struct ctl_table fs_table[] = {
 		.extra1		= &zero,
 		.extra2		= &two,
 	},
+#ifdef CONFIG_EXEC_CACHE
+	{
+		.procname	= "exec_prefault",
+		.data		= &sysctl_exec_prefault,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
 #if defined(CONFIG_BINFMT_MISC) || defined(CONFIG_BINFMT_MISC_MODULE)
 	{
 		.procname	= "binfmt_misc",
@@ -1735,6 +1822,21 @@ static struct ctl_table fs_table[] = {
 		.proc_handler	= &pipe_proc_fn,
 		.extra1		= &pipe_min_size,
 	},
+	{
+		.procname	= "pipe-auto-max-size",
+		.data		= &pipe_auto_max_size,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+	},
+	{
+		.procname	= "pipe-user-auto-pages",
+		.data		= &pipe_user_auto_pages,
+		.maxlen		= sizeof(pipe_user_auto_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	},
 	{ }
 };
 
@@ -579,6 +579,57 @@ static int taskstats_user_cmd(struct sk_buff *skb, struct genl_info *info)
 		return -EINVAL;
 }
 
+/*
+ * Dump the stats of every task in one go, in pid order.  cb->args[0] is
+ * where the next skb picks up.
+ */
+static int taskstats_user_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct pid_namespace *pid_ns = task_active_pid_ns(current);
+	struct user_namespace *user_ns = current_user_ns();
+	pid_t nr = max_t(pid_t, cb->args[0], 1);
+
+	for (;; nr++) {
+		struct task_struct *tsk = NULL;
+		struct taskstats *stats;
+		struct pid *pid;
+		void *reply;
+
+		rcu_read_lock();
+		pid = find_ge_pid(nr, pid_ns);
+		if (pid) {
+			nr = pid_nr_ns(pid, pid_ns);
+			tsk = pid_task(pid, PIDTYPE_PID);
+			if (tsk)
+				get_task_struct(tsk);
+		}
+		rcu_read_unlock();
+		if (!pid)
+			break;
+		if (!tsk)
+			continue;
+
+		reply = genlmsg_put(skb, NETLINK_CB(cb->skb).portid,
+				    cb->nlh->nlmsg_seq, &family, NLM_F_MULTI,
+				    TASKSTATS_CMD_NEW);
+		stats = reply ? mk_reply(skb, TASKSTATS_TYPE_PID, nr) : NULL;
+		if (!stats) {
+			/* the skb is full, this one goes in the next */
+			if (reply)
+				genlmsg_cancel(skb, reply);
+			put_task_struct(tsk);
+			break;
+		}
+
+		fill_stats(user_ns, pid_ns, tsk, stats);
+		put_task_struct(tsk);
+		genlmsg_end(skb, reply);
+	}
+
+	cb->args[0] = nr;
+	return skb->len;
+}
+
 static struct taskstats *taskstats_tgid_alloc(struct task_struct *tsk)
 {
 	struct signal_struct *sig = tsk->signal;
@@ -668,6 +719,7 @@ static const struct genl_ops taskstats_ops[] = {
 	{
 		.cmd		= TASKSTATS_CMD_GET,
 		.doit		= taskstats_user_cmd,
+		.dumpit		= taskstats_user_dump,
 		.policy		= taskstats_cmd_get_policy,
 		.flags		= GENL_ADMIN_PERM,
 	},
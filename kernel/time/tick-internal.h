@@ -164,3 +164,17 @@ static inline void timers_update_migration(bool update_nohz) { }
 DECLARE_PER_CPU(struct hrtimer_cpu_base, hrtimer_bases);
 
 extern u64 get_next_timer_interrupt(unsigned long basej, u64 basem);
+extern void timer_clear_idle(void);
+
+/* Snapshot of a per-CPU timer wheel base, for /proc/timer_list */
+struct timer_base_stats {
+	unsigned long	clk;
+	unsigned long	next_expiry;
+	bool		is_idle;
+	unsigned long	pending;
+	unsigned long	queued;
+	unsigned long	expired;
+	unsigned long	migrated;
+};
+
+extern bool timer_base_stats(int cpu, int nr, struct timer_base_stats *st);
@@ -168,6 +168,25 @@ static void print_cpu(struct seq_file *m, int cpu, u64 now)
 #undef P
 #undef P_ns
 
+#define P(x) \
+	SEQ_printf(m, "  .%-15s: %Lu\n", #x, \
+		   (unsigned long long)(st.x))
+	{
+		struct timer_base_stats st;
+
+		for (i = 0; timer_base_stats(cpu, i, &st); i++) {
+			SEQ_printf(m, " timer wheel %d:\n", i);
+			P(clk);
+			P(next_expiry);
+			P(is_idle);
+			P(pending);
+			P(queued);
+			P(expired);
+			P(migrated);
+		}
+	}
+#undef P
+
 #ifdef CONFIG_TICK_ONESHOT
 # define P(x) \
 	SEQ_printf(m, "  .%-15s: %Lu\n", #x, \
@@ -287,7 +306,7 @@ static void timer_list_show_tickdevices_header(struct seq_file *m)
 
 static inline void timer_list_header(struct seq_file *m, u64 now)
 {
-	SEQ_printf(m, "Timer List Version: v0.8\n");
+	SEQ_printf(m, "Timer List Version: v0.9\n");
 	SEQ_printf(m, "HRTIMER_MAX_CLOCK_BASES: %d\n", HRTIMER_MAX_CLOCK_BASES);
 	SEQ_printf(m, "now at %Ld nsecs\n", (unsigned long long)now);
 	SEQ_printf(m, "\n");
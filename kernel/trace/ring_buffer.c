@@ -22,6 +22,9 @@
 #include <linux/hash.h>
 #include <linux/list.h>
 #include <linux/cpu.h>
+#include <linux/mm.h>
+
+#include <uapi/linux/trace_mmap.h>
 
 #include <asm/local.h>
 
@@ -300,6 +303,7 @@ struct buffer_page {
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
+	unsigned	 id;		/* subbuf id in a mapping */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -464,6 +468,12 @@ struct ring_buffer_per_cpu {
 	struct completion		update_done;
 
 	struct rb_irq_work		irq_work;
+
+	/* user space mappings, see ring_buffer_map() */
+	struct mutex			mapping_lock;
+	unsigned int			mapped;
+	struct trace_buffer_meta	*meta_page;
+	unsigned long			*subbuf_ids;	/* id to data page */
 };
 
 struct ring_buffer {
@@ -1224,6 +1234,7 @@ rb_allocate_cpu_buffer(struct ring_buffer *buffer, int nr_pages, int cpu)
 	init_irq_work(&cpu_buffer->irq_work.work, rb_wake_up_waiters);
 	init_waitqueue_head(&cpu_buffer->irq_work.waiters);
 	init_waitqueue_head(&cpu_buffer->irq_work.full_waiters);
+	mutex_init(&cpu_buffer->mapping_lock);
 
 	bpage = kzalloc_node(ALIGN(sizeof(*bpage), cache_line_size()),
 			    GFP_KERNEL, cpu_to_node(cpu));
@@ -1685,6 +1696,16 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size,
 	/* prevent another thread from changing buffer sizes */
 	mutex_lock(&buffer->mutex);
 
+	/* the pages of a mapped buffer are user space's as well */
+	for_each_buffer_cpu(buffer, cpu) {
+		if (cpu_id != RING_BUFFER_ALL_CPUS && cpu != cpu_id)
+			continue;
+		if (buffer->buffers[cpu]->mapped) {
+			mutex_unlock(&buffer->mutex);
+			return -EBUSY;
+		}
+	}
+
 	if (cpu_id == RING_BUFFER_ALL_CPUS) {
 		/* calculate the pages to update */
 		for_each_buffer_cpu(buffer, cpu) {
@@ -1873,6 +1894,21 @@ static inline unsigned rb_page_size(struct buffer_page *bpage)
 	return rb_page_commit(bpage);
 }
 
+/* hand the reader page, as far as it is committed, to user space */
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+	struct buffer_page *reader = cpu_buffer->reader_page;
+
+	meta->reader.id = reader->id;
+	meta->reader.read = reader->read;
+	meta->reader.commit = rb_page_commit(reader);
+
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+}
+
 static inline unsigned
 rb_commit_index(struct ring_buffer_per_cpu *cpu_buffer)
 {
@@ -4210,6 +4246,9 @@ rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 	cpu_buffer->lost_events = 0;
 	cpu_buffer->last_overrun = 0;
 
+	if (cpu_buffer->mapped)
+		rb_update_meta_page(cpu_buffer);
+
 	rb_head_page_activate(cpu_buffer);
 }
 
@@ -4348,6 +4387,11 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (cpu_buffer_a->nr_pages != cpu_buffer_b->nr_pages)
 		goto out;
 
+	/* user space holds on to the pages of mapped buffers */
+	ret = -EBUSY;
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped)
+		goto out;
+
 	ret = -EAGAIN;
 
 	if (atomic_read(&buffer_a->record_disabled))
@@ -4524,12 +4568,14 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 	/*
 	 * If this page has been partially read or
 	 * if len is not big enough to read the rest of the page or
-	 * a writer is still on the page, then
+	 * a writer is still on the page, or
+	 * the pages are mapped to user space, then
 	 * we must copy the data from the page to the buffer.
 	 * Otherwise, we can simply swap the page with the one passed in.
 	 */
 	if (read || (len < (commit - read)) ||
-	    cpu_buffer->reader_page == cpu_buffer->commit_page) {
+	    cpu_buffer->reader_page == cpu_buffer->commit_page ||
+	    cpu_buffer->mapped) {
 		struct buffer_data_page *rpage = cpu_buffer->reader_page->page;
 		unsigned int rpos = read;
 		unsigned int pos = 0;
@@ -4638,6 +4684,240 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/*
+ * Give every page an id, the reader page 0 and the others in ring order,
+ * which is where user space finds them in the mapping. The pages stay
+ * in their buffer_page while mapped: ring_buffer_read_page() copies
+ * instead of swapping, and resizing and swapping cpu buffers fail.
+ */
+static void rb_setup_ids_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+	struct buffer_page *bpage = cpu_buffer->reader_page;
+	unsigned int i;
+
+	bpage->id = 0;
+	cpu_buffer->subbuf_ids[0] = (unsigned long)bpage->page;
+
+	bpage = cpu_buffer->head_page;
+	for (i = 1; i <= cpu_buffer->nr_pages; i++) {
+		bpage->id = i;
+		cpu_buffer->subbuf_ids[i] = (unsigned long)bpage->page;
+		rb_inc_page(cpu_buffer, &bpage);
+	}
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = cpu_buffer->nr_pages + 1;
+
+	rb_update_meta_page(cpu_buffer);
+}
+
+static int rb_map_vma(struct ring_buffer_per_cpu *cpu_buffer,
+		      struct vm_area_struct *vma)
+{
+	unsigned long nr_pages = vma_pages(vma);
+	unsigned long addr = vma->vm_start;
+	unsigned long i;
+	int err;
+
+	if (vma->vm_pgoff || nr_pages > cpu_buffer->nr_pages + 2)
+		return -EINVAL;
+
+	err = vm_insert_page(vma, addr,
+			     virt_to_page(cpu_buffer->meta_page));
+	for (i = 0; !err && i < nr_pages - 1; i++) {
+		addr += PAGE_SIZE;
+		err = vm_insert_page(vma, addr,
+				     virt_to_page(cpu_buffer->subbuf_ids[i]));
+	}
+	return err;
+}
+
+/**
+ * ring_buffer_map - map a per cpu buffer to user space
+ * @buffer: the buffer
+ * @cpu: the cpu buffer to map
+ * @vma: the vma to map it to, or NULL to take another reference on an
+ *	existing mapping, for a vma that was split off one
+ *
+ * The mapping is read only: the meta page, a struct trace_buffer_meta,
+ * followed by the data pages in id order. The reader page changes with
+ * ring_buffer_map_get_reader(). While the buffer is mapped, it can't be
+ * resized.
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu,
+		    struct vm_area_struct *vma)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	unsigned long flags;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	if (vma) {
+		if (vma->vm_flags & (VM_WRITE | VM_EXEC))
+			return -EPERM;
+		vma->vm_flags &= ~(VM_MAYWRITE | VM_MAYEXEC);
+		vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_DONTDUMP;
+	}
+
+	mutex_lock(&cpu_buffer->mapping_lock);
+
+	if (cpu_buffer->mapped) {
+		if (vma)
+			err = rb_map_vma(cpu_buffer, vma);
+		if (!err)
+			cpu_buffer->mapped++;
+		goto out;
+	}
+
+	if (WARN_ON(!vma)) {
+		err = -ENODEV;
+		goto out;
+	}
+
+	err = -ENOMEM;
+	cpu_buffer->meta_page = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!cpu_buffer->meta_page)
+		goto out;
+	cpu_buffer->subbuf_ids = kcalloc(cpu_buffer->nr_pages + 1,
+					 sizeof(*cpu_buffer->subbuf_ids),
+					 GFP_KERNEL);
+	if (!cpu_buffer->subbuf_ids)
+		goto out_free;
+
+	/* no resizing of the pages we are about to hand out */
+	mutex_lock(&buffer->mutex);
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	rb_setup_ids_meta_page(cpu_buffer);
+	cpu_buffer->mapped = 1;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+	mutex_unlock(&buffer->mutex);
+
+	err = rb_map_vma(cpu_buffer, vma);
+	if (!err)
+		goto out;
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 0;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+ out_free:
+	kfree(cpu_buffer->subbuf_ids);
+	cpu_buffer->subbuf_ids = NULL;
+	free_page((unsigned long)cpu_buffer->meta_page);
+	cpu_buffer->meta_page = NULL;
+ out:
+	mutex_unlock(&cpu_buffer->mapping_lock);
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - drop a reference on a user space mapping
+ * @buffer: the buffer
+ * @cpu: the cpu buffer that was mapped
+ *
+ * Pages still in a vma being torn down hold a reference of their own.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	unsigned long flags;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&cpu_buffer->mapping_lock);
+
+	if (!cpu_buffer->mapped) {
+		err = -ENODEV;
+		goto out;
+	}
+
+	if (--cpu_buffer->mapped)
+		goto out;
+
+	mutex_lock(&buffer->mutex);
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 0;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+	mutex_unlock(&buffer->mutex);
+
+	kfree(cpu_buffer->subbuf_ids);
+	cpu_buffer->subbuf_ids = NULL;
+	free_page((unsigned long)cpu_buffer->meta_page);
+	cpu_buffer->meta_page = NULL;
+ out:
+	mutex_unlock(&cpu_buffer->mapping_lock);
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_get_reader - hand user space the next events
+ * @buffer: the buffer
+ * @cpu: the mapped cpu buffer
+ *
+ * Consumes the events the meta page handed out the last time, swaps in
+ * a new reader page if that was the end of the current one, and updates
+ * the meta page. The writer never writes to the events handed out, so
+ * user space reads them in place, without a copy.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	struct buffer_page *reader;
+	unsigned long flags;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		err = -ENODEV;
+		goto out;
+	}
+	meta = cpu_buffer->meta_page;
+
+	/*
+	 * Another reader, trace_pipe_raw say, may have consumed events in
+	 * the meantime, or even moved on to another page.
+	 */
+	reader = cpu_buffer->reader_page;
+	if (reader->id == meta->reader.id) {
+		while (reader->read < meta->reader.commit &&
+		       reader->read < rb_page_size(reader))
+			rb_advance_reader(cpu_buffer);
+	}
+
+	/* swaps in the next page, if there is one and this one is done */
+	rb_get_reader_page(cpu_buffer);
+
+	meta->reader.lost_events = cpu_buffer->lost_events;
+	cpu_buffer->lost_events = 0;
+	rb_update_meta_page(cpu_buffer);
+
+ out:
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 #ifdef CONFIG_HOTPLUG_CPU
 static int rb_cpu_notify(struct notifier_block *self,
 			 unsigned long action, void *hcpu)
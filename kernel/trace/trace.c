@@ -42,6 +42,8 @@
 #include <linux/fs.h>
 #include <linux/sched/rt.h>
 
+#include <uapi/linux/trace_mmap.h>
+
 #include "trace.h"
 #include "trace_output.h"
 
@@ -678,6 +680,10 @@ static int alloc_snapshot(struct trace_array *tr)
 {
 	int ret;
 
+	/* a snapshot would swap the mapped pages out from under user space */
+	if (tr->mapped)
+		return -EBUSY;
+
 	if (!tr->allocated_snapshot) {
 
 		/* allocate spare buffer */
@@ -3803,6 +3809,9 @@ static const char readme_msg[] =
 #endif
 #ifdef CONFIG_TRACER_SNAPSHOT
 	"\t\t    snapshot\n"
+#endif
+#ifdef CONFIG_HIST_TRIGGERS
+	"\t\t    hist (see below)\n"
 #endif
 	"\t   example: echo traceoff > events/block/block_unplug/trigger\n"
 	"\t            echo traceoff:3 > events/block/block_unplug/trigger\n"
@@ -3819,6 +3828,23 @@ static const char readme_msg[] =
 	"\t   To remove a trigger with a count:\n"
 	"\t     echo '!<trigger>:0 > <system>/<event>/trigger\n"
 	"\t   Filters can be ignored when removing a trigger.\n"
+#ifdef CONFIG_HIST_TRIGGERS
+	"      hist trigger\t- If set, event hits are aggregated into a hash table\n"
+	"\t    Format: hist:keys=<field1[,field2,...]>\n"
+	"\t            [:values=<field1[,field2,...]>]\n"
+	"\t            [:sort=<field1>[.descending]]\n"
+	"\t            [:size=#entries]\n"
+	"\t            [:pause][:continue][:clear]\n"
+	"\t            [if <filter>]\n\n"
+	"\t    Reading events/<system>/<event>/hist shows the table, sorted\n"
+	"\t    on hitcount unless another key or value is given with sort.\n"
+	"\t    A field name can be followed by .hex, .sym, .sym-offset,\n"
+	"\t    .execname, .syscall or .log2 to change how it's used as a\n"
+	"\t    key; 'stacktrace' as a key is the kernel stack at the event.\n"
+	"\t    size is rounded up to a power of two, 2048 by default.\n\n"
+	"\t    pause, continue and clear act on the matching hist trigger\n"
+	"\t    already set on the event; a new one with pause starts paused.\n"
+#endif
 ;
 
 static ssize_t
@@ -5853,12 +5879,82 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 	return ret;
 }
 
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	return ring_buffer_map_get_reader(iter->trace_buffer->buffer,
+					  iter->cpu_file);
+}
+
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	mutex_lock(&trace_types_lock);
+	if (!ring_buffer_map(iter->trace_buffer->buffer, iter->cpu_file, NULL))
+		iter->tr->mapped++;
+	mutex_unlock(&trace_types_lock);
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	mutex_lock(&trace_types_lock);
+	if (!ring_buffer_unmap(iter->trace_buffer->buffer, iter->cpu_file))
+		iter->tr->mapped--;
+	mutex_unlock(&trace_types_lock);
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+};
+
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int ret;
+
+	/* only the per cpu trace_pipe_raw files, one buffer each */
+	if (iter->cpu_file == RING_BUFFER_ALL_CPUS)
+		return -EINVAL;
+
+	mutex_lock(&trace_types_lock);
+#ifdef CONFIG_TRACER_MAX_TRACE
+	if (iter->tr->allocated_snapshot) {
+		ret = -EBUSY;
+		goto out;
+	}
+#endif
+	ret = ring_buffer_map(iter->trace_buffer->buffer, iter->cpu_file, vma);
+	if (ret)
+		goto out;
+
+	iter->tr->mapped++;
+	vma->vm_ops = &tracing_buffers_vmops;
+ out:
+	mutex_unlock(&trace_types_lock);
+	return ret;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.poll		= tracing_buffers_poll,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
@@ -0,0 +1,1294 @@
+/*
+ * trace_events_hist - trace event hist triggers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Copyright (C) 2015 Tom Zanussi <tom.zanussi@linux.intel.com>
+ */
+
+#include <linux/module.h>
+#include <linux/kallsyms.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/stacktrace.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+
+#include "trace.h"
+
+/*
+ * A hist trigger aggregates the events that hit it into a table
+ * keyed on one or more of the event's fields, summing the values of
+ * others along the way.  The table is updated from the event itself,
+ * with nothing but cmpxchg, so it can be hit from any context,
+ * including NMI, and nothing has to go through the ring buffer.
+ *
+ * Reading the event's 'hist' file sorts and prints the table.
+ */
+
+#define HIST_KEYS_MAX		3
+#define HIST_VALS_MAX		4	/* hitcount, plus three more */
+#define HIST_FIELDS_MAX		(HIST_KEYS_MAX + HIST_VALS_MAX)
+#define HIST_KEY_SIZE_MAX	256
+
+#define HIST_STACKTRACE_DEPTH	16
+#define HIST_STACKTRACE_SIZE	(HIST_STACKTRACE_DEPTH * sizeof(unsigned long))
+#define HIST_STACKTRACE_SKIP	5
+
+#define HIST_BITS_DEFAULT	11
+#define HIST_BITS_MIN		7
+#define HIST_BITS_MAX		16
+
+#define HIST_DUP_TRY_MAX	10
+
+/*
+ * The map: max_elts preallocated elements, each holding the sums
+ * and a copy of its key, and a table of twice as many slots (so
+ * that it can never fill up and probing always ends) pointing at
+ * them.  A slot is claimed by cmpxchg()ing the key's hash into it;
+ * the winner then takes the next free element, copies the key in
+ * and publishes it.  Nothing is ever removed, except by clearing
+ * the whole map.
+ */
+struct hist_elt {
+	atomic64_t		sums[HIST_VALS_MAX];
+	char			key[];
+};
+
+struct hist_map_entry {
+	u32			key;	/* hash of the key, 0 for a free slot */
+	struct hist_elt		*val;
+};
+
+struct hist_map {
+	unsigned int		map_bits;
+	unsigned int		max_elts;
+	unsigned int		key_size;
+	unsigned int		elt_size;
+	atomic_t		next_elt;
+	atomic64_t		hits;
+	atomic64_t		drops;
+	struct hist_map_entry	*entries;
+	void			*elts;
+};
+
+static struct hist_map *hist_map_create(unsigned int map_bits,
+					unsigned int key_size)
+{
+	struct hist_map *map;
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return NULL;
+
+	map->map_bits = map_bits;
+	map->max_elts = 1 << map_bits;
+	map->key_size = key_size;
+	map->elt_size = sizeof(struct hist_elt) + key_size;
+
+	map->entries = vzalloc(2 * map->max_elts * sizeof(*map->entries));
+	if (!map->entries)
+		goto free;
+
+	map->elts = vzalloc(map->max_elts * map->elt_size);
+	if (!map->elts)
+		goto free;
+
+	return map;
+ free:
+	vfree(map->entries);
+	kfree(map);
+	return NULL;
+}
+
+static void hist_map_destroy(struct hist_map *map)
+{
+	if (!map)
+		return;
+
+	vfree(map->elts);
+	vfree(map->entries);
+	kfree(map);
+}
+
+/* Only with no inserters running, see hist_trigger_clear() */
+static void hist_map_clear(struct hist_map *map)
+{
+	memset(map->entries, 0, 2 * map->max_elts * sizeof(*map->entries));
+	memset(map->elts, 0, map->max_elts * map->elt_size);
+	atomic_set(&map->next_elt, 0);
+	atomic64_set(&map->hits, 0);
+	atomic64_set(&map->drops, 0);
+}
+
+static struct hist_elt *hist_map_get_elt(struct hist_map *map)
+{
+	unsigned int idx;
+
+	/* don't let a full map's counter wrap around into used elts */
+	if (atomic_read(&map->next_elt) >= map->max_elts)
+		return NULL;
+
+	idx = atomic_inc_return(&map->next_elt) - 1;
+	if (idx >= map->max_elts)
+		return NULL;
+
+	return map->elts + idx * map->elt_size;
+}
+
+static struct hist_elt *hist_map_insert(struct hist_map *map, void *key)
+{
+	u32 idx, key_hash, test_key;
+	struct hist_map_entry *entry;
+	struct hist_elt *elt;
+	int dup_try = 0;
+
+	key_hash = jhash(key, map->key_size, 0);
+	if (key_hash == 0)
+		key_hash = 1;
+
+	idx = key_hash >> (32 - (map->map_bits + 1));
+
+	while (1) {
+		idx &= 2 * map->max_elts - 1;
+		entry = &map->entries[idx];
+		test_key = READ_ONCE(entry->key);
+
+		if (test_key == key_hash) {
+			elt = READ_ONCE(entry->val);
+			if (elt && !memcmp(elt->key, key, map->key_size)) {
+				atomic64_inc(&map->hits);
+				return elt;
+			}
+			if (!elt) {
+				/* claimed, but not published yet */
+				if (++dup_try > HIST_DUP_TRY_MAX)
+					break;
+				cpu_relax();
+				continue;
+			}
+		}
+
+		if (!test_key) {
+			if (cmpxchg(&entry->key, 0, key_hash)) {
+				/* lost the race for it, look again */
+				if (++dup_try > HIST_DUP_TRY_MAX)
+					break;
+				continue;
+			}
+
+			elt = hist_map_get_elt(map);
+			if (!elt) {
+				entry->key = 0;
+				break;
+			}
+
+			memcpy(elt->key, key, map->key_size);
+			smp_wmb(); /* key before the elt is visible */
+			WRITE_ONCE(entry->val, elt);
+			atomic64_inc(&map->hits);
+
+			return elt;
+		}
+
+		idx++;
+	}
+
+	atomic64_inc(&map->drops);
+
+	return NULL;
+}
+
+enum hist_field_flags {
+	HIST_FIELD_FL_HITCOUNT		= 1,
+	HIST_FIELD_FL_KEY		= 2,
+	HIST_FIELD_FL_STRING		= 4,
+	HIST_FIELD_FL_HEX		= 8,
+	HIST_FIELD_FL_SYM		= 16,
+	HIST_FIELD_FL_SYM_OFFSET	= 32,
+	HIST_FIELD_FL_EXECNAME		= 64,
+	HIST_FIELD_FL_SYSCALL		= 128,
+	HIST_FIELD_FL_STACKTRACE	= 256,
+	HIST_FIELD_FL_LOG2		= 512,
+};
+
+#define HIST_FIELD_FL_MODIFIERS	(HIST_FIELD_FL_HEX | HIST_FIELD_FL_SYM | \
+				 HIST_FIELD_FL_SYM_OFFSET |		\
+				 HIST_FIELD_FL_EXECNAME |		\
+				 HIST_FIELD_FL_SYSCALL | HIST_FIELD_FL_LOG2)
+
+struct hist_field;
+
+typedef u64 (*hist_field_fn_t) (struct hist_field *field, void *event);
+
+struct hist_field {
+	struct ftrace_event_field	*field;
+	unsigned long			flags;
+	hist_field_fn_t			fn;
+	unsigned int			size;
+	unsigned int			offset;	/* into the compound key */
+};
+
+struct hist_trigger_attrs {
+	char		*keys_str;
+	char		*vals_str;
+	char		*sort_key_str;
+	bool		pause;
+	bool		cont;
+	bool		clear;
+	unsigned int	map_bits;
+};
+
+/*
+ * fields[] holds the values, hitcount first, then the keys; a sort
+ * key is an index into it.
+ */
+struct hist_trigger_data {
+	struct hist_field		fields[HIST_FIELDS_MAX];
+	unsigned int			n_vals;
+	unsigned int			n_keys;
+	unsigned int			key_size;
+	unsigned int			sort_field;
+	bool				sort_descending;
+	struct hist_trigger_attrs	*attrs;
+	struct hist_map			*map;
+};
+
+static u64 hist_field_counter(struct hist_field *field, void *event)
+{
+	return 1;
+}
+
+#define DEFINE_HIST_FIELD_FN(type)					\
+static u64 hist_field_##type(struct hist_field *hist_field, void *event)\
+{									\
+	type *addr = (type *)(event + hist_field->field->offset);	\
+									\
+	return (u64)*addr;						\
+}
+
+DEFINE_HIST_FIELD_FN(s64);
+DEFINE_HIST_FIELD_FN(u64);
+DEFINE_HIST_FIELD_FN(s32);
+DEFINE_HIST_FIELD_FN(u32);
+DEFINE_HIST_FIELD_FN(s16);
+DEFINE_HIST_FIELD_FN(u16);
+DEFINE_HIST_FIELD_FN(s8);
+DEFINE_HIST_FIELD_FN(u8);
+
+static hist_field_fn_t select_value_fn(int field_size, int field_is_signed)
+{
+	hist_field_fn_t fn = NULL;
+
+	switch (field_size) {
+	case 8:
+		fn = field_is_signed ? hist_field_s64 : hist_field_u64;
+		break;
+	case 4:
+		fn = field_is_signed ? hist_field_s32 : hist_field_u32;
+		break;
+	case 2:
+		fn = field_is_signed ? hist_field_s16 : hist_field_u16;
+		break;
+	case 1:
+		fn = field_is_signed ? hist_field_s8 : hist_field_u8;
+		break;
+	}
+
+	return fn;
+}
+
+static const char *hist_field_name(struct hist_field *hist_field)
+{
+	if (hist_field->flags & HIST_FIELD_FL_HITCOUNT)
+		return "hitcount";
+	if (hist_field->flags & HIST_FIELD_FL_STACKTRACE)
+		return "stacktrace";
+
+	return hist_field->field->name;
+}
+
+static const char *hist_field_modifier(struct hist_field *hist_field)
+{
+	unsigned long flags = hist_field->flags;
+
+	if (flags & HIST_FIELD_FL_HEX)
+		return "hex";
+	if (flags & HIST_FIELD_FL_SYM)
+		return "sym";
+	if (flags & HIST_FIELD_FL_SYM_OFFSET)
+		return "sym-offset";
+	if (flags & HIST_FIELD_FL_EXECNAME)
+		return "execname";
+	if (flags & HIST_FIELD_FL_SYSCALL)
+		return "syscall";
+	if (flags & HIST_FIELD_FL_LOG2)
+		return "log2";
+
+	return NULL;
+}
+
+static unsigned long parse_hist_field_modifier(char *str)
+{
+	if (strcmp(str, "hex") == 0)
+		return HIST_FIELD_FL_HEX;
+	if (strcmp(str, "sym") == 0)
+		return HIST_FIELD_FL_SYM;
+	if (strcmp(str, "sym-offset") == 0)
+		return HIST_FIELD_FL_SYM_OFFSET;
+	if (strcmp(str, "execname") == 0)
+		return HIST_FIELD_FL_EXECNAME;
+	if (strcmp(str, "syscall") == 0)
+		return HIST_FIELD_FL_SYSCALL;
+	if (strcmp(str, "log2") == 0)
+		return HIST_FIELD_FL_LOG2;
+
+	return 0;
+}
+
+static bool is_string_field(struct ftrace_event_field *field)
+{
+	return field->filter_type == FILTER_STATIC_STRING ||
+		field->filter_type == FILTER_DYN_STRING ||
+		field->filter_type == FILTER_PTR_STRING;
+}
+
+static void destroy_hist_trigger_attrs(struct hist_trigger_attrs *attrs)
+{
+	if (!attrs)
+		return;
+
+	kfree(attrs->sort_key_str);
+	kfree(attrs->vals_str);
+	kfree(attrs->keys_str);
+	kfree(attrs);
+}
+
+static struct hist_trigger_attrs *parse_hist_trigger_attrs(char *trigger_str)
+{
+	struct hist_trigger_attrs *attrs;
+	int ret = 0;
+
+	attrs = kzalloc(sizeof(*attrs), GFP_KERNEL);
+	if (!attrs)
+		return ERR_PTR(-ENOMEM);
+
+	while (trigger_str) {
+		char *str = strsep(&trigger_str, ":");
+		char **attr_str = NULL;
+		unsigned long size;
+
+		if ((strncmp(str, "key=", strlen("key=")) == 0) ||
+		    (strncmp(str, "keys=", strlen("keys=")) == 0))
+			attr_str = &attrs->keys_str;
+		else if ((strncmp(str, "val=", strlen("val=")) == 0) ||
+			 (strncmp(str, "vals=", strlen("vals=")) == 0) ||
+			 (strncmp(str, "values=", strlen("values=")) == 0))
+			attr_str = &attrs->vals_str;
+		else if (strncmp(str, "sort=", strlen("sort=")) == 0)
+			attr_str = &attrs->sort_key_str;
+		else if (strcmp(str, "pause") == 0)
+			attrs->pause = true;
+		else if ((strcmp(str, "cont") == 0) ||
+			 (strcmp(str, "continue") == 0))
+			attrs->cont = true;
+		else if (strcmp(str, "clear") == 0)
+			attrs->clear = true;
+		else if (strncmp(str, "size=", strlen("size=")) == 0) {
+			strsep(&str, "=");
+			if (!str) {
+				ret = -EINVAL;
+				goto free;
+			}
+
+			ret = kstrtoul(str, 0, &size);
+			if (ret)
+				goto free;
+
+			size = roundup_pow_of_two(size);
+			attrs->map_bits = ilog2(size);
+			if (attrs->map_bits < HIST_BITS_MIN ||
+			    attrs->map_bits > HIST_BITS_MAX) {
+				ret = -EINVAL;
+				goto free;
+			}
+		} else {
+			ret = -EINVAL;
+			goto free;
+		}
+
+		if (attr_str) {
+			kfree(*attr_str);
+			*attr_str = kstrdup(str, GFP_KERNEL);
+			if (!*attr_str) {
+				ret = -ENOMEM;
+				goto free;
+			}
+		}
+	}
+
+	if (!attrs->keys_str) {
+		ret = -EINVAL;
+		goto free;
+	}
+
+	if (!attrs->map_bits)
+		attrs->map_bits = HIST_BITS_DEFAULT;
+
+	return attrs;
+ free:
+	destroy_hist_trigger_attrs(attrs);
+
+	return ERR_PTR(ret);
+}
+
+static int create_val_field(struct hist_trigger_data *hist_data,
+			    struct trace_event_file *file, char *field_str)
+{
+	struct hist_field *hist_field;
+	struct ftrace_event_field *field;
+
+	if (hist_data->n_vals >= HIST_VALS_MAX)
+		return -EINVAL;
+
+	/* values are summed, so no modifiers and nothing but numbers */
+	field = trace_find_event_field(file->event_call, field_str);
+	if (!field || is_string_field(field))
+		return -EINVAL;
+
+	hist_field = &hist_data->fields[hist_data->n_vals];
+	hist_field->fn = select_value_fn(field->size, field->is_signed);
+	if (!hist_field->fn)
+		return -EINVAL;
+
+	hist_field->field = field;
+	hist_field->size = field->size;
+	hist_data->n_vals++;
+
+	return 0;
+}
+
+static int create_val_fields(struct hist_trigger_data *hist_data,
+			     struct trace_event_file *file)
+{
+	char *fields_str, *field_str;
+	int ret;
+
+	/* hitcount is always the first value */
+	hist_data->fields[0].flags = HIST_FIELD_FL_HITCOUNT;
+	hist_data->fields[0].fn = hist_field_counter;
+	hist_data->fields[0].size = sizeof(u64);
+	hist_data->n_vals = 1;
+
+	fields_str = hist_data->attrs->vals_str;
+	if (!fields_str)
+		return 0;
+
+	strsep(&fields_str, "=");
+	if (!fields_str)
+		return -EINVAL;
+
+	while ((field_str = strsep(&fields_str, ",")) != NULL) {
+		if (strcmp(field_str, "hitcount") == 0)
+			continue;
+
+		ret = create_val_field(hist_data, file, field_str);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int create_key_field(struct hist_trigger_data *hist_data,
+			    struct trace_event_file *file, char *field_str)
+{
+	struct hist_field *hist_field;
+	struct ftrace_event_field *field = NULL;
+	unsigned long flags = HIST_FIELD_FL_KEY;
+	char *field_name;
+	unsigned int size;
+
+	if (hist_data->n_keys >= HIST_KEYS_MAX)
+		return -EINVAL;
+
+	field_name = strsep(&field_str, ".");
+	if (field_str) {
+		unsigned long modifier = parse_hist_field_modifier(field_str);
+
+		if (!modifier)
+			return -EINVAL;
+		flags |= modifier;
+	}
+
+	if (strcmp(field_name, "stacktrace") == 0) {
+		if (flags & HIST_FIELD_FL_MODIFIERS)
+			return -EINVAL;
+		flags |= HIST_FIELD_FL_STACKTRACE;
+		size = HIST_STACKTRACE_SIZE;
+	} else {
+		field = trace_find_event_field(file->event_call, field_name);
+		if (!field)
+			return -EINVAL;
+
+		if (is_string_field(field)) {
+			/* only strings with a size of their own can be copied */
+			if (field->filter_type != FILTER_STATIC_STRING ||
+			    (flags & HIST_FIELD_FL_MODIFIERS))
+				return -EINVAL;
+			flags |= HIST_FIELD_FL_STRING;
+			size = field->size;
+		} else {
+			if (!select_value_fn(field->size, field->is_signed))
+				return -EINVAL;
+			size = sizeof(u64);
+		}
+	}
+
+	size = ALIGN(size, sizeof(u64));
+	if (hist_data->key_size + size > HIST_KEY_SIZE_MAX)
+		return -EINVAL;
+
+	hist_field = &hist_data->fields[hist_data->n_vals + hist_data->n_keys];
+	hist_field->field = field;
+	hist_field->flags = flags;
+	hist_field->size = size;
+	hist_field->offset = hist_data->key_size;
+	if (field && !(flags & HIST_FIELD_FL_STRING))
+		hist_field->fn = select_value_fn(field->size, field->is_signed);
+
+	hist_data->key_size += size;
+	hist_data->n_keys++;
+
+	return 0;
+}
+
+static int create_key_fields(struct hist_trigger_data *hist_data,
+			     struct trace_event_file *file)
+{
+	char *fields_str, *field_str;
+	int ret;
+
+	fields_str = hist_data->attrs->keys_str;
+	strsep(&fields_str, "=");
+	if (!fields_str)
+		return -EINVAL;
+
+	while ((field_str = strsep(&fields_str, ",")) != NULL) {
+		ret = create_key_field(hist_data, file, field_str);
+		if (ret)
+			return ret;
+	}
+
+	if (!hist_data->n_keys)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int create_sort_key(struct hist_trigger_data *hist_data)
+{
+	char *field_str, *field_name;
+	unsigned int i, n_fields;
+
+	/* by default, sort on hitcount, ascending */
+	hist_data->sort_field = 0;
+
+	field_str = hist_data->attrs->sort_key_str;
+	if (!field_str)
+		return 0;
+
+	strsep(&field_str, "=");
+	if (!field_str)
+		return -EINVAL;
+
+	field_name = strsep(&field_str, ".");
+	if (field_str) {
+		if (strcmp(field_str, "descending") == 0)
+			hist_data->sort_descending = true;
+		else if (strcmp(field_str, "ascending") != 0)
+			return -EINVAL;
+	}
+
+	n_fields = hist_data->n_vals + hist_data->n_keys;
+	for (i = 0; i < n_fields; i++) {
+		if (strcmp(field_name, hist_field_name(&hist_data->fields[i])) == 0) {
+			hist_data->sort_field = i;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static void destroy_hist_data(struct hist_trigger_data *hist_data)
+{
+	destroy_hist_trigger_attrs(hist_data->attrs);
+	hist_map_destroy(hist_data->map);
+	kfree(hist_data);
+}
+
+/*
+ * The map itself is only created when the trigger is registered, see
+ * hist_register_trigger(); a command that only pauses, continues or
+ * clears an existing trigger, or removes one, never needs it.
+ */
+static struct hist_trigger_data *
+create_hist_data(struct hist_trigger_attrs *attrs,
+		 struct trace_event_file *file)
+{
+	struct hist_trigger_data *hist_data;
+	int ret;
+
+	hist_data = kzalloc(sizeof(*hist_data), GFP_KERNEL);
+	if (!hist_data)
+		return ERR_PTR(-ENOMEM);
+
+	hist_data->attrs = attrs;
+
+	ret = create_val_fields(hist_data, file);
+	if (ret)
+		goto free;
+
+	ret = create_key_fields(hist_data, file);
+	if (ret)
+		goto free;
+
+	ret = create_sort_key(hist_data);
+	if (ret)
+		goto free;
+
+	return hist_data;
+ free:
+	hist_data->attrs = NULL;
+	destroy_hist_data(hist_data);
+
+	return ERR_PTR(ret);
+}
+
+static void hist_trigger_build_key(struct hist_trigger_data *hist_data,
+				   void *compound_key, void *rec)
+{
+	struct hist_field *key_field;
+	unsigned int i;
+	void *key;
+	u64 val;
+
+	memset(compound_key, 0, hist_data->key_size);
+
+	for (i = 0; i < hist_data->n_keys; i++) {
+		key_field = &hist_data->fields[hist_data->n_vals + i];
+		key = compound_key + key_field->offset;
+
+		if (key_field->flags & HIST_FIELD_FL_STACKTRACE) {
+			struct stack_trace stacktrace = {
+				.max_entries	= HIST_STACKTRACE_DEPTH,
+				.entries	= key,
+				.skip		= HIST_STACKTRACE_SKIP,
+			};
+
+			save_stack_trace(&stacktrace);
+		} else if (key_field->flags & HIST_FIELD_FL_STRING) {
+			strncpy(key, rec + key_field->field->offset,
+				key_field->field->size);
+		} else {
+			val = key_field->fn(key_field, rec);
+			/* bucket by the next power of two up */
+			if (key_field->flags & HIST_FIELD_FL_LOG2)
+				val = val ? fls64(val - 1) : 0;
+			*(u64 *)key = val;
+		}
+	}
+}
+
+static void
+event_hist_trigger(struct event_trigger_data *data, void *rec)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	u64 compound_key[HIST_KEY_SIZE_MAX / sizeof(u64)];
+	struct hist_field *hist_field;
+	struct hist_elt *elt;
+	unsigned int i;
+
+	if (READ_ONCE(data->paused) || !rec)
+		return;
+
+	hist_trigger_build_key(hist_data, compound_key, rec);
+
+	elt = hist_map_insert(hist_data->map, compound_key);
+	if (!elt)
+		return;
+
+	atomic64_inc(&elt->sums[0]);
+	for (i = 1; i < hist_data->n_vals; i++) {
+		hist_field = &hist_data->fields[i];
+		atomic64_add(hist_field->fn(hist_field, rec), &elt->sums[i]);
+	}
+}
+
+static void hist_field_print(struct seq_file *m, struct hist_field *hist_field)
+{
+	const char *modifier = hist_field_modifier(hist_field);
+
+	seq_puts(m, hist_field_name(hist_field));
+	if (modifier)
+		seq_printf(m, ".%s", modifier);
+}
+
+static int event_hist_trigger_print(struct seq_file *m,
+				    struct event_trigger_ops *ops,
+				    struct event_trigger_data *data)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	unsigned int i;
+
+	seq_puts(m, "hist:keys=");
+	for (i = 0; i < hist_data->n_keys; i++) {
+		if (i)
+			seq_putc(m, ',');
+		hist_field_print(m, &hist_data->fields[hist_data->n_vals + i]);
+	}
+
+	seq_puts(m, ":vals=");
+	for (i = 0; i < hist_data->n_vals; i++) {
+		if (i)
+			seq_putc(m, ',');
+		hist_field_print(m, &hist_data->fields[i]);
+	}
+
+	seq_puts(m, ":sort=");
+	seq_puts(m, hist_field_name(&hist_data->fields[hist_data->sort_field]));
+	if (hist_data->sort_descending)
+		seq_puts(m, ".descending");
+
+	seq_printf(m, ":size=%u", 1U << hist_data->attrs->map_bits);
+
+	if (data->filter_str)
+		seq_printf(m, " if %s", data->filter_str);
+
+	if (data->paused)
+		seq_puts(m, " [paused]");
+	else
+		seq_puts(m, " [active]");
+
+	seq_putc(m, '\n');
+
+	return 0;
+}
+
+static void event_hist_trigger_free(struct event_trigger_ops *ops,
+				    struct event_trigger_data *data)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+
+	if (WARN_ON_ONCE(data->ref <= 0))
+		return;
+
+	data->ref--;
+	if (!data->ref) {
+		set_trigger_filter(NULL, data, NULL);
+		synchronize_sched(); /* make sure current triggers exit */
+		destroy_hist_data(hist_data);
+		kfree(data);
+	}
+}
+
+static struct event_trigger_ops event_hist_trigger_ops = {
+	.func			= event_hist_trigger,
+	.print			= event_hist_trigger_print,
+	.init			= event_trigger_init,
+	.free			= event_hist_trigger_free,
+};
+
+static struct event_trigger_ops *event_hist_get_trigger_ops(char *cmd,
+							    char *param)
+{
+	return &event_hist_trigger_ops;
+}
+
+static bool hist_trigger_match(struct event_trigger_data *data,
+			       struct event_trigger_data *data_test)
+{
+	struct hist_trigger_data *hist_data, *hist_data_test;
+	struct hist_field *field, *field_test;
+	unsigned int i, n_fields;
+
+	hist_data = data->private_data;
+	hist_data_test = data_test->private_data;
+
+	if (hist_data->n_vals != hist_data_test->n_vals ||
+	    hist_data->n_keys != hist_data_test->n_keys ||
+	    hist_data->sort_field != hist_data_test->sort_field ||
+	    hist_data->sort_descending != hist_data_test->sort_descending)
+		return false;
+
+	n_fields = hist_data->n_vals + hist_data->n_keys;
+	for (i = 0; i < n_fields; i++) {
+		field = &hist_data->fields[i];
+		field_test = &hist_data_test->fields[i];
+
+		if (field->field != field_test->field ||
+		    field->flags != field_test->flags)
+			return false;
+	}
+
+	if (!data->filter_str != !data_test->filter_str)
+		return false;
+
+	if (data->filter_str &&
+	    strcmp(data->filter_str, data_test->filter_str) != 0)
+		return false;
+
+	return true;
+}
+
+static void hist_trigger_clear(struct event_trigger_data *data)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	bool paused;
+
+	paused = data->paused;
+	data->paused = true;
+
+	synchronize_sched(); /* make sure no one is inserting */
+
+	hist_map_clear(hist_data->map);
+
+	data->paused = paused;
+}
+
+/*
+ * Registering a hist trigger that matches an existing one only
+ * applies its pause, continue or clear to it.  Any number of
+ * different hist triggers can be set on the same event.
+ */
+static int hist_register_trigger(char *glob, struct event_trigger_ops *ops,
+				 struct event_trigger_data *data,
+				 struct trace_event_file *file)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	struct hist_trigger_attrs *attrs = hist_data->attrs;
+	struct event_trigger_data *test;
+	int ret = 0;
+
+	list_for_each_entry_rcu(test, &file->triggers, list) {
+		if (test->cmd_ops->trigger_type != ETT_EVENT_HIST)
+			continue;
+		if (!hist_trigger_match(data, test))
+			continue;
+
+		if (attrs->pause)
+			test->paused = true;
+		else if (attrs->cont)
+			test->paused = false;
+		else if (attrs->clear)
+			hist_trigger_clear(test);
+		else
+			ret = -EEXIST;
+		goto out;
+	}
+
+	if (attrs->cont || attrs->clear) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	hist_data->map = hist_map_create(attrs->map_bits, hist_data->key_size);
+	if (!hist_data->map) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (attrs->pause)
+		data->paused = true;
+
+	if (data->ops->init) {
+		ret = data->ops->init(data->ops, data);
+		if (ret < 0)
+			goto out;
+	}
+
+	list_add_rcu(&data->list, &file->triggers);
+	ret++;
+
+	if (trace_event_trigger_enable_disable(file, 1) < 0) {
+		list_del_rcu(&data->list);
+		ret--;
+	}
+	update_cond_flag(file);
+ out:
+	return ret;
+}
+
+static void hist_unregister_trigger(char *glob, struct event_trigger_ops *ops,
+				    struct event_trigger_data *data,
+				    struct trace_event_file *file)
+{
+	struct event_trigger_data *test;
+	bool unregistered = false;
+
+	list_for_each_entry_rcu(test, &file->triggers, list) {
+		if (test->cmd_ops->trigger_type != ETT_EVENT_HIST)
+			continue;
+		if (!hist_trigger_match(data, test))
+			continue;
+
+		unregistered = true;
+		list_del_rcu(&test->list);
+		update_cond_flag(file);
+		trace_event_trigger_enable_disable(file, 0);
+		break;
+	}
+
+	if (unregistered && test->ops->free)
+		test->ops->free(test->ops, test);
+}
+
+static int event_hist_trigger_func(struct event_command *cmd_ops,
+				   struct trace_event_file *file,
+				   char *glob, char *cmd, char *param)
+{
+	struct event_trigger_data *trigger_data;
+	struct event_trigger_ops *trigger_ops;
+	struct hist_trigger_data *hist_data;
+	struct hist_trigger_attrs *attrs;
+	char *trigger;
+	int ret = 0;
+
+	if (!param)
+		return -EINVAL;
+
+	/* separate the trigger from the filter (k:v [if filter]) */
+	trigger = strsep(&param, " \t");
+	if (!trigger)
+		return -EINVAL;
+
+	attrs = parse_hist_trigger_attrs(trigger);
+	if (IS_ERR(attrs))
+		return PTR_ERR(attrs);
+
+	hist_data = create_hist_data(attrs, file);
+	if (IS_ERR(hist_data)) {
+		destroy_hist_trigger_attrs(attrs);
+		return PTR_ERR(hist_data);
+	}
+
+	trigger_ops = cmd_ops->get_trigger_ops(cmd, trigger);
+
+	ret = -ENOMEM;
+	trigger_data = kzalloc(sizeof(*trigger_data), GFP_KERNEL);
+	if (!trigger_data)
+		goto out_free;
+
+	trigger_data->count = -1;
+	trigger_data->ops = trigger_ops;
+	trigger_data->cmd_ops = cmd_ops;
+	INIT_LIST_HEAD(&trigger_data->list);
+	RCU_INIT_POINTER(trigger_data->filter, NULL);
+	trigger_data->private_data = hist_data;
+
+	/* the filter is part of what identifies the trigger, set it first */
+	if (param) {
+		ret = cmd_ops->set_filter(param, trigger_data, file);
+		if (ret < 0)
+			goto out_free;
+	}
+
+	if (glob[0] == '!') {
+		cmd_ops->unreg(glob+1, trigger_ops, trigger_data, file);
+		ret = 0;
+		goto out_free;
+	}
+
+	ret = cmd_ops->reg(glob, trigger_ops, trigger_data, file);
+	/*
+	 * The above returns on success the # of triggers registered,
+	 * but if it didn't register any it returns zero.  That's only
+	 * expected when an existing trigger was paused, continued or
+	 * cleared; otherwise consider it a failure too.
+	 */
+	if (!ret) {
+		if (!(attrs->pause || attrs->cont || attrs->clear))
+			ret = -ENOENT;
+		goto out_free;
+	} else if (ret < 0)
+		goto out_free;
+
+	/* Just return zero, not the number of registered triggers */
+	ret = 0;
+ out:
+	return ret;
+ out_free:
+	if (trigger_data) {
+		cmd_ops->set_filter(NULL, trigger_data, NULL);
+		kfree(trigger_data);
+	}
+	destroy_hist_data(hist_data);
+	goto out;
+}
+
+static struct event_command trigger_hist_cmd = {
+	.name			= "hist",
+	.trigger_type		= ETT_EVENT_HIST,
+	.needs_rec		= true,
+	.func			= event_hist_trigger_func,
+	.reg			= hist_register_trigger,
+	.unreg			= hist_unregister_trigger,
+	.get_trigger_ops	= event_hist_get_trigger_ops,
+	.set_filter		= set_trigger_filter,
+};
+
+__init int register_trigger_hist_cmd(void)
+{
+	int ret;
+
+	ret = register_event_command(&trigger_hist_cmd);
+	WARN_ON(ret < 0);
+
+	return ret;
+}
+
+/* Showing the table, via the event's 'hist' file */
+
+struct hist_sort_entry {
+	struct hist_elt			*elt;
+	struct hist_trigger_data	*hist_data;
+};
+
+static int hist_sort_cmp(const void *a, const void *b)
+{
+	const struct hist_sort_entry *sort_a = a, *sort_b = b;
+	struct hist_trigger_data *hist_data = sort_a->hist_data;
+	struct hist_field *sort_field;
+	void *key_a, *key_b;
+	int ret;
+
+	sort_field = &hist_data->fields[hist_data->sort_field];
+
+	if (hist_data->sort_field < hist_data->n_vals) {
+		u64 val_a = atomic64_read(&sort_a->elt->sums[hist_data->sort_field]);
+		u64 val_b = atomic64_read(&sort_b->elt->sums[hist_data->sort_field]);
+
+		ret = val_a < val_b ? -1 : val_a > val_b;
+		goto out;
+	}
+
+	key_a = sort_a->elt->key + sort_field->offset;
+	key_b = sort_b->elt->key + sort_field->offset;
+
+	if (sort_field->flags & HIST_FIELD_FL_STRING)
+		ret = strncmp(key_a, key_b, sort_field->field->size);
+	else if (sort_field->flags & HIST_FIELD_FL_STACKTRACE)
+		ret = memcmp(key_a, key_b, HIST_STACKTRACE_SIZE);
+	else if (sort_field->field->is_signed &&
+		 !(sort_field->flags & HIST_FIELD_FL_MODIFIERS)) {
+		s64 val_a = *(s64 *)key_a, val_b = *(s64 *)key_b;
+
+		ret = val_a < val_b ? -1 : val_a > val_b;
+	} else {
+		u64 val_a = *(u64 *)key_a, val_b = *(u64 *)key_b;
+
+		ret = val_a < val_b ? -1 : val_a > val_b;
+	}
+ out:
+	return hist_data->sort_descending ? -ret : ret;
+}
+
+static void hist_trigger_stacktrace_print(struct seq_file *m,
+					  unsigned long *stacktrace_entries)
+{
+	char str[KSYM_SYMBOL_LEN];
+	unsigned int i;
+
+	for (i = 0; i < HIST_STACKTRACE_DEPTH; i++) {
+		if (!stacktrace_entries[i] ||
+		    stacktrace_entries[i] == ULONG_MAX)
+			return;
+
+		sprint_symbol(str, stacktrace_entries[i]);
+		seq_printf(m, "%*c%s\n", 9, ' ', str);
+	}
+}
+
+static void hist_trigger_entry_print(struct seq_file *m,
+				     struct hist_trigger_data *hist_data,
+				     struct hist_elt *elt)
+{
+	struct hist_field *key_field, *val_field;
+	char str[KSYM_SYMBOL_LEN];
+	const char *field_name;
+	unsigned int i;
+	void *key;
+	u64 uval;
+
+	seq_puts(m, "{ ");
+
+	for (i = 0; i < hist_data->n_keys; i++) {
+		key_field = &hist_data->fields[hist_data->n_vals + i];
+		key = elt->key + key_field->offset;
+		field_name = hist_field_name(key_field);
+		uval = *(u64 *)key;
+
+		if (i)
+			seq_puts(m, ", ");
+
+		if (key_field->flags & HIST_FIELD_FL_STACKTRACE) {
+			seq_printf(m, "%s:\n", field_name);
+			hist_trigger_stacktrace_print(m, key);
+		} else if (key_field->flags & HIST_FIELD_FL_STRING) {
+			seq_printf(m, "%s: %-50.*s", field_name,
+				   key_field->field->size, (char *)key);
+		} else if (key_field->flags & HIST_FIELD_FL_HEX) {
+			seq_printf(m, "%s: %llx", field_name, uval);
+		} else if (key_field->flags & HIST_FIELD_FL_SYM) {
+			sprint_symbol_no_offset(str, uval);
+			seq_printf(m, "%s: [%llx] %-45s", field_name, uval, str);
+		} else if (key_field->flags & HIST_FIELD_FL_SYM_OFFSET) {
+			sprint_symbol(str, uval);
+			seq_printf(m, "%s: [%llx] %-55s", field_name, uval, str);
+		} else if (key_field->flags & HIST_FIELD_FL_EXECNAME) {
+			char comm[TASK_COMM_LEN];
+
+			trace_find_cmdline(uval, comm);
+			seq_printf(m, "%s: %-16s[%10llu]", field_name,
+				   comm, uval);
+		} else if (key_field->flags & HIST_FIELD_FL_SYSCALL) {
+			const char *syscall_name;
+
+			syscall_name = get_syscall_name(uval);
+			if (!syscall_name)
+				syscall_name = "unknown_syscall";
+
+			seq_printf(m, "%s: %-30s[%3llu]", field_name,
+				   syscall_name, uval);
+		} else if (key_field->flags & HIST_FIELD_FL_LOG2) {
+			seq_printf(m, "%s: ~ 2^%-2llu", field_name, uval);
+		} else if (key_field->field->is_signed) {
+			seq_printf(m, "%s: %10lld", field_name, (s64)uval);
+		} else {
+			seq_printf(m, "%s: %10llu", field_name, uval);
+		}
+	}
+
+	seq_puts(m, " }");
+
+	seq_printf(m, " hitcount: %10llu",
+		   (u64)atomic64_read(&elt->sums[0]));
+
+	for (i = 1; i < hist_data->n_vals; i++) {
+		val_field = &hist_data->fields[i];
+		seq_printf(m, "  %s: %10llu", hist_field_name(val_field),
+			   (u64)atomic64_read(&elt->sums[i]));
+	}
+
+	seq_putc(m, '\n');
+}
+
+static int print_entries(struct seq_file *m,
+			 struct hist_trigger_data *hist_data)
+{
+	struct hist_map *map = hist_data->map;
+	struct hist_sort_entry *sort_entries;
+	struct hist_elt *elt;
+	unsigned int i, n_entries = 0, n_max;
+
+	n_max = min_t(unsigned int, atomic_read(&map->next_elt),
+		      map->max_elts);
+	if (!n_max)
+		return 0;
+
+	sort_entries = vmalloc(n_max * sizeof(*sort_entries));
+	if (!sort_entries)
+		return -ENOMEM;
+
+	for (i = 0; i < 2 * map->max_elts && n_entries < n_max; i++) {
+		if (!READ_ONCE(map->entries[i].key))
+			continue;
+
+		elt = READ_ONCE(map->entries[i].val);
+		if (!elt)
+			continue;
+
+		sort_entries[n_entries].elt = elt;
+		sort_entries[n_entries].hist_data = hist_data;
+		n_entries++;
+	}
+
+	sort(sort_entries, n_entries, sizeof(*sort_entries),
+	     hist_sort_cmp, NULL);
+
+	for (i = 0; i < n_entries; i++)
+		hist_trigger_entry_print(m, hist_data, sort_entries[i].elt);
+
+	vfree(sort_entries);
+
+	return n_entries;
+}
+
+static void hist_trigger_show(struct seq_file *m,
+			      struct event_trigger_data *data, int n)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	int n_entries;
+
+	if (n > 0)
+		seq_puts(m, "\n\n");
+
+	seq_puts(m, "# event histogram\n#\n# trigger info: ");
+	data->ops->print(m, data->ops, data);
+	seq_puts(m, "#\n\n");
+
+	n_entries = print_entries(m, hist_data);
+	if (n_entries < 0)
+		n_entries = 0;
+
+	seq_printf(m, "\nTotals:\n    Hits: %llu\n    Entries: %u\n    Dropped: %llu\n",
+		   (u64)atomic64_read(&hist_data->map->hits), n_entries,
+		   (u64)atomic64_read(&hist_data->map->drops));
+}
+
+static int hist_show(struct seq_file *m, void *v)
+{
+	struct event_trigger_data *data;
+	struct trace_event_file *event_file;
+	int n = 0, ret = 0;
+
+	mutex_lock(&event_mutex);
+
+	event_file = event_file_data(m->private);
+	if (unlikely(!event_file)) {
+		ret = -ENODEV;
+		goto out_unlock;
+	}
+
+	list_for_each_entry_rcu(data, &event_file->triggers, list) {
+		if (data->cmd_ops->trigger_type == ETT_EVENT_HIST)
+			hist_trigger_show(m, data, n++);
+	}
+
+ out_unlock:
+	mutex_unlock(&event_mutex);
+
+	return ret;
+}
+
+static int event_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hist_show, file);
+}
+
+const struct file_operations event_hist_fops = {
+	.open = event_hist_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
@@ -19,6 +19,7 @@
 #include <linux/sysctl.h>
 #include <linux/smpboot.h>
 #include <linux/sched/rt.h>
+#include <linux/sched/isolation.h>
 #include <linux/tick.h>
 
 #include <asm/irq_regs.h>
@@ -1039,15 +1040,9 @@ void __init lockup_detector_init(void)
 {
 	set_sample_period();
 
-#ifdef CONFIG_NO_HZ_FULL
-	if (tick_nohz_full_enabled()) {
-		pr_info("Disabling watchdog on nohz_full cores by default\n");
-		cpumask_copy(&watchdog_cpumask, housekeeping_mask);
-	} else
-		cpumask_copy(&watchdog_cpumask, cpu_possible_mask);
-#else
-	cpumask_copy(&watchdog_cpumask, cpu_possible_mask);
-#endif
+	cpumask_copy(&watchdog_cpumask, housekeeping_cpumask(HK_FLAG_MISC));
+	if (!cpumask_equal(&watchdog_cpumask, cpu_possible_mask))
+		pr_info("Disabling watchdog on isolated cores by default\n");
 
 	if (watchdog_enabled)
 		watchdog_enable_all_cpus();
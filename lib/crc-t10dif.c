@@ -15,6 +15,7 @@
 #include <linux/init.h>
 #include <crypto/hash.h>
 #include <linux/static_key.h>
+#include <linux/uio.h>
 
 static struct crypto_shash *crct10dif_tfm;
 static struct static_key crct10dif_fallback __read_mostly;
@@ -47,6 +48,42 @@ __u16 crc_t10dif(const unsigned char *buffer, size_t len)
 }
 EXPORT_SYMBOL(crc_t10dif);
 
+static u32 crc_t10dif_iter_update(u32 crc, const void *p, size_t len)
+{
+	return crc_t10dif_update(crc, p, len);
+}
+
+/*
+ * Copy to/from an iov_iter and compute the T10 DIF CRC of the data in the
+ * same pass, see crc_and_copy_to_iter().  To generate protection
+ * information call these once per protection interval.
+ */
+size_t crc_t10dif_and_copy_to_iter(void *addr, size_t bytes, __u16 *crc,
+				   struct iov_iter *i)
+{
+	u32 c = *crc;
+	size_t copied;
+
+	copied = crc_and_copy_to_iter(addr, bytes, &c, crc_t10dif_iter_update,
+				      i);
+	*crc = c;
+	return copied;
+}
+EXPORT_SYMBOL(crc_t10dif_and_copy_to_iter);
+
+size_t crc_t10dif_and_copy_from_iter(void *addr, size_t bytes, __u16 *crc,
+				     struct iov_iter *i)
+{
+	u32 c = *crc;
+	size_t copied;
+
+	copied = crc_and_copy_from_iter(addr, bytes, &c, crc_t10dif_iter_update,
+					i);
+	*crc = c;
+	return copied;
+}
+EXPORT_SYMBOL(crc_t10dif_and_copy_from_iter);
+
 static int __init crc_t10dif_mod_init(void)
 {
 	crct10dif_tfm = crypto_alloc_shash("crct10dif", 0, 0);
@@ -748,6 +748,135 @@ size_t csum_and_copy_to_iter(void *addr, size_t bytes, __wsum *csum,
 }
 EXPORT_SYMBOL(csum_and_copy_to_iter);
 
+/*
+ * The CRC is folded in chunk by chunk right behind the copy, while the
+ * data is still in L1, so that copying and checksumming only pull it
+ * through the cache hierarchy once.
+ */
+#define CRC_COPY_CHUNK	2048
+
+static void crc_copy(void *to, const void *from, size_t len, u32 *crc,
+		     crc_update_fn update, bool crc_dst)
+{
+	while (len) {
+		size_t n = min_t(size_t, len, CRC_COPY_CHUNK);
+
+		memcpy(to, from, n);
+		*crc = update(*crc, crc_dst ? to : from, n);
+		to += n;
+		from += n;
+		len -= n;
+	}
+}
+
+static size_t crc_copy_to_user(void __user *to, const void *from, size_t len,
+			       u32 *crc, crc_update_fn update)
+{
+	while (len) {
+		size_t n = min_t(size_t, len, CRC_COPY_CHUNK);
+		size_t left = __copy_to_user(to, from, n);
+
+		*crc = update(*crc, from, n - left);
+		if (left)
+			return len - n + left;
+		to += n;
+		from += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static size_t crc_copy_from_user(void *to, const void __user *from, size_t len,
+				 u32 *crc, crc_update_fn update)
+{
+	while (len) {
+		size_t n = min_t(size_t, len, CRC_COPY_CHUNK);
+		size_t left = __copy_from_user(to, from, n);
+
+		*crc = update(*crc, to, n - left);
+		if (left)
+			return len - n + left;
+		to += n;
+		from += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * crc_and_copy_to_iter - copy data to an iterator and checksum it
+ * @addr: the data
+ * @bytes: how much of it to copy
+ * @crc: the CRC to update with the data copied
+ * @update: the CRC function, like crc32c()
+ * @i: the destination
+ *
+ * Returns the number of bytes copied; @crc covers exactly those.
+ */
+size_t crc_and_copy_to_iter(void *addr, size_t bytes, u32 *crc,
+			    crc_update_fn update, struct iov_iter *i)
+{
+	char *from = addr;
+	if (unlikely(bytes > i->count))
+		bytes = i->count;
+
+	if (unlikely(!bytes))
+		return 0;
+
+	iterate_and_advance(i, bytes, v,
+		crc_copy_to_user(v.iov_base, (from += v.iov_len) - v.iov_len,
+				 v.iov_len, crc, update),
+	({
+		char *p = kmap_atomic(v.bv_page);
+		crc_copy(p + v.bv_offset, (from += v.bv_len) - v.bv_len,
+			 v.bv_len, crc, update, false);
+		kunmap_atomic(p);
+	}),
+		crc_copy(v.iov_base, (from += v.iov_len) - v.iov_len,
+			 v.iov_len, crc, update, false)
+	)
+
+	return bytes;
+}
+EXPORT_SYMBOL(crc_and_copy_to_iter);
+
+/**
+ * crc_and_copy_from_iter - copy data from an iterator and checksum it
+ * @addr: where to copy to
+ * @bytes: how much to copy
+ * @crc: the CRC to update with the data copied
+ * @update: the CRC function, like crc32c()
+ * @i: the source
+ *
+ * Returns the number of bytes copied; @crc covers exactly those.
+ */
+size_t crc_and_copy_from_iter(void *addr, size_t bytes, u32 *crc,
+			      crc_update_fn update, struct iov_iter *i)
+{
+	char *to = addr;
+	if (unlikely(bytes > i->count))
+		bytes = i->count;
+
+	if (unlikely(!bytes))
+		return 0;
+
+	iterate_and_advance(i, bytes, v,
+		crc_copy_from_user((to += v.iov_len) - v.iov_len, v.iov_base,
+				   v.iov_len, crc, update),
+	({
+		char *p = kmap_atomic(v.bv_page);
+		crc_copy((to += v.bv_len) - v.bv_len, p + v.bv_offset,
+			 v.bv_len, crc, update, true);
+		kunmap_atomic(p);
+	}),
+		crc_copy((to += v.iov_len) - v.iov_len, v.iov_base,
+			 v.iov_len, crc, update, true)
+	)
+
+	return bytes;
+}
+EXPORT_SYMBOL(crc_and_copy_from_iter);
+
 int iov_iter_npages(const struct iov_iter *i, int maxpages)
 {
 	size_t size = i->count;
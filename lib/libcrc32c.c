@@ -36,6 +36,7 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/uio.h>
 
 static struct crypto_shash *tfm;
 
@@ -57,6 +58,29 @@ u32 crc32c(u32 crc, const void *address, unsigned int length)
 
 EXPORT_SYMBOL(crc32c);
 
+static u32 crc32c_update(u32 crc, const void *p, size_t len)
+{
+	return crc32c(crc, p, len);
+}
+
+/*
+ * Copy to/from an iov_iter and compute the crc32c of the data in the same
+ * pass, see crc_and_copy_to_iter().
+ */
+size_t crc32c_and_copy_to_iter(void *addr, size_t bytes, u32 *crc,
+			       struct iov_iter *i)
+{
+	return crc_and_copy_to_iter(addr, bytes, crc, crc32c_update, i);
+}
+EXPORT_SYMBOL(crc32c_and_copy_to_iter);
+
+size_t crc32c_and_copy_from_iter(void *addr, size_t bytes, u32 *crc,
+				 struct iov_iter *i)
+{
+	return crc_and_copy_from_iter(addr, bytes, crc, crc32c_update, i);
+}
+EXPORT_SYMBOL(crc32c_and_copy_from_iter);
+
 static int __init libcrc32c_mod_init(void)
 {
 	tfm = crypto_alloc_shash("crc32c", 0, 0);
@@ -0,0 +1,111 @@
+/*
+ * Range locks, see include/linux/range_lock.h
+ *
+ * All ranges, held or waiting, are in an interval tree. A new range
+ * counts the overlapping ranges already in the tree that it conflicts
+ * with and waits for that count to drop to zero; a range leaving the tree
+ * decrements the count of the conflicting ranges queued after it.
+ */
+
+#include <linux/range_lock.h>
+#include <linux/sched.h>
+#include <linux/export.h>
+
+#define to_range_lock(ptr) container_of(ptr, struct range_lock, node)
+
+static inline bool range_conflicts(struct range_lock *a, struct range_lock *b)
+{
+	return !a->reader || !b->reader;
+}
+
+static void range_lock_common(struct range_lock_tree *tree,
+			      struct range_lock *lock, bool reader)
+{
+	struct interval_tree_node *node;
+
+	lock->reader = reader;
+	lock->task = current;
+
+	spin_lock(&tree->lock);
+	lock->seqnum = tree->seqnum++;
+	node = interval_tree_iter_first(&tree->root, lock->node.start,
+					lock->node.last);
+	while (node) {
+		if (range_conflicts(to_range_lock(node), lock))
+			lock->blocking_ranges++;
+		node = interval_tree_iter_next(node, lock->node.start,
+					       lock->node.last);
+	}
+	interval_tree_insert(&lock->node, &tree->root);
+	spin_unlock(&tree->lock);
+
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!READ_ONCE(lock->blocking_ranges))
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static void range_unlock_common(struct range_lock_tree *tree,
+				struct range_lock *lock)
+{
+	struct interval_tree_node *node;
+
+	spin_lock(&tree->lock);
+	interval_tree_remove(&lock->node, &tree->root);
+	node = interval_tree_iter_first(&tree->root, lock->node.start,
+					lock->node.last);
+	while (node) {
+		struct range_lock *blocked = to_range_lock(node);
+
+		if (blocked->seqnum > lock->seqnum &&
+		    range_conflicts(blocked, lock) &&
+		    !--blocked->blocking_ranges)
+			wake_up_process(blocked->task);
+		node = interval_tree_iter_next(node, lock->node.start,
+					       lock->node.last);
+	}
+	spin_unlock(&tree->lock);
+}
+
+/**
+ * range_read_lock - lock a range for reading
+ * @tree:	the tree of ranges
+ * @lock:	the range, set up with range_lock_init()
+ *
+ * Waits for the overlapping writers queued before @lock to be gone.
+ */
+void range_read_lock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	might_sleep();
+	range_lock_common(tree, lock, true);
+}
+EXPORT_SYMBOL(range_read_lock);
+
+void range_read_unlock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	range_unlock_common(tree, lock);
+}
+EXPORT_SYMBOL(range_read_unlock);
+
+/**
+ * range_write_lock - lock a range for writing
+ * @tree:	the tree of ranges
+ * @lock:	the range, set up with range_lock_init()
+ *
+ * Waits for all the overlapping ranges queued before @lock to be gone.
+ */
+void range_write_lock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	might_sleep();
+	range_lock_common(tree, lock, false);
+}
+EXPORT_SYMBOL(range_write_lock);
+
+void range_write_unlock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	range_unlock_common(tree, lock);
+}
+EXPORT_SYMBOL(range_write_unlock);
@@ -31,6 +31,16 @@
 #define HASH_DEFAULT_SIZE	64UL
 #define HASH_MIN_SIZE		4U
 #define BUCKET_LOCKS_PER_CPU   128UL
+/* Tables with more buckets than this are nested rather than vmalloc()ed */
+#define HASH_NESTED_MIN_SIZE	(1UL << 16)
+
+/* Number of bucket index bits a page of nested table pointers resolves */
+#define NESTED_SHIFT		(PAGE_SHIFT - ilog2(sizeof(void *)))
+
+union nested_table {
+	union nested_table __rcu *table;
+	struct rhash_head __rcu *bucket;
+};
 
 static u32 head_hashfn(struct rhashtable *ht,
 		       const struct bucket_table *tbl,
@@ -95,10 +105,48 @@ static int alloc_bucket_locks(struct rhashtable *ht, struct bucket_table *tbl,
 	return 0;
 }
 
+static void nested_table_free(union nested_table *ntbl, unsigned int size)
+{
+	const unsigned int len = 1 << NESTED_SHIFT;
+	unsigned int i;
+
+	ntbl = rcu_dereference_raw(ntbl->table);
+	if (!ntbl)
+		return;
+
+	if (size > len) {
+		size >>= NESTED_SHIFT;
+		for (i = 0; i < len; i++)
+			nested_table_free(ntbl + i, size);
+	}
+
+	free_page((unsigned long)ntbl);
+}
+
+static void nested_bucket_table_free(const struct bucket_table *tbl)
+{
+	unsigned int size = tbl->size >> tbl->nest;
+	unsigned int len = 1 << tbl->nest;
+	union nested_table *ntbl;
+	unsigned int i;
+
+	ntbl = (union nested_table *)rcu_dereference_raw(tbl->buckets[0]);
+	if (!ntbl)
+		return;
+
+	for (i = 0; i < len; i++)
+		nested_table_free(ntbl + i, size);
+
+	free_page((unsigned long)ntbl);
+}
+
 static void bucket_table_free(const struct bucket_table *tbl)
 {
-	if (tbl)
+	if (tbl) {
+		if (tbl->nest)
+			nested_bucket_table_free(tbl);
 		kvfree(tbl->locks);
+	}
 
 	kvfree(tbl);
 }
@@ -108,6 +156,107 @@ static void bucket_table_free_rcu(struct rcu_head *head)
 	bucket_table_free(container_of(head, struct bucket_table, rcu));
 }
 
+/*
+ * Populate the nested table at *@prev, which holds the @size buckets
+ * whose index has the low @shifted bits equal to @nhash.
+ */
+static int nested_table_alloc(struct rhashtable *ht,
+			      union nested_table __rcu **prev,
+			      unsigned int size, unsigned int nhash,
+			      unsigned int shifted)
+{
+	const unsigned int len = 1 << NESTED_SHIFT;
+	union nested_table *ntbl;
+	unsigned int i;
+	int err;
+
+	ntbl = (union nested_table *)get_zeroed_page(GFP_KERNEL);
+	if (!ntbl)
+		return -ENOMEM;
+	RCU_INIT_POINTER(*prev, ntbl);
+
+	if (size <= len) {
+		for (i = 0; i < size; i++)
+			INIT_RHT_NULLS_HEAD(ntbl[i].bucket, ht,
+					    (i << shifted) | nhash);
+		return 0;
+	}
+
+	size >>= NESTED_SHIFT;
+	for (i = 0; i < len; i++) {
+		err = nested_table_alloc(ht, &ntbl[i].table, size,
+					 (i << shifted) | nhash,
+					 shifted + NESTED_SHIFT);
+		if (err)
+			return err;
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/*
+ * Build a table of @nbuckets from single pages, so that even tables with
+ * tens of millions of buckets neither depend on finding a huge contiguous
+ * area nor on vmalloc space.  The first level resolves the low @nest bits
+ * of the bucket index, every further one NESTED_SHIFT bits.
+ */
+static struct bucket_table *nested_bucket_table_alloc(struct rhashtable *ht,
+						      size_t nbuckets)
+{
+	struct bucket_table *tbl;
+	union nested_table *ntbl;
+	unsigned int i, nest, size;
+
+	if (nbuckets < (1UL << (NESTED_SHIFT + 1)))
+		return NULL;
+
+	tbl = kzalloc(sizeof(*tbl) + sizeof(tbl->buckets[0]), GFP_KERNEL);
+	if (!tbl)
+		return NULL;
+
+	nest = (ilog2(nbuckets) - 1) % NESTED_SHIFT + 1;
+	tbl->size = nbuckets;
+	tbl->nest = nest;
+
+	ntbl = (union nested_table *)get_zeroed_page(GFP_KERNEL);
+	if (!ntbl)
+		goto fail;
+	RCU_INIT_POINTER(tbl->buckets[0], (struct rhash_head *)ntbl);
+
+	size = nbuckets >> nest;
+	for (i = 0; i < (1U << nest); i++)
+		if (nested_table_alloc(ht, &ntbl[i].table, size, i, nest))
+			goto fail;
+
+	return tbl;
+
+fail:
+	bucket_table_free(tbl);
+	return NULL;
+}
+
+struct rhash_head __rcu **rht_bucket_nested(const struct bucket_table *tbl,
+					    unsigned int hash)
+{
+	unsigned int size = tbl->size >> tbl->nest;
+	union nested_table *ntbl;
+
+	ntbl = (union nested_table *)rcu_dereference_raw(tbl->buckets[0]);
+	ntbl = rcu_dereference_raw(ntbl[hash & ((1 << tbl->nest) - 1)].table);
+	hash >>= tbl->nest;
+
+	while (size > (1 << NESTED_SHIFT)) {
+		ntbl = rcu_dereference_raw(
+			ntbl[hash & ((1 << NESTED_SHIFT) - 1)].table);
+		size >>= NESTED_SHIFT;
+		hash >>= NESTED_SHIFT;
+	}
+
+	return &ntbl[hash].bucket;
+}
+EXPORT_SYMBOL_GPL(rht_bucket_nested);
+
 static struct bucket_table *bucket_table_alloc(struct rhashtable *ht,
 					       size_t nbuckets,
 					       gfp_t gfp)
@@ -120,12 +269,19 @@ static struct bucket_table *bucket_table_alloc(struct rhashtable *ht,
 	if (size <= (PAGE_SIZE << PAGE_ALLOC_COSTLY_ORDER) ||
 	    gfp != GFP_KERNEL)
 		tbl = kzalloc(size, gfp | __GFP_NOWARN | __GFP_NORETRY);
-	if (tbl == NULL && gfp == GFP_KERNEL)
-		tbl = vzalloc(size);
+	if (tbl == NULL && gfp == GFP_KERNEL) {
+		if (nbuckets <= HASH_NESTED_MIN_SIZE)
+			tbl = vzalloc(size);
+		if (tbl == NULL) {
+			tbl = nested_bucket_table_alloc(ht, nbuckets);
+			nbuckets = 0;
+		}
+	}
 	if (tbl == NULL)
 		return NULL;
 
-	tbl->size = nbuckets;
+	if (nbuckets)
+		tbl->size = nbuckets;
 
 	if (alloc_bucket_locks(ht, tbl, gfp) < 0) {
 		bucket_table_free(tbl);
@@ -160,7 +316,7 @@ static int rhashtable_rehash_one(struct rhashtable *ht, unsigned int old_hash)
 	struct bucket_table *old_tbl = rht_dereference(ht->tbl, ht);
 	struct bucket_table *new_tbl = rhashtable_last_table(ht,
 		rht_dereference_rcu(old_tbl->future_tbl, ht));
-	struct rhash_head __rcu **pprev = &old_tbl->buckets[old_hash];
+	struct rhash_head __rcu **pprev = rht_bucket_var(old_tbl, old_hash);
 	int err = -ENOENT;
 	struct rhash_head *head, *next, *entry;
 	spinlock_t *new_bucket_lock;
@@ -184,12 +340,12 @@ static int rhashtable_rehash_one(struct rhashtable *ht, unsigned int old_hash)
 	new_bucket_lock = rht_bucket_lock(new_tbl, new_hash);
 
 	spin_lock_nested(new_bucket_lock, SINGLE_DEPTH_NESTING);
-	head = rht_dereference_bucket(new_tbl->buckets[new_hash],
+	head = rht_dereference_bucket(*rht_bucket(new_tbl, new_hash),
 				      new_tbl, new_hash);
 
 	RCU_INIT_POINTER(entry->next, head);
 
-	rcu_assign_pointer(new_tbl->buckets[new_hash], entry);
+	rcu_assign_pointer(*rht_bucket_var(new_tbl, new_hash), entry);
 	spin_unlock(new_bucket_lock);
 
 	rcu_assign_pointer(*pprev, next);
@@ -466,11 +622,11 @@ struct bucket_table *rhashtable_insert_slow(struct rhashtable *ht,
 
 	err = 0;
 
-	head = rht_dereference_bucket(tbl->buckets[hash], tbl, hash);
+	head = rht_dereference_bucket(*rht_bucket(tbl, hash), tbl, hash);
 
 	RCU_INIT_POINTER(obj->next, head);
 
-	rcu_assign_pointer(tbl->buckets[hash], obj);
+	rcu_assign_pointer(*rht_bucket_var(tbl, hash), obj);
 
 	atomic_inc(&ht->nelems);
 
@@ -833,7 +989,7 @@ void rhashtable_free_and_destroy(struct rhashtable *ht,
 		for (i = 0; i < tbl->size; i++) {
 			struct rhash_head *pos, *next;
 
-			for (pos = rht_dereference(tbl->buckets[i], ht),
+			for (pos = rht_dereference(*rht_bucket(tbl, i), ht),
 			     next = !rht_is_a_nulls(pos) ?
 					rht_dereference(pos->next, ht) : NULL;
 			     !rht_is_a_nulls(pos);
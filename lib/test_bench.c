@@ -0,0 +1,355 @@
+/*
+ * Microbenchmarks of kernel hot paths
+ *
+ * The benchmarks run in the context of the task writing their name, and
+ * optionally an iteration count, to <debugfs>/bench/run:
+ *
+ *	echo "page_alloc 100000" > /sys/kernel/debug/bench/run
+ *	cat /sys/kernel/debug/bench/run
+ *
+ * Reading the file returns the results of the last run, one line per
+ * measured operation:
+ *
+ *	<benchmark>.<operation> iterations=<n> ns_total=<ns> ns_per_op=<ns>
+ *
+ * which is the format tools/testing/selftests/bench uses for the
+ * benchmarks it runs from userspace, so that results of different
+ * kernels can be compared.  <debugfs>/bench/list lists the benchmarks.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/debugfs.h>
+#include <linux/gfp.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+/* objects allocated before being freed again, to exercise the caches */
+#define BENCH_BATCH		64
+#define BENCH_MAX_ITERS		(1UL << 24)
+#define BENCH_RESULT_SIZE	1024
+
+struct bench {
+	const char *name;
+	unsigned long default_iters;
+	int (*run)(const struct bench *b, unsigned long iters);
+};
+
+static DEFINE_MUTEX(bench_mutex);
+static char bench_result[BENCH_RESULT_SIZE];
+static size_t bench_result_len;
+
+static void bench_report(const struct bench *b, const char *op,
+			 unsigned long iters, u64 ns)
+{
+	bench_result_len += scnprintf(bench_result + bench_result_len,
+				      sizeof(bench_result) - bench_result_len,
+				      "%s.%s iterations=%lu ns_total=%llu ns_per_op=%llu\n",
+				      b->name, op, iters, ns,
+				      div64_u64(ns, iters));
+}
+
+static int bench_page_alloc(const struct bench *b, unsigned long iters)
+{
+	struct page *pages[BENCH_BATCH];
+	u64 alloc_ns = 0, free_ns = 0, start;
+	unsigned long done, i, n;
+
+	for (done = 0; done < iters; done += n) {
+		n = min_t(unsigned long, iters - done, BENCH_BATCH);
+
+		start = ktime_get_ns();
+		for (i = 0; i < n; i++) {
+			pages[i] = alloc_page(GFP_KERNEL);
+			if (unlikely(!pages[i]))
+				break;
+		}
+		alloc_ns += ktime_get_ns() - start;
+
+		if (unlikely(i < n)) {
+			while (i--)
+				__free_page(pages[i]);
+			return -ENOMEM;
+		}
+
+		start = ktime_get_ns();
+		for (i = 0; i < n; i++)
+			__free_page(pages[i]);
+		free_ns += ktime_get_ns() - start;
+
+		cond_resched();
+	}
+
+	bench_report(b, "alloc", iters, alloc_ns);
+	bench_report(b, "free", iters, free_ns);
+	return 0;
+}
+
+static int bench_slab(const struct bench *b, unsigned long iters)
+{
+	void *objs[BENCH_BATCH];
+	u64 alloc_ns = 0, free_ns = 0, start;
+	unsigned long done, i, n;
+
+	for (done = 0; done < iters; done += n) {
+		n = min_t(unsigned long, iters - done, BENCH_BATCH);
+
+		start = ktime_get_ns();
+		for (i = 0; i < n; i++) {
+			objs[i] = kmalloc(64, GFP_KERNEL);
+			if (unlikely(!objs[i]))
+				break;
+		}
+		alloc_ns += ktime_get_ns() - start;
+
+		if (unlikely(i < n)) {
+			while (i--)
+				kfree(objs[i]);
+			return -ENOMEM;
+		}
+
+		start = ktime_get_ns();
+		for (i = 0; i < n; i++)
+			kfree(objs[i]);
+		free_ns += ktime_get_ns() - start;
+
+		cond_resched();
+	}
+
+	bench_report(b, "kmalloc64", iters, alloc_ns);
+	bench_report(b, "kfree64", iters, free_ns);
+	return 0;
+}
+
+struct bench_obj {
+	u32			key;
+	struct rhash_head	node;
+};
+
+static const struct rhashtable_params bench_rht_params = {
+	.head_offset		= offsetof(struct bench_obj, node),
+	.key_offset		= offsetof(struct bench_obj, key),
+	.key_len		= sizeof(u32),
+	.hashfn			= jhash,
+	.automatic_shrinking	= true,
+};
+
+static int bench_rhashtable(const struct bench *b, unsigned long iters)
+{
+	u64 insert_ns, lookup_ns, remove_ns, start;
+	struct bench_obj *objs;
+	struct rhashtable ht;
+	unsigned long i;
+	int err;
+
+	objs = vzalloc(iters * sizeof(*objs));
+	if (!objs)
+		return -ENOMEM;
+	for (i = 0; i < iters; i++)
+		objs[i].key = i;
+
+	err = rhashtable_init(&ht, &bench_rht_params);
+	if (err)
+		goto out_free;
+
+	/* the table grows along, as it would in real use */
+	start = ktime_get_ns();
+	for (i = 0; i < iters; i++) {
+		err = rhashtable_insert_fast(&ht, &objs[i].node,
+					     bench_rht_params);
+		if (err)
+			goto out_destroy;
+	}
+	insert_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	rcu_read_lock();
+	for (i = 0; i < iters; i++) {
+		u32 key = i;
+
+		if (!rhashtable_lookup_fast(&ht, &key, bench_rht_params)) {
+			rcu_read_unlock();
+			err = -ENOENT;
+			goto out_destroy;
+		}
+	}
+	rcu_read_unlock();
+	lookup_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < iters; i++)
+		rhashtable_remove_fast(&ht, &objs[i].node, bench_rht_params);
+	remove_ns = ktime_get_ns() - start;
+
+	bench_report(b, "insert", iters, insert_ns);
+	bench_report(b, "lookup", iters, lookup_ns);
+	bench_report(b, "remove", iters, remove_ns);
+
+out_destroy:
+	rhashtable_destroy(&ht);
+out_free:
+	vfree(objs);
+	return err;
+}
+
+static atomic_long_t bench_rcu_done;
+
+static void bench_rcu_cb(struct rcu_head *head)
+{
+	atomic_long_inc(&bench_rcu_done);
+}
+
+static int bench_rcu(const struct bench *b, unsigned long iters)
+{
+	u64 queue_ns, total_ns, start;
+	struct rcu_head *heads;
+	unsigned long i;
+
+	heads = vmalloc(iters * sizeof(*heads));
+	if (!heads)
+		return -ENOMEM;
+
+	atomic_long_set(&bench_rcu_done, 0);
+
+	start = ktime_get_ns();
+	for (i = 0; i < iters; i++)
+		call_rcu(&heads[i], bench_rcu_cb);
+	queue_ns = ktime_get_ns() - start;
+	/* until all of the callbacks have been invoked */
+	rcu_barrier();
+	total_ns = ktime_get_ns() - start;
+
+	vfree(heads);
+	if (WARN_ON(atomic_long_read(&bench_rcu_done) != iters))
+		return -EINVAL;
+
+	bench_report(b, "call_rcu", iters, queue_ns);
+	bench_report(b, "callback", iters, total_ns);
+	return 0;
+}
+
+static const struct bench benches[] = {
+	{ "page_alloc",	1UL << 20,	bench_page_alloc },
+	{ "slab",	1UL << 20,	bench_slab },
+	{ "rhashtable",	1UL << 18,	bench_rhashtable },
+	{ "rcu",	1UL << 18,	bench_rcu },
+};
+
+static ssize_t bench_run_read(struct file *file, char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	ssize_t ret;
+
+	mutex_lock(&bench_mutex);
+	ret = simple_read_from_buffer(buf, count, ppos, bench_result,
+				      bench_result_len);
+	mutex_unlock(&bench_mutex);
+	return ret;
+}
+
+static ssize_t bench_run_write(struct file *file, const char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	char buf[64], name[32];
+	unsigned long iters = 0;
+	int i, n, err;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	n = sscanf(buf, "%31s %lu", name, &iters);
+	if (n < 1)
+		return -EINVAL;
+	if (n == 2 && (!iters || iters > BENCH_MAX_ITERS))
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++)
+		if (!strcmp(name, benches[i].name))
+			break;
+	if (i == ARRAY_SIZE(benches))
+		return -ENOENT;
+	if (!iters)
+		iters = benches[i].default_iters;
+
+	mutex_lock(&bench_mutex);
+	bench_result_len = 0;
+	err = benches[i].run(&benches[i], iters);
+	if (err)
+		bench_result_len = 0;
+	mutex_unlock(&bench_mutex);
+
+	return err ? err : count;
+}
+
+static const struct file_operations bench_run_fops = {
+	.owner	= THIS_MODULE,
+	.read	= bench_run_read,
+	.write	= bench_run_write,
+	.llseek	= default_llseek,
+};
+
+static ssize_t bench_list_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	char list[ARRAY_SIZE(benches) * 32];
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++)
+		len += scnprintf(list + len, sizeof(list) - len, "%s\n",
+				 benches[i].name);
+
+	return simple_read_from_buffer(buf, count, ppos, list, len);
+}
+
+static const struct file_operations bench_list_fops = {
+	.owner	= THIS_MODULE,
+	.read	= bench_list_read,
+	.llseek	= default_llseek,
+};
+
+static struct dentry *bench_dir;
+
+static int __init test_bench_init(void)
+{
+	bench_dir = debugfs_create_dir("bench", NULL);
+	if (!bench_dir)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("run", 0600, bench_dir, NULL,
+				 &bench_run_fops) ||
+	    !debugfs_create_file("list", 0400, bench_dir, NULL,
+				 &bench_list_fops)) {
+		debugfs_remove_recursive(bench_dir);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void __exit test_bench_exit(void)
+{
+	debugfs_remove_recursive(bench_dir);
+}
+
+module_init(test_bench_init);
+module_exit(test_bench_exit);
+
+MODULE_DESCRIPTION("Microbenchmarks of kernel hot paths");
+MODULE_LICENSE("GPL v2");
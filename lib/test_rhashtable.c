@@ -27,6 +27,7 @@
 
 #define MAX_ENTRIES	1000000
 #define TEST_INSERT_FAIL INT_MAX
+#define TEST_BULK_BATCH	16
 
 static int entries = 50000;
 module_param(entries, int, 0);
@@ -52,6 +53,14 @@ static int tcount = 10;
 module_param(tcount, int, 0);
 MODULE_PARM_DESC(tcount, "Number of threads to spawn (default: 10)");
 
+static bool bulk = false;
+module_param(bulk, bool, 0);
+MODULE_PARM_DESC(bulk, "Insert in batches in the throughput test (default: off)");
+
+static int nested_size = 1 << 18;
+module_param(nested_size, int, 0);
+MODULE_PARM_DESC(nested_size, "Size hint of the nested table test, 0 to skip (default: 262144)");
+
 struct test_obj {
 	int			value;
 	struct rhash_head	node;
@@ -61,6 +70,9 @@ struct thread_data {
 	int id;
 	struct task_struct *task;
 	struct test_obj *objs;
+	u64 insert_ns;
+	u64 lookup_ns;
+	u64 remove_ns;
 };
 
 static struct test_obj array[MAX_ENTRIES];
@@ -301,6 +313,184 @@ out:
 	return err;
 }
 
+/* Insert objs[0..n) in batches, returns the number of failed insertions */
+static int bench_insert_bulk(struct test_obj *objs, int n)
+{
+	struct rhash_head *batch[TEST_BULK_BATCH];
+	int i, j, k, nr, fails = 0;
+
+	for (i = 0; i < n; i += nr) {
+		nr = min(n - i, TEST_BULK_BATCH);
+		for (j = 0; j < nr; j++)
+			batch[j] = &objs[i + j].node;
+
+		/* the rest of the batch is retried one by one */
+		for (k = rhashtable_insert_bulk(&ht, batch, nr,
+						test_rht_params);
+		     k < nr; k++) {
+			if (rhashtable_insert_fast(&ht, batch[k],
+						   test_rht_params)) {
+				objs[i + k].value = TEST_INSERT_FAIL;
+				fails++;
+			}
+		}
+	}
+	return fails;
+}
+
+static int bench_threadfunc(void *data)
+{
+	struct thread_data *tdata = data;
+	int i, err = 0, insert_fails = 0;
+	s64 start;
+
+	for (i = 0; i < entries; i++)
+		tdata->objs[i].value = (tdata->id << 16) | i;
+
+	up(&prestart_sem);
+	if (down_interruptible(&startup_sem))
+		pr_err("  thread[%d]: down_interruptible failed\n", tdata->id);
+
+	start = ktime_get_ns();
+	if (bulk) {
+		insert_fails = bench_insert_bulk(tdata->objs, entries);
+	} else {
+		for (i = 0; i < entries; i++) {
+			if (rhashtable_insert_fast(&ht, &tdata->objs[i].node,
+						   test_rht_params)) {
+				tdata->objs[i].value = TEST_INSERT_FAIL;
+				insert_fails++;
+			}
+		}
+	}
+	tdata->insert_ns = ktime_get_ns() - start;
+	if (insert_fails)
+		pr_info("  thread[%d]: %d insert failures\n",
+			tdata->id, insert_fails);
+
+	start = ktime_get_ns();
+	err = thread_lookup_test(tdata);
+	tdata->lookup_ns = ktime_get_ns() - start;
+	if (err)
+		pr_err("  thread[%d]: lookups failed\n", tdata->id);
+
+	start = ktime_get_ns();
+	for (i = 0; i < entries; i++) {
+		if (tdata->objs[i].value == TEST_INSERT_FAIL)
+			continue;
+		if (rhashtable_remove_fast(&ht, &tdata->objs[i].node,
+					   test_rht_params)) {
+			pr_err("  thread[%d]: rhashtable_remove_fast failed\n",
+			       tdata->id);
+			err++;
+		}
+	}
+	tdata->remove_ns = ktime_get_ns() - start;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule();
+	}
+	return err;
+}
+
+static u64 __init bench_rate(u64 ops, u64 ns)
+{
+	if (!ns)
+		return 0;
+	return div64_u64(ops * NSEC_PER_SEC, ns);
+}
+
+/*
+ * Throughput test: all threads insert into, look up in and remove from
+ * one table at the same time.  The rates are total operations over the
+ * time the slowest thread took for the phase.
+ */
+static int __init test_rht_bench(struct thread_data *tdata,
+				 struct test_obj *objs)
+{
+	u64 insert_ns = 0, lookup_ns = 0, remove_ns = 0;
+	u64 ops = (u64)tcount * entries;
+	int i, err, started_threads = 0, failed_threads = 0;
+
+	memset(objs, 0, tcount * entries * sizeof(struct test_obj));
+	err = rhashtable_init(&ht, &test_rht_params);
+	if (err < 0) {
+		pr_warn("Test failed: Unable to initialize hashtable: %d\n",
+			err);
+		return err;
+	}
+
+	sema_init(&prestart_sem, 1 - tcount);
+	for (i = 0; i < tcount; i++) {
+		tdata[i].id = i;
+		tdata[i].objs = objs + i * entries;
+		tdata[i].task = kthread_run(bench_threadfunc, &tdata[i],
+					    "rhashtable_bench[%d]", i);
+		if (IS_ERR(tdata[i].task))
+			pr_err(" kthread_run failed for thread %d\n", i);
+		else
+			started_threads++;
+	}
+	if (down_interruptible(&prestart_sem))
+		pr_err("  down interruptible failed\n");
+	for (i = 0; i < tcount; i++)
+		up(&startup_sem);
+	for (i = 0; i < tcount; i++) {
+		if (IS_ERR(tdata[i].task))
+			continue;
+		if ((err = kthread_stop(tdata[i].task))) {
+			pr_warn("Test failed: thread %d returned: %d\n",
+				i, err);
+			failed_threads++;
+		}
+		insert_ns = max(insert_ns, tdata[i].insert_ns);
+		lookup_ns = max(lookup_ns, tdata[i].lookup_ns);
+		remove_ns = max(remove_ns, tdata[i].remove_ns);
+	}
+	rhashtable_destroy(&ht);
+
+	pr_info("  %d threads, %d failed: insert%s %llu/s, lookup %llu/s, remove %llu/s\n",
+		started_threads, failed_threads, bulk ? " (bulk)" : "",
+		bench_rate(ops, insert_ns), bench_rate(ops, lookup_ns),
+		bench_rate(ops, remove_ns));
+
+	return failed_threads ? -EINVAL : 0;
+}
+
+/* Run the basic test on a table large enough to be nested from the start */
+static int __init test_rht_nested(void)
+{
+	struct rhashtable_params params = test_rht_params;
+	const struct bucket_table *tbl;
+	s64 time;
+	int err;
+
+	params.nelem_hint = nested_size;
+	params.max_size = 0;
+
+	memset(&array, 0, sizeof(array));
+	err = rhashtable_init(&ht, &params);
+	if (err < 0) {
+		pr_warn("Test failed: Unable to initialize nested hashtable: %d\n",
+			err);
+		return err;
+	}
+
+	tbl = rht_dereference(ht.tbl, &ht);
+	pr_info("Nested table test: %u buckets, %u bits nested at first level\n",
+		tbl->size, tbl->nest);
+
+	time = test_rhashtable(&ht);
+	rhashtable_destroy(&ht);
+	if (time < 0) {
+		pr_warn("Test failed: return code %lld\n", time);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int __init test_rht_init(void)
 {
 	int i, err, started_threads = 0, failed_threads = 0;
@@ -342,6 +532,9 @@ static int __init test_rht_init(void)
 	do_div(total_time, runs);
 	pr_info("Average test time: %llu\n", total_time);
 
+	if (nested_size && test_rht_nested())
+		return -EINVAL;
+
 	if (!tcount)
 		return 0;
 
@@ -391,6 +584,11 @@ static int __init test_rht_init(void)
 	pr_info("Started %d threads, %d failed\n",
 	        started_threads, failed_threads);
 	rhashtable_destroy(&ht);
+
+	pr_info("Testing concurrent rhashtable throughput from %d threads\n",
+		tcount);
+	test_rht_bench(tdata, objs);
+
 	vfree(tdata);
 	vfree(objs);
 	return 0;
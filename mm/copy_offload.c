@@ -0,0 +1,172 @@
+/*
+ * Offloading huge page copies to DMA engines
+ *
+ * Migrating a transparent or hugetlb huge page and collapsing small pages
+ * into a THP copy megabytes with the CPU, which takes the memory bandwidth
+ * and the caches of whatever else runs there. With vm.copy_offload set
+ * those copies are queued to a public DMA_MEMCPY channel of the dmaengine
+ * instead, and the copying task sleeps until the engine is done.
+ *
+ * A copy that cannot be queued, because there is no channel, no
+ * descriptor or no mapping, is left to the caller to do with the CPU. So
+ * is the whole batch when the engine reports an error.
+ *
+ * Pages copied by the engine are counted in copy_offload_pages in
+ * /proc/vmstat, pages the CPU had to copy instead in copy_offload_fallback.
+ *
+ * DMA is assumed to be cache coherent and the copies are made through
+ * the physical pages, without regard to virtual cache aliases.
+ */
+
+#include <linux/mm.h>
+#include <linux/completion.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/mutex.h>
+#include <linux/sysctl.h>
+#include <linux/vmstat.h>
+#include <linux/copy_offload.h>
+
+int sysctl_copy_offload __read_mostly;
+
+/*
+ * Public channels are only handed out by dma_find_channel() once someone
+ * did a dmaengine_get(). That reference is kept once taken: batches in
+ * flight may still use the channels after offloading was switched off.
+ */
+static bool copy_offload_registered;
+static DEFINE_MUTEX(copy_offload_mutex);
+
+/**
+ * copy_offload_begin - start a batch of page copies
+ * @co: the batch
+ *
+ * Returns false if offloading is off or there is no channel to offload
+ * to, in which case the caller copies with the CPU and must not call
+ * copy_offload_pages() or copy_offload_end().
+ */
+bool copy_offload_begin(struct copy_offload *co)
+{
+	if (!READ_ONCE(sysctl_copy_offload))
+		return false;
+
+	co->chan = dma_find_channel(DMA_MEMCPY);
+	co->cookie = 0;
+	co->nr_pages = 0;
+	return co->chan != NULL;
+}
+
+/**
+ * copy_offload_pages - queue a copy of physically contiguous pages
+ * @co: the batch
+ * @dst: first page to copy to
+ * @src: first page to copy from
+ * @nr_pages: number of pages
+ *
+ * Returns false if the copy could not be queued; the caller has to do it
+ * then, and may go on queueing others.
+ */
+bool copy_offload_pages(struct copy_offload *co, struct page *dst,
+			struct page *src, unsigned int nr_pages)
+{
+	struct dma_device *device = co->chan->device;
+	struct dma_async_tx_descriptor *tx = NULL;
+	struct dmaengine_unmap_data *unmap;
+	size_t len = (size_t)nr_pages << PAGE_SHIFT;
+	dma_addr_t src_dma, dst_dma;
+
+	unmap = dmaengine_get_unmap_data(device->dev, 2, GFP_NOWAIT);
+	if (!unmap)
+		goto fallback;
+	unmap->len = len;
+
+	src_dma = dma_map_page(device->dev, src, 0, len, DMA_TO_DEVICE);
+	if (dma_mapping_error(device->dev, src_dma))
+		goto put;
+	unmap->addr[unmap->to_cnt++] = src_dma;
+
+	dst_dma = dma_map_page(device->dev, dst, 0, len, DMA_FROM_DEVICE);
+	if (dma_mapping_error(device->dev, dst_dma))
+		goto put;
+	unmap->addr[unmap->to_cnt + unmap->from_cnt++] = dst_dma;
+
+	tx = device->device_prep_dma_memcpy(co->chan, dst_dma, src_dma, len,
+					    DMA_CTRL_ACK);
+	if (tx) {
+		dma_set_unmap(tx, unmap);
+		co->cookie = dmaengine_submit(tx);
+		co->nr_pages += nr_pages;
+	}
+put:
+	dmaengine_unmap_put(unmap);
+	if (tx)
+		return true;
+fallback:
+	count_vm_events(COPY_OFFLOAD_FALLBACK, nr_pages);
+	return false;
+}
+
+static void copy_offload_done(void *arg)
+{
+	complete(arg);
+}
+
+/**
+ * copy_offload_end - wait for a batch of copies to complete
+ * @co: the batch
+ *
+ * Returns true if all copies queued have been done. On false the caller
+ * has to redo all of them with the CPU.
+ */
+bool copy_offload_end(struct copy_offload *co)
+{
+	struct dma_chan *chan = co->chan;
+	struct dma_async_tx_descriptor *tx = NULL;
+	DECLARE_COMPLETION_ONSTACK(done);
+	enum dma_status status;
+
+	if (!co->nr_pages)
+		return true;
+
+	/*
+	 * Memcpy channels complete in order, so an interrupt descriptor
+	 * after the copies lets us sleep rather than poll for the last one.
+	 */
+	if (dma_has_cap(DMA_INTERRUPT, chan->device->cap_mask))
+		tx = chan->device->device_prep_dma_interrupt(chan,
+				DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+	if (tx) {
+		tx->callback = copy_offload_done;
+		tx->callback_param = &done;
+		dmaengine_submit(tx);
+		dma_async_issue_pending(chan);
+		wait_for_completion(&done);
+		status = dma_async_is_tx_complete(chan, co->cookie, NULL, NULL);
+	} else {
+		status = dma_sync_wait(chan, co->cookie);
+	}
+
+	if (status != DMA_COMPLETE) {
+		count_vm_events(COPY_OFFLOAD_FALLBACK, co->nr_pages);
+		return false;
+	}
+	count_vm_events(COPY_OFFLOAD_PAGES, co->nr_pages);
+	return true;
+}
+
+int copy_offload_sysctl_handler(struct ctl_table *table, int write,
+				void __user *buffer, size_t *length,
+				loff_t *ppos)
+{
+	int ret;
+
+	mutex_lock(&copy_offload_mutex);
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!ret && write && sysctl_copy_offload && !copy_offload_registered) {
+		dmaengine_get();
+		copy_offload_registered = true;
+	}
+	mutex_unlock(&copy_offload_mutex);
+
+	return ret;
+}
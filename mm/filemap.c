@@ -676,6 +676,21 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 }
 EXPORT_SYMBOL(add_to_page_cache_locked);
 
+static void page_cache_lru_add(struct page *page, void *shadow)
+{
+	/*
+	 * The page might have been evicted from cache only
+	 * recently, in which case it should be activated like
+	 * any other repeatedly accessed page.
+	 */
+	if (shadow && workingset_refault(shadow)) {
+		SetPageActive(page);
+		workingset_activation(page);
+	} else
+		ClearPageActive(page);
+	lru_cache_add(page);
+}
+
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
@@ -687,23 +702,124 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 					 gfp_mask, &shadow);
 	if (unlikely(ret))
 		__clear_page_locked(page);
-	else {
-		/*
-		 * The page might have been evicted from cache only
-		 * recently, in which case it should be activated like
-		 * any other repeatedly accessed page.
-		 */
-		if (shadow && workingset_refault(shadow)) {
-			SetPageActive(page);
-			workingset_activation(page);
-		} else
-			ClearPageActive(page);
-		lru_cache_add(page);
-	}
+	else
+		page_cache_lru_add(page, shadow);
 	return ret;
 }
 EXPORT_SYMBOL_GPL(add_to_page_cache_lru);
 
+/*
+ * Insert up to PAGEVEC_SIZE locked pages, all in the same radix tree
+ * node, under one hold of the tree_lock: after the first insertion the
+ * others need no new nodes, so one preload covers them all.
+ */
+static int __add_to_page_cache_batch(struct page **pages, int nr,
+				     struct address_space *mapping,
+				     gfp_t gfp_mask, void **shadows)
+{
+	struct mem_cgroup *memcg[PAGEVEC_SIZE];
+	int i, charged, added = 0;
+	int error = 0;
+
+	for (charged = 0; charged < nr; charged++) {
+		struct page *page = pages[charged];
+
+		VM_BUG_ON_PAGE(!PageLocked(page), page);
+		VM_BUG_ON_PAGE(PageSwapBacked(page) || PageHuge(page), page);
+		error = mem_cgroup_try_charge(page, current->mm, gfp_mask,
+					      &memcg[charged]);
+		if (error)
+			break;
+	}
+	if (!charged)
+		return error;
+
+	error = radix_tree_maybe_preload(gfp_mask & ~__GFP_HIGHMEM);
+	if (error)
+		goto cancel;
+
+	spin_lock_irq(&mapping->tree_lock);
+	for (; added < charged; added++) {
+		struct page *page = pages[added];
+
+		page_cache_get(page);
+		page->mapping = mapping;
+		shadows[added] = NULL;
+		error = page_cache_tree_insert(mapping, page, &shadows[added]);
+		if (unlikely(error)) {
+			page->mapping = NULL;
+			break;
+		}
+		__inc_zone_page_state(page, NR_FILE_PAGES);
+	}
+	radix_tree_preload_end();
+	spin_unlock_irq(&mapping->tree_lock);
+	if (added < charged)
+		page_cache_release(pages[added]);
+
+	for (i = 0; i < added; i++) {
+		mem_cgroup_commit_charge(pages[i], memcg[i], false);
+		trace_mm_filemap_add_to_page_cache(pages[i]);
+	}
+cancel:
+	for (i = added; i < charged; i++)
+		mem_cgroup_cancel_charge(pages[i], memcg[i]);
+	return added ? added : error;
+}
+
+/**
+ * add_to_page_cache_lru_batch - add new pages to the pagecache and the LRU
+ * @pages:	pages to add, with ->index set, in increasing index order
+ * @nr:		number of pages
+ * @mapping:	the pages' address_space
+ * @gfp_mask:	page allocation mode
+ *
+ * Like add_to_page_cache_lru() on each page in turn, but taking the
+ * tree_lock once per radix tree node the pages are going to. Stops at the
+ * first page that could not be added.
+ *
+ * Returns the number of pages added from the start of @pages, or the error
+ * that prevented adding the first one.
+ */
+int add_to_page_cache_lru_batch(struct page **pages, int nr,
+				struct address_space *mapping, gfp_t gfp_mask)
+{
+	void *shadows[PAGEVEC_SIZE];
+	int done = 0;
+
+	while (done < nr) {
+		pgoff_t first = pages[done]->index;
+		int i, n, ret;
+
+		for (n = 1; n < min(nr - done, PAGEVEC_SIZE); n++) {
+			if ((pages[done + n]->index ^ first) >>
+			    RADIX_TREE_MAP_SHIFT)
+				break;
+		}
+
+		for (i = 0; i < n; i++)
+			__set_page_locked(pages[done + i]);
+		ret = __add_to_page_cache_batch(pages + done, n, mapping,
+						gfp_mask, shadows);
+		for (i = 0; i < n; i++) {
+			struct page *page = pages[done + i];
+
+			if (i < ret)
+				page_cache_lru_add(page, shadows[i]);
+			else
+				__clear_page_locked(page);
+		}
+
+		if (ret < 0)
+			return done ? done : ret;
+		done += ret;
+		if (ret < n)
+			break;
+	}
+	return done;
+}
+EXPORT_SYMBOL_GPL(add_to_page_cache_lru_batch);
+
 #ifdef CONFIG_NUMA
 struct page *__page_cache_alloc(gfp_t gfp)
 {
@@ -1512,12 +1628,97 @@ static void shrink_readahead_size_eio(struct file *filp,
 	ra->ra_pages /= 4;
 }
 
+/*
+ * Drop the pages of [@start, @end) that IOCB_UNCACHED I/O is done with.
+ * Only whole pages go, the partial one at the end is likely to be used by
+ * the next I/O of the stream. Dirty, mapped and locked pages stay, and so
+ * do the pages referenced by other users when @keep_referenced.
+ */
+static void filemap_drop_uncached(struct address_space *mapping,
+				  loff_t start, loff_t end,
+				  bool keep_referenced)
+{
+	pgoff_t index = start >> PAGE_CACHE_SHIFT;
+	pgoff_t last = end >> PAGE_CACHE_SHIFT;
+	struct pagevec pvec;
+	int i;
+
+	if (end >= i_size_read(mapping->host))
+		last++;
+	pagevec_init(&pvec, 0);
+	while (index < last &&
+	       pagevec_lookup(&pvec, mapping, index,
+			      min(last - index, (pgoff_t)PAGEVEC_SIZE))) {
+		for (i = 0; i < pagevec_count(&pvec); i++) {
+			struct page *page = pvec.pages[i];
+
+			index = page->index;
+			if (index >= last)
+				break;
+			if (keep_referenced &&
+			    (PageReferenced(page) || PageActive(page)))
+				continue;
+			if (!trylock_page(page))
+				continue;
+			if (page->mapping == mapping)
+				invalidate_inode_page(page);
+			unlock_page(page);
+		}
+		pagevec_release(&pvec);
+		cond_resched();
+		index++;
+	}
+}
+
+/*
+ * Reads take the cached pages they are about to copy from in batches of
+ * contiguous pages, for one radix tree walk per PAGEVEC_SIZE pages.
+ */
+struct read_batch {
+	unsigned int nr;
+	unsigned int next;
+	struct page *pages[PAGEVEC_SIZE];
+};
+
+static void read_batch_release(struct read_batch *batch)
+{
+	while (batch->next < batch->nr)
+		page_cache_release(batch->pages[batch->next++]);
+	batch->nr = batch->next = 0;
+}
+
+/* Returns a reference to the page at @index, or NULL if it is not cached */
+static struct page *read_batch_get(struct address_space *mapping,
+				   struct read_batch *batch,
+				   pgoff_t index, pgoff_t last_index)
+{
+	struct page *page;
+
+	if (batch->next < batch->nr) {
+		page = batch->pages[batch->next];
+		if (page->index == index) {
+			batch->next++;
+			return page;
+		}
+	}
+
+	read_batch_release(batch);
+	batch->nr = find_get_pages_contig(mapping, index,
+			min_t(pgoff_t, last_index - index, PAGEVEC_SIZE),
+			batch->pages);
+	if (!batch->nr)
+		return NULL;
+	batch->next = 1;
+	return batch->pages[0];
+}
+
 /**
  * do_generic_file_read - generic file read routine
  * @filp:	the file to read
  * @ppos:	current file position
  * @iter:	data destination
  * @written:	already copied
+ * @flags:	IOCB_* flags of the read
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
@@ -1526,16 +1727,19 @@ static void shrink_readahead_size_eio(struct file *filp,
  * of the logic when it comes to error handling etc.
  */
 static ssize_t do_generic_file_read(struct file *filp, loff_t *ppos,
-		struct iov_iter *iter, ssize_t written)
+		struct iov_iter *iter, ssize_t written, int flags)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
 	struct file_ra_state *ra = &filp->f_ra;
+	struct read_batch batch = { .nr = 0, .next = 0 };
 	pgoff_t index;
 	pgoff_t last_index;
 	pgoff_t prev_index;
 	unsigned long offset;      /* offset into pagecache page */
 	unsigned int prev_offset;
+	loff_t start_pos = *ppos;
+	bool uncached = flags & IOCB_UNCACHED;
 	int error = 0;
 
 	index = *ppos >> PAGE_CACHE_SHIFT;
@@ -1552,8 +1756,10 @@ static ssize_t do_generic_file_read(struct file *filp, loff_t *ppos,
 
 		cond_resched();
 find_page:
-		page = find_get_page(mapping, index);
+		page = read_batch_get(mapping, &batch, index, last_index);
 		if (!page) {
+			if (flags & IOCB_NOWAIT)
+				goto would_block;
 			page_cache_sync_readahead(mapping,
 					ra, filp,
 					index, last_index - index);
@@ -1617,9 +1823,10 @@ page_ok:
 
 		/*
 		 * When a sequential read accesses a page several times,
-		 * only mark it as accessed the first time.
+		 * only mark it as accessed the first time. Uncached reads
+		 * don't, so their pages can be told from others' later.
 		 */
-		if (prev_index != index || offset != prev_offset)
+		if (!uncached && (prev_index != index || offset != prev_offset))
 			mark_page_accessed(page);
 		prev_index = index;
 
@@ -1645,6 +1852,10 @@ page_ok:
 		continue;
 
 page_not_up_to_date:
+		if (flags & IOCB_NOWAIT) {
+			page_cache_release(page);
+			goto would_block;
+		}
 		/* Get exclusive access to the page ... */
 		error = lock_page_killable(page);
 		if (unlikely(error))
@@ -1664,6 +1875,12 @@ page_not_up_to_date_locked:
 			goto page_ok;
 		}
 
+		if (flags & IOCB_NOWAIT) {
+			unlock_page(page);
+			page_cache_release(page);
+			goto would_block;
+		}
+
 readpage:
 		/*
 		 * A previous I/O error may have been due to temporary
@@ -1734,12 +1951,17 @@ no_cached_page:
 		goto readpage;
 	}
 
+would_block:
+	error = -EAGAIN;
 out:
+	read_batch_release(&batch);
 	ra->prev_pos = prev_index;
 	ra->prev_pos <<= PAGE_CACHE_SHIFT;
 	ra->prev_pos |= prev_offset;
 
 	*ppos = ((loff_t)index << PAGE_CACHE_SHIFT) + offset;
+	if (uncached)
+		filemap_drop_uncached(mapping, start_pos, *ppos, true);
 	file_accessed(filp);
 	return written ? written : error;
 }
@@ -1797,7 +2019,8 @@ generic_file_read_iter(struct kiocb *iocb, struct iov_iter *iter)
 		}
 	}
 
-	retval = do_generic_file_read(file, ppos, iter, retval);
+	retval = do_generic_file_read(file, ppos, iter, retval,
+				      iocb->ki_flags);
 out:
 	return retval;
 }
@@ -2695,6 +2918,20 @@ ssize_t generic_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 		if (err < 0)
 			ret = err;
 	}
+
+	/*
+	 * Uncached writes are written back now and their pages dropped,
+	 * rather than left for reclaim to find on the LRU.
+	 */
+	if (ret > 0 && (iocb->ki_flags & IOCB_UNCACHED) &&
+	    !(iocb->ki_flags & IOCB_DIRECT)) {
+		loff_t pos = iocb->ki_pos - ret;
+
+		if (!filemap_write_and_wait_range(file->f_mapping, pos,
+						  iocb->ki_pos - 1))
+			filemap_drop_uncached(file->f_mapping, pos,
+					      iocb->ki_pos, false);
+	}
 	return ret;
 }
 EXPORT_SYMBOL(generic_file_write_iter);
@@ -8,6 +8,7 @@
 #include <linux/rmap.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/lazyfork.h>
 
 #include <linux/sched.h>
 #include <linux/rwsem.h>
@@ -69,6 +70,9 @@ static struct page *follow_page_pte(struct vm_area_struct *vma,
 retry:
 	if (unlikely(pmd_bad(*pmd)))
 		return no_page_table(vma, flags);
+	/* Fault to get a table shared by fork copied first */
+	if (unlikely(lazyfork_pmd(*pmd)))
+		return NULL;
 
 	ptep = pte_offset_map_lock(mm, pmd, address, &ptl);
 	pte = *ptep;
@@ -26,6 +26,9 @@
 #include <linux/hashtable.h>
 #include <linux/userfaultfd_k.h>
 #include <linux/page_idle.h>
+#include <linux/prezero.h>
+#include <linux/lazyfork.h>
+#include <linux/copy_offload.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -57,7 +60,6 @@ static unsigned int khugepaged_full_scans;
 static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
 /* during fragmentation poll the hugepage allocator once every minute */
 static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
-static struct task_struct *khugepaged_thread __read_mostly;
 static DEFINE_MUTEX(khugepaged_mutex);
 static DEFINE_SPINLOCK(khugepaged_mm_lock);
 static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
@@ -68,7 +70,7 @@ static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
  */
 static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
 
-static int khugepaged(void *none);
+static int khugepaged(void *data);
 static int khugepaged_slab_init(void);
 static void khugepaged_slab_exit(void);
 
@@ -77,35 +79,64 @@ static __read_mostly DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
 
 static struct kmem_cache *mm_slot_cache __read_mostly;
 
+/**
+ * struct khugepaged_worker - one khugepaged thread
+ * @task: the kernel thread, bound to the cpus of @nid
+ * @nid: the node the worker runs on
+ * @mm_slot: the mm_slot this worker is scanning, if any
+ * @node_load: pages per node seen in the pmd being scanned
+ * @last_target_node: last node a hugepage was collapsed on
+ *
+ * There is one worker per node with memory. All workers scan the single
+ * khugepaged_scan list, each taking a different mm_slot at a time.
+ */
+struct khugepaged_worker {
+	struct task_struct *task;
+	int nid;
+	struct mm_slot *mm_slot;
+	int node_load[MAX_NUMNODES];
+	int last_target_node;
+};
+static struct khugepaged_worker *khugepaged_workers[MAX_NUMNODES];
+
 /**
  * struct mm_slot - hash lookup from mm to mm_slot
  * @hash: hash collision list
  * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
  * @mm: the mm that this information is valid for
+ * @worker: the worker currently scanning this mm, or NULL
+ * @address: the next address inside the mm to be scanned
+ * @last_anon: anon pages of the mm when its last scan completed
  */
 struct mm_slot {
 	struct hlist_node hash;
 	struct list_head mm_node;
 	struct mm_struct *mm;
+	struct khugepaged_worker *worker;
+	unsigned long address;
+	unsigned long last_anon;
 };
 
 /**
- * struct khugepaged_scan - cursor for scanning
- * @mm_head: the head of the mm list to scan
- * @mm_slot: the current mm_slot we are scanning
- * @address: the next address inside that to be scanned
+ * struct khugepaged_scan - list of mms to scan
+ * @mm_head: the head of the mm list to scan, next to be scanned first
+ * @nr_slots: number of mm_slots on the list
+ * @nr_scanned: mm_slots fully scanned since the last full scan
  *
- * There is only the one khugepaged_scan instance of this cursor structure.
+ * There is only the one khugepaged_scan instance of this structure.
  */
 struct khugepaged_scan {
 	struct list_head mm_head;
-	struct mm_slot *mm_slot;
-	unsigned long address;
+	unsigned int nr_slots;
+	unsigned int nr_scanned;
 };
 static struct khugepaged_scan khugepaged_scan = {
 	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
 };
 
+/* mm_slots considered when picking the next mm to scan */
+#define KHUGEPAGED_PICK_WINDOW	8
+
 
 static void set_recommended_min_free_kbytes(void)
 {
@@ -144,28 +175,70 @@ static void set_recommended_min_free_kbytes(void)
 	setup_per_zone_wmarks();
 }
 
+static int khugepaged_start_worker(int nid)
+{
+	struct khugepaged_worker *kw;
+	const struct cpumask *cpumask = cpumask_of_node(nid);
+
+	kw = kzalloc_node(sizeof(*kw), GFP_KERNEL, nid);
+	if (!kw)
+		return -ENOMEM;
+
+	kw->nid = nid;
+	kw->last_target_node = NUMA_NO_NODE;
+	kw->task = kthread_create_on_node(khugepaged, kw, nid,
+					  "khugepaged%d", nid);
+	if (IS_ERR(kw->task)) {
+		int err = PTR_ERR(kw->task);
+
+		pr_err("khugepaged: kthread_run(khugepaged) failed\n");
+		kfree(kw);
+		return err;
+	}
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(kw->task, cpumask);
+	khugepaged_workers[nid] = kw;
+	wake_up_process(kw->task);
+
+	return 0;
+}
+
+static void khugepaged_stop_workers(void)
+{
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		struct khugepaged_worker *kw = khugepaged_workers[nid];
+
+		if (!kw)
+			continue;
+		kthread_stop(kw->task);
+		khugepaged_workers[nid] = NULL;
+		kfree(kw);
+	}
+}
+
 static int start_stop_khugepaged(void)
 {
 	int err = 0;
+	int nid;
+
 	if (khugepaged_enabled()) {
-		if (!khugepaged_thread)
-			khugepaged_thread = kthread_run(khugepaged, NULL,
-							"khugepaged");
-		if (IS_ERR(khugepaged_thread)) {
-			pr_err("khugepaged: kthread_run(khugepaged) failed\n");
-			err = PTR_ERR(khugepaged_thread);
-			khugepaged_thread = NULL;
-			goto fail;
+		for_each_node_state(nid, N_MEMORY) {
+			if (khugepaged_workers[nid])
+				continue;
+			err = khugepaged_start_worker(nid);
+			if (err)
+				goto fail;
 		}
 
 		if (!list_empty(&khugepaged_scan.mm_head))
-			wake_up_interruptible(&khugepaged_wait);
+			wake_up_interruptible_all(&khugepaged_wait);
 
 		set_recommended_min_free_kbytes();
-	} else if (khugepaged_thread) {
-		kthread_stop(khugepaged_thread);
-		khugepaged_thread = NULL;
-	}
+	} else
+		khugepaged_stop_workers();
 fail:
 	return err;
 }
@@ -425,7 +498,7 @@ static ssize_t scan_sleep_millisecs_store(struct kobject *kobj,
 		return -EINVAL;
 
 	khugepaged_scan_sleep_millisecs = msecs;
-	wake_up_interruptible(&khugepaged_wait);
+	wake_up_interruptible_all(&khugepaged_wait);
 
 	return count;
 }
@@ -452,7 +525,7 @@ static ssize_t alloc_sleep_millisecs_store(struct kobject *kobj,
 		return -EINVAL;
 
 	khugepaged_alloc_sleep_millisecs = msecs;
-	wake_up_interruptible(&khugepaged_wait);
+	wake_up_interruptible_all(&khugepaged_wait);
 
 	return count;
 }
@@ -715,7 +788,7 @@ static int __do_huge_pmd_anonymous_page(struct mm_struct *mm,
 					struct vm_area_struct *vma,
 					unsigned long address, pmd_t *pmd,
 					struct page *page, gfp_t gfp,
-					unsigned int flags)
+					unsigned int flags, bool zeroed)
 {
 	struct mem_cgroup *memcg;
 	pgtable_t pgtable;
@@ -737,7 +810,8 @@ static int __do_huge_pmd_anonymous_page(struct mm_struct *mm,
 		return VM_FAULT_OOM;
 	}
 
-	clear_huge_page(page, haddr, HPAGE_PMD_NR);
+	if (!zeroed)
+		clear_huge_page(page, haddr, HPAGE_PMD_NR);
 	/*
 	 * The memory barrier inside __SetPageUptodate makes sure that
 	 * clear_huge_page writes become visible before the set_pmd_at()
@@ -812,6 +886,7 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	gfp_t gfp;
 	struct page *page;
 	unsigned long haddr = address & HPAGE_PMD_MASK;
+	bool zeroed = false;
 
 	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
 		return VM_FAULT_FALLBACK;
@@ -860,13 +935,17 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		return ret;
 	}
 	gfp = alloc_hugepage_gfpmask(transparent_hugepage_defrag(vma), 0);
-	page = alloc_hugepage_vma(gfp, vma, haddr, HPAGE_PMD_ORDER);
+	page = prezero_alloc_thp(vma);
+	if (page)
+		zeroed = true;
+	else
+		page = alloc_hugepage_vma(gfp, vma, haddr, HPAGE_PMD_ORDER);
 	if (unlikely(!page)) {
 		count_vm_event(THP_FAULT_FALLBACK);
 		return VM_FAULT_FALLBACK;
 	}
 	return __do_huge_pmd_anonymous_page(mm, vma, address, pmd, page, gfp,
-					    flags);
+					    flags, zeroed);
 }
 
 static void insert_pfn_pmd(struct vm_area_struct *vma, unsigned long addr,
@@ -2115,11 +2194,12 @@ int __khugepaged_enter(struct mm_struct *mm)
 	 */
 	wakeup = list_empty(&khugepaged_scan.mm_head);
 	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	khugepaged_scan.nr_slots++;
 	spin_unlock(&khugepaged_mm_lock);
 
 	atomic_inc(&mm->mm_count);
 	if (wakeup)
-		wake_up_interruptible(&khugepaged_wait);
+		wake_up_interruptible_all(&khugepaged_wait);
 
 	return 0;
 }
@@ -2151,9 +2231,10 @@ void __khugepaged_exit(struct mm_struct *mm)
 
 	spin_lock(&khugepaged_mm_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+	if (mm_slot && !mm_slot->worker) {
 		hash_del(&mm_slot->hash);
 		list_del(&mm_slot->mm_node);
+		khugepaged_scan.nr_slots--;
 		free = 1;
 	}
 	spin_unlock(&khugepaged_mm_lock);
@@ -2214,6 +2295,9 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 		}
 		if (!pte_present(pteval))
 			goto out;
+		/* the huge pmd would lose the userfaultfd write protection */
+		if (pte_uffd_wp(pteval))
+			goto out;
 		page = vm_normal_page(vma, address, pteval);
 		if (unlikely(!page))
 			goto out;
@@ -2279,12 +2363,42 @@ out:
 	return 0;
 }
 
+/*
+ * Have a DMA engine copy the small pages into the huge one, if offloading
+ * is on; false means __collapse_huge_page_copy() has to copy them itself.
+ * The pages are isolated and locked, so the ptes stay put.
+ */
+static bool __collapse_huge_page_offload(pte_t *pte, struct page *page)
+{
+	struct copy_offload co;
+	bool queued = true;
+	pte_t *_pte;
+
+	if (!copy_offload_begin(&co))
+		return false;
+
+	for (_pte = pte; _pte < pte+HPAGE_PMD_NR; _pte++, page++) {
+		pte_t pteval = *_pte;
+
+		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval)))
+			continue;
+		if (!copy_offload_pages(&co, page, pte_page(pteval), 1)) {
+			queued = false;
+			break;
+		}
+	}
+
+	return copy_offload_end(&co) && queued;
+}
+
 static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
 				      struct vm_area_struct *vma,
 				      unsigned long address,
 				      spinlock_t *ptl)
 {
+	bool copied = __collapse_huge_page_offload(pte, page);
 	pte_t *_pte;
+
 	for (_pte = pte; _pte < pte+HPAGE_PMD_NR; _pte++) {
 		pte_t pteval = *_pte;
 		struct page *src_page;
@@ -2306,7 +2420,9 @@ static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
 			}
 		} else {
 			src_page = pte_page(pteval);
-			copy_user_highpage(page, src_page, address, vma);
+			if (!copied)
+				copy_user_highpage(page, src_page, address,
+						   vma);
 			VM_BUG_ON_PAGE(page_mapcount(src_page) != 1, src_page);
 			release_pte_page(src_page);
 			/*
@@ -2340,9 +2456,7 @@ static void khugepaged_alloc_sleep(void)
 	remove_wait_queue(&khugepaged_wait, &wait);
 }
 
-static int khugepaged_node_load[MAX_NUMNODES];
-
-static bool khugepaged_scan_abort(int nid)
+static bool khugepaged_scan_abort(struct khugepaged_worker *kw, int nid)
 {
 	int i;
 
@@ -2354,11 +2468,11 @@ static bool khugepaged_scan_abort(int nid)
 		return false;
 
 	/* If there is a count for this node already, it must be acceptable */
-	if (khugepaged_node_load[nid])
+	if (kw->node_load[nid])
 		return false;
 
 	for (i = 0; i < MAX_NUMNODES; i++) {
-		if (!khugepaged_node_load[i])
+		if (!kw->node_load[i])
 			continue;
 		if (node_distance(nid, i) > RECLAIM_DISTANCE)
 			return true;
@@ -2367,28 +2481,27 @@ static bool khugepaged_scan_abort(int nid)
 }
 
 #ifdef CONFIG_NUMA
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct khugepaged_worker *kw)
 {
-	static int last_khugepaged_target_node = NUMA_NO_NODE;
 	int nid, target_node = 0, max_value = 0;
 
 	/* find first node with max normal pages hit */
 	for (nid = 0; nid < MAX_NUMNODES; nid++)
-		if (khugepaged_node_load[nid] > max_value) {
-			max_value = khugepaged_node_load[nid];
+		if (kw->node_load[nid] > max_value) {
+			max_value = kw->node_load[nid];
 			target_node = nid;
 		}
 
 	/* do some balance if several nodes have the same hit record */
-	if (target_node <= last_khugepaged_target_node)
-		for (nid = last_khugepaged_target_node + 1; nid < MAX_NUMNODES;
+	if (target_node <= kw->last_target_node)
+		for (nid = kw->last_target_node + 1; nid < MAX_NUMNODES;
 				nid++)
-			if (max_value == khugepaged_node_load[nid]) {
+			if (max_value == kw->node_load[nid]) {
 				target_node = nid;
 				break;
 			}
 
-	last_khugepaged_target_node = target_node;
+	kw->last_target_node = target_node;
 	return target_node;
 }
 
@@ -2434,7 +2547,7 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, struct mm_struct *mm,
 	return *hpage;
 }
 #else
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct khugepaged_worker *kw)
 {
 	return 0;
 }
@@ -2552,9 +2665,11 @@ static void collapse_huge_page(struct mm_struct *mm,
 	if (!hugepage_vma_check(vma))
 		goto out;
 	pmd = mm_find_pmd(mm, address);
-	if (!pmd)
+	/* A fork may have shared the table since it was scanned */
+	if (!pmd || lazyfork_pmd(*pmd))
 		goto out;
 
+	vm_write_begin(vma);
 	anon_vma_lock_write(vma->anon_vma);
 
 	pte = pte_offset_map(pmd, address);
@@ -2590,6 +2705,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
 		spin_unlock(pmd_ptl);
 		anon_vma_unlock_write(vma->anon_vma);
+		vm_write_end(vma);
 		goto out;
 	}
 
@@ -2623,6 +2739,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	set_pmd_at(mm, address, pmd, _pmd);
 	update_mmu_cache_pmd(vma, address, pmd);
 	spin_unlock(pmd_ptl);
+	vm_write_end(vma);
 
 	*hpage = NULL;
 
@@ -2636,7 +2753,8 @@ out:
 	goto out_up_write;
 }
 
-static int khugepaged_scan_pmd(struct mm_struct *mm,
+static int khugepaged_scan_pmd(struct khugepaged_worker *kw,
+			       struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
 			       struct page **hpage)
@@ -2653,10 +2771,10 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
 	pmd = mm_find_pmd(mm, address);
-	if (!pmd)
+	if (!pmd || lazyfork_pmd(*pmd))
 		goto out;
 
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(kw->node_load, 0, sizeof(kw->node_load));
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
@@ -2668,7 +2786,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			else
 				goto out_unmap;
 		}
-		if (!pte_present(pteval))
+		if (!pte_present(pteval) || pte_uffd_wp(pteval))
 			goto out_unmap;
 		if (pte_write(pteval))
 			writable = true;
@@ -2678,14 +2796,14 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			goto out_unmap;
 		/*
 		 * Record which node the original page is from and save this
-		 * information to khugepaged_node_load[].
+		 * information to kw->node_load[].
 		 * Khupaged will allocate hugepage from the node has the max
 		 * hit record.
 		 */
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node))
+		if (khugepaged_scan_abort(kw, node))
 			goto out_unmap;
-		khugepaged_node_load[node]++;
+		kw->node_load[node]++;
 		VM_BUG_ON_PAGE(PageCompound(page), page);
 		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page))
 			goto out_unmap;
@@ -2706,7 +2824,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
 	if (ret) {
-		node = khugepaged_find_target_node();
+		node = khugepaged_find_target_node(kw);
 		/* collapse_huge_page will return with the mmap_sem released */
 		collapse_huge_page(mm, address, hpage, vma, node);
 	}
@@ -2724,6 +2842,7 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 		/* free mm_slot */
 		hash_del(&mm_slot->hash);
 		list_del(&mm_slot->mm_node);
+		khugepaged_scan.nr_slots--;
 
 		/*
 		 * Not strictly needed because the mm exited already.
@@ -2737,27 +2856,64 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 	}
 }
 
-static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+/*
+ * Pick the next mm_slot for @kw to scan. Among the next few idle slots in
+ * round robin order take the mm that faulted in the most anon memory since
+ * its last scan, which is where a fresh heap is waiting to be collapsed.
+ * Slots whose memcg has used up its scan budget are rotated to the tail.
+ */
+static struct mm_slot *khugepaged_pick_mm_slot(struct khugepaged_worker *kw)
+{
+	struct mm_slot *mm_slot, *next, *best = NULL;
+	long score, best_score = 0;
+	int window = KHUGEPAGED_PICK_WINDOW;
+	int visited = 0;
+
+	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
+
+	list_for_each_entry_safe(mm_slot, next, &khugepaged_scan.mm_head,
+				 mm_node) {
+		if (++visited > KHUGEPAGED_PICK_WINDOW * 4)
+			break;
+		if (mm_slot->worker)
+			continue;
+		if (!mem_cgroup_khugepaged_may_scan(mm_slot->mm)) {
+			list_move_tail(&mm_slot->mm_node,
+				       &khugepaged_scan.mm_head);
+			continue;
+		}
+
+		score = get_mm_counter(mm_slot->mm, MM_ANONPAGES) -
+			mm_slot->last_anon;
+		if (!best || score > best_score) {
+			best = mm_slot;
+			best_score = score;
+		}
+		if (!--window)
+			break;
+	}
+
+	if (best) {
+		best->worker = kw;
+		list_move_tail(&best->mm_node, &khugepaged_scan.mm_head);
+	}
+	return best;
+}
+
+static unsigned int khugepaged_scan_mm_slot(struct khugepaged_worker *kw,
+					    unsigned int pages,
 					    struct page **hpage)
 	__releases(&khugepaged_mm_lock)
 	__acquires(&khugepaged_mm_lock)
 {
-	struct mm_slot *mm_slot;
+	struct mm_slot *mm_slot = kw->mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
 	int progress = 0;
 
 	VM_BUG_ON(!pages);
 	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
-
-	if (khugepaged_scan.mm_slot)
-		mm_slot = khugepaged_scan.mm_slot;
-	else {
-		mm_slot = list_entry(khugepaged_scan.mm_head.next,
-				     struct mm_slot, mm_node);
-		khugepaged_scan.address = 0;
-		khugepaged_scan.mm_slot = mm_slot;
-	}
+	VM_BUG_ON(mm_slot->worker != kw);
 	spin_unlock(&khugepaged_mm_lock);
 
 	mm = mm_slot->mm;
@@ -2765,7 +2921,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	if (unlikely(khugepaged_test_exit(mm)))
 		vma = NULL;
 	else
-		vma = find_vma(mm, khugepaged_scan.address);
+		vma = find_vma(mm, mm_slot->address);
 
 	progress++;
 	for (; vma; vma = vma->vm_next) {
@@ -2785,26 +2941,26 @@ skip:
 		hend = vma->vm_end & HPAGE_PMD_MASK;
 		if (hstart >= hend)
 			goto skip;
-		if (khugepaged_scan.address > hend)
+		if (mm_slot->address > hend)
 			goto skip;
-		if (khugepaged_scan.address < hstart)
-			khugepaged_scan.address = hstart;
-		VM_BUG_ON(khugepaged_scan.address & ~HPAGE_PMD_MASK);
+		if (mm_slot->address < hstart)
+			mm_slot->address = hstart;
+		VM_BUG_ON(mm_slot->address & ~HPAGE_PMD_MASK);
 
-		while (khugepaged_scan.address < hend) {
+		while (mm_slot->address < hend) {
 			int ret;
 			cond_resched();
 			if (unlikely(khugepaged_test_exit(mm)))
 				goto breakouterloop;
 
-			VM_BUG_ON(khugepaged_scan.address < hstart ||
-				  khugepaged_scan.address + HPAGE_PMD_SIZE >
+			VM_BUG_ON(mm_slot->address < hstart ||
+				  mm_slot->address + HPAGE_PMD_SIZE >
 				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
+			ret = khugepaged_scan_pmd(kw, mm, vma,
+						  mm_slot->address,
 						  hpage);
 			/* move to next address */
-			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			mm_slot->address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
 			if (ret)
 				/* we released mmap_sem so break loop */
@@ -2817,29 +2973,33 @@ breakouterloop:
 	up_read(&mm->mmap_sem); /* exit_mmap will destroy ptes after this */
 breakouterloop_mmap_sem:
 
+	mem_cgroup_khugepaged_scanned(mm, progress);
+
 	spin_lock(&khugepaged_mm_lock);
-	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	VM_BUG_ON(kw->mm_slot != mm_slot);
 	/*
 	 * Release the current mm_slot if this mm is about to die, or
-	 * if we scanned all vmas of this mm.
+	 * if we scanned all vmas of this mm. The scan position is kept
+	 * if the memcg ran out of budget, another worker resumes there.
 	 */
 	if (khugepaged_test_exit(mm) || !vma) {
+		mm_slot->address = 0;
+		mm_slot->last_anon = get_mm_counter(mm, MM_ANONPAGES);
+		if (++khugepaged_scan.nr_scanned >= khugepaged_scan.nr_slots) {
+			khugepaged_scan.nr_scanned = 0;
+			khugepaged_full_scans++;
+		}
 		/*
 		 * Make sure that if mm_users is reaching zero while
 		 * khugepaged runs here, khugepaged_exit will find
-		 * mm_slot not pointing to the exiting mm.
+		 * mm_slot not being scanned.
 		 */
-		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
-			khugepaged_scan.mm_slot = list_entry(
-				mm_slot->mm_node.next,
-				struct mm_slot, mm_node);
-			khugepaged_scan.address = 0;
-		} else {
-			khugepaged_scan.mm_slot = NULL;
-			khugepaged_full_scans++;
-		}
-
+		mm_slot->worker = NULL;
+		kw->mm_slot = NULL;
 		collect_mm_slot(mm_slot);
+	} else if (!mem_cgroup_khugepaged_may_scan(mm)) {
+		mm_slot->worker = NULL;
+		kw->mm_slot = NULL;
 	}
 
 	return progress;
@@ -2857,10 +3017,10 @@ static int khugepaged_wait_event(void)
 		kthread_should_stop();
 }
 
-static void khugepaged_do_scan(void)
+static void khugepaged_do_scan(struct khugepaged_worker *kw)
 {
 	struct page *hpage = NULL;
-	unsigned int progress = 0, pass_through_head = 0;
+	unsigned int progress = 0, nr_picked = 0;
 	unsigned int pages = khugepaged_pages_to_scan;
 	bool wait = true;
 
@@ -2876,11 +3036,13 @@ static void khugepaged_do_scan(void)
 			break;
 
 		spin_lock(&khugepaged_mm_lock);
-		if (!khugepaged_scan.mm_slot)
-			pass_through_head++;
-		if (khugepaged_has_work() &&
-		    pass_through_head < 2)
-			progress += khugepaged_scan_mm_slot(pages - progress,
+		/* Visit each mm at most once per round, like a full pass */
+		if (!kw->mm_slot && khugepaged_has_work() &&
+		    nr_picked++ < khugepaged_scan.nr_slots)
+			kw->mm_slot = khugepaged_pick_mm_slot(kw);
+		if (kw->mm_slot)
+			progress += khugepaged_scan_mm_slot(kw,
+							    pages - progress,
 							    &hpage);
 		else
 			progress = pages;
@@ -2907,23 +3069,26 @@ static void khugepaged_wait_work(void)
 		wait_event_freezable(khugepaged_wait, khugepaged_wait_event());
 }
 
-static int khugepaged(void *none)
+static int khugepaged(void *data)
 {
+	struct khugepaged_worker *kw = data;
 	struct mm_slot *mm_slot;
 
 	set_freezable();
 	set_user_nice(current, MAX_NICE);
 
 	while (!kthread_should_stop()) {
-		khugepaged_do_scan();
+		khugepaged_do_scan(kw);
 		khugepaged_wait_work();
 	}
 
 	spin_lock(&khugepaged_mm_lock);
-	mm_slot = khugepaged_scan.mm_slot;
-	khugepaged_scan.mm_slot = NULL;
-	if (mm_slot)
+	mm_slot = kw->mm_slot;
+	kw->mm_slot = NULL;
+	if (mm_slot) {
+		mm_slot->worker = NULL;
 		collect_mm_slot(mm_slot);
+	}
 	spin_unlock(&khugepaged_mm_lock);
 	return 0;
 }
@@ -24,6 +24,7 @@
 #include <linux/swapops.h>
 #include <linux/page-isolation.h>
 #include <linux/jhash.h>
+#include <linux/ktask.h>
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
@@ -33,6 +34,7 @@
 #include <linux/hugetlb.h>
 #include <linux/hugetlb_cgroup.h>
 #include <linux/node.h>
+#include <linux/prezero.h>
 #include "internal.h"
 
 int hugepages_treat_as_movable;
@@ -835,10 +837,71 @@ static bool vma_has_reserves(struct vm_area_struct *vma, long chg)
 	return false;
 }
 
+#ifdef CONFIG_HUGEPAGE_PREZERO
+/*
+ * A free huge page whose contents were cleared by the prezero thread is
+ * marked with PG_private_2 on its first tail page, like page_huge_active().
+ * Zeroed pages are kept at the head of the free lists and dirty ones at the
+ * tail, so that dequeue_huge_page_node() hands out zeroed pages first.
+ */
+static bool page_huge_zeroed(struct page *page)
+{
+	return PagePrivate2(&page[1]);
+}
+
+static void set_page_huge_zeroed(struct page *page)
+{
+	SetPagePrivate2(&page[1]);
+}
+
+static bool test_clear_page_huge_zeroed(struct page *page)
+{
+	return TestClearPagePrivate2(&page[1]);
+}
+
+static bool hugetlb_prezero_enabled(void)
+{
+	return READ_ONCE(sysctl_prezero_hugetlb);
+}
+
+/* Consume the zeroed state of a page allocated for a fault */
+static bool huge_page_prezeroed(struct page *page)
+{
+	if (!test_clear_page_huge_zeroed(page))
+		return false;
+	count_vm_event(PREZERO_HUGETLB_ALLOC);
+	return true;
+}
+#else
+static inline bool page_huge_zeroed(struct page *page)
+{
+	return false;
+}
+
+static inline bool test_clear_page_huge_zeroed(struct page *page)
+{
+	return false;
+}
+
+static inline bool hugetlb_prezero_enabled(void)
+{
+	return false;
+}
+
+static inline bool huge_page_prezeroed(struct page *page)
+{
+	return false;
+}
+#endif
+
 static void enqueue_huge_page(struct hstate *h, struct page *page)
 {
 	int nid = page_to_nid(page);
-	list_move(&page->lru, &h->hugepage_freelists[nid]);
+
+	if (hugetlb_prezero_enabled() && !page_huge_zeroed(page))
+		list_move_tail(&page->lru, &h->hugepage_freelists[nid]);
+	else
+		list_move(&page->lru, &h->hugepage_freelists[nid]);
 	h->free_huge_pages++;
 	h->free_huge_pages_node[nid]++;
 }
@@ -1152,7 +1215,7 @@ static void update_and_free_page(struct hstate *h, struct page *page)
 		page[i].flags &= ~(1 << PG_locked | 1 << PG_error |
 				1 << PG_referenced | 1 << PG_dirty |
 				1 << PG_active | 1 << PG_private |
-				1 << PG_writeback);
+				1 << PG_private_2 | 1 << PG_writeback);
 	}
 	VM_BUG_ON_PAGE(hugetlb_cgroup_from_page(page), page);
 	set_compound_page_dtor(page, NULL_COMPOUND_DTOR);
@@ -1230,6 +1293,7 @@ void free_huge_page(struct page *page)
 
 	spin_lock(&hugetlb_lock);
 	clear_page_huge_active(page);
+	test_clear_page_huge_zeroed(page);
 	hugetlb_cgroup_uncharge_page(hstate_index(h),
 				     pages_per_huge_page(h), page);
 	if (restore_reserve)
@@ -1244,10 +1308,70 @@ void free_huge_page(struct page *page)
 	} else {
 		arch_clear_hugepage_flags(page);
 		enqueue_huge_page(h, page);
+		if (hugetlb_prezero_enabled())
+			prezero_kick_node(nid);
 	}
 	spin_unlock(&hugetlb_lock);
 }
 
+#ifdef CONFIG_HUGEPAGE_PREZERO
+/*
+ * Called by the prezero thread of @nid to clear one dirty free huge page.
+ * The page is taken off the free list and held like an allocated page while
+ * it is cleared, so only pages beyond the reserved ones are used and an
+ * unreserved allocation may briefly find one page less. Returns false if
+ * there was nothing left to zero.
+ */
+bool hugetlb_prezero_page(int nid)
+{
+	struct hstate *h;
+
+	for_each_hstate(h) {
+		struct page *page = NULL, *p;
+
+		spin_lock(&hugetlb_lock);
+		if (h->free_huge_pages > h->resv_huge_pages) {
+			list_for_each_entry_reverse(p, &h->hugepage_freelists[nid],
+						    lru) {
+				if (page_huge_zeroed(p))
+					break;
+				if (is_migrate_isolate_page(p))
+					continue;
+				page = p;
+				break;
+			}
+		}
+		if (page) {
+			list_move(&page->lru, &h->hugepage_activelist);
+			set_page_refcounted(page);
+			h->free_huge_pages--;
+			h->free_huge_pages_node[nid]--;
+		}
+		spin_unlock(&hugetlb_lock);
+
+		if (!page)
+			continue;
+
+		clear_huge_page(page, 0, pages_per_huge_page(h));
+
+		/*
+		 * If somebody took a speculative reference meanwhile, their
+		 * put_page() frees the page through free_huge_page() instead.
+		 */
+		spin_lock(&hugetlb_lock);
+		if (put_page_testzero(page)) {
+			set_page_huge_zeroed(page);
+			enqueue_huge_page(h, page);
+		}
+		spin_unlock(&hugetlb_lock);
+		count_vm_event(PREZERO_HUGETLB_ZEROED);
+		return true;
+	}
+
+	return false;
+}
+#endif
+
 static void prep_new_huge_page(struct hstate *h, struct page *page, int nid)
 {
 	INIT_LIST_HEAD(&page->lru);
@@ -2021,11 +2145,73 @@ static void __init gather_bootmem_prealloc(void)
 	}
 }
 
+struct hugetlb_prealloc_args {
+	struct hstate		*h;
+	atomic_long_t		nr_allocated;
+};
+
+static int __init hugetlb_prealloc_chunk(unsigned long start,
+					 unsigned long end, int nid, void *arg)
+{
+	struct hugetlb_prealloc_args *args = arg;
+	unsigned long nr = 0;
+
+	for (; start < end; start++) {
+		if (!alloc_fresh_huge_page_node(args->h, nid))
+			break;
+		count_vm_event(HTLB_BUDDY_PGALLOC);
+		nr++;
+		cond_resched();
+	}
+	atomic_long_add(nr, &args->nr_allocated);
+	return KTASK_RETURN_SUCCESS;
+}
+
+/*
+ * Allocate the boot time huge pages of @h from all nodes at once, an equal
+ * share from each node with memory.  Returns the number of pages allocated,
+ * a node which runs out leaves the rest to the caller.
+ */
+static unsigned long __init hugetlb_prealloc_pages(struct hstate *h)
+{
+	int nr_nodes = num_node_state(N_MEMORY);
+	struct hugetlb_prealloc_args args;
+	struct ktask_node *kn;
+	unsigned long per_node, extra;
+	int nid, n = 0;
+	/* a thread is worth it for about 1GB of huge pages */
+	DEFINE_KTASK_CTL(ctl, hugetlb_prealloc_chunk, &args,
+			 max(1UL, (1UL << (30 - PAGE_SHIFT)) >> huge_page_order(h)));
+
+	kn = kcalloc(nr_nodes, sizeof(*kn), GFP_KERNEL);
+	if (!kn)
+		return 0;
+
+	per_node = h->max_huge_pages / nr_nodes;
+	extra = h->max_huge_pages % nr_nodes;
+	for_each_node_state(nid, N_MEMORY) {
+		kn[n].kn_start = 0;
+		kn[n].kn_task_size = per_node + (n < extra);
+		kn[n].kn_nid = nid;
+		n++;
+	}
+
+	args.h = h;
+	atomic_long_set(&args.nr_allocated, 0);
+	ktask_run_numa(kn, nr_nodes, &ctl);
+	kfree(kn);
+
+	return atomic_long_read(&args.nr_allocated);
+}
+
 static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 {
-	unsigned long i;
+	unsigned long i = 0;
+
+	if (!hstate_is_gigantic(h))
+		i = hugetlb_prealloc_pages(h);
 
-	for (i = 0; i < h->max_huge_pages; ++i) {
+	for (; i < h->max_huge_pages; ++i) {
 		if (hstate_is_gigantic(h)) {
 			if (!alloc_bootmem_huge_page(h))
 				break;
@@ -3560,7 +3746,8 @@ retry:
 				ret = VM_FAULT_SIGBUS;
 			goto out;
 		}
-		clear_huge_page(page, address, pages_per_huge_page(h));
+		if (!huge_page_prezeroed(page))
+			clear_huge_page(page, address, pages_per_huge_page(h));
 		__SetPageUptodate(page);
 		set_page_huge_active(page);
 
@@ -23,7 +23,7 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
+#include <linux/xxhash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -90,36 +90,56 @@
  *
  * If the merge_across_nodes tunable is unset, then KSM maintains multiple
  * stable trees and multiple unstable trees: one of each for each NUMA node.
+ *
+ * The mms are scanned by a pool of scan_threads ksmd threads, spread over
+ * the nodes with memory; each mm is handed to a thread on the node it was
+ * registered from.  The threads walk page tables and checksum pages in
+ * parallel, updates to the trees are serialized by ksm_tree_mutex.  The
+ * unstable tree is flushed once every thread has completed a full scan.
  */
 
 /**
  * struct mm_slot - ksm information per mm that is being scanned
  * @link: link to the mm_slots hash list
- * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
+ * @mm_list: link into the mm_slots list of the scanning thread
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @scan: the scanning thread this mm is assigned to
+ * @nid: node the mm was registered from, to pick a scanning thread
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	struct ksm_scan *scan;
+	int nid;
 };
 
 /**
- * struct ksm_scan - cursor for scanning
+ * struct ksm_scan - cursor for scanning, one per ksmd thread
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
- * @seqnr: count of completed full scans (needed when removing unstable node)
- *
- * There is only the one ksm_scan instance of this cursor structure.
+ * @seqnr: value of ksm_seqnr when the current full scan was started
+ * @done_seqnr: ksm_seqnr + 1 once a full scan started then has completed
+ * @mm_head: head of the mm_slots assigned to this thread
+ * @nr_slots: number of mm_slots on @mm_head
+ * @pages_to_scan: batch size when pages_to_scan_autotune is set
+ * @thread: the ksmd thread using this cursor
+ * @nid: node whose cpus @thread is bound to
  */
 struct ksm_scan {
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
 	unsigned long seqnr;
+	unsigned long done_seqnr;
+	struct mm_slot mm_head;
+	unsigned long nr_slots;
+	unsigned long pages_to_scan;
+	struct task_struct *thread;
+	int nid;
 };
 
 /**
@@ -194,12 +214,14 @@ static LIST_HEAD(migrate_nodes);
 #define MM_SLOTS_HASH_BITS 10
 static DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
 
-static struct mm_slot ksm_mm_head = {
-	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
-};
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+#define KSM_MAX_SCAN_THREADS	32
+static struct ksm_scan ksm_scans[KSM_MAX_SCAN_THREADS];
+
+/* Number of ksmd threads scanning, and so of ksm_scans[] in use */
+static int ksm_nr_scan_threads = 1;
+
+/* Count of completed full scans (needed when removing unstable node) */
+static unsigned long ksm_seqnr;
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
@@ -215,7 +237,7 @@ static unsigned long ksm_pages_sharing;
 static unsigned long ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items;
 
 /* Number of pages ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
@@ -223,6 +245,15 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/*
+ * Scale the batch of each ksmd between pages_to_scan and
+ * KSM_AUTOTUNE_MAX_SCALE times that, depending on how many of the pages
+ * scanned in the last batch were merged.
+ */
+static unsigned int ksm_pages_to_scan_autotune;
+#define KSM_AUTOTUNE_MAX_SCALE	16
+#define KSM_AUTOTUNE_GOOD_YIELD	64	/* merges per 1024 pages scanned */
+
 #ifdef CONFIG_NUMA
 /* Zeroed when merging across nodes is not allowed */
 static unsigned int ksm_merge_across_nodes = 1;
@@ -243,6 +274,17 @@ static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
 static DEFINE_MUTEX(ksm_thread_mutex);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
+/*
+ * ksmd threads hold ksm_scan_rwsem for read while scanning a batch; it
+ * is taken for write, inside ksm_thread_mutex, to keep them out while
+ * everything is unmerged or the trees are reorganized.  ksm_tree_mutex
+ * serializes the threads' updates to the stable and unstable trees,
+ * migrate_nodes, the rmap_items linked into them and ksm_seqnr; it is
+ * taken outside of mmap_sem.
+ */
+static DECLARE_RWSEM(ksm_scan_rwsem);
+static DEFINE_MUTEX(ksm_tree_mutex);
+
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
 		sizeof(struct __struct), __alignof__(struct __struct),\
 		(__flags), NULL)
@@ -285,13 +327,13 @@ static inline struct rmap_item *alloc_rmap_item(void)
 
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -643,7 +685,7 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(ksm_seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
 			rb_erase(&rmap_item->node,
@@ -655,17 +697,6 @@ out:
 	cond_resched();		/* we're called from many long loops */
 }
 
-static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
-				       struct rmap_item **rmap_list)
-{
-	while (*rmap_list) {
-		struct rmap_item *rmap_item = *rmap_list;
-		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
-	}
-}
-
 /*
  * Though it's very tempting to unmerge rmap_items from stable tree rather
  * than check every pte of a given vma, the locking doesn't quite work for
@@ -697,6 +728,17 @@ static int unmerge_ksm_pages(struct vm_area_struct *vma,
 }
 
 #ifdef CONFIG_SYSFS
+static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
+				       struct rmap_item **rmap_list)
+{
+	while (*rmap_list) {
+		struct rmap_item *rmap_item = *rmap_list;
+		*rmap_list = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
+}
+
 /*
  * Only called through the sysfs control interface:
  */
@@ -765,7 +807,7 @@ static int remove_all_stable_nodes(void)
 	return err;
 }
 
-static int unmerge_and_remove_all_rmap_items(void)
+static int unmerge_scan_rmap_items(struct ksm_scan *kw)
 {
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
@@ -773,12 +815,12 @@ static int unmerge_and_remove_all_rmap_items(void)
 	int err = 0;
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+	kw->mm_slot = list_entry(kw->mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
+	for (mm_slot = kw->mm_slot;
+			mm_slot != &kw->mm_head; mm_slot = kw->mm_slot) {
 		mm = mm_slot->mm;
 		down_read(&mm->mmap_sem);
 		for (vma = mm->mmap; vma; vma = vma->vm_next) {
@@ -795,11 +837,12 @@ static int unmerge_and_remove_all_rmap_items(void)
 		remove_trailing_rmap_items(mm_slot, &mm_slot->rmap_list);
 
 		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
+		kw->mm_slot = list_entry(mm_slot->mm_list.next,
 						struct mm_slot, mm_list);
 		if (ksm_test_exit(mm)) {
 			hash_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
+			kw->nr_slots--;
 			spin_unlock(&ksm_mmlist_lock);
 
 			free_mm_slot(mm_slot);
@@ -811,26 +854,41 @@ static int unmerge_and_remove_all_rmap_items(void)
 			up_read(&mm->mmap_sem);
 		}
 	}
-
-	/* Clean up stable nodes, but don't worry if some are still busy */
-	remove_all_stable_nodes();
-	ksm_scan.seqnr = 0;
 	return 0;
 
 error:
 	up_read(&mm->mmap_sem);
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	kw->mm_slot = &kw->mm_head;
 	spin_unlock(&ksm_mmlist_lock);
 	return err;
 }
+
+/* Called with ksm_scan_rwsem held for write: no ksmd is scanning */
+static int unmerge_and_remove_all_rmap_items(void)
+{
+	int i, err;
+
+	for (i = 0; i < ksm_nr_scan_threads; i++) {
+		err = unmerge_scan_rmap_items(&ksm_scans[i]);
+		if (err)
+			return err;
+	}
+
+	/* Clean up stable nodes, but don't worry if some are still busy */
+	remove_all_stable_nodes();
+	ksm_seqnr = 0;
+	for (i = 0; i < ksm_nr_scan_threads; i++)
+		ksm_scans[i].done_seqnr = 0;
+	return 0;
+}
 #endif /* CONFIG_SYSFS */
 
 static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	checksum = xxhash(addr, PAGE_SIZE, 0);
 	kunmap_atomic(addr);
 	return checksum;
 }
@@ -1395,7 +1453,7 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	}
 
 	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (ksm_seqnr & SEQNR_MASK);
 	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
 	rb_insert_color(&rmap_item->node, root);
@@ -1430,16 +1488,22 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  *
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
+ *
+ * Takes ksm_tree_mutex, but drops it to calculate the checksum: by then
+ * rmap_item is in neither tree, so no other ksmd can get hold of it.
+ * Returns true if the page was merged.
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static bool cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 {
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
 	unsigned int checksum;
+	bool merged = false;
 	int err;
 
+	mutex_lock(&ksm_tree_mutex);
 	stable_node = page_stable_node(page);
 	if (stable_node) {
 		if (stable_node->head != &migrate_nodes &&
@@ -1451,14 +1515,14 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		}
 		if (stable_node->head != &migrate_nodes &&
 		    rmap_item->head == stable_node)
-			return;
+			goto out;
 	}
 
 	/* We first start with searching the page inside the stable tree */
 	kpage = stable_tree_search(page);
 	if (kpage == page && rmap_item->head == stable_node) {
 		put_page(kpage);
-		return;
+		goto out;
 	}
 
 	remove_rmap_item_from_tree(rmap_item);
@@ -1473,10 +1537,12 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			lock_page(kpage);
 			stable_tree_append(rmap_item, page_stable_node(kpage));
 			unlock_page(kpage);
+			merged = true;
 		}
 		put_page(kpage);
-		return;
+		goto out;
 	}
+	mutex_unlock(&ksm_tree_mutex);
 
 	/*
 	 * If the hash value of the page has changed from the last time
@@ -1487,9 +1553,10 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
-		return;
+		return false;
 	}
 
+	mutex_lock(&ksm_tree_mutex);
 	tree_rmap_item =
 		unstable_tree_search_insert(rmap_item, page, &tree_page);
 	if (tree_rmap_item) {
@@ -1506,6 +1573,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			if (stable_node) {
 				stable_tree_append(tree_rmap_item, stable_node);
 				stable_tree_append(rmap_item, stable_node);
+				merged = true;
 			}
 			unlock_page(kpage);
 
@@ -1521,11 +1589,48 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			}
 		}
 	}
+out:
+	mutex_unlock(&ksm_tree_mutex);
+	return merged;
+}
+
+/*
+ * rmap_items which have gone stale are unlinked from their rmap_list under
+ * mmap_sem, which must not be held while taking ksm_tree_mutex: they are
+ * chained on a private list through rmap_list, then removed from the trees
+ * and freed by remove_stale_rmap_items() once mmap_sem has been dropped.
+ */
+static void unlink_stale_rmap_item(struct rmap_item **rmap_list,
+				   struct rmap_item **stale)
+{
+	struct rmap_item *rmap_item = *rmap_list;
+
+	*rmap_list = rmap_item->rmap_list;
+	rmap_item->rmap_list = *stale;
+	*stale = rmap_item;
+}
+
+static void remove_stale_rmap_items(struct rmap_item *stale)
+{
+	struct rmap_item *rmap_item;
+
+	if (!stale)
+		return;
+
+	mutex_lock(&ksm_tree_mutex);
+	while (stale) {
+		rmap_item = stale;
+		stale = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
+	mutex_unlock(&ksm_tree_mutex);
 }
 
 static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 					    struct rmap_item **rmap_list,
-					    unsigned long addr)
+					    unsigned long addr,
+					    struct rmap_item **stale)
 {
 	struct rmap_item *rmap_item;
 
@@ -1535,9 +1640,7 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 			return rmap_item;
 		if (rmap_item->address > addr)
 			break;
-		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		unlink_stale_rmap_item(rmap_list, stale);
 	}
 
 	rmap_item = alloc_rmap_item();
@@ -1551,68 +1654,123 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * Start a new generation of the unstable tree: called with ksm_tree_mutex
+ * held, once every ksmd with mms to scan has completed a full scan started
+ * in the current generation, so that each rmap_item left in the unstable
+ * tree has been seen again and is at most one generation old.
+ */
+static void ksm_new_unstable_tree(void)
+{
+	int nid;
+
+	/*
+	 * Whereas stale stable_nodes on the stable_tree itself
+	 * get pruned in the regular course of stable_tree_search(),
+	 * those moved out to the migrate_nodes list can accumulate:
+	 * so prune them once before each full scan.
+	 */
+	if (!ksm_merge_across_nodes) {
+		struct stable_node *stable_node;
+		struct list_head *this, *next;
+		struct page *page;
+
+		list_for_each_safe(this, next, &migrate_nodes) {
+			stable_node = list_entry(this,
+					struct stable_node, list);
+			page = get_ksm_page(stable_node, false);
+			if (page)
+				put_page(page);
+			cond_resched();
+		}
+	}
+
+	for (nid = 0; nid < ksm_nr_node_ids; nid++)
+		root_unstable_tree[nid] = RB_ROOT;
+
+	ksm_seqnr++;
+}
+
+static void ksm_scan_done(struct ksm_scan *kw)
+{
+	bool flushed = false;
+	int i;
+
+	mutex_lock(&ksm_tree_mutex);
+	if (kw->seqnr == ksm_seqnr) {
+		kw->done_seqnr = ksm_seqnr + 1;
+		for (i = 0; i < ksm_nr_scan_threads; i++) {
+			struct ksm_scan *other = &ksm_scans[i];
+
+			if (other->done_seqnr != ksm_seqnr + 1 &&
+			    !list_empty(&other->mm_head.mm_list))
+				break;
+		}
+		if (i == ksm_nr_scan_threads) {
+			ksm_new_unstable_tree();
+			flushed = true;
+		}
+	}
+	mutex_unlock(&ksm_tree_mutex);
+
+	/*
+	 * A number of pages can hang around indefinitely on per-cpu
+	 * pagevecs, raised page count preventing write_protect_page
+	 * from merging them.  Though it doesn't really matter much,
+	 * it is puzzling to see some stuck in pages_volatile until
+	 * other activity jostles them out, and they also prevented
+	 * LTP's KSM test from succeeding deterministically; so drain
+	 * them here (here rather than on entry to ksm_do_scan(),
+	 * so we don't IPI too often when pages_to_scan is set low).
+	 */
+	if (flushed)
+		lru_add_drain_all();
+}
+
+static bool ksm_mm_has_mergeable_vma(struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+
+	if (ksm_test_exit(mm))
+		return false;
+	for (vma = mm->mmap; vma; vma = vma->vm_next)
+		if (vma->vm_flags & VM_MERGEABLE)
+			return true;
+	return false;
+}
+
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_scan *kw,
+						 struct page **page)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
-	int nid;
+	struct rmap_item *stale = NULL;
+	bool remove_slot;
 
-	if (list_empty(&ksm_mm_head.mm_list))
+	if (list_empty(&kw->mm_head.mm_list))
 		return NULL;
 
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
-		/*
-		 * A number of pages can hang around indefinitely on per-cpu
-		 * pagevecs, raised page count preventing write_protect_page
-		 * from merging them.  Though it doesn't really matter much,
-		 * it is puzzling to see some stuck in pages_volatile until
-		 * other activity jostles them out, and they also prevented
-		 * LTP's KSM test from succeeding deterministically; so drain
-		 * them here (here rather than on entry to ksm_do_scan(),
-		 * so we don't IPI too often when pages_to_scan is set low).
-		 */
-		lru_add_drain_all();
-
-		/*
-		 * Whereas stale stable_nodes on the stable_tree itself
-		 * get pruned in the regular course of stable_tree_search(),
-		 * those moved out to the migrate_nodes list can accumulate:
-		 * so prune them once before each full scan.
-		 */
-		if (!ksm_merge_across_nodes) {
-			struct stable_node *stable_node;
-			struct list_head *this, *next;
-			struct page *page;
-
-			list_for_each_safe(this, next, &migrate_nodes) {
-				stable_node = list_entry(this,
-						struct stable_node, list);
-				page = get_ksm_page(stable_node, false);
-				if (page)
-					put_page(page);
-				cond_resched();
-			}
-		}
-
-		for (nid = 0; nid < ksm_nr_node_ids; nid++)
-			root_unstable_tree[nid] = RB_ROOT;
+	slot = kw->mm_slot;
+	if (slot == &kw->mm_head) {
+		mutex_lock(&ksm_tree_mutex);
+		kw->seqnr = ksm_seqnr;
+		mutex_unlock(&ksm_tree_mutex);
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
+		kw->mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
 		/*
 		 * Although we tested list_empty() above, a racing __ksm_exit
 		 * of the last mm on the list may have removed it since then.
 		 */
-		if (slot == &ksm_mm_head)
+		if (slot == &kw->mm_head)
 			return NULL;
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		kw->address = 0;
+		kw->rmap_list = &slot->rmap_list;
 	}
 
 	mm = slot->mm;
@@ -1620,71 +1778,84 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, kw->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (kw->address < vma->vm_start)
+			kw->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			kw->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (kw->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, kw->address, FOLL_GET);
 			if (IS_ERR_OR_NULL(*page)) {
-				ksm_scan.address += PAGE_SIZE;
+				kw->address += PAGE_SIZE;
 				cond_resched();
 				continue;
 			}
 			if (PageAnon(*page) ||
 			    page_trans_compound_anon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+				flush_anon_page(vma, *page, kw->address);
 				flush_dcache_page(*page);
 				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
+					kw->rmap_list, kw->address, &stale);
 				if (rmap_item) {
-					ksm_scan.rmap_list =
+					kw->rmap_list =
 							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
+					kw->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
+				remove_stale_rmap_items(stale);
 				return rmap_item;
 			}
 			put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			kw->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		kw->address = 0;
+		kw->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	while (*kw->rmap_list)
+		unlink_stale_rmap_item(kw->rmap_list, &stale);
+
+	/*
+	 * We've completed a full scan of all vmas, holding mmap_sem
+	 * throughout, and found no VM_MERGEABLE: so do the same as
+	 * __ksm_exit does to remove this mm from all our lists now.
+	 * This applies either when cleaning up after __ksm_exit
+	 * (but beware: we can reach here even before __ksm_exit),
+	 * or when all VM_MERGEABLE areas have been unmapped (and
+	 * mmap_sem then protects against race with MADV_MERGEABLE).
+	 */
+	remove_slot = (kw->address == 0);
+	if (stale) {
+		up_read(&mm->mmap_sem);
+		remove_stale_rmap_items(stale);
+		down_read(&mm->mmap_sem);
+		/* MADV_MERGEABLE may have slipped in while mmap_sem was dropped */
+		if (remove_slot && ksm_mm_has_mergeable_vma(mm))
+			remove_slot = false;
+	}
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+	kw->mm_slot = list_entry(slot->mm_list.next,
 						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
-		/*
-		 * We've completed a full scan of all vmas, holding mmap_sem
-		 * throughout, and found no VM_MERGEABLE: so do the same as
-		 * __ksm_exit does to remove this mm from all our lists now.
-		 * This applies either when cleaning up after __ksm_exit
-		 * (but beware: we can reach here even before __ksm_exit),
-		 * or when all VM_MERGEABLE areas have been unmapped (and
-		 * mmap_sem then protects against race with MADV_MERGEABLE).
-		 */
+	if (remove_slot) {
 		hash_del(&slot->link);
 		list_del(&slot->mm_list);
+		kw->nr_slots--;
 		spin_unlock(&ksm_mmlist_lock);
 
 		free_mm_slot(slot);
@@ -1697,63 +1868,120 @@ next_mm:
 	}
 
 	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
+	slot = kw->mm_slot;
+	if (slot != &kw->mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	ksm_scan_done(kw);
 	return NULL;
 }
 
+static unsigned int ksm_scan_batch(struct ksm_scan *kw)
+{
+	unsigned long base = ksm_thread_pages_to_scan;
+	unsigned long max = min_t(unsigned long, UINT_MAX,
+				  base * KSM_AUTOTUNE_MAX_SCALE);
+
+	if (!ksm_pages_to_scan_autotune)
+		return base;
+	return clamp(kw->pages_to_scan, base, max);
+}
+
+/*
+ * Scan more while pages in a batch keep being merged, back off towards
+ * pages_to_scan once nothing is found.
+ */
+static void ksm_autotune(struct ksm_scan *kw, unsigned int batch,
+			 unsigned int scanned, unsigned int merged)
+{
+	if (!ksm_pages_to_scan_autotune || !scanned)
+		return;
+
+	if ((unsigned long)merged * 1024 >=
+	    (unsigned long)scanned * KSM_AUTOTUNE_GOOD_YIELD)
+		kw->pages_to_scan = (unsigned long)batch * 2;
+	else if (!merged)
+		kw->pages_to_scan = batch / 2;
+	else
+		kw->pages_to_scan = batch;
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @kw - the cursor of this ksmd.
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_scan *kw, unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
+	unsigned int scanned = 0, merged = 0;
 
-	while (scan_npages-- && likely(!freezing(current))) {
+	while (scanned < scan_npages && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(kw, &page);
 		if (!rmap_item)
-			return;
-		cmp_and_merge_page(page, rmap_item);
+			break;
+		scanned++;
+		if (cmp_and_merge_page(page, rmap_item))
+			merged++;
 		put_page(page);
 	}
+
+	ksm_autotune(kw, scan_npages, scanned, merged);
 }
 
-static int ksmd_should_run(void)
+static int ksmd_should_run(struct ksm_scan *kw)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&kw->mm_head.mm_list);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_scan *kw = data;
+
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		wait_while_offlining();
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		down_read(&ksm_scan_rwsem);
+		if (ksmd_should_run(kw) && !(ksm_run & KSM_RUN_OFFLINE))
+			ksm_do_scan(kw, ksm_scan_batch(kw));
+		up_read(&ksm_scan_rwsem);
 
 		try_to_freeze();
 
-		if (ksmd_should_run()) {
+		if (ksm_run & KSM_RUN_OFFLINE) {
+			wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
+				    TASK_UNINTERRUPTIBLE);
+		} else if (ksmd_should_run(kw)) {
 			schedule_timeout_interruptible(
 				msecs_to_jiffies(ksm_thread_sleep_millisecs));
 		} else {
 			wait_event_freezable(ksm_thread_wait,
-				ksmd_should_run() || kthread_should_stop());
+				ksmd_should_run(kw) || kthread_should_stop());
 		}
 	}
 	return 0;
 }
 
+/* Called with ksm_mmlist_lock held */
+static struct ksm_scan *ksm_pick_scan(int nid)
+{
+	struct ksm_scan *kw, *local = NULL, *any = NULL;
+	int i;
+
+	for (i = 0; i < ksm_nr_scan_threads; i++) {
+		kw = &ksm_scans[i];
+		if (!any || kw->nr_slots < any->nr_slots)
+			any = kw;
+		if (kw->nid == nid &&
+		    (!local || kw->nr_slots < local->nr_slots))
+			local = kw;
+	}
+	return local ? local : any;
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1804,16 +2032,20 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 int __ksm_enter(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
+	struct ksm_scan *kw;
 	int needs_wakeup;
 
 	mm_slot = alloc_mm_slot();
 	if (!mm_slot)
 		return -ENOMEM;
 
-	/* Check ksm_run too?  Would need tighter locking */
-	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
-
 	spin_lock(&ksm_mmlist_lock);
+	mm_slot->nid = numa_node_id();
+	kw = ksm_pick_scan(mm_slot->nid);
+	mm_slot->scan = kw;
+	kw->nr_slots++;
+	/* Check ksm_run too?  Would need tighter locking */
+	needs_wakeup = list_empty(&kw->mm_head.mm_list);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
 	 * When KSM_RUN_MERGE (or KSM_RUN_STOP),
@@ -1826,9 +2058,9 @@ int __ksm_enter(struct mm_struct *mm)
 	 * missed: then we might as well insert at the end of the list.
 	 */
 	if (ksm_run & KSM_RUN_UNMERGE)
-		list_add_tail(&mm_slot->mm_list, &ksm_mm_head.mm_list);
+		list_add_tail(&mm_slot->mm_list, &kw->mm_head.mm_list);
 	else
-		list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+		list_add_tail(&mm_slot->mm_list, &kw->mm_slot->mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
@@ -1856,14 +2088,15 @@ void __ksm_exit(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && mm_slot->scan->mm_slot != mm_slot) {
 		if (!mm_slot->rmap_list) {
 			hash_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
+			mm_slot->scan->nr_slots--;
 			easy_to_free = 1;
 		} else {
 			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+				  &mm_slot->scan->mm_slot->mm_list);
 		}
 	}
 	spin_unlock(&ksm_mmlist_lock);
@@ -2059,6 +2292,9 @@ static int ksm_memory_callback(struct notifier_block *self,
 		 */
 		mutex_lock(&ksm_thread_mutex);
 		ksm_run |= KSM_RUN_OFFLINE;
+		/* Wait for any ksmd still scanning a batch */
+		down_write(&ksm_scan_rwsem);
+		up_write(&ksm_scan_rwsem);
 		mutex_unlock(&ksm_thread_mutex);
 		break;
 
@@ -2091,6 +2327,56 @@ static void wait_while_offlining(void)
 }
 #endif /* CONFIG_MEMORY_HOTREMOVE */
 
+/*
+ * The scanning threads are spread round robin over the nodes with memory,
+ * and bound to their node's cpus when there is more than one of them.
+ */
+static int ksm_scan_nid(int idx)
+{
+	int nid, nr = num_node_state(N_MEMORY);
+
+	if (!nr)
+		return NUMA_NO_NODE;
+	idx %= nr;
+	for_each_node_state(nid, N_MEMORY)
+		if (!idx--)
+			return nid;
+	return NUMA_NO_NODE;
+}
+
+static void ksm_bind_scan_thread(struct ksm_scan *kw, int nr_threads)
+{
+	const struct cpumask *cpumask = cpu_possible_mask;
+
+	if (nr_threads > 1 && kw->nid != NUMA_NO_NODE &&
+	    !cpumask_empty(cpumask_of_node(kw->nid)))
+		cpumask = cpumask_of_node(kw->nid);
+	set_cpus_allowed_ptr(kw->thread, cpumask);
+}
+
+static int ksm_start_scan_thread(int idx)
+{
+	struct ksm_scan *kw = &ksm_scans[idx];
+	struct task_struct *thread;
+
+	kw->nid = ksm_scan_nid(idx);
+	if (idx)
+		thread = kthread_create_on_node(ksm_scan_thread, kw, kw->nid,
+						"ksmd%d", idx);
+	else
+		thread = kthread_create_on_node(ksm_scan_thread, kw, kw->nid,
+						"ksmd");
+	if (IS_ERR(thread)) {
+		pr_err("ksm: creating kthread failed\n");
+		return PTR_ERR(thread);
+	}
+
+	kw->thread = thread;
+	ksm_bind_scan_thread(kw, max(ksm_nr_scan_threads, idx + 1));
+	wake_up_process(thread);
+	return 0;
+}
+
 #ifdef CONFIG_SYSFS
 /*
  * This all compiles without CONFIG_SYSFS, but is a waste of space.
@@ -2148,6 +2434,109 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t pages_to_scan_autotune_show(struct kobject *kobj,
+					   struct kobj_attribute *attr,
+					   char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_pages_to_scan_autotune);
+}
+
+static ssize_t pages_to_scan_autotune_store(struct kobject *kobj,
+					    struct kobj_attribute *attr,
+					    const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = kstrtoul(buf, 10, &knob);
+	if (err)
+		return err;
+	if (knob > 1)
+		return -EINVAL;
+
+	ksm_pages_to_scan_autotune = knob;
+
+	return count;
+}
+KSM_ATTR(pages_to_scan_autotune);
+
+/*
+ * Called with ksm_scan_rwsem held for write: hand all mm_slots out again
+ * over the first nr_threads scanning threads, restarting their scans.
+ */
+static void ksm_redistribute_mm_slots(int nr_threads)
+{
+	LIST_HEAD(mm_slots);
+	struct mm_slot *mm_slot, *next;
+	struct ksm_scan *kw;
+	int i;
+
+	spin_lock(&ksm_mmlist_lock);
+	for (i = 0; i < KSM_MAX_SCAN_THREADS; i++) {
+		kw = &ksm_scans[i];
+		list_splice_tail_init(&kw->mm_head.mm_list, &mm_slots);
+		kw->mm_slot = &kw->mm_head;
+		kw->nr_slots = 0;
+		kw->done_seqnr = 0;
+	}
+
+	ksm_nr_scan_threads = nr_threads;
+	list_for_each_entry_safe(mm_slot, next, &mm_slots, mm_list) {
+		kw = ksm_pick_scan(mm_slot->nid);
+		mm_slot->scan = kw;
+		kw->nr_slots++;
+		list_move_tail(&mm_slot->mm_list, &kw->mm_head.mm_list);
+	}
+	spin_unlock(&ksm_mmlist_lock);
+}
+
+static ssize_t scan_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", ksm_nr_scan_threads);
+}
+
+static ssize_t scan_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	int err, i, old;
+	unsigned long nr_threads;
+
+	err = kstrtoul(buf, 10, &nr_threads);
+	if (err || !nr_threads || nr_threads > KSM_MAX_SCAN_THREADS)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	wait_while_offlining();
+	old = ksm_nr_scan_threads;
+	for (i = nr_threads; i < old; i++) {
+		kthread_stop(ksm_scans[i].thread);
+		ksm_scans[i].thread = NULL;
+	}
+	for (i = old; i < nr_threads; i++) {
+		err = ksm_start_scan_thread(i);
+		if (err) {
+			nr_threads = i;
+			break;
+		}
+	}
+
+	if (nr_threads != old) {
+		down_write(&ksm_scan_rwsem);
+		ksm_redistribute_mm_slots(nr_threads);
+		up_write(&ksm_scan_rwsem);
+		for (i = 0; i < nr_threads; i++)
+			ksm_bind_scan_thread(&ksm_scans[i], nr_threads);
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	wake_up_interruptible(&ksm_thread_wait);
+
+	return err ? err : count;
+}
+KSM_ATTR(scan_threads);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -2179,7 +2568,9 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 		ksm_run = flags;
 		if (flags & KSM_RUN_UNMERGE) {
 			set_current_oom_origin();
+			down_write(&ksm_scan_rwsem);
 			err = unmerge_and_remove_all_rmap_items();
+			up_write(&ksm_scan_rwsem);
 			clear_current_oom_origin();
 			if (err) {
 				ksm_run = KSM_RUN_STOP;
@@ -2218,6 +2609,7 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 
 	mutex_lock(&ksm_thread_mutex);
 	wait_while_offlining();
+	down_write(&ksm_scan_rwsem);
 	if (ksm_merge_across_nodes != knob) {
 		if (ksm_pages_shared || remove_all_stable_nodes())
 			err = -EBUSY;
@@ -2247,6 +2639,7 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 			ksm_nr_node_ids = knob ? 1 : nr_node_ids;
 		}
 	}
+	up_write(&ksm_scan_rwsem);
 	mutex_unlock(&ksm_thread_mutex);
 
 	return err ? err : count;
@@ -2280,7 +2673,7 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items) - ksm_pages_shared
 				- ksm_pages_sharing - ksm_pages_unshared;
 	/*
 	 * It was not worth any locking to calculate that statistic,
@@ -2295,13 +2688,15 @@ KSM_ATTR_RO(pages_volatile);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	return sprintf(buf, "%lu\n", ksm_seqnr);
 }
 KSM_ATTR_RO(full_scans);
 
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
+	&pages_to_scan_autotune_attr.attr,
+	&scan_threads_attr.attr,
 	&run_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
@@ -2322,25 +2717,29 @@ static struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
-	int err;
+	int err, i;
+
+	for (i = 0; i < KSM_MAX_SCAN_THREADS; i++) {
+		struct ksm_scan *kw = &ksm_scans[i];
+
+		INIT_LIST_HEAD(&kw->mm_head.mm_list);
+		kw->mm_slot = &kw->mm_head;
+		kw->nid = NUMA_NO_NODE;
+	}
 
 	err = ksm_slab_init();
 	if (err)
 		goto out;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
-		pr_err("ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
+	err = ksm_start_scan_thread(0);
+	if (err)
 		goto out_free;
-	}
 
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		pr_err("ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
+		kthread_stop(ksm_scans[0].thread);
 		goto out_free;
 	}
 #else
@@ -14,6 +14,7 @@
 #include <linux/falloc.h>
 #include <linux/sched.h>
 #include <linux/ksm.h>
+#include <linux/ptshare.h>
 #include <linux/fs.h>
 #include <linux/file.h>
 #include <linux/blkdev.h>
@@ -94,6 +95,14 @@ static long madvise_behavior(struct vm_area_struct *vma,
 		if (error)
 			goto out;
 		break;
+#ifdef CONFIG_PTSHARE
+	case MADV_PTSHARE:
+	case MADV_NOPTSHARE:
+		error = ptshare_madvise(vma, &new_flags, behavior);
+		if (error)
+			goto out;
+		break;
+#endif
 	}
 
 	if (new_flags == vma->vm_flags) {
@@ -128,7 +137,9 @@ success:
 	/*
 	 * vm_flags is protected by the mmap_sem held in write mode.
 	 */
+	vm_write_begin(vma);
 	vma->vm_flags = new_flags;
+	vm_write_end(vma);
 
 out:
 	if (error == -ENOMEM)
@@ -405,6 +416,10 @@ madvise_behavior_valid(int behavior)
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	case MADV_HUGEPAGE:
 	case MADV_NOHUGEPAGE:
+#endif
+#ifdef CONFIG_PTSHARE
+	case MADV_PTSHARE:
+	case MADV_NOPTSHARE:
 #endif
 	case MADV_DONTDUMP:
 	case MADV_DODUMP:
@@ -102,6 +102,8 @@ static const char * const mem_cgroup_events_names[] = {
 	"pgpgout",
 	"pgfault",
 	"pgmajfault",
+	"bg_reclaim",
+	"bg_reclaimed",
 };
 
 static const char * const mem_cgroup_lru_names[] = {
@@ -723,6 +725,7 @@ static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
 	}
 
 	__this_cpu_add(memcg->stat->nr_page_events, nr_pages);
+	mem_cgroup_stat_updated(memcg);
 }
 
 static unsigned long mem_cgroup_node_nr_lru_pages(struct mem_cgroup *memcg,
@@ -2024,6 +2027,67 @@ void mem_cgroup_handle_over_high(void)
 	current->memcg_nr_pages_over_high = 0;
 }
 
+/*
+ * Background reclaim keeps a memcg with a bg_reclaim_margin that much
+ * below min(high, max), so that charges rarely have to reclaim directly
+ * or on the way back to userland.
+ */
+static struct workqueue_struct *memcg_bg_reclaim_wq;
+
+/* Usage above which background reclaim runs, PAGE_COUNTER_MAX if never */
+static unsigned long memcg_bg_reclaim_wmark(struct mem_cgroup *memcg)
+{
+	unsigned long margin = READ_ONCE(memcg->bg_reclaim_margin);
+	unsigned long ceiling;
+
+	if (!margin)
+		return PAGE_COUNTER_MAX;
+
+	ceiling = min(READ_ONCE(memcg->memory.limit), READ_ONCE(memcg->high));
+	if (ceiling == PAGE_COUNTER_MAX)
+		return PAGE_COUNTER_MAX;
+
+	return ceiling > margin ? ceiling - margin : 0;
+}
+
+static void memcg_bg_reclaim_func(struct work_struct *work)
+{
+	struct mem_cgroup *memcg = container_of(work, struct mem_cgroup,
+						bg_reclaim_work);
+	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
+	unsigned long wmark, usage, target, nr_reclaimed;
+
+	mem_cgroup_events(memcg, MEM_CGROUP_EVENTS_BG_RECLAIM, 1);
+
+	for (;;) {
+		wmark = memcg_bg_reclaim_wmark(memcg);
+		usage = page_counter_read(&memcg->memory);
+		if (usage <= wmark)
+			break;
+
+		/* Go a quarter of the margin further, not to run per batch */
+		target = wmark - min(wmark, READ_ONCE(memcg->bg_reclaim_margin) / 4);
+		nr_reclaimed = try_to_free_mem_cgroup_pages(memcg, usage - target,
+							    GFP_KERNEL, true);
+		mem_cgroup_events(memcg, MEM_CGROUP_EVENTS_BG_RECLAIMED,
+				  nr_reclaimed);
+
+		if (!nr_reclaimed && !nr_retries--)
+			break;
+		cond_resched();
+	}
+}
+
+static void memcg_bg_reclaim_check(struct mem_cgroup *memcg)
+{
+	for (; memcg; memcg = parent_mem_cgroup(memcg)) {
+		if (page_counter_read(&memcg->memory) >
+		    memcg_bg_reclaim_wmark(memcg) &&
+		    !work_pending(&memcg->bg_reclaim_work))
+			queue_work(memcg_bg_reclaim_wq, &memcg->bg_reclaim_work);
+	}
+}
+
 static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		      unsigned int nr_pages)
 {
@@ -2143,6 +2207,8 @@ done_restock:
 	if (batch > nr_pages)
 		refill_stock(memcg, batch - nr_pages);
 
+	memcg_bg_reclaim_check(memcg);
+
 	/*
 	 * If the hierarchy is above the normal consumption range, schedule
 	 * reclaim on returning to userland.  We can perform reclaim here
@@ -2477,6 +2543,7 @@ void mem_cgroup_split_huge_fixup(struct page *head)
 
 	__this_cpu_sub(head->mem_cgroup->stat->count[MEM_CGROUP_STAT_RSS_HUGE],
 		       HPAGE_PMD_NR);
+	mem_cgroup_stat_updated(head->mem_cgroup);
 }
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
@@ -2485,7 +2552,11 @@ static void mem_cgroup_swap_statistics(struct mem_cgroup *memcg,
 					 bool charge)
 {
 	int val = (charge) ? 1 : -1;
+
+	preempt_disable();
 	this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_SWAP], val);
+	mem_cgroup_stat_updated(memcg);
+	preempt_enable();
 }
 
 /**
@@ -3153,6 +3224,7 @@ static int memcg_numa_stat_show(struct seq_file *m, void *v)
 static int memcg_stat_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	struct mem_cgroup_stat local, total;
 	unsigned long memory, memsw;
 	struct mem_cgroup *mi;
 	unsigned int i;
@@ -3163,16 +3235,30 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 		     MEM_CGROUP_EVENTS_NSTATS);
 	BUILD_BUG_ON(ARRAY_SIZE(mem_cgroup_lru_names) != NR_LRU_LISTS);
 
+	/*
+	 * Only the memcgs with updates since the last flush are visited,
+	 * instead of every memcg of the subtree on every cpu.
+	 */
+	cgroup_rstat_flush_hold(memcg->css.cgroup);
+	local = memcg->stat_local;
+	total = memcg->stat_total;
+	cgroup_rstat_flush_release();
+
+	/* without use_hierarchy, total_ only ever covered the memcg itself */
+	if (!memcg->use_hierarchy && memcg != root_mem_cgroup)
+		total = local;
+
 	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
 		if (i == MEM_CGROUP_STAT_SWAP && !do_swap_account)
 			continue;
+		/* per-cpu deltas race with each other, hide negative sums */
 		seq_printf(m, "%s %lu\n", mem_cgroup_stat_names[i],
-			   mem_cgroup_read_stat(memcg, i) * PAGE_SIZE);
+			   max(local.count[i], 0L) * PAGE_SIZE);
 	}
 
 	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++)
 		seq_printf(m, "%s %lu\n", mem_cgroup_events_names[i],
-			   mem_cgroup_read_events(memcg, i));
+			   local.events[i]);
 
 	for (i = 0; i < NR_LRU_LISTS; i++)
 		seq_printf(m, "%s %lu\n", mem_cgroup_lru_names[i],
@@ -3191,23 +3277,15 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 			   (u64)memsw * PAGE_SIZE);
 
 	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
-		unsigned long long val = 0;
-
 		if (i == MEM_CGROUP_STAT_SWAP && !do_swap_account)
 			continue;
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_read_stat(mi, i) * PAGE_SIZE;
-		seq_printf(m, "total_%s %llu\n", mem_cgroup_stat_names[i], val);
+		seq_printf(m, "total_%s %llu\n", mem_cgroup_stat_names[i],
+			   (u64)max(total.count[i], 0L) * PAGE_SIZE);
 	}
 
-	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++) {
-		unsigned long long val = 0;
-
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_read_events(mi, i);
+	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++)
 		seq_printf(m, "total_%s %llu\n",
-			   mem_cgroup_events_names[i], val);
-	}
+			   mem_cgroup_events_names[i], (u64)total.events[i]);
 
 	for (i = 0; i < NR_LRU_LISTS; i++) {
 		unsigned long long val = 0;
@@ -3245,6 +3323,34 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 	return 0;
 }
 
+static u64 mem_cgroup_bg_reclaim_margin_read(struct cgroup_subsys_state *css,
+					     struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	return (u64)READ_ONCE(memcg->bg_reclaim_margin) * PAGE_SIZE;
+}
+
+static ssize_t mem_cgroup_bg_reclaim_margin_write(struct kernfs_open_file *of,
+						  char *buf, size_t nbytes,
+						  loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned long long bytes;
+	char *end;
+
+	buf = strstrip(buf);
+	bytes = memparse(buf, &end);
+	if (*end != '\0')
+		return -EINVAL;
+
+	WRITE_ONCE(memcg->bg_reclaim_margin,
+		   min_t(u64, DIV_ROUND_UP(bytes, PAGE_SIZE), PAGE_COUNTER_MAX));
+	memcg_bg_reclaim_check(memcg);
+
+	return nbytes;
+}
+
 static u64 mem_cgroup_swappiness_read(struct cgroup_subsys_state *css,
 				      struct cftype *cft)
 {
@@ -3269,6 +3375,77 @@ static int mem_cgroup_swappiness_write(struct cgroup_subsys_state *css,
 	return 0;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static u64 mem_cgroup_khugepaged_budget_read(struct cgroup_subsys_state *css,
+					     struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	return memcg->khugepaged_scan_budget;
+}
+
+static int mem_cgroup_khugepaged_budget_write(struct cgroup_subsys_state *css,
+					      struct cftype *cft, u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	WRITE_ONCE(memcg->khugepaged_scan_budget, val);
+	return 0;
+}
+
+/*
+ * memory.khugepaged_scan_budget caps the number of pages the khugepaged
+ * workers scan per second in mms owned by the memcg, so that a tenant with
+ * a lot of address space cannot keep them from everybody else. Returns the
+ * memcg of @mm if it has a budget, with the budget period advanced.
+ */
+static struct mem_cgroup *khugepaged_budget_memcg(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg;
+
+	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (!memcg || !READ_ONCE(memcg->khugepaged_scan_budget))
+		return NULL;
+
+	if (time_after_eq(jiffies, READ_ONCE(memcg->khugepaged_period) + HZ)) {
+		WRITE_ONCE(memcg->khugepaged_period, jiffies);
+		atomic_long_set(&memcg->khugepaged_scanned, 0);
+	}
+	return memcg;
+}
+
+bool mem_cgroup_khugepaged_may_scan(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg;
+	bool ret = true;
+
+	if (mem_cgroup_disabled())
+		return true;
+
+	rcu_read_lock();
+	memcg = khugepaged_budget_memcg(mm);
+	if (memcg)
+		ret = atomic_long_read(&memcg->khugepaged_scanned) <
+			READ_ONCE(memcg->khugepaged_scan_budget);
+	rcu_read_unlock();
+	return ret;
+}
+
+void mem_cgroup_khugepaged_scanned(struct mm_struct *mm, unsigned int pages)
+{
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	rcu_read_lock();
+	memcg = khugepaged_budget_memcg(mm);
+	if (memcg)
+		atomic_long_add(pages, &memcg->khugepaged_scanned);
+	rcu_read_unlock();
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 static void __mem_cgroup_threshold(struct mem_cgroup *memcg, bool swap)
 {
 	struct mem_cgroup_threshold_ary *t;
@@ -4064,6 +4241,19 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.read_u64 = mem_cgroup_swappiness_read,
 		.write_u64 = mem_cgroup_swappiness_write,
 	},
+	{
+		.name = "bg_reclaim_margin_in_bytes",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = mem_cgroup_bg_reclaim_margin_read,
+		.write = mem_cgroup_bg_reclaim_margin_write,
+	},
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	{
+		.name = "khugepaged_scan_budget",
+		.read_u64 = mem_cgroup_khugepaged_budget_read,
+		.write_u64 = mem_cgroup_khugepaged_budget_write,
+	},
+#endif
 	{
 		.name = "move_charge_at_immigrate",
 		.read_u64 = mem_cgroup_move_charge_read,
@@ -4254,6 +4444,7 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 	vmpressure_init(&memcg->vmpressure);
 	INIT_LIST_HEAD(&memcg->event_list);
 	spin_lock_init(&memcg->event_list_lock);
+	INIT_WORK(&memcg->bg_reclaim_work, memcg_bg_reclaim_func);
 #ifdef CONFIG_MEMCG_KMEM
 	memcg->kmemcg_id = -1;
 #endif
@@ -4362,6 +4553,7 @@ static void mem_cgroup_css_free(struct cgroup_subsys_state *css)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
 
+	cancel_work_sync(&memcg->bg_reclaim_work);
 	memcg_destroy_kmem(memcg);
 	__mem_cgroup_free(memcg);
 }
@@ -4389,9 +4581,54 @@ static void mem_cgroup_css_reset(struct cgroup_subsys_state *css)
 	memcg->low = 0;
 	memcg->high = PAGE_COUNTER_MAX;
 	memcg->soft_limit = PAGE_COUNTER_MAX;
+	memcg->bg_reclaim_margin = 0;
 	memcg_wb_domain_size_changed(memcg);
 }
 
+/*
+ * Fold what changed in the per-cpu stats of @css on @cpu since the last
+ * flush into its totals, along with the deltas its children passed on,
+ * and pass the subtree's deltas on to the parent.  The cgroup core
+ * flushes children before their parents.
+ */
+static void mem_cgroup_css_rstat_flush(struct cgroup_subsys_state *css,
+				       int cpu)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+	struct mem_cgroup *parent = css->parent ?
+		mem_cgroup_from_css(css->parent) : NULL;
+	struct mem_cgroup_stat_cpu *statc = per_cpu_ptr(memcg->stat, cpu);
+	int i;
+
+	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
+		long v = READ_ONCE(statc->count[i]);
+		long delta = v - statc->count_prev[i];
+
+		statc->count_prev[i] = v;
+		memcg->stat_local.count[i] += delta;
+
+		delta += memcg->stat_pending.count[i];
+		memcg->stat_pending.count[i] = 0;
+		memcg->stat_total.count[i] += delta;
+		if (parent)
+			parent->stat_pending.count[i] += delta;
+	}
+
+	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++) {
+		unsigned long v = READ_ONCE(statc->events[i]);
+		unsigned long delta = v - statc->events_prev[i];
+
+		statc->events_prev[i] = v;
+		memcg->stat_local.events[i] += delta;
+
+		delta += memcg->stat_pending.events[i];
+		memcg->stat_pending.events[i] = 0;
+		memcg->stat_total.events[i] += delta;
+		if (parent)
+			parent->stat_pending.events[i] += delta;
+	}
+}
+
 #ifdef CONFIG_MMU
 /* Handlers for move charge at task migration. */
 static int mem_cgroup_do_precharge(unsigned long count)
@@ -4606,6 +4843,9 @@ static int mem_cgroup_move_account(struct page *page,
 			       nr_pages);
 	}
 
+	mem_cgroup_stat_updated(from);
+	mem_cgroup_stat_updated(to);
+
 	/*
 	 * It is safe to change page->mem_cgroup here because the page
 	 * is referenced, charged, and isolated - we can't race with
@@ -5241,6 +5481,12 @@ static struct cftype memory_files[] = {
 		.seq_show = memory_max_show,
 		.write = memory_max_write,
 	},
+	{
+		.name = "bg_reclaim_margin",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = mem_cgroup_bg_reclaim_margin_read,
+		.write = mem_cgroup_bg_reclaim_margin_write,
+	},
 	{
 		.name = "events",
 		.flags = CFTYPE_NOT_ON_ROOT,
@@ -5257,6 +5503,7 @@ struct cgroup_subsys memory_cgrp_subsys = {
 	.css_released = mem_cgroup_css_released,
 	.css_free = mem_cgroup_css_free,
 	.css_reset = mem_cgroup_css_reset,
+	.css_rstat_flush = mem_cgroup_css_rstat_flush,
 	.can_attach = mem_cgroup_can_attach,
 	.cancel_attach = mem_cgroup_cancel_attach,
 	.post_attach = mem_cgroup_move_task,
@@ -5476,6 +5723,7 @@ static void uncharge_batch(struct mem_cgroup *memcg, unsigned long pgpgout,
 	__this_cpu_sub(memcg->stat->count[MEM_CGROUP_STAT_RSS_HUGE], nr_huge);
 	__this_cpu_add(memcg->stat->events[MEM_CGROUP_EVENTS_PGPGOUT], pgpgout);
 	__this_cpu_add(memcg->stat->nr_page_events, nr_pages);
+	mem_cgroup_stat_updated(memcg);
 	memcg_check_events(memcg, dummy_page);
 	local_irq_restore(flags);
 
@@ -5632,6 +5880,10 @@ static int __init mem_cgroup_init(void)
 
 	hotcpu_notifier(memcg_cpu_hotplug_callback, 0);
 
+	memcg_bg_reclaim_wq = alloc_workqueue("memcg_bg_reclaim",
+					      WQ_UNBOUND | WQ_FREEZABLE, 0);
+	BUG_ON(!memcg_bg_reclaim_wq);
+
 	for_each_possible_cpu(cpu)
 		INIT_WORK(&per_cpu_ptr(&memcg_stock, cpu)->work,
 			  drain_local_stock);
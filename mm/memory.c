@@ -62,6 +62,8 @@
 #include <linux/dma-debug.h>
 #include <linux/debugfs.h>
 #include <linux/userfaultfd_k.h>
+#include <linux/ptshare.h>
+#include <linux/lazyfork.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -393,6 +395,7 @@ static void free_pte_range(struct mmu_gather *tlb, pmd_t *pmd,
 			   unsigned long addr)
 {
 	pgtable_t token = pmd_pgtable(*pmd);
+	ptshare_free_table(pmd_page(*pmd));
 	pmd_clear(pmd);
 	pte_free_tlb(tlb, token, addr);
 	atomic_long_dec(&tlb->mm->nr_ptes);
@@ -887,9 +890,13 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 				pte = swp_entry_to_pte(entry);
 				if (pte_swp_soft_dirty(*src_pte))
 					pte = pte_swp_mksoft_dirty(pte);
+				if (pte_swp_uffd_wp(*src_pte))
+					pte = pte_swp_mkuffd_wp(pte);
 				set_pte_at(src_mm, addr, src_pte, pte);
 			}
 		}
+		/* the child's vmas are not registered with any userfaultfd */
+		pte = pte_swp_clear_uffd_wp(pte);
 		goto out_set_pte;
 	}
 
@@ -909,6 +916,7 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	if (vm_flags & VM_SHARED)
 		pte = pte_mkclean(pte);
 	pte = pte_mkold(pte);
+	pte = pte_clear_uffd_wp(pte);
 
 	page = vm_normal_page(vma, addr, pte);
 	if (page) {
@@ -988,12 +996,340 @@ again:
 	return 0;
 }
 
+#ifdef CONFIG_LAZY_FORK
+/*
+ * Lazy fork
+ *
+ * Copying the page tables of a process with a lot of memory makes its
+ * fork take long, while the child, often one writing a snapshot of that
+ * memory out, touches few of the pages before it exits. Fork of an mm
+ * with MMF_LAZY_FORK set hands the pte tables of private anonymous vmas
+ * to the child as they are, and a table is only copied when one of the
+ * mms first faults on it.
+ *
+ * The rules keeping this safe:
+ *
+ * - Each mm maps a shared table through a write protected pmd, so any
+ *   write to its range faults. The number of mms beyond the first is
+ *   kept in the table's _mapcount, under its pte lock, which all of them
+ *   take. An mm left alone on a table takes it over by making its pmd
+ *   writable again.
+ *
+ * - Nothing changes the ptes of a shared table for one mm: faults,
+ *   mprotect(), mremap(), swapoff and partial unmaps first copy it with
+ *   lazyfork_unshare(), unmapping all of it just drops the mm's pmd. gup
+ *   and khugepaged fault or skip, the rmap does not unmap its pages, so
+ *   reclaim and migration leave them alone while shared.
+ *
+ * - The entries of a shared table are accounted in the rss counters of
+ *   its pt_owner only, the mm that first shared it, or of none once the
+ *   owner left. The mm taking it over accounts them again.
+ */
+
+static bool lazyfork_vma(struct vm_area_struct *vma)
+{
+	return test_bit(MMF_LAZY_FORK, &vma->vm_mm->flags) &&
+	       vma_is_anonymous(vma) && vma->anon_vma &&
+	       !(vma->vm_flags & (VM_SHARED | VM_LOCKED | VM_MERGEABLE |
+				  VM_HUGETLB | VM_SPECIAL));
+}
+
+/* Give @dst_mm the table @src_pmd points to, instead of a copy of it */
+static void lazyfork_share(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+			   pmd_t *dst_pmd, pmd_t *src_pmd)
+{
+	struct page *table = pmd_page(*src_pmd);
+	spinlock_t *ptl;
+
+	/* make sure dst_mm is on swapoff's mmlist, as in copy_one_pte() */
+	if (unlikely(!list_empty(&src_mm->mmlist)) &&
+	    list_empty(&dst_mm->mmlist)) {
+		spin_lock(&mmlist_lock);
+		if (list_empty(&dst_mm->mmlist))
+			list_add(&dst_mm->mmlist, &src_mm->mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+
+	/* Speculative faults recheck the pmd under the pte lock */
+	ptl = pte_lockptr(src_mm, src_pmd);
+	spin_lock(ptl);
+	if (!lazyfork_pmd(*src_pmd)) {
+		table->pt_owner = src_mm;
+		/* dup_mmap() flushes the TLB of src_mm */
+		set_pmd(src_pmd, pmd_wrprotect(*src_pmd));
+	}
+	atomic_inc(&table->_mapcount);
+	set_pmd(dst_pmd, *src_pmd);
+	spin_unlock(ptl);
+
+	atomic_long_inc(&dst_mm->nr_ptes);
+}
+
+/* Add the entries of a table to the rss of @mm, or with @sign -1 remove */
+static void lazyfork_account(struct mm_struct *mm, struct vm_area_struct *vma,
+			     pte_t *pte, unsigned long addr, int sign)
+{
+	int rss[NR_MM_COUNTERS];
+	int i;
+
+	init_rss_vec(rss);
+	for (i = 0; i < PTRS_PER_PTE; i++, pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+		struct page *page = NULL;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			page = vm_normal_page(vma, addr, ptent);
+		} else {
+			swp_entry_t entry = pte_to_swp_entry(ptent);
+
+			if (!non_swap_entry(entry))
+				rss[MM_SWAPENTS] += sign;
+			else if (is_migration_entry(entry))
+				page = migration_entry_to_page(entry);
+		}
+		if (page)
+			rss[PageAnon(page) ? MM_ANONPAGES : MM_FILEPAGES] += sign;
+	}
+	add_mm_rss_vec(mm, rss);
+}
+
+/*
+ * The last mm left on a table takes it over, if @table has no other
+ * users: it accounts the entries unless it already did, and gets its pmd
+ * writable again. Called with the pmd and pte locks held.
+ */
+static bool lazyfork_take_over(struct vm_area_struct *vma, pmd_t *pmd,
+			       struct page *table, pte_t *pte,
+			       unsigned long addr)
+{
+	struct mm_struct *mm = vma->vm_mm;
+
+	if (page_mapcount(table) > 0)
+		return false;
+
+	if (table->pt_owner != mm)
+		lazyfork_account(mm, vma, pte, addr, 1);
+	table->pt_owner = NULL;
+	set_pmd(pmd, pmd_mkwrite(*pmd));
+	return true;
+}
+
+/* Drop what copy_one_pte() took for the first @nr entries of a copy */
+static void lazyfork_undo_copy(struct vm_area_struct *vma, pte_t *pte,
+			       unsigned long addr, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++, pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+		struct page *page;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			page = vm_normal_page(vma, addr, ptent);
+			if (page) {
+				page_remove_rmap(page);
+				put_page(page);
+			}
+		} else if (!non_swap_entry(pte_to_swp_entry(ptent))) {
+			swap_free(pte_to_swp_entry(ptent));
+		}
+		pte_clear(vma->vm_mm, addr, pte);
+	}
+}
+
+/*
+ * Returns -EAGAIN if it needs *@newp for the copy, or *@entry to have a
+ * swap count continuation added first.
+ */
+static int __lazyfork_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+			      unsigned long addr, pgtable_t *newp,
+			      swp_entry_t *entry)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int rss[NR_MM_COUNTERS];
+	spinlock_t *pmdl, *ptl;
+	struct page *table;
+	pte_t *src, *dst;
+	int i, ret = 0;
+
+	pmdl = pmd_lock(mm, pmd);
+	if (!lazyfork_pmd(*pmd))
+		goto out;
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock_nested(ptl, SINGLE_DEPTH_NESTING);
+	src = pte_offset_map(pmd, addr);
+
+	if (lazyfork_take_over(vma, pmd, table, src, addr))
+		goto unlock;
+	if (!*newp) {
+		ret = -EAGAIN;
+		goto unlock;
+	}
+
+	init_rss_vec(rss);
+	dst = page_address(*newp);
+	for (i = 0; i < PTRS_PER_PTE; i++) {
+		if (pte_none(src[i]))
+			continue;
+		entry->val = copy_one_pte(mm, mm, &dst[i], &src[i], vma,
+					  addr + i * PAGE_SIZE, rss);
+		if (entry->val) {
+			lazyfork_undo_copy(vma, dst, addr, i);
+			ret = -EAGAIN;
+			goto unlock;
+		}
+	}
+
+	/* The owner keeps the rss it accounted the table with */
+	if (table->pt_owner == mm)
+		table->pt_owner = NULL;
+	else
+		add_mm_rss_vec(mm, rss);
+	pmd_populate(mm, pmd, *newp);
+	*newp = NULL;
+	/* Before the last mm left on the table may free it */
+	flush_tlb_range(vma, addr, addr + PMD_SIZE);
+	atomic_dec(&table->_mapcount);
+unlock:
+	pte_unmap(src);
+	spin_unlock(ptl);
+out:
+	spin_unlock(pmdl);
+	return ret;
+}
+
+static pgtable_t lazyfork_alloc_table(gfp_t gfp)
+{
+	struct page *table;
+
+	do {
+		table = alloc_page(gfp | __GFP_NOTRACK | __GFP_ZERO);
+		if (table && pgtable_page_ctor(table))
+			return table;
+		if (table)
+			__free_page(table);
+	} while (gfp & __GFP_NOFAIL);
+
+	return NULL;
+}
+
+/**
+ * lazyfork_unshare - make a pte table shared by fork private
+ * @vma:	the vma mapping the table
+ * @pmd:	the write protected pmd pointing to it
+ * @addr:	an address in its range
+ * @gfp:	how to allocate the copy, with __GFP_NOFAIL it never fails
+ *
+ * Copies the table for @vma's mm if other mms still use it, or takes it
+ * over if not. The caller holds mmap_sem. Returns -ENOMEM if the copy
+ * could not be allocated.
+ */
+int lazyfork_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+		     unsigned long addr, gfp_t gfp)
+{
+	pgtable_t new = NULL;
+	swp_entry_t entry;
+	int ret;
+
+	addr &= PMD_MASK;
+	for (;;) {
+		entry.val = 0;
+		ret = __lazyfork_unshare(vma, pmd, addr, &new, &entry);
+		if (ret != -EAGAIN)
+			break;
+		ret = -ENOMEM;
+		if (entry.val) {
+			if (add_swap_count_continuation(entry, gfp) < 0)
+				break;
+		} else {
+			new = lazyfork_alloc_table(gfp);
+			if (!new)
+				break;
+		}
+	}
+
+	if (new)
+		pte_free(vma->vm_mm, new);
+	return ret;
+}
+
+/*
+ * Unmapping the whole range of a shared table only drops this mm from
+ * it. Returns true if it did, false if the ptes are this mm's alone and
+ * are still to be zapped.
+ */
+static bool lazyfork_zap(struct vm_area_struct *vma, pmd_t *pmd,
+			 unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	spinlock_t *pmdl, *ptl;
+	struct page *table;
+	bool dropped = false;
+	pte_t *pte;
+
+	if ((addr & ~PMD_MASK) || end - addr != PMD_SIZE) {
+		lazyfork_unshare(vma, pmd, addr, GFP_KERNEL | __GFP_NOFAIL);
+		return false;
+	}
+
+	pmdl = pmd_lock(mm, pmd);
+	if (!lazyfork_pmd(*pmd))
+		goto out;
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock_nested(ptl, SINGLE_DEPTH_NESTING);
+	pte = pte_offset_map(pmd, addr);
+
+	if (!lazyfork_take_over(vma, pmd, table, pte, addr)) {
+		if (table->pt_owner == mm) {
+			lazyfork_account(mm, vma, pte, addr, -1);
+			table->pt_owner = NULL;
+		}
+		pmd_clear(pmd);
+		flush_tlb_range(vma, addr, end);
+		atomic_dec(&table->_mapcount);
+		dropped = true;
+	}
+
+	pte_unmap(pte);
+	spin_unlock(ptl);
+out:
+	spin_unlock(pmdl);
+	if (dropped)
+		atomic_long_dec(&mm->nr_ptes);
+	return dropped;
+}
+#else /* CONFIG_LAZY_FORK */
+static inline bool lazyfork_vma(struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline void lazyfork_share(struct mm_struct *dst_mm,
+				  struct mm_struct *src_mm,
+				  pmd_t *dst_pmd, pmd_t *src_pmd)
+{
+}
+
+static inline bool lazyfork_zap(struct vm_area_struct *vma, pmd_t *pmd,
+				unsigned long addr, unsigned long end)
+{
+	return false;
+}
+#endif /* CONFIG_LAZY_FORK */
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
 {
 	pmd_t *src_pmd, *dst_pmd;
 	unsigned long next;
+	bool lazy = lazyfork_vma(vma);
 
 	dst_pmd = pmd_alloc(dst_mm, dst_pud, addr);
 	if (!dst_pmd)
@@ -1014,6 +1350,10 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (lazy && next - addr == PMD_SIZE) {
+			lazyfork_share(dst_mm, src_mm, dst_pmd, src_pmd);
+			continue;
+		}
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -1197,7 +1537,8 @@ again:
 		pte_clear_not_present_full(mm, addr, pte, tlb->fullmm);
 	} while (pte++, addr += PAGE_SIZE, addr != end);
 
-	add_mm_rss_vec(mm, rss);
+	if (!ptshare_pte_unaccounted(start_pte))
+		add_mm_rss_vec(mm, rss);
 	arch_leave_lazy_mmu_mode();
 
 	/* Do the actual TLB flush before dropping ptl */
@@ -1222,6 +1563,26 @@ again:
 	return addr;
 }
 
+/*
+ * A pte table shared with other mms is left alone by MADV_DONTNEED, which
+ * is only advisory for shared mappings. Truncation must drop its ptes for
+ * all of them, and visits every sharer's vma: make each one flush its
+ * own TLB for the range. See mm/ptshare.c.
+ */
+static bool zap_shared_pte_table(struct mmu_gather *tlb, pmd_t *pmd,
+				 unsigned long addr, unsigned long end,
+				 struct zap_details *details)
+{
+	if (!ptshare_table_shared(pmd_page(*pmd)))
+		return false;
+	if (!details)
+		return true;
+
+	__tlb_adjust_range(tlb, addr);
+	__tlb_adjust_range(tlb, end - PAGE_SIZE);
+	return false;
+}
+
 static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 				struct vm_area_struct *vma, pud_t *pud,
 				unsigned long addr, unsigned long end,
@@ -1258,6 +1619,12 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		 */
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			goto next;
+		if (unlikely(vma->vm_flags & VM_PTSHARE) &&
+		    zap_shared_pte_table(tlb, pmd, addr, next, details))
+			goto next;
+		if (unlikely(lazyfork_pmd(*pmd)) &&
+		    lazyfork_zap(vma, pmd, addr, next))
+			goto next;
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 next:
 		cond_resched();
@@ -1347,6 +1714,11 @@ static void unmap_single_vma(struct mmu_gather *tlb,
 				__unmap_hugepage_range_final(tlb, vma, start, end, NULL);
 				i_mmap_unlock_write(vma->vm_file->f_mapping);
 			}
+		} else if (unlikely(vma->vm_flags & VM_PTSHARE) && !details) {
+			/* Keep the tables from being shared under us */
+			i_mmap_lock_read(vma->vm_file->f_mapping);
+			unmap_page_range(tlb, vma, start, end, details);
+			i_mmap_unlock_read(vma->vm_file->f_mapping);
 		} else
 			unmap_page_range(tlb, vma, start, end, details);
 	}
@@ -1377,8 +1749,11 @@ void unmap_vmas(struct mmu_gather *tlb,
 	struct mm_struct *mm = vma->vm_mm;
 
 	mmu_notifier_invalidate_range_start(mm, start_addr, end_addr);
-	for ( ; vma && vma->vm_start < end_addr; vma = vma->vm_next)
+	for ( ; vma && vma->vm_start < end_addr; vma = vma->vm_next) {
+		if (unlikely(vma->vm_flags & VM_PTSHARE))
+			ptshare_unshare(vma);
 		unmap_single_vma(tlb, vma, start_addr, end_addr, NULL);
+	}
 	mmu_notifier_invalidate_range_end(mm, start_addr, end_addr);
 }
 
@@ -2324,11 +2699,16 @@ static int wp_page_shared(struct mm_struct *mm, struct vm_area_struct *vma,
  */
 static int do_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		unsigned long address, pte_t *page_table, pmd_t *pmd,
-		spinlock_t *ptl, pte_t orig_pte)
+		spinlock_t *ptl, pte_t orig_pte, unsigned int flags)
 	__releases(ptl)
 {
 	struct page *old_page;
 
+	if (userfaultfd_pte_wp(vma, orig_pte)) {
+		pte_unmap_unlock(page_table, ptl);
+		return handle_userfault(vma, address, flags, VM_UFFD_WP);
+	}
+
 	old_page = vm_normal_page(vma, address, orig_pte);
 	if (!old_page) {
 		/*
@@ -2598,7 +2978,8 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	inc_mm_counter_fast(mm, MM_ANONPAGES);
 	dec_mm_counter_fast(mm, MM_SWAPENTS);
 	pte = mk_pte(page, vma->vm_page_prot);
-	if ((flags & FAULT_FLAG_WRITE) && reuse_swap_page(page)) {
+	if ((flags & FAULT_FLAG_WRITE) && reuse_swap_page(page) &&
+	    !pte_swp_uffd_wp(orig_pte)) {
 		pte = maybe_mkwrite(pte_mkdirty(pte), vma);
 		flags &= ~FAULT_FLAG_WRITE;
 		ret |= VM_FAULT_WRITE;
@@ -2607,6 +2988,9 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	flush_icache_page(vma, page);
 	if (pte_swp_soft_dirty(orig_pte))
 		pte = pte_mksoft_dirty(pte);
+	/* a write is reported by do_wp_page() below */
+	if (pte_swp_uffd_wp(orig_pte))
+		pte = pte_mkuffd_wp(pte);
 	set_pte_at(mm, address, page_table, pte);
 	if (page == swapcache) {
 		do_page_add_anon_rmap(page, vma, address, exclusive);
@@ -2635,7 +3019,8 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	}
 
 	if (flags & FAULT_FLAG_WRITE) {
-		ret |= do_wp_page(mm, vma, address, page_table, pmd, ptl, pte);
+		ret |= do_wp_page(mm, vma, address, page_table, pmd, ptl, pte,
+				  flags);
 		if (ret & VM_FAULT_ERROR)
 			ret &= VM_FAULT_ERROR;
 		goto out;
@@ -2860,7 +3245,8 @@ void do_set_pte(struct vm_area_struct *vma, unsigned long address,
 		inc_mm_counter_fast(vma->vm_mm, MM_ANONPAGES);
 		page_add_new_anon_rmap(page, vma, address);
 	} else {
-		inc_mm_counter_fast(vma->vm_mm, MM_FILEPAGES);
+		if (!ptshare_pte_unaccounted(pte))
+			inc_mm_counter_fast(vma->vm_mm, MM_FILEPAGES);
 		page_add_file_rmap(page);
 	}
 	set_pte_at(vma->vm_mm, address, pte, entry);
@@ -3261,6 +3647,8 @@ static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	/* Migrate to the requested node */
 	migrated = migrate_misplaced_page(page, vma, target_nid);
 	if (migrated) {
+		if (!node_is_toptier(page_nid))
+			count_vm_event(PGPROMOTE_SUCCESS);
 		page_nid = target_nid;
 		flags |= TNF_MIGRATED;
 	} else
@@ -3349,7 +3737,7 @@ static int handle_pte_fault(struct mm_struct *mm,
 	if (flags & FAULT_FLAG_WRITE) {
 		if (!pte_write(entry))
 			return do_wp_page(mm, vma, address,
-					pte, pmd, ptl, entry);
+					pte, pmd, ptl, entry, flags);
 		entry = pte_mkdirty(entry);
 	}
 	entry = pte_mkyoung(entry);
@@ -3436,6 +3824,8 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	 * run pte_offset_map on the pmd, if an huge pmd could
 	 * materialize from under us from a different thread.
 	 */
+	if (unlikely(pmd_none(*pmd)) && unlikely(vma->vm_flags & VM_PTSHARE))
+		ptshare_attach(vma, address, pmd);
 	if (unlikely(pmd_none(*pmd)) &&
 	    unlikely(__pte_alloc(mm, vma, pmd, address)))
 		return VM_FAULT_OOM;
@@ -3458,6 +3848,10 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	 * read mode and khugepaged takes it in write mode. So now it's
 	 * safe to run pte_offset_map().
 	 */
+	/* Any fault on a table shared by fork gets it copied first */
+	if (unlikely(lazyfork_pmd(*pmd)) &&
+	    lazyfork_unshare(vma, pmd, address, GFP_KERNEL))
+		return VM_FAULT_OOM;
 	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
@@ -3469,9 +3863,48 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
  * The mmap_sem may have been released depending on flags and our
  * return value.  See filemap_fault() and __lock_page_or_retry().
  */
+#ifdef CONFIG_MPROTECT_RANGE_LOCK
+/*
+ * mprotect_range() changes the protection of a vma with mmap_sem held
+ * only for read: keep its flags stable for the duration of the fault.
+ * Userfaultfd vmas are left out, their faults wait with mmap_sem dropped.
+ */
+static bool fault_range_lock(struct mm_struct *mm, struct vm_area_struct *vma,
+			     unsigned long address, struct range_lock *range)
+{
+	if (!test_bit(MMF_RANGE_LOCK, &mm->flags) || userfaultfd_armed(vma))
+		return false;
+
+	address &= PAGE_MASK;
+	range_lock_init(range, address, address + PAGE_SIZE - 1);
+	range_read_lock(&mm->mmap_range, range);
+	return true;
+}
+
+static void fault_range_unlock(struct mm_struct *mm, struct range_lock *range)
+{
+	range_read_unlock(&mm->mmap_range, range);
+}
+#else
+static inline bool fault_range_lock(struct mm_struct *mm,
+				    struct vm_area_struct *vma,
+				    unsigned long address,
+				    struct range_lock *range)
+{
+	return false;
+}
+
+static inline void fault_range_unlock(struct mm_struct *mm,
+				      struct range_lock *range)
+{
+}
+#endif
+
 int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		    unsigned long address, unsigned int flags)
 {
+	struct range_lock range;
+	bool ranged;
 	int ret;
 
 	__set_current_state(TASK_RUNNING);
@@ -3489,7 +3922,10 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (flags & FAULT_FLAG_USER)
 		mem_cgroup_oom_enable();
 
+	ranged = fault_range_lock(mm, vma, address, &range);
 	ret = __handle_mm_fault(mm, vma, address, flags);
+	if (ranged)
+		fault_range_unlock(mm, &range);
 
 	if (flags & FAULT_FLAG_USER) {
 		mem_cgroup_oom_disable();
@@ -3507,6 +3943,215 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults
+ *
+ * The first touch of a page in a private anonymous vma is handled here
+ * without mmap_sem, so that the threads of a process faulting in fresh
+ * memory do not queue up behind an mmap() or munmap() of some unrelated
+ * range. The vma is found under mm_rb_lock and kept from being freed by
+ * vm_ref_count, and what is used of it is sampled under vm_sequence.
+ *
+ * The pte is only set with its lock held, after checking that the vma is
+ * unchanged and still linked. Whatever unmaps, moves or reprotects the
+ * range either has changed vm_sequence or unlinked the vma by then, or
+ * takes the same pte lock after us and sees the new pte.
+ *
+ * Anything else, no pte table yet, a huge pmd, a NUMA policy on the vma,
+ * userfaultfd, a stack vma or a failed allocation, returns VM_FAULT_RETRY
+ * for the caller to take mmap_sem and go through handle_mm_fault().
+ */
+
+static bool spf_vma_changed(struct vm_area_struct *vma, unsigned int seq)
+{
+	return RB_EMPTY_NODE(&vma->vm_rb) ||
+	       read_seqcount_retry(&vma->vm_sequence, seq);
+}
+
+/*
+ * Page tables are freed after a TLB flush, which cannot complete while we
+ * run with interrupts off, as in gup_fast. Returns the pmd of @address if
+ * its pte table exists and the pte is none.
+ */
+static pmd_t *spf_find_pmd(struct mm_struct *mm, unsigned long address,
+			   pmd_t *orig_pmd)
+{
+	pmd_t *pmd = NULL;
+	pgd_t *pgd;
+	pud_t *pud;
+	pte_t *pte;
+	pmd_t pmdval;
+
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out;
+	pmd = pmd_offset(pud, address);
+	pmdval = READ_ONCE(*pmd);
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    unlikely(pmd_bad(pmdval)) || lazyfork_pmd(pmdval)) {
+		pmd = NULL;
+		goto out;
+	}
+	pte = pte_offset_map(&pmdval, address);
+	if (!pte_none(READ_ONCE(*pte)))
+		pmd = NULL;
+	pte_unmap(pte);
+	*orig_pmd = pmdval;
+out:
+	local_irq_enable();
+	return pmd;
+}
+
+/*
+ * Lock the pte of @address if @pmd still points to the same table and the
+ * vma has not changed. Holding the pte lock keeps the table from being
+ * freed from then on. Only a trylock is safe with interrupts off: the
+ * holder may be waiting for our CPU to acknowledge a TLB flush.
+ */
+static pte_t *spf_pte_lock(struct vm_area_struct *vma, unsigned int seq,
+			   pmd_t *pmd, pmd_t orig_pmd, unsigned long address,
+			   spinlock_t **ptlp)
+{
+	pte_t *pte = NULL;
+	spinlock_t *ptl;
+
+	local_irq_disable();
+	if (!pmd_same(READ_ONCE(*pmd), orig_pmd))
+		goto out;
+	ptl = pte_lockptr(vma->vm_mm, &orig_pmd);
+	if (!spin_trylock(ptl))
+		goto out;
+	/* lazyfork_share() write protects the pmd under the pte lock */
+	if (!pmd_same(READ_ONCE(*pmd), orig_pmd) ||
+	    spf_vma_changed(vma, seq)) {
+		spin_unlock(ptl);
+		goto out;
+	}
+	pte = pte_offset_map(&orig_pmd, address);
+	*ptlp = ptl;
+out:
+	local_irq_enable();
+	return pte;
+}
+
+/**
+ * handle_speculative_fault - handle a user fault without mmap_sem
+ * @mm:		the faulting mm, current->mm
+ * @address:	the faulting address
+ * @flags:	FAULT_FLAG_xxx flags of the fault
+ *
+ * Returns 0 if the fault was handled, VM_FAULT_RETRY if the caller must
+ * handle it the usual way with mmap_sem held. Errors are never returned,
+ * the slow path reports them.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma;
+	struct anon_vma *anon_vma;
+	struct mem_cgroup *memcg;
+	struct page *page = NULL;
+	unsigned long vm_flags;
+	pgprot_t page_prot;
+	unsigned int seq;
+	pgoff_t index;
+	pmd_t *pmd, orig_pmd;
+	spinlock_t *ptl;
+	pte_t *pte, entry;
+	int ret = VM_FAULT_RETRY;
+
+	vma = get_vma(mm, address);
+	if (!vma)
+		goto out;
+
+	seq = raw_read_seqcount(&vma->vm_sequence);
+	if (seq & 1)
+		goto out_put;
+	vm_flags = READ_ONCE(vma->vm_flags);
+	page_prot = vma->vm_page_prot;
+	anon_vma = READ_ONCE(vma->anon_vma);
+	index = ((address - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
+	if (!vma_is_anonymous(vma) || !anon_vma || vma_policy(vma) ||
+	    userfaultfd_armed(vma) ||
+	    address < vma->vm_start || address >= vma->vm_end)
+		goto out_put;
+	if (vm_flags & (VM_SHARED | VM_SPECIAL | VM_GROWSDOWN | VM_GROWSUP))
+		goto out_put;
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vm_flags & VM_WRITE))
+			goto out_put;
+	} else if (!(vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		goto out_put;
+	/* Nothing above may be used unless it was a consistent snapshot */
+	if (spf_vma_changed(vma, seq))
+		goto out_put;
+
+	pmd = spf_find_pmd(mm, address, &orig_pmd);
+	if (!pmd)
+		goto out_put;
+
+	if (!(flags & FAULT_FLAG_WRITE) && !mm_forbids_zeropage(mm)) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address), page_prot));
+	} else {
+		/* The vma has no policy, the task's policy applies */
+		page = alloc_page(GFP_HIGHUSER_MOVABLE);
+		if (!page)
+			goto out_put;
+		clear_user_highpage(page, address);
+		if (mem_cgroup_try_charge(page, mm, GFP_KERNEL, &memcg)) {
+			page_cache_release(page);
+			goto out_put;
+		}
+		__SetPageUptodate(page);
+		entry = mk_pte(page, page_prot);
+		if (vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+	}
+
+	pte = spf_pte_lock(vma, seq, pmd, orig_pmd, address, &ptl);
+	if (!pte)
+		goto out_release;
+	ret = 0;
+	/* Another thread may have got there first */
+	if (!pte_none(*pte))
+		goto out_unlock;
+
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap_index(page, anon_vma, index);
+		mem_cgroup_commit_charge(page, memcg, false);
+		lru_cache_add_active_or_unevictable(page, vma);
+		page = NULL;
+	}
+	set_pte_at(mm, address, pte, entry);
+	update_mmu_cache(vma, address, pte);
+out_unlock:
+	pte_unmap_unlock(pte, ptl);
+out_release:
+	if (page) {
+		mem_cgroup_cancel_charge(page, memcg);
+		page_cache_release(page);
+	}
+out_put:
+	put_vma(vma);
+out:
+	if (ret == VM_FAULT_RETRY) {
+		count_vm_event(SPECULATIVE_PGFAULT_FALLBACK);
+	} else {
+		count_vm_event(PGFAULT);
+		mem_cgroup_count_vm_event(mm, PGFAULT);
+		count_vm_event(SPECULATIVE_PGFAULT);
+		check_sync_rss_stat(current);
+	}
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
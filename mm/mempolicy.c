@@ -575,6 +575,39 @@ unsigned long change_prot_numa(struct vm_area_struct *vma,
 
 	return nr_updated;
 }
+
+/*
+ * The NUMA scanner changes many ranges of an mm in a row. Between
+ * prot_numa_batch_begin() and prot_numa_batch_end(), change_prot_numa_batch()
+ * leaves the TLB flushes of non-hugetlb vmas to a single shootdown, and
+ * mm_tlb_flush_pending() tells rmap walkers that the hinting ptes may
+ * still be cached.
+ */
+void prot_numa_batch_begin(struct mm_struct *mm)
+{
+	inc_tlb_flush_pending(mm);
+}
+
+unsigned long change_prot_numa_batch(struct vm_area_struct *vma,
+			unsigned long addr, unsigned long end)
+{
+	int nr_updated;
+
+	if (is_vm_hugetlb_page(vma))
+		return change_prot_numa(vma, addr, end);
+
+	nr_updated = change_prot_numa_noflush(vma, addr, end);
+	if (nr_updated)
+		count_vm_numa_events(NUMA_PTE_UPDATES, nr_updated);
+
+	return nr_updated;
+}
+
+void prot_numa_batch_end(struct mm_struct *mm)
+{
+	try_to_unmap_flush();
+	dec_tlb_flush_pending(mm);
+}
 #else
 static unsigned long change_prot_numa(struct vm_area_struct *vma,
 			unsigned long addr, unsigned long end)
@@ -679,7 +712,9 @@ static int vma_replace_policy(struct vm_area_struct *vma,
 	}
 
 	old = vma->vm_policy;
+	vm_write_begin(vma);
 	vma->vm_policy = new; /* protected by mmap_sem */
+	vm_write_end(vma);
 	mpol_put(old);
 
 	return 0;
@@ -38,6 +38,7 @@
 #include <linux/balloon_compaction.h>
 #include <linux/mmu_notifier.h>
 #include <linux/page_idle.h>
+#include <linux/copy_offload.h>
 
 #include <asm/tlbflush.h>
 
@@ -147,6 +148,8 @@ static int remove_migration_pte(struct page *new, struct vm_area_struct *vma,
 	pte = pte_mkold(mk_pte(new, vma->vm_page_prot));
 	if (pte_swp_soft_dirty(*ptep))
 		pte = pte_mksoft_dirty(pte);
+	if (pte_swp_uffd_wp(*ptep))
+		pte = pte_mkuffd_wp(pte);
 
 	/* Recheck VMA as permissions can change since migration started  */
 	if (is_write_migration_entry(entry))
@@ -494,6 +497,7 @@ static void __copy_gigantic_page(struct page *dst, struct page *src,
 
 static void copy_huge_page(struct page *dst, struct page *src)
 {
+	struct copy_offload co;
 	int i;
 	int nr_pages;
 
@@ -512,6 +516,13 @@ static void copy_huge_page(struct page *dst, struct page *src)
 		nr_pages = hpage_nr_pages(src);
 	}
 
+	if (copy_offload_begin(&co)) {
+		bool queued = copy_offload_pages(&co, dst, src, nr_pages);
+
+		if (copy_offload_end(&co) && queued)
+			return;
+	}
+
 	for (i = 0; i < nr_pages; i++) {
 		cond_resched();
 		copy_highpage(dst + i, src + i);
@@ -779,8 +790,23 @@ static int move_to_new_page(struct page *newpage, struct page *page,
 	return rc;
 }
 
-static int __unmap_and_move(struct page *page, struct page *newpage,
-				int force, enum migrate_mode mode)
+/*
+ * Returned by __migrate_page_unmap() when the page is ready to be moved.
+ * The anon_vma reference and whether the page was mapped are kept in
+ * newpage->private until __migrate_page_move().
+ */
+#define MIGRATEPAGE_UNMAPPED	1
+
+/*
+ * Lock @page and @newpage and replace the ptes mapping @page with
+ * migration entries. With TTU_BATCH_FLUSH in @ttu_flags, the TLBs may
+ * still cache the old ptes until try_to_unmap_flush(). Returns
+ * MIGRATEPAGE_UNMAPPED with both pages locked, or the result of the
+ * migration with both unlocked.
+ */
+static int __migrate_page_unmap(struct page *page, struct page *newpage,
+				int force, enum migrate_mode mode,
+				enum ttu_flags ttu_flags)
 {
 	int rc = -EAGAIN;
 	int page_was_mapped = 0;
@@ -887,17 +913,13 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 		/* Establish migration ptes */
 		VM_BUG_ON_PAGE(PageAnon(page) && !PageKsm(page) && !anon_vma,
 				page);
-		try_to_unmap(page,
-			TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
+		try_to_unmap(page, TTU_MIGRATION|TTU_IGNORE_MLOCK|
+			     TTU_IGNORE_ACCESS|ttu_flags);
 		page_was_mapped = 1;
 	}
 
-	if (!page_mapped(page))
-		rc = move_to_new_page(newpage, page, mode);
-
-	if (page_was_mapped)
-		remove_migration_ptes(page,
-			rc == MIGRATEPAGE_SUCCESS ? newpage : page);
+	set_page_private(newpage, (unsigned long)anon_vma | page_was_mapped);
+	return MIGRATEPAGE_UNMAPPED;
 
 out_unlock_both:
 	unlock_page(newpage);
@@ -911,47 +933,64 @@ out:
 }
 
 /*
- * gcc 4.7 and 4.8 on arm get an ICEs when inlining unmap_and_move().  Work
- * around it.
- */
-#if (GCC_VERSION >= 40700 && GCC_VERSION < 40900) && defined(CONFIG_ARM)
-#define ICE_noinline noinline
-#else
-#define ICE_noinline
-#endif
-
-/*
- * Obtain the lock on page, remove all ptes and migrate the page
- * to the newly allocated page in newpage.
+ * Second half of the migration of a page unmapped by
+ * __migrate_page_unmap(), once no TLB caches its old ptes.
  */
-static ICE_noinline int unmap_and_move(new_page_t get_new_page,
-				   free_page_t put_new_page,
-				   unsigned long private, struct page *page,
-				   int force, enum migrate_mode mode,
-				   enum migrate_reason reason)
+static int __migrate_page_move(struct page *page, struct page *newpage,
+			       enum migrate_mode mode)
 {
-	int rc = MIGRATEPAGE_SUCCESS;
-	int *result = NULL;
-	struct page *newpage;
+	unsigned long state = page_private(newpage);
+	struct anon_vma *anon_vma = (struct anon_vma *)(state & ~1UL);
+	int page_was_mapped = state & 1;
+	int rc = -EAGAIN;
 
-	newpage = get_new_page(page, private, &result);
-	if (!newpage)
-		return -ENOMEM;
+	/* Before the move may set up newpage->private */
+	set_page_private(newpage, 0);
 
-	if (page_count(page) == 1) {
-		/* page was freed from under us. So we are done. */
-		goto out;
-	}
+	if (!page_mapped(page))
+		rc = move_to_new_page(newpage, page, mode);
 
-	if (unlikely(PageTransHuge(page)))
-		if (unlikely(split_huge_page(page)))
-			goto out;
+	if (page_was_mapped)
+		remove_migration_ptes(page,
+			rc == MIGRATEPAGE_SUCCESS ? newpage : page);
 
-	rc = __unmap_and_move(page, newpage, force, mode);
-	if (rc == MIGRATEPAGE_SUCCESS)
-		put_new_page = NULL;
+	unlock_page(newpage);
+	/* Drop an anon_vma reference if we took one */
+	if (anon_vma)
+		put_anon_vma(anon_vma);
+	unlock_page(page);
 
-out:
+	return rc;
+}
+
+static int __unmap_and_move(struct page *page, struct page *newpage,
+				int force, enum migrate_mode mode)
+{
+	int rc;
+
+	/*
+	 * Batch the flushes of all the ptes mapping the page: one
+	 * shootdown instead of one per pte.
+	 */
+	rc = __migrate_page_unmap(page, newpage, force, mode,
+				  TTU_BATCH_FLUSH);
+	if (rc != MIGRATEPAGE_UNMAPPED)
+		return rc;
+
+	try_to_unmap_flush();
+	return __migrate_page_move(page, newpage, mode);
+}
+
+/*
+ * Take @page off the migration list unless it is to be retried, and
+ * release @newpage: with @put_new_page if the migration did not use it,
+ * to the LRU in place of @page otherwise.
+ */
+static void migrate_page_done(struct page *page, struct page *newpage,
+			      int rc, free_page_t put_new_page,
+			      unsigned long private, enum migrate_reason reason,
+			      int *result)
+{
 	if (rc != -EAGAIN) {
 		/*
 		 * A page that has been migrated has all references
@@ -996,6 +1035,52 @@ out:
 		else
 			*result = page_to_nid(newpage);
 	}
+}
+
+/*
+ * gcc 4.7 and 4.8 on arm get an ICEs when inlining unmap_and_move().  Work
+ * around it.
+ */
+#if (GCC_VERSION >= 40700 && GCC_VERSION < 40900) && defined(CONFIG_ARM)
+#define ICE_noinline noinline
+#else
+#define ICE_noinline
+#endif
+
+/*
+ * Obtain the lock on page, remove all ptes and migrate the page
+ * to the newly allocated page in newpage.
+ */
+static ICE_noinline int unmap_and_move(new_page_t get_new_page,
+				   free_page_t put_new_page,
+				   unsigned long private, struct page *page,
+				   int force, enum migrate_mode mode,
+				   enum migrate_reason reason)
+{
+	int rc = MIGRATEPAGE_SUCCESS;
+	int *result = NULL;
+	struct page *newpage;
+
+	newpage = get_new_page(page, private, &result);
+	if (!newpage)
+		return -ENOMEM;
+
+	if (page_count(page) == 1) {
+		/* page was freed from under us. So we are done. */
+		goto out;
+	}
+
+	if (unlikely(PageTransHuge(page)))
+		if (unlikely(split_huge_page(page)))
+			goto out;
+
+	rc = __unmap_and_move(page, newpage, force, mode);
+	if (rc == MIGRATEPAGE_SUCCESS)
+		put_new_page = NULL;
+
+out:
+	migrate_page_done(page, newpage, rc, put_new_page, private, reason,
+			  result);
 	return rc;
 }
 
@@ -1104,6 +1189,138 @@ out:
 	return rc;
 }
 
+/*
+ * Asynchronous migration unmaps the pages of a list a batch at a time,
+ * flushes the TLBs once for the whole batch and then moves the pages,
+ * rather than sending a round of IPIs per page. Async mode only trylocks
+ * the pages, so holding the locks of a batch cannot deadlock.
+ */
+#define MIGRATE_BATCH_NR	SWAP_CLUSTER_MAX
+
+struct migrate_batch {
+	free_page_t *put_new_page;
+	unsigned long private;
+	enum migrate_reason reason;
+	struct list_head unmapped;	/* Waiting for the TLB flush */
+	struct list_head newpages;	/* Their new pages, in the same order */
+	struct list_head retry;		/* Left for the retries */
+	unsigned int nr_unmapped;
+	int nr_succeeded;
+	int nr_failed;
+};
+
+static void migrate_batch_done(struct migrate_batch *mb, struct page *page,
+			       struct page *newpage, int rc,
+			       free_page_t put_new_page, int *result)
+{
+	switch (rc) {
+	case -EAGAIN:
+		list_move_tail(&page->lru, &mb->retry);
+		break;
+	case MIGRATEPAGE_SUCCESS:
+		mb->nr_succeeded++;
+		break;
+	default:
+		mb->nr_failed++;
+		break;
+	}
+	migrate_page_done(page, newpage, rc, put_new_page, mb->private,
+			  mb->reason, result);
+}
+
+static void migrate_batch_move(struct migrate_batch *mb)
+{
+	struct page *page, *page2, *newpage;
+	int rc;
+
+	try_to_unmap_flush();
+
+	list_for_each_entry_safe(page, page2, &mb->unmapped, lru) {
+		newpage = list_first_entry(&mb->newpages, struct page, lru);
+		list_del(&newpage->lru);
+
+		rc = __migrate_page_move(page, newpage, MIGRATE_ASYNC);
+		migrate_batch_done(mb, page, newpage, rc,
+				   rc == MIGRATEPAGE_SUCCESS ?
+				   NULL : mb->put_new_page, NULL);
+	}
+	mb->nr_unmapped = 0;
+}
+
+/*
+ * First pass of migrate_pages() in async mode. Huge pages, and the pages
+ * that could not be migrated for now, are left on @from.
+ */
+static int migrate_pages_batch(struct list_head *from,
+		new_page_t get_new_page, free_page_t put_new_page,
+		unsigned long private, enum migrate_reason reason,
+		int *nr_succeeded, int *nr_failed)
+{
+	struct migrate_batch mb = {
+		.put_new_page = put_new_page,
+		.private = private,
+		.reason = reason,
+		.unmapped = LIST_HEAD_INIT(mb.unmapped),
+		.newpages = LIST_HEAD_INIT(mb.newpages),
+		.retry = LIST_HEAD_INIT(mb.retry),
+	};
+	struct page *page, *page2, *newpage;
+	int *result;
+	int rc = 0;
+
+	list_for_each_entry_safe(page, page2, from, lru) {
+		cond_resched();
+
+		if (PageHuge(page) || PageTransHuge(page))
+			continue;
+
+		result = NULL;
+		newpage = get_new_page(page, private, &result);
+		if (!newpage) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		if (page_count(page) == 1) {
+			/* page was freed from under us. So we are done. */
+			migrate_batch_done(&mb, page, newpage,
+					   MIGRATEPAGE_SUCCESS, put_new_page,
+					   result);
+			continue;
+		}
+
+		if (unlikely(result)) {
+			/* The result is reported per page, don't batch */
+			rc = __unmap_and_move(page, newpage, 0, MIGRATE_ASYNC);
+			migrate_batch_done(&mb, page, newpage, rc,
+					   rc == MIGRATEPAGE_SUCCESS ?
+					   NULL : put_new_page, result);
+			continue;
+		}
+
+		rc = __migrate_page_unmap(page, newpage, 0, MIGRATE_ASYNC,
+					  TTU_BATCH_FLUSH);
+		if (rc != MIGRATEPAGE_UNMAPPED) {
+			migrate_batch_done(&mb, page, newpage, rc,
+					   put_new_page, NULL);
+			continue;
+		}
+
+		list_move_tail(&page->lru, &mb.unmapped);
+		list_add_tail(&newpage->lru, &mb.newpages);
+		if (++mb.nr_unmapped == MIGRATE_BATCH_NR)
+			migrate_batch_move(&mb);
+	}
+
+	if (mb.nr_unmapped)
+		migrate_batch_move(&mb);
+	list_splice(&mb.retry, from);
+
+	*nr_succeeded += mb.nr_succeeded;
+	*nr_failed += mb.nr_failed;
+	return rc == -ENOMEM ? rc : 0;
+}
+
 /*
  * migrate_pages - migrate the pages specified in a list, to the free pages
  *		   supplied as the target for the page migration
@@ -1141,7 +1358,16 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 	if (!swapwrite)
 		current->flags |= PF_SWAPWRITE;
 
-	for(pass = 0; pass < 10 && retry; pass++) {
+	if (mode == MIGRATE_ASYNC) {
+		rc = migrate_pages_batch(from, get_new_page, put_new_page,
+					 private, reason, &nr_succeeded,
+					 &nr_failed);
+		if (rc == -ENOMEM)
+			goto out;
+		pass = 1;
+	}
+
+	for (; pass < 10 && retry; pass++) {
 		retry = 0;
 
 		list_for_each_entry_safe(page, page2, from, lru) {
@@ -1193,6 +1419,61 @@ out:
 }
 
 #ifdef CONFIG_NUMA
+/*
+ * Memory tiering: reclaim on a node with a demotion target migrates cold
+ * pages to the target, a slower node, instead of discarding them. Nodes
+ * that are the target of another node are not top tier, and NUMA hinting
+ * faults promote their pages back. Targets are set in
+ * /sys/devices/system/node/nodeN/demotion_target and may not form cycles.
+ */
+static int node_demotion[MAX_NUMNODES] __read_mostly = {
+	[0 ... MAX_NUMNODES - 1] = NUMA_NO_NODE
+};
+static nodemask_t demotion_nodes __read_mostly;
+static DEFINE_MUTEX(demotion_mutex);
+
+int next_demotion_node(int node)
+{
+	return READ_ONCE(node_demotion[node]);
+}
+
+bool node_is_toptier(int node)
+{
+	return !node_isset(node, demotion_nodes);
+}
+
+int set_demotion_target(int node, int target)
+{
+	nodemask_t targets = NODE_MASK_NONE;
+	int nid, next;
+
+	if (target != NUMA_NO_NODE) {
+		if (target == node || target < 0 || target >= MAX_NUMNODES ||
+		    !node_state(target, N_MEMORY))
+			return -EINVAL;
+	}
+
+	mutex_lock(&demotion_mutex);
+	/* Following the chain from the target must not lead back here */
+	for (next = target; next != NUMA_NO_NODE;
+	     next = node_demotion[next]) {
+		if (next == node) {
+			mutex_unlock(&demotion_mutex);
+			return -EINVAL;
+		}
+	}
+
+	WRITE_ONCE(node_demotion[node], target);
+	for_each_node(nid) {
+		if (node_demotion[nid] != NUMA_NO_NODE)
+			node_set(node_demotion[nid], targets);
+	}
+	demotion_nodes = targets;
+	mutex_unlock(&demotion_mutex);
+
+	return 0;
+}
+
 /*
  * Move a list of individual pages
  */
@@ -19,6 +19,7 @@
 #include <linux/rmap.h>
 #include <linux/mmzone.h>
 #include <linux/hugetlb.h>
+#include <linux/ptshare.h>
 #include <linux/memcontrol.h>
 #include <linux/mm_inline.h>
 
@@ -422,7 +423,9 @@ static unsigned long __munlock_pagevec_fill(struct pagevec *pvec,
 void munlock_vma_pages_range(struct vm_area_struct *vma,
 			     unsigned long start, unsigned long end)
 {
+	vm_write_begin(vma);
 	vma->vm_flags &= VM_LOCKED_CLEAR_MASK;
+	vm_write_end(vma);
 
 	while (start < end) {
 		struct page *page = NULL;
@@ -504,6 +507,12 @@ static int mlock_fixup(struct vm_area_struct *vma, struct vm_area_struct **prev,
 	int ret = 0;
 	int lock = !!(newflags & VM_LOCKED);
 
+	/* Another mm must not unmap locked pages through a shared table */
+	if ((vma->vm_flags & VM_PTSHARE) && lock) {
+		ptshare_unshare(vma);
+		newflags &= ~VM_PTSHARE;
+	}
+
 	if (newflags == vma->vm_flags || (vma->vm_flags & VM_SPECIAL) ||
 	    is_vm_hugetlb_page(vma) || vma == get_gate_vma(current->mm))
 		/* don't set VM_LOCKED or VM_LOCKONFAULT and don't count */
@@ -545,9 +554,11 @@ success:
 	 * set VM_LOCKED, populate_vma_page_range will bring it back.
 	 */
 
-	if (lock)
+	if (lock) {
+		vm_write_begin(vma);
 		vma->vm_flags = newflags;
-	else
+		vm_write_end(vma);
+	} else
 		munlock_vma_pages_range(vma, start, end);
 
 out:
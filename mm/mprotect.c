@@ -24,6 +24,9 @@
 #include <linux/migrate.h>
 #include <linux/perf_event.h>
 #include <linux/ksm.h>
+#include <linux/ptshare.h>
+#include <linux/lazyfork.h>
+#include <linux/userfaultfd_k.h>
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
 #include <asm/cacheflush.h>
@@ -121,6 +124,8 @@ static unsigned long change_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 				newpte = swp_entry_to_pte(entry);
 				if (pte_swp_soft_dirty(oldpte))
 					newpte = pte_swp_mksoft_dirty(newpte);
+				if (pte_swp_uffd_wp(oldpte))
+					newpte = pte_swp_mkuffd_wp(newpte);
 				set_pte_at(mm, addr, pte, newpte);
 
 				pages++;
@@ -177,6 +182,13 @@ static inline unsigned long change_pmd_range(struct vm_area_struct *vma,
 			}
 			/* fall through, the trans huge pmd just split */
 		}
+		if (lazyfork_pmd(*pmd)) {
+			/* NUMA hinting would change the ptes for all mms */
+			if (prot_numa)
+				continue;
+			lazyfork_unshare(vma, pmd, addr,
+					 GFP_KERNEL | __GFP_NOFAIL);
+		}
 		this_pages = change_pte_range(vma, pmd, addr, next, newprot,
 				 dirty_accountable, prot_numa);
 		pages += this_pages;
@@ -212,7 +224,7 @@ static inline unsigned long change_pud_range(struct vm_area_struct *vma,
 
 static unsigned long change_protection_range(struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end, pgprot_t newprot,
-		int dirty_accountable, int prot_numa)
+		int dirty_accountable, int prot_numa, bool defer_flush)
 {
 	struct mm_struct *mm = vma->vm_mm;
 	pgd_t *pgd;
@@ -223,7 +235,7 @@ static unsigned long change_protection_range(struct vm_area_struct *vma,
 	BUG_ON(addr >= end);
 	pgd = pgd_offset(mm, addr);
 	flush_cache_range(vma, addr, end);
-	set_tlb_flush_pending(mm);
+	inc_tlb_flush_pending(mm);
 	do {
 		next = pgd_addr_end(addr, end);
 		if (pgd_none_or_clear_bad(pgd))
@@ -233,9 +245,9 @@ static unsigned long change_protection_range(struct vm_area_struct *vma,
 	} while (pgd++, addr = next, addr != end);
 
 	/* Only flush the TLB if we actually modified any entries: */
-	if (pages)
+	if (pages && !(defer_flush && defer_tlb_flush(mm)))
 		flush_tlb_range(vma, start, end);
-	clear_tlb_flush_pending(mm);
+	dec_tlb_flush_pending(mm);
 
 	return pages;
 }
@@ -249,11 +261,24 @@ unsigned long change_protection(struct vm_area_struct *vma, unsigned long start,
 	if (is_vm_hugetlb_page(vma))
 		pages = hugetlb_change_protection(vma, start, end, newprot);
 	else
-		pages = change_protection_range(vma, start, end, newprot, dirty_accountable, prot_numa);
+		pages = change_protection_range(vma, start, end, newprot, dirty_accountable, prot_numa, false);
 
 	return pages;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Make the ptes of a range of a vma other than hugetlb NUMA hinting ones,
+ * leaving the TLB flush to try_to_unmap_flush() where possible. See
+ * prot_numa_batch_begin().
+ */
+unsigned long change_prot_numa_noflush(struct vm_area_struct *vma,
+				       unsigned long start, unsigned long end)
+{
+	return change_protection_range(vma, start, end, PAGE_NONE, 0, 1, true);
+}
+#endif
+
 int
 mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 	unsigned long start, unsigned long end, unsigned long newflags)
@@ -266,6 +291,13 @@ mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 	int error;
 	int dirty_accountable = 0;
 
+	/* Changing the ptes of a shared table would change them for all */
+	if ((oldflags & VM_PTSHARE) && newflags != oldflags) {
+		ptshare_unshare(vma);
+		oldflags = vma->vm_flags;
+		newflags &= ~VM_PTSHARE;
+	}
+
 	if (newflags == oldflags) {
 		*pprev = vma;
 		return 0;
@@ -318,9 +350,11 @@ success:
 	 * vm_flags and vm_page_prot are protected by the mmap_sem
 	 * held in write mode.
 	 */
+	vm_write_begin(vma);
 	vma->vm_flags = newflags;
 	dirty_accountable = vma_wants_writenotify(vma);
 	vma_set_page_prot(vma);
+	vm_write_end(vma);
 
 	change_protection(vma, start, end, vma->vm_page_prot,
 			  dirty_accountable, 0);
@@ -344,6 +378,105 @@ fail:
 	return error;
 }
 
+#ifdef CONFIG_MPROTECT_RANGE_LOCK
+/*
+ * Once mprotect() had to wait for mmap_sem, the faults of the mm lock
+ * their page in mm->mmap_range. Then a call covering exactly one vma,
+ * which needs no split or merge, can run with mmap_sem held for read and
+ * that vma's range locked for write: nothing else changes the vma under
+ * mmap_sem for read, and the faults see its flags stable.
+ *
+ * Vmas whose change needs more than their ptes rewritten are left to
+ * mprotect_fixup(). Returns false if the call was not handled.
+ */
+static bool mprotect_range(struct mm_struct *mm, unsigned long start,
+			   unsigned long end, unsigned long vm_flags,
+			   unsigned long reqprot, unsigned long prot,
+			   int *errorp)
+{
+	long nrpages = (end - start) >> PAGE_SHIFT;
+	unsigned long oldflags, newflags;
+	unsigned long charged = 0;
+	struct vm_area_struct *vma;
+	struct range_lock range;
+	int dirty_accountable;
+	bool handled = false;
+	int error;
+
+	if (!test_bit(MMF_RANGE_LOCK, &mm->flags))
+		return false;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, start);
+	if (!vma || vma->vm_start != start || vma->vm_end != end ||
+	    userfaultfd_armed(vma))
+		goto out;
+	if (vma->vm_flags & (VM_LOCKED | VM_HUGETLB | VM_PTSHARE |
+			     VM_GROWSDOWN | VM_GROWSUP))
+		goto out;
+
+	handled = true;
+	range_lock_init(&range, start, end - 1);
+	range_write_lock(&mm->mmap_range, &range);
+
+	oldflags = vma->vm_flags;
+	newflags = vm_flags | (oldflags & ~(VM_READ | VM_WRITE | VM_EXEC));
+
+	/* newflags >> 4 shift VM_MAY% in place of VM_% */
+	error = -EACCES;
+	if ((newflags & ~(newflags >> 4)) & (VM_READ | VM_WRITE | VM_EXEC))
+		goto out_unlock;
+
+	error = security_file_mprotect(vma, reqprot, prot);
+	if (error || newflags == oldflags)
+		goto out_unlock;
+
+	/* See mprotect_fixup() */
+	if (newflags & VM_WRITE) {
+		if (!(oldflags & (VM_ACCOUNT|VM_WRITE|
+				  VM_SHARED|VM_NORESERVE))) {
+			charged = nrpages;
+			error = -ENOMEM;
+			if (security_vm_enough_memory_mm(mm, charged))
+				goto out_unlock;
+			newflags |= VM_ACCOUNT;
+		}
+	}
+
+	vm_write_begin(vma);
+	vma->vm_flags = newflags;
+	dirty_accountable = vma_wants_writenotify(vma);
+	vma_set_page_prot(vma);
+	vm_write_end(vma);
+
+	change_protection(vma, start, end, vma->vm_page_prot,
+			  dirty_accountable, 0);
+
+	/* Other mprotect_range() calls may be accounting concurrently */
+	spin_lock(&mm->page_table_lock);
+	vm_stat_account(mm, oldflags, vma->vm_file, -nrpages);
+	vm_stat_account(mm, newflags, vma->vm_file, nrpages);
+	spin_unlock(&mm->page_table_lock);
+	perf_event_mmap(vma);
+	error = 0;
+
+out_unlock:
+	range_write_unlock(&mm->mmap_range, &range);
+	*errorp = error;
+out:
+	up_read(&mm->mmap_sem);
+	return handled;
+}
+#else
+static inline bool mprotect_range(struct mm_struct *mm, unsigned long start,
+				  unsigned long end, unsigned long vm_flags,
+				  unsigned long reqprot, unsigned long prot,
+				  int *errorp)
+{
+	return false;
+}
+#endif
+
 SYSCALL_DEFINE3(mprotect, unsigned long, start, size_t, len,
 		unsigned long, prot)
 {
@@ -375,7 +508,17 @@ SYSCALL_DEFINE3(mprotect, unsigned long, start, size_t, len,
 
 	vm_flags = calc_vm_prot_bits(prot);
 
-	down_write(&current->mm->mmap_sem);
+	if (!grows && mprotect_range(current->mm, start, end, vm_flags,
+				     reqprot, prot, &error))
+		return error;
+
+	if (!down_write_trylock(&current->mm->mmap_sem)) {
+		down_write(&current->mm->mmap_sem);
+#ifdef CONFIG_MPROTECT_RANGE_LOCK
+		/* Faults see the bit once they hold mmap_sem */
+		set_bit(MMF_RANGE_LOCK, &current->mm->flags);
+#endif
+	}
 
 	vma = find_vma(current->mm, start);
 	error = -ENOMEM;
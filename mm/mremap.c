@@ -11,6 +11,8 @@
 #include <linux/hugetlb.h>
 #include <linux/shm.h>
 #include <linux/ksm.h>
+#include <linux/ptshare.h>
+#include <linux/lazyfork.h>
 #include <linux/mman.h>
 #include <linux/swap.h>
 #include <linux/capability.h>
@@ -216,6 +218,13 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 		if (pmd_none(*new_pmd) && __pte_alloc(new_vma->vm_mm, new_vma,
 						      new_pmd, new_addr))
 			break;
+		/* Moving ptes of a table shared by fork would move them for all */
+		if (lazyfork_pmd(*old_pmd))
+			lazyfork_unshare(vma, old_pmd, old_addr,
+					 GFP_KERNEL | __GFP_NOFAIL);
+		if (lazyfork_pmd(*new_pmd))
+			lazyfork_unshare(new_vma, new_pmd, new_addr,
+					 GFP_KERNEL | __GFP_NOFAIL);
 		next = (new_addr + PMD_SIZE) & PMD_MASK;
 		if (extent > next - new_addr)
 			extent = next - new_addr;
@@ -238,7 +247,7 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		unsigned long new_len, unsigned long new_addr, bool *locked)
 {
 	struct mm_struct *mm = vma->vm_mm;
-	struct vm_area_struct *new_vma;
+	struct vm_area_struct *new_vma, *src_vma;
 	unsigned long vm_flags = vma->vm_flags;
 	unsigned long new_pgoff;
 	unsigned long moved_len;
@@ -255,6 +264,12 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (mm->map_count >= sysctl_max_map_count - 3)
 		return -ENOMEM;
 
+	/* Moving the ptes of a shared table would move them for all */
+	if (vma->vm_flags & VM_PTSHARE) {
+		ptshare_unshare(vma);
+		vm_flags = vma->vm_flags;
+	}
+
 	/*
 	 * Advise KSM to break any KSM pages in the area to be moved:
 	 * it would be confusing if they were to turn up at the new
@@ -273,6 +288,12 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (!new_vma)
 		return -ENOMEM;
 
+	/* Keep speculative faults out of both ranges while the ptes move */
+	src_vma = vma;
+	vm_write_begin(src_vma);
+	if (new_vma != src_vma)
+		vm_write_begin(new_vma);
+
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len,
 				     need_rmap_locks);
 	if (moved_len < old_len) {
@@ -298,6 +319,10 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 			   new_addr, new_addr + new_len);
 	}
 
+	if (new_vma != src_vma)
+		vm_write_end(new_vma);
+	vm_write_end(src_vma);
+
 	/* Conceal VM_ACCOUNT so old reservation is not undone */
 	if (vm_flags & VM_ACCOUNT) {
 		vma->vm_flags &= ~VM_ACCOUNT;
@@ -1,6 +1,9 @@
 #include <linux/init.h>
 #include <linux/bootmem.h>
+#include <linux/freezer.h>
 #include <linux/fs.h>
+#include <linux/hashtable.h>
+#include <linux/kthread.h>
 #include <linux/sysfs.h>
 #include <linux/kobject.h>
 #include <linux/mm.h>
@@ -10,6 +13,7 @@
 #include <linux/mmu_notifier.h>
 #include <linux/page_ext.h>
 #include <linux/page_idle.h>
+#include <linux/slab.h>
 
 #define BITMAP_CHUNK_SIZE	sizeof(u64)
 #define BITMAP_CHUNK_BITS	(BITMAP_CHUNK_SIZE * BITS_PER_BYTE)
@@ -194,6 +198,356 @@ static ssize_t page_idle_bitmap_write(struct file *file, struct kobject *kobj,
 	return (char *)in - buf;
 }
 
+/*
+ * Idle page tracking by virtual address, for the processes which asked
+ * for it through /proc/<pid>/idle_pages.  kidled walks their page tables
+ * a few pages at a time, at the rate set in /sys/kernel/mm/page_idle:
+ * it counts the pages which haven't been touched since the previous pass
+ * went by, and marks them all idle again.  Reading the counts of a range
+ * back is then a page table walk, without any PFN or rmap lookups.
+ */
+struct page_idle_walk {
+	struct page_idle_stats	stats;
+	bool			mark;	/* set the idle flags up again */
+};
+
+struct page_idle_mm {
+	struct hlist_node	hash;
+	struct list_head	list;
+	struct mm_struct	*mm;
+	unsigned long		next;		/* where the pass goes on */
+	struct page_idle_stats	pass;		/* counts of the pass going on */
+	struct page_idle_stats	last;		/* and of the last complete one */
+	unsigned long		passes;
+	unsigned long		round;		/* the last kidled round in it */
+	bool			removed;
+};
+
+static DEFINE_HASHTABLE(page_idle_mm_hash, 8);
+static LIST_HEAD(page_idle_mm_list);
+static DEFINE_SPINLOCK(page_idle_mm_lock);
+static DECLARE_WAIT_QUEUE_HEAD(kidled_wait);
+
+/* pages of address space walked per round, and the sleep in between */
+static unsigned int page_idle_scan_pages __read_mostly = 16384;
+static unsigned int page_idle_scan_sleep_millisecs __read_mostly = 100;
+
+static void page_idle_account(struct page_idle_walk *iw, struct page *page,
+			      bool young, unsigned long nr)
+{
+	if (young || !page_is_idle(page))
+		iw->stats.active += nr;
+	else
+		iw->stats.idle += nr;
+
+	if (iw->mark) {
+		/* don't let reclaim miss the reference we took away */
+		if (young)
+			set_page_young(page);
+		set_page_idle(page);
+	}
+}
+
+static int page_idle_pte_range(pmd_t *pmd, unsigned long addr,
+			       unsigned long end, struct mm_walk *walk)
+{
+	struct page_idle_walk *iw = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	struct page *page;
+	pte_t *pte, *orig_pte;
+	spinlock_t *ptl;
+	bool young;
+
+	if (pmd_trans_huge_lock(pmd, vma, &ptl) == 1) {
+		page = pmd_page(*pmd);
+		if (!is_huge_zero_pmd(*pmd) && PageLRU(page)) {
+			if (iw->mark)
+				young = pmdp_clear_young_notify(vma, addr, pmd);
+			else
+				young = pmd_young(*pmd) ||
+					mmu_notifier_test_young(walk->mm, addr);
+			page_idle_account(iw, page, young, HPAGE_PMD_NR);
+		}
+		spin_unlock(ptl);
+		return 0;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || !PageLRU(page))
+			continue;
+
+		if (iw->mark)
+			young = ptep_clear_young_notify(vma, addr, pte);
+		else
+			young = pte_young(*pte) ||
+				mmu_notifier_test_young(walk->mm, addr);
+		page_idle_account(iw, page, young, 1);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+	return 0;
+}
+
+/**
+ * page_idle_count_range - count the idle and active pages of a range
+ * @vma:	the vma the range is in, with its mmap_sem held
+ * @start:	start of the range
+ * @end:	end of the range
+ * @stats:	the counts are added in here
+ *
+ * A page is idle if it was marked idle and wasn't touched since.
+ */
+void page_idle_count_range(struct vm_area_struct *vma, unsigned long start,
+			   unsigned long end, struct page_idle_stats *stats)
+{
+	struct page_idle_walk iw = { .mark = false };
+	struct mm_walk walk = {
+		.pmd_entry = page_idle_pte_range,
+		.mm = vma->vm_mm,
+		.private = &iw,
+	};
+
+	walk_page_range(start, end, &walk);
+	stats->idle += iw.stats.idle;
+	stats->active += iw.stats.active;
+}
+
+static struct page_idle_mm *page_idle_mm_find(struct mm_struct *mm)
+{
+	struct page_idle_mm *slot;
+
+	hash_for_each_possible(page_idle_mm_hash, slot, hash, (unsigned long)mm)
+		if (slot->mm == mm && !slot->removed)
+			return slot;
+	return NULL;
+}
+
+/**
+ * page_idle_scan_mm - have kidled scan an mm, or stop scanning it
+ * @mm:		the mm
+ * @on:		whether to scan it
+ */
+int page_idle_scan_mm(struct mm_struct *mm, bool on)
+{
+	struct page_idle_mm *slot, *new = NULL;
+
+	if (on) {
+		new = kzalloc(sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return -ENOMEM;
+	}
+
+	spin_lock(&page_idle_mm_lock);
+	slot = page_idle_mm_find(mm);
+	if (on && !slot) {
+		new->mm = mm;
+		atomic_inc(&mm->mm_count);
+		hash_add(page_idle_mm_hash, &new->hash, (unsigned long)mm);
+		list_add_tail(&new->list, &page_idle_mm_list);
+		new = NULL;
+	} else if (!on && slot) {
+		/* kidled frees it, it may be scanning it right now */
+		slot->removed = true;
+	}
+	spin_unlock(&page_idle_mm_lock);
+
+	kfree(new);
+	if (on)
+		wake_up_interruptible(&kidled_wait);
+	return 0;
+}
+
+/**
+ * page_idle_scan_result - the counts of kidled's last pass over an mm
+ * @mm:		the mm
+ * @stats:	filled in with the counts
+ * @passes:	filled in with the number of complete passes
+ *
+ * Returns false if kidled isn't scanning @mm.
+ */
+bool page_idle_scan_result(struct mm_struct *mm, struct page_idle_stats *stats,
+			   unsigned long *passes)
+{
+	struct page_idle_mm *slot;
+
+	spin_lock(&page_idle_mm_lock);
+	slot = page_idle_mm_find(mm);
+	if (slot) {
+		*stats = slot->last;
+		*passes = slot->passes;
+	}
+	spin_unlock(&page_idle_mm_lock);
+
+	return slot != NULL;
+}
+
+/* scan @slot's mm on from where the last round stopped, within @budget */
+static void kidled_scan_mm(struct page_idle_mm *slot, unsigned long *budget)
+{
+	struct mm_struct *mm = slot->mm;
+	struct page_idle_walk iw = { .mark = true };
+	struct mm_walk walk = {
+		.pmd_entry = page_idle_pte_range,
+		.mm = mm,
+		.private = &iw,
+	};
+	struct vm_area_struct *vma;
+	unsigned long addr = slot->next;
+
+	if (!atomic_inc_not_zero(&mm->mm_users)) {
+		spin_lock(&page_idle_mm_lock);
+		slot->removed = true;
+		spin_unlock(&page_idle_mm_lock);
+		return;
+	}
+
+	down_read(&mm->mmap_sem);
+	for (vma = find_vma(mm, addr); vma && *budget; vma = vma->vm_next) {
+		unsigned long start = max(addr, vma->vm_start);
+		unsigned long end = vma->vm_end;
+
+		if ((end - start) >> PAGE_SHIFT > *budget)
+			end = start + (*budget << PAGE_SHIFT);
+
+		walk_page_range(start, end, &walk);
+		*budget -= (end - start) >> PAGE_SHIFT;
+		addr = end;
+		if (end < vma->vm_end)
+			break;
+	}
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+
+	spin_lock(&page_idle_mm_lock);
+	slot->pass.idle += iw.stats.idle;
+	slot->pass.active += iw.stats.active;
+	if (!vma) {
+		slot->last = slot->pass;
+		memset(&slot->pass, 0, sizeof(slot->pass));
+		slot->passes++;
+		slot->next = 0;
+		list_move_tail(&slot->list, &page_idle_mm_list);
+	} else {
+		slot->next = addr;
+	}
+	spin_unlock(&page_idle_mm_lock);
+}
+
+/*
+ * Go round the mms with the scan budget, each of them at most once per
+ * round: a small mm could otherwise be done over several times in one.
+ */
+static void kidled_do_round(unsigned long round)
+{
+	unsigned long budget = READ_ONCE(page_idle_scan_pages);
+
+	while (budget) {
+		struct page_idle_mm *slot;
+
+		spin_lock(&page_idle_mm_lock);
+		slot = list_first_entry_or_null(&page_idle_mm_list,
+						struct page_idle_mm, list);
+		if (slot && slot->removed) {
+			hash_del(&slot->hash);
+			list_del(&slot->list);
+			spin_unlock(&page_idle_mm_lock);
+			mmdrop(slot->mm);
+			kfree(slot);
+			continue;
+		}
+		if (slot && slot->round == round)
+			slot = NULL;
+		else if (slot)
+			slot->round = round;
+		spin_unlock(&page_idle_mm_lock);
+
+		if (!slot)
+			break;
+		kidled_scan_mm(slot, &budget);
+	}
+}
+
+static int kidled(void *unused)
+{
+	unsigned long round = 0;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		kidled_do_round(++round);
+
+		wait_event_freezable_timeout(kidled_wait,
+				kthread_should_stop(),
+				msecs_to_jiffies(page_idle_scan_sleep_millisecs));
+		wait_event_freezable(kidled_wait, kthread_should_stop() ||
+				     !list_empty(&page_idle_mm_list));
+	}
+	return 0;
+}
+
+static ssize_t scan_pages_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", page_idle_scan_pages);
+}
+
+static ssize_t scan_pages_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned int pages;
+	int err;
+
+	err = kstrtouint(buf, 10, &pages);
+	if (err || !pages)
+		return -EINVAL;
+
+	page_idle_scan_pages = pages;
+	return count;
+}
+
+static struct kobj_attribute scan_pages_attr =
+	__ATTR(scan_pages, 0644, scan_pages_show, scan_pages_store);
+
+static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 char *buf)
+{
+	return sprintf(buf, "%u\n", page_idle_scan_sleep_millisecs);
+}
+
+static ssize_t scan_sleep_millisecs_store(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  const char *buf, size_t count)
+{
+	unsigned int msecs;
+	int err;
+
+	err = kstrtouint(buf, 10, &msecs);
+	if (err)
+		return -EINVAL;
+
+	page_idle_scan_sleep_millisecs = msecs;
+	wake_up_interruptible(&kidled_wait);
+	return count;
+}
+
+static struct kobj_attribute scan_sleep_millisecs_attr =
+	__ATTR(scan_sleep_millisecs, 0644, scan_sleep_millisecs_show,
+	       scan_sleep_millisecs_store);
+
+static struct attribute *page_idle_attrs[] = {
+	&scan_pages_attr.attr,
+	&scan_sleep_millisecs_attr.attr,
+	NULL,
+};
+
 static struct bin_attribute page_idle_bitmap_attr =
 		__BIN_ATTR(bitmap, S_IRUSR | S_IWUSR,
 			   page_idle_bitmap_read, page_idle_bitmap_write, 0);
@@ -204,6 +558,7 @@ static struct bin_attribute *page_idle_bin_attrs[] = {
 };
 
 static struct attribute_group page_idle_attr_group = {
+	.attrs = page_idle_attrs,
 	.bin_attrs = page_idle_bin_attrs,
 	.name = "page_idle",
 };
@@ -227,6 +582,9 @@ static int __init page_idle_init(void)
 		pr_err("page_idle: register sysfs failed\n");
 		return err;
 	}
+
+	if (IS_ERR(kthread_run(kidled, NULL, "kidled")))
+		pr_err("page_idle: failed to start kidled\n");
 	return 0;
 }
 subsys_initcall(page_idle_init);
@@ -0,0 +1,287 @@
+/*
+ * Background zeroing of huge pages
+ *
+ * Clearing a huge page in the fault path takes a noticeable amount of time,
+ * and for 1GB hugetlb pages it dominates the fault. A kernel thread per node
+ * with memory runs at SCHED_IDLE and does that work ahead of time: it keeps
+ * a pool of zeroed transparent huge pages (vm.prezero_thp_pages per node)
+ * and zeroes free hugetlb pages (vm.prezero_hugetlb). The fault paths take
+ * those pages first and skip clear_huge_page().
+ *
+ * The THP pool is given back through a shrinker under memory pressure.
+ */
+
+#include <linux/mm.h>
+#include <linux/huge_mm.h>
+#include <linux/hugetlb.h>
+#include <linux/mempolicy.h>
+#include <linux/cpuset.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/sysctl.h>
+#include <linux/vmstat.h>
+#include <linux/prezero.h>
+
+/* Delay before refilling after an allocation failure or a shrink */
+#define PREZERO_BACKOFF		(10 * HZ)
+
+struct prezero_node {
+	int nid;
+	spinlock_t lock;
+	struct list_head thp_pages;	/* Zeroed THPs, linked by page->lru */
+	int nr_thp;
+	unsigned long refill_after;	/* jiffies, see PREZERO_BACKOFF */
+	bool kicked;
+	wait_queue_head_t wait;
+	struct task_struct *task;
+};
+
+int sysctl_prezero_thp_pages __read_mostly;
+int sysctl_prezero_hugetlb __read_mostly;
+
+static struct prezero_node *prezero_nodes[MAX_NUMNODES];
+static DEFINE_MUTEX(prezero_mutex);
+
+static void prezero_kick(struct prezero_node *pn)
+{
+	if (!READ_ONCE(pn->kicked)) {
+		WRITE_ONCE(pn->kicked, true);
+		wake_up_interruptible(&pn->wait);
+	}
+}
+
+void prezero_kick_node(int nid)
+{
+	struct prezero_node *pn = READ_ONCE(prezero_nodes[nid]);
+
+	if (pn)
+		prezero_kick(pn);
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static struct page *prezero_take_thp(struct prezero_node *pn)
+{
+	struct page *page = NULL;
+
+	spin_lock(&pn->lock);
+	if (!list_empty(&pn->thp_pages)) {
+		page = list_first_entry(&pn->thp_pages, struct page, lru);
+		list_del(&page->lru);
+		pn->nr_thp--;
+	}
+	spin_unlock(&pn->lock);
+
+	return page;
+}
+
+/*
+ * Take a zeroed THP for a fault in @vma. The pool is node local, so faults
+ * under a NUMA policy or a cpuset excluding this node use the page allocator.
+ */
+struct page *prezero_alloc_thp(struct vm_area_struct *vma)
+{
+	struct prezero_node *pn;
+	struct page *page;
+	int nid = numa_node_id();
+
+	if (!READ_ONCE(sysctl_prezero_thp_pages))
+		return NULL;
+#ifdef CONFIG_NUMA
+	if (vma_policy(vma) || current->mempolicy)
+		return NULL;
+#endif
+	if (!cpuset_node_allowed(nid, GFP_TRANSHUGE))
+		return NULL;
+
+	pn = READ_ONCE(prezero_nodes[nid]);
+	if (!pn)
+		return NULL;
+
+	page = prezero_take_thp(pn);
+	prezero_kick(pn);
+	if (page)
+		count_vm_event(PREZERO_THP_ALLOC);
+
+	return page;
+}
+
+static bool prezero_thp_work(struct prezero_node *pn)
+{
+	int target = READ_ONCE(sysctl_prezero_thp_pages);
+	struct page *page;
+
+	if (READ_ONCE(pn->nr_thp) > target) {
+		page = prezero_take_thp(pn);
+		if (page)
+			put_page(page);
+		return page != NULL;
+	}
+
+	if (READ_ONCE(pn->nr_thp) == target ||
+	    time_before(jiffies, READ_ONCE(pn->refill_after)))
+		return false;
+
+	/* Only take memory that is free without reclaim or compaction */
+	page = alloc_pages_node(pn->nid, (GFP_TRANSHUGE & ~__GFP_RECLAIM) |
+				__GFP_THISNODE, HPAGE_PMD_ORDER);
+	if (!page) {
+		WRITE_ONCE(pn->refill_after, jiffies + PREZERO_BACKOFF);
+		return false;
+	}
+
+	clear_huge_page(page, 0, HPAGE_PMD_NR);
+
+	spin_lock(&pn->lock);
+	list_add(&page->lru, &pn->thp_pages);
+	pn->nr_thp++;
+	spin_unlock(&pn->lock);
+	count_vm_event(PREZERO_THP_REFILL);
+
+	return true;
+}
+
+static unsigned long prezero_shrink_count(struct shrinker *shrink,
+					  struct shrink_control *sc)
+{
+	struct prezero_node *pn = READ_ONCE(prezero_nodes[sc->nid]);
+
+	return pn ? READ_ONCE(pn->nr_thp) * HPAGE_PMD_NR : 0;
+}
+
+static unsigned long prezero_shrink_scan(struct shrinker *shrink,
+					 struct shrink_control *sc)
+{
+	struct prezero_node *pn = READ_ONCE(prezero_nodes[sc->nid]);
+	unsigned long freed = 0;
+
+	if (!pn)
+		return SHRINK_STOP;
+
+	WRITE_ONCE(pn->refill_after, jiffies + PREZERO_BACKOFF);
+	while (freed < sc->nr_to_scan) {
+		struct page *page = prezero_take_thp(pn);
+
+		if (!page)
+			break;
+		put_page(page);
+		freed += HPAGE_PMD_NR;
+	}
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+static struct shrinker prezero_shrinker = {
+	.count_objects = prezero_shrink_count,
+	.scan_objects = prezero_shrink_scan,
+	.seeks = DEFAULT_SEEKS,
+	.flags = SHRINKER_NUMA_AWARE,
+};
+
+static int __init prezero_init(void)
+{
+	return register_shrinker(&prezero_shrinker);
+}
+subsys_initcall(prezero_init);
+#else
+static inline bool prezero_thp_work(struct prezero_node *pn)
+{
+	return false;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+static bool prezero_hugetlb_work(struct prezero_node *pn)
+{
+#ifdef CONFIG_HUGETLB_PAGE
+	if (READ_ONCE(sysctl_prezero_hugetlb))
+		return hugetlb_prezero_page(pn->nid);
+#endif
+	return false;
+}
+
+static int prezero_thread(void *data)
+{
+	struct prezero_node *pn = data;
+	struct sched_param param = { .sched_priority = 0 };
+
+	sched_setscheduler_nocheck(current, SCHED_IDLE, &param);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		bool progress;
+
+		WRITE_ONCE(pn->kicked, false);
+		do {
+			progress = prezero_thp_work(pn);
+			progress |= prezero_hugetlb_work(pn);
+			cond_resched();
+		} while (progress && !kthread_should_stop() && !freezing(current));
+
+		wait_event_freezable_timeout(pn->wait, READ_ONCE(pn->kicked) ||
+					     kthread_should_stop(),
+					     PREZERO_BACKOFF);
+	}
+
+	return 0;
+}
+
+static int prezero_start_node(int nid)
+{
+	struct prezero_node *pn;
+	const struct cpumask *cpumask = cpumask_of_node(nid);
+
+	pn = kzalloc_node(sizeof(*pn), GFP_KERNEL, nid);
+	if (!pn)
+		return -ENOMEM;
+
+	pn->nid = nid;
+	spin_lock_init(&pn->lock);
+	INIT_LIST_HEAD(&pn->thp_pages);
+	init_waitqueue_head(&pn->wait);
+
+	pn->task = kthread_create_on_node(prezero_thread, pn, nid,
+					  "kprezerod%d", nid);
+	if (IS_ERR(pn->task)) {
+		int err = PTR_ERR(pn->task);
+
+		pr_err("Failed to start kprezerod on node %d\n", nid);
+		kfree(pn);
+		return err;
+	}
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(pn->task, cpumask);
+
+	/* Publish the fully set up node before anyone can kick it */
+	smp_wmb();
+	WRITE_ONCE(prezero_nodes[nid], pn);
+	wake_up_process(pn->task);
+
+	return 0;
+}
+
+int prezero_sysctl_handler(struct ctl_table *table, int write,
+			   void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret, nid;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	mutex_lock(&prezero_mutex);
+	for_each_node_state(nid, N_MEMORY) {
+		if (!prezero_nodes[nid]) {
+			if (!sysctl_prezero_thp_pages && !sysctl_prezero_hugetlb)
+				continue;
+			ret = prezero_start_node(nid);
+			if (ret)
+				break;
+		}
+		prezero_kick(prezero_nodes[nid]);
+	}
+	mutex_unlock(&prezero_mutex);
+
+	return ret;
+}
@@ -0,0 +1,205 @@
+/*
+ * Page table sharing for shmem mappings
+ *
+ * Processes mapping one large shmem segment MAP_SHARED, a database's
+ * shared buffers for instance, each fill identical pte tables for it. In
+ * a vma marked with MADV_PTSHARE, a fault in a pmd range covered by the
+ * vma that has no pte table yet takes the table of another mm mapping the
+ * same file offsets at the same pmd alignment with the same flags, much
+ * like huge_pmd_share() does for hugetlb.
+ *
+ * The rules keeping this safe:
+ *
+ * - A table is attached and detached only under i_mmap_rwsem held for
+ *   write. The number of mms beyond the first is kept in its _mapcount.
+ *
+ * - Only VM_PTSHARE vmas map shared tables. Whatever changes the ptes of
+ *   a single mm (munmap, exit, mprotect, mremap, mlock) first calls
+ *   ptshare_unshare(), which detaches the mm and clears VM_PTSHARE.
+ *   MADV_DONTNEED leaves shared tables alone, truncation zaps them for
+ *   all sharers, see zap_shared_pte_table().
+ *
+ * - The rmap changing a pte in a shared table flushes the TLBs of all
+ *   sharers, ptshare_flush_tlb_page().
+ *
+ * - When a table is first shared, the rss its owner had accounted for it
+ *   is dropped and no entry of it is accounted again.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/mman.h>
+#include <linux/pagemap.h>
+#include <linux/shmem_fs.h>
+#include <linux/ptshare.h>
+#include <asm/pgalloc.h>
+#include <asm/tlbflush.h>
+
+#include "internal.h"
+
+static bool ptshare_covers(struct vm_area_struct *vma, unsigned long base)
+{
+	return base >= vma->vm_start && base + PMD_SIZE <= vma->vm_end;
+}
+
+/*
+ * Stop accounting the entries of @table in @mm, which filled it alone.
+ * The owner's faults check PG_private_2 under the pte lock.
+ */
+static void ptshare_unaccount(struct mm_struct *mm, pmd_t *pmd,
+			      struct page *table, unsigned long base)
+{
+	spinlock_t *ptl;
+	pte_t *pte;
+	int i, nr = 0;
+
+	if (PagePrivate2(table))
+		return;
+
+	pte = pte_offset_map_lock(mm, pmd, base, &ptl);
+	for (i = 0; i < PTRS_PER_PTE; i++) {
+		if (!pte_none(pte[i]))
+			nr++;
+	}
+	SetPagePrivate2(table);
+	pte_unmap_unlock(pte, ptl);
+
+	add_mm_counter(mm, MM_FILEPAGES, -nr);
+}
+
+/*
+ * Try to populate @pmd, which is empty, with another mm's table for the
+ * same part of the file. Returns true if it did.
+ */
+bool ptshare_attach(struct vm_area_struct *vma, unsigned long address,
+		    pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	unsigned long base = address & PMD_MASK;
+	pgoff_t idx = linear_page_index(vma, base);
+	struct vm_area_struct *svma;
+	struct page *table = NULL;
+	bool attached = false;
+	spinlock_t *ptl;
+
+	if (!ptshare_covers(vma, base))
+		return false;
+
+	i_mmap_lock_write(mapping);
+	vma_interval_tree_foreach(svma, &mapping->i_mmap, idx, idx) {
+		unsigned long saddr;
+		pmd_t *spmd;
+
+		if (svma->vm_mm == mm || svma->vm_flags != vma->vm_flags)
+			continue;
+
+		saddr = svma->vm_start + ((idx - svma->vm_pgoff) << PAGE_SHIFT);
+		if ((saddr & ~PMD_MASK) || !ptshare_covers(svma, saddr))
+			continue;
+
+		spmd = mm_find_pmd(svma->vm_mm, saddr);
+		if (spmd) {
+			table = pmd_page(*spmd);
+			ptshare_unaccount(svma->vm_mm, spmd, table, saddr);
+			break;
+		}
+	}
+
+	if (table) {
+		ptl = pmd_lock(mm, pmd);
+		if (pmd_none(*pmd)) {
+			atomic_inc(&table->_mapcount);
+			atomic_long_inc(&mm->nr_ptes);
+			pmd_populate(mm, pmd, table);
+			attached = true;
+		}
+		spin_unlock(ptl);
+	}
+	i_mmap_unlock_write(mapping);
+
+	return attached;
+}
+
+/* Drop this mm's reference to a shared table, under i_mmap_rwsem */
+static void ptshare_detach(struct vm_area_struct *vma, pmd_t *pmd,
+			   unsigned long base)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *table = pmd_page(*pmd);
+	spinlock_t *ptl;
+
+	if (!ptshare_table_shared(table))
+		return;
+
+	ptl = pmd_lock(mm, pmd);
+	pmd_clear(pmd);
+	spin_unlock(ptl);
+	/* Before the last sharer may free it */
+	flush_tlb_range(vma, base, base + PMD_SIZE);
+
+	atomic_long_dec(&mm->nr_ptes);
+	atomic_dec(&table->_mapcount);
+}
+
+/*
+ * Make @vma's page tables private before changing them, and keep other
+ * mms from sharing them later. The whole vma stops sharing, and the
+ * caller holds mmap_sem for write so no fault of this mm is using a
+ * table being detached.
+ */
+void ptshare_unshare(struct vm_area_struct *vma)
+{
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	unsigned long addr;
+
+	i_mmap_lock_write(mapping);
+	vma->vm_flags &= ~VM_PTSHARE;
+	for (addr = vma->vm_start & PMD_MASK; addr < vma->vm_end;
+	     addr += PMD_SIZE) {
+		pmd_t *pmd = mm_find_pmd(vma->vm_mm, addr);
+
+		if (pmd)
+			ptshare_detach(vma, pmd, addr);
+	}
+	i_mmap_unlock_write(mapping);
+}
+
+void __ptshare_flush_tlb_page(struct vm_area_struct *vma,
+			      unsigned long address)
+{
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	pgoff_t idx = linear_page_index(vma, address);
+	struct vm_area_struct *svma;
+
+	vma_interval_tree_foreach(svma, &mapping->i_mmap, idx, idx) {
+		if (svma->vm_mm == vma->vm_mm ||
+		    !(svma->vm_flags & VM_PTSHARE))
+			continue;
+		flush_tlb_page(svma, svma->vm_start +
+			       ((idx - svma->vm_pgoff) << PAGE_SHIFT));
+	}
+}
+
+int ptshare_madvise(struct vm_area_struct *vma, unsigned long *vm_flags,
+		    int advice)
+{
+	switch (advice) {
+	case MADV_PTSHARE:
+		if (!vma->vm_file || !(*vm_flags & VM_SHARED) ||
+		    !shmem_mapping(vma->vm_file->f_mapping) ||
+		    (*vm_flags & (VM_LOCKED | VM_SPECIAL | VM_HUGETLB)))
+			return -EINVAL;
+		*vm_flags |= VM_PTSHARE;
+		break;
+	case MADV_NOPTSHARE:
+		/* This stops sharing for the whole vma, not just the range */
+		if (*vm_flags & VM_PTSHARE) {
+			ptshare_unshare(vma);
+			*vm_flags &= ~VM_PTSHARE;
+		}
+		break;
+	}
+
+	return 0;
+}
@@ -18,6 +18,8 @@
 #include <linux/syscalls.h>
 #include <linux/file.h>
 
+#include <trace/events/filemap.h>
+
 #include "internal.h"
 
 /*
@@ -124,14 +126,30 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 		goto out;
 	}
 
-	for (page_idx = 0; page_idx < nr_pages; page_idx++) {
-		struct page *page = list_to_page(pages);
-		list_del(&page->lru);
-		if (!add_to_page_cache_lru(page, mapping, page->index,
-				mapping_gfp_constraint(mapping, GFP_KERNEL))) {
-			mapping->a_ops->readpage(filp, page);
+	while (nr_pages) {
+		struct page *batch[PAGEVEC_SIZE];
+		int nr = min_t(unsigned, nr_pages, PAGEVEC_SIZE);
+		int added;
+
+		for (page_idx = 0; page_idx < nr; page_idx++) {
+			batch[page_idx] = list_to_page(pages);
+			list_del(&batch[page_idx]->lru);
+		}
+		nr_pages -= nr;
+
+		for (page_idx = 0; page_idx < nr; ) {
+			added = add_to_page_cache_lru_batch(batch + page_idx,
+					nr - page_idx, mapping,
+					mapping_gfp_constraint(mapping, GFP_KERNEL));
+			if (added <= 0) {
+				page_cache_release(batch[page_idx++]);
+				continue;
+			}
+			while (added--) {
+				mapping->a_ops->readpage(filp, batch[page_idx]);
+				page_cache_release(batch[page_idx++]);
+			}
 		}
-		page_cache_release(page);
 	}
 	ret = 0;
 
@@ -196,8 +214,10 @@ int __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	 * uptodate then the caller will launch readpage again, and
 	 * will then handle the error.
 	 */
-	if (ret)
+	if (ret) {
 		read_pages(mapping, filp, &page_pool, ret);
+		__add_wb_stat(&inode_to_bdi(inode)->wb, WB_READAHEAD, ret);
+	}
 	BUG_ON(!list_empty(&page_pool));
 out:
 	return ret;
@@ -309,6 +329,65 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * it approaches max_readhead.
  */
 
+/*
+ * Is @offset where the window of a sequential stream expects its next read?
+ */
+static bool ra_stream_next(pgoff_t start, unsigned int size,
+			   unsigned int async_size, pgoff_t offset)
+{
+	return size && (offset == start + size - async_size ||
+			offset == start + size);
+}
+
+/*
+ * Remember the current window before another stream replaces it, in
+ * place of the oldest one saved.
+ */
+static void ra_save_stream(struct file_ra_state *ra)
+{
+	struct ra_stream *stream;
+
+	if (!ra->size)
+		return;
+	stream = &ra->saved[ra->next_saved];
+	stream->start = ra->start;
+	stream->size = ra->size;
+	stream->async_size = ra->async_size;
+	ra->next_saved = (ra->next_saved + 1) % RA_SAVED_STREAMS;
+}
+
+/*
+ * Interleaved sequential readers of one file, threads reading different
+ * parts of it through the same struct file for instance, each need their
+ * own window. If @offset continues one of the saved windows, swap it with
+ * the current one.
+ */
+static bool ra_switch_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	int i;
+
+	for (i = 0; i < RA_SAVED_STREAMS; i++) {
+		struct ra_stream *stream = &ra->saved[i];
+		struct ra_stream cur = {
+			.start = ra->start,
+			.size = ra->size,
+			.async_size = ra->async_size,
+		};
+
+		if (!ra_stream_next(stream->start, stream->size,
+				    stream->async_size, offset))
+			continue;
+
+		ra->start = stream->start;
+		ra->size = stream->size;
+		ra->async_size = stream->async_size;
+		*stream = cur;
+		return true;
+	}
+
+	return false;
+}
+
 /*
  * Count contiguously cached pages from @offset-1 to @offset-@max,
  * this count is a conservative estimation of
@@ -354,6 +433,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_save_stream(ra);
 	ra->start = offset;
 	ra->size = min(size + req_size, max);
 	ra->async_size = 1;
@@ -380,11 +460,13 @@ ondemand_readahead(struct address_space *mapping,
 		goto initial_readahead;
 
 	/*
-	 * It's the expected callback offset, assume sequential access.
+	 * It's the expected callback offset, assume sequential access, of
+	 * the current stream or of one seen before on this file.
 	 * Ramp up sizes, and push forward the readahead window.
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
-	     offset == (ra->start + ra->size))) {
+	     offset == (ra->start + ra->size)) ||
+	    ra_switch_stream(ra, offset)) {
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
@@ -407,6 +489,7 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_save_stream(ra);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -444,6 +527,7 @@ ondemand_readahead(struct address_space *mapping,
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
+	ra_save_stream(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
@@ -459,6 +543,8 @@ readit:
 		ra->size += ra->async_size;
 	}
 
+	trace_mm_filemap_readahead(mapping, offset, req_size, ra,
+				   hit_readahead_marker);
 	return ra_submit(ra, mapping, filp);
 }
 
@@ -491,6 +577,7 @@ void page_cache_sync_readahead(struct address_space *mapping,
 	}
 
 	/* do read-ahead */
+	__inc_wb_stat(&inode_to_bdi(mapping->host)->wb, WB_RA_SYNC);
 	ondemand_readahead(mapping, ra, filp, false, offset, req_size);
 }
 EXPORT_SYMBOL_GPL(page_cache_sync_readahead);
@@ -535,6 +622,7 @@ page_cache_async_readahead(struct address_space *mapping,
 		return;
 
 	/* do read-ahead */
+	__inc_wb_stat(&inode_to_bdi(mapping->host)->wb, WB_RA_ASYNC);
 	ondemand_readahead(mapping, ra, filp, true, offset, req_size);
 }
 EXPORT_SYMBOL_GPL(page_cache_async_readahead);
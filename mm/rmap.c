@@ -60,6 +60,8 @@
 #include <linux/hugetlb.h>
 #include <linux/backing-dev.h>
 #include <linux/page_idle.h>
+#include <linux/ptshare.h>
+#include <linux/lazyfork.h>
 
 #include <asm/tlbflush.h>
 
@@ -600,6 +602,11 @@ static void percpu_flush_tlb_batch_pages(void *data)
 	flush_tlb_local();
 }
 
+static unsigned int remote_cpus(const struct cpumask *mask, int cpu)
+{
+	return cpumask_weight(mask) - cpumask_test_cpu(cpu, mask);
+}
+
 /*
  * Flush TLB entries for recently unmapped pages from remote CPUs. It is
  * important if a PTE was dirty when it was unmapped that it's flushed
@@ -617,6 +624,11 @@ void try_to_unmap_flush(void)
 	cpu = get_cpu();
 
 	trace_tlb_flush(TLB_REMOTE_SHOOTDOWN, -1UL);
+	if (tlb_ubc->nr_ipis) {
+		trace_tlb_flush_batched(tlb_ubc->nr_ipis,
+				remote_cpus(&tlb_ubc->cpumask, cpu));
+		tlb_ubc->nr_ipis = 0;
+	}
 
 	if (cpumask_test_cpu(cpu, &tlb_ubc->cpumask))
 		percpu_flush_tlb_batch_pages(&tlb_ubc->cpumask);
@@ -647,6 +659,9 @@ static void set_tlb_ubc_flush_pending(struct mm_struct *mm,
 
 	cpumask_or(&tlb_ubc->cpumask, &tlb_ubc->cpumask, mm_cpumask(mm));
 	tlb_ubc->flush_required = true;
+	if (trace_tlb_flush_batched_enabled())
+		tlb_ubc->nr_ipis += remote_cpus(mm_cpumask(mm),
+						raw_smp_processor_id());
 
 	/*
 	 * If the PTE was dirty then it's best to assume it's writable. The
@@ -675,6 +690,17 @@ static bool should_defer_flush(struct mm_struct *mm, enum ttu_flags flags)
 
 	return should_defer;
 }
+
+/*
+ * Leave the flush of ptes changed in @mm, but still mapping the same
+ * pages, to the next try_to_unmap_flush(). Returns false if the caller
+ * has to flush them itself.
+ */
+bool defer_tlb_flush(struct mm_struct *mm)
+{
+	set_tlb_ubc_flush_pending(mm, NULL, false);
+	return true;
+}
 #else
 static void set_tlb_ubc_flush_pending(struct mm_struct *mm,
 		struct page *page, bool writable)
@@ -991,6 +1017,7 @@ static int page_mkclean_one(struct page *page, struct vm_area_struct *vma,
 
 		flush_cache_page(vma, address, pte_pfn(*pte));
 		entry = ptep_clear_flush(vma, address, pte);
+		ptshare_flush_tlb_page(vma, address, pte);
 		entry = pte_wrprotect(entry);
 		entry = pte_mkclean(entry);
 		set_pte_at(mm, address, pte, entry);
@@ -1199,6 +1226,30 @@ void page_add_new_anon_rmap(struct page *page,
 	__page_set_anon_rmap(page, vma, address, 1);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/**
+ * page_add_new_anon_rmap_index - add pte mapping to a new anonymous page
+ * @page:	the page to add the mapping to
+ * @anon_vma:	the anon_vma of the vm area the mapping is added in
+ * @index:	the linear page index of the address mapped
+ *
+ * Same as page_add_new_anon_rmap, for a speculative fault that holds no
+ * mmap_sem: vma_adjust() may be updating the vma's vm_start and vm_pgoff
+ * under it, so the index is the one computed from its validated copy.
+ */
+void page_add_new_anon_rmap_index(struct page *page,
+	struct anon_vma *anon_vma, pgoff_t index)
+{
+	VM_BUG_ON_PAGE(PageTransHuge(page), page);
+	SetPageSwapBacked(page);
+	atomic_set(&page->_mapcount, 0); /* increment count (starts at -1) */
+	__mod_zone_page_state(page_zone(page), NR_ANON_PAGES, 1);
+	anon_vma = (void *) anon_vma + PAGE_MAPPING_ANON;
+	page->mapping = (struct address_space *) anon_vma;
+	page->index = index;
+}
+#endif
+
 /**
  * page_add_file_rmap - add pte mapping to a file page
  * @page: the page to add the mapping to
@@ -1303,6 +1354,7 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	spinlock_t *ptl;
 	int ret = SWAP_AGAIN;
 	enum ttu_flags flags = (enum ttu_flags)arg;
+	bool file_rss;
 
 	/* munlock has nothing to gain from examining un-locked vmas */
 	if ((flags & TTU_MUNLOCK) && !(vma->vm_flags & VM_LOCKED))
@@ -1327,6 +1379,9 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		if (flags & TTU_MUNLOCK)
 			goto out_unmap;
 	}
+	/* Unmapping it from a table shared by fork would do so for all */
+	if (PageAnon(page) && lazyfork_pte_shared(pte))
+		goto out_unmap;
 	if (!(flags & TTU_IGNORE_ACCESS)) {
 		if (ptep_clear_flush_young_notify(vma, address, pte)) {
 			ret = SWAP_FAIL;
@@ -1350,6 +1405,8 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else {
 		pteval = ptep_clear_flush(vma, address, pte);
 	}
+	ptshare_flush_tlb_page(vma, address, pte);
+	file_rss = !ptshare_pte_unaccounted(pte);
 
 	/* Move the dirty bit to the physical page now the pte is gone. */
 	if (pte_dirty(pteval))
@@ -1364,7 +1421,7 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		} else {
 			if (PageAnon(page))
 				dec_mm_counter(mm, MM_ANONPAGES);
-			else
+			else if (file_rss)
 				dec_mm_counter(mm, MM_FILEPAGES);
 		}
 		set_pte_at(mm, address, pte,
@@ -1377,7 +1434,7 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		 */
 		if (PageAnon(page))
 			dec_mm_counter(mm, MM_ANONPAGES);
-		else
+		else if (file_rss)
 			dec_mm_counter(mm, MM_FILEPAGES);
 	} else if (IS_ENABLED(CONFIG_MIGRATION) && (flags & TTU_MIGRATION)) {
 		swp_entry_t entry;
@@ -1391,6 +1448,8 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		swp_pte = swp_entry_to_pte(entry);
 		if (pte_soft_dirty(pteval))
 			swp_pte = pte_swp_mksoft_dirty(swp_pte);
+		if (pte_uffd_wp(pteval))
+			swp_pte = pte_swp_mkuffd_wp(swp_pte);
 		set_pte_at(mm, address, pte, swp_pte);
 	} else if (PageAnon(page)) {
 		swp_entry_t entry = { .val = page_private(page) };
@@ -1416,8 +1475,10 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		swp_pte = swp_entry_to_pte(entry);
 		if (pte_soft_dirty(pteval))
 			swp_pte = pte_swp_mksoft_dirty(swp_pte);
+		if (pte_uffd_wp(pteval))
+			swp_pte = pte_swp_mkuffd_wp(swp_pte);
 		set_pte_at(mm, address, pte, swp_pte);
-	} else
+	} else if (file_rss)
 		dec_mm_counter(mm, MM_FILEPAGES);
 
 	page_remove_rmap(page);
@@ -2128,6 +2128,9 @@ static void put_cpu_partial(struct kmem_cache *s, struct page *page, int drain)
 #endif
 }
 
+static void magazine_flush_cpu(struct kmem_cache *s, struct kmem_cache_cpu *c);
+static void depot_drain(struct kmem_cache *s);
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(s, CPUSLAB_FLUSH);
@@ -2148,6 +2151,7 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
 	if (likely(c)) {
+		magazine_flush_cpu(s, c);
 		if (c->page)
 			flush_slab(s, c);
 
@@ -2167,12 +2171,14 @@ static bool has_cpu_slab(int cpu, void *info)
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	return c->page || c->partial;
+	return c->page || c->partial ||
+		(c->mag && (c->mag->rounds || c->mag_prev->rounds));
 }
 
 static void flush_all(struct kmem_cache *s)
 {
 	on_each_cpu_cond(has_cpu_slab, flush_cpu_slab, s, 1, GFP_ATOMIC);
+	depot_drain(s);
 }
 
 /*
@@ -2479,6 +2485,9 @@ static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
  *
  * Otherwise we can simply pick the next object from the lockless free list.
  */
+static void *magazine_alloc(struct kmem_cache *s);
+static bool magazine_free(struct kmem_cache *s, struct page *page, void *x);
+
 static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 		gfp_t gfpflags, int node, unsigned long addr)
 {
@@ -2490,6 +2499,12 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 	s = slab_pre_alloc_hook(s, gfpflags);
 	if (!s)
 		return NULL;
+
+	if (unlikely(s->flags & SLAB_MAGAZINE) && node == NUMA_NO_NODE) {
+		object = magazine_alloc(s);
+		if (object)
+			goto out;
+	}
 redo:
 	/*
 	 * Must read kmem_cache cpu data via this cpu ptr. Preemption is
@@ -2558,6 +2573,7 @@ redo:
 		stat(s, ALLOC_FASTPATH);
 	}
 
+out:
 	if (unlikely(gfpflags & __GFP_ZERO) && object)
 		memset(object, 0, s->object_size);
 
@@ -2761,16 +2777,13 @@ slab_empty:
  * same page) possible by specifying head and tail ptr, plus objects
  * count (cnt). Bulk free indicated by tail pointer being set.
  */
-static __always_inline void slab_free(struct kmem_cache *s, struct page *page,
-				      void *head, void *tail, int cnt,
-				      unsigned long addr)
+static __always_inline void do_slab_free(struct kmem_cache *s,
+				struct page *page, void *head, void *tail,
+				int cnt, unsigned long addr)
 {
 	void *tail_obj = tail ? : head;
 	struct kmem_cache_cpu *c;
 	unsigned long tid;
-
-	slab_free_freelist_hook(s, head, tail);
-
 redo:
 	/*
 	 * Determine the currently cpus per cpu slab.
@@ -2804,6 +2817,19 @@ redo:
 
 }
 
+static __always_inline void slab_free(struct kmem_cache *s, struct page *page,
+				      void *head, void *tail, int cnt,
+				      unsigned long addr)
+{
+	slab_free_freelist_hook(s, head, tail);
+
+	if (unlikely(s->flags & SLAB_MAGAZINE) && !tail &&
+	    magazine_free(s, page, head))
+		return;
+
+	do_slab_free(s, page, head, tail, cnt, addr);
+}
+
 void kmem_cache_free(struct kmem_cache *s, void *x)
 {
 	s = cache_from_obj(s, x);
@@ -2841,6 +2867,7 @@ int build_detached_freelist(struct kmem_cache *s, size_t size,
 	size_t first_skipped_index = 0;
 	int lookahead = 3;
 	void *object;
+	struct page *page;
 
 	/* Always re-init detached_freelist */
 	df->page = NULL;
@@ -2852,12 +2879,25 @@ int build_detached_freelist(struct kmem_cache *s, size_t size,
 	if (!object)
 		return 0;
 
-	/* Support for memcg, compiler can optimize this out */
-	df->s = cache_from_obj(s, object);
+	page = virt_to_head_page(object);
+	if (!s) {
+		/* Handle kfree_bulk(): each object tells its cache */
+		if (unlikely(!PageSlab(page))) {
+			BUG_ON(!PageCompound(page));
+			kfree_hook(object);
+			__free_kmem_pages(page, compound_order(page));
+			p[size] = NULL; /* mark object processed */
+			return size;
+		}
+		df->s = page->slab_cache;
+	} else {
+		/* Support for memcg, compiler can optimize this out */
+		df->s = cache_from_obj(s, object);
+	}
 
 	/* Start new detached freelist */
 	set_freepointer(df->s, object, NULL);
-	df->page = virt_to_head_page(object);
+	df->page = page;
 	df->tail = object;
 	df->freelist = object;
 	p[size] = NULL; /* mark object processed */
@@ -2908,6 +2948,161 @@ void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 }
 EXPORT_SYMBOL(kmem_cache_free_bulk);
 
+/*
+ * Magazine layer for SLAB_MAGAZINE caches.
+ *
+ * Every cpu has a loaded and a previous magazine of freed objects. Frees
+ * push onto the loaded magazine and allocations pop from it with interrupts
+ * disabled, without touching the slab page, so objects freed away from the
+ * cpu slab no longer take __slab_free() one at a time. When both magazines
+ * are full, one is exchanged for an empty magazine from the depot, where a
+ * cpu that runs out can pick it up. Only if the depot has no empty magazine
+ * are the objects returned to their slabs, in bulk.
+ *
+ * The magazine functions are called with interrupts disabled.
+ */
+static void magazine_flush(struct kmem_cache *s, struct slub_magazine *mag)
+{
+	size_t size = mag->rounds;
+
+	if (!size)
+		return;
+
+	stat(s, MAGAZINE_FLUSH);
+	do {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, mag->objects, &df);
+		if (unlikely(!df.page))
+			continue;
+
+		do_slab_free(df.s, df.page, df.freelist, df.tail, df.cnt,
+			     _RET_IP_);
+	} while (likely(size));
+	mag->rounds = 0;
+}
+
+/* Both magazines are empty: trade one of them for a full one */
+static bool depot_get_full(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct slub_depot *depot = &s->depot;
+	struct slub_magazine *mag = NULL;
+
+	spin_lock(&depot->lock);
+	if (!list_empty(&depot->full)) {
+		mag = list_first_entry(&depot->full, struct slub_magazine, list);
+		list_del(&mag->list);
+		list_add(&c->mag_prev->list, &depot->empty);
+		c->mag_prev = c->mag;
+		c->mag = mag;
+	}
+	spin_unlock(&depot->lock);
+
+	if (mag)
+		stat(s, MAGAZINE_DEPOT_GET);
+	return mag;
+}
+
+/* Both magazines are full: trade one of them for an empty one */
+static bool depot_put_full(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct slub_depot *depot = &s->depot;
+	struct slub_magazine *mag = NULL;
+
+	spin_lock(&depot->lock);
+	if (!list_empty(&depot->empty)) {
+		mag = list_first_entry(&depot->empty, struct slub_magazine, list);
+		list_del(&mag->list);
+		list_add(&c->mag_prev->list, &depot->full);
+		c->mag_prev = c->mag;
+		c->mag = mag;
+	}
+	spin_unlock(&depot->lock);
+
+	if (mag)
+		stat(s, MAGAZINE_DEPOT_PUT);
+	return mag;
+}
+
+static void *magazine_alloc(struct kmem_cache *s)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	void *object = NULL;
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(s->cpu_slab);
+	if (!c->mag->rounds) {
+		if (c->mag_prev->rounds)
+			swap(c->mag, c->mag_prev);
+		else if (!depot_get_full(s, c)) {
+			stat(s, MAGAZINE_ALLOC_MISS);
+			goto out;
+		}
+	}
+	object = c->mag->objects[--c->mag->rounds];
+	stat(s, MAGAZINE_ALLOC_HIT);
+out:
+	local_irq_restore(flags);
+	return object;
+}
+
+static bool magazine_free(struct kmem_cache *s, struct page *page, void *x)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	bool ret = false;
+
+	local_irq_save(flags);
+	/*
+	 * Remote node and pfmemalloc objects go straight back to their slab,
+	 * magazines only hand out memory that the fast path would.
+	 */
+	if (page_to_nid(page) != numa_mem_id() || PageSlabPfmemalloc(page))
+		goto out;
+
+	c = this_cpu_ptr(s->cpu_slab);
+	if (c->mag->rounds == SLUB_MAGAZINE_SIZE) {
+		if (c->mag_prev->rounds < SLUB_MAGAZINE_SIZE)
+			swap(c->mag, c->mag_prev);
+		else if (!depot_put_full(s, c)) {
+			magazine_flush(s, c->mag_prev);
+			swap(c->mag, c->mag_prev);
+		}
+	}
+	c->mag->objects[c->mag->rounds++] = x;
+	stat(s, MAGAZINE_FREE);
+	ret = true;
+out:
+	local_irq_restore(flags);
+	return ret;
+}
+
+static void magazine_flush_cpu(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	if (!c->mag)
+		return;
+
+	magazine_flush(s, c->mag);
+	magazine_flush(s, c->mag_prev);
+}
+
+static void depot_drain(struct kmem_cache *s)
+{
+	struct slub_depot *depot = &s->depot;
+	struct slub_magazine *mag;
+	unsigned long flags;
+
+	if (!(s->flags & SLAB_MAGAZINE))
+		return;
+
+	spin_lock_irqsave(&depot->lock, flags);
+	list_for_each_entry(mag, &depot->full, list)
+		magazine_flush(s, mag);
+	list_splice_init(&depot->full, &depot->empty);
+	spin_unlock_irqrestore(&depot->lock, flags);
+}
+
 /* Note that interrupts must be enabled when calling this function. */
 int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 			  void **p)
@@ -3104,6 +3299,50 @@ init_kmem_cache_node(struct kmem_cache_node *n)
 #endif
 }
 
+static void free_kmem_cache_magazines(struct kmem_cache *s)
+{
+	struct slub_magazine *mag, *next;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
+
+		kfree(c->mag);
+		kfree(c->mag_prev);
+		c->mag = NULL;
+		c->mag_prev = NULL;
+	}
+
+	list_for_each_entry_safe(mag, next, &s->depot.empty, list)
+		kfree(mag);
+	INIT_LIST_HEAD(&s->depot.empty);
+}
+
+static int alloc_kmem_cache_magazines(struct kmem_cache *s)
+{
+	int cpu;
+
+	spin_lock_init(&s->depot.lock);
+	INIT_LIST_HEAD(&s->depot.full);
+	INIT_LIST_HEAD(&s->depot.empty);
+
+	if (!(s->flags & SLAB_MAGAZINE))
+		return 1;
+
+	for_each_possible_cpu(cpu) {
+		struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
+
+		c->mag = kzalloc(sizeof(struct slub_magazine), GFP_KERNEL);
+		c->mag_prev = kzalloc(sizeof(struct slub_magazine), GFP_KERNEL);
+		if (!c->mag || !c->mag_prev) {
+			free_kmem_cache_magazines(s);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 static inline int alloc_kmem_cache_cpus(struct kmem_cache *s)
 {
 	BUILD_BUG_ON(PERCPU_DYNAMIC_EARLY_SIZE <
@@ -3121,6 +3360,11 @@ static inline int alloc_kmem_cache_cpus(struct kmem_cache *s)
 
 	init_kmem_cache_cpus(s);
 
+	if (!alloc_kmem_cache_magazines(s)) {
+		free_percpu(s->cpu_slab);
+		return 0;
+	}
+
 	return 1;
 }
 
@@ -3335,6 +3579,13 @@ static int kmem_cache_open(struct kmem_cache *s, unsigned long flags)
 	s->flags = kmem_cache_flags(s->size, flags, s->name, s->ctor);
 	s->reserved = 0;
 
+	/*
+	 * Magazines are kmalloc'ed and would hide objects from the debug
+	 * checks on free.
+	 */
+	if (slab_state < UP || kmem_cache_debug(s))
+		s->flags &= ~SLAB_MAGAZINE;
+
 	if (need_reserve_slab_rcu && (s->flags & SLAB_DESTROY_BY_RCU))
 		s->reserved = sizeof(struct rcu_head);
 
@@ -3474,6 +3725,7 @@ static inline int kmem_cache_close(struct kmem_cache *s)
 		if (n->nr_partial || slabs_node(s, node))
 			return 1;
 	}
+	free_kmem_cache_magazines(s);
 	free_percpu(s->cpu_slab);
 	free_kmem_cache_nodes(s);
 	return 0;
@@ -4779,6 +5031,12 @@ static ssize_t hwcache_align_show(struct kmem_cache *s, char *buf)
 }
 SLAB_ATTR_RO(hwcache_align);
 
+static ssize_t magazine_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%d\n", !!(s->flags & SLAB_MAGAZINE));
+}
+SLAB_ATTR_RO(magazine);
+
 #ifdef CONFIG_ZONE_DMA
 static ssize_t cache_dma_show(struct kmem_cache *s, char *buf)
 {
@@ -5092,6 +5350,12 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(MAGAZINE_ALLOC_HIT, magazine_alloc_hit);
+STAT_ATTR(MAGAZINE_ALLOC_MISS, magazine_alloc_miss);
+STAT_ATTR(MAGAZINE_FREE, magazine_free);
+STAT_ATTR(MAGAZINE_FLUSH, magazine_flush);
+STAT_ATTR(MAGAZINE_DEPOT_GET, magazine_depot_get);
+STAT_ATTR(MAGAZINE_DEPOT_PUT, magazine_depot_put);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -5109,6 +5373,7 @@ static struct attribute *slab_attrs[] = {
 	&aliases_attr.attr,
 	&align_attr.attr,
 	&hwcache_align_attr.attr,
+	&magazine_attr.attr,
 	&reclaim_account_attr.attr,
 	&destroy_by_rcu_attr.attr,
 	&shrink_attr.attr,
@@ -5159,6 +5424,12 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&magazine_alloc_hit_attr.attr,
+	&magazine_alloc_miss_attr.attr,
+	&magazine_free_attr.attr,
+	&magazine_flush_attr.attr,
+	&magazine_depot_get_attr.attr,
+	&magazine_depot_put_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
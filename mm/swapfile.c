@@ -38,6 +38,7 @@
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
 #include <linux/swapops.h>
+#include <linux/lazyfork.h>
 #include <linux/swap_cgroup.h>
 
 static bool swap_count_continued(struct swap_info_struct *, pgoff_t,
@@ -1120,6 +1121,11 @@ static inline int maybe_same_pte(pte_t pte, pte_t swp_pte)
 	 * pte from logical point of view.
 	 */
 	pte_t swp_pte_dirty = pte_swp_mksoft_dirty(swp_pte);
+#endif
+
+	/* the same goes for the userfaultfd write protect bit */
+	pte = pte_swp_clear_uffd_wp(pte);
+#ifdef CONFIG_MEM_SOFT_DIRTY
 	return pte_same(pte, swp_pte) || pte_same(pte, swp_pte_dirty);
 #else
 	return pte_same(pte, swp_pte);
@@ -1137,7 +1143,7 @@ static int unuse_pte(struct vm_area_struct *vma, pmd_t *pmd,
 	struct page *swapcache;
 	struct mem_cgroup *memcg;
 	spinlock_t *ptl;
-	pte_t *pte;
+	pte_t *pte, newpte;
 	int ret = 1;
 
 	swapcache = page;
@@ -1160,8 +1166,10 @@ static int unuse_pte(struct vm_area_struct *vma, pmd_t *pmd,
 	dec_mm_counter(vma->vm_mm, MM_SWAPENTS);
 	inc_mm_counter(vma->vm_mm, MM_ANONPAGES);
 	get_page(page);
-	set_pte_at(vma->vm_mm, addr, pte,
-		   pte_mkold(mk_pte(page, vma->vm_page_prot)));
+	newpte = pte_mkold(mk_pte(page, vma->vm_page_prot));
+	if (pte_swp_uffd_wp(*pte))
+		newpte = pte_mkuffd_wp(newpte);
+	set_pte_at(vma->vm_mm, addr, pte, newpte);
 	if (page == swapcache) {
 		page_add_anon_rmap(page, vma, addr);
 		mem_cgroup_commit_charge(page, memcg, true);
@@ -1235,6 +1243,9 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 		next = pmd_addr_end(addr, end);
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
+		if (lazyfork_pmd(*pmd))
+			lazyfork_unshare(vma, pmd, addr,
+					 GFP_KERNEL | __GFP_NOFAIL);
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
 		if (ret)
 			return ret;
@@ -14,6 +14,7 @@
 #include <linux/swapops.h>
 #include <linux/userfaultfd_k.h>
 #include <linux/mmu_notifier.h>
+#include <linux/lazyfork.h>
 #include <asm/tlbflush.h>
 #include "internal.h"
 
@@ -22,7 +23,8 @@ static int mcopy_atomic_pte(struct mm_struct *dst_mm,
 			    struct vm_area_struct *dst_vma,
 			    unsigned long dst_addr,
 			    unsigned long src_addr,
-			    struct page **pagep)
+			    struct page **pagep,
+			    bool wp_copy)
 {
 	struct mem_cgroup *memcg;
 	pte_t _dst_pte, *dst_pte;
@@ -69,6 +71,9 @@ static int mcopy_atomic_pte(struct mm_struct *dst_mm,
 	_dst_pte = mk_pte(page, dst_vma->vm_page_prot);
 	if (dst_vma->vm_flags & VM_WRITE)
 		_dst_pte = pte_mkwrite(pte_mkdirty(_dst_pte));
+	/* map it wrprotected so that the first write is reported too */
+	if (wp_copy)
+		_dst_pte = pte_mkuffd_wp(_dst_pte);
 
 	ret = -EEXIST;
 	dst_pte = pte_offset_map_lock(dst_mm, dst_pmd, dst_addr, &ptl);
@@ -143,7 +148,8 @@ static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 					      unsigned long dst_start,
 					      unsigned long src_start,
 					      unsigned long len,
-					      bool zeropage)
+					      bool zeropage,
+					      bool wp_copy)
 {
 	struct vm_area_struct *dst_vma;
 	ssize_t err;
@@ -200,6 +206,10 @@ retry:
 	if (dst_vma->vm_ops)
 		goto out_unlock;
 
+	/* only ranges registered for write protection can be copied so */
+	if (wp_copy && !userfaultfd_wp(dst_vma))
+		goto out_unlock;
+
 	/*
 	 * Ensure the dst_vma has a anon_vma or this page
 	 * would get a NULL anon_vma when moved in the
@@ -244,9 +254,16 @@ retry:
 		BUG_ON(pmd_none(*dst_pmd));
 		BUG_ON(pmd_trans_huge(*dst_pmd));
 
+		if (unlikely(lazyfork_pmd(*dst_pmd)) &&
+		    lazyfork_unshare(dst_vma, dst_pmd, dst_addr, GFP_KERNEL)) {
+			err = -ENOMEM;
+			break;
+		}
+
 		if (!zeropage)
 			err = mcopy_atomic_pte(dst_mm, dst_pmd, dst_vma,
-					       dst_addr, src_addr, &page);
+					       dst_addr, src_addr, &page,
+					       wp_copy);
 		else
 			err = mfill_zeropage_pte(dst_mm, dst_pmd, dst_vma,
 						 dst_addr);
@@ -296,13 +313,130 @@ out:
 }
 
 ssize_t mcopy_atomic(struct mm_struct *dst_mm, unsigned long dst_start,
-		     unsigned long src_start, unsigned long len)
+		     unsigned long src_start, unsigned long len, bool wp_copy)
 {
-	return __mcopy_atomic(dst_mm, dst_start, src_start, len, false);
+	return __mcopy_atomic(dst_mm, dst_start, src_start, len, false,
+			      wp_copy);
 }
 
 ssize_t mfill_zeropage(struct mm_struct *dst_mm, unsigned long start,
 		       unsigned long len)
 {
-	return __mcopy_atomic(dst_mm, start, 0, len, true);
+	return __mcopy_atomic(dst_mm, start, 0, len, true, false);
+}
+
+static int uffd_wp_pte_range(pmd_t *pmd, unsigned long addr,
+			     unsigned long end, struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+	struct mm_struct *mm = vma->vm_mm;
+	bool enable_wp = *(bool *)walk->private;
+	pte_t *pte, ptent;
+	spinlock_t *ptl;
+
+	/* the write protection is tracked in the ptes only */
+	split_huge_page_pmd(vma, addr, pmd);
+	if (pmd_trans_unstable(pmd))
+		return 0;
+	if (unlikely(lazyfork_pmd(*pmd)) &&
+	    lazyfork_unshare(vma, pmd, addr, GFP_KERNEL))
+		return -ENOMEM;
+
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		ptent = *pte;
+
+		if (pte_present(ptent)) {
+			if (!enable_wp && !pte_uffd_wp(ptent))
+				continue;
+			ptent = ptep_modify_prot_start(mm, addr, pte);
+			/*
+			 * Unprotecting leaves the pte read-only, the
+			 * retried write fault makes it writable again.
+			 */
+			if (enable_wp)
+				ptent = pte_mkuffd_wp(ptent);
+			else
+				ptent = pte_clear_uffd_wp(ptent);
+			ptep_modify_prot_commit(mm, addr, pte, ptent);
+		} else if (is_swap_pte(ptent)) {
+			if (enable_wp)
+				ptent = pte_swp_mkuffd_wp(ptent);
+			else
+				ptent = pte_swp_clear_uffd_wp(ptent);
+			set_pte_at(mm, addr, pte, ptent);
+		}
+	}
+	pte_unmap_unlock(pte - 1, ptl);
+	cond_resched();
+	return 0;
+}
+
+/**
+ * uffd_wp_range - set or clear the userfaultfd write protection of ptes
+ * @vma: the vma the range belongs to
+ * @start: start of the range, page aligned
+ * @len: length of the range, page aligned, within @vma
+ * @enable_wp: protect the range if true, unprotect it otherwise
+ *
+ * Called with the mmap_sem held.
+ */
+int uffd_wp_range(struct vm_area_struct *vma, unsigned long start,
+		  unsigned long len, bool enable_wp)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct mm_walk uffd_wp_walk = {
+		.pmd_entry = uffd_wp_pte_range,
+		.mm = mm,
+		.private = &enable_wp,
+	};
+	int err;
+
+	mmu_notifier_invalidate_range_start(mm, start, start + len);
+	err = walk_page_range(start, start + len, &uffd_wp_walk);
+	/* a stale writable tlb entry would bypass the protection */
+	flush_tlb_range(vma, start, start + len);
+	mmu_notifier_invalidate_range_end(mm, start, start + len);
+	return err;
+}
+
+/**
+ * mwriteprotect_range - set or clear the userfaultfd write protection
+ * @dst_mm: the mm the range belongs to
+ * @start: start of the range, page aligned
+ * @len: length of the range, page aligned
+ * @enable_wp: protect the range if true, unprotect it otherwise
+ *
+ * The range must be within a single anonymous vma registered with
+ * UFFDIO_REGISTER_MODE_WP.  Writes to protected pages are reported as
+ * UFFD_PAGEFAULT_FLAG_WP faults until the pages are unprotected.
+ * Pages not mapped yet are left alone, faulting them in is reported
+ * as a missing page fault.
+ */
+int mwriteprotect_range(struct mm_struct *dst_mm, unsigned long start,
+			unsigned long len, bool enable_wp)
+{
+	struct vm_area_struct *dst_vma;
+	int err;
+
+	BUG_ON(start & ~PAGE_MASK);
+	BUG_ON(len & ~PAGE_MASK);
+	BUG_ON(start + len <= start);
+
+	down_read(&dst_mm->mmap_sem);
+
+	err = -ENOENT;
+	dst_vma = find_vma(dst_mm, start);
+	if (!dst_vma || (dst_vma->vm_flags & VM_SHARED) || dst_vma->vm_ops)
+		goto out_unlock;
+	if (start < dst_vma->vm_start || start + len > dst_vma->vm_end)
+		goto out_unlock;
+	if (!userfaultfd_wp(dst_vma))
+		goto out_unlock;
+
+	err = uffd_wp_range(dst_vma, start, len, enable_wp);
+
+out_unlock:
+	up_read(&dst_mm->mmap_sem);
+	return err;
 }
@@ -46,6 +46,9 @@
 #include <linux/oom.h>
 #include <linux/prefetch.h>
 #include <linux/printk.h>
+#include <linux/page_idle.h>
+#include <linux/migrate.h>
+#include <linux/biased-rwsem.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -147,7 +150,8 @@ int vm_swappiness = 60;
 unsigned long vm_total_pages;
 
 static LIST_HEAD(shrinker_list);
-static DECLARE_RWSEM(shrinker_rwsem);
+/* taken for read on every slab shrink, from all nodes at once */
+static DECLARE_BIAS_RWSEM(shrinker_rwsem);
 
 #ifdef CONFIG_MEMCG
 static bool global_reclaim(struct scan_control *sc)
@@ -242,9 +246,9 @@ int register_shrinker(struct shrinker *shrinker)
 	if (!shrinker->nr_deferred)
 		return -ENOMEM;
 
-	down_write(&shrinker_rwsem);
+	bias_down_write(&shrinker_rwsem);
 	list_add_tail(&shrinker->list, &shrinker_list);
-	up_write(&shrinker_rwsem);
+	bias_up_write(&shrinker_rwsem);
 	return 0;
 }
 EXPORT_SYMBOL(register_shrinker);
@@ -254,9 +258,9 @@ EXPORT_SYMBOL(register_shrinker);
  */
 void unregister_shrinker(struct shrinker *shrinker)
 {
-	down_write(&shrinker_rwsem);
+	bias_down_write(&shrinker_rwsem);
 	list_del(&shrinker->list);
-	up_write(&shrinker_rwsem);
+	bias_up_write(&shrinker_rwsem);
 	kfree(shrinker->nr_deferred);
 }
 EXPORT_SYMBOL(unregister_shrinker);
@@ -417,7 +421,7 @@ static unsigned long shrink_slab(gfp_t gfp_mask, int nid,
 	if (nr_scanned == 0)
 		nr_scanned = SWAP_CLUSTER_MAX;
 
-	if (!down_read_trylock(&shrinker_rwsem)) {
+	if (!bias_down_read_trylock(&shrinker_rwsem)) {
 		/*
 		 * If we would return 0, our callers would understand that we
 		 * have nothing else to shrink and give up trying. By returning
@@ -444,7 +448,7 @@ static unsigned long shrink_slab(gfp_t gfp_mask, int nid,
 		freed += do_shrink_slab(&sc, shrinker, nr_scanned, nr_eligible);
 	}
 
-	up_read(&shrinker_rwsem);
+	bias_up_read(&shrinker_rwsem);
 out:
 	cond_resched();
 	return freed;
@@ -874,6 +878,93 @@ static void page_check_dirty_writeback(struct page *page,
 		mapping->a_ops->is_dirty_writeback(page, dirty, writeback);
 }
 
+#if defined(CONFIG_MIGRATION) && defined(CONFIG_NUMA)
+struct demote_control {
+	int nid;
+	unsigned int nr_demoted;
+};
+
+static struct page *alloc_demote_page(struct page *page,
+				      unsigned long private, int **result)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+	struct page *newpage;
+
+	/*
+	 * Only wake kswapd on the target: reclaiming it from here would
+	 * make the reclaim of this node wait for that of the slower one.
+	 */
+	newpage = alloc_pages_node(dc->nid,
+			(GFP_HIGHUSER_MOVABLE & ~__GFP_RECLAIM) |
+			__GFP_KSWAPD_RECLAIM | __GFP_THISNODE |
+			__GFP_NOWARN | __GFP_NOMEMALLOC, 0);
+	if (newpage)
+		dc->nr_demoted++;
+	return newpage;
+}
+
+static void free_demote_page(struct page *page, unsigned long private)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+
+	dc->nr_demoted--;
+	put_page(page);
+}
+
+/*
+ * Migrate the pages on @demote_pages to the demotion target of @zone's
+ * node. The pages that could not be are left on the list.
+ */
+static unsigned int demote_page_list(struct list_head *demote_pages,
+				     struct zone *zone)
+{
+	struct demote_control dc = {
+		.nid = next_demotion_node(zone_to_nid(zone)),
+	};
+	struct page *page;
+
+	if (list_empty(demote_pages) || dc.nid == NUMA_NO_NODE)
+		return 0;
+
+	/* migrate_pages() accounts the pages it takes off the list */
+	list_for_each_entry(page, demote_pages, lru)
+		inc_zone_page_state(page, NR_ISOLATED_ANON +
+				    page_is_file_cache(page));
+
+	migrate_pages(demote_pages, alloc_demote_page, free_demote_page,
+		      (unsigned long)&dc, MIGRATE_ASYNC, MR_DEMOTION);
+
+	list_for_each_entry(page, demote_pages, lru)
+		dec_zone_page_state(page, NR_ISOLATED_ANON +
+				    page_is_file_cache(page));
+
+	if (current_is_kswapd())
+		count_vm_events(PGDEMOTE_KSWAPD, dc.nr_demoted);
+	else
+		count_vm_events(PGDEMOTE_DIRECT, dc.nr_demoted);
+
+	return dc.nr_demoted;
+}
+
+/* Demotion is for the pressure on a node, not on a memcg */
+static bool can_demote(struct zone *zone, struct scan_control *sc)
+{
+	return global_reclaim(sc) &&
+		next_demotion_node(zone_to_nid(zone)) != NUMA_NO_NODE;
+}
+#else
+static inline unsigned int demote_page_list(struct list_head *demote_pages,
+					    struct zone *zone)
+{
+	return 0;
+}
+
+static inline bool can_demote(struct zone *zone, struct scan_control *sc)
+{
+	return false;
+}
+#endif
+
 /*
  * shrink_page_list() returns the number of reclaimed pages
  */
@@ -897,9 +988,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 	unsigned long nr_reclaimed = 0;
 	unsigned long nr_writeback = 0;
 	unsigned long nr_immediate = 0;
+	LIST_HEAD(demote_pages);
+	bool do_demote_pass = can_demote(zone, sc) && !force_reclaim;
 
 	cond_resched();
 
+retry:
 	while (!list_empty(page_list)) {
 		struct address_space *mapping;
 		struct page *page;
@@ -1040,6 +1134,17 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * Before reclaiming the page, try to move it to a slower
+		 * node. Huge pages would have to be split first: leave
+		 * them to reclaim.
+		 */
+		if (do_demote_pass && !PageTransHuge(page)) {
+			list_add(&page->lru, &demote_pages);
+			unlock_page(page);
+			continue;
+		}
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
@@ -1216,6 +1321,14 @@ keep:
 		VM_BUG_ON_PAGE(PageLRU(page) || PageUnevictable(page), page);
 	}
 
+	/* Reclaim the pages that could not be demoted */
+	nr_reclaimed += demote_page_list(&demote_pages, zone);
+	if (!list_empty(&demote_pages)) {
+		list_splice_init(&demote_pages, page_list);
+		do_demote_pass = false;
+		goto retry;
+	}
+
 	mem_cgroup_uncharge_list(&free_pages);
 	try_to_unmap_flush();
 	free_hot_cold_page_list(&free_pages, true);
@@ -1333,6 +1446,46 @@ int __isolate_lru_page(struct page *page, isolate_mode_t mode)
 	return ret;
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * With the multi-gen LRU, the inactive list of a type is its oldest
+ * generation. Returns that list, or NULL if @lru is managed as usual.
+ */
+static struct list_head *lru_gen_isolate_list(struct lruvec *lruvec,
+					      enum lru_list lru)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int type = is_file_lru(lru);
+
+	if (!lru_gen_enabled() || is_active_lru(lru))
+		return NULL;
+
+	return &lrugen->lists[lru_gen_from_seq(lrugen->min_seq[type])][type];
+}
+
+static void lru_gen_isolate_page(struct page *page, struct lruvec *lruvec,
+				 int nr_pages)
+{
+	int gen = page_lru_gen(page);
+
+	VM_BUG_ON_PAGE(gen < 0, page);
+
+	lruvec->lrugen.nr_pages[gen][page_is_file_cache(page)] -= nr_pages;
+	set_mask_bits(&page->flags, LRU_GEN_MASK, 0);
+}
+#else
+static inline struct list_head *lru_gen_isolate_list(struct lruvec *lruvec,
+						     enum lru_list lru)
+{
+	return NULL;
+}
+
+static inline void lru_gen_isolate_page(struct page *page,
+					struct lruvec *lruvec, int nr_pages)
+{
+}
+#endif
+
 /*
  * zone->lru_lock is heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
@@ -1358,10 +1511,14 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		unsigned long *nr_scanned, struct scan_control *sc,
 		isolate_mode_t mode, enum lru_list lru)
 {
-	struct list_head *src = &lruvec->lists[lru];
+	struct list_head *src = lru_gen_isolate_list(lruvec, lru);
+	bool lru_gen = src;
 	unsigned long nr_taken = 0;
 	unsigned long scan;
 
+	if (!lru_gen)
+		src = &lruvec->lists[lru];
+
 	for (scan = 0; scan < nr_to_scan && nr_taken < nr_to_scan &&
 					!list_empty(src); scan++) {
 		struct page *page;
@@ -1376,6 +1533,8 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		case 0:
 			nr_pages = hpage_nr_pages(page);
 			mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
+			if (lru_gen)
+				lru_gen_isolate_page(page, lruvec, nr_pages);
 			list_move(&page->lru, dst);
 			nr_taken += nr_pages;
 			break;
@@ -1435,9 +1594,14 @@ int isolate_lru_page(struct page *page)
 		lruvec = mem_cgroup_page_lruvec(page, zone);
 		if (PageLRU(page)) {
 			int lru = page_lru(page);
+			bool active = lru_gen_page_active(page, lruvec);
+
 			get_page(page);
 			ClearPageLRU(page);
 			del_page_from_lru_list(page, lruvec, lru);
+			/* Keep the page young once it is put back */
+			if (active)
+				SetPageActive(page);
 			ret = 0;
 		}
 		spin_unlock_irq(&zone->lru_lock);
@@ -2176,6 +2340,505 @@ static inline void init_tlb_ubc(void)
 }
 #endif /* CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH */
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-gen LRU. See the comment above struct lru_gen for an overview.
+ *
+ * Instead of moving pages from the active to the inactive list one at a
+ * time after checking their references through the rmap, the aging opens a
+ * new generation and walks the page tables of the processes using the
+ * lruvec, promoting whatever was accessed since the previous walk. The
+ * eviction then reclaims from the oldest generation through the same path
+ * as shrink_inactive_list().
+ */
+
+/* The maximum number of pages moved per lru_lock hold */
+#define MAX_LRU_BATCH		(SWAP_CLUSTER_MAX * 64)
+
+DEFINE_STATIC_KEY_FALSE(lru_gen_key);
+
+static bool lru_gen_boot_enabled __initdata = IS_ENABLED(CONFIG_LRU_GEN_ENABLED);
+
+static int __init early_lru_gen_param(char *buf)
+{
+	return strtobool(buf, &lru_gen_boot_enabled);
+}
+early_param("lru_gen", early_lru_gen_param);
+
+static int __init lru_gen_init(void)
+{
+	if (lru_gen_boot_enabled)
+		static_branch_enable(&lru_gen_key);
+	return 0;
+}
+core_initcall(lru_gen_init);
+
+int lru_gen_sysctl_handler(struct ctl_table *table, int write,
+			   void __user *buffer, size_t *length, loff_t *ppos)
+{
+	static DEFINE_MUTEX(lru_gen_sysctl_mutex);
+	struct ctl_table t;
+	int err, state;
+
+	mutex_lock(&lru_gen_sysctl_mutex);
+	state = lru_gen_enabled();
+	t = *table;
+	t.data = &state;
+	err = proc_dointvec_minmax(&t, write, buffer, length, ppos);
+	if (!err && write && state != lru_gen_enabled()) {
+		/*
+		 * Pages are moved between the two LRU modes lazily, the next
+		 * time their lruvec is reclaimed.
+		 */
+		if (state)
+			static_branch_enable(&lru_gen_key);
+		else
+			static_branch_disable(&lru_gen_key);
+	}
+	mutex_unlock(&lru_gen_sysctl_mutex);
+
+	return err;
+}
+
+/*
+ * Every mm_struct with user page tables is on lru_gen_mm_list, so that the
+ * aging can find the page tables mapping the pages of a given lruvec.
+ */
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_del(&mm->lru_gen_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+static unsigned long lru_gen_size(struct lruvec *lruvec, int type)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	unsigned long size = 0;
+	int gen;
+
+	for (gen = 0; gen < MAX_NR_GENS; gen++)
+		size += lrugen->nr_pages[gen][type];
+
+	return size;
+}
+
+/*
+ * Retires the oldest generation of @type. Pages still on it are carried
+ * over into the next generation, up to MAX_LRU_BATCH of them per call.
+ * Returns true once the oldest generation is gone, false if the caller
+ * needs to drop the lru_lock and try again.
+ */
+static bool lru_gen_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int old_gen = lru_gen_from_seq(lrugen->min_seq[type]);
+	int new_gen = lru_gen_from_seq(lrugen->min_seq[type] + 1);
+	struct list_head *head = &lrugen->lists[old_gen][type];
+	unsigned long remaining = MAX_LRU_BATCH;
+	enum lru_list lru = type * LRU_FILE;
+	long nr_pages;
+
+	VM_BUG_ON(lrugen->max_seq - lrugen->min_seq[type] + 1 <= MIN_NR_GENS);
+
+	while (!list_empty(head)) {
+		struct page *page = list_first_entry(head, struct page, lru);
+
+		if (!remaining--)
+			return false;
+
+		nr_pages = hpage_nr_pages(page);
+		lru_gen_update_size(lruvec, old_gen, type, -nr_pages);
+		lru_gen_update_size(lruvec, new_gen, type, nr_pages);
+		set_mask_bits(&page->flags, LRU_GEN_MASK,
+			      (new_gen + 1UL) << LRU_GEN_PGOFF);
+		/* Older pages go towards the tail */
+		list_move_tail(&page->lru, &lrugen->lists[new_gen][type]);
+	}
+
+	/* The next generation becomes the oldest, i.e. the inactive list */
+	nr_pages = lrugen->nr_pages[new_gen][type];
+	mem_cgroup_update_lru_size(lruvec, lru + LRU_ACTIVE, -nr_pages);
+	mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
+	__mod_zone_page_state(zone, NR_LRU_BASE + lru + LRU_ACTIVE, -nr_pages);
+	__mod_zone_page_state(zone, NR_LRU_BASE + lru, nr_pages);
+	lrugen->min_seq[type]++;
+
+	return true;
+}
+
+/* Opens a new, empty, youngest generation */
+static void lru_gen_inc_max_seq(struct lruvec *lruvec)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int type;
+
+	spin_lock_irq(&zone->lru_lock);
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		/*
+		 * Make room for the new generation. This only carries pages
+		 * over when a type is not evicted at all, e.g. anon without
+		 * swap.
+		 */
+		while (lrugen->max_seq - lrugen->min_seq[type] + 1 >=
+		       MAX_NR_GENS) {
+			if (lru_gen_inc_min_seq(lruvec, type))
+				continue;
+
+			spin_unlock_irq(&zone->lru_lock);
+			cond_resched();
+			spin_lock_irq(&zone->lru_lock);
+		}
+	}
+
+	lrugen->timestamps[lru_gen_from_seq(lrugen->max_seq + 1)] = jiffies;
+	lrugen->max_seq++;
+	spin_unlock_irq(&zone->lru_lock);
+}
+
+static void lru_gen_mark_young(struct page *page)
+{
+	clear_page_idle(page);
+	activate_page(page);
+}
+
+static int lru_gen_walk_pmd_range(pmd_t *pmd, unsigned long addr,
+				  unsigned long end, struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *pte, *orig_pte;
+	spinlock_t *ptl;
+	struct page *page;
+
+	if (pmd_trans_huge_lock(pmd, vma, &ptl) == 1) {
+		if (pmdp_test_and_clear_young(vma, addr, pmd))
+			lru_gen_mark_young(pmd_page(*pmd));
+		spin_unlock(ptl);
+		return 0;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	/*
+	 * The accessed bits are cleared without flushing the TLB, like
+	 * page_referenced() does on x86: an access that hits a stale TLB
+	 * entry is only missed until the entry is evicted.
+	 */
+	orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page)
+			continue;
+
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			lru_gen_mark_young(page);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+	return 0;
+}
+
+static int lru_gen_walk_test(unsigned long start, unsigned long end,
+			     struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+
+	/* Nothing to age, or the access pattern was already hinted at */
+	if (vma->vm_flags & (VM_LOCKED | VM_SPECIAL | VM_HUGETLB |
+			     VM_SEQ_READ | VM_RAND_READ))
+		return 1;
+	return 0;
+}
+
+/*
+ * Walks the page tables of the processes in @memcg, or of all processes if
+ * @memcg is NULL, and promotes the pages found accessed to the youngest
+ * generation of their lruvecs.
+ */
+static void lru_gen_walk_mms(struct mem_cgroup *memcg)
+{
+	struct mm_struct *mm, *prev_mm = NULL;
+	struct list_head *p;
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_walk_pmd_range,
+		.test_walk = lru_gen_walk_test,
+	};
+
+	spin_lock(&lru_gen_mm_lock);
+	p = lru_gen_mm_list.next;
+	while (p != &lru_gen_mm_list) {
+		mm = list_entry(p, struct mm_struct, lru_gen_list);
+		if (!atomic_inc_not_zero(&mm->mm_users)) {
+			p = p->next;
+			continue;
+		}
+		spin_unlock(&lru_gen_mm_lock);
+
+		if (prev_mm)
+			mmput(prev_mm);
+		prev_mm = mm;
+
+		if ((!memcg || mm_match_cgroup(mm, memcg)) &&
+		    down_read_trylock(&mm->mmap_sem)) {
+			walk.mm = mm;
+			if (mm->highest_vm_end)
+				walk_page_range(0, mm->highest_vm_end, &walk);
+			up_read(&mm->mmap_sem);
+		}
+		cond_resched();
+
+		/* Our reference keeps mm on the list */
+		spin_lock(&lru_gen_mm_lock);
+		p = mm->lru_gen_list.next;
+	}
+	spin_unlock(&lru_gen_mm_lock);
+
+	if (prev_mm)
+		mmput(prev_mm);
+}
+
+static void lru_gen_age(struct lruvec *lruvec, struct scan_control *sc)
+{
+	lru_gen_inc_max_seq(lruvec);
+
+	/*
+	 * Direct reclaim does not walk page tables to keep allocation
+	 * latency in check: referenced pages are still found and promoted
+	 * by page_check_references() when they come up for eviction.
+	 */
+	if (current_is_kswapd())
+		lru_gen_walk_mms(NULL);
+	else if (!global_reclaim(sc))
+		lru_gen_walk_mms(lruvec_memcg(lruvec));
+	else
+		return;
+
+	/* Flush the promotions batched on this CPU */
+	lru_add_drain();
+}
+
+/*
+ * Makes sure the oldest generation of @type has pages, retiring empty
+ * generations and running the aging when only MIN_NR_GENS are left.
+ * Returns false if there is nothing of @type to evict right now.
+ */
+static bool lru_gen_prepare_eviction(struct lruvec *lruvec, int type,
+				     struct scan_control *sc)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	bool aged = false;
+	bool ret = true;
+
+	spin_lock_irq(&zone->lru_lock);
+	while (list_empty(&lrugen->lists[lru_gen_from_seq(lrugen->min_seq[type])][type])) {
+		if (lrugen->max_seq - lrugen->min_seq[type] + 1 > MIN_NR_GENS) {
+			/* The oldest generation is empty, retiring is cheap */
+			lru_gen_inc_min_seq(lruvec, type);
+			continue;
+		}
+
+		if (aged || !lru_gen_size(lruvec, type)) {
+			ret = false;
+			break;
+		}
+
+		spin_unlock_irq(&zone->lru_lock);
+		lru_gen_age(lruvec, sc);
+		aged = true;
+		spin_lock_irq(&zone->lru_lock);
+	}
+	spin_unlock_irq(&zone->lru_lock);
+
+	return ret;
+}
+
+/*
+ * Moves the pages left on the two-list LRU over to the multi-gen LRU after
+ * it has been turned on, and lru_gen_drain() moves them back after it has
+ * been turned off. In both cases the oldest pages move first, so that the
+ * LRU order is preserved.
+ */
+static void lru_gen_fill(struct lruvec *lruvec)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	enum lru_list lru;
+
+	for_each_evictable_lru(lru) {
+		struct list_head *head = &lruvec->lists[lru];
+		unsigned long batch = 0;
+
+		if (list_empty(head))
+			continue;
+
+		spin_lock_irq(&zone->lru_lock);
+		while (lru_gen_enabled() && !list_empty(head)) {
+			struct page *page = lru_to_page(head);
+
+			del_page_from_lru_list(page, lruvec, lru);
+			add_page_to_lru_list(page, lruvec, lru);
+
+			if (++batch % MAX_LRU_BATCH == 0) {
+				spin_unlock_irq(&zone->lru_lock);
+				cond_resched();
+				spin_lock_irq(&zone->lru_lock);
+			}
+		}
+		spin_unlock_irq(&zone->lru_lock);
+	}
+}
+
+static void lru_gen_drain(struct lruvec *lruvec)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	unsigned long batch = 0;
+	unsigned long seq;
+	int type;
+
+	if (!lru_gen_size(lruvec, LRU_GEN_ANON) &&
+	    !lru_gen_size(lruvec, LRU_GEN_FILE))
+		return;
+
+	spin_lock_irq(&zone->lru_lock);
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		for (seq = lrugen->min_seq[type]; seq <= lrugen->max_seq; seq++) {
+			struct list_head *head;
+
+			head = &lrugen->lists[lru_gen_from_seq(seq)][type];
+			while (!lru_gen_enabled() && !list_empty(head)) {
+				struct page *page = lru_to_page(head);
+				bool active = lru_gen_page_active(page, lruvec);
+
+				del_page_from_lru_list(page, lruvec,
+						       page_lru(page));
+				if (active)
+					SetPageActive(page);
+				add_page_to_lru_list(page, lruvec,
+						     page_lru(page));
+
+				if (++batch % MAX_LRU_BATCH == 0) {
+					spin_unlock_irq(&zone->lru_lock);
+					cond_resched();
+					spin_lock_irq(&zone->lru_lock);
+				}
+			}
+		}
+	}
+	spin_unlock_irq(&zone->lru_lock);
+}
+
+/*
+ * The multi-gen LRU counterpart of get_scan_count(): scan each type in
+ * proportion to its size and to swappiness.
+ */
+static void lru_gen_get_scan_count(struct lruvec *lruvec, int swappiness,
+				   struct scan_control *sc, unsigned long *nr,
+				   unsigned long *lru_pages)
+{
+	bool may_swap = sc->may_swap && swappiness &&
+			get_nr_swap_pages() > 0;
+	int type;
+
+	*lru_pages = 0;
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		unsigned long size = lru_gen_size(lruvec, type);
+		unsigned long scan;
+
+		if (type == LRU_GEN_ANON && !may_swap) {
+			nr[type] = 0;
+			continue;
+		}
+
+		scan = size >> sc->priority;
+		if (!scan && !sc->priority)
+			scan = size;
+		if (may_swap)
+			scan = div64_u64(scan * (type == LRU_GEN_FILE ?
+						 200 - swappiness : swappiness),
+					 100);
+
+		*lru_pages += size;
+		nr[type] = scan;
+	}
+}
+
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec, int swappiness,
+				  struct scan_control *sc,
+				  unsigned long *lru_pages)
+{
+	unsigned long nr[ANON_AND_FILE];
+	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	unsigned long nr_reclaimed = 0;
+	struct blk_plug plug;
+	bool may_abort;
+	int type;
+
+	lru_gen_fill(lruvec);
+	lru_gen_get_scan_count(lruvec, swappiness, sc, nr, lru_pages);
+
+	/* See the comment about scan_adjusted in shrink_lruvec() */
+	may_abort = !(global_reclaim(sc) && !current_is_kswapd() &&
+		      sc->priority == DEF_PRIORITY);
+
+	init_tlb_ubc();
+
+	blk_start_plug(&plug);
+	while (nr[LRU_GEN_ANON] || nr[LRU_GEN_FILE]) {
+		for (type = 0; type < ANON_AND_FILE; type++) {
+			unsigned long nr_to_scan;
+
+			if (!nr[type])
+				continue;
+
+			if (!lru_gen_prepare_eviction(lruvec, type, sc)) {
+				nr[type] = 0;
+				continue;
+			}
+
+			nr_to_scan = min(nr[type], SWAP_CLUSTER_MAX);
+			nr[type] -= nr_to_scan;
+			nr_reclaimed += shrink_inactive_list(nr_to_scan, lruvec,
+							     sc, type * LRU_FILE);
+		}
+
+		if (nr_reclaimed >= nr_to_reclaim && may_abort)
+			break;
+	}
+	blk_finish_plug(&plug);
+	sc->nr_reclaimed += nr_reclaimed;
+
+	throttle_vm_writeout(sc->gfp_mask);
+}
+#else
+static inline void lru_gen_drain(struct lruvec *lruvec)
+{
+}
+
+static inline void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+					 int swappiness,
+					 struct scan_control *sc,
+					 unsigned long *lru_pages)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
@@ -2191,6 +2854,14 @@ static void shrink_lruvec(struct lruvec *lruvec, int swappiness,
 	struct blk_plug plug;
 	bool scan_adjusted;
 
+	if (lru_gen_enabled()) {
+		lru_gen_shrink_lruvec(lruvec, swappiness, sc, lru_pages);
+		return;
+	}
+
+	/* Take back what the multi-gen LRU left behind */
+	lru_gen_drain(lruvec);
+
 	get_scan_count(lruvec, swappiness, sc, nr, lru_pages);
 
 	/* Record the original scan target for proportional adjustments later */
@@ -2941,7 +3612,8 @@ static void age_active_anon(struct zone *zone, struct scan_control *sc)
 {
 	struct mem_cgroup *memcg;
 
-	if (!total_swap_pages)
+	/* The multi-gen LRU ages anon pages as part of the eviction */
+	if (!total_swap_pages || lru_gen_enabled())
 		return;
 
 	memcg = mem_cgroup_iter(NULL, NULL, NULL);
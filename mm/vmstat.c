@@ -21,6 +21,7 @@
 #include <linux/seq_file.h>
 #include <linux/debugfs.h>
 #include <linux/sched.h>
+#include <linux/sched/isolation.h>
 #include <linux/math64.h>
 #include <linux/writeback.h>
 #include <linux/compaction.h>
@@ -778,6 +779,10 @@ const char * const vmstat_text[] = {
 	"pgfree",
 	"pgactivate",
 	"pgdeactivate",
+	"pcp_highorder_alloc",
+	"pcp_highorder_refill",
+	"pcp_highorder_free",
+	"pcp_highorder_drain",
 
 	"pgfault",
 	"pgmajfault",
@@ -791,6 +796,8 @@ const char * const vmstat_text[] = {
 
 #ifdef CONFIG_NUMA
 	"zone_reclaim_failed",
+	"pgdemote_kswapd",
+	"pgdemote_direct",
 #endif
 	"pginodesteal",
 	"slabs_scanned",
@@ -811,6 +818,7 @@ const char * const vmstat_text[] = {
 	"numa_hint_faults",
 	"numa_hint_faults_local",
 	"numa_pages_migrated",
+	"pgpromote_success",
 #endif
 #ifdef CONFIG_MIGRATION
 	"pgmigrate_success",
@@ -846,6 +854,20 @@ const char * const vmstat_text[] = {
 	"thp_zero_page_alloc",
 	"thp_zero_page_alloc_failed",
 #endif
+#ifdef CONFIG_HUGEPAGE_PREZERO
+	"prezero_thp_refill",
+	"prezero_thp_alloc",
+	"prezero_hugetlb_zeroed",
+	"prezero_hugetlb_alloc",
+#endif
+#ifdef CONFIG_PAGE_COPY_OFFLOAD
+	"copy_offload_pages",
+	"copy_offload_fallback",
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+	"speculative_pgfault_fallback",
+#endif
 #ifdef CONFIG_MEMORY_BALLOON
 	"balloon_inflate",
 	"balloon_deflate",
@@ -1456,9 +1478,15 @@ static void vmstat_shepherd(struct work_struct *w)
 	int cpu;
 
 	get_online_cpus();
-	/* Check processors whose vmstat worker threads have been disabled */
+	/*
+	 * Check processors whose vmstat worker threads have been disabled.
+	 * Isolated cpus are left alone: their differentials get folded as
+	 * they overflow the threshold, which bounds the drift the way the
+	 * update interval does elsewhere.
+	 */
 	for_each_cpu(cpu, cpu_stat_off)
-		if (need_update(cpu) &&
+		if (housekeeping_test_cpu(cpu, HK_FLAG_MISC) &&
+		    need_update(cpu) &&
 			cpumask_test_and_clear_cpu(cpu, cpu_stat_off))
 
 			queue_delayed_work_on(cpu, vmstat_wq,
@@ -1428,9 +1428,12 @@ static struct ceph_auth_handshake *get_connect_authorizer(struct ceph_connection
  */
 static void prepare_write_banner(struct ceph_connection *con)
 {
+	con->my_addr = con->msgr->my_enc_addr;
+	con->my_addr.nonce = cpu_to_le32(le32_to_cpu(con->my_addr.nonce) +
+					 con->nonce_offset);
+
 	con_out_kvec_add(con, strlen(CEPH_BANNER), CEPH_BANNER);
-	con_out_kvec_add(con, sizeof (con->msgr->my_enc_addr),
-					&con->msgr->my_enc_addr);
+	con_out_kvec_add(con, sizeof (con->my_addr), &con->my_addr);
 
 	con->out_more = 0;
 	con_flag_set(con, CON_FLAG_WRITE_PENDING);
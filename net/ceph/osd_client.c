@@ -1012,9 +1012,56 @@ static void osd_reset(struct ceph_connection *con)
 /*
  * Track open sessions with osds.
  */
+static inline struct ceph_connection *osd_con(struct ceph_osd *osd, int i)
+{
+	return i ? &osd->o_extra_cons[i - 1].oc_con : &osd->o_con;
+}
+
+static struct ceph_auth_handshake *osd_con_auth(struct ceph_osd *osd,
+						struct ceph_connection *con)
+{
+	if (con == &osd->o_con)
+		return &osd->o_auth;
+	return &container_of(con, struct ceph_osd_con, oc_con)->oc_auth;
+}
+
+static void osd_open_cons(struct ceph_osd *osd, struct ceph_entity_addr *addr)
+{
+	int i;
+
+	for (i = 0; i < osd->o_nr_cons; i++)
+		ceph_con_open(osd_con(osd, i), CEPH_ENTITY_TYPE_OSD,
+			      osd->o_osd, addr);
+}
+
+static void osd_close_cons(struct ceph_osd *osd)
+{
+	int i;
+
+	for (i = 0; i < osd->o_nr_cons; i++)
+		ceph_con_close(osd_con(osd, i));
+}
+
+/*
+ * Pick the connection a request goes out on.  The raw pg seed is the
+ * hash of the object name, so all requests to one object stay on one
+ * connection and in order; the lingering ones, whose watches are tied
+ * to the session, use the first.
+ */
+static struct ceph_connection *osd_req_con(struct ceph_osd_request *req)
+{
+	struct ceph_osd *osd = req->r_osd;
+
+	if (osd->o_nr_cons == 1 || req->r_linger)
+		return &osd->o_con;
+	return osd_con(osd, req->r_pgid.seed % osd->o_nr_cons);
+}
+
 static struct ceph_osd *create_osd(struct ceph_osd_client *osdc, int onum)
 {
+	int nr_cons = osdc->client->options->osd_conns;
 	struct ceph_osd *osd;
+	int i;
 
 	osd = kzalloc(sizeof(*osd), GFP_NOFS);
 	if (!osd)
@@ -1030,6 +1077,26 @@ static struct ceph_osd *create_osd(struct ceph_osd_client *osdc, int onum)
 	osd->o_incarnation = 1;
 
 	ceph_con_init(&osd->o_con, osd, &osd_con_ops, &osdc->client->msgr);
+	osd->o_nr_cons = 1;
+
+	/*
+	 * The extra connections present the messenger's address with a
+	 * nonce of their own, or the OSD would take each for a reconnect
+	 * of the previous one.  Without them, we make do with the first.
+	 */
+	if (nr_cons > 1) {
+		osd->o_extra_cons = kcalloc(nr_cons - 1,
+					    sizeof(*osd->o_extra_cons),
+					    GFP_NOFS);
+		if (osd->o_extra_cons)
+			osd->o_nr_cons = nr_cons;
+	}
+	for (i = 1; i < osd->o_nr_cons; i++) {
+		struct ceph_connection *con = osd_con(osd, i);
+
+		ceph_con_init(con, osd, &osd_con_ops, &osdc->client->msgr);
+		con->nonce_offset = i;
+	}
 
 	INIT_LIST_HEAD(&osd->o_keepalive_item);
 	return osd;
@@ -1053,9 +1120,17 @@ static void put_osd(struct ceph_osd *osd)
 	     atomic_read(&osd->o_ref) - 1);
 	if (atomic_dec_and_test(&osd->o_ref)) {
 		struct ceph_auth_client *ac = osd->o_osdc->client->monc.auth;
+		int i;
 
-		if (osd->o_auth.authorizer)
-			ceph_auth_destroy_authorizer(ac, osd->o_auth.authorizer);
+		for (i = 0; i < osd->o_nr_cons; i++) {
+			struct ceph_auth_handshake *auth =
+				osd_con_auth(osd, osd_con(osd, i));
+
+			if (auth->authorizer)
+				ceph_auth_destroy_authorizer(ac,
+							     auth->authorizer);
+		}
+		kfree(osd->o_extra_cons);
 		kfree(osd);
 	}
 }
@@ -1079,7 +1154,7 @@ static void remove_osd(struct ceph_osd_client *osdc, struct ceph_osd *osd)
 	dout("%s %p osd%d\n", __func__, osd, osd->o_osd);
 
 	if (!RB_EMPTY_NODE(&osd->o_node)) {
-		ceph_con_close(&osd->o_con);
+		osd_close_cons(osd);
 		__remove_osd(osdc, osd);
 		put_osd(osd);
 	}
@@ -1166,8 +1241,8 @@ static int __reset_osd(struct ceph_osd_client *osdc, struct ceph_osd *osd)
 		return -EAGAIN;
 	}
 
-	ceph_con_close(&osd->o_con);
-	ceph_con_open(&osd->o_con, CEPH_ENTITY_TYPE_OSD, osd->o_osd, peer_addr);
+	osd_close_cons(osd);
+	osd_open_cons(osd, peer_addr);
 	osd->o_incarnation++;
 
 	return 0;
@@ -1479,9 +1554,7 @@ static int __map_request(struct ceph_osd_client *osdc,
 		dout("map_request osd %p is osd%d\n", req->r_osd, o);
 		__insert_osd(osdc, req->r_osd);
 
-		ceph_con_open(&req->r_osd->o_con,
-			      CEPH_ENTITY_TYPE_OSD, o,
-			      &osdc->osdmap->osd_addr[o]);
+		osd_open_cons(req->r_osd, &osdc->osdmap->osd_addr[o]);
 	}
 
 	__enqueue_request(req);
@@ -1521,7 +1594,7 @@ static void __send_request(struct ceph_osd_client *osdc,
 
 	req->r_sent = req->r_osd->o_incarnation;
 
-	ceph_con_send(&req->r_osd->o_con, req->r_request);
+	ceph_con_send(osd_req_con(req), req->r_request);
 }
 
 /*
@@ -1612,10 +1685,13 @@ static void handle_timeout(struct work_struct *work)
 		list_move_tail(&osd->o_keepalive_item, &slow_osds);
 	}
 	while (!list_empty(&slow_osds)) {
+		int i;
+
 		osd = list_entry(slow_osds.next, struct ceph_osd,
 				 o_keepalive_item);
 		list_del_init(&osd->o_keepalive_item);
-		ceph_con_keepalive(&osd->o_con);
+		for (i = 0; i < osd->o_nr_cons; i++)
+			ceph_con_keepalive(osd_con(osd, i));
 	}
 
 	__schedule_osd_timeout(osdc);
@@ -2934,7 +3010,7 @@ static struct ceph_auth_handshake *get_authorizer(struct ceph_connection *con,
 	struct ceph_osd *o = con->private;
 	struct ceph_osd_client *osdc = o->o_osdc;
 	struct ceph_auth_client *ac = osdc->client->monc.auth;
-	struct ceph_auth_handshake *auth = &o->o_auth;
+	struct ceph_auth_handshake *auth = osd_con_auth(o, con);
 
 	if (force_new && auth->authorizer) {
 		ceph_auth_destroy_authorizer(ac, auth->authorizer);
@@ -2963,7 +3039,8 @@ static int verify_authorizer_reply(struct ceph_connection *con, int len)
 	struct ceph_osd_client *osdc = o->o_osdc;
 	struct ceph_auth_client *ac = osdc->client->monc.auth;
 
-	return ceph_auth_verify_authorizer_reply(ac, o->o_auth.authorizer, len);
+	return ceph_auth_verify_authorizer_reply(ac,
+			osd_con_auth(o, con)->authorizer, len);
 }
 
 static int invalidate_authorizer(struct ceph_connection *con)
@@ -2979,7 +3056,7 @@ static int invalidate_authorizer(struct ceph_connection *con)
 static int osd_sign_message(struct ceph_msg *msg)
 {
 	struct ceph_osd *o = msg->con->private;
-	struct ceph_auth_handshake *auth = &o->o_auth;
+	struct ceph_auth_handshake *auth = osd_con_auth(o, msg->con);
 
 	return ceph_auth_sign_message(auth, msg);
 }
@@ -2987,7 +3064,7 @@ static int osd_sign_message(struct ceph_msg *msg)
 static int osd_check_message_signature(struct ceph_msg *msg)
 {
 	struct ceph_osd *o = msg->con->private;
-	struct ceph_auth_handshake *auth = &o->o_auth;
+	struct ceph_auth_handshake *auth = osd_con_auth(o, msg->con);
 
 	return ceph_auth_check_message_signature(auth, msg);
 }
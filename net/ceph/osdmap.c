@@ -1,6 +1,7 @@
 
 #include <linux/ceph/ceph_debug.h>
 
+#include <linux/hash.h>
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <asm/div64.h>
@@ -648,12 +649,123 @@ bad:
 	return -EINVAL;
 }
 
+/*
+ * Cache of acting sets.  Every request is mapped on its own, and most
+ * of them go to a PG some other request was just mapped to, so the
+ * result of the walk through CRUSH, the up set and the temps is kept
+ * in a small direct-mapped table.  All of its inputs are part of the
+ * osdmap, which is only ever changed with the osd_client's map_sem
+ * held for write, so the table is simply emptied then.  Mappings are
+ * done with map_sem held for read; the slots have a seqcount each, and
+ * the writers take ->lock.
+ */
+#define PG_CACHE_BITS		9
+#define PG_CACHE_SIZE		(1 << PG_CACHE_BITS)
+#define PG_CACHE_MAX_OSDS	6	/* bigger sets aren't cached */
+
+struct ceph_pg_acting_slot {
+	seqcount_t seq;
+	bool valid;
+	s8 len;
+	int primary;
+	struct ceph_pg pgid;
+	int osds[PG_CACHE_MAX_OSDS];
+};
+
+struct ceph_pg_acting_cache {
+	spinlock_t lock;
+	struct ceph_pg_acting_slot slots[PG_CACHE_SIZE];
+};
+
+static void pg_cache_init(struct ceph_osdmap *map)
+{
+	struct ceph_pg_acting_cache *cache;
+	int i;
+
+	/* we can do without it */
+	cache = ceph_kvmalloc(sizeof(*cache), GFP_NOFS);
+	if (!cache)
+		return;
+
+	spin_lock_init(&cache->lock);
+	for (i = 0; i < PG_CACHE_SIZE; i++) {
+		seqcount_init(&cache->slots[i].seq);
+		cache->slots[i].valid = false;
+	}
+	map->pg_cache = cache;
+}
+
+/* the map is about to change; caller holds map_sem for write */
+static void pg_cache_invalidate(struct ceph_osdmap *map)
+{
+	int i;
+
+	if (!map->pg_cache)
+		return;
+
+	for (i = 0; i < PG_CACHE_SIZE; i++)
+		map->pg_cache->slots[i].valid = false;
+}
+
+static struct ceph_pg_acting_slot *pg_cache_slot(struct ceph_osdmap *map,
+						 struct ceph_pg pgid)
+{
+	return &map->pg_cache->slots[hash_64(pgid.pool ^
+					     ((u64)pgid.seed << 32),
+					     PG_CACHE_BITS)];
+}
+
+static bool pg_cache_lookup(struct ceph_osdmap *map, struct ceph_pg pgid,
+			    int *osds, int *len, int *primary)
+{
+	struct ceph_pg_acting_slot *slot;
+	unsigned int seq;
+	bool hit;
+
+	if (!map->pg_cache)
+		return false;
+
+	slot = pg_cache_slot(map, pgid);
+	do {
+		seq = read_seqcount_begin(&slot->seq);
+		hit = slot->valid && !pgid_cmp(slot->pgid, pgid);
+		if (hit) {
+			*len = slot->len;
+			*primary = slot->primary;
+			memcpy(osds, slot->osds, *len * sizeof(*osds));
+		}
+	} while (read_seqcount_retry(&slot->seq, seq));
+
+	return hit;
+}
+
+static void pg_cache_store(struct ceph_osdmap *map, struct ceph_pg pgid,
+			   const int *osds, int len, int primary)
+{
+	struct ceph_pg_acting_slot *slot;
+
+	if (!map->pg_cache || len > PG_CACHE_MAX_OSDS)
+		return;
+
+	slot = pg_cache_slot(map, pgid);
+	spin_lock(&map->pg_cache->lock);
+	write_seqcount_begin(&slot->seq);
+	slot->valid = true;
+	slot->pgid = pgid;
+	slot->len = len;
+	slot->primary = primary;
+	memcpy(slot->osds, osds, len * sizeof(*osds));
+	write_seqcount_end(&slot->seq);
+	spin_unlock(&map->pg_cache->lock);
+}
+
 /*
  * osd map
  */
 void ceph_osdmap_destroy(struct ceph_osdmap *map)
 {
 	dout("osdmap_destroy %p\n", map);
+	kvfree(map->pg_cache);
 	if (map->crush)
 		crush_destroy(map->crush);
 	while (!RB_EMPTY_ROOT(&map->pg_temp)) {
@@ -1181,6 +1293,7 @@ struct ceph_osdmap *ceph_osdmap_decode(void **p, void *end)
 	map->pg_temp = RB_ROOT;
 	map->primary_temp = RB_ROOT;
 	mutex_init(&map->crush_scratch_mutex);
+	pg_cache_init(map);
 
 	ret = osdmap_decode(p, end, map);
 	if (ret) {
@@ -1234,6 +1347,9 @@ struct ceph_osdmap *osdmap_apply_incremental(void **p, void *end,
 		return ceph_osdmap_decode(p, min(*p+len, end));
 	}
 
+	/* from here on, the map changes under the cached mappings */
+	pg_cache_invalidate(map);
+
 	/* new crush? */
 	ceph_decode_32_safe(p, end, len, e_inval);
 	if (len > 0) {
@@ -1687,14 +1803,8 @@ static int apply_temps(struct ceph_osdmap *osdmap,
 	return temp_len;
 }
 
-/*
- * Calculate acting set for given pgid.
- *
- * Return acting set length, or error.  *primary is set to acting
- * primary osd id, or -1 if acting set is empty or on error.
- */
-int ceph_calc_pg_acting(struct ceph_osdmap *osdmap, struct ceph_pg pgid,
-			int *osds, int *primary)
+static int __calc_pg_acting(struct ceph_osdmap *osdmap, struct ceph_pg pgid,
+			    int *osds, int *primary)
 {
 	struct ceph_pg_pool_info *pool;
 	u32 pps;
@@ -1739,6 +1849,38 @@ int ceph_calc_pg_acting(struct ceph_osdmap *osdmap, struct ceph_pg pgid,
 	return len;
 }
 
+/*
+ * Calculate acting set for given pgid.
+ *
+ * Return acting set length, or error.  *primary is set to acting
+ * primary osd id, or -1 if acting set is empty or on error.
+ */
+int ceph_calc_pg_acting(struct ceph_osdmap *osdmap, struct ceph_pg pgid,
+			int *osds, int *primary)
+{
+	struct ceph_pg_pool_info *pool;
+	int len;
+
+	pool = __lookup_pg_pool(&osdmap->pg_pools, pgid.pool);
+	if (!pool) {
+		*primary = -1;
+		return -ENOENT;
+	}
+
+	/* raw_pg -> pg, which is all the mapping depends on */
+	pgid.seed = ceph_stable_mod(pgid.seed, pool->pg_num,
+				    pool->pg_num_mask);
+
+	if (pg_cache_lookup(osdmap, pgid, osds, &len, primary))
+		return len;
+
+	len = __calc_pg_acting(osdmap, pgid, osds, primary);
+	if (len >= 0)
+		pg_cache_store(osdmap, pgid, osds, len, *primary);
+
+	return len;
+}
+
 /*
  * Return primary osd for given pgid, or -1 if none.
  */
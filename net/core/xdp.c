@@ -0,0 +1,362 @@
+/*
+ * net/core/xdp.c	eXpress Data Path: BPF on received frames before
+ *			any sk_buff is built for them.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * A driver with an ndo_xdp op runs the program attached to it on every
+ * frame it takes off its rx ring, straight from the page the hardware
+ * wrote into.  XDP_DROP hands the buffer back to the ring, without going
+ * near the allocator; XDP_PASS goes on to build the skb as usual.
+ * XDP_TX and XDP_REDIRECT copy the frame into a fresh skb for the device
+ * it leaves on, so the rx buffer is recycled as for a drop.
+ *
+ * The same spot in the driver also feeds an xdp_capture consumer bound
+ * to the queue, an AF_PACKET ring for instance, which copies the frame
+ * out of the rx buffer without an skb ever being built for it.
+ */
+
+#include <linux/bpf.h>
+#include <linux/etherdevice.h>
+#include <linux/filter.h>
+#include <linux/netdevice.h>
+#include <linux/percpu.h>
+#include <linux/rtnetlink.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <net/net_namespace.h>
+
+/* set by bpf_redirect(), valid when the program returns XDP_REDIRECT */
+static DEFINE_PER_CPU(u32, xdp_redirect_ifindex);
+
+/**
+ * dev_change_xdp - set or clear the XDP program of a device
+ * @dev: device
+ * @prog: BPF_PROG_TYPE_XDP program, or NULL to clear
+ *
+ * On success the device owns the reference to @prog.  Called with the
+ * rtnl lock held.
+ */
+int dev_change_xdp(struct net_device *dev, struct bpf_prog *prog)
+{
+	const struct net_device_ops *ops = dev->netdev_ops;
+	struct netdev_xdp xdp;
+
+	ASSERT_RTNL();
+
+	if (!ops->ndo_xdp)
+		return -EOPNOTSUPP;
+
+	memset(&xdp, 0, sizeof(xdp));
+	xdp.command = XDP_SETUP_PROG;
+	xdp.prog = prog;
+
+	return ops->ndo_xdp(dev, &xdp);
+}
+EXPORT_SYMBOL(dev_change_xdp);
+
+static bool dev_xdp_attached(struct net_device *dev)
+{
+	struct netdev_xdp xdp;
+
+	memset(&xdp, 0, sizeof(xdp));
+	xdp.command = XDP_QUERY_PROG;
+	if (dev->netdev_ops->ndo_xdp(dev, &xdp))
+		return false;
+
+	return xdp.prog_attached;
+}
+
+/* BPF_PROG_ATTACH: a program already attached is replaced atomically */
+int xdp_attach(int ifindex, struct bpf_prog *prog)
+{
+	struct net_device *dev;
+	int ret;
+
+	rtnl_lock();
+	dev = __dev_get_by_index(current->nsproxy->net_ns, ifindex);
+	if (dev)
+		ret = dev_change_xdp(dev, prog);
+	else
+		ret = -ENODEV;
+	rtnl_unlock();
+
+	return ret;
+}
+
+int xdp_detach(int ifindex)
+{
+	struct net_device *dev;
+	int ret;
+
+	rtnl_lock();
+	dev = __dev_get_by_index(current->nsproxy->net_ns, ifindex);
+	if (!dev)
+		ret = -ENODEV;
+	else if (!dev->netdev_ops->ndo_xdp)
+		ret = -EOPNOTSUPP;
+	else if (!dev_xdp_attached(dev))
+		ret = -ENOENT;
+	else
+		ret = dev_change_xdp(dev, NULL);
+	rtnl_unlock();
+
+	return ret;
+}
+
+/**
+ * xdp_capture_attach - hand the frames of an rx queue to a consumer
+ * @dev: device
+ * @queue: rx queue of @dev
+ * @cap: the consumer
+ *
+ * Returns -EOPNOTSUPP if the driver doesn't feed consumers, the driver's
+ * error if it can't for @queue as things stand, and -EBUSY if another
+ * consumer has the queue already.  Called with the rtnl lock held.
+ */
+int xdp_capture_attach(struct net_device *dev, unsigned int queue,
+		       struct xdp_capture *cap)
+{
+	const struct net_device_ops *ops = dev->netdev_ops;
+	struct xdp_capture_table *old, *new;
+	struct netdev_xdp xdp;
+	unsigned int i;
+	int err;
+
+	ASSERT_RTNL();
+
+	if (!ops->ndo_xdp)
+		return -EOPNOTSUPP;
+
+	memset(&xdp, 0, sizeof(xdp));
+	xdp.command = XDP_SETUP_CAPTURE;
+	xdp.queue = queue;
+	err = ops->ndo_xdp(dev, &xdp);
+	if (err)
+		return err;
+
+	old = rtnl_dereference(dev->xdp_capture);
+	if (old && queue < old->nr) {
+		if (rtnl_dereference(old->queue[queue]))
+			return -EBUSY;
+		rcu_assign_pointer(old->queue[queue], cap);
+		return 0;
+	}
+
+	new = kzalloc(sizeof(*new) + (queue + 1) * sizeof(new->queue[0]),
+		      GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+
+	new->nr = queue + 1;
+	for (i = 0; old && i < old->nr; i++)
+		RCU_INIT_POINTER(new->queue[i], rtnl_dereference(old->queue[i]));
+	RCU_INIT_POINTER(new->queue[queue], cap);
+	rcu_assign_pointer(dev->xdp_capture, new);
+
+	if (old)
+		kfree_rcu(old, rcu);
+	return 0;
+}
+EXPORT_SYMBOL(xdp_capture_attach);
+
+/**
+ * xdp_capture_detach - take the consumer of an rx queue off it
+ * @dev: device
+ * @queue: rx queue of @dev
+ *
+ * The consumer may still be called until an RCU grace period has gone
+ * by.  Called with the rtnl lock held.
+ */
+void xdp_capture_detach(struct net_device *dev, unsigned int queue)
+{
+	struct xdp_capture_table *t = rtnl_dereference(dev->xdp_capture);
+	unsigned int i;
+
+	ASSERT_RTNL();
+
+	if (WARN_ON(!t || queue >= t->nr))
+		return;
+
+	RCU_INIT_POINTER(t->queue[queue], NULL);
+	for (i = 0; i < t->nr; i++)
+		if (rtnl_dereference(t->queue[i]))
+			return;
+
+	/* the last one gone, the driver may turn LRO back on */
+	RCU_INIT_POINTER(dev->xdp_capture, NULL);
+	kfree_rcu(t, rcu);
+}
+EXPORT_SYMBOL(xdp_capture_detach);
+
+/**
+ * xdp_do_xmit - send a frame out for XDP_TX or XDP_REDIRECT
+ * @xdp: the frame, still in the rx buffer
+ * @act: XDP_TX or XDP_REDIRECT
+ *
+ * The frame is copied, the caller keeps the rx buffer.  Called from the
+ * driver's rx poll, under rcu_read_lock().
+ */
+int xdp_do_xmit(struct xdp_buff *xdp, u32 act)
+{
+	struct net_device *dev = xdp->dev;
+	unsigned int len = xdp->data_end - xdp->data;
+	struct sk_buff *skb;
+
+	if (act == XDP_REDIRECT) {
+		dev = dev_get_by_index_rcu(dev_net(dev),
+					   this_cpu_read(xdp_redirect_ifindex));
+		if (unlikely(!dev))
+			return -ENODEV;
+	}
+
+	if (unlikely(!(dev->flags & IFF_UP)))
+		return -ENETDOWN;
+
+	if (unlikely(len < ETH_HLEN || len > dev->mtu + dev->hard_header_len))
+		return -EMSGSIZE;
+
+	skb = netdev_alloc_skb(dev, len);
+	if (unlikely(!skb))
+		return -ENOMEM;
+
+	memcpy(skb_put(skb, len), xdp->data, len);
+	skb_reset_mac_header(skb);
+	skb->protocol = eth_hdr(skb)->h_proto;
+	skb->dev = dev;
+
+	return net_xmit_errno(dev_queue_xmit(skb));
+}
+EXPORT_SYMBOL(xdp_do_xmit);
+
+#ifdef CONFIG_BPF_SYSCALL
+static inline struct xdp_buff *xdp_ctx_buff(u64 ctx)
+{
+	return container_of((struct xdp_md *)(long)ctx, struct xdp_buff, md);
+}
+
+static u64 bpf_xdp_load_bytes(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5)
+{
+	struct xdp_buff *xdp = xdp_ctx_buff(r1);
+	unsigned int offset = (unsigned int)r2;
+	void *to = (void *)(long)r3;
+	unsigned int len = (unsigned int)r4;
+
+	if (unlikely(offset > xdp->md.len || len > xdp->md.len - offset))
+		return -EFAULT;
+
+	memcpy(to, xdp->data + offset, len);
+	return 0;
+}
+
+static const struct bpf_func_proto bpf_xdp_load_bytes_proto = {
+	.func		= bpf_xdp_load_bytes,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_ANYTHING,
+	.arg3_type	= ARG_PTR_TO_STACK,
+	.arg4_type	= ARG_CONST_STACK_SIZE,
+};
+
+static u64 bpf_xdp_store_bytes(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5)
+{
+	struct xdp_buff *xdp = xdp_ctx_buff(r1);
+	unsigned int offset = (unsigned int)r2;
+	void *from = (void *)(long)r3;
+	unsigned int len = (unsigned int)r4;
+
+	if (unlikely(offset > xdp->md.len || len > xdp->md.len - offset))
+		return -EFAULT;
+
+	memcpy(xdp->data + offset, from, len);
+	return 0;
+}
+
+static const struct bpf_func_proto bpf_xdp_store_bytes_proto = {
+	.func		= bpf_xdp_store_bytes,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_ANYTHING,
+	.arg3_type	= ARG_PTR_TO_STACK,
+	.arg4_type	= ARG_CONST_STACK_SIZE,
+};
+
+static u64 bpf_xdp_redirect(u64 ifindex, u64 flags, u64 r3, u64 r4, u64 r5)
+{
+	if (unlikely(flags))
+		return XDP_ABORTED;
+
+	this_cpu_write(xdp_redirect_ifindex, ifindex);
+	return XDP_REDIRECT;
+}
+
+static const struct bpf_func_proto bpf_xdp_redirect_proto = {
+	.func		= bpf_xdp_redirect,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_ANYTHING,
+	.arg2_type	= ARG_ANYTHING,
+};
+
+static const struct bpf_func_proto *xdp_func_proto(enum bpf_func_id func_id)
+{
+	switch (func_id) {
+	case BPF_FUNC_map_lookup_elem:
+		return &bpf_map_lookup_elem_proto;
+	case BPF_FUNC_map_update_elem:
+		return &bpf_map_update_elem_proto;
+	case BPF_FUNC_map_delete_elem:
+		return &bpf_map_delete_elem_proto;
+	case BPF_FUNC_ktime_get_ns:
+		return &bpf_ktime_get_ns_proto;
+	case BPF_FUNC_get_prandom_u32:
+		return &bpf_get_prandom_u32_proto;
+	case BPF_FUNC_get_smp_processor_id:
+		return &bpf_get_smp_processor_id_proto;
+	case BPF_FUNC_tail_call:
+		return &bpf_tail_call_proto;
+	case BPF_FUNC_xdp_load_bytes:
+		return &bpf_xdp_load_bytes_proto;
+	case BPF_FUNC_xdp_store_bytes:
+		return &bpf_xdp_store_bytes_proto;
+	case BPF_FUNC_redirect:
+		return &bpf_xdp_redirect_proto;
+	default:
+		return NULL;
+	}
+}
+
+/* bpf+xdp programs only read 'struct xdp_md' */
+static bool xdp_is_valid_access(int off, int size, enum bpf_access_type type)
+{
+	if (off < 0 || off >= sizeof(struct xdp_md))
+		return false;
+
+	if (size != sizeof(__u32) || off % size != 0)
+		return false;
+
+	return type == BPF_READ;
+}
+
+static const struct bpf_verifier_ops xdp_ops = {
+	.get_func_proto  = xdp_func_proto,
+	.is_valid_access = xdp_is_valid_access,
+};
+
+static struct bpf_prog_type_list xdp_tl = {
+	.ops	= &xdp_ops,
+	.type	= BPF_PROG_TYPE_XDP,
+};
+
+static int __init register_xdp_prog_ops(void)
+{
+	bpf_register_prog_type(&xdp_tl);
+	return 0;
+}
+late_initcall(register_xdp_prog_ops);
+#endif /* CONFIG_BPF_SYSCALL */
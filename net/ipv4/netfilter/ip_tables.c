@@ -25,6 +25,9 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
@@ -282,6 +285,166 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+/*
+ * Runs of consecutive rules that each match one exact destination
+ * address, the way chains of services or of blocked hosts are written,
+ * get indexed by that address: a packet then only looks at the rules of
+ * the run whose address hashes like its own, in their order.  The rules
+ * it skips would all have failed ip_packet_match(), so neither verdicts
+ * nor counters change.  A rule of a run has its number in the run index,
+ * plus one, in the bits of ->comefrom above the hook mask.
+ */
+#define IPT_DST_RUN_MIN		8
+#define IPT_DST_SHIFT		8
+#define IPT_DST_MAX		((1U << (32 - IPT_DST_SHIFT)) - 1)
+
+struct ipt_dst_run {
+	unsigned int	bits;
+	unsigned int	end;		/* offset of the rule after the run */
+	u32		*bucket;	/* offset of the first rule per bucket */
+};
+
+struct ipt_dst_member {
+	unsigned int	run;
+	unsigned int	bucket;
+	unsigned int	next;		/* offset of the next rule in the bucket */
+};
+
+struct ipt_dst_index {
+	struct ipt_dst_run	*run;
+	struct ipt_dst_member	member[0];
+};
+
+static inline bool ipt_dst_indexable(const struct ipt_entry *e)
+{
+	return e->ip.dmsk.s_addr == htonl(0xFFFFFFFF) &&
+	       !(e->ip.invflags & IPT_INV_DSTIP);
+}
+
+static inline const struct ipt_dst_member *
+ipt_dst_member(const struct ipt_dst_index *index, const struct ipt_entry *e)
+{
+	return &index->member[(e->comefrom >> IPT_DST_SHIFT) - 1];
+}
+
+/* The first rule at or after @e, in its run, that @daddr could match */
+static struct ipt_entry *
+ipt_dst_skip(const struct xt_table_info *private, const void *table_base,
+	     struct ipt_entry *e, __be32 daddr)
+{
+	const struct ipt_dst_index *index = private->index;
+	const struct ipt_dst_member *m = ipt_dst_member(index, e);
+	const struct ipt_dst_run *r = &index->run[m->run];
+	unsigned int off, b;
+
+	b = hash_32((__force u32)daddr, r->bits);
+	if (b == m->bucket)
+		return e;
+
+	off = r->bucket[b];
+	while (off < (void *)e - table_base)
+		off = ipt_dst_member(index, get_entry(table_base, off))->next;
+	return get_entry(table_base, off);
+}
+
+static void ipt_dst_count(unsigned int *runs, unsigned int *members,
+			  unsigned int *buckets, unsigned int len)
+{
+	if (len < IPT_DST_RUN_MIN)
+		return;
+	++*runs;
+	*members += len;
+	*buckets += 1U << (ilog2(roundup_pow_of_two(len)) + 1);
+}
+
+/* Best effort: without the index, rules are just walked one by one */
+static void ipt_dst_index_build(struct xt_table_info *info, void *entry0)
+{
+	unsigned int runs = 0, members = 0, buckets = 0, len = 0;
+	struct ipt_dst_index *index;
+	struct ipt_entry *iter, *start = NULL;
+	struct ipt_dst_run *r;
+	u32 *bucket;
+	unsigned int i, k;
+	size_t sz;
+
+	xt_entry_foreach(iter, entry0, info->size) {
+		if (ipt_dst_indexable(iter)) {
+			len++;
+			continue;
+		}
+		ipt_dst_count(&runs, &members, &buckets, len);
+		len = 0;
+	}
+	ipt_dst_count(&runs, &members, &buckets, len);
+	if (!runs || members > IPT_DST_MAX)
+		return;
+
+	sz = sizeof(*index) + members * sizeof(index->member[0]) +
+	     runs * sizeof(*r) + buckets * sizeof(*bucket);
+	index = NULL;
+	if (sz <= (PAGE_SIZE << PAGE_ALLOC_COSTLY_ORDER))
+		index = kmalloc(sz, GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY);
+	if (!index)
+		index = vmalloc(sz);
+	if (!index)
+		return;
+
+	index->run = (void *)&index->member[members];
+	bucket = (void *)&index->run[runs];
+	r = index->run;
+	k = 0;
+	len = 0;
+	xt_entry_foreach(iter, entry0, info->size) {
+		unsigned int first;
+
+		if (ipt_dst_indexable(iter)) {
+			if (!len++)
+				start = iter;
+			continue;
+		}
+		if (len < IPT_DST_RUN_MIN) {
+			len = 0;
+			continue;
+		}
+
+		r->bits = ilog2(roundup_pow_of_two(len)) + 1;
+		r->end = (void *)iter - entry0;
+		r->bucket = bucket;
+		for (i = 0; i < 1U << r->bits; i++)
+			r->bucket[i] = r->end;
+		bucket += 1U << r->bits;
+
+		first = k;
+		for (; start != iter; start = ipt_next_entry(start), k++) {
+			index->member[k].run = r - index->run;
+			index->member[k].bucket =
+				hash_32((__force u32)start->ip.dst.s_addr,
+					r->bits);
+			index->member[k].next = (void *)start - entry0;
+			start->comefrom |= (k + 1) << IPT_DST_SHIFT;
+		}
+		/* chain each bucket in rule order, back to front */
+		for (i = k; i-- > first; ) {
+			struct ipt_dst_member *m = &index->member[i];
+			unsigned int off = m->next;
+
+			m->next = r->bucket[m->bucket];
+			r->bucket[m->bucket] = off;
+		}
+		r++;
+		len = 0;
+	}
+	/* a run left open here is unmarked: tables end with an error rule */
+	info->index = index;
+}
+
+static void ipt_free_table_info(struct xt_table_info *info)
+{
+	kvfree(info->index);
+	xt_free_table_info(info);
+}
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -356,6 +519,8 @@ ipt_do_table(struct sk_buff *skb,
 		struct xt_counters *counter;
 
 		IP_NF_ASSERT(e);
+		if (unlikely(e->comefrom >> IPT_DST_SHIFT))
+			e = ipt_dst_skip(private, table_base, e, ip->daddr);
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, acpar.fragoff)) {
  no_match:
@@ -880,6 +1045,7 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 		return ret;
 	}
 
+	ipt_dst_index_build(newinfo, entry0);
 	return ret;
 }
 
@@ -1232,7 +1398,7 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 	xt_entry_foreach(iter, oldinfo->entries, oldinfo->size)
 		cleanup_entry(iter, net);
 
-	xt_free_table_info(oldinfo);
+	ipt_free_table_info(oldinfo);
 	if (copy_to_user(counters_ptr, counters,
 			 sizeof(struct xt_counters) * num_counters) != 0) {
 		/* Silent error, can't fail, new table is already in place */
@@ -1298,7 +1464,7 @@ do_replace(struct net *net, const void __user *user, unsigned int len)
 	xt_entry_foreach(iter, loc_cpu_entry, newinfo->size)
 		cleanup_entry(iter, net);
  free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 }
 
@@ -1773,17 +1939,19 @@ translate_compat_table(struct net *net,
 				break;
 			cleanup_entry(iter1, net);
 		}
-		xt_free_table_info(newinfo);
+		ipt_free_table_info(newinfo);
 		return ret;
 	}
 
+	ipt_dst_index_build(newinfo, entry1);
+
 	*pinfo = newinfo;
 	*pentry0 = entry1;
-	xt_free_table_info(info);
+	ipt_free_table_info(info);
 	return 0;
 
 free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 out:
 	xt_entry_foreach(iter0, entry0, total_size) {
 		if (j-- == 0)
@@ -1849,7 +2017,7 @@ compat_do_replace(struct net *net, void __user *user, unsigned int len)
 	xt_entry_foreach(iter, loc_cpu_entry, newinfo->size)
 		cleanup_entry(iter, net);
  free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 }
 
@@ -2094,7 +2262,7 @@ struct xt_table *ipt_register_table(struct net *net,
 	return new_table;
 
 out_free:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 out:
 	return ERR_PTR(ret);
 }
@@ -2114,7 +2282,7 @@ void ipt_unregister_table(struct net *net, struct xt_table *table)
 		cleanup_entry(iter, net);
 	if (private->number > private->initial_entries)
 		module_put(table_owner);
-	xt_free_table_info(private);
+	ipt_free_table_info(private);
 }
 
 /* Returns 1 if the type and code is matched by the range, 0 otherwise */
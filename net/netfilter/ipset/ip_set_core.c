@@ -1538,6 +1538,15 @@ ip_set_uadd(struct sock *ctnl, struct sk_buff *skb,
 			      use_lineno);
 	} else {
 		int nla_rem;
+		u32 n = 0;
+
+		if (set->variant->reserve) {
+			nla_for_each_nested(nla, attr[IPSET_ATTR_ADT], nla_rem)
+				n++;
+			/* On failure, adding resizes step by step as usual */
+			if (n > 1)
+				set->variant->reserve(set, n);
+		}
 
 		nla_for_each_nested(nla, attr[IPSET_ATTR_ADT], nla_rem) {
 			memset(tb, 0, sizeof(tb));
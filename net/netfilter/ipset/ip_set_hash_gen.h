@@ -199,7 +199,9 @@ htable_bits(u32 hashsize)
 #undef mtype_test
 #undef mtype_uref
 #undef mtype_expire
+#undef mtype_grow
 #undef mtype_resize
+#undef mtype_reserve
 #undef mtype_head
 #undef mtype_list
 #undef mtype_gc
@@ -241,7 +243,9 @@ htable_bits(u32 hashsize)
 #define mtype_test		IPSET_TOKEN(MTYPE, _test)
 #define mtype_uref		IPSET_TOKEN(MTYPE, _uref)
 #define mtype_expire		IPSET_TOKEN(MTYPE, _expire)
+#define mtype_grow		IPSET_TOKEN(MTYPE, _grow)
 #define mtype_resize		IPSET_TOKEN(MTYPE, _resize)
+#define mtype_reserve		IPSET_TOKEN(MTYPE, _reserve)
 #define mtype_head		IPSET_TOKEN(MTYPE, _head)
 #define mtype_list		IPSET_TOKEN(MTYPE, _list)
 #define mtype_gc		IPSET_TOKEN(MTYPE, _gc)
@@ -553,12 +557,12 @@ mtype_gc(unsigned long ul_set)
 	add_timer(&h->gc);
 }
 
-/* Resize a hash: create a new hash table with doubling the hashsize
- * and inserting the elements to it. Repeat until we succeed or
- * fail due to memory pressures.
+/* Resize a hash: create a new hash table with doubling the hashsize,
+ * or with 2^hbits buckets if that's more, and inserting the elements
+ * to it. Repeat until we succeed or fail due to memory pressures.
  */
 static int
-mtype_resize(struct ip_set *set, bool retried)
+mtype_grow(struct ip_set *set, u8 hbits)
 {
 	struct htype *h = set->data;
 	struct htable *t, *orig;
@@ -583,6 +587,8 @@ mtype_resize(struct ip_set *set, bool retried)
 	orig = rcu_dereference_bh_nfnl(h->table);
 	htable_bits = orig->htable_bits;
 	rcu_read_unlock_bh();
+	if (hbits > htable_bits + 1)
+		htable_bits = hbits - 1;
 
 retry:
 	ret = 0;
@@ -698,6 +704,35 @@ cleanup:
 	goto out;
 }
 
+static int
+mtype_resize(struct ip_set *set, bool retried)
+{
+	return mtype_grow(set, 0);
+}
+
+/* Make room for n more elements with a single resize, instead of
+ * doubling again and again while a batch of them gets added.
+ */
+static int
+mtype_reserve(struct ip_set *set, u32 n)
+{
+	struct htype *h = set->data;
+	u32 want;
+	u8 hbits;
+
+	rcu_read_lock_bh();
+	hbits = rcu_dereference_bh_nfnl(h->table)->htable_bits;
+	rcu_read_unlock_bh();
+
+	want = min_t(u64, (u64)h->elements + n, h->maxelem);
+	/* Buckets are created with room for AHASH_INIT_SIZE elements */
+	if (want <= (u64)jhash_size(hbits) * AHASH_INIT_SIZE)
+		return 0;
+
+	return mtype_grow(set,
+			  htable_bits(DIV_ROUND_UP(want, AHASH_INIT_SIZE)));
+}
+
 /* Add an element to a hash and update the internal counters when succeeded,
  * otherwise report the proper error code.
  */
@@ -1218,6 +1253,7 @@ static const struct ip_set_type_variant mtype_variant = {
 	.list	= mtype_list,
 	.uref	= mtype_uref,
 	.resize	= mtype_resize,
+	.reserve = mtype_reserve,
 	.same_set = mtype_same_set,
 };
 
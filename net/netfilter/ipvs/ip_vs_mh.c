@@ -0,0 +1,429 @@
+/*
+ * IPVS:	Maglev Hashing scheduling module
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Changes:
+ *
+ */
+
+/*
+ * The mh algorithm assigns a preference list of all the lookup table
+ * slots to each destination, and fills the table in turns, each
+ * destination taking in its turn the next slot of its list that's still
+ * free, until all slots are taken.  Connections are then mapped to
+ * destinations through the slot their source address (and port) hash
+ * to, as with sh.
+ *
+ * Each destination's list is a permutation of the slots which only
+ * depends on its own address and port, so adding or removing a
+ * destination only moves around few of the slots of the others: the
+ * connections of the remaining servers mostly stay where they are, and
+ * several directors with the same destinations map them the same way.
+ *
+ * The weight of a destination sets how many slots it takes per turn,
+ * and destinations of weight 0 don't get any.
+ *
+ * See "Maglev: A Fast and Reliable Software Network Load Balancer",
+ * Eisenbud et al., NSDI 2016.
+ *
+ */
+
+#define KMSG_COMPONENT "IPVS"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/ip.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/jhash.h>
+#include <linux/gcd.h>
+#include <linux/bitmap.h>
+
+#include <net/ip_vs.h>
+
+#include <net/tcp.h>
+#include <linux/udp.h>
+#include <linux/sctp.h>
+
+
+/*
+ *      IPVS MH lookup table slot
+ */
+struct ip_vs_mh_lookup {
+	struct ip_vs_dest __rcu	*dest;	/* real server */
+};
+
+/*
+ *      for the IPVS MH lookup table, whose size must be prime
+ */
+#ifndef CONFIG_IP_VS_MH_TAB_INDEX
+#define CONFIG_IP_VS_MH_TAB_INDEX	12
+#endif
+
+static const int ip_vs_mh_primes[] = {
+	251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521, 131071
+};
+
+#define IP_VS_MH_TAB_SIZE	ip_vs_mh_primes[CONFIG_IP_VS_MH_TAB_INDEX - 8]
+
+/* Same on every director, so that they all map connections alike */
+#define IP_VS_MH_SEED1		0x4d61676cU
+#define IP_VS_MH_SEED2		0x65764c42U
+#define IP_VS_MH_SEED3		0x534c4f54U
+
+struct ip_vs_mh_state {
+	struct rcu_head			rcu_head;
+	struct ip_vs_mh_lookup		lookup[0];
+};
+
+/* A destination filling the table */
+struct ip_vs_mh_dest_setup {
+	struct ip_vs_dest	*dest;
+	unsigned int		pos;	/* next slot of its preference list */
+	unsigned int		skip;
+	unsigned int		turns;	/* slots taken per turn */
+};
+
+/* Helper function to determine if server is unavailable */
+static inline bool is_unavailable(struct ip_vs_dest *dest)
+{
+	return atomic_read(&dest->weight) <= 0 ||
+	       dest->flags & IP_VS_DEST_F_OVERLOAD;
+}
+
+static inline u32
+ip_vs_mh_addr_hash(int af, const union nf_inet_addr *addr, __be16 port,
+		   u32 seed)
+{
+	u32 hash;
+
+#ifdef CONFIG_IP_VS_IPV6
+	if (af == AF_INET6)
+		hash = jhash2((const u32 *)addr->ip6, 4, seed);
+	else
+#endif
+		hash = jhash_1word((__force u32)addr->ip, seed);
+
+	return jhash_1word((__force u32)port, hash);
+}
+
+/*
+ *	Returns the lookup table slot of a connection
+ */
+static inline unsigned int
+ip_vs_mh_hashkey(int af, const union nf_inet_addr *addr,
+		 __be16 port, unsigned int offset)
+{
+	return ip_vs_mh_addr_hash(af, addr, port, IP_VS_MH_SEED3 + offset) %
+	       IP_VS_MH_TAB_SIZE;
+}
+
+
+/*
+ *      Get ip_vs_dest associated with supplied parameters.
+ */
+static inline struct ip_vs_dest *
+ip_vs_mh_get(struct ip_vs_service *svc, struct ip_vs_mh_state *s,
+	     const union nf_inet_addr *addr, __be16 port)
+{
+	unsigned int hash = ip_vs_mh_hashkey(svc->af, addr, port, 0);
+	struct ip_vs_dest *dest = rcu_dereference(s->lookup[hash].dest);
+
+	return (!dest || is_unavailable(dest)) ? NULL : dest;
+}
+
+
+/* As ip_vs_mh_get, but with fallback if selected server is unavailable,
+ * rehashing the connection until an available server is found.
+ */
+static inline struct ip_vs_dest *
+ip_vs_mh_get_fallback(struct ip_vs_service *svc, struct ip_vs_mh_state *s,
+		      const union nf_inet_addr *addr, __be16 port)
+{
+	unsigned int offset, hash;
+	struct ip_vs_dest *dest;
+
+	/* first try the dest it's supposed to go to */
+	hash = ip_vs_mh_hashkey(svc->af, addr, port, 0);
+	dest = rcu_dereference(s->lookup[hash].dest);
+	if (!dest)
+		return NULL;
+	if (!is_unavailable(dest))
+		return dest;
+
+	IP_VS_DBG_BUF(6, "MH: selected unavailable server %s:%d, reselecting",
+		      IP_VS_DBG_ADDR(dest->af, &dest->addr), ntohs(dest->port));
+
+	for (offset = 1; offset < IP_VS_MH_TAB_SIZE; offset++) {
+		hash = ip_vs_mh_hashkey(svc->af, addr, port, offset);
+		dest = rcu_dereference(s->lookup[hash].dest);
+		if (!dest)
+			break;
+		if (!is_unavailable(dest))
+			return dest;
+		IP_VS_DBG_BUF(6, "MH: selected unavailable "
+			      "server %s:%d (offset %d), reselecting",
+			      IP_VS_DBG_ADDR(dest->af, &dest->addr),
+			      ntohs(dest->port), offset);
+	}
+
+	return NULL;
+}
+
+static void ip_vs_mh_set(struct ip_vs_mh_lookup *l, struct ip_vs_dest *dest)
+{
+	struct ip_vs_dest *old = rcu_dereference_protected(l->dest, 1);
+
+	if (old == dest)
+		return;
+	if (old)
+		ip_vs_dest_put(old);
+	if (dest)
+		ip_vs_dest_hold(dest);
+	RCU_INIT_POINTER(l->dest, dest);
+}
+
+/*
+ *      Flush all the slots of the specified table.
+ */
+static void ip_vs_mh_flush(struct ip_vs_mh_state *s)
+{
+	int i;
+
+	for (i = 0; i < IP_VS_MH_TAB_SIZE; i++)
+		ip_vs_mh_set(&s->lookup[i], NULL);
+}
+
+/*
+ *      Fill the lookup table with the destinations of the service.
+ */
+static int
+ip_vs_mh_reassign(struct ip_vs_mh_state *s, struct ip_vs_service *svc)
+{
+	const unsigned int size = IP_VS_MH_TAB_SIZE;
+	struct ip_vs_mh_dest_setup *setup, *ds;
+	unsigned long *taken;
+	struct ip_vs_dest *dest;
+	unsigned int filled, n, t, g;
+	int weight, ret = 0;
+
+	n = 0;
+	g = 0;
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		weight = atomic_read(&dest->weight);
+		if (weight <= 0)
+			continue;
+		g = g ? gcd(g, weight) : weight;
+		n++;
+	}
+	if (!n) {
+		ip_vs_mh_flush(s);
+		return 0;
+	}
+
+	setup = kcalloc(n, sizeof(*setup), GFP_KERNEL);
+	taken = kcalloc(BITS_TO_LONGS(size), sizeof(long), GFP_KERNEL);
+	if (!setup || !taken) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ds = setup;
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		weight = atomic_read(&dest->weight);
+		if (weight <= 0)
+			continue;
+		ds->dest = dest;
+		ds->pos = ip_vs_mh_addr_hash(dest->af, &dest->addr, dest->port,
+					     IP_VS_MH_SEED1) % size;
+		ds->skip = ip_vs_mh_addr_hash(dest->af, &dest->addr,
+					      dest->port, IP_VS_MH_SEED2) %
+			   (size - 1) + 1;
+		ds->turns = weight / g;
+		ds++;
+	}
+
+	filled = 0;
+	while (filled < size) {
+		for (ds = setup; ds < setup + n && filled < size; ds++) {
+			for (t = 0; t < ds->turns && filled < size; t++) {
+				/* skip < size, a prime: all slots get listed */
+				while (test_bit(ds->pos, taken))
+					ds->pos = (ds->pos + ds->skip) % size;
+				__set_bit(ds->pos, taken);
+				ip_vs_mh_set(&s->lookup[ds->pos], ds->dest);
+				filled++;
+			}
+		}
+	}
+
+	IP_VS_DBG(6, "MH: %u slots filled by %u dests\n", size, n);
+
+out:
+	kfree(taken);
+	kfree(setup);
+	return ret;
+}
+
+
+static int ip_vs_mh_init_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_state *s;
+	int ret;
+
+	/* allocate the MH table for this service */
+	s = kzalloc(sizeof(*s) + IP_VS_MH_TAB_SIZE * sizeof(s->lookup[0]),
+		    GFP_KERNEL);
+	if (s == NULL)
+		return -ENOMEM;
+
+	IP_VS_DBG(6, "MH lookup table (memory=%Zdbytes) allocated for "
+		  "current service\n",
+		  sizeof(struct ip_vs_mh_lookup) * IP_VS_MH_TAB_SIZE);
+
+	/* fill the lookup table with current dests */
+	ret = ip_vs_mh_reassign(s, svc);
+	if (ret < 0) {
+		ip_vs_mh_flush(s);
+		kfree(s);
+		return ret;
+	}
+
+	svc->sched_data = s;
+	return 0;
+}
+
+
+static void ip_vs_mh_done_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_state *s = svc->sched_data;
+
+	/* got to clean up the lookup table here */
+	ip_vs_mh_flush(s);
+
+	/* release the table itself */
+	kfree_rcu(s, rcu_head);
+	IP_VS_DBG(6, "MH lookup table (memory=%Zdbytes) released\n",
+		  sizeof(struct ip_vs_mh_lookup) * IP_VS_MH_TAB_SIZE);
+}
+
+
+static int ip_vs_mh_dest_changed(struct ip_vs_service *svc,
+				 struct ip_vs_dest *dest)
+{
+	struct ip_vs_mh_state *s = svc->sched_data;
+
+	/* refill the lookup table with the updated service */
+	return ip_vs_mh_reassign(s, svc);
+}
+
+
+/* Helper function to get port number */
+static inline __be16
+ip_vs_mh_get_port(const struct sk_buff *skb, struct ip_vs_iphdr *iph)
+{
+	__be16 _ports[2], *ports;
+
+	/* At this point we know that we have a valid packet of some kind.
+	 * Because ICMP packets are only guaranteed to have the first 8
+	 * bytes, let's just grab the ports.  Fortunately they're in the
+	 * same position for all three of the protocols we care about.
+	 */
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_SCTP:
+		ports = skb_header_pointer(skb, iph->len, sizeof(_ports),
+					   &_ports);
+		if (unlikely(!ports))
+			return 0;
+
+		if (likely(!ip_vs_iph_inverse(iph)))
+			return ports[0];
+		else
+			return ports[1];
+	default:
+		return 0;
+	}
+}
+
+
+/*
+ *      Maglev Hashing scheduling
+ */
+static struct ip_vs_dest *
+ip_vs_mh_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
+		  struct ip_vs_iphdr *iph)
+{
+	struct ip_vs_dest *dest;
+	struct ip_vs_mh_state *s;
+	__be16 port = 0;
+	const union nf_inet_addr *hash_addr;
+
+	hash_addr = ip_vs_iph_inverse(iph) ? &iph->daddr : &iph->saddr;
+
+	IP_VS_DBG(6, "ip_vs_mh_schedule(): Scheduling...\n");
+
+	if (svc->flags & IP_VS_SVC_F_SCHED_MH_PORT)
+		port = ip_vs_mh_get_port(skb, iph);
+
+	s = (struct ip_vs_mh_state *) svc->sched_data;
+
+	if (svc->flags & IP_VS_SVC_F_SCHED_MH_FALLBACK)
+		dest = ip_vs_mh_get_fallback(svc, s, hash_addr, port);
+	else
+		dest = ip_vs_mh_get(svc, s, hash_addr, port);
+
+	if (!dest) {
+		ip_vs_scheduler_err(svc, "no destination available");
+		return NULL;
+	}
+
+	IP_VS_DBG_BUF(6, "MH: source IP address %s --> server %s:%d\n",
+		      IP_VS_DBG_ADDR(svc->af, hash_addr),
+		      IP_VS_DBG_ADDR(dest->af, &dest->addr),
+		      ntohs(dest->port));
+
+	return dest;
+}
+
+
+/*
+ *      IPVS MH Scheduler structure
+ */
+static struct ip_vs_scheduler ip_vs_mh_scheduler =
+{
+	.name =			"mh",
+	.refcnt =		ATOMIC_INIT(0),
+	.module =		THIS_MODULE,
+	.n_list	 =		LIST_HEAD_INIT(ip_vs_mh_scheduler.n_list),
+	.init_service =		ip_vs_mh_init_svc,
+	.done_service =		ip_vs_mh_done_svc,
+	.add_dest =		ip_vs_mh_dest_changed,
+	.del_dest =		ip_vs_mh_dest_changed,
+	.upd_dest =		ip_vs_mh_dest_changed,
+	.schedule =		ip_vs_mh_schedule,
+};
+
+
+static int __init ip_vs_mh_init(void)
+{
+	return register_ip_vs_scheduler(&ip_vs_mh_scheduler);
+}
+
+
+static void __exit ip_vs_mh_cleanup(void)
+{
+	unregister_ip_vs_scheduler(&ip_vs_mh_scheduler);
+	synchronize_rcu();
+}
+
+
+module_init(ip_vs_mh_init);
+module_exit(ip_vs_mh_cleanup);
+MODULE_LICENSE("GPL");
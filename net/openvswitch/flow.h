@@ -130,7 +130,8 @@ struct sw_flow_key_range {
 struct sw_flow_mask {
 	int ref_count;
 	struct rcu_head rcu;
-	struct list_head list;
+	unsigned long __percpu *hits;	/* packets that matched a flow */
+	u64 last_hits;			/* as of the last rebalance */
 	struct sw_flow_key_range range;
 	struct sw_flow_key key;
 };
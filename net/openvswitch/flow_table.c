@@ -41,12 +41,15 @@
 #include <linux/icmp.h>
 #include <linux/icmpv6.h>
 #include <linux/rculist.h>
+#include <linux/percpu.h>
+#include <linux/sort.h>
 #include <net/ip.h>
 #include <net/ipv6.h>
 #include <net/ndisc.h>
 
 #define TBL_MIN_BUCKETS		1024
 #define REHASH_INTERVAL		(10 * 60 * HZ)
+#define REBALANCE_INTERVAL	(4 * HZ)
 
 static struct kmem_cache *flow_cache;
 struct kmem_cache *flow_stats_cache __read_mostly;
@@ -206,14 +209,34 @@ static struct table_instance *table_instance_alloc(int new_size)
 	return ti;
 }
 
+static struct mask_array *mask_array_alloc(int count)
+{
+	struct mask_array *ma;
+
+	ma = kzalloc(sizeof(*ma) + count * sizeof(ma->masks[0]), GFP_KERNEL);
+	if (ma)
+		ma->count = count;
+
+	return ma;
+}
+
 int ovs_flow_tbl_init(struct flow_table *table)
 {
 	struct table_instance *ti, *ufid_ti;
+	struct mask_array *ma;
+
+	table->mask_cache = alloc_percpu(struct mask_cache_entry);
+	if (!table->mask_cache)
+		return -ENOMEM;
+
+	ma = mask_array_alloc(0);
+	if (!ma)
+		goto free_mask_cache;
 
 	ti = table_instance_alloc(TBL_MIN_BUCKETS);
 
 	if (!ti)
-		return -ENOMEM;
+		goto free_mask_array;
 
 	ufid_ti = table_instance_alloc(TBL_MIN_BUCKETS);
 	if (!ufid_ti)
@@ -221,17 +244,33 @@ int ovs_flow_tbl_init(struct flow_table *table)
 
 	rcu_assign_pointer(table->ti, ti);
 	rcu_assign_pointer(table->ufid_ti, ufid_ti);
-	INIT_LIST_HEAD(&table->mask_list);
+	rcu_assign_pointer(table->mask_array, ma);
 	table->last_rehash = jiffies;
+	table->last_rebalance = jiffies;
 	table->count = 0;
 	table->ufid_count = 0;
 	return 0;
 
 free_ti:
 	__table_instance_destroy(ti);
+free_mask_array:
+	kfree(ma);
+free_mask_cache:
+	free_percpu(table->mask_cache);
 	return -ENOMEM;
 }
 
+static void mask_free(struct sw_flow_mask *mask)
+{
+	free_percpu(mask->hits);
+	kfree(mask);
+}
+
+static void mask_free_rcu(struct rcu_head *rcu)
+{
+	mask_free(container_of(rcu, struct sw_flow_mask, rcu));
+}
+
 static void flow_tbl_destroy_rcu_cb(struct rcu_head *rcu)
 {
 	struct table_instance *ti = container_of(rcu, struct table_instance, rcu);
@@ -284,8 +323,14 @@ void ovs_flow_tbl_destroy(struct flow_table *table)
 {
 	struct table_instance *ti = rcu_dereference_raw(table->ti);
 	struct table_instance *ufid_ti = rcu_dereference_raw(table->ufid_ti);
+	struct mask_array *ma = rcu_dereference_raw(table->mask_array);
+	int i;
 
 	table_instance_destroy(ti, ufid_ti, false);
+	for (i = 0; i < ma->count; i++)
+		mask_free(ma->masks[i]);
+	kfree(ma);
+	free_percpu(table->mask_cache);
 }
 
 struct sw_flow *ovs_flow_tbl_dump_next(struct table_instance *ti,
@@ -488,22 +533,65 @@ static struct sw_flow *masked_flow_lookup(struct table_instance *ti,
 	return NULL;
 }
 
+static struct sw_flow *flow_lookup(struct table_instance *ti,
+				   const struct mask_array *ma,
+				   const struct sw_flow_key *key,
+				   u32 *n_mask_hit, u32 *index)
+{
+	struct sw_flow_mask *mask;
+	struct sw_flow *flow;
+	int i;
+
+	for (i = 0; i < ma->count; i++) {
+		mask = ma->masks[i];
+		(*n_mask_hit)++;
+		flow = masked_flow_lookup(ti, key, mask);
+		if (flow) {  /* Found */
+			this_cpu_inc(*mask->hits);
+			*index = i;
+			return flow;
+		}
+	}
+	return NULL;
+}
+
+/* Must be called with rcu_read_lock and BH disabled, if 'skb_hash' is
+ * not 0: the mask that the last packet with that hash matched is then
+ * tried before all the others.
+ */
 struct sw_flow *ovs_flow_tbl_lookup_stats(struct flow_table *tbl,
 				    const struct sw_flow_key *key,
-				    u32 *n_mask_hit)
+				    u32 skb_hash, u32 *n_mask_hit)
 {
 	struct table_instance *ti = rcu_dereference_ovsl(tbl->ti);
+	struct mask_array *ma = rcu_dereference_ovsl(tbl->mask_array);
+	struct mask_cache_entry *ce;
 	struct sw_flow_mask *mask;
 	struct sw_flow *flow;
+	u32 index;
 
 	*n_mask_hit = 0;
-	list_for_each_entry_rcu(mask, &tbl->mask_list, list) {
+	if (!skb_hash)
+		return flow_lookup(ti, ma, key, n_mask_hit, &index);
+
+	/* The masks may have moved since, it's only a hint */
+	ce = this_cpu_ptr(tbl->mask_cache) + (skb_hash & (MASK_CACHE_SIZE - 1));
+	if (ce->skb_hash == skb_hash && ce->mask_index < ma->count) {
+		mask = ma->masks[ce->mask_index];
 		(*n_mask_hit)++;
 		flow = masked_flow_lookup(ti, key, mask);
-		if (flow)  /* Found */
+		if (flow) {
+			this_cpu_inc(*mask->hits);
 			return flow;
+		}
 	}
-	return NULL;
+
+	flow = flow_lookup(ti, ma, key, n_mask_hit, &index);
+	if (flow) {
+		ce->skb_hash = skb_hash;
+		ce->mask_index = index;
+	}
+	return flow;
 }
 
 struct sw_flow *ovs_flow_tbl_lookup(struct flow_table *tbl,
@@ -511,19 +599,20 @@ struct sw_flow *ovs_flow_tbl_lookup(struct flow_table *tbl,
 {
 	u32 __always_unused n_mask_hit;
 
-	return ovs_flow_tbl_lookup_stats(tbl, key, &n_mask_hit);
+	return ovs_flow_tbl_lookup_stats(tbl, key, 0, &n_mask_hit);
 }
 
 struct sw_flow *ovs_flow_tbl_lookup_exact(struct flow_table *tbl,
 					  const struct sw_flow_match *match)
 {
 	struct table_instance *ti = rcu_dereference_ovsl(tbl->ti);
-	struct sw_flow_mask *mask;
+	struct mask_array *ma = ovsl_dereference(tbl->mask_array);
 	struct sw_flow *flow;
+	int i;
 
 	/* Always called under ovs-mutex. */
-	list_for_each_entry(mask, &tbl->mask_list, list) {
-		flow = masked_flow_lookup(ti, match->key, mask);
+	for (i = 0; i < ma->count; i++) {
+		flow = masked_flow_lookup(ti, match->key, ma->masks[i]);
 		if (flow && ovs_identifier_is_key(&flow->id) &&
 		    ovs_flow_cmp_unmasked_key(flow, match))
 			return flow;
@@ -573,13 +662,9 @@ struct sw_flow *ovs_flow_tbl_lookup_ufid(struct flow_table *tbl,
 
 int ovs_flow_tbl_num_masks(const struct flow_table *table)
 {
-	struct sw_flow_mask *mask;
-	int num = 0;
-
-	list_for_each_entry(mask, &table->mask_list, list)
-		num++;
+	struct mask_array *ma = rcu_dereference_ovsl(table->mask_array);
 
-	return num;
+	return ma->count;
 }
 
 static struct table_instance *table_instance_expand(struct table_instance *ti,
@@ -588,7 +673,112 @@ static struct table_instance *table_instance_expand(struct table_instance *ti,
 	return table_instance_rehash(ti, ti->n_buckets * 2, ufid);
 }
 
-/* Remove 'mask' from the mask list, if it is not needed any more. */
+static void tbl_mask_array_replace(struct flow_table *tbl,
+				   struct mask_array *new)
+{
+	struct mask_array *old = ovsl_dereference(tbl->mask_array);
+
+	rcu_assign_pointer(tbl->mask_array, new);
+	kfree_rcu(old, rcu);
+}
+
+static int tbl_mask_array_add(struct flow_table *tbl,
+			      struct sw_flow_mask *mask)
+{
+	struct mask_array *old = ovsl_dereference(tbl->mask_array);
+	struct mask_array *new;
+
+	new = mask_array_alloc(old->count + 1);
+	if (!new)
+		return -ENOMEM;
+
+	/* New masks go first, a flow was just added for some traffic */
+	new->masks[0] = mask;
+	memcpy(&new->masks[1], old->masks, old->count * sizeof(old->masks[0]));
+	tbl_mask_array_replace(tbl, new);
+	return 0;
+}
+
+static void tbl_mask_array_del(struct flow_table *tbl,
+			       struct sw_flow_mask *mask)
+{
+	struct mask_array *old = ovsl_dereference(tbl->mask_array);
+	struct mask_array *new;
+	int i, j;
+
+	new = mask_array_alloc(old->count - 1);
+	if (!new) {
+		/* Keep the unused mask around rather than fail */
+		mask->ref_count++;
+		return;
+	}
+
+	for (i = 0, j = 0; i < old->count; i++)
+		if (old->masks[i] != mask)
+			new->masks[j++] = old->masks[i];
+	tbl_mask_array_replace(tbl, new);
+	call_rcu(&mask->rcu, mask_free_rcu);
+}
+
+struct mask_count {
+	int index;
+	u64 hits;
+};
+
+static int mask_count_cmp(const void *a, const void *b)
+{
+	const struct mask_count *mc_a = a, *mc_b = b;
+
+	if (mc_a->hits != mc_b->hits)
+		return mc_a->hits > mc_b->hits ? -1 : 1;
+	return mc_a->index - mc_b->index;
+}
+
+/* Sort the masks by how many packets matched them since last time. */
+static void tbl_mask_array_rebalance(struct flow_table *tbl)
+{
+	struct mask_array *old = ovsl_dereference(tbl->mask_array);
+	struct mask_count *counts;
+	struct mask_array *new;
+	int i, cpu;
+
+	tbl->last_rebalance = jiffies;
+	if (old->count < 2)
+		return;
+
+	counts = kmalloc_array(old->count, sizeof(*counts), GFP_KERNEL);
+	if (!counts)
+		return;
+
+	for (i = 0; i < old->count; i++) {
+		struct sw_flow_mask *mask = old->masks[i];
+		u64 hits = 0;
+
+		for_each_possible_cpu(cpu)
+			hits += *per_cpu_ptr(mask->hits, cpu);
+		counts[i].index = i;
+		counts[i].hits = hits - mask->last_hits;
+		mask->last_hits = hits;
+	}
+	sort(counts, old->count, sizeof(*counts), mask_count_cmp, NULL);
+
+	for (i = 0; i < old->count; i++)
+		if (counts[i].index != i)
+			break;
+	if (i == old->count)
+		goto out;
+
+	new = mask_array_alloc(old->count);
+	if (!new)
+		goto out;
+	for (i = 0; i < old->count; i++)
+		new->masks[i] = old->masks[counts[i].index];
+	tbl_mask_array_replace(tbl, new);
+out:
+	kfree(counts);
+}
+
+/* Remove 'mask' from the mask array, if it is not needed any more. */
 static void flow_mask_remove(struct flow_table *tbl, struct sw_flow_mask *mask)
 {
 	if (mask) {
@@ -599,10 +789,8 @@ static void flow_mask_remove(struct flow_table *tbl, struct sw_flow_mask *mask)
 		BUG_ON(!mask->ref_count);
 		mask->ref_count--;
 
-		if (!mask->ref_count) {
-			list_del_rcu(&mask->list);
-			kfree_rcu(mask, rcu);
-		}
+		if (!mask->ref_count)
+			tbl_mask_array_del(tbl, mask);
 	}
 }
 
@@ -631,8 +819,16 @@ static struct sw_flow_mask *mask_alloc(void)
 	struct sw_flow_mask *mask;
 
 	mask = kmalloc(sizeof(*mask), GFP_KERNEL);
-	if (mask)
-		mask->ref_count = 1;
+	if (!mask)
+		return NULL;
+
+	mask->hits = alloc_percpu(unsigned long);
+	if (!mask->hits) {
+		kfree(mask);
+		return NULL;
+	}
+	mask->ref_count = 1;
+	mask->last_hits = 0;
 
 	return mask;
 }
@@ -651,19 +847,17 @@ static bool mask_equal(const struct sw_flow_mask *a,
 static struct sw_flow_mask *flow_mask_find(const struct flow_table *tbl,
 					   const struct sw_flow_mask *mask)
 {
-	struct list_head *ml;
+	struct mask_array *ma = ovsl_dereference(tbl->mask_array);
+	int i;
 
-	list_for_each(ml, &tbl->mask_list) {
-		struct sw_flow_mask *m;
-		m = container_of(ml, struct sw_flow_mask, list);
-		if (mask_equal(mask, m))
-			return m;
-	}
+	for (i = 0; i < ma->count; i++)
+		if (mask_equal(mask, ma->masks[i]))
+			return ma->masks[i];
 
 	return NULL;
 }
 
-/* Add 'mask' into the mask list, if it is not already there. */
+/* Add 'mask' into the mask array, if it is not already there. */
 static int flow_mask_insert(struct flow_table *tbl, struct sw_flow *flow,
 			    const struct sw_flow_mask *new)
 {
@@ -676,7 +870,10 @@ static int flow_mask_insert(struct flow_table *tbl, struct sw_flow *flow,
 			return -ENOMEM;
 		mask->key = new->key;
 		mask->range = new->range;
-		list_add_rcu(&mask->list, &tbl->mask_list);
+		if (tbl_mask_array_add(tbl, mask)) {
+			mask_free(mask);
+			return -ENOMEM;
+		}
 	} else {
 		BUG_ON(!mask->ref_count);
 		mask->ref_count++;
@@ -744,6 +941,8 @@ int ovs_flow_tbl_insert(struct flow_table *table, struct sw_flow *flow,
 	flow_key_insert(table, flow);
 	if (ovs_identifier_is_ufid(&flow->id))
 		flow_ufid_insert(table, flow);
+	if (time_after(jiffies, table->last_rebalance + REBALANCE_INTERVAL))
+		tbl_mask_array_rebalance(table);
 
 	return 0;
 }
@@ -45,11 +45,29 @@ struct table_instance {
 	bool keep_flows;
 };
 
+/* Per cpu, which mask the last packet with a given skb hash matched */
+#define MASK_CACHE_BITS		8
+#define MASK_CACHE_SIZE		(1 << MASK_CACHE_BITS)
+
+struct mask_cache_entry {
+	u32 skb_hash;
+	u32 mask_index;
+};
+
+/* Replaced as a whole on any change, most used masks first */
+struct mask_array {
+	struct rcu_head rcu;
+	int count;
+	struct sw_flow_mask *masks[];
+};
+
 struct flow_table {
 	struct table_instance __rcu *ti;
 	struct table_instance __rcu *ufid_ti;
-	struct list_head mask_list;
+	struct mask_cache_entry __percpu *mask_cache;
+	struct mask_array __rcu *mask_array;
 	unsigned long last_rehash;
+	unsigned long last_rebalance;
 	unsigned int count;
 	unsigned int ufid_count;
 };
@@ -75,7 +93,7 @@ struct sw_flow *ovs_flow_tbl_dump_next(struct table_instance *table,
 				       u32 *bucket, u32 *idx);
 struct sw_flow *ovs_flow_tbl_lookup_stats(struct flow_table *,
 				    const struct sw_flow_key *,
-				    u32 *n_mask_hit);
+				    u32 skb_hash, u32 *n_mask_hit);
 struct sw_flow *ovs_flow_tbl_lookup(struct flow_table *,
 				    const struct sw_flow_key *);
 struct sw_flow *ovs_flow_tbl_lookup_exact(struct flow_table *tbl,
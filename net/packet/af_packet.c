@@ -60,6 +60,7 @@
 #include <linux/in.h>
 #include <linux/inet.h>
 #include <linux/netdevice.h>
+#include <linux/etherdevice.h>
 #include <linux/if_packet.h>
 #include <linux/wireless.h>
 #include <linux/kernel.h>
@@ -73,6 +74,7 @@
 #include <net/sock.h>
 #include <linux/errno.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
 #include <asm/page.h>
@@ -985,7 +987,8 @@ static void prb_clear_blk_fill_status(struct packet_ring_buffer *rb)
 static void prb_fill_rxhash(struct tpacket_kbdq_core *pkc,
 			struct tpacket3_hdr *ppd)
 {
-	ppd->hv1.tp_rxhash = skb_get_hash(pkc->skb);
+	/* no skb, and so no hash, for frames straight from the driver */
+	ppd->hv1.tp_rxhash = pkc->skb ? skb_get_hash(pkc->skb) : 0;
 }
 
 static void prb_clear_rxhash(struct tpacket_kbdq_core *pkc,
@@ -997,7 +1000,7 @@ static void prb_clear_rxhash(struct tpacket_kbdq_core *pkc,
 static void prb_fill_vlan_info(struct tpacket_kbdq_core *pkc,
 			struct tpacket3_hdr *ppd)
 {
-	if (skb_vlan_tag_present(pkc->skb)) {
+	if (pkc->skb && skb_vlan_tag_present(pkc->skb)) {
 		ppd->hv1.tp_vlan_tci = skb_vlan_tag_get(pkc->skb);
 		ppd->hv1.tp_vlan_tpid = ntohs(pkc->skb->vlan_proto);
 		ppd->tp_status = TP_STATUS_VLAN_VALID | TP_STATUS_VLAN_TPID_VALID;
@@ -1964,6 +1967,68 @@ static unsigned int run_filter(struct sk_buff *skb,
 	return res;
 }
 
+/*
+ * PACKET_WAKEUP: a reader asleep in poll() or recvmsg() is woken once
+ * for every wakeup.frames frames queued, or wakeup.usecs after the first
+ * one it wasn't woken for, whichever comes first.  A reader that looks
+ * finds every frame there as before; only the wakeups are coalesced.
+ * TPACKET_V3 rings wake the reader once per block anyway.
+ */
+static enum hrtimer_restart packet_wakeup_timer(struct hrtimer *timer)
+{
+	struct packet_sock *po = container_of(timer, struct packet_sock,
+					      wakeup.timer);
+
+	if (atomic_xchg(&po->wakeup.pending, 0))
+		po->sk.sk_data_ready(&po->sk);
+	return HRTIMER_NORESTART;
+}
+
+static void packet_data_ready(struct sock *sk)
+{
+	struct packet_wakeup *w = &pkt_sk(sk)->wakeup;
+	unsigned int frames = READ_ONCE(w->frames);
+
+	if (likely(frames <= 1)) {
+		sk->sk_data_ready(sk);
+		return;
+	}
+
+	if (atomic_inc_return(&w->pending) >= frames) {
+		atomic_set(&w->pending, 0);
+		sk->sk_data_ready(sk);
+		return;
+	}
+
+	/* a timer already running keeps the deadline of an earlier frame */
+	if (!hrtimer_is_queued(&w->timer))
+		hrtimer_start(&w->timer,
+			      ns_to_ktime((u64)READ_ONCE(w->usecs) *
+					  NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+}
+
+static int packet_set_wakeup(struct sock *sk,
+			     const struct tpacket_wakeup_req *req)
+{
+	struct packet_wakeup *w = &pkt_sk(sk)->wakeup;
+
+	/* frames must not wait for a reader that won't be woken */
+	if (req->tp_frames > 1 &&
+	    (!req->tp_usecs || req->tp_usecs > USEC_PER_SEC))
+		return -EINVAL;
+
+	lock_sock(sk);
+	WRITE_ONCE(w->usecs, req->tp_usecs);
+	WRITE_ONCE(w->frames, req->tp_frames);
+	release_sock(sk);
+
+	/* whoever was left waiting is woken by the timer, if it's running */
+	if (req->tp_frames <= 1 && atomic_xchg(&w->pending, 0))
+		sk->sk_data_ready(sk);
+	return 0;
+}
+
 /*
  * This function makes lazy skb cloning in hope that most of packets
  * are discarded by BPF.
@@ -2069,7 +2134,7 @@ static int packet_rcv(struct sk_buff *skb, struct net_device *dev,
 	sock_skb_set_dropcount(sk, skb);
 	__skb_queue_tail(&sk->sk_receive_queue, skb);
 	spin_unlock(&sk->sk_receive_queue.lock);
-	sk->sk_data_ready(sk);
+	packet_data_ready(sk);
 	return 0;
 
 drop_n_acct:
@@ -2088,6 +2153,112 @@ drop:
 	return 0;
 }
 
+/*
+ * PACKET_RX_QUEUE binds a TPACKET_V3 ring to one rx queue of the bound
+ * device.  If the driver can, it hands packet_rxq_rcv() the frames of
+ * that queue straight from its rx buffers, before any skb is built for
+ * them, and they are copied into the ring there; neither the socket
+ * filter nor fanout get to see them.  With TP_RXQ_CONSUME they then go
+ * no further, as if an XDP program had dropped them.  Otherwise the ring
+ * is fed by tpacket_rcv() as usual, with whatever was received on that
+ * queue.
+ */
+static bool packet_rxq_skip(struct packet_sock *po, struct sk_buff *skb)
+{
+	int queue = READ_ONCE(po->rxq.queue);
+
+	if (likely(queue < 0))
+		return false;
+
+	/* fed by the driver, anything here would be a duplicate */
+	if (READ_ONCE(po->rxq.dev))
+		return true;
+
+	return skb->pkt_type == PACKET_OUTGOING ||
+	       !skb_rx_queue_recorded(skb) || skb_get_rx_queue(skb) != queue;
+}
+
+static unsigned char packet_rxq_pkttype(const struct net_device *dev,
+					const struct ethhdr *eth)
+{
+	if (unlikely(is_multicast_ether_addr(eth->h_dest))) {
+		if (is_broadcast_ether_addr(eth->h_dest))
+			return PACKET_BROADCAST;
+		return PACKET_MULTICAST;
+	}
+	if (unlikely(!ether_addr_equal(eth->h_dest, dev->dev_addr)))
+		return PACKET_OTHERHOST;
+	return PACKET_HOST;
+}
+
+/* Called by the driver from its rx poll, under rcu_read_lock() */
+static bool packet_rxq_rcv(struct xdp_capture *cap, struct xdp_buff *xdp)
+{
+	struct packet_sock *po = container_of(cap, struct packet_sock, rxq.cap);
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+	struct net_device *dev = xdp->dev;
+	struct sock *sk = &po->sk;
+	const struct ethhdr *eth = xdp->data;
+	unsigned int len = xdp->data_end - xdp->data;
+	unsigned int snaplen = len;
+	unsigned short macoff, netoff;
+	struct tpacket3_hdr *h3;
+	struct sockaddr_ll *sll;
+	struct timespec ts;
+
+	if (unlikely(len < ETH_HLEN))
+		return false;
+
+	/* laid out as tpacket_rcv() would for SOCK_RAW */
+	netoff = TPACKET_ALIGN(po->tp_hdrlen + 16) + po->tp_reserve;
+	macoff = netoff - ETH_HLEN;
+	if (unlikely(macoff + snaplen > pkc->max_frame_len)) {
+		snaplen = pkc->max_frame_len - macoff;
+		if (unlikely((int)snaplen < 0)) {
+			snaplen = 0;
+			macoff = pkc->max_frame_len;
+		}
+	}
+
+	spin_lock(&sk->sk_receive_queue.lock);
+	h3 = __packet_lookup_frame_in_block(po, NULL, TP_STATUS_KERNEL,
+					    macoff + snaplen);
+	if (!h3) {
+		po->stats.stats1.tp_drops++;
+		spin_unlock(&sk->sk_receive_queue.lock);
+		sk->sk_data_ready(sk);
+		goto out;
+	}
+	po->stats.stats1.tp_packets++;
+	spin_unlock(&sk->sk_receive_queue.lock);
+
+	memcpy((u8 *)h3 + macoff, xdp->data, snaplen);
+	getnstimeofday(&ts);
+
+	h3->tp_status |= TP_STATUS_USER;
+	h3->tp_len = len;
+	h3->tp_snaplen = snaplen;
+	h3->tp_mac = macoff;
+	h3->tp_net = netoff;
+	h3->tp_sec = ts.tv_sec;
+	h3->tp_nsec = ts.tv_nsec;
+	memset(h3->tp_padding, 0, sizeof(h3->tp_padding));
+
+	sll = (void *)h3 + TPACKET_ALIGN(sizeof(*h3));
+	sll->sll_halen = ETH_ALEN;
+	memcpy(sll->sll_addr, eth->h_source, ETH_ALEN);
+	sll->sll_family = AF_PACKET;
+	sll->sll_hatype = dev->type;
+	sll->sll_protocol = eth->h_proto;
+	sll->sll_pkttype = packet_rxq_pkttype(dev, eth);
+	sll->sll_ifindex = dev->ifindex;
+
+	smp_mb();
+	prb_clear_blk_fill_status(&po->rx_ring);
+out:
+	return po->rxq.flags & TP_RXQ_CONSUME;
+}
+
 static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		       struct packet_type *pt, struct net_device *orig_dev)
 {
@@ -2120,6 +2291,9 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	if (!net_eq(dev_net(dev), sock_net(sk)))
 		goto drop;
 
+	if (unlikely(packet_rxq_skip(po, skb)))
+		goto drop;
+
 	if (dev->header_ops) {
 		if (sk->sk_type != SOCK_DGRAM)
 			skb_push(skb, skb->data - skb_mac_header(skb));
@@ -2289,7 +2463,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 
 	if (po->tp_version <= TPACKET_V2) {
 		__packet_set_status(po, h.raw, status);
-		sk->sk_data_ready(sk);
+		packet_data_ready(sk);
 	} else {
 		prb_clear_blk_fill_status(&po->rx_ring);
 	}
@@ -2599,6 +2773,140 @@ out:
 	return err;
 }
 
+/*
+ * MSG_ZEROCOPY: with PACKET_ZEROCOPY set, packet_snd() copies only the
+ * first PACKET_ZC_COPYLEN bytes and hangs the user pages off the skb as
+ * frags.  When the skb has let go of them, or a tap had to copy them, a
+ * notification is queued on the error queue, ee_info..ee_data giving
+ * the range of send ids it covers.  Each such send takes the next id,
+ * and a notification still queued is extended by the ones completing
+ * after it, so a reader that falls behind finds one for many sends.
+ */
+#define PACKET_ZC_COPYLEN	128
+
+/* lives in the cb of the notification skb until it is queued */
+struct packet_zc {
+	struct ubuf_info	ubuf;
+	struct sock		*sk;
+	u32			id;
+};
+
+static struct sk_buff *packet_zc_skb(struct ubuf_info *ubuf)
+{
+	return container_of((void *)ubuf, struct sk_buff, cb);
+}
+
+static bool packet_zc_extend(struct sk_buff *tail, u32 id, bool copied)
+{
+	struct sock_extended_err *ee = &SKB_EXT_ERR(tail)->ee;
+
+	if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee->ee_data + 1 != id ||
+	    !!(ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != copied)
+		return false;
+
+	ee->ee_data = id;
+	return true;
+}
+
+static void packet_zc_callback(struct ubuf_info *ubuf, bool success)
+{
+	struct packet_zc *zc = container_of(ubuf, struct packet_zc, ubuf);
+	struct sk_buff *tail, *skb = packet_zc_skb(ubuf);
+	struct sock *sk = zc->sk;
+	struct sk_buff_head *q = &sk->sk_error_queue;
+	struct sock_exterr_skb *serr;
+	unsigned long flags;
+	u32 id = zc->id;
+
+	if (sock_flag(sk, SOCK_DEAD))
+		goto out;
+
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (tail && packet_zc_extend(tail, id, !success)) {
+		spin_unlock_irqrestore(&q->lock, flags);
+		goto out;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_info = id;
+	serr->ee.ee_data = id;
+	if (!success)
+		serr->ee.ee_code = SO_EE_CODE_ZEROCOPY_COPIED;
+
+	if (!sock_queue_err_skb(sk, skb))
+		skb = NULL;
+out:
+	consume_skb(skb);
+	sock_put(sk);
+}
+
+static struct ubuf_info *packet_zc_alloc(struct sock *sk)
+{
+	struct packet_zc *zc;
+	struct sk_buff *skb;
+
+	BUILD_BUG_ON(sizeof(*zc) > sizeof(skb->cb));
+
+	/* the notification has to fit in the receive buffer when it comes */
+	if (atomic_read(&sk->sk_rmem_alloc) >= sk->sk_rcvbuf)
+		return NULL;
+
+	skb = alloc_skb(0, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	zc = (struct packet_zc *)skb->cb;
+	zc->ubuf.callback = packet_zc_callback;
+	zc->ubuf.ctx = NULL;
+	zc->ubuf.desc = 0;
+	zc->sk = sk;
+	sock_hold(sk);
+
+	return &zc->ubuf;
+}
+
+/* the send is going out: it takes the next id, whatever happens to it */
+static void packet_zc_commit(struct ubuf_info *ubuf)
+{
+	struct packet_zc *zc = container_of(ubuf, struct packet_zc, ubuf);
+
+	zc->id = (u32)atomic_inc_return(&pkt_sk(zc->sk)->zckey) - 1;
+}
+
+/* the send failed before it got anywhere: no id, no notification */
+static void packet_zc_abort(struct ubuf_info *ubuf)
+{
+	struct packet_zc *zc = container_of(ubuf, struct packet_zc, ubuf);
+
+	sock_put(zc->sk);
+	kfree_skb(packet_zc_skb(ubuf));
+}
+
+/*
+ * How much of @len to copy so that the rest can go out of the user
+ * pages, at least @linear; 0 if it all has to be copied after all.
+ */
+static size_t packet_zc_copylen(const struct iov_iter *from, size_t len,
+				size_t linear)
+{
+	size_t copylen = max_t(size_t, linear, PACKET_ZC_COPYLEN);
+	struct iov_iter i;
+
+	if (len <= copylen)
+		return 0;
+
+	i = *from;
+	iov_iter_advance(&i, copylen);
+	if (iov_iter_npages(&i, INT_MAX) > MAX_SKB_FRAGS)
+		return 0;
+
+	return copylen;
+}
+
 static struct sk_buff *packet_alloc_skb(struct sock *sk, size_t prepad,
 				        size_t reserve, size_t len,
 				        size_t linear, int noblock,
@@ -2640,6 +2948,8 @@ static int packet_snd(struct socket *sock, struct msghdr *msg, size_t len)
 	unsigned short gso_type = 0;
 	int hlen, tlen;
 	int extra_len = 0;
+	struct ubuf_info *zc = NULL;
+	size_t linear, copylen = 0;
 	ssize_t n;
 
 	/*
@@ -2740,11 +3050,24 @@ static int packet_snd(struct socket *sock, struct msghdr *msg, size_t len)
 		goto out_unlock;
 
 	err = -ENOBUFS;
+	linear = __virtio16_to_cpu(vio_le(), vnet_hdr.hdr_len);
+	if ((msg->msg_flags & MSG_ZEROCOPY) && po->tx_zerocopy) {
+		zc = packet_zc_alloc(sk);
+		if (!zc)
+			goto out_unlock;
+		/* dev_validate_header() wants the whole header linear */
+		copylen = packet_zc_copylen(&msg->msg_iter, len,
+					    max_t(size_t, linear, reserve));
+	}
+
 	hlen = LL_RESERVED_SPACE(dev);
 	tlen = dev->needed_tailroom;
-	skb = packet_alloc_skb(sk, hlen + tlen, hlen, len,
-			       __virtio16_to_cpu(vio_le(), vnet_hdr.hdr_len),
-			       msg->msg_flags & MSG_DONTWAIT, &err);
+	if (copylen)
+		skb = packet_alloc_skb(sk, hlen + tlen, hlen, copylen, copylen,
+				       msg->msg_flags & MSG_DONTWAIT, &err);
+	else
+		skb = packet_alloc_skb(sk, hlen + tlen, hlen, len, linear,
+				       msg->msg_flags & MSG_DONTWAIT, &err);
 	if (skb == NULL)
 		goto out_unlock;
 
@@ -2757,8 +3080,16 @@ static int packet_snd(struct socket *sock, struct msghdr *msg, size_t len)
 			goto out_free;
 	}
 
-	/* Returns -EFAULT on error */
-	err = skb_copy_datagram_from_iter(skb, offset, &msg->msg_iter, len);
+	if (copylen) {
+		/* the user data goes after what dev_hard_header() put there */
+		__skb_pull(skb, offset);
+		err = zerocopy_sg_from_iter(skb, &msg->msg_iter);
+		__skb_push(skb, offset);
+	} else {
+		/* Returns -EFAULT on error */
+		err = skb_copy_datagram_from_iter(skb, offset, &msg->msg_iter,
+						  len);
+	}
 	if (err)
 		goto out_free;
 
@@ -2809,6 +3140,19 @@ static int packet_snd(struct socket *sock, struct msghdr *msg, size_t len)
 	if (unlikely(extra_len == 4))
 		skb->no_fcs = 1;
 
+	if (zc) {
+		packet_zc_commit(zc);
+		if (copylen) {
+			skb_shinfo(skb)->destructor_arg = zc;
+			skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY |
+						     SKBTX_SHARED_FRAG;
+		} else {
+			/* copied already, the buffer is free again */
+			zc->callback(zc, false);
+		}
+		zc = NULL;
+	}
+
 	err = po->xmit(skb);
 	if (err > 0 && (err = net_xmit_errno(err)) != 0)
 		goto out_unlock;
@@ -2820,6 +3164,8 @@ static int packet_snd(struct socket *sock, struct msghdr *msg, size_t len)
 out_free:
 	kfree_skb(skb);
 out_unlock:
+	if (zc)
+		packet_zc_abort(zc);
 	if (dev)
 		dev_put(dev);
 out:
@@ -2842,6 +3188,67 @@ static int packet_sendmsg(struct socket *sock, struct msghdr *msg, size_t len)
  *	to 'closed' state and remove our protocol entry in the device list.
  */
 
+/* Called with rtnl held; the caller waits for packet_rxq_rcv() to be done */
+static void __packet_rxq_unbind(struct packet_sock *po)
+{
+	ASSERT_RTNL();
+
+	if (po->rxq.dev) {
+		xdp_capture_detach(po->rxq.dev, po->rxq.queue);
+		dev_put(po->rxq.dev);
+		WRITE_ONCE(po->rxq.dev, NULL);
+	}
+	WRITE_ONCE(po->rxq.queue, -1);
+	po->rxq.flags = 0;
+}
+
+static void packet_rxq_unbind(struct packet_sock *po)
+{
+	bool direct = po->rxq.dev;
+
+	__packet_rxq_unbind(po);
+	if (direct)
+		synchronize_net();
+}
+
+/* Called with rtnl and the socket lock held */
+static int packet_rxq_bind(struct sock *sk, const struct tpacket_rxq_req *req)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct net_device *dev;
+
+	if (req->tp_flags & ~TP_RXQ_CONSUME)
+		return -EINVAL;
+
+	if (po->rxq.queue >= 0)
+		packet_rxq_unbind(po);
+	if (req->tp_queue == ~0U)
+		return 0;
+
+	if (req->tp_queue > INT_MAX || sk->sk_type != SOCK_RAW ||
+	    po->tp_version != TPACKET_V3 || !po->rx_ring.pg_vec)
+		return -EINVAL;
+
+	dev = po->ifindex > 0 ?
+	      __dev_get_by_index(sock_net(sk), po->ifindex) : NULL;
+	if (!dev)
+		return -ENODEV;
+	if (dev->type != ARPHRD_ETHER)
+		return -EINVAL;
+
+	po->rxq.flags = req->tp_flags;
+	WRITE_ONCE(po->rxq.queue, req->tp_queue);
+
+	/* tpacket_rcv() lets go of the queue before the driver takes it */
+	WRITE_ONCE(po->rxq.dev, dev);
+	if (xdp_capture_attach(dev, req->tp_queue, &po->rxq.cap))
+		WRITE_ONCE(po->rxq.dev, NULL);
+	else
+		dev_hold(dev);
+
+	return 0;
+}
+
 static int packet_release(struct socket *sock)
 {
 	struct sock *sk = sock->sk;
@@ -2873,6 +3280,12 @@ static int packet_release(struct socket *sock)
 	}
 	spin_unlock(&po->bind_lock);
 
+	if (po->rxq.queue >= 0) {
+		rtnl_lock();
+		packet_rxq_unbind(po);
+		rtnl_unlock();
+	}
+
 	packet_flush_mclist(sk);
 
 	if (po->rx_ring.pg_vec) {
@@ -2891,6 +3304,7 @@ static int packet_release(struct socket *sock)
 	/*
 	 *	Now the socket is dead. No more input will appear.
 	 */
+	hrtimer_cancel(&po->wakeup.timer);
 	sock_orphan(sk);
 	sock->sk = NULL;
 
@@ -2926,6 +3340,12 @@ static int packet_do_bind(struct sock *sk, const char *name, int ifindex,
 	spin_lock(&po->bind_lock);
 	rcu_read_lock();
 
+	/* the queue belongs to the device bound now */
+	if (po->rxq.queue >= 0) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
 	if (name) {
 		dev = dev_get_by_name_rcu(sock_net(sk), name);
 		if (!dev) {
@@ -3074,6 +3494,10 @@ static int packet_create(struct net *net, struct socket *sock, int protocol,
 	sk->sk_family = PF_PACKET;
 	po->num = proto;
 	po->xmit = dev_queue_xmit;
+	po->rxq.cap.rcv = packet_rxq_rcv;
+	po->rxq.queue = -1;
+	hrtimer_init(&po->wakeup.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	po->wakeup.timer.function = packet_wakeup_timer;
 
 	err = packet_alloc_pending(po);
 	if (err)
@@ -3708,6 +4132,46 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->xmit = val ? packet_direct_xmit : dev_queue_xmit;
 		return 0;
 	}
+	case PACKET_ZEROCOPY:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		po->tx_zerocopy = !!val;
+		return 0;
+	}
+	case PACKET_WAKEUP:
+	{
+		struct tpacket_wakeup_req req;
+
+		if (optlen != sizeof(req))
+			return -EINVAL;
+		if (copy_from_user(&req, optval, sizeof(req)))
+			return -EFAULT;
+
+		return packet_set_wakeup(sk, &req);
+	}
+	case PACKET_RX_QUEUE:
+	{
+		struct tpacket_rxq_req req;
+		int ret;
+
+		if (optlen != sizeof(req))
+			return -EINVAL;
+		if (copy_from_user(&req, optval, sizeof(req)))
+			return -EFAULT;
+
+		rtnl_lock();
+		lock_sock(sk);
+		ret = packet_rxq_bind(sk, &req);
+		release_sock(sk);
+		rtnl_unlock();
+		return ret;
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -3723,6 +4187,8 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	void *data = &val;
 	union tpacket_stats_u st;
 	struct tpacket_rollover_stats rstats;
+	struct tpacket_rxq_req rxq;
+	struct tpacket_wakeup_req wakeup;
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -3813,6 +4279,25 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	case PACKET_QDISC_BYPASS:
 		val = packet_use_direct_xmit(po);
 		break;
+	case PACKET_ZEROCOPY:
+		val = po->tx_zerocopy;
+		break;
+	case PACKET_WAKEUP:
+		wakeup.tp_frames = po->wakeup.frames;
+		wakeup.tp_usecs = po->wakeup.usecs;
+		data = &wakeup;
+		lv = sizeof(wakeup);
+		break;
+	case PACKET_RX_QUEUE:
+		rtnl_lock();
+		rxq.tp_queue = po->rxq.queue;
+		rxq.tp_flags = po->rxq.flags;
+		if (po->rxq.dev)
+			rxq.tp_flags |= TP_RXQ_DIRECT;
+		rtnl_unlock();
+		data = &rxq;
+		lv = sizeof(rxq);
+		break;
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -3842,6 +4327,9 @@ static int packet_notifier(struct notifier_block *this,
 		case NETDEV_UNREGISTER:
 			if (po->mclist)
 				packet_dev_mclist_delete(dev, &po->mclist);
+			/* down already, the driver doesn't feed the ring */
+			if (dev->ifindex == po->ifindex)
+				__packet_rxq_unbind(po);
 			/* fallthrough */
 
 		case NETDEV_DOWN:
@@ -4150,6 +4638,13 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 
 	lock_sock(sk);
 
+	/* the driver may be writing to the rx ring of a bound queue */
+	if (!closing && !tx_ring && po->rxq.queue >= 0) {
+		release_sock(sk);
+		err = -EBUSY;
+		goto out_free_pg_vec;
+	}
+
 	/* Detach socket from network */
 	spin_lock(&po->bind_lock);
 	was_running = po->running;
@@ -4199,6 +4694,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	}
 	release_sock(sk);
 
+out_free_pg_vec:
 	if (pg_vec)
 		free_pg_vec(pg_vec, order, req->tp_block_nr);
 out:
@@ -100,6 +100,22 @@ struct packet_rollover {
 	u32			history[ROLLOVER_HLEN] ____cacheline_aligned;
 } ____cacheline_aligned_in_smp;
 
+/* see PACKET_RX_QUEUE, all under rtnl */
+struct packet_rxq {
+	struct xdp_capture	cap;
+	int			queue;	/* -1 if not bound to one */
+	unsigned int		flags;
+	struct net_device	*dev;	/* set if the driver feeds the ring */
+};
+
+/* see PACKET_WAKEUP */
+struct packet_wakeup {
+	unsigned int		frames;
+	unsigned int		usecs;
+	atomic_t		pending;	/* frames the reader wasn't woken for */
+	struct hrtimer		timer;
+};
+
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
@@ -125,9 +141,13 @@ struct packet_sock {
 	unsigned int		tp_reserve;
 	unsigned int		tp_loss:1;
 	unsigned int		tp_tx_has_off:1;
+	unsigned int		tx_zerocopy:1;
+	atomic_t		zckey;		/* next MSG_ZEROCOPY send id */
 	unsigned int		tp_tstamp;
 	struct net_device __rcu	*cached_dev;
 	int			(*xmit)(struct sk_buff *skb);
+	struct packet_rxq	rxq;
+	struct packet_wakeup	wakeup;
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
 };
 
@@ -46,6 +46,7 @@
 unsigned int rds_ib_fmr_1m_pool_size = RDS_FMR_1M_POOL_SIZE;
 unsigned int rds_ib_fmr_8k_pool_size = RDS_FMR_8K_POOL_SIZE;
 unsigned int rds_ib_retry_count = RDS_IB_DEFAULT_RETRY_COUNT;
+unsigned int rds_ib_srq_max_wr;
 
 module_param(rds_ib_fmr_1m_pool_size, int, 0444);
 MODULE_PARM_DESC(rds_ib_fmr_1m_pool_size, " Max number of 1M fmr per HCA");
@@ -53,6 +54,8 @@ module_param(rds_ib_fmr_8k_pool_size, int, 0444);
 MODULE_PARM_DESC(rds_ib_fmr_8k_pool_size, " Max number of 8K fmr per HCA");
 module_param(rds_ib_retry_count, int, 0444);
 MODULE_PARM_DESC(rds_ib_retry_count, " Number of hw retries before reporting an error");
+module_param(rds_ib_srq_max_wr, int, 0444);
+MODULE_PARM_DESC(rds_ib_srq_max_wr, " Number of receive buffers shared by all connections of an HCA, 0 for per connection buffers");
 
 /*
  * we have a clumsy combination of RCU and a rwsem protecting this list
@@ -97,6 +100,7 @@ static void rds_ib_dev_free(struct work_struct *work)
 	struct rds_ib_device *rds_ibdev = container_of(work,
 					struct rds_ib_device, free_work);
 
+	rds_ib_srq_destroy(rds_ibdev);
 	if (rds_ibdev->mr_8k_pool)
 		rds_ib_destroy_mr_pool(rds_ibdev->mr_8k_pool);
 	if (rds_ibdev->mr_1m_pool)
@@ -182,6 +186,11 @@ static void rds_ib_add_one(struct ib_device *device)
 		goto put_dev;
 	}
 
+	/* without a shared receive queue, connections bring their own */
+	if (rds_ib_srq_create(rds_ibdev, dev_attr))
+		printk(KERN_NOTICE "RDS/IB: %s: no shared receive queue\n",
+		       device->name);
+
 	rdsdebug("RDS/IB: max_mr = %d, max_wrs = %d, max_sge = %d, fmr_max_remaps = %d, max_1m_fmrs = %d, max_8k_fmrs = %d\n",
 		 dev_attr->max_fmr, rds_ibdev->max_wrs, rds_ibdev->max_sge,
 		 rds_ibdev->fmr_max_remaps, rds_ibdev->max_1m_fmrs,
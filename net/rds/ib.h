@@ -91,6 +91,32 @@ struct rds_ib_recv_work {
 	struct ib_sge		r_sge[2];
 };
 
+/*
+ * A shared receive queue is posted with the buffers of all connections
+ * on a device instead of giving each connection a ring of its own.
+ * Completions still come in on the receive cq of the connection the
+ * data was sent to; the buffer is then handed back to s_free.
+ */
+struct rds_ib_srq {
+	struct rds_ib_device	*s_rds_ibdev;
+	struct ib_srq		*s_srq;
+	u32			s_nr;
+	u32			s_limit;
+	struct rds_ib_recv_work *s_recvs;
+	struct rds_header	*s_recv_hdrs;
+	u64			s_recv_hdrs_dma;
+	spinlock_t		s_lock;		/* protects s_free */
+	u32			*s_free;
+	u32			s_nr_free;
+	unsigned long		s_flags;
+	struct rds_ib_refill_cache s_cache_incs;
+	struct rds_ib_refill_cache s_cache_frags;
+	struct delayed_work	s_refill_w;
+};
+
+/* bits for s_flags */
+#define RDS_IB_SRQ_REFILL	0
+
 struct rds_ib_work_ring {
 	u32		w_nr;
 	u32		w_alloc_ptr;
@@ -152,6 +178,7 @@ struct rds_ib_connection {
 	u64			i_ack_recv;	/* last ACK received */
 	struct rds_ib_refill_cache i_cache_incs;
 	struct rds_ib_refill_cache i_cache_frags;
+	struct rds_ib_srq	*i_srq;		/* replaces the recv ring if set */
 
 	/* sending acks */
 	unsigned long		i_ack_flags;
@@ -217,6 +244,7 @@ struct rds_ib_device {
 	unsigned int		max_wrs;
 	unsigned int		max_initiator_depth;
 	unsigned int		max_responder_resources;
+	struct rds_ib_srq	*srq;
 	spinlock_t		spinlock;	/* protect the above */
 	atomic_t		refcount;
 	struct work_struct	free_work;
@@ -248,6 +276,8 @@ struct rds_ib_statistics {
 	uint64_t	s_ib_rx_refill_from_cq;
 	uint64_t	s_ib_rx_refill_from_thread;
 	uint64_t	s_ib_rx_alloc_limit;
+	uint64_t	s_ib_srq_lows;
+	uint64_t	s_ib_srq_refills;
 	uint64_t	s_ib_rx_credit_updates;
 	uint64_t	s_ib_ack_sent;
 	uint64_t	s_ib_ack_send_failure;
@@ -320,6 +350,7 @@ extern struct ib_client rds_ib_client;
 extern unsigned int rds_ib_fmr_1m_pool_size;
 extern unsigned int rds_ib_fmr_8k_pool_size;
 extern unsigned int rds_ib_retry_count;
+extern unsigned int rds_ib_srq_max_wr;
 
 extern spinlock_t ib_nodev_conns_lock;
 extern struct list_head ib_nodev_conns;
@@ -379,6 +410,10 @@ void rds_ib_attempt_ack(struct rds_ib_connection *ic);
 void rds_ib_ack_send_complete(struct rds_ib_connection *ic);
 u64 rds_ib_piggyb_ack(struct rds_ib_connection *ic);
 void rds_ib_set_ack(struct rds_ib_connection *ic, u64 seq, int ack_required);
+int rds_ib_srq_create(struct rds_ib_device *rds_ibdev,
+		      struct ib_device_attr *dev_attr);
+void rds_ib_srq_destroy(struct rds_ib_device *rds_ibdev);
+void rds_ib_srq_drain_cq(struct rds_ib_connection *ic);
 
 /* ib_ring.c */
 void rds_ib_ring_init(struct rds_ib_work_ring *ring, u32 nr);
@@ -54,7 +54,8 @@ static void rds_ib_set_flow_control(struct rds_connection *conn, u32 credits)
 {
 	struct rds_ib_connection *ic = conn->c_transport_data;
 
-	if (rds_ib_sysctl_flow_control && credits != 0) {
+	/* credits count posted buffers, which srq connections don't own */
+	if (rds_ib_sysctl_flow_control && credits != 0 && !ic->i_srq) {
 		/* We're doing flow control */
 		ic->i_flowctl = 1;
 		rds_ib_send_add_credits(conn, credits);
@@ -372,6 +373,10 @@ static int rds_ib_setup_qp(struct rds_connection *conn)
 	/* Protection domain and memory range */
 	ic->i_pd = rds_ibdev->pd;
 
+	ic->i_srq = rds_ibdev->srq;
+	if (ic->i_srq)
+		ic->i_flowctl = 0;
+
 	cq_attr.cqe = ic->i_send_ring.w_nr + 1;
 
 	ic->i_send_cq = ib_create_cq(dev, rds_ib_cq_comp_handler_send,
@@ -420,6 +425,11 @@ static int rds_ib_setup_qp(struct rds_connection *conn)
 	attr.qp_type = IB_QPT_RC;
 	attr.send_cq = ic->i_send_cq;
 	attr.recv_cq = ic->i_recv_cq;
+	if (ic->i_srq) {
+		attr.srq = ic->i_srq->s_srq;
+		attr.cap.max_recv_wr = 0;
+		attr.cap.max_recv_sge = 0;
+	}
 
 	/*
 	 * XXX this can fail if max_*_wr is too large?  Are we supposed
@@ -441,14 +451,16 @@ static int rds_ib_setup_qp(struct rds_connection *conn)
 		goto out;
 	}
 
-	ic->i_recv_hdrs = ib_dma_alloc_coherent(dev,
-					   ic->i_recv_ring.w_nr *
+	if (!ic->i_srq) {
+		ic->i_recv_hdrs = ib_dma_alloc_coherent(dev,
+					ic->i_recv_ring.w_nr *
 						sizeof(struct rds_header),
-					   &ic->i_recv_hdrs_dma, GFP_KERNEL);
-	if (!ic->i_recv_hdrs) {
-		ret = -ENOMEM;
-		rdsdebug("ib_dma_alloc_coherent recv failed\n");
-		goto out;
+					&ic->i_recv_hdrs_dma, GFP_KERNEL);
+		if (!ic->i_recv_hdrs) {
+			ret = -ENOMEM;
+			rdsdebug("ib_dma_alloc_coherent recv failed\n");
+			goto out;
+		}
 	}
 
 	ic->i_ack = ib_dma_alloc_coherent(dev, sizeof(struct rds_header),
@@ -467,12 +479,15 @@ static int rds_ib_setup_qp(struct rds_connection *conn)
 		goto out;
 	}
 
-	ic->i_recvs = vzalloc_node(ic->i_recv_ring.w_nr * sizeof(struct rds_ib_recv_work),
-				   ibdev_to_node(dev));
-	if (!ic->i_recvs) {
-		ret = -ENOMEM;
-		rdsdebug("recv allocation failed\n");
-		goto out;
+	if (!ic->i_srq) {
+		ic->i_recvs = vzalloc_node(ic->i_recv_ring.w_nr *
+						sizeof(struct rds_ib_recv_work),
+					   ibdev_to_node(dev));
+		if (!ic->i_recvs) {
+			ret = -ENOMEM;
+			rdsdebug("recv allocation failed\n");
+			goto out;
+		}
 	}
 
 	rds_ib_recv_init_ack(ic);
@@ -748,8 +763,11 @@ void rds_ib_conn_shutdown(struct rds_connection *conn)
 			rdma_destroy_qp(ic->i_cm_id);
 		if (ic->i_send_cq)
 			ib_destroy_cq(ic->i_send_cq);
-		if (ic->i_recv_cq)
+		if (ic->i_recv_cq) {
+			if (ic->i_srq)
+				rds_ib_srq_drain_cq(ic);
 			ib_destroy_cq(ic->i_recv_cq);
+		}
 
 		/* then free the resources that ib callbacks use */
 		if (ic->i_send_hdrs)
@@ -777,6 +795,13 @@ void rds_ib_conn_shutdown(struct rds_connection *conn)
 
 		rdma_destroy_id(ic->i_cm_id);
 
+		/*
+		 * Buffers still held by this connection are given back
+		 * to its own caches from now on, the srq goes with the
+		 * device.
+		 */
+		WRITE_ONCE(ic->i_srq, NULL);
+
 		/*
 		 * Move connection back to the nodev list.
 		 */
@@ -34,6 +34,7 @@
 #include <linux/slab.h>
 #include <linux/pci.h>
 #include <linux/dma-mapping.h>
+#include <linux/vmalloc.h>
 #include <rdma/rdma_cm.h>
 
 #include "rds.h"
@@ -48,6 +49,10 @@ void rds_ib_recv_init_ring(struct rds_ib_connection *ic)
 	struct rds_ib_recv_work *recv;
 	u32 i;
 
+	/* the srq's work requests were set up with it */
+	if (ic->i_srq)
+		return;
+
 	for (i = 0, recv = ic->i_recvs; i < ic->i_recv_ring.w_nr; i++, recv++) {
 		struct ib_sge *sge;
 
@@ -151,7 +156,8 @@ static void rds_ib_cache_splice_all_lists(struct rds_ib_refill_cache *cache,
 	}
 }
 
-void rds_ib_recv_free_caches(struct rds_ib_connection *ic)
+static void __rds_ib_recv_free_caches(struct rds_ib_refill_cache *incs,
+				      struct rds_ib_refill_cache *frags)
 {
 	struct rds_ib_incoming *inc;
 	struct rds_ib_incoming *inc_tmp;
@@ -159,9 +165,9 @@ void rds_ib_recv_free_caches(struct rds_ib_connection *ic)
 	struct rds_page_frag *frag_tmp;
 	LIST_HEAD(list);
 
-	rds_ib_cache_xfer_to_ready(&ic->i_cache_incs);
-	rds_ib_cache_splice_all_lists(&ic->i_cache_incs, &list);
-	free_percpu(ic->i_cache_incs.percpu);
+	rds_ib_cache_xfer_to_ready(incs);
+	rds_ib_cache_splice_all_lists(incs, &list);
+	free_percpu(incs->percpu);
 
 	list_for_each_entry_safe(inc, inc_tmp, &list, ii_cache_entry) {
 		list_del(&inc->ii_cache_entry);
@@ -169,9 +175,9 @@ void rds_ib_recv_free_caches(struct rds_ib_connection *ic)
 		kmem_cache_free(rds_ib_incoming_slab, inc);
 	}
 
-	rds_ib_cache_xfer_to_ready(&ic->i_cache_frags);
-	rds_ib_cache_splice_all_lists(&ic->i_cache_frags, &list);
-	free_percpu(ic->i_cache_frags.percpu);
+	rds_ib_cache_xfer_to_ready(frags);
+	rds_ib_cache_splice_all_lists(frags, &list);
+	free_percpu(frags->percpu);
 
 	list_for_each_entry_safe(frag, frag_tmp, &list, f_cache_entry) {
 		list_del(&frag->f_cache_entry);
@@ -180,11 +186,34 @@ void rds_ib_recv_free_caches(struct rds_ib_connection *ic)
 	}
 }
 
+void rds_ib_recv_free_caches(struct rds_ib_connection *ic)
+{
+	__rds_ib_recv_free_caches(&ic->i_cache_incs, &ic->i_cache_frags);
+}
+
 /* fwd decl */
 static void rds_ib_recv_cache_put(struct list_head *new_item,
 				  struct rds_ib_refill_cache *cache);
 static struct list_head *rds_ib_recv_cache_get(struct rds_ib_refill_cache *cache);
+static void rds_ib_srq_refill(struct rds_ib_srq *srq, gfp_t gfp);
 
+/*
+ * Buffers received through a shared receive queue go back to it, unless
+ * the connection was shut down and has left the srq in the meantime.
+ */
+static struct rds_ib_refill_cache *rds_ib_inc_cache(struct rds_ib_connection *ic)
+{
+	struct rds_ib_srq *srq = READ_ONCE(ic->i_srq);
+
+	return srq ? &srq->s_cache_incs : &ic->i_cache_incs;
+}
+
+static struct rds_ib_refill_cache *rds_ib_frag_cache(struct rds_ib_connection *ic)
+{
+	struct rds_ib_srq *srq = READ_ONCE(ic->i_srq);
+
+	return srq ? &srq->s_cache_frags : &ic->i_cache_frags;
+}
 
 /* Recycle frag and attached recv buffer f_sg */
 static void rds_ib_frag_free(struct rds_ib_connection *ic,
@@ -192,7 +221,7 @@ static void rds_ib_frag_free(struct rds_ib_connection *ic,
 {
 	rdsdebug("frag %p page %p\n", frag, sg_page(&frag->f_sg));
 
-	rds_ib_recv_cache_put(&frag->f_cache_entry, &ic->i_cache_frags);
+	rds_ib_recv_cache_put(&frag->f_cache_entry, rds_ib_frag_cache(ic));
 }
 
 /* Recycle inc after freeing attached frags */
@@ -213,7 +242,7 @@ void rds_ib_inc_free(struct rds_incoming *inc)
 	BUG_ON(!list_empty(&ibinc->ii_frags));
 
 	rdsdebug("freeing ibinc %p inc %p\n", ibinc, inc);
-	rds_ib_recv_cache_put(&ibinc->ii_cache_entry, &ic->i_cache_incs);
+	rds_ib_recv_cache_put(&ibinc->ii_cache_entry, rds_ib_inc_cache(ic));
 }
 
 static void rds_ib_recv_clear_one(struct rds_ib_connection *ic,
@@ -238,14 +267,15 @@ void rds_ib_recv_clear_ring(struct rds_ib_connection *ic)
 		rds_ib_recv_clear_one(ic, &ic->i_recvs[i]);
 }
 
-static struct rds_ib_incoming *rds_ib_refill_one_inc(struct rds_ib_connection *ic,
+/* The caller attaches the inc to a connection with rds_inc_init() */
+static struct rds_ib_incoming *rds_ib_refill_one_inc(struct rds_ib_refill_cache *cache,
 						     gfp_t slab_mask)
 {
 	struct rds_ib_incoming *ibinc;
 	struct list_head *cache_item;
 	int avail_allocs;
 
-	cache_item = rds_ib_recv_cache_get(&ic->i_cache_incs);
+	cache_item = rds_ib_recv_cache_get(cache);
 	if (cache_item) {
 		ibinc = container_of(cache_item, struct rds_ib_incoming, ii_cache_entry);
 	} else {
@@ -262,19 +292,18 @@ static struct rds_ib_incoming *rds_ib_refill_one_inc(struct rds_ib_connection *i
 		}
 	}
 	INIT_LIST_HEAD(&ibinc->ii_frags);
-	rds_inc_init(&ibinc->ii_inc, ic->conn, ic->conn->c_faddr);
 
 	return ibinc;
 }
 
-static struct rds_page_frag *rds_ib_refill_one_frag(struct rds_ib_connection *ic,
+static struct rds_page_frag *rds_ib_refill_one_frag(struct rds_ib_refill_cache *cache,
 						    gfp_t slab_mask, gfp_t page_mask)
 {
 	struct rds_page_frag *frag;
 	struct list_head *cache_item;
 	int ret;
 
-	cache_item = rds_ib_recv_cache_get(&ic->i_cache_frags);
+	cache_item = rds_ib_recv_cache_get(cache);
 	if (cache_item) {
 		frag = container_of(cache_item, struct rds_page_frag, f_cache_entry);
 	} else {
@@ -320,13 +349,16 @@ static int rds_ib_recv_refill_one(struct rds_connection *conn,
 	 * recvs that were continuations will still have this allocated.
 	 */
 	if (!recv->r_ibinc) {
-		recv->r_ibinc = rds_ib_refill_one_inc(ic, slab_mask);
+		recv->r_ibinc = rds_ib_refill_one_inc(&ic->i_cache_incs,
+						      slab_mask);
 		if (!recv->r_ibinc)
 			goto out;
+		rds_inc_init(&recv->r_ibinc->ii_inc, conn, conn->c_faddr);
 	}
 
 	WARN_ON(recv->r_frag); /* leak! */
-	recv->r_frag = rds_ib_refill_one_frag(ic, slab_mask, page_mask);
+	recv->r_frag = rds_ib_refill_one_frag(&ic->i_cache_frags, slab_mask,
+					      page_mask);
 	if (!recv->r_frag)
 		goto out;
 
@@ -382,6 +414,12 @@ void rds_ib_recv_refill(struct rds_connection *conn, int prefill, gfp_t gfp)
 	bool can_wait = !!(gfp & __GFP_DIRECT_RECLAIM);
 	u32 pos;
 
+	/* the connection has no buffers of its own to post */
+	if (ic->i_srq) {
+		rds_ib_srq_refill(ic->i_srq, gfp);
+		return;
+	}
+
 	/* the goal here is to just make sure that someone, somewhere
 	 * is posting buffers.  If we can't get the refill lock,
 	 * let them do their thing
@@ -829,12 +867,13 @@ static void rds_ib_cong_recv(struct rds_connection *conn,
 }
 
 static void rds_ib_process_recv(struct rds_connection *conn,
-				struct rds_ib_recv_work *recv, u32 data_len,
+				struct rds_ib_recv_work *recv,
+				struct rds_header *ihdr, u32 data_len,
 				struct rds_ib_ack_state *state)
 {
 	struct rds_ib_connection *ic = conn->c_transport_data;
 	struct rds_ib_incoming *ibinc = ic->i_ibinc;
-	struct rds_header *ihdr, *hdr;
+	struct rds_header *hdr;
 
 	/* XXX shut down the connection if port 0,0 are seen? */
 
@@ -851,8 +890,6 @@ static void rds_ib_process_recv(struct rds_connection *conn,
 	}
 	data_len -= sizeof(struct rds_header);
 
-	ihdr = &ic->i_recv_hdrs[recv - ic->i_recvs];
-
 	/* Validate the checksum. */
 	if (!rds_message_verify_checksum(ihdr)) {
 		rds_ib_conn_error(conn, "incoming message "
@@ -953,6 +990,330 @@ static void rds_ib_process_recv(struct rds_connection *conn,
 	}
 }
 
+static void rds_ib_srq_put_slot(struct rds_ib_srq *srq, u32 slot)
+{
+	spin_lock_bh(&srq->s_lock);
+	srq->s_free[srq->s_nr_free++] = slot;
+	spin_unlock_bh(&srq->s_lock);
+}
+
+static bool rds_ib_srq_get_slot(struct rds_ib_srq *srq, u32 *slot)
+{
+	bool ret = false;
+
+	spin_lock_bh(&srq->s_lock);
+	if (srq->s_nr_free) {
+		*slot = srq->s_free[--srq->s_nr_free];
+		ret = true;
+	}
+	spin_unlock_bh(&srq->s_lock);
+	return ret;
+}
+
+static int rds_ib_srq_refill_one(struct rds_ib_srq *srq,
+				 struct rds_ib_recv_work *recv, gfp_t gfp)
+{
+	struct ib_device *dev = srq->s_rds_ibdev->dev;
+	gfp_t slab_mask = GFP_NOWAIT;
+	gfp_t page_mask = GFP_NOWAIT;
+	int ret;
+
+	if (gfp & __GFP_DIRECT_RECLAIM) {
+		slab_mask = GFP_KERNEL;
+		page_mask = GFP_HIGHUSER;
+	}
+
+	if (!srq->s_cache_incs.ready)
+		rds_ib_cache_xfer_to_ready(&srq->s_cache_incs);
+	if (!srq->s_cache_frags.ready)
+		rds_ib_cache_xfer_to_ready(&srq->s_cache_frags);
+
+	/* the inc is attached to a connection once a message starts in it */
+	if (!recv->r_ibinc) {
+		recv->r_ibinc = rds_ib_refill_one_inc(&srq->s_cache_incs,
+						      slab_mask);
+		if (!recv->r_ibinc)
+			return -ENOMEM;
+	}
+
+	WARN_ON(recv->r_frag); /* leak! */
+	recv->r_frag = rds_ib_refill_one_frag(&srq->s_cache_frags, slab_mask,
+					      page_mask);
+	if (!recv->r_frag)
+		return -ENOMEM;
+
+	ret = ib_dma_map_sg(dev, &recv->r_frag->f_sg, 1, DMA_FROM_DEVICE);
+	WARN_ON(ret != 1);
+
+	recv->r_sge[1].addr = ib_sg_dma_address(dev, &recv->r_frag->f_sg);
+	recv->r_sge[1].length = ib_sg_dma_len(dev, &recv->r_frag->f_sg);
+	return 0;
+}
+
+/*
+ * Post the free buffers of a shared receive queue.  Like the connection
+ * rings, only one caller refills at a time and the others just leave.
+ */
+static void rds_ib_srq_refill(struct rds_ib_srq *srq, gfp_t gfp)
+{
+	struct rds_ib_recv_work *recv;
+	struct ib_recv_wr *failed_wr;
+	bool can_wait = !!(gfp & __GFP_DIRECT_RECLAIM);
+	unsigned int posted = 0;
+	u32 slot;
+	int ret;
+
+	if (test_and_set_bit(RDS_IB_SRQ_REFILL, &srq->s_flags))
+		return;
+
+	while (rds_ib_srq_get_slot(srq, &slot)) {
+		recv = &srq->s_recvs[slot];
+		ret = rds_ib_srq_refill_one(srq, recv, gfp);
+		if (!ret) {
+			ret = ib_post_srq_recv(srq->s_srq, &recv->r_wr,
+					       &failed_wr);
+			if (ret) {
+				printk(KERN_WARNING "RDS/IB: srq recv post "
+				       "returned %d\n", ret);
+				ib_dma_unmap_sg(srq->s_rds_ibdev->dev,
+						&recv->r_frag->f_sg, 1,
+						DMA_FROM_DEVICE);
+				rds_ib_recv_cache_put(&recv->r_frag->f_cache_entry,
+						      &srq->s_cache_frags);
+				recv->r_frag = NULL;
+			}
+		}
+		if (ret) {
+			rds_ib_srq_put_slot(srq, slot);
+			break;
+		}
+		posted++;
+	}
+
+	if (posted)
+		rds_ib_stats_inc(s_ib_srq_refills);
+
+	clear_bit(RDS_IB_SRQ_REFILL, &srq->s_flags);
+
+	/* leave what we couldn't allocate here to krdsd */
+	if (!can_wait && READ_ONCE(srq->s_nr_free))
+		queue_delayed_work(rds_wq, &srq->s_refill_w, 1);
+}
+
+static void rds_ib_srq_refill_worker(struct work_struct *work)
+{
+	struct rds_ib_srq *srq = container_of(work, struct rds_ib_srq,
+					      s_refill_w.work);
+	struct ib_srq_attr attr = {
+		.srq_limit = srq->s_limit,
+	};
+
+	rds_ib_srq_refill(srq, GFP_KERNEL);
+
+	/* the limit event is one-shot, so arm it again */
+	ib_modify_srq(srq->s_srq, &attr, IB_SRQ_LIMIT);
+}
+
+static void rds_ib_srq_event_handler(struct ib_event *event, void *context)
+{
+	struct rds_ib_srq *srq = context;
+
+	rdsdebug("srq %p event %u (%s)\n", srq, event->event,
+		 ib_event_msg(event->event));
+
+	if (event->event == IB_EVENT_SRQ_LIMIT_REACHED) {
+		rds_ib_stats_inc(s_ib_srq_lows);
+		queue_delayed_work(rds_wq, &srq->s_refill_w, 0);
+	}
+}
+
+static void rds_ib_srq_cqe_handler(struct rds_ib_connection *ic,
+				   struct ib_wc *wc,
+				   struct rds_ib_ack_state *state)
+{
+	struct rds_connection *conn = ic->conn;
+	struct rds_ib_srq *srq = ic->i_srq;
+	struct rds_ib_recv_work *recv;
+
+	recv = &srq->s_recvs[wc->wr_id];
+	ib_dma_unmap_sg(srq->s_rds_ibdev->dev, &recv->r_frag->f_sg, 1,
+			DMA_FROM_DEVICE);
+
+	if (wc->status == IB_WC_SUCCESS) {
+		/* a new message starts in this buffer: the inc is ours now */
+		if (!ic->i_ibinc)
+			rds_inc_init(&recv->r_ibinc->ii_inc, conn,
+				     conn->c_faddr);
+		rds_ib_process_recv(conn, recv, &srq->s_recv_hdrs[wc->wr_id],
+				    wc->byte_len, state);
+	} else {
+		if (rds_conn_up(conn) || rds_conn_connecting(conn))
+			rds_ib_conn_error(conn, "recv completion on %pI4 had status %u (%s), disconnecting and reconnecting\n",
+					  &conn->c_faddr,
+					  wc->status,
+					  ib_wc_status_msg(wc->status));
+	}
+
+	if (recv->r_frag) {
+		rds_ib_frag_free(ic, recv->r_frag);
+		recv->r_frag = NULL;
+	}
+	rds_ib_srq_put_slot(srq, wc->wr_id);
+
+	if (READ_ONCE(srq->s_nr_free) >= srq->s_nr / 2)
+		rds_ib_srq_refill(srq, GFP_NOWAIT);
+}
+
+/*
+ * Receives that completed on a connection's cq after its tasklet was
+ * killed still hold srq buffers.  Called once the qp is gone, so that
+ * nothing can be added to the cq any more.
+ */
+void rds_ib_srq_drain_cq(struct rds_ib_connection *ic)
+{
+	struct rds_ib_srq *srq = ic->i_srq;
+	struct rds_ib_recv_work *recv;
+	struct ib_wc *wc;
+	int nr, i;
+
+	while ((nr = ib_poll_cq(ic->i_recv_cq, RDS_IB_WC_MAX,
+				ic->i_recv_wc)) > 0) {
+		for (i = 0; i < nr; i++) {
+			wc = &ic->i_recv_wc[i];
+			recv = &srq->s_recvs[wc->wr_id];
+			ib_dma_unmap_sg(srq->s_rds_ibdev->dev,
+					&recv->r_frag->f_sg, 1,
+					DMA_FROM_DEVICE);
+			rds_ib_recv_cache_put(&recv->r_frag->f_cache_entry,
+					      &srq->s_cache_frags);
+			recv->r_frag = NULL;
+			rds_ib_srq_put_slot(srq, wc->wr_id);
+		}
+	}
+}
+
+int rds_ib_srq_create(struct rds_ib_device *rds_ibdev,
+		      struct ib_device_attr *dev_attr)
+{
+	struct ib_device *dev = rds_ibdev->dev;
+	struct ib_srq_init_attr srq_attr = {};
+	struct ib_srq_attr attr = {};
+	struct rds_ib_recv_work *recv;
+	struct rds_ib_srq *srq;
+	int ret = -ENOMEM;
+	u32 i;
+
+	if (!rds_ib_srq_max_wr || !dev_attr->max_srq)
+		return 0;
+
+	srq = kzalloc_node(sizeof(*srq), GFP_KERNEL, ibdev_to_node(dev));
+	if (!srq)
+		return -ENOMEM;
+
+	srq->s_rds_ibdev = rds_ibdev;
+	srq->s_nr = min_t(u32, rds_ib_srq_max_wr, dev_attr->max_srq_wr);
+	srq->s_limit = srq->s_nr / 8;
+	spin_lock_init(&srq->s_lock);
+	INIT_DELAYED_WORK(&srq->s_refill_w, rds_ib_srq_refill_worker);
+
+	if (rds_ib_recv_alloc_cache(&srq->s_cache_incs))
+		goto out_free;
+	if (rds_ib_recv_alloc_cache(&srq->s_cache_frags))
+		goto out_incs;
+
+	srq->s_recvs = vzalloc_node(srq->s_nr * sizeof(*srq->s_recvs),
+				    ibdev_to_node(dev));
+	srq->s_free = vmalloc_node(srq->s_nr * sizeof(*srq->s_free),
+				   ibdev_to_node(dev));
+	if (!srq->s_recvs || !srq->s_free)
+		goto out_caches;
+
+	srq->s_recv_hdrs = ib_dma_alloc_coherent(dev, srq->s_nr *
+						 sizeof(struct rds_header),
+						 &srq->s_recv_hdrs_dma,
+						 GFP_KERNEL);
+	if (!srq->s_recv_hdrs)
+		goto out_caches;
+
+	srq_attr.event_handler = rds_ib_srq_event_handler;
+	srq_attr.srq_context = srq;
+	srq_attr.attr.max_wr = srq->s_nr;
+	srq_attr.attr.max_sge = RDS_IB_RECV_SGE;
+	srq_attr.srq_type = IB_SRQT_BASIC;
+	srq->s_srq = ib_create_srq(rds_ibdev->pd, &srq_attr);
+	if (IS_ERR(srq->s_srq)) {
+		ret = PTR_ERR(srq->s_srq);
+		goto out_hdrs;
+	}
+
+	for (i = 0, recv = srq->s_recvs; i < srq->s_nr; i++, recv++) {
+		recv->r_wr.wr_id = i;
+		recv->r_wr.sg_list = recv->r_sge;
+		recv->r_wr.num_sge = RDS_IB_RECV_SGE;
+		recv->r_sge[0].addr = srq->s_recv_hdrs_dma +
+				      i * sizeof(struct rds_header);
+		recv->r_sge[0].length = sizeof(struct rds_header);
+		recv->r_sge[0].lkey = rds_ibdev->pd->local_dma_lkey;
+		recv->r_sge[1].lkey = rds_ibdev->pd->local_dma_lkey;
+		srq->s_free[i] = i;
+	}
+	srq->s_nr_free = srq->s_nr;
+
+	rds_ibdev->srq = srq;
+	rds_ib_srq_refill(srq, GFP_KERNEL);
+	attr.srq_limit = srq->s_limit;
+	ib_modify_srq(srq->s_srq, &attr, IB_SRQ_LIMIT);
+	return 0;
+
+out_hdrs:
+	ib_dma_free_coherent(dev, srq->s_nr * sizeof(struct rds_header),
+			     srq->s_recv_hdrs, srq->s_recv_hdrs_dma);
+out_caches:
+	vfree(srq->s_free);
+	vfree(srq->s_recvs);
+	free_percpu(srq->s_cache_frags.percpu);
+out_incs:
+	free_percpu(srq->s_cache_incs.percpu);
+out_free:
+	kfree(srq);
+	return ret;
+}
+
+/* Called with all the device's connections gone */
+void rds_ib_srq_destroy(struct rds_ib_device *rds_ibdev)
+{
+	struct rds_ib_srq *srq = rds_ibdev->srq;
+	struct rds_ib_recv_work *recv;
+	u32 i;
+
+	if (!srq)
+		return;
+
+	cancel_delayed_work_sync(&srq->s_refill_w);
+	ib_destroy_srq(srq->s_srq);
+
+	for (i = 0, recv = srq->s_recvs; i < srq->s_nr; i++, recv++) {
+		if (recv->r_ibinc)
+			rds_ib_recv_cache_put(&recv->r_ibinc->ii_cache_entry,
+					      &srq->s_cache_incs);
+		if (recv->r_frag) {
+			ib_dma_unmap_sg(rds_ibdev->dev, &recv->r_frag->f_sg,
+					1, DMA_FROM_DEVICE);
+			rds_ib_recv_cache_put(&recv->r_frag->f_cache_entry,
+					      &srq->s_cache_frags);
+		}
+	}
+
+	ib_dma_free_coherent(rds_ibdev->dev,
+			     srq->s_nr * sizeof(struct rds_header),
+			     srq->s_recv_hdrs, srq->s_recv_hdrs_dma);
+	vfree(srq->s_free);
+	vfree(srq->s_recvs);
+	__rds_ib_recv_free_caches(&srq->s_cache_incs, &srq->s_cache_frags);
+	rds_ibdev->srq = NULL;
+	kfree(srq);
+}
+
 void rds_ib_recv_cqe_handler(struct rds_ib_connection *ic,
 			     struct ib_wc *wc,
 			     struct rds_ib_ack_state *state)
@@ -966,6 +1327,11 @@ void rds_ib_recv_cqe_handler(struct rds_ib_connection *ic,
 		 be32_to_cpu(wc->ex.imm_data));
 
 	rds_ib_stats_inc(s_ib_rx_cq_event);
+	if (ic->i_srq) {
+		rds_ib_srq_cqe_handler(ic, wc, state);
+		return;
+	}
+
 	recv = &ic->i_recvs[rds_ib_ring_oldest(&ic->i_recv_ring)];
 	ib_dma_unmap_sg(ic->i_cm_id->device, &recv->r_frag->f_sg, 1,
 			DMA_FROM_DEVICE);
@@ -975,7 +1341,9 @@ void rds_ib_recv_cqe_handler(struct rds_ib_connection *ic,
 	 * event is processed.
 	 */
 	if (wc->status == IB_WC_SUCCESS) {
-		rds_ib_process_recv(conn, recv, wc->byte_len, state);
+		rds_ib_process_recv(conn, recv,
+				    &ic->i_recv_hdrs[recv - ic->i_recvs],
+				    wc->byte_len, state);
 	} else {
 		/* We expect errors as the qp is drained during shutdown */
 		if (rds_conn_up(conn) || rds_conn_connecting(conn))
@@ -13,6 +13,9 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/rhashtable.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
 
 #include <linux/if_ether.h>
 #include <linux/in6.h>
@@ -41,20 +44,45 @@ struct fl_flow_mask_range {
 	unsigned short int end;
 };
 
+/* The filters using one mask, in a hash table of their masked keys */
 struct fl_flow_mask {
 	struct fl_flow_key key;
 	struct fl_flow_mask_range range;
+	struct rhashtable ht;
+	struct rhashtable_params ht_params;
+	struct list_head list;		/* in cls_fl_head->masks */
+	unsigned int refcnt;		/* filters using the mask, rtnl */
+	struct work_struct work;
 	struct rcu_head	rcu;
 };
 
+/*
+ * A per cpu cache of what the full, unmasked key of recent packets
+ * matched, nothing included, so that a flow doesn't search every mask
+ * on every packet.  Entries are only valid for the generation of the
+ * filter set they were filled in for.
+ */
+#define FL_CACHE_BITS	6
+#define FL_CACHE_SIZE	(1U << FL_CACHE_BITS)
+
+struct fl_cache_entry {
+	u32 hash;
+	u32 gen;
+	struct cls_fl_filter *f;
+	struct fl_flow_key key;
+};
+
+struct fl_cache {
+	struct fl_cache_entry ent[FL_CACHE_SIZE];
+};
+
 struct cls_fl_head {
-	struct rhashtable ht;
-	struct fl_flow_mask mask;
+	struct list_head masks;		/* searched in the order added */
 	struct flow_dissector dissector;
+	struct fl_cache __percpu *cache;
+	u32 gen;			/* bumped on every change of filters */
 	u32 hgen;
-	bool mask_assigned;
 	struct list_head filters;
-	struct rhashtable_params ht_params;
 	struct rcu_head rcu;
 };
 
@@ -64,6 +92,7 @@ struct cls_fl_filter {
 	struct tcf_exts exts;
 	struct tcf_result res;
 	struct fl_flow_key key;
+	struct fl_flow_mask *mask;
 	struct list_head list;
 	u32 handle;
 	struct rcu_head	rcu;
@@ -109,21 +138,51 @@ static void fl_set_masked_key(struct fl_flow_key *mkey, struct fl_flow_key *key,
 		*lmkey++ = *lkey++ & *lmask++;
 }
 
-static void fl_clear_masked_range(struct fl_flow_key *key,
-				  struct fl_flow_mask *mask)
+static bool fl_mask_eq(struct fl_flow_mask *mask1,
+		       struct fl_flow_mask *mask2)
 {
-	memset(fl_key_get_start(key, mask), 0, fl_mask_range(mask));
+	const long *lmask1 = fl_key_get_start(&mask1->key, mask1);
+	const long *lmask2 = fl_key_get_start(&mask2->key, mask2);
+
+	return !memcmp(&mask1->range, &mask2->range, sizeof(mask1->range)) &&
+	       !memcmp(lmask1, lmask2, fl_mask_range(mask1));
+}
+
+static const struct rhashtable_params fl_ht_params = {
+	.key_offset = offsetof(struct cls_fl_filter, mkey), /* base offset */
+	.head_offset = offsetof(struct cls_fl_filter, ht_node),
+	.automatic_shrinking = true,
+};
+
+static struct cls_fl_filter *fl_lookup(struct cls_fl_head *head,
+				       struct fl_flow_key *key)
+{
+	struct fl_flow_mask *mask;
+	struct cls_fl_filter *f;
+	struct fl_flow_key mkey;
+
+	list_for_each_entry_rcu(mask, &head->masks, list) {
+		fl_set_masked_key(&mkey, key, mask);
+		f = rhashtable_lookup_fast(&mask->ht,
+					   fl_key_get_start(&mkey, mask),
+					   mask->ht_params);
+		if (f)
+			return f;
+	}
+	return NULL;
 }
 
 static int fl_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 		       struct tcf_result *res)
 {
 	struct cls_fl_head *head = rcu_dereference_bh(tp->root);
+	struct fl_cache_entry *ce;
 	struct cls_fl_filter *f;
 	struct fl_flow_key skb_key;
-	struct fl_flow_key skb_mkey;
+	u32 gen, hash;
 
-	fl_clear_masked_range(&skb_key, &head->mask);
+	/* all of it, the cache hashes and compares the whole key */
+	memset(&skb_key, 0, sizeof(skb_key));
 	skb_key.indev_ifindex = skb->skb_iif;
 	/* skb_flow_dissect() does not set n_proto in case an unknown protocol,
 	 * so do it rather here.
@@ -131,11 +190,21 @@ static int fl_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 	skb_key.basic.n_proto = skb->protocol;
 	skb_flow_dissect(skb, &head->dissector, &skb_key, 0);
 
-	fl_set_masked_key(&skb_mkey, &skb_key, &head->mask);
+	/* sampled before the lookup, which may race with a change */
+	gen = READ_ONCE(head->gen);
+	hash = jhash2((const u32 *)&skb_key, sizeof(skb_key) / sizeof(u32), 0);
+	ce = &this_cpu_ptr(head->cache)->ent[hash & (FL_CACHE_SIZE - 1)];
+	if (ce->gen == gen && ce->hash == hash &&
+	    !memcmp(&ce->key, &skb_key, sizeof(skb_key))) {
+		f = ce->f;
+	} else {
+		f = fl_lookup(head, &skb_key);
+		ce->gen = gen;
+		ce->hash = hash;
+		ce->f = f;
+		ce->key = skb_key;
+	}
 
-	f = rhashtable_lookup_fast(&head->ht,
-				   fl_key_get_start(&skb_mkey, &head->mask),
-				   head->ht_params);
 	if (f) {
 		*res = f->res;
 		return tcf_exts_exec(skb, &f->exts, res);
@@ -143,6 +212,31 @@ static int fl_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 	return -1;
 }
 
+#define FL_KEY_MEMBER_OFFSET(member) offsetof(struct fl_flow_key, member)
+
+#define FL_KEY_SET(keys, cnt, id, member)					\
+	do {									\
+		keys[cnt].key_id = id;						\
+		keys[cnt].offset = FL_KEY_MEMBER_OFFSET(member);		\
+		cnt++;								\
+	} while(0);
+
+/* one dissection for all the masks, so everything a mask may use */
+static void fl_init_dissector(struct cls_fl_head *head)
+{
+	struct flow_dissector_key keys[FLOW_DISSECTOR_KEY_MAX];
+	size_t cnt = 0;
+
+	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_CONTROL, control);
+	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_BASIC, basic);
+	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_ETH_ADDRS, eth);
+	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_IPV4_ADDRS, ipv4);
+	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_IPV6_ADDRS, ipv6);
+	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_PORTS, tp);
+
+	skb_flow_dissector_init(&head->dissector, keys, cnt);
+}
+
 static int fl_init(struct tcf_proto *tp)
 {
 	struct cls_fl_head *head;
@@ -151,12 +245,89 @@ static int fl_init(struct tcf_proto *tp)
 	if (!head)
 		return -ENOBUFS;
 
+	head->cache = alloc_percpu(struct fl_cache);
+	if (!head->cache) {
+		kfree(head);
+		return -ENOBUFS;
+	}
+
+	/* zeroed cache entries have generation 0, never a valid one */
+	head->gen = 1;
+	INIT_LIST_HEAD(&head->masks);
+	fl_init_dissector(head);
 	INIT_LIST_HEAD_RCU(&head->filters);
 	rcu_assign_pointer(tp->root, head);
 
 	return 0;
 }
 
+/* called with rtnl held, after any change to the filters */
+static void fl_cache_invalidate(struct cls_fl_head *head)
+{
+	u32 gen = head->gen + 1;
+
+	WRITE_ONCE(head->gen, gen ? : 1);
+}
+
+static void fl_mask_free_work(struct work_struct *work)
+{
+	struct fl_flow_mask *mask = container_of(work, struct fl_flow_mask,
+						 work);
+
+	rhashtable_destroy(&mask->ht);
+	kfree(mask);
+}
+
+static void fl_mask_free_rcu(struct rcu_head *rcu)
+{
+	struct fl_flow_mask *mask = container_of(rcu, struct fl_flow_mask, rcu);
+
+	/* rhashtable_destroy() may sleep */
+	INIT_WORK(&mask->work, fl_mask_free_work);
+	schedule_work(&mask->work);
+}
+
+/*
+ * Returns the mask of @head equal to @mask, or @mask itself turned into
+ * a new one of @head.  Either way, @mask is consumed.
+ */
+static struct fl_flow_mask *fl_mask_get(struct cls_fl_head *head,
+					struct fl_flow_mask *mask)
+{
+	struct fl_flow_mask *m;
+	int err;
+
+	list_for_each_entry(m, &head->masks, list) {
+		if (fl_mask_eq(m, mask)) {
+			m->refcnt++;
+			kfree(mask);
+			return m;
+		}
+	}
+
+	mask->ht_params = fl_ht_params;
+	mask->ht_params.key_len = fl_mask_range(mask);
+	mask->ht_params.key_offset += mask->range.start;
+	err = rhashtable_init(&mask->ht, &mask->ht_params);
+	if (err) {
+		kfree(mask);
+		return ERR_PTR(err);
+	}
+
+	mask->refcnt = 1;
+	list_add_tail_rcu(&mask->list, &head->masks);
+	return mask;
+}
+
+static void fl_mask_put(struct fl_flow_mask *mask)
+{
+	if (--mask->refcnt)
+		return;
+
+	list_del_rcu(&mask->list);
+	call_rcu(&mask->rcu, fl_mask_free_rcu);
+}
+
 static void fl_destroy_filter(struct rcu_head *head)
 {
 	struct cls_fl_filter *f = container_of(head, struct cls_fl_filter, rcu);
@@ -165,6 +336,14 @@ static void fl_destroy_filter(struct rcu_head *head)
 	kfree(f);
 }
 
+static void fl_destroy_head(struct rcu_head *rcu)
+{
+	struct cls_fl_head *head = container_of(rcu, struct cls_fl_head, rcu);
+
+	free_percpu(head->cache);
+	kfree(head);
+}
+
 static bool fl_destroy(struct tcf_proto *tp, bool force)
 {
 	struct cls_fl_head *head = rtnl_dereference(tp->root);
@@ -175,12 +354,11 @@ static bool fl_destroy(struct tcf_proto *tp, bool force)
 
 	list_for_each_entry_safe(f, next, &head->filters, list) {
 		list_del_rcu(&f->list);
+		fl_mask_put(f->mask);
 		call_rcu(&f->rcu, fl_destroy_filter);
 	}
 	RCU_INIT_POINTER(tp->root, NULL);
-	if (head->mask_assigned)
-		rhashtable_destroy(&head->ht);
-	kfree_rcu(head, rcu);
+	call_rcu(&head->rcu, fl_destroy_head);
 	return true;
 }
 
@@ -301,100 +479,6 @@ static int fl_set_key(struct net *net, struct nlattr **tb,
 	return 0;
 }
 
-static bool fl_mask_eq(struct fl_flow_mask *mask1,
-		       struct fl_flow_mask *mask2)
-{
-	const long *lmask1 = fl_key_get_start(&mask1->key, mask1);
-	const long *lmask2 = fl_key_get_start(&mask2->key, mask2);
-
-	return !memcmp(&mask1->range, &mask2->range, sizeof(mask1->range)) &&
-	       !memcmp(lmask1, lmask2, fl_mask_range(mask1));
-}
-
-static const struct rhashtable_params fl_ht_params = {
-	.key_offset = offsetof(struct cls_fl_filter, mkey), /* base offset */
-	.head_offset = offsetof(struct cls_fl_filter, ht_node),
-	.automatic_shrinking = true,
-};
-
-static int fl_init_hashtable(struct cls_fl_head *head,
-			     struct fl_flow_mask *mask)
-{
-	head->ht_params = fl_ht_params;
-	head->ht_params.key_len = fl_mask_range(mask);
-	head->ht_params.key_offset += mask->range.start;
-
-	return rhashtable_init(&head->ht, &head->ht_params);
-}
-
-#define FL_KEY_MEMBER_OFFSET(member) offsetof(struct fl_flow_key, member)
-#define FL_KEY_MEMBER_SIZE(member) (sizeof(((struct fl_flow_key *) 0)->member))
-#define FL_KEY_MEMBER_END_OFFSET(member)					\
-	(FL_KEY_MEMBER_OFFSET(member) + FL_KEY_MEMBER_SIZE(member))
-
-#define FL_KEY_IN_RANGE(mask, member)						\
-        (FL_KEY_MEMBER_OFFSET(member) <= (mask)->range.end &&			\
-         FL_KEY_MEMBER_END_OFFSET(member) >= (mask)->range.start)
-
-#define FL_KEY_SET(keys, cnt, id, member)					\
-	do {									\
-		keys[cnt].key_id = id;						\
-		keys[cnt].offset = FL_KEY_MEMBER_OFFSET(member);		\
-		cnt++;								\
-	} while(0);
-
-#define FL_KEY_SET_IF_IN_RANGE(mask, keys, cnt, id, member)			\
-	do {									\
-		if (FL_KEY_IN_RANGE(mask, member))				\
-			FL_KEY_SET(keys, cnt, id, member);			\
-	} while(0);
-
-static void fl_init_dissector(struct cls_fl_head *head,
-			      struct fl_flow_mask *mask)
-{
-	struct flow_dissector_key keys[FLOW_DISSECTOR_KEY_MAX];
-	size_t cnt = 0;
-
-	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_CONTROL, control);
-	FL_KEY_SET(keys, cnt, FLOW_DISSECTOR_KEY_BASIC, basic);
-	FL_KEY_SET_IF_IN_RANGE(mask, keys, cnt,
-			       FLOW_DISSECTOR_KEY_ETH_ADDRS, eth);
-	FL_KEY_SET_IF_IN_RANGE(mask, keys, cnt,
-			       FLOW_DISSECTOR_KEY_IPV4_ADDRS, ipv4);
-	FL_KEY_SET_IF_IN_RANGE(mask, keys, cnt,
-			       FLOW_DISSECTOR_KEY_IPV6_ADDRS, ipv6);
-	FL_KEY_SET_IF_IN_RANGE(mask, keys, cnt,
-			       FLOW_DISSECTOR_KEY_PORTS, tp);
-
-	skb_flow_dissector_init(&head->dissector, keys, cnt);
-}
-
-static int fl_check_assign_mask(struct cls_fl_head *head,
-				struct fl_flow_mask *mask)
-{
-	int err;
-
-	if (head->mask_assigned) {
-		if (!fl_mask_eq(&head->mask, mask))
-			return -EINVAL;
-		else
-			return 0;
-	}
-
-	/* Mask is not assigned yet. So assign it and init hashtable
-	 * according to that.
-	 */
-	err = fl_init_hashtable(head, mask);
-	if (err)
-		return err;
-	memcpy(&head->mask, mask, sizeof(head->mask));
-	head->mask_assigned = true;
-
-	fl_init_dissector(head, mask);
-
-	return 0;
-}
-
 static int fl_set_parms(struct net *net, struct tcf_proto *tp,
 			struct cls_fl_filter *f, struct fl_flow_mask *mask,
 			unsigned long base, struct nlattr **tb,
@@ -458,7 +542,7 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 	struct cls_fl_filter *fold = (struct cls_fl_filter *) *arg;
 	struct cls_fl_filter *fnew;
 	struct nlattr *tb[TCA_FLOWER_MAX + 1];
-	struct fl_flow_mask mask = {};
+	struct fl_flow_mask *mask;
 	int err;
 
 	if (!tca[TCA_OPTIONS])
@@ -475,6 +559,12 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 	if (!fnew)
 		return -ENOBUFS;
 
+	mask = kzalloc(sizeof(*mask), GFP_KERNEL);
+	if (!mask) {
+		kfree(fnew);
+		return -ENOBUFS;
+	}
+
 	tcf_exts_init(&fnew->exts, TCA_FLOWER_ACT, 0);
 
 	if (!handle) {
@@ -486,35 +576,43 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 	}
 	fnew->handle = handle;
 
-	err = fl_set_parms(net, tp, fnew, &mask, base, tb, tca[TCA_RATE], ovr);
+	err = fl_set_parms(net, tp, fnew, mask, base, tb, tca[TCA_RATE], ovr);
 	if (err)
 		goto errout;
 
-	err = fl_check_assign_mask(head, &mask);
-	if (err)
+	fnew->mask = fl_mask_get(head, mask);
+	mask = NULL;
+	if (IS_ERR(fnew->mask)) {
+		err = PTR_ERR(fnew->mask);
 		goto errout;
+	}
 
-	err = rhashtable_insert_fast(&head->ht, &fnew->ht_node,
-				     head->ht_params);
-	if (err)
+	err = rhashtable_insert_fast(&fnew->mask->ht, &fnew->ht_node,
+				     fnew->mask->ht_params);
+	if (err) {
+		fl_mask_put(fnew->mask);
 		goto errout;
+	}
 	if (fold)
-		rhashtable_remove_fast(&head->ht, &fold->ht_node,
-				       head->ht_params);
+		rhashtable_remove_fast(&fold->mask->ht, &fold->ht_node,
+				       fold->mask->ht_params);
 
 	*arg = (unsigned long) fnew;
 
 	if (fold) {
 		list_replace_rcu(&fold->list, &fnew->list);
 		tcf_unbind_filter(tp, &fold->res);
+		fl_mask_put(fold->mask);
 		call_rcu(&fold->rcu, fl_destroy_filter);
 	} else {
 		list_add_tail_rcu(&fnew->list, &head->filters);
 	}
+	fl_cache_invalidate(head);
 
 	return 0;
 
 errout:
+	kfree(mask);
 	kfree(fnew);
 	return err;
 }
@@ -524,10 +622,12 @@ static int fl_delete(struct tcf_proto *tp, unsigned long arg)
 	struct cls_fl_head *head = rtnl_dereference(tp->root);
 	struct cls_fl_filter *f = (struct cls_fl_filter *) arg;
 
-	rhashtable_remove_fast(&head->ht, &f->ht_node,
-			       head->ht_params);
+	rhashtable_remove_fast(&f->mask->ht, &f->ht_node,
+			       f->mask->ht_params);
 	list_del_rcu(&f->list);
 	tcf_unbind_filter(tp, &f->res);
+	fl_mask_put(f->mask);
+	fl_cache_invalidate(head);
 	call_rcu(&f->rcu, fl_destroy_filter);
 	return 0;
 }
@@ -571,7 +671,6 @@ static int fl_dump_key_val(struct sk_buff *skb,
 static int fl_dump(struct net *net, struct tcf_proto *tp, unsigned long fh,
 		   struct sk_buff *skb, struct tcmsg *t)
 {
-	struct cls_fl_head *head = rtnl_dereference(tp->root);
 	struct cls_fl_filter *f = (struct cls_fl_filter *) fh;
 	struct nlattr *nest;
 	struct fl_flow_key *key, *mask;
@@ -590,7 +689,7 @@ static int fl_dump(struct net *net, struct tcf_proto *tp, unsigned long fh,
 		goto nla_put_failure;
 
 	key = &f->key;
-	mask = &head->mask.key;
+	mask = &f->mask->key;
 
 	if (mask->indev_ifindex) {
 		struct net_device *dev;
@@ -687,6 +786,9 @@ static int __init cls_fl_init(void)
 static void __exit cls_fl_exit(void)
 {
 	unregister_tcf_proto_ops(&cls_fl_ops);
+	/* masks go away from RCU callbacks and then a work item */
+	rcu_barrier();
+	flush_scheduled_work();
 }
 
 module_init(cls_fl_init);
@@ -29,6 +29,8 @@
  *   - Use a special fifo for high prio packets
  *
  *  dequeue() : serves flows in Round Robin
+ *  Flows waiting for their next transmit time are kept in a calendar
+ *  queue (q->wheel), so that throttling and releasing them is O(1).
  *  Note : When a flow becomes empty, we do not immediately remove it from
  *  rb trees, for performance reasons (its expected to send additional packets,
  *  or SLAB cache will reuse socket for another flow)
@@ -45,6 +47,7 @@
 #include <linux/skbuff.h>
 #include <linux/slab.h>
 #include <linux/rbtree.h>
+#include <linux/bitops.h>
 #include <linux/hash.h>
 #include <linux/prefetch.h>
 #include <linux/vmalloc.h>
@@ -70,10 +73,27 @@ struct fq_flow {
 	u32		socket_hash;	/* sk_hash */
 	struct fq_flow *next;		/* next pointer in RR lists, or &detached */
 
-	struct rb_node  rate_node;	/* anchor in q->delayed tree */
+	struct hlist_node wheel_node;	/* anchor in q->wheel slot */
 	u64		time_next_packet;
 };
 
+/*
+ * Calendar queue of throttled flows: slot (t >> FQ_WHEEL_GRAN_LOG) &
+ * (FQ_WHEEL_SLOTS - 1) holds the flows due in the 131 us starting at t.
+ * The wheel spans a bit more than the one second fq_dequeue() clamps
+ * delays to, so no flow is ever more than one turn ahead.
+ */
+#define FQ_WHEEL_GRAN_LOG	17
+#define FQ_WHEEL_BITS		13
+#define FQ_WHEEL_SLOTS		(1U << FQ_WHEEL_BITS)
+#define FQ_WHEEL_MASK		(FQ_WHEEL_SLOTS - 1)
+
+struct fq_wheel {
+	u64		time;	/* slots before this one are empty */
+	unsigned long	map[BITS_TO_LONGS(FQ_WHEEL_SLOTS)];
+	struct hlist_head slot[FQ_WHEEL_SLOTS];
+};
+
 struct fq_flow_head {
 	struct fq_flow *first;
 	struct fq_flow *last;
@@ -84,7 +104,7 @@ struct fq_sched_data {
 
 	struct fq_flow_head old_flows;
 
-	struct rb_root	delayed;	/* for rate limited flows */
+	struct fq_wheel	*wheel;		/* for rate limited flows */
 	u64		time_next_delayed_flow;
 
 	struct fq_flow	internal;	/* for non classified or high prio packets */
@@ -128,20 +148,12 @@ static bool fq_flow_is_detached(const struct fq_flow *f)
 
 static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
 {
-	struct rb_node **p = &q->delayed.rb_node, *parent = NULL;
-
-	while (*p) {
-		struct fq_flow *aux;
+	struct fq_wheel *w = q->wheel;
+	unsigned int idx;
 
-		parent = *p;
-		aux = container_of(parent, struct fq_flow, rate_node);
-		if (f->time_next_packet >= aux->time_next_packet)
-			p = &parent->rb_right;
-		else
-			p = &parent->rb_left;
-	}
-	rb_link_node(&f->rate_node, parent, p);
-	rb_insert_color(&f->rate_node, &q->delayed);
+	idx = (f->time_next_packet >> FQ_WHEEL_GRAN_LOG) & FQ_WHEEL_MASK;
+	hlist_add_head(&f->wheel_node, &w->slot[idx]);
+	__set_bit(idx, w->map);
 	q->throttled_flows++;
 	q->stat_throttled++;
 
@@ -404,25 +416,76 @@ static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch)
 	return NET_XMIT_SUCCESS;
 }
 
+/* first busy slot at or after @idx, going round; FQ_WHEEL_SLOTS if none */
+static unsigned int fq_wheel_next(const struct fq_wheel *w, unsigned int idx)
+{
+	unsigned int next = find_next_bit(w->map, FQ_WHEEL_SLOTS, idx);
+
+	if (next >= FQ_WHEEL_SLOTS)
+		next = find_first_bit(w->map, FQ_WHEEL_SLOTS);
+	return next;
+}
+
+/* the slot the current time is in may hold flows not due yet */
+static void fq_wheel_release(struct fq_sched_data *q, unsigned int idx,
+			     u64 now)
+{
+	struct fq_wheel *w = q->wheel;
+	struct hlist_node *tmp;
+	struct fq_flow *f;
+
+	hlist_for_each_entry_safe(f, tmp, &w->slot[idx], wheel_node) {
+		if (f->time_next_packet > now)
+			continue;
+		hlist_del(&f->wheel_node);
+		q->throttled_flows--;
+		fq_flow_add_tail(&q->old_flows, f);
+	}
+	if (hlist_empty(&w->slot[idx]))
+		__clear_bit(idx, w->map);
+}
+
 static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 {
-	struct rb_node *p;
+	struct fq_wheel *w = q->wheel;
+	u64 now_slot = now >> FQ_WHEEL_GRAN_LOG;
+	unsigned int start, idx, next;
+	struct fq_flow *f;
+	u64 d, n;
 
 	if (q->time_next_delayed_flow > now)
 		return;
 
-	q->time_next_delayed_flow = ~0ULL;
-	while ((p = rb_first(&q->delayed)) != NULL) {
-		struct fq_flow *f = container_of(p, struct fq_flow, rate_node);
-
-		if (f->time_next_packet > now) {
-			q->time_next_delayed_flow = f->time_next_packet;
-			break;
+	/* visit the busy slots between the last visit and now, at most
+	 * one whole turn if we've been idle for longer than that
+	 */
+	n = min_t(u64, now_slot - w->time, FQ_WHEEL_MASK);
+	start = w->time & FQ_WHEEL_MASK;
+	for (d = 0; d <= n; d++) {
+		idx = (start + d) & FQ_WHEEL_MASK;
+		next = find_next_bit(w->map, FQ_WHEEL_SLOTS, idx);
+		if (next >= FQ_WHEEL_SLOTS) {
+			next = find_first_bit(w->map, FQ_WHEEL_SLOTS);
+			if (next >= FQ_WHEEL_SLOTS)
+				break;
+			d += FQ_WHEEL_SLOTS - idx + next;
+		} else {
+			d += next - idx;
 		}
-		rb_erase(p, &q->delayed);
-		q->throttled_flows--;
-		fq_flow_add_tail(&q->old_flows, f);
+		if (d > n)
+			break;
+		fq_wheel_release(q, next, now);
 	}
+	w->time = now_slot;
+
+	/* what's left is due from now on, the next busy slot first */
+	q->time_next_delayed_flow = ~0ULL;
+	if (!q->throttled_flows)
+		return;
+	idx = fq_wheel_next(w, now_slot & FQ_WHEEL_MASK);
+	hlist_for_each_entry(f, &w->slot[idx], wheel_node)
+		if (q->time_next_delayed_flow > f->time_next_packet)
+			q->time_next_delayed_flow = f->time_next_packet;
 }
 
 static struct sk_buff *fq_dequeue(struct Qdisc *sch)
@@ -544,7 +607,7 @@ static void fq_reset(struct Qdisc *sch)
 	}
 	q->new_flows.first	= NULL;
 	q->old_flows.first	= NULL;
-	q->delayed		= RB_ROOT;
+	memset(q->wheel, 0, sizeof(*q->wheel));
 	q->flows		= 0;
 	q->inactive_flows	= 0;
 	q->throttled_flows	= 0;
@@ -753,6 +816,7 @@ static void fq_destroy(struct Qdisc *sch)
 
 	fq_reset(sch);
 	fq_free(q->fq_root);
+	fq_free(q->wheel);
 	qdisc_watchdog_cancel(&q->watchdog);
 }
 
@@ -770,17 +834,30 @@ static int fq_init(struct Qdisc *sch, struct nlattr *opt)
 	q->rate_enable		= 1;
 	q->new_flows.first	= NULL;
 	q->old_flows.first	= NULL;
-	q->delayed		= RB_ROOT;
 	q->fq_root		= NULL;
 	q->fq_trees_log		= ilog2(1024);
 	q->orphan_mask		= 1024 - 1;
+	q->time_next_delayed_flow = ~0ULL;
 	qdisc_watchdog_init(&q->watchdog, sch);
 
+	q->wheel = fq_alloc_node(sizeof(*q->wheel),
+				 netdev_queue_numa_node_read(sch->dev_queue));
+	if (!q->wheel)
+		return -ENOMEM;
+	memset(q->wheel, 0, sizeof(*q->wheel));
+
 	if (opt)
 		err = fq_change(sch, opt);
 	else
 		err = fq_resize(sch, q->fq_trees_log);
 
+	/* ->destroy() isn't called if ->init() fails */
+	if (err) {
+		fq_free(q->fq_root);
+		q->fq_root = NULL;
+		fq_free(q->wheel);
+		q->wheel = NULL;
+	}
 	return err;
 }
 
@@ -37,6 +37,7 @@
 #include <linux/sunrpc/rpc_pipe_fs.h>
 #include <linux/sunrpc/metrics.h>
 #include <linux/sunrpc/bc_xprt.h>
+#include <linux/sunrpc/xprtmultipath.h>
 #include <trace/events/sunrpc.h>
 
 #include "sunrpc.h"
@@ -476,6 +477,54 @@ struct rpc_clnt *rpc_create_xprt(struct rpc_create_args *args,
 }
 EXPORT_SYMBOL_GPL(rpc_create_xprt);
 
+/*
+ * Open nconnect - 1 more transports like the first one and spread the
+ * client's RPCs over all of them.  Whatever couldn't be set up is done
+ * without, as the client works with the first transport alone.
+ */
+static void rpc_clnt_add_xprts(struct rpc_clnt *clnt,
+			       struct xprt_create *xprtargs,
+			       const struct rpc_create_args *args)
+{
+	unsigned int i, nconnect = min_t(unsigned int, args->nconnect,
+					 RPC_MAX_NCONNECT);
+	struct rpc_xprt_switch *xps;
+	struct rpc_xprt *xprt;
+
+	xps = xprt_switch_alloc(nconnect, GFP_KERNEL);
+	if (xps == NULL)
+		return;
+
+	rcu_read_lock();
+	xprt = xprt_get(rcu_dereference(clnt->cl_xprt));
+	rcu_read_unlock();
+	if (xprt == NULL)
+		goto out_put;
+	xprt_switch_add_xprt(xps, xprt);
+
+	for (i = 1; i < nconnect; i++) {
+		xprt = xprt_create_transport(xprtargs);
+		if (IS_ERR(xprt)) {
+			dprintk("RPC:       %s: only %u of %u transports\n",
+					__func__, i, nconnect);
+			break;
+		}
+		xprt->resvport = 1;
+		if (args->flags & RPC_CLNT_CREATE_NONPRIVPORT)
+			xprt->resvport = 0;
+		xprt_switch_add_xprt(xps, xprt);
+	}
+
+	if (xps->xps_nxprts > 1) {
+		spin_lock(&clnt->cl_lock);
+		clnt->cl_xpswitch = xps;
+		spin_unlock(&clnt->cl_lock);
+		return;
+	}
+out_put:
+	xprt_switch_put(xps);
+}
+
 /**
  * rpc_create - create an RPC client and transport with one call
  * @args: rpc_clnt create argument structure
@@ -488,6 +537,7 @@ EXPORT_SYMBOL_GPL(rpc_create_xprt);
  */
 struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 {
+	struct rpc_clnt *clnt;
 	struct rpc_xprt *xprt;
 	struct xprt_create xprtargs = {
 		.net = args->net,
@@ -552,7 +602,10 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 	if (args->flags & RPC_CLNT_CREATE_NONPRIVPORT)
 		xprt->resvport = 0;
 
-	return rpc_create_xprt(args, xprt);
+	clnt = rpc_create_xprt(args, xprt);
+	if (!IS_ERR(clnt) && args->nconnect > 1)
+		rpc_clnt_add_xprts(clnt, &xprtargs, args);
+	return clnt;
 }
 EXPORT_SYMBOL_GPL(rpc_create);
 
@@ -583,6 +636,12 @@ static struct rpc_clnt *__rpc_clone_client(struct rpc_create_args *args,
 		goto out_err;
 	}
 
+	/* Clones share the transports of their parent */
+	spin_lock(&clnt->cl_lock);
+	if (clnt->cl_xpswitch && clnt->cl_xpswitch->xps_xprt[0] == xprt)
+		new->cl_xpswitch = xprt_switch_get(clnt->cl_xpswitch);
+	spin_unlock(&clnt->cl_lock);
+
 	/* Turn off autobind on clones */
 	new->cl_autobind = 0;
 	new->cl_softrtry = clnt->cl_softrtry;
@@ -657,6 +716,7 @@ int rpc_switch_client_transport(struct rpc_clnt *clnt,
 {
 	const struct rpc_timeout *old_timeo;
 	rpc_authflavor_t pseudoflavor;
+	struct rpc_xprt_switch *xps;
 	struct rpc_xprt *xprt, *old;
 	struct rpc_clnt *parent;
 	int err;
@@ -694,9 +754,16 @@ int rpc_switch_client_transport(struct rpc_clnt *clnt,
 	if (err)
 		goto out_revert;
 
+	/* The other transports lead to the server we're leaving */
+	spin_lock(&clnt->cl_lock);
+	xps = clnt->cl_xpswitch;
+	clnt->cl_xpswitch = NULL;
+	spin_unlock(&clnt->cl_lock);
+
 	synchronize_rcu();
 	if (parent != clnt)
 		rpc_release_client(parent);
+	xprt_switch_put(xps);
 	xprt_put(old);
 	dprintk("RPC:       replaced xprt for clnt %p\n", clnt);
 	return 0;
@@ -782,6 +849,7 @@ rpc_free_client(struct rpc_clnt *clnt)
 	rpc_unregister_client(clnt);
 	rpc_free_iostats(clnt->cl_metrics);
 	clnt->cl_metrics = NULL;
+	xprt_switch_put(clnt->cl_xpswitch);
 	xprt_put(rcu_dereference_raw(clnt->cl_xprt));
 	rpciod_down();
 	rpc_free_clid(clnt);
@@ -876,10 +944,23 @@ void rpc_task_release_client(struct rpc_task *task)
 		spin_unlock(&clnt->cl_lock);
 		task->tk_client = NULL;
 
+		if (task->tk_xprt) {
+			xprt_put(task->tk_xprt);
+			task->tk_xprt = NULL;
+		}
 		rpc_release_client(clnt);
 	}
 }
 
+/* Pick the transport for a new task, with ->cl_lock held */
+static struct rpc_xprt *rpc_task_get_xprt(struct rpc_clnt *clnt)
+{
+	if (clnt->cl_xpswitch)
+		return xprt_switch_get_next(clnt->cl_xpswitch);
+	return xprt_get(rcu_dereference_protected(clnt->cl_xprt,
+				lockdep_is_held(&clnt->cl_lock)));
+}
+
 static
 void rpc_task_set_client(struct rpc_task *task, struct rpc_clnt *clnt)
 {
@@ -896,6 +977,7 @@ void rpc_task_set_client(struct rpc_task *task, struct rpc_clnt *clnt)
 		/* Add to the client's list of all tasks */
 		spin_lock(&clnt->cl_lock);
 		list_add_tail(&task->tk_task, &clnt->cl_tasks);
+		task->tk_xprt = rpc_task_get_xprt(clnt);
 		spin_unlock(&clnt->cl_lock);
 	}
 }
@@ -1355,10 +1437,19 @@ EXPORT_SYMBOL_GPL(rpc_get_timeout);
  */
 void rpc_force_rebind(struct rpc_clnt *clnt)
 {
+	struct rpc_xprt_switch *xps;
+	unsigned int i;
+
 	if (clnt->cl_autobind) {
 		rcu_read_lock();
 		xprt_clear_bound(rcu_dereference(clnt->cl_xprt));
 		rcu_read_unlock();
+
+		spin_lock(&clnt->cl_lock);
+		xps = clnt->cl_xpswitch;
+		for (i = 0; xps && i < xps->xps_nxprts; i++)
+			xprt_clear_bound(xps->xps_xprt[i]);
+		spin_unlock(&clnt->cl_lock);
 	}
 }
 EXPORT_SYMBOL_GPL(rpc_force_rebind);
@@ -22,6 +22,7 @@
 #include <linux/sunrpc/clnt.h>
 #include <linux/sunrpc/svcsock.h>
 #include <linux/sunrpc/metrics.h>
+#include <linux/sunrpc/xprtmultipath.h>
 #include <linux/rcupdate.h>
 
 #include "netns.h"
@@ -203,8 +204,9 @@ static void _print_name(struct seq_file *seq, unsigned int op,
 void rpc_print_iostats(struct seq_file *seq, struct rpc_clnt *clnt)
 {
 	struct rpc_iostats *stats = clnt->cl_metrics;
+	struct rpc_xprt_switch *xps;
 	struct rpc_xprt *xprt;
-	unsigned int op, maxproc = clnt->cl_maxproc;
+	unsigned int i, op, maxproc = clnt->cl_maxproc;
 
 	if (!stats)
 		return;
@@ -213,11 +215,21 @@ void rpc_print_iostats(struct seq_file *seq, struct rpc_clnt *clnt)
 	seq_printf(seq, "p/v: %u/%u (%s)\n",
 			clnt->cl_prog, clnt->cl_vers, clnt->cl_program->name);
 
-	rcu_read_lock();
-	xprt = rcu_dereference(clnt->cl_xprt);
-	if (xprt)
-		xprt->ops->print_stats(xprt, seq);
-	rcu_read_unlock();
+	/* one "xprt:" line per transport */
+	spin_lock(&clnt->cl_lock);
+	xps = clnt->cl_xpswitch;
+	if (xps) {
+		for (i = 0; i < xps->xps_nxprts; i++) {
+			xprt = xps->xps_xprt[i];
+			xprt->ops->print_stats(xprt, seq);
+		}
+	} else {
+		xprt = rcu_dereference_protected(clnt->cl_xprt,
+				lockdep_is_held(&clnt->cl_lock));
+		if (xprt)
+			xprt->ops->print_stats(xprt, seq);
+	}
+	spin_unlock(&clnt->cl_lock);
 
 	seq_printf(seq, "\tper-op statistics\n");
 	for (op = 0; op < maxproc; op++) {
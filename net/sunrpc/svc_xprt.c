@@ -323,7 +323,7 @@ void svc_xprt_do_enqueue(struct svc_xprt *xprt)
 {
 	struct svc_pool *pool;
 	struct svc_rqst	*rqstp = NULL;
-	int cpu;
+	int cpu, pass;
 	bool queued = false;
 
 	if (!svc_xprt_has_something_to_do(xprt))
@@ -346,12 +346,19 @@ void svc_xprt_do_enqueue(struct svc_xprt *xprt)
 	atomic_long_inc(&pool->sp_stats.packets);
 
 redo_search:
-	/* find a thread for this xprt */
+	/*
+	 * find a thread for this xprt, preferably one that last ran on this
+	 * CPU: waking it up needs no IPI and it finds its cache warm.
+	 */
+	pass = 0;
 	rcu_read_lock();
+search_pass:
 	list_for_each_entry_rcu(rqstp, &pool->sp_all_threads, rq_all) {
 		/* Do a lockless check first */
 		if (test_bit(RQ_BUSY, &rqstp->rq_flags))
 			continue;
+		if (pass == 0 && task_cpu(rqstp->rq_task) != cpu)
+			continue;
 
 		/*
 		 * Once the xprt has been queued, it can only be dequeued by
@@ -379,6 +386,8 @@ redo_search:
 		put_cpu();
 		goto out;
 	}
+	if (pass++ == 0)
+		goto search_pass;
 	rcu_read_unlock();
 
 	/*
@@ -0,0 +1,74 @@
+/*
+ * linux/net/sunrpc/xprtmultipath.c
+ *
+ * Round-robin over several transports to the same server.  The switch is
+ * shared by an RPC client and its clones; each task is given one of its
+ * transports when it is bound to the client, and keeps it until it is
+ * released, retransmissions included.
+ */
+
+#include <linux/slab.h>
+#include <linux/sunrpc/xprtmultipath.h>
+
+/**
+ * xprt_switch_alloc - allocate an empty transport switch
+ * @nxprts: how many transports it may hold
+ * @gfp: allocation flags
+ *
+ */
+struct rpc_xprt_switch *xprt_switch_alloc(unsigned int nxprts, gfp_t gfp)
+{
+	struct rpc_xprt_switch *xps;
+
+	xps = kzalloc(sizeof(*xps) + nxprts * sizeof(struct rpc_xprt *), gfp);
+	if (xps)
+		kref_init(&xps->xps_kref);
+	return xps;
+}
+
+/**
+ * xprt_switch_add_xprt - add a transport to a switch being set up
+ * @xps: the switch, not visible to any task yet
+ * @xprt: transport, whose reference is handed over to @xps
+ *
+ */
+void xprt_switch_add_xprt(struct rpc_xprt_switch *xps, struct rpc_xprt *xprt)
+{
+	xps->xps_xprt[xps->xps_nxprts++] = xprt;
+}
+
+/**
+ * xprt_switch_get_next - pick the next transport of a switch
+ * @xps: the switch
+ *
+ * Returns a reference to the transport.  The caller holds a reference
+ * to @xps.
+ */
+struct rpc_xprt *xprt_switch_get_next(struct rpc_xprt_switch *xps)
+{
+	unsigned int n = atomic_inc_return(&xps->xps_next);
+
+	return xprt_get(xps->xps_xprt[n % xps->xps_nxprts]);
+}
+
+static void xprt_switch_free(struct kref *kref)
+{
+	struct rpc_xprt_switch *xps = container_of(kref,
+			struct rpc_xprt_switch, xps_kref);
+	unsigned int i;
+
+	for (i = 0; i < xps->xps_nxprts; i++)
+		xprt_put(xps->xps_xprt[i]);
+	kfree(xps);
+}
+
+/**
+ * xprt_switch_put - release a reference to a transport switch
+ * @xps: the switch, or NULL
+ *
+ */
+void xprt_switch_put(struct rpc_xprt_switch *xps)
+{
+	if (xps)
+		kref_put(&xps->xps_kref, xprt_switch_free);
+}
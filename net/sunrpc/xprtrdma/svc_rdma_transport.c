@@ -71,9 +71,8 @@ static int svc_rdma_secure_port(struct svc_rqst *);
 static void rq_cq_reap(struct svcxprt_rdma *xprt);
 static void sq_cq_reap(struct svcxprt_rdma *xprt);
 
-static DECLARE_TASKLET(dto_tasklet, dto_tasklet_func, 0UL);
-static DEFINE_SPINLOCK(dto_lock);
-static LIST_HEAD(dto_xprt_q);
+/* spreads the transports' CQs over the device's completion vectors */
+static atomic_t svc_rdma_comp_vector = ATOMIC_INIT(0);
 
 static struct svc_xprt_ops svc_rdma_ops = {
 	.xpo_create = svc_rdma_create,
@@ -264,31 +263,35 @@ static void qp_event_handler(struct ib_event *event, void *context)
 /*
  * Data Transfer Operation Tasklet
  *
- * Walks a list of transports with I/O pending, removing entries as
- * they are added to the server's I/O pending list. Two bits indicate
- * if SQ, RQ, or both have I/O pending. The dto_lock is an irqsave
- * spinlock that serializes access to the transport list with the RQ
- * and SQ interrupt handlers.
+ * Each transport has a tasklet of its own, so completions on different
+ * transports are reaped on whichever CPUs took their interrupts rather
+ * than all being funnelled through one list and one CPU. Two bits
+ * indicate if SQ, RQ, or both have I/O pending; RDMAXPRT_DTO_QUEUED
+ * tells the completion handlers whether the tasklet already holds a
+ * transport reference for a pass that hasn't started yet.
  */
 static void dto_tasklet_func(unsigned long data)
 {
-	struct svcxprt_rdma *xprt;
-	unsigned long flags;
+	struct svcxprt_rdma *xprt = (struct svcxprt_rdma *)data;
 
-	spin_lock_irqsave(&dto_lock, flags);
-	while (!list_empty(&dto_xprt_q)) {
-		xprt = list_entry(dto_xprt_q.next,
-				  struct svcxprt_rdma, sc_dto_q);
-		list_del_init(&xprt->sc_dto_q);
-		spin_unlock_irqrestore(&dto_lock, flags);
+	/* completions from here on schedule another pass */
+	clear_bit(RDMAXPRT_DTO_QUEUED, &xprt->sc_flags);
+	smp_mb__after_atomic();
 
-		rq_cq_reap(xprt);
-		sq_cq_reap(xprt);
+	rq_cq_reap(xprt);
+	sq_cq_reap(xprt);
 
-		svc_xprt_put(&xprt->sc_xprt);
-		spin_lock_irqsave(&dto_lock, flags);
-	}
-	spin_unlock_irqrestore(&dto_lock, flags);
+	svc_xprt_put(&xprt->sc_xprt);
+}
+
+static void svc_rdma_schedule_dto(struct svcxprt_rdma *xprt)
+{
+	if (test_and_set_bit(RDMAXPRT_DTO_QUEUED, &xprt->sc_flags))
+		return;
+
+	svc_xprt_get(&xprt->sc_xprt);
+	/* Tasklet does all the work to avoid irqsave locks. */
+	tasklet_schedule(&xprt->sc_dto_tasklet);
 }
 
 /*
@@ -300,32 +303,18 @@ static void dto_tasklet_func(unsigned long data)
 static void rq_comp_handler(struct ib_cq *cq, void *cq_context)
 {
 	struct svcxprt_rdma *xprt = cq_context;
-	unsigned long flags;
 
 	/* Guard against unconditional flush call for destroyed QP */
 	if (atomic_read(&xprt->sc_xprt.xpt_ref.refcount)==0)
 		return;
 
 	/*
-	 * Set the bit regardless of whether or not it's on the list
-	 * because it may be on the list already due to an SQ
+	 * Set the bit regardless of whether or not the tasklet is
+	 * scheduled because it may be already due to an SQ
 	 * completion.
 	 */
 	set_bit(RDMAXPRT_RQ_PENDING, &xprt->sc_flags);
-
-	/*
-	 * If this transport is not already on the DTO transport queue,
-	 * add it
-	 */
-	spin_lock_irqsave(&dto_lock, flags);
-	if (list_empty(&xprt->sc_dto_q)) {
-		svc_xprt_get(&xprt->sc_xprt);
-		list_add_tail(&xprt->sc_dto_q, &dto_xprt_q);
-	}
-	spin_unlock_irqrestore(&dto_lock, flags);
-
-	/* Tasklet does all the work to avoid irqsave locks. */
-	tasklet_schedule(&dto_tasklet);
+	svc_rdma_schedule_dto(xprt);
 }
 
 /*
@@ -338,9 +327,11 @@ static void rq_comp_handler(struct ib_cq *cq, void *cq_context)
  */
 static void rq_cq_reap(struct svcxprt_rdma *xprt)
 {
-	int ret;
-	struct ib_wc wc;
+	int ret, i;
+	struct ib_wc wc_a[6];
+	struct ib_wc *wc;
 	struct svc_rdma_op_ctxt *ctxt = NULL;
+	LIST_HEAD(ready);
 
 	if (!test_and_clear_bit(RDMAXPRT_RQ_PENDING, &xprt->sc_flags))
 		return;
@@ -348,23 +339,33 @@ static void rq_cq_reap(struct svcxprt_rdma *xprt)
 	ib_req_notify_cq(xprt->sc_rq_cq, IB_CQ_NEXT_COMP);
 	atomic_inc(&rdma_stat_rq_poll);
 
-	while ((ret = ib_poll_cq(xprt->sc_rq_cq, 1, &wc)) > 0) {
-		ctxt = (struct svc_rdma_op_ctxt *)(unsigned long)wc.wr_id;
-		ctxt->wc_status = wc.status;
-		ctxt->byte_len = wc.byte_len;
-		svc_rdma_unmap_dma(ctxt);
-		if (wc.status != IB_WC_SUCCESS) {
-			/* Close the transport */
-			dprintk("svcrdma: transport closing putting ctxt %p\n", ctxt);
-			set_bit(XPT_CLOSE, &xprt->sc_xprt.xpt_flags);
-			svc_rdma_put_context(ctxt, 1);
-			svc_xprt_put(&xprt->sc_xprt);
-			continue;
+	while ((ret = ib_poll_cq(xprt->sc_rq_cq, ARRAY_SIZE(wc_a),
+				 wc_a)) > 0) {
+		for (i = 0; i < ret; i++) {
+			wc = &wc_a[i];
+			ctxt = (struct svc_rdma_op_ctxt *)(unsigned long)wc->wr_id;
+			ctxt->wc_status = wc->status;
+			ctxt->byte_len = wc->byte_len;
+			svc_rdma_unmap_dma(ctxt);
+			if (wc->status != IB_WC_SUCCESS) {
+				/* Close the transport */
+				dprintk("svcrdma: transport closing putting ctxt %p\n",
+					ctxt);
+				set_bit(XPT_CLOSE, &xprt->sc_xprt.xpt_flags);
+				svc_rdma_put_context(ctxt, 1);
+				svc_xprt_put(&xprt->sc_xprt);
+				continue;
+			}
+			list_add_tail(&ctxt->dto_q, &ready);
 		}
+
+		/* one trip through the lock for the whole batch */
 		spin_lock_bh(&xprt->sc_rq_dto_lock);
-		list_add_tail(&ctxt->dto_q, &xprt->sc_rq_dto_q);
+		list_splice_tail_init(&ready, &xprt->sc_rq_dto_q);
 		spin_unlock_bh(&xprt->sc_rq_dto_lock);
-		svc_xprt_put(&xprt->sc_xprt);
+		for (i = 0; i < ret; i++)
+			if (wc_a[i].status == IB_WC_SUCCESS)
+				svc_xprt_put(&xprt->sc_xprt);
 	}
 
 	if (ctxt)
@@ -482,32 +483,18 @@ static void sq_cq_reap(struct svcxprt_rdma *xprt)
 static void sq_comp_handler(struct ib_cq *cq, void *cq_context)
 {
 	struct svcxprt_rdma *xprt = cq_context;
-	unsigned long flags;
 
 	/* Guard against unconditional flush call for destroyed QP */
 	if (atomic_read(&xprt->sc_xprt.xpt_ref.refcount)==0)
 		return;
 
 	/*
-	 * Set the bit regardless of whether or not it's on the list
-	 * because it may be on the list already due to an RQ
+	 * Set the bit regardless of whether or not the tasklet is
+	 * scheduled because it may be already due to an RQ
 	 * completion.
 	 */
 	set_bit(RDMAXPRT_SQ_PENDING, &xprt->sc_flags);
-
-	/*
-	 * If this transport is not already on the DTO transport queue,
-	 * add it
-	 */
-	spin_lock_irqsave(&dto_lock, flags);
-	if (list_empty(&xprt->sc_dto_q)) {
-		svc_xprt_get(&xprt->sc_xprt);
-		list_add_tail(&xprt->sc_dto_q, &dto_xprt_q);
-	}
-	spin_unlock_irqrestore(&dto_lock, flags);
-
-	/* Tasklet does all the work to avoid irqsave locks. */
-	tasklet_schedule(&dto_tasklet);
+	svc_rdma_schedule_dto(xprt);
 }
 
 static struct svcxprt_rdma *rdma_create_xprt(struct svc_serv *serv,
@@ -519,7 +506,6 @@ static struct svcxprt_rdma *rdma_create_xprt(struct svc_serv *serv,
 		return NULL;
 	svc_xprt_init(&init_net, &svc_rdma_class, &cma_xprt->sc_xprt, serv);
 	INIT_LIST_HEAD(&cma_xprt->sc_accept_q);
-	INIT_LIST_HEAD(&cma_xprt->sc_dto_q);
 	INIT_LIST_HEAD(&cma_xprt->sc_rq_dto_q);
 	INIT_LIST_HEAD(&cma_xprt->sc_read_complete_q);
 	INIT_LIST_HEAD(&cma_xprt->sc_frmr_q);
@@ -528,6 +514,8 @@ static struct svcxprt_rdma *rdma_create_xprt(struct svc_serv *serv,
 	spin_lock_init(&cma_xprt->sc_lock);
 	spin_lock_init(&cma_xprt->sc_rq_dto_lock);
 	spin_lock_init(&cma_xprt->sc_frmr_q_lock);
+	tasklet_init(&cma_xprt->sc_dto_tasklet, dto_tasklet_func,
+		     (unsigned long)cma_xprt);
 
 	cma_xprt->sc_ord = svcrdma_ord;
 
@@ -939,6 +927,11 @@ static struct svc_xprt *svc_rdma_accept(struct svc_xprt *xprt)
 		dprintk("svcrdma: error creating PD for connect request\n");
 		goto errout;
 	}
+	/* both CQs on one vector: the tasklet reaps them together */
+	if (newxprt->sc_cm_id->device->num_comp_vectors > 1)
+		cq_attr.comp_vector =
+			(unsigned int)atomic_inc_return(&svc_rdma_comp_vector) %
+			newxprt->sc_cm_id->device->num_comp_vectors;
 	cq_attr.cqe = newxprt->sc_sq_depth;
 	newxprt->sc_sq_cq = ib_create_cq(newxprt->sc_cm_id->device,
 					 sq_comp_handler,
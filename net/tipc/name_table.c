@@ -35,6 +35,8 @@
  */
 
 #include <net/sock.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
 #include "core.h"
 #include "netlink.h"
 #include "name_table.h"
@@ -60,10 +62,16 @@ tipc_nl_name_table_policy[TIPC_NLA_NAME_TABLE_MAX + 1] = {
  * @node_list_size: number of entries in "node_list"
  * @cluster_list_size: number of entries in "cluster_list"
  * @zone_list_size: number of entries in "zone_list"
+ * @rr: per-cpu round-robin cursor used by tipc_nametbl_translate()
+ * @rcu: RCU callback head used for deferred freeing
  *
  * Note: The zone list always contains at least one entry, since all
  *       publications of the associated name sequence belong to it.
  *       (The cluster and node lists may be empty.)
+ *       The lists are RCU protected, so that name translation can walk
+ *       them without taking the name sequence lock; each cpu then picks
+ *       the next publication from its own cursor instead of rotating the
+ *       shared lists.
  */
 struct name_info {
 	struct list_head node_list;
@@ -72,6 +80,8 @@ struct name_info {
 	u32 node_list_size;
 	u32 cluster_list_size;
 	u32 zone_list_size;
+	u32 __percpu *rr;
+	struct rcu_head rcu;
 };
 
 /**
@@ -86,6 +96,16 @@ struct sub_seq {
 	struct name_info *info;
 };
 
+/**
+ * struct sub_seq_array - RCU freeable container of a sub-sequence array
+ * @rcu: RCU callback head used for deferred freeing
+ * @sseqs: the sub-sequences
+ */
+struct sub_seq_array {
+	struct rcu_head rcu;
+	struct sub_seq sseqs[0];
+};
+
 /**
  * struct name_seq - container for all published instances of a name type
  * @type: 32 bit 'type' value for name sequence
@@ -96,6 +116,7 @@ struct sub_seq {
  * @ns_list: links to adjacent name sequences in hash chain
  * @subscriptions: list of subscriptions for this 'type'
  * @lock: spinlock controlling access to publication lists of all sub-sequences
+ * @seqcount: lets lockless readers detect changes to the sub-sequence array
  * @rcu: RCU callback head used for deferred freeing
  */
 struct name_seq {
@@ -106,6 +127,7 @@ struct name_seq {
 	struct hlist_node ns_list;
 	struct list_head subscriptions;
 	spinlock_t lock;
+	seqcount_t seqcount;
 	struct rcu_head rcu;
 };
 
@@ -143,7 +165,46 @@ static struct publication *publ_create(u32 type, u32 lower, u32 upper,
  */
 static struct sub_seq *tipc_subseq_alloc(u32 cnt)
 {
-	return kcalloc(cnt, sizeof(struct sub_seq), GFP_ATOMIC);
+	struct sub_seq_array *arr;
+
+	arr = kzalloc(sizeof(*arr) + cnt * sizeof(struct sub_seq), GFP_ATOMIC);
+	return arr ? arr->sseqs : NULL;
+}
+
+/**
+ * tipc_subseq_free - free a sub-sequence array once lockless readers are done
+ */
+static void tipc_subseq_free(struct sub_seq *sseqs)
+{
+	kfree_rcu(container_of(sseqs, struct sub_seq_array, sseqs[0]), rcu);
+}
+
+static void tipc_nameinfo_free_rcu(struct rcu_head *head)
+{
+	struct name_info *info = container_of(head, struct name_info, rcu);
+
+	free_percpu(info->rr);
+	kfree(info);
+}
+
+/**
+ * tipc_nameinfo_create - create an empty publication info structure
+ */
+static struct name_info *tipc_nameinfo_create(void)
+{
+	struct name_info *info = kzalloc(sizeof(*info), GFP_ATOMIC);
+
+	if (!info)
+		return NULL;
+	info->rr = alloc_percpu_gfp(u32, GFP_ATOMIC);
+	if (!info->rr) {
+		kfree(info);
+		return NULL;
+	}
+	INIT_LIST_HEAD(&info->node_list);
+	INIT_LIST_HEAD(&info->cluster_list);
+	INIT_LIST_HEAD(&info->zone_list);
+	return info;
 }
 
 /**
@@ -159,11 +220,13 @@ static struct name_seq *tipc_nameseq_create(u32 type, struct hlist_head *seq_hea
 	if (!nseq || !sseq) {
 		pr_warn("Name sequence creation failed, no memory\n");
 		kfree(nseq);
-		kfree(sseq);
+		if (sseq)
+			kfree(container_of(sseq, struct sub_seq_array, sseqs[0]));
 		return NULL;
 	}
 
 	spin_lock_init(&nseq->lock);
+	seqcount_init(&nseq->seqcount);
 	nseq->type = type;
 	nseq->sseqs = sseq;
 	nseq->alloc = 1;
@@ -198,6 +261,43 @@ static struct sub_seq *nameseq_find_subseq(struct name_seq *nseq,
 	return NULL;
 }
 
+/**
+ * nameseq_find_info_rcu - find publication info (if any) of a name instance
+ *
+ * Lockless variant of nameseq_find_subseq(), to be called under
+ * rcu_read_lock(); the returned info stays valid until rcu_read_unlock().
+ */
+static struct name_info *nameseq_find_info_rcu(struct name_seq *nseq,
+					       u32 instance)
+{
+	struct name_info *info;
+	struct sub_seq *sseqs;
+	unsigned int start;
+	int low, high, mid;
+
+	do {
+		start = read_seqcount_begin(&nseq->seqcount);
+		info = NULL;
+		low = 0;
+		high = READ_ONCE(nseq->first_free) - 1;
+		/* Pairs with smp_wmb() in tipc_nameseq_insert_publ() */
+		smp_rmb();
+		sseqs = READ_ONCE(nseq->sseqs);
+		while (low <= high) {
+			mid = (low + high) / 2;
+			if (instance < sseqs[mid].lower) {
+				high = mid - 1;
+			} else if (instance > sseqs[mid].upper) {
+				low = mid + 1;
+			} else {
+				info = READ_ONCE(sseqs[mid].info);
+				break;
+			}
+		}
+	} while (read_seqcount_retry(&nseq->seqcount, start));
+	return info;
+}
+
 /**
  * nameseq_locate_subseq - determine position of name instance in sub-sequence
  *
@@ -271,6 +371,13 @@ static struct publication *tipc_nameseq_insert_publ(struct net *net,
 			return NULL;
 		}
 
+		info = tipc_nameinfo_create();
+		if (!info) {
+			pr_warn("Cannot publish {%u,%u,%u}, no memory\n",
+				type, lower, upper);
+			return NULL;
+		}
+
 		/* Ensure there is space for new sub-sequence */
 		if (nseq->first_free == nseq->alloc) {
 			struct sub_seq *sseqs = tipc_subseq_alloc(nseq->alloc * 2);
@@ -278,35 +385,31 @@ static struct publication *tipc_nameseq_insert_publ(struct net *net,
 			if (!sseqs) {
 				pr_warn("Cannot publish {%u,%u,%u}, no memory\n",
 					type, lower, upper);
+				tipc_nameinfo_free_rcu(&info->rcu);
 				return NULL;
 			}
 			memcpy(sseqs, nseq->sseqs,
 			       nseq->alloc * sizeof(struct sub_seq));
-			kfree(nseq->sseqs);
-			nseq->sseqs = sseqs;
+			tipc_subseq_free(nseq->sseqs);
+			/* Lockless readers may pick the new array up at once */
+			smp_wmb();
+			WRITE_ONCE(nseq->sseqs, sseqs);
 			nseq->alloc *= 2;
 		}
 
-		info = kzalloc(sizeof(*info), GFP_ATOMIC);
-		if (!info) {
-			pr_warn("Cannot publish {%u,%u,%u}, no memory\n",
-				type, lower, upper);
-			return NULL;
-		}
-
-		INIT_LIST_HEAD(&info->node_list);
-		INIT_LIST_HEAD(&info->cluster_list);
-		INIT_LIST_HEAD(&info->zone_list);
-
 		/* Insert new sub-sequence */
+		write_seqcount_begin(&nseq->seqcount);
 		sseq = &nseq->sseqs[inspos];
 		freesseq = &nseq->sseqs[nseq->first_free];
 		memmove(sseq + 1, sseq, (freesseq - sseq) * sizeof(*sseq));
 		memset(sseq, 0, sizeof(*sseq));
+		/* A reader seeing the new size must see the new array too */
+		smp_wmb();
 		nseq->first_free++;
 		sseq->lower = lower;
 		sseq->upper = upper;
 		sseq->info = info;
+		write_seqcount_end(&nseq->seqcount);
 		created_subseq = 1;
 	}
 
@@ -315,16 +418,16 @@ static struct publication *tipc_nameseq_insert_publ(struct net *net,
 	if (!publ)
 		return NULL;
 
-	list_add(&publ->zone_list, &info->zone_list);
+	list_add_rcu(&publ->zone_list, &info->zone_list);
 	info->zone_list_size++;
 
 	if (in_own_cluster(net, node)) {
-		list_add(&publ->cluster_list, &info->cluster_list);
+		list_add_rcu(&publ->cluster_list, &info->cluster_list);
 		info->cluster_list_size++;
 	}
 
 	if (in_own_node(net, node)) {
-		list_add(&publ->node_list, &info->node_list);
+		list_add_rcu(&publ->node_list, &info->node_list);
 		info->node_list_size++;
 	}
 
@@ -375,26 +478,28 @@ static struct publication *tipc_nameseq_remove_publ(struct net *net,
 
 found:
 	/* Remove publication from zone scope list */
-	list_del(&publ->zone_list);
+	list_del_rcu(&publ->zone_list);
 	info->zone_list_size--;
 
 	/* Remove publication from cluster scope list, if present */
 	if (in_own_cluster(net, node)) {
-		list_del(&publ->cluster_list);
+		list_del_rcu(&publ->cluster_list);
 		info->cluster_list_size--;
 	}
 
 	/* Remove publication from node scope list, if present */
 	if (in_own_node(net, node)) {
-		list_del(&publ->node_list);
+		list_del_rcu(&publ->node_list);
 		info->node_list_size--;
 	}
 
 	/* Contract subseq list if no more publications for that subseq */
 	if (list_empty(&info->zone_list)) {
-		kfree(info);
+		call_rcu(&info->rcu, tipc_nameinfo_free_rcu);
+		write_seqcount_begin(&nseq->seqcount);
 		free = &nseq->sseqs[nseq->first_free--];
 		memmove(sseq, sseq + 1, (free - (sseq + 1)) * sizeof(*sseq));
+		write_seqcount_end(&nseq->seqcount);
 		removed_subseq = 1;
 	}
 
@@ -499,7 +604,7 @@ struct publication *tipc_nametbl_remove_publ(struct net *net, u32 type,
 	publ = tipc_nameseq_remove_publ(net, seq, lower, node, ref, key);
 	if (!seq->first_free && list_empty(&seq->subscriptions)) {
 		hlist_del_init_rcu(&seq->ns_list);
-		kfree(seq->sseqs);
+		tipc_subseq_free(seq->sseqs);
 		spin_unlock_bh(&seq->lock);
 		kfree_rcu(seq, rcu);
 		return publ;
@@ -508,6 +613,44 @@ struct publication *tipc_nametbl_remove_publ(struct net *net, u32 type,
 	return publ;
 }
 
+/**
+ * nameinfo_rr_next - advance this cpu's round-robin cursor over a list
+ * @info: publication info the list belongs to
+ * @head: node, cluster or zone list of @info
+ * @size: number of entries in @head
+ *
+ * Called under rcu_read_lock(). The list may change under us, so @size
+ * is a hint only; returns NULL if the list is empty.
+ */
+static struct list_head *nameinfo_rr_next(struct name_info *info,
+					  struct list_head *head, u32 size)
+{
+	struct list_head *pos;
+	u32 n;
+
+	if (!size)
+		return NULL;
+	n = this_cpu_inc_return(*info->rr) % size;
+	for (pos = rcu_dereference(list_next_rcu(head)); pos != head;
+	     pos = rcu_dereference(list_next_rcu(pos))) {
+		if (!n--)
+			return pos;
+	}
+
+	/* The list shrank since we sampled its size */
+	pos = rcu_dereference(list_next_rcu(head));
+	return pos != head ? pos : NULL;
+}
+
+#define nameinfo_rr_pick(info, member)					\
+({									\
+	struct list_head *__pos;					\
+									\
+	__pos = nameinfo_rr_next(info, &(info)->member,			\
+				 READ_ONCE((info)->member##_size));	\
+	__pos ? list_entry(__pos, struct publication, member) : NULL;	\
+})
+
 /**
  * tipc_nametbl_translate - perform name translation
  *
@@ -525,7 +668,6 @@ u32 tipc_nametbl_translate(struct net *net, u32 type, u32 instance,
 			   u32 *destnode)
 {
 	struct tipc_net *tn = net_generic(net, tipc_net_id);
-	struct sub_seq *sseq;
 	struct name_info *info;
 	struct publication *publ;
 	struct name_seq *seq;
@@ -539,58 +681,32 @@ u32 tipc_nametbl_translate(struct net *net, u32 type, u32 instance,
 	seq = nametbl_find_seq(net, type);
 	if (unlikely(!seq))
 		goto not_found;
-	spin_lock_bh(&seq->lock);
-	sseq = nameseq_find_subseq(seq, instance);
-	if (unlikely(!sseq))
-		goto no_match;
-	info = sseq->info;
+	info = nameseq_find_info_rcu(seq, instance);
+	if (unlikely(!info))
+		goto not_found;
 
 	/* Closest-First Algorithm */
 	if (likely(!*destnode)) {
-		if (!list_empty(&info->node_list)) {
-			publ = list_first_entry(&info->node_list,
-						struct publication,
-						node_list);
-			list_move_tail(&publ->node_list,
-				       &info->node_list);
-		} else if (!list_empty(&info->cluster_list)) {
-			publ = list_first_entry(&info->cluster_list,
-						struct publication,
-						cluster_list);
-			list_move_tail(&publ->cluster_list,
-				       &info->cluster_list);
-		} else {
-			publ = list_first_entry(&info->zone_list,
-						struct publication,
-						zone_list);
-			list_move_tail(&publ->zone_list,
-				       &info->zone_list);
-		}
+		publ = nameinfo_rr_pick(info, node_list);
+		if (!publ)
+			publ = nameinfo_rr_pick(info, cluster_list);
+		if (!publ)
+			publ = nameinfo_rr_pick(info, zone_list);
 	}
 
 	/* Round-Robin Algorithm */
 	else if (*destnode == tn->own_addr) {
-		if (list_empty(&info->node_list))
-			goto no_match;
-		publ = list_first_entry(&info->node_list, struct publication,
-					node_list);
-		list_move_tail(&publ->node_list, &info->node_list);
+		publ = nameinfo_rr_pick(info, node_list);
 	} else if (in_own_cluster_exact(net, *destnode)) {
-		if (list_empty(&info->cluster_list))
-			goto no_match;
-		publ = list_first_entry(&info->cluster_list, struct publication,
-					cluster_list);
-		list_move_tail(&publ->cluster_list, &info->cluster_list);
+		publ = nameinfo_rr_pick(info, cluster_list);
 	} else {
-		publ = list_first_entry(&info->zone_list, struct publication,
-					zone_list);
-		list_move_tail(&publ->zone_list, &info->zone_list);
+		publ = nameinfo_rr_pick(info, zone_list);
 	}
 
+	if (unlikely(!publ))
+		goto not_found;
 	ref = publ->ref;
 	node = publ->node;
-no_match:
-	spin_unlock_bh(&seq->lock);
 not_found:
 	rcu_read_unlock();
 	*destnode = node;
@@ -755,7 +871,7 @@ void tipc_nametbl_unsubscribe(struct tipc_subscription *s)
 		list_del_init(&s->nameseq_list);
 		if (!seq->first_free && list_empty(&seq->subscriptions)) {
 			hlist_del_init_rcu(&seq->ns_list);
-			kfree(seq->sseqs);
+			tipc_subseq_free(seq->sseqs);
 			spin_unlock_bh(&seq->lock);
 			kfree_rcu(seq, rcu);
 		} else {
@@ -806,7 +922,7 @@ static void tipc_purge_publications(struct net *net, struct name_seq *seq)
 		kfree_rcu(publ, rcu);
 	}
 	hlist_del_init_rcu(&seq->ns_list);
-	kfree(seq->sseqs);
+	tipc_subseq_free(seq->sseqs);
 	spin_unlock_bh(&seq->lock);
 
 	kfree_rcu(seq, rcu);
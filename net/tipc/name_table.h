@@ -130,4 +130,24 @@ static inline void tipc_plist_init(struct tipc_plist *pl)
 void tipc_plist_push(struct tipc_plist *pl, u32 port);
 u32 tipc_plist_pop(struct tipc_plist *pl);
 
+/* tipc_plist_next - walk a port list without consuming it
+ * @pl: the list, which is also its own first entry
+ * @pos: current entry, or NULL to start the walk
+ * Returns next entry, or NULL when done
+ */
+static inline struct tipc_plist *tipc_plist_next(struct tipc_plist *pl,
+						 struct tipc_plist *pos)
+{
+	if (!pos)
+		return pl->port ? pl : NULL;
+	pos = list_next_entry(pos, list);
+	return pos != pl ? pos : NULL;
+}
+
+static inline void tipc_plist_purge(struct tipc_plist *pl)
+{
+	while (tipc_plist_pop(pl))
+		;
+}
+
 #endif
@@ -727,9 +727,9 @@ void tipc_sk_mcast_rcv(struct net *net, struct sk_buff_head *arrvq,
 		       struct sk_buff_head *inputq)
 {
 	struct tipc_msg *msg;
-	struct tipc_plist dports;
-	u32 portid;
-	u32 scope = TIPC_CLUSTER_SCOPE;
+	struct tipc_plist dports, *dport;
+	u32 type = 0, lower = 0, upper = 0;
+	u32 scope, last_scope = 0;
 	struct sk_buff_head tmpq;
 	uint hsz;
 	struct sk_buff *skb, *_skb;
@@ -742,18 +742,29 @@ void tipc_sk_mcast_rcv(struct net *net, struct sk_buff_head *arrvq,
 		msg = buf_msg(skb);
 		hsz = skb_headroom(skb) + msg_hdr_sz(msg);
 
+		scope = TIPC_CLUSTER_SCOPE;
 		if (in_own_node(net, msg_orignode(msg)))
 			scope = TIPC_NODE_SCOPE;
 
-		/* Create destination port list and message clones: */
-		tipc_nametbl_mc_translate(net,
-					  msg_nametype(msg), msg_namelower(msg),
-					  msg_nameupper(msg), scope, &dports);
-		portid = tipc_plist_pop(&dports);
-		for (; portid; portid = tipc_plist_pop(&dports)) {
+		/* A burst to the same name sequence is translated only once */
+		if (!last_scope || scope != last_scope ||
+		    msg_nametype(msg) != type || msg_namelower(msg) != lower ||
+		    msg_nameupper(msg) != upper) {
+			tipc_plist_purge(&dports);
+			type = msg_nametype(msg);
+			lower = msg_namelower(msg);
+			upper = msg_nameupper(msg);
+			last_scope = scope;
+			tipc_nametbl_mc_translate(net, type, lower, upper,
+						  scope, &dports);
+		}
+
+		/* Create message clones for the destination port list: */
+		dport = tipc_plist_next(&dports, NULL);
+		for (; dport; dport = tipc_plist_next(&dports, dport)) {
 			_skb = __pskb_copy(skb, hsz, GFP_ATOMIC);
 			if (_skb) {
-				msg_set_destport(buf_msg(_skb), portid);
+				msg_set_destport(buf_msg(_skb), dport->port);
 				__skb_queue_tail(&tmpq, _skb);
 				continue;
 			}
@@ -769,6 +780,7 @@ void tipc_sk_mcast_rcv(struct net *net, struct sk_buff_head *arrvq,
 		__skb_queue_purge(&tmpq);
 		kfree_skb(skb);
 	}
+	tipc_plist_purge(&dports);
 	tipc_sk_rcv(net, inputq);
 }
 
@@ -255,15 +255,23 @@ static void inc_inflight_move_tail(struct unix_sock *u)
 
 static bool gc_in_progress;
 #define UNIX_INFLIGHT_TRIGGER_GC 16000
+/* More fds than this in flight and a user pays for the collection */
+#define UNIX_INFLIGHT_SANE_USER (SCM_MAX_FD * 8)
 
 void wait_for_unix_gc(void)
 {
-	/* If number of inflight sockets is insane,
-	 * force a garbage collect right now.
+	/* Senders that don't keep piles of fds in flight can't be the
+	 * reason for a collection, so they don't wait for one.  Those
+	 * that do run it themselves if the total gets out of hand, and
+	 * wait for whoever runs it otherwise.
 	 */
-	if (unix_tot_inflight > UNIX_INFLIGHT_TRIGGER_GC && !gc_in_progress)
+	if (READ_ONCE(current_user()->unix_inflight) <= UNIX_INFLIGHT_SANE_USER)
+		return;
+
+	if (READ_ONCE(unix_tot_inflight) > UNIX_INFLIGHT_TRIGGER_GC &&
+	    !READ_ONCE(gc_in_progress))
 		unix_gc();
-	wait_event(unix_gc_wait, gc_in_progress == false);
+	wait_event(unix_gc_wait, !READ_ONCE(gc_in_progress));
 }
 
 /* The external entry point: unix_gc() */
@@ -157,7 +157,8 @@ static int load_maps(struct bpf_map_def *maps, int len)
 		map_fd[i] = bpf_create_map(maps[i].type,
 					   maps[i].key_size,
 					   maps[i].value_size,
-					   maps[i].max_entries);
+					   maps[i].max_entries,
+					   maps[i].map_flags);
 		if (map_fd[i] < 0)
 			return 1;
 
@@ -324,6 +325,66 @@ int load_bpf_file(char *path)
 	return 0;
 }
 
+#define MAX_SYMS 300000
+static struct ksym syms[MAX_SYMS];
+static int sym_cnt;
+
+static int ksym_cmp(const void *p1, const void *p2)
+{
+	long a1 = ((struct ksym *)p1)->addr, a2 = ((struct ksym *)p2)->addr;
+
+	return a1 < a2 ? -1 : a1 > a2;
+}
+
+int load_kallsyms(void)
+{
+	FILE *f = fopen("/proc/kallsyms", "r");
+	char func[256], buf[256];
+	char symbol;
+	void *addr;
+	int i = 0;
+
+	if (!f)
+		return -ENOENT;
+
+	while (i < MAX_SYMS && fgets(buf, sizeof(buf), f)) {
+		if (sscanf(buf, "%p %c %255s", &addr, &symbol, func) != 3)
+			break;
+		if (!addr)
+			continue;
+		syms[i].addr = (long) addr;
+		syms[i].name = strdup(func);
+		i++;
+	}
+	fclose(f);
+	sym_cnt = i;
+	qsort(syms, sym_cnt, sizeof(struct ksym), ksym_cmp);
+	return 0;
+}
+
+struct ksym *ksym_search(long key)
+{
+	int start = 0, end = sym_cnt;
+
+	while (start < end) {
+		int mid = start + (end - start) / 2;
+
+		if (key < syms[mid].addr)
+			end = mid;
+		else if (key > syms[mid].addr)
+			start = mid + 1;
+		else
+			return &syms[mid];
+	}
+
+	/* syms[start - 1] is the last symbol below key */
+	if (start >= 1)
+		return &syms[start - 1];
+
+	/* out of range. return _stext */
+	return &syms[0];
+}
+
 void read_trace_pipe(void)
 {
 	int trace_fd;
@@ -24,4 +24,14 @@ int load_bpf_file(char *path);
 
 void read_trace_pipe(void);
 
+struct ksym {
+	long addr;
+	char *name;
+};
+
+/* reads /proc/kallsyms, returns zero on success */
+int load_kallsyms(void);
+/* the symbol containing @key, or the first one if there is none */
+struct ksym *ksym_search(long key);
+
 #endif
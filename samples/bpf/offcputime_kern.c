@@ -0,0 +1,166 @@
+/* offcputime: off-cpu time by stack and wakeup latency, summed in kernel
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <uapi/linux/bpf.h>
+#include <uapi/linux/ptrace.h>
+#include <uapi/linux/perf_event.h>
+#include <linux/version.h>
+#include <linux/sched.h>
+#include "bpf_helpers.h"
+
+#define _(P) ({typeof(P) val; bpf_probe_read(&val, sizeof(val), &P); val;})
+
+#define MINBLOCK_US	1
+#define MAX_SLOTS	32
+
+struct key_t {
+	char comm[TASK_COMM_LEN];
+	u32 kernstack;
+	u32 userstack;
+};
+
+/* total off-cpu time in usecs, by task name and stacks */
+struct bpf_map_def SEC("maps") counts = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(struct key_t),
+	.value_size = sizeof(u64),
+	.max_entries = 10000,
+};
+
+/* when a pid was last scheduled out */
+struct bpf_map_def SEC("maps") start = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = 10000,
+};
+
+struct bpf_map_def SEC("maps") stackmap = {
+	.type = BPF_MAP_TYPE_STACK_TRACE,
+	.key_size = sizeof(u32),
+	.value_size = PERF_MAX_STACK_DEPTH * sizeof(u64),
+	.max_entries = 10000,
+};
+
+/* when a sleeping pid was last woken up */
+struct bpf_map_def SEC("maps") wakeup = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = 10000,
+};
+
+/* log2 histogram of wakeup to run latency in usecs */
+struct bpf_map_def SEC("maps") lat_hist = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = MAX_SLOTS,
+};
+
+#define STACKID_FLAGS (0 | BPF_F_FAST_STACK_CMP)
+
+static unsigned int log2(unsigned int v)
+{
+	unsigned int r;
+	unsigned int shift;
+
+	r = (v > 0xFFFF) << 4; v >>= r;
+	shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	r |= (v >> 1);
+
+	return r;
+}
+
+static unsigned int log2l(unsigned long v)
+{
+	unsigned int hi = v >> 32;
+
+	if (hi)
+		return log2(hi) + 32;
+	else
+		return log2(v);
+}
+
+SEC("kprobe/try_to_wake_up")
+int waker(struct pt_regs *ctx)
+{
+	struct task_struct *p = (void *) PT_REGS_PARM1(ctx);
+	u64 ts = bpf_ktime_get_ns();
+	u32 pid = _(p->pid);
+
+	bpf_map_update_elem(&wakeup, &pid, &ts, BPF_ANY);
+	return 0;
+}
+
+static void account_wakeup(u32 pid, u64 now)
+{
+	u64 *tsp, *val;
+	u32 slot;
+
+	tsp = bpf_map_lookup_elem(&wakeup, &pid);
+	if (!tsp)
+		return;
+
+	slot = log2l((now - *tsp) / 1000);
+	bpf_map_delete_elem(&wakeup, &pid);
+	if (slot >= MAX_SLOTS)
+		slot = MAX_SLOTS - 1;
+
+	val = bpf_map_lookup_elem(&lat_hist, &slot);
+	if (val)
+		__sync_fetch_and_add(val, 1);
+}
+
+SEC("kprobe/finish_task_switch")
+int oncpu(struct pt_regs *ctx)
+{
+	struct task_struct *p = (void *) PT_REGS_PARM1(ctx);
+	struct key_t key = {};
+	u64 delta, ts, *tsp, *val, zero = 0;
+	u32 pid;
+
+	/* record when the previous task went off cpu */
+	pid = _(p->pid);
+	ts = bpf_ktime_get_ns();
+	bpf_map_update_elem(&start, &pid, &ts, BPF_ANY);
+	/* a wakeup it got while still running is not a latency */
+	bpf_map_delete_elem(&wakeup, &pid);
+
+	/* and account the time the current task has just spent off it */
+	pid = bpf_get_current_pid_tgid();
+	account_wakeup(pid, ts);
+
+	tsp = bpf_map_lookup_elem(&start, &pid);
+	if (!tsp)
+		/* missed start */
+		return 0;
+
+	delta = (ts - *tsp) / 1000;
+	bpf_map_delete_elem(&start, &pid);
+	if (delta < MINBLOCK_US)
+		return 0;
+
+	bpf_get_current_comm(&key.comm, sizeof(key.comm));
+	key.kernstack = bpf_get_stackid(ctx, &stackmap, STACKID_FLAGS);
+	key.userstack = bpf_get_stackid(ctx, &stackmap,
+					STACKID_FLAGS | BPF_F_USER_STACK);
+
+	val = bpf_map_lookup_elem(&counts, &key);
+	if (!val) {
+		bpf_map_update_elem(&counts, &key, &zero, BPF_NOEXIST);
+		val = bpf_map_lookup_elem(&counts, &key);
+		if (!val)
+			return 0;
+	}
+	__sync_fetch_and_add(val, delta);
+	return 0;
+}
+
+char _license[] SEC("license") = "GPL";
+u32 _version SEC("version") = LINUX_VERSION_CODE;
@@ -0,0 +1,313 @@
+/*
+ * block-aio: Stress the block I/O submission path with direct I/O.
+ *
+ * Every thread keeps a number of O_DIRECT reads of random blocks in
+ * flight through the native aio interface, or issues them one by one
+ * with pread() when asked for synchronous I/O. Pointed at a null_blk
+ * device (the default) no time is spent in any real hardware, so the
+ * resulting IOPS are a measure of the kernel's submission and
+ * completion paths.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+static const char *filename = "/dev/nullb0";
+static unsigned int nthreads = 1;
+static unsigned int nsecs    = 10;
+static unsigned int bs       = 4096;
+static unsigned int depth    = 32;
+static bool sync_io = false, done = false, silent = false;
+
+static struct timeval start, end, runtime;
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static struct stats throughput_stats;
+static pthread_cond_t thread_parent, thread_worker;
+static int fd;
+static unsigned long long nr_blocks;
+static unsigned long total_ops;
+
+struct worker {
+	int tid;
+	pthread_t thread;
+	unsigned int seed;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_STRING( 'f', "file",    &filename, "path", "Specify the block device or file to read from"),
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_UINTEGER('b', "bs",      &bs,       "Specify block size (in bytes)"),
+	OPT_UINTEGER('d', "depth",   &depth,    "Specify amount of I/Os in flight per thread"),
+	OPT_BOOLEAN( 'S', "sync",    &sync_io,  "Use synchronous pread() instead of aio"),
+	OPT_BOOLEAN( 's', "silent",  &silent,   "Silent mode: do not display data/details"),
+	OPT_END()
+};
+
+static const char * const bench_block_aio_usage[] = {
+	"perf bench block aio <options>",
+	NULL
+};
+
+/* glibc does not wrap the native aio system calls */
+static inline int io_setup(unsigned nr, aio_context_t *ctxp)
+{
+	return syscall(SYS_io_setup, nr, ctxp);
+}
+
+static inline int io_destroy(aio_context_t ctx)
+{
+	return syscall(SYS_io_destroy, ctx);
+}
+
+static inline int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+	return syscall(SYS_io_submit, ctx, nr, iocbpp);
+}
+
+static inline int io_getevents(aio_context_t ctx, long min_nr, long max_nr,
+			       struct io_event *events, struct timespec *timeout)
+{
+	return syscall(SYS_io_getevents, ctx, min_nr, max_nr, events, timeout);
+}
+
+static inline off_t random_offset(struct worker *w)
+{
+	return (off_t)(rand_r(&w->seed) % nr_blocks) * bs;
+}
+
+static void *alloc_buf(void)
+{
+	void *buf;
+
+	/* O_DIRECT wants buffers aligned to the logical block size */
+	if (posix_memalign(&buf, page_size, bs))
+		err(EXIT_FAILURE, "posix_memalign");
+	return buf;
+}
+
+static void worker_sync(struct worker *w)
+{
+	void *buf = alloc_buf();
+
+	do {
+		if (pread(fd, buf, bs, random_offset(w)) != bs)
+			err(EXIT_FAILURE, "pread");
+		w->ops++;
+	}  while (!done);
+
+	free(buf);
+}
+
+static void worker_aio(struct worker *w)
+{
+	struct timespec timeout = { .tv_sec = 0, .tv_nsec = 100000000 };
+	aio_context_t ctx = 0;
+	struct io_event *events;
+	struct iocb *iocbs, **iocbpp;
+	unsigned int i;
+	int ret;
+
+	if (io_setup(depth, &ctx))
+		err(EXIT_FAILURE, "io_setup");
+
+	iocbs = calloc(depth, sizeof(*iocbs));
+	iocbpp = calloc(depth, sizeof(*iocbpp));
+	events = calloc(depth, sizeof(*events));
+	if (!iocbs || !iocbpp || !events)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < depth; i++) {
+		iocbs[i].aio_fildes = fd;
+		iocbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+		iocbs[i].aio_buf = (unsigned long)alloc_buf();
+		iocbs[i].aio_nbytes = bs;
+		iocbs[i].aio_offset = random_offset(w);
+		iocbs[i].aio_data = (unsigned long)&iocbs[i];
+		iocbpp[i] = &iocbs[i];
+	}
+
+	if (io_submit(ctx, depth, iocbpp) != (int)depth)
+		err(EXIT_FAILURE, "io_submit");
+
+	do {
+		ret = io_getevents(ctx, 1, depth, events, &timeout);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "io_getevents");
+		}
+
+		/* resubmit whatever completed, at new offsets */
+		for (i = 0; i < (unsigned int)ret; i++) {
+			struct iocb *iocb = (void *)(unsigned long)events[i].data;
+
+			if (events[i].res != bs)
+				errx(EXIT_FAILURE, "aio read failed: %lld",
+				     (long long)events[i].res);
+
+			iocb->aio_offset = random_offset(w);
+			iocbpp[i] = iocb;
+		}
+		w->ops += ret;
+
+		if (ret && io_submit(ctx, ret, iocbpp) != ret)
+			err(EXIT_FAILURE, "io_submit");
+	}  while (!done);
+
+	/* waits for whatever is still in flight */
+	io_destroy(ctx);
+
+	for (i = 0; i < depth; i++)
+		free((void *)(unsigned long)iocbs[i].aio_buf);
+	free(events);
+	free(iocbpp);
+	free(iocbs);
+}
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = (struct worker *) arg;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	if (sync_io)
+		worker_sync(w);
+	else
+		worker_aio(w);
+
+	return NULL;
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime);
+}
+
+static void print_summary(void)
+{
+	unsigned long avg = avg_stats(&throughput_stats);
+	double stddev = stddev_stats(&throughput_stats);
+
+	printf("%sAveraged %ld IOPS per thread (+- %.2f%%), %ld IOPS in total, total secs = %d\n",
+	       !silent ? "\n" : "", avg, rel_stddev_stats(stddev, avg),
+	       total_ops, (int) runtime.tv_sec);
+}
+
+int bench_block_aio(int argc, const char **argv,
+		    const char *prefix __maybe_unused)
+{
+	int ret = 0;
+	struct sigaction act;
+	unsigned int i;
+	off_t size;
+	struct worker *worker = NULL;
+
+	argc = parse_options(argc, argv, options, bench_block_aio_usage, 0);
+	if (argc || !nthreads || !depth || !bs || bs % 512) {
+		usage_with_options(bench_block_aio_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(filename, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+		err(EXIT_FAILURE, "open %s", filename);
+
+	/* works for block devices and regular files alike */
+	size = lseek(fd, 0, SEEK_END);
+	if (size < 0)
+		err(EXIT_FAILURE, "lseek");
+	nr_blocks = size / bs;
+	if (!nr_blocks)
+		errx(EXIT_FAILURE, "%s is smaller than one block", filename);
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	printf("Run summary [PID %d]: %d threads reading %d bytes blocks of %s, %s, for %d secs.\n\n",
+	       getpid(), nthreads, bs, filename,
+	       sync_io ? "synchronously" : "with aio", nsecs);
+	if (!sync_io)
+		printf("%d I/Os in flight per thread.\n\n", depth);
+
+	init_stats(&throughput_stats);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		worker[i].tid = i;
+		worker[i].seed = getpid() + i;
+		ret = pthread_create(&worker[i].thread, NULL, workerfn,
+				     (void *)(struct worker *) &worker[i]);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(worker[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		unsigned long t = worker[i].ops/runtime.tv_sec;
+
+		update_stats(&throughput_stats, t);
+		total_ops += t;
+		if (!silent)
+			printf("[thread %2d] %ld IOPS\n", worker[i].tid, t);
+	}
+
+	print_summary();
+
+	close(fd);
+	free(worker);
+	return ret;
+}
@@ -0,0 +1,247 @@
+/*
+ * epoll-wait: Stress many threads waiting on a single epoll instance.
+ *
+ * A writer thread keeps signalling a set of eventfds which are all
+ * registered with one epoll file descriptor, while the worker threads
+ * block in epoll_wait() on it and consume whatever becomes ready. This
+ * hammers the epoll ready list and wait queue, and shows how wakeups
+ * scale with the number of waiters.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+static unsigned int nthreads = 0;
+static unsigned int nsecs    = 8;
+static unsigned int nfds     = 64;
+static bool edge = false, done = false, silent = false;
+
+static struct timeval start, end, runtime;
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static struct stats throughput_stats;
+static pthread_cond_t thread_parent, thread_worker;
+static int epollfd;
+static int *fds;
+
+struct worker {
+	int tid;
+	pthread_t thread;
+	unsigned long ops;
+	unsigned long spurious;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of waiting threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_UINTEGER('f', "nfds",    &nfds,     "Specify amount of file descriptors to monitor"),
+	OPT_BOOLEAN( 'E', "edge",    &edge,     "Use edge-triggered instead of level-triggered events"),
+	OPT_BOOLEAN( 's', "silent",  &silent,   "Silent mode: do not display data/details"),
+	OPT_END()
+};
+
+static const char * const bench_epoll_wait_usage[] = {
+	"perf bench epoll wait <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = (struct worker *) arg;
+	struct epoll_event ev;
+	u64 val;
+	int ret;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		/* time out now and then so that we notice being done */
+		ret = epoll_wait(epollfd, &ev, 1, 100);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "epoll_wait");
+		}
+		if (!ret)
+			continue;
+
+		/* somebody else woken for the same event may have won */
+		if (read(ev.data.fd, &val, sizeof(val)) == sizeof(val))
+			w->ops++;
+		else
+			w->spurious++;
+	}  while (!done);
+
+	return NULL;
+}
+
+static void *writerfn(void *arg __maybe_unused)
+{
+	u64 val = 1;
+	unsigned int i;
+	ssize_t __maybe_unused ret;
+
+	do {
+		for (i = 0; i < nfds; i++)
+			ret = write(fds[i], &val, sizeof(val));
+	}  while (!done);
+
+	return NULL;
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime);
+}
+
+static void print_summary(void)
+{
+	unsigned long avg = avg_stats(&throughput_stats);
+	double stddev = stddev_stats(&throughput_stats);
+
+	printf("%sAveraged %ld operations/sec (+- %.2f%%), total secs = %d\n",
+	       !silent ? "\n" : "", avg, rel_stddev_stats(stddev, avg),
+	       (int) runtime.tv_sec);
+}
+
+static void setup_fds(void)
+{
+	struct epoll_event ev;
+	unsigned int i;
+
+	epollfd = epoll_create1(0);
+	if (epollfd < 0)
+		err(EXIT_FAILURE, "epoll_create1");
+
+	fds = calloc(nfds, sizeof(*fds));
+	if (!fds)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < nfds; i++) {
+		fds[i] = eventfd(0, EFD_NONBLOCK);
+		if (fds[i] < 0)
+			err(EXIT_FAILURE, "eventfd");
+
+		ev.events = EPOLLIN;
+		if (edge)
+			ev.events |= EPOLLET;
+		ev.data.fd = fds[i];
+		if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fds[i], &ev))
+			err(EXIT_FAILURE, "epoll_ctl");
+	}
+}
+
+int bench_epoll_wait(int argc, const char **argv,
+		     const char *prefix __maybe_unused)
+{
+	int ret = 0;
+	struct sigaction act;
+	unsigned int i;
+	pthread_t writer;
+	struct worker *worker = NULL;
+
+	argc = parse_options(argc, argv, options, bench_epoll_wait_usage, 0);
+	if (argc || !nfds) {
+		usage_with_options(bench_epoll_wait_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	if (!nthreads) /* default to the number of CPUs */
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	setup_fds();
+
+	printf("Run summary [PID %d]: %d threads waiting on %d %s-triggered fds for %d secs.\n\n",
+	       getpid(), nthreads, nfds, edge ? "edge" : "level", nsecs);
+
+	init_stats(&throughput_stats);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		worker[i].tid = i;
+		ret = pthread_create(&worker[i].thread, NULL, workerfn,
+				     (void *)(struct worker *) &worker[i]);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	ret = pthread_create(&writer, NULL, writerfn, NULL);
+	if (ret)
+		err(EXIT_FAILURE, "pthread_create");
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	ret = pthread_join(writer, NULL);
+	if (ret)
+		err(EXIT_FAILURE, "pthread_join");
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(worker[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		unsigned long t = worker[i].ops/runtime.tv_sec;
+
+		update_stats(&throughput_stats, t);
+		if (!silent)
+			printf("[thread %2d] %ld ops/sec, %ld spurious wakeups\n",
+			       worker[i].tid, t, worker[i].spurious);
+	}
+
+	print_summary();
+
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+	close(epollfd);
+	free(fds);
+	free(worker);
+	return ret;
+}
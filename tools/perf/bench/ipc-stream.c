@@ -0,0 +1,208 @@
+/*
+ * ipc-stream.c
+ *
+ * pipe: Benchmark for streaming data through a pipe()
+ * unix: Benchmark for streaming data through a unix domain socketpair()
+ *
+ * Unlike sched/pipe, which bounces a single word back and forth to measure
+ * wakeup latency, these push a stream of large buffers one way and measure
+ * how much data the kernel moves per second.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include <pthread.h>
+
+#define LOOPS_DEFAULT 100000
+static	int			loops = LOOPS_DEFAULT;
+static	unsigned int		size = 64 * 1024;
+
+/* Use processes by default: */
+static bool			threaded;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop",	&loops,		"Specify number of buffers to send"),
+	OPT_UINTEGER('s', "size",	&size,		"Specify size of each buffer (in bytes)"),
+	OPT_BOOLEAN('T', "threaded",	&threaded,	"Specify threads/process based task setup"),
+	OPT_END()
+};
+
+static const char * const bench_ipc_pipe_usage[] = {
+	"perf bench ipc pipe <options>",
+	NULL
+};
+
+static const char * const bench_ipc_unix_usage[] = {
+	"perf bench ipc unix <options>",
+	NULL
+};
+
+struct stream {
+	int			fd;
+	char			*buf;
+	pthread_t		pthread;
+};
+
+static void *reader_thread(void *__stream)
+{
+	struct stream *s = __stream;
+	unsigned long long left = (unsigned long long)loops * size;
+	ssize_t ret;
+
+	while (left) {
+		ret = read(s->fd, s->buf, min(left, (unsigned long long)size));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		BUG_ON(ret <= 0);
+		left -= ret;
+	}
+
+	return NULL;
+}
+
+static void *writer_thread(void *__stream)
+{
+	struct stream *s = __stream;
+	unsigned int done;
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		for (done = 0; done < size; done += ret) {
+			ret = write(s->fd, s->buf + done, size - done);
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			BUG_ON(ret <= 0);
+		}
+	}
+
+	return NULL;
+}
+
+static int bench_ipc_stream(const char *what, int fds[2])
+{
+	struct stream reader, writer;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec = 0;
+	double mib;
+	int __maybe_unused ret, wait_stat;
+	pid_t pid, retpid __maybe_unused;
+
+	reader.fd = fds[0];
+	writer.fd = fds[1];
+	reader.buf = zalloc(size);
+	writer.buf = zalloc(size);
+	BUG_ON(!reader.buf || !writer.buf);
+
+	gettimeofday(&start, NULL);
+
+	if (threaded) {
+		ret = pthread_create(&reader.pthread, NULL, reader_thread, &reader);
+		BUG_ON(ret);
+		ret = pthread_create(&writer.pthread, NULL, writer_thread, &writer);
+		BUG_ON(ret);
+
+		ret = pthread_join(reader.pthread, NULL);
+		BUG_ON(ret);
+		ret = pthread_join(writer.pthread, NULL);
+		BUG_ON(ret);
+	} else {
+		pid = fork();
+		assert(pid >= 0);
+
+		if (!pid) {
+			writer_thread(&writer);
+			exit(0);
+		} else {
+			reader_thread(&reader);
+		}
+
+		retpid = waitpid(pid, &wait_stat, 0);
+		assert((retpid == pid) && WIFEXITED(wait_stat));
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	free(reader.buf);
+	free(writer.buf);
+	close(fds[0]);
+	close(fds[1]);
+
+	result_usec = diff.tv_sec * 1000000;
+	result_usec += diff.tv_usec;
+	mib = (double)loops * size / (1024 * 1024);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Streamed %d buffers of %u bytes through a %s between two %s\n\n",
+		       loops, size, what, threaded ? "threads" : "processes");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf MB/sec\n",
+		       mib / ((double)result_usec / (double)1000000));
+		printf(" %14lf usecs/buffer\n",
+		       (double)result_usec / (double)loops);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lf\n", mib / ((double)result_usec / (double)1000000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
+
+int bench_ipc_pipe(int argc, const char **argv, const char *prefix __maybe_unused)
+{
+	int fds[2];
+
+	argc = parse_options(argc, argv, options, bench_ipc_pipe_usage, 0);
+	if (loops <= 0 || !size) {
+		usage_with_options(bench_ipc_pipe_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	BUG_ON(pipe(fds));
+
+	return bench_ipc_stream("pipe", fds);
+}
+
+int bench_ipc_unix(int argc, const char **argv, const char *prefix __maybe_unused)
+{
+	int fds[2];
+
+	argc = parse_options(argc, argv, options, bench_ipc_unix_usage, 0);
+	if (loops <= 0 || !size) {
+		usage_with_options(bench_ipc_unix_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	BUG_ON(socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+	return bench_ipc_stream("unix socket", fds);
+}
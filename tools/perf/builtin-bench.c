@@ -13,6 +13,10 @@
  *  mem   ... memory access performance
  *  numa  ... NUMA scheduling and MM performance
  *  futex ... Futex performance
+ *  epoll ... epoll performance
+ *  ipc   ... Pipe and socket throughput
+ *  block ... Block I/O submission performance
+ *  syscall ... System call overhead
  */
 #include "perf.h"
 #include "util/util.h"
@@ -51,6 +55,7 @@ static struct bench sched_benchmarks[] = {
 static struct bench mem_benchmarks[] = {
 	{ "memcpy",	"Benchmark for memcpy() functions",		bench_mem_memcpy	},
 	{ "memset",	"Benchmark for memset() functions",		bench_mem_memset	},
+	{ "page-fault",	"Benchmark for anonymous page faults",		bench_mem_page_fault	},
 	{ "all",	"Run all memory access benchmarks",		NULL			},
 	{ NULL,		NULL,						NULL			}
 };
@@ -66,6 +71,31 @@ static struct bench futex_benchmarks[] = {
 	{ NULL,		NULL,						NULL			}
 };
 
+static struct bench epoll_benchmarks[] = {
+	{ "wait",	"Benchmark for many threads in epoll_wait()",	bench_epoll_wait	},
+	{ "all",	"Run all epoll benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
+static struct bench ipc_benchmarks[] = {
+	{ "pipe",	"Benchmark for pipe() throughput",		bench_ipc_pipe		},
+	{ "unix",	"Benchmark for unix socket throughput",		bench_ipc_unix		},
+	{ "all",	"Run all IPC throughput benchmarks",		NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
+static struct bench block_benchmarks[] = {
+	{ "aio",	"Benchmark for direct I/O submission",		bench_block_aio		},
+	{ "all",	"Run all block I/O benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
+static struct bench syscall_benchmarks[] = {
+	{ "basic",	"Benchmark for basic system call overhead",	bench_syscall_basic	},
+	{ "all",	"Run all syscall benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
 struct collection {
 	const char	*name;
 	const char	*summary;
@@ -79,6 +109,10 @@ static struct collection collections[] = {
 	{ "numa",	"NUMA scheduling and MM benchmarks",		numa_benchmarks		},
 #endif
 	{"futex",       "Futex stressing benchmarks",                   futex_benchmarks        },
+	{ "epoll",	"epoll stressing benchmarks",			epoll_benchmarks	},
+	{ "ipc",	"Pipe and socket throughput benchmarks",	ipc_benchmarks		},
+	{ "block",	"Block I/O submission benchmarks",		block_benchmarks	},
+	{ "syscall",	"System call benchmarks",			syscall_benchmarks	},
 	{ "all",	"All benchmarks",				NULL			},
 	{ NULL,		NULL,						NULL			}
 };
@@ -65,6 +65,8 @@ struct lock_stat {
 	u64			wait_time_max;
 
 	int			discard; /* flag of blacklist */
+
+	unsigned int		flags;	/* LCB_F_*, for contention stats */
 };
 
 /*
@@ -106,11 +108,35 @@ struct lock_seq_stat {
 	int                     read_count;
 };
 
+/*
+ * Flags of lock:contention_begin, imported from
+ * include/trace/events/lock.h.
+ */
+#define LCB_F_SPIN	(1U << 0)
+#define LCB_F_READ	(1U << 1)
+#define LCB_F_WRITE	(1U << 2)
+#define LCB_F_MUTEX	(1U << 3)
+
+/*
+ * Contention waits can nest, e.g. on the wait_lock spinlock of a
+ * rw_semaphore the task is already waiting for.
+ */
+#define MAX_CONTENTION_DEPTH 8
+
+struct contention_seq {
+	u64			addr;
+	u64			ip;
+	unsigned int		flags;
+};
+
 struct thread_stat {
 	struct rb_node		rb;
 
 	u32                     tid;
 	struct list_head        seq_list;
+
+	int			nr_contention;
+	struct contention_seq	contention[MAX_CONTENTION_DEPTH];
 };
 
 static struct rb_root		thread_stats;
@@ -354,6 +380,12 @@ struct trace_lock_handler {
 
 	int (*release_event)(struct perf_evsel *evsel,
 			     struct perf_sample *sample);
+
+	int (*contention_begin_event)(struct perf_evsel *evsel,
+				      struct perf_sample *sample);
+
+	int (*contention_end_event)(struct perf_evsel *evsel,
+				    struct perf_sample *sample);
 };
 
 static struct lock_seq_stat *get_seq(struct thread_stat *ts, void *addr)
@@ -641,6 +673,100 @@ end:
 	return 0;
 }
 
+static int report_contention_begin_event(struct perf_evsel *evsel,
+					 struct perf_sample *sample)
+{
+	struct thread_stat *ts;
+	struct contention_seq *seq;
+
+	ts = thread_stat_findnew(sample->tid);
+	if (!ts)
+		return -ENOMEM;
+
+	if (ts->nr_contention == MAX_CONTENTION_DEPTH) {
+		bad_hist[BROKEN_CONTENDED]++;
+		return 0;
+	}
+
+	seq = &ts->contention[ts->nr_contention++];
+	seq->addr = perf_evsel__intval(evsel, sample, "lock_addr");
+	seq->ip = perf_evsel__intval(evsel, sample, "ip");
+	seq->flags = perf_evsel__intval(evsel, sample, "flags");
+	return 0;
+}
+
+/* the caller of a contended lock, by symbol if we can */
+static const char *contention_caller(u64 ip, char *buf, size_t size)
+{
+	struct machine *machine = &session->machines.host;
+	struct symbol *sym;
+	struct map *map;
+
+	sym = machine__find_kernel_function(machine, ip, &map, NULL);
+	if (sym)
+		snprintf(buf, size, "%s+%#" PRIx64, sym->name,
+			 map->map_ip(map, ip) - sym->start);
+	else
+		snprintf(buf, size, "%#" PRIx64, ip);
+	return buf;
+}
+
+static int report_contention_end_event(struct perf_evsel *evsel,
+				       struct perf_sample *sample)
+{
+	u64 addr = perf_evsel__intval(evsel, sample, "lock_addr");
+	u64 wait = perf_evsel__intval(evsel, sample, "wait_ns");
+	struct contention_seq *seq = NULL;
+	struct thread_stat *ts;
+	struct lock_stat *ls;
+	char name[128];
+	void *key;
+	int i;
+
+	ts = thread_stat_find(sample->tid);
+	if (ts) {
+		for (i = ts->nr_contention - 1; i >= 0; i--) {
+			if (ts->contention[i].addr == addr) {
+				seq = &ts->contention[i];
+				break;
+			}
+		}
+	}
+
+	/* the begin was lost, or before the start of the recording */
+	if (!seq) {
+		bad_hist[BROKEN_ACQUIRED]++;
+		return 0;
+	}
+
+	/* the stats are per caller */
+	key = (void *)(unsigned long)seq->ip;
+	ls = NULL;
+	list_for_each_entry(ls, lockhashentry(key), hash_entry) {
+		if (ls->addr == key)
+			break;
+	}
+	if (&ls->hash_entry == lockhashentry(key)) {
+		ls = lock_stat_findnew(key, contention_caller(seq->ip, name,
+							      sizeof(name)));
+		if (!ls)
+			return -ENOMEM;
+		ls->flags = seq->flags;
+	}
+
+	ls->nr_contended++;
+	ls->wait_time_total += wait;
+	if (ls->wait_time_max < wait)
+		ls->wait_time_max = wait;
+	if (ls->wait_time_min > wait)
+		ls->wait_time_min = wait;
+	ls->avg_wait_time = ls->wait_time_total / ls->nr_contended;
+
+	/* pop it, and whatever was left above it */
+	ts->nr_contention = seq - ts->contention;
+	return 0;
+}
+
 /* lock oriented handlers */
 /* TODO: handlers for CPU oriented, thread oriented */
 static struct trace_lock_handler report_lock_ops  = {
@@ -650,6 +776,12 @@ static struct trace_lock_handler report_lock_ops  = {
 	.release_event		= report_lock_release_event,
 };
 
+/* caller oriented handlers, on the lockdep-less contention tracepoints */
+static struct trace_lock_handler contention_lock_ops  = {
+	.contention_begin_event	= report_contention_begin_event,
+	.contention_end_event	= report_contention_end_event,
+};
+
 static struct trace_lock_handler *trace_handler;
 
 static int perf_evsel__process_lock_acquire(struct perf_evsel *evsel,
@@ -684,6 +816,22 @@ static int perf_evsel__process_lock_release(struct perf_evsel *evsel,
 	return 0;
 }
 
+static int perf_evsel__process_contention_begin(struct perf_evsel *evsel,
+					       struct perf_sample *sample)
+{
+	if (trace_handler->contention_begin_event)
+		return trace_handler->contention_begin_event(evsel, sample);
+	return 0;
+}
+
+static int perf_evsel__process_contention_end(struct perf_evsel *evsel,
+					     struct perf_sample *sample)
+{
+	if (trace_handler->contention_end_event)
+		return trace_handler->contention_end_event(evsel, sample);
+	return 0;
+}
+
 static void print_bad_events(int bad, int total)
 {
 	/* Output for debug, this have to be removed */
@@ -753,6 +901,47 @@ static void print_result(void)
 	print_bad_events(bad, total);
 }
 
+static const char *contention_type(unsigned int flags)
+{
+	if (flags & LCB_F_MUTEX)
+		return "mutex";
+	if (flags & LCB_F_SPIN)
+		return "spinlock";
+	if (flags & LCB_F_READ)
+		return "rwsem:R";
+	if (flags & LCB_F_WRITE)
+		return "rwsem:W";
+	return "unknown";
+}
+
+static void print_contention_result(void)
+{
+	struct lock_stat *st;
+
+	pr_info("%10s ", "contended");
+	pr_info("%15s ", "total wait (ns)");
+	pr_info("%15s ", "max wait (ns)");
+	pr_info("%15s ", "avg wait (ns)");
+	pr_info("%10s ", "type");
+	pr_info("%s", "caller");
+
+	pr_info("\n\n");
+
+	while ((st = pop_from_result())) {
+		pr_info("%10u ", st->nr_contended);
+		pr_info("%15" PRIu64 " ", st->wait_time_total);
+		pr_info("%15" PRIu64 " ", st->wait_time_max);
+		pr_info("%15" PRIu64 " ", st->avg_wait_time);
+		pr_info("%10s ", contention_type(st->flags));
+		pr_info("%s", st->name);
+		pr_info("\n");
+	}
+
+	if (bad_hist[BROKEN_ACQUIRED] || bad_hist[BROKEN_CONTENDED])
+		pr_info("\n%d unmatched contention_end, %d too deeply nested contention_begin events\n",
+			bad_hist[BROKEN_ACQUIRED], bad_hist[BROKEN_CONTENDED]);
+}
+
 static bool info_threads, info_map;
 
 static void dump_threads(void)
@@ -850,6 +1039,12 @@ static const struct perf_evsel_str_handler lock_tracepoints[] = {
 	{ "lock:lock_release",	 perf_evsel__process_lock_release,   }, /* CONFIG_LOCKDEP */
 };
 
+/* the contention tracepoints don't need lockdep */
+static const struct perf_evsel_str_handler contention_tracepoints[] = {
+	{ "lock:contention_begin", perf_evsel__process_contention_begin, },
+	{ "lock:contention_end",   perf_evsel__process_contention_end,   },
+};
+
 static bool force;
 
 static int __cmd_report(bool display_info)
@@ -877,7 +1072,8 @@ static int __cmd_report(bool display_info)
 	if (!perf_session__has_traces(session, "lock record"))
 		goto out_delete;
 
-	if (perf_session__set_tracepoints_handlers(session, lock_tracepoints)) {
+	if (perf_session__set_tracepoints_handlers(session, lock_tracepoints) ||
+	    perf_session__set_tracepoints_handlers(session, contention_tracepoints)) {
 		pr_err("Initializing perf session tracepoint handlers failed\n");
 		goto out_delete;
 	}
@@ -892,7 +1088,10 @@ static int __cmd_report(bool display_info)
 	setup_pager();
 	if (display_info) /* used for info subcommand */
 		err = dump_info();
-	else {
+	else if (trace_handler == &contention_lock_ops) {
+		sort_result();
+		print_contention_result();
+	} else {
 		sort_result();
 		print_result();
 	}
@@ -907,21 +1106,32 @@ static int __cmd_record(int argc, const char **argv)
 	const char *record_args[] = {
 		"record", "-R", "-m", "1024", "-c", "1",
 	};
+	const struct perf_evsel_str_handler *tracepoints = lock_tracepoints;
+	unsigned int nr_tracepoints = ARRAY_SIZE(lock_tracepoints);
 	unsigned int rec_argc, i, j, ret;
 	const char **rec_argv;
 
+	/* without lockdep, record the contention tracepoints only */
 	for (i = 0; i < ARRAY_SIZE(lock_tracepoints); i++) {
 		if (!is_valid_tracepoint(lock_tracepoints[i].name)) {
+			tracepoints = contention_tracepoints;
+			nr_tracepoints = ARRAY_SIZE(contention_tracepoints);
+			break;
+		}
+	}
+
+	for (i = 0; i < nr_tracepoints; i++) {
+		if (!is_valid_tracepoint(tracepoints[i].name)) {
 				pr_err("tracepoint %s is not enabled. "
 				       "Are CONFIG_LOCKDEP and CONFIG_LOCK_STAT enabled?\n",
-				       lock_tracepoints[i].name);
+				       tracepoints[i].name);
 				return 1;
 		}
 	}
 
 	rec_argc = ARRAY_SIZE(record_args) + argc - 1;
 	/* factor of 2 is for -e in front of each tracepoint */
-	rec_argc += 2 * ARRAY_SIZE(lock_tracepoints);
+	rec_argc += 2 * nr_tracepoints;
 
 	rec_argv = calloc(rec_argc + 1, sizeof(char *));
 	if (!rec_argv)
@@ -930,9 +1140,9 @@ static int __cmd_record(int argc, const char **argv)
 	for (i = 0; i < ARRAY_SIZE(record_args); i++)
 		rec_argv[i] = strdup(record_args[i]);
 
-	for (j = 0; j < ARRAY_SIZE(lock_tracepoints); j++) {
+	for (j = 0; j < nr_tracepoints; j++) {
 		rec_argv[i++] = "-e";
-		rec_argv[i++] = strdup(lock_tracepoints[j].name);
+		rec_argv[i++] = strdup(tracepoints[j].name);
 	}
 
 	for (j = 1; j < (unsigned int)argc; j++, i++)
@@ -968,12 +1178,22 @@ int cmd_lock(int argc, const char **argv, const char *prefix __maybe_unused)
 	/* TODO: type */
 	OPT_END()
 	};
+	const struct option contention_options[] = {
+	OPT_STRING('k', "key", &sort_key, "wait_total",
+		    "key for sorting (contended / avg_wait / wait_total / wait_max / wait_min)"),
+	OPT_BOOLEAN('f', "force", &force, "don't complain, do it"),
+	OPT_END()
+	};
 	const char * const info_usage[] = {
 		"perf lock info [<options>]",
 		NULL
 	};
+	const char * const contention_usage[] = {
+		"perf lock contention [<options>]",
+		NULL
+	};
 	const char *const lock_subcommands[] = { "record", "report", "script",
-						 "info", NULL };
+						 "info", "contention", NULL };
 	const char *lock_usage[] = {
 		NULL,
 		NULL
@@ -1017,6 +1237,17 @@ int cmd_lock(int argc, const char **argv, const char *prefix __maybe_unused)
 		/* recycling report_lock_ops */
 		trace_handler = &report_lock_ops;
 		rc = __cmd_report(true);
+	} else if (!strncmp(argv[0], "contention", 4)) {
+		sort_key = "wait_total";
+		if (argc) {
+			argc = parse_options(argc, argv, contention_options,
+					     contention_usage, 0);
+			if (argc)
+				usage_with_options(contention_usage,
+						   contention_options);
+		}
+		trace_handler = &contention_lock_ops;
+		rc = __cmd_report(false);
 	} else {
 		usage_with_options(lock_usage, lock_options);
 	}
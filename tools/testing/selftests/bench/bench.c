@@ -0,0 +1,429 @@
+/*
+ * Benchmarks of kernel hot paths
+ *
+ * Runs the in-kernel benchmarks of the test_bench module, if it is
+ * loaded, and benchmarks of system call paths from userspace.  Every
+ * measured operation is reported on a line of its own:
+ *
+ *	<benchmark>.<operation> iterations=<n> ns_total=<ns> ns_per_op=<ns>
+ *
+ * Lines starting with '#' describe the kernel and the machine.  Saved
+ * results of two kernels can be compared with "bench -c old new", which
+ * fails if an operation became slower by more than a threshold.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KBENCH_DIR	"/sys/kernel/debug/bench"
+#define NULLB_DEV	"/dev/nullb0"
+#define FILE_SIZE	(16 << 20)
+#define IO_SIZE		4096
+#define MAX_RESULTS	256
+
+/* iterations are divided by this in quick mode */
+static unsigned long quick_div = 1;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *name, unsigned long iters,
+		   unsigned long long ns)
+{
+	printf("%s iterations=%lu ns_total=%llu ns_per_op=%llu\n",
+	       name, iters, ns, ns / iters);
+	fflush(stdout);
+}
+
+static void skip(const char *name, const char *why)
+{
+	printf("# %s: skipped, %s\n", name, why);
+}
+
+static long futex(int *uaddr, int op, int val)
+{
+	return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static int futex_word;
+
+static void *futex_pong(void *arg)
+{
+	unsigned long i, iters = (unsigned long)arg;
+
+	for (i = 0; i < iters; i++) {
+		while (__atomic_load_n(&futex_word, __ATOMIC_ACQUIRE) == 0)
+			futex(&futex_word, FUTEX_WAIT_PRIVATE, 0);
+		__atomic_store_n(&futex_word, 0, __ATOMIC_RELEASE);
+		futex(&futex_word, FUTEX_WAKE_PRIVATE, 1);
+	}
+	return NULL;
+}
+
+static int bench_futex(void)
+{
+	unsigned long i, iters = 1000000 / quick_div;
+	unsigned long long start;
+	pthread_t thread;
+	int word = 0;
+
+	/* the syscall overhead, without anybody to wake */
+	start = now_ns();
+	for (i = 0; i < iters; i++)
+		futex(&word, FUTEX_WAKE_PRIVATE, 1);
+	report("futex.wake_nowaiter", iters, now_ns() - start);
+
+	/* a wait and wake round trip between two threads */
+	iters = 100000 / quick_div;
+	futex_word = 0;
+	if (pthread_create(&thread, NULL, futex_pong, (void *)iters)) {
+		perror("pthread_create");
+		return -1;
+	}
+	start = now_ns();
+	for (i = 0; i < iters; i++) {
+		__atomic_store_n(&futex_word, 1, __ATOMIC_RELEASE);
+		futex(&futex_word, FUTEX_WAKE_PRIVATE, 1);
+		while (__atomic_load_n(&futex_word, __ATOMIC_ACQUIRE) == 1)
+			futex(&futex_word, FUTEX_WAIT_PRIVATE, 1);
+	}
+	report("futex.pingpong", iters, now_ns() - start);
+	pthread_join(thread, NULL);
+	return 0;
+}
+
+static int bench_epoll(void)
+{
+	unsigned long i, iters = 1000000 / quick_div;
+	struct epoll_event ev = { .events = EPOLLIN };
+	unsigned long long start;
+	int efd, epfd, ret = -1;
+
+	/* a level triggered eventfd which stays readable */
+	efd = eventfd(1, 0);
+	if (efd < 0) {
+		perror("eventfd");
+		return -1;
+	}
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		goto out_efd;
+	}
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev)) {
+		perror("epoll_ctl");
+		goto out;
+	}
+
+	start = now_ns();
+	for (i = 0; i < iters; i++) {
+		if (epoll_wait(epfd, &ev, 1, 0) != 1) {
+			fprintf(stderr, "epoll_wait: eventfd not ready\n");
+			goto out;
+		}
+	}
+	report("epoll.wait_ready", iters, now_ns() - start);
+	ret = 0;
+out:
+	close(epfd);
+out_efd:
+	close(efd);
+	return ret;
+}
+
+static int bench_pagecache(void)
+{
+	unsigned long i, iters = 1000000 / quick_div;
+	char path[] = "bench.XXXXXX";
+	static char buf[IO_SIZE];
+	unsigned long long start;
+	off_t off;
+	int fd, ret = -1;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return -1;
+	}
+	unlink(path);
+
+	/* writing it leaves the whole file in the page cache */
+	memset(buf, 0x5a, sizeof(buf));
+	for (off = 0; off < FILE_SIZE; off += IO_SIZE) {
+		if (pwrite(fd, buf, IO_SIZE, off) != IO_SIZE) {
+			perror("pwrite");
+			goto out;
+		}
+	}
+
+	start = now_ns();
+	for (i = 0, off = 0; i < iters; i++) {
+		if (pread(fd, buf, IO_SIZE, off) != IO_SIZE) {
+			perror("pread");
+			goto out;
+		}
+		off += IO_SIZE;
+		if (off == FILE_SIZE)
+			off = 0;
+	}
+	report("pagecache.pread_4k", iters, now_ns() - start);
+	ret = 0;
+out:
+	close(fd);
+	return ret;
+}
+
+static int bench_nullb(void)
+{
+	unsigned long i, iters = 200000 / quick_div;
+	unsigned long long start;
+	void *buf;
+	off_t off;
+	int fd, ret = -1;
+
+	/* O_DIRECT reads go through blk-mq submission and completion */
+	fd = open(NULLB_DEV, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		skip("nullb", NULLB_DEV " not available");
+		return 0;
+	}
+	if (posix_memalign(&buf, IO_SIZE, IO_SIZE)) {
+		fprintf(stderr, "posix_memalign failed\n");
+		goto out;
+	}
+
+	start = now_ns();
+	for (i = 0, off = 0; i < iters; i++) {
+		if (pread(fd, buf, IO_SIZE, off) != IO_SIZE) {
+			perror("pread " NULLB_DEV);
+			goto out_free;
+		}
+		off += IO_SIZE;
+		if (off == FILE_SIZE)
+			off = 0;
+	}
+	report("nullb.pread_4k_direct", iters, now_ns() - start);
+	ret = 0;
+out_free:
+	free(buf);
+out:
+	close(fd);
+	return ret;
+}
+
+/* runs one benchmark of the test_bench module */
+static int kbench_run(const char *name, unsigned long iters)
+{
+	char cmd[64], result[1024];
+	ssize_t len;
+	int fd, n;
+
+	fd = open(KBENCH_DIR "/run", O_RDWR);
+	if (fd < 0) {
+		perror("open " KBENCH_DIR "/run");
+		return -1;
+	}
+
+	n = snprintf(cmd, sizeof(cmd), "%s %lu", name, iters);
+	if (write(fd, cmd, n) != n) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	len = pread(fd, result, sizeof(result) - 1, 0);
+	close(fd);
+	if (len <= 0) {
+		fprintf(stderr, "%s: no results\n", name);
+		return -1;
+	}
+	result[len] = '\0';
+	fputs(result, stdout);
+	fflush(stdout);
+	return 0;
+}
+
+static int bench_kernel(void)
+{
+	static const struct {
+		const char *name;
+		unsigned long iters;
+	} kbenches[] = {
+		{ "page_alloc",	1UL << 20 },
+		{ "slab",	1UL << 20 },
+		{ "rhashtable",	1UL << 18 },
+		{ "rcu",	1UL << 18 },
+	};
+	int i, ret = 0;
+
+	if (access(KBENCH_DIR "/run", F_OK)) {
+		skip("kernel", "test_bench module not loaded");
+		return 0;
+	}
+
+	for (i = 0; i < sizeof(kbenches) / sizeof(kbenches[0]); i++)
+		if (kbench_run(kbenches[i].name,
+			       kbenches[i].iters / quick_div))
+			ret = -1;
+	return ret;
+}
+
+static void print_header(void)
+{
+	struct utsname u;
+
+	if (!uname(&u))
+		printf("# kernel: %s %s %s\n", u.release, u.version, u.machine);
+	printf("# cpus: %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+	if (quick_div > 1)
+		printf("# quick: iterations divided by %lu\n", quick_div);
+}
+
+struct result {
+	char name[64];
+	double ns_per_op;
+};
+
+static int load_results(const char *path, struct result *res)
+{
+	unsigned long long ns_total;
+	unsigned long iters;
+	char line[256];
+	FILE *f;
+	int n = 0;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (n < MAX_RESULTS && fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%63s iterations=%lu ns_total=%llu",
+			   res[n].name, &iters, &ns_total) != 3 || !iters)
+			continue;
+		res[n].ns_per_op = (double)ns_total / iters;
+		n++;
+	}
+
+	fclose(f);
+	return n;
+}
+
+/* compares the results of two runs, fails on regressions */
+static int compare(const char *old_path, const char *new_path,
+		   double threshold)
+{
+	static struct result old[MAX_RESULTS], new[MAX_RESULTS];
+	int nr_old, nr_new, i, j, regressions = 0;
+
+	nr_old = load_results(old_path, old);
+	nr_new = load_results(new_path, new);
+	if (nr_old < 0 || nr_new < 0)
+		return 2;
+
+	printf("%-32s %12s %12s %9s\n", "# operation", "old ns/op",
+	       "new ns/op", "change");
+	for (i = 0; i < nr_new; i++) {
+		double delta;
+
+		for (j = 0; j < nr_old; j++)
+			if (!strcmp(new[i].name, old[j].name))
+				break;
+		if (j == nr_old) {
+			printf("%-32s %12s %12.1f %9s\n", new[i].name, "-",
+			       new[i].ns_per_op, "new");
+			continue;
+		}
+
+		delta = (new[i].ns_per_op - old[j].ns_per_op) * 100 /
+			old[j].ns_per_op;
+		printf("%-32s %12.1f %12.1f %+8.1f%%%s\n", new[i].name,
+		       old[j].ns_per_op, new[i].ns_per_op, delta,
+		       delta > threshold ? " REGRESSION" : "");
+		if (delta > threshold)
+			regressions++;
+	}
+
+	return regressions ? 1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-q]\n"
+		"       %s -c OLD NEW [-t PERCENT]\n"
+		"  -q          quick run, with fewer iterations\n"
+		"  -c OLD NEW  compare two saved runs\n"
+		"  -t PERCENT  slowdown reported as a regression (default 5)\n",
+		prog, prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *old_path = NULL;
+	double threshold = 5;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "qc:t:")) != -1) {
+		switch (opt) {
+		case 'q':
+			quick_div = 16;
+			break;
+		case 'c':
+			old_path = optarg;
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (old_path) {
+		if (optind != argc - 1)
+			usage(argv[0]);
+		return compare(old_path, argv[optind], threshold);
+	}
+	if (optind != argc)
+		usage(argv[0]);
+
+	print_header();
+	if (bench_kernel())
+		ret = 1;
+	if (bench_futex())
+		ret = 1;
+	if (bench_epoll())
+		ret = 1;
+	if (bench_pagecache())
+		ret = 1;
+	if (bench_nullb())
+		ret = 1;
+
+	return ret;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Runs the kernel hot path benchmarks.
+#
+# The modules the benchmarks need are loaded if they can be, and unloaded
+# again afterwards if they weren't loaded before.  The results go to
+# stdout; save them and compare the runs of two kernels with
+#	./bench -c old.txt new.txt
+
+loaded=""
+
+load_module()
+{
+	mod=$1
+	shift
+	if [ ! -d /sys/module/$mod ] && modprobe -q $mod "$@" 2>/dev/null; then
+		loaded="$loaded $mod"
+	fi
+}
+
+load_module test_bench
+# queue_mode=2 is blk-mq
+load_module null_blk queue_mode=2
+
+./bench $BENCH_FLAGS
+ret=$?
+
+for mod in $loaded; do
+	modprobe -q -r $mod
+done
+
+if [ $ret -ne 0 ]; then
+	echo "bench: [FAIL]"
+	exit 1
+fi
+echo "bench: [PASS]"
+exit 0